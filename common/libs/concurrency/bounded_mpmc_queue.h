@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace cuttlefish {
+
+// Bounded multi producer, multi consumer queue. Unlike ThreadSafeQueue, Push
+// and TryPop don't take a lock: every slot of the ring carries a sequence
+// number that tells producers and consumers whose turn it is, so they only
+// contend on the two ring indices.
+//
+// Blocking consumers sleep on a condition variable, which producers only
+// touch when somebody is actually waiting.
+//
+// When full, Push either rejects the new item or, with kDropOldest, discards
+// the oldest one to make room.
+template <typename T>
+class BoundedMpmcQueue {
+ public:
+  enum class FullPolicy { kReject, kDropOldest };
+
+  // The capacity is rounded up to a power of 2.
+  explicit BoundedMpmcQueue(std::size_t capacity,
+                            FullPolicy policy = FullPolicy::kReject)
+      : mask_(RoundUpToPowerOf2(capacity) - 1),
+        policy_(policy),
+        slots_(new Slot[mask_ + 1]) {
+    for (std::size_t i = 0; i <= mask_; i++) {
+      slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  BoundedMpmcQueue(const BoundedMpmcQueue&) = delete;
+  BoundedMpmcQueue& operator=(const BoundedMpmcQueue&) = delete;
+
+  ~BoundedMpmcQueue() {
+    while (TryPop()) {
+    }
+  }
+
+  std::size_t Capacity() const { return mask_ + 1; }
+
+  // Returns false if the item was rejected because the queue was full.
+  template <typename U>
+  bool Push(U&& u) {
+    static_assert(std::is_constructible_v<T, decltype(u)>);
+    while (!TryEmplace(std::forward<U>(u))) {
+      if (policy_ == FullPolicy::kReject) {
+        return false;
+      }
+      // Make room, somebody else may take the free slot first
+      TryPop();
+    }
+    WakeConsumer();
+    return true;
+  }
+
+  std::optional<T> TryPop() {
+    std::size_t position = tail_.load(std::memory_order_relaxed);
+    while (true) {
+      Slot& slot = slots_[position & mask_];
+      std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(sequence) -
+                  static_cast<std::ptrdiff_t>(position + 1);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(position, position + 1,
+                                        std::memory_order_relaxed)) {
+          T* item = slot.Item();
+          std::optional<T> result(std::move(*item));
+          item->~T();
+          // Hand the slot to the producer one lap ahead
+          slot.sequence.store(position + mask_ + 1, std::memory_order_release);
+          return result;
+        }
+      } else if (diff < 0) {
+        return std::nullopt;  // Empty
+      } else {
+        position = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Waits until an item is available.
+  T Pop() {
+    if (auto item = TryPop()) {
+      return std::move(*item);
+    }
+    std::unique_lock<std::mutex> lock(waiters_mutex_);
+    waiters_.fetch_add(1, std::memory_order_relaxed);
+    // Pairs with the fence in WakeConsumer
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::optional<T> item;
+    while (!(item = TryPop())) {
+      has_items_.wait(lock);
+    }
+    waiters_.fetch_sub(1, std::memory_order_relaxed);
+    return std::move(*item);
+  }
+
+  // Waits until at least one item is available and returns every item in the
+  // queue at that point. Only wakes one waiting consumer.
+  std::vector<T> PopAll() {
+    std::vector<T> items;
+    items.push_back(Pop());
+    while (auto item = TryPop()) {
+      items.push_back(std::move(*item));
+    }
+    return items;
+  }
+
+  // Only a hint when other threads use the queue at the same time.
+  bool IsEmpty() const {
+    return head_.load(std::memory_order_relaxed) ==
+           tail_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // Keeps the indices and every slot on their own cache lines, so producers
+  // and consumers working on different slots don't invalidate each other's.
+  static constexpr std::size_t kCacheLineSize = 64;
+
+  struct alignas(kCacheLineSize) Slot {
+    T* Item() { return std::launder(reinterpret_cast<T*>(&storage)); }
+
+    std::atomic<std::size_t> sequence;
+    std::aligned_storage_t<sizeof(T), alignof(T)> storage;
+  };
+
+  static std::size_t RoundUpToPowerOf2(std::size_t value) {
+    std::size_t power = 1;
+    while (power < value) {
+      power <<= 1;
+    }
+    return power;
+  }
+
+  template <typename U>
+  bool TryEmplace(U&& u) {
+    std::size_t position = head_.load(std::memory_order_relaxed);
+    while (true) {
+      Slot& slot = slots_[position & mask_];
+      std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(sequence) -
+                  static_cast<std::ptrdiff_t>(position);
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(position, position + 1,
+                                        std::memory_order_relaxed)) {
+          new (&slot.storage) T(std::forward<U>(u));
+          // Hand the slot to the consumer of this lap
+          slot.sequence.store(position + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;  // Full
+      } else {
+        position = head_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void WakeConsumer() {
+    // Pairs with the fence in Pop: either the consumer sees the new item or
+    // this sees the consumer waiting.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters_.load(std::memory_order_relaxed) > 0) {
+      // Taking the lock ensures the consumer is either before its last
+      // TryPop or already waiting, so the notification can't be missed.
+      std::lock_guard<std::mutex> lock(waiters_mutex_);
+      has_items_.notify_one();
+    }
+  }
+
+  const std::size_t mask_;
+  const FullPolicy policy_;
+  std::unique_ptr<Slot[]> slots_;
+  alignas(kCacheLineSize) std::atomic<std::size_t> head_{0};
+  alignas(kCacheLineSize) std::atomic<std::size_t> tail_{0};
+  alignas(kCacheLineSize) std::atomic<std::size_t> waiters_{0};
+  std::mutex waiters_mutex_;
+  std::condition_variable has_items_;
+};
+
+}  // namespace cuttlefish
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/libs/concurrency/bounded_mpmc_queue.h"
+
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+namespace {
+
+using FullPolicy = BoundedMpmcQueue<int>::FullPolicy;
+
+constexpr auto kBlockedTime = std::chrono::milliseconds(50);
+
+std::vector<int> PopEverything(BoundedMpmcQueue<int>& queue) {
+  std::vector<int> items;
+  while (auto item = queue.TryPop()) {
+    items.push_back(*item);
+  }
+  return items;
+}
+
+// Keeps track of how many instances are alive
+class Counted {
+ public:
+  Counted() { live++; }
+  Counted(const Counted&) { live++; }
+  Counted(Counted&&) { live++; }
+  ~Counted() { live--; }
+
+  static int live;
+};
+int Counted::live = 0;
+
+TEST(BoundedMpmcQueue, RoundsTheCapacityUpToAPowerOf2) {
+  EXPECT_EQ(BoundedMpmcQueue<int>(1).Capacity(), 1u);
+  EXPECT_EQ(BoundedMpmcQueue<int>(5).Capacity(), 8u);
+  EXPECT_EQ(BoundedMpmcQueue<int>(64).Capacity(), 64u);
+}
+
+TEST(BoundedMpmcQueue, PopsInPushOrder) {
+  BoundedMpmcQueue<int> queue(8);
+  EXPECT_TRUE(queue.IsEmpty());
+  EXPECT_FALSE(queue.TryPop());
+  // Several laps around the ring
+  for (int lap = 0; lap < 3; lap++) {
+    std::vector<int> pushed;
+    for (int i = 0; i < 8; i++) {
+      ASSERT_TRUE(queue.Push(lap * 8 + i));
+      pushed.push_back(lap * 8 + i);
+    }
+    EXPECT_FALSE(queue.IsEmpty());
+    EXPECT_EQ(PopEverything(queue), pushed);
+    EXPECT_TRUE(queue.IsEmpty());
+  }
+}
+
+TEST(BoundedMpmcQueue, RejectsItemsWhenFull) {
+  BoundedMpmcQueue<int> queue(4, FullPolicy::kReject);
+  for (int i = 0; i < 4; i++) {
+    ASSERT_TRUE(queue.Push(i));
+  }
+  EXPECT_FALSE(queue.Push(4));
+  EXPECT_FALSE(queue.Push(5));
+  EXPECT_EQ(PopEverything(queue), (std::vector<int>{0, 1, 2, 3}));
+
+  // There is room again
+  EXPECT_TRUE(queue.Push(6));
+  EXPECT_EQ(PopEverything(queue), std::vector<int>{6});
+}
+
+TEST(BoundedMpmcQueue, DropsTheOldestItemsWhenFull) {
+  BoundedMpmcQueue<int> queue(4, FullPolicy::kDropOldest);
+  for (int i = 0; i < 6; i++) {
+    ASSERT_TRUE(queue.Push(i));
+  }
+  EXPECT_EQ(PopEverything(queue), (std::vector<int>{2, 3, 4, 5}));
+}
+
+TEST(BoundedMpmcQueue, DeliversEveryItemOnceToConcurrentConsumers) {
+  constexpr int kProducers = 4;
+  constexpr int kConsumers = 4;
+  constexpr int kItemsPerProducer = 20000;
+  // Small enough for producers to find it full
+  BoundedMpmcQueue<int> queue(16);
+
+  std::vector<std::vector<int>> received(kConsumers);
+  std::vector<std::thread> consumers;
+  for (int consumer = 0; consumer < kConsumers; consumer++) {
+    consumers.emplace_back([&queue, &items = received[consumer]]() {
+      for (int item = queue.Pop(); item >= 0; item = queue.Pop()) {
+        items.push_back(item);
+      }
+    });
+  }
+  std::vector<std::thread> producers;
+  for (int producer = 0; producer < kProducers; producer++) {
+    producers.emplace_back([&queue, producer]() {
+      for (int i = 0; i < kItemsPerProducer; i++) {
+        while (!queue.Push(producer * kItemsPerProducer + i)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  // One end marker per consumer
+  for (int consumer = 0; consumer < kConsumers; consumer++) {
+    while (!queue.Push(-1)) {
+      std::this_thread::yield();
+    }
+  }
+  for (auto& consumer : consumers) {
+    consumer.join();
+  }
+
+  std::vector<int> times_received(kProducers * kItemsPerProducer, 0);
+  for (const auto& items : received) {
+    std::vector<int> last(kProducers, -1);
+    for (int item : items) {
+      times_received[item]++;
+      // Each consumer sees the items of a producer in the order they were
+      // pushed
+      int producer = item / kItemsPerProducer;
+      EXPECT_GT(item, last[producer]);
+      last[producer] = item;
+    }
+  }
+  for (int item = 0; item < kProducers * kItemsPerProducer; item++) {
+    ASSERT_EQ(times_received[item], 1) << "item " << item;
+  }
+  EXPECT_TRUE(queue.IsEmpty());
+}
+
+TEST(BoundedMpmcQueue, PopWaitsForAPush) {
+  BoundedMpmcQueue<int> queue(4);
+  auto popped = std::async(std::launch::async, [&queue]() {
+    return queue.Pop();
+  });
+  EXPECT_EQ(popped.wait_for(kBlockedTime), std::future_status::timeout);
+  ASSERT_TRUE(queue.Push(42));
+  EXPECT_EQ(popped.get(), 42);
+}
+
+TEST(BoundedMpmcQueue, PopAllWaitsForAPushAndTakesEverything) {
+  BoundedMpmcQueue<int> queue(4);
+  auto popped = std::async(std::launch::async, [&queue]() {
+    return queue.PopAll();
+  });
+  EXPECT_EQ(popped.wait_for(kBlockedTime), std::future_status::timeout);
+  ASSERT_TRUE(queue.Push(1));
+  EXPECT_EQ(popped.get(), std::vector<int>{1});
+
+  for (int i = 2; i < 5; i++) {
+    ASSERT_TRUE(queue.Push(i));
+  }
+  EXPECT_EQ(queue.PopAll(), (std::vector<int>{2, 3, 4}));
+  EXPECT_TRUE(queue.IsEmpty());
+}
+
+TEST(BoundedMpmcQueue, DestroysTheItemsLeftInIt) {
+  {
+    BoundedMpmcQueue<Counted> queue(4, BoundedMpmcQueue<Counted>::FullPolicy::
+                                           kDropOldest);
+    for (int i = 0; i < 6; i++) {
+      ASSERT_TRUE(queue.Push(Counted()));
+    }
+    // The dropped items are gone already
+    EXPECT_EQ(Counted::live, 4);
+    EXPECT_TRUE(queue.TryPop());
+    EXPECT_EQ(Counted::live, 3);
+  }
+  EXPECT_EQ(Counted::live, 0);
+
+  // Too long for the small string optimization, leaks show under ASan
+  BoundedMpmcQueue<std::string> strings(4);
+  ASSERT_TRUE(strings.Push(std::string(100, 'a')));
+  ASSERT_TRUE(strings.Push(std::string(100, 'b')));
+  EXPECT_EQ(strings.TryPop(), std::string(100, 'a'));
+}
+
+}  // namespace
+}  // namespace cuttlefish
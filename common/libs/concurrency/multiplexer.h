@@ -19,6 +19,7 @@
 #include <condition_variable>
 #include <functional>
 #include <memory>
+#include <type_traits>
 #include <vector>
 
 #include "common/libs/concurrency/semaphore.h"
@@ -45,9 +46,19 @@ class Multiplexer {
     return id_to_return;
   }
 
+  // Queue::Push may return a bool telling whether the item ended up making
+  // the queue longer. It does not when the queue, being full, ignored it or
+  // used it to replace an older item, and Pop() must not expect one more item.
   void Push(const int idx, T&& t) {
     CheckIdx(idx);
-    queues_[idx]->Push(std::move(t));
+    using PushResult = decltype(queues_[idx]->Push(std::move(t)));
+    if constexpr (std::is_same_v<PushResult, bool>) {
+      if (!queues_[idx]->Push(std::move(t))) {
+        return;
+      }
+    } else {
+      queues_[idx]->Push(std::move(t));
+    }
     sem_items_.SemPost();
   }
 
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares BoundedMpmcQueue with ThreadSafeQueue moving items from a number of
+// producers to two blocking consumers.
+
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "common/libs/concurrency/bounded_mpmc_queue.h"
+#include "common/libs/concurrency/thread_safe_queue.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr std::size_t kItems = 1 << 16;
+constexpr std::size_t kConsumers = 2;
+
+// ThreadSafeQueue::Push only accepts types that can be assigned to as rvalues
+struct Item {
+  std::size_t value;
+};
+
+template <typename Queue, typename PushFn>
+void Transfer(benchmark::State& state, Queue& queue, PushFn push) {
+  auto producers = static_cast<std::size_t>(state.range(0));
+  for (auto _ : state) {
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < kConsumers; i++) {
+      threads.emplace_back([&queue]() {
+        for (std::size_t j = 0; j < kItems / kConsumers; j++) {
+          benchmark::DoNotOptimize(queue.Pop());
+        }
+      });
+    }
+    for (std::size_t i = 0; i < producers; i++) {
+      threads.emplace_back([&queue, &push, i, producers]() {
+        for (std::size_t j = i; j < kItems; j += producers) {
+          push(queue, j);
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kItems);
+}
+
+void BM_BoundedMpmcQueue(benchmark::State& state) {
+  BoundedMpmcQueue<Item> queue(1024);
+  Transfer(state, queue, [](auto& queue, std::size_t item) {
+    while (!queue.Push(Item{item})) {
+      std::this_thread::yield();
+    }
+  });
+}
+BENCHMARK(BM_BoundedMpmcQueue)->Arg(1)->Arg(4)->Arg(16)->UseRealTime();
+
+void BM_ThreadSafeQueue(benchmark::State& state) {
+  ThreadSafeQueue<Item> queue;
+  Transfer(state, queue,
+           [](auto& queue, std::size_t item) { queue.Push(Item{item}); });
+}
+BENCHMARK(BM_ThreadSafeQueue)->Arg(1)->Arg(4)->Arg(16)->UseRealTime();
+
+}  // namespace
+}  // namespace cuttlefish
+
+BENCHMARK_MAIN();
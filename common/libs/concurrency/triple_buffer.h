@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace cuttlefish {
+
+// Lock-free, single producer, single consumer mailbox that only keeps the
+// latest value written.
+//
+// Three slots rotate between the producer (back), the consumer (front) and a
+// shared middle slot whose index is swapped atomically. Neither side ever
+// waits on the other, and writing never allocates.
+template <typename T>
+class TripleBuffer {
+ public:
+  static_assert(std::is_default_constructible_v<T>,
+                "Items in TripleBuffer should be default constructible");
+
+  TripleBuffer() = default;
+  TripleBuffer(const TripleBuffer&) = delete;
+  TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+  // Producer side. Returns false when the value replaced one that the consumer
+  // never read.
+  bool Write(T&& value) {
+    slots_[back_] = std::move(value);
+    const auto prev = middle_.exchange(back_ | kFresh, std::memory_order_acq_rel);
+    back_ = prev & kIndexMask;
+    if (prev & kFresh) {
+      // Release whatever the dropped value holds right away rather than on the
+      // next write.
+      slots_[back_] = T();
+      return false;
+    }
+    return true;
+  }
+
+  // Consumer side. Only the consumer clears the fresh bit, so once observed
+  // it stays set until the exchange below.
+  std::optional<T> Read() {
+    if (!HasValue()) {
+      return std::nullopt;
+    }
+    const auto prev = middle_.exchange(front_, std::memory_order_acq_rel);
+    front_ = prev & kIndexMask;
+    return std::move(slots_[front_]);
+  }
+
+  // Whether there is a value the consumer hasn't read yet. Safe to call from
+  // either side.
+  bool HasValue() const {
+    return middle_.load(std::memory_order_acquire) & kFresh;
+  }
+
+ private:
+  static constexpr std::uint8_t kIndexMask = 0x3;
+  static constexpr std::uint8_t kFresh = 0x4;
+
+  T slots_[3];
+  // Keep the indices owned by each side away from the shared one.
+  alignas(64) std::uint8_t back_ = 0;
+  alignas(64) std::atomic<std::uint8_t> middle_{1};
+  alignas(64) std::uint8_t front_ = 2;
+};
+
+}  // namespace cuttlefish
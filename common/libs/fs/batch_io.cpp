@@ -0,0 +1,421 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/libs/fs/batch_io.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+
+#include <android-base/logging.h>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IORING_OFF_SQES
+#define CUTTLEFISH_HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef CUTTLEFISH_HAVE_IO_URING
+// The same on all architectures of interest, the host libc may be too old to
+// define them.
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#endif
+
+namespace cuttlefish {
+
+#ifdef CUTTLEFISH_HAVE_IO_URING
+
+struct BatchIo::Ring {
+  ~Ring() {
+    if (sqes) {
+      munmap(sqes, sqes_size);
+    }
+    if (cq_ptr && cq_ptr != sq_ptr) {
+      munmap(cq_ptr, cq_size);
+    }
+    if (sq_ptr) {
+      munmap(sq_ptr, sq_size);
+    }
+  }
+
+  void* sq_ptr = nullptr;
+  size_t sq_size = 0;
+  void* cq_ptr = nullptr;
+  size_t cq_size = 0;
+  struct io_uring_sqe* sqes = nullptr;
+  size_t sqes_size = 0;
+
+  unsigned* sq_tail;
+  unsigned* sq_mask;
+  unsigned* sq_array;
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned* cq_mask;
+  struct io_uring_cqe* cqes;
+};
+
+namespace {
+
+template <typename T>
+T* RingField(void* ring, uint32_t offset) {
+  return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+}
+
+void* MapRing(int ring_fd, size_t size, off_t offset) {
+  void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+  return ptr == MAP_FAILED ? nullptr : ptr;
+}
+
+}  // namespace
+
+#else
+
+struct BatchIo::Ring {};
+
+#endif
+
+BatchIo::BatchIo(size_t capacity) : capacity_(capacity) {}
+
+BatchIo::~BatchIo() {
+  // The kernel may still use the buffers of submitted operations, and so
+  // could their owners after returning from here.
+  auto drained = Submit(Pending());
+  if (!drained.ok()) {
+    LOG(ERROR) << "Failed to wait for pending I/O: " << drained.error();
+  }
+  ring_.reset();
+  if (ring_fd_ >= 0) {
+    close(ring_fd_);
+  }
+}
+
+Result<std::unique_ptr<BatchIo>> BatchIo::Create(unsigned int queue_depth) {
+  CF_EXPECT(queue_depth > 0, "The queue depth can't be 0");
+  std::unique_ptr<BatchIo> io(new BatchIo(queue_depth));
+#ifdef CUTTLEFISH_HAVE_IO_URING
+  struct io_uring_params params = {};
+  int ring_fd = syscall(__NR_io_uring_setup, queue_depth, &params);
+  if (ring_fd < 0) {
+    LOG(VERBOSE) << "io_uring is not available, using synchronous I/O: "
+                 << strerror(errno);
+    return io;
+  }
+  auto ring = std::make_unique<Ring>();
+  ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = false;
+#ifdef IORING_FEAT_SINGLE_MMAP
+  single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+#endif
+  if (single_mmap) {
+    ring->sq_size = ring->cq_size = std::max(ring->sq_size, ring->cq_size);
+  }
+  ring->sq_ptr = MapRing(ring_fd, ring->sq_size, IORING_OFF_SQ_RING);
+  ring->cq_ptr = single_mmap
+                     ? ring->sq_ptr
+                     : MapRing(ring_fd, ring->cq_size, IORING_OFF_CQ_RING);
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = static_cast<struct io_uring_sqe*>(
+      MapRing(ring_fd, ring->sqes_size, IORING_OFF_SQES));
+  if (!ring->sq_ptr || !ring->cq_ptr || !ring->sqes) {
+    LOG(WARNING) << "Failed to map the io_uring queues, using synchronous "
+                 << "I/O: " << strerror(errno);
+    ring.reset();
+    close(ring_fd);
+    return io;
+  }
+  ring->sq_tail = RingField<unsigned>(ring->sq_ptr, params.sq_off.tail);
+  ring->sq_mask = RingField<unsigned>(ring->sq_ptr, params.sq_off.ring_mask);
+  ring->sq_array = RingField<unsigned>(ring->sq_ptr, params.sq_off.array);
+  ring->cq_head = RingField<unsigned>(ring->cq_ptr, params.cq_off.head);
+  ring->cq_tail = RingField<unsigned>(ring->cq_ptr, params.cq_off.tail);
+  ring->cq_mask = RingField<unsigned>(ring->cq_ptr, params.cq_off.ring_mask);
+  ring->cqes =
+      RingField<struct io_uring_cqe>(ring->cq_ptr, params.cq_off.cqes);
+  io->ring_fd_ = ring_fd;
+  io->ring_ = std::move(ring);
+  // The completion queue is at least as large, so it can't overflow
+  io->capacity_ = params.sq_entries;
+#endif
+  return io;
+}
+
+Result<void> BatchIo::Read(SharedFD fd, void* buf, size_t length,
+                           off_t offset, uint64_t user_data) {
+  CF_EXPECT(Queue(Operation{
+      .opcode = Opcode::kRead,
+      .fd = std::move(fd),
+      .iov = {.iov_base = buf, .iov_len = length},
+      .offset = offset,
+      .user_data = user_data,
+  }));
+  return {};
+}
+
+Result<void> BatchIo::Write(SharedFD fd, const void* buf, size_t length,
+                            off_t offset, uint64_t user_data) {
+  CF_EXPECT(Queue(Operation{
+      .opcode = Opcode::kWrite,
+      .fd = std::move(fd),
+      .iov = {.iov_base = const_cast<void*>(buf), .iov_len = length},
+      .offset = offset,
+      .user_data = user_data,
+  }));
+  return {};
+}
+
+Result<void> BatchIo::Fsync(SharedFD fd, uint64_t user_data) {
+  CF_EXPECT(Queue(Operation{
+      .opcode = Opcode::kFsync,
+      .fd = std::move(fd),
+      .iov = {},
+      .offset = 0,
+      .user_data = user_data,
+  }));
+  return {};
+}
+
+Result<void> BatchIo::Queue(Operation operation) {
+  CF_EXPECT(operation.fd->IsOpen(), "Can't queue I/O on a closed file");
+  CF_EXPECT(pending_.size() < capacity_,
+            "All " << capacity_ << " slots are in use, wait for some "
+                   << "completions first");
+  auto id = next_id_++;
+  pending_.emplace(id, std::move(operation));
+  queued_.push_back(id);
+  return {};
+}
+
+Result<std::vector<BatchIoCompletion>> BatchIo::Submit(size_t wait_for) {
+  CF_EXPECT(wait_for <= pending_.size(),
+            "Can't wait for " << wait_for << " completions with "
+                              << pending_.size() << " operations pending");
+  std::vector<BatchIoCompletion> completions;
+  if (ring_) {
+    CF_EXPECT(SubmitToRing(wait_for, completions));
+  } else {
+    RunSynchronously(completions);
+  }
+  return completions;
+}
+
+#ifdef CUTTLEFISH_HAVE_IO_URING
+
+Result<void> BatchIo::SubmitToRing(
+    size_t wait_for, std::vector<BatchIoCompletion>& completions) {
+  unsigned tail = *ring_->sq_tail;
+  for (auto id : queued_) {
+    auto& operation = pending_.at(id);
+    unsigned index = tail & *ring_->sq_mask;
+    struct io_uring_sqe* sqe = &ring_->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    switch (operation.opcode) {
+      case Opcode::kRead:
+        sqe->opcode = IORING_OP_READV;
+        break;
+      case Opcode::kWrite:
+        sqe->opcode = IORING_OP_WRITEV;
+        break;
+      case Opcode::kFsync:
+        sqe->opcode = IORING_OP_FSYNC;
+        break;
+    }
+    sqe->fd = operation.fd->fd_;
+    if (operation.opcode != Opcode::kFsync) {
+      // Nodes of the map don't move, so this stays valid until it completes
+      sqe->addr = reinterpret_cast<uint64_t>(&operation.iov);
+      sqe->len = 1;
+      sqe->off = operation.offset;
+    }
+    sqe->user_data = id;
+    ring_->sq_array[index] = index;
+    tail++;
+  }
+  // Publish the entries before the kernel looks at the new tail
+  __atomic_store_n(ring_->sq_tail, tail, __ATOMIC_RELEASE);
+  size_t to_submit = queued_.size();
+  queued_.clear();
+
+  while (true) {
+    size_t waiting = wait_for > completions.size()
+                         ? wait_for - completions.size()
+                         : 0;
+    if (to_submit > 0 || waiting > 0) {
+      int submitted =
+          syscall(__NR_io_uring_enter, ring_fd_, to_submit, waiting,
+                  waiting > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+      if (submitted < 0) {
+        CF_EXPECT(errno == EINTR || errno == EAGAIN || errno == EBUSY,
+                  "io_uring_enter failed: " << strerror(errno));
+        submitted = 0;
+      }
+      to_submit -= submitted;
+    }
+
+    unsigned head = *ring_->cq_head;
+    unsigned cq_tail = __atomic_load_n(ring_->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != cq_tail; head++) {
+      const auto& cqe = ring_->cqes[head & *ring_->cq_mask];
+      auto it = pending_.find(cqe.user_data);
+      CF_EXPECT(it != pending_.end(),
+                "Unknown io_uring completion " << cqe.user_data);
+      completions.push_back(BatchIoCompletion{
+          .user_data = it->second.user_data,
+          .result = cqe.res,
+      });
+      pending_.erase(it);
+    }
+    __atomic_store_n(ring_->cq_head, head, __ATOMIC_RELEASE);
+
+    if (to_submit == 0 && completions.size() >= wait_for) {
+      return {};
+    }
+  }
+}
+
+#else
+
+Result<void> BatchIo::SubmitToRing(size_t, std::vector<BatchIoCompletion>&) {
+  return CF_ERR("Built without io_uring support");
+}
+
+#endif
+
+void BatchIo::RunSynchronously(std::vector<BatchIoCompletion>& completions) {
+  for (auto id : queued_) {
+    auto it = pending_.find(id);
+    auto& operation = it->second;
+    int fd = operation.fd->fd_;
+    ssize_t result = 0;
+    switch (operation.opcode) {
+      case Opcode::kRead:
+        result = TEMP_FAILURE_RETRY(pread(fd, operation.iov.iov_base,
+                                          operation.iov.iov_len,
+                                          operation.offset));
+        break;
+      case Opcode::kWrite:
+        result = TEMP_FAILURE_RETRY(pwrite(fd, operation.iov.iov_base,
+                                           operation.iov.iov_len,
+                                           operation.offset));
+        break;
+      case Opcode::kFsync:
+        result = TEMP_FAILURE_RETRY(fsync(fd));
+        break;
+    }
+    completions.push_back(BatchIoCompletion{
+        .user_data = operation.user_data,
+        .result = result < 0 ? -errno : result,
+    });
+    pending_.erase(it);
+  }
+  queued_.clear();
+}
+
+Result<void> CopyRangeBatched(BatchIo& io, SharedFD in, off_t in_offset,
+                              SharedFD out, off_t out_offset, uint64_t length,
+                              size_t chunk_size, size_t parallelism) {
+  CF_EXPECT(io.Pending() == 0, "The batch must not be in use");
+  CF_EXPECT(chunk_size > 0 && parallelism > 0);
+  chunk_size = std::min<uint64_t>(chunk_size, length);
+  parallelism = std::min(parallelism, io.Capacity());
+
+  // Every slot holds one chunk, which is read entirely and then written
+  // entirely, with one operation in flight at a time.
+  struct Slot {
+    std::vector<char> buffer;
+    uint64_t position;  // Relative to the start of the range
+    size_t length;
+    size_t written;
+  };
+  std::vector<Slot> slots(parallelism);
+  std::vector<size_t> free_slots;
+  for (size_t i = 0; i < slots.size(); i++) {
+    free_slots.push_back(i);
+  }
+  // Pieces of chunks that came back short from a read
+  std::deque<std::pair<uint64_t, size_t>> unread;
+  uint64_t next_position = 0;
+
+  auto queue_write = [&](size_t index) -> Result<void> {
+    auto& slot = slots[index];
+    CF_EXPECT(io.Write(out, slot.buffer.data() + slot.written,
+                       slot.length - slot.written,
+                       out_offset + slot.position + slot.written,
+                       index * 2 + 1));
+    return {};
+  };
+
+  while (next_position < length || !unread.empty() || io.Pending() > 0) {
+    while (!free_slots.empty() && (next_position < length || !unread.empty())) {
+      auto index = free_slots.back();
+      free_slots.pop_back();
+      auto& slot = slots[index];
+      if (!unread.empty()) {
+        std::tie(slot.position, slot.length) = unread.front();
+        unread.pop_front();
+      } else {
+        slot.position = next_position;
+        slot.length = std::min<uint64_t>(chunk_size, length - next_position);
+        next_position += slot.length;
+      }
+      slot.buffer.resize(chunk_size);
+      slot.written = 0;
+      CF_EXPECT(io.Read(in, slot.buffer.data(), slot.length,
+                        in_offset + slot.position, index * 2));
+    }
+    for (const auto& completion : CF_EXPECT(io.Submit(1))) {
+      auto index = completion.user_data / 2;
+      auto& slot = slots[index];
+      bool is_write = completion.user_data % 2;
+      CF_EXPECT(completion.result >= 0,
+                "Failed to " << (is_write ? "write" : "read") << " at "
+                             << slot.position << ": "
+                             << strerror(-completion.result));
+      CF_EXPECT(completion.result > 0,
+                "Unexpected end of file at " << slot.position);
+      if (!is_write) {
+        if (static_cast<size_t>(completion.result) < slot.length) {
+          unread.emplace_back(slot.position + completion.result,
+                              slot.length - completion.result);
+          slot.length = completion.result;
+        }
+        CF_EXPECT(queue_write(index));
+      } else {
+        slot.written += completion.result;
+        if (slot.written < slot.length) {
+          CF_EXPECT(queue_write(index));
+        } else {
+          free_slots.push_back(index);
+        }
+      }
+    }
+  }
+  return {};
+}
+
+}  // namespace cuttlefish
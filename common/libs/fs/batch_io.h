@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+struct BatchIoCompletion {
+  uint64_t user_data;
+  // Bytes transferred, or -errno
+  ssize_t result;
+};
+
+/**
+ * Runs many reads, writes and fsyncs at once, which keeps fast storage busy
+ * where one synchronous call at a time would leave it mostly idle.
+ *
+ * Operations are queued, all of them start with the next Submit, and they
+ * complete in any order. The buffers must stay valid until the operation's
+ * completion is returned. Uses io_uring when the kernel supports it and
+ * performs the operations synchronously inside Submit otherwise.
+ *
+ * Not thread-safe.
+ */
+class BatchIo {
+ public:
+  static Result<std::unique_ptr<BatchIo>> Create(unsigned int queue_depth = 64);
+  ~BatchIo();
+
+  // How many operations can be queued or in flight at once
+  size_t Capacity() const { return capacity_; }
+  // Operations queued or submitted whose completion wasn't returned yet
+  size_t Pending() const { return pending_.size(); }
+  bool UsesIoUring() const { return ring_fd_ >= 0; }
+
+  Result<void> Read(SharedFD fd, void* buf, size_t length, off_t offset,
+                    uint64_t user_data);
+  Result<void> Write(SharedFD fd, const void* buf, size_t length,
+                     off_t offset, uint64_t user_data);
+  Result<void> Fsync(SharedFD fd, uint64_t user_data);
+
+  // Starts the queued operations and waits until at least `wait_for` of the
+  // pending ones have completed, returning every completion available.
+  Result<std::vector<BatchIoCompletion>> Submit(size_t wait_for);
+
+ private:
+  enum class Opcode { kRead, kWrite, kFsync };
+  struct Operation {
+    Opcode opcode;
+    SharedFD fd;  // Keeps the descriptor open while the kernel uses it
+    struct iovec iov;
+    off_t offset;
+    uint64_t user_data;
+  };
+  struct Ring;
+
+  BatchIo(size_t capacity);
+
+  Result<void> Queue(Operation operation);
+  Result<void> SubmitToRing(size_t wait_for,
+                            std::vector<BatchIoCompletion>& completions);
+  void RunSynchronously(std::vector<BatchIoCompletion>& completions);
+
+  size_t capacity_;
+  int ring_fd_ = -1;
+  std::unique_ptr<Ring> ring_;
+  uint64_t next_id_ = 0;
+  std::unordered_map<uint64_t, Operation> pending_;
+  std::vector<uint64_t> queued_;
+};
+
+/**
+ * Copies `length` bytes between two files keeping up to `parallelism` reads
+ * and writes of `chunk_size` bytes in flight.
+ */
+Result<void> CopyRangeBatched(BatchIo& io, SharedFD in, off_t in_offset,
+                              SharedFD out, off_t out_offset, uint64_t length,
+                              size_t chunk_size = 1 << 20,
+                              size_t parallelism = 8);
+
+}  // namespace cuttlefish
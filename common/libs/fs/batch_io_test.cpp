@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/libs/fs/batch_io.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace cuttlefish {
+
+std::vector<char> BatchTestData(size_t size) {
+  std::vector<char> data(size);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = i * 13;
+  }
+  return data;
+}
+
+std::vector<char> BatchContentsOf(SharedFD fd, size_t size) {
+  std::vector<char> data(size);
+  EXPECT_EQ(size, fd->LSeek(0, SEEK_END));
+  EXPECT_EQ(0, fd->LSeek(0, SEEK_SET));
+  EXPECT_EQ(size, fd->Read(data.data(), size));
+  return data;
+}
+
+TEST(BatchIo, WritesAndReadsBack) {
+  auto io = BatchIo::Create(4);
+  ASSERT_TRUE(io.ok()) << io.error();
+  auto file = SharedFD::MemfdCreate("batch_io_test");
+  auto data = BatchTestData(4 * 4096);
+  for (size_t i = 0; i < 4; i++) {
+    ASSERT_TRUE((*io)->Write(file, data.data() + i * 4096, 4096, i * 4096, i)
+                    .ok());
+  }
+  auto written = (*io)->Submit(4);
+  ASSERT_TRUE(written.ok()) << written.error();
+  ASSERT_EQ(4, written->size());
+  for (const auto& completion : *written) {
+    EXPECT_EQ(4096, completion.result);
+  }
+  EXPECT_EQ(data, BatchContentsOf(file, data.size()));
+
+  std::vector<char> read_back(data.size());
+  ASSERT_TRUE((*io)->Read(file, read_back.data(), read_back.size(), 0, 7).ok());
+  ASSERT_TRUE((*io)->Fsync(file, 8).ok());
+  auto read = (*io)->Submit(2);
+  ASSERT_TRUE(read.ok()) << read.error();
+  ASSERT_EQ(2, read->size());
+  for (const auto& completion : *read) {
+    if (completion.user_data == 7) {
+      EXPECT_EQ(data.size(), completion.result);
+    }
+  }
+  EXPECT_EQ(data, read_back);
+}
+
+TEST(BatchIo, RejectsMoreThanItsCapacity) {
+  auto io = BatchIo::Create(2);
+  ASSERT_TRUE(io.ok()) << io.error();
+  auto file = SharedFD::MemfdCreate("batch_io_test");
+  char buf[16];
+  size_t queued = 0;
+  while ((*io)->Read(file, buf, sizeof(buf), 0, queued).ok()) {
+    queued++;
+  }
+  EXPECT_EQ((*io)->Capacity(), queued);
+  auto completions = (*io)->Submit(queued);
+  ASSERT_TRUE(completions.ok()) << completions.error();
+  EXPECT_EQ(queued, completions->size());
+}
+
+TEST(BatchIo, ReportsErrors) {
+  auto io = BatchIo::Create();
+  ASSERT_TRUE(io.ok()) << io.error();
+  SharedFD fds[2];
+  ASSERT_TRUE(SharedFD::Pipe(fds, fds + 1));
+  char buf[16];
+  ASSERT_TRUE((*io)->Read(fds[1], buf, sizeof(buf), 0, 0).ok());
+  auto completions = (*io)->Submit(1);
+  ASSERT_TRUE(completions.ok()) << completions.error();
+  ASSERT_EQ(1, completions->size());
+  EXPECT_LT((*completions)[0].result, 0);
+}
+
+TEST(BatchIo, CopiesRanges) {
+  auto io = BatchIo::Create(8);
+  ASSERT_TRUE(io.ok()) << io.error();
+  auto data = BatchTestData(1000000);
+  auto in = SharedFD::MemfdCreate("batch_io_test_in");
+  ASSERT_EQ(data.size(), in->Write(data.data(), data.size()));
+  auto out = SharedFD::MemfdCreate("batch_io_test_out");
+  auto copied = CopyRangeBatched(**io, in, 100, out, 0, data.size() - 100,
+                                 /* chunk_size */ 4096, /* parallelism */ 8);
+  ASSERT_TRUE(copied.ok()) << copied.error();
+  EXPECT_EQ(std::vector<char>(data.begin() + 100, data.end()),
+            BatchContentsOf(out, data.size() - 100));
+}
+
+TEST(BatchIo, FailsToCopyPastTheEnd) {
+  auto io = BatchIo::Create();
+  ASSERT_TRUE(io.ok()) << io.error();
+  auto in = SharedFD::MemfdCreate("batch_io_test_in");
+  ASSERT_EQ(5, in->Write("12345", 5));
+  auto out = SharedFD::MemfdCreate("batch_io_test_out");
+  EXPECT_FALSE(CopyRangeBatched(**io, in, 0, out, 0, 10).ok());
+}
+
+}  // namespace cuttlefish
@@ -142,13 +142,13 @@ Result<void> Epoll::Delete(SharedFD fd) {
   return {};
 }
 
-Result<std::optional<EpollEvent>> Epoll::Wait() {
+Result<std::optional<EpollEvent>> Epoll::Wait(int timeout_ms) {
   epoll_event event;
   int success;
   {
     std::shared_lock lock(epoll_mutex_);
     CF_EXPECT(epoll_fd_->IsOpen(), "Empty Epoll instance");
-    success = epoll_wait(epoll_fd_->fd_, &event, 1, -1);
+    success = epoll_wait(epoll_fd_->fd_, &event, 1, timeout_ms);
   }
   if (success == -1) {
     return CF_ERRNO("epoll_wait failed");
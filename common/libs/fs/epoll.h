@@ -44,7 +44,8 @@ class Epoll {
   Result<void> Modify(SharedFD fd, uint32_t events);
   Result<void> AddOrModify(SharedFD fd, uint32_t events);
   Result<void> Delete(SharedFD fd);
-  Result<std::optional<EpollEvent>> Wait();
+  // Waits for at most `timeout_ms` milliseconds, or forever if it's negative
+  Result<std::optional<EpollEvent>> Wait(int timeout_ms = -1);
 
  private:
   Epoll(SharedFD);
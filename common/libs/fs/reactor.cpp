@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/libs/fs/reactor.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "common/libs/fs/epoll.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+Result<std::unique_ptr<Reactor>> Reactor::Create() {
+  auto epoll = CF_EXPECT(Epoll::Create());
+  auto wakeup = SharedFD::Event(0, EFD_NONBLOCK);
+  CF_EXPECT(wakeup->IsOpen(),
+            "Failed to create eventfd: " << wakeup->StrError());
+  CF_EXPECT(epoll.Add(wakeup, EPOLLIN));
+  return std::unique_ptr<Reactor>(new Reactor(std::move(epoll), wakeup));
+}
+
+Reactor::Reactor(Epoll epoll, SharedFD wakeup)
+    : epoll_(std::move(epoll)), wakeup_(wakeup) {}
+
+Result<void> Reactor::Add(SharedFD fd, uint32_t events, FdCallback callback) {
+  CF_EXPECT(callbacks_.count(fd) == 0, "Already watching the fd");
+  CF_EXPECT(epoll_.Add(fd, events));
+  callbacks_[fd] = std::make_shared<FdCallback>(std::move(callback));
+  return {};
+}
+
+Result<void> Reactor::Modify(SharedFD fd, uint32_t events) {
+  CF_EXPECT(epoll_.Modify(fd, events));
+  return {};
+}
+
+Result<void> Reactor::Remove(SharedFD fd) {
+  CF_EXPECT(callbacks_.erase(fd) == 1, "Not watching the fd");
+  CF_EXPECT(epoll_.Delete(fd));
+  return {};
+}
+
+void Reactor::RunAfter(std::chrono::milliseconds delay, Callback callback) {
+  timers_.push(Timer{Clock::now() + delay, next_timer_sequence_++,
+                     std::move(callback)});
+}
+
+void Reactor::Defer(Callback callback) {
+  {
+    std::lock_guard lock(deferred_mutex_);
+    deferred_.emplace_back(std::move(callback));
+  }
+  wakeup_->EventfdWrite(1);
+}
+
+void Reactor::Stop() {
+  {
+    std::lock_guard lock(deferred_mutex_);
+    stopped_ = true;
+  }
+  wakeup_->EventfdWrite(1);
+}
+
+Result<void> Reactor::Run() {
+  while (true) {
+    RunDeferred();
+    RunExpiredTimers();
+    {
+      std::lock_guard lock(deferred_mutex_);
+      if (stopped_) {
+        stopped_ = false;
+        return {};
+      }
+    }
+    auto event = CF_EXPECT(epoll_.Wait(NextTimeoutMs()));
+    if (!event) {
+      continue;  // Timeout or spurious wakeup
+    }
+    if (event->fd == wakeup_) {
+      eventfd_t value;
+      wakeup_->EventfdRead(&value);
+      continue;
+    }
+    auto it = callbacks_.find(event->fd);
+    if (it == callbacks_.end()) {
+      continue;  // Removed by an earlier callback
+    }
+    // Held in case the callback removes itself
+    auto callback = it->second;
+    (*callback)(event->events);
+  }
+}
+
+int Reactor::NextTimeoutMs() const {
+  if (timers_.empty()) {
+    return -1;
+  }
+  auto remaining = timers_.top().deadline - Clock::now();
+  // Rounded up, waking up early would only wait again
+  auto ms = std::chrono::ceil<std::chrono::milliseconds>(remaining).count();
+  return std::max<int64_t>(ms, 0);
+}
+
+void Reactor::RunExpiredTimers() {
+  auto now = Clock::now();
+  while (!timers_.empty() && timers_.top().deadline <= now) {
+    // The callback may add timers, so it can't run from inside the queue
+    auto callback = std::move(const_cast<Timer&>(timers_.top()).callback);
+    timers_.pop();
+    callback();
+  }
+}
+
+void Reactor::RunDeferred() {
+  std::vector<Callback> deferred;
+  {
+    std::lock_guard lock(deferred_mutex_);
+    deferred.swap(deferred_);
+  }
+  for (auto& callback : deferred) {
+    callback();
+  }
+}
+
+}  // namespace cuttlefish
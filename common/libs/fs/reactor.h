@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <vector>
+
+#include "common/libs/fs/epoll.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+/**
+ * An event loop on top of Epoll. Watched file descriptors stay registered
+ * until removed, and their callbacks run on the thread calling Run with the
+ * events that were observed.
+ *
+ * Add, Modify, Remove and RunAfter may only be called before Run or from the
+ * loop's own callbacks. Defer and Stop may be called from any thread.
+ */
+class Reactor {
+ public:
+  using FdCallback = std::function<void(uint32_t events)>;
+  using Callback = std::function<void()>;
+
+  static Result<std::unique_ptr<Reactor>> Create();
+
+  Result<void> Add(SharedFD fd, uint32_t events, FdCallback callback);
+  Result<void> Modify(SharedFD fd, uint32_t events);
+  // Safe to call from the fd's own callback
+  Result<void> Remove(SharedFD fd);
+
+  // Runs `callback` once, from the loop, after at least `delay`.
+  void RunAfter(std::chrono::milliseconds delay, Callback callback);
+  // Runs `callback` from the loop as soon as possible.
+  void Defer(Callback callback);
+
+  // Runs callbacks until Stop is called.
+  Result<void> Run();
+  void Stop();
+
+ private:
+  using Clock = std::chrono::steady_clock;
+  struct Timer {
+    Clock::time_point deadline;
+    uint64_t sequence;  // Keeps timers with the same deadline in order
+    Callback callback;
+
+    bool operator>(const Timer& other) const {
+      return deadline != other.deadline ? deadline > other.deadline
+                                        : sequence > other.sequence;
+    }
+  };
+
+  Reactor(Epoll epoll, SharedFD wakeup);
+
+  int NextTimeoutMs() const;
+  void RunExpiredTimers();
+  void RunDeferred();
+
+  Epoll epoll_;
+  SharedFD wakeup_;
+  std::map<SharedFD, std::shared_ptr<FdCallback>> callbacks_;
+  std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers_;
+  uint64_t next_timer_sequence_ = 0;
+
+  std::mutex deferred_mutex_;
+  std::vector<Callback> deferred_;
+  bool stopped_ = false;
+};
+
+}  // namespace cuttlefish
@@ -20,7 +20,9 @@
 #include <netinet/in.h>
 #include <poll.h>
 #include <sys/file.h>
+#include <linux/errqueue.h>
 #include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
@@ -79,6 +81,11 @@ void CheckMarked(fd_set* in_out_mask, SharedFDSet* in_out_set) {
 # endif
 #endif
 
+#ifndef __NR_pidfd_open
+// The same on all architectures of interest
+# define __NR_pidfd_open 434
+#endif
+
 int memfd_create_wrapper(const char* name, unsigned int flags) {
 #ifdef CUTTLEFISH_HOST
   // TODO(schuffelen): Use memfd_create with a newer host libc.
@@ -98,9 +105,61 @@ bool IsRegularFile(const int fd) {
 
 constexpr size_t kPreferredBufferSize = 8192;
 
+// The errors with which the in-kernel copies reject a pair of files they
+// can't handle, as opposed to failing to copy.
+bool IsUnsupportedCopy(int error) {
+  return error == EXDEV || error == ENOSYS || error == EOPNOTSUPP ||
+         error == EINVAL;
+}
+
+ssize_t CopyFileRangeTransfer(FileInstance& in, FileInstance& out,
+                              size_t length) {
+  return out.CopyFileRange(in, length);
+}
+
+ssize_t SendFileTransfer(FileInstance& in, FileInstance& out, size_t length) {
+  return out.SendFile(in, length);
+}
+
+ssize_t SpliceTransfer(FileInstance& in, FileInstance& out, size_t length) {
+  return in.Splice(out, length, SPLICE_F_MOVE);
+}
+
 }  // namespace
 
+FileInstance::KernelCopy FileInstance::CopyInKernel(
+    FileInstance& in, size_t* length,
+    ssize_t (*transfer)(FileInstance& in, FileInstance& out, size_t length)) {
+  bool started = false;
+  while (*length > 0) {
+    ssize_t copied = transfer(in, *this, *length);
+    // Some kernels report files like the ones in procfs as empty instead of
+    // rejecting them, the read fallback still sees when input ends.
+    bool unsupported =
+        copied == 0 || IsUnsupportedCopy(errno_) || IsUnsupportedCopy(in.errno_);
+    if (copied <= 0 && !started && unsupported) {
+      // Leave no trace of the attempt, the next method may work
+      errno_ = 0;
+      in.errno_ = 0;
+      return KernelCopy::kUnsupported;
+    }
+    if (copied <= 0) {
+      return KernelCopy::kFailed;
+    }
+    started = true;
+    *length -= copied;
+  }
+  return KernelCopy::kDone;
+}
+
 bool FileInstance::CopyFrom(FileInstance& in, size_t length) {
+  for (auto transfer :
+       {CopyFileRangeTransfer, SendFileTransfer, SpliceTransfer}) {
+    auto result = CopyInKernel(in, &length, transfer);
+    if (result != KernelCopy::kUnsupported) {
+      return result == KernelCopy::kDone;
+    }
+  }
   std::vector<char> buffer(kPreferredBufferSize);
   while (length > 0) {
     ssize_t num_read = in.Read(buffer.data(), std::min(buffer.size(), length));
@@ -127,7 +186,8 @@ bool FileInstance::CopyAllFrom(FileInstance& in) {
   // the errno variable is not zeroed out before.
   errno_ = 0;
   in.errno_ = 0;
-  while (CopyFrom(in, kPreferredBufferSize)) {
+  // Large chunks let the in-kernel copies move more with each system call
+  while (CopyFrom(in, 1 << 20)) {
   }
   // Only return false if there was an actual error.
   return !GetErrno() && !in.GetErrno();
@@ -363,6 +423,12 @@ SharedFD SharedFD::MemfdCreate(const std::string& name, unsigned int flags) {
   return std::shared_ptr<FileInstance>(new FileInstance(fd, error_num));
 }
 
+SharedFD SharedFD::PidFdOpen(pid_t pid, unsigned int flags) {
+  int fd = syscall(__NR_pidfd_open, pid, flags);
+  int error_num = errno;
+  return std::shared_ptr<FileInstance>(new FileInstance(fd, error_num));
+}
+
 SharedFD SharedFD::MemfdCreateWithData(const std::string& name, const std::string& data, unsigned int flags) {
   auto memfd = MemfdCreate(name, flags);
   if (WriteAll(memfd, data) != data.size()) {
@@ -634,6 +700,14 @@ ScopedMMap::~ScopedMMap() {
   return std::shared_ptr<FileInstance>(new FileInstance(-1, EBADF));
 }
 
+ssize_t FileInstance::CopyFileRange(FileInstance& in, size_t length) {
+  errno = 0;
+  ssize_t rval = TEMP_FAILURE_RETRY(
+      copy_file_range(in.fd_, nullptr, fd_, nullptr, length, 0));
+  errno_ = errno;
+  return rval;
+}
+
 int FileInstance::Bind(const struct sockaddr* addr, socklen_t addrlen) {
   errno = 0;
   int rval = bind(fd_, addr, addrlen);
@@ -662,6 +736,13 @@ int FileInstance::UNMANAGED_Dup2(int newfd) {
   return rval;
 }
 
+int FileInstance::Fallocate(int mode, off_t offset, off_t length) {
+  errno = 0;
+  int rval = TEMP_FAILURE_RETRY(fallocate(fd_, mode, offset, length));
+  errno_ = errno;
+  return rval;
+}
+
 int FileInstance::Fcntl(int command, int value) {
   errno = 0;
   int rval = TEMP_FAILURE_RETRY(fcntl(fd_, command, value));
@@ -676,6 +757,13 @@ int FileInstance::Flock(int operation) {
   return rval;
 }
 
+int FileInstance::Fsync() {
+  errno = 0;
+  int rval = TEMP_FAILURE_RETRY(fsync(fd_));
+  errno_ = errno;
+  return rval;
+}
+
 int FileInstance::GetSockName(struct sockaddr* addr, socklen_t* addrlen) {
   errno = 0;
   int rval = TEMP_FAILURE_RETRY(getsockname(fd_, addr, addrlen));
@@ -737,6 +825,14 @@ ssize_t FileInstance::RecvMsg(struct msghdr* msg, int flags) {
   return rval;
 }
 
+int FileInstance::RecvMMsg(struct mmsghdr* msgs, unsigned int vlen,
+                           int flags) {
+  errno = 0;
+  int rval = TEMP_FAILURE_RETRY(recvmmsg(fd_, msgs, vlen, flags, nullptr));
+  errno_ = errno;
+  return rval;
+}
+
 ssize_t FileInstance::Read(void* buf, size_t count) {
   errno = 0;
   ssize_t rval = TEMP_FAILURE_RETRY(read(fd_, buf, count));
@@ -744,6 +840,13 @@ ssize_t FileInstance::Read(void* buf, size_t count) {
   return rval;
 }
 
+ssize_t FileInstance::Readv(const struct iovec* iov, int iovcnt) {
+  errno = 0;
+  ssize_t rval = TEMP_FAILURE_RETRY(readv(fd_, iov, iovcnt));
+  errno_ = errno;
+  return rval;
+}
+
 int FileInstance::EventfdRead(eventfd_t* value) {
   errno = 0;
   auto rval = eventfd_read(fd_, value);
@@ -765,6 +868,48 @@ ssize_t FileInstance::SendMsg(const struct msghdr* msg, int flags) {
   return rval;
 }
 
+int FileInstance::SendMMsg(struct mmsghdr* msgs, unsigned int vlen,
+                           int flags) {
+  errno = 0;
+  int rval = TEMP_FAILURE_RETRY(sendmmsg(fd_, msgs, vlen, flags));
+  errno_ = errno;
+  return rval;
+}
+
+ssize_t FileInstance::SendFile(FileInstance& in, size_t length) {
+  errno = 0;
+  ssize_t rval = TEMP_FAILURE_RETRY(sendfile(fd_, in.fd_, nullptr, length));
+  errno_ = errno;
+  return rval;
+}
+
+int FileInstance::RecvZeroCopyCompletion(uint32_t* first, uint32_t* last) {
+  char control[CMSG_SPACE(sizeof(struct sock_extended_err))];
+  struct msghdr msg = {};
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  errno = 0;
+  int rval = TEMP_FAILURE_RETRY(recvmsg(fd_, &msg, MSG_ERRQUEUE));
+  errno_ = errno;
+  if (rval < 0) {
+    return rval;
+  }
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  if (!cmsg) {
+    errno_ = EAGAIN;
+    return -1;
+  }
+  auto error = reinterpret_cast<struct sock_extended_err*>(CMSG_DATA(cmsg));
+  if (error->ee_errno != 0 || error->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+    // Something else was queued, report it as the error
+    errno_ = error->ee_errno ? error->ee_errno : EIO;
+    return -1;
+  }
+  *first = error->ee_info;
+  *last = error->ee_data;
+  return 0;
+}
+
 int FileInstance::Shutdown(int how) {
   errno = 0;
   int rval = shutdown(fd_, how);
@@ -832,6 +977,30 @@ ssize_t FileInstance::Write(const void* buf, size_t count) {
   return rval;
 }
 
+ssize_t FileInstance::Splice(FileInstance& out, size_t length,
+                             unsigned int flags) {
+  errno = 0;
+  ssize_t rval = TEMP_FAILURE_RETRY(
+      splice(fd_, nullptr, out.fd_, nullptr, length, flags));
+  errno_ = errno;
+  return rval;
+}
+
+ssize_t FileInstance::Tee(FileInstance& out, size_t length,
+                          unsigned int flags) {
+  errno = 0;
+  ssize_t rval = TEMP_FAILURE_RETRY(tee(fd_, out.fd_, length, flags));
+  errno_ = errno;
+  return rval;
+}
+
+ssize_t FileInstance::Writev(const struct iovec* iov, int iovcnt) {
+  errno = 0;
+  ssize_t rval = TEMP_FAILURE_RETRY(writev(fd_, iov, iovcnt));
+  errno_ = errno;
+  return rval;
+}
+
 int FileInstance::EventfdWrite(eventfd_t value) {
   errno = 0;
   int rval = eventfd_write(fd_, value);
@@ -136,6 +136,8 @@ class SharedFD {
   static SharedFD MemfdCreate(const std::string& name, unsigned int flags = 0);
   static SharedFD MemfdCreateWithData(const std::string& name, const std::string& data, unsigned int flags = 0);
   static SharedFD Mkstemp(std::string* path);
+  // Readable once the process exits. Needs Linux 5.3 or newer.
+  static SharedFD PidFdOpen(pid_t pid, unsigned int flags = 0);
   static int Poll(PollSharedFd* fds, size_t num_fds, int timeout);
   static int Poll(std::vector<PollSharedFd>& fds, int timeout);
   static bool SocketPair(int domain, int type, int protocol, SharedFD* fd0,
@@ -236,6 +238,7 @@ class FileInstance {
   // Give SharedFD access to the aliasing constructor.
   friend class SharedFD;
   friend class Epoll;
+  friend class BatchIo;
 
  public:
   virtual ~FileInstance() { Close(); }
@@ -244,6 +247,9 @@ class FileInstance {
   static std::shared_ptr<FileInstance> ClosedInstance();
 
   int Bind(const struct sockaddr* addr, socklen_t addrlen);
+  // Copies up to length bytes from in at its current offset, in the kernel.
+  // Both need to be regular files. Errors are set on this file.
+  ssize_t CopyFileRange(FileInstance& in, size_t length);
   int Connect(const struct sockaddr* addr, socklen_t addrlen);
   int ConnectWithTimeout(const struct sockaddr* addr, socklen_t addrlen,
                          struct timeval* timeout);
@@ -255,6 +261,8 @@ class FileInstance {
   // Otherwise an error will be set either on this file or the input.
   // The non-const reference is needed to avoid binding this to a particular
   // reference type.
+  // The data stays in the kernel when possible, trying copy_file_range,
+  // sendfile and splice in that order before copying through a buffer.
   bool CopyFrom(FileInstance& in, size_t length);
   // Same as CopyFrom, but reads from input until EOF is reached.
   bool CopyAllFrom(FileInstance& in);
@@ -262,9 +270,11 @@ class FileInstance {
   int UNMANAGED_Dup();
   int UNMANAGED_Dup2(int newfd);
   int Fchdir();
+  int Fallocate(int mode, off_t offset, off_t length);
   int Fcntl(int command, int value);
 
   int Flock(int operation);
+  int Fsync();
 
   int GetErrno() const { return errno_; }
   int GetSockName(struct sockaddr* addr, socklen_t* addrlen);
@@ -295,10 +305,29 @@ class FileInstance {
   off_t LSeek(off_t offset, int whence);
   ssize_t Recv(void* buf, size_t len, int flags);
   ssize_t RecvMsg(struct msghdr* msg, int flags);
+  // Receives up to vlen messages, returns how many were received.
+  int RecvMMsg(struct mmsghdr* msgs, unsigned int vlen, int flags);
   ssize_t Read(void* buf, size_t count);
+  ssize_t Readv(const struct iovec* iov, int iovcnt);
   int EventfdRead(eventfd_t* value);
   ssize_t Send(const void* buf, size_t len, int flags);
   ssize_t SendMsg(const struct msghdr* msg, int flags);
+  // Sends up to vlen messages with a single system call, returns how many
+  // were sent.
+  int SendMMsg(struct mmsghdr* msgs, unsigned int vlen, int flags);
+  // Copies up to length bytes from in at its current offset without going
+  // through user space. in needs to support mmap, usually a regular file.
+  // Errors are set on this file.
+  ssize_t SendFile(FileInstance& in, size_t length);
+  /*
+   * Send and SendMsg with MSG_ZEROCOPY make the kernel send straight from the
+   * caller's memory once SO_ZEROCOPY is enabled on the socket. The buffers
+   * must stay untouched until the kernel reports that it's done with them:
+   * each zero copy send is numbered, starting from 0, and this reads the
+   * next completion notification, setting [*first, *last] to the range of
+   * sends that completed. Returns -1 with EAGAIN if there is none yet.
+   */
+  int RecvZeroCopyCompletion(uint32_t* first, uint32_t* last);
 
   template <typename... Args>
   ssize_t SendFileDescriptors(const void* buf, size_t len, Args&&... sent_fds) {
@@ -311,6 +340,12 @@ class FileInstance {
   }
 
   int Shutdown(int how);
+  // Moves up to length bytes to out without copying them through user space.
+  // At least one of the two needs to be a pipe. Errors are set on this file.
+  ssize_t Splice(FileInstance& out, size_t length, unsigned int flags);
+  // Copies up to length bytes from this pipe to the out pipe without
+  // consuming them. Errors are set on this file.
+  ssize_t Tee(FileInstance& out, size_t length, unsigned int flags);
   void Set(fd_set* dest, int* max_index) const;
   int SetSockOpt(int level, int optname, const void* optval, socklen_t optlen);
   int GetSockOpt(int level, int optname, void* optval, socklen_t* optlen);
@@ -327,6 +362,7 @@ class FileInstance {
    *
    */
   ssize_t Write(const void* buf, size_t count);
+  ssize_t Writev(const struct iovec* iov, int iovcnt);
   int EventfdWrite(eventfd_t value);
   bool IsATTY();
 
@@ -334,6 +370,11 @@ class FileInstance {
   FileInstance(int fd, int in_errno);
   FileInstance* Accept(struct sockaddr* addr, socklen_t* addrlen) const;
 
+  enum class KernelCopy { kDone, kFailed, kUnsupported };
+  KernelCopy CopyInKernel(
+      FileInstance& in, size_t* length,
+      ssize_t (*transfer)(FileInstance& in, FileInstance& out, size_t length));
+
   int fd_;
   int errno_;
   std::string identity_;
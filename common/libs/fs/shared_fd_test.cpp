@@ -15,6 +15,7 @@
  */
 
 #include "common/libs/fs/shared_fd.h"
+#include "common/libs/fs/shared_buf.h"
 #include "common/libs/fs/shared_select.h"
 
 #include <stdlib.h>
@@ -22,6 +23,8 @@
 #include <gtest/gtest.h>
 
 #include <string>
+#include <thread>
+#include <vector>
 
 namespace cuttlefish {
 
@@ -38,4 +41,105 @@ TEST(SendFD, Basic) {
   EXPECT_EQ(0, strcmp(buf, pipe_message));
 }
 
+TEST(Readv, ScattersThePipeContents) {
+  SharedFD fds[2];
+  SharedFD::Pipe(fds, fds + 1);
+  ASSERT_EQ(sizeof(pipe_message),
+            fds[1]->Write(pipe_message, sizeof(pipe_message)));
+  char head[8];
+  char tail[80];
+  struct iovec iov[] = {{head, sizeof(head)}, {tail, sizeof(tail)}};
+  EXPECT_EQ(sizeof(pipe_message), fds[0]->Readv(iov, 2));
+  EXPECT_EQ(0, memcmp(head, pipe_message, sizeof(head)));
+  EXPECT_EQ(0, strcmp(tail, pipe_message + sizeof(head)));
+}
+
+TEST(SendMMsg, SendsEveryMessage) {
+  SharedFD fds[2];
+  ASSERT_TRUE(SharedFD::SocketPair(AF_UNIX, SOCK_DGRAM, 0, fds, fds + 1));
+  std::string messages[] = {"one", "two", "three"};
+  struct iovec iov[3];
+  struct mmsghdr msgs[3] = {};
+  for (int i = 0; i < 3; i++) {
+    iov[i] = {messages[i].data(), messages[i].size()};
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  EXPECT_EQ(3, fds[0]->SendMMsg(msgs, 3, 0));
+  for (const auto& message : messages) {
+    char buf[80];
+    ASSERT_EQ(message.size(), fds[1]->Recv(buf, sizeof(buf), 0));
+    EXPECT_EQ(message, std::string(buf, message.size()));
+  }
+}
+
+std::vector<char> TestData() {
+  std::vector<char> data(100000);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = i * 7;
+  }
+  return data;
+}
+
+SharedFD TempFileWith(const std::vector<char>& data) {
+  auto fd = SharedFD::MemfdCreate("shared_fd_test");
+  EXPECT_EQ(data.size(), fd->Write(data.data(), data.size()));
+  EXPECT_EQ(0, fd->LSeek(0, SEEK_SET));
+  return fd;
+}
+
+std::vector<char> ContentsOf(SharedFD fd) {
+  std::vector<char> data(fd->LSeek(0, SEEK_END));
+  EXPECT_EQ(0, fd->LSeek(0, SEEK_SET));
+  EXPECT_EQ(data.size(), fd->Read(data.data(), data.size()));
+  return data;
+}
+
+TEST(CopyFrom, FileToFile) {
+  auto data = TestData();
+  auto in = TempFileWith(data);
+  auto out = SharedFD::MemfdCreate("shared_fd_test_out");
+  ASSERT_TRUE(out->CopyFrom(*in, data.size())) << out->StrError();
+  EXPECT_EQ(data, ContentsOf(out));
+}
+
+TEST(CopyFrom, PipeToFile) {
+  auto data = TestData();
+  SharedFD fds[2];
+  SharedFD::Pipe(fds, fds + 1);
+  std::thread writer([&]() {
+    EXPECT_EQ(data.size(), WriteAll(fds[1], data));
+    fds[1]->Close();
+  });
+  auto out = SharedFD::MemfdCreate("shared_fd_test_out");
+  EXPECT_TRUE(out->CopyAllFrom(*fds[0])) << out->StrError();
+  writer.join();
+  EXPECT_EQ(data, ContentsOf(out));
+}
+
+TEST(CopyFrom, SocketToSocket) {
+  auto data = TestData();
+  SharedFD in[2];
+  SharedFD out[2];
+  ASSERT_TRUE(SharedFD::SocketPair(AF_UNIX, SOCK_STREAM, 0, in, in + 1));
+  ASSERT_TRUE(SharedFD::SocketPair(AF_UNIX, SOCK_STREAM, 0, out, out + 1));
+  std::thread writer([&]() {
+    EXPECT_EQ(data.size(), WriteAll(in[1], data));
+    in[1]->Close();
+  });
+  std::vector<char> received;
+  std::thread reader([&]() {
+    char buf[4096];
+    ssize_t read;
+    while ((read = out[1]->Read(buf, sizeof(buf))) > 0) {
+      received.insert(received.end(), buf, buf + read);
+    }
+  });
+  EXPECT_TRUE(out[0]->CopyAllFrom(*in[0])) << out[0]->StrError();
+  out[0]->Close();
+  writer.join();
+  reader.join();
+  EXPECT_EQ(data, received);
+}
+
 }
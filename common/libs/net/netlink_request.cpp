@@ -21,6 +21,7 @@
 #include <string.h>
 
 #include <algorithm>
+#include <atomic>
 #include <string>
 #include <vector>
 
@@ -28,7 +29,7 @@
 
 namespace cuttlefish {
 namespace {
-uint32_t kRequestSequenceNumber = 0;
+std::atomic<uint32_t> kRequestSequenceNumber = 0;
 }  // namespace
 
 uint32_t NetlinkRequest::SeqNo() const {
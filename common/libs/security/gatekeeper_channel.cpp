@@ -43,7 +43,7 @@ void GatekeeperCommandDestroyer::operator()(GatekeeperRawMessage* ptr) {
 }
 
 GatekeeperChannel::GatekeeperChannel(SharedFD input, SharedFD output)
-    : input_(input), output_(output) {
+    : input_(input), output_(output), reader_(input) {
 }
 
 bool GatekeeperChannel::SendRequest(
@@ -62,12 +62,19 @@ bool GatekeeperChannel::SendMessage(
     const gatekeeper::GateKeeperMessage& message) {
   LOG(DEBUG) << "Sending message with id: " << command;
   auto payload_size = message.GetSerializedSize();
-  auto to_send = CreateGatekeeperMessage(command, is_response, payload_size);
-  message.Serialize(to_send->payload, to_send->payload + payload_size);
   auto write_size = payload_size + sizeof(GatekeeperRawMessage);
-  auto to_send_bytes = reinterpret_cast<const char*>(to_send.get());
+  if (send_buffer_.size() < write_size) {
+    send_buffer_.resize(write_size);
+  }
+  auto to_send = reinterpret_cast<GatekeeperRawMessage*>(send_buffer_.data());
+  to_send->cmd = command;
+  to_send->is_response = is_response;
+  to_send->payload_size = payload_size;
+  message.Serialize(to_send->payload, to_send->payload + payload_size);
+  auto to_send_bytes = reinterpret_cast<const char*>(send_buffer_.data());
   auto written = WriteAll(output_, to_send_bytes, write_size);
-  if (written == -1) {
+  keymaster::Eraser(send_buffer_.data(), write_size);
+  if (written != write_size) {
     LOG(ERROR) << "Could not write Gatekeeper Message: " << output_->StrError();
   }
   return written == write_size;
@@ -75,11 +82,9 @@ bool GatekeeperChannel::SendMessage(
 
 ManagedGatekeeperMessage GatekeeperChannel::ReceiveMessage() {
   struct GatekeeperRawMessage message_header;
-  auto read = ReadExactBinary(input_, &message_header);
-  if (read != sizeof(GatekeeperRawMessage)) {
-    LOG(ERROR) << "Expected " << sizeof(GatekeeperRawMessage) << ", received "
-               << read;
-    LOG(ERROR) << "Could not read Gatekeeper Message: " << input_->StrError();
+  if (!reader_.ReadExactBinary(&message_header)) {
+    LOG(ERROR) << "Could not read Gatekeeper Message header: "
+               << input_->StrError();
     return {};
   }
   LOG(DEBUG) << "Received message with id: " << message_header.cmd;
@@ -87,8 +92,7 @@ ManagedGatekeeperMessage GatekeeperChannel::ReceiveMessage() {
                                          message_header.is_response,
                                          message_header.payload_size);
   auto message_bytes = reinterpret_cast<char*>(message->payload);
-  read = ReadExact(input_, message_bytes, message->payload_size);
-  if (read != message->payload_size) {
+  if (!reader_.ReadExact(message_bytes, message->payload_size)) {
     LOG(ERROR) << "Could not read Gatekeeper Message: " << input_->StrError();
     return {};
   }
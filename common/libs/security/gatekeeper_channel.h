@@ -19,8 +19,10 @@
 #include "gatekeeper/gatekeeper_messages.h"
 
 #include "common/libs/fs/shared_fd.h"
+#include "common/libs/security/message_reader.h"
 
 #include <memory>
+#include <vector>
 
 namespace gatekeeper {
 
@@ -80,6 +82,9 @@ public:
 private:
   SharedFD input_;
   SharedFD output_;
+  MessageReader reader_;
+  // Reused between messages to avoid an allocation per message
+  std::vector<std::uint8_t> send_buffer_;
   bool SendMessage(uint32_t command, bool response,
                    const gatekeeper::GateKeeperMessage& message);
 };
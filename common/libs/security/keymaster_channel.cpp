@@ -17,6 +17,7 @@
 #include "common/libs/security/keymaster_channel.h"
 
 #include <cstdlib>
+#include <cstring>
 #include <memory>
 #include <ostream>
 #include <string>
@@ -48,54 +49,88 @@ void KeymasterCommandDestroyer::operator()(keymaster_message* ptr) {
 }
 
 KeymasterChannel::KeymasterChannel(SharedFD input, SharedFD output)
-    : input_(input), output_(output) {
+    : input_(input), output_(output), reader_(input) {
 }
 
-bool KeymasterChannel::SendRequest(
-    AndroidKeymasterCommand command, const keymaster::Serializable& message) {
-  return SendMessage(command, false, message);
+bool KeymasterChannel::SendRequest(AndroidKeymasterCommand command,
+                                   const keymaster::Serializable& message,
+                                   uint32_t request_id) {
+  return SendMessage(command, false, request_id, message);
 }
 
-bool KeymasterChannel::SendResponse(
-    AndroidKeymasterCommand command, const keymaster::Serializable& message) {
-  return SendMessage(command, true, message);
+bool KeymasterChannel::SendResponse(AndroidKeymasterCommand command,
+                                    const keymaster::Serializable& message,
+                                    uint32_t request_id) {
+  return SendMessage(command, true, request_id, message);
 }
 
 bool KeymasterChannel::SendMessage(
     AndroidKeymasterCommand command,
     bool is_response,
+    uint32_t request_id,
     const keymaster::Serializable& message) {
-  auto payload_size = message.SerializedSize();
-  LOG(VERBOSE) << "Sending message with id: " << command << " and size "
-               << payload_size;
-  auto to_send = CreateKeymasterMessage(command, is_response, payload_size);
-  message.Serialize(to_send->payload, to_send->payload + payload_size);
+  auto message_size = message.SerializedSize();
+  LOG(VERBOSE) << "Sending message with id: " << command << ", request "
+               << request_id << " and size " << message_size;
+  auto tag_size = request_id != 0 ? sizeof(request_id) : 0;
+  auto payload_size = tag_size + message_size;
   auto write_size = payload_size + sizeof(keymaster_message);
-  auto to_send_bytes = reinterpret_cast<const char*>(to_send.get());
+  // Keeps messages from concurrent senders from interleaving on the wire
+  std::lock_guard<std::mutex> lock(send_mutex_);
+  if (send_buffer_.size() < write_size) {
+    send_buffer_.resize(write_size);
+  }
+  auto to_send = reinterpret_cast<keymaster_message*>(send_buffer_.data());
+  to_send->cmd = command;
+  if (request_id != 0) {
+    to_send->cmd = static_cast<AndroidKeymasterCommand>(
+        command | kKeymasterTaggedCommand);
+    memcpy(to_send->payload, &request_id, tag_size);
+  }
+  to_send->is_response = is_response;
+  to_send->payload_size = payload_size;
+  message.Serialize(to_send->payload + tag_size,
+                    to_send->payload + payload_size);
+  auto to_send_bytes = reinterpret_cast<const char*>(send_buffer_.data());
   auto written = WriteAll(output_, to_send_bytes, write_size);
+  keymaster::Eraser(send_buffer_.data(), write_size);
   if (written != write_size) {
     LOG(ERROR) << "Could not write Keymaster Message: " << output_->StrError();
   }
   return written == write_size;
 }
 
-ManagedKeymasterMessage KeymasterChannel::ReceiveMessage() {
+ManagedKeymasterMessage KeymasterChannel::ReceiveMessage(
+    uint32_t* request_id) {
   struct keymaster_message message_header;
-  auto read = ReadExactBinary(input_, &message_header);
-  if (read != sizeof(keymaster_message)) {
-    LOG(ERROR) << "Expected " << sizeof(keymaster_message) << ", received "
-               << read;
-    LOG(ERROR) << "Could not read Keymaster Message: " << input_->StrError();
+  if (!reader_.ReadExactBinary(&message_header)) {
+    LOG(ERROR) << "Could not read Keymaster Message header: "
+               << input_->StrError();
     return {};
   }
-  LOG(VERBOSE) << "Received message with id: " << message_header.cmd
-               << " and size " << message_header.payload_size;
-  auto message = CreateKeymasterMessage(message_header.cmd,
-                                        message_header.is_response,
-                                        message_header.payload_size);
+  uint32_t command = message_header.cmd;
+  uint32_t payload_size = message_header.payload_size;
+  uint32_t message_request_id = 0;
+  if (command & kKeymasterTaggedCommand) {
+    command &= ~kKeymasterTaggedCommand;
+    if (payload_size < sizeof(message_request_id) ||
+        !reader_.ReadExactBinary(&message_request_id)) {
+      LOG(ERROR) << "Could not read Keymaster Message request id: "
+                 << input_->StrError();
+      return {};
+    }
+    payload_size -= sizeof(message_request_id);
+  }
+  if (request_id) {
+    *request_id = message_request_id;
+  }
+  LOG(VERBOSE) << "Received message with id: " << command << ", request "
+               << message_request_id << " and size " << payload_size;
+  auto message = CreateKeymasterMessage(
+      static_cast<AndroidKeymasterCommand>(command),
+      message_header.is_response, payload_size);
   auto message_bytes = reinterpret_cast<char*>(message->payload);
-  read = ReadExact(input_, message_bytes, message->payload_size);
-  if (read != message->payload_size) {
+  if (!reader_.ReadExact(message_bytes, message->payload_size)) {
     LOG(ERROR) << "Could not read Keymaster Message: " << input_->StrError();
     return {};
   }
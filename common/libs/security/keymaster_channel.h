@@ -19,11 +19,14 @@
 #include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 #include <keymaster/android_keymaster_messages.h>
 #include <keymaster/serializable.h>
 
 #include "common/libs/fs/shared_fd.h"
+#include "common/libs/security/message_reader.h"
 
 namespace keymaster {
 
@@ -39,6 +42,14 @@ struct keymaster_message {
     std::uint8_t payload[0];
 };
 
+/**
+ * Set in the cmd of tagged messages, whose payload starts with a 32 bit
+ * request id chosen by the sender of a request and echoed in its response, so
+ * several requests can be in flight on the same channel. Only sent to peers
+ * known to understand it, untagged messages are answered in order.
+ */
+constexpr std::uint32_t kKeymasterTaggedCommand = 1u << 30;
+
 } // namespace keymaster
 
 namespace cuttlefish {
@@ -68,22 +79,35 @@ ManagedKeymasterMessage CreateKeymasterMessage(AndroidKeymasterCommand command,
                                                std::size_t payload_size);
 
 /*
- * Interface for communication channels that synchronously communicate Keymaster
- * IPC/RPC calls. Sends messages over a file descriptor.
+ * Interface for communication channels that communicate Keymaster IPC/RPC
+ * calls. Sends messages over a file descriptor.
+ *
+ * Messages may be sent from several threads at once. A non zero request_id
+ * sends a tagged message, responses to tagged requests carry the request_id
+ * of the request they answer and may arrive in any order. ReceiveMessage
+ * must only be called from one thread at a time, it stores the request id of
+ * the message in `request_id`, 0 for untagged messages.
  */
 class KeymasterChannel {
 public:
   KeymasterChannel(SharedFD input, SharedFD output);
 
   bool SendRequest(AndroidKeymasterCommand command,
-                   const keymaster::Serializable& message);
+                   const keymaster::Serializable& message,
+                   std::uint32_t request_id = 0);
   bool SendResponse(AndroidKeymasterCommand command,
-                    const keymaster::Serializable& message);
-  ManagedKeymasterMessage ReceiveMessage();
+                    const keymaster::Serializable& message,
+                    std::uint32_t request_id = 0);
+  ManagedKeymasterMessage ReceiveMessage(std::uint32_t* request_id = nullptr);
 private:
   SharedFD input_;
   SharedFD output_;
+  MessageReader reader_;
+  std::mutex send_mutex_;
+  // Reused between messages to avoid an allocation per message
+  std::vector<std::uint8_t> send_buffer_;
   bool SendMessage(AndroidKeymasterCommand command, bool response,
+                   std::uint32_t request_id,
                    const keymaster::Serializable& message);
 };
 
@@ -17,7 +17,13 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cstring>
+#include <list>
+#include <set>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "common/libs/fs/shared_fd.h"
 #include "common/libs/security/keymaster_channel.h"
@@ -75,4 +81,131 @@ TEST(KeymasterChannel, SendAndReceiveResponse) {
   ASSERT_TRUE(std::equal(request.begin(), request.end(), read.begin()));
 }
 
+TEST(KeymasterChannel, ReceivePipelinedRequests) {
+  SharedFD read_fd;
+  SharedFD write_fd;
+  ASSERT_TRUE(SharedFD::Pipe(&read_fd, &write_fd)) << "Failed to create pipe";
+
+  KeymasterChannel channel{read_fd, write_fd};
+
+  std::list<keymaster::Buffer> requests;
+  for (size_t size : {6, 70000, 1}) {
+    std::vector<uint8_t> data(size, static_cast<uint8_t>(size));
+    requests.emplace_back(data.data(), data.size());
+  }
+  std::thread writer([&channel, &requests]() {
+    for (const auto& request : requests) {
+      ASSERT_TRUE(channel.SendRequest(keymaster::UPDATE_OPERATION, request))
+          << "Failed to send request";
+    }
+  });
+  for (const auto& request : requests) {
+    auto message = channel.ReceiveMessage();
+    ASSERT_TRUE(message) << "Failed to receive request";
+    EXPECT_EQ(message->cmd, keymaster::UPDATE_OPERATION) << "Command mismatch";
+
+    keymaster::Buffer read;
+    const uint8_t* read_data = message->payload;
+    EXPECT_TRUE(read.Deserialize(&read_data, read_data + message->payload_size))
+        << "Failed to deserialize request";
+    ASSERT_EQ(request.available_read(), read.available_read());
+    ASSERT_TRUE(std::equal(request.begin(), request.end(), read.begin()));
+  }
+  writer.join();
+}
+
+
+TEST(KeymasterChannel, ResponseCarriesRequestId) {
+  SharedFD read_fd;
+  SharedFD write_fd;
+  ASSERT_TRUE(SharedFD::Pipe(&read_fd, &write_fd)) << "Failed to create pipe";
+
+  KeymasterChannel channel{read_fd, write_fd};
+
+  char buffer[] = {1, 2, 3};
+  keymaster::Buffer response(buffer, sizeof(buffer));
+
+  ASSERT_TRUE(channel.SendResponse(keymaster::FINISH_OPERATION, response, 42))
+      << "Failed to send response";
+  uint32_t request_id = 0;
+  auto message = channel.ReceiveMessage(&request_id);
+  ASSERT_TRUE(message) << "Failed to receive response";
+  EXPECT_EQ(message->cmd, keymaster::FINISH_OPERATION) << "Command mismatch";
+  EXPECT_TRUE(message->is_response) << "Request/response mismatch";
+  EXPECT_EQ(request_id, 42u) << "Request id mismatch";
+
+  keymaster::Buffer read;
+  const uint8_t* read_data = message->payload;
+  ASSERT_TRUE(read.Deserialize(&read_data, read_data + message->payload_size))
+      << "Failed to deserialize response";
+  ASSERT_EQ(read.available_read(), sizeof(buffer)) << "Size mismatch";
+}
+
+// Peers that don't know about request ids must keep understanding untagged
+// messages
+TEST(KeymasterChannel, UntaggedMessageLayout) {
+  SharedFD read_fd;
+  SharedFD write_fd;
+  ASSERT_TRUE(SharedFD::Pipe(&read_fd, &write_fd)) << "Failed to create pipe";
+
+  KeymasterChannel channel{read_fd, write_fd};
+
+  char buffer[] = {1, 2, 3};
+  keymaster::Buffer request(buffer, sizeof(buffer));
+  ASSERT_TRUE(channel.SendRequest(keymaster::GENERATE_KEY, request))
+      << "Failed to send request";
+
+  std::vector<uint8_t> written(8 + request.SerializedSize());
+  ASSERT_EQ(read_fd->Read(written.data(), written.size()),
+            static_cast<ssize_t>(written.size()));
+  uint32_t header[2];
+  memcpy(header, written.data(), sizeof(header));
+  EXPECT_EQ(header[0], static_cast<uint32_t>(keymaster::GENERATE_KEY));
+  EXPECT_EQ(header[1], request.SerializedSize());
+}
+
+TEST(KeymasterChannel, ConcurrentSendersDoNotInterleave) {
+  SharedFD read_fd;
+  SharedFD write_fd;
+  ASSERT_TRUE(SharedFD::Pipe(&read_fd, &write_fd)) << "Failed to create pipe";
+
+  KeymasterChannel channel{read_fd, write_fd};
+
+  constexpr uint32_t kSenders = 4;
+  constexpr uint32_t kRequestsPerSender = 16;
+  std::vector<std::thread> senders;
+  for (uint32_t sender = 0; sender < kSenders; sender++) {
+    senders.emplace_back([&channel, sender]() {
+      for (uint32_t i = 0; i < kRequestsPerSender; i++) {
+        uint32_t request_id = sender * kRequestsPerSender + i;
+        std::vector<uint8_t> data(10000, static_cast<uint8_t>(request_id));
+        keymaster::Buffer request(data.data(), data.size());
+        ASSERT_TRUE(channel.SendRequest(keymaster::UPDATE_OPERATION, request,
+                                        request_id))
+            << "Failed to send request";
+      }
+    });
+  }
+  std::set<uint32_t> received;
+  for (uint32_t i = 0; i < kSenders * kRequestsPerSender; i++) {
+    uint32_t request_id = 0;
+    auto message = channel.ReceiveMessage(&request_id);
+    ASSERT_TRUE(message) << "Failed to receive request";
+
+    keymaster::Buffer read;
+    const uint8_t* read_data = message->payload;
+    ASSERT_TRUE(read.Deserialize(&read_data, read_data + message->payload_size))
+        << "Failed to deserialize request";
+    auto expected = static_cast<uint8_t>(request_id);
+    ASSERT_TRUE(std::all_of(read.begin(), read.end(),
+                            [expected](uint8_t b) { return b == expected; }))
+        << "Payload of request " << request_id << " was corrupted";
+    EXPECT_TRUE(received.insert(request_id).second)
+        << "Request " << request_id << " received twice";
+  }
+  for (auto& sender : senders) {
+    sender.join();
+  }
+}
+
 }  // namespace cuttlefish
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "common/libs/security/message_reader.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <keymaster/mem.h>
+
+#include "common/libs/fs/shared_buf.h"
+
+namespace cuttlefish {
+
+static constexpr std::size_t kReadBufferSize = 64 * 1024;
+
+MessageReader::MessageReader(SharedFD input)
+    : input_(input), buffer_(kReadBufferSize) {
+}
+
+MessageReader::~MessageReader() {
+  keymaster::Eraser(buffer_.data(), buffer_.size());
+}
+
+bool MessageReader::ReadExact(void* data, std::size_t size) {
+  auto out = reinterpret_cast<std::uint8_t*>(data);
+  while (size > 0) {
+    if (begin_ == end_) {
+      begin_ = end_ = 0;
+      if (size >= buffer_.size()) {
+        auto read = cuttlefish::ReadExact(
+            input_, reinterpret_cast<char*>(out), size);
+        return read == static_cast<ssize_t>(size);
+      }
+      auto read = input_->Read(buffer_.data(), buffer_.size());
+      if (read <= 0) {
+        return false;
+      }
+      end_ = read;
+    }
+    auto available = std::min(size, end_ - begin_);
+    std::memcpy(out, buffer_.data() + begin_, available);
+    keymaster::Eraser(buffer_.data() + begin_, available);
+    begin_ += available;
+    out += available;
+    size -= available;
+  }
+  return true;
+}
+
+} // namespace cuttlefish
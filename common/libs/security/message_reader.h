@@ -0,0 +1,57 @@
+/*
+ * Copyright 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "common/libs/fs/shared_fd.h"
+
+namespace cuttlefish {
+
+/*
+ * Reads framed messages from a file descriptor. Data is read in large chunks,
+ * so a message header and its payload, or several pipelined messages, are
+ * usually consumed with a single syscall. Payloads that don't fit in the
+ * buffer are read directly into their destination. Buffered bytes are wiped
+ * once consumed since they may carry key material.
+ */
+class MessageReader {
+public:
+  MessageReader(SharedFD input);
+  ~MessageReader();
+
+  MessageReader(const MessageReader&) = delete;
+  MessageReader& operator=(const MessageReader&) = delete;
+
+  /* Returns false if the input ends or fails before `size` bytes are read. */
+  bool ReadExact(void* data, std::size_t size);
+
+  template <typename T>
+  bool ReadExactBinary(T* binary_data) {
+    return ReadExact(binary_data, sizeof(*binary_data));
+  }
+private:
+  SharedFD input_;
+  std::vector<std::uint8_t> buffer_;
+  std::size_t begin_ = 0;
+  std::size_t end_ = 0;
+};
+
+} // namespace cuttlefish
@@ -16,25 +16,197 @@
 
 #include "common/libs/utils/archive.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
 #include <ostream>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
+#include <android-base/file.h>
 #include <android-base/strings.h>
 #include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+#include <ziparchive/zip_archive.h>
 
+#include "common/libs/utils/files.h"
 #include "common/libs/utils/subprocess.h"
 
 namespace cuttlefish {
+namespace {
+
+bool IsZipFile(const std::string& file) {
+  android::base::unique_fd fd(open(file.c_str(), O_RDONLY | O_CLOEXEC));
+  char magic[4];
+  if (fd < 0 || !android::base::ReadFully(fd, magic, sizeof(magic))) {
+    return false;
+  }
+  // A local file header, or the end of central directory of an empty archive
+  return memcmp(magic, "PK\x03\x04", 4) == 0 ||
+         memcmp(magic, "PK\x05\x06", 4) == 0;
+}
+
+// Leaves blocks of zeroes as holes in the output file, like `bsdtar -S`.
+class SparseFileWriter : public zip_archive::Writer {
+ public:
+  SparseFileWriter(int fd) : fd_(fd) {}
+
+  bool Append(uint8_t* buf, size_t buf_size) override {
+    constexpr size_t kBlockSize = 4096;
+    while (buf_size > 0) {
+      auto length = std::min(buf_size, kBlockSize);
+      bool zeroes = std::all_of(buf, buf + length,
+                                [](uint8_t byte) { return byte == 0; });
+      if (!zeroes &&
+          !android::base::WriteFullyAtOffset(fd_, buf, length, offset_)) {
+        return false;
+      }
+      buf += length;
+      buf_size -= length;
+      offset_ += length;
+    }
+    return true;
+  }
+
+  bool Finish() { return ftruncate(fd_, offset_) == 0; }
+
+ private:
+  int fd_;
+  off64_t offset_ = 0;
+};
+
+// The data of stored entries is used as is, the kernel can copy it without
+// going through this process.
+bool CopyStoredEntry(ZipArchiveHandle zip, const ZipEntry64& entry, int out) {
+#ifdef __ANDROID__
+  // Not available in every bionic version this is built against
+  (void)zip;
+  (void)entry;
+  (void)out;
+  return false;
+#else
+  int in = GetFileDescriptor(zip);
+  off64_t in_offset = entry.offset;
+  off64_t out_offset = 0;
+  auto length = entry.uncompressed_length;
+  while (length > 0) {
+    auto copied =
+        copy_file_range(in, &in_offset, out, &out_offset, length, 0);
+    if (copied <= 0) {
+      return false;
+    }
+    length -= copied;
+  }
+  return true;
+#endif
+}
+
+bool ExtractZipEntry(ZipArchiveHandle zip, const std::string& name,
+                     const std::string& target_directory) {
+  // Entries must land inside the target directory
+  if (name.find("..") != std::string::npos || name.empty() || name[0] == '/') {
+    LOG(ERROR) << "Refusing to extract \"" << name << "\"";
+    return false;
+  }
+  auto path = target_directory + "/" + name;
+  if (android::base::EndsWith(name, "/")) {
+    return EnsureDirectoryExists(path).ok();
+  }
+  ZipEntry64 entry;
+  int32_t status = FindEntry(zip, name, &entry);
+  if (status != 0) {
+    LOG(ERROR) << "Could not find \"" << name << "\": "
+               << ErrorCodeString(status);
+    return false;
+  }
+  auto directory = cpp_dirname(path);
+  if (auto result = EnsureDirectoryExists(directory); !result.ok()) {
+    LOG(ERROR) << result.error();
+    return false;
+  }
+  android::base::unique_fd out(
+      open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644));
+  if (out < 0) {
+    PLOG(ERROR) << "Could not create \"" << path << "\"";
+    return false;
+  }
+  if (entry.method == kCompressStored && CopyStoredEntry(zip, entry, out)) {
+    return true;
+  }
+  // Either compressed, or copy_file_range is unsupported here
+  SparseFileWriter writer(out);
+  status = ExtractToWriter(zip, &entry, &writer);
+  if (status != 0 || !writer.Finish()) {
+    LOG(ERROR) << "Could not extract \"" << name << "\" to \"" << path
+               << "\": " << ErrorCodeString(status);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
 
 Archive::Archive(const std::string& file) : file(file) {
 }
 
 Archive::~Archive() {
+  if (zip) {
+    CloseArchive(zip);
+  }
+}
+
+bool Archive::OpenZip() {
+  if (zip) {
+    return true;
+  }
+  if (!IsZipFile(file)) {
+    return false;
+  }
+  int32_t status = OpenArchive(file.c_str(), &zip);
+  if (status != 0) {
+    LOG(ERROR) << "Could not open \"" << file << "\": "
+               << ErrorCodeString(status) << ", falling back to bsdtar";
+    CloseArchive(zip);
+    zip = nullptr;
+    return false;
+  }
+  return true;
 }
 
 std::vector<std::string> Archive::Contents() {
+  if (OpenZip()) {
+    if (zip_contents) {
+      return *zip_contents;
+    }
+    void* cookie;
+    int32_t status = StartIteration(zip, &cookie);
+    if (status != 0) {
+      LOG(ERROR) << "Could not list \"" << file << "\": "
+                 << ErrorCodeString(status);
+      return {};
+    }
+    std::vector<std::string> contents;
+    ZipEntry64 entry;
+    std::string name;
+    while ((status = Next(cookie, &entry, &name)) == 0) {
+      contents.push_back(name);
+    }
+    EndIteration(cookie);
+    if (status != -1) {  // -1 is the end of the entries
+      LOG(ERROR) << "Could not list \"" << file << "\": "
+                 << ErrorCodeString(status);
+      return {};
+    }
+    zip_contents = contents;
+    return contents;
+  }
   Command bsdtar_cmd("/usr/bin/bsdtar");
   bsdtar_cmd.AddParameter("-tf");
   bsdtar_cmd.AddParameter(file);
@@ -55,6 +227,43 @@ bool Archive::ExtractAll(const std::string& target_directory) {
 
 bool Archive::ExtractFiles(const std::vector<std::string>& to_extract,
                            const std::string& target_directory) {
+  if (OpenZip()) {
+    auto names = to_extract.empty() ? Contents() : to_extract;
+    // The largest archives are target files with a few large images, so the
+    // entries are extracted in parallel. A handle can't be shared between
+    // threads, each extra thread reads the central directory again.
+    std::atomic<std::size_t> next = 0;
+    std::atomic<bool> success = true;
+    auto extract = [&](ZipArchiveHandle handle) {
+      for (auto i = next++; i < names.size() && success; i = next++) {
+        if (!ExtractZipEntry(handle, names[i], target_directory)) {
+          success = false;
+        }
+      }
+    };
+    auto num_threads = std::min<std::size_t>(
+        std::max(1u, std::thread::hardware_concurrency()), names.size());
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < num_threads; i++) {
+      threads.emplace_back([this, &extract, &success]() {
+        ZipArchiveHandle handle;
+        if (OpenArchive(file.c_str(), &handle) != 0) {
+          success = false;
+        } else {
+          extract(handle);
+        }
+        CloseArchive(handle);
+      });
+    }
+    extract(zip);
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    if (!success) {
+      LOG(ERROR) << "Extraction from \"" << file << "\" failed";
+    }
+    return success;
+  }
   Command bsdtar_cmd("/usr/bin/bsdtar");
   bsdtar_cmd.AddParameter("-x");
   bsdtar_cmd.AddParameter("-v");
@@ -76,6 +285,22 @@ bool Archive::ExtractFiles(const std::vector<std::string>& to_extract,
 }
 
 std::string Archive::ExtractToMemory(const std::string& path) {
+  if (OpenZip()) {
+    ZipEntry64 entry;
+    int32_t status = FindEntry(zip, path, &entry);
+    std::string contents(status == 0 ? entry.uncompressed_length : 0, '\0');
+    if (status == 0) {
+      status = ::ExtractToMemory(zip, &entry,
+                                 reinterpret_cast<uint8_t*>(contents.data()),
+                                 contents.size());
+    }
+    if (status != 0) {
+      LOG(ERROR) << "Could not extract \"" << path << "\" from \"" << file
+                 << "\" to memory: " << ErrorCodeString(status);
+      return "";
+    }
+    return contents;
+  }
   Command bsdtar_cmd("/usr/bin/bsdtar");
   bsdtar_cmd.AddParameter("-xf");
   bsdtar_cmd.AddParameter(file);
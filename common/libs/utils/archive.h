@@ -15,17 +15,27 @@
  */
 #pragma once
 
+#include <optional>
 #include <string>
 #include <vector>
 
+struct ZipArchive;
+
 namespace cuttlefish {
 
-// Operations on archive files
+// Operations on archive files. Zip files are read in process, keeping their
+// central directory between calls, other formats go through bsdtar.
 class Archive {
   std::string file;
+  ZipArchive* zip = nullptr;
+  std::optional<std::vector<std::string>> zip_contents;
+
+  bool OpenZip();
 public:
   Archive(const std::string& file);
   ~Archive();
+  Archive(const Archive&) = delete;
+  Archive& operator=(const Archive&) = delete;
 
   std::vector<std::string> Contents();
   bool ExtractAll(const std::string& target_directory = ".");
@@ -16,42 +16,161 @@
 
 #include "common/libs/utils/base64.h"
 
+#include <array>
 #include <cstddef>
 #include <cstdint>
 #include <string>
 #include <vector>
 
-#include <openssl/base64.h>
-
 namespace cuttlefish {
+namespace {
+
+constexpr char kAlphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Encodes 12 bits at a time, 3 input bytes take two lookups.
+struct EncodeTable {
+  constexpr EncodeTable() : pairs() {
+    for (int i = 0; i < 4096; i++) {
+      pairs[i * 2] = kAlphabet[i >> 6];
+      pairs[i * 2 + 1] = kAlphabet[i & 0x3f];
+    }
+  }
+  char pairs[4096 * 2];
+};
+
+// Decodes 4 characters with one lookup each, every table holds the bits of a
+// character already shifted to its place in the 24 bit group. Characters
+// outside of the alphabet have kInvalid set.
+constexpr std::uint32_t kInvalid = 0x01000000;
+
+struct DecodeTables {
+  constexpr DecodeTables() : values() {
+    for (int position = 0; position < 4; position++) {
+      for (int c = 0; c < 256; c++) {
+        values[position][c] = kInvalid;
+      }
+      for (int i = 0; i < 64; i++) {
+        auto c = static_cast<unsigned char>(kAlphabet[i]);
+        values[position][c] = static_cast<std::uint32_t>(i)
+                              << (18 - 6 * position);
+      }
+    }
+  }
+  std::uint32_t values[4][256];
+};
+
+constexpr EncodeTable kEncodeTable;
+constexpr DecodeTables kDecodeTables;
+
+std::uint32_t DecodeQuad(const unsigned char* in) {
+  return kDecodeTables.values[0][in[0]] | kDecodeTables.values[1][in[1]] |
+         kDecodeTables.values[2][in[2]] | kDecodeTables.values[3][in[3]];
+}
+
+}  // namespace
+
+std::size_t Base64EncodedSize(std::size_t size) {
+  return (size + 2) / 3 * 4;
+}
+
+std::size_t Base64DecodedMaxSize(std::size_t size) {
+  return size / 4 * 3;
+}
+
+void EncodeBase64(const void* data, std::size_t size, char* out) {
+  auto in = reinterpret_cast<const std::uint8_t*>(data);
+  auto end = in + size - size % 3;
+  for (; in != end; in += 3, out += 4) {
+    std::uint32_t group = (in[0] << 16) | (in[1] << 8) | in[2];
+    auto first = &kEncodeTable.pairs[(group >> 12) * 2];
+    auto second = &kEncodeTable.pairs[(group & 0xfff) * 2];
+    out[0] = first[0];
+    out[1] = first[1];
+    out[2] = second[0];
+    out[3] = second[1];
+  }
+  if (size % 3 == 1) {
+    out[0] = kAlphabet[in[0] >> 2];
+    out[1] = kAlphabet[(in[0] & 0x3) << 4];
+    out[2] = '=';
+    out[3] = '=';
+  } else if (size % 3 == 2) {
+    out[0] = kAlphabet[in[0] >> 2];
+    out[1] = kAlphabet[((in[0] & 0x3) << 4) | (in[1] >> 4)];
+    out[2] = kAlphabet[(in[1] & 0xf) << 2];
+    out[3] = '=';
+  }
+}
 
-bool EncodeBase64(const void *data, std::size_t size, std::string *out) {
-  std::size_t enc_len = 0;
-  auto len_res = EVP_EncodedLength(&enc_len, size);
-  if (!len_res) {
+bool DecodeBase64(const char* data, std::size_t size, std::uint8_t* out,
+                  std::size_t* decoded_size) {
+  if (size % 4 != 0) {
+    return false;
+  }
+  *decoded_size = 0;
+  if (size == 0) {
+    return true;
+  }
+  auto in = reinterpret_cast<const unsigned char*>(data);
+  auto last = in + size - 4;
+  auto begin = out;
+  // Errors are accumulated and checked once, valid input is the common case
+  std::uint32_t errors = 0;
+  for (; in != last; in += 4, out += 3) {
+    auto group = DecodeQuad(in);
+    errors |= group;
+    out[0] = group >> 16;
+    out[1] = group >> 8;
+    out[2] = group;
+  }
+  if ((errors & kInvalid) != 0) {
+    return false;
+  }
+  // Only the last group may have padding
+  unsigned char tail[4] = {in[0], in[1], in[2], in[3]};
+  int padding = 0;
+  if (tail[3] == '=') {
+    padding = tail[2] == '=' ? 2 : 1;
+    tail[3] = 'A';
+    if (padding == 2) {
+      tail[2] = 'A';
+    }
+  }
+  auto group = DecodeQuad(tail);
+  if ((group & kInvalid) != 0) {
     return false;
   }
-  out->resize(enc_len);
-  auto enc_res =
-      EVP_EncodeBlock(reinterpret_cast<std::uint8_t *>(out->data()),
-                      reinterpret_cast<const std::uint8_t *>(data), size);
-  if (enc_res < 0) {
+  // Padded groups must not carry bits that the encoder always leaves unset
+  if ((padding == 1 && (group & 0xff)) || (padding == 2 && (group & 0xffff))) {
     return false;
   }
-  out->resize(enc_res);  // Don't count the terminating \0 character
+  out[0] = group >> 16;
+  if (padding < 2) {
+    out[1] = group >> 8;
+  }
+  if (padding < 1) {
+    out[2] = group;
+  }
+  out += 3 - padding;
+  *decoded_size = out - begin;
   return true;
 }
 
-bool DecodeBase64(const std::string &data, std::vector<std::uint8_t> *buffer) {
-  std::size_t out_len;
-  auto len_res = EVP_DecodedLength(&out_len, data.size());
-  if (!len_res) {
+bool EncodeBase64(const void* data, std::size_t size, std::string* out) {
+  out->resize(Base64EncodedSize(size));
+  EncodeBase64(data, size, out->data());
+  return true;
+}
+
+bool DecodeBase64(const std::string& data, std::vector<std::uint8_t>* buffer) {
+  buffer->resize(Base64DecodedMaxSize(data.size()));
+  std::size_t decoded_size = 0;
+  if (!DecodeBase64(data.data(), data.size(), buffer->data(), &decoded_size)) {
     return false;
   }
-  buffer->resize(out_len);
-  return EVP_DecodeBase64(buffer->data(), &out_len, out_len,
-                          reinterpret_cast<const std::uint8_t *>(data.data()),
-                          data.size());
+  buffer->resize(decoded_size);
+  return true;
 }
 
 }  // namespace cuttlefish
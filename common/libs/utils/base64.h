@@ -27,4 +27,20 @@ bool EncodeBase64(const void* _data, std::size_t size, std::string* out);
 
 bool DecodeBase64(const std::string& data, std::vector<std::uint8_t>* buffer);
 
+// Number of characters in the base64 encoding of `size` bytes.
+std::size_t Base64EncodedSize(std::size_t size);
+
+// Upper bound of the number of bytes encoded by `size` base64 characters.
+std::size_t Base64DecodedMaxSize(std::size_t size);
+
+// Encodes `size` bytes into `out`, which must have room for
+// Base64EncodedSize(size) characters. No terminating '\0' is written.
+void EncodeBase64(const void* data, std::size_t size, char* out);
+
+// Decodes `size` base64 characters into `out`, which must have room for
+// Base64DecodedMaxSize(size) bytes, and stores the number of bytes written in
+// `decoded_size`. Returns false if the input is not valid padded base64.
+bool DecodeBase64(const char* data, std::size_t size, std::uint8_t* out,
+                  std::size_t* decoded_size);
+
 }  // namespace cuttlefish
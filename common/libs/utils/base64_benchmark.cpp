@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares the base64 codec with the BoringSSL one it replaced, on payloads
+// the size of a small message and of a screenshot.
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <openssl/base64.h>
+
+#include "common/libs/utils/base64.h"
+
+namespace cuttlefish {
+namespace {
+
+std::vector<std::uint8_t> Payload(std::size_t size) {
+  std::vector<std::uint8_t> data(size);
+  for (std::size_t i = 0; i < size; i++) {
+    data[i] = static_cast<std::uint8_t>(i * 2654435761u >> 13);
+  }
+  return data;
+}
+
+void BM_Encode(benchmark::State& state) {
+  auto data = Payload(state.range(0));
+  std::string out(Base64EncodedSize(data.size()), '\0');
+  for (auto _ : state) {
+    EncodeBase64(data.data(), data.size(), out.data());
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_Encode)->Arg(256)->Arg(4 << 20);
+
+void BM_EncodeBoringSsl(benchmark::State& state) {
+  auto data = Payload(state.range(0));
+  std::vector<std::uint8_t> out(Base64EncodedSize(data.size()) + 1);
+  for (auto _ : state) {
+    EVP_EncodeBlock(out.data(), data.data(), data.size());
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_EncodeBoringSsl)->Arg(256)->Arg(4 << 20);
+
+void BM_Decode(benchmark::State& state) {
+  auto data = Payload(state.range(0));
+  std::string encoded;
+  EncodeBase64(data.data(), data.size(), &encoded);
+  std::vector<std::uint8_t> out(Base64DecodedMaxSize(encoded.size()));
+  for (auto _ : state) {
+    std::size_t decoded_size;
+    DecodeBase64(encoded.data(), encoded.size(), out.data(), &decoded_size);
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_Decode)->Arg(256)->Arg(4 << 20);
+
+void BM_DecodeBoringSsl(benchmark::State& state) {
+  auto data = Payload(state.range(0));
+  std::string encoded;
+  EncodeBase64(data.data(), data.size(), &encoded);
+  std::vector<std::uint8_t> out(Base64DecodedMaxSize(encoded.size()));
+  for (auto _ : state) {
+    std::size_t decoded_size;
+    EVP_DecodeBase64(out.data(), &decoded_size, out.size(),
+                     reinterpret_cast<const std::uint8_t*>(encoded.data()),
+                     encoded.size());
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_DecodeBoringSsl)->Arg(256)->Arg(4 << 20);
+
+}  // namespace
+}  // namespace cuttlefish
+
+BENCHMARK_MAIN();
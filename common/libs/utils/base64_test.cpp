@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/libs/utils/base64.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+
+static std::string Encode(const std::string& data) {
+  std::string out;
+  EXPECT_TRUE(EncodeBase64(data.data(), data.size(), &out));
+  return out;
+}
+
+static bool Decode(const std::string& data, std::string* out) {
+  std::vector<std::uint8_t> buffer;
+  if (!DecodeBase64(data, &buffer)) {
+    return false;
+  }
+  *out = std::string(buffer.begin(), buffer.end());
+  return true;
+}
+
+TEST(Base64, Rfc4648Vectors) {
+  std::vector<std::pair<std::string, std::string>> vectors = {
+      {"", ""},         {"f", "Zg=="},         {"fo", "Zm8="},
+      {"foo", "Zm9v"},  {"foob", "Zm9vYg=="},  {"fooba", "Zm9vYmE="},
+      {"foobar", "Zm9vYmFy"},
+  };
+  for (const auto& [plain, encoded] : vectors) {
+    ASSERT_EQ(Encode(plain), encoded);
+    std::string decoded;
+    ASSERT_TRUE(Decode(encoded, &decoded)) << encoded;
+    ASSERT_EQ(decoded, plain);
+  }
+}
+
+TEST(Base64, RoundTripsAllBytes) {
+  std::string data;
+  for (int i = 0; i < 1000; i++) {
+    data += static_cast<char>(i * 7);
+  }
+  for (std::size_t size = 0; size < data.size(); size += 97) {
+    std::string decoded;
+    ASSERT_TRUE(Decode(Encode(data.substr(0, size)), &decoded));
+    ASSERT_EQ(decoded, data.substr(0, size));
+  }
+}
+
+TEST(Base64, RejectsInvalidInput) {
+  std::string decoded;
+  ASSERT_FALSE(Decode("Zm9", &decoded));        // Not a multiple of 4
+  ASSERT_FALSE(Decode("Zm9v\nYmFy", &decoded));  // Whitespace
+  ASSERT_FALSE(Decode("Zm=v", &decoded));       // Padding in the middle
+  ASSERT_FALSE(Decode("Zm9*", &decoded));       // Outside of the alphabet
+  ASSERT_FALSE(Decode("Zh==", &decoded));       // Non-zero padding bits
+  ASSERT_FALSE(Decode("Zm9vYmE=Zm9v", &decoded));
+}
+
+TEST(Base64, EncodesIntoCallerBuffer) {
+  std::string data = "foobar";
+  std::string out(Base64EncodedSize(data.size()) + 1, '!');
+  EncodeBase64(data.data(), data.size(), out.data());
+  ASSERT_EQ(out, "Zm9vYmFy!");
+
+  std::vector<std::uint8_t> buffer(Base64DecodedMaxSize(4));
+  std::size_t decoded_size = 0;
+  ASSERT_TRUE(DecodeBase64("Zm8=", 4, buffer.data(), &decoded_size));
+  ASSERT_EQ(decoded_size, 2);
+  ASSERT_EQ(std::string(buffer.begin(), buffer.begin() + 2), "fo");
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace cuttlefish {
+
+// Layout of the persistent memory region the host camera streamer writes
+// frames into for the guest camera HAL to read them in place. The vsock
+// connection then only carries a CameraFrameDescriptor per frame.
+//
+// Each slot is protected by a sequence counter, odd while the host writes to
+// it. Readers check the counter is the same even value before and after
+// reading the frame and discard it otherwise.
+
+constexpr uint32_t kCameraFrameRingMagic = 0x52464643;  // "CFFR"
+constexpr uint32_t kCameraFrameRingVersion = 1;
+constexpr std::size_t kCameraFrameRingHeaderSize = 4096;
+// Big enough for a 1080p I420 frame
+constexpr std::size_t kCameraFrameRingSlotSize = 3112960;
+constexpr uint32_t kCameraFrameRingMaxSlots = 8;
+
+struct CameraFrameSlot {
+  std::atomic<uint32_t> sequence;
+  uint32_t width;
+  uint32_t height;
+  uint32_t size;
+};
+
+struct CameraFrameRingHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slot_count;
+  uint32_t slot_size;
+  CameraFrameSlot slots[kCameraFrameRingMaxSlots];
+};
+static_assert(sizeof(CameraFrameRingHeader) <= kCameraFrameRingHeaderSize);
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+inline uint8_t* CameraFrameRingSlotData(void* ring, uint32_t slot) {
+  return static_cast<uint8_t*>(ring) + kCameraFrameRingHeaderSize +
+         static_cast<std::size_t>(slot) *
+             static_cast<CameraFrameRingHeader*>(ring)->slot_size;
+}
+
+constexpr uint32_t kCameraFrameDescriptorMagic = 0x44524643;  // "CFRD"
+
+// Sent over vsock instead of the frame's contents.
+struct CameraFrameDescriptor {
+  uint32_t magic;
+  uint32_t slot;
+  uint32_t sequence;
+};
+
+inline bool IsCameraFrameDescriptor(const std::vector<char>& message) {
+  uint32_t magic;
+  if (message.size() != sizeof(CameraFrameDescriptor)) {
+    return false;
+  }
+  std::memcpy(&magic, message.data(), sizeof(magic));
+  return magic == kCameraFrameDescriptorMagic;
+}
+
+}  // namespace cuttlefish
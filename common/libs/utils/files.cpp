@@ -22,10 +22,12 @@
 #include <fcntl.h>
 #include <ftw.h>
 #include <libgen.h>
+#include <linux/falloc.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
 #include <cerrno>
 #include <chrono>
@@ -45,6 +47,7 @@
 
 #include <android-base/macros.h>
 
+#include "common/libs/fs/shared_buf.h"
 #include "common/libs/fs/shared_fd.h"
 
 namespace cuttlefish {
@@ -84,6 +87,10 @@ bool DirectoryExists(const std::string& path, bool follow_symlinks) {
 
 Result<void> EnsureDirectoryExists(const std::string& directory_path) {
   if (!DirectoryExists(directory_path)) {
+    auto parent = cpp_dirname(directory_path);
+    if (parent != directory_path && parent != ".") {
+      CF_EXPECT(EnsureDirectoryExists(parent));
+    }
     LOG(DEBUG) << "Setting up " << directory_path;
     if (mkdir(directory_path.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) <
             0 &&
@@ -281,6 +288,72 @@ FileSizes SparseFileSizes(const std::string& path) {
   return (FileSizes) { .sparse_size = farthest_seek, .disk_size = data_bytes };
 }
 
+Result<off_t> PunchHolesInZeroBlocks(const std::string& path) {
+  constexpr off_t kBlockSize = 4096;
+  constexpr size_t kBufferSize = 1 << 20;
+
+  auto fd = SharedFD::Open(path, O_RDWR);
+  CF_EXPECT(fd->IsOpen(),
+            "Could not open \"" << path << "\": " << fd->StrError());
+  off_t file_size = fd->LSeek(0, SEEK_END);
+  CF_EXPECT(file_size != -1,
+            "Could not lseek in \"" << path << "\": " << fd->StrError());
+
+  std::vector<char> buffer(kBufferSize);
+  off_t punched = 0;
+  off_t zero_start = -1;
+  auto punch = [&](off_t end) -> Result<void> {
+    if (zero_start >= 0 && end > zero_start) {
+      int mode = FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+      CF_EXPECT(fd->Fallocate(mode, zero_start, end - zero_start) == 0,
+                "Could not punch hole in \"" << path
+                                              << "\": " << fd->StrError());
+      punched += end - zero_start;
+    }
+    zero_start = -1;
+    return {};
+  };
+
+  // Only data extents are read; existing holes are skipped over.
+  off_t offset = 0;
+  while (offset < file_size) {
+    off_t data = fd->LSeek(offset, SEEK_DATA);
+    if (data == -1 && fd->GetErrno() == ENXIO) {
+      break;
+    }
+    CF_EXPECT(data != -1,
+              "Could not lseek in \"" << path << "\": " << fd->StrError());
+    off_t hole = fd->LSeek(data, SEEK_HOLE);
+    CF_EXPECT(hole != -1,
+              "Could not lseek in \"" << path << "\": " << fd->StrError());
+    // Round inward so only whole blocks are considered
+    off_t extent_start = (data + kBlockSize - 1) / kBlockSize * kBlockSize;
+    off_t extent_end = hole / kBlockSize * kBlockSize;
+
+    for (off_t pos = extent_start; pos < extent_end;) {
+      size_t chunk = std::min<off_t>(kBufferSize, extent_end - pos);
+      CF_EXPECT(fd->LSeek(pos, SEEK_SET) == pos,
+                "Could not lseek in \"" << path << "\": " << fd->StrError());
+      CF_EXPECT(ReadExact(fd, buffer.data(), chunk) == (ssize_t)chunk,
+                "Could not read \"" << path << "\": " << fd->StrError());
+      for (size_t block = 0; block < chunk; block += kBlockSize) {
+        const char* begin = buffer.data() + block;
+        bool zero = std::all_of(begin, begin + kBlockSize,
+                                [](char c) { return c == 0; });
+        if (zero && zero_start < 0) {
+          zero_start = pos + block;
+        } else if (!zero) {
+          CF_EXPECT(punch(pos + block));
+        }
+      }
+      pos += chunk;
+    }
+    CF_EXPECT(punch(extent_end));
+    offset = hole;
+  }
+  return punched;
+}
+
 std::string cpp_basename(const std::string& str) {
   char* copy = strdup(str.c_str()); // basename may modify its argument
   std::string ret(basename(copy));
@@ -54,4 +54,9 @@ struct FileSizes {
   off_t disk_size;
 };
 FileSizes SparseFileSizes(const std::string& path);
+
+// Deallocates every aligned block of `path` that only holds zeroes, keeping
+// the logical size. Returns the number of bytes punched out. The file must
+// not be written concurrently.
+Result<off_t> PunchHolesInZeroBlocks(const std::string& path);
 }  // namespace cuttlefish
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/libs/utils/files.h"
+
+#include <string>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+
+TEST(PunchHolesInZeroBlocks, KeepsContentsAndSize) {
+  TemporaryFile file;
+  std::string contents(4096, 'a');
+  contents += std::string(16 * 4096, '\0');
+  contents += std::string(4096, 'b');
+  ASSERT_TRUE(android::base::WriteStringToFile(contents, file.path));
+  auto before = SparseFileSizes(file.path);
+
+  auto punched = PunchHolesInZeroBlocks(file.path);
+  ASSERT_TRUE(punched.ok()) << punched.error();
+  ASSERT_EQ(*punched, 16 * 4096);
+
+  auto after = SparseFileSizes(file.path);
+  ASSERT_EQ(after.sparse_size, before.sparse_size);
+  ASSERT_LT(after.disk_size, before.disk_size);
+
+  std::string read_back;
+  ASSERT_TRUE(android::base::ReadFileToString(file.path, &read_back));
+  ASSERT_EQ(read_back, contents);
+}
+
+TEST(PunchHolesInZeroBlocks, IgnoresPartialBlocks) {
+  TemporaryFile file;
+  std::string contents(4096, 'a');
+  contents += std::string(100, '\0');
+  ASSERT_TRUE(android::base::WriteStringToFile(contents, file.path));
+
+  auto punched = PunchHolesInZeroBlocks(file.path);
+  ASSERT_TRUE(punched.ok()) << punched.error();
+  ASSERT_EQ(*punched, 0);
+}
+
+}  // namespace cuttlefish
@@ -56,7 +56,7 @@ Flag& Flag::UnvalidatedAlias(const FlagAlias& alias) & {
 }
 Flag Flag::UnvalidatedAlias(const FlagAlias& alias) && {
   aliases_.push_back(alias);
-  return *this;
+  return std::move(*this);
 }
 
 void Flag::ValidateAlias(const FlagAlias& alias) {
@@ -95,7 +95,7 @@ Flag& Flag::Alias(const FlagAlias& alias) & {
 Flag Flag::Alias(const FlagAlias& alias) && {
   ValidateAlias(alias);
   aliases_.push_back(alias);
-  return *this;
+  return std::move(*this);
 }
 
 Flag& Flag::Help(const std::string& help) & {
@@ -104,7 +104,7 @@ Flag& Flag::Help(const std::string& help) & {
 }
 Flag Flag::Help(const std::string& help) && {
   help_ = help;
-  return *this;
+  return std::move(*this);
 }
 
 Flag& Flag::Getter(std::function<std::string()> fn) & {
@@ -113,7 +113,7 @@ Flag& Flag::Getter(std::function<std::string()> fn) & {
 }
 Flag Flag::Getter(std::function<std::string()> fn) && {
   getter_ = std::move(fn);
-  return *this;
+  return std::move(*this);
 }
 
 Flag& Flag::Setter(std::function<bool(const FlagMatch&)> fn) & {
@@ -122,15 +122,15 @@ Flag& Flag::Setter(std::function<bool(const FlagMatch&)> fn) & {
 }
 Flag Flag::Setter(std::function<bool(const FlagMatch&)> fn) && {
   setter_ = std::move(fn);
-  return *this;
+  return std::move(*this);
 }
 
 static bool LikelyFlag(const std::string& next_arg) {
   return android::base::StartsWith(next_arg, "-");
 }
 
-Flag::FlagProcessResult Flag::Process(
-    const std::string& arg, const std::optional<std::string>& next_arg) const {
+Flag::FlagProcessResult Flag::Process(const std::string& arg,
+                                      const std::string* next_arg) const {
   if (!setter_ && aliases_.size() > 0) {
     LOG(ERROR) << "No setter for flag with alias " << aliases_[0].name;
     return FlagProcessResult::kFlagError;
@@ -195,29 +195,48 @@ Flag::FlagProcessResult Flag::Process(
 }
 
 bool Flag::Parse(std::vector<std::string>& arguments) const {
-  for (int i = 0; i < arguments.size();) {
-    std::string arg = arguments[i];
-    std::optional<std::string> next_arg;
-    if (i < arguments.size() - 1) {
-      next_arg = arguments[i + 1];
+  // Every flag of a tool goes over every argument, so the arguments aren't
+  // copied to be matched and the unmatched ones are compacted in a single
+  // pass instead of erasing each match from the middle of the vector.
+  std::size_t kept = 0;
+  std::size_t i = 0;
+  // Arguments between i and next were consumed as values of arguments[i]
+  std::size_t next = 1;
+  auto keep = [&arguments, &kept](std::size_t index) {
+    if (kept != index) {
+      arguments[kept] = std::move(arguments[index]);
     }
-    auto result = Process(arg, next_arg);
+    kept++;
+  };
+  while (i < arguments.size()) {
+    const std::string* next_arg =
+        next < arguments.size() ? &arguments[next] : nullptr;
+    auto result = Process(arguments[i], next_arg);
     if (result == FlagProcessResult::kFlagError) {
+      keep(i);
+      for (std::size_t j = next; j < arguments.size(); j++) {
+        keep(j);
+      }
+      arguments.resize(kept);
       return false;
     } else if (result == FlagProcessResult::kFlagConsumed) {
-      arguments.erase(arguments.begin() + i);
+      i = next;
     } else if (result == FlagProcessResult::kFlagConsumedWithFollowing) {
-      arguments.erase(arguments.begin() + i, arguments.begin() + i + 2);
+      i = next + 1;
     } else if (result == FlagProcessResult::kFlagConsumedOnlyFollowing) {
-      arguments.erase(arguments.begin() + i + 1, arguments.begin() + i + 2);
-    } else if (result == FlagProcessResult::kFlagSkip) {
-      i++;
+      // The same argument is matched again against the one after
+      next++;
       continue;
+    } else if (result == FlagProcessResult::kFlagSkip) {
+      keep(i);
+      i = next;
     } else {
       LOG(ERROR) << "Unknown FlagProcessResult: " << (int)result;
       return false;
     }
+    next = i + 1;
   }
+  arguments.resize(kept);
   return true;
 }
 bool Flag::Parse(std::vector<std::string>&& arguments) const {
@@ -107,9 +107,9 @@ class Flag {
   Flag& UnvalidatedAlias(const FlagAlias& alias) &;
   Flag UnvalidatedAlias(const FlagAlias& alias) &&;
 
-  /* Attempt to match a single argument. */
+  /* Attempt to match a single argument. `next_arg` is null for the last one. */
   FlagProcessResult Process(const std::string& argument,
-                            const std::optional<std::string>& next_arg) const;
+                            const std::string* next_arg) const;
 
   bool HasAlias(const FlagAlias&) const;
 
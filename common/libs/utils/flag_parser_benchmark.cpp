@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures what a short lived host tool spends on its flags at startup:
+// defining them and parsing a command line that sets a few of them.
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "common/libs/utils/flag_parser.h"
+
+namespace cuttlefish {
+namespace {
+
+// Values outlive the flags, as the globals of a tool would
+struct Values {
+  std::deque<std::string> strings;
+  std::deque<std::int32_t> ints;
+  std::deque<bool> bools;
+};
+
+// A third of each type, like the tools mixing paths, counts and switches.
+std::vector<Flag> DefineFlags(int count, Values& values) {
+  std::vector<Flag> flags;
+  for (int i = 0; i < count; i++) {
+    auto name = "flag_" + std::to_string(i);
+    switch (i % 3) {
+      case 0:
+        flags.emplace_back(
+            GflagsCompatFlag(name, values.strings.emplace_back()));
+        break;
+      case 1:
+        flags.emplace_back(GflagsCompatFlag(name, values.ints.emplace_back()));
+        break;
+      default:
+        flags.emplace_back(GflagsCompatFlag(name, values.bools.emplace_back()));
+    }
+  }
+  return flags;
+}
+
+// Sets every fourth flag in one of the forms it accepts.
+std::vector<std::string> CommandLine(int count) {
+  std::vector<std::string> args;
+  for (int i = 0; i < count; i += 4) {
+    auto name = "flag_" + std::to_string(i);
+    switch (i % 3) {
+      case 0:
+        args.emplace_back("--" + name + "=/some/path/" + name);
+        break;
+      case 1:
+        args.emplace_back("--" + name);
+        args.emplace_back(std::to_string(i));
+        break;
+      default:
+        args.emplace_back("--no" + name);
+    }
+  }
+  args.emplace_back("positional");
+  return args;
+}
+
+void BM_DefineFlags(benchmark::State& state) {
+  for (auto _ : state) {
+    Values values;
+    auto flags = DefineFlags(state.range(0), values);
+    benchmark::DoNotOptimize(flags.data());
+  }
+}
+BENCHMARK(BM_DefineFlags)->Arg(10)->Arg(100);
+
+void BM_ParseFlags(benchmark::State& state) {
+  Values values;
+  auto flags = DefineFlags(state.range(0), values);
+  const auto command_line = CommandLine(state.range(0));
+  for (auto _ : state) {
+    auto args = command_line;
+    benchmark::DoNotOptimize(ParseFlags(flags, args));
+  }
+  state.SetItemsProcessed(state.iterations() * command_line.size());
+}
+BENCHMARK(BM_ParseFlags)->Arg(10)->Arg(100);
+
+}  // namespace
+}  // namespace cuttlefish
+
+BENCHMARK_MAIN();
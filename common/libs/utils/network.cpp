@@ -43,6 +43,7 @@
 #include <utility>
 #include <vector>
 
+#include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/strings.h>
 
@@ -109,6 +110,10 @@ SharedFD OpenTapInterface(const std::string& interface_name) {
   struct ifreq ifr;
   memset(&ifr, 0, sizeof(ifr));
   ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_VNET_HDR;
+  // the kernel refuses to attach to a multiqueue tap without the flag
+  if (IsMultiQueueTap(interface_name)) {
+    ifr.ifr_flags |= IFF_MULTI_QUEUE;
+  }
   strncpy(ifr.ifr_name, interface_name.c_str(), IFNAMSIZ);
 
   int err = tap_fd->Ioctl(TUNSETIFF, &ifr);
@@ -131,6 +136,15 @@ SharedFD OpenTapInterface(const std::string& interface_name) {
   return tap_fd;
 }
 
+bool IsMultiQueueTap(const std::string& interface_name) {
+  std::string flags;
+  if (!android::base::ReadFileToString(
+          "/sys/class/net/" + interface_name + "/tun_flags", &flags)) {
+    return false;
+  }
+  return std::strtoul(flags.c_str(), nullptr, 16) & IFF_MULTI_QUEUE;
+}
+
 std::set<std::string> TapInterfacesInUse() {
   Command cmd("/bin/bash");
   cmd.AddParameter("-c");
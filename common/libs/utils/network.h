@@ -27,8 +27,13 @@ namespace cuttlefish {
 // Creates, or connects to if it already exists, a tap network interface. The
 // user needs CAP_NET_ADMIN to create such interfaces or be the owner to connect
 // to one.
+// Multiqueue taps are opened as such, giving the first queue.
 SharedFD OpenTapInterface(const std::string& interface_name);
 
+// Whether the tap interface was created with multiqueue support, which lets a
+// VMM attach one queue per virtio-net queue pair.
+bool IsMultiQueueTap(const std::string& interface_name);
+
 // Returns a list of TAP devices that have open file descriptors
 std::set<std::string> TapInterfacesInUse();
 
@@ -14,45 +14,290 @@
  * limitations under the License.
  */
 
+
 #include "common/libs/utils/socket2socket_proxy.h"
 
+#include <fcntl.h>
 #include <sys/socket.h>
 
+#include <algorithm>
 #include <cstring>
 #include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include <android-base/logging.h>
 
+#include "common/libs/fs/epoll.h"
+
 namespace cuttlefish {
 namespace {
 
-void Forward(const std::string& label, SharedFD from, SharedFD to) {
-  auto success = to->CopyAllFrom(*from);
-  if (!success) {
-    if (from->GetErrno()) {
-      LOG(ERROR) << label << ": Error reading: " << from->StrError();
+// The default capacity of a pipe, so a splice into an empty pipe never blocks
+constexpr std::size_t kChunkSize = 1 << 16;
+// Keeps a busy connection from starving the others handled by the same thread
+constexpr int kMaxChunksPerWakeup = 16;
+
+// One direction of a connection. Data moves from one socket into a pipe and
+// from the pipe into the other socket with splice(2), without being copied to
+// user space. Sockets the kernel can't splice fall back to a buffer. Nothing is
+// read while there is data the destination hasn't taken yet.
+class Forwarder {
+ public:
+  Forwarder(std::string label, SharedFD from, SharedFD to)
+      : label_(label), from_(from), to_(to) {
+    if (!SharedFD::Pipe(&pipe_read_, &pipe_write_)) {
+      LOG(DEBUG) << label_ << ": Failed to create a pipe, not splicing";
+      StopSplicing();
+    }
+  }
+
+  // Moves all it can without blocking
+  void Pump() {
+    for (int i = 0; i < kMaxChunksPerWakeup && !Done(); i++) {
+      if (pending_ == 0 && !read_done_) {
+        Read();
+      }
+      if (pending_ == 0 || !Write()) {
+        break;
+      }
     }
-    if (to->GetErrno()) {
-      LOG(ERROR) << label << ": Error writing: " << to->StrError();
+    if (read_done_ && pending_ == 0 && !shut_down_) {
+      to_->Shutdown(SHUT_WR);
+      shut_down_ = true;
+      LOG(DEBUG) << label_ << " completed";
     }
   }
-  to->Shutdown(SHUT_WR);
-  LOG(DEBUG) << label << " completed";
-}
 
-void SetupProxying(SharedFD client, SharedFD target) {
-  std::thread([client, target]() {
-    std::thread client2target(Forward, "client2target", client, target);
-    Forward("target2client", target, client);
-    client2target.join();
-    // The actual proxying is handled in a detached thread so that this function
-    // returns immediately
-  }).detach();
-}
+  bool WantsRead() const { return !read_done_ && pending_ == 0; }
+  bool WantsWrite() const { return pending_ > 0; }
+  bool Done() const { return shut_down_; }
+
+ private:
+  void Read() {
+    ssize_t read;
+    if (splice_) {
+      read = from_->Splice(*pipe_write_, kChunkSize,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (read < 0 && from_->GetErrno() == EINVAL) {
+        StopSplicing();
+        Read();
+        return;
+      }
+    } else {
+      read = from_->Read(buffer_.data(), buffer_.size());
+    }
+    if (read > 0) {
+      pending_ = read;
+      buffer_start_ = 0;
+    } else if (read == 0) {
+      read_done_ = true;
+    } else if (from_->GetErrno() != EAGAIN) {
+      LOG(ERROR) << label_ << ": Error reading: " << from_->StrError();
+      read_done_ = true;
+    }
+  }
+
+  // Returns false if the destination isn't taking more
+  bool Write() {
+    ssize_t written;
+    if (splice_) {
+      written = pipe_read_->Splice(*to_, pending_,
+                                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (written < 0 && pipe_read_->GetErrno() == EINVAL) {
+        StopSplicing();
+        return Write();
+      }
+    } else {
+      written = to_->Write(buffer_.data() + buffer_start_, pending_);
+    }
+    if (written > 0) {
+      pending_ -= written;
+      buffer_start_ += written;
+      return true;
+    }
+    // Splice sets the error on the pipe, even when it comes from the socket
+    auto& error_fd = splice_ ? pipe_read_ : to_;
+    if (written < 0 && error_fd->GetErrno() == EAGAIN) {
+      return false;
+    }
+    LOG(ERROR) << label_ << ": Error writing: " << error_fd->StrError();
+    // Nothing else will make it to the other side
+    pending_ = 0;
+    read_done_ = true;
+    return false;
+  }
+
+  void StopSplicing() {
+    splice_ = false;
+    buffer_.resize(kChunkSize);
+    buffer_start_ = 0;
+    // Take back what is already in the pipe
+    if (pending_ > 0) {
+      auto read = pipe_read_->Read(buffer_.data(), pending_);
+      pending_ = std::max<ssize_t>(read, 0);
+    }
+  }
+
+  std::string label_;
+  SharedFD from_;
+  SharedFD to_;
+  SharedFD pipe_read_;
+  SharedFD pipe_write_;
+  bool splice_ = true;
+  std::vector<char> buffer_;
+  std::size_t buffer_start_ = 0;
+  // In the pipe or the buffer
+  std::size_t pending_ = 0;
+  bool read_done_ = false;
+  bool shut_down_ = false;
+};
+
+struct Connection {
+  Connection(SharedFD client, SharedFD target)
+      : client(client),
+        target(target),
+        client2target("client2target", client, target),
+        target2client("target2client", target, client) {}
+
+  SharedFD client;
+  SharedFD target;
+  // Events for either socket are handled by one thread at a time
+  std::mutex mutex;
+  Forwarder client2target;
+  Forwarder target2client;
+  bool closed = false;
+};
+
+// Forwards the data of every proxied connection of the process with a few
+// threads waiting on the same epoll instance. The sockets are registered with
+// EPOLLONESHOT and re-armed with the events the connection currently needs,
+// so a connection that can't write stops being read.
+class ProxyLoop {
+ public:
+  static ProxyLoop& Get() {
+    static auto loop = new ProxyLoop();
+    return *loop;
+  }
+
+  void Add(SharedFD client, SharedFD target) {
+    for (auto fd : {client, target}) {
+      auto flags = fd->Fcntl(F_GETFL, 0);
+      if (flags < 0 || fd->Fcntl(F_SETFL, flags | O_NONBLOCK) < 0) {
+        LOG(ERROR) << "Failed to make the socket non-blocking: "
+                   << fd->StrError();
+        return;
+      }
+    }
+    auto connection = std::make_shared<Connection>(client, target);
+    {
+      std::lock_guard lock(connections_mutex_);
+      connections_[client] = connection;
+      connections_[target] = connection;
+    }
+    std::lock_guard lock(connection->mutex);
+    for (auto fd : {client, target}) {
+      auto result = epoll_.Add(fd, EPOLLONESHOT);
+      if (!result.ok()) {
+        LOG(ERROR) << "Failed to watch the socket: " << result.error();
+        Close(*connection);
+        return;
+      }
+    }
+    Handle(*connection);
+  }
+
+ private:
+  ProxyLoop() {
+    auto epoll = Epoll::Create();
+    CHECK(epoll.ok()) << epoll.error();
+    epoll_ = std::move(*epoll);
+    auto threads = std::clamp(std::thread::hardware_concurrency() / 2, 1u, 4u);
+    for (unsigned int i = 0; i < threads; i++) {
+      std::thread([this]() { Run(); }).detach();
+    }
+  }
+
+  [[noreturn]] void Run() {
+    while (true) {
+      auto event = epoll_.Wait();
+      if (!event.ok()) {
+        LOG(ERROR) << "Failed to wait for proxied connections: "
+                   << event.error();
+        continue;
+      }
+      if (!*event) {
+        continue;
+      }
+      std::shared_ptr<Connection> connection;
+      {
+        std::lock_guard lock(connections_mutex_);
+        auto it = connections_.find((*event)->fd);
+        if (it == connections_.end()) {
+          continue;
+        }
+        connection = it->second;
+      }
+      std::lock_guard lock(connection->mutex);
+      if (!connection->closed) {
+        Handle(*connection);
+      }
+    }
+  }
+
+  // Called with the connection's lock held
+  void Handle(Connection& connection) {
+    connection.client2target.Pump();
+    connection.target2client.Pump();
+    if (connection.client2target.Done() && connection.target2client.Done()) {
+      Close(connection);
+      return;
+    }
+    auto events = [](const Forwarder& reader, const Forwarder& writer) {
+      return (reader.WantsRead() ? EPOLLIN : 0) |
+             (writer.WantsWrite() ? EPOLLOUT : 0) | EPOLLONESHOT;
+    };
+    auto client_events =
+        events(connection.client2target, connection.target2client);
+    auto target_events =
+        events(connection.target2client, connection.client2target);
+    for (auto [fd, fd_events] :
+         {std::make_pair(connection.client, client_events),
+          std::make_pair(connection.target, target_events)}) {
+      if (fd_events == EPOLLONESHOT) {
+        // Left disarmed, re-arming would only report hang ups in a loop until
+        // the other socket lets the connection make progress
+        continue;
+      }
+      auto result = epoll_.Modify(fd, fd_events);
+      if (!result.ok()) {
+        LOG(ERROR) << "Failed to watch the socket: " << result.error();
+        Close(connection);
+        return;
+      }
+    }
+  }
+
+  void Close(Connection& connection) {
+    connection.closed = true;
+    for (auto fd : {connection.client, connection.target}) {
+      // Fails if it was never added
+      epoll_.Delete(fd);
+    }
+    std::lock_guard lock(connections_mutex_);
+    connections_.erase(connection.client);
+    connections_.erase(connection.target);
+  }
+
+  Epoll epoll_;
+  std::mutex connections_mutex_;
+  std::map<SharedFD, std::shared_ptr<Connection>> connections_;
+};
 
 }  // namespace
 
@@ -66,7 +311,7 @@ void Proxy(SharedFD server, std::function<SharedFD()> conn_factory) {
     }
     auto target = conn_factory();
     if (target->IsOpen()) {
-      SetupProxying(client, target);
+      ProxyLoop::Get().Add(client, target);
     }
     // The client will close when it goes out of scope here if the target didn't
     // open.
@@ -24,7 +24,8 @@ namespace cuttlefish {
 // Executes a TCP proxy
 // Accept() is called on the server in a loop, for every client connection a
 // target connection is created through the conn_factory callback and data is
-// forwarded between the two connections.
+// forwarded between the two connections. The connections of every proxy in the
+// process are served by a few shared threads.
 // This function is meant to execute forever, but will return if the server is
 // closed in another thread. It's recommended the caller disables the default
 // behavior for SIGPIPE before calling this function, otherwise it runs the risk
@@ -17,17 +17,24 @@
 #include "common/libs/utils/subprocess.h"
 
 #include <fcntl.h>
+#include <sched.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/prctl.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include <cerrno>
 #include <cstring>
+#include <future>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
 #include <ostream>
 #include <set>
 #include <sstream>
@@ -39,11 +46,17 @@
 #include <android-base/logging.h>
 #include <android-base/strings.h>
 
+#include "common/libs/fs/epoll.h"
 #include "common/libs/fs/shared_buf.h"
 #include "common/libs/utils/files.h"
+#include "common/libs/utils/tracing.h"
 
 extern char** environ;
 
+#ifndef PR_SET_MEMORY_MERGE
+#define PR_SET_MEMORY_MERGE 67
+#endif
+
 namespace cuttlefish {
 namespace {
 
@@ -70,14 +83,6 @@ bool validate_redirects(
   return true;
 }
 
-void do_redirects(const std::map<Subprocess::StdIOChannel, int>& redirects) {
-  for (const auto& entry : redirects) {
-    auto std_channel = static_cast<int>(entry.first);
-    auto fd = entry.second;
-    TEMP_FAILURE_RETRY(dup2(fd, std_channel));
-  }
-}
-
 std::vector<const char*> ToCharPointers(const std::vector<std::string>& vect) {
   std::vector<const char*> ret = {};
   for (const auto& str : vect) {
@@ -86,6 +91,178 @@ std::vector<const char*> ToCharPointers(const std::vector<std::string>& vect) {
   ret.push_back(NULL);
   return ret;
 }
+
+// Finds the executable the way execvp does, with the PATH of this process.
+// Done before starting the child because the child may not allocate memory.
+std::string ResolveExecutable(const std::string& name) {
+  if (name.empty() || name.find('/') != std::string::npos) {
+    return name;
+  }
+  const char* path = getenv("PATH");
+  for (const auto& dir :
+       android::base::Split(path ? path : "/bin:/usr/bin", ":")) {
+    auto candidate = (dir.empty() ? "." : dir) + "/" + name;
+    struct stat st;
+    if (stat(candidate.c_str(), &st) == 0 && S_ISREG(st.st_mode) &&
+        access(candidate.c_str(), X_OK) == 0) {
+      return candidate;
+    }
+  }
+  // Let exec fail with the usual error
+  return name;
+}
+
+// Failures in the child before exec, the parent logs them
+struct ChildErrors {
+  int setpgid_errno = 0;
+  int cgroup_errno = 0;
+  int merge_errno = 0;
+  int affinity_errno = 0;
+  int fcntl_errno = 0;
+  int fchdir_errno = 0;
+  int exec_errno = 0;
+};
+
+// Everything the child needs, prepared by the parent. The child shares the
+// parent's memory until it calls exec, so it can only make system calls and
+// report failures through `errors`.
+struct SpawnArgs {
+  const char* path;
+  char* const* argv;
+  char* const* envp;
+  std::vector<int> redirect_pairs;  // fd, channel, fd, channel, ...
+  std::vector<int> inherited_fds;
+  int working_directory;
+  int cgroup_procs;
+  bool exit_with_parent;
+  bool in_group;
+  bool mergeable_memory;
+  // Empty to keep the parent's
+  std::optional<cpu_set_t> cpu_affinity;
+  sigset_t parent_mask;
+
+  // Written by the child, in memory shared with the parent even if the child
+  // was forked.
+  volatile ChildErrors* errors = nullptr;
+};
+
+int SpawnChild(void* data) {
+  auto args = reinterpret_cast<SpawnArgs*>(data);
+  // Signal handlers of the parent would run on its memory, restore the
+  // defaults before unblocking signals.
+  for (int sig = 1; sig < NSIG; sig++) {
+    struct sigaction action;
+    if (sigaction(sig, nullptr, &action) == 0 &&
+        action.sa_handler != SIG_DFL && action.sa_handler != SIG_IGN) {
+      action.sa_handler = SIG_DFL;
+      action.sa_flags = 0;
+      sigaction(sig, &action, nullptr);
+    }
+  }
+  sigprocmask(SIG_SETMASK, &args->parent_mask, nullptr);
+
+  if (args->exit_with_parent) {
+    prctl(PR_SET_PDEATHSIG, SIGHUP); // Die when parent dies
+  }
+  for (size_t i = 0; i + 1 < args->redirect_pairs.size(); i += 2) {
+    TEMP_FAILURE_RETRY(
+        dup2(args->redirect_pairs[i], args->redirect_pairs[i + 1]));
+  }
+  if (args->in_group && setpgid(0, 0) != 0) {
+    args->errors->setpgid_errno = errno;
+  }
+  // "0" stands for the writing process
+  if (args->cgroup_procs >= 0 && write(args->cgroup_procs, "0", 1) != 1) {
+    args->errors->cgroup_errno = errno;
+  }
+  if (args->mergeable_memory &&
+      prctl(PR_SET_MEMORY_MERGE, 1, 0, 0, 0) != 0) {
+    args->errors->merge_errno = errno;
+  }
+  if (args->cpu_affinity &&
+      sched_setaffinity(0, sizeof(cpu_set_t), &*args->cpu_affinity) != 0) {
+    args->errors->affinity_errno = errno;
+  }
+  for (int fd : args->inherited_fds) {
+    if (fcntl(fd, F_SETFD, 0)) {
+      args->errors->fcntl_errno = errno;
+    }
+  }
+  if (args->working_directory >= 0 && fchdir(args->working_directory) != 0) {
+    args->errors->fchdir_errno = errno;
+  }
+  execve(args->path, args->argv, args->envp);
+  args->errors->exec_errno = errno;
+  _exit(-1);
+}
+
+// Starts the child with fork(). The child reports its errors through shared
+// memory, and its end of the pipe closing on exec or exit tells the parent when
+// they are final.
+pid_t ForkChild(SpawnArgs* args) {
+  int done[2];
+  if (pipe2(done, O_CLOEXEC) != 0) {
+    return -1;
+  }
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(done[0]);
+    SpawnChild(args);
+  }
+  int fork_errno = errno;
+  close(done[1]);
+  if (pid > 0) {
+    char unused;
+    while (TEMP_FAILURE_RETRY(read(done[0], &unused, 1)) > 0) {
+    }
+  }
+  close(done[0]);
+  errno = fork_errno;
+  return pid;
+}
+
+// Starts the child with clone(CLONE_VM | CLONE_VFORK) rather than fork(): the
+// page tables of the (potentially huge) parent are not copied and the parent
+// resumes as soon as the child calls exec. Returns -1 with errno set if the
+// child couldn't be created. Falls back to fork() if clone() is not allowed.
+//
+// Settings of the whole address space, like PR_SET_MEMORY_MERGE, would land on
+// this process if the child shared its memory, children that need them are
+// always forked.
+pid_t Spawn(SpawnArgs* args) {
+  auto errors = mmap(nullptr, sizeof(ChildErrors), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (errors == MAP_FAILED) {
+    return -1;
+  }
+  args->errors = new (errors) ChildErrors();
+  // Enough for the few system calls the child makes
+  constexpr size_t kStackSize = 64 * 1024;
+  void* stack = args->mergeable_memory
+                    ? MAP_FAILED
+                    : mmap(nullptr, kStackSize, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  // Block signals so that no handler runs in the child before it resets them
+  sigset_t all_signals;
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &args->parent_mask);
+  pid_t pid = -1;
+  if (stack != MAP_FAILED) {
+    // The stack grows down on every architecture the host tools are built for
+    pid = clone(SpawnChild, reinterpret_cast<char*>(stack) + kStackSize,
+                CLONE_VM | CLONE_VFORK | SIGCHLD, args);
+  }
+  if (pid == -1) {
+    pid = ForkChild(args);
+  }
+  int spawn_errno = errno;
+  pthread_sigmask(SIG_SETMASK, &args->parent_mask, nullptr);
+  if (stack != MAP_FAILED) {
+    munmap(stack, kStackSize);
+  }
+  errno = spawn_errno;
+  return pid;
+}
 }  // namespace
 
 SubprocessOptions& SubprocessOptions::Verbose(bool verbose) & {
@@ -115,6 +292,26 @@ SubprocessOptions SubprocessOptions::InGroup(bool in_group) && {
   return *this;
 }
 
+SubprocessOptions& SubprocessOptions::MergeableMemory(
+    bool mergeable_memory) & {
+  mergeable_memory_ = mergeable_memory;
+  return *this;
+}
+SubprocessOptions SubprocessOptions::MergeableMemory(
+    bool mergeable_memory) && {
+  mergeable_memory_ = mergeable_memory;
+  return *this;
+}
+
+SubprocessOptions& SubprocessOptions::Cgroup(SharedFD cgroup_procs) & {
+  cgroup_procs_ = std::move(cgroup_procs);
+  return *this;
+}
+SubprocessOptions SubprocessOptions::Cgroup(SharedFD cgroup_procs) && {
+  cgroup_procs_ = std::move(cgroup_procs);
+  return *this;
+}
+
 Subprocess::Subprocess(Subprocess&& subprocess)
     : pid_(subprocess.pid_),
       started_(subprocess.started_),
@@ -287,49 +484,99 @@ Command Command::SetWorkingDirectory(SharedFD dirfd) && {
   return std::move(*this);
 }
 
+Command& Command::SetCpuAffinity(std::vector<int> cpus) & {
+  cpu_affinity_ = std::move(cpus);
+  return *this;
+}
+Command Command::SetCpuAffinity(std::vector<int> cpus) && {
+  cpu_affinity_ = std::move(cpus);
+  return std::move(*this);
+}
+
 Subprocess Command::Start(SubprocessOptions options) const {
+  CF_TRACE_DETAIL("spawn", command_[0]);
   auto cmd = ToCharPointers(command_);
 
   if (!validate_redirects(redirects_, inherited_fds_)) {
     return Subprocess(-1, {});
   }
 
-  pid_t pid = fork();
-  if (!pid) {
-    if (options.ExitWithParent()) {
-      prctl(PR_SET_PDEATHSIG, SIGHUP); // Die when parent dies
+  auto path = ResolveExecutable(command_[0]);
+  auto envp = ToCharPointers(env_);
+  SpawnArgs args;
+  args.path = path.c_str();
+  args.argv = const_cast<char* const*>(cmd.data());
+  args.envp = const_cast<char* const*>(envp.data());
+  for (const auto& entry : redirects_) {
+    args.redirect_pairs.push_back(entry.second);
+    args.redirect_pairs.push_back(static_cast<int>(entry.first));
+  }
+  for (const auto& entry : inherited_fds_) {
+    args.inherited_fds.push_back(entry.second);
+  }
+  args.working_directory = -1;
+  if (working_directory_->IsOpen()) {
+    args.working_directory = working_directory_->UNMANAGED_Dup();
+    fcntl(args.working_directory, F_SETFD, FD_CLOEXEC);
+  }
+  args.cgroup_procs = -1;
+  if (options.Cgroup()->IsOpen()) {
+    args.cgroup_procs = options.Cgroup()->UNMANAGED_Dup();
+    fcntl(args.cgroup_procs, F_SETFD, FD_CLOEXEC);
+  }
+  args.exit_with_parent = options.ExitWithParent();
+  args.in_group = options.InGroup();
+  args.mergeable_memory = options.MergeableMemory();
+  if (!cpu_affinity_.empty()) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu : cpu_affinity_) {
+      CPU_SET(cpu, &cpus);
     }
+    args.cpu_affinity = cpus;
+  }
 
-    do_redirects(redirects_);
-    if (options.InGroup()) {
-      // This call should never fail (see SETPGID(2))
-      if (setpgid(0, 0) != 0) {
-        auto error = errno;
-        LOG(ERROR) << "setpgid failed (" << strerror(error) << ")";
-      }
+  pid_t pid = Spawn(&args);
+  int spawn_errno = errno;
+  if (args.working_directory >= 0) {
+    close(args.working_directory);
+  }
+  if (args.cgroup_procs >= 0) {
+    close(args.cgroup_procs);
+  }
+  // The child has called exec or exited by now
+  if (args.errors) {
+    ChildErrors errors = const_cast<ChildErrors&>(*args.errors);
+    munmap(const_cast<ChildErrors*>(args.errors), sizeof(ChildErrors));
+    if (errors.setpgid_errno) {
+      LOG(ERROR) << "setpgid failed (" << strerror(errors.setpgid_errno) << ")";
     }
-    for (const auto& entry : inherited_fds_) {
-      if (fcntl(entry.second, F_SETFD, 0)) {
-        int error_num = errno;
-        LOG(ERROR) << "fcntl failed: " << strerror(error_num);
-      }
+    if (errors.cgroup_errno) {
+      LOG(ERROR) << "Joining the cgroup failed: "
+                 << strerror(errors.cgroup_errno);
     }
-    if (working_directory_->IsOpen()) {
-      if (SharedFD::Fchdir(working_directory_) != 0) {
-        LOG(ERROR) << "Fchdir failed: " << working_directory_->StrError();
-      }
+    if (errors.merge_errno) {
+      LOG(WARNING) << "Memory of " << cmd[0]
+                   << " is not mergeable, PR_SET_MEMORY_MERGE failed ("
+                   << strerror(errors.merge_errno) << ")";
+    }
+    if (errors.affinity_errno) {
+      LOG(ERROR) << "sched_setaffinity failed: "
+                 << strerror(errors.affinity_errno);
+    }
+    if (errors.fcntl_errno) {
+      LOG(ERROR) << "fcntl failed: " << strerror(errors.fcntl_errno);
+    }
+    if (errors.fchdir_errno) {
+      LOG(ERROR) << "Fchdir failed: " << strerror(errors.fchdir_errno);
+    }
+    if (errors.exec_errno) {
+      LOG(ERROR) << "exec of " << cmd[0] << " failed ("
+                 << strerror(errors.exec_errno) << ")";
     }
-    int rval;
-    auto envp = ToCharPointers(env_);
-    rval = execvpe(cmd[0], const_cast<char* const*>(cmd.data()),
-                   const_cast<char* const*>(envp.data()));
-    // No need for an if: if exec worked it wouldn't have returned
-    LOG(ERROR) << "exec of " << cmd[0] << " failed (" << strerror(errno)
-               << ")";
-    exit(rval);
   }
   if (pid == -1) {
-    LOG(ERROR) << "fork failed (" << strerror(errno) << ")";
+    LOG(ERROR) << "fork failed (" << strerror(spawn_errno) << ")";
   }
   if (options.Verbose()) { // "more verbose", and LOG(DEBUG) > LOG(VERBOSE)
     LOG(DEBUG) << "Started (pid: " << pid << "): " << cmd[0];
@@ -359,107 +606,268 @@ std::string Command::AsBashScript(
   return contents;
 }
 
-// A class that waits for threads to exit in its destructor.
-class ThreadJoiner {
-std::vector<std::thread*> threads_;
-public:
-  ThreadJoiner(const std::vector<std::thread*> threads) : threads_(threads) {}
-  ~ThreadJoiner() {
-    for (auto& thread : threads_) {
-      if (thread->joinable()) {
-        thread->join();
+namespace {
+
+// The state of a command started by RunWithManagedStdioAsync. Only touched by
+// the ManagedStdioLoop thread once registered, except for the exit code when
+// the process can't be watched with a pidfd.
+struct ManagedStdioRun {
+  ManagedStdioRun(Subprocess subprocess, std::string name)
+      : subprocess(std::move(subprocess)), name(std::move(name)) {}
+
+  Subprocess subprocess;
+  std::string name;
+  std::promise<int> promise;
+
+  SharedFD stdin_fd;
+  const std::string* stdin_str = nullptr;
+  size_t stdin_written = 0;
+  SharedFD stdout_fd;
+  std::string* stdout_str = nullptr;
+  SharedFD stderr_fd;
+  std::string* stderr_str = nullptr;
+  SharedFD pid_fd;
+
+  bool io_error = false;
+  std::optional<int> exit_code;
+};
+
+// Services the stdio pipes of every command run with RunWithManagedStdioAsync
+// from a single thread, and resolves their futures once the process exits.
+class ManagedStdioLoop {
+ public:
+  static ManagedStdioLoop& Get() {
+    static auto loop = new ManagedStdioLoop();
+    return *loop;
+  }
+
+  void Add(std::shared_ptr<ManagedStdioRun> run) {
+    std::lock_guard lock(mutex_);
+    // Waits with a pidfd so that a process that closes its output before
+    // exiting doesn't block the loop. Without pidfd support a thread waits for
+    // it once its pipes are drained.
+    run->pid_fd = SharedFD::PidFdOpen(run->subprocess.pid());
+    for (auto [fd, events] : {std::make_pair(run->stdin_fd, EPOLLOUT),
+                              std::make_pair(run->stdout_fd, EPOLLIN),
+                              std::make_pair(run->stderr_fd, EPOLLIN),
+                              std::make_pair(run->pid_fd, EPOLLIN)}) {
+      if (!fd->IsOpen()) {
+        continue;
+      }
+      if (fd == run->pid_fd) {
+        if (epoll_.Add(fd, events).ok()) {
+          runs_[fd] = run;
+        } else {
+          run->pid_fd = SharedFD();
+        }
+        continue;
+      }
+      auto fd_flags = fd->Fcntl(F_GETFL, 0);
+      if (fd_flags < 0 || fd->Fcntl(F_SETFL, fd_flags | O_NONBLOCK) < 0) {
+        LOG(ERROR) << "Failed to make the pipe non-blocking: "
+                   << fd->StrError();
+        run->io_error = true;
+      }
+      auto result = epoll_.Add(fd, events);
+      if (!result.ok()) {
+        LOG(ERROR) << "Failed to watch the stdio of " << run->name << ": "
+                   << result.error();
+        run->io_error = true;
+      }
+      runs_[fd] = run;
+    }
+    if (run->io_error) {
+      for (auto fd : {&run->stdin_fd, &run->stdout_fd, &run->stderr_fd}) {
+        CloseFd(*fd);
+      }
+    }
+    MaybeFinish(run);
+  }
+
+ private:
+  ManagedStdioLoop() {
+    auto epoll = Epoll::Create();
+    CHECK(epoll.ok()) << epoll.error();
+    epoll_ = std::move(*epoll);
+    std::thread([this]() { Run(); }).detach();
+  }
+
+  [[noreturn]] void Run() {
+    while (true) {
+      auto event = epoll_.Wait();
+      if (!event.ok()) {
+        LOG(ERROR) << "Failed to wait for managed stdio: " << event.error();
+        continue;
+      }
+      if (!*event) {
+        continue;
+      }
+      std::lock_guard lock(mutex_);
+      auto it = runs_.find((*event)->fd);
+      if (it == runs_.end()) {
+        continue;
       }
+      auto run = it->second;
+      Handle(*run, (*event)->fd);
+      MaybeFinish(run);
     }
   }
+
+  // Called with mutex_ held
+  void Handle(ManagedStdioRun& run, SharedFD fd) {
+    if (fd == run.pid_fd) {
+      CloseFd(run.pid_fd);
+      run.exit_code = run.subprocess.Wait();
+    } else if (fd == run.stdin_fd) {
+      const auto& data = *run.stdin_str;
+      while (run.stdin_written < data.size()) {
+        auto written = run.stdin_fd->Write(data.data() + run.stdin_written,
+                                           data.size() - run.stdin_written);
+        if (written < 0) {
+          if (run.stdin_fd->GetErrno() == EAGAIN) {
+            return;
+          }
+          LOG(ERROR) << "Error in writing stdin to process";
+          run.io_error = true;
+          break;
+        }
+        run.stdin_written += written;
+      }
+      CloseFd(run.stdin_fd);
+    } else {
+      bool is_stdout = fd == run.stdout_fd;
+      auto output = is_stdout ? run.stdout_str : run.stderr_str;
+      char buffer[4096];
+      while (true) {
+        auto read = fd->Read(buffer, sizeof(buffer));
+        if (read > 0) {
+          output->append(buffer, read);
+          continue;
+        }
+        if (read < 0 && fd->GetErrno() == EAGAIN) {
+          return;
+        }
+        if (read < 0) {
+          run.io_error = true;
+          LOG(ERROR) << "Error in reading " << (is_stdout ? "stdout" : "stderr")
+                     << " from process";
+        }
+        break;
+      }
+      CloseFd(is_stdout ? run.stdout_fd : run.stderr_fd);
+    }
+  }
+
+  // Called with mutex_ held
+  void MaybeFinish(std::shared_ptr<ManagedStdioRun> run) {
+    if (run->stdin_fd->IsOpen() || run->stdout_fd->IsOpen() ||
+        run->stderr_fd->IsOpen() || run->pid_fd->IsOpen()) {
+      return;
+    }
+    if (!run->exit_code) {
+      // No pidfd, or it couldn't be watched
+      std::thread([run]() {
+        run->exit_code = run->subprocess.Wait();
+        Finish(*run);
+      }).detach();
+      return;
+    }
+    Finish(*run);
+  }
+
+  static void Finish(ManagedStdioRun& run) {
+    if (run.io_error) {
+      LOG(ERROR) << "IO error communicating with " << run.name;
+      run.promise.set_value(-1);
+    } else {
+      run.promise.set_value(*run.exit_code);
+    }
+  }
+
+  // Called with mutex_ held
+  void CloseFd(SharedFD& fd) {
+    if (runs_.erase(fd)) {
+      // Fails if it couldn't be added
+      epoll_.Delete(fd);
+    }
+    fd = SharedFD();
+  }
+
+  Epoll epoll_;
+  std::mutex mutex_;
+  std::map<SharedFD, std::shared_ptr<ManagedStdioRun>> runs_;
 };
 
-int RunWithManagedStdio(Command&& cmd_tmp, const std::string* stdin_str,
-                        std::string* stdout_str, std::string* stderr_str,
-                        SubprocessOptions options) {
-  /*
-   * The order of these declarations is necessary for safety. If the function
-   * returns at any point, the Command will be destroyed first, closing all
-   * of its references to SharedFDs. This will cause the thread internals to fail
-   * their reads or writes. The ThreadJoiner then waits for the threads to
-   * complete, as running the destructor of an active std::thread crashes the
-   * program.
-   *
-   * C++ scoping rules dictate that objects are descoped in reverse order to
-   * construction, so this behavior is predictable.
-   */
-  std::thread stdin_thread, stdout_thread, stderr_thread;
-  ThreadJoiner thread_joiner({&stdin_thread, &stdout_thread, &stderr_thread});
+}  // namespace
+
+std::future<int> RunWithManagedStdioAsync(Command&& cmd_tmp,
+                                          const std::string* stdin_str,
+                                          std::string* stdout_str,
+                                          std::string* stderr_str,
+                                          SubprocessOptions options) {
+  auto failed = []() {
+    std::promise<int> promise;
+    promise.set_value(-1);
+    return promise.get_future();
+  };
   Command cmd = std::move(cmd_tmp);
-  bool io_error = false;
+  SharedFD stdin_fd, stdout_fd, stderr_fd;
   if (stdin_str != nullptr) {
-    SharedFD pipe_read, pipe_write;
-    if (!SharedFD::Pipe(&pipe_read, &pipe_write)) {
+    SharedFD pipe_read;
+    if (!SharedFD::Pipe(&pipe_read, &stdin_fd)) {
       LOG(ERROR) << "Could not create a pipe to write the stdin of \""
                 << cmd.GetShortName() << "\"";
-      return -1;
+      return failed();
     }
     cmd.RedirectStdIO(Subprocess::StdIOChannel::kStdIn, pipe_read);
-    stdin_thread = std::thread([pipe_write, stdin_str, &io_error]() {
-      int written = WriteAll(pipe_write, *stdin_str);
-      if (written < 0) {
-        io_error = true;
-        LOG(ERROR) << "Error in writing stdin to process";
-      }
-    });
   }
   if (stdout_str != nullptr) {
-    SharedFD pipe_read, pipe_write;
-    if (!SharedFD::Pipe(&pipe_read, &pipe_write)) {
+    SharedFD pipe_write;
+    if (!SharedFD::Pipe(&stdout_fd, &pipe_write)) {
       LOG(ERROR) << "Could not create a pipe to read the stdout of \""
                 << cmd.GetShortName() << "\"";
-      return -1;
+      return failed();
     }
     cmd.RedirectStdIO(Subprocess::StdIOChannel::kStdOut, pipe_write);
-    stdout_thread = std::thread([pipe_read, stdout_str, &io_error]() {
-      int read = ReadAll(pipe_read, stdout_str);
-      if (read < 0) {
-        io_error = true;
-        LOG(ERROR) << "Error in reading stdout from process";
-      }
-    });
   }
   if (stderr_str != nullptr) {
-    SharedFD pipe_read, pipe_write;
-    if (!SharedFD::Pipe(&pipe_read, &pipe_write)) {
+    SharedFD pipe_write;
+    if (!SharedFD::Pipe(&stderr_fd, &pipe_write)) {
       LOG(ERROR) << "Could not create a pipe to read the stderr of \""
                 << cmd.GetShortName() << "\"";
-      return -1;
+      return failed();
     }
     cmd.RedirectStdIO(Subprocess::StdIOChannel::kStdErr, pipe_write);
-    stderr_thread = std::thread([pipe_read, stderr_str, &io_error]() {
-      int read = ReadAll(pipe_read, stderr_str);
-      if (read < 0) {
-        io_error = true;
-        LOG(ERROR) << "Error in reading stderr from process";
-      }
-    });
   }
 
   auto subprocess = cmd.Start(options);
   if (!subprocess.Started()) {
-    return -1;
+    return failed();
   }
-  auto cmd_short_name = cmd.GetShortName();
+  auto run =
+      std::make_shared<ManagedStdioRun>(std::move(subprocess), cmd.GetShortName());
   {
-    // Force the destructor to run by moving it into a smaller scope.
-    // This is necessary to close the write end of the pipe.
+    // Closes the Command's references to the child's ends of the pipes, or
+    // the output pipes would never report the end of the stream.
     Command forceDelete = std::move(cmd);
   }
+  run->stdin_fd = stdin_fd;
+  run->stdin_str = stdin_str;
+  run->stdout_fd = stdout_fd;
+  run->stdout_str = stdout_str;
+  run->stderr_fd = stderr_fd;
+  run->stderr_str = stderr_str;
+  auto future = run->promise.get_future();
+  ManagedStdioLoop::Get().Add(std::move(run));
+  return future;
+}
 
-  int code = subprocess.Wait();
-  {
-    auto join_threads = std::move(thread_joiner);
-  }
-  if (io_error) {
-    LOG(ERROR) << "IO error communicating with " << cmd_short_name;
-    return -1;
-  }
-  return code;
+int RunWithManagedStdio(Command&& cmd, const std::string* stdin_str,
+                        std::string* stdout_str, std::string* stderr_str,
+                        SubprocessOptions options) {
+  return RunWithManagedStdioAsync(std::move(cmd), stdin_str, stdout_str,
+                                  stderr_str, options)
+      .get();
 }
 
 int execute(const std::vector<std::string>& command,
@@ -24,6 +24,7 @@
 #include <cstdio>
 #include <cstring>
 #include <functional>
+#include <future>
 #include <map>
 #include <ostream>
 #include <sstream>
@@ -91,7 +92,10 @@ class Subprocess {
 class SubprocessOptions {
  public:
   SubprocessOptions()
-      : verbose_(true), exit_with_parent_(true), in_group_(false) {}
+      : verbose_(true),
+        exit_with_parent_(true),
+        in_group_(false),
+        mergeable_memory_(false) {}
 
   SubprocessOptions& Verbose(bool verbose) &;
   SubprocessOptions Verbose(bool verbose) &&;
@@ -100,15 +104,28 @@ class SubprocessOptions {
   // The subprocess runs as head of its own process group.
   SubprocessOptions& InGroup(bool in_group) &;
   SubprocessOptions InGroup(bool in_group) &&;
+  // The subprocess moves itself into a cgroup, given by its open cgroup.procs
+  // file, before running the executable. Its own children inherit the cgroup.
+  SubprocessOptions& Cgroup(SharedFD cgroup_procs) &;
+  SubprocessOptions Cgroup(SharedFD cgroup_procs) &&;
+  // All of the subprocess' anonymous memory is offered to KSM for merging with
+  // identical pages, e.g. those of other guests. Best effort, needs a kernel
+  // with PR_SET_MEMORY_MERGE that keeps it across exec.
+  SubprocessOptions& MergeableMemory(bool mergeable_memory) &;
+  SubprocessOptions MergeableMemory(bool mergeable_memory) &&;
 
   bool Verbose() const { return verbose_; }
   bool ExitWithParent() const { return exit_with_parent_; }
   bool InGroup() const { return in_group_; }
+  SharedFD Cgroup() const { return cgroup_procs_; }
+  bool MergeableMemory() const { return mergeable_memory_; }
 
  private:
   bool verbose_;
   bool exit_with_parent_;
   bool in_group_;
+  SharedFD cgroup_procs_;
+  bool mergeable_memory_;
 };
 
 // An executable command. Multiple subprocesses can be started from the same
@@ -259,6 +276,10 @@ class Command {
   Command& SetWorkingDirectory(SharedFD dirfd) &;
   Command SetWorkingDirectory(SharedFD dirfd) &&;
 
+  // Restricts the subprocesses to the given host cpus, all of them by default.
+  Command& SetCpuAffinity(std::vector<int> cpus) &;
+  Command SetCpuAffinity(std::vector<int> cpus) &&;
+
   // Starts execution of the command. This method can be called multiple times,
   // effectively staring multiple (possibly concurrent) instances.
   Subprocess Start(SubprocessOptions options = SubprocessOptions()) const;
@@ -282,6 +303,7 @@ class Command {
   std::vector<std::string> env_{};
   SubprocessStopper subprocess_stopper_;
   SharedFD working_directory_;
+  std::vector<int> cpu_affinity_;
 };
 
 /*
@@ -300,6 +322,19 @@ int RunWithManagedStdio(Command&& command, const std::string* stdin,
                         std::string* stdout, std::string* stderr,
                         SubprocessOptions options = SubprocessOptions());
 
+/*
+ * Starts a Command like RunWithManagedStdio without waiting for it. The
+ * returned future becomes ready with the value RunWithManagedStdio would have
+ * returned once the command exits and its output has been collected.
+ *
+ * The pipes of every command started this way are serviced by one shared
+ * thread, so many commands can run concurrently. `stdin`, `stdout` and
+ * `stderr` must remain valid until the future is ready.
+ */
+std::future<int> RunWithManagedStdioAsync(
+    Command&& command, const std::string* stdin, std::string* stdout,
+    std::string* stderr, SubprocessOptions options = SubprocessOptions());
+
 // Convenience wrapper around Command and Subprocess class, allows to easily
 // execute a command and wait for it to complete. The version without the env
 // parameter starts the command with the same environment as the parent. Returns
@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/libs/utils/tracing.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <json/json.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+
+namespace cuttlefish {
+
+std::atomic<bool> gTracingEnabled = false;
+
+namespace {
+
+constexpr char kTraceFileEnv[] = "CUTTLEFISH_TRACE_FILE";
+constexpr std::size_t kBufferEvents = 1024;
+constexpr std::int64_t kFlushIntervalNs = 1000000000;
+
+struct TraceEvent {
+  const char* name;
+  std::string detail;
+  // 'X' for spans, 'C' for counters
+  char phase;
+  std::int64_t timestamp_ns;
+  // The duration of spans
+  std::int64_t value;
+};
+
+class ThreadBuffer;
+
+struct TraceState {
+  std::mutex mutex;
+  SharedFD file;
+  pid_t pid;
+  std::set<ThreadBuffer*> buffers;
+};
+
+// Leaked so it outlives the buffers of threads exiting after main()
+TraceState& State() {
+  static auto state = new TraceState();
+  return *state;
+}
+
+// Chrome traces take microseconds
+std::string Microseconds(std::int64_t ns) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%lld.%03lld", static_cast<long long>(ns / 1000),
+           static_cast<long long>(ns % 1000));
+  return buf;
+}
+
+std::string Serialize(const TraceEvent& event, pid_t pid, pid_t tid) {
+  std::string json = "{\"name\":" + Json::valueToQuotedString(event.name) +
+                     ",\"ph\":\"" + event.phase +
+                     "\",\"ts\":" + Microseconds(event.timestamp_ns) +
+                     ",\"pid\":" + std::to_string(pid) +
+                     ",\"tid\":" + std::to_string(tid);
+  if (event.phase == 'X') {
+    json += ",\"dur\":" + Microseconds(event.value);
+    if (!event.detail.empty()) {
+      json += ",\"args\":{\"detail\":" +
+              Json::valueToQuotedString(event.detail.c_str()) + "}";
+    }
+  } else {
+    json += ",\"args\":{\"value\":" + std::to_string(event.value) + "}";
+  }
+  return json + "},\n";
+}
+
+std::string Metadata(const char* name, const std::string& value, pid_t pid,
+                     pid_t tid) {
+  return std::string("{\"name\":\"") + name +
+         "\",\"ph\":\"M\",\"pid\":" + std::to_string(pid) +
+         ",\"tid\":" + std::to_string(tid) + ",\"args\":{\"name\":" +
+         Json::valueToQuotedString(value.c_str()) + "}},\n";
+}
+
+// Must be called with the state mutex held
+void WriteLocked(TraceState& state, const std::string& json) {
+  if (json.empty() || !state.file->IsOpen()) {
+    return;
+  }
+  // O_APPEND keeps the writes of different processes apart
+  if (WriteAll(state.file, json) != static_cast<ssize_t>(json.size())) {
+    LOG(ERROR) << "Failed to write the trace: " << state.file->StrError();
+  }
+}
+
+// Only the thread owning the buffer adds events to it, other threads may
+// write out the events added so far.
+class ThreadBuffer {
+ public:
+  ThreadBuffer() : tid_(syscall(SYS_gettid)), events_(kBufferEvents) {
+    char name[16] = {};
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+    auto& state = State();
+    std::lock_guard lock(state.mutex);
+    state.buffers.insert(this);
+    WriteLocked(state, Metadata("thread_name", name, state.pid, tid_));
+  }
+  ~ThreadBuffer() {
+    auto& state = State();
+    auto json = Take(true);
+    std::lock_guard lock(state.mutex);
+    WriteLocked(state, json);
+    state.buffers.erase(this);
+  }
+
+  void Append(TraceEvent event) {
+    auto index = committed_.load(std::memory_order_relaxed);
+    if (index == events_.size() ||
+        event.timestamp_ns - last_flush_ns_ > kFlushIntervalNs) {
+      auto json = Take(true);
+      auto& state = State();
+      std::lock_guard lock(state.mutex);
+      WriteLocked(state, json);
+      last_flush_ns_ = event.timestamp_ns;
+      index = 0;
+    }
+    events_[index] = std::move(event);
+    committed_.store(index + 1, std::memory_order_release);
+  }
+
+  // Serializes the events not written out yet. Only the owner may reuse the
+  // buffer afterwards.
+  std::string Take(bool owner) {
+    std::lock_guard lock(mutex_);
+    auto committed = committed_.load(std::memory_order_acquire);
+    auto pid = State().pid;
+    std::string json;
+    for (auto i = taken_; i < committed; i++) {
+      json += Serialize(events_[i], pid, tid_);
+    }
+    taken_ = committed;
+    if (owner) {
+      taken_ = 0;
+      committed_.store(0, std::memory_order_relaxed);
+    }
+    return json;
+  }
+
+ private:
+  const pid_t tid_;
+  std::vector<TraceEvent> events_;
+  std::atomic<std::size_t> committed_ = 0;
+  std::mutex mutex_;
+  std::size_t taken_ = 0;
+  std::int64_t last_flush_ns_ = 0;
+};
+
+ThreadBuffer& LocalBuffer() {
+  thread_local ThreadBuffer buffer;
+  return buffer;
+}
+
+Result<SharedFD> OpenTrace(const std::string& path) {
+  auto file = SharedFD::Open(path, O_WRONLY | O_APPEND | O_CLOEXEC);
+  if (file->IsOpen()) {
+    return file;
+  }
+  // The first process to trace creates the file with the array's opening
+  // bracket, the closing one is optional in the format.
+  auto temporary = path + "." + std::to_string(getpid());
+  auto created = SharedFD::Open(temporary,
+                                O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644);
+  CF_EXPECT(created->IsOpen(), "Could not create \""
+                                   << temporary
+                                   << "\": " << created->StrError());
+  CF_EXPECT(WriteAll(created, "[\n") == 2, created->StrError());
+  if (link(temporary.c_str(), path.c_str()) != 0 && errno != EEXIST) {
+    auto error = strerror(errno);
+    unlink(temporary.c_str());
+    return CF_ERR("Could not create \"" << path << "\": " << error);
+  }
+  unlink(temporary.c_str());
+  file = SharedFD::Open(path, O_WRONLY | O_APPEND | O_CLOEXEC);
+  CF_EXPECT(file->IsOpen(),
+            "Could not open \"" << path << "\": " << file->StrError());
+  return file;
+}
+
+const bool kStartedFromEnvironment = []() {
+  auto path = getenv(kTraceFileEnv);
+  if (path == nullptr || *path == '\0') {
+    return false;
+  }
+  auto result = StartTracing(path);
+  if (!result.ok()) {
+    LOG(ERROR) << "Not tracing: " << result.error();
+    return false;
+  }
+  return true;
+}();
+
+}  // namespace
+
+Result<void> StartTracing(const std::string& path) {
+  auto& state = State();
+  {
+    std::lock_guard lock(state.mutex);
+    if (state.file->IsOpen()) {
+      return {};
+    }
+    state.file = CF_EXPECT(OpenTrace(path));
+    state.pid = getpid();
+    char name[16] = {};
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+    WriteLocked(state, Metadata("process_name", name, state.pid, state.pid));
+  }
+  atexit(FlushTrace);
+  gTracingEnabled = true;
+  return {};
+}
+
+void FlushTrace() {
+  auto& state = State();
+  std::lock_guard lock(state.mutex);
+  for (auto buffer : state.buffers) {
+    WriteLocked(state, buffer->Take(false));
+  }
+}
+
+std::int64_t TraceNow() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<std::int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void RecordTraceSpan(const char* name, std::string detail,
+                     std::int64_t start_ns, std::int64_t end_ns) {
+  LocalBuffer().Append({
+      .name = name,
+      .detail = std::move(detail),
+      .phase = 'X',
+      .timestamp_ns = start_ns,
+      .value = end_ns - start_ns,
+  });
+}
+
+void RecordTraceCounter(const char* name, std::int64_t value) {
+  LocalBuffer().Append({
+      .name = name,
+      .detail = {},
+      .phase = 'C',
+      .timestamp_ns = TraceNow(),
+      .value = value,
+  });
+}
+
+}  // namespace cuttlefish
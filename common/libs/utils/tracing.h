@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "common/libs/utils/result.h"
+
+// Spans and counters recorded in the Chrome trace event format, which both
+// Perfetto (ui.perfetto.dev) and chrome://tracing open.
+//
+// Tracing starts in every process that has CUTTLEFISH_TRACE_FILE set in its
+// environment, which host processes pass on to the processes they launch.
+// All of them append to that one file, with timestamps of the same monotonic
+// clock, so the processes of an instance show up in a single timeline.
+//
+// When tracing is off a trace point is a relaxed atomic load. When it's on,
+// events go to a buffer of the recording thread without any locking, and the
+// buffer is written out when it fills up, at least every second while the
+// thread keeps recording, when the thread exits and when the process exits.
+// Events of a process that is killed may be lost.
+//
+//   void Convert() {
+//     CF_TRACE("convert");
+//     ...
+//   }
+//   CF_TRACE_DETAIL("spawn", executable);
+//   TraceCounter("queued_frames", queue.size());
+//
+// Event names must be string literals, details are copied.
+
+namespace cuttlefish {
+
+extern std::atomic<bool> gTracingEnabled;
+
+inline bool TracingEnabled() {
+  return gTracingEnabled.load(std::memory_order_relaxed);
+}
+
+// Appends the events of this process to the trace at `path`, creating it
+// if needed. Called on startup with CUTTLEFISH_TRACE_FILE.
+Result<void> StartTracing(const std::string& path);
+// Writes out the buffered events of all threads.
+void FlushTrace();
+
+// Monotonic nanoseconds, the timestamps of the trace
+std::int64_t TraceNow();
+
+void RecordTraceSpan(const char* name, std::string detail,
+                     std::int64_t start_ns, std::int64_t end_ns);
+void RecordTraceCounter(const char* name, std::int64_t value);
+
+inline void TraceCounter(const char* name, std::int64_t value) {
+  if (TracingEnabled()) {
+    RecordTraceCounter(name, value);
+  }
+}
+
+class ScopedTrace {
+ public:
+  explicit ScopedTrace(const char* name)
+      : name_(name), start_ns_(TracingEnabled() ? TraceNow() : -1) {}
+  ScopedTrace(const char* name, std::string detail)
+      : name_(name),
+        detail_(std::move(detail)),
+        start_ns_(TracingEnabled() ? TraceNow() : -1) {}
+  ~ScopedTrace() {
+    if (start_ns_ >= 0) {
+      RecordTraceSpan(name_, std::move(detail_), start_ns_, TraceNow());
+    }
+  }
+
+  ScopedTrace(const ScopedTrace&) = delete;
+  ScopedTrace& operator=(const ScopedTrace&) = delete;
+
+ private:
+  const char* name_;
+  std::string detail_;
+  // Negative when tracing was off at the start of the span
+  std::int64_t start_ns_;
+};
+
+}  // namespace cuttlefish
+
+#define CF_TRACE_CONCAT_INNER(a, b) a##b
+#define CF_TRACE_CONCAT(a, b) CF_TRACE_CONCAT_INNER(a, b)
+
+// Records a span from here to the end of the enclosing scope
+#define CF_TRACE(name) \
+  ::cuttlefish::ScopedTrace CF_TRACE_CONCAT(cf_trace_, __LINE__)(name)
+
+// Like CF_TRACE, with a detail shown on the span. The detail is only
+// evaluated while tracing.
+#define CF_TRACE_DETAIL(name, detail)                               \
+  ::cuttlefish::ScopedTrace CF_TRACE_CONCAT(cf_trace_, __LINE__)(   \
+      name, ::cuttlefish::TracingEnabled() ? std::string(detail) \
+                                           : std::string())
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "common/libs/utils/tracing.h"
+
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <thread>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <json/json.h>
+
+namespace cuttlefish {
+
+TEST(Tracing, WritesSpansAndCountersOfAllThreads) {
+  TemporaryDir dir;
+  auto path = std::string(dir.path) + "/trace.json";
+  auto started = StartTracing(path);
+  ASSERT_TRUE(started.ok()) << started.error();
+  ASSERT_TRUE(TracingEnabled());
+
+  {
+    CF_TRACE_DETAIL("outer", "some \"detail\"");
+    std::thread([]() { CF_TRACE("inner"); }).join();
+    TraceCounter("counter", 42);
+  }
+  FlushTrace();
+
+  std::string contents;
+  ASSERT_TRUE(android::base::ReadFileToString(path, &contents));
+  // The format allows leaving the array open, the parser doesn't
+  ASSERT_EQ(contents.substr(contents.size() - 2), ",\n");
+  contents = contents.substr(0, contents.size() - 2) + "]";
+  Json::Value events;
+  std::string errors;
+  std::unique_ptr<Json::CharReader> reader(
+      Json::CharReaderBuilder().newCharReader());
+  ASSERT_TRUE(reader->parse(contents.data(), contents.data() + contents.size(),
+                            &events, &errors))
+      << errors;
+
+  std::map<std::string, Json::Value> by_name;
+  for (const auto& event : events) {
+    ASSERT_EQ(event["pid"].asInt(), getpid());
+    by_name[event["name"].asString()] = event;
+  }
+  ASSERT_EQ(by_name["outer"]["ph"].asString(), "X");
+  ASSERT_EQ(by_name["outer"]["args"]["detail"].asString(), "some \"detail\"");
+  ASSERT_EQ(by_name["inner"]["ph"].asString(), "X");
+  ASSERT_NE(by_name["inner"]["tid"], by_name["outer"]["tid"]);
+  ASSERT_GE(by_name["inner"]["ts"].asDouble(),
+            by_name["outer"]["ts"].asDouble());
+  ASSERT_EQ(by_name["counter"]["ph"].asString(), "C");
+  ASSERT_EQ(by_name["counter"]["args"]["value"].asInt(), 42);
+  ASSERT_EQ(by_name["process_name"]["ph"].asString(), "M");
+}
+
+}  // namespace cuttlefish
@@ -16,9 +16,12 @@
 
 #include "common/libs/utils/vsock_connection.h"
 
+#include <limits.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 
+#include <algorithm>
 #include <functional>
 #include <future>
 #include <memory>
@@ -127,12 +130,18 @@ std::future<std::vector<char>> VsockConnection::ReadMessageAsync() {
 }
 
 Json::Value VsockConnection::ReadJsonMessage() {
-  auto msg = ReadMessage();
-  Json::CharReaderBuilder builder;
-  Json::CharReader* reader = builder.newCharReader();
+  std::lock_guard<std::recursive_mutex> lock(read_mutex_);
+  if (!ReadMessage(json_buffer_)) {
+    return {};
+  }
+  if (!json_reader_) {
+    json_reader_.reset(Json::CharReaderBuilder().newCharReader());
+  }
   Json::Value json_msg;
   std::string errors;
-  if (!reader->parse(msg.data(), msg.data() + msg.size(), &json_msg, &errors)) {
+  if (!json_reader_->parse(json_buffer_.data(),
+                           json_buffer_.data() + json_buffer_.size(),
+                           &json_msg, &errors)) {
     return {};
   }
   return json_msg;
@@ -164,14 +173,61 @@ bool VsockConnection::Write(const std::vector<char>& data) {
   return Write(data.data(), data.size());
 }
 
+bool VsockConnection::Writev(std::vector<struct iovec>& buffers) {
+  std::lock_guard<std::recursive_mutex> lock(write_mutex_);
+  std::size_t first = 0;
+  while (first < buffers.size()) {
+    int count = std::min<std::size_t>(buffers.size() - first, IOV_MAX);
+    auto written = fd_->Writev(&buffers[first], count);
+    if (written <= 0) {
+      Disconnect();
+      return false;
+    }
+    // Skips what was written, possibly stopping in the middle of a buffer
+    std::size_t left = written;
+    while (first < buffers.size() && left >= buffers[first].iov_len) {
+      left -= buffers[first].iov_len;
+      first++;
+    }
+    if (left > 0) {
+      auto base = static_cast<char*>(buffers[first].iov_base);
+      buffers[first].iov_base = base + left;
+      buffers[first].iov_len -= left;
+    }
+  }
+  return true;
+}
+
+void VsockConnection::AddStrides(std::vector<struct iovec>& buffers,
+                                 const char* data, unsigned int size,
+                                 unsigned int num_strides, int stride_size) {
+  if (stride_size == static_cast<int>(size)) {
+    buffers.push_back({const_cast<char*>(data), size * num_strides});
+    return;
+  }
+  const char* src = data;
+  for (unsigned int i = 0; i < num_strides; ++i, src += stride_size) {
+    buffers.push_back({const_cast<char*>(src), size});
+  }
+}
+
 // Message format is buffer size followed by buffer data
 bool VsockConnection::WriteMessage(const std::string& data) {
-  return Write(data.size()) && Write(data.c_str(), data.length());
+  int32_t size = data.size();
+  std::vector<struct iovec> buffers = {
+      {&size, sizeof(size)},
+      {const_cast<char*>(data.data()), data.size()},
+  };
+  return Writev(buffers);
 }
 
 bool VsockConnection::WriteMessage(const std::vector<char>& data) {
-  std::lock_guard<std::recursive_mutex> lock(write_mutex_);
-  return Write(data.size()) && Write(data);
+  int32_t size = data.size();
+  std::vector<struct iovec> buffers = {
+      {&size, sizeof(size)},
+      {const_cast<char*>(data.data()), data.size()},
+  };
+  return Writev(buffers);
 }
 
 bool VsockConnection::WriteMessage(const Json::Value& data) {
@@ -182,13 +238,9 @@ bool VsockConnection::WriteMessage(const Json::Value& data) {
 
 bool VsockConnection::WriteStrides(const char* data, unsigned int size,
                                    unsigned int num_strides, int stride_size) {
-  const char* src = data;
-  for (unsigned int i = 0; i < num_strides; ++i, src += stride_size) {
-    if (!Write(src, size)) {
-      return false;
-    }
-  }
-  return true;
+  std::vector<struct iovec> buffers;
+  AddStrides(buffers, data, size, num_strides, stride_size);
+  return Writev(buffers);
 }
 
 bool VsockClientConnection::Connect(unsigned int port, unsigned int cid) {
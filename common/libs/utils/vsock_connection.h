@@ -15,10 +15,13 @@
  */
 #pragma once
 
+#include <sys/uio.h>
+
 #include <cstddef>
 #include <cstdint>
 #include <functional>
 #include <future>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <vector>
@@ -59,12 +62,23 @@ class VsockConnection {
   bool WriteMessage(const Json::Value& data);
   bool WriteStrides(const char* data, unsigned int size,
                     unsigned int num_strides, int stride_size);
+  // Writes the buffers in order with as few system calls as it takes, and
+  // no copies. The buffers are consumed by partial writes.
+  bool Writev(std::vector<struct iovec>& buffers);
+  // Adds `num_strides` rows of `size` bytes every `stride_size` bytes to the
+  // buffers, rows that are contiguous as a single buffer.
+  static void AddStrides(std::vector<struct iovec>& buffers, const char* data,
+                         unsigned int size, unsigned int num_strides,
+                         int stride_size);
 
  protected:
   std::recursive_mutex read_mutex_;
   std::recursive_mutex write_mutex_;
   std::function<void()> disconnect_callback_;
   SharedFD fd_;
+  // Reused by ReadJsonMessage, under read_mutex_.
+  std::vector<char> json_buffer_;
+  std::unique_ptr<Json::CharReader> json_reader_;
 };
 
 class VsockClientConnection : public VsockConnection {
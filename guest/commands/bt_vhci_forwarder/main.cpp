@@ -15,20 +15,21 @@
 
 #include <fcntl.h>
 #include <sys/poll.h>
-#include <sys/uio.h>
 #include <termios.h>
 #include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <iomanip>
 #include <ios>
-#include <optional>
+#include <vector>
 
 #include <gflags/gflags.h>
 
 #include "android-base/logging.h"
 
-#include "model/hci/h4_packetizer.h"
-
 // Copied from net/bluetooth/hci.h
+#define HCI_COMMAND_PKT 0x01
 #define HCI_ACLDATA_PKT 0x02
 #define HCI_SCODATA_PKT 0x03
 #define HCI_EVENT_PKT 0x04
@@ -40,48 +41,218 @@
 // Include H4 header byte, and reserve more buffer size in the case of excess
 // packet.
 constexpr const size_t kBufferSize = (HCI_MAX_FRAME_SIZE + 1) * 2;
+// Packets read from vhci in one wakeup are sent to the virtio-console with
+// one write, and the reads from the virtio-console can hold many packets.
+// The latter needs room for the largest H4 packet the header can describe.
+constexpr const size_t kBatchSize = 1 << 17;
 
 constexpr const char* kVhciDev = "/dev/vhci";
 DEFINE_string(virtio_console_dev, "", "virtio-console device path");
+DEFINE_int32(stats_interval_s, 60,
+             "How often to log the forwarding statistics, if there was "
+             "traffic. 0 disables them.");
+
+using Clock = std::chrono::steady_clock;
+
+struct ForwardStats {
+  const char* direction;
+  uint64_t packets = 0;
+  uint64_t bytes = 0;
+  uint64_t dropped = 0;
+  uint64_t writes = 0;
+  // From the wakeup that found a packet to the write that forwarded it
+  Clock::duration total_latency{};
+  Clock::duration max_latency{};
 
-ssize_t send(int fd_, uint8_t type, const uint8_t* data, size_t length) {
-  struct iovec iov[] = {{&type, sizeof(type)},
-                        {const_cast<uint8_t*>(data), length}};
-  ssize_t ret = 0;
-  do {
-    ret = TEMP_FAILURE_RETRY(writev(fd_, iov, sizeof(iov) / sizeof(iov[0])));
-  } while (-1 == ret && EAGAIN == errno);
-  if (ret == -1) {
-    PLOG(ERROR) << "virtio-console to vhci failed";
+  void Forwarded(size_t packet_count, size_t byte_count, Clock::time_point woken) {
+    auto latency = Clock::now() - woken;
+    packets += packet_count;
+    bytes += byte_count;
+    writes++;
+    total_latency += latency * packet_count;
+    max_latency = std::max(max_latency, latency);
+  }
+
+  void LogAndReset() {
+    if (packets == 0 && dropped == 0) {
+      return;
+    }
+    using std::chrono::microseconds;
+    auto average = packets ? total_latency / static_cast<int64_t>(packets)
+                           : Clock::duration{};
+    LOG(INFO) << direction << ": " << packets << " packets, " << bytes
+              << " bytes in " << writes << " writes, " << dropped
+              << " dropped, latency avg "
+              << std::chrono::duration_cast<microseconds>(average).count()
+              << "us max "
+              << std::chrono::duration_cast<microseconds>(max_latency).count()
+              << "us";
+    *this = ForwardStats{direction};
+  }
+};
+
+bool WriteAll(int fd, const uint8_t* data, size_t length) {
+  while (length > 0) {
+    ssize_t ret = TEMP_FAILURE_RETRY(write(fd, data, length));
+    if (ret < 0 && errno == EAGAIN) {
+      struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+      TEMP_FAILURE_RETRY(poll(&pfd, 1, -1));
+      continue;
+    }
+    if (ret <= 0) {
+      return false;
+    }
+    data += ret;
+    length -= ret;
   }
-  return ret;
+  return true;
 }
 
-ssize_t forward(int from, int to, std::optional<unsigned char> filter_out,
-                unsigned char* buf) {
-  ssize_t count = TEMP_FAILURE_RETRY(read(from, buf, kBufferSize));
-  if (count < 0) {
-    PLOG(ERROR) << "read failed";
-    return count;
-  } else if (count == 0) {
-    return count;
+// Reads every packet vhci has queued, one per read, and forwards them with a
+// single write.
+void ForwardFromVhci(int vhci_fd, int virtio_fd, std::vector<uint8_t>& batch,
+                     ForwardStats& stats, Clock::time_point woken) {
+  size_t used = 0;
+  size_t packets = 0;
+  auto flush = [&]() {
+    if (used == 0) {
+      return;
+    }
+    if (WriteAll(virtio_fd, batch.data(), used)) {
+      stats.Forwarded(packets, used, woken);
+    } else {
+      PLOG(ERROR) << "vhci to virtio-console failed";
+      stats.dropped += packets;
+    }
+    used = packets = 0;
+  };
+  while (true) {
+    if (batch.size() - used < kBufferSize) {
+      flush();
+    }
+    ssize_t count =
+        TEMP_FAILURE_RETRY(read(vhci_fd, batch.data() + used, kBufferSize));
+    if (count < 0 && errno != EAGAIN) {
+      PLOG(ERROR) << "read failed";
+    }
+    if (count <= 0) {
+      break;
+    }
+    // TODO(b/182245475) Ignore HCI_VENDOR_PKT
+    // because root-canal cannot handle it.
+    if (batch[used] == HCI_VENDOR_PKT) {
+      LOG(INFO) << "ignore 0x" << std::hex << std::setw(2) << std::setfill('0')
+                << (unsigned)HCI_VENDOR_PKT << " packet";
+      stats.dropped++;
+      continue;
+    }
+    used += count;
+    packets++;
   }
-  if (filter_out && buf[0] == *filter_out) {
-    LOG(INFO) << "ignore 0x" << std::hex << std::setw(2) << std::setfill('0')
-              << (unsigned)buf[0] << " packet";
+  flush();
+}
+
+// Returns the size of the H4 packet at the start of data, including the type
+// byte, 0 if more data is needed to know it or -1 if the type is unknown.
+ssize_t H4PacketSize(const uint8_t* data, size_t length) {
+  if (length < 1) {
     return 0;
   }
-  count = TEMP_FAILURE_RETRY(write(to, buf, count));
-  if (count < 0) {
-    PLOG(ERROR) << "write failed, type: 0x" << std::hex << std::setw(2)
-               << std::setfill('0') << (unsigned)buf[0];
+  size_t header;
+  switch (data[0]) {
+    case HCI_COMMAND_PKT:
+    case HCI_SCODATA_PKT:
+      header = 3;
+      break;
+    case HCI_ACLDATA_PKT:
+    case HCI_ISODATA_PKT:
+      header = 4;
+      break;
+    case HCI_EVENT_PKT:
+      header = 2;
+      break;
+    default:
+      return -1;
   }
-  return count;
+  if (length < 1 + header) {
+    return 0;
+  }
+  const uint8_t* h = data + 1;
+  size_t payload;
+  switch (data[0]) {
+    case HCI_COMMAND_PKT:
+    case HCI_SCODATA_PKT:
+      payload = h[2];
+      break;
+    case HCI_ACLDATA_PKT:
+      payload = h[2] | (h[3] << 8);
+      break;
+    case HCI_ISODATA_PKT:
+      payload = (h[2] | (h[3] << 8)) & 0x3fff;
+      break;
+    default:  // HCI_EVENT_PKT
+      payload = h[1];
+      break;
+  }
+  return 1 + header + payload;
 }
 
-ssize_t forward(int from, int to, unsigned char* buf) {
-  return forward(from, to, std::nullopt, buf);
-}
+// vhci takes one whole packet per write, while the virtio-console is a byte
+// stream that can hold many packets or only part of one.
+class VirtioReader {
+ public:
+  VirtioReader() : buffer_(kBatchSize) {}
+
+  // Returns false if the virtio-console couldn't be read.
+  bool Forward(int virtio_fd, int vhci_fd, ForwardStats& stats,
+               Clock::time_point woken) {
+    ssize_t count = TEMP_FAILURE_RETRY(
+        read(virtio_fd, buffer_.data() + used_, buffer_.size() - used_));
+    if (count < 0) {
+      PLOG(ERROR) << "virtio_fd ready, but read failed";
+      return false;
+    }
+    used_ += count;
+    size_t offset = 0;
+    while (offset < used_) {
+      ssize_t size = H4PacketSize(buffer_.data() + offset, used_ - offset);
+      if (size < 0) {
+        // The stream can't be resynchronized from here
+        LOG(ERROR) << "Unknown packet type 0x" << std::hex << std::setw(2)
+                   << std::setfill('0') << (unsigned)buffer_[offset]
+                   << ", dropping " << std::dec << used_ - offset << " bytes";
+        stats.dropped++;
+        offset = used_;
+        break;
+      }
+      if (size == 0 || offset + size > used_) {
+        break;  // Partial packet, wait for the rest of it
+      }
+      const uint8_t* packet = buffer_.data() + offset;
+      offset += size;
+      if (packet[0] == HCI_COMMAND_PKT) {
+        LOG(ERROR)
+            << "Unexpected command: command pkt shouldn't be sent as response.";
+        stats.dropped++;
+        continue;
+      }
+      ssize_t ret = TEMP_FAILURE_RETRY(write(vhci_fd, packet, size));
+      if (ret != size) {
+        PLOG(ERROR) << "virtio-console to vhci failed";
+        stats.dropped++;
+        continue;
+      }
+      stats.Forwarded(1, size, woken);
+    }
+    used_ -= offset;
+    memmove(buffer_.data(), buffer_.data() + offset, used_);
+    return true;
+  }
+
+ private:
+  std::vector<uint8_t> buffer_;
+  size_t used_ = 0;
+};
 
 int setTerminalRaw(int fd_) {
   termios terminal_settings;
@@ -97,7 +268,8 @@ int setTerminalRaw(int fd_) {
 int main(int argc, char** argv) {
   gflags::ParseCommandLineFlags(&argc, &argv, true);
 
-  int vhci_fd = open(kVhciDev, O_RDWR);
+  // Non blocking, so that every queued packet can be read in one wakeup
+  int vhci_fd = open(kVhciDev, O_RDWR | O_NONBLOCK);
   int virtio_fd = open(FLAGS_virtio_console_dev.c_str(), O_RDWR);
   setTerminalRaw(virtio_fd);
 
@@ -107,43 +279,37 @@ int main(int argc, char** argv) {
   fds[0].events = POLLIN;
   fds[1].fd = virtio_fd;
   fds[1].events = POLLIN;
-  unsigned char buf[kBufferSize];
+  std::vector<uint8_t> vhci_batch(kBatchSize);
+  VirtioReader virtio_reader;
 
-  auto h4 = rootcanal::H4Packetizer(
-      virtio_fd,
-      [](const std::vector<uint8_t>& /* raw_command */) {
-        LOG(ERROR)
-            << "Unexpected command: command pkt shouldn't be sent as response.";
-      },
-      [vhci_fd](const std::vector<uint8_t>& raw_event) {
-        send(vhci_fd, HCI_EVENT_PKT, raw_event.data(), raw_event.size());
-      },
-      [vhci_fd](const std::vector<uint8_t>& raw_acl) {
-        send(vhci_fd, HCI_ACLDATA_PKT, raw_acl.data(), raw_acl.size());
-      },
-      [vhci_fd](const std::vector<uint8_t>& raw_sco) {
-        send(vhci_fd, HCI_SCODATA_PKT, raw_sco.data(), raw_sco.size());
-      },
-      [vhci_fd](const std::vector<uint8_t>& raw_iso) {
-        send(vhci_fd, HCI_ISODATA_PKT, raw_iso.data(), raw_iso.size());
-      },
-      []() { LOG(INFO) << "HCI socket device disconnected"; });
+  ForwardStats to_host{"vhci to virtio-console"};
+  ForwardStats to_vhci{"virtio-console to vhci"};
+  auto stats_interval = std::chrono::seconds(FLAGS_stats_interval_s);
+  auto next_stats = Clock::now() + stats_interval;
 
   bool before_first_command = true;
 
   while (true) {
-    int ret = TEMP_FAILURE_RETRY(poll(fds, 2, -1));
+    int timeout_ms = -1;
+    if (FLAGS_stats_interval_s > 0) {
+      timeout_ms = std::max<int64_t>(
+          0, std::chrono::duration_cast<std::chrono::milliseconds>(
+                 next_stats - Clock::now())
+                 .count());
+    }
+    int ret = TEMP_FAILURE_RETRY(poll(fds, 2, timeout_ms));
+    auto woken = Clock::now();
+    if (FLAGS_stats_interval_s > 0 && woken >= next_stats) {
+      to_host.LogAndReset();
+      to_vhci.LogAndReset();
+      next_stats = woken + stats_interval;
+    }
     if (ret < 0) {
       PLOG(ERROR) << "poll failed";
       continue;
     }
     if (fds[0].revents & (POLLIN | POLLERR)) {
-      // TODO(b/182245475) Ignore HCI_VENDOR_PKT
-      // because root-canal cannot handle it.
-      ssize_t c = forward(vhci_fd, virtio_fd, HCI_VENDOR_PKT, buf);
-      if (c < 0) {
-        PLOG(ERROR) << "vhci to virtio-console failed";
-      }
+      ForwardFromVhci(vhci_fd, virtio_fd, vhci_batch, to_host, woken);
       before_first_command = false;
     }
     if (fds[1].revents & POLLHUP) {
@@ -154,6 +320,7 @@ int main(int argc, char** argv) {
     if (fds[1].revents & (POLLIN | POLLERR)) {
       if (before_first_command) {
         // Drop any data left in the virtio-console from a previous reset.
+        uint8_t buf[kBufferSize];
         ssize_t bytes = TEMP_FAILURE_RETRY(read(virtio_fd, buf, kBufferSize));
         if (bytes < 0) {
           LOG(ERROR) << "virtio_fd ready, but read failed " << strerror(errno);
@@ -162,9 +329,7 @@ int main(int argc, char** argv) {
         }
         continue;
       }
-      // 'virtio-console to vhci' depends on H4Packetizer because vhci expects
-      // full packet, but the data from virtio-console could be partial.
-      h4.OnDataReady(virtio_fd);
+      virtio_reader.Forward(virtio_fd, vhci_fd, to_vhci, woken);
     }
   }
 }
@@ -19,6 +19,18 @@
 #include <android/binder_manager.h>
 #include <utils/SystemClock.h>
 
+#include <time.h>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
 #include <thread>
 
 #include <aidl/android/hardware/sensors/BnSensors.h>
@@ -137,10 +149,216 @@ void InjectHingeAngle(int angle) {
   endSensorInjection(sensors);
 }
 
+// A sample read by InjectStream: a trace timestamp, the sensor type and up
+// to 16 values, in the order of the corresponding ISensors event payload.
+struct StreamedSample {
+  int64_t timestamp_ns;
+  SensorType type;
+  std::array<float, 16> values;
+  size_t value_count;
+};
+
+// Parses "<timestamp_ns> <sensor_type> <value>...", separated by whitespace
+// or commas. sensor_type is the numeric value of ISensors SensorType.
+bool ParseStreamedSample(const std::string& line, StreamedSample* sample) {
+  const char* pos = line.c_str();
+  char* end = nullptr;
+  // Skips the separators in front of the next field
+  auto skip_separators = [&pos]() {
+    while (*pos == ',' || isspace(static_cast<unsigned char>(*pos))) {
+      pos++;
+    }
+    return *pos != '\0';
+  };
+  if (!skip_separators()) {
+    return false;
+  }
+  sample->timestamp_ns = strtoll(pos, &end, 10);
+  if (end == pos) {
+    return false;
+  }
+  pos = end;
+  if (!skip_separators()) {
+    return false;
+  }
+  sample->type = static_cast<SensorType>(strtol(pos, &end, 10));
+  if (end == pos) {
+    return false;
+  }
+  pos = end;
+  sample->value_count = 0;
+  while (skip_separators()) {
+    if (sample->value_count == sample->values.size()) {
+      return false;
+    }
+    sample->values[sample->value_count] = strtof(pos, &end);
+    if (end == pos) {
+      return false;
+    }
+    sample->value_count++;
+    pos = end;
+  }
+  return sample->value_count > 0;
+}
+
+void SetEventPayload(const StreamedSample& sample, Event* event) {
+  auto value = [&sample](size_t i) {
+    return i < sample.value_count ? sample.values[i] : 0.0f;
+  };
+  switch (sample.type) {
+    case SensorType::ACCELEROMETER:
+    case SensorType::MAGNETIC_FIELD:
+    case SensorType::ORIENTATION:
+    case SensorType::GYROSCOPE:
+    case SensorType::GRAVITY:
+    case SensorType::LINEAR_ACCELERATION: {
+      Event::EventPayload::Vec3 vec3;
+      vec3.x = value(0);
+      vec3.y = value(1);
+      vec3.z = value(2);
+      vec3.status = SensorStatus::ACCURACY_HIGH;
+      event->payload.set<Event::EventPayload::Tag::vec3>(vec3);
+      break;
+    }
+    case SensorType::GAME_ROTATION_VECTOR: {
+      Event::EventPayload::Vec4 vec4;
+      vec4.x = value(0);
+      vec4.y = value(1);
+      vec4.z = value(2);
+      vec4.w = value(3);
+      event->payload.set<Event::EventPayload::Tag::vec4>(vec4);
+      break;
+    }
+    case SensorType::ROTATION_VECTOR:
+    case SensorType::GEOMAGNETIC_ROTATION_VECTOR: {
+      Event::EventPayload::Data data;
+      for (size_t i = 0; i < data.values.size(); i++) {
+        data.values[i] = value(i);
+      }
+      event->payload.set<Event::EventPayload::Tag::data>(data);
+      break;
+    }
+    default:
+      event->payload.set<Event::EventPayload::Tag::scalar>(value(0));
+      break;
+  }
+}
+
+// Bounds how far the stdin reader may run ahead of playback.
+constexpr size_t kMaxQueuedSamples = 4096;
+
+// Plays back samples read from stdin, one per line, at the pace given by
+// their timestamps. Lines are parsed on a separate thread so that reading
+// and parsing the next batch doesn't delay injection. Injected events carry
+// the time they were actually injected at.
+void InjectStream() {
+  auto sensors = startSensorInjection();
+
+  std::map<SensorType, int> handles;
+  std::vector<SensorInfo> sensors_list;
+  auto result = sensors->getSensorsList(&sensors_list);
+  if (!result.isOk()) {
+    LOG(FATAL) << "Unable to get ISensors sensors list: "
+               << result.getDescription();
+  }
+  for (const SensorInfo& sensor : sensors_list) {
+    handles.emplace(sensor.type, sensor.sensorHandle);
+  }
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<StreamedSample> queue;
+  bool input_done = false;
+  std::thread reader([&]() {
+    std::string line;
+    size_t line_number = 0;
+    while (std::getline(std::cin, line)) {
+      line_number++;
+      if (line.empty() || line[0] == '#') {
+        continue;
+      }
+      StreamedSample sample;
+      if (!ParseStreamedSample(line, &sample)) {
+        LOG(ERROR) << "Ignoring malformed sample on line " << line_number
+                   << ": " << line;
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&queue]() { return queue.size() < kMaxQueuedSamples; });
+      queue.push_back(sample);
+      cv.notify_all();
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    input_done = true;
+    cv.notify_all();
+  });
+
+  bool started = false;
+  int64_t trace_start_ns = 0;
+  int64_t playback_start_ns = 0;
+  int64_t max_lateness_ns = 0;
+  size_t injected = 0;
+  Event event;
+  while (true) {
+    StreamedSample sample;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&]() { return !queue.empty() || input_done; });
+      if (queue.empty()) {
+        break;
+      }
+      sample = queue.front();
+      queue.pop_front();
+      cv.notify_all();
+    }
+    auto handle = handles.find(sample.type);
+    if (handle == handles.end()) {
+      LOG(ERROR) << "No sensor of type " << static_cast<int>(sample.type)
+                 << ", dropping its samples";
+      handles.emplace(sample.type, -1);
+      continue;
+    } else if (handle->second == -1) {
+      continue;
+    }
+    if (!started) {
+      started = true;
+      trace_start_ns = sample.timestamp_ns;
+      playback_start_ns = android::elapsedRealtimeNano();
+    }
+    // elapsedRealtimeNano is CLOCK_BOOTTIME, sleep against the same clock.
+    int64_t deadline_ns =
+        playback_start_ns + (sample.timestamp_ns - trace_start_ns);
+    struct timespec deadline = {
+        .tv_sec = static_cast<time_t>(deadline_ns / 1000000000),
+        .tv_nsec = static_cast<long>(deadline_ns % 1000000000),
+    };
+    while (clock_nanosleep(CLOCK_BOOTTIME, TIMER_ABSTIME, &deadline, nullptr) ==
+           EINTR) {
+    }
+
+    event.sensorHandle = handle->second;
+    event.sensorType = sample.type;
+    SetEventPayload(sample, &event);
+    event.timestamp = android::elapsedRealtimeNano();
+    max_lateness_ns = std::max(max_lateness_ns, event.timestamp - deadline_ns);
+    auto result = sensors->injectSensorData(event);
+    if (!result.isOk()) {
+      LOG(FATAL) << "Unable to inject ISensors event: "
+                 << result.getDescription();
+    }
+    injected++;
+  }
+  reader.join();
+
+  LOG(INFO) << "Injected " << injected << " samples, at most "
+            << max_lateness_ns / 1000 << "us late";
+  endSensorInjection(sensors);
+}
+
 int main(int argc, char** argv) {
-  if (argc == 2) {
-    LOG(FATAL) << "Expected command line args 'rotate <portrait|landscape>' or "
-                  "'hinge_angle <value>'";
+  if (argc < 2 || (strcmp(argv[1], "stream") && argc < 3)) {
+    LOG(FATAL) << "Expected command line args 'rotate <portrait|landscape>', "
+                  "'hinge_angle <value>' or 'stream'";
   }
 
   if (!strcmp(argv[1], "rotate")) {
@@ -159,6 +377,8 @@ int main(int argc, char** argv) {
       LOG(FATAL) << "Bad hinge_angle value: " << argv[2];
     }
     InjectHingeAngle(angle);
+  } else if (!strcmp(argv[1], "stream")) {
+    InjectStream();
   } else {
     LOG(FATAL) << "Unknown arg: " << argv[1];
   }
@@ -96,6 +96,13 @@ bool VirtualDeviceBase::SetUp() {
     }
   }
 
+  for (uint32_t msc : GetMsc()) {
+    if (!DoIoctl(fd_, UI_SET_MSCBIT, msc)) {
+      SLOGE("Error setting msc: %" PRIu32, msc);
+      return false;
+    }
+  }
+
   if (write(fd_, &dev_, sizeof(dev_)) < 0) {
     SLOGE("Unable to set input device info (%s)", strerror(errno));
     return false;
@@ -125,7 +132,17 @@ bool VirtualDeviceBase::EmitEvent(uint16_t type,
   return true;
 }
 
-// By default devices have no event types, keys, properties or absolutes,
+bool VirtualDeviceBase::EmitEvents(
+    const std::vector<struct input_event>& events) {
+  auto size = static_cast<ssize_t>(events.size() * sizeof(events[0]));
+  if (write(fd_, events.data(), size) < size) {
+    SLOGE("Events write failed (%s): aborting", strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+// By default devices have no event types, keys, properties, absolutes or msc,
 // subclasses can override this behavior if necessary.
 const std::vector<const uint32_t>& VirtualDeviceBase::GetEventTypes() const {
   static const std::vector<const uint32_t> evt_types{};
@@ -143,3 +160,7 @@ const std::vector<const uint32_t>& VirtualDeviceBase::GetAbs() const {
   static const std::vector<const uint32_t> abs{};
   return abs;
 }
+const std::vector<const uint32_t>& VirtualDeviceBase::GetMsc() const {
+  static const std::vector<const uint32_t> msc{};
+  return msc;
+}
@@ -31,12 +31,15 @@ class VirtualDeviceBase {
 
   bool SetUp();
   bool EmitEvent(uint16_t type, uint16_t code, uint32_t value);
+  // Writes all the events with a single write() call.
+  bool EmitEvents(const std::vector<struct input_event>& events);
 
  protected:
   virtual const std::vector<const uint32_t>& GetEventTypes() const;
   virtual const std::vector<const uint32_t>& GetKeys() const;
   virtual const std::vector<const uint32_t>& GetProperties() const;
   virtual const std::vector<const uint32_t>& GetAbs() const;
+  virtual const std::vector<const uint32_t>& GetMsc() const;
 
   const char* const device_name_;
   const uint16_t bus_type_;
@@ -19,7 +19,7 @@
 namespace cuttlefish_input_service {
 
 const std::vector<const uint32_t>& VirtualTouchScreen::GetEventTypes() const {
-  static const std::vector<const uint32_t> evt_types{EV_ABS, EV_KEY};
+  static const std::vector<const uint32_t> evt_types{EV_ABS, EV_KEY, EV_MSC};
   return evt_types;
 }
 const std::vector<const uint32_t>& VirtualTouchScreen::GetKeys() const {
@@ -34,6 +34,11 @@ const std::vector<const uint32_t>& VirtualTouchScreen::GetAbs() const {
   static const std::vector<const uint32_t> abs{ABS_X, ABS_Y};
   return abs;
 }
+// The host sends the time at which events happened on the client
+const std::vector<const uint32_t>& VirtualTouchScreen::GetMsc() const {
+  static const std::vector<const uint32_t> msc{MSC_TIMESTAMP};
+  return msc;
+}
 
 VirtualTouchScreen::VirtualTouchScreen(uint32_t width, uint32_t height)
     : VirtualDeviceBase("VSoC touchscreen", 0x6006) {
@@ -28,6 +28,7 @@ class VirtualTouchScreen : public VirtualDeviceBase {
   virtual const std::vector<const uint32_t>& GetKeys() const;
   virtual const std::vector<const uint32_t>& GetProperties() const;
   virtual const std::vector<const uint32_t>& GetAbs() const;
+  virtual const std::vector<const uint32_t>& GetMsc() const;
 };
 
 }  // namespace cuttlefish_input_service
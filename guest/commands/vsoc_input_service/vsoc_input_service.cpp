@@ -20,7 +20,9 @@
 #include <linux/uinput.h>
 #include <linux/virtio_input.h>
 
+#include <cstring>
 #include <thread>
+#include <vector>
 
 #include <android-base/logging.h>
 #include <gflags/gflags.h>
@@ -29,7 +31,6 @@
 #include "common/libs/fs/shared_fd.h"
 #include "common/libs/device_config/device_config.h"
 
-using cuttlefish::input_events::InputEvent;
 using cuttlefish_input_service::VirtualDeviceBase;
 using cuttlefish_input_service::VirtualKeyboard;
 using cuttlefish_input_service::VirtualPowerButton;
@@ -41,11 +42,42 @@ DEFINE_uint32(touch_port, 0, "keyboard vsock port");
 
 namespace {
 
+// Events are read in bulk as they come from the host and written to uinput a
+// report at a time, so a whole report costs a single write() no matter how
+// many events it's made of.
 void EventLoop(std::shared_ptr<VirtualDeviceBase> device,
-               std::function<InputEvent()> next_event) {
+               cuttlefish::SharedFD fd, const char* name) {
+  static constexpr size_t kMaxEventsPerRead = 256;
+  std::vector<struct virtio_input_event> events(kMaxEventsPerRead);
+  auto buffer = reinterpret_cast<char*>(events.data());
+  size_t buffer_size = events.size() * sizeof(events[0]);
+  size_t buffered = 0;
+  std::vector<struct input_event> report;
+  report.reserve(kMaxEventsPerRead);
   while (1) {
-    InputEvent event = next_event();
-    device->EmitEvent(event.type, event.code, event.value);
+    auto read = fd->Read(buffer + buffered, buffer_size - buffered);
+    if (read <= 0) {
+      LOG(FATAL) << "Could not read " << name << " event: " << fd->StrError();
+    }
+    buffered += read;
+    size_t count = buffered / sizeof(events[0]);
+    for (size_t i = 0; i < count; ++i) {
+      struct input_event event {};
+      event.type = events[i].type;
+      event.code = events[i].code;
+      event.value = events[i].value;
+      report.push_back(event);
+      // Don't let a misbehaving host grow the report forever
+      if ((event.type == EV_SYN && event.code == SYN_REPORT) ||
+          report.size() >= kMaxEventsPerRead) {
+        device->EmitEvents(report);
+        report.clear();
+      }
+    }
+    // Keep the beginning of an event that didn't arrive whole
+    size_t consumed = count * sizeof(events[0]);
+    memmove(buffer, buffer + consumed, buffered - consumed);
+    buffered -= consumed;
   }
 }
 
@@ -104,30 +136,10 @@ bool VSoCInputService::ProcessEvents() {
 
   // Start device threads
   std::thread screen_thread([this, touch_fd]() {
-    EventLoop(virtual_touchscreen_, [touch_fd]() {
-      struct virtio_input_event event;
-      if (touch_fd->Read(&event, sizeof(event)) != sizeof(event)) {
-        LOG(FATAL) << "Could not read touch event: " << touch_fd->StrError();
-      }
-      return InputEvent {
-        .type = event.type,
-        .code = event.code,
-        .value = event.value,
-      };
-    });
+    EventLoop(virtual_touchscreen_, touch_fd, "touch");
   });
   std::thread keyboard_thread([this, keyboard_fd]() {
-    EventLoop(virtual_keyboard_, [keyboard_fd]() {
-      struct virtio_input_event event;
-      if (keyboard_fd->Read(&event, sizeof(event)) != sizeof(event)) {
-        LOG(FATAL) << "Could not read keyboard event: " << keyboard_fd->StrError();
-      }
-      return InputEvent {
-        .type = event.type,
-        .code = event.code,
-        .value = event.value,
-      };
-    });
+    EventLoop(virtual_keyboard_, keyboard_fd, "keyboard");
   });
 
   screen_thread.join();
@@ -18,6 +18,7 @@
 #include <hidl/Status.h>
 #include <include/convert.h>
 #include <inttypes.h>
+#include <algorithm>
 #include <libyuv.h>
 #include <log/log.h>
 #include "vsock_camera_metadata.h"
@@ -454,6 +455,47 @@ void VsockCameraDeviceSession::tryWriteFmqResult(V3_2::CaptureResult& result) {
 
 using ::android::hardware::camera::device::V3_2::BufferStatus;
 using ::android::hardware::graphics::common::V1_0::PixelFormat;
+
+namespace {
+
+// An output already filled for the current request.
+struct FilledYUVOutput {
+  int32_t width;
+  int32_t height;
+  YCbCrLayout layout;
+};
+
+bool sameChromaLayout(const YCbCrLayout& a, const YCbCrLayout& b) {
+  auto order = [](const YCbCrLayout& layout) {
+    return static_cast<uint8_t*>(layout.cr) > static_cast<uint8_t*>(layout.cb);
+  };
+  return a.chromaStep == b.chromaStep && order(a) == order(b);
+}
+
+void copyYUVLayout(const FilledYUVOutput& src, const YCbCrLayout& dst) {
+  const int w = src.width;
+  const int h = src.height;
+  libyuv::CopyPlane(static_cast<uint8_t*>(src.layout.y), src.layout.yStride,
+                    static_cast<uint8_t*>(dst.y), dst.yStride, w, h);
+  if (src.layout.chromaStep == 1) {
+    libyuv::CopyPlane(static_cast<uint8_t*>(src.layout.cb), src.layout.cStride,
+                      static_cast<uint8_t*>(dst.cb), dst.cStride, w / 2, h / 2);
+    libyuv::CopyPlane(static_cast<uint8_t*>(src.layout.cr), src.layout.cStride,
+                      static_cast<uint8_t*>(dst.cr), dst.cStride, w / 2, h / 2);
+  } else {
+    // Both chroma planes are interleaved, copy them as one starting with the
+    // first of them.
+    auto src_uv = std::min(static_cast<uint8_t*>(src.layout.cb),
+                           static_cast<uint8_t*>(src.layout.cr));
+    auto dst_uv = std::min(static_cast<uint8_t*>(dst.cb),
+                           static_cast<uint8_t*>(dst.cr));
+    libyuv::CopyPlane(src_uv, src.layout.cStride, dst_uv, dst.cStride, w,
+                      h / 2);
+  }
+}
+
+}  // namespace
+
 void VsockCameraDeviceSession::processRequestLoop(
     unsigned int wait_timeout_ms) {
   while (process_requests_.load()) {
@@ -472,8 +514,17 @@ void VsockCameraDeviceSession::processRequestLoop(
       notifyShutter(request.frame_number, request.timestamp);
     }
     std::vector<ReleaseFence> release_fences;
+    // The fences' handles are referenced by result_buffers, and copying them
+    // would close them.
+    release_fences.reserve(request.buffer_ids.size());
     std::vector<StreamBuffer> result_buffers;
     std::vector<uint64_t> pending_buffers;
+    // The frame is scaled and converted once for each size and layout, other
+    // outputs like it copy from the first one, so those are kept locked until
+    // all outputs are filled.
+    std::vector<FilledYUVOutput> filled_outputs;
+    std::vector<std::pair<size_t, std::shared_ptr<CachedStreamBuffer>>>
+        locked_buffers;
     bool request_ok = true;
     for (auto buffer_id : request.buffer_ids) {
       auto buffer = buffer_cache_.get(buffer_id);
@@ -493,9 +544,31 @@ void VsockCameraDeviceSession::processRequestLoop(
                  stream.format == PixelFormat::IMPLEMENTATION_DEFINED) {
         auto dst_yuv =
             buffer->acquireAsYUV(stream.width, stream.height, wait_timeout_ms);
-        has_result =
-            frame_provider_->copyYUVFrame(stream.width, stream.height, dst_yuv);
-        release_fences.emplace_back(buffer->release());
+        auto filled = std::find_if(
+            filled_outputs.begin(), filled_outputs.end(),
+            [&stream, &dst_yuv](const FilledYUVOutput& output) {
+              return output.width == stream.width &&
+                     output.height == stream.height &&
+                     sameChromaLayout(output.layout, dst_yuv);
+            });
+        if (dst_yuv.y != nullptr && filled != filled_outputs.end()) {
+          copyYUVLayout(*filled, dst_yuv);
+          has_result = true;
+        } else {
+          has_result = frame_provider_->copyYUVFrame(stream.width,
+                                                     stream.height, dst_yuv);
+          if (has_result) {
+            filled_outputs.push_back({stream.width, stream.height, dst_yuv});
+          }
+        }
+        locked_buffers.emplace_back(result_buffers.size(), buffer);
+        result_buffers.push_back(
+            {.streamId = buffer->streamId(),
+             .bufferId = buffer->bufferId(),
+             .buffer = nullptr,
+             .status = has_result ? BufferStatus::OK : BufferStatus::ERROR,
+             .releaseFence = nullptr});
+        continue;
       } else if (stream.format == PixelFormat::BLOB) {
         auto time_elapsed = now - request.timestamp;
         if (time_elapsed == 0) {
@@ -537,6 +610,10 @@ void VsockCameraDeviceSession::processRequestLoop(
            .status = has_result ? BufferStatus::OK : BufferStatus::ERROR,
            .releaseFence = release_fences.back().handle()});
     }
+    for (auto& [index, buffer] : locked_buffers) {
+      release_fences.emplace_back(buffer->release());
+      result_buffers[index].releaseFence = release_fences.back().handle();
+    }
     if (!request_ok) {
       continue;
     }
@@ -17,39 +17,55 @@
 #include "vsock_camera_provider_2_7.h"
 #include <cutils/properties.h>
 #include <log/log.h>
+
+#include <algorithm>
+#include <string>
+
 #include "vsock_camera_server.h"
 
 namespace android::hardware::camera::provider::V2_7::implementation {
 
 namespace {
-VsockCameraServer gCameraServer;
-constexpr auto kDeviceName = "device@3.4/external/0";
+// Camera N is served on vsock_camera_port + N
+constexpr int32_t kMaxCameras = 4;
+VsockCameraServer gCameraServers[kMaxCameras];
+constexpr auto kDeviceNamePrefix = "device@3.4/external/";
 }  // namespace
 
 using android::hardware::camera::provider::V2_7::ICameraProvider;
 extern "C" ICameraProvider* HIDL_FETCH_ICameraProvider(const char* name) {
   return (strcmp(name, "external/0") == 0)
-             ? new VsockCameraProvider(&gCameraServer)
+             ? new VsockCameraProvider(gCameraServers)
              : nullptr;
 }
 
-VsockCameraProvider::VsockCameraProvider(VsockCameraServer* server) {
-  server_ = server;
-  if (!server->isRunning()) {
-    constexpr static const auto camera_port_property =
-        "ro.boot.vsock_camera_port";
-    constexpr static const auto camera_cid_property =
-        "ro.boot.vsock_camera_cid";
-    auto port = property_get_int32(camera_port_property, -1);
-    auto cid = property_get_int32(camera_cid_property, -1);
-    if (port > 0) {
-      server->start(port, cid);
+VsockCameraProvider::VsockCameraProvider(VsockCameraServer* servers) {
+  constexpr static const auto camera_port_property =
+      "ro.boot.vsock_camera_port";
+  constexpr static const auto camera_cid_property = "ro.boot.vsock_camera_cid";
+  constexpr static const auto camera_count_property =
+      "ro.boot.vsock_camera_count";
+  auto port = property_get_int32(camera_port_property, -1);
+  auto cid = property_get_int32(camera_cid_property, -1);
+  // Older hosts don't set the count and stream a single camera
+  auto count = std::clamp<int32_t>(
+      property_get_int32(camera_count_property, 1), 1, kMaxCameras);
+  // Each camera has its own connection, so the host streams them
+  // concurrently and switching between them doesn't wait on a new one.
+  cameras_.resize(count);
+  for (int32_t i = 0; i < count; i++) {
+    cameras_[i].name = kDeviceNamePrefix + std::to_string(i);
+    cameras_[i].server = &servers[i];
+    if (port > 0 && !servers[i].isRunning()) {
+      servers[i].start(port + i, cid);
     }
   }
 }
 
 VsockCameraProvider::~VsockCameraProvider() {
-  server_->setConnectedCallback(nullptr);
+  for (auto& camera : cameras_) {
+    camera.server->setConnectedCallback(nullptr);
+  }
 }
 
 Return<Status> VsockCameraProvider::setCallback(
@@ -58,15 +74,20 @@ Return<Status> VsockCameraProvider::setCallback(
     std::lock_guard<std::mutex> lock(mutex_);
     callbacks_ = callback;
   }
-  server_->setConnectedCallback(
-      [this](std::shared_ptr<cuttlefish::VsockConnection> connection,
-             VsockCameraDevice::Settings settings) {
-        connection_ = connection;
-        settings_ = settings;
-        deviceAdded(kDeviceName);
-        connection_->SetDisconnectCallback(
-            [this] { deviceRemoved(kDeviceName); });
-      });
+  for (auto& camera : cameras_) {
+    camera.server->setConnectedCallback(
+        [this, &camera](std::shared_ptr<cuttlefish::VsockConnection> connection,
+                        VsockCameraDevice::Settings settings) {
+          {
+            std::lock_guard<std::mutex> lock(mutex_);
+            camera.connection = connection;
+            camera.settings = settings;
+          }
+          deviceAdded(camera.name.c_str());
+          connection->SetDisconnectCallback(
+              [this, &camera] { deviceRemoved(camera.name.c_str()); });
+        });
+  }
   return Status::OK;
 }
 
@@ -107,12 +128,22 @@ Return<void> VsockCameraProvider::getCameraDeviceInterface_V3_x(
     const hidl_string& name_hidl_str,
     ICameraProvider::getCameraDeviceInterface_V3_x_cb _hidl_cb) {
   std::string name(name_hidl_str.c_str());
-  if (name != kDeviceName) {
+  auto camera = std::find_if(
+      cameras_.begin(), cameras_.end(),
+      [&name](const Camera& camera) { return camera.name == name; });
+  if (camera == cameras_.end()) {
     _hidl_cb(Status::ILLEGAL_ARGUMENT, nullptr);
     return Void();
   }
 
-  _hidl_cb(Status::OK, new VsockCameraDevice(name, settings_, connection_));
+  std::shared_ptr<cuttlefish::VsockConnection> connection;
+  VsockCameraDevice::Settings settings;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    connection = camera->connection;
+    settings = camera->settings;
+  }
+  _hidl_cb(Status::OK, new VsockCameraDevice(name, settings, connection));
   return Void();
 }
 
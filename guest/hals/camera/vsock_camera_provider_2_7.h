@@ -16,6 +16,8 @@
 #pragma once
 
 #include <mutex>
+#include <string>
+#include <vector>
 
 #include <android/hardware/camera/provider/2.7/ICameraProvider.h>
 #include <hidl/MQDescriptor.h>
@@ -42,7 +44,8 @@ using ::android::hardware::camera::provider::V2_7::ICameraProvider;
 
 class VsockCameraProvider : public ICameraProvider {
  public:
-  VsockCameraProvider(VsockCameraServer* server);
+  // Takes the servers of every camera the device may have, one per port.
+  VsockCameraProvider(VsockCameraServer* servers);
   ~VsockCameraProvider();
 
   Return<Status> setCallback(
@@ -71,11 +74,16 @@ class VsockCameraProvider : public ICameraProvider {
  private:
   void deviceRemoved(const char* name);
   void deviceAdded(const char* name);
+  struct Camera {
+    std::string name;
+    VsockCameraServer* server;
+    std::shared_ptr<cuttlefish::VsockConnection> connection;
+    VsockCameraDevice::Settings settings;
+  };
   std::mutex mutex_;
   sp<ICameraProviderCallback> callbacks_;
-  std::shared_ptr<cuttlefish::VsockConnection> connection_;
-  VsockCameraDevice::Settings settings_;
-  VsockCameraServer* server_;
+  // Sized once, the connected callbacks keep references to the elements
+  std::vector<Camera> cameras_;
 };
 
 }  // namespace android::hardware::camera::provider::V2_7::implementation
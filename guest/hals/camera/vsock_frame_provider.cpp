@@ -14,8 +14,11 @@
  * limitations under the License.
  */
 #include "vsock_frame_provider.h"
+#include <cutils/properties.h>
+#include <fcntl.h>
 #include <hardware/camera3.h>
 #include <libyuv.h>
+#include <unistd.h>
 #include <cstring>
 #define LOG_TAG "VsockFrameProvider"
 #include <log/log.h>
@@ -25,14 +28,41 @@ namespace cuttlefish {
 namespace {
 bool writeJsonEventMessage(
     std::shared_ptr<cuttlefish::VsockConnection> connection,
-    const std::string& message) {
+    const std::string& message, bool shared_frames = false) {
   Json::Value json_message;
   json_message["event"] = message;
+  if (shared_frames) {
+    json_message["shared_frames"] = true;
+  }
   return connection && connection->WriteMessage(json_message);
 }
+
+// O_DIRECT transfers need to be aligned to the logical block size.
+constexpr size_t kDirectIoAlignment = 4096;
+
+size_t alignUp(size_t value) {
+  return (value + kDirectIoAlignment - 1) & ~(kDirectIoAlignment - 1);
+}
+
+bool readDirect(int fd, std::vector<char>& buffer, size_t& offset, off_t pos,
+                size_t size) {
+  buffer.resize(alignUp(size) + kDirectIoAlignment);
+  auto address = reinterpret_cast<uintptr_t>(buffer.data());
+  offset = alignUp(address) - address;
+  auto read = TEMP_FAILURE_RETRY(
+      pread(fd, buffer.data() + offset, alignUp(size), pos));
+  buffer.resize(offset + size);
+  return read >= static_cast<ssize_t>(size);
+}
+
 }  // namespace
 
-VsockFrameProvider::~VsockFrameProvider() { stop(); }
+VsockFrameProvider::~VsockFrameProvider() {
+  stop();
+  if (frame_ring_fd_ >= 0) {
+    close(frame_ring_fd_);
+  }
+}
 
 void VsockFrameProvider::start(
     std::shared_ptr<cuttlefish::VsockConnection> connection, uint32_t width,
@@ -40,7 +70,10 @@ void VsockFrameProvider::start(
   stop();
   running_ = true;
   connection_ = connection;
-  writeJsonEventMessage(connection, "VIRTUAL_DEVICE_START_CAMERA_SESSION");
+  frame_width_ = width;
+  frame_height_ = height;
+  writeJsonEventMessage(connection, "VIRTUAL_DEVICE_START_CAMERA_SESSION",
+                        openFrameRing());
   reader_thread_ =
       std::thread([this, width, height] { VsockReadLoop(width, height); });
 }
@@ -71,43 +104,65 @@ void VsockFrameProvider::requestJpeg() {
 void VsockFrameProvider::cancelJpegRequest() { jpeg_pending_ = false; }
 
 bool VsockFrameProvider::copyYUVFrame(uint32_t w, uint32_t h, YCbCrLayout dst) {
-  size_t y_size = w * h;
-  size_t cbcr_size = (w / 2) * (h / 2);
+  const uint32_t fw = frame_width_;
+  const uint32_t fh = frame_height_;
+  size_t y_size = fw * fh;
+  size_t cbcr_size = (fw / 2) * (fh / 2);
   size_t total_size = y_size + 2 * cbcr_size;
   std::lock_guard<std::mutex> lock(frame_mutex_);
-  if (frame_.size() < total_size) {
-    ALOGE("%s: %zu is too little for %ux%u frame", __FUNCTION__, frame_.size(),
-          w, h);
+  if (frame_.size() - frame_offset_ < total_size) {
+    ALOGE("%s: %zu is too little for %ux%u frame", __FUNCTION__,
+          frame_.size() - frame_offset_, fw, fh);
     return false;
   }
   if (dst.y == nullptr) {
     ALOGE("%s: Destination is nullptr!", __FUNCTION__);
     return false;
   }
-  YCbCrLayout src{.y = static_cast<void*>(frame_.data()),
-                  .cb = static_cast<void*>(frame_.data() + y_size),
-                  .cr = static_cast<void*>(frame_.data() + y_size + cbcr_size),
-                  .yStride = w,
-                  .cStride = w / 2,
-                  .chromaStep = 1};
-  uint8_t* src_y = static_cast<uint8_t*>(src.y);
+  uint8_t* src_y = reinterpret_cast<uint8_t*>(frame_.data() + frame_offset_);
+  uint8_t* src_cb = src_y + y_size;
+  uint8_t* src_cr = src_cb + cbcr_size;
+  uint32_t src_stride = fw;
+  uint32_t src_cstride = fw / 2;
   uint8_t* dst_y = static_cast<uint8_t*>(dst.y);
-  uint8_t* src_cb = static_cast<uint8_t*>(src.cb);
   uint8_t* dst_cb = static_cast<uint8_t*>(dst.cb);
-  uint8_t* src_cr = static_cast<uint8_t*>(src.cr);
   uint8_t* dst_cr = static_cast<uint8_t*>(dst.cr);
-  libyuv::CopyPlane(src_y, src.yStride, dst_y, dst.yStride, w, h);
+  if (w != fw || h != fh) {
+    if (dst.chromaStep == 1) {
+      // Planar destinations are scaled into directly
+      return libyuv::I420Scale(src_y, src_stride, src_cb, src_cstride, src_cr,
+                               src_cstride, fw, fh, dst_y, dst.yStride, dst_cb,
+                               dst.cStride, dst_cr, dst.cStride, w, h,
+                               libyuv::kFilterBilinear) == 0;
+    }
+    scaled_frame_.resize(w * h + 2 * (w / 2) * (h / 2));
+    uint8_t* scaled_y = scaled_frame_.data();
+    uint8_t* scaled_cb = scaled_y + w * h;
+    uint8_t* scaled_cr = scaled_cb + (w / 2) * (h / 2);
+    if (libyuv::I420Scale(src_y, src_stride, src_cb, src_cstride, src_cr,
+                          src_cstride, fw, fh, scaled_y, w, scaled_cb, w / 2,
+                          scaled_cr, w / 2, w, h,
+                          libyuv::kFilterBilinear) != 0) {
+      return false;
+    }
+    src_y = scaled_y;
+    src_cb = scaled_cb;
+    src_cr = scaled_cr;
+    src_stride = w;
+    src_cstride = w / 2;
+  }
+  libyuv::CopyPlane(src_y, src_stride, dst_y, dst.yStride, w, h);
   if (dst.chromaStep == 1) {
     // Planar
-    libyuv::CopyPlane(src_cb, src.cStride, dst_cb, dst.cStride, w / 2, h / 2);
-    libyuv::CopyPlane(src_cr, src.cStride, dst_cr, dst.cStride, w / 2, h / 2);
+    libyuv::CopyPlane(src_cb, src_cstride, dst_cb, dst.cStride, w / 2, h / 2);
+    libyuv::CopyPlane(src_cr, src_cstride, dst_cr, dst.cStride, w / 2, h / 2);
   } else if (dst.chromaStep == 2 && dst_cr - dst_cb == 1) {
     // Interleaved cb/cr planes starting with cb
-    libyuv::MergeUVPlane(src_cb, src.cStride, src_cr, src.cStride, dst_cb,
+    libyuv::MergeUVPlane(src_cb, src_cstride, src_cr, src_cstride, dst_cb,
                          dst.cStride, w / 2, h / 2);
   } else if (dst.chromaStep == 2 && dst_cb - dst_cr == 1) {
     // Interleaved cb/cr planes starting with cr
-    libyuv::MergeUVPlane(src_cr, src.cStride, src_cb, src.cStride, dst_cr,
+    libyuv::MergeUVPlane(src_cr, src_cstride, src_cb, src_cstride, dst_cr,
                          dst.cStride, w / 2, h / 2);
   } else {
     ALOGE("%s: Unsupported interleaved U/V layout", __FUNCTION__);
@@ -155,11 +210,18 @@ bool VsockFrameProvider::framesizeMatches(uint32_t width, uint32_t height,
 void VsockFrameProvider::VsockReadLoop(uint32_t width, uint32_t height) {
   jpeg_pending_ = false;
   while (running_.load() && connection_->ReadMessage(next_frame_)) {
-    if (framesizeMatches(width, height, next_frame_)) {
+    next_frame_offset_ = 0;
+    const bool is_descriptor = IsCameraFrameDescriptor(next_frame_);
+    if (framesizeMatches(width, height, next_frame_) ||
+        (is_descriptor && readSharedFrame(next_frame_, width, height))) {
       std::lock_guard<std::mutex> lock(frame_mutex_);
       timestamp_ = systemTime();
       frame_.swap(next_frame_);
+      std::swap(frame_offset_, next_frame_offset_);
       yuv_frame_updated_.notify_one();
+    } else if (is_descriptor) {
+      // A frame the host overwrote already, a newer one is on its way.
+      continue;
     } else if (isBlob(next_frame_)) {
       std::lock_guard<std::mutex> lock(jpeg_mutex_);
       bool was_pending = jpeg_pending_.exchange(false);
@@ -177,4 +239,79 @@ void VsockFrameProvider::VsockReadLoop(uint32_t width, uint32_t height) {
   }
 }
 
+bool VsockFrameProvider::openFrameRing() {
+  if (frame_ring_fd_ >= 0) {
+    return true;
+  }
+  char path[PROPERTY_VALUE_MAX];
+  if (property_get("ro.vendor.camera.pmem", path, "") <= 0) {
+    return false;
+  }
+  // The block device's page cache would hide the host's later writes, so
+  // the frames are read directly from the persistent memory instead.
+  int fd = TEMP_FAILURE_RETRY(open(path, O_RDONLY | O_DIRECT | O_CLOEXEC));
+  if (fd < 0) {
+    ALOGW("%s: Unable to open %s, frames will come over vsock", __FUNCTION__,
+          path);
+    return false;
+  }
+  std::vector<char> buffer;
+  size_t offset;
+  if (!readDirect(fd, buffer, offset, 0, sizeof(CameraFrameRingHeader))) {
+    close(fd);
+    return false;
+  }
+  auto header =
+      reinterpret_cast<const CameraFrameRingHeader*>(buffer.data() + offset);
+  if (header->magic != kCameraFrameRingMagic ||
+      header->version != kCameraFrameRingVersion || header->slot_count == 0 ||
+      header->slot_count > kCameraFrameRingMaxSlots) {
+    ALOGW("%s: %s is not set up by the host", __FUNCTION__, path);
+    close(fd);
+    return false;
+  }
+  frame_ring_slot_count_ = header->slot_count;
+  frame_ring_slot_size_ = header->slot_size;
+  frame_ring_fd_ = fd;
+  return true;
+}
+
+bool VsockFrameProvider::readSharedFrame(const std::vector<char>& message,
+                                         uint32_t width, uint32_t height) {
+  CameraFrameDescriptor descriptor;
+  std::memcpy(&descriptor, message.data(), sizeof(descriptor));
+  if (frame_ring_fd_ < 0 || descriptor.slot >= frame_ring_slot_count_) {
+    ALOGE("%s: Unexpected frame descriptor", __FUNCTION__);
+    return false;
+  }
+  // The sequence is checked again after reading the frame, in case the host
+  // started writing a new one to the same slot meanwhile.
+  std::vector<char> buffer;
+  size_t offset;
+  auto read_slot = [&]() -> const CameraFrameSlot* {
+    if (!readDirect(frame_ring_fd_, buffer, offset, 0,
+                    sizeof(CameraFrameRingHeader))) {
+      return nullptr;
+    }
+    auto header =
+        reinterpret_cast<const CameraFrameRingHeader*>(buffer.data() + offset);
+    auto slot = &header->slots[descriptor.slot];
+    return slot->sequence.load() == descriptor.sequence ? slot : nullptr;
+  };
+  auto slot = read_slot();
+  if (!slot || slot->width != width || slot->height != height ||
+      slot->size != 3 * width * height / 2) {
+    return false;
+  }
+  const uint32_t size = slot->size;
+  off_t pos = kCameraFrameRingHeaderSize +
+              static_cast<off_t>(descriptor.slot) * frame_ring_slot_size_;
+  if (!readDirect(frame_ring_fd_, next_frame_, next_frame_offset_, pos,
+                  size)) {
+    ALOGE("%s: Failed to read shared frame", __FUNCTION__);
+    return false;
+  }
+  return read_slot() != nullptr;
+}
+
 }  // namespace cuttlefish
@@ -19,6 +19,7 @@
 #include <mutex>
 #include <thread>
 #include <vector>
+#include "camera_frame_ring.h"
 #include "utils/Timers.h"
 #include "vsock_connection.h"
 
@@ -44,6 +45,8 @@ class VsockFrameProvider {
   bool jpegPending() const { return jpeg_pending_.load(); }
   bool isRunning() const { return running_.load(); }
   bool waitYUVFrame(unsigned int max_wait_ms);
+  // Scales the latest frame to the given size if needed, converting it to the
+  // destination's chroma layout.
   bool copyYUVFrame(uint32_t width, uint32_t height, YCbCrLayout dst);
   bool copyJpegData(uint32_t size, void* dst);
 
@@ -52,6 +55,9 @@ class VsockFrameProvider {
   bool framesizeMatches(uint32_t width, uint32_t height,
                         const std::vector<char>& data);
   void VsockReadLoop(uint32_t expected_width, uint32_t expected_height);
+  bool openFrameRing();
+  bool readSharedFrame(const std::vector<char>& descriptor, uint32_t width,
+                       uint32_t height);
   std::thread reader_thread_;
   std::mutex frame_mutex_;
   std::mutex jpeg_mutex_;
@@ -60,6 +66,18 @@ class VsockFrameProvider {
   std::atomic<bool> jpeg_pending_;
   std::vector<char> frame_;
   std::vector<char> next_frame_;
+  // Where the frame starts in frame_ and next_frame_, shared frames are read
+  // into them at an alignment suitable for O_DIRECT.
+  size_t frame_offset_ = 0;
+  size_t next_frame_offset_ = 0;
+  // Memory the host writes frames into, see camera_frame_ring.h.
+  int frame_ring_fd_ = -1;
+  uint32_t frame_width_ = 0;
+  uint32_t frame_height_ = 0;
+  // Intermediate I420 frame for scaling into interleaved layouts
+  std::vector<uint8_t> scaled_frame_;
+  uint32_t frame_ring_slot_count_ = 0;
+  uint32_t frame_ring_slot_size_ = 0;
   std::vector<char> cached_jpeg_;
   std::condition_variable yuv_frame_updated_;
   std::shared_ptr<cuttlefish::VsockConnection> connection_;
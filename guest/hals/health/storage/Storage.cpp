@@ -16,22 +16,124 @@
 
 #include "Storage.h"
 
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/statvfs.h>
+
+#include <algorithm>
+#include <thread>
+
 #include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+#include <android/binder_manager.h>
 
 namespace aidl::android::hardware::health::storage {
 
+namespace {
+
+// Filesystems backed by the writable overlay disks. Freed blocks are only
+// returned to the host once the guest discards them.
+constexpr const char* kTrimTargets[] = {"/data", "/metadata"};
+
+// FITRIM is issued in slices of this size so a pass can stop at the
+// deadline and report progress between slices.
+constexpr uint64_t kTrimSliceBytes = 1ULL << 30;
+
+Result TrimFilesystem(const char* path,
+                      std::chrono::steady_clock::time_point deadline) {
+  ::android::base::unique_fd fd(
+      open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+  if (fd < 0) {
+    PLOG(WARNING) << "Cannot open " << path;
+    return Result::IO_ERROR;
+  }
+  struct statvfs st;
+  if (fstatvfs(fd, &st) < 0) {
+    PLOG(WARNING) << "Cannot stat " << path;
+    return Result::IO_ERROR;
+  }
+  uint64_t size = static_cast<uint64_t>(st.f_blocks) * st.f_frsize;
+
+  uint64_t trimmed = 0;
+  for (uint64_t start = 0; start < size; start += kTrimSliceBytes) {
+    if (std::chrono::steady_clock::now() >= deadline) {
+      LOG(INFO) << "Deadline reached trimming " << path << " at "
+                << (start * 100 / size) << "%";
+      break;
+    }
+    struct fstrim_range range = {
+        .start = start,
+        .len = std::min(kTrimSliceBytes, size - start),
+        .minlen = 0,
+    };
+    if (ioctl(fd, FITRIM, &range) < 0) {
+      PLOG(WARNING) << "FITRIM failed on " << path;
+      return Result::IO_ERROR;
+    }
+    // The kernel rewrites len with the number of bytes actually discarded
+    trimmed += range.len;
+    LOG(VERBOSE) << "Trimmed " << path << " "
+                 << (std::min(start + kTrimSliceBytes, size) * 100 / size) << "%";
+  }
+  LOG(INFO) << "Discarded " << (trimmed >> 20) << " MiB on " << path;
+  return Result::SUCCESS;
+}
+
+}  // namespace
+
 ndk::ScopedAStatus
-Storage::garbageCollect(int64_t /*timeout_seconds*/,
+Storage::garbageCollect(int64_t timeout_seconds,
                         const std::shared_ptr<IGarbageCollectCallback> &cb) {
-  LOG(INFO) << "IStorage::garbageCollect() is called. Nothing to do.";
+  LOG(INFO) << "IStorage::garbageCollect() is called with timeout "
+            << timeout_seconds << "s";
+  std::lock_guard lock(mutex_);
   if (cb != nullptr) {
-    auto ret = cb->onFinish(Result::SUCCESS);
-    if (!ret.isOk()) {
-      LOG(WARNING) << "Cannot return result to callback: "
-                   << ret.getDescription();
-    }
+    callbacks_.push_back(cb);
   }
+  if (running_) {
+    // Callers arriving mid-pass are answered when that pass finishes
+    return ndk::ScopedAStatus::ok();
+  }
+  running_ = true;
+  // Keep the lazy service alive until the callbacks have been answered
+  AServiceManager_forceLazyServicesPersist(true);
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::seconds(std::max<int64_t>(timeout_seconds, 0));
+  std::thread([this, deadline] { RunGarbageCollect(deadline); }).detach();
   return ndk::ScopedAStatus::ok();
 }
 
+void Storage::RunGarbageCollect(
+    std::chrono::steady_clock::time_point deadline) {
+  Result result = Result::SUCCESS;
+  for (const auto* path : kTrimTargets) {
+    auto ret = TrimFilesystem(path, deadline);
+    if (ret != Result::SUCCESS) {
+      result = ret;
+    }
+  }
+
+  // Callers that arrive while results are being delivered share this pass
+  for (;;) {
+    std::vector<std::shared_ptr<IGarbageCollectCallback>> callbacks;
+    {
+      std::lock_guard lock(mutex_);
+      callbacks.swap(callbacks_);
+      if (callbacks.empty()) {
+        running_ = false;
+        AServiceManager_forceLazyServicesPersist(false);
+        return;
+      }
+    }
+    for (const auto& callback : callbacks) {
+      auto ret = callback->onFinish(result);
+      if (!ret.isOk()) {
+        LOG(WARNING) << "Cannot return result to callback: "
+                     << ret.getDescription();
+      }
+    }
+  }
+}
+
 } // namespace aidl::android::hardware::health::storage
@@ -16,14 +16,29 @@
 
 #pragma once
 
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include <aidl/android/hardware/health/storage/BnStorage.h>
 
 namespace aidl::android::hardware::health::storage {
 
 class Storage : public BnStorage {
+ public:
   ndk::ScopedAStatus
   garbageCollect(int64_t timeout_seconds,
                  const std::shared_ptr<IGarbageCollectCallback> &cb) override;
+
+ private:
+  // Trims the guest filesystems on a worker thread until done or the
+  // deadline passes, then reports to every callback queued meanwhile.
+  void RunGarbageCollect(std::chrono::steady_clock::time_point deadline);
+
+  std::mutex mutex_;
+  bool running_ = false;
+  std::vector<std::shared_ptr<IGarbageCollectCallback>> callbacks_;
 };
 
 } // namespace aidl::android::hardware::health::storage
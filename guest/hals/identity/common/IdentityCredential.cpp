@@ -310,6 +310,23 @@ ndk::ScopedAStatus IdentityCredential::startRetrieval(
           IIdentityCredentialStore::STATUS_READER_SIGNATURE_CHECK_FAILED,
           "Error splitting certificate chain from COSE_Sign1"));
     }
+    // Every reader certificate is compared against every remaining ACP, so
+    // extract the public key of each ACP certificate only once.
+    map<int32_t, vector<uint8_t>> profilePubKeys;
+    for (const SecureAccessControlProfile& profile : remainingAcps) {
+      if (profile.readerCertificate.encodedCertificate.size() == 0) {
+        continue;
+      }
+      optional<vector<uint8_t>> profilePubKey =
+          support::certificateChainGetTopMostKey(
+              profile.readerCertificate.encodedCertificate);
+      if (!profilePubKey) {
+        return ndk::ScopedAStatus(AStatus_fromServiceSpecificErrorWithMessage(
+            IIdentityCredentialStore::STATUS_FAILED,
+            "Error getting public key from profile"));
+      }
+      profilePubKeys[profile.id] = std::move(profilePubKey.value());
+    }
     for (ssize_t n = splitCerts.value().size() - 1; n >= 0; --n) {
       const vector<uint8_t>& x509Cert = splitCerts.value()[n];
       if (!hwProxy_->pushReaderCert(x509Cert)) {
@@ -337,19 +354,12 @@ ndk::ScopedAStatus IdentityCredential::startRetrieval(
       vector<SecureAccessControlProfile>::iterator it = remainingAcps.begin();
       while (it != remainingAcps.end()) {
         const SecureAccessControlProfile& profile = *it;
-        if (profile.readerCertificate.encodedCertificate.size() == 0) {
+        auto profilePubKey = profilePubKeys.find(profile.id);
+        if (profilePubKey == profilePubKeys.end()) {
           ++it;
           continue;
         }
-        optional<vector<uint8_t>> profilePubKey =
-            support::certificateChainGetTopMostKey(
-                profile.readerCertificate.encodedCertificate);
-        if (!profilePubKey) {
-          return ndk::ScopedAStatus(AStatus_fromServiceSpecificErrorWithMessage(
-              IIdentityCredentialStore::STATUS_FAILED,
-              "Error getting public key from profile"));
-        }
-        if (profilePubKey.value() == x509CertPubKey.value()) {
+        if (profilePubKey->second == x509CertPubKey.value()) {
           optional<bool> res = hwProxy_->validateAccessControlProfile(
               profile.id, profile.readerCertificate.encodedCertificate,
               profile.userAuthenticationRequired, profile.timeoutMillis,
@@ -26,24 +26,50 @@ namespace keymaster {
 
 RemoteKeymaster::RemoteKeymaster(cuttlefish::KeymasterChannel* channel,
                                  int32_t message_version)
-    : channel_(channel), message_version_(message_version) {}
+    : channel_(channel),
+      message_version_(message_version),
+      // Set by hosts whose secure_env answers tagged messages
+      pipelined_(android::base::GetBoolProperty("ro.boot.keymint_pipelined",
+                                                false)) {}
 
 RemoteKeymaster::~RemoteKeymaster() {}
 
 void RemoteKeymaster::ForwardCommand(AndroidKeymasterCommand command,
                                      const Serializable& req,
                                      KeymasterResponse* rsp) {
-  if (!channel_->SendRequest(command, req)) {
+  std::unique_lock<std::mutex> untagged_lock(untagged_mutex_, std::defer_lock);
+  uint32_t request_id = 0;
+  if (pipelined_) {
+    // 0 is reserved for untagged requests
+    do {
+      request_id = next_request_id_++;
+    } while (request_id == 0);
+  } else {
+    untagged_lock.lock();
+  }
+  {
+    std::lock_guard<std::mutex> lock(responses_mutex_);
+    pending_.insert(request_id);
+  }
+  if (!channel_->SendRequest(command, req, request_id)) {
     LOG(ERROR) << "Failed to send keymaster message: " << command;
+    std::lock_guard<std::mutex> lock(responses_mutex_);
+    pending_.erase(request_id);
     rsp->error = KM_ERROR_UNKNOWN_ERROR;
     return;
   }
-  auto response = channel_->ReceiveMessage();
+  auto response = AwaitResponse(request_id);
   if (!response) {
     LOG(ERROR) << "Failed to receive keymaster response: " << command;
     rsp->error = KM_ERROR_UNKNOWN_ERROR;
     return;
   }
+  if (response->cmd != command) {
+    LOG(ERROR) << "Received keymaster response to " << response->cmd
+               << " for request " << request_id << " to " << command;
+    rsp->error = KM_ERROR_UNKNOWN_ERROR;
+    return;
+  }
   const uint8_t* buffer = response->payload;
   const uint8_t* buffer_end = response->payload + response->payload_size;
   if (!rsp->Deserialize(&buffer, buffer_end)) {
@@ -53,6 +79,53 @@ void RemoteKeymaster::ForwardCommand(AndroidKeymasterCommand command,
   }
 }
 
+cuttlefish::ManagedKeymasterMessage RemoteKeymaster::AwaitResponse(
+    uint32_t request_id) {
+  std::unique_lock<std::mutex> lock(responses_mutex_);
+  while (true) {
+    auto it = responses_.find(request_id);
+    if (it != responses_.end()) {
+      auto response = std::move(it->second);
+      responses_.erase(it);
+      pending_.erase(request_id);
+      return response;
+    }
+    if (receiving_) {
+      responses_cv_.wait(lock);
+      continue;
+    }
+    // Nobody is reading the channel, read on behalf of every waiter.
+    receiving_ = true;
+    lock.unlock();
+    uint32_t message_request_id = 0;
+    auto message = channel_->ReceiveMessage(&message_request_id);
+    lock.lock();
+    receiving_ = false;
+    // Either hands over a response or lets another waiter take over reading.
+    responses_cv_.notify_all();
+    if (!message) {
+      pending_.erase(request_id);
+      return {};
+    }
+    if (!message->is_response) {
+      LOG(ERROR) << "Dropping unexpected keymaster request from host: "
+                 << message->cmd;
+      continue;
+    }
+    if (message_request_id == request_id) {
+      pending_.erase(request_id);
+      return message;
+    }
+    if (pending_.count(message_request_id) == 0) {
+      // Nobody would ever take it
+      LOG(ERROR) << "Dropping keymaster response " << message->cmd
+                 << " to unknown request " << message_request_id;
+      continue;
+    }
+    responses_.emplace(message_request_id, std::move(message));
+  }
+}
+
 bool RemoteKeymaster::Initialize() {
   // We don't need to bother with GetVersion, because CF HAL and remote sides
   // are always compiled together, so will never disagree about message
@@ -17,19 +17,46 @@
 #ifndef REMOTE_KEYMASTER_H_
 #define REMOTE_KEYMASTER_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+
 #include <keymaster/android_keymaster_messages.h>
 
 #include "common/libs/security/keymaster_channel.h"
 
 namespace keymaster {
 
+/*
+ * Forwards KeyMint calls to the host. Calls may be made from several binder
+ * threads at once. When the host advertises it understands tagged messages,
+ * each request is tagged with an id, and whichever caller is waiting reads
+ * responses off the channel and hands them to their owners, so independent
+ * operations are in flight together instead of queueing behind each other's
+ * round trips. Otherwise the calls take turns.
+ */
 class RemoteKeymaster {
  private:
   cuttlefish::KeymasterChannel* channel_;
   const int32_t message_version_;
+  const bool pipelined_;
+
+  // Held for the whole round trip of untagged requests
+  std::mutex untagged_mutex_;
+  std::atomic<uint32_t> next_request_id_{1};
+  std::mutex responses_mutex_;
+  std::condition_variable responses_cv_;
+  // Requests waiting for their response
+  std::set<uint32_t> pending_;
+  // Responses received on behalf of another caller, by request id
+  std::map<uint32_t, cuttlefish::ManagedKeymasterMessage> responses_;
+  bool receiving_ = false;
 
   void ForwardCommand(AndroidKeymasterCommand command, const Serializable& req,
                       KeymasterResponse* rsp);
+  cuttlefish::ManagedKeymasterMessage AwaitResponse(uint32_t request_id);
 
  public:
   RemoteKeymaster(cuttlefish::KeymasterChannel*,
@@ -36,6 +36,7 @@
 namespace {
 
 const char device[] = "/dev/hvc3";
+constexpr uint32_t kBinderThreads = 4;
 
 using aidl::android::hardware::security::keymint::RemoteKeyMintDevice;
 using aidl::android::hardware::security::keymint::
@@ -75,9 +76,10 @@ SecurityLevel getSecurityLevel(::keymaster::RemoteKeymaster& remote_keymaster) {
 
 int main(int, char** argv) {
   android::base::InitLogging(argv, android::base::KernelLogger);
-  // Zero threads seems like a useless pool, but below we'll join this thread to
-  // it, increasing the pool size to 1.
-  ABinderProcess_setThreadPoolMaxThreadCount(0);
+  // RemoteKeymaster multiplexes concurrent calls over the channel, so let
+  // independent KeyMint calls from keystore2 run on their own binder threads.
+  // The main thread joins the pool below as well.
+  ABinderProcess_setThreadPoolMaxThreadCount(kBinderThreads - 1);
   // Add Keymint Service
   auto fd = cuttlefish::SharedFD::Open(device, O_RDWR);
   if (!fd->IsOpen()) {
@@ -105,6 +107,7 @@ int main(int, char** argv) {
   addService<RemoteSharedSecret>(remote_keymaster);
   addService<RemoteRemotelyProvisionedComponent>(remote_keymaster);
 
+  ABinderProcess_startThreadPool();
   ABinderProcess_joinThreadPool();
   return EXIT_FAILURE;  // should not reach
 }
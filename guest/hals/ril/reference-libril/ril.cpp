@@ -279,7 +279,7 @@ static void rilEventAddWakeup(struct ril_event *ev) {
 }
 
 /**
- * A write on the wakeup fd is done just to pop us out of select()
+ * A write on the wakeup fd is done just to pop us out of epoll_wait()
  * We empty the buffer here and then ril_event will reset the timers on the
  * way back down
  */
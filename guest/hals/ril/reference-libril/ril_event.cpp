@@ -17,6 +17,7 @@
 
 #define LOG_TAG "RILC"
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
@@ -24,7 +25,9 @@
 #include <utils/Log.h>
 #include <ril_event.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <time.h>
 
 #include <pthread.h>
@@ -53,23 +56,21 @@ static pthread_mutex_t listMutex;
         : (a)->tv_sec op (b)->tv_sec)
 #endif
 
-#ifndef timersub
-#define timersub(a, b, res)                           \
-    do {                                              \
-        (res)->tv_sec = (a)->tv_sec - (b)->tv_sec;    \
-        (res)->tv_usec = (a)->tv_usec - (b)->tv_usec; \
-        if ((res)->tv_usec < 0) {                     \
-            (res)->tv_usec += 1000000;                \
-            (res)->tv_sec -= 1;                       \
-        }                                             \
-    } while(0);
-#endif
 
-static fd_set readFds;
-static int nfds = 0;
+static int epollFd = -1;
+static int timerFd = -1;
+
+// Watched events indexed by fd, so a ready fd whose watch was dropped by
+// another thread after epoll_wait() returned is simply skipped.
+static struct ril_event ** watch_table = NULL;
+static int watch_table_size = 0;
+
+// Binary min-heap of pending timers ordered by timeout; ev->index is the
+// event's slot.
+static struct ril_event ** timer_heap = NULL;
+static int timer_count = 0;
+static int timer_capacity = 0;
 
-static struct ril_event * watch_table[MAX_FD_EVENTS];
-static struct ril_event timer_list;
 static struct ril_event pending_list;
 
 #define DEBUG 0
@@ -82,6 +83,7 @@ static void dump_event(struct ril_event * ev)
     dlog("     next    = %x", (unsigned int)ev->next);
     dlog("     prev    = %x", (unsigned int)ev->prev);
     dlog("     fd      = %d", ev->fd);
+    dlog("     index   = %d", ev->index);
     dlog("     pers    = %d", ev->persist);
     dlog("     timeout = %ds + %dus", (int)ev->timeout.tv_sec, (int)ev->timeout.tv_usec);
     dlog("     func    = %x", (unsigned int)ev->func);
@@ -130,28 +132,102 @@ static void removeFromList(struct ril_event * ev)
     dlog("~~~~ -removeFromList ~~~~");
 }
 
+static bool heapLess(int a, int b)
+{
+    return timercmp(&timer_heap[a]->timeout, &timer_heap[b]->timeout, <);
+}
 
-static void removeWatch(struct ril_event * ev, int index)
+static void heapSwap(int a, int b)
 {
-    dlog("~~~~ +removeWatch ~~~~");
-    watch_table[index] = NULL;
-    ev->index = -1;
+    struct ril_event * tmp = timer_heap[a];
+    timer_heap[a] = timer_heap[b];
+    timer_heap[b] = tmp;
+    timer_heap[a]->index = a;
+    timer_heap[b]->index = b;
+}
 
-    FD_CLR(ev->fd, &readFds);
+static void heapSiftUp(int i)
+{
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!heapLess(i, parent)) break;
+        heapSwap(i, parent);
+        i = parent;
+    }
+}
 
-    if (ev->fd+1 == nfds) {
-        int n = 0;
+static void heapSiftDown(int i)
+{
+    for (;;) {
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < timer_count && heapLess(left, smallest)) smallest = left;
+        if (right < timer_count && heapLess(right, smallest)) smallest = right;
+        if (smallest == i) break;
+        heapSwap(i, smallest);
+        i = smallest;
+    }
+}
 
-        for (int i = 0; i < MAX_FD_EVENTS; i++) {
-            struct ril_event * rev = watch_table[i];
+static bool heapPush(struct ril_event * ev)
+{
+    if (timer_count == timer_capacity) {
+        int capacity = timer_capacity ? timer_capacity * 2 : MAX_FD_EVENTS;
+        struct ril_event ** heap = (struct ril_event **)
+                realloc(timer_heap, capacity * sizeof(struct ril_event *));
+        if (heap == NULL) {
+            RLOGE("ril_event: out of memory growing timer heap");
+            return false;
+        }
+        timer_heap = heap;
+        timer_capacity = capacity;
+    }
+    ev->index = timer_count;
+    timer_heap[timer_count++] = ev;
+    heapSiftUp(ev->index);
+    return true;
+}
 
-            if ((rev != NULL) && (rev->fd > n)) {
-                n = rev->fd;
-            }
+static void heapRemove(struct ril_event * ev)
+{
+    int i = ev->index;
+    ev->index = -1;
+    if (--timer_count == i) return;
+
+    timer_heap[i] = timer_heap[timer_count];
+    timer_heap[i]->index = i;
+    heapSiftUp(i);
+    heapSiftDown(timer_heap[i]->index);
+}
+
+// Arm the timerfd for the earliest timer, or disarm it if there is none.
+// Must hold listMutex.
+static void armTimer()
+{
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (timer_count > 0) {
+        its.it_value.tv_sec = timer_heap[0]->timeout.tv_sec;
+        its.it_value.tv_nsec = timer_heap[0]->timeout.tv_usec * 1000;
+        // An all-zero it_value disarms; never let a due timer look like that.
+        if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) {
+            its.it_value.tv_nsec = 1;
         }
-        nfds = n + 1;
-        dlog("~~~~ nfds = %d ~~~~", nfds);
     }
+    if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        RLOGE("ril_event: timerfd_settime error (%d)", errno);
+    }
+}
+
+static void removeWatch(struct ril_event * ev)
+{
+    dlog("~~~~ +removeWatch ~~~~");
+    if (epoll_ctl(epollFd, EPOLL_CTL_DEL, ev->fd, NULL) < 0) {
+        RLOGE("ril_event: epoll_ctl(DEL, %d) error (%d)", ev->fd, errno);
+    }
+    watch_table[ev->fd] = NULL;
+    ev->watched = false;
     dlog("~~~~ -removeWatch ~~~~");
 }
 
@@ -160,38 +236,49 @@ static void processTimeouts()
     dlog("~~~~ +processTimeouts ~~~~");
     MUTEX_ACQUIRE();
     struct timeval now;
-    struct ril_event * tev = timer_list.next;
-    struct ril_event * next;
+    uint64_t expirations;
+    bool fired = false;
+
+    // Clear the timerfd's readiness; it's nonblocking, so a wakeup that
+    // came from an fd instead just returns EAGAIN.
+    if (read(timerFd, &expirations, sizeof(expirations)) > 0) {
+        fired = true;
+    }
 
     getNow(&now);
-    // walk list, see if now >= ev->timeout for any events
 
     dlog("~~~~ Looking for timers <= %ds + %dus ~~~~", (int)now.tv_sec, (int)now.tv_usec);
-    while ((tev != &timer_list) && (timercmp(&now, &tev->timeout, >))) {
+    while (timer_count > 0 && !timercmp(&timer_heap[0]->timeout, &now, >)) {
         // Timer expired
         dlog("~~~~ firing timer ~~~~");
-        next = tev->next;
-        removeFromList(tev);
+        struct ril_event * tev = timer_heap[0];
+        heapRemove(tev);
         addToList(tev, &pending_list);
-        tev = next;
+        fired = true;
+    }
+    if (fired) {
+        armTimer();
     }
     MUTEX_RELEASE();
     dlog("~~~~ -processTimeouts ~~~~");
 }
 
-static void processReadReadies(fd_set * rfds, int n)
+static void processReadReadies(struct epoll_event * events, int n)
 {
     dlog("~~~~ +processReadReadies (%d) ~~~~", n);
     MUTEX_ACQUIRE();
 
-    for (int i = 0; (i < MAX_FD_EVENTS) && (n > 0); i++) {
-        struct ril_event * rev = watch_table[i];
-        if (rev != NULL && FD_ISSET(rev->fd, rfds)) {
+    for (int i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        if (fd == timerFd || fd >= watch_table_size) continue;
+
+        struct ril_event * rev = watch_table[fd];
+        if (rev != NULL) {
+            dlog("DON: fd=%d is ready", fd);
             addToList(rev, &pending_list);
             if (rev->persist == false) {
-                removeWatch(rev, i);
+                removeWatch(rev);
             }
-            n--;
         }
     }
 
@@ -212,40 +299,32 @@ static void firePending()
     dlog("~~~~ -firePending ~~~~");
 }
 
-static int calcNextTimeout(struct timeval * tv)
+// Initialize internal data structs
+void ril_event_init()
 {
-    struct ril_event * tev = timer_list.next;
-    struct timeval now;
+    MUTEX_INIT();
 
-    getNow(&now);
+    init_list(&pending_list);
 
-    // Sorted list, so calc based on first node
-    if (tev == &timer_list) {
-        // no pending timers
-        return -1;
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) {
+        RLOGE("ril_event: epoll_create1 error (%d)", errno);
+        return;
     }
 
-    dlog("~~~~ now = %ds + %dus ~~~~", (int)now.tv_sec, (int)now.tv_usec);
-    dlog("~~~~ next = %ds + %dus ~~~~",
-            (int)tev->timeout.tv_sec, (int)tev->timeout.tv_usec);
-    if (timercmp(&tev->timeout, &now, >)) {
-        timersub(&tev->timeout, &now, tv);
-    } else {
-        // timer already expired.
-        tv->tv_sec = tv->tv_usec = 0;
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerFd < 0) {
+        RLOGE("ril_event: timerfd_create error (%d)", errno);
+        return;
     }
-    return 0;
-}
-
-// Initialize internal data structs
-void ril_event_init()
-{
-    MUTEX_INIT();
 
-    FD_ZERO(&readFds);
-    init_list(&timer_list);
-    init_list(&pending_list);
-    memset(watch_table, 0, sizeof(watch_table));
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = timerFd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &event) < 0) {
+        RLOGE("ril_event: epoll_ctl(ADD, timerfd) error (%d)", errno);
+    }
 }
 
 // Initialize an event
@@ -266,18 +345,41 @@ void ril_event_add(struct ril_event * ev)
 {
     dlog("~~~~ +ril_event_add ~~~~");
     MUTEX_ACQUIRE();
-    for (int i = 0; i < MAX_FD_EVENTS; i++) {
-        if (watch_table[i] == NULL) {
-            watch_table[i] = ev;
-            ev->index = i;
-            dlog("~~~~ added at %d ~~~~", i);
-            dump_event(ev);
-            FD_SET(ev->fd, &readFds);
-            if (ev->fd >= nfds) nfds = ev->fd+1;
-            dlog("~~~~ nfds = %d ~~~~", nfds);
-            break;
+
+    if (ev->fd < 0 || ev->watched) {
+        MUTEX_RELEASE();
+        return;
+    }
+
+    if (ev->fd >= watch_table_size) {
+        int size = watch_table_size ? watch_table_size : MAX_FD_EVENTS;
+        while (size <= ev->fd) size *= 2;
+        struct ril_event ** table = (struct ril_event **)
+                realloc(watch_table, size * sizeof(struct ril_event *));
+        if (table == NULL) {
+            RLOGE("ril_event: out of memory growing watch table");
+            MUTEX_RELEASE();
+            return;
         }
+        memset(table + watch_table_size, 0,
+                (size - watch_table_size) * sizeof(struct ril_event *));
+        watch_table = table;
+        watch_table_size = size;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = ev->fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, ev->fd, &event) < 0) {
+        RLOGE("ril_event: epoll_ctl(ADD, %d) error (%d)", ev->fd, errno);
+    } else {
+        watch_table[ev->fd] = ev;
+        ev->watched = true;
+        dlog("~~~~ added fd %d ~~~~", ev->fd);
+        dump_event(ev);
     }
+
     MUTEX_RELEASE();
     dlog("~~~~ -ril_event_add ~~~~");
 }
@@ -288,23 +390,21 @@ void ril_timer_add(struct ril_event * ev, struct timeval * tv)
     dlog("~~~~ +ril_timer_add ~~~~");
     MUTEX_ACQUIRE();
 
-    struct ril_event * list;
     if (tv != NULL) {
-        // add to timer list
-        list = timer_list.next;
         ev->fd = -1; // make sure fd is invalid
 
+        if (ev->index >= 0) {
+            heapRemove(ev);
+        }
+
         struct timeval now;
         getNow(&now);
         timeradd(&now, tv, &ev->timeout);
 
-        // keep list sorted
-        while (timercmp(&list->timeout, &ev->timeout, < )
-                && (list != &timer_list)) {
-            list = list->next;
+        // Only a new earliest deadline needs the timerfd re-armed
+        if (heapPush(ev) && ev->index == 0) {
+            armTimer();
         }
-        // list now points to the first event older than ev
-        addToList(ev, list);
     }
 
     MUTEX_RELEASE();
@@ -317,59 +417,34 @@ void ril_event_del(struct ril_event * ev)
     dlog("~~~~ +ril_event_del ~~~~");
     MUTEX_ACQUIRE();
 
-    if (ev->index < 0 || ev->index >= MAX_FD_EVENTS) {
-        MUTEX_RELEASE();
-        return;
+    if (ev->watched) {
+        removeWatch(ev);
+    } else if (ev->index >= 0) {
+        bool wasFirst = ev->index == 0;
+        heapRemove(ev);
+        if (wasFirst) {
+            armTimer();
+        }
     }
 
-    removeWatch(ev, ev->index);
-
     MUTEX_RELEASE();
     dlog("~~~~ -ril_event_del ~~~~");
 }
 
-#if DEBUG
-static void printReadies(fd_set * rfds)
-{
-    for (int i = 0; (i < MAX_FD_EVENTS); i++) {
-        struct ril_event * rev = watch_table[i];
-        if (rev != NULL && FD_ISSET(rev->fd, rfds)) {
-          dlog("DON: fd=%d is ready", rev->fd);
-        }
-    }
-}
-#else
-#define printReadies(rfds) do {} while(0)
-#endif
-
 void ril_event_loop()
 {
     int n;
-    fd_set rfds;
-    struct timeval tv;
-    struct timeval * ptv;
-
+    struct epoll_event events[MAX_FD_EVENTS];
 
     for (;;) {
-
-        // make local copy of read fd_set
-        memcpy(&rfds, &readFds, sizeof(fd_set));
-        if (-1 == calcNextTimeout(&tv)) {
-            // no pending timers; block indefinitely
-            dlog("~~~~ no timers; blocking indefinitely ~~~~");
-            ptv = NULL;
-        } else {
-            dlog("~~~~ blocking for %ds + %dus ~~~~", (int)tv.tv_sec, (int)tv.tv_usec);
-            ptv = &tv;
-        }
-        printReadies(&rfds);
-        n = select(nfds, &rfds, NULL, NULL, ptv);
-        printReadies(&rfds);
+        // Timers are delivered through timerFd, so there's never a timeout
+        // to compute here; an idle loop sleeps until something is due.
+        n = epoll_wait(epollFd, events, MAX_FD_EVENTS, -1);
         dlog("~~~~ %d events fired ~~~~", n);
         if (n < 0) {
             if (errno == EINTR) continue;
 
-            RLOGE("ril_event: select error (%d)", errno);
+            RLOGE("ril_event: epoll_wait error (%d)", errno);
             // bail?
             return;
         }
@@ -377,7 +452,7 @@ void ril_event_loop()
         // Check for timeouts
         processTimeouts();
         // Check for read-ready
-        processReadReadies(&rfds, n);
+        processReadReadies(events, n);
         // Fire away
         firePending();
     }
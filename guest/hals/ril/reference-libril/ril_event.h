@@ -15,7 +15,8 @@
 ** limitations under the License.
 */
 
-// Max number of fd's we watch at any one time.  Increase if necessary.
+// Number of ready fds collected per epoll_wait() call.  Watches are not
+// capped; any extra ready fds are picked up on the next pass.
 #define MAX_FD_EVENTS 8
 
 typedef void (*ril_event_cb)(int fd, short events, void *userdata);
@@ -25,7 +26,8 @@ struct ril_event {
     struct ril_event *prev;
 
     int fd;
-    int index;
+    int index;      // slot in the timer heap, -1 when not queued
+    bool watched;   // registered with the epoll set
     bool persist;
     struct timeval timeout;
     ril_event_cb func;
@@ -117,14 +117,75 @@ static void sleepMsec(long long msec)
 
 
 
+/*
+ * The lines of a response, and their ATLines, are carved out of blocks owned
+ * by the response and freed all at once with it, instead of costing two
+ * allocations per line. The first block is allocated along with the response,
+ * which covers almost every response, and a few freed responses are kept for
+ * reuse so a steady stream of commands doesn't allocate at all.
+ */
+#define AT_ARENA_BLOCK_SIZE 1024
+#define AT_RESPONSE_POOL_SIZE 4
+
+typedef struct ATArenaBlock {
+    struct ATArenaBlock *p_next;
+    size_t used;
+    size_t size;
+    char data[];
+} ATArenaBlock;
+
+static pthread_mutex_t s_responsePoolMutex = PTHREAD_MUTEX_INITIALIZER;
+static ATResponse *s_responsePool[AT_RESPONSE_POOL_SIZE];
+static int s_responsePoolCount = 0;
+
+static ATArenaBlock *inlineArenaBlock(ATResponse *p_response)
+{
+    return (ATArenaBlock *) (p_response + 1);
+}
+
+/** returns NULL if out of memory */
+static void *arenaAlloc(ATResponse *p_response, size_t size)
+{
+    ATArenaBlock *p_block = p_response->p_arena;
+    void *ret;
+
+    /* keeps every allocation aligned for the ATLines */
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+    if (p_block->size - p_block->used < size) {
+        size_t blockSize =
+                size > AT_ARENA_BLOCK_SIZE ? size : AT_ARENA_BLOCK_SIZE;
+
+        p_block = (ATArenaBlock *) malloc(sizeof(ATArenaBlock) + blockSize);
+        if (p_block == NULL) {
+            return NULL;
+        }
+        p_block->used = 0;
+        p_block->size = blockSize;
+        p_block->p_next = p_response->p_arena;
+        p_response->p_arena = p_block;
+    }
+
+    ret = p_block->data + p_block->used;
+    p_block->used += size;
+    return ret;
+}
+
 /** add an intermediate response to sp_response*/
 static void addIntermediate(const char *line)
 {
     ATLine *p_new;
+    size_t len = strlen(line) + 1;
 
-    p_new = (ATLine  *) malloc(sizeof(ATLine));
+    /* the line is stored right after its ATLine */
+    p_new = (ATLine *) arenaAlloc(sp_response, sizeof(ATLine) + len);
+    if (p_new == NULL) {
+        RLOGE("Out of memory for intermediate response \"%s\"", line);
+        return;
+    }
 
-    p_new->line = strdup(line);
+    p_new->line = (char *) (p_new + 1);
+    memcpy(p_new->line, line, len);
 
     /* note: this adds to the head of the list, so the list
        will be in reverse order of lines received. the order is flipped
@@ -219,7 +280,16 @@ static int isSMSUnsolicited(const char *line)
 /** assumes s_commandmutex is held */
 static void handleFinalResponse(const char *line)
 {
-    sp_response->finalResponse = strdup(line);
+    size_t len = strlen(line) + 1;
+
+    sp_response->finalResponse = (char *) arenaAlloc(sp_response, len);
+    if (sp_response->finalResponse == NULL) {
+        /* waiters only check for a final response, any will do */
+        sp_response->finalResponse = (char *) "ERROR";
+        sp_response->success = 0;
+    } else {
+        memcpy(sp_response->finalResponse, line, len);
+    }
 
     pthread_cond_signal(&s_commandcond);
 }
@@ -439,24 +509,23 @@ static void *readerLoop(void *arg __unused)
         }
 
         if(isSMSUnsolicited(line)) {
-            char *line1;
+            // Only used by this thread
+            static char line1[MAX_AT_RESPONSE+1];
             const char *line2;
 
             // The scope of string returned by 'readline()' is valid only
             // till next call to 'readline()' hence making a copy of line
             // before calling readline again.
-            line1 = strdup(line);
+            strlcpy(line1, line, sizeof(line1));
             line2 = readline();
 
             if (line2 == NULL) {
-                free(line1);
                 break;
             }
 
             if (s_unsolHandler != NULL) {
                 s_unsolHandler (line1, line2);
             }
-            free(line1);
         } else {
             processLine(line);
         }
@@ -618,28 +687,61 @@ void at_close()
 
 static ATResponse * at_response_new()
 {
-    return (ATResponse *) calloc(1, sizeof(ATResponse));
+    ATResponse *p_response = NULL;
+    ATArenaBlock *p_block;
+
+    pthread_mutex_lock(&s_responsePoolMutex);
+    if (s_responsePoolCount > 0) {
+        p_response = s_responsePool[--s_responsePoolCount];
+    }
+    pthread_mutex_unlock(&s_responsePoolMutex);
+
+    if (p_response == NULL) {
+        p_response = (ATResponse *) malloc(sizeof(ATResponse)
+                            + sizeof(ATArenaBlock) + AT_ARENA_BLOCK_SIZE);
+        if (p_response == NULL) {
+            return NULL;
+        }
+    }
+
+    p_response->success = 0;
+    p_response->finalResponse = NULL;
+    p_response->p_intermediates = NULL;
+
+    p_block = inlineArenaBlock(p_response);
+    p_block->p_next = NULL;
+    p_block->used = 0;
+    p_block->size = AT_ARENA_BLOCK_SIZE;
+    p_response->p_arena = p_block;
+
+    return p_response;
 }
 
 void at_response_free(ATResponse *p_response)
 {
-    ATLine *p_line;
+    ATArenaBlock *p_block;
 
     if (p_response == NULL) return;
 
-    p_line = p_response->p_intermediates;
+    /* the lines all live in the arena, only the extra blocks need freeing */
+    p_block = p_response->p_arena;
 
-    while (p_line != NULL) {
-        ATLine *p_toFree;
+    while (p_block != inlineArenaBlock(p_response)) {
+        ATArenaBlock *p_toFree;
 
-        p_toFree = p_line;
-        p_line = p_line->p_next;
+        p_toFree = p_block;
+        p_block = p_block->p_next;
 
-        free(p_toFree->line);
         free(p_toFree);
     }
 
-    free (p_response->finalResponse);
+    pthread_mutex_lock(&s_responsePoolMutex);
+    if (s_responsePoolCount < AT_RESPONSE_POOL_SIZE) {
+        s_responsePool[s_responsePoolCount++] = p_response;
+        p_response = NULL;
+    }
+    pthread_mutex_unlock(&s_responsePoolMutex);
+
     free (p_response);
 }
 
@@ -691,6 +793,10 @@ static int at_send_command_full_nolock (const char *command, ATCommandType type,
     s_responsePrefix = responsePrefix;
     s_smsPDU = smspdu;
     sp_response = at_response_new();
+    if (sp_response == NULL) {
+        err = AT_ERROR_GENERIC;
+        goto error;
+    }
 
     if (timeoutMsec != 0) {
         setTimespecRelative(&ts, timeoutMsec);
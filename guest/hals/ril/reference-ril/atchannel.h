@@ -57,12 +57,16 @@ typedef struct ATLine  {
     char *line;
 } ATLine;
 
+struct ATArenaBlock;
+
 /** Free this with at_response_free() */
 typedef struct {
     int success;              /* true if final response indicates
                                     success (eg "OK") */
     char *finalResponse;      /* eg OK, ERROR */
     ATLine  *p_intermediates; /* any intermediate responses */
+    struct ATArenaBlock *p_arena; /* storage for the lines above, owned by
+                                     atchannel and freed with the response */
 } ATResponse;
 
 /**
@@ -16,34 +16,60 @@
 
 #include <android-base/logging.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <log/log.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/inotify.h>
 #include <unistd.h>
-#include <fstream>
+#include <zlib.h>
+
+#include <memory>
+#include <set>
+#include <string>
 
 #include <cutils/properties.h>
 #include <gflags/gflags.h>
 
+#include "common/libs/fs/shared_buf.h"
 #include "common/libs/fs/shared_fd.h"
-#include "common/libs/utils/subprocess.h"
 
 static const char TOMBSTONE_DIR[] = "/data/tombstones/";
 
+DEFINE_uint32(port,
+              static_cast<uint32_t>(
+                  property_get_int64("ro.boot.vsock_tombstone_port", 0)),
+              "VSOCK port to send tombstones to");
+DEFINE_uint32(cid, 2, "VSOCK CID to send logcat output to");
+// Receivers from before compressed uploads store them as they are
+DEFINE_bool(compress,
+            property_get_bool("ro.boot.vsock_tombstone_compression", false),
+            "gzip the tombstones while sending them, only if the receiver "
+            "inflates them");
+DEFINE_int32(compression_level, Z_BEST_SPEED, "zlib compression level");
+DEFINE_uint32(coalesce_ms, 500,
+              "Wait until tombstones stop changing for this long before "
+              "sending them, so each is sent once per burst of writes");
+
+#define TOMBSTONE_BUFFER_SIZE (64 * 1024)
+
 // returns a fd which when read from, provides inotify events when tombstones
-// are created
+// are created or finish being written
 static int new_tombstone_create_notifier(void) {
-  int file_create_notification_handle = inotify_init();
+  int file_create_notification_handle = inotify_init1(IN_CLOEXEC);
   if (file_create_notification_handle == -1) {
     ALOGE("%s: inotify_init failure error: '%s' (%d)", __FUNCTION__,
       strerror(errno), errno);
     return -1;
   }
 
-  int watch_descriptor = inotify_add_watch(file_create_notification_handle,
-    TOMBSTONE_DIR, IN_CREATE);
+  // tombstoned links finished tombstones into place (IN_CREATE), debuggerd
+  // fallbacks write them in place (IN_CLOSE_WRITE).
+  int watch_descriptor =
+      inotify_add_watch(file_create_notification_handle, TOMBSTONE_DIR,
+                        IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO);
   if (watch_descriptor == -1) {
     ALOGE("%s: Could not add watch for '%s', error: '%s' (%d)", __FUNCTION__,
       TOMBSTONE_DIR, strerror(errno), errno);
@@ -55,19 +81,21 @@ static int new_tombstone_create_notifier(void) {
 }
 
 #define INOTIFY_MAX_EVENT_SIZE (sizeof(struct inotify_event) + NAME_MAX + 1)
-static std::vector<std::string> get_next_tombstones_path_blocking(int fd) {
-  char event_readout[INOTIFY_MAX_EVENT_SIZE];
+// Returns false if the inotify fd couldn't be read
+static bool read_tombstone_events(int fd, std::set<std::string>* paths) {
+  // Large enough for a burst of events to be read at once
+  char event_readout[16 * INOTIFY_MAX_EVENT_SIZE];
   int bytes_parsed = 0;
-  std::vector<std::string> tombstone_paths;
   // Each successful read can contain one or more of inotify_event events
   // Note: read() on inotify returns 'whole' events, will never partially
   // populate the buffer.
-  int event_read_out_length = read(fd, event_readout, INOTIFY_MAX_EVENT_SIZE);
+  int event_read_out_length =
+      TEMP_FAILURE_RETRY(read(fd, event_readout, sizeof(event_readout)));
 
   if(event_read_out_length == -1) {
     ALOGE("%s: Couldn't read out inotify event due to error: '%s' (%d)",
       __FUNCTION__, strerror(errno), errno);
-    return std::vector<std::string>();
+    return false;
   }
 
   while (bytes_parsed < event_read_out_length) {
@@ -80,23 +108,143 @@ static std::vector<std::string> get_next_tombstones_path_blocking(int fd) {
       ALOGE("%s: inotify event didn't contain filename", __FUNCTION__);
       continue;
     }
-    if (!(event->mask & IN_CREATE)) {
-      ALOGE("%s: inotify event didn't pertain to file creation", __FUNCTION__);
+    if (event->mask & IN_ISDIR) {
       continue;
     }
-    tombstone_paths.push_back(std::string(TOMBSTONE_DIR) +
-                              std::string(event->name));
+    paths->insert(std::string(TOMBSTONE_DIR) + std::string(event->name));
   }
+  return true;
+}
 
+// Blocks until tombstones are written, then keeps collecting events until
+// none arrive for --coalesce_ms. A crash storm, or a tombstone reported by
+// more than one event, results in each path being sent once.
+static std::set<std::string> get_next_tombstones_path_blocking(int fd) {
+  std::set<std::string> tombstone_paths;
+  int timeout_ms = -1;
+  while (true) {
+    struct pollfd poll_fd = {.fd = fd, .events = POLLIN, .revents = 0};
+    int ready = poll(&poll_fd, 1, timeout_ms);
+    if (ready == -1 && errno == EINTR) {
+      continue;
+    } else if (ready <= 0) {
+      // Quiet period elapsed or poll failed, send what was collected
+      if (ready == -1) {
+        ALOGE("%s: poll failed: '%s' (%d)", __FUNCTION__, strerror(errno),
+              errno);
+      }
+      break;
+    }
+    if (!read_tombstone_events(fd, &tombstone_paths)) {
+      break;
+    }
+    timeout_ms = FLAGS_coalesce_ms;
+  }
   return tombstone_paths;
 }
 
-DEFINE_uint32(port,
-              static_cast<uint32_t>(
-                  property_get_int64("ro.boot.vsock_tombstone_port", 0)),
-              "VSOCK port to send tombstones to");
-DEFINE_uint32(cid, 2, "VSOCK CID to send logcat output to");
-#define TOMBSTONE_BUFFER_SIZE (1024)
+// Compresses the tombstone into a gzip stream as it is read, writing
+// compressed data out whenever the output buffer fills up.
+class GzipSender {
+ public:
+  GzipSender(cuttlefish::SharedFD out) : out_(out) {}
+  ~GzipSender() {
+    if (initialized_) {
+      deflateEnd(&stream_);
+    }
+  }
+
+  bool Init() {
+    // 15 window bits, +16 for a gzip header so the receiver can recognize it
+    initialized_ = deflateInit2(&stream_, FLAGS_compression_level, Z_DEFLATED,
+                                15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    return initialized_;
+  }
+
+  // Use an empty buffer with `finish` to flush the end of the stream
+  bool Send(const char* data, size_t size, bool finish) {
+    stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream_.avail_in = size;
+    int result;
+    do {
+      stream_.next_out = reinterpret_cast<Bytef*>(buffer_);
+      stream_.avail_out = sizeof(buffer_);
+      result = deflate(&stream_, finish ? Z_FINISH : Z_NO_FLUSH);
+      if (result == Z_STREAM_ERROR) {
+        return false;
+      }
+      ssize_t pending = sizeof(buffer_) - stream_.avail_out;
+      if (pending > 0 &&
+          cuttlefish::WriteAll(out_, buffer_, pending) != pending) {
+        return false;
+      }
+    } while (stream_.avail_out == 0 || (finish && result != Z_STREAM_END));
+    return true;
+  }
+
+  uint64_t compressed_size() const { return stream_.total_out; }
+
+ private:
+  cuttlefish::SharedFD out_;
+  z_stream stream_ = {};
+  bool initialized_ = false;
+  char buffer_[TOMBSTONE_BUFFER_SIZE];
+};
+
+static void transmit_tombstone(const std::string& ts_path) {
+  auto ts_fd = cuttlefish::SharedFD::Open(ts_path, O_RDONLY);
+  if (!ts_fd->IsOpen()) {
+    // Rotated away before we got to it
+    LOG(WARNING) << "Could not open " << ts_path << ": " << ts_fd->StrError();
+    return;
+  }
+  auto log_fd =
+      cuttlefish::SharedFD::VsockClient(FLAGS_cid, FLAGS_port, SOCK_STREAM);
+  if (!log_fd->IsOpen()) {
+    auto error = log_fd->StrError();
+    ALOGE("Unable to connect to vsock:%u:%u: %s", FLAGS_cid, FLAGS_port,
+          error.c_str());
+    return;
+  }
+
+  std::unique_ptr<GzipSender> gzip;
+  if (FLAGS_compress) {
+    gzip.reset(new GzipSender(log_fd));
+    if (!gzip->Init()) {
+      LOG(ERROR) << "Failed to initialize zlib, sending " << ts_path
+                 << " uncompressed";
+      gzip.reset();
+    }
+  }
+
+  static char buffer[TOMBSTONE_BUFFER_SIZE];
+  uint64_t num_bytes_read = 0;
+  ssize_t read;
+  bool sent = true;
+  while (sent && (read = ts_fd->Read(buffer, sizeof(buffer))) > 0) {
+    num_bytes_read += read;
+    if (gzip) {
+      sent = gzip->Send(buffer, read, false);
+    } else {
+      sent = cuttlefish::WriteAll(log_fd, buffer, read) == read;
+    }
+  }
+  if (sent && read == 0 && gzip) {
+    sent = gzip->Send(nullptr, 0, true);
+  }
+
+  if (read < 0) {
+    ALOGE("Failed to read %s: %s", ts_path.c_str(), ts_fd->StrError().c_str());
+  } else if (!sent) {
+    auto error = log_fd->StrError();
+    ALOGE("Failed to send %s: %s", ts_path.c_str(), error.c_str());
+  } else if (gzip) {
+    LOG(INFO) << num_bytes_read << " bytes transferred from " << ts_path
+              << " as " << gzip->compressed_size() << " compressed bytes";
+  } else {
+    LOG(INFO) << num_bytes_read << " bytes transferred from " << ts_path;
+  }
+}
 
 int main(int argc, char** argv) {
   gflags::ParseCommandLineFlags(&argc, &argv, true);
@@ -112,33 +260,10 @@ int main(int argc, char** argv) {
   LOG(INFO) << "tombstone watcher successfully initialized";
 
   while (true) {
-    std::vector<std::string> ts_paths =
+    auto ts_paths =
         get_next_tombstones_path_blocking(file_create_notification_handle);
     for (auto& ts_path : ts_paths) {
-      auto log_fd =
-          cuttlefish::SharedFD::VsockClient(FLAGS_cid, FLAGS_port, SOCK_STREAM);
-      std::ifstream ifs(ts_path);
-      char buffer[TOMBSTONE_BUFFER_SIZE];
-      uint num_transfers = 0;
-      int num_bytes_read = 0;
-      while (log_fd->IsOpen() && ifs.is_open() && !ifs.eof()) {
-        ifs.read(buffer, sizeof(buffer));
-        num_bytes_read += ifs.gcount();
-        log_fd->Write(buffer, ifs.gcount());
-        num_transfers++;
-      }
-
-      if (!log_fd->IsOpen()) {
-        auto error = log_fd->StrError();
-        ALOGE("Unable to connect to vsock:%u:%u: %s", FLAGS_cid, FLAGS_port,
-              error.c_str());
-      } else if (!ifs.is_open()) {
-        ALOGE("%s closed in the middle of readout.", ts_path.c_str());
-      } else {
-        LOG(INFO) << num_bytes_read << " chars transferred from "
-                  << ts_path.c_str() << " over " << num_transfers << " "
-                  << TOMBSTONE_BUFFER_SIZE << " byte sized transfers";
-      }
+      transmit_tombstone(ts_path);
     }
   }
 
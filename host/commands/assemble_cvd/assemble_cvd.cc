@@ -162,6 +162,17 @@ Result<const CuttlefishConfig*> InitFilesystemAndCreateConfig(
                                                     FLAGS_modem_simulator_count,
                                                     kernel_config, injector);
     std::set<std::string> preserving;
+    // Only hold digests keyed by file identity, valid across any launch
+    preserving.insert("os_composite_disk_config.txt.digest_cache");
+    preserving.insert("persistent_composite_disk_config.txt.digest_cache");
+    // Keeps track of which target files its images came from
+    preserving.insert("target_combined");
+    // Repacked boot images, keyed by the digests of their inputs
+    preserving.insert("repack_cache");
+    // Checked against the super image, or a link into the image store
+    preserving.insert("super_pmem.img");
+    preserving.insert("super_pmem.img.digest_cache");
+    preserving.insert("gem5_checkpoint.digest_cache");
     auto os_builder = OsCompositeDiskBuilder(config);
     bool creating_os_disk = CF_EXPECT(os_builder.WillRebuildCompositeDisk());
     if (FLAGS_resume && creating_os_disk) {
@@ -170,8 +181,11 @@ Result<const CuttlefishConfig*> InitFilesystemAndCreateConfig(
                 << "overlay incompatible. Wiping the overlay files.";
     } else if (FLAGS_resume && !creating_os_disk) {
       preserving.insert("overlay.img");
+      preserving.insert("overlay.img.manifest");
       preserving.insert("ap_overlay.img");
+      preserving.insert("ap_overlay.img.manifest");
       preserving.insert("os_composite_disk_config.txt");
+      preserving.insert("os_composite_disk_config.txt.manifest");
       preserving.insert("os_composite_gpt_header.img");
       preserving.insert("os_composite_gpt_footer.img");
       preserving.insert("os_composite.img");
@@ -186,6 +200,7 @@ Result<const CuttlefishConfig*> InitFilesystemAndCreateConfig(
       preserving.insert("modem_nvram.json");
       preserving.insert("recording");
       preserving.insert("persistent_composite_disk_config.txt");
+      preserving.insert("persistent_composite_disk_config.txt.manifest");
       preserving.insert("persistent_composite_gpt_header.img");
       preserving.insert("persistent_composite_gpt_footer.img");
       preserving.insert("persistent_composite.img");
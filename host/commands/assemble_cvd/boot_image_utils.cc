@@ -20,34 +20,279 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 
+#include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/strings.h>
+#include <bootimg.h>
 
 #include "common/libs/utils/files.h"
+#include "common/libs/utils/result.h"
 #include "common/libs/utils/subprocess.h"
+#include "host/commands/assemble_cvd/image_digest.h"
+#include "host/libs/config/data_image.h"
 
 const char TMP_EXTENSION[] = ".tmp";
 const char CPIO_EXT[] = ".cpio";
 const char TMP_RD_DIR[] = "stripped_ramdisk_dir";
 const char STRIPPED_RD[] = "stripped_ramdisk";
 const char CONCATENATED_VENDOR_RAMDISK[] = "concatenated_vendor_ramdisk";
+const char REPACK_CACHE_DIR[] = "repack_cache";
 namespace cuttlefish {
 namespace {
-std::string ExtractValue(const std::string& dictionary, const std::string& key) {
-  std::size_t index = dictionary.find(key);
-  if (index != std::string::npos) {
-    std::size_t end_index = dictionary.find('\n', index + key.length());
-    if (end_index != std::string::npos) {
-      return dictionary.substr(index + key.length(),
-          end_index - index - key.length());
-    }
+// Boot image v3 and later always use 4 KiB pages
+constexpr uint32_t kBootImagePageSize = 4096;
+
+uint64_t PageAlign(uint64_t size, uint64_t page_size) {
+  return (size + page_size - 1) / page_size * page_size;
+}
+
+std::string FixedString(const uint8_t* field, size_t size) {
+  auto chars = reinterpret_cast<const char*>(field);
+  return std::string(chars, strnlen(chars, size));
+}
+
+Result<void> SetFixedString(uint8_t* field, size_t size,
+                            const std::string& value) {
+  // Leaves room for the terminator
+  CF_EXPECT(value.size() < size, "\"" << value << "\" is longer than "
+                                      << (size - 1) << " bytes");
+  memcpy(field, value.data(), value.size());
+  return {};
+}
+
+// Returns `size` bytes at `offset`, after checking they are in the image.
+Result<std::string> Section(const std::string& image, uint64_t offset,
+                            uint64_t size) {
+  CF_EXPECT(offset <= image.size() && size <= image.size() - offset,
+            "Image is truncated");
+  return image.substr(offset, size);
+}
+
+void AppendPageAligned(std::string& image, const std::string& section,
+                       uint64_t page_size) {
+  image += section;
+  image.resize(PageAlign(image.size(), page_size), '\0');
+}
+
+}  // namespace
+
+Result<BootImage> ReadBootImage(const std::string& path) {
+  std::string image;
+  CF_EXPECT(android::base::ReadFileToString(path, &image),
+            "Failed to read \"" << path << "\"");
+  CF_EXPECT(image.size() >= sizeof(boot_img_hdr_v3) &&
+                memcmp(image.data(), BOOT_MAGIC, BOOT_MAGIC_SIZE) == 0,
+            "\"" << path << "\" is not a boot image");
+  boot_img_hdr_v3 header;
+  memcpy(&header, image.data(), sizeof(header));
+  // Copied out of the packed header so it can be streamed
+  uint32_t version = header.header_version;
+  CF_EXPECT(version >= 3,
+            "Boot image header version " << version << " is not supported");
+
+  BootImage boot;
+  boot.os_version = header.os_version;
+  boot.cmdline = FixedString(header.cmdline, sizeof(header.cmdline));
+  uint64_t offset = kBootImagePageSize;
+  boot.kernel = CF_EXPECT(Section(image, offset, header.kernel_size));
+  offset += PageAlign(header.kernel_size, kBootImagePageSize);
+  boot.ramdisk = CF_EXPECT(Section(image, offset, header.ramdisk_size));
+  return boot;
+}
+
+Result<VendorBootImage> ReadVendorBootImage(const std::string& path) {
+  std::string image;
+  CF_EXPECT(android::base::ReadFileToString(path, &image),
+            "Failed to read \"" << path << "\"");
+  CF_EXPECT(image.size() >= sizeof(vendor_boot_img_hdr_v3) &&
+                memcmp(image.data(), VENDOR_BOOT_MAGIC,
+                       VENDOR_BOOT_MAGIC_SIZE) == 0,
+            "\"" << path << "\" is not a vendor boot image");
+  vendor_boot_img_hdr_v4 header = {};
+  memcpy(&header, image.data(),
+         std::min(image.size(), sizeof(vendor_boot_img_hdr_v4)));
+  uint32_t version = header.header_version;
+  CF_EXPECT(version >= 3,
+            "Vendor boot header version " << version << " is not supported");
+  CF_EXPECT(header.page_size > 0, "Vendor boot image has no page size");
+
+  VendorBootImage vendor_boot;
+  vendor_boot.page_size = header.page_size;
+  vendor_boot.kernel_addr = header.kernel_addr;
+  vendor_boot.ramdisk_addr = header.ramdisk_addr;
+  vendor_boot.tags_addr = header.tags_addr;
+  vendor_boot.dtb_addr = header.dtb_addr;
+  vendor_boot.name = FixedString(header.name, sizeof(header.name));
+  vendor_boot.cmdline = FixedString(header.cmdline, sizeof(header.cmdline));
+
+  auto page = header.page_size;
+  uint64_t offset = PageAlign(header.header_size, page);
+  vendor_boot.ramdisk =
+      CF_EXPECT(Section(image, offset, header.vendor_ramdisk_size));
+  offset += PageAlign(header.vendor_ramdisk_size, page);
+  vendor_boot.dtb = CF_EXPECT(Section(image, offset, header.dtb_size));
+  offset += PageAlign(header.dtb_size, page);
+  if (version >= 4) {
+    offset += PageAlign(header.vendor_ramdisk_table_size, page);
+    vendor_boot.bootconfig =
+        CF_EXPECT(Section(image, offset, header.bootconfig_size));
   }
-  return "";
+  return vendor_boot;
+}
+
+// Writes a version 4 boot image, the same as `mkbootimg --header_version 4`.
+Result<void> WriteBootImage(const BootImage& boot, const std::string& path) {
+  boot_img_hdr_v4 header = {};
+  memcpy(header.magic, BOOT_MAGIC, BOOT_MAGIC_SIZE);
+  header.kernel_size = boot.kernel.size();
+  header.ramdisk_size = boot.ramdisk.size();
+  header.os_version = boot.os_version;
+  header.header_size = sizeof(header);
+  header.header_version = 4;
+  CF_EXPECT(SetFixedString(header.cmdline, sizeof(header.cmdline),
+                           boot.cmdline));
+
+  std::string image(reinterpret_cast<const char*>(&header), sizeof(header));
+  image.resize(kBootImagePageSize, '\0');
+  AppendPageAligned(image, boot.kernel, kBootImagePageSize);
+  AppendPageAligned(image, boot.ramdisk, kBootImagePageSize);
+  CF_EXPECT(android::base::WriteStringToFile(image, path),
+            "Failed to write \"" << path << "\"");
+  return {};
+}
+
+// Writes a version 4 vendor boot image holding a single platform ramdisk,
+// the same as `mkbootimg --header_version 4 --vendor_ramdisk`.
+Result<void> WriteVendorBootImage(const VendorBootImage& vendor_boot,
+                                  const std::string& path) {
+  vendor_ramdisk_table_entry_v4 entry = {};
+  entry.ramdisk_size = vendor_boot.ramdisk.size();
+  entry.ramdisk_offset = 0;
+  entry.ramdisk_type = VENDOR_RAMDISK_TYPE_PLATFORM;
+
+  vendor_boot_img_hdr_v4 header = {};
+  memcpy(header.magic, VENDOR_BOOT_MAGIC, VENDOR_BOOT_MAGIC_SIZE);
+  header.header_version = 4;
+  header.page_size = vendor_boot.page_size;
+  header.kernel_addr = vendor_boot.kernel_addr;
+  header.ramdisk_addr = vendor_boot.ramdisk_addr;
+  header.vendor_ramdisk_size = vendor_boot.ramdisk.size();
+  CF_EXPECT(SetFixedString(header.cmdline, sizeof(header.cmdline),
+                           vendor_boot.cmdline));
+  header.tags_addr = vendor_boot.tags_addr;
+  CF_EXPECT(
+      SetFixedString(header.name, sizeof(header.name), vendor_boot.name));
+  header.header_size = sizeof(header);
+  header.dtb_size = vendor_boot.dtb.size();
+  header.dtb_addr = vendor_boot.dtb_addr;
+  header.vendor_ramdisk_table_size = sizeof(entry);
+  header.vendor_ramdisk_table_entry_num = 1;
+  header.vendor_ramdisk_table_entry_size = sizeof(entry);
+  header.bootconfig_size = vendor_boot.bootconfig.size();
+
+  auto page = vendor_boot.page_size;
+  std::string image;
+  AppendPageAligned(
+      image, std::string(reinterpret_cast<const char*>(&header), sizeof(header)),
+      page);
+  AppendPageAligned(image, vendor_boot.ramdisk, page);
+  AppendPageAligned(image, vendor_boot.dtb, page);
+  AppendPageAligned(
+      image, std::string(reinterpret_cast<const char*>(&entry), sizeof(entry)),
+      page);
+  AppendPageAligned(image, vendor_boot.bootconfig, page);
+  CF_EXPECT(android::base::WriteStringToFile(image, path),
+            "Failed to write \"" << path << "\"");
+  return {};
 }
 
+namespace {
+
+bool AddHashFooter(const std::string& image_path, off_t partition_size,
+                   const std::string& partition_name) {
+  auto avbtool_path = HostBinaryPath("avbtool");
+  Command avb_cmd(avbtool_path);
+  avb_cmd.AddParameter("add_hash_footer");
+  avb_cmd.AddParameter("--image");
+  avb_cmd.AddParameter(image_path);
+  avb_cmd.AddParameter("--partition_size");
+  avb_cmd.AddParameter(partition_size);
+  avb_cmd.AddParameter("--partition_name");
+  avb_cmd.AddParameter(partition_name);
+  int success = avb_cmd.Start().Wait();
+  if (success != 0) {
+    LOG(ERROR) << "Unable to run avbtool. Exited with status " << success;
+    return false;
+  }
+  return true;
+}
+
+// Repacked images are kept in the assembly directory under a digest of
+// everything that went into them, so launching again with the same kernel
+// and ramdisk skips unpacking, repacking and signing. Only the latest image
+// of each kind is kept.
+class RepackCache {
+ public:
+  RepackCache(const std::string& build_dir, const std::string& kind)
+      : dir_(build_dir + "/" + REPACK_CACHE_DIR),
+        kind_(kind),
+        digests_(dir_ + "/" + kind + ".digest_cache") {}
+
+  // Derives the cache key. Returns false if the inputs can't be hashed, in
+  // which case the cache is bypassed.
+  bool SetInputs(const std::vector<std::string>& files,
+                 const std::string& options) {
+    std::string key = kind_ + "\n" + options + "\n";
+    for (const auto& file : files) {
+      auto digest = digests_.Digest(file);
+      if (!digest.ok()) {
+        LOG(DEBUG) << "Not caching " << kind_ << ": " << digest.error();
+        return false;
+      }
+      key += *digest + "\n";
+    }
+    entry_ = dir_ + "/" + kind_ + "-" + StringDigest(key) + ".img";
+    return true;
+  }
+
+  bool Lookup(const std::string& output) const {
+    if (entry_.empty() || !FileExists(entry_)) {
+      return false;
+    }
+    LOG(DEBUG) << "Using cached " << entry_;
+    return CopyImageFile(entry_, output);
+  }
+
+  void Store(const std::string& image) {
+    if (entry_.empty() || !EnsureDirectoryExists(dir_).ok()) {
+      return;
+    }
+    for (const auto& file : DirectoryContents(dir_)) {
+      if (android::base::StartsWith(file, kind_ + "-")) {
+        RemoveFile(dir_ + "/" + file);
+      }
+    }
+    if (!CopyImageFile(image, entry_)) {
+      RemoveFile(entry_);
+      return;
+    }
+    auto saved = digests_.Save();
+    if (!saved.ok()) {
+      LOG(DEBUG) << saved.error();
+    }
+  }
+
+ private:
+  std::string dir_;
+  std::string kind_;
+  FileDigestCache digests_;
+  std::string entry_;
+};
+
 // Though it is just as fast to overwrite the existing boot images with the newly generated ones,
 // the cuttlefish composite disk generator checks the age of each of the components and
 // regenerates the disk outright IF any one of the components is younger/newer than the current
@@ -119,25 +364,17 @@ void RepackVendorRamdisk(const std::string& kernel_modules_ramdisk_path,
 
 bool UnpackBootImage(const std::string& boot_image_path,
                      const std::string& unpack_dir) {
-  auto unpack_path = HostBinaryPath("unpack_bootimg");
-  Command unpack_cmd(unpack_path);
-  unpack_cmd.AddParameter("--boot_img");
-  unpack_cmd.AddParameter(boot_image_path);
-  unpack_cmd.AddParameter("--out");
-  unpack_cmd.AddParameter(unpack_dir);
-
-  auto output_file = SharedFD::Creat(unpack_dir + "/boot_params", 0666);
-  if (!output_file->IsOpen()) {
-    LOG(ERROR) << "Unable to create intermediate boot params file: "
-               << output_file->StrError();
+  auto boot = ReadBootImage(boot_image_path);
+  if (!boot.ok()) {
+    LOG(ERROR) << "Unable to unpack boot image: " << boot.error();
     return false;
   }
-  unpack_cmd.RedirectStdIO(Subprocess::StdIOChannel::kStdOut, output_file);
-
-  int success = unpack_cmd.Start().Wait();
-  if (success != 0) {
-    LOG(ERROR) << "Unable to run unpack_bootimg. Exited with status "
-               << success;
+  using android::base::WriteStringToFile;
+  if (!WriteStringToFile(boot->kernel, unpack_dir + "/kernel") ||
+      !WriteStringToFile(boot->ramdisk, unpack_dir + "/ramdisk") ||
+      !WriteStringToFile("command line args: " + boot->cmdline + "\n",
+                         unpack_dir + "/boot_params")) {
+    PLOG(ERROR) << "Unable to write unpacked boot image to " << unpack_dir;
     return false;
   }
   return true;
@@ -152,40 +389,24 @@ bool UnpackVendorBootImageIfNotUnpacked(
     return true;
   }
 
-  auto unpack_path = HostBinaryPath("unpack_bootimg");
-  Command unpack_cmd(unpack_path);
-  unpack_cmd.AddParameter("--boot_img");
-  unpack_cmd.AddParameter(vendor_boot_image_path);
-  unpack_cmd.AddParameter("--out");
-  unpack_cmd.AddParameter(unpack_dir);
-  auto output_file = SharedFD::Creat(unpack_dir + "/vendor_boot_params", 0666);
-  if (!output_file->IsOpen()) {
-    LOG(ERROR) << "Unable to create intermediate vendor boot params file: "
-               << output_file->StrError();
+  auto vendor_boot = ReadVendorBootImage(vendor_boot_image_path);
+  if (!vendor_boot.ok()) {
+    LOG(ERROR) << "Unable to unpack vendor boot image: "
+               << vendor_boot.error();
     return false;
   }
-  unpack_cmd.RedirectStdIO(Subprocess::StdIOChannel::kStdOut, output_file);
-  int success = unpack_cmd.Start().Wait();
-  if (success != 0) {
-    LOG(ERROR) << "Unable to run unpack_bootimg. Exited with status " << success;
-    return false;
-  }
-
-  // Concatenates all vendor ramdisk into one single ramdisk.
-  Command concat_cmd("/bin/bash");
-  concat_cmd.AddParameter("-c");
-  concat_cmd.AddParameter("cat " + unpack_dir + "/vendor_ramdisk*");
-  auto concat_file =
-      SharedFD::Creat(unpack_dir + "/" + CONCATENATED_VENDOR_RAMDISK, 0666);
-  if (!concat_file->IsOpen()) {
-    LOG(ERROR) << "Unable to create concatenated vendor ramdisk file: "
-               << concat_file->StrError();
-    return false;
-  }
-  concat_cmd.RedirectStdIO(Subprocess::StdIOChannel::kStdOut, concat_file);
-  success = concat_cmd.Start().Wait();
-  if (success != 0) {
-    LOG(ERROR) << "Unable to run cat. Exited with status " << success;
+  // The ramdisk fragments are contiguous, so this is already all of them
+  // concatenated into one single ramdisk.
+  using android::base::WriteStringToFile;
+  if (!WriteStringToFile(vendor_boot->ramdisk,
+                         unpack_dir + "/" + CONCATENATED_VENDOR_RAMDISK) ||
+      !WriteStringToFile(vendor_boot->dtb, unpack_dir + "/dtb") ||
+      !WriteStringToFile(vendor_boot->bootconfig, unpack_dir + "/bootconfig") ||
+      !WriteStringToFile(
+          "vendor command line args: " + vendor_boot->cmdline + "\n",
+          unpack_dir + "/vendor_boot_params")) {
+    PLOG(ERROR) << "Unable to write unpacked vendor boot image to "
+                << unpack_dir;
     return false;
   }
   return true;
@@ -195,47 +416,33 @@ bool RepackBootImage(const std::string& new_kernel_path,
                      const std::string& boot_image_path,
                      const std::string& new_boot_image_path,
                      const std::string& build_dir) {
-  if (UnpackBootImage(boot_image_path, build_dir) == false) {
-    return false;
+  auto tmp_boot_image_path = new_boot_image_path + TMP_EXTENSION;
+  RepackCache cache(build_dir, "boot");
+  if (cache.SetInputs({new_kernel_path, boot_image_path}, "") &&
+      cache.Lookup(tmp_boot_image_path)) {
+    return DeleteTmpFileIfNotChanged(tmp_boot_image_path, new_boot_image_path);
   }
 
-  std::string boot_params = ReadFile(build_dir + "/boot_params");
-  auto kernel_cmdline = ExtractValue(boot_params, "command line args: ");
-  LOG(DEBUG) << "Cmdline from boot image is " << kernel_cmdline;
-
-  auto tmp_boot_image_path = new_boot_image_path + TMP_EXTENSION;
-  auto repack_path = HostBinaryPath("mkbootimg");
-  Command repack_cmd(repack_path);
-  repack_cmd.AddParameter("--kernel");
-  repack_cmd.AddParameter(new_kernel_path);
-  repack_cmd.AddParameter("--ramdisk");
-  repack_cmd.AddParameter(build_dir + "/ramdisk");
-  repack_cmd.AddParameter("--header_version");
-  repack_cmd.AddParameter("4");
-  repack_cmd.AddParameter("--cmdline");
-  repack_cmd.AddParameter(kernel_cmdline);
-  repack_cmd.AddParameter("-o");
-  repack_cmd.AddParameter(tmp_boot_image_path);
-  int success = repack_cmd.Start().Wait();
-  if (success != 0) {
-    LOG(ERROR) << "Unable to run mkbootimg. Exited with status " << success;
+  auto boot = ReadBootImage(boot_image_path);
+  if (!boot.ok()) {
+    LOG(ERROR) << "Unable to unpack boot image: " << boot.error();
+    return false;
+  }
+  LOG(DEBUG) << "Cmdline from boot image is " << boot->cmdline;
+  if (!android::base::ReadFileToString(new_kernel_path, &boot->kernel)) {
+    PLOG(ERROR) << "Unable to read \"" << new_kernel_path << "\"";
+    return false;
+  }
+  auto written = WriteBootImage(*boot, tmp_boot_image_path);
+  if (!written.ok()) {
+    LOG(ERROR) << "Unable to repack boot image: " << written.error();
     return false;
   }
 
-  auto avbtool_path = HostBinaryPath("avbtool");
-  Command avb_cmd(avbtool_path);
-  avb_cmd.AddParameter("add_hash_footer");
-  avb_cmd.AddParameter("--image");
-  avb_cmd.AddParameter(tmp_boot_image_path);
-  avb_cmd.AddParameter("--partition_size");
-  avb_cmd.AddParameter(FileSize(boot_image_path));
-  avb_cmd.AddParameter("--partition_name");
-  avb_cmd.AddParameter("boot");
-  success = avb_cmd.Start().Wait();
-  if (success != 0) {
-    LOG(ERROR) << "Unable to run avbtool. Exited with status " << success;
+  if (!AddHashFooter(tmp_boot_image_path, FileSize(boot_image_path), "boot")) {
     return false;
   }
+  cache.Store(tmp_boot_image_path);
 
   return DeleteTmpFileIfNotChanged(tmp_boot_image_path, new_boot_image_path);
 }
@@ -245,32 +452,51 @@ bool RepackVendorBootImage(const std::string& new_ramdisk,
                            const std::string& new_vendor_boot_image_path,
                            const std::string& unpack_dir,
                            bool bootconfig_supported) {
+  auto tmp_vendor_boot_image_path = new_vendor_boot_image_path + TMP_EXTENSION;
+  RepackCache cache(unpack_dir, "vendor_boot");
+  std::vector<std::string> inputs = {vendor_boot_image_path};
+  if (new_ramdisk.size()) {
+    inputs.push_back(new_ramdisk);
+  }
+  if (cache.SetInputs(inputs, bootconfig_supported ? "bootconfig" : "") &&
+      cache.Lookup(tmp_vendor_boot_image_path)) {
+    return DeleteTmpFileIfNotChanged(tmp_vendor_boot_image_path,
+                                     new_vendor_boot_image_path);
+  }
+
   if (UnpackVendorBootImageIfNotUnpacked(vendor_boot_image_path, unpack_dir) ==
       false) {
     return false;
   }
+  auto vendor_boot = ReadVendorBootImage(vendor_boot_image_path);
+  if (!vendor_boot.ok()) {
+    LOG(ERROR) << "Unable to unpack vendor boot image: "
+               << vendor_boot.error();
+    return false;
+  }
 
-  std::string ramdisk_path;
   if (new_ramdisk.size()) {
-    ramdisk_path = unpack_dir + "/vendor_ramdisk_repacked";
+    auto ramdisk_path = unpack_dir + "/vendor_ramdisk_repacked";
     if (!FileExists(ramdisk_path)) {
       RepackVendorRamdisk(new_ramdisk,
                           unpack_dir + "/" + CONCATENATED_VENDOR_RAMDISK,
                           ramdisk_path, unpack_dir);
     }
-  } else {
-    ramdisk_path = unpack_dir + "/" + CONCATENATED_VENDOR_RAMDISK;
+    if (!android::base::ReadFileToString(ramdisk_path,
+                                         &vendor_boot->ramdisk)) {
+      PLOG(ERROR) << "Unable to read \"" << ramdisk_path << "\"";
+      return false;
+    }
   }
 
-  std::string bootconfig = ReadFile(unpack_dir + "/bootconfig");
   LOG(DEBUG) << "Bootconfig parameters from vendor boot image are "
-             << bootconfig;
-  std::string vendor_boot_params = ReadFile(unpack_dir + "/vendor_boot_params");
+             << vendor_boot->bootconfig;
   auto kernel_cmdline =
-      ExtractValue(vendor_boot_params, "vendor command line args: ") +
+      vendor_boot->cmdline +
       (bootconfig_supported
            ? ""
-           : " " + android::base::StringReplace(bootconfig, "\n", " ", true));
+           : " " + android::base::StringReplace(vendor_boot->bootconfig, "\n",
+                                                " ", true));
   if (!bootconfig_supported) {
     // TODO(b/182417593): Until we pass the module parameters through
     // modules.options, we pass them through bootconfig using
@@ -278,47 +504,23 @@ bool RepackVendorBootImage(const std::string& new_ramdisk,
     // rename them back to the old cmdline version
     kernel_cmdline = android::base::StringReplace(
         kernel_cmdline, " kernel.", " ", true);
+    vendor_boot->bootconfig.clear();
   }
   LOG(DEBUG) << "Cmdline from vendor boot image is " << kernel_cmdline;
+  vendor_boot->cmdline = kernel_cmdline;
 
-  auto tmp_vendor_boot_image_path = new_vendor_boot_image_path + TMP_EXTENSION;
-  auto repack_path = HostBinaryPath("mkbootimg");
-  Command repack_cmd(repack_path);
-  repack_cmd.AddParameter("--vendor_ramdisk");
-  repack_cmd.AddParameter(ramdisk_path);
-  repack_cmd.AddParameter("--header_version");
-  repack_cmd.AddParameter("4");
-  repack_cmd.AddParameter("--vendor_cmdline");
-  repack_cmd.AddParameter(kernel_cmdline);
-  repack_cmd.AddParameter("--vendor_boot");
-  repack_cmd.AddParameter(tmp_vendor_boot_image_path);
-  repack_cmd.AddParameter("--dtb");
-  repack_cmd.AddParameter(unpack_dir + "/dtb");
-  if (bootconfig_supported) {
-    repack_cmd.AddParameter("--vendor_bootconfig");
-    repack_cmd.AddParameter(unpack_dir + "/bootconfig");
-  }
-
-  int success = repack_cmd.Start().Wait();
-  if (success != 0) {
-    LOG(ERROR) << "Unable to run mkbootimg. Exited with status " << success;
+  auto written =
+      WriteVendorBootImage(*vendor_boot, tmp_vendor_boot_image_path);
+  if (!written.ok()) {
+    LOG(ERROR) << "Unable to repack vendor boot image: " << written.error();
     return false;
   }
 
-  auto avbtool_path = HostBinaryPath("avbtool");
-  Command avb_cmd(avbtool_path);
-  avb_cmd.AddParameter("add_hash_footer");
-  avb_cmd.AddParameter("--image");
-  avb_cmd.AddParameter(tmp_vendor_boot_image_path);
-  avb_cmd.AddParameter("--partition_size");
-  avb_cmd.AddParameter(FileSize(vendor_boot_image_path));
-  avb_cmd.AddParameter("--partition_name");
-  avb_cmd.AddParameter("vendor_boot");
-  success = avb_cmd.Start().Wait();
-  if (success != 0) {
-    LOG(ERROR) << "Unable to run avbtool. Exited with status " << success;
+  if (!AddHashFooter(tmp_vendor_boot_image_path,
+                     FileSize(vendor_boot_image_path), "vendor_boot")) {
     return false;
   }
+  cache.Store(tmp_vendor_boot_image_path);
 
   return DeleteTmpFileIfNotChanged(tmp_vendor_boot_image_path, new_vendor_boot_image_path);
 }
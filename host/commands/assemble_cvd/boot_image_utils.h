@@ -15,10 +15,46 @@
  */
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
+#include "common/libs/utils/result.h"
+
 namespace cuttlefish {
+// The parts of a boot image that are kept when repacking it
+struct BootImage {
+  uint32_t os_version;
+  std::string cmdline;
+  std::string kernel;
+  std::string ramdisk;
+};
+
+// The parts of a vendor boot image that are kept when repacking it
+struct VendorBootImage {
+  uint32_t page_size;
+  uint32_t kernel_addr;
+  uint32_t ramdisk_addr;
+  uint32_t tags_addr;
+  uint64_t dtb_addr;
+  std::string name;
+  std::string cmdline;
+  // All vendor ramdisk fragments, back to back
+  std::string ramdisk;
+  std::string dtb;
+  std::string bootconfig;
+};
+
+// Reads version 3 and later boot images.
+Result<BootImage> ReadBootImage(const std::string& path);
+// Writes a version 4 boot image, the same as `mkbootimg --header_version 4`.
+Result<void> WriteBootImage(const BootImage& boot, const std::string& path);
+// Reads version 3 and later vendor boot images.
+Result<VendorBootImage> ReadVendorBootImage(const std::string& path);
+// Writes a version 4 vendor boot image holding a single platform ramdisk.
+Result<void> WriteVendorBootImage(const VendorBootImage& vendor_boot,
+                                  const std::string& path);
+
 bool RepackBootImage(const std::string& new_kernel_path,
                      const std::string& boot_image_path,
                      const std::string& new_boot_image_path,
@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/assemble_cvd/boot_image_utils.h"
+
+#include <string.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <android-base/file.h>
+#include <bootimg.h>
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+namespace {
+
+std::string Bytes(const void* data, std::size_t size) {
+  return std::string(reinterpret_cast<const char*>(data), size);
+}
+
+// Pads `image` with zeros to a multiple of `page_size`
+void PadToPage(std::string& image, std::size_t page_size) {
+  image.resize((image.size() + page_size - 1) / page_size * page_size, '\0');
+}
+
+// Lays out a version 3 boot image the way mkbootimg does
+std::string BootImageV3(const std::string& kernel, const std::string& ramdisk,
+                        const std::string& cmdline) {
+  boot_img_hdr_v3 header = {};
+  memcpy(header.magic, BOOT_MAGIC, BOOT_MAGIC_SIZE);
+  header.kernel_size = kernel.size();
+  header.ramdisk_size = ramdisk.size();
+  header.os_version = 0x1a0c2d;
+  header.header_size = sizeof(header);
+  header.header_version = 3;
+  memcpy(header.cmdline, cmdline.data(), cmdline.size());
+
+  auto image = Bytes(&header, sizeof(header));
+  PadToPage(image, 4096);
+  image += kernel;
+  PadToPage(image, 4096);
+  image += ramdisk;
+  PadToPage(image, 4096);
+  return image;
+}
+
+// Lays out a version 3 vendor boot image the way mkbootimg does
+std::string VendorBootImageV3(const std::string& ramdisk,
+                              const std::string& dtb,
+                              const std::string& cmdline) {
+  constexpr std::uint32_t kPageSize = 2048;
+  vendor_boot_img_hdr_v3 header = {};
+  memcpy(header.magic, VENDOR_BOOT_MAGIC, VENDOR_BOOT_MAGIC_SIZE);
+  header.header_version = 3;
+  header.page_size = kPageSize;
+  header.kernel_addr = 0x8000;
+  header.ramdisk_addr = 0x1000000;
+  header.vendor_ramdisk_size = ramdisk.size();
+  memcpy(header.cmdline, cmdline.data(), cmdline.size());
+  header.tags_addr = 0x100;
+  memcpy(header.name, "cuttlefish", strlen("cuttlefish"));
+  header.header_size = sizeof(header);
+  header.dtb_size = dtb.size();
+  header.dtb_addr = 0x1f00000;
+
+  auto image = Bytes(&header, sizeof(header));
+  PadToPage(image, kPageSize);
+  image += ramdisk;
+  PadToPage(image, kPageSize);
+  image += dtb;
+  PadToPage(image, kPageSize);
+  return image;
+}
+
+class BootImageTest : public ::testing::Test {
+ protected:
+  std::string Path(const std::string& name) const {
+    return std::string(dir_.path) + "/" + name;
+  }
+
+  std::string Write(const std::string& name, const std::string& contents) {
+    auto path = Path(name);
+    EXPECT_TRUE(android::base::WriteStringToFile(contents, path));
+    return path;
+  }
+
+  TemporaryDir dir_;
+};
+
+TEST_F(BootImageTest, ReadsVersion3BootImages) {
+  // The ramdisk starts on the page after a kernel not a whole page long
+  std::string kernel(5000, 'k');
+  std::string ramdisk(100, 'r');
+  auto path = Write("boot.img", BootImageV3(kernel, ramdisk, "console=ttyS0"));
+
+  auto boot = ReadBootImage(path);
+  ASSERT_TRUE(boot.ok()) << boot.error();
+  EXPECT_EQ(boot->kernel, kernel);
+  EXPECT_EQ(boot->ramdisk, ramdisk);
+  EXPECT_EQ(boot->cmdline, "console=ttyS0");
+  EXPECT_EQ(boot->os_version, 0x1a0c2du);
+}
+
+TEST_F(BootImageTest, RoundTripsVersion4BootImages) {
+  BootImage boot;
+  boot.os_version = 0x1a0c2d;
+  boot.cmdline = std::string(BOOT_ARGS_SIZE + BOOT_EXTRA_ARGS_SIZE - 1, 'c');
+  boot.kernel = std::string(4096, 'k');
+  boot.ramdisk = "ramdisk";
+  ASSERT_TRUE(WriteBootImage(boot, Path("boot.img")).ok());
+
+  std::string image;
+  ASSERT_TRUE(android::base::ReadFileToString(Path("boot.img"), &image));
+  EXPECT_EQ(image.size(), 3 * 4096u);
+  boot_img_hdr_v4 header;
+  memcpy(&header, image.data(), sizeof(header));
+  EXPECT_EQ(header.header_version, 4u);
+  EXPECT_EQ(header.header_size, sizeof(header));
+  EXPECT_EQ(header.signature_size, 0u);
+  EXPECT_EQ(image.substr(2 * 4096, boot.ramdisk.size()), boot.ramdisk);
+
+  auto read = ReadBootImage(Path("boot.img"));
+  ASSERT_TRUE(read.ok()) << read.error();
+  EXPECT_EQ(read->os_version, boot.os_version);
+  EXPECT_EQ(read->cmdline, boot.cmdline);
+  EXPECT_EQ(read->kernel, boot.kernel);
+  EXPECT_EQ(read->ramdisk, boot.ramdisk);
+}
+
+TEST_F(BootImageTest, RefusesCommandLinesThatDontFitInTheHeader) {
+  BootImage boot;
+  boot.os_version = 0;
+  boot.cmdline = std::string(BOOT_ARGS_SIZE + BOOT_EXTRA_ARGS_SIZE, 'c');
+  EXPECT_FALSE(WriteBootImage(boot, Path("boot.img")).ok());
+
+  VendorBootImage vendor_boot = {};
+  vendor_boot.page_size = 4096;
+  vendor_boot.cmdline = std::string(VENDOR_BOOT_ARGS_SIZE, 'c');
+  EXPECT_FALSE(WriteVendorBootImage(vendor_boot, Path("vendor_boot.img")).ok());
+}
+
+TEST_F(BootImageTest, RefusesTruncatedBootImages) {
+  auto image = BootImageV3(std::string(5000, 'k'), "ramdisk", "");
+  // Cuts into the kernel
+  auto path = Write("boot.img", image.substr(0, 4096 + 100));
+  EXPECT_FALSE(ReadBootImage(path).ok());
+  path = Write("header.img", image.substr(0, sizeof(boot_img_hdr_v3) - 1));
+  EXPECT_FALSE(ReadBootImage(path).ok());
+}
+
+TEST_F(BootImageTest, RefusesOtherFiles) {
+  auto image = BootImageV3("kernel", "ramdisk", "");
+  image[0] = 'X';
+  EXPECT_FALSE(ReadBootImage(Write("boot.img", image)).ok());
+  EXPECT_FALSE(ReadVendorBootImage(Write("vendor_boot.img", image)).ok());
+  EXPECT_FALSE(ReadBootImage(Path("missing.img")).ok());
+
+  // Versions before 3 have a different layout
+  image = BootImageV3("kernel", "ramdisk", "");
+  image[offsetof(boot_img_hdr_v3, header_version)] = 2;
+  EXPECT_FALSE(ReadBootImage(Write("v2.img", image)).ok());
+}
+
+TEST_F(BootImageTest, ReadsVersion3VendorBootImages) {
+  std::string ramdisk(3000, 'r');
+  std::string dtb(10, 'd');
+  auto path = Write("vendor_boot.img",
+                    VendorBootImageV3(ramdisk, dtb, "androidboot.x=1"));
+
+  auto vendor_boot = ReadVendorBootImage(path);
+  ASSERT_TRUE(vendor_boot.ok()) << vendor_boot.error();
+  EXPECT_EQ(vendor_boot->page_size, 2048u);
+  EXPECT_EQ(vendor_boot->kernel_addr, 0x8000u);
+  EXPECT_EQ(vendor_boot->ramdisk_addr, 0x1000000u);
+  EXPECT_EQ(vendor_boot->tags_addr, 0x100u);
+  EXPECT_EQ(vendor_boot->dtb_addr, 0x1f00000u);
+  EXPECT_EQ(vendor_boot->name, "cuttlefish");
+  EXPECT_EQ(vendor_boot->cmdline, "androidboot.x=1");
+  EXPECT_EQ(vendor_boot->ramdisk, ramdisk);
+  EXPECT_EQ(vendor_boot->dtb, dtb);
+  EXPECT_EQ(vendor_boot->bootconfig, "");
+}
+
+TEST_F(BootImageTest, RefusesTruncatedVendorBootImages) {
+  auto image = VendorBootImageV3(std::string(3000, 'r'), "dtb", "");
+  // Cuts into the dtb
+  auto path = Write("vendor_boot.img", image.substr(0, 3 * 2048 + 1));
+  EXPECT_FALSE(ReadVendorBootImage(path).ok());
+}
+
+TEST_F(BootImageTest, RoundTripsVersion4VendorBootImages) {
+  VendorBootImage vendor_boot;
+  vendor_boot.page_size = 4096;
+  vendor_boot.kernel_addr = 0x8000;
+  vendor_boot.ramdisk_addr = 0x1000000;
+  vendor_boot.tags_addr = 0x100;
+  vendor_boot.dtb_addr = 0x1f00000;
+  vendor_boot.name = "cuttlefish";
+  vendor_boot.cmdline = "androidboot.x=1";
+  vendor_boot.ramdisk = std::string(5000, 'r');
+  vendor_boot.dtb = "dtb";
+  vendor_boot.bootconfig = "androidboot.hardware=cutf_cvm\n";
+  ASSERT_TRUE(WriteVendorBootImage(vendor_boot, Path("vendor_boot.img")).ok());
+
+  std::string image;
+  ASSERT_TRUE(
+      android::base::ReadFileToString(Path("vendor_boot.img"), &image));
+  // Header, two pages of ramdisk, dtb, ramdisk table and bootconfig
+  ASSERT_EQ(image.size(), 6 * 4096u);
+  vendor_boot_img_hdr_v4 header;
+  memcpy(&header, image.data(), sizeof(header));
+  EXPECT_EQ(header.header_version, 4u);
+  EXPECT_EQ(header.vendor_ramdisk_table_entry_num, 1u);
+  vendor_ramdisk_table_entry_v4 entry;
+  memcpy(&entry, image.data() + 4 * 4096, sizeof(entry));
+  EXPECT_EQ(entry.ramdisk_size, vendor_boot.ramdisk.size());
+  EXPECT_EQ(entry.ramdisk_offset, 0u);
+  EXPECT_EQ(entry.ramdisk_type, static_cast<std::uint32_t>(
+                                    VENDOR_RAMDISK_TYPE_PLATFORM));
+
+  auto read = ReadVendorBootImage(Path("vendor_boot.img"));
+  ASSERT_TRUE(read.ok()) << read.error();
+  EXPECT_EQ(read->page_size, vendor_boot.page_size);
+  EXPECT_EQ(read->kernel_addr, vendor_boot.kernel_addr);
+  EXPECT_EQ(read->ramdisk_addr, vendor_boot.ramdisk_addr);
+  EXPECT_EQ(read->tags_addr, vendor_boot.tags_addr);
+  EXPECT_EQ(read->dtb_addr, vendor_boot.dtb_addr);
+  EXPECT_EQ(read->name, vendor_boot.name);
+  EXPECT_EQ(read->cmdline, vendor_boot.cmdline);
+  EXPECT_EQ(read->ramdisk, vendor_boot.ramdisk);
+  EXPECT_EQ(read->dtb, vendor_boot.dtb);
+  EXPECT_EQ(read->bootconfig, vendor_boot.bootconfig);
+}
+
+TEST_F(BootImageTest, UnpacksBootImages) {
+  auto path = Write("boot.img", BootImageV3("kernel", "ramdisk", "quiet"));
+  ASSERT_TRUE(UnpackBootImage(path, dir_.path));
+
+  std::string contents;
+  ASSERT_TRUE(android::base::ReadFileToString(Path("kernel"), &contents));
+  EXPECT_EQ(contents, "kernel");
+  ASSERT_TRUE(android::base::ReadFileToString(Path("ramdisk"), &contents));
+  EXPECT_EQ(contents, "ramdisk");
+  ASSERT_TRUE(android::base::ReadFileToString(Path("boot_params"), &contents));
+  EXPECT_EQ(contents, "command line args: quiet\n");
+}
+
+}  // namespace
+}  // namespace cuttlefish
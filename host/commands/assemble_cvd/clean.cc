@@ -17,23 +17,133 @@
 
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
+#include <map>
 #include <regex>
 #include <vector>
 
 #include <android-base/logging.h>
 #include <android-base/strings.h>
 
+#include "common/libs/fs/shared_fd.h"
 #include "common/libs/utils/files.h"
 #include "common/libs/utils/result.h"
+#include "common/libs/utils/subprocess.h"
 #include "host/commands/assemble_cvd/flags.h"
 
 namespace cuttlefish {
 namespace {
 
+constexpr char kTrashPrefix[] = ".cuttlefish_trash.";
+
+// Directories next to the cleaned paths, on the same filesystem so moving the
+// prior files there is a rename instead of a deletion.
+class Trash {
+ public:
+  Result<void> Add(const std::string& path) {
+    auto dir = CF_EXPECT(DirFor(cpp_dirname(path)));
+    auto target = dir + "/" + std::to_string(count_++);
+    if (rename(path.c_str(), target.c_str()) < 0) {
+      return CF_ERRNO("Could not move \"" << path << "\" to the trash");
+    }
+    LOG(DEBUG) << "Moved to the trash: " << path;
+    return {};
+  }
+
+  // Starts a detached, low priority `rm` of the trash, along with any trash
+  // earlier runs left next to `paths` or next to this run's trash, e.g. when
+  // they crashed before emptying theirs.
+  void EmptyInBackground(const std::vector<std::string>& paths);
+
+ private:
+  Result<std::string> DirFor(const std::string& parent) {
+    if (auto it = dirs_.find(parent); it != dirs_.end()) {
+      return it->second;
+    }
+    std::string dir = parent + "/" + kTrashPrefix + "XXXXXX";
+    if (mkdtemp(dir.data()) == nullptr) {
+      return CF_ERRNO("Could not create a trash directory in \"" << parent
+                                                                 << "\"");
+    }
+    dirs_[parent] = dir;
+    return dir;
+  }
+
+  std::map<std::string, std::string> dirs_;
+  int count_ = 0;
+};
+
+void Trash::EmptyInBackground(const std::vector<std::string>& paths) {
+  std::set<std::string> parents;
+  for (const auto& [parent, dir] : dirs_) {
+    parents.insert(parent);
+  }
+  // Trash inside the cleaned directories is moved to this run's trash
+  for (const auto& path : paths) {
+    parents.insert(cpp_dirname(path));
+  }
+  Command rm("nice");
+  rm.AddParameter("-n", "19");
+  rm.AddParameter("ionice");
+  rm.AddParameter("-c", "3");
+  rm.AddParameter("rm");
+  rm.AddParameter("-rf");
+  rm.AddParameter("--");
+  bool found = false;
+  for (const auto& parent : parents) {
+    for (const auto& name : DirectoryContents(parent)) {
+      if (android::base::StartsWith(name, kTrashPrefix)) {
+        rm.AddParameter(parent + "/" + name);
+        found = true;
+      }
+    }
+  }
+  if (!found) {
+    return;
+  }
+  // Holding on to the launcher's stdio would keep its readers waiting
+  auto dev_null = SharedFD::Open("/dev/null", O_RDWR);
+  rm.RedirectStdIO(Subprocess::StdIOChannel::kStdIn, dev_null);
+  rm.RedirectStdIO(Subprocess::StdIOChannel::kStdOut, dev_null);
+  rm.RedirectStdIO(Subprocess::StdIOChannel::kStdErr, dev_null);
+  // Left running when assemble_cvd exits, away from its terminal's signals
+  auto deletion = rm.Start(SubprocessOptions()
+                               .Verbose(false)
+                               .ExitWithParent(false)
+                               .InGroup(true));
+  if (!deletion.Started()) {
+    LOG(WARNING) << "Could not start deleting the trash, it will be deleted "
+                 << "by the next clean";
+    return;
+  }
+  LOG(DEBUG) << "Deleting the prior files in the background";
+}
+
+bool ContainsPreserved(const std::string& path,
+                       const std::set<std::string>& preserving) {
+  if (preserving.count(cpp_basename(path))) {
+    return true;
+  }
+  if (!DirectoryExists(path, /* follow_symlinks */ false)) {
+    return false;
+  }
+  for (const auto& name : DirectoryContents(path)) {
+    if (name != "." && name != ".." &&
+        ContainsPreserved(path + "/" + name, preserving)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 Result<void> CleanPriorFiles(const std::string& path,
-                             const std::set<std::string>& preserving) {
+                             const std::set<std::string>& preserving,
+                             Trash& trash) {
   if (preserving.count(cpp_basename(path))) {
     LOG(DEBUG) << "Preserving: " << path;
     return {};
@@ -47,6 +157,15 @@ Result<void> CleanPriorFiles(const std::string& path,
       return CF_ERRNO("Could not stat \"" << path);
     }
   }
+  if ((statbuf.st_mode & S_IFMT) == S_IFDIR &&
+      !ContainsPreserved(path, preserving)) {
+    auto trashed = trash.Add(path);
+    if (trashed.ok()) {
+      return {};
+    }
+    // e.g. a mount point, delete it in place instead
+    LOG(DEBUG) << trashed.error();
+  }
   if ((statbuf.st_mode & S_IFMT) != S_IFDIR) {
     LOG(DEBUG) << "Deleting: " << path;
     if (unlink(path.c_str()) < 0) {
@@ -64,7 +183,7 @@ Result<void> CleanPriorFiles(const std::string& path,
       continue;
     }
     std::string entity_path = path + "/" + entity_name;
-    CF_EXPECT(CleanPriorFiles(entity_path.c_str(), preserving),
+    CF_EXPECT(CleanPriorFiles(entity_path.c_str(), preserving, trash),
               "CleanPriorFiles for \""
                   << path << "\" failed on recursing into \"" << entity_path
                   << "\"");
@@ -95,10 +214,18 @@ Result<void> CleanPriorFiles(const std::vector<std::string>& paths,
   int rval = std::system(lsof_cmd.c_str());
   // lsof returns 0 if any of the files are open
   CF_EXPECT(WEXITSTATUS(rval) != 0, "Clean aborted: files are in use");
+  // Prior files are moved aside and deleted after assemble_cvd moves on, as
+  // overlays and logs can take a while to delete.
+  Trash trash;
   for (const auto& path : paths) {
-    CF_EXPECT(CleanPriorFiles(path, preserving),
-              "CleanPriorFiles failed for \"" << path << "\"");
+    auto cleaned = CleanPriorFiles(path, preserving, trash);
+    if (!cleaned.ok()) {
+      trash.EmptyInBackground(paths);
+      return CF_ERR("CleanPriorFiles failed for \"" << path << "\":\n"
+                                                     << cleaned.error());
+    }
   }
+  trash.EmptyInBackground(paths);
   return {};
 }
 
@@ -15,6 +15,9 @@
 
 #include "host/commands/assemble_cvd/disk_builder.h"
 
+#include <unistd.h>
+
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <string>
@@ -24,6 +27,8 @@
 
 #include "common/libs/fs/shared_fd.h"
 #include "common/libs/utils/files.h"
+#include "host/commands/assemble_cvd/image_digest.h"
+#include "host/commands/assemble_cvd/image_store.h"
 #include "host/libs/config/cuttlefish_config.h"
 #include "host/libs/image_aggregator/image_aggregator.h"
 #include "host/libs/vm_manager/crosvm_manager.h"
@@ -73,15 +78,6 @@ DiskBuilder DiskBuilder::FooterPath(std::string footer_path) && {
   return *this;
 }
 
-DiskBuilder& DiskBuilder::CrosvmPath(std::string crosvm_path) & {
-  crosvm_path_ = std::move(crosvm_path);
-  return *this;
-}
-DiskBuilder DiskBuilder::CrosvmPath(std::string crosvm_path) && {
-  crosvm_path_ = std::move(crosvm_path);
-  return *this;
-}
-
 DiskBuilder& DiskBuilder::VmManager(std::string vm_manager) & {
   vm_manager_ = std::move(vm_manager);
   return *this;
@@ -127,6 +123,15 @@ DiskBuilder DiskBuilder::ResumeIfPossible(bool resume_if_possible) && {
   return *this;
 }
 
+DiskBuilder& DiskBuilder::ImageStoreDir(std::string image_store_dir) & {
+  image_store_dir_ = std::move(image_store_dir);
+  return *this;
+}
+DiskBuilder DiskBuilder::ImageStoreDir(std::string image_store_dir) && {
+  image_store_dir_ = std::move(image_store_dir);
+  return *this;
+}
+
 Result<std::string> DiskBuilder::TextConfig() {
   std::ostringstream disk_conf;
 
@@ -140,6 +145,36 @@ Result<std::string> DiskBuilder::TextConfig() {
   return disk_conf.str();
 }
 
+std::string DiskBuilder::ManifestPath() const {
+  return config_path_ + ".manifest";
+}
+
+std::string DiskBuilder::DigestCachePath() const {
+  return config_path_ + ".digest_cache";
+}
+
+Result<std::string> DiskBuilder::ContentManifest() {
+  CF_EXPECT(!config_path_.empty(), "No config path");
+  CF_EXPECT(!vm_manager_.empty(), "Missing vm_manager");
+  if (vm_manager_ != vm_manager::CrosvmManager::name()) {
+    // The disk is built from the desparsed images, digesting them as fetched
+    // would never match the manifest written after the build.
+    DeAndroidSparse(partitions_);
+  }
+  FileDigestCache digests(DigestCachePath());
+  std::ostringstream manifest;
+  for (auto& partition : partitions_) {
+    if (partition.label == "frp") {
+      continue;
+    }
+    manifest << partition.label << " " << FileSize(partition.image_file_path)
+             << " " << CF_EXPECT(digests.Digest(partition.image_file_path))
+             << "\n";
+  }
+  CF_EXPECT(digests.Save());
+  return manifest.str();
+}
+
 Result<bool> DiskBuilder::WillRebuildCompositeDisk() {
   if (!resume_if_possible_) {
     return true;
@@ -157,9 +192,16 @@ Result<bool> DiskBuilder::WillRebuildCompositeDisk() {
   CF_EXPECT(!composite_disk_path_.empty(), "No composite disk path");
   auto composite_mod_time = FileModificationTime(composite_disk_path_);
 
+  auto prior_manifest = ReadFile(ManifestPath());
   if (composite_mod_time == decltype(composite_mod_time)()) {
     LOG(DEBUG) << "No prior composite disk";
     return true;
+  } else if (!prior_manifest.empty()) {
+    // Re-fetched or touched files with the same contents don't count
+    if (prior_manifest != CF_EXPECT(ContentManifest())) {
+      LOG(DEBUG) << "Composite disk component contents changed";
+      return true;
+    }
   } else if (last_component_mod_time > composite_mod_time) {
     LOG(DEBUG) << "Composite disk component file updated";
     return true;
@@ -169,7 +211,13 @@ Result<bool> DiskBuilder::WillRebuildCompositeDisk() {
 }
 
 Result<bool> DiskBuilder::BuildCompositeDiskIfNecessary() {
+  using android::base::WriteStringToFile;
   if (!CF_EXPECT(WillRebuildCompositeDisk())) {
+    // Disks from before manifests were kept rely on modification times
+    if (!FileExists(ManifestPath())) {
+      CF_EXPECT(WriteStringToFile(CF_EXPECT(ContentManifest()), ManifestPath()),
+                "Failed to write \"" << ManifestPath() << "\"");
+    }
     return false;
   }
 
@@ -180,14 +228,27 @@ Result<bool> DiskBuilder::BuildCompositeDiskIfNecessary() {
     CreateCompositeDisk(partitions_, AbsolutePath(header_path_),
                         AbsolutePath(footer_path_),
                         AbsolutePath(composite_disk_path_));
-  } else {
+  } else if (image_store_dir_.empty()) {
     // If this doesn't fit into the disk, it will fail while aggregating. The
     // aggregator doesn't maintain any sparse attributes.
     AggregateImage(partitions_, AbsolutePath(composite_disk_path_));
+  } else {
+    // The key must be computed from the contents the disk is built from
+    DeAndroidSparse(partitions_);
+    FileDigestCache digests(DigestCachePath());
+    auto key = CF_EXPECT(ImageStoreKey(partitions_, digests));
+    CF_EXPECT(digests.Save());
+    CF_EXPECT(ImageStore(image_store_dir_)
+                  .Link(key, AbsolutePath(composite_disk_path_),
+                        [this](const std::string& path) -> Result<void> {
+                          AggregateImage(partitions_, path);
+                          return {};
+                        }));
   }
 
-  using android::base::WriteStringToFile;
   CF_EXPECT(WriteStringToFile(CF_EXPECT(TextConfig()), config_path_), true);
+  CF_EXPECT(WriteStringToFile(CF_EXPECT(ContentManifest()), ManifestPath()),
+            "Failed to write \"" << ManifestPath() << "\"");
 
   return true;
 }
@@ -200,20 +261,36 @@ Result<bool> DiskBuilder::BuildOverlayIfNecessary() {
 
   CF_EXPECT(!composite_disk_path_.empty(), "Composite disk path missing");
   auto composite_disk_mod_time = FileModificationTime(composite_disk_path_);
+  // The overlay records the manifest of the disk it was created on top of
+  auto composite_manifest = ReadFile(ManifestPath());
+  auto overlay_manifest_path = overlay_path_ + ".manifest";
+  auto overlay_manifest = ReadFile(overlay_manifest_path);
   if (overlay_mod_time == decltype(overlay_mod_time)()) {
     LOG(DEBUG) << "No prior overlay";
     can_reuse_overlay = false;
+  } else if (!overlay_manifest.empty() && !composite_manifest.empty()) {
+    if (overlay_manifest != composite_manifest) {
+      LOG(DEBUG) << "Overlay base contents changed";
+      can_reuse_overlay = false;
+    }
   } else if (overlay_mod_time < composite_disk_mod_time) {
     LOG(DEBUG) << "Overlay is out of date";
     can_reuse_overlay = false;
   }
 
+  using android::base::WriteStringToFile;
   if (can_reuse_overlay) {
+    if (overlay_manifest.empty() && !composite_manifest.empty()) {
+      CF_EXPECT(WriteStringToFile(composite_manifest, overlay_manifest_path),
+                "Failed to write \"" << overlay_manifest_path << "\"");
+    }
     return false;
   }
 
-  CF_EXPECT(!crosvm_path_.empty(), "crosvm binary missing");
-  CreateQcowOverlay(crosvm_path_, composite_disk_path_, overlay_path_);
+  CF_EXPECT(CreateQcowOverlay(composite_disk_path_, overlay_path_),
+            "Failed to create \"" << overlay_path_ << "\"");
+  CF_EXPECT(WriteStringToFile(composite_manifest, overlay_manifest_path),
+            "Failed to write \"" << overlay_manifest_path << "\"");
 
   return true;
 }
@@ -36,9 +36,6 @@ class DiskBuilder {
   DiskBuilder& FooterPath(std::string footer_path) &;
   DiskBuilder FooterPath(std::string footer_path) &&;
 
-  DiskBuilder& CrosvmPath(std::string crosvm_path) &;
-  DiskBuilder CrosvmPath(std::string crosvm_path) &&;
-
   DiskBuilder& VmManager(std::string vm_manager) &;
   DiskBuilder VmManager(std::string vm_manager) &&;
 
@@ -54,6 +51,11 @@ class DiskBuilder {
   DiskBuilder& ResumeIfPossible(bool resume_if_possible) &;
   DiskBuilder ResumeIfPossible(bool resume_if_possible) &&;
 
+  // Aggregated disks are kept in an ImageStore in this directory and shared
+  // with other launches. Empty to build them in place.
+  DiskBuilder& ImageStoreDir(std::string image_store_dir) &;
+  DiskBuilder ImageStoreDir(std::string image_store_dir) &&;
+
   Result<bool> WillRebuildCompositeDisk();
   /** Returns `true` if the file was actually rebuilt. */
   Result<bool> BuildCompositeDiskIfNecessary();
@@ -62,16 +64,21 @@ class DiskBuilder {
 
  private:
   Result<std::string> TextConfig();
+  // Sizes and digests of the partitions, to detect changes in their contents
+  // regardless of modification times.
+  Result<std::string> ContentManifest();
+  std::string ManifestPath() const;
+  std::string DigestCachePath() const;
 
   std::vector<ImagePartition> partitions_;
   std::string header_path_;
   std::string footer_path_;
   std::string vm_manager_;
-  std::string crosvm_path_;
   std::string config_path_;
   std::string composite_disk_path_;
   std::string overlay_path_;
   bool resume_if_possible_;
+  std::string image_store_dir_;
 };
 
 }  // namespace cuttlefish
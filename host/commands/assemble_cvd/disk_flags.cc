@@ -21,8 +21,14 @@
 #include <fruit/fruit.h>
 #include <gflags/gflags.h>
 #include <sys/statvfs.h>
+#include <unistd.h>
 
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
 
 #include "common/libs/fs/shared_buf.h"
 #include "common/libs/utils/environment.h"
@@ -32,7 +38,10 @@
 #include "host/commands/assemble_cvd/boot_config.h"
 #include "host/commands/assemble_cvd/boot_image_utils.h"
 #include "host/commands/assemble_cvd/disk_builder.h"
+#include "host/commands/assemble_cvd/image_digest.h"
+#include "host/commands/assemble_cvd/image_store.h"
 #include "host/commands/assemble_cvd/super_image_mixer.h"
+#include "host/libs/config/boot_timeline.h"
 #include "host/libs/config/bootconfig_args.h"
 #include "host/libs/config/cuttlefish_config.h"
 #include "host/libs/config/data_image.h"
@@ -84,6 +93,18 @@ DEFINE_int32(blank_metadata_image_mb, 16,
              "The size of the blank metadata image to generate, MB.");
 DEFINE_int32(blank_sdcard_image_mb, 2048,
              "If enabled, the size of the blank sdcard image to generate, MB.");
+DEFINE_string(image_store_dir, "",
+              "Directory where aggregated OS disks are kept and shared between "
+              "launches with identical images, e.g. "
+              "~/.cache/cuttlefish/image_store. Disabled when empty.");
+DEFINE_bool(pmem_super_image, false,
+            "Expose the super partition, which holds the read-only system, "
+            "vendor and product images, to the guest through virtio-pmem "
+            "instead of the OS disk. With --image_store_dir, every instance "
+            "maps the same file, so they share its host page cache, and a "
+            "guest mounting its partitions with DAX doesn't keep its own "
+            "copy in its page cache. The partitions can't be written to, "
+            "e.g. by OTA updates.");
 
 DECLARE_string(ap_rootfs_image);
 DECLARE_string(bootloader);
@@ -200,11 +221,13 @@ std::vector<ImagePartition> GetOsCompositeDiskConfig() {
       .image_file_path = AbsolutePath(FLAGS_vbmeta_system_image),
       .read_only = true,
   });
-  partitions.push_back(ImagePartition{
-      .label = "super",
-      .image_file_path = AbsolutePath(FLAGS_super_image),
-      .read_only = true,
-  });
+  if (!FLAGS_pmem_super_image) {
+    partitions.push_back(ImagePartition{
+        .label = "super",
+        .image_file_path = AbsolutePath(FLAGS_super_image),
+        .read_only = true,
+    });
+  }
   partitions.push_back(ImagePartition{
       .label = "userdata",
       .image_file_path = AbsolutePath(FLAGS_data_image),
@@ -242,12 +265,12 @@ DiskBuilder OsCompositeDiskBuilder(const CuttlefishConfig& config) {
   return DiskBuilder()
       .Partitions(GetOsCompositeDiskConfig())
       .VmManager(config.vm_manager())
-      .CrosvmPath(config.crosvm_binary())
       .ConfigPath(config.AssemblyPath("os_composite_disk_config.txt"))
       .HeaderPath(config.AssemblyPath("os_composite_gpt_header.img"))
       .FooterPath(config.AssemblyPath("os_composite_gpt_footer.img"))
       .CompositeDiskPath(config.os_composite_disk_path())
-      .ResumeIfPossible(FLAGS_resume);
+      .ResumeIfPossible(FLAGS_resume)
+      .ImageStoreDir(FLAGS_image_store_dir);
 }
 
 std::vector<ImagePartition> persistent_composite_disk_config(
@@ -282,6 +305,79 @@ std::vector<ImagePartition> persistent_composite_disk_config(
   return partitions;
 }
 
+// The super image with a partition table of its own, as virtio-pmem devices
+// carry a single file.
+static Result<void> BuildSuperPmemImage(const CuttlefishConfig& config) {
+  std::vector<ImagePartition> partitions = {ImagePartition{
+      .label = "super",
+      .image_file_path = AbsolutePath(FLAGS_super_image),
+      .read_only = true,
+  }};
+  DeAndroidSparse(partitions);
+  auto pmem_path = config.super_pmem_path();
+  if (FLAGS_image_store_dir.empty()) {
+    if (FileModificationTime(pmem_path) <
+        FileModificationTime(FLAGS_super_image)) {
+      AggregateImage(partitions, pmem_path);
+    }
+    return {};
+  }
+  FileDigestCache digests(pmem_path + ".digest_cache");
+  auto key = CF_EXPECT(ImageStoreKey(partitions, digests));
+  CF_EXPECT(digests.Save());
+  CF_EXPECT(ImageStore(FLAGS_image_store_dir)
+                .Link(key, pmem_path,
+                      [&partitions](const std::string& path) -> Result<void> {
+                        AggregateImage(partitions, path);
+                        return {};
+                      }));
+  return {};
+}
+
+// Points the instance's gem5 checkpoint link to the cache entry for its
+// images and simulated system, so runs with the same ones restore the same
+// checkpoint.
+static Result<void> LinkGem5Checkpoint(
+    const CuttlefishConfig& config,
+    const CuttlefishConfig::InstanceSpecific& instance) {
+  FileDigestCache digests(
+      instance.PerInstancePath("gem5_checkpoint.digest_cache"));
+  std::stringstream inputs;
+  inputs << "memory_mb " << config.memory_mb() << "\n";
+  inputs << "gem5 " << config.gem5_binary_dir() << "\n";
+  inputs << "script "
+         << StringDigest(vm_manager::fs_header + vm_manager::fs_run +
+                         vm_manager::fs_mem_pci + vm_manager::fs_kernel_cmd +
+                         vm_manager::fs_exe_main)
+         << "\n";
+  inputs << "kernel "
+         << CF_EXPECT(digests.Digest(config.assembly_dir() + "/kernel")) << "\n";
+  inputs << "initrd "
+         << CF_EXPECT(digests.Digest(instance.PerInstancePath("initrd.img")))
+         << "\n";
+  // Composite disks only name the images they are made of
+  auto partitions = GetOsCompositeDiskConfig();
+  auto persistent = persistent_composite_disk_config(config, instance);
+  partitions.insert(partitions.end(), persistent.begin(), persistent.end());
+  for (const auto& partition : partitions) {
+    inputs << partition.label << " "
+           << CF_EXPECT(digests.Digest(partition.image_file_path)) << "\n";
+  }
+  for (const auto& disk : instance.virtual_disk_paths()) {
+    inputs << "disk " << CF_EXPECT(digests.Digest(disk)) << "\n";
+  }
+  CF_EXPECT(digests.Save());
+
+  CF_EXPECT(EnsureDirectoryExists(config.gem5_checkpoint_dir()));
+  auto entry = config.gem5_checkpoint_dir() + "/" + StringDigest(inputs.str());
+  auto link = instance.gem5_checkpoint_path();
+  RemoveFile(link);
+  CF_EXPECT(symlink(entry.c_str(), link.c_str()) == 0,
+            "Failed to link \"" << link << "\" to \"" << entry
+                                 << "\": " << strerror(errno));
+  return {};
+}
+
 static uint64_t AvailableSpaceAtPath(const std::string& path) {
   struct statvfs vfs;
   if (statvfs(path.c_str(), &vfs) != 0) {
@@ -614,11 +710,34 @@ class GeneratePersistentVbmeta : public SetupFeature {
   }
 
   bool Setup() override {
+    // Only public keys go in it, so every instance gets the same image. The
+    // first instance to get here makes it, the others clone it.
+    static std::mutex shared_vbmeta_mutex;
+    static bool shared_vbmeta_made = false;
+    auto shared_vbmeta = config_.AssemblyPath("persistent_vbmeta.img");
+    {
+      std::lock_guard<std::mutex> lock(shared_vbmeta_mutex);
+      if (!shared_vbmeta_made) {
+        if (!MakeVbmeta(shared_vbmeta)) {
+          return false;
+        }
+        shared_vbmeta_made = true;
+      }
+    }
+    if (!CopyImageFile(shared_vbmeta, instance_.vbmeta_path())) {
+      LOG(ERROR) << "Unable to copy " << shared_vbmeta << " to "
+                 << instance_.vbmeta_path();
+      return false;
+    }
+    return true;
+  }
+
+  bool MakeVbmeta(const std::string& vbmeta_path) {
     auto avbtool_path = HostBinaryPath("avbtool");
     Command vbmeta_cmd(avbtool_path);
     vbmeta_cmd.AddParameter("make_vbmeta_image");
     vbmeta_cmd.AddParameter("--output");
-    vbmeta_cmd.AddParameter(instance_.vbmeta_path());
+    vbmeta_cmd.AddParameter(vbmeta_path);
     vbmeta_cmd.AddParameter("--algorithm");
     vbmeta_cmd.AddParameter("SHA256_RSA4096");
     vbmeta_cmd.AddParameter("--key");
@@ -642,17 +761,17 @@ class GeneratePersistentVbmeta : public SetupFeature {
       return false;
     }
 
-    if (FileSize(instance_.vbmeta_path()) > VBMETA_MAX_SIZE) {
-      LOG(ERROR) << "Generated vbmeta - " << instance_.vbmeta_path()
+    if (FileSize(vbmeta_path) > VBMETA_MAX_SIZE) {
+      LOG(ERROR) << "Generated vbmeta - " << vbmeta_path
                  << " is larger than the expected " << VBMETA_MAX_SIZE
                  << ". Stopping.";
       return false;
     }
-    if (FileSize(instance_.vbmeta_path()) != VBMETA_MAX_SIZE) {
-      auto fd = SharedFD::Open(instance_.vbmeta_path(), O_RDWR);
+    if (FileSize(vbmeta_path) != VBMETA_MAX_SIZE) {
+      auto fd = SharedFD::Open(vbmeta_path, O_RDWR);
       if (!fd->IsOpen() || fd->Truncate(VBMETA_MAX_SIZE) != 0) {
         LOG(ERROR) << "`truncate --size=" << VBMETA_MAX_SIZE << " "
-                   << instance_.vbmeta_path() << "` "
+                   << vbmeta_path << "` "
                    << "failed: " << fd->StrError();
         return false;
       }
@@ -743,6 +862,38 @@ class InitializeHwcomposerPmemImage : public SetupFeature {
   const CuttlefishConfig::InstanceSpecific& instance_;
 };
 
+class InitializeCameraFramesPmemImage : public SetupFeature {
+ public:
+  INJECT(InitializeCameraFramesPmemImage(
+      const CuttlefishConfig& config,
+      const CuttlefishConfig::InstanceSpecific& instance))
+      : config_(config), instance_(instance) {}
+
+  // SetupFeature
+  std::string Name() const override {
+    return "InitializeCameraFramesPmemImage";
+  }
+  bool Enabled() const override { return !config_.protected_vm(); }
+
+ private:
+  std::unordered_set<SetupFeature*> Dependencies() const override { return {}; }
+  Result<void> ResultSetup() override {
+    // The contents are only meaningful while the device runs, the host
+    // streamer initializes them on every start.
+    if (FileExists(instance_.camera_frames_pmem_path())) {
+      return {};
+    }
+    CF_EXPECT(CreateBlankImage(instance_.camera_frames_pmem_path(),
+                               10 /* mb */, "none"),
+              "Failed creating \"" << instance_.camera_frames_pmem_path()
+                                    << "\"");
+    return {};
+  }
+
+  const CuttlefishConfig& config_;
+  const CuttlefishConfig::InstanceSpecific& instance_;
+};
+
 class InitializePstore : public SetupFeature {
  public:
   INJECT(InitializePstore(const CuttlefishConfig& config,
@@ -856,7 +1007,6 @@ class InitializeInstanceCompositeDisk : public SetupFeature {
         DiskBuilder()
             .Partitions(persistent_composite_disk_config(config_, instance_))
             .VmManager(config_.vm_manager())
-            .CrosvmPath(config_.crosvm_binary())
             .ConfigPath(ipath("persistent_composite_disk_config.txt"))
             .HeaderPath(ipath("persistent_composite_gpt_header.img"))
             .FooterPath(ipath("persistent_composite_gpt_footer.img"))
@@ -946,6 +1096,7 @@ static fruit::Component<> DiskChangesPerInstanceComponent(
       .bindInstance(*instance)
       .addMultibinding<SetupFeature, InitializeAccessKregistryImage>()
       .addMultibinding<SetupFeature, InitializeHwcomposerPmemImage>()
+      .addMultibinding<SetupFeature, InitializeCameraFramesPmemImage>()
       .addMultibinding<SetupFeature, InitializePstore>()
       .addMultibinding<SetupFeature, InitializeSdCard>()
       .addMultibinding<SetupFeature, InitializeFactoryResetProtected>()
@@ -961,17 +1112,44 @@ Result<void> CreateDynamicDiskFiles(const FetcherConfig& fetcher_config,
   // assemble_cvd.cpp
   fruit::Injector<> injector(DiskChangesComponent, &fetcher_config, &config);
 
+  // Every instance waits for the shared files, so they go in every timeline
+  auto instances = config.Instances();
+  std::vector<BootTimeline> timelines;
+  std::vector<BootTimeline*> timeline_ptrs;
+  for (const auto& instance : instances) {
+    timelines.emplace_back(
+        CF_EXPECT(BootTimeline::Create(instance.boot_timeline_path())));
+  }
+  for (auto& timeline : timelines) {
+    timeline_ptrs.push_back(&timeline);
+  }
+
   const auto& features = injector.getMultibindings<SetupFeature>();
-  CF_EXPECT(SetupFeature::RunSetup(features));
-
-  for (const auto& instance : config.Instances()) {
-    fruit::Injector<> instance_injector(DiskChangesPerInstanceComponent,
-                                        &fetcher_config, &config, &instance);
-    const auto& instance_features =
-        instance_injector.getMultibindings<SetupFeature>();
-    CF_EXPECT(SetupFeature::RunSetup(instance_features),
-              "instance = \"" << instance.instance_name() << "\"");
+  std::unordered_map<SetupFeature*, std::vector<BootTimeline*>>
+      shared_timelines;
+  for (auto feature : features) {
+    shared_timelines[feature] = timeline_ptrs;
+  }
+  CF_EXPECT(SetupFeature::RunSetupInParallel(features, shared_timelines));
+
+  // Instances don't share any files, so all of their features go in one graph.
+  // Each feature only goes in the timeline of its own instance.
+  std::vector<std::unique_ptr<fruit::Injector<>>> instance_injectors;
+  std::vector<SetupFeature*> instance_features;
+  std::unordered_map<SetupFeature*, std::vector<BootTimeline*>>
+      instance_timelines;
+  for (std::size_t i = 0; i < instances.size(); i++) {
+    instance_injectors.emplace_back(std::make_unique<fruit::Injector<>>(
+        DiskChangesPerInstanceComponent, &fetcher_config, &config,
+        &instances[i]));
+    for (auto feature :
+         instance_injectors.back()->getMultibindings<SetupFeature>()) {
+      instance_features.push_back(feature);
+      instance_timelines[feature] = {timeline_ptrs[i]};
+    }
   }
+  CF_EXPECT(SetupFeature::RunSetupInParallel(instance_features,
+                                             instance_timelines));
 
   // Check if filling in the sparse image would run out of disk space.
   auto existing_sizes = SparseFileSizes(FLAGS_data_image);
@@ -994,6 +1172,10 @@ Result<void> CreateDynamicDiskFiles(const FetcherConfig& fetcher_config,
                << "\": " << existing_sizes.disk_size;
   }
 
+  if (config.pmem_super_image()) {
+    CF_EXPECT(BuildSuperPmemImage(config));
+  }
+
   auto os_disk_builder = OsCompositeDiskBuilder(config);
   auto built_composite =
       CF_EXPECT(os_disk_builder.BuildCompositeDiskIfNecessary());
@@ -1041,6 +1223,9 @@ Result<void> CreateDynamicDiskFiles(const FetcherConfig& fetcher_config,
           instance.PerInstancePath("initrd.img"),
           instance.persistent_bootconfig_path(),
           config.assembly_dir());
+      if (!config.gem5_checkpoint_dir().empty()) {
+        CF_EXPECT(LinkGem5Checkpoint(config, instance));
+      }
     }
   }
 
@@ -13,6 +13,7 @@
 #include <array>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <optional>
 #include <regex>
 #include <set>
@@ -30,6 +31,7 @@
 #include "host/libs/config/config_flag.h"
 #include "host/libs/config/host_tools_version.h"
 #include "host/libs/graphics_detector/graphics_detector.h"
+#include "host/libs/vm_manager/cpu_placement.h"
 #include "host/libs/vm_manager/crosvm_manager.h"
 #include "host/libs/vm_manager/gem5_manager.h"
 #include "host/libs/vm_manager/qemu_manager.h"
@@ -181,6 +183,30 @@ DEFINE_bool(
         false,
         "[Experimental] If enabled, exposes local adb service through a websocket.");
 
+DEFINE_string(webrtc_video_codecs, "VP8",
+              "Comma separated list of the video codecs offered to WebRTC "
+              "clients, most preferred first, e.g. H264,VP9,VP8. Hardware "
+              "encoders are used when available. VP8 is always offered as a "
+              "fallback.");
+
+DEFINE_bool(webrtc_share_encoders, false,
+            "Encode each display once for all the WebRTC clients watching it "
+            "with the same codec and resolution, instead of once per client.");
+
+DEFINE_bool(webrtc_screen_content, true,
+            "Tune the WebRTC video encoders for the UI shown on the displays: "
+            "keep text sharp rather than the frame rate, use temporal layers "
+            "and only send key frames when a client asks for them.");
+
+DEFINE_int32(webrtc_thumbnail_interval_ms, 1000,
+             "How often a small picture of the first display is published to "
+             "the operator for device lists, if it changed. 0 disables "
+             "thumbnails.");
+
+DEFINE_bool(webrtc_lazy_streaming, false,
+            "Don't convert display frames or process guest audio until a "
+            "WebRTC client connects, saving host CPU on headless devices.");
+
 static constexpr auto HOST_OPERATOR_SOCKET_PATH = "/run/cuttlefish/operator";
 
 DEFINE_bool(
@@ -238,17 +264,66 @@ DEFINE_string(uuid, cuttlefish::ForCurrentInstance(cuttlefish::kDefaultUuidPrefi
 DEFINE_bool(daemon, false,
             "Run cuttlefish in background, the launcher exits on boot "
             "completed/failed");
+DEFINE_bool(binary_subprocess_logs, false,
+            "Write the output of the host processes to a compact binary "
+            "subprocess_logs.bin instead of launcher.log. Print it with "
+            "log_tee --print_binary_log=<path>.");
+DEFINE_bool(structured_logs, false,
+            "Also keep the launcher, kernel and logcat logs in a compressed, "
+            "indexed store that `cvd logs` queries without a full scan.");
+DEFINE_bool(compress_tombstones, false,
+            "gzip the tombstones received from the device in the background, "
+            "renaming each of them to tombstone_<time>.gz.");
 
 DEFINE_string(setupwizard_mode, "DISABLED",
             "One of DISABLED,OPTIONAL,REQUIRED");
 
 DEFINE_string(qemu_binary_dir, "/usr/bin",
               "Path to the directory containing the qemu binary to use");
+DEFINE_bool(qemu_performance_profile, false,
+            "Launch qemu tuned for guest performance: an iothread per disk, "
+            "vhost networking, guest-handled CPU idle and fewer emulated "
+            "legacy devices. Idle vCPUs keep their host CPUs busy, so only "
+            "use it when the host isn't overcommitted.");
 DEFINE_string(crosvm_binary, HostBinaryPath("crosvm"),
               "The Crosvm binary to use");
 DEFINE_string(gem5_binary_dir, HostBinaryPath("gem5"),
               "Path to the gem5 build tree root");
+DEFINE_string(gem5_checkpoint_dir, "",
+              "With vm_manager=gem5, checkpoint the simulation once the guest "
+              "booted and restore later runs with the same images and "
+              "configuration from it, skipping the boot. Checkpoints are as "
+              "large as the guest memory and are not removed automatically.");
 DEFINE_bool(restart_subprocesses, true, "Restart any crashed host process");
+DEFINE_bool(resource_accounting, true,
+            "Place the host processes of each instance in cgroup v2 groups and "
+            "export their resource usage. Needs a cgroup delegated to the user, "
+            "e.g. by starting under `systemd-run --user --scope -p "
+            "Delegate=yes`, and is skipped otherwise.");
+DEFINE_string(host_process_cgroups,
+              "crosvm:cpu.weight=400,io.weight=400;"
+              "log_tee:cpu.weight=25,io.weight=25;"
+              "guest_diagnostics_receiver:cpu.weight=25,io.weight=25",
+              "With --resource_accounting, settings for the cgroups of the "
+              "host processes, as <process>:<file>=<value>,...;<process>:... "
+              "The files can be cpu.weight, cpu.max, io.weight, memory.high "
+              "and memory.max. Weights are relative to the other processes "
+              "of the same instance.");
+DEFINE_bool(guest_memory_merge, false,
+            "Let the host's KSM merge the guest memory with identical pages of "
+            "other guests, e.g. those booted from the same build. Needs Linux "
+            "6.7 or later with crosvm, and KSM tuning needs write access to "
+            "/sys/kernel/mm/ksm.");
+DEFINE_int32(ksm_boot_pages_to_scan, 2000,
+             "With --guest_memory_merge, the KSM pages_to_scan of the host "
+             "while any such instance boots.");
+DEFINE_int32(ksm_steady_pages_to_scan, 100,
+             "With --guest_memory_merge, the KSM pages_to_scan of the host "
+             "once all such instances booted.");
+DEFINE_string(snapshot_path, "",
+              "Resume the device from a snapshot taken with `cvd snapshot` "
+              "instead of booting it. The snapshot must come from an instance "
+              "with the same number and configuration.");
 DEFINE_bool(enable_vehicle_hal_grpc_server, true, "Enables the vehicle HAL "
             "emulation gRPC server on the host");
 DEFINE_string(bootloader, "", "Bootloader binary path");
@@ -279,6 +354,16 @@ DEFINE_int32(modem_simulator_sim_type, 1,
 DEFINE_bool(console, false, "Enable the serial console");
 
 DEFINE_bool(vhost_net, false, "Enable vhost acceleration of networking");
+DEFINE_bool(vhost_user_block, false,
+            "Serve each disk from a crosvm vhost-user block backend in its own "
+            "process, so disk I/O doesn't compete with the vCPU threads of "
+            "the VM process. crosvm on arm64 only.");
+DEFINE_bool(vhost_user_gpu, false,
+            "Serve the GPU from a crosvm vhost-user GPU backend in its own "
+            "process. crosvm on arm64 only.");
+DEFINE_string(vhost_user_cpus, "",
+              "Host cpus for the vhost-user backends, e.g. \"8-11\". By "
+              "default they run on the same cpus as the other host processes.");
 
 DEFINE_string(
     vhost_user_mac80211_hwsim, "",
@@ -297,8 +382,49 @@ DEFINE_string(ap_kernel_image,
 
 DEFINE_bool(record_screen, false, "Enable screen recording. "
                                   "Requires --start_webrtc");
+DEFINE_int32(record_screen_segment_seconds, 0,
+             "Split screen recordings into files of about this many seconds. "
+             "0 records into a single file.");
+DEFINE_int32(record_screen_last_seconds, 0,
+             "Only keep about the last this many seconds of the screen "
+             "recording in memory, and write them when the device stops. 0 "
+             "writes the whole recording.");
+DEFINE_bool(record_input, false,
+            "Record the input sent to the device from the streamer, to be "
+            "replayed with input_replay. Requires --start_webrtc");
+DEFINE_bool(record_frames, false,
+            "Record every frame of the displays, to be replayed by "
+            "webrtc_display_pipeline_benchmark. Slows the device down. "
+            "Requires --start_webrtc");
+DEFINE_int32(display_frame_keepalive_ms, 1000,
+             "Guest frames identical to the previous one are dropped before "
+             "encoding, except once every this many milliseconds. Set to 0 to "
+             "stream every frame.");
 
 DEFINE_bool(smt, false, "Enable simultaneous multithreading (SMT/HT)");
+DEFINE_bool(enable_memory_balloon, false,
+            "Reclaim idle guest memory when the host runs low on memory, "
+            "through the memory balloon and free page reporting. Only "
+            "supported with crosvm.");
+DEFINE_string(guest_hugepages, "none",
+              "Back guest memory with hugepages to cut TLB misses. \"thp\" "
+              "uses transparent hugepages, \"hugetlb\" reserved ones "
+              "(qemu only), \"none\" regular pages.");
+DEFINE_int32(disk_num_queues, 1,
+             "virtio-blk queues per disk, 0 for one per vCPU");
+DEFINE_int32(net_num_queues, 1,
+             "virtio-net queue pairs per interface, 0 for one per vCPU. "
+             "Only used with multiqueue taps, such as the ones from allocd");
+DEFINE_string(disk_io_backend, "threads",
+              "How the VMM submits disk I/O: \"threads\", \"io_uring\" or "
+              "\"native\" Linux AIO (qemu only, needs --disk_direct_io)");
+DEFINE_bool(disk_direct_io, false,
+            "Open the disk images with O_DIRECT, bypassing the host page "
+            "cache");
+DEFINE_bool(pin_vcpus, false,
+            "Place each instance on one host NUMA node. Pins the vCPUs to "
+            "cores of their own where crosvm allows it, and keeps the "
+            "instance's host processes and memory on that node.");
 
 DEFINE_int32(vsock_guest_cid,
              cuttlefish::GetDefaultVsockCid(),
@@ -327,13 +453,22 @@ DEFINE_bool(protected_vm, false, "Boot in Protected VM mode");
 DEFINE_bool(enable_audio, cuttlefish::HostArch() != cuttlefish::Arch::Arm64,
             "Whether to play or capture audio");
 
+DEFINE_bool(enable_screenshot_socket, false,
+            "Serve screenshots of the displays on a local socket in the "
+            "instance's internal directory, without a WebRTC client.");
+
 DEFINE_uint32(camera_server_port, 0, "camera vsock port");
+DEFINE_uint32(camera_count, 1,
+              "Cameras the guest exposes, streamed concurrently from the "
+              "client's video tracks. Camera N listens on "
+              "camera_server_port + N.");
 
 DEFINE_string(userdata_format, "f2fs", "The userdata filesystem format");
 
 DECLARE_string(assembly_dir);
 DECLARE_string(boot_image);
 DECLARE_string(system_image_dir);
+DECLARE_bool(pmem_super_image);
 
 namespace cuttlefish {
 using vm_manager::QemuManager;
@@ -415,6 +550,29 @@ std::optional<CuttlefishConfig::DisplayConfig> ParseDisplayConfig(
   };
 }
 
+std::map<std::string, std::map<std::string, std::string>> ParseCgroupSettings(
+    const std::string& flag) {
+  static const std::set<std::string> kAllowedFiles = {
+      "cpu.max", "cpu.weight", "io.weight", "memory.high", "memory.max",
+  };
+  std::map<std::string, std::map<std::string, std::string>> settings;
+  for (const auto& group : android::base::Split(flag, ";")) {
+    if (group.empty()) {
+      continue;
+    }
+    auto name_and_files = android::base::Split(group, ":");
+    CHECK_EQ(2, name_and_files.size()) << "Invalid cgroup settings: " << group;
+    for (const auto& file : android::base::Split(name_and_files[1], ",")) {
+      auto key_value = android::base::Split(file, "=");
+      CHECK_EQ(2, key_value.size()) << "Invalid cgroup setting: " << file;
+      CHECK(kAllowedFiles.count(key_value[0]) > 0)
+          << "Unsupported cgroup file \"" << key_value[0] << "\"";
+      settings[name_and_files[0]][key_value[0]] = key_value[1];
+    }
+  }
+  return settings;
+}
+
 #ifdef __ANDROID__
 Result<KernelConfig> ReadKernelConfig() {
   // QEMU isn't on Android, so always follow host arch
@@ -529,7 +687,7 @@ CuttlefishConfig InitializeCuttlefishConfiguration(
   tmp_config_obj.set_display_configs(display_configs);
 
   const GraphicsAvailability graphics_availability =
-    GetGraphicsAvailabilityWithSubprocessCheck();
+    GetCachedGraphicsAvailability();
 
   LOG(DEBUG) << graphics_availability;
 
@@ -570,6 +728,19 @@ CuttlefishConfig InitializeCuttlefishConfiguration(
   }
 
   tmp_config_obj.set_restart_subprocesses(FLAGS_restart_subprocesses);
+  tmp_config_obj.set_resource_accounting(FLAGS_resource_accounting);
+  tmp_config_obj.set_host_process_cgroups(
+      ParseCgroupSettings(FLAGS_host_process_cgroups));
+  CHECK(FLAGS_ksm_boot_pages_to_scan > 0 && FLAGS_ksm_steady_pages_to_scan > 0)
+      << "KSM pages_to_scan values must be positive";
+  tmp_config_obj.set_guest_memory_merge(FLAGS_guest_memory_merge);
+  tmp_config_obj.set_ksm_boot_pages_to_scan(FLAGS_ksm_boot_pages_to_scan);
+  tmp_config_obj.set_ksm_steady_pages_to_scan(FLAGS_ksm_steady_pages_to_scan);
+  if (!FLAGS_snapshot_path.empty()) {
+    CHECK(DirectoryExists(FLAGS_snapshot_path))
+        << "No snapshot found at \"" << FLAGS_snapshot_path << "\"";
+    tmp_config_obj.set_snapshot_path(AbsolutePath(FLAGS_snapshot_path));
+  }
   tmp_config_obj.set_gpu_capture_binary(FLAGS_gpu_capture_binary);
   if (!tmp_config_obj.gpu_capture_binary().empty()) {
     CHECK(tmp_config_obj.gpu_mode() == kGpuModeGfxStream)
@@ -616,6 +787,46 @@ CuttlefishConfig InitializeCuttlefishConfiguration(
       << "CPUs must be a multiple of 2 in SMT mode";
   tmp_config_obj.set_cpus(FLAGS_cpus);
   tmp_config_obj.set_smt(FLAGS_smt);
+  CHECK(!FLAGS_enable_memory_balloon ||
+        FLAGS_vm_manager == vm_manager::CrosvmManager::name())
+      << "The memory balloon needs vm_manager=crosvm";
+  tmp_config_obj.set_enable_memory_balloon(FLAGS_enable_memory_balloon);
+  CHECK(FLAGS_guest_hugepages == "none" || FLAGS_guest_hugepages == "thp" ||
+        FLAGS_guest_hugepages == "hugetlb")
+      << "Unknown --guest_hugepages=" << FLAGS_guest_hugepages;
+  CHECK(FLAGS_guest_hugepages != "hugetlb" ||
+        FLAGS_vm_manager == vm_manager::QemuManager::name())
+      << "Reserved hugepages need vm_manager=qemu_cli, crosvm only supports "
+      << "--guest_hugepages=thp";
+  tmp_config_obj.set_guest_hugepages(FLAGS_guest_hugepages);
+
+  CHECK(FLAGS_disk_num_queues >= 0) << "--disk_num_queues must not be negative";
+  tmp_config_obj.set_disk_num_queues(
+      FLAGS_disk_num_queues == 0 ? FLAGS_cpus : FLAGS_disk_num_queues);
+  CHECK(FLAGS_net_num_queues >= 0) << "--net_num_queues must not be negative";
+  // the guest driver doesn't use more queue pairs than it has vCPUs
+  tmp_config_obj.set_net_num_queues(
+      FLAGS_net_num_queues == 0 ? FLAGS_cpus
+                                : std::min(FLAGS_net_num_queues, FLAGS_cpus));
+  CHECK(FLAGS_disk_io_backend == "threads" ||
+        FLAGS_disk_io_backend == "io_uring" ||
+        FLAGS_disk_io_backend == "native")
+      << "Unknown --disk_io_backend=" << FLAGS_disk_io_backend;
+  CHECK(FLAGS_disk_io_backend != "native" ||
+        (FLAGS_vm_manager == vm_manager::QemuManager::name() &&
+         FLAGS_disk_direct_io))
+      << "--disk_io_backend=native needs vm_manager=qemu_cli and "
+      << "--disk_direct_io";
+  tmp_config_obj.set_disk_io_backend(FLAGS_disk_io_backend);
+  tmp_config_obj.set_disk_direct_io(FLAGS_disk_direct_io);
+  // The guest only names the partitions of PCI devices listed as boot
+  // devices, which covers the pmem device only with crosvm on arm64.
+  CHECK(!FLAGS_pmem_super_image ||
+        (FLAGS_vm_manager == vm_manager::CrosvmManager::name() &&
+         HostArch() == Arch::Arm64 && !FLAGS_protected_vm))
+      << "--pmem_super_image needs vm_manager=crosvm on an arm64 host and "
+      << "--protected_vm=false";
+  tmp_config_obj.set_pmem_super_image(FLAGS_pmem_super_image);
 
   tmp_config_obj.set_memory_mb(FLAGS_memory_mb);
 
@@ -643,8 +854,19 @@ CuttlefishConfig InitializeCuttlefishConfiguration(
   tmp_config_obj.set_deprecated_boot_completed(FLAGS_deprecated_boot_completed);
 
   tmp_config_obj.set_qemu_binary_dir(FLAGS_qemu_binary_dir);
+  CHECK(!FLAGS_qemu_performance_profile ||
+        FLAGS_vm_manager == QemuManager::name())
+      << "--qemu_performance_profile needs vm_manager=qemu_cli";
+  tmp_config_obj.set_qemu_performance_profile(FLAGS_qemu_performance_profile);
   tmp_config_obj.set_crosvm_binary(FLAGS_crosvm_binary);
   tmp_config_obj.set_gem5_binary_dir(FLAGS_gem5_binary_dir);
+  CHECK(FLAGS_gem5_checkpoint_dir.empty() ||
+        FLAGS_vm_manager == Gem5Manager::name())
+      << "--gem5_checkpoint_dir needs vm_manager=gem5";
+  tmp_config_obj.set_gem5_checkpoint_dir(
+      FLAGS_gem5_checkpoint_dir.empty()
+          ? ""
+          : AbsolutePath(FLAGS_gem5_checkpoint_dir));
 
   tmp_config_obj.set_seccomp_policy_dir(FLAGS_seccomp_policy_dir);
 
@@ -671,8 +893,21 @@ CuttlefishConfig InitializeCuttlefishConfiguration(
 
   tmp_config_obj.set_webrtc_enable_adb_websocket(
           FLAGS_webrtc_enable_adb_websocket);
+  tmp_config_obj.set_webrtc_video_codecs(FLAGS_webrtc_video_codecs);
+  tmp_config_obj.set_webrtc_share_encoders(FLAGS_webrtc_share_encoders);
+  tmp_config_obj.set_webrtc_screen_content(FLAGS_webrtc_screen_content);
+  CHECK(FLAGS_camera_count >= 1 && FLAGS_camera_count <= 4)
+      << "--camera_count must be between 1 and 4";
+  CHECK(FLAGS_webrtc_thumbnail_interval_ms >= 0)
+      << "--webrtc_thumbnail_interval_ms must not be negative";
+  tmp_config_obj.set_webrtc_thumbnail_interval_ms(
+      FLAGS_webrtc_thumbnail_interval_ms);
+  tmp_config_obj.set_webrtc_lazy_streaming(FLAGS_webrtc_lazy_streaming);
 
   tmp_config_obj.set_run_as_daemon(FLAGS_daemon);
+  tmp_config_obj.set_binary_subprocess_logs(FLAGS_binary_subprocess_logs);
+  tmp_config_obj.set_structured_logs(FLAGS_structured_logs);
+  tmp_config_obj.set_compress_tombstones(FLAGS_compress_tombstones);
 
   tmp_config_obj.set_data_policy(FLAGS_data_policy);
   tmp_config_obj.set_blank_data_image_mb(FLAGS_blank_data_image_mb);
@@ -698,6 +933,23 @@ CuttlefishConfig InitializeCuttlefishConfiguration(
 
   tmp_config_obj.set_vhost_net(FLAGS_vhost_net);
 
+  // The guest finds its disks and GPU by PCI slot on x86, where the slots of
+  // vhost-user devices aren't known in advance.
+  CHECK((!FLAGS_vhost_user_block && !FLAGS_vhost_user_gpu) ||
+        (FLAGS_vm_manager == vm_manager::CrosvmManager::name() &&
+         HostArch() == Arch::Arm64 && !FLAGS_protected_vm))
+      << "--vhost_user_block and --vhost_user_gpu need vm_manager=crosvm on "
+      << "an arm64 host and --protected_vm=false";
+  CHECK(!FLAGS_vhost_user_gpu || FLAGS_gpu_capture_binary.empty())
+      << "GPU capture is not supported with --vhost_user_gpu";
+  if (!FLAGS_vhost_user_cpus.empty()) {
+    auto cpus = vm_manager::ParseCpuList(FLAGS_vhost_user_cpus);
+    CHECK(cpus.ok()) << "Invalid --vhost_user_cpus: " << cpus.error();
+  }
+  tmp_config_obj.set_vhost_user_block(FLAGS_vhost_user_block);
+  tmp_config_obj.set_vhost_user_gpu(FLAGS_vhost_user_gpu);
+  tmp_config_obj.set_vhost_user_cpus(FLAGS_vhost_user_cpus);
+
   tmp_config_obj.set_vhost_user_mac80211_hwsim(FLAGS_vhost_user_mac80211_hwsim);
 
   if ((FLAGS_ap_rootfs_image.empty()) != (FLAGS_ap_kernel_image.empty())) {
@@ -719,6 +971,20 @@ CuttlefishConfig InitializeCuttlefishConfiguration(
       FLAGS_bluetooth_default_commands_file);
 
   tmp_config_obj.set_record_screen(FLAGS_record_screen);
+  CHECK(FLAGS_record_screen_segment_seconds >= 0)
+      << "--record_screen_segment_seconds must not be negative";
+  tmp_config_obj.set_record_screen_segment_seconds(
+      FLAGS_record_screen_segment_seconds);
+  CHECK(FLAGS_record_screen_last_seconds >= 0)
+      << "--record_screen_last_seconds must not be negative";
+  tmp_config_obj.set_record_screen_last_seconds(
+      FLAGS_record_screen_last_seconds);
+  tmp_config_obj.set_record_input(FLAGS_record_input);
+  tmp_config_obj.set_record_frames(FLAGS_record_frames);
+  CHECK(FLAGS_display_frame_keepalive_ms >= 0)
+      << "--display_frame_keepalive_ms must not be negative";
+  tmp_config_obj.set_display_frame_keepalive_ms(
+      FLAGS_display_frame_keepalive_ms);
 
   tmp_config_obj.set_enable_host_bluetooth(FLAGS_enable_host_bluetooth);
 
@@ -732,6 +998,21 @@ CuttlefishConfig InitializeCuttlefishConfiguration(
   }
   std::vector<std::string> gnss_file_paths = android::base::Split(FLAGS_gnss_file_path, ",");
 
+  std::vector<vm_manager::NumaNode> numa_nodes;
+  if (FLAGS_pin_vcpus) {
+    auto topology = vm_manager::HostNumaTopology();
+    CHECK(topology.ok()) << "Could not read the host topology: "
+                         << topology.error();
+    numa_nodes = std::move(*topology);
+    // Instance numbers are global, so other groups on the host get other cores
+    if (!vm_manager::PlacementFits(numa_nodes, num_instances.back(),
+                                   FLAGS_cpus)) {
+      LOG(WARNING) << "Not enough host cores for " << num_instances.back()
+                   << " instances of " << FLAGS_cpus << " vCPUs, some "
+                   << "instances will share cores";
+    }
+  }
+
   bool is_first_instance = true;
   for (const auto& num : num_instances) {
     IfaceConfig iface_config;
@@ -797,6 +1078,18 @@ CuttlefishConfig InitializeCuttlefishConfiguration(
     }
 
     instance.set_camera_server_port(FLAGS_camera_server_port);
+    instance.set_camera_count(FLAGS_camera_count);
+
+    if (FLAGS_pin_vcpus) {
+      auto placement =
+          vm_manager::PlaceInstance(numa_nodes, num - 1, FLAGS_cpus);
+      CHECK(placement.ok()) << placement.error();
+      instance.set_numa_node(placement->numa_node);
+      instance.set_cpu_affinity(vm_manager::FormatVcpuAffinity(placement->cpus));
+    } else {
+      instance.set_numa_node(-1);
+      instance.set_cpu_affinity("");
+    }
 
     if (FLAGS_protected_vm) {
       instance.set_virtual_disk_paths(
@@ -908,6 +1201,7 @@ CuttlefishConfig InitializeCuttlefishConfiguration(
       (cuttlefish::HostArch() == cuttlefish::Arch::Arm64) ? "false" : "true",
       SET_FLAGS_DEFAULT);
   tmp_config_obj.set_enable_audio(FLAGS_enable_audio);
+  tmp_config_obj.set_enable_screenshot_socket(FLAGS_enable_screenshot_socket);
 
   return tmp_config_obj;
 }
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/assemble_cvd/image_digest.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+#include <openssl/sha.h>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+std::string ToHex(const uint8_t (&digest)[SHA256_DIGEST_LENGTH]) {
+  std::string hex;
+  for (auto byte : digest) {
+    hex += android::base::StringPrintf("%02x", byte);
+  }
+  return hex;
+}
+
+}  // namespace
+
+Result<std::string> FileDigest(const std::string& path) {
+  auto fd = SharedFD::Open(path, O_RDONLY);
+  CF_EXPECT(fd->IsOpen(),
+            "Failed to open \"" << path << "\": " << fd->StrError());
+  SHA256_CTX sha;
+  SHA256_Init(&sha);
+  std::vector<char> buffer(1 << 20);
+  for (;;) {
+    auto read = fd->Read(buffer.data(), buffer.size());
+    CF_EXPECT(read >= 0,
+              "Failed to read \"" << path << "\": " << fd->StrError());
+    if (read == 0) {
+      break;
+    }
+    SHA256_Update(&sha, buffer.data(), read);
+  }
+  uint8_t digest[SHA256_DIGEST_LENGTH];
+  SHA256_Final(digest, &sha);
+  return ToHex(digest);
+}
+
+std::string StringDigest(const std::string& data) {
+  uint8_t digest[SHA256_DIGEST_LENGTH];
+  SHA256(reinterpret_cast<const uint8_t*>(data.data()), data.size(), digest);
+  return ToHex(digest);
+}
+
+Result<std::string> FileIdentity(const std::string& path) {
+  struct stat st;
+  CF_EXPECT(stat(path.c_str(), &st) == 0,
+            "Failed to stat \"" << path << "\": " << strerror(errno));
+  return android::base::StringPrintf(
+      "%llu %llu %lld %lld.%09ld", static_cast<unsigned long long>(st.st_dev),
+      static_cast<unsigned long long>(st.st_ino),
+      static_cast<long long>(st.st_size),
+      static_cast<long long>(st.st_mtim.tv_sec), st.st_mtim.tv_nsec);
+}
+
+FileDigestCache::FileDigestCache(std::string cache_path)
+    : cache_path_(std::move(cache_path)) {
+  // Lines of "<identity>\t<digest>"
+  for (const auto& line : android::base::Split(ReadFile(cache_path_), "\n")) {
+    auto fields = android::base::Split(line, "\t");
+    if (fields.size() == 2) {
+      loaded_[fields[0]] = fields[1];
+    }
+  }
+}
+
+Result<std::string> FileDigestCache::Digest(const std::string& path) {
+  auto identity = CF_EXPECT(FileIdentity(path));
+  for (auto entries : {&used_, &loaded_}) {
+    auto it = entries->find(identity);
+    if (it != entries->end()) {
+      return used_[identity] = it->second;
+    }
+  }
+  auto digest = CF_EXPECT(FileDigest(path));
+  // The contents read may not match either identity otherwise
+  CF_EXPECT(CF_EXPECT(FileIdentity(path)) == identity,
+            "\"" << path << "\" changed while computing its digest");
+  return used_[identity] = digest;
+}
+
+Result<void> FileDigestCache::Save() {
+  std::stringstream cache;
+  for (const auto& [identity, digest] : used_) {
+    cache << identity << "\t" << digest << "\n";
+  }
+  CF_EXPECT(android::base::WriteStringToFile(cache.str(), cache_path_),
+            "Failed to write \"" << cache_path_ << "\"");
+  return {};
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <map>
+#include <string>
+
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+// Hex encoded SHA-256 of the whole contents of the file
+Result<std::string> FileDigest(const std::string& path);
+std::string StringDigest(const std::string& data);
+// Device, inode, size and modification time of the file, which change
+// whenever it's replaced or written to.
+Result<std::string> FileIdentity(const std::string& path);
+
+// Remembers file digests across launches, keyed by the file's inode, size and
+// modification time, so unchanged images are not read again.
+class FileDigestCache {
+ public:
+  // Loads the entries saved in `cache_path`, if any.
+  FileDigestCache(std::string cache_path);
+
+  Result<std::string> Digest(const std::string& path);
+  // Only keeps the entries looked up since loading.
+  Result<void> Save();
+
+ private:
+  std::string cache_path_;
+  std::map<std::string, std::string> loaded_;
+  std::map<std::string, std::string> used_;
+};
+
+}  // namespace cuttlefish
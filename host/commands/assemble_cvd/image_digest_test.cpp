@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/assemble_cvd/image_digest.h"
+
+#include <string>
+
+#include <android-base/file.h>
+#include <android-base/strings.h>
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+namespace {
+
+constexpr char kAbcDigest[] =
+    "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+
+class FileDigestCacheTest : public ::testing::Test {
+ protected:
+  std::string Path(const std::string& name) const {
+    return std::string(dir_.path) + "/" + name;
+  }
+
+  TemporaryDir dir_;
+};
+
+TEST_F(FileDigestCacheTest, DigestsContents) {
+  ASSERT_TRUE(android::base::WriteStringToFile("abc", Path("image")));
+  auto digest = FileDigest(Path("image"));
+  ASSERT_TRUE(digest.ok()) << digest.error();
+  EXPECT_EQ(*digest, kAbcDigest);
+  EXPECT_EQ(StringDigest("abc"), kAbcDigest);
+}
+
+TEST_F(FileDigestCacheTest, FailsForMissingFiles) {
+  FileDigestCache cache(Path("cache"));
+  EXPECT_FALSE(cache.Digest(Path("missing")).ok());
+}
+
+TEST_F(FileDigestCacheTest, ReusesSavedDigestsOfUnchangedFiles) {
+  ASSERT_TRUE(android::base::WriteStringToFile("abc", Path("image")));
+  {
+    FileDigestCache cache(Path("cache"));
+    auto digest = cache.Digest(Path("image"));
+    ASSERT_TRUE(digest.ok()) << digest.error();
+    ASSERT_TRUE(cache.Save().ok());
+  }
+  // A digest that could only come from the cache
+  std::string saved;
+  ASSERT_TRUE(android::base::ReadFileToString(Path("cache"), &saved));
+  saved = android::base::StringReplace(saved, kAbcDigest, "cached", false);
+  ASSERT_TRUE(android::base::WriteStringToFile(saved, Path("cache")));
+
+  FileDigestCache cache(Path("cache"));
+  auto digest = cache.Digest(Path("image"));
+  ASSERT_TRUE(digest.ok()) << digest.error();
+  EXPECT_EQ(*digest, "cached");
+}
+
+TEST_F(FileDigestCacheTest, RecomputesDigestsOfReplacedFiles) {
+  ASSERT_TRUE(android::base::WriteStringToFile("old", Path("image")));
+  FileDigestCache cache(Path("cache"));
+  ASSERT_TRUE(cache.Digest(Path("image")).ok());
+  ASSERT_TRUE(cache.Save().ok());
+
+  // A new inode, even with the same size and modification time
+  ASSERT_TRUE(android::base::WriteStringToFile("abc", Path("new_image")));
+  ASSERT_EQ(rename(Path("new_image").c_str(), Path("image").c_str()), 0);
+
+  FileDigestCache reloaded(Path("cache"));
+  auto digest = reloaded.Digest(Path("image"));
+  ASSERT_TRUE(digest.ok()) << digest.error();
+  EXPECT_EQ(*digest, kAbcDigest);
+}
+
+TEST_F(FileDigestCacheTest, SavesOnlyTheDigestsUsed) {
+  ASSERT_TRUE(android::base::WriteStringToFile("a", Path("first")));
+  ASSERT_TRUE(android::base::WriteStringToFile("b", Path("second")));
+  {
+    FileDigestCache cache(Path("cache"));
+    ASSERT_TRUE(cache.Digest(Path("first")).ok());
+    ASSERT_TRUE(cache.Digest(Path("second")).ok());
+    ASSERT_TRUE(cache.Save().ok());
+  }
+  {
+    FileDigestCache cache(Path("cache"));
+    ASSERT_TRUE(cache.Digest(Path("second")).ok());
+    ASSERT_TRUE(cache.Save().ok());
+  }
+  std::string saved;
+  ASSERT_TRUE(android::base::ReadFileToString(Path("cache"), &saved));
+  EXPECT_EQ(android::base::Split(saved, "\n").size(), 2) << saved;
+  EXPECT_EQ(saved.find(StringDigest("a")), std::string::npos);
+  EXPECT_NE(saved.find(StringDigest("b")), std::string::npos);
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/assemble_cvd/image_store.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/files.h"
+#include "host/commands/assemble_cvd/image_digest.h"
+
+namespace cuttlefish {
+namespace {
+
+// Entries are several gigabytes each, only the latest are kept.
+constexpr size_t kMaxStoreEntries = 4;
+constexpr char kEntrySuffix[] = ".img";
+// Touched on every use, the entries' own modification times are compared to
+// the instances' overlays and must only change when they are rebuilt.
+constexpr char kUsedSuffix[] = ".img.used";
+// Holds a link to every instance file that was pointed to the entry.
+constexpr char kRefsSuffix[] = ".img.refs";
+constexpr char kLockFile[] = "lock";
+
+}  // namespace
+
+ImageStore::ImageStore(std::string directory)
+    : directory_(std::move(directory)) {}
+
+Result<void> ImageStore::Link(
+    const std::string& key, const std::string& link,
+    std::function<Result<void>(const std::string& path)> build) {
+  CF_EXPECT(EnsureDirectoryExists(directory_));
+  // Held until the entry is linked to, so other launches can't evict it in
+  // between and don't build the same entry at the same time.
+  auto lock_path = directory_ + "/" + kLockFile;
+  auto lock = SharedFD::Open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  CF_EXPECT(lock->IsOpen(),
+            "Failed to open \"" << lock_path << "\": " << lock->StrError());
+  CF_EXPECT(lock->Flock(LOCK_EX) == 0,
+            "Failed to lock \"" << lock_path << "\": " << lock->StrError());
+
+  auto entry = directory_ + "/" + key + kEntrySuffix;
+  if (FileExists(entry)) {
+    LOG(DEBUG) << "Reusing " << entry;
+  } else {
+    // Left behind if a launch was killed while building
+    auto building = entry + ".tmp";
+    RemoveFile(building);
+    auto result = build(building);
+    if (!result.ok()) {
+      RemoveFile(building);
+    }
+    CF_EXPECT(std::move(result));
+    // Instances only write to their overlays
+    CF_EXPECT(chmod(building.c_str(), 0444) == 0,
+              "Failed to chmod \"" << building << "\": " << strerror(errno));
+    CF_EXPECT(RenameFile(building, entry),
+              "Failed to move \"" << building << "\" to \"" << entry << "\"");
+  }
+
+  auto used = entry + kUsedSuffix;
+  auto used_fd = SharedFD::Open(used, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+  CF_EXPECT(used_fd->IsOpen(),
+            "Failed to open \"" << used << "\": " << used_fd->StrError());
+  CF_EXPECT(utimensat(AT_FDCWD, used.c_str(), nullptr, 0) == 0,
+            "Failed to touch \"" << used << "\": " << strerror(errno));
+
+  RemoveFile(link);
+  CF_EXPECT(symlink(entry.c_str(), link.c_str()) == 0,
+            "Failed to link \"" << link << "\" to \"" << entry
+                                 << "\": " << strerror(errno));
+  auto refs = entry + kRefsSuffix;
+  CF_EXPECT(EnsureDirectoryExists(refs));
+  auto absolute_link = AbsolutePath(link);
+  auto ref = refs + "/" + StringDigest(absolute_link);
+  RemoveFile(ref);
+  CF_EXPECT(symlink(absolute_link.c_str(), ref.c_str()) == 0,
+            "Failed to link \"" << ref << "\" to \"" << absolute_link
+                                 << "\": " << strerror(errno));
+
+  Evict();
+  return {};
+}
+
+// Drops the references whose link was removed or pointed elsewhere since.
+bool ImageStore::InUse(const std::string& entry) {
+  auto refs = entry + kRefsSuffix;
+  if (!DirectoryExists(refs, /* follow_symlinks */ false)) {
+    return false;
+  }
+  bool in_use = false;
+  for (const auto& name : DirectoryContents(refs)) {
+    if (name == "." || name == "..") {
+      continue;
+    }
+    auto ref = refs + "/" + name;
+    std::string link;
+    std::string target;
+    if (android::base::Readlink(ref, &link) &&
+        android::base::Readlink(link, &target) && target == entry) {
+      in_use = true;
+    } else {
+      RemoveFile(ref);
+    }
+  }
+  return in_use;
+}
+
+void ImageStore::Evict() {
+  std::vector<std::pair<std::chrono::system_clock::time_point, std::string>>
+      entries;
+  for (const auto& name : DirectoryContents(directory_)) {
+    if (android::base::EndsWith(name, kEntrySuffix)) {
+      auto path = directory_ + "/" + name;
+      entries.emplace_back(FileModificationTime(path + kUsedSuffix), path);
+    }
+  }
+  if (entries.size() <= kMaxStoreEntries) {
+    return;
+  }
+  std::sort(entries.begin(), entries.end());
+  auto excess = entries.size() - kMaxStoreEntries;
+  for (const auto& [used, path] : entries) {
+    if (excess == 0) {
+      break;
+    }
+    if (InUse(path)) {
+      continue;
+    }
+    LOG(DEBUG) << "Evicting " << path;
+    RemoveFile(path);
+    RemoveFile(path + kUsedSuffix);
+    RecursivelyRemoveDirectory(path + kRefsSuffix);
+    excess--;
+  }
+}
+
+Result<std::string> ImageStoreKey(
+    const std::vector<ImagePartition>& partitions, FileDigestCache& digests) {
+  std::stringstream layout;
+  for (const auto& partition : partitions) {
+    layout << partition.label << " " << partition.type << " "
+           << partition.read_only << " "
+           << CF_EXPECT(digests.Digest(partition.image_file_path)) << "\n";
+  }
+  return StringDigest(layout.str());
+}
+
+}  // namespace cuttlefish
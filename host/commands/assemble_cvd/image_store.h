@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "common/libs/utils/result.h"
+#include "host/commands/assemble_cvd/image_digest.h"
+#include "host/libs/image_aggregator/image_aggregator.h"
+
+namespace cuttlefish {
+
+// Host wide store of aggregated disk images, shared read-only by every launch
+// using the same partitions. Entries are named after a digest of the
+// partitions' contents, instances write to their own qcow2 overlays on top.
+// Each entry keeps a reference to the links pointing to it and is only evicted
+// once none of them does anymore.
+class ImageStore {
+ public:
+  ImageStore(std::string directory);
+
+  // Points `link` to the entry with this key, calling `build` to write it
+  // first if it isn't in the store yet.
+  Result<void> Link(const std::string& key, const std::string& link,
+                    std::function<Result<void>(const std::string& path)> build);
+
+ private:
+  bool InUse(const std::string& entry);
+  void Evict();
+
+  std::string directory_;
+};
+
+// Covers the partitions' layout as well as their contents
+Result<std::string> ImageStoreKey(const std::vector<ImagePartition>& partitions,
+                                  FileDigestCache& digests);
+
+}  // namespace cuttlefish
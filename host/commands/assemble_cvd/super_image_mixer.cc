@@ -23,6 +23,7 @@
 #include <functional>
 #include <memory>
 
+#include <android-base/file.h>
 #include <android-base/strings.h>
 #include <android-base/logging.h>
 
@@ -30,6 +31,7 @@
 #include "common/libs/utils/archive.h"
 #include "common/libs/utils/files.h"
 #include "common/libs/utils/subprocess.h"
+#include "host/commands/assemble_cvd/image_digest.h"
 #include "host/commands/assemble_cvd/misc_info.h"
 #include "host/libs/config/cuttlefish_config.h"
 #include "host/libs/config/fetcher_config.h"
@@ -78,9 +80,13 @@ void FindImports(Archive* archive, const std::string& build_prop_file) {
   }
 }
 
+// Only extracts the images of the builds with `extract_default` or
+// `extract_system` set, the others are expected to be in `output_path` from an
+// earlier call with the same zip.
 bool CombineTargetZipFiles(const std::string& default_target_zip,
                            const std::string& system_target_zip,
-                           const std::string& output_path) {
+                           const std::string& output_path, bool extract_default,
+                           bool extract_system) {
   Archive default_target_archive(default_target_zip);
   Archive system_target_archive(system_target_zip);
 
@@ -94,12 +100,14 @@ bool CombineTargetZipFiles(const std::string& default_target_zip,
     LOG(ERROR) << "Could not open " << system_target_zip;
     return false;
   }
-  if (mkdir(output_path.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) < 0) {
+  if (mkdir(output_path.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) < 0 &&
+      errno != EEXIST) {
     LOG(ERROR) << "Could not create directory " << output_path;
     return false;
   }
   std::string output_meta = output_path + "/META";
-  if (mkdir(output_meta.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) < 0) {
+  if (mkdir(output_meta.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) < 0 &&
+      errno != EEXIST) {
     LOG(ERROR) << "Could not create directory " << output_meta;
     return false;
   }
@@ -155,6 +163,8 @@ bool CombineTargetZipFiles(const std::string& default_target_zip,
     return false;
   }
 
+  // Each archive is extracted in a single call, which works in parallel
+  std::vector<std::string> default_target_files;
   for (const auto& name : default_target_contents) {
     if (!android::base::StartsWith(name, "IMAGES/")) {
       continue;
@@ -164,10 +174,7 @@ bool CombineTargetZipFiles(const std::string& default_target_zip,
       continue;
     }
     LOG(INFO) << "Writing " << name;
-    if (!default_target_archive.ExtractFiles({name}, output_path)) {
-      LOG(ERROR) << "Failed to extract " << name << " from the default target zip";
-      return false;
-    }
+    default_target_files.push_back(name);
   }
   for (const auto& name : default_target_contents) {
     if (!android::base::EndsWith(name, "build.prop")) {
@@ -177,12 +184,16 @@ bool CombineTargetZipFiles(const std::string& default_target_zip,
     }
     FindImports(&default_target_archive, name);
     LOG(INFO) << "Writing " << name;
-    if (!default_target_archive.ExtractFiles({name}, output_path)) {
-      LOG(ERROR) << "Failed to extract " << name << " from the default target zip";
-      return false;
-    }
+    default_target_files.push_back(name);
+  }
+  // An empty list would extract everything
+  if (extract_default && !default_target_files.empty() &&
+      !default_target_archive.ExtractFiles(default_target_files, output_path)) {
+    LOG(ERROR) << "Failed to extract files from the default target zip";
+    return false;
   }
 
+  std::vector<std::string> system_target_files;
   for (const auto& name : system_target_contents) {
     if (!android::base::StartsWith(name, "IMAGES/")) {
       continue;
@@ -192,10 +203,7 @@ bool CombineTargetZipFiles(const std::string& default_target_zip,
       continue;
     }
     LOG(INFO) << "Writing " << name;
-    if (!system_target_archive.ExtractFiles({name}, output_path)) {
-      LOG(ERROR) << "Failed to extract " << name << " from the system target zip";
-      return false;
-    }
+    system_target_files.push_back(name);
   }
   for (const auto& name : system_target_contents) {
     if (!android::base::EndsWith(name, "build.prop")) {
@@ -205,10 +213,13 @@ bool CombineTargetZipFiles(const std::string& default_target_zip,
     }
     FindImports(&system_target_archive, name);
     LOG(INFO) << "Writing " << name;
-    if (!system_target_archive.ExtractFiles({name}, output_path)) {
-      LOG(ERROR) << "Failed to extract " << name << " from the default target zip";
-      return false;
-    }
+    system_target_files.push_back(name);
+  }
+  // An empty list would extract everything
+  if (extract_system && !system_target_files.empty() &&
+      !system_target_archive.ExtractFiles(system_target_files, output_path)) {
+    LOG(ERROR) << "Failed to extract files from the system target zip";
+    return false;
   }
 
   return true;
@@ -238,6 +249,35 @@ bool BuildSuperImage(const std::string& combined_target_zip,
   }) == 0;
 }
 
+// Runs fetch_cvd for the files among `paths` that it deferred with
+// --lazy_fetch and that aren't downloaded yet.
+Result<void> FetchDeferredFiles(const FetcherConfig& fetcher_config,
+                                const std::vector<std::string>& paths) {
+  auto cvd_files = fetcher_config.get_cvd_files();
+  std::vector<std::string> missing;
+  for (const auto& path : paths) {
+    auto it = cvd_files.find(path);
+    if (it != cvd_files.end() && !it->second.deferred_artifact.empty() &&
+        !FileExists(path)) {
+      missing.push_back(path);
+    }
+  }
+  if (missing.empty()) {
+    return {};
+  }
+  auto fetcher = fetcher_config.fetcher_binary();
+  auto missing_list = android::base::Join(missing, ",");
+  CF_EXPECT(fetcher != "", "No fetch_cvd recorded to download " << missing_list);
+  LOG(INFO) << "Downloading deferred " << missing_list;
+  int result = execute({
+    fetcher,
+    "--directory=" + CurrentDirectory(),
+    "--fetch_deferred=" + missing_list,
+  });
+  CF_EXPECT(result == 0, "Failed to download " << missing_list);
+  return {};
+}
+
 bool SuperImageNeedsRebuilding(const FetcherConfig& fetcher_config) {
   bool has_default_build = false;
   bool has_system_build = false;
@@ -251,35 +291,78 @@ bool SuperImageNeedsRebuilding(const FetcherConfig& fetcher_config) {
   return has_default_build && has_system_build;
 }
 
-bool RebuildSuperImage(const FetcherConfig& fetcher_config,
-                       const CuttlefishConfig& config,
-                       const std::string& output_path) {
+Result<void> RebuildSuperImage(const FetcherConfig& fetcher_config,
+                               const CuttlefishConfig& config,
+                               const std::string& output_path) {
   std::string default_target_zip =
       TargetFilesZip(fetcher_config, FileSource::DEFAULT_BUILD);
-  if (default_target_zip == "") {
-    LOG(ERROR) << "Unable to find default target zip file.";
-    return false;
-  }
+  CF_EXPECT(default_target_zip != "",
+            "Unable to find default target zip file.");
   std::string system_target_zip =
       TargetFilesZip(fetcher_config, FileSource::SYSTEM_BUILD);
-  if (system_target_zip == "") {
-    LOG(ERROR) << "Unable to find system target zip file.";
-    return false;
-  }
+  CF_EXPECT(system_target_zip != "", "Unable to find system target zip file.");
   auto instance = config.ForDefaultInstance();
   // TODO(schuffelen): Use cuttlefish_assembly
   std::string combined_target_path = instance.PerInstanceInternalPath("target_combined");
-  // TODO(schuffelen): Use otatools/bin/merge_target_files
-  if (!CombineTargetZipFiles(default_target_zip, system_target_zip,
-                             combined_target_path)) {
-    LOG(ERROR) << "Could not combine target zip files.";
-    return false;
+  CF_EXPECT(EnsureDirectoryExists(combined_target_path));
+
+  // The directory keeps the digests of the zips its images were extracted
+  // from, and the identity of the super image last built from it.
+  FileDigestCache digests(combined_target_path + "/.digest_cache");
+  auto stamp_path = [&combined_target_path](const std::string& name) {
+    return combined_target_path + "/." + name;
+  };
+  auto cvd_files = fetcher_config.get_cvd_files();
+  auto target_digest = [&](const std::string& zip) -> Result<std::string> {
+    const auto& file = cvd_files[zip];
+    if (!file.deferred_artifact.empty()) {
+      // May not be downloaded yet, a build's artifacts don't change
+      return StringDigest(file.build_id + "/" + file.build_target + "/" +
+                          file.deferred_artifact);
+    }
+    return CF_EXPECT(digests.Digest(zip));
+  };
+  auto default_digest = CF_EXPECT(target_digest(default_target_zip));
+  auto system_digest = CF_EXPECT(target_digest(system_target_zip));
+  CF_EXPECT(digests.Save());
+  bool default_changed =
+      ReadFile(stamp_path("default_target_digest")) != default_digest;
+  bool system_changed =
+      ReadFile(stamp_path("system_target_digest")) != system_digest;
+  if (!default_changed && !system_changed && FileExists(output_path) &&
+      ReadFile(stamp_path("super_image_identity")) ==
+          CF_EXPECT(FileIdentity(output_path))) {
+    LOG(INFO) << "Target files unchanged, reusing " << output_path;
+    return {};
+  }
+  // An interrupted rebuild leaves no stamps to trust
+  for (const auto& name : {"default_target_digest", "system_target_digest",
+                           "super_image_identity"}) {
+    RemoveFile(stamp_path(name));
   }
-  bool success = BuildSuperImage(combined_target_path, output_path);
-  if (!success) {
-    LOG(ERROR) << "Could not write the final output super image.";
+
+  std::vector<std::string> needed = {default_target_zip, system_target_zip};
+  auto otatools_zip = fetcher_config.FindCvdFileWithSuffix("otatools.zip");
+  if (otatools_zip != "") {
+    needed.push_back(otatools_zip);
   }
-  return success;
+  CF_EXPECT(FetchDeferredFiles(fetcher_config, needed));
+
+  // TODO(schuffelen): Use otatools/bin/merge_target_files
+  CF_EXPECT(CombineTargetZipFiles(default_target_zip, system_target_zip,
+                                  combined_target_path, default_changed,
+                                  system_changed),
+            "Could not combine target zip files.");
+  using android::base::WriteStringToFile;
+  CF_EXPECT(WriteStringToFile(default_digest,
+                              stamp_path("default_target_digest")));
+  CF_EXPECT(WriteStringToFile(system_digest,
+                              stamp_path("system_target_digest")));
+  CF_EXPECT(BuildSuperImage(combined_target_path, output_path),
+            "Could not write the final output super image.");
+  CF_EXPECT(WriteStringToFile(CF_EXPECT(FileIdentity(output_path)),
+                              stamp_path("super_image_identity")));
+  return {};
 }
 
 class SuperImageOutputPathTag {};
@@ -299,16 +382,12 @@ class SuperImageRebuilderImpl : public SuperImageRebuilder {
 
  private:
   std::unordered_set<SetupFeature*> Dependencies() const override { return {}; }
-  bool Setup() override {
+  Result<void> ResultSetup() override {
     if (SuperImageNeedsRebuilding(fetcher_config_)) {
-      bool success = RebuildSuperImage(fetcher_config_, config_, output_path_);
-      if (!success) {
-        LOG(ERROR)
-            << "Super image rebuilding requested but could not be completed.";
-        return false;
-      }
+      CF_EXPECT(RebuildSuperImage(fetcher_config_, config_, output_path_),
+                "Super image rebuilding requested but could not be completed.");
     }
-    return true;
+    return {};
   }
 
   const FetcherConfig& fetcher_config_;
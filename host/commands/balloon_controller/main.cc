@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+#include <gflags/gflags.h>
+#include <json/json.h>
+
+#include "common/libs/utils/files.h"
+#include "common/libs/utils/result.h"
+#include "host/libs/config/cuttlefish_config.h"
+#include "host/libs/config/logging.h"
+#include "host/libs/vm_manager/vm_manager.h"
+
+DEFINE_int32(interval_seconds, 5, "How often to check host and guest memory");
+DEFINE_int32(host_pressure_percent, 10,
+             "Reclaim guest memory while less than this percentage of host "
+             "memory is available. Give memory back above twice as much.");
+DEFINE_int32(guest_reserve_mb, 512,
+             "Memory to leave available to the guest when reclaiming");
+DEFINE_int32(max_balloon_percent, 75,
+             "The most of the guest memory the balloon may take");
+
+namespace cuttlefish {
+namespace {
+
+constexpr std::uint64_t kMiB = 1024 * 1024;
+// Smallest balloon size change worth asking the guest for
+constexpr std::uint64_t kMinStep = 64 * kMiB;
+
+struct HostMemory {
+  std::uint64_t total_bytes = 0;
+  std::uint64_t available_bytes = 0;
+};
+
+Result<HostMemory> ReadHostMemory() {
+  std::ifstream meminfo("/proc/meminfo");
+  CF_EXPECT(meminfo.is_open(), "Could not open /proc/meminfo");
+  HostMemory memory;
+  std::string line;
+  while (std::getline(meminfo, line)) {
+    // Lines look like "MemAvailable:   12345678 kB"
+    auto fields = android::base::Tokenize(line, " ");
+    std::uint64_t kb = 0;
+    if (fields.size() < 2 || !android::base::ParseUint(fields[1], &kb)) {
+      continue;
+    }
+    if (fields[0] == "MemTotal:") {
+      memory.total_bytes = kb * 1024;
+    } else if (fields[0] == "MemAvailable:") {
+      memory.available_bytes = kb * 1024;
+    }
+  }
+  CF_EXPECT(memory.total_bytes > 0, "No MemTotal in /proc/meminfo");
+  return memory;
+}
+
+// Inflates the balloon over the guest's spare memory while the host is short,
+// and deflates it in steps once the host has memory to spare again.
+std::uint64_t BalloonTarget(const CuttlefishConfig& config,
+                            const HostMemory& host,
+                            const vm_manager::BalloonStats& guest) {
+  auto low = host.total_bytes * FLAGS_host_pressure_percent / 100;
+  auto max_balloon =
+      config.memory_mb() * kMiB * FLAGS_max_balloon_percent / 100;
+  auto reserve = FLAGS_guest_reserve_mb * kMiB;
+  auto balloon = guest.balloon_bytes;
+  if (host.available_bytes < low) {
+    if (guest.available_bytes <= reserve) {
+      return balloon;
+    }
+    // Half of the spare memory at a time, the guest reacts to the loss
+    auto spare = guest.available_bytes - reserve;
+    return std::min(max_balloon, balloon + spare / 2);
+  }
+  if (host.available_bytes > 2 * low) {
+    return balloon - std::min(balloon, std::max(kMinStep, balloon / 4));
+  }
+  return balloon;
+}
+
+Result<void> WriteStatus(const std::string& path, const HostMemory& host,
+                         const vm_manager::BalloonStats& guest,
+                         std::uint64_t target) {
+  Json::Value status;
+  status["balloon_target_mb"] = Json::UInt64(target / kMiB);
+  status["balloon_mb"] = Json::UInt64(guest.balloon_bytes / kMiB);
+  status["guest_available_mb"] = Json::UInt64(guest.available_bytes / kMiB);
+  status["host_available_mb"] = Json::UInt64(host.available_bytes / kMiB);
+  // Readers never see a partial file
+  auto temp = path + ".tmp";
+  {
+    std::ofstream out(temp);
+    out << status;
+    CF_EXPECT(out.good(), "Could not write \"" << temp << "\"");
+  }
+  CF_EXPECT(rename(temp.c_str(), path.c_str()) == 0,
+            "Could not rename \"" << temp << "\": " << strerror(errno));
+  return {};
+}
+
+Result<void> BalloonControllerMain(int argc, char** argv) {
+  DefaultSubprocessLogging(argv);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  auto config = CF_EXPECT(CuttlefishConfig::Get());
+  auto instance = config->ForDefaultInstance();
+  auto vmm = vm_manager::GetVmManager(config->vm_manager(),
+                                      config->target_arch());
+  CF_EXPECT(vmm != nullptr, "Invalid VM manager: " << config->vm_manager());
+
+  std::uint64_t last_target = 0;
+  while (true) {
+    std::this_thread::sleep_for(std::chrono::seconds(FLAGS_interval_seconds));
+    auto host = ReadHostMemory();
+    if (!host.ok()) {
+      LOG(ERROR) << host.error();
+      continue;
+    }
+    // Fails until the guest driver is up
+    auto guest = vmm->GetBalloonStats(*config);
+    if (!guest.ok()) {
+      LOG(DEBUG) << guest.error();
+      continue;
+    }
+    auto target = BalloonTarget(*config, *host, *guest);
+    auto difference = target > guest->balloon_bytes
+                          ? target - guest->balloon_bytes
+                          : guest->balloon_bytes - target;
+    if (target != last_target && (difference >= kMinStep || target == 0)) {
+      auto set = vmm->SetBalloonSize(*config, target);
+      if (set.ok()) {
+        LOG(INFO) << "Balloon target " << target / kMiB << " MiB, host has "
+                  << host->available_bytes / kMiB << " MiB available";
+        last_target = target;
+      } else {
+        LOG(ERROR) << set.error();
+      }
+    }
+    auto written = WriteStatus(instance.balloon_status_path(), *host, *guest,
+                               last_target);
+    if (!written.ok()) {
+      LOG(ERROR) << written.error();
+    }
+  }
+}
+
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  auto result = cuttlefish::BalloonControllerMain(argc, argv);
+  CHECK(result.ok()) << result.error();
+  return 0;
+}
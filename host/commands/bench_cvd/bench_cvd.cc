@@ -0,0 +1,440 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <linux/input.h>
+#include <sys/utsname.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <gflags/gflags.h>
+#include <json/json.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/fs/shared_select.h"
+#include "common/libs/utils/environment.h"
+#include "common/libs/utils/files.h"
+#include "common/libs/utils/result.h"
+#include "common/libs/utils/subprocess.h"
+#include "host/commands/run_cvd/runner_defs.h"
+#include "host/libs/config/boot_timeline.h"
+#include "host/libs/config/cuttlefish_config.h"
+#include "host/libs/input_recording/input_recording.h"
+
+DEFINE_int32(instance_num, cuttlefish::GetInstance(),
+             "Which instance to benchmark");
+DEFINE_int32(input_samples, 20,
+             "How many key presses to measure the input to display latency "
+             "with, zero to skip");
+DEFINE_int32(input_timeout_ms, 1000,
+             "How long to wait for a frame after a key press before counting "
+             "the sample as missed");
+DEFINE_int32(settle_ms, 300,
+             "How long the displays have to go without a frame before each key "
+             "press, so that the next frame is the press' doing");
+DEFINE_int32(push_size_mb, 64,
+             "Size of the file pushed with adb to measure its throughput, zero "
+             "to skip");
+DEFINE_int32(idle_seconds, 10,
+             "How long to measure the host CPU usage of the instance for, zero "
+             "to only report memory");
+DEFINE_string(output, "", "File to write the results to instead of stdout");
+
+namespace cuttlefish {
+namespace {
+
+constexpr char kUsage[] =
+    "Measures the performance of a running device and prints the results as "
+    "json.\n"
+    "\n"
+    "usage: cvd start --daemon [...] && cvd bench [--instance_num=N]\n"
+    "\n"
+    "The boot timings come from the boot timeline of the last launch, the "
+    "other results are measured by driving the device: key presses through "
+    "the input replay socket, a push of random data over adb and the resource "
+    "usage of the instance's host processes while it idles. Results that "
+    "can't be measured are null, with the reason under \"skipped\".";
+
+using Clock = std::chrono::steady_clock;
+
+// Where the pushed file goes in the guest
+constexpr char kGuestPushPath[] = "/data/local/tmp/bench_push.bin";
+// Keys whose presses show the volume panel, alternated so the volume ends
+// where it started
+constexpr std::uint16_t kProbeKeys[] = {KEY_VOLUMEUP, KEY_VOLUMEDOWN};
+// Gives up on waiting for the displays to settle, e.g. with animations
+constexpr auto kMaxSettleTime = std::chrono::seconds(5);
+
+double Milliseconds(Clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+Json::Value OptionalMs(const std::map<std::string, std::chrono::microseconds>&
+                           marks,
+                       const std::string& name) {
+  auto it = marks.find(name);
+  if (it == marks.end()) {
+    return {};
+  }
+  return Json::Int64(it->second.count() / 1000);
+}
+
+Result<Json::Value> BootResults(
+    const CuttlefishConfig::InstanceSpecific& instance) {
+  auto marks =
+      CF_EXPECT(ReadBootTimelineMarks(instance.boot_timeline_path()));
+  Json::Value boot;
+  boot["assembly_ms"] = OptionalMs(marks.phase_ends, "assemble");
+  boot["boot_completed_ms"] = OptionalMs(marks.instants, "BootCompleted");
+  boot["first_frame_ms"] = OptionalMs(marks.instants, "FirstFrame");
+  return boot;
+}
+
+// The streamer's default input format
+struct VirtioInputEvent {
+  std::uint16_t type;
+  std::uint16_t code;
+  std::int32_t value;
+};
+
+InputRecord KeyRecord(std::uint16_t code, bool down) {
+  VirtioInputEvent events[] = {
+      {.type = EV_KEY, .code = code, .value = down},
+      {.type = EV_SYN, .code = SYN_REPORT, .value = 0},
+  };
+  auto bytes = reinterpret_cast<const char*>(events);
+  return InputRecord{
+      .timestamp = {},
+      .label = kKeyboardInputLabel,
+      .data = std::vector<char>(bytes, bytes + sizeof(events)),
+  };
+}
+
+// False when no frame was committed before the timeout
+Result<bool> WaitForFrame(SharedFD connection, Clock::duration timeout) {
+  auto deadline = Clock::now() + timeout;
+  for (;;) {
+    auto left = std::chrono::duration_cast<std::chrono::microseconds>(
+        deadline - Clock::now());
+    if (left.count() <= 0) {
+      return false;
+    }
+    SharedFDSet read_set;
+    read_set.Set(connection);
+    struct timeval select_timeout = {
+        .tv_sec = static_cast<time_t>(left.count() / 1000000),
+        .tv_usec = static_cast<suseconds_t>(left.count() % 1000000),
+    };
+    int selected = Select(&read_set, nullptr, nullptr, &select_timeout);
+    CF_EXPECT(selected >= 0, "Failed waiting for a frame: " << strerror(errno));
+    if (selected == 0) {
+      return false;
+    }
+    auto record = CF_EXPECT(ReadInputRecord(connection));
+    CF_EXPECT(record.has_value(), "The streamer closed the input connection");
+    if (record->label == kFrameCommitLabel) {
+      return true;
+    }
+  }
+}
+
+// False when frames kept coming for too long
+Result<bool> WaitForSettledDisplays(SharedFD connection) {
+  auto give_up = Clock::now() + kMaxSettleTime;
+  while (Clock::now() < give_up) {
+    if (!CF_EXPECT(WaitForFrame(connection,
+                                std::chrono::milliseconds(FLAGS_settle_ms)))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Json::Value LatencyStats(std::vector<double> samples_ms) {
+  Json::Value stats;
+  stats["samples"] = Json::UInt64(samples_ms.size());
+  if (samples_ms.empty()) {
+    return stats;
+  }
+  std::sort(samples_ms.begin(), samples_ms.end());
+  auto percentile = [&samples_ms](double p) {
+    return samples_ms[static_cast<std::size_t>(p * (samples_ms.size() - 1))];
+  };
+  stats["min_ms"] = samples_ms.front();
+  stats["median_ms"] = percentile(0.5);
+  stats["p90_ms"] = percentile(0.9);
+  stats["max_ms"] = samples_ms.back();
+  return stats;
+}
+
+// From writing a key press to the input replay socket to the streamer
+// reporting the next frame, so it includes the guest's input handling,
+// rendering, composition and the host's frame processing.
+Result<Json::Value> InputToDisplayLatency(
+    const CuttlefishConfig::InstanceSpecific& instance) {
+  auto path = instance.input_replay_socket_path();
+  auto connection = SharedFD::SocketLocalClient(path, false, SOCK_STREAM);
+  CF_EXPECT(connection->IsOpen(),
+            "Failed to connect to \"" << path << "\": "
+                                      << connection->StrError());
+  std::vector<double> samples_ms;
+  int missed = 0;
+  int unsettled = 0;
+  for (int i = 0; i < FLAGS_input_samples; i++) {
+    auto key = kProbeKeys[i % std::size(kProbeKeys)];
+    if (!CF_EXPECT(WaitForSettledDisplays(connection))) {
+      unsettled++;
+      continue;
+    }
+    auto pressed = Clock::now();
+    CF_EXPECT(WriteInputRecord(connection, KeyRecord(key, true)));
+    auto got_frame = CF_EXPECT(WaitForFrame(
+        connection, std::chrono::milliseconds(FLAGS_input_timeout_ms)));
+    if (got_frame) {
+      samples_ms.push_back(Milliseconds(Clock::now() - pressed));
+    } else {
+      missed++;
+    }
+    CF_EXPECT(WriteInputRecord(connection, KeyRecord(key, false)));
+  }
+  auto latency = LatencyStats(std::move(samples_ms));
+  latency["missed"] = missed;
+  latency["unsettled"] = unsettled;
+  return latency;
+}
+
+Result<void> WriteRandomFile(const std::string& path, std::size_t size) {
+  auto file = SharedFD::Open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  CF_EXPECT(file->IsOpen(),
+            "Failed to create \"" << path << "\": " << file->StrError());
+  // Random so that adb can't compress it
+  std::mt19937_64 generator;
+  std::vector<std::uint64_t> chunk(1 << 17);
+  for (std::size_t written = 0; written < size;) {
+    std::generate(chunk.begin(), chunk.end(), generator);
+    auto bytes = std::min(size - written, chunk.size() * sizeof(chunk[0]));
+    CF_EXPECT(WriteAll(file, reinterpret_cast<const char*>(chunk.data()),
+                       bytes) == static_cast<ssize_t>(bytes),
+              "Failed to write \"" << path << "\": " << file->StrError());
+    written += bytes;
+  }
+  return {};
+}
+
+Command AdbCommand(const CuttlefishConfig::InstanceSpecific& instance) {
+  Command adb(HostBinaryPath("adb"));
+  adb.AddParameter("-s").AddParameter(instance.adb_device_name());
+  return adb;
+}
+
+Result<Json::Value> AdbPushThroughput(
+    const CuttlefishConfig::InstanceSpecific& instance) {
+  auto local_path = instance.PerInstanceInternalPath("bench_push.bin");
+  std::size_t size = static_cast<std::size_t>(FLAGS_push_size_mb) << 20;
+  CF_EXPECT(WriteRandomFile(local_path, size));
+
+  auto push = AdbCommand(instance);
+  push.AddParameter("push").AddParameter(local_path).AddParameter(
+      kGuestPushPath);
+  std::string push_stdout, push_stderr;
+  auto start = Clock::now();
+  int exit_code = RunWithManagedStdio(std::move(push), nullptr, &push_stdout,
+                                      &push_stderr);
+  auto elapsed = Clock::now() - start;
+  RemoveFile(local_path);
+
+  auto remove = AdbCommand(instance);
+  remove.AddParameter("shell").AddParameter("rm").AddParameter("-f")
+      .AddParameter(kGuestPushPath);
+  if (RunWithManagedStdio(std::move(remove), nullptr, nullptr, nullptr) != 0) {
+    LOG(WARNING) << "Failed to remove " << kGuestPushPath << " from the device";
+  }
+  CF_EXPECT(exit_code == 0, "adb push failed: " << push_stderr);
+
+  auto seconds = std::chrono::duration<double>(elapsed).count();
+  Json::Value push_results;
+  push_results["bytes"] = Json::UInt64(size);
+  push_results["seconds"] = seconds;
+  push_results["mb_per_second"] = FLAGS_push_size_mb / seconds;
+  return push_results;
+}
+
+Result<Json::Value> QueryProcessStatus(
+    const CuttlefishConfig::InstanceSpecific& instance) {
+  auto path = instance.launcher_monitor_socket_path();
+  auto monitor = SharedFD::SocketLocalClient(path, false, SOCK_STREAM);
+  CF_EXPECT(monitor->IsOpen(), "Unable to connect to the launcher monitor at \""
+                                   << path << "\": " << monitor->StrError());
+  auto action = LauncherAction::kProcessStatus;
+  CF_EXPECT(WriteAllBinary(monitor, &action) == sizeof(action),
+            monitor->StrError());
+  LauncherResponse response;
+  CF_EXPECT(ReadExactBinary(monitor, &response) == sizeof(response),
+            monitor->StrError());
+  CF_EXPECT(response == LauncherResponse::kSuccess,
+            "The launcher failed to report its processes");
+  std::uint32_t size = 0;
+  CF_EXPECT(ReadExactBinary(monitor, &size) == sizeof(size),
+            monitor->StrError());
+  std::string status(size, '\0');
+  CF_EXPECT(ReadExact(monitor, &status) == static_cast<ssize_t>(size),
+            monitor->StrError());
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  Json::Value processes;
+  std::string errors;
+  CF_EXPECT(reader->parse(status.data(), status.data() + status.size(),
+                          &processes, &errors),
+            "Could not parse the process status: " << errors);
+  CF_EXPECT(processes.isArray(), "The process status is not a list");
+  return processes;
+}
+
+// Memory of the instance's host processes, and their CPU usage over
+// --idle_seconds, in percent of one core
+Result<Json::Value> HostUsage(
+    const CuttlefishConfig::InstanceSpecific& instance) {
+  auto before = CF_EXPECT(QueryProcessStatus(instance));
+  auto start = Clock::now();
+  std::this_thread::sleep_for(std::chrono::seconds(FLAGS_idle_seconds));
+  auto after = CF_EXPECT(QueryProcessStatus(instance));
+  auto elapsed_ms = Milliseconds(Clock::now() - start);
+
+  Json::Value usage;
+  Json::Value processes(Json::arrayValue);
+  std::int64_t total_rss_kb = 0;
+  double total_cpu_percent = 0;
+  for (Json::ArrayIndex i = 0; i < after.size(); i++) {
+    const auto& process = after[i];
+    Json::Value process_usage;
+    process_usage["name"] = process["name"];
+    process_usage["rss_kb"] = process["rss_kb"];
+    total_rss_kb += process["rss_kb"].asInt64();
+    // The launcher lists its processes in the same order every time
+    if (FLAGS_idle_seconds > 0 && i < before.size() &&
+        before[i]["name"] == process["name"] &&
+        before[i]["pid"] == process["pid"]) {
+      auto cpu_ms = process["cpu_time_ms"].asInt64() -
+                    before[i]["cpu_time_ms"].asInt64();
+      auto cpu_percent = 100.0 * cpu_ms / elapsed_ms;
+      process_usage["cpu_percent"] = cpu_percent;
+      total_cpu_percent += cpu_percent;
+    }
+    processes.append(process_usage);
+  }
+  usage["rss_kb"] = Json::Int64(total_rss_kb);
+  if (FLAGS_idle_seconds > 0) {
+    usage["cpu_percent"] = total_cpu_percent;
+  }
+  usage["processes"] = processes;
+  return usage;
+}
+
+Json::Value HostDescription(const CuttlefishConfig& config) {
+  Json::Value host;
+  struct utsname name;
+  if (uname(&name) == 0) {
+    host["kernel"] = name.release;
+  }
+  host["cpus"] = std::thread::hardware_concurrency();
+  host["vm_manager"] = config.vm_manager();
+  host["gpu_mode"] = config.gpu_mode();
+  host["guest_cpus"] = config.cpus();
+  host["guest_memory_mb"] = config.memory_mb();
+  return host;
+}
+
+Result<void> BenchCvdMain(int argc, char** argv) {
+  ::android::base::InitLogging(argv, android::base::StderrLogger);
+  google::SetUsageMessage(kUsage);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  auto config = CuttlefishConfig::Get();
+  CF_EXPECT(config != nullptr, "Unable to load the config");
+  auto instance = config->ForInstance(FLAGS_instance_num);
+
+  Json::Value results;
+  results["instance_num"] = FLAGS_instance_num;
+  results["host"] = HostDescription(*config);
+  Json::Value skipped(Json::objectValue);
+  // Each measurement is independent, one failing leaves the others useful
+  auto measure = [&results, &skipped](
+                     const char* name, bool enabled,
+                     std::function<Result<Json::Value>()> measurement) {
+    results[name] = Json::Value();
+    if (!enabled) {
+      skipped[name] = "Disabled by its flag";
+      return;
+    }
+    auto result = measurement();
+    if (!result.ok()) {
+      LOG(ERROR) << "Failed to measure " << name << ": " << result.error();
+      skipped[name] = result.error().message();
+      return;
+    }
+    results[name] = *result;
+  };
+  measure("boot", true, [&instance]() { return BootResults(instance); });
+  measure("input_to_display", FLAGS_input_samples > 0,
+          [&instance]() { return InputToDisplayLatency(instance); });
+  measure("adb_push", FLAGS_push_size_mb > 0,
+          [&instance]() { return AdbPushThroughput(instance); });
+  results["audio_round_trip"] = Json::Value();
+  skipped["audio_round_trip"] =
+      "The host has no audio loopback, the device's audio only reaches "
+      "streaming clients";
+  // Last, so that the idle period follows the other measurements
+  measure("host_usage", true, [&instance]() { return HostUsage(instance); });
+  results["skipped"] = skipped;
+
+  Json::StreamWriterBuilder factory;
+  auto serialized = Json::writeString(factory, results) + "\n";
+  if (FLAGS_output.empty()) {
+    std::cout << serialized;
+  } else {
+    auto output = SharedFD::Open(FLAGS_output, O_CREAT | O_WRONLY | O_TRUNC,
+                                 0644);
+    CF_EXPECT(output->IsOpen(), "Failed to open \"" << FLAGS_output << "\": "
+                                                    << output->StrError());
+    CF_EXPECT(WriteAll(output, serialized) ==
+                  static_cast<ssize_t>(serialized.size()),
+              output->StrError());
+  }
+  return {};
+}
+
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  auto result = cuttlefish::BenchCvdMain(argc, argv);
+  if (!result.ok()) {
+    LOG(ERROR) << result.error();
+    return 1;
+  }
+  return 0;
+}
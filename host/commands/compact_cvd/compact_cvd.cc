@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <string>
+
+#include <android-base/logging.h>
+#include <gflags/gflags.h>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/environment.h"
+#include "common/libs/utils/files.h"
+#include "host/libs/config/cuttlefish_config.h"
+#include "host/libs/image_aggregator/image_aggregator.h"
+
+DEFINE_int32(instance_num, cuttlefish::GetInstance(),
+             "Which instance to compact. Ignored with --all_instances.");
+
+DEFINE_bool(all_instances, false, "Compact every instance in the config.");
+
+DEFINE_bool(report, false,
+            "Only print the logical and physical size of each instance disk "
+            "without changing anything. Safe while the device is running.");
+
+namespace cuttlefish {
+namespace {
+
+bool IsRunning(const CuttlefishConfig::InstanceSpecific& instance) {
+  auto monitor_path = instance.launcher_monitor_socket_path();
+  if (!FileIsSocket(monitor_path)) {
+    return false;
+  }
+  auto monitor_socket =
+      SharedFD::SocketLocalClient(monitor_path.c_str(), false, SOCK_STREAM);
+  return monitor_socket->IsOpen();
+}
+
+void PrintSizes(const std::string& instance, const std::string& path) {
+  auto sizes = SparseFileSizes(path);
+  std::cout << std::left << std::setw(12) << instance << std::right
+            << std::setw(12) << (sizes.sparse_size >> 20) << std::setw(12)
+            << (sizes.disk_size >> 20) << "  " << path << "\n";
+}
+
+int CompactCvdMain(int argc, char** argv) {
+  ::android::base::InitLogging(argv, android::base::StderrLogger);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  auto config = CuttlefishConfig::Get();
+  if (!config) {
+    LOG(ERROR) << "Failed to obtain config object";
+    return 1;
+  }
+  std::vector<CuttlefishConfig::InstanceSpecific> instances;
+  if (FLAGS_all_instances) {
+    instances = config->Instances();
+  } else {
+    instances.push_back(config->ForInstance(FLAGS_instance_num));
+  }
+
+  if (FLAGS_report) {
+    std::cout << std::left << std::setw(12) << "INSTANCE" << std::right
+              << std::setw(12) << "LOGICAL_MB" << std::setw(12)
+              << "PHYSICAL_MB" << "  PATH\n";
+  }
+  // Components shared between instances are only visited once
+  std::set<std::string> visited;
+  int status = 0;
+  for (const auto& instance : instances) {
+    if (!FLAGS_report && IsRunning(instance)) {
+      LOG(ERROR) << "Instance " << instance.instance_name()
+                 << " is running; stop it before compacting its disks";
+      status = 2;
+      continue;
+    }
+    for (const auto& disk : instance.virtual_disk_paths()) {
+      for (const auto& file : WritableDiskFiles(disk)) {
+        if (!visited.insert(AbsolutePath(file)).second) {
+          continue;
+        }
+        if (FLAGS_report) {
+          PrintSizes(instance.instance_name(), file);
+          continue;
+        }
+        auto punched = PunchHolesInZeroBlocks(file);
+        if (!punched.ok()) {
+          LOG(ERROR) << "Failed to compact " << file << ": "
+                     << punched.error();
+          status = 3;
+          continue;
+        }
+        LOG(INFO) << "Released " << (*punched >> 20) << " MiB from " << file;
+      }
+    }
+  }
+  return status;
+}
+
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  return cuttlefish::CompactCvdMain(argc, argv);
+}
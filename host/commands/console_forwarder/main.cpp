@@ -14,22 +14,27 @@
  * limitations under the License.
  */
 
-#include <termios.h>
-#include <stdlib.h>
+
+#include <fcntl.h>
 #include <signal.h>
+#include <stdlib.h>
+#include <termios.h>
 #include <unistd.h>
 
-#include <deque>
-#include <thread>
+#include <memory>
+#include <string>
 #include <vector>
 
 #include <gflags/gflags.h>
 #include <android-base/logging.h>
 
-#include <common/libs/fs/shared_fd.h>
-#include <common/libs/fs/shared_select.h>
-#include <host/libs/config/cuttlefish_config.h>
-#include <host/libs/config/logging.h>
+#include "common/libs/fs/epoll.h"
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+#include "host/commands/console_forwarder/output_ring.h"
+#include "host/libs/config/cuttlefish_config.h"
+#include "host/libs/config/logging.h"
 
 DEFINE_int32(console_in_fd,
              -1,
@@ -39,35 +44,80 @@ DEFINE_int32(console_out_fd,
              "File descriptor for the console's output channel");
 
 namespace cuttlefish {
+namespace {
+
+constexpr std::size_t kReadSize = 4096;
+// What a client connecting late or reading slowly can still get
+constexpr std::size_t kClientBufferSize = 1 << 16;
+constexpr std::size_t kKernelLogBufferSize = 1 << 20;
+
+Result<void> SetNonBlocking(SharedFD fd) {
+  auto flags = fd->Fcntl(F_GETFL, 0);
+  CF_EXPECT(flags >= 0, "fcntl failed: " << fd->StrError());
+  CF_EXPECT(fd->Fcntl(F_SETFL, flags | O_NONBLOCK) >= 0,
+            "fcntl failed: " << fd->StrError());
+  return {};
+}
 
-// Handles forwarding the serial console to a pseudo-terminal (PTY)
+}  // namespace
+
+// Forwards a serial console to a pseudo-terminal (PTY).
 // It receives a couple of fds for the console (could be the same fd twice if,
 // for example a socket_pair were used).
-// Data available in the console's output needs to be read immediately to avoid
-// the having the VMM blocked on writes to the pipe. To achieve this one thread
-// takes care of (and only of) all read calls (from console output and from the
-// socket client), using select(2) to ensure it never blocks. Writes are handled
-// in a different thread, the two threads communicate through a buffer queue
-// protected by a mutex.
-class ConsoleForwarder {
+// The console's output is also written to a log file and to the kernel log
+// monitor. It needs to be read immediately to avoid having the VMM blocked on
+// writes to the pipe, so nothing here blocks: output a destination isn't
+// ready for waits in a bounded ring, and the client's input is only read when
+// the VMM can take it.
+class Console {
  public:
-  ConsoleForwarder(std::string console_path, SharedFD console_in,
-                   SharedFD console_out, SharedFD console_log,
-                   SharedFD kernel_log)
+  Console(std::string console_path, SharedFD console_in, SharedFD console_out,
+          SharedFD console_log, SharedFD kernel_log)
       : console_path_(console_path),
         console_in_(console_in),
         console_out_(console_out),
         console_log_(console_log),
-        kernel_log_(kernel_log) {}
-  [[noreturn]] void StartServer() {
-    // Create a new thread to handle writes to the console
-    writer_thread_ = std::thread([this]() { WriteLoop(); });
-    // Use the calling thread (likely the process' main thread) to handle
-    // reading the console's output and input from the client.
-    ReadLoop();
+        kernel_log_(kernel_log),
+        client_output_(kClientBufferSize),
+        kernel_log_output_(kKernelLogBufferSize),
+        client_input_(kReadSize) {}
+
+  Result<void> Start(Epoll& epoll) {
+    CF_EXPECT(SetNonBlocking(console_in_));
+    CF_EXPECT(SetNonBlocking(console_out_));
+    if (kernel_log_->IsOpen()) {
+      CF_EXPECT(SetNonBlocking(kernel_log_));
+    }
+    CF_EXPECT(epoll.Add(console_out_, EPOLLIN));
+    CF_EXPECT(OpenPTY(epoll));
+    return {};
   }
+
+  // Returns false if the event is for another console
+  Result<bool> Handle(Epoll& epoll, const EpollEvent& event) {
+    if (event.fd == console_out_) {
+      CF_EXPECT(ForwardOutput(epoll));
+    } else if (event.fd == client_fd_) {
+      if (event.events & EPOLLOUT) {
+        CF_EXPECT(FlushClient(epoll));
+      }
+      if (event.events & EPOLLIN) {
+        CF_EXPECT(ForwardInput(epoll));
+      } else if (event.events & (EPOLLHUP | EPOLLERR)) {
+        CF_EXPECT(OpenPTY(epoll));
+      }
+    } else if (event.fd == console_in_) {
+      CF_EXPECT(FlushInput(epoll));
+    } else if (event.fd == kernel_log_) {
+      CF_EXPECT(FlushKernelLog(epoll));
+    } else {
+      return false;
+    }
+    return true;
+  }
+
  private:
-  SharedFD OpenPTY() {
+  SharedFD OpenPTYDevice() {
     // Remove any stale symlink to a pts device
     auto ret = unlink(console_path_.c_str());
     CHECK(!(ret < 0 && errno != ENOENT))
@@ -105,97 +155,153 @@ class ConsoleForwarder {
     return pty_shared_fd;
   }
 
-  void EnqueueWrite(std::shared_ptr<std::vector<char>> buf_ptr, SharedFD fd) {
-    std::lock_guard<std::mutex> lock(write_queue_mutex_);
-    write_queue_.emplace_back(fd, buf_ptr);
-    condvar_.notify_one();
+  // Also replaces the PTY of a client that went away, e.g. the user closed
+  // minicom, or killed screen, or closed kgdb. Output the client didn't get
+  // stays buffered for the next one.
+  Result<void> OpenPTY(Epoll& epoll) {
+    if (client_fd_->IsOpen()) {
+      CF_EXPECT(epoll.Delete(client_fd_));
+      client_fd_->Close();
+    }
+    client_fd_ = OpenPTYDevice();
+    client_events_ = EPOLLIN;
+    CF_EXPECT(epoll.Add(client_fd_, client_events_));
+    CF_EXPECT(FlushClient(epoll));
+    return {};
   }
 
-  [[noreturn]] void WriteLoop() {
-    while (true) {
-      while (!write_queue_.empty()) {
-        std::shared_ptr<std::vector<char>> buf_ptr;
-        SharedFD fd;
-        {
-          std::lock_guard<std::mutex> lock(write_queue_mutex_);
-          auto& front = write_queue_.front();
-          buf_ptr = front.second;
-          fd = front.first;
-          write_queue_.pop_front();
-        }
-        // Write all bytes to the file descriptor. Writes may block, so the
-        // mutex lock should NOT be held while writing to avoid blocking the
-        // other thread.
-        ssize_t bytes_written = 0;
-        ssize_t bytes_to_write = buf_ptr->size();
-        while (bytes_to_write > 0) {
-          bytes_written =
-              fd->Write(buf_ptr->data() + bytes_written, bytes_to_write);
-          if (bytes_written < 0) {
-            // It is expected for writes to the PTY to fail if nothing is connected
-            if(fd->GetErrno() != EAGAIN) {
-              LOG(ERROR) << "Error writing to fd: " << fd->StrError();
-            }
-
-            // Don't try to write from this buffer anymore, error handling will
-            // be done on the reading thread (failed client will be
-            // disconnected, on serial console failure this process will abort).
-            break;
-          }
-          bytes_to_write -= bytes_written;
-        }
-      }
-      {
-        std::unique_lock<std::mutex> lock(write_queue_mutex_);
-        // Check again before sleeping, state may have changed
-        if (write_queue_.empty()) {
-          condvar_.wait(lock);
-        }
-      }
+  Result<void> UpdateClientEvents(Epoll& epoll) {
+    uint32_t events = (input_blocked_ ? 0 : EPOLLIN) |
+                      (client_output_.Empty() ? 0 : EPOLLOUT);
+    if (events != client_events_) {
+      CF_EXPECT(epoll.Modify(client_fd_, events));
+      client_events_ = events;
     }
+    return {};
   }
 
-  [[noreturn]] void ReadLoop() {
-    SharedFD client_fd;
-    while (true) {
-      if (!client_fd->IsOpen()) {
-        client_fd = OpenPTY();
+  // Waits for fd to be writable while there is output for it
+  Result<void> UpdateWriteEvents(Epoll& epoll, SharedFD fd, bool pending,
+                                 bool& polled) {
+    if (pending && !polled) {
+      CF_EXPECT(epoll.Add(fd, EPOLLOUT));
+    } else if (!pending && polled) {
+      CF_EXPECT(epoll.Delete(fd));
+    }
+    polled = pending;
+    return {};
+  }
+
+  Result<void> ForwardOutput(Epoll& epoll) {
+    char buf[kReadSize];
+    std::size_t to_read = sizeof(buf);
+    bool in_kernel_log = false;
+    if (use_tee_ && kernel_log_->IsOpen() && kernel_log_output_.Empty()) {
+      // Both are pipes, the kernel can copy to the kernel log monitor before
+      // the same bytes are read here
+      auto copied = console_out_->Tee(*kernel_log_, sizeof(buf),
+                                      SPLICE_F_NONBLOCK);
+      if (copied > 0) {
+        to_read = copied;
+        in_kernel_log = true;
+      } else if (copied < 0 && console_out_->GetErrno() == EINVAL) {
+        use_tee_ = false;
       }
+    }
+    auto bytes_read = console_out_->Read(buf, to_read);
+    if (bytes_read < 0 && console_out_->GetErrno() == EAGAIN) {
+      return {};
+    }
+    // This is likely unrecoverable, so exit here
+    CF_EXPECT(bytes_read > 0, "Error reading from console output: "
+                                  << console_out_->StrError());
 
-      SharedFDSet read_set;
-      read_set.Set(console_out_);
-      read_set.Set(client_fd);
-
-      Select(&read_set, nullptr, nullptr, nullptr);
-      if (read_set.IsSet(console_out_)) {
-        std::shared_ptr<std::vector<char>> buf_ptr = std::make_shared<std::vector<char>>(4096);
-        auto bytes_read = console_out_->Read(buf_ptr->data(), buf_ptr->size());
-        // This is likely unrecoverable, so exit here
-        CHECK(bytes_read > 0) << "Error reading from console output: "
-                              << console_out_->StrError();
-        buf_ptr->resize(bytes_read);
-        EnqueueWrite(buf_ptr, console_log_);
-        if (client_fd->IsOpen()) {
-          EnqueueWrite(buf_ptr, client_fd);
-        }
-        EnqueueWrite(buf_ptr, kernel_log_);
+    if (WriteAll(console_log_, buf, bytes_read) != bytes_read) {
+      LOG(ERROR) << "Error writing to the console log: "
+                 << console_log_->StrError();
+    }
+    if (!in_kernel_log && kernel_log_->IsOpen()) {
+      kernel_log_output_.Push(buf, bytes_read);
+      CF_EXPECT(FlushKernelLog(epoll));
+    }
+    client_output_.Push(buf, bytes_read);
+    CF_EXPECT(FlushClient(epoll));
+    return {};
+  }
+
+  Result<void> ForwardInput(Epoll& epoll) {
+    if (use_splice_) {
+      auto moved = client_fd_->Splice(*console_in_, kReadSize,
+                                      SPLICE_F_NONBLOCK);
+      if (moved > 0) {
+        return {};
       }
-      if (read_set.IsSet(client_fd)) {
-        std::shared_ptr<std::vector<char>> buf_ptr = std::make_shared<std::vector<char>>(4096);
-        auto bytes_read = client_fd->Read(buf_ptr->data(), buf_ptr->size());
-        if (bytes_read <= 0) {
-          // If this happens, it's usually because the PTY controller went away
-          // e.g. the user closed minicom, or killed screen, or closed kgdb. In
-          // such a case, we will just re-create the PTY
-          LOG(ERROR) << "Error reading from client fd: "
-                     << client_fd->StrError();
-          client_fd->Close();
-        } else {
-          buf_ptr->resize(bytes_read);
-          EnqueueWrite(buf_ptr, console_in_);
-        }
+      if (moved < 0 && client_fd_->GetErrno() == EAGAIN) {
+        // Either the VMM isn't reading or it was a spurious wakeup, stop
+        // reading the client until the VMM's pipe has room
+        input_blocked_ = true;
+        CF_EXPECT(UpdateWriteEvents(epoll, console_in_, true, input_polled_));
+        CF_EXPECT(UpdateClientEvents(epoll));
+        return {};
       }
+      if (moved < 0 && client_fd_->GetErrno() == EINVAL) {
+        // This kernel can't splice from a PTY
+        use_splice_ = false;
+      } else {
+        LOG(ERROR) << "Error reading from client fd: "
+                   << client_fd_->StrError();
+        CF_EXPECT(OpenPTY(epoll));
+        return {};
+      }
+    }
+
+    char buf[kReadSize];
+    auto bytes_read = client_fd_->Read(buf, sizeof(buf));
+    if (bytes_read < 0 && client_fd_->GetErrno() == EAGAIN) {
+      return {};
+    }
+    if (bytes_read <= 0) {
+      LOG(ERROR) << "Error reading from client fd: " << client_fd_->StrError();
+      CF_EXPECT(OpenPTY(epoll));
+      return {};
+    }
+    client_input_.Push(buf, bytes_read);
+    CF_EXPECT(FlushInput(epoll));
+    return {};
+  }
+
+  Result<void> FlushInput(Epoll& epoll) {
+    if (!client_input_.WriteTo(console_in_)) {
+      LOG(ERROR) << "Error writing to console input: "
+                 << console_in_->StrError();
+      client_input_.Clear();
+    }
+    // Splicing leaves the input in the PTY, nothing to flush but the reads
+    // need to start again
+    input_blocked_ = !client_input_.Empty();
+    CF_EXPECT(
+        UpdateWriteEvents(epoll, console_in_, input_blocked_, input_polled_));
+    CF_EXPECT(UpdateClientEvents(epoll));
+    return {};
+  }
+
+  Result<void> FlushClient(Epoll& epoll) {
+    // Errors mean the client went away, which the read side handles
+    client_output_.WriteTo(client_fd_);
+    CF_EXPECT(UpdateClientEvents(epoll));
+    return {};
+  }
+
+  Result<void> FlushKernelLog(Epoll& epoll) {
+    if (!kernel_log_output_.WriteTo(kernel_log_)) {
+      LOG(ERROR) << "Error writing to the kernel log: "
+                 << kernel_log_->StrError();
+      kernel_log_output_.Clear();
     }
+    CF_EXPECT(UpdateWriteEvents(epoll, kernel_log_,
+                                !kernel_log_output_.Empty(),
+                                kernel_log_polled_));
+    return {};
   }
 
   std::string console_path_;
@@ -203,11 +309,45 @@ class ConsoleForwarder {
   SharedFD console_out_;
   SharedFD console_log_;
   SharedFD kernel_log_;
-  std::thread writer_thread_;
-  std::mutex write_queue_mutex_;
-  std::condition_variable condvar_;
-  std::deque<std::pair<SharedFD, std::shared_ptr<std::vector<char>>>>
-      write_queue_;
+  SharedFD client_fd_;
+  uint32_t client_events_ = 0;
+  OutputRing client_output_;
+  OutputRing kernel_log_output_;
+  // Only holds what a partial write to the VMM's pipe left
+  OutputRing client_input_;
+  bool input_blocked_ = false;
+  bool input_polled_ = false;
+  bool kernel_log_polled_ = false;
+  bool use_splice_ = true;
+  bool use_tee_ = true;
+};
+
+// All the consoles of an instance are served from a single thread.
+class ConsoleForwarder {
+ public:
+  ConsoleForwarder(std::vector<std::unique_ptr<Console>> consoles)
+      : consoles_(std::move(consoles)) {}
+
+  Result<void> Run() {
+    auto epoll = CF_EXPECT(Epoll::Create());
+    for (auto& console : consoles_) {
+      CF_EXPECT(console->Start(epoll));
+    }
+    while (true) {
+      auto event = CF_EXPECT(epoll.Wait());
+      if (!event) {
+        continue;
+      }
+      for (auto& console : consoles_) {
+        if (CF_EXPECT(console->Handle(epoll, *event))) {
+          break;
+        }
+      }
+    }
+  }
+
+ private:
+  std::vector<std::unique_ptr<Console>> consoles_;
 };
 
 int ConsoleForwarderMain(int argc, char** argv) {
@@ -238,14 +378,18 @@ int ConsoleForwarderMain(int argc, char** argv) {
       SharedFD::Open(console_log.c_str(), O_CREAT | O_APPEND | O_WRONLY, 0666);
   auto kernel_log_fd = SharedFD::Open(instance.kernel_log_pipe_name(),
                                       O_APPEND | O_WRONLY, 0666);
-  ConsoleForwarder console_forwarder(console_path, console_in, console_out,
-                                     console_log_fd, kernel_log_fd);
+  std::vector<std::unique_ptr<Console>> consoles;
+  consoles.emplace_back(new Console(console_path, console_in, console_out,
+                                    console_log_fd, kernel_log_fd));
+  ConsoleForwarder console_forwarder(std::move(consoles));
 
   // Don't get a SIGPIPE from the clients
-  CHECK(sigaction(SIGPIPE, nullptr, nullptr) == 0)
+  CHECK(signal(SIGPIPE, SIG_IGN) != SIG_ERR)
       << "Failed to set SIGPIPE to be ignored: " << strerror(errno);
 
-  console_forwarder.StartServer();
+  auto result = console_forwarder.Run();
+  LOG(FATAL) << result.error();
+  return 1;
 }
 
 }  // namespace cuttlefish
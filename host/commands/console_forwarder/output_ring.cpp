@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/console_forwarder/output_ring.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+
+namespace cuttlefish {
+
+OutputRing::OutputRing(std::size_t capacity) : buffer_(capacity) {}
+
+void OutputRing::Push(const char* data, std::size_t size) {
+  if (size >= buffer_.size()) {
+    // Only the newest bytes fit
+    data += size - buffer_.size();
+    size = buffer_.size();
+    Clear();
+  }
+  auto overflow = (size_ + size) - std::min(size_ + size, buffer_.size());
+  start_ = (start_ + overflow) % buffer_.size();
+  size_ -= overflow;
+
+  auto end = (start_ + size_) % buffer_.size();
+  auto first = std::min(size, buffer_.size() - end);
+  memcpy(buffer_.data() + end, data, first);
+  memcpy(buffer_.data(), data + first, size - first);
+  size_ += size;
+}
+
+bool OutputRing::WriteTo(SharedFD fd) {
+  while (size_ > 0) {
+    auto first = std::min(size_, buffer_.size() - start_);
+    struct iovec iov[2] = {
+        {.iov_base = buffer_.data() + start_, .iov_len = first},
+        {.iov_base = buffer_.data(), .iov_len = size_ - first},
+    };
+    auto written = fd->Writev(iov, iov[1].iov_len > 0 ? 2 : 1);
+    if (written < 0) {
+      return fd->GetErrno() == EAGAIN;
+    }
+    if (written == 0) {
+      return true;
+    }
+    start_ = (start_ + written) % buffer_.size();
+    size_ -= written;
+  }
+  start_ = 0;
+  return true;
+}
+
+void OutputRing::Clear() {
+  start_ = 0;
+  size_ = 0;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "common/libs/fs/shared_fd.h"
+
+namespace cuttlefish {
+
+// Output waiting for a destination that isn't writable, e.g. a PTY nobody has
+// opened. Holds at most `capacity` bytes, the oldest are dropped to make room
+// for newer ones.
+class OutputRing {
+ public:
+  explicit OutputRing(std::size_t capacity);
+
+  bool Empty() const { return size_ == 0; }
+  std::size_t Size() const { return size_; }
+  std::size_t Capacity() const { return buffer_.size(); }
+
+  void Push(const char* data, std::size_t size);
+  // Writes as much as the destination takes without blocking. Returns false
+  // on errors other than EAGAIN, the error is set on fd.
+  bool WriteTo(SharedFD fd);
+  void Clear();
+
+ private:
+  std::vector<char> buffer_;
+  std::size_t start_ = 0;
+  std::size_t size_ = 0;
+};
+
+}  // namespace cuttlefish
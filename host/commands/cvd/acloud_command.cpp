@@ -326,7 +326,8 @@ class AcloudCreateCommand : public CvdServerHandler {
 
 }  // namespace
 
-fruit::Component<fruit::Required<CvdCommandHandler>> AcloudCommandComponent() {
+fruit::Component<fruit::Required<InstanceManager, WarmPool>>
+AcloudCommandComponent() {
   return fruit::createComponent()
       .addMultibinding<CvdServerHandler, AcloudCreateCommand>()
       .addMultibinding<CvdServerHandler, TryAcloudCreateCommand>();
@@ -0,0 +1,363 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/cvd/build_prefetcher.h"
+
+#include <signal.h>
+#include <time.h>
+
+#include <algorithm>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+#include <fruit/fruit.h>
+
+#include "cvd_server.pb.h"
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/environment.h"
+#include "common/libs/utils/files.h"
+#include "common/libs/utils/flag_parser.h"
+#include "common/libs/utils/result.h"
+#include "common/libs/utils/subprocess.h"
+#include "host/commands/cvd/server.h"
+#include "host/libs/config/cuttlefish_config.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr char kPartialSuffix[] = ".partial";
+
+std::string PrefetchDirectory() {
+  return StringFromEnv("XDG_CACHE_HOME",
+                       StringFromEnv("HOME", ".") + "/.cache") +
+         "/cuttlefish/prefetch";
+}
+
+std::string BuildDirectory(const std::string& build) {
+  auto parts = android::base::Split(build, "/");
+  return PrefetchDirectory() + "/" + parts[0] + "_" + parts[1];
+}
+
+Command FetchCommand(const std::map<std::string, std::string>& env,
+                     const std::vector<std::string>& args) {
+  Command command(HostBinaryPath("fetch_cvd"));
+  for (const auto& arg : args) {
+    command.AddParameter(arg);
+  }
+  for (const auto& [name, value] : env) {
+    command.UnsetFromEnvironment(name);
+    command.AddEnvironmentVariable(name, value);
+  }
+  return command;
+}
+
+}  // namespace
+
+BuildPrefetcher::BuildPrefetcher() : thread_([this]() { Loop(); }) {}
+
+BuildPrefetcher::~BuildPrefetcher() {
+  {
+    std::lock_guard lock(mutex_);
+    stopping_ = true;
+    if (fetch_pid_ > 0) {
+      kill(fetch_pid_, SIGKILL);
+    }
+  }
+  wake_.notify_all();
+  thread_.join();
+}
+
+Result<void> BuildPrefetcher::Configure(const cvd::CommandRequest& request,
+                                        Policy policy) {
+  for (const auto& build : policy.builds) {
+    auto parts = android::base::Split(build, "/");
+    CF_EXPECT(parts.size() == 2 && !parts[0].empty() && !parts[1].empty(),
+              "\"" << build << "\" is not of the form branch/target");
+  }
+  CF_EXPECT(policy.retention >= 1, "At least one build has to be kept");
+  CF_EXPECT(policy.off_peak_begin >= 0 && policy.off_peak_begin < 24 &&
+                policy.off_peak_end >= 0 && policy.off_peak_end < 24,
+            "Off peak hours must be between 0 and 23");
+  CF_EXPECT(policy.interval.count() > 0, "The interval must be positive");
+  {
+    std::lock_guard lock(mutex_);
+    policy_ = std::move(policy);
+    env_ = std::map<std::string, std::string>(request.env().begin(),
+                                              request.env().end());
+    reconfigured_ = true;
+  }
+  wake_.notify_all();
+  return {};
+}
+
+std::string BuildPrefetcher::Status() {
+  std::lock_guard lock(mutex_);
+  std::stringstream status;
+  if (policy_.builds.empty()) {
+    status << "Not prefetching any builds\n";
+    return status.str();
+  }
+  status << "Prefetching into \"" << PrefetchDirectory() << "\", keeping "
+         << policy_.retention << " builds each";
+  if (policy_.rate_limit > 0) {
+    status << " at up to " << policy_.rate_limit << " KiB/s";
+  }
+  if (policy_.off_peak_begin != policy_.off_peak_end) {
+    status << " between " << policy_.off_peak_begin << ":00 and "
+           << policy_.off_peak_end << ":00";
+  }
+  auto next = std::chrono::system_clock::to_time_t(next_check_);
+  std::tm next_tm;
+  localtime_r(&next, &next_tm);
+  status << ", next check at " << std::put_time(&next_tm, "%H:%M") << "\n";
+  for (const auto& build : policy_.builds) {
+    auto it = results_.find(build);
+    status << build << ": "
+           << (it == results_.end() ? "not checked yet" : it->second) << "\n";
+  }
+  return status.str();
+}
+
+std::map<std::string, std::vector<std::string>>
+BuildPrefetcher::FetchedBuilds() {
+  std::vector<std::string> builds;
+  {
+    std::lock_guard lock(mutex_);
+    builds = policy_.builds;
+  }
+  std::map<std::string, std::vector<std::string>> fetched;
+  for (const auto& build : builds) {
+    auto directory = BuildDirectory(build);
+    auto& build_directories = fetched[build];
+    for (const auto& name : DirectoryContents(directory)) {
+      auto path = directory + "/" + name;
+      if (name != "." && name != ".." &&
+          !android::base::EndsWith(name, kPartialSuffix) &&
+          DirectoryExists(path)) {
+        build_directories.push_back(path);
+      }
+    }
+  }
+  return fetched;
+}
+
+void BuildPrefetcher::Loop() {
+  std::unique_lock lock(mutex_);
+  while (!stopping_) {
+    reconfigured_ = false;
+    if (policy_.builds.empty()) {
+      wake_.wait(lock, [this]() { return stopping_ || reconfigured_; });
+      continue;
+    }
+    auto policy = policy_;
+    auto env = env_;
+    next_check_ = std::chrono::system_clock::now() + policy.interval;
+    if (InOffPeakWindow(policy)) {
+      for (const auto& build : policy.builds) {
+        if (stopping_ || reconfigured_) {
+          break;
+        }
+        lock.unlock();
+        auto result = Prefetch(build, policy, env);
+        lock.lock();
+        if (result.ok()) {
+          results_[build] = *result;
+        } else {
+          LOG(ERROR) << "Could not prefetch " << build << ":\n"
+                     << result.error();
+          results_[build] = "failed, see the server log";
+        }
+      }
+    }
+    wake_.wait_until(lock, next_check_,
+                     [this]() { return stopping_ || reconfigured_; });
+  }
+}
+
+bool BuildPrefetcher::InOffPeakWindow(const Policy& policy) const {
+  if (policy.off_peak_begin == policy.off_peak_end) {
+    return true;
+  }
+  auto now = std::time(nullptr);
+  std::tm now_tm;
+  localtime_r(&now, &now_tm);
+  int hour = now_tm.tm_hour;
+  if (policy.off_peak_begin < policy.off_peak_end) {
+    return hour >= policy.off_peak_begin && hour < policy.off_peak_end;
+  }
+  // The window spans midnight
+  return hour >= policy.off_peak_begin || hour < policy.off_peak_end;
+}
+
+Result<std::string> BuildPrefetcher::Prefetch(
+    const std::string& build, const Policy& policy,
+    const std::map<std::string, std::string>& env) {
+  auto parts = android::base::Split(build, "/");
+  const auto& target = parts[1];
+
+  // Only the latest complete build is of interest, don't wait for others
+  std::string build_id;
+  std::string resolve_err;
+  auto resolve = FetchCommand(env, {"--default_build=" + build,
+                                    "--wait_retry_period=0",
+                                    "--print_build_id"});
+  int exit_code = RunWithManagedStdio(std::move(resolve), nullptr, &build_id,
+                                      &resolve_err);
+  build_id = android::base::Trim(build_id);
+  CF_EXPECT(exit_code == 0 && !build_id.empty(),
+            "Could not find the latest build of " << build << ":\n"
+                                                  << resolve_err);
+
+  auto directory = BuildDirectory(build);
+  auto build_directory = directory + "/" + build_id;
+  if (DirectoryExists(build_directory)) {
+    return "build " + build_id + " is the latest, fetched already";
+  }
+  auto partial = build_directory + kPartialSuffix;
+  if (DirectoryExists(partial)) {
+    RecursivelyRemoveDirectory(partial);
+  }
+  CF_EXPECT(EnsureDirectoryExists(partial));
+
+  auto log_path = directory + "/fetch.log";
+  auto log = SharedFD::Open(log_path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  CF_EXPECT(log->IsOpen(), "Could not open \"" << log_path
+                                               << "\": " << log->StrError());
+  auto fetch = FetchCommand(
+      env, {"--default_build=" + build_id + "/" + target,
+            "--directory=" + partial,
+            "--download_rate_limit=" + std::to_string(policy.rate_limit)});
+  fetch.RedirectStdIO(Subprocess::StdIOChannel::kStdOut, log);
+  fetch.RedirectStdIO(Subprocess::StdIOChannel::kStdErr, log);
+  LOG(INFO) << "Prefetching build " << build_id << " of " << build;
+  {
+    std::unique_lock lock(mutex_);
+    CF_EXPECT(!stopping_, "The server is stopping");
+    auto subprocess = fetch.Start();
+    CF_EXPECT(subprocess.Started(), "Could not start fetch_cvd");
+    // The pid stays reserved until it's waited for, so the destructor can
+    // kill it meanwhile.
+    fetch_pid_ = subprocess.pid();
+    lock.unlock();
+    exit_code = subprocess.Wait();
+    lock.lock();
+    fetch_pid_ = -1;
+  }
+  if (exit_code != 0) {
+    RecursivelyRemoveDirectory(partial);
+    return CF_ERR("Fetching build " << build_id << " failed, see \""
+                                    << log_path << "\"");
+  }
+  CF_EXPECT(RenameFile(partial, build_directory));
+  Trim(directory, policy.retention);
+  return "fetched build " + build_id + " into \"" + build_directory + "\"";
+}
+
+void BuildPrefetcher::Trim(const std::string& directory, int retention) {
+  std::vector<std::string> builds;
+  for (const auto& name : DirectoryContents(directory)) {
+    auto path = directory + "/" + name;
+    if (name != "." && name != ".." &&
+        !android::base::EndsWith(name, kPartialSuffix) &&
+        DirectoryExists(path)) {
+      builds.push_back(path);
+    }
+  }
+  // Newest first
+  std::sort(builds.begin(), builds.end(),
+            [](const std::string& a, const std::string& b) {
+              return FileModificationTime(a) > FileModificationTime(b);
+            });
+  for (size_t i = retention; i < builds.size(); i++) {
+    LOG(INFO) << "Removing prefetched build \"" << builds[i] << "\"";
+    RecursivelyRemoveDirectory(builds[i]);
+  }
+}
+
+namespace {
+
+class PrefetchCommand : public CvdServerHandler {
+ public:
+  INJECT(PrefetchCommand(BuildPrefetcher& prefetcher))
+      : prefetcher_(prefetcher) {}
+  ~PrefetchCommand() = default;
+
+  Result<bool> CanHandle(const RequestWithStdio& request) const override {
+    return ParseInvocation(request.Message()).command == "prefetch";
+  }
+  Result<cvd::Response> Handle(const RequestWithStdio& request) override {
+    CF_EXPECT(CanHandle(request));
+    auto args = ParseInvocation(request.Message()).arguments;
+    if (!args.empty()) {
+      std::string builds;
+      std::int32_t retention = 1;
+      std::int32_t rate_limit = 0;
+      std::string off_peak;
+      std::int32_t interval = 30;
+      CF_EXPECT(ParseFlags({GflagsCompatFlag("builds", builds),
+                            GflagsCompatFlag("retention", retention),
+                            GflagsCompatFlag("rate_limit", rate_limit),
+                            GflagsCompatFlag("off_peak_hours", off_peak),
+                            GflagsCompatFlag("interval_minutes", interval)},
+                           args));
+      CF_EXPECT(args.empty(), "Unexpected arguments: "
+                                  << android::base::Join(args, " "));
+      CF_EXPECT(rate_limit >= 0, "The rate limit can't be negative");
+      BuildPrefetcher::Policy policy;
+      if (!builds.empty()) {
+        policy.builds = android::base::Split(builds, ",");
+      }
+      policy.retention = retention;
+      policy.rate_limit = rate_limit;
+      policy.interval = std::chrono::minutes(interval);
+      if (!off_peak.empty()) {
+        auto hours = android::base::Split(off_peak, "-");
+        CF_EXPECT(hours.size() == 2 &&
+                      android::base::ParseInt(hours[0],
+                                              &policy.off_peak_begin) &&
+                      android::base::ParseInt(hours[1], &policy.off_peak_end),
+                  "--off_peak_hours should look like 22-6");
+      }
+      CF_EXPECT(prefetcher_.Configure(request.Message().command_request(),
+                                      std::move(policy)));
+    }
+    WriteAll(request.Out(), prefetcher_.Status());
+
+    cvd::Response response;
+    response.mutable_command_response();
+    response.mutable_status()->set_code(cvd::Status::OK);
+    return response;
+  }
+  Result<void> Interrupt() override { return CF_ERR("Can't be interrupted."); }
+
+ private:
+  BuildPrefetcher& prefetcher_;
+};
+
+}  // namespace
+
+fruit::Component<fruit::Required<BuildPrefetcher>> buildPrefetcherComponent() {
+  return fruit::createComponent()
+      .addMultibinding<CvdServerHandler, PrefetchCommand>();
+}
+
+}  // namespace cuttlefish
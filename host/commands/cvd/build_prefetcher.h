@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fruit/fruit.h>
+
+#include "cvd_server.pb.h"
+
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+// Fetches the latest builds of some branches and targets while the server is
+// otherwise idle, so their artifacts are in the host artifact cache before a
+// `cvd fetch` asks for them. Every new build is fetched into its own
+// directory, of which the most recent ones are kept.
+class BuildPrefetcher {
+ public:
+  struct Policy {
+    // "branch/target" of each build to follow
+    std::vector<std::string> builds;
+    // Fetched builds kept for each of them
+    int retention = 1;
+    // Cap on the download rate in KiB/s, 0 for none
+    std::uint64_t rate_limit = 0;
+    // Hours of the local day in [begin, end) when fetching may start, any
+    // hour when they are equal.
+    int off_peak_begin = 0;
+    int off_peak_end = 0;
+    // Time between checks for new builds
+    std::chrono::minutes interval{30};
+  };
+
+  INJECT(BuildPrefetcher());
+  ~BuildPrefetcher();
+
+  // Replaces the policy, running fetch_cvd with the environment of `request`.
+  // No builds stops prefetching.
+  Result<void> Configure(const cvd::CommandRequest& request, Policy policy);
+
+  std::string Status();
+  // The directories of the fetched builds of every followed "branch/target",
+  // each named after the build id.
+  std::map<std::string, std::vector<std::string>> FetchedBuilds();
+
+ private:
+  void Loop();
+  bool InOffPeakWindow(const Policy& policy) const;
+  // Returns what was done
+  Result<std::string> Prefetch(const std::string& build, const Policy& policy,
+                               const std::map<std::string, std::string>& env);
+  void Trim(const std::string& directory, int retention);
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stopping_ = false;
+  bool reconfigured_ = false;
+  Policy policy_;
+  std::map<std::string, std::string> env_;
+  // What happened in the last attempt for each build
+  std::map<std::string, std::string> results_;
+  std::chrono::system_clock::time_point next_check_;
+  pid_t fetch_pid_ = -1;
+  std::thread thread_;
+};
+
+}  // namespace cuttlefish
@@ -0,0 +1,420 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <tuple>
+
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+#include <fruit/fruit.h>
+#include <json/json.h>
+
+#include "cvd_server.pb.h"
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/utils/environment.h"
+#include "common/libs/utils/files.h"
+#include "common/libs/utils/flag_parser.h"
+#include "common/libs/utils/result.h"
+#include "host/commands/cvd/build_prefetcher.h"
+#include "host/commands/cvd/instance_manager.h"
+#include "host/commands/cvd/server.h"
+#include "host/commands/cvd/warm_pool.h"
+
+namespace cuttlefish {
+namespace {
+
+// Reads a "<name>: <value> kB" line of /proc/meminfo
+std::int64_t MemInfoMb(const std::string& meminfo, const std::string& name) {
+  for (const auto& line : android::base::Split(meminfo, "\n")) {
+    if (!android::base::StartsWith(line, name + ":")) {
+      continue;
+    }
+    auto fields = android::base::Tokenize(line.substr(name.size() + 1), " ");
+    std::int64_t kb = 0;
+    if (!fields.empty() && android::base::ParseInt(fields[0], &kb)) {
+      return kb / 1024;
+    }
+  }
+  return 0;
+}
+
+double LoadAverage() {
+  double load = 0;
+  std::istringstream(ReadFile("/proc/loadavg")) >> load;
+  return load;
+}
+
+int RenderNodeCount() {
+  int count = 0;
+  for (const auto& name : DirectoryContents("/dev/dri")) {
+    if (android::base::StartsWith(name, "renderD")) {
+      count++;
+    }
+  }
+  return count;
+}
+
+Json::Value ToJsonArray(const std::vector<std::string>& values) {
+  Json::Value array(Json::arrayValue);
+  for (const auto& value : values) {
+    array.append(value);
+  }
+  return array;
+}
+
+// What a host can take, as reported by `cvd capacity`. The fields of the
+// report are read back by `cvd place`.
+class CapacityCommand : public CvdServerHandler {
+ public:
+  INJECT(CapacityCommand(InstanceManager& instance_manager,
+                         WarmPool& warm_pool, BuildPrefetcher& prefetcher))
+      : instance_manager_(instance_manager),
+        warm_pool_(warm_pool),
+        prefetcher_(prefetcher) {}
+  ~CapacityCommand() = default;
+
+  Result<bool> CanHandle(const RequestWithStdio& request) const override {
+    return ParseInvocation(request.Message()).command == "capacity";
+  }
+  Result<cvd::Response> Handle(const RequestWithStdio& request) override {
+    CF_EXPECT(CanHandle(request));
+    auto args = ParseInvocation(request.Message()).arguments;
+    CF_EXPECT(args.empty(),
+              "Unexpected arguments: " << android::base::Join(args, " "));
+    WriteAll(request.Out(), Json::writeString(Json::StreamWriterBuilder(),
+                                              Report(request)) +
+                                "\n");
+
+    cvd::Response response;
+    response.mutable_command_response();
+    response.mutable_status()->set_code(cvd::Status::OK);
+    return response;
+  }
+  Result<void> Interrupt() override { return CF_ERR("Can't be interrupted."); }
+
+ private:
+  Json::Value Report(const RequestWithStdio& request) {
+    Json::Value report;
+    char hostname[256] = {};
+    gethostname(hostname, sizeof(hostname) - 1);
+    report["host"] = hostname;
+
+    auto cpus = std::thread::hardware_concurrency();
+    report["cpus"] = cpus;
+    report["cpus_available"] = std::max(0.0, cpus - LoadAverage());
+    auto meminfo = ReadFile("/proc/meminfo");
+    report["memory_mb"] = Json::Int64(MemInfoMb(meminfo, "MemTotal"));
+    report["memory_mb_available"] =
+        Json::Int64(MemInfoMb(meminfo, "MemAvailable"));
+    // Instances are created in the client's home directory
+    const auto& env = request.Message().command_request().env();
+    auto home = env.count("HOME") ? env.at("HOME") : StringFromEnv("HOME", "/");
+    struct statvfs disk;
+    if (statvfs(home.c_str(), &disk) == 0) {
+      report["disk_gb_available"] =
+          Json::UInt64(disk.f_bavail * disk.f_frsize >> 30);
+    } else {
+      report["disk_gb_available"] = 0;
+    }
+    report["gpus"] = RenderNodeCount();
+
+    int instances = 0;
+    for (const auto& status : instance_manager_.InstanceStatuses()) {
+      if (status.state() == cvd::InstanceStatus::STATE_BOOTING ||
+          status.state() == cvd::InstanceStatus::STATE_RUNNING) {
+        instances++;
+      }
+    }
+    report["instances"] = instances;
+
+    Json::Value cached_builds(Json::objectValue);
+    auto fetched = prefetcher_.FetchedBuilds();
+    for (const auto& [build, directories] : fetched) {
+      std::vector<std::string> ids;
+      for (const auto& directory : directories) {
+        ids.push_back(cpp_basename(directory));
+      }
+      cached_builds[build] = ToJsonArray(ids);
+    }
+    report["cached_builds"] = cached_builds;
+
+    Json::Value warm_pools(Json::arrayValue);
+    for (const auto& pool : warm_pool_.Pools()) {
+      Json::Value pool_json;
+      pool_json["product_out"] = pool.product_out;
+      pool_json["launch_args"] = ToJsonArray(pool.launch_args);
+      // Pools of prefetched builds can be found by their build
+      pool_json["build"] = "";
+      pool_json["build_id"] = "";
+      for (const auto& [build, directories] : fetched) {
+        for (const auto& directory : directories) {
+          if (android::base::StartsWith(pool.product_out, directory + "/") ||
+              pool.product_out == directory) {
+            pool_json["build"] = build;
+            pool_json["build_id"] = cpp_basename(directory);
+          }
+        }
+      }
+      pool_json["size"] = Json::UInt64(pool.size);
+      pool_json["idle"] = Json::UInt64(pool.idle);
+      pool_json["booting"] = Json::UInt64(pool.starting);
+      warm_pools.append(pool_json);
+    }
+    report["warm_pools"] = warm_pools;
+    return report;
+  }
+
+  InstanceManager& instance_manager_;
+  WarmPool& warm_pool_;
+  BuildPrefetcher& prefetcher_;
+};
+
+struct Demand {
+  std::string build;
+  double cpus;
+  std::int64_t memory_mb;
+  std::int64_t disk_gb;
+  bool gpu;
+};
+
+// Lower is better
+enum class Preference {
+  kWarmInstance = 0,
+  kCachedBuild = 1,
+  kCapacity = 2,
+};
+
+struct Candidate {
+  std::string host;
+  Preference preference;
+  // Memory left after the placement, hosts with less are filled first
+  std::int64_t memory_mb_left;
+  double cpus_left;
+};
+
+// Returns why the host can't take the instance, if it can't
+std::optional<std::string> Misfit(const Json::Value& report,
+                                  const Demand& demand) {
+  if (report["cpus_available"].asDouble() < demand.cpus) {
+    return "not enough CPUs";
+  }
+  if (report["memory_mb_available"].asInt64() < demand.memory_mb) {
+    return "not enough memory";
+  }
+  if (report["disk_gb_available"].asInt64() < demand.disk_gb) {
+    return "not enough disk space";
+  }
+  if (demand.gpu && report["gpus"].asInt() == 0) {
+    return "no GPU";
+  }
+  return {};
+}
+
+// Whether the fetched build `id` of `build`, a "branch/target", is the one
+// demanded as either "branch/target" or "id/target"
+bool IsDemandedBuild(const std::string& build, const std::string& id,
+                     const std::string& demanded) {
+  if (build == demanded) {
+    return true;
+  }
+  auto slash = build.find('/');
+  return !id.empty() && slash != std::string::npos &&
+         id + build.substr(slash) == demanded;
+}
+
+Preference PreferenceFor(const Json::Value& report, const Demand& demand) {
+  if (demand.build.empty()) {
+    return Preference::kCapacity;
+  }
+  for (const auto& pool : report["warm_pools"]) {
+    if (pool["idle"].asUInt64() > 0 &&
+        IsDemandedBuild(pool["build"].asString(), pool["build_id"].asString(),
+                        demand.build)) {
+      return Preference::kWarmInstance;
+    }
+  }
+  // A build id is as good as its branch for the cache
+  const auto& cached = report["cached_builds"];
+  for (const auto& build : cached.getMemberNames()) {
+    if (build == demand.build) {
+      return Preference::kCachedBuild;
+    }
+    for (const auto& id : cached[build]) {
+      if (IsDemandedBuild(build, id.asString(), demand.build)) {
+        return Preference::kCachedBuild;
+      }
+    }
+  }
+  return Preference::kCapacity;
+}
+
+// Picks a host for an instance out of the `cvd capacity` reports of several
+// hosts. Hosts with an idle warm pool instance of the build come first, then
+// hosts with the build's artifacts fetched already, then the fullest host
+// that still fits the instance (best fit), which keeps whole hosts free for
+// large instances.
+class PlaceCommand : public CvdServerHandler {
+ public:
+  INJECT(PlaceCommand()) {}
+  ~PlaceCommand() = default;
+
+  Result<bool> CanHandle(const RequestWithStdio& request) const override {
+    return ParseInvocation(request.Message()).command == "place";
+  }
+  Result<cvd::Response> Handle(const RequestWithStdio& request) override {
+    CF_EXPECT(CanHandle(request));
+    auto args = ParseInvocation(request.Message()).arguments;
+    std::string reports;
+    Demand demand;
+    std::int32_t cpus = 2;
+    std::int32_t memory_mb = 2048;
+    std::int32_t disk_gb = 0;
+    demand.gpu = false;
+    CF_EXPECT(ParseFlags({GflagsCompatFlag("reports", reports),
+                          GflagsCompatFlag("build", demand.build),
+                          GflagsCompatFlag("cpus", cpus),
+                          GflagsCompatFlag("memory_mb", memory_mb),
+                          GflagsCompatFlag("disk_gb", disk_gb),
+                          GflagsCompatFlag("gpu", demand.gpu)},
+                         args));
+    CF_EXPECT(args.empty(),
+              "Unexpected arguments: " << android::base::Join(args, " "));
+    CF_EXPECT(!reports.empty(), "--reports is required");
+    demand.cpus = cpus;
+    demand.memory_mb = memory_mb;
+    demand.disk_gb = disk_gb;
+
+    const auto& working_dir =
+        request.Message().command_request().working_directory();
+    std::vector<Candidate> candidates;
+    Json::Value rejected(Json::objectValue);
+    for (auto path : android::base::Split(reports, ",")) {
+      if (!android::base::StartsWith(path, "/")) {
+        path = working_dir + "/" + path;
+      }
+      auto report = CF_EXPECT(ReadReport(path));
+      auto host = report["host"].asString();
+      if (auto misfit = Misfit(report, demand); misfit) {
+        rejected[host] = *misfit;
+        continue;
+      }
+      candidates.push_back({
+          .host = host,
+          .preference = PreferenceFor(report, demand),
+          .memory_mb_left =
+              report["memory_mb_available"].asInt64() - demand.memory_mb,
+          .cpus_left = report["cpus_available"].asDouble() - demand.cpus,
+      });
+    }
+    CF_EXPECT(!candidates.empty(),
+              "No host can take the instance: "
+                  << Json::writeString(Json::StreamWriterBuilder(), rejected));
+    auto best = std::min_element(
+        candidates.begin(), candidates.end(),
+        [](const Candidate& a, const Candidate& b) {
+          return std::tie(a.preference, a.memory_mb_left, a.cpus_left) <
+                 std::tie(b.preference, b.memory_mb_left, b.cpus_left);
+        });
+
+    Json::Value placement;
+    placement["host"] = best->host;
+    switch (best->preference) {
+      case Preference::kWarmInstance:
+        placement["reason"] = "warm pool instance";
+        break;
+      case Preference::kCachedBuild:
+        placement["reason"] = "cached build";
+        break;
+      case Preference::kCapacity:
+        placement["reason"] = "best fit";
+        break;
+    }
+    placement["rejected"] = rejected;
+    WriteAll(request.Out(),
+             Json::writeString(Json::StreamWriterBuilder(), placement) + "\n");
+
+    cvd::Response response;
+    response.mutable_command_response();
+    response.mutable_status()->set_code(cvd::Status::OK);
+    return response;
+  }
+  Result<void> Interrupt() override { return CF_ERR("Can't be interrupted."); }
+
+ private:
+  static Result<Json::Value> ReadReport(const std::string& path) {
+    CF_EXPECT(FileExists(path), "\"" << path << "\" does not exist");
+    Json::Value report;
+    std::string errors;
+    auto contents = ReadFile(path);
+    std::unique_ptr<Json::CharReader> reader(
+        Json::CharReaderBuilder().newCharReader());
+    CF_EXPECT(reader->parse(contents.data(), contents.data() + contents.size(),
+                            &report, &errors),
+              "Could not parse \"" << path << "\": " << errors);
+    CF_EXPECT(report.isObject(), "\"" << path << "\" is not a JSON object");
+    CF_EXPECT(report["host"].isString(), "\"" << path
+                                              << "\" has no host name");
+    // Reports are files supplied by the user, the fields read by Misfit() and
+    // PreferenceFor() must not throw when converted.
+    CF_EXPECT(report["cpus_available"].isNumeric() &&
+                  report["memory_mb_available"].isInt64() &&
+                  report["disk_gb_available"].isInt64() &&
+                  report["gpus"].isInt(),
+              "\"" << path << "\" has invalid capacity fields");
+    const auto& cached = report["cached_builds"];
+    CF_EXPECT(cached.isNull() || cached.isObject(),
+              "\"" << path << "\" has invalid cached builds");
+    for (const auto& build : cached.getMemberNames()) {
+      CF_EXPECT(cached[build].isArray(),
+                "\"" << path << "\" has invalid cached builds");
+      for (const auto& id : cached[build]) {
+        CF_EXPECT(id.isString(),
+                  "\"" << path << "\" has invalid cached builds");
+      }
+    }
+    const auto& pools = report["warm_pools"];
+    CF_EXPECT(pools.isNull() || pools.isArray(),
+              "\"" << path << "\" has invalid warm pools");
+    for (const auto& pool : pools) {
+      CF_EXPECT(pool.isObject() && pool["build"].isString() &&
+                    (pool["build_id"].isNull() ||
+                     pool["build_id"].isString()) &&
+                    pool["idle"].isUInt64(),
+                "\"" << path << "\" has invalid warm pools");
+    }
+    return report;
+  }
+};
+
+}  // namespace
+
+fruit::Component<fruit::Required<InstanceManager, WarmPool, BuildPrefetcher>>
+clusterComponent() {
+  return fruit::createComponent()
+      .addMultibinding<CvdServerHandler, CapacityCommand>()
+      .addMultibinding<CvdServerHandler, PlaceCommand>();
+}
+
+}  // namespace cuttlefish
@@ -15,9 +15,14 @@
 
 #include "host/commands/cvd/command_sequence.h"
 
+#include <condition_variable>
+#include <optional>
+#include <thread>
+
 #include <fruit/fruit.h>
 
 #include "common/libs/fs/shared_buf.h"
+#include "host/commands/cvd/scope_guard.h"
 #include "host/commands/cvd/server.h"
 #include "host/commands/cvd/server_client.h"
 
@@ -62,40 +67,141 @@ std::string FormattedCommand(const cvd::CommandRequest command) {
 }  // namespace
 
 CommandSequenceExecutor::CommandSequenceExecutor(
-    CvdCommandHandler& inner_handler)
-    : inner_handler_(inner_handler) {}
+    InstanceManager& instance_manager, WarmPool& warm_pool)
+    : instance_manager_(instance_manager), warm_pool_(warm_pool) {}
 
 Result<void> CommandSequenceExecutor::Interrupt() {
-  CF_EXPECT(inner_handler_.Interrupt());
+  std::scoped_lock interrupt_lock(interrupt_mutex_);
+  interrupted_ = true;
+  for (auto handler : running_handlers_) {
+    CF_EXPECT(handler->Interrupt());
+  }
   return {};
 }
 
 Result<void> CommandSequenceExecutor::Execute(
     const std::vector<RequestWithStdio>& requests, SharedFD report) {
-  std::unique_lock interrupt_lock(interrupt_mutex_);
-  if (interrupted_) {
-    return CF_ERR("Interrupted");
-  }
+  std::vector<SequencedRequest> sequence;
   for (const auto& request : requests) {
-    auto& inner_proto = request.Message();
-    CF_EXPECT(inner_proto.has_command_request());
-    auto& command = inner_proto.command_request();
-    std::string str = FormattedCommand(command);
-    CF_EXPECT(WriteAll(report, str) == str.size(), report->StrError());
+    std::vector<size_t> depends_on;
+    if (!sequence.empty()) {
+      depends_on.push_back(sequence.size() - 1);
+    }
+    sequence.push_back(SequencedRequest{request, std::move(depends_on)});
+  }
+  CF_EXPECT(Execute(sequence, report));
+  return {};
+}
+
+Result<void> CommandSequenceExecutor::Execute(
+    const std::vector<SequencedRequest>& requests, SharedFD report) {
+  for (size_t i = 0; i < requests.size(); i++) {
+    CF_EXPECT(requests[i].request.Message().has_command_request());
+    for (auto dependency : requests[i].depends_on) {
+      CF_EXPECT(dependency < i, "Request " << i << " depends on request "
+                                           << dependency << " after it");
+    }
+  }
+
+  enum class State { kPending, kRunning, kDone };
+  std::vector<State> states(requests.size(), State::kPending);
+  std::mutex state_mutex;
+  std::condition_variable state_changed;
+  size_t running = 0;
+  std::optional<Result<void>> failure;
+  std::vector<std::thread> threads;
+
+  std::unique_lock state_lock(state_mutex);
+  while (true) {
+    bool interrupted;
+    {
+      std::scoped_lock interrupt_lock(interrupt_mutex_);
+      interrupted = interrupted_;
+    }
+    if (interrupted && !failure) {
+      failure = CF_ERR("Interrupted");
+    }
+    size_t remaining = 0;
+    for (size_t i = 0; i < requests.size() && !failure; i++) {
+      if (states[i] != State::kPending) {
+        continue;
+      }
+      remaining++;
+      bool ready = true;
+      for (auto dependency : requests[i].depends_on) {
+        ready &= states[dependency] == State::kDone;
+      }
+      if (!ready) {
+        continue;
+      }
+      states[i] = State::kRunning;
+      running++;
+      auto label = "[" + std::to_string(i + 1) + "/" +
+                   std::to_string(requests.size()) + "] ";
+      threads.emplace_back([this, &requests, &states, &state_mutex,
+                            &state_changed, &running, &failure, report, i,
+                            label]() {
+        auto result = ExecuteOne(requests[i].request, label, report);
+        std::scoped_lock lock(state_mutex);
+        running--;
+        if (result.ok()) {
+          states[i] = State::kDone;
+        } else if (!failure) {
+          failure = std::move(result);
+        }
+        state_changed.notify_all();
+      });
+    }
+    if (running == 0 && (failure || remaining == 0)) {
+      break;
+    }
+    state_changed.wait(state_lock);
+  }
+  state_lock.unlock();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  if (failure) {
+    CF_EXPECT(std::move(*failure));
+  }
+  return {};
+}
 
-    interrupt_lock.unlock();
-    auto response = CF_EXPECT(inner_handler_.Handle(request));
-    interrupt_lock.lock();
+Result<void> CommandSequenceExecutor::ExecuteOne(
+    const RequestWithStdio& request, const std::string& label,
+    SharedFD report) {
+  // Every request gets its own handler, a handler only tracks one subprocess
+  CvdCommandHandler handler(instance_manager_, warm_pool_);
+  {
+    std::scoped_lock interrupt_lock(interrupt_mutex_);
     if (interrupted_) {
       return CF_ERR("Interrupted");
     }
-    CF_EXPECT(response.status().code() == cvd::Status::OK,
-              "Reason: \"" << response.status().message() << "\"");
+    running_handlers_.insert(&handler);
+  }
+  ScopeGuard remove_handler([this, &handler]() {
+    std::scoped_lock interrupt_lock(interrupt_mutex_);
+    running_handlers_.erase(&handler);
+  });
+  {
+    std::scoped_lock report_lock(report_mutex_);
+    auto str = label + FormattedCommand(request.Message().command_request());
+    CF_EXPECT(WriteAll(report, str) == str.size(), report->StrError());
+  }
 
-    static const char kDoneMsg[] = "Done\n";
-    CF_EXPECT(WriteAll(request.Err(), kDoneMsg) == sizeof(kDoneMsg) - 1,
-              request.Err()->StrError());
+  auto response = CF_EXPECT(handler.Handle(request));
+  {
+    std::scoped_lock interrupt_lock(interrupt_mutex_);
+    if (interrupted_) {
+      return CF_ERR("Interrupted");
+    }
   }
+  CF_EXPECT(response.status().code() == cvd::Status::OK,
+            "Reason: \"" << response.status().message() << "\"");
+
+  auto done = label + "Done\n";
+  CF_EXPECT(WriteAll(request.Err(), done) == done.size(),
+            request.Err()->StrError());
   return {};
 }
 
@@ -15,27 +15,52 @@
 
 #pragma once
 
+#include <memory>
+#include <mutex>
+#include <set>
 #include <vector>
 
 #include <fruit/fruit.h>
 
 #include "common/libs/fs/shared_fd.h"
+#include "host/commands/cvd/instance_manager.h"
 #include "host/commands/cvd/server.h"
 #include "host/commands/cvd/server_client.h"
+#include "host/commands/cvd/warm_pool.h"
 
 namespace cuttlefish {
 
+// A request in a sequence, with the indices of the earlier requests in the
+// same sequence that have to succeed before it can start.
+struct SequencedRequest {
+  RequestWithStdio request;
+  std::vector<size_t> depends_on;
+};
+
 class CommandSequenceExecutor {
  public:
-  INJECT(CommandSequenceExecutor(CvdCommandHandler& inner_handler));
+  INJECT(CommandSequenceExecutor(InstanceManager& instance_manager,
+                                 WarmPool& warm_pool));
 
   Result<void> Interrupt();
+  // Runs every request once all of its dependencies have succeeded, so
+  // independent requests run concurrently. Stops starting new requests after
+  // the first failure, and returns once the running ones are done.
+  Result<void> Execute(const std::vector<SequencedRequest>&, SharedFD report);
+  // Runs the requests one after another.
   Result<void> Execute(const std::vector<RequestWithStdio>&, SharedFD report);
 
  private:
+  Result<void> ExecuteOne(const RequestWithStdio&, const std::string& label,
+                          SharedFD report);
+
+  InstanceManager& instance_manager_;
+  WarmPool& warm_pool_;
   std::mutex interrupt_mutex_;
   bool interrupted_ = false;
-  CvdCommandHandler& inner_handler_;
+  // The handlers of the requests currently running
+  std::set<CvdCommandHandler*> running_handlers_;
+  std::mutex report_mutex_;
 };
 
 }  // namespace cuttlefish
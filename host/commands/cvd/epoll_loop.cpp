@@ -16,6 +16,12 @@
 
 #include "host/commands/cvd/epoll_loop.h"
 
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
 #include <android-base/errors.h>
 
 #include "common/libs/fs/epoll.h"
@@ -26,38 +32,46 @@ namespace cuttlefish {
 
 EpollPool::EpollPool(Epoll epoll) : epoll_(std::move(epoll)) {}
 
-EpollPool::EpollPool(EpollPool&& other) {
-  std::unique_lock own_lock(instance_mutex_, std::defer_lock);
-  std::unique_lock other_lock(other.instance_mutex_, std::defer_lock);
-  std::unique_lock own_cb_lock(callbacks_mutex_, std::defer_lock);
-  std::unique_lock other_cb_lock(other.callbacks_mutex_, std::defer_lock);
-  std::lock(own_lock, other_lock, own_cb_lock, other_cb_lock);
-  epoll_ = std::move(other.epoll_);
-  callbacks_ = std::move(other.callbacks_);
-}
-
-EpollPool& EpollPool::operator=(EpollPool&& other) {
-  std::unique_lock own_lock(instance_mutex_, std::defer_lock);
-  std::unique_lock other_lock(other.instance_mutex_, std::defer_lock);
-  std::unique_lock own_cb_lock(callbacks_mutex_, std::defer_lock);
-  std::unique_lock other_cb_lock(other.callbacks_mutex_, std::defer_lock);
-  std::lock(own_lock, other_lock, own_cb_lock, other_cb_lock);
-  epoll_ = std::move(other.epoll_);
-  callbacks_ = std::move(other.callbacks_);
-
-  return *this;
+EpollPool::CallbackShard& EpollPool::ShardFor(const SharedFD& fd) {
+  return shards_[SharedFDHash()(fd) % kNumShards];
 }
 
 Result<void> EpollPool::Register(SharedFD fd, uint32_t events,
                                  EpollCallback callback) {
-  std::shared_lock instance_lock(instance_mutex_, std::defer_lock);
-  std::unique_lock callbacks_lock(callbacks_mutex_, std::defer_lock);
-  std::lock(instance_lock, callbacks_lock);
-  if (callbacks_.find(fd) != callbacks_.end()) {
+  auto& shard = ShardFor(fd);
+  std::lock_guard lock(shard.mutex);
+  if (shard.callbacks.find(fd) != shard.callbacks.end()) {
     return CF_ERR("Already have a callback created");
   }
   CF_EXPECT(epoll_.AddOrModify(fd, events | EPOLLONESHOT));
-  callbacks_[fd] = std::move(callback);
+  shard.callbacks[fd] = std::move(callback);
+  return {};
+}
+
+Result<void> EpollPool::RegisterTimer(std::chrono::milliseconds delay,
+                                      std::function<Result<void>()> callback) {
+  int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  CF_EXPECT(timer_fd >= 0, "timerfd_create failed: " << strerror(errno));
+  // A zero expiration would disarm the timer instead
+  auto nanos = std::max<int64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(delay).count(), 1);
+  struct itimerspec expiration = {};
+  expiration.it_value.tv_sec = nanos / 1000000000;
+  expiration.it_value.tv_nsec = nanos % 1000000000;
+  int set = timerfd_settime(timer_fd, 0, &expiration, nullptr);
+  int set_errno = errno;
+  auto timer = SharedFD::Dup(timer_fd);
+  close(timer_fd);
+  CF_EXPECT(set == 0, "timerfd_settime failed: " << strerror(set_errno));
+  CF_EXPECT(timer->IsOpen(), timer->StrError());
+
+  auto timer_cb = [this, callback](EpollEvent event) -> Result<void> {
+    // Closes the timer once the callback is done with it
+    CF_EXPECT(epoll_.Delete(event.fd));
+    CF_EXPECT(callback());
+    return {};
+  };
+  CF_EXPECT(Register(timer, EPOLLIN, std::move(timer_cb)));
   return {};
 }
 
@@ -68,29 +82,29 @@ Result<void> EpollPool::HandleEvent() {
   }
   EpollCallback callback;
   {
-    std::lock_guard lock(callbacks_mutex_);
-    auto it = callbacks_.find(event->fd);
-    CF_EXPECT(it != callbacks_.end(), "Could not find event callback");
+    auto& shard = ShardFor(event->fd);
+    std::lock_guard lock(shard.mutex);
+    auto it = shard.callbacks.find(event->fd);
+    CF_EXPECT(it != shard.callbacks.end(), "Could not find event callback");
     callback = std::move(it->second);
-    callbacks_.erase(it);
+    shard.callbacks.erase(it);
   }
   CF_EXPECT(callback(*event));
   return {};
 }
 
 Result<void> EpollPool::Remove(SharedFD fd) {
-  std::shared_lock instance_lock(instance_mutex_, std::defer_lock);
-  std::unique_lock callbacks_lock(callbacks_mutex_, std::defer_lock);
-  std::lock(instance_lock, callbacks_lock);
+  auto& shard = ShardFor(fd);
+  std::lock_guard lock(shard.mutex);
   CF_EXPECT(epoll_.Delete(fd), "No callback registered with epoll");
-  callbacks_.erase(fd);
+  shard.callbacks.erase(fd);
   return {};
 }
 
 fruit::Component<EpollPool> EpollLoopComponent() {
   return fruit::createComponent()
-      .registerProvider([]() -> EpollPool {
-        return EpollPool(OR_FATAL(Epoll::Create()));
+      .registerProvider([]() -> EpollPool* {
+        return new EpollPool(OR_FATAL(Epoll::Create()));
       });
 }
 
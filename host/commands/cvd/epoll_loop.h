@@ -14,9 +14,12 @@
  * limitations under the License.
  */
 
+#include <array>
+#include <chrono>
 #include <functional>
-#include <map>
+#include <memory>
 #include <mutex>
+#include <unordered_map>
 
 #include <fruit/fruit.h>
 
@@ -33,8 +36,6 @@ using EpollCallback = std::function<Result<void>(EpollEvent)>;
 class EpollPool {
  public:
   EpollPool(Epoll);
-  EpollPool(EpollPool&&);
-  EpollPool& operator=(EpollPool&&);
 
   /**
    * The `callback` function will be invoked with an EpollEvent containing `fd`
@@ -47,14 +48,38 @@ class EpollPool {
    * re-registered.
    */
   Result<void> Register(SharedFD fd, uint32_t events, EpollCallback callback);
+  /**
+   * Invokes `callback` once, from a caller of `HandleEvent`, after `delay` has
+   * elapsed. Errors returned by the callback manifest in `HandleEvent`.
+   */
+  Result<void> RegisterTimer(std::chrono::milliseconds delay,
+                             std::function<Result<void>()> callback);
+  /**
+   * Waits for one event and invokes its callback. Any number of threads may
+   * call this concurrently, each event is delivered to exactly one of them.
+   */
   Result<void> HandleEvent();
   Result<void> Remove(SharedFD fd);
 
  private:
-  std::shared_mutex instance_mutex_;
+  struct SharedFDHash {
+    std::size_t operator()(const SharedFD& fd) const {
+      return std::hash<FileInstance*>()(fd.operator->().get());
+    }
+  };
+  // The callbacks are split among several independently locked tables so
+  // that threads handling events for different file descriptors rarely wait
+  // for each other.
+  struct CallbackShard {
+    std::mutex mutex;
+    std::unordered_map<SharedFD, EpollCallback, SharedFDHash> callbacks;
+  };
+  static constexpr std::size_t kNumShards = 16;
+
+  CallbackShard& ShardFor(const SharedFD& fd);
+
   Epoll epoll_;
-  std::mutex callbacks_mutex_;
-  std::map<SharedFD, EpollCallback> callbacks_;
+  std::array<CallbackShard, kNumShards> shards_;
 };
 
 fruit::Component<EpollPool> EpollLoopComponent();
@@ -17,12 +17,15 @@
 #include "host/commands/cvd/instance_lock.h"
 
 #include <sys/file.h>
+#include <sys/mman.h>
 
 #include <algorithm>
+#include <cstdint>
 #include <sstream>
 #include <string>
 
 #include <android-base/file.h>
+#include <android-base/logging.h>
 #include <android-base/strings.h>
 #include <fruit/fruit.h>
 
@@ -33,6 +36,85 @@
 
 namespace cuttlefish {
 
+namespace {
+
+Result<std::string> LockFileDir() {
+  auto dir = TempDir() + "/acloud_cvd_temp";
+  CF_EXPECT(EnsureDirectoryExists(dir));
+  return dir;
+}
+
+/*
+ * A bitmap shared by every cvd process on the host, with a bit set for each
+ * instance number that was last seen in use. It lets concurrent callers of
+ * TryAcquireUnusedLock go straight to a free instance instead of locking and
+ * reading every lock file in turn.
+ *
+ * The bits are only hints: the lock files remain the source of truth, and a
+ * stale bit (e.g. left by a crashed process) is corrected by the slow path
+ * that probes every lock file.
+ */
+class InstanceAllocationHints {
+ public:
+  static constexpr int kNumInstances = 4096;
+
+  // Opens the bitmap and holds an exclusive lock on it until destroyed.
+  static Result<InstanceAllocationHints> Lock() {
+    auto path = CF_EXPECT(LockFileDir()) + "/instance-allocation-hints";
+    auto fd = SharedFD::Open(path, O_CREAT | O_RDWR, 0666);
+    CF_EXPECT(fd->IsOpen(), "open(\"" << path << "\"): " << fd->StrError());
+    CF_EXPECT(fd->Flock(LOCK_EX) == 0, fd->StrError());
+    // Extends a new file with zeroes, a no-op for an existing one
+    CF_EXPECT(fd->Truncate(kSize) == 0, fd->StrError());
+    auto map = fd->MMap(nullptr, kSize, PROT_READ | PROT_WRITE, MAP_SHARED, 0);
+    CF_EXPECT(static_cast<bool>(map),
+              "mmap(\"" << path << "\"): " << fd->StrError());
+    return InstanceAllocationHints(fd, std::move(map));
+  }
+
+  bool InUse(int num) const {
+    if (num < 0 || num >= kNumInstances) {
+      return false;
+    }
+    return Words()[num / 64] & (uint64_t{1} << (num % 64));
+  }
+
+  void Set(int num, bool in_use) {
+    if (num < 0 || num >= kNumInstances) {
+      return;
+    }
+    auto& word = Words()[num / 64];
+    auto bit = uint64_t{1} << (num % 64);
+    word = in_use ? (word | bit) : (word & ~bit);
+  }
+
+ private:
+  static constexpr size_t kSize = kNumInstances / 8;
+
+  InstanceAllocationHints(SharedFD fd, ScopedMMap map)
+      : fd_(fd), map_(std::move(map)) {}
+
+  uint64_t* Words() { return reinterpret_cast<uint64_t*>(map_.get()); }
+  const uint64_t* Words() const {
+    return reinterpret_cast<const uint64_t*>(map_.get());
+  }
+
+  SharedFD fd_;
+  ScopedMMap map_;
+};
+
+void UpdateAllocationHint(int instance_num, InUseState state) {
+  auto hints = InstanceAllocationHints::Lock();
+  if (!hints.ok()) {
+    LOG(DEBUG) << "Could not update the instance allocation hints: "
+               << hints.error();
+    return;
+  }
+  hints->Set(instance_num, state == InUseState::kInUse);
+}
+
+}  // namespace
+
 InstanceLockFile::InstanceLockFile(SharedFD fd, int instance_num)
     : fd_(fd), instance_num_(instance_num) {}
 
@@ -56,6 +138,7 @@ Result<void> InstanceLockFile::Status(InUseState state) {
   CF_EXPECT(fd_->LSeek(0, SEEK_SET) == 0, fd_->StrError());
   char state_char = static_cast<char>(state);
   CF_EXPECT(fd_->Write(&state_char, 1) == 1, fd_->StrError());
+  UpdateAllocationHint(instance_num_, state);
   return {};
 }
 
@@ -88,9 +171,8 @@ std::string TempDir() {
 
 static Result<SharedFD> OpenLockFile(int instance_num) {
   std::stringstream path;
-  path << TempDir() << "/acloud_cvd_temp/";
-  CF_EXPECT(EnsureDirectoryExists(path.str()));
-  path << "local-instance-" << instance_num << ".lock";
+  path << CF_EXPECT(LockFileDir()) << "/local-instance-" << instance_num
+       << ".lock";
   auto fd = SharedFD::Open(path.str(), O_CREAT | O_RDWR, 0666);
   CF_EXPECT(fd->IsOpen(), "open(\"" << path.str() << "\"): " << fd->StrError());
   return fd;
@@ -176,10 +258,33 @@ cvd-wtap-02:       0       0    0    0    0     0          0         0        0
 Result<std::optional<InstanceLockFile>>
 InstanceLockFileManager::TryAcquireUnusedLock() {
   auto nums = CF_EXPECT(AllInstanceNums());
-  for (const auto& num : nums) {
-    auto lock = CF_EXPECT(TryAcquireLock(num));
-    if (lock && CF_EXPECT(lock->Status()) == InUseState::kNotInUse) {
-      return std::move(*lock);
+  auto hints = InstanceAllocationHints::Lock();
+  if (!hints.ok()) {
+    LOG(DEBUG) << "Probing every instance, no allocation hints: "
+               << hints.error();
+  }
+  // The instances not known to be in use are tried first, then the others in
+  // case their hints are stale. Holding the hints lock serializes concurrent
+  // callers, so each usually succeeds with its first attempt.
+  for (bool hinted_in_use : {false, true}) {
+    if (hinted_in_use && !hints.ok()) {
+      break;
+    }
+    for (const auto& num : nums) {
+      if (hints.ok() && hints->InUse(num) != hinted_in_use) {
+        continue;
+      }
+      auto lock = CF_EXPECT(TryAcquireLock(num));
+      bool unused =
+          lock && CF_EXPECT(lock->Status()) == InUseState::kNotInUse;
+      if (hints.ok()) {
+        // Reserved for this caller until it releases the lock file or resets
+        // the state to kNotInUse
+        hints->Set(num, true);
+      }
+      if (unused) {
+        return std::move(*lock);
+      }
     }
   }
   return {};
@@ -16,6 +16,9 @@
 
 #include "host/commands/cvd/instance_manager.h"
 
+#include <errno.h>
+#include <signal.h>
+
 #include <map>
 #include <mutex>
 #include <optional>
@@ -23,7 +26,9 @@
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/strings.h>
 #include <fruit/fruit.h>
+#include <json/json.h>
 
 #include "cvd_server.pb.h"
 
@@ -69,8 +74,18 @@ void InstanceManager::SetInstanceGroup(
 
 void InstanceManager::RemoveInstanceGroup(
     const InstanceManager::InstanceGroupDir& dir) {
-  std::lock_guard assemblies_lock(instance_groups_mutex_);
-  instance_groups_.erase(dir);
+  {
+    std::lock_guard assemblies_lock(instance_groups_mutex_);
+    instance_groups_.erase(dir);
+  }
+  std::lock_guard statuses_lock(instance_statuses_mutex_);
+  for (auto it = instance_statuses_.begin(); it != instance_statuses_.end();) {
+    if (android::base::StartsWith(it->second.assembly_dir(), dir + "/")) {
+      it = instance_statuses_.erase(it);
+    } else {
+      it++;
+    }
+  }
 }
 
 Result<InstanceManager::InstanceGroupInfo> InstanceManager::GetInstanceGroup(
@@ -84,6 +99,81 @@ Result<InstanceManager::InstanceGroupInfo> InstanceManager::GetInstanceGroup(
   }
 }
 
+void InstanceManager::SetInstanceStatus(const cvd::InstanceStatus& status) {
+  std::lock_guard lock(instance_statuses_mutex_);
+  instance_statuses_[status.instance_dir()] = status;
+}
+
+std::vector<cvd::InstanceStatus> InstanceManager::InstanceStatuses() const {
+  std::vector<cvd::InstanceStatus> statuses;
+  std::lock_guard lock(instance_statuses_mutex_);
+  for (const auto& [instance_dir, status] : instance_statuses_) {
+    statuses.push_back(status);
+    auto& copy = statuses.back();
+    pid_t run_cvd = copy.run_cvd_pid();
+    bool exited = run_cvd > 0 && kill(run_cvd, 0) != 0 && errno == ESRCH;
+    if (exited && copy.state() != cvd::InstanceStatus::STATE_STOPPED) {
+      copy.set_state(cvd::InstanceStatus::STATE_STOPPED);
+      copy.clear_processes();
+      copy.clear_cgroups();
+      copy.clear_network();
+    }
+  }
+  return statuses;
+}
+
+cvd::Status InstanceManager::CvdFleetCached(const SharedFD& out) const {
+  Json::Value fleet(Json::arrayValue);
+  for (const auto& status : InstanceStatuses()) {
+    Json::Value instance;
+    instance["assembly_dir"] = status.assembly_dir();
+    instance["instance_name"] = status.instance_name();
+    instance["instance_dir"] = status.instance_dir();
+    instance["state"] = cvd::InstanceStatus::State_Name(status.state());
+    instance["boot_phase"] = status.boot_phase();
+    instance["run_cvd_pid"] = status.run_cvd_pid();
+    instance["update_time_ms"] = Json::Int64(status.update_time_ms());
+    Json::Value processes(Json::arrayValue);
+    for (const auto& process : status.processes()) {
+      Json::Value process_json;
+      process_json["name"] = process.name();
+      process_json["pid"] = process.pid();
+      process_json["restarts"] = process.restarts();
+      process_json["rss_kb"] = Json::Int64(process.rss_kb());
+      process_json["ksm_merging_kb"] = Json::Int64(process.ksm_merging_kb());
+      process_json["cpu_time_ms"] = Json::Int64(process.cpu_time_ms());
+      processes.append(process_json);
+    }
+    instance["processes"] = processes;
+    Json::Value cgroups(Json::arrayValue);
+    for (const auto& cgroup : status.cgroups()) {
+      Json::Value cgroup_json;
+      cgroup_json["group"] = cgroup.group();
+      cgroup_json["cpu_time_ms"] = Json::Int64(cgroup.cpu_time_ms());
+      cgroup_json["memory_bytes"] = Json::Int64(cgroup.memory_bytes());
+      cgroup_json["io_read_bytes"] = Json::Int64(cgroup.io_read_bytes());
+      cgroup_json["io_write_bytes"] = Json::Int64(cgroup.io_write_bytes());
+      cgroups.append(cgroup_json);
+    }
+    instance["cgroups"] = cgroups;
+    Json::Value network(Json::arrayValue);
+    for (const auto& interface : status.network()) {
+      Json::Value interface_json;
+      interface_json["interface"] = interface.interface();
+      interface_json["receive_bytes"] = Json::Int64(interface.receive_bytes());
+      interface_json["transmit_bytes"] =
+          Json::Int64(interface.transmit_bytes());
+      network.append(interface_json);
+    }
+    instance["network"] = network;
+    fleet.append(instance);
+  }
+  WriteAll(out, fleet.toStyledString());
+  cvd::Status status;
+  status.set_code(cvd::Status::OK);
+  return status;
+}
+
 cvd::Status InstanceManager::CvdFleet(const SharedFD& out,
                                       const std::string& env_config) const {
   std::lock_guard assemblies_lock(instance_groups_mutex_);
@@ -156,6 +246,10 @@ cvd::Status InstanceManager::CvdClear(const SharedFD& out,
   WriteAll(out, "Stopped all known instances\n");
 
   instance_groups_.clear();
+  {
+    std::lock_guard statuses_lock(instance_statuses_mutex_);
+    instance_statuses_.clear();
+  }
   status.set_code(cvd::Status::OK);
   return status;
 }
@@ -20,6 +20,7 @@
 #include <mutex>
 #include <optional>
 #include <string>
+#include <vector>
 
 #include <fruit/fruit.h>
 
@@ -31,6 +32,11 @@
 
 namespace cuttlefish {
 
+constexpr char kBenchBin[] = "bench_cvd";
+constexpr char kDisplayBin[] = "display_cvd";
+constexpr char kProfileBin[] = "profile_cvd";
+constexpr char kSnapshotBin[] = "snapshot_cvd";
+constexpr char kStartBin[] = "cvd_internal_start";
 constexpr char kStatusBin[] = "cvd_internal_status";
 constexpr char kStopBin[] = "cvd_internal_stop";
 
@@ -49,14 +55,26 @@ class InstanceManager {
   void RemoveInstanceGroup(const InstanceGroupDir&);
   Result<InstanceGroupInfo> GetInstanceGroup(const InstanceGroupDir&) const;
 
+  // Caches the last status pushed by the run_cvd of an instance.
+  void SetInstanceStatus(const cvd::InstanceStatus&);
+  // The cached status of every known instance. Instances whose run_cvd went
+  // away without reporting it are marked as stopped.
+  std::vector<cvd::InstanceStatus> InstanceStatuses() const;
+
   cvd::Status CvdClear(const SharedFD& out, const SharedFD& err);
   cvd::Status CvdFleet(const SharedFD& out, const std::string& envconfig) const;
+  // Like CvdFleet, but only prints the cached statuses.
+  cvd::Status CvdFleetCached(const SharedFD& out) const;
 
  private:
   InstanceLockFileManager& lock_manager_;
 
   mutable std::mutex instance_groups_mutex_;
   std::map<InstanceGroupDir, InstanceGroupInfo> instance_groups_;
+
+  mutable std::mutex instance_statuses_mutex_;
+  // Keyed by instance_dir
+  std::map<std::string, cvd::InstanceStatus> instance_statuses_;
 };
 
 std::optional<std::string> GetCuttlefishConfigPath(
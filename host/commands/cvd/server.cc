@@ -18,6 +18,7 @@
 
 #include <signal.h>
 
+#include <algorithm>
 #include <atomic>
 #include <future>
 #include <map>
@@ -48,37 +49,55 @@
 namespace cuttlefish {
 
 static fruit::Component<> RequestComponent(CvdServer* server,
-                                           InstanceManager* instance_manager) {
+                                           InstanceManager* instance_manager,
+                                           WarmPool* warm_pool,
+                                           BuildPrefetcher* prefetcher) {
   return fruit::createComponent()
       .bindInstance(*server)
       .bindInstance(*instance_manager)
+      .bindInstance(*warm_pool)
+      .bindInstance(*prefetcher)
       .install(AcloudCommandComponent)
+      .install(buildPrefetcherComponent)
+      .install(clusterComponent)
       .install(cvdCommandComponent)
+      .install(cvdInstanceStatusComponent)
       .install(cvdShutdownComponent)
-      .install(cvdVersionComponent);
+      .install(cvdVersionComponent)
+      .install(warmPoolComponent);
 }
 
-static constexpr int kNumThreads = 10;
+static constexpr std::size_t kMinNumThreads = 10;
 
-CvdServer::CvdServer(EpollPool& epoll_pool, InstanceManager& instance_manager)
+CvdServer::CvdServer(EpollPool& epoll_pool, InstanceManager& instance_manager,
+                     WarmPool& warm_pool, BuildPrefetcher& prefetcher)
     : epoll_pool_(epoll_pool),
       instance_manager_(instance_manager),
+      warm_pool_(warm_pool),
+      prefetcher_(prefetcher),
       running_(true) {
   std::scoped_lock lock(threads_mutex_);
-  for (auto i = 0; i < kNumThreads; i++) {
-    threads_.emplace_back([this]() {
-      while (running_) {
-        auto result = epoll_pool_.HandleEvent();
-        if (!result.ok()) {
-          LOG(ERROR) << "Epoll worker error:\n" << result.error();
-        }
-      }
-      auto wakeup = BestEffortWakeup();
-      CHECK(wakeup.ok()) << wakeup.error().message();
-    });
+  auto num_threads = std::max<std::size_t>(kMinNumThreads,
+                                           std::thread::hardware_concurrency());
+  for (std::size_t i = 0; i < num_threads; i++) {
+    StartWorkerThread();
   }
 }
 
+// Called with threads_mutex_ held
+void CvdServer::StartWorkerThread() {
+  threads_.emplace_back([this]() {
+    while (running_) {
+      auto result = epoll_pool_.HandleEvent();
+      if (!result.ok()) {
+        LOG(ERROR) << "Epoll worker error:\n" << result.error();
+      }
+    }
+    auto wakeup = BestEffortWakeup();
+    CHECK(wakeup.ok()) << wakeup.error().message();
+  });
+}
+
 CvdServer::~CvdServer() {
   running_ = false;
   auto wakeup = BestEffortWakeup();
@@ -134,10 +153,22 @@ void CvdServer::Stop() {
 }
 
 void CvdServer::Join() {
-  for (auto& thread : threads_) {
-    if (thread.joinable()) {
-      thread.join();
+  // Threads may still be started while the earlier ones are joined
+  while (true) {
+    std::thread* next = nullptr;
+    {
+      std::scoped_lock lock(threads_mutex_);
+      for (auto& thread : threads_) {
+        if (thread.joinable() && thread.get_id() != std::this_thread::get_id()) {
+          next = &thread;
+          break;
+        }
+      }
     }
+    if (next == nullptr) {
+      return;
+    }
+    next->join();
   }
 }
 
@@ -225,9 +256,19 @@ Result<void> CvdServer::HandleMessage(EpollEvent event) {
 
 Result<cvd::Response> CvdServer::HandleRequest(RequestWithStdio request,
                                                SharedFD client) {
-  fruit::Injector<> injector(RequestComponent, this, &instance_manager_);
+  fruit::Injector<> injector(RequestComponent, this, &instance_manager_,
+                                  &warm_pool_, &prefetcher_);
   auto possible_handlers = injector.getMultibindings<CvdServerHandler>();
 
+  // Keeps a thread available for other clients while this one is handled
+  {
+    std::scoped_lock lock(threads_mutex_);
+    if (++busy_threads_ >= threads_.size() && running_) {
+      StartWorkerThread();
+    }
+  }
+  ScopeGuard release_thread([this] { busy_threads_--; });
+
   // Even if the interrupt callback outlives the request handler, it'll only
   // hold on to this struct which will be cleaned out when the request handler
   // exits.
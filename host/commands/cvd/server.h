@@ -17,6 +17,7 @@
 #pragma once
 
 #include <atomic>
+#include <list>
 #include <map>
 #include <optional>
 #include <shared_mutex>
@@ -32,9 +33,11 @@
 #include "common/libs/utils/result.h"
 #include "common/libs/utils/subprocess.h"
 #include "common/libs/utils/unix_sockets.h"
+#include "host/commands/cvd/build_prefetcher.h"
 #include "host/commands/cvd/epoll_loop.h"
 #include "host/commands/cvd/instance_manager.h"
 #include "host/commands/cvd/server_client.h"
+#include "host/commands/cvd/warm_pool.h"
 
 namespace cuttlefish {
 
@@ -49,7 +52,8 @@ class CvdServerHandler {
 
 class CvdServer {
  public:
-  INJECT(CvdServer(EpollPool&, InstanceManager&));
+  INJECT(CvdServer(EpollPool&, InstanceManager&, WarmPool&,
+                   BuildPrefetcher&));
   ~CvdServer();
 
   Result<void> StartServer(SharedFD server);
@@ -67,21 +71,28 @@ class CvdServer {
   Result<void> HandleMessage(EpollEvent);
   Result<cvd::Response> HandleRequest(RequestWithStdio, SharedFD client);
   Result<void> BestEffortWakeup();
+  void StartWorkerThread();
 
   EpollPool& epoll_pool_;
   InstanceManager& instance_manager_;
+  WarmPool& warm_pool_;
+  BuildPrefetcher& prefetcher_;
   std::atomic_bool running_ = true;
 
   std::mutex ongoing_requests_mutex_;
   std::set<std::shared_ptr<OngoingRequest>> ongoing_requests_;
-  // TODO(schuffelen): Move this thread pool to another class.
+  // Threads waiting on epoll_pool_. Request handlers block their thread for
+  // as long as the command runs, so more threads are started whenever all of
+  // them are busy. A list keeps the threads in place while it grows.
   std::mutex threads_mutex_;
-  std::vector<std::thread> threads_;
+  std::list<std::thread> threads_;
+  std::atomic<std::size_t> busy_threads_ = 0;
 };
 
 class CvdCommandHandler : public CvdServerHandler {
  public:
-  INJECT(CvdCommandHandler(InstanceManager& instance_manager));
+  INJECT(CvdCommandHandler(InstanceManager& instance_manager,
+                           WarmPool& warm_pool));
 
   Result<bool> CanHandle(const RequestWithStdio&) const override;
   Result<cvd::Response> Handle(const RequestWithStdio&) override;
@@ -89,16 +100,25 @@ class CvdCommandHandler : public CvdServerHandler {
 
  private:
   InstanceManager& instance_manager_;
+  WarmPool& warm_pool_;
   std::optional<Subprocess> subprocess_;
   std::mutex interruptible_;
   bool interrupted_ = false;
 };
 
-fruit::Component<fruit::Required<InstanceManager>> cvdCommandComponent();
+fruit::Component<fruit::Required<InstanceManager, WarmPool>>
+cvdCommandComponent();
 fruit::Component<fruit::Required<CvdServer, InstanceManager>>
 cvdShutdownComponent();
 fruit::Component<> cvdVersionComponent();
-fruit::Component<fruit::Required<CvdCommandHandler>> AcloudCommandComponent();
+fruit::Component<fruit::Required<InstanceManager>>
+cvdInstanceStatusComponent();
+fruit::Component<fruit::Required<InstanceManager, WarmPool>>
+AcloudCommandComponent();
+fruit::Component<fruit::Required<WarmPool>> warmPoolComponent();
+fruit::Component<fruit::Required<BuildPrefetcher>> buildPrefetcherComponent();
+fruit::Component<fruit::Required<InstanceManager, WarmPool, BuildPrefetcher>>
+clusterComponent();
 
 struct CommandInvocation {
   std::string command;
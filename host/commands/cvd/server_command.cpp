@@ -34,13 +34,15 @@
 #include "common/libs/utils/result.h"
 #include "common/libs/utils/subprocess.h"
 #include "host/commands/cvd/instance_manager.h"
+#include "host/commands/cvd/warm_pool.h"
 #include "host/libs/config/cuttlefish_config.h"
 
 namespace cuttlefish {
 namespace {
 
+constexpr char kCompactBin[] = "compact_cvd";
 constexpr char kHostBugreportBin[] = "cvd_internal_host_bugreport";
-constexpr char kStartBin[] = "cvd_internal_start";
+constexpr char kLogsBin[] = "cvd_internal_logs";
 constexpr char kFetchBin[] = "fetch_cvd";
 constexpr char kMkdirBin[] = "/bin/mkdir";
 
@@ -58,9 +60,34 @@ Commands:
   stop                Stop a running device.
   clear               Stop all running devices and delete all instance and assembly directories.
   fleet               View the current fleet status.
+                      With --cached, print the last status reported by each
+                      instance without querying them.
   kill-server         Kill the cvd_server background process.
   status              Check and print the state of a running instance.
   host_bugreport      Capture a host bugreport, including configs, logs, and tombstones.
+  logs                Query the logs of a device started with --structured_logs.
+  snapshot            Save the state of a running device to a directory.
+  restore             Start a device from a snapshot instead of booting it.
+  display             Add, remove or resize the displays of a running device
+                      without restarting it.
+  bench               Measure the boot, input latency, adb throughput and host
+                      resource usage of a running device, as json.
+  profile             Capture a CPU or heap profile of one of a running device's
+                      host processes for pprof. --process=<name> [--type=cpu|heap]
+                      [--duration=30s]
+  compact             Return space freed by the guest from a stopped device's disks to the host.
+                      With --report, print logical and physical disk sizes instead.
+  pool                Keep booted devices ready for `cvd start --daemon`.
+  prefetch            Fetch new builds of some branches in the background.
+                      --builds=<branch/target,...> [--retention=N]
+                      [--rate_limit=<KiB/s>] [--off_peak_hours=22-6]
+                      [--interval_minutes=M]. Without arguments, print the
+                      prefetch status.
+  capacity            Print what this host can take as JSON: free CPUs, memory,
+                      disk and GPUs, warm pools and prefetched builds.
+  place               Pick a host for an instance out of their capacity reports.
+                      --reports=<file,...> [--build=<branch/target>] [--cpus=N]
+                      [--memory_mb=M] [--disk_gb=G] [--gpu]
 
 Args:
   <command args>      Each command has its own set of args. See cvd help <command>.
@@ -71,13 +98,20 @@ const std::map<std::string, std::string> CommandToBinaryMap = {
     {"help", kHelpBin},
     {"host_bugreport", kHostBugreportBin},
     {"cvd_host_bugreport", kHostBugreportBin},
+    {"logs", kLogsBin},
     {"start", kStartBin},
     {"launch_cvd", kStartBin},
     {"status", kStatusBin},
     {"cvd_status", kStatusBin},
+    {"restore", kStartBin},
+    {"snapshot", kSnapshotBin},
+    {"display", kDisplayBin},
+    {"bench", kBenchBin},
+    {"profile", kProfileBin},
     {"stop", kStopBin},
     {"stop_cvd", kStopBin},
     {"clear", kClearBin},
+    {"compact", kCompactBin},
     {"fetch", kFetchBin},
     {"fetch_cvd", kFetchBin},
     {"mkdir", kMkdirBin},
@@ -85,8 +119,9 @@ const std::map<std::string, std::string> CommandToBinaryMap = {
 
 }  // namespace
 
-CvdCommandHandler::CvdCommandHandler(InstanceManager& instance_manager)
-    : instance_manager_(instance_manager) {}
+CvdCommandHandler::CvdCommandHandler(InstanceManager& instance_manager,
+                                     WarmPool& warm_pool)
+    : instance_manager_(instance_manager), warm_pool_(warm_pool) {}
 
 Result<bool> CvdCommandHandler::CanHandle(
     const RequestWithStdio& request) const {
@@ -164,6 +199,13 @@ Result<cvd::Response> CvdCommandHandler::Handle(
     if (env_config != request.Message().command_request().env().end()) {
       config_path = env_config->second;
     }
+    bool cached = false;
+    CF_EXPECT(ParseFlags({GflagsCompatFlag("cached", cached)}, args));
+    if (cached) {
+      *response.mutable_status() =
+          instance_manager_.CvdFleetCached(request.Out());
+      return response;
+    }
     *response.mutable_status() =
         instance_manager_.CvdFleet(request.Out(), config_path);
     return response;
@@ -177,7 +219,23 @@ Result<cvd::Response> CvdCommandHandler::Handle(
     auto ins_flag = GflagsCompatFlag("base_instance_num", first_instance);
     auto num_instances = 1;
     auto num_instances_flag = GflagsCompatFlag("num_instances", num_instances);
-    CF_EXPECT(ParseFlags({ins_flag, num_instances_flag}, args));
+    std::string snapshot_path;
+    auto snapshot_flag = GflagsCompatFlag("snapshot_path", snapshot_path);
+    CF_EXPECT(ParseFlags({ins_flag, num_instances_flag, snapshot_flag}, args));
+    CF_EXPECT(invocation.command != "restore" || !snapshot_path.empty(),
+              "`cvd restore` needs the --snapshot_path of a `cvd snapshot`");
+
+    // A pool instance already has its own instance number
+    if (invocation.command != "restore" &&
+        instance_env == request.Message().command_request().env().end()) {
+      auto acquired = CF_EXPECT(warm_pool_.Acquire(
+          request.Message().command_request(), args_copy, home));
+      if (acquired) {
+        WriteAll(request.Err(), "Started a device from the warm pool.\n");
+        response.mutable_status()->set_code(cvd::Status::OK);
+        return response;
+      }
+    }
 
     // Track this assembly_dir in the fleet.
     InstanceManager::InstanceGroupInfo info;
@@ -330,7 +388,8 @@ CommandInvocation ParseInvocation(const cvd::Request& request) {
   return invocation;
 }
 
-fruit::Component<fruit::Required<InstanceManager>> cvdCommandComponent() {
+fruit::Component<fruit::Required<InstanceManager, WarmPool>>
+cvdCommandComponent() {
   return fruit::createComponent()
       .addMultibinding<CvdServerHandler, CvdCommandHandler>();
 }
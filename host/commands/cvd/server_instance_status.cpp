@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/cvd/server.h"
+
+#include <fruit/fruit.h>
+
+#include "cvd_server.pb.h"
+
+#include "common/libs/utils/result.h"
+#include "host/commands/cvd/instance_manager.h"
+
+namespace cuttlefish {
+namespace {
+
+// Both requests only touch the cache in InstanceManager, so they are answered
+// without starting any subprocesses or contacting the instances.
+class CvdInstanceStatusHandler : public CvdServerHandler {
+ public:
+  INJECT(CvdInstanceStatusHandler(InstanceManager& instance_manager))
+      : instance_manager_(instance_manager) {}
+
+  Result<bool> CanHandle(const RequestWithStdio& request) const override {
+    auto contents = request.Message().contents_case();
+    return contents == cvd::Request::ContentsCase::kInstanceStatusUpdate ||
+           contents == cvd::Request::ContentsCase::kInstanceStatusRequest;
+  }
+
+  Result<cvd::Response> Handle(const RequestWithStdio& request) override {
+    CF_EXPECT(CanHandle(request));
+    cvd::Response response;
+    if (request.Message().has_instance_status_update()) {
+      const auto& status = request.Message().instance_status_update().status();
+      CF_EXPECT(!status.instance_dir().empty(), "Missing the instance_dir");
+      instance_manager_.SetInstanceStatus(status);
+      response.mutable_instance_status_update_response();
+    } else {
+      auto& statuses =
+          *response.mutable_instance_status_response()->mutable_statuses();
+      for (auto& status : instance_manager_.InstanceStatuses()) {
+        *statuses.Add() = std::move(status);
+      }
+    }
+    response.mutable_status()->set_code(cvd::Status::OK);
+    return response;
+  }
+
+  Result<void> Interrupt() override { return CF_ERR("Can't interrupt"); }
+
+ private:
+  InstanceManager& instance_manager_;
+};
+
+}  // namespace
+
+fruit::Component<fruit::Required<InstanceManager>>
+cvdInstanceStatusComponent() {
+  return fruit::createComponent()
+      .addMultibinding<CvdServerHandler, CvdInstanceStatusHandler>();
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,439 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/cvd/warm_pool.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+#include <fruit/fruit.h>
+
+#include "cvd_server.pb.h"
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/files.h"
+#include "common/libs/utils/flag_parser.h"
+#include "common/libs/utils/result.h"
+#include "common/libs/utils/subprocess.h"
+#include "host/commands/cvd/server.h"
+#include "host/libs/config/cuttlefish_config.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr char kAndroidHostOut[] = "ANDROID_HOST_OUT";
+constexpr char kAndroidProductOut[] = "ANDROID_PRODUCT_OUT";
+
+// What a device leaves in its HOME. Handing an instance over links these.
+constexpr std::array<const char*, 3> kHomeFiles = {
+    "cuttlefish_assembly",
+    "cuttlefish_runtime",
+    ".cuttlefish_config.json",
+};
+
+std::string EnvValue(const cvd::CommandRequest& request,
+                     const std::string& name) {
+  auto it = request.env().find(name);
+  return it == request.env().end() ? "" : it->second;
+}
+
+void SetEnv(Command& command, const std::string& name,
+            const std::string& value) {
+  command.UnsetFromEnvironment(name);
+  command.AddEnvironmentVariable(name, value);
+}
+
+bool IsDaemonFlag(const std::string& arg) {
+  return arg == "--daemon" || arg == "-daemon" || arg == "--daemon=true";
+}
+
+// Pool instances always run as daemons, the flag doesn't tell builds apart
+std::vector<std::string> WithoutDaemonFlag(std::vector<std::string> args) {
+  args.erase(std::remove_if(args.begin(), args.end(), IsDaemonFlag),
+             args.end());
+  return args;
+}
+
+std::string PoolKey(const std::string& host_out, const std::string& product_out,
+                    const std::vector<std::string>& launch_args) {
+  return host_out + "\n" + product_out + "\n" +
+         android::base::Join(launch_args, "\n");
+}
+
+// Whether `link` is a symlink to a file in `directory`
+bool LinksInto(const std::string& link, const std::string& directory) {
+  std::string target;
+  return android::base::Readlink(link, &target) &&
+         android::base::StartsWith(target, directory + "/");
+}
+
+std::string PoolDirectory(const std::string& key) {
+  std::stringstream name;
+  name << std::hex << std::hash<std::string>()(key);
+  return TempDir() + "/cvd_warm_pool/" + name.str();
+}
+
+}  // namespace
+
+WarmPool::WarmPool(InstanceLockFileManager& lock_manager,
+                   InstanceManager& instance_manager)
+    : lock_manager_(lock_manager), instance_manager_(instance_manager) {}
+
+WarmPool::~WarmPool() {
+  std::unique_lock lock(mutex_);
+  stopping_ = true;
+  workers_done_.wait(lock, [this]() { return workers_ == 0; });
+  for (const auto& [key, pool] : pools_) {
+    for (const auto& member : pool.idle) {
+      Stop(pool, member);
+    }
+  }
+  // Devices still running keep their homes, e.g. when the server restarts
+  lock.unlock();
+  ReleaseHandedOut();
+}
+
+Result<void> WarmPool::Configure(const cvd::CommandRequest& request,
+                                 const std::vector<std::string>& launch_args,
+                                 int size, bool snapshots) {
+  CF_EXPECT(size >= 0, "The pool size can't be negative");
+  auto host_out = EnvValue(request, kAndroidHostOut);
+  CF_EXPECT(!host_out.empty(), "Missing " << kAndroidHostOut);
+  auto product_out = EnvValue(request, kAndroidProductOut);
+  CF_EXPECT(!product_out.empty(), "Missing " << kAndroidProductOut);
+  auto args = WithoutDaemonFlag(launch_args);
+  auto key = PoolKey(host_out, product_out, args);
+
+  Pool spec;
+  std::vector<Member> extra;
+  {
+    std::lock_guard lock(mutex_);
+    auto& pool = pools_[key];
+    pool.host_out = host_out;
+    pool.product_out = product_out;
+    pool.launch_args = args;
+    pool.snapshots = snapshots;
+    pool.size = size;
+    while (pool.idle.size() > pool.size) {
+      extra.emplace_back(std::move(pool.idle.back()));
+      pool.idle.pop_back();
+    }
+    spec = pool;
+    Refill(key, pool);
+  }
+  for (const auto& member : extra) {
+    Stop(spec, member);
+  }
+  ReleaseHandedOut();
+  return {};
+}
+
+Result<bool> WarmPool::Acquire(const cvd::CommandRequest& request,
+                               const std::vector<std::string>& start_args,
+                               const std::string& home) {
+  auto args = WithoutDaemonFlag(start_args);
+  if (args.size() == start_args.size()) {
+    // A foreground start lasts as long as the device, unlike a hand over
+    return false;
+  }
+  for (const auto& file : kHomeFiles) {
+    struct stat st;
+    auto path = home + "/" + file;
+    if (lstat(path.c_str(), &st) == 0 && !S_ISLNK(st.st_mode)) {
+      return false;
+    }
+  }
+  auto key = PoolKey(EnvValue(request, kAndroidHostOut),
+                     EnvValue(request, kAndroidProductOut), args);
+  ReleaseHandedOut();
+
+  Pool spec;
+  Member member;
+  std::vector<Member> cleared;
+  bool found = false;
+  {
+    std::lock_guard lock(mutex_);
+    auto it = pools_.find(key);
+    if (it == pools_.end()) {
+      return false;
+    }
+    auto& idle = it->second.idle;
+    // `cvd clear` stops the pool instances too
+    auto running = [this](const Member& member) {
+      return instance_manager_.GetInstanceGroup(member.home).ok();
+    };
+    auto first_cleared = std::stable_partition(idle.begin(), idle.end(),
+                                               running);
+    cleared.assign(std::make_move_iterator(first_cleared),
+                   std::make_move_iterator(idle.end()));
+    idle.erase(first_cleared, idle.end());
+    if (!idle.empty()) {
+      member = idle.front();
+      idle.erase(idle.begin());
+      found = true;
+    }
+    spec = it->second;
+    Refill(key, it->second);
+  }
+  for (const auto& stopped : cleared) {
+    RecursivelyRemoveDirectory(stopped.home);
+  }
+  if (!found) {
+    return false;
+  }
+
+  auto hand_over = [this, &member, &home]() -> Result<void> {
+    auto group = CF_EXPECT(instance_manager_.GetInstanceGroup(member.home));
+    CF_EXPECT(EnsureDirectoryExists(home));
+    for (const auto& file : kHomeFiles) {
+      auto target = member.home + "/" + file;
+      auto link = home + "/" + file;
+      unlink(link.c_str());
+      CF_EXPECT(symlink(target.c_str(), link.c_str()) == 0,
+                "Could not link \"" << link << "\" to \"" << target
+                                    << "\": " << strerror(errno));
+    }
+    instance_manager_.RemoveInstanceGroup(member.home);
+    instance_manager_.SetInstanceGroup(home, group);
+    return {};
+  };
+  auto handed_over = hand_over();
+  if (!handed_over.ok()) {
+    Stop(spec, member);
+    return CF_ERR("Could not hand over instance " << member.instance << ":\n"
+                                                  << handed_over.error());
+  }
+  LOG(INFO) << "Handed warm pool instance " << member.instance << " to \""
+            << home << "\"";
+  std::lock_guard lock(mutex_);
+  handed_out_.push_back({home, member});
+  return true;
+}
+
+std::string WarmPool::Status() {
+  std::lock_guard lock(mutex_);
+  std::stringstream status;
+  for (const auto& [key, pool] : pools_) {
+    status << pool.product_out;
+    for (const auto& arg : pool.launch_args) {
+      status << " " << arg;
+    }
+    status << ": " << pool.idle.size() << " of " << pool.size << " idle, "
+           << pool.starting << " booting\n";
+  }
+  return status.str();
+}
+
+std::vector<WarmPool::PoolStatus> WarmPool::Pools() {
+  std::lock_guard lock(mutex_);
+  std::vector<PoolStatus> pools;
+  for (const auto& [key, pool] : pools_) {
+    pools.push_back({pool.product_out, pool.launch_args, pool.size,
+                     pool.idle.size(), pool.starting});
+  }
+  return pools;
+}
+
+void WarmPool::Refill(const std::string& key, Pool& pool) {
+  while (!stopping_ && pool.idle.size() + pool.starting < pool.size) {
+    pool.starting++;
+    workers_++;
+    auto boot = boots_++;
+    std::thread([this, key, spec = pool, boot]() {
+      auto member = Boot(PoolDirectory(key), spec, boot);
+      std::unique_lock lock(mutex_);
+      auto& pool = pools_[key];
+      pool.starting--;
+      if (!member.ok()) {
+        LOG(ERROR) << "Could not boot a warm pool instance:\n"
+                   << member.error();
+      } else if (stopping_ || pool.idle.size() >= pool.size) {
+        // The pool shrank meanwhile
+        lock.unlock();
+        Stop(spec, *member);
+        lock.lock();
+      } else {
+        pool.idle.emplace_back(std::move(*member));
+      }
+      workers_--;
+      workers_done_.notify_all();
+    }).detach();
+  }
+}
+
+Result<WarmPool::Member> WarmPool::Boot(const std::string& directory,
+                                        const Pool& pool, size_t boot) {
+  auto lock = CF_EXPECT(lock_manager_.TryAcquireUnusedLock());
+  CF_EXPECT(lock.has_value(), "No unused instance number left");
+  Member member;
+  member.instance = lock->Instance();
+  member.home = directory + "/home-" + std::to_string(boot);
+  CF_EXPECT(EnsureDirectoryExists(member.home));
+  auto log_path = member.home + "/warm_pool.log";
+  auto log = SharedFD::Open(log_path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  CF_EXPECT(log->IsOpen(), "Could not open \"" << log_path
+                                               << "\": " << log->StrError());
+
+  // Snapshots only resume into the same instance number
+  auto snapshot = directory + "/snapshot-" + std::to_string(member.instance);
+  bool restore = pool.snapshots && DirectoryExists(snapshot);
+
+  auto bin_dir = pool.host_out + "/bin/";
+  Command start(bin_dir + kStartBin);
+  start.AddParameter("--daemon");
+  for (const auto& arg : pool.launch_args) {
+    start.AddParameter(arg);
+  }
+  if (restore) {
+    start.AddParameter("--snapshot_path=", snapshot);
+  }
+  SetEnv(start, "HOME", member.home);
+  SetEnv(start, "CUTTLEFISH_INSTANCE", std::to_string(member.instance));
+  SetEnv(start, kAndroidHostOut, pool.host_out);
+  SetEnv(start, kAndroidProductOut, pool.product_out);
+  start.RedirectStdIO(Subprocess::StdIOChannel::kStdOut, log);
+  start.RedirectStdIO(Subprocess::StdIOChannel::kStdErr, log);
+  int exit_code = start.Start().Wait();
+  CF_EXPECT(exit_code == 0, "Starting instance " << member.instance
+                                                 << " failed, see \""
+                                                 << log_path << "\"");
+  CF_EXPECT(lock->Status(InUseState::kInUse));
+
+  InstanceManager::InstanceGroupInfo info;
+  info.host_binaries_dir = bin_dir;
+  info.instances.insert(member.instance);
+  instance_manager_.SetInstanceGroup(member.home, info);
+
+  auto config_path = GetCuttlefishConfigPath(member.home);
+  if (pool.snapshots && !restore && config_path) {
+    Command take(bin_dir + kSnapshotBin);
+    take.AddParameter("--snapshot_path=", snapshot);
+    SetEnv(take, kCuttlefishConfigEnvVarName, *config_path);
+    SetEnv(take, "CUTTLEFISH_INSTANCE", std::to_string(member.instance));
+    take.RedirectStdIO(Subprocess::StdIOChannel::kStdOut, log);
+    take.RedirectStdIO(Subprocess::StdIOChannel::kStdErr, log);
+    if (take.Start().Wait() != 0) {
+      LOG(WARNING) << "Could not snapshot instance " << member.instance
+                   << ", see \"" << log_path << "\"";
+      RecursivelyRemoveDirectory(snapshot);
+    }
+  }
+  return member;
+}
+
+void WarmPool::Stop(const Pool& pool, const Member& member) {
+  auto config_path = GetCuttlefishConfigPath(member.home);
+  if (config_path) {
+    Command stop(pool.host_out + "/bin/" + kStopBin);
+    SetEnv(stop, kCuttlefishConfigEnvVarName, *config_path);
+    if (stop.Start().Wait() != 0) {
+      LOG(WARNING) << "Could not stop warm pool instance " << member.instance;
+    }
+  }
+  instance_manager_.RemoveInstanceGroup(member.home);
+  auto lock = lock_manager_.TryAcquireLock(member.instance);
+  if (lock.ok() && *lock) {
+    (*lock)->Status(InUseState::kNotInUse);
+  }
+  RecursivelyRemoveDirectory(member.home);
+}
+
+void WarmPool::ReleaseHandedOut() {
+  std::vector<HandedOut> released;
+  {
+    std::lock_guard lock(mutex_);
+    auto running = [this](const HandedOut& handed) {
+      return instance_manager_.GetInstanceGroup(handed.home).ok() &&
+             LinksInto(handed.home + "/" + kHomeFiles[0], handed.member.home);
+    };
+    auto first_released =
+        std::partition(handed_out_.begin(), handed_out_.end(), running);
+    released.assign(std::make_move_iterator(first_released),
+                    std::make_move_iterator(handed_out_.end()));
+    handed_out_.erase(first_released, handed_out_.end());
+  }
+  for (const auto& handed : released) {
+    for (const auto& file : kHomeFiles) {
+      auto link = handed.home + "/" + file;
+      if (LinksInto(link, handed.member.home)) {
+        unlink(link.c_str());
+      }
+    }
+    RecursivelyRemoveDirectory(handed.member.home);
+    LOG(DEBUG) << "Removed the home of warm pool instance "
+               << handed.member.instance << ", handed to \"" << handed.home
+               << "\"";
+  }
+}
+
+namespace {
+
+class WarmPoolCommand : public CvdServerHandler {
+ public:
+  INJECT(WarmPoolCommand(WarmPool& warm_pool)) : warm_pool_(warm_pool) {}
+  ~WarmPoolCommand() = default;
+
+  Result<bool> CanHandle(const RequestWithStdio& request) const override {
+    return ParseInvocation(request.Message()).command == "pool";
+  }
+  Result<cvd::Response> Handle(const RequestWithStdio& request) override {
+    CF_EXPECT(CanHandle(request));
+    auto args = ParseInvocation(request.Message()).arguments;
+    std::int32_t size = -1;
+    bool snapshots = false;
+    CF_EXPECT(ParseFlags({GflagsCompatFlag("size", size),
+                          GflagsCompatFlag("snapshots", snapshots)},
+                         args));
+    // The remaining arguments are for launch_cvd
+    if (size >= 0) {
+      CF_EXPECT(warm_pool_.Configure(request.Message().command_request(),
+                                     args, size, snapshots));
+    }
+    WriteAll(request.Out(), warm_pool_.Status());
+
+    cvd::Response response;
+    response.mutable_command_response();
+    response.mutable_status()->set_code(cvd::Status::OK);
+    return response;
+  }
+  Result<void> Interrupt() override { return CF_ERR("Can't be interrupted."); }
+
+ private:
+  WarmPool& warm_pool_;
+};
+
+}  // namespace
+
+fruit::Component<fruit::Required<WarmPool>> warmPoolComponent() {
+  return fruit::createComponent()
+      .addMultibinding<CvdServerHandler, WarmPoolCommand>();
+}
+
+}  // namespace cuttlefish
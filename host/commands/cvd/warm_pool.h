@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <fruit/fruit.h>
+
+#include "cvd_server.pb.h"
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+#include "host/commands/cvd/instance_lock.h"
+#include "host/commands/cvd/instance_manager.h"
+
+namespace cuttlefish {
+
+// Keeps instances of a build booted and idle, so `cvd start` can hand one out
+// instead of waiting for a boot. A build is identified by the host and product
+// directories of the request together with its launch arguments.
+class WarmPool {
+ public:
+  struct PoolStatus {
+    std::string product_out;
+    std::vector<std::string> launch_args;
+    size_t size;
+    size_t idle;
+    size_t starting;
+  };
+
+  INJECT(WarmPool(InstanceLockFileManager&, InstanceManager&));
+  ~WarmPool();
+
+  // Keeps `size` idle instances of the build of `request`. Instances beyond
+  // `size` are stopped. With `snapshots` the first boot of every instance
+  // number is saved, and later instances with that number resume from it.
+  Result<void> Configure(const cvd::CommandRequest& request,
+                         const std::vector<std::string>& launch_args,
+                         int size, bool snapshots);
+
+  // Hands an idle instance matching a `cvd start` with `start_args` over to
+  // `home` and starts booting its replacement. Returns false when there is no
+  // matching instance, or `home` has a device of its own.
+  Result<bool> Acquire(const cvd::CommandRequest& request,
+                       const std::vector<std::string>& start_args,
+                       const std::string& home);
+
+  std::string Status();
+  std::vector<PoolStatus> Pools();
+
+ private:
+  struct Member {
+    int instance;
+    std::string home;
+  };
+  // The device of a handed out instance keeps running from its own home,
+  // which `home` links to, until it is stopped.
+  struct HandedOut {
+    std::string home;
+    Member member;
+  };
+  struct Pool {
+    std::string host_out;
+    std::string product_out;
+    std::vector<std::string> launch_args;
+    bool snapshots = false;
+    size_t size = 0;
+    size_t starting = 0;
+    std::vector<Member> idle;
+  };
+
+  // Must be called with mutex_ held
+  void Refill(const std::string& key, Pool& pool);
+  Result<Member> Boot(const std::string& directory, const Pool& pool,
+                      size_t boot);
+  void Stop(const Pool& pool, const Member& member);
+  // Removes the homes of handed out instances whose devices were stopped, or
+  // replaced by a device of their own. Must be called without mutex_ held.
+  void ReleaseHandedOut();
+
+  InstanceLockFileManager& lock_manager_;
+  InstanceManager& instance_manager_;
+
+  std::mutex mutex_;
+  std::condition_variable workers_done_;
+  size_t workers_ = 0;
+  size_t boots_ = 0;
+  bool stopping_ = false;
+  std::map<std::string, Pool> pools_;
+  std::vector<HandedOut> handed_out_;
+};
+
+}  // namespace cuttlefish
@@ -1,3 +1,6 @@
+#include <fstream>
+#include <iostream>
+
 #include "gflags/gflags.h"
 
 #include "android-base/logging.h"
@@ -10,6 +13,9 @@ DEFINE_uint32(instance_number, 1,
               "number of the cvd instance to send the sms to, default is 1");
 DEFINE_uint32(modem_id, 0,
               "modem id needed for multisim devices, default is 0");
+DEFINE_string(messages_file, "",
+              "file with one message per line to send instead of the "
+              "positional argument, \"-\" reads the messages from stdin");
 
 namespace cuttlefish {
 namespace {
@@ -20,10 +26,11 @@ namespace {
 //   * cvd_send_sms --sender_number="16501239999" "hello world"
 //   * cvd_send_sms --instance-number=2 "hello world"
 //   * cvd_send_sms --instance-number=2 --modem_id=1 "hello world"
+//   * cvd_send_sms --messages_file=messages.txt
 
 int SendSmsMain(int argc, char** argv) {
   gflags::ParseCommandLineFlags(&argc, &argv, true);
-  if (argc == 1) {
+  if (argc == 1 && FLAGS_messages_file.empty()) {
     LOG(ERROR) << "Missing message content. First positional argument is used "
                   "as the message content, `cvd_send_sms --instance-number=2 "
                   "\"hello world\"`";
@@ -36,6 +43,21 @@ int SendSmsMain(int argc, char** argv) {
   auto client_socket = cuttlefish::SharedFD::SocketLocalClient(
       socket_name.c_str(), /* abstract */ true, SOCK_STREAM);
   SmsSender sms_sender(client_socket);
+  if (!FLAGS_messages_file.empty()) {
+    if (FLAGS_messages_file == "-") {
+      return sms_sender.SendLines(std::cin, FLAGS_sender_number, FLAGS_modem_id)
+                 ? 0
+                 : -1;
+    }
+    std::ifstream messages(FLAGS_messages_file);
+    if (!messages) {
+      LOG(ERROR) << "Failed to open \"" << FLAGS_messages_file << "\"";
+      return -1;
+    }
+    return sms_sender.SendLines(messages, FLAGS_sender_number, FLAGS_modem_id)
+               ? 0
+               : -1;
+  }
   if (!sms_sender.Send(argv[1], FLAGS_sender_number, FLAGS_modem_id)) {
     return -1;
   }
@@ -1,6 +1,7 @@
 #include "host/commands/cvd_send_sms/pdu_format_builder.h"
 
 #include <algorithm>
+#include <array>
 #include <codecvt>
 #include <cstddef>
 #include <iomanip>
@@ -8,12 +9,11 @@
 #include <map>
 #include <regex>
 #include <sstream>
+#include <unordered_map>
 #include <vector>
 
 #include "android-base/logging.h"
-#include "unicode/uchriter.h"
 #include "unicode/unistr.h"
-#include "unicode/ustring.h"
 
 namespace cuttlefish {
 
@@ -33,59 +33,71 @@ const std::vector<std::string> kGSM7BitDefaultAlphabet = {
 };
 // clang-format on
 
+// Returns the septet of a UTF-16 code unit in the GSM 7 bit Default Alphabet,
+// or -1 if it isn't part of it. The lookup tables are built once.
+static int Gsm7bitCode(char16_t unit) {
+  struct Codes {
+    std::array<int8_t, 128> ascii;
+    std::unordered_map<char16_t, int8_t> others;
+  };
+  static const Codes* codes = []() {
+    auto codes = new Codes();
+    codes->ascii.fill(-1);
+    for (size_t i = 0; i < kGSM7BitDefaultAlphabet.size(); i++) {
+      icu::UnicodeString character(kGSM7BitDefaultAlphabet[i].c_str());
+      char16_t code_unit = character.charAt(0);
+      if (code_unit < codes->ascii.size()) {
+        codes->ascii[code_unit] = i;
+      } else {
+        codes->others.emplace(code_unit, i);
+      }
+    }
+    return codes;
+  }();
+  if (unit < codes->ascii.size()) {
+    return codes->ascii[unit];
+  }
+  auto it = codes->others.find(unit);
+  return it == codes->others.end() ? -1 : it->second;
+}
+
 // Encodes using the GSM 7bit encoding as defined in 3GPP TS 23.038
 // https://www.etsi.org/deliver/etsi_ts/123000_123099/123038/09.01.01_60/ts_123038v090101p.pdf
+//
+// The septets are packed least significant bit first, through an accumulator
+// that emits an octet whenever it holds 8 bits.
 static std::string Gsm7bitEncode(const std::string& input) {
+  static constexpr char kHexDigits[] = "0123456789abcdef";
   icu::UnicodeString unicode_str(input.c_str());
-  icu::UCharCharacterIterator iter(unicode_str.getTerminatedBuffer(),
-                                   unicode_str.length());
-  size_t octects_size = unicode_str.length() - (unicode_str.length() / 8);
-  std::byte octects[octects_size];
-  std::byte* octects_index = octects;
-  int bits_to_write_in_prev_octect = 0;
-  for (; iter.hasNext(); iter.next()) {
-    UChar uchar = iter.current();
-    char dest[5];
-    UErrorCode uerror_code;
-    u_strToUTF8(dest, 5, NULL, &uchar, 1, &uerror_code);
-    if (U_FAILURE(uerror_code)) {
-      LOG(ERROR) << "u_strToUTF8 failed with error: "
-                 << u_errorName(uerror_code) << ", with string: " << input;
-      return "";
-    }
-    std::string character(dest);
-    auto found_it = std::find(kGSM7BitDefaultAlphabet.begin(),
-                              kGSM7BitDefaultAlphabet.end(), character);
-    if (found_it == kGSM7BitDefaultAlphabet.end()) {
+  const char16_t* units = unicode_str.getBuffer();
+  int32_t length = unicode_str.length();
+  std::string result;
+  result.reserve((length - length / 8) * 2);
+  uint32_t bits = 0;
+  int bit_count = 0;
+  for (int32_t i = 0; i < length; i++) {
+    int code = Gsm7bitCode(units[i]);
+    if (code < 0) {
+      std::string character;
+      icu::UnicodeString(units[i]).toUTF8String(character);
       LOG(ERROR) << "Character: " << character
                  << " does not exist in GSM 7 bit Default Alphabet";
       return "";
     }
-    std::byte code =
-        (std::byte)std::distance(kGSM7BitDefaultAlphabet.begin(), found_it);
-    if (iter.hasPrevious()) {
-      std::byte prev_octect_value = *(octects_index - 1);
-      // Writes the corresponding lowest part in the previous octect.
-      *(octects_index - 1) =
-          code << (8 - bits_to_write_in_prev_octect) | prev_octect_value;
-    }
-    if (bits_to_write_in_prev_octect < 7) {
-      // Writes the remaining highest part in the current octect.
-      *octects_index = code >> bits_to_write_in_prev_octect;
-      bits_to_write_in_prev_octect++;
-      octects_index++;
-    } else {  // bits_to_write_in_prev_octect == 7
-      // The 7 bits of the current character were fully packed into the
-      // previous octect.
-      bits_to_write_in_prev_octect = 0;
+    bits |= code << bit_count;
+    bit_count += 7;
+    if (bit_count >= 8) {
+      result += kHexDigits[(bits >> 4) & 0xf];
+      result += kHexDigits[bits & 0xf];
+      bits >>= 8;
+      bit_count -= 8;
     }
   }
-  std::stringstream result;
-  for (int i = 0; i < octects_size; i++) {
-    result << std::setfill('0') << std::setw(2) << std::hex
-           << std::to_integer<int>(octects[i]);
+  if (bit_count > 0) {
+    result += kHexDigits[(bits >> 4) & 0xf];
+    result += kHexDigits[bits & 0xf];
   }
-  return result.str();
+  return result;
 }
 
 // Validates whether the passed phone number conforms to the E.164 specs,
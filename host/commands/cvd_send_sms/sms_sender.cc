@@ -13,6 +13,12 @@
 #include "host/commands/cvd_send_sms/pdu_format_builder.h"
 
 namespace cuttlefish {
+namespace {
+
+// Pending commands are flushed to the socket once they reach this size.
+constexpr size_t kWriteBatchSize = 64 * 1024;
+
+}  // namespace
 
 SmsSender::SmsSender(SharedFD modem_simulator_client_fd)
     : modem_simulator_client_fd_(modem_simulator_client_fd) {}
@@ -41,4 +47,49 @@ bool SmsSender::Send(const std::string& content,
   }
   return true;
 }
+
+bool SmsSender::SendLines(std::istream& messages,
+                          const std::string& sender_number, uint32_t modem_id) {
+  if (!modem_simulator_client_fd_->IsOpen()) {
+    LOG(ERROR) << "Failed to connect to remote modem simulator, error: "
+               << modem_simulator_client_fd_->StrError();
+    return false;
+  }
+  PDUFormatBuilder builder;
+  builder.SetSenderNumber(sender_number);
+  // The modem simulator only reads the "REM<modem_id>" prefix once per
+  // connection, every following command goes to the same remote client.
+  std::string batch = "REM" + std::to_string(modem_id);
+  batch.reserve(kWriteBatchSize + 1024);
+  bool success = true;
+  std::string content;
+  for (size_t line = 1; std::getline(messages, content); line++) {
+    builder.SetUserData(content);
+    std::string pdu_format_str = builder.Build();
+    if (pdu_format_str.empty()) {
+      LOG(ERROR) << "Skipping message on line " << line;
+      success = false;
+      continue;
+    }
+    batch += "AT+REMOTESMS=";
+    batch += pdu_format_str;
+    batch += '\r';
+    if (batch.size() < kWriteBatchSize) {
+      continue;
+    }
+    if (WriteAll(modem_simulator_client_fd_, batch) != batch.size()) {
+      LOG(ERROR) << "Error writing to socket: "
+                 << modem_simulator_client_fd_->StrError();
+      return false;
+    }
+    batch.clear();
+  }
+  if (!batch.empty() &&
+      WriteAll(modem_simulator_client_fd_, batch) != batch.size()) {
+    LOG(ERROR) << "Error writing to socket: "
+               << modem_simulator_client_fd_->StrError();
+    return false;
+  }
+  return success;
+}
 }  // namespace cuttlefish
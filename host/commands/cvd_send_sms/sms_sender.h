@@ -15,6 +15,7 @@
 
 #pragma once
 
+#include <istream>
 #include <string>
 
 #include "common/libs/fs/shared_fd.h"
@@ -29,6 +30,12 @@ class SmsSender {
   bool Send(const std::string& sms_body, const std::string& sender_number,
             uint32_t modem_id = 0);
 
+  // Sends every line of `messages` as a separate SMS over the same
+  // connection, batching the commands into large writes. Messages that can't
+  // be encoded are skipped. Returns true if all the messages were sent.
+  bool SendLines(std::istream& messages, const std::string& sender_number,
+                 uint32_t modem_id = 0);
+
  private:
   SharedFD modem_simulator_client_fd_;
 };
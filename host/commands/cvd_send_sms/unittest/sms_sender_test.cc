@@ -80,5 +80,17 @@ TEST_F(SmsSenderTest, NonDefaultModemIdValueSucceeds) {
       "REM1AT+REMOTESMS=0001000b916105214365f700000ae8329bfd4697d9ec37\r");
 }
 
+TEST_F(SmsSenderTest, SendLinesBatchesCommands) {
+  SmsSender sender(client_fd_);
+  std::istringstream messages("hellohello\n\nhellohello\n");
+
+  bool result = sender.SendLines(messages, "+16501234567");
+
+  EXPECT_FALSE(result);
+  AssertCommandIsSent(
+      "REM0AT+REMOTESMS=0001000b916105214365f700000ae8329bfd4697d9ec37\r"
+      "AT+REMOTESMS=0001000b916105214365f700000ae8329bfd4697d9ec37\r");
+}
+
 }  // namespace
 }  // namespace cuttlefish
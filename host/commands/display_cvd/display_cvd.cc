@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <android-base/logging.h>
+#include <gflags/gflags.h>
+#include <json/json.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/fs/shared_select.h"
+#include "common/libs/utils/environment.h"
+#include "host/commands/run_cvd/runner_defs.h"
+#include "host/libs/config/cuttlefish_config.h"
+
+DEFINE_int32(instance_num, cuttlefish::GetInstance(),
+             "Which instance's displays to change");
+
+DEFINE_int32(wait_for_launcher, 30,
+             "How many seconds to wait for the launcher to respond to the "
+             "display command. A value of zero means wait indefinetly");
+
+DEFINE_int32(display, -1, "Number of the display to remove or resize");
+DEFINE_int32(width, 0, "Width of the display to add, or its new width");
+DEFINE_int32(height, 0, "Height of the display to add, or its new height");
+DEFINE_int32(dpi, 0, "Pixel density of the display, unchanged when zero");
+DEFINE_int32(refresh_rate_hz, 0,
+             "Refresh rate of the display, unchanged when zero");
+
+namespace cuttlefish {
+namespace {
+
+constexpr char kUsage[] =
+    "Changes the displays of a running device without restarting it.\n"
+    "\n"
+    "usage: cvd display list\n"
+    "       cvd display add --width=W --height=H [--dpi=D] "
+    "[--refresh_rate_hz=R]\n"
+    "       cvd display remove --display=N\n"
+    "       cvd display resize --display=N [--width=W] [--height=H] "
+    "[--dpi=D] [--refresh_rate_hz=R]\n"
+    "\n"
+    "Added displays take the lowest free display number. Each command prints "
+    "the displays of the device afterwards.";
+
+int DisplayCvdMain(int argc, char** argv) {
+  ::android::base::InitLogging(argv, android::base::StderrLogger);
+  google::SetUsageMessage(kUsage);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc != 2) {
+    LOG(ERROR) << "Expected one of list, add, remove or resize\n" << kUsage;
+    return 1;
+  }
+  Json::Value request;
+  request["action"] = argv[1];
+  if (FLAGS_display >= 0) {
+    request["display"] = FLAGS_display;
+  }
+  for (auto [name, value] : {std::make_pair("width", FLAGS_width),
+                             std::make_pair("height", FLAGS_height),
+                             std::make_pair("dpi", FLAGS_dpi),
+                             std::make_pair("refresh_rate_hz",
+                                            FLAGS_refresh_rate_hz)}) {
+    if (value > 0) {
+      request[name] = value;
+    }
+  }
+
+  auto config = CuttlefishConfig::Get();
+  if (!config) {
+    LOG(ERROR) << "Failed to obtain config object";
+    return 1;
+  }
+
+  auto instance = config->ForInstance(FLAGS_instance_num);
+  auto monitor_path = instance.launcher_monitor_socket_path();
+  if (monitor_path.empty()) {
+    LOG(ERROR) << "No path to launcher monitor found";
+    return 2;
+  }
+  // This may hang if the server never picks up the connection.
+  auto monitor_socket = SharedFD::SocketLocalClient(
+      monitor_path.c_str(), false, SOCK_STREAM, FLAGS_wait_for_launcher);
+  if (!monitor_socket->IsOpen()) {
+    LOG(ERROR) << "Unable to connect to launcher monitor at " << monitor_path
+               << ": " << monitor_socket->StrError();
+    return 3;
+  }
+  Json::StreamWriterBuilder factory;
+  auto request_str = Json::writeString(factory, request);
+  std::uint32_t request_size = request_str.size();
+  auto action = LauncherAction::kDisplays;
+  if (WriteAllBinary(monitor_socket, &action) != sizeof(action) ||
+      WriteAllBinary(monitor_socket, &request_size) != sizeof(request_size) ||
+      WriteAll(monitor_socket, request_str) != (ssize_t)request_str.size()) {
+    LOG(ERROR) << "Error sending launcher monitor the display command: "
+               << monitor_socket->StrError();
+    return 4;
+  }
+  // Perform a select with a timeout to guard against launcher hanging
+  SharedFDSet read_set;
+  read_set.Set(monitor_socket);
+  struct timeval timeout = {FLAGS_wait_for_launcher, 0};
+  int selected = Select(&read_set, nullptr, nullptr,
+                        FLAGS_wait_for_launcher <= 0 ? nullptr : &timeout);
+  if (selected < 0) {
+    LOG(ERROR) << "Failed communication with the launcher monitor: "
+               << strerror(errno);
+    return 5;
+  }
+  if (selected == 0) {
+    LOG(ERROR) << "Timeout expired waiting for launcher monitor to respond";
+    return 6;
+  }
+  LauncherResponse response;
+  auto bytes_recv = monitor_socket->Recv(&response, sizeof(response), 0);
+  if (bytes_recv < 0) {
+    LOG(ERROR) << "Error receiving response from launcher monitor: "
+               << monitor_socket->StrError();
+    return 7;
+  }
+  if (response != LauncherResponse::kSuccess) {
+    LOG(ERROR) << "Received '" << static_cast<char>(response)
+               << "' response from launcher monitor for display request, "
+               << "see the launcher log for details";
+    return 8;
+  }
+  std::uint32_t displays_size = 0;
+  std::string displays;
+  if (ReadExactBinary(monitor_socket, &displays_size) !=
+      sizeof(displays_size)) {
+    LOG(ERROR) << "Error receiving the displays from launcher monitor: "
+               << monitor_socket->StrError();
+    return 9;
+  }
+  displays.resize(displays_size);
+  if (ReadExact(monitor_socket, &displays) != (ssize_t)displays.size()) {
+    LOG(ERROR) << "Error receiving the displays from launcher monitor: "
+               << monitor_socket->StrError();
+    return 9;
+  }
+  std::cout << displays << std::endl;
+  return 0;
+}
+
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  return cuttlefish::DisplayCvdMain(argc, argv);
+}
@@ -13,15 +13,19 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <fstream>
+#include <future>
 #include <iostream>
 #include <iterator>
+#include <optional>
 #include <string>
 
 #include <curl/curl.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "android-base/file.h"
 #include "android-base/logging.h"
 #include "android-base/strings.h"
 #include "gflags/gflags.h"
@@ -34,9 +38,13 @@
 
 #include "host/libs/config/fetcher_config.h"
 
+#include "host/libs/web/artifact_cache.h"
 #include "host/libs/web/build_api.h"
 #include "host/libs/web/credential_source.h"
 #include "host/libs/web/install_zip.h"
+#include "host/libs/web/tar_stream.h"
+#include "host/libs/web/zip_delta.h"
+#include "host/libs/web/zip_stream.h"
 
 namespace {
 
@@ -57,6 +65,19 @@ DEFINE_string(otatools_build, "", "source for the host ota tools");
 DEFINE_bool(download_img_zip, true, "Whether to fetch the -img-*.zip file.");
 DEFINE_bool(download_target_files_zip, false, "Whether to fetch the "
                                               "-target_files-*.zip file.");
+DEFINE_string(delta_base_dir, "", "Directory holding the images of a "
+              "previous fetch. Images of the img zip matching those there or "
+              "in --directory are reused instead of downloaded.");
+DEFINE_bool(print_build_id, false, "Print the id of the build "
+            "--default_build refers to and exit without fetching anything.");
+DEFINE_uint64(download_rate_limit, 0, "Cap on the combined rate of the "
+              "downloads, in KiB/s. 0 for no cap.");
+DEFINE_bool(lazy_fetch, false, "Leave the target files and ota tools to be "
+                               "downloaded once a later step needs them, "
+                               "rather than before the device boots.");
+DEFINE_string(fetch_deferred, "", "Comma separated files in --directory "
+                                  "that an earlier --lazy_fetch deferred. Only "
+                                  "downloads these.");
 
 DEFINE_string(credential_source, "", "Build API credential source");
 DEFINE_string(directory, CurrentDirectory(), "Target directory to fetch "
@@ -64,6 +85,24 @@ DEFINE_string(directory, CurrentDirectory(), "Target directory to fetch "
 DEFINE_bool(run_next_stage, false, "Continue running the device through the next stage.");
 DEFINE_string(wait_retry_period, "20", "Retry period for pending builds given "
                                        "in seconds. Set to 0 to not wait.");
+DEFINE_string(artifact_cache_dir,
+              cuttlefish::StringFromEnv(
+                  "XDG_CACHE_HOME",
+                  cuttlefish::StringFromEnv("HOME", ".") + "/.cache") +
+                  "/cuttlefish/artifacts",
+              "Directory where downloaded artifacts are kept and shared "
+              "between fetches of the same build. Empty to disable.");
+DEFINE_uint64(artifact_cache_size_gb, 20,
+              "Size the artifact cache is trimmed to after each download, "
+              "least recently used artifacts first.");
+DEFINE_string(credential_cache_dir,
+              cuttlefish::StringFromEnv(
+                  "XDG_CACHE_HOME",
+                  cuttlefish::StringFromEnv("HOME", ".") + "/.cache") +
+                  "/cuttlefish/credentials",
+              "Directory where access tokens are shared with other fetches "
+              "using the same credentials until they expire. Empty to "
+              "disable.");
 
 namespace cuttlefish {
 namespace {
@@ -91,6 +130,59 @@ std::string TargetBuildZipFromArtifacts(
   return "";
 }
 
+/** Downloads only the images that differ from those in --delta_base_dir.
+ *
+ * Returns nothing if the zip couldn't be read in ranges.
+ */
+std::optional<std::vector<std::string>> fetch_image_delta(
+    BuildApi* build_api, const DeviceBuild& build,
+    const std::string& img_zip_name, const std::string& target_directory,
+    const std::vector<std::string>& images) {
+  std::string url = build_api->ArtifactUrl(build, img_zip_name);
+  if (url.empty()) {
+    return {};
+  }
+  ZipDeltaFetcher fetcher(build_api->Curl(), url);
+  if (!fetcher.Fetch(target_directory, FLAGS_delta_base_dir, images)) {
+    LOG(WARNING) << "Could not fetch " << build << ":" << img_zip_name
+                 << " in ranges";
+    return {};
+  }
+  LOG(INFO) << "Reused " << fetcher.ReusedBytes() << " bytes of images and "
+            << "downloaded " << fetcher.DownloadedBytes() << " bytes of "
+            << img_zip_name;
+  return fetcher.Extracted();
+}
+
+/** Extracts the images while the img zip downloads, without storing the zip.
+ *
+ * Returns nothing if the zip couldn't be streamed, and an empty list if it was
+ * missing some of the images.
+ */
+std::optional<std::vector<std::string>> stream_images(
+    BuildApi* build_api, const DeviceBuild& build,
+    const std::string& img_zip_name, const std::string& target_directory,
+    const std::vector<std::string>& images) {
+  ZipStreamExtractor extractor(target_directory, images);
+  auto callback = [&extractor](char* data, size_t size) {
+    return extractor.Consume(data, size);
+  };
+  if (!build_api->ArtifactToCallback(build, img_zip_name, callback) ||
+      !extractor.Finish()) {
+    LOG(WARNING) << "Could not stream " << build << ":" << img_zip_name;
+    return {};
+  }
+  std::vector<std::string> files = extractor.Extracted();
+  for (const auto& image : images) {
+    auto path = target_directory + "/" + image;
+    if (std::find(files.begin(), files.end(), path) == files.end()) {
+      LOG(ERROR) << "Could not find " << image << " in " << img_zip_name;
+      return std::vector<std::string>{};
+    }
+  }
+  return files;
+}
+
 std::vector<std::string> download_images(BuildApi* build_api,
                                          const Build& build,
                                          const std::string& target_directory,
@@ -101,6 +193,23 @@ std::vector<std::string> download_images(BuildApi* build_api,
     LOG(ERROR) << "Target " << build << " did not have an img zip";
     return {};
   }
+  auto device_build = std::get_if<DeviceBuild>(&build);
+  if (device_build && FLAGS_delta_base_dir != "") {
+    auto files = fetch_image_delta(build_api, *device_build, img_zip_name,
+                                   target_directory, images);
+    if (files) {
+      return *files;
+    }
+  }
+  // A cached zip is extracted from the cache instead
+  if (device_build && !build_api->CachesArtifacts()) {
+    auto files = stream_images(build_api, *device_build, img_zip_name,
+                               target_directory, images);
+    if (files) {
+      return *files;
+    }
+    LOG(INFO) << "Downloading " << img_zip_name << " before extracting it";
+  }
   std::string local_path = target_directory + "/" + img_zip_name;
   if (!build_api->ArtifactToFile(build, img_zip_name, local_path)) {
     LOG(ERROR) << "Unable to download " << build << ":" << img_zip_name << " to "
@@ -143,6 +252,43 @@ std::vector<std::string> download_target_files(BuildApi* build_api,
   return {local_path};
 }
 
+/** Returns the path download_target_files would write the zip to, without
+ * downloading it.
+ */
+std::string deferred_target_files(BuildApi* build_api, const Build& build,
+                                  const std::string& target_directory) {
+  auto artifacts = build_api->Artifacts(build);
+  std::string target_zip = TargetBuildZipFromArtifacts(build, "target_files", artifacts);
+  if (target_zip.size() == 0) {
+    LOG(ERROR) << "Target " << build << " did not have a target files zip";
+    return "";
+  }
+  return target_directory + "/" + target_zip;
+}
+
+/** Extracts the host package while it downloads, without storing the
+ * archive. Files already in the target directory with the same contents are
+ * left untouched.
+ *
+ * Returns nothing if the archive couldn't be streamed.
+ */
+std::optional<std::vector<std::string>> stream_host_package(
+    BuildApi* build_api, const DeviceBuild& build,
+    const std::string& target_directory) {
+  TarStreamExtractor extractor(target_directory);
+  auto callback = [&extractor](char* data, size_t size) {
+    return extractor.Consume(data, size);
+  };
+  if (!build_api->ArtifactToCallback(build, HOST_TOOLS, callback) ||
+      !extractor.Finish()) {
+    LOG(WARNING) << "Could not stream " << build << ":" << HOST_TOOLS;
+    return {};
+  }
+  LOG(INFO) << extractor.Unchanged() << " files of " << HOST_TOOLS
+            << " were already up to date";
+  return extractor.Extracted();
+}
+
 std::vector<std::string> download_host_package(BuildApi* build_api,
                                                const Build& build,
                                                const std::string& target_directory) {
@@ -155,6 +301,16 @@ std::vector<std::string> download_host_package(BuildApi* build_api,
     LOG(ERROR) << "Target " << build << " did not have " << HOST_TOOLS;
     return {};
   }
+  // A cached archive is extracted from the cache instead
+  auto device_build = std::get_if<DeviceBuild>(&build);
+  if (device_build && !build_api->CachesArtifacts()) {
+    auto files = stream_host_package(build_api, *device_build,
+                                     target_directory);
+    if (files) {
+      return *files;
+    }
+    LOG(INFO) << "Downloading " << HOST_TOOLS << " before extracting it";
+  }
   std::string local_path = target_directory + "/" + HOST_TOOLS;
 
   if (!build_api->ArtifactToFile(build, HOST_TOOLS, local_path)) {
@@ -217,24 +373,30 @@ std::vector<std::string> download_ota_tools(BuildApi* build_api,
   return files;
 }
 
+CvdFile ConfigFile(FileSource purpose, const Build& build,
+                   const std::string& path,
+                   const std::string& directory_prefix) {
+  std::string_view local_path(path);
+  if (!android::base::ConsumePrefix(&local_path, directory_prefix)) {
+    LOG(ERROR) << "Failed to remove prefix " << directory_prefix << " from "
+               << local_path;
+  }
+  while (android::base::StartsWith(local_path, "/")) {
+    android::base::ConsumePrefix(&local_path, "/");
+  }
+  // TODO(schuffelen): Do better for local builds here.
+  auto id = std::visit([](auto&& arg) { return arg.id; }, build);
+  auto target = std::visit([](auto&& arg) { return arg.target; }, build);
+  return CvdFile(purpose, id, target, std::string(local_path));
+}
+
 void AddFilesToConfig(FileSource purpose, const Build& build,
                       const std::vector<std::string>& paths,
                       FetcherConfig* config,
                       const std::string& directory_prefix,
                       bool override_entry = false) {
   for (const std::string& path : paths) {
-    std::string_view local_path(path);
-    if (!android::base::ConsumePrefix(&local_path, directory_prefix)) {
-      LOG(ERROR) << "Failed to remove prefix " << directory_prefix << " from "
-                 << local_path;
-    }
-    while (android::base::StartsWith(local_path, "/")) {
-      android::base::ConsumePrefix(&local_path, "/");
-    }
-    // TODO(schuffelen): Do better for local builds here.
-    auto id = std::visit([](auto&& arg) { return arg.id; }, build);
-    auto target = std::visit([](auto&& arg) { return arg.target; }, build);
-    CvdFile file(purpose, id, target, std::string(local_path));
+    CvdFile file = ConfigFile(purpose, build, path, directory_prefix);
     bool added = config->add_cvd_file(file, override_entry);
     if (!added) {
       LOG(ERROR) << "Duplicate file " << file;
@@ -244,6 +406,56 @@ void AddFilesToConfig(FileSource purpose, const Build& build,
   }
 }
 
+/** Adds a file to be downloaded by a later fetch_cvd --fetch_deferred.
+ *
+ * The artifact to download is the file's name in the build.
+ */
+void AddDeferredFileToConfig(FileSource purpose, const Build& build,
+                             const std::string& path, FetcherConfig* config,
+                             const std::string& directory_prefix,
+                             bool override_entry = false) {
+  CvdFile file = ConfigFile(purpose, build, path, directory_prefix);
+  file.deferred_artifact = android::base::Basename(path);
+  if (!config->add_cvd_file(file, override_entry)) {
+    LOG(FATAL) << "Failed to add deferred path " << path;
+  }
+}
+
+void fetch_deferred_files(BuildApi* build_api,
+                          const std::vector<std::string>& paths,
+                          const std::string& target_directory,
+                          FetcherConfig* config) {
+  auto cvd_files = config->get_cvd_files();
+  for (const auto& path : paths) {
+    auto it = cvd_files.find(path);
+    if (it == cvd_files.end() || it->second.deferred_artifact.empty()) {
+      LOG(FATAL) << "\"" << path << "\" was not deferred by an earlier fetch";
+    }
+    const auto& file = it->second;
+    std::string local_path = target_directory + "/" + path;
+    if (FileExists(local_path)) {
+      continue;
+    }
+    DeviceBuild build(file.build_id, file.build_target);
+    if (file.deferred_artifact == OTA_TOOLS) {
+      std::vector<std::string> ota_tools_files =
+          download_ota_tools(build_api, build, target_directory);
+      if (ota_tools_files.empty()) {
+        LOG(FATAL) << "Could not download ota tools for " << build;
+      }
+      // Replaces the zip's entry, which stays marked as deferred
+      AddFilesToConfig(file.source, build, ota_tools_files, config,
+                       target_directory, true);
+      AddDeferredFileToConfig(file.source, build, local_path, config,
+                              target_directory, true);
+    } else if (!build_api->ArtifactToFile(build, file.deferred_artifact,
+                                          local_path)) {
+      LOG(FATAL) << "Could not download " << build << ":"
+                 << file.deferred_artifact << " to " << local_path;
+    }
+  }
+}
+
 std::string USAGE_MESSAGE =
     "<flags>\n"
     "\n"
@@ -285,26 +497,44 @@ int FetchCvdMain(int argc, char** argv) {
   gflags::SetUsageMessage(USAGE_MESSAGE);
   gflags::ParseCommandLineFlags(&argc, &argv, true);
 
-  FetcherConfig config;
-  config.RecordFlags();
-
   std::string target_dir = AbsolutePath(FLAGS_directory);
   if (!DirectoryExists(target_dir) && mkdir(target_dir.c_str(), 0777) != 0) {
     LOG(FATAL) << "Could not create " << target_dir;
   }
+  std::string fetcher_path = target_dir + "/fetcher_config.json";
+
+  FetcherConfig config;
+  if (FLAGS_fetch_deferred != "") {
+    if (!config.LoadFromFile(fetcher_path)) {
+      LOG(FATAL) << "Could not load " << fetcher_path;
+    }
+    // Deferred files are downloaded as the fetch that deferred them would have
+    for (const auto& flag : {"api_key", "credential_source"}) {
+      if (gflags::GetCommandLineFlagInfoOrDie(flag).is_default) {
+        gflags::SetCommandLineOption(flag, config.RecordedFlag(flag).c_str());
+      }
+    }
+  } else {
+    config.RecordFlags();
+  }
   std::string target_dir_slash = target_dir;
   std::chrono::seconds retry_period(std::stoi(FLAGS_wait_retry_period));
 
   curl_global_init(CURL_GLOBAL_DEFAULT);
   {
-    auto curl = CurlWrapper::Create();
+    auto curl = CurlWrapper::Create(FLAGS_download_rate_limit << 10);
     auto retrying_curl = CurlWrapper::WithServerErrorRetry(
         *curl, 10, std::chrono::milliseconds(5000));
     std::unique_ptr<CredentialSource> credential_source;
+    // Tells apart the accounts whose tokens are shared between fetches
+    std::string credential_identity;
     if (auto crds = TryOpenServiceAccountFile(*curl, FLAGS_credential_source)) {
       credential_source = std::move(crds);
+      android::base::ReadFileToString(FLAGS_credential_source,
+                                      &credential_identity);
     } else if (FLAGS_credential_source == "gce") {
       credential_source = GceMetadataCredentialSource::make(*retrying_curl);
+      credential_identity = "gce";
     } else if (FLAGS_credential_source == "") {
       std::string file = StringFromEnv("HOME", ".") + "/.acloud_oauth2.dat";
       LOG(VERBOSE) << "Probing acloud credentials at " << file;
@@ -315,6 +545,7 @@ int FetchCvdMain(int argc, char** argv) {
         if (attempt_load.ok()) {
           credential_source.reset(
               new RefreshCredentialSource(std::move(*attempt_load)));
+          android::base::ReadFileToString(file, &credential_identity);
         } else {
           LOG(VERBOSE) << "Failed to load acloud credentials: "
                        << attempt_load.error();
@@ -325,214 +556,339 @@ int FetchCvdMain(int argc, char** argv) {
     } else {
       credential_source = FixedCredentialSource::make(FLAGS_credential_source);
     }
-    BuildApi build_api(*retrying_curl, credential_source.get(), FLAGS_api_key);
-
-    auto default_build = ArgumentToBuild(&build_api, FLAGS_default_build,
-                                         DEFAULT_BUILD_TARGET,
-                                         retry_period);
-
-    std::vector<std::string> host_package_files =
-        download_host_package(&build_api, default_build, target_dir);
-    if (host_package_files.empty()) {
-      LOG(FATAL) << "Could not download host package for " << default_build;
+    if (credential_source && !credential_identity.empty() &&
+        FLAGS_credential_cache_dir != "") {
+      credential_source = CachedCredentialSource::make(
+          std::move(credential_source), FLAGS_credential_cache_dir,
+          credential_identity);
+    }
+    std::unique_ptr<ArtifactCache> artifact_cache;
+    if (FLAGS_artifact_cache_dir != "") {
+      artifact_cache = std::make_unique<ArtifactCache>(
+          FLAGS_artifact_cache_dir, FLAGS_artifact_cache_size_gb << 30);
     }
-    AddFilesToConfig(FileSource::DEFAULT_BUILD, default_build,
-                     host_package_files, &config, target_dir);
+    BuildApi build_api(*retrying_curl, credential_source.get(), FLAGS_api_key,
+                       artifact_cache.get());
 
-    if (FLAGS_system_build != "" || FLAGS_kernel_build != "" || FLAGS_otatools_build != "") {
-      auto ota_build = default_build;
+    if (FLAGS_fetch_deferred != "") {
+      fetch_deferred_files(&build_api,
+                           android::base::Split(FLAGS_fetch_deferred, ","),
+                           target_dir, &config);
+    } else {
+      auto default_build = ArgumentToBuild(&build_api, FLAGS_default_build,
+                                           DEFAULT_BUILD_TARGET,
+                                           retry_period);
+      if (FLAGS_print_build_id) {
+        std::cout << std::visit([](auto&& arg) { return arg.id; },
+                                default_build)
+                  << std::endl;
+        return 0;
+      }
+
+      // Resolve every build up front, as this may block waiting on the builds
+      // to complete. The downloads below then run concurrently.
+      std::optional<Build> system_build;
+      if (FLAGS_system_build != "") {
+        system_build = ArgumentToBuild(&build_api, FLAGS_system_build,
+                                       DEFAULT_BUILD_TARGET, retry_period);
+      }
+      std::optional<Build> ota_build;
       if (FLAGS_otatools_build != "") {
         ota_build = ArgumentToBuild(&build_api, FLAGS_otatools_build,
                                     DEFAULT_BUILD_TARGET, retry_period);
-      } else if (FLAGS_system_build != "") {
-        ota_build = ArgumentToBuild(&build_api, FLAGS_system_build,
-                                    DEFAULT_BUILD_TARGET, retry_period);
+      } else if (system_build) {
+        ota_build = *system_build;
+      } else if (FLAGS_kernel_build != "") {
+        ota_build = default_build;
       }
-      std::vector<std::string> ota_tools_files =
-          download_ota_tools(&build_api, ota_build, target_dir);
-      if (ota_tools_files.empty()) {
-        LOG(FATAL) << "Could not download ota tools for " << ota_build;
-      }
-      AddFilesToConfig(FileSource::DEFAULT_BUILD, default_build,
-                       ota_tools_files, &config, target_dir);
-    }
-    if (FLAGS_download_img_zip) {
-      std::vector<std::string> image_files =
-          download_images(&build_api, default_build, target_dir);
-      if (image_files.empty()) {
-        LOG(FATAL) << "Could not download images for " << default_build;
+      std::optional<Build> kernel_build;
+      if (FLAGS_kernel_build != "") {
+        kernel_build = ArgumentToBuild(&build_api, FLAGS_kernel_build,
+                                       "kernel", retry_period);
       }
-      LOG(INFO) << "Adding img-zip files for default build";
-      for (auto& file : image_files) {
-        LOG(INFO) << file;
+      std::optional<Build> bootloader_build;
+      if (FLAGS_bootloader_build != "") {
+        bootloader_build = ArgumentToBuild(&build_api, FLAGS_bootloader_build,
+                                           "u-boot_crosvm_x86_64", retry_period);
       }
-      AddFilesToConfig(FileSource::DEFAULT_BUILD, default_build, image_files,
-                       &config, target_dir);
-    }
-    if (FLAGS_system_build != "" || FLAGS_download_target_files_zip) {
-      std::string default_target_dir = target_dir + "/default";
-      if (mkdir(default_target_dir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) < 0) {
-        LOG(FATAL) << "Could not create " << default_target_dir;
-      }
-      std::vector<std::string> target_files =
-          download_target_files(&build_api, default_build, default_target_dir);
-      if (target_files.empty()) {
-        LOG(FATAL) << "Could not download target files for " << default_build;
-      }
-      LOG(INFO) << "Adding target files for default build";
-      AddFilesToConfig(FileSource::DEFAULT_BUILD, default_build, target_files,
-                       &config, target_dir);
-    }
 
-    if (FLAGS_system_build != "") {
-      auto system_build = ArgumentToBuild(&build_api, FLAGS_system_build,
-                                          DEFAULT_BUILD_TARGET,
-                                          retry_period);
-      bool system_in_img_zip = true;
-      if (FLAGS_download_img_zip) {
-        std::vector<std::string> image_files =
-            download_images(&build_api, system_build, target_dir,
-                            {"system.img", "product.img"});
-        if (image_files.empty()) {
-          LOG(INFO) << "Could not find system image for " << system_build
-                    << "in the img zip. Assuming a super image build, which will "
-                    << "get the system image from the target zip.";
-          system_in_img_zip = false;
-        } else {
-          LOG(INFO) << "Adding img-zip files for system build";
-          AddFilesToConfig(FileSource::SYSTEM_BUILD, system_build, image_files,
-                           &config, target_dir, true);
+      // With --lazy_fetch, files only needed to rebuild images are left for
+      // the step rebuilding them to download, see --fetch_deferred.
+      auto can_defer = [](const Build& build) {
+        return FLAGS_lazy_fetch && std::holds_alternative<DeviceBuild>(build);
+      };
+      std::string deferred_ota_tools;
+      std::string deferred_default_target;
+      std::string deferred_system_target;
+
+      // Independent artifacts download in parallel. Artifacts that extract
+      // into overlapping paths of target_dir stay ordered within one task. The
+      // produced files are added to the config afterwards in a fixed order.
+      auto host_package_task = std::async(std::launch::async, [&]() {
+        std::vector<std::string> host_package_files =
+            download_host_package(&build_api, default_build, target_dir);
+        if (host_package_files.empty()) {
+          LOG(FATAL) << "Could not download host package for " << default_build;
         }
-      }
-      std::string system_target_dir = target_dir + "/system";
-      if (mkdir(system_target_dir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) < 0) {
-        LOG(FATAL) << "Could not create " << system_target_dir;
-      }
-      std::vector<std::string> target_files =
-          download_target_files(&build_api, system_build, system_target_dir);
-      if (target_files.empty()) {
-        LOG(FATAL) << "Could not download target files for " << system_build;
-        return -1;
-      }
-      AddFilesToConfig(FileSource::SYSTEM_BUILD, system_build, target_files,
-                       &config, target_dir);
-      if (!system_in_img_zip) {
-        if (ExtractImages(target_files[0], target_dir, {"IMAGES/system.img"})
-            != std::vector<std::string>{}) {
-          std::string extracted_system = target_dir + "/IMAGES/system.img";
-          std::string target_system = target_dir + "/system.img";
-          if (rename(extracted_system.c_str(), target_system.c_str())) {
-            int error_num = errno;
-            LOG(FATAL) << "Could not replace system.img in target directory: "
-                       << strerror(error_num);
-            return -1;
+        return host_package_files;
+      });
+
+      auto ota_tools_task = std::async(std::launch::async, [&]() {
+        std::vector<std::string> ota_tools_files;
+        if (ota_build && can_defer(*ota_build)) {
+          deferred_ota_tools = target_dir + "/" + OTA_TOOLS;
+        } else if (ota_build) {
+          ota_tools_files = download_ota_tools(&build_api, *ota_build, target_dir);
+          if (ota_tools_files.empty()) {
+            LOG(FATAL) << "Could not download ota tools for " << *ota_build;
           }
-	} else {
-          LOG(FATAL) << "Could not get system.img from the target zip";
-          return -1;
         }
-	if (ExtractImages(target_files[0], target_dir, {"IMAGES/product.img"})
-	  != std::vector<std::string>{}) {
-          std::string extracted_product = target_dir + "/IMAGES/product.img";
-          std::string target_product = target_dir + "/product.img";
-          if (rename(extracted_product.c_str(), target_product.c_str())) {
-            int error_num = errno;
-            LOG(FATAL) << "Could not replace product.img in target directory"
-                       << strerror(error_num);
-            return -1;
+        return ota_tools_files;
+      });
+
+      std::vector<std::string> default_image_files;
+      std::vector<std::string> system_image_files;
+      std::vector<std::string> system_target_files;
+      auto images_task = std::async(std::launch::async, [&]() {
+        if (FLAGS_download_img_zip) {
+          default_image_files =
+              download_images(&build_api, default_build, target_dir);
+          if (default_image_files.empty()) {
+            LOG(FATAL) << "Could not download images for " << default_build;
           }
-	}
-        if (ExtractImages(target_files[0], target_dir, {"IMAGES/system_ext.img"})
-            != std::vector<std::string>{}) {
-          std::string extracted_system_ext = target_dir + "/IMAGES/system_ext.img";
-          std::string target_system_ext = target_dir + "/system_ext.img";
-          if (rename(extracted_system_ext.c_str(), target_system_ext.c_str())) {
-            int error_num = errno;
-            LOG(FATAL) << "Could not move system_ext.img in target directory: "
-                       << strerror(error_num);
-            return -1;
+        }
+        if (!system_build) {
+          return;
+        }
+        bool system_in_img_zip = true;
+        if (FLAGS_download_img_zip) {
+          system_image_files =
+              download_images(&build_api, *system_build, target_dir,
+                              {"system.img", "product.img"});
+          if (system_image_files.empty()) {
+            LOG(INFO) << "Could not find system image for " << *system_build
+                      << "in the img zip. Assuming a super image build, which will "
+                      << "get the system image from the target zip.";
+            system_in_img_zip = false;
           }
         }
-        if (ExtractImages(target_files[0], target_dir, {"IMAGES/vbmeta_system.img"})
-            != std::vector<std::string>{}) {
-          std::string extracted_vbmeta_system = target_dir + "/IMAGES/vbmeta_system.img";
-          std::string target_vbmeta_system = target_dir + "/vbmeta_system.img";
-          if (rename(extracted_vbmeta_system.c_str(), target_vbmeta_system.c_str())) {
-            int error_num = errno;
-            LOG(FATAL) << "Could not move vbmeta_system.img in target directory: "
-                       << strerror(error_num);
-            return -1;
+        std::string system_target_dir = target_dir + "/system";
+        if (mkdir(system_target_dir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) < 0) {
+          LOG(FATAL) << "Could not create " << system_target_dir;
+        }
+        if (system_in_img_zip && can_defer(*system_build)) {
+          deferred_system_target = deferred_target_files(
+              &build_api, *system_build, system_target_dir);
+          if (deferred_system_target.empty()) {
+            LOG(FATAL) << "Could not find target files for " << *system_build;
           }
+          return;
         }
-        // This should technically call AddFilesToConfig with the produced files,
-        // but it will conflict with the ones produced from the default system image
-        // and pie doesn't care about the produced file list anyway.
-      }
-    }
+        system_target_files =
+            download_target_files(&build_api, *system_build, system_target_dir);
+        if (system_target_files.empty()) {
+          LOG(FATAL) << "Could not download target files for " << *system_build;
+        }
+        if (!system_in_img_zip) {
+          if (ExtractImages(system_target_files[0], target_dir, {"IMAGES/system.img"})
+              != std::vector<std::string>{}) {
+            std::string extracted_system = target_dir + "/IMAGES/system.img";
+            std::string target_system = target_dir + "/system.img";
+            if (rename(extracted_system.c_str(), target_system.c_str())) {
+              int error_num = errno;
+              LOG(FATAL) << "Could not replace system.img in target directory: "
+                         << strerror(error_num);
+            }
+          } else {
+            LOG(FATAL) << "Could not get system.img from the target zip";
+          }
+          if (ExtractImages(system_target_files[0], target_dir, {"IMAGES/product.img"})
+              != std::vector<std::string>{}) {
+            std::string extracted_product = target_dir + "/IMAGES/product.img";
+            std::string target_product = target_dir + "/product.img";
+            if (rename(extracted_product.c_str(), target_product.c_str())) {
+              int error_num = errno;
+              LOG(FATAL) << "Could not replace product.img in target directory"
+                         << strerror(error_num);
+            }
+          }
+          if (ExtractImages(system_target_files[0], target_dir, {"IMAGES/system_ext.img"})
+              != std::vector<std::string>{}) {
+            std::string extracted_system_ext = target_dir + "/IMAGES/system_ext.img";
+            std::string target_system_ext = target_dir + "/system_ext.img";
+            if (rename(extracted_system_ext.c_str(), target_system_ext.c_str())) {
+              int error_num = errno;
+              LOG(FATAL) << "Could not move system_ext.img in target directory: "
+                         << strerror(error_num);
+            }
+          }
+          if (ExtractImages(system_target_files[0], target_dir, {"IMAGES/vbmeta_system.img"})
+              != std::vector<std::string>{}) {
+            std::string extracted_vbmeta_system = target_dir + "/IMAGES/vbmeta_system.img";
+            std::string target_vbmeta_system = target_dir + "/vbmeta_system.img";
+            if (rename(extracted_vbmeta_system.c_str(), target_vbmeta_system.c_str())) {
+              int error_num = errno;
+              LOG(FATAL) << "Could not move vbmeta_system.img in target directory: "
+                         << strerror(error_num);
+            }
+          }
+          // This should technically call AddFilesToConfig with the produced files,
+          // but it will conflict with the ones produced from the default system image
+          // and pie doesn't care about the produced file list anyway.
+        }
+      });
+
+      auto default_target_task = std::async(std::launch::async, [&]() {
+        std::vector<std::string> target_files;
+        if (system_build || FLAGS_download_target_files_zip) {
+          std::string default_target_dir = target_dir + "/default";
+          if (mkdir(default_target_dir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) < 0) {
+            LOG(FATAL) << "Could not create " << default_target_dir;
+          }
+          if (can_defer(default_build)) {
+            deferred_default_target = deferred_target_files(
+                &build_api, default_build, default_target_dir);
+            if (deferred_default_target.empty()) {
+              LOG(FATAL) << "Could not find target files for " << default_build;
+            }
+            return target_files;
+          }
+          target_files =
+              download_target_files(&build_api, default_build, default_target_dir);
+          if (target_files.empty()) {
+            LOG(FATAL) << "Could not download target files for " << default_build;
+          }
+        }
+        return target_files;
+      });
+
+      std::vector<std::string> initramfs_files;
+      auto kernel_task = std::async(std::launch::async, [&]() {
+        std::vector<std::string> kernel_files;
+        if (!kernel_build) {
+          return kernel_files;
+        }
+        std::string local_path = target_dir + "/kernel";
+        // If the kernel is from an arm/aarch64 build, the artifact will be called
+        // Image.
+        if (build_api.ArtifactToFile(*kernel_build, "bzImage", local_path) ||
+            build_api.ArtifactToFile(*kernel_build, "Image", local_path)) {
+          kernel_files.push_back(local_path);
+        } else {
+          LOG(FATAL) << "Could not download " << *kernel_build << ":bzImage to "
+              << local_path;
+        }
+        std::vector<Artifact> kernel_artifacts = build_api.Artifacts(*kernel_build);
+        for (const auto& artifact : kernel_artifacts) {
+          if (artifact.Name() != "initramfs.img") {
+            continue;
+          }
+          bool downloaded = build_api.ArtifactToFile(
+              *kernel_build, "initramfs.img", target_dir + "/initramfs.img");
+          if (!downloaded) {
+            LOG(FATAL) << "Could not download " << *kernel_build << ":initramfs.img to "
+                       << target_dir + "/initramfs.img";
+          }
+          initramfs_files.push_back(target_dir + "/initramfs.img");
+        }
+        return kernel_files;
+      });
 
-    if (FLAGS_kernel_build != "") {
-      auto kernel_build = ArgumentToBuild(&build_api, FLAGS_kernel_build,
-                                          "kernel", retry_period);
+      auto bootloader_task = std::async(std::launch::async, [&]() {
+        std::vector<std::string> bootloader_files;
+        if (!bootloader_build) {
+          return bootloader_files;
+        }
+        std::string local_path = target_dir + "/bootloader";
+        // The img zip of the default build is extracted at the same time and
+        // may hold a bootloader of its own, this one is moved over it once
+        // both are done.
+        std::string download_path = local_path + ".download";
+        // If the bootloader is from an arm/aarch64 build, the artifact will be of
+        // filetype bin.
+        if (build_api.ArtifactToFile(*bootloader_build, "u-boot.rom", download_path) ||
+            build_api.ArtifactToFile(*bootloader_build, "u-boot.bin", download_path)) {
+          bootloader_files.push_back(local_path);
+        } else {
+          LOG(FATAL) << "Could not download " << *bootloader_build << ":u-boot.rom to "
+              << download_path;
+        }
+        return bootloader_files;
+      });
 
-      std::string local_path = target_dir + "/kernel";
-      if (build_api.ArtifactToFile(kernel_build, "bzImage", local_path)) {
-        AddFilesToConfig(FileSource::KERNEL_BUILD, kernel_build, {local_path},
-                         &config, target_dir);
+      AddFilesToConfig(FileSource::DEFAULT_BUILD, default_build,
+                       host_package_task.get(), &config, target_dir);
+      AddFilesToConfig(FileSource::DEFAULT_BUILD, default_build,
+                       ota_tools_task.get(), &config, target_dir);
+      images_task.get();
+      auto default_target_files = default_target_task.get();
+      if (FLAGS_download_img_zip) {
+        LOG(INFO) << "Adding img-zip files for default build";
+        for (auto& file : default_image_files) {
+          LOG(INFO) << file;
+        }
+        AddFilesToConfig(FileSource::DEFAULT_BUILD, default_build,
+                         default_image_files, &config, target_dir);
       }
-      // If the kernel is from an arm/aarch64 build, the artifact will be called
-      // Image.
-      else if (build_api.ArtifactToFile(kernel_build, "Image", local_path)) {
-        AddFilesToConfig(FileSource::KERNEL_BUILD, kernel_build, {local_path},
-                         &config, target_dir);
-      } else {
-        LOG(FATAL) << "Could not download " << kernel_build << ":bzImage to "
-            << local_path;
+      if (!default_target_files.empty()) {
+        LOG(INFO) << "Adding target files for default build";
+        AddFilesToConfig(FileSource::DEFAULT_BUILD, default_build,
+                         default_target_files, &config, target_dir);
       }
-      std::vector<Artifact> kernel_artifacts = build_api.Artifacts(kernel_build);
-      for (const auto& artifact : kernel_artifacts) {
-        if (artifact.Name() != "initramfs.img") {
-          continue;
+      if (system_build) {
+        if (!system_image_files.empty()) {
+          LOG(INFO) << "Adding img-zip files for system build";
+          AddFilesToConfig(FileSource::SYSTEM_BUILD, *system_build,
+                           system_image_files, &config, target_dir, true);
         }
-        bool downloaded = build_api.ArtifactToFile(
-            kernel_build, "initramfs.img", target_dir + "/initramfs.img");
-        if (!downloaded) {
-          LOG(FATAL) << "Could not download " << kernel_build << ":initramfs.img to "
-                     << target_dir + "/initramfs.img";
+        AddFilesToConfig(FileSource::SYSTEM_BUILD, *system_build,
+                         system_target_files, &config, target_dir);
+      }
+      auto kernel_files = kernel_task.get();
+      if (kernel_build) {
+        AddFilesToConfig(FileSource::KERNEL_BUILD, *kernel_build, kernel_files,
+                         &config, target_dir);
+        AddFilesToConfig(FileSource::KERNEL_BUILD, *kernel_build,
+                         initramfs_files, &config, target_dir);
+      }
+      auto bootloader_files = bootloader_task.get();
+      if (bootloader_build) {
+        // images_task is done by now
+        auto bootloader_path = target_dir + "/bootloader";
+        if (!RenameFile(bootloader_path + ".download", bootloader_path)) {
+          LOG(FATAL) << "Could not move the downloaded bootloader to "
+                     << bootloader_path;
         }
-        AddFilesToConfig(FileSource::KERNEL_BUILD, kernel_build,
-                         {target_dir + "/initramfs.img"}, &config, target_dir);
+        AddFilesToConfig(FileSource::BOOTLOADER_BUILD, *bootloader_build,
+                         bootloader_files, &config, target_dir, true);
       }
-    }
-
-    if (FLAGS_bootloader_build != "") {
-      auto bootloader_build = ArgumentToBuild(&build_api,
-                                              FLAGS_bootloader_build,
-                                              "u-boot_crosvm_x86_64",
-					      retry_period);
-
-      std::string local_path = target_dir + "/bootloader";
-      if (build_api.ArtifactToFile(bootloader_build, "u-boot.rom", local_path)) {
-        AddFilesToConfig(FileSource::BOOTLOADER_BUILD, bootloader_build,
-                         {local_path}, &config, target_dir, true);
+      if (!deferred_ota_tools.empty()) {
+        AddDeferredFileToConfig(FileSource::DEFAULT_BUILD, *ota_build,
+                                deferred_ota_tools, &config, target_dir);
       }
-      // If the bootloader is from an arm/aarch64 build, the artifact will be of
-      // filetype bin.
-      else if (build_api.ArtifactToFile(bootloader_build, "u-boot.bin",
-                                        local_path)) {
-        AddFilesToConfig(FileSource::BOOTLOADER_BUILD, bootloader_build,
-                         {local_path}, &config, target_dir, true);
-      } else {
-        LOG(FATAL) << "Could not download " << bootloader_build << ":u-boot.rom to "
-            << local_path;
+      if (!deferred_default_target.empty()) {
+        AddDeferredFileToConfig(FileSource::DEFAULT_BUILD, default_build,
+                                deferred_default_target, &config, target_dir);
+      }
+      if (!deferred_system_target.empty()) {
+        AddDeferredFileToConfig(FileSource::SYSTEM_BUILD, *system_build,
+                                deferred_system_target, &config, target_dir);
+      }
+      if (FLAGS_lazy_fetch) {
+        config.set_fetcher_binary(android::base::GetExecutablePath());
       }
     }
   }
   curl_global_cleanup();
 
+  if (FLAGS_fetch_deferred != "") {
+    // The first fetch already listed every file
+    return config.SaveToFile(fetcher_path) ? 0 : 1;
+  }
+
   // Due to constraints of the build system, artifacts intentionally cannot determine
   // their own build id. So it's unclear which build number fetch_cvd itself was built at.
   // https://android.googlesource.com/platform/build/+/979c9f3/Changes.md#build_number
-  std::string fetcher_path = target_dir + "/fetcher_config.json";
   AddFilesToConfig(GENERATED, DeviceBuild("", ""), {fetcher_path}, &config,
                    target_dir);
   config.SaveToFile(fetcher_path);
@@ -28,13 +28,17 @@
 #include <signal.h>
 
 #include <chrono>
+#include <condition_variable>
 #include <deque>
+#include <map>
 #include <mutex>
+#include <optional>
 #include <sstream>
 #include <thread>
 #include <vector>
 
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android-base/strings.h>
 #include <gflags/gflags.h>
 
@@ -47,6 +51,8 @@ using grpc::Server;
 using grpc::ServerBuilder;
 using grpc::ServerContext;
 using grpc::Status;
+using gnss_grpc_proxy::GnssRecord;
+using gnss_grpc_proxy::SendGnssBatchRequest;
 using gnss_grpc_proxy::SendNmeaRequest;
 using gnss_grpc_proxy::SendNmeaReply;
 using gnss_grpc_proxy::GnssGrpcProxy;
@@ -66,11 +72,78 @@ DEFINE_string(gnss_file_path,
               "",
               "NMEA file path for gnss grpc");
 
+DEFINE_double(gnss_playback_speed, 1.0,
+              "How much faster than recorded to play back gnss_file_path "
+              "and batched records");
+DEFINE_double(gnss_playback_rate_hz, 1.0,
+              "Rate to play back gnss_file_path records that have no usable "
+              "timestamp at");
+
 constexpr char CMD_GET_LOCATION[] = "CMD_GET_LOCATION";
 constexpr char CMD_GET_RAWMEASUREMENT[] = "CMD_GET_RAWMEASUREMENT";
 constexpr char END_OF_MSG_MARK[] = "\n\n\n\n";
 
 constexpr uint32_t GNSS_SERIAL_BUFFER_SIZE = 4096;
+
+// Turns the timestamps of a trace into deadlines so records are played back
+// at the rate they were recorded at, scaled by --gnss_playback_speed. Records
+// without a usable timestamp come 1/--gnss_playback_rate_hz after the
+// previous one. Deadlines are absolute so the playback doesn't drift.
+class PlaybackClock {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  PlaybackClock() : start_(Clock::now()) {}
+
+  // Blocks until the record with the given trace time is due.
+  void WaitForRecord(std::optional<int64_t> trace_time_ns) {
+    if (records_ > 0) {
+      if (trace_time_ns && last_trace_time_ns_ &&
+          *trace_time_ns > *last_trace_time_ns_) {
+        trace_offset_ns_ += *trace_time_ns - *last_trace_time_ns_;
+      } else {
+        trace_offset_ns_ +=
+            static_cast<int64_t>(1e9 / FLAGS_gnss_playback_rate_hz);
+      }
+    }
+    records_++;
+    if (trace_time_ns) {
+      last_trace_time_ns_ = trace_time_ns;
+    }
+    auto offset = std::chrono::nanoseconds(static_cast<int64_t>(
+        trace_offset_ns_ / FLAGS_gnss_playback_speed));
+    std::this_thread::sleep_until(start_ + offset);
+  }
+
+ private:
+  Clock::time_point start_;
+  int64_t trace_offset_ns_ = 0;
+  std::optional<int64_t> last_trace_time_ns_;
+  uint64_t records_ = 0;
+};
+
+// The time of day of a $GPGGA or $GPRMC sentence, hhmmss.ss in the second
+// field.
+std::optional<int64_t> NmeaTimeOfDayNanos(const std::string& sentence) {
+  auto fields = android::base::Split(sentence, ",");
+  if (fields.size() < 2 || fields[1].size() < 6) {
+    return {};
+  }
+  int hours, minutes;
+  if (!android::base::ParseInt(fields[1].substr(0, 2), &hours) ||
+      !android::base::ParseInt(fields[1].substr(2, 2), &minutes)) {
+    return {};
+  }
+  char* end;
+  double seconds = strtod(fields[1].c_str() + 4, &end);
+  if (*end != '\0') {
+    return {};
+  }
+  // Going past midnight goes back in time, the clock falls back to the
+  // configured rate for that record.
+  return static_cast<int64_t>(((hours * 60 + minutes) * 60 + seconds) * 1e9);
+}
+
 // Logic and data behind the server's behavior.
 class GnssGrpcProxyServiceImpl final : public GnssGrpcProxy::Service {
   public:
@@ -86,6 +159,26 @@ class GnssGrpcProxyServiceImpl final : public GnssGrpcProxy::Service {
       return Status::OK;
     }
 
+    Status SendGnssBatch(ServerContext* context,
+                         const SendGnssBatchRequest* request,
+                         SendNmeaReply* reply) override {
+      auto now = PlaybackClock::Clock::now();
+      std::multimap<PlaybackClock::Clock::time_point, GnssRecord> records;
+      for (const auto& record : request->records()) {
+        auto offset = std::chrono::nanoseconds(static_cast<int64_t>(
+            record.offset_ms() * 1e6 / FLAGS_gnss_playback_speed));
+        records.emplace(now + offset, record);
+      }
+      {
+        std::lock_guard<std::mutex> lock(batch_mutex_);
+        batch_records_ = std::move(records);
+      }
+      batch_cv_.notify_one();
+      reply->set_reply("Received " + std::to_string(request->records_size()) +
+                       " gnss records.");
+      return Status::OK;
+    }
+
     void sendToSerial() {
       std::lock_guard<std::mutex> lock(cached_nmea_mutex);
       if (!isNMEA(cached_nmea)) {
@@ -125,6 +218,10 @@ class GnssGrpcProxyServiceImpl final : public GnssGrpcProxy::Service {
       read_thread_ = std::thread([this]() { ReadLoop(); });
     }
 
+    void StartBatchPlaybackThread() {
+      batch_thread_ = std::thread([this]() { PlayBatches(); });
+    }
+
     void StartReadNmeaFileThread() {
       // Create a new thread to read nmea data.
       nmea_file_read_thread_ =
@@ -143,6 +240,7 @@ class GnssGrpcProxyServiceImpl final : public GnssGrpcProxy::Service {
           std::string line;
           std::string lastLine;
           int count = 0;
+          PlaybackClock clock;
           while (std::getline(file, line)) {
               count++;
               /* Only support a lite version of NEMA format to make it simple.
@@ -151,16 +249,17 @@ class GnssGrpcProxyServiceImpl final : public GnssGrpcProxy::Service {
                * $GPRMC,213204.00,A,3725.371240,N,12205.589239,W,000.0,000.0,290819,,,A*49
                * $GPGGA,....
                * $GPRMC,....
-               * Sending at 1Hz, currently user should
-               * provide a NMEA file that has one location per second. need some extra work
-               * to make it more generic, i.e. align with the timestamp in the file.
+               * Each pair is played at the time in its sentences, so files
+               * with several locations per second play at that rate.
                */
               if (count % 2 == 0) {
-                {
-                  std::lock_guard<std::mutex> lock(cached_nmea_mutex);
-                  cached_nmea = lastLine + '\n' + line;
+                auto time_ns = NmeaTimeOfDayNanos(line);
+                if (!time_ns) {
+                  time_ns = NmeaTimeOfDayNanos(lastLine);
                 }
-                std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+                clock.WaitForRecord(time_ns);
+                std::lock_guard<std::mutex> lock(cached_nmea_mutex);
+                cached_nmea = lastLine + '\n' + line;
               }
               lastLine = line;
           }
@@ -178,6 +277,7 @@ class GnssGrpcProxyServiceImpl final : public GnssGrpcProxy::Service {
         std::string line;
         std::string cached_line = "";
         std::string header = "";
+        PlaybackClock clock;
 
         while (!cached_line.empty() || std::getline(file, line)) {
           if (!cached_line.empty()) {
@@ -197,23 +297,25 @@ class GnssGrpcProxyServiceImpl final : public GnssGrpcProxy::Service {
             continue;
           }
 
-          {
-            std::lock_guard<std::mutex> lock(cached_gnss_raw_mutex);
-            cached_gnss_raw = header + "\n" + line;
-
-            std::string new_line = "";
-            while (std::getline(file, new_line)) {
-              // Group raw data by TimeNanos.
-              if (getTimeNanosFromLine(new_line) ==
-                  getTimeNanosFromLine(line)) {
-                cached_gnss_raw += "\n" + new_line;
-              } else {
-                cached_line = new_line;
-                break;
-              }
+          // Group raw data by TimeNanos, it's built outside of the lock so the
+          // serial reader isn't kept waiting on the file.
+          std::string record = header + "\n" + line;
+          std::string new_line = "";
+          while (std::getline(file, new_line)) {
+            if (getTimeNanosFromLine(new_line) == getTimeNanosFromLine(line)) {
+              record += "\n" + new_line;
+            } else {
+              cached_line = new_line;
+              break;
             }
           }
-          std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+          int64_t time_ns;
+          clock.WaitForRecord(
+              android::base::ParseInt(getTimeNanosFromLine(line), &time_ns)
+                  ? std::optional<int64_t>(time_ns)
+                  : std::nullopt);
+          std::lock_guard<std::mutex> lock(cached_gnss_raw_mutex);
+          cached_gnss_raw = std::move(record);
         }
         file.close();
       } else {
@@ -232,9 +334,39 @@ class GnssGrpcProxyServiceImpl final : public GnssGrpcProxy::Service {
       if (read_thread_.joinable()) {
         read_thread_.join();
       }
+      if (batch_thread_.joinable()) {
+        batch_thread_.join();
+      }
     }
 
   private:
+    [[noreturn]] void PlayBatches() {
+      std::unique_lock<std::mutex> lock(batch_mutex_);
+      while (true) {
+        if (batch_records_.empty()) {
+          batch_cv_.wait(lock);
+          continue;
+        }
+        auto next = batch_records_.begin();
+        // Woken up early when a new batch replaces this one
+        if (batch_cv_.wait_until(lock, next->first) !=
+            std::cv_status::timeout) {
+          continue;
+        }
+        auto record = std::move(next->second);
+        batch_records_.erase(next);
+        lock.unlock();
+        if (record.has_nmea()) {
+          std::lock_guard<std::mutex> nmea_lock(cached_nmea_mutex);
+          cached_nmea = record.nmea();
+        } else if (record.has_raw_measurement()) {
+          std::lock_guard<std::mutex> raw_lock(cached_gnss_raw_mutex);
+          cached_gnss_raw = record.raw_measurement();
+        }
+        lock.lock();
+      }
+    }
+
     [[noreturn]] void ReadLoop() {
       cuttlefish::SharedFDSet read_set;
       read_set.Set(gnss_out_);
@@ -299,6 +431,11 @@ class GnssGrpcProxyServiceImpl final : public GnssGrpcProxy::Service {
     std::thread read_thread_;
     std::thread nmea_file_read_thread_;
     std::thread measurement_file_read_thread_;
+    std::thread batch_thread_;
+
+    std::multimap<PlaybackClock::Clock::time_point, GnssRecord> batch_records_;
+    std::mutex batch_mutex_;
+    std::condition_variable batch_cv_;
 
     std::string cached_nmea;
     std::mutex cached_nmea_mutex;
@@ -338,6 +475,7 @@ void RunServer() {
       std::this_thread::sleep_for(std::chrono::milliseconds(2000));
     }
   } else {
+    service.StartBatchPlaybackThread();
     ServerBuilder builder;
     // Listen on the given address without any authentication mechanism.
     builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
@@ -359,6 +497,9 @@ void RunServer() {
 int main(int argc, char** argv) {
   ::android::base::InitLogging(argv, android::base::StderrLogger);
   ::gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CHECK(FLAGS_gnss_playback_speed > 0) << "--gnss_playback_speed must be > 0";
+  CHECK(FLAGS_gnss_playback_rate_hz > 0)
+      << "--gnss_playback_rate_hz must be > 0";
 
   LOG(DEBUG) << "Starting gnss grpc proxy server...";
   RunServer();
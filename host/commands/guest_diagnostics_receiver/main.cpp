@@ -0,0 +1,585 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <deque>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+#include <zlib.h>
+
+#include "common/libs/fs/epoll.h"
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/files.h"
+#include "common/libs/utils/flag_parser.h"
+#include "common/libs/utils/result.h"
+#include "common/libs/utils/shared_fd_flag.h"
+#include "host/libs/config/cuttlefish_config.h"
+#include "host/libs/config/logging.h"
+#include "host/libs/log_store/log_store.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr size_t kReadSize = 64 * 1024;
+// Most tombstones are smaller than this, so they are written without growing
+// the file. The unused tail is released when the upload completes.
+constexpr off_t kTombstonePreallocation = 1 << 20;
+// tombstone_transmit may gzip uploads. Tombstones are text or protobuf, and
+// neither can start with these bytes.
+constexpr char kGzipMagic[] = {'\x1f', '\x8b'};
+
+// The guest writes `logcat -v threadtime`, the priority is the fifth field:
+// "MM-DD HH:MM:SS.mmm  PID  TID P TAG: message"
+android::base::LogSeverity LogcatLineSeverity(std::string_view line) {
+  for (int field = 0; field < 4; field++) {
+    auto start = line.find_first_not_of(' ');
+    if (start == std::string_view::npos) {
+      return android::base::INFO;
+    }
+    line.remove_prefix(start);
+    auto end = line.find(' ');
+    if (end == std::string_view::npos) {
+      return android::base::INFO;
+    }
+    line.remove_prefix(end);
+  }
+  line.remove_prefix(std::min(line.find_first_not_of(' '), line.size()));
+  if (line.size() < 2 || line[1] != ' ') {
+    return android::base::INFO;
+  }
+  switch (line[0]) {
+    case 'V':
+      return android::base::VERBOSE;
+    case 'D':
+      return android::base::DEBUG;
+    case 'W':
+      return android::base::WARNING;
+    case 'E':
+      return android::base::ERROR;
+    case 'F':
+      return android::base::FATAL;
+    default:
+      return android::base::INFO;
+  }
+}
+
+// Copies the guest's logcat output from the pipe to the logcat file.
+class LogcatReceiver {
+ public:
+  LogcatReceiver(SharedFD pipe, SharedFD logcat_file,
+                 std::optional<LogStoreWriter> log_store)
+      : pipe_(pipe),
+        logcat_file_(logcat_file),
+        log_store_(std::move(log_store)) {}
+
+  Result<void> Start(Epoll& epoll) {
+    CF_EXPECT(epoll.Add(pipe_, EPOLLIN));
+    return {};
+  }
+
+  // Returns whether the event belonged to the logcat pipe
+  Result<bool> Handle(const EpollEvent& event) {
+    if (event.fd != pipe_) {
+      return false;
+    }
+    char buff[kReadSize];
+    auto read = pipe_->Read(buff, sizeof(buff));
+    CF_EXPECT(read >= 0, "Could not read logcat: " << pipe_->StrError());
+    auto written = WriteAll(logcat_file_, buff, read);
+    CF_EXPECT(written == read, "Error writing to log file: "
+                                   << logcat_file_->StrError()
+                                   << ". This is unrecoverable.");
+    if (log_store_) {
+      StoreLines(std::string_view(buff, read));
+    }
+    return true;
+  }
+
+  // How long the epoll can wait before the store's current chunk has to be
+  // written, -1 if it can wait forever.
+  int StoreTimeoutMs() const {
+    if (!log_store_) {
+      return -1;
+    }
+    auto timeout = log_store_->TimeUntilFlush();
+    return timeout ? timeout->count() : -1;
+  }
+
+  // Writes the lines received before logcat went quiet
+  void FlushStore() {
+    if (!log_store_) {
+      return;
+    }
+    auto result = log_store_->MaybeFlush();
+    if (!result.ok()) {
+      LOG(ERROR) << "Could not write the log store: " << result.error();
+    }
+  }
+
+ private:
+  void StoreLines(std::string_view data) {
+    auto now = LogStoreNow();
+    for (auto newline = data.find('\n'); newline != std::string_view::npos;
+         newline = data.find('\n')) {
+      partial_line_.append(data.substr(0, newline));
+      auto line = android::base::Trim(partial_line_);
+      if (!line.empty()) {
+        log_store_->Append(now, LogcatLineSeverity(line), "", line);
+      }
+      partial_line_.clear();
+      data.remove_prefix(newline + 1);
+    }
+    partial_line_.append(data);
+    FlushStore();
+  }
+
+  SharedFD pipe_;
+  SharedFD logcat_file_;
+  std::optional<LogStoreWriter> log_store_;
+  std::string partial_line_;
+};
+
+// Gzips finished tombstones on a worker thread, so a crash storm doesn't
+// delay accepting the next uploads.
+class TombstoneCompressor {
+ public:
+  TombstoneCompressor() : thread_([this]() { Run(); }) {}
+
+  void Compress(std::string path) {
+    std::lock_guard lock(mutex_);
+    pending_.emplace_back(std::move(path));
+    cv_.notify_one();
+  }
+
+ private:
+  [[noreturn]] void Run() {
+    while (true) {
+      std::string path;
+      {
+        std::unique_lock lock(mutex_);
+        cv_.wait(lock, [this]() { return !pending_.empty(); });
+        path = std::move(pending_.front());
+        pending_.pop_front();
+      }
+      auto result = CompressFile(path);
+      if (!result.ok()) {
+        LOG(ERROR) << "Failed to compress " << path << ": " << result.error();
+      }
+    }
+  }
+
+  static Result<void> CompressFile(const std::string& path) {
+    auto in = SharedFD::Open(path, O_RDONLY);
+    CF_EXPECT(in->IsOpen(), "Could not open: " << in->StrError());
+    // Written under a temporary name so the tombstone directory never holds a
+    // truncated archive.
+    auto tmp_path = path + ".gz.tmp";
+    auto out = gzopen(tmp_path.c_str(), "wb");
+    CF_EXPECT(out != nullptr, "Could not create \"" << tmp_path << "\"");
+    char buff[kReadSize];
+    ssize_t read;
+    bool write_ok = true;
+    while (write_ok && (read = in->Read(buff, sizeof(buff))) > 0) {
+      write_ok = gzwrite(out, buff, read) == read;
+    }
+    bool close_ok = gzclose(out) == Z_OK;
+    if (read < 0 || !write_ok || !close_ok) {
+      unlink(tmp_path.c_str());
+    }
+    CF_EXPECT(read >= 0, "Read failed: " << in->StrError());
+    CF_EXPECT(write_ok && close_ok, "Could not write \"" << tmp_path << "\"");
+    CF_EXPECT(rename(tmp_path.c_str(), (path + ".gz").c_str()) == 0,
+              "rename failed: " << strerror(errno));
+    CF_EXPECT(unlink(path.c_str()) == 0, "unlink failed: " << strerror(errno));
+    return {};
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::string> pending_;
+  std::thread thread_;
+};
+
+// Decompresses the uploads tombstone_transmit sends gzip compressed.
+class TombstoneInflater {
+ public:
+  TombstoneInflater() {
+    // 15 window bits, +16 to expect a gzip header
+    initialized_ = inflateInit2(&stream_, 15 + 16) == Z_OK;
+  }
+  ~TombstoneInflater() {
+    if (initialized_) {
+      inflateEnd(&stream_);
+    }
+  }
+
+  // Returns the number of decompressed bytes written to `out`
+  Result<size_t> Inflate(const char* data, size_t size, SharedFD out) {
+    if (!initialized_) {
+      return CF_ERR("Could not initialize zlib");
+    }
+    stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream_.avail_in = size;
+    size_t total = 0;
+    // A full output buffer may leave inflated bytes behind even after all of
+    // the input was consumed
+    stream_.avail_out = 0;
+    while ((stream_.avail_in > 0 || stream_.avail_out == 0) && !finished_) {
+      stream_.next_out = reinterpret_cast<Bytef*>(buffer_);
+      stream_.avail_out = sizeof(buffer_);
+      auto result = inflate(&stream_, Z_NO_FLUSH);
+      CF_EXPECT(result == Z_OK || result == Z_STREAM_END ||
+                    result == Z_BUF_ERROR,
+                "Corrupt compressed tombstone: " << result);
+      finished_ = result == Z_STREAM_END;
+      ssize_t inflated = sizeof(buffer_) - stream_.avail_out;
+      CF_EXPECT(WriteAll(out, buffer_, inflated) == inflated,
+                out->StrError());
+      total += inflated;
+    }
+    return total;
+  }
+
+  // Whether the end of the gzip stream was seen, uploads that stop before it
+  // are truncated.
+  bool Finished() const { return finished_; }
+
+ private:
+  z_stream stream_ = {};
+  bool initialized_ = false;
+  bool finished_ = false;
+  char buffer_[kReadSize];
+};
+
+// Accepts tombstone uploads from the guest. Every connection is written to its
+// own file, so any number of them can be in flight at once.
+class TombstoneReceiver {
+ public:
+  TombstoneReceiver(SharedFD server, std::string tombstone_dir,
+                    TombstoneCompressor* compressor)
+      : server_(server),
+        tombstone_dir_(std::move(tombstone_dir)),
+        compressor_(compressor) {}
+
+  Result<void> Start(Epoll& epoll) {
+    CF_EXPECT(epoll.Add(server_, EPOLLIN));
+    return {};
+  }
+
+  // Returns whether the event belonged to the tombstone server or an upload
+  Result<bool> Handle(Epoll& epoll, const EpollEvent& event) {
+    if (event.fd == server_) {
+      CF_EXPECT(AcceptUpload(epoll));
+      return true;
+    }
+    auto it = uploads_.find(event.fd);
+    if (it == uploads_.end()) {
+      return false;
+    }
+    if (!ReceiveChunk(it->first, it->second)) {
+      CF_EXPECT(epoll.Delete(it->first));
+      FinishUpload(it->second);
+      uploads_.erase(it);
+    }
+    return true;
+  }
+
+ private:
+  struct Upload {
+    enum class Encoding {
+      kUnknown,
+      kPlain,
+      kGzip,
+      // Compressed by the guest and stored as received, instead of being
+      // decompressed here and compressed again by the TombstoneCompressor.
+      kGzipStored,
+    };
+    SharedFD file;
+    std::string path;
+    off_t size = 0;
+    Encoding encoding = Encoding::kUnknown;
+    // The first bytes, until there are enough to recognize a gzip header
+    std::string prefix;
+    std::unique_ptr<TombstoneInflater> inflater;
+  };
+
+  Result<void> AcceptUpload(Epoll& epoll) {
+    auto conn = SharedFD::Accept(*server_);
+    if (!conn->IsOpen()) {
+      LOG(ERROR) << "Failed to accept tombstone connection: "
+                 << conn->StrError();
+      return {};
+    }
+    CF_EXPECT(conn->Fcntl(F_SETFL, O_NONBLOCK) == 0, conn->StrError());
+    Upload upload;
+    upload.file = OpenNextTombstone(upload.path);
+    if (!upload.file->IsOpen()) {
+      LOG(ERROR) << "Failed to create a tombstone file: "
+                 << upload.file->StrError();
+      return {};
+    }
+    // Not all filesystems support this, it's only an optimization.
+    upload.file->Fallocate(FALLOC_FL_KEEP_SIZE, 0, kTombstonePreallocation);
+    CF_EXPECT(epoll.Add(conn, EPOLLIN));
+    uploads_.emplace(conn, std::move(upload));
+    return {};
+  }
+
+  // Returns false once the upload is complete.
+  bool ReceiveChunk(SharedFD conn, Upload& upload) {
+    char buff[kReadSize];
+    auto read = conn->Read(buff, sizeof(buff));
+    if (read < 0 && conn->GetErrno() == EAGAIN) {
+      return true;
+    } else if (read <= 0) {
+      return false;
+    }
+    if (upload.encoding == Upload::Encoding::kUnknown) {
+      upload.prefix.append(buff, read);
+      if (upload.prefix.size() < sizeof(kGzipMagic)) {
+        return true;
+      }
+      bool gzip = std::equal(std::begin(kGzipMagic), std::end(kGzipMagic),
+                             upload.prefix.begin());
+      if (!gzip) {
+        upload.encoding = Upload::Encoding::kPlain;
+      } else if (compressor_) {
+        upload.encoding = Upload::Encoding::kGzipStored;
+      } else {
+        upload.encoding = Upload::Encoding::kGzip;
+        upload.inflater = std::make_unique<TombstoneInflater>();
+      }
+      auto result = Store(upload, upload.prefix.data(), upload.prefix.size());
+      upload.prefix.clear();
+      return result;
+    }
+    return Store(upload, buff, read);
+  }
+
+  // Returns false if the upload can't continue.
+  bool Store(Upload& upload, const char* data, size_t size) {
+    if (upload.encoding == Upload::Encoding::kGzip) {
+      auto inflated = upload.inflater->Inflate(data, size, upload.file);
+      if (!inflated.ok()) {
+        LOG(ERROR) << "Error writing to " << upload.path << ": "
+                   << inflated.error();
+        return false;
+      }
+      upload.size += *inflated;
+      return true;
+    }
+    if (WriteAll(upload.file, data, size) != static_cast<ssize_t>(size)) {
+      LOG(ERROR) << "Error writing to " << upload.path << ": "
+                 << upload.file->StrError();
+      return false;
+    }
+    upload.size += size;
+    return true;
+  }
+
+  void FinishUpload(Upload& upload) {
+    // Uploads too short to hold a gzip header
+    if (upload.encoding == Upload::Encoding::kUnknown) {
+      upload.encoding = Upload::Encoding::kPlain;
+      Store(upload, upload.prefix.data(), upload.prefix.size());
+    }
+    if (upload.encoding == Upload::Encoding::kGzip &&
+        !upload.inflater->Finished()) {
+      LOG(ERROR) << "Compressed tombstone " << upload.path
+                 << " ended early, it is truncated";
+    }
+    // Drops the part of the preallocation that wasn't used
+    if (upload.file->Truncate(upload.size) < 0) {
+      LOG(ERROR) << "Failed to truncate " << upload.path << ": "
+                 << upload.file->StrError();
+    }
+    upload.file->Close();
+    LOG(DEBUG) << "Received " << upload.path;
+    if (upload.encoding == Upload::Encoding::kGzipStored) {
+      auto gz_path = upload.path + ".gz";
+      if (rename(upload.path.c_str(), gz_path.c_str()) != 0) {
+        LOG(ERROR) << "Failed to rename " << upload.path << ": "
+                   << strerror(errno);
+      }
+    } else if (compressor_) {
+      compressor_->Compress(upload.path);
+    }
+  }
+
+  // Names are based on the time of the upload, with a counter for those in
+  // the same second. The files are created exclusively, so the files from a
+  // previous run of the receiver are never overwritten.
+  SharedFD OpenNextTombstone(std::string& path) {
+    auto now = std::chrono::system_clock::to_time_t(
+        std::chrono::system_clock::now());
+    char time_str[32];
+    std::strftime(time_str, sizeof(time_str), "%Y-%m-%d-%H%M%S",
+                  std::gmtime(&now));
+    auto base = tombstone_dir_ + "/tombstone_" + time_str;
+    if (base != last_tombstone_base_) {
+      last_tombstone_base_ = base;
+      tombstones_in_last_second_ = 0;
+    }
+    while (true) {
+      path = base;
+      if (tombstones_in_last_second_ > 0) {
+        path += "_" + std::to_string(tombstones_in_last_second_);
+      }
+      tombstones_in_last_second_++;
+      if (compressor_ && FileExists(path + ".gz")) {
+        continue;
+      }
+      auto file = SharedFD::Open(path, O_CREAT | O_EXCL | O_WRONLY, 0666);
+      if (file->IsOpen() || file->GetErrno() != EEXIST) {
+        LOG(DEBUG) << "Creating " << path;
+        return file;
+      }
+    }
+  }
+
+  SharedFD server_;
+  std::string tombstone_dir_;
+  TombstoneCompressor* compressor_;
+  std::map<SharedFD, Upload> uploads_;
+  std::string last_tombstone_base_;
+  int tombstones_in_last_second_ = 0;
+};
+
+Result<void> ReceiveDiagnostics(LogcatReceiver& logcat,
+                                TombstoneReceiver& tombstones) {
+  auto epoll = CF_EXPECT(Epoll::Create());
+  CF_EXPECT(logcat.Start(epoll));
+  CF_EXPECT(tombstones.Start(epoll));
+  while (true) {
+    auto event = CF_EXPECT(epoll.Wait(logcat.StoreTimeoutMs()));
+    if (!event) {
+      logcat.FlushStore();
+      continue;
+    }
+    if (CF_EXPECT(logcat.Handle(*event))) {
+      continue;
+    }
+    CF_EXPECT(tombstones.Handle(epoll, *event));
+  }
+}
+
+}  // namespace
+
+int GuestDiagnosticsReceiverMain(int argc, char** argv) {
+  DefaultSubprocessLogging(argv);
+
+  std::vector<Flag> flags;
+
+  SharedFD log_pipe;
+  flags.emplace_back(
+      SharedFDFlag("log_pipe_fd", log_pipe)
+          .Help("A file descriptor representing a (UNIX) socket from which to "
+                "read the logs. If not given the pipe is opened according to "
+                "the instance configuration"));
+
+  std::string tombstone_dir;
+  flags.emplace_back(GflagsCompatFlag("tombstone_dir", tombstone_dir)
+                         .Help("directory to write out tombstones in"));
+
+  SharedFD server_fd;
+  flags.emplace_back(
+      SharedFDFlag("server_fd", server_fd)
+          .Help("File descriptor to an already created vsock server"));
+
+  bool compress_tombstones = false;
+  flags.emplace_back(
+      GflagsCompatFlag("compress_tombstones", compress_tombstones)
+          .Help("gzip the tombstones once they are received"));
+
+  flags.emplace_back(HelpFlag(flags));
+  flags.emplace_back(UnexpectedArgumentGuard());
+
+  std::vector<std::string> args =
+      ArgsToVec(argc - 1, argv + 1);  // Skip argv[0]
+  CHECK(ParseFlags(flags, args)) << "Could not process command line flags.";
+
+  CHECK(server_fd->IsOpen()) << "Did not receive a server fd";
+
+  auto config = CuttlefishConfig::Get();
+  CHECK(config) << "Could not open cuttlefish config";
+
+  auto instance = config->ForDefaultInstance();
+
+  // Disable default handling of SIGPIPE
+  CHECK(signal(SIGPIPE, SIG_IGN) != SIG_ERR)
+      << "Failed to set SIGPIPE to be ignored: " << strerror(errno);
+
+  if (!log_pipe->IsOpen()) {
+    log_pipe = SharedFD::Open(instance.logcat_pipe_name(), O_RDONLY);
+  }
+  CHECK(log_pipe->IsOpen()) << "Error opening log pipe: "
+                            << log_pipe->StrError();
+
+  auto logcat_path = instance.logcat_path();
+  auto logcat_file =
+      SharedFD::Open(logcat_path, O_CREAT | O_APPEND | O_WRONLY, 0666);
+  CHECK(logcat_file->IsOpen()) << "Error opening " << logcat_path << ": "
+                               << logcat_file->StrError();
+
+  std::optional<LogStoreWriter> log_store;
+  if (config->structured_logs()) {
+    auto writer = LogStoreWriter::Create(instance.log_store_dir(), "logcat");
+    if (writer.ok()) {
+      log_store = std::move(*writer);
+    } else {
+      LOG(ERROR) << "Failed to open the log store: " << writer.error();
+    }
+  }
+
+  LOG(DEBUG) << "Host is starting server on port "
+             << server_fd->VsockServerPort();
+
+  std::optional<TombstoneCompressor> compressor;
+  if (compress_tombstones) {
+    compressor.emplace();
+  }
+
+  LogcatReceiver logcat(log_pipe, logcat_file, std::move(log_store));
+  TombstoneReceiver tombstones(server_fd, tombstone_dir,
+                               compressor ? &*compressor : nullptr);
+  auto result = ReceiveDiagnostics(logcat, tombstones);
+  LOG(FATAL) << result.error();
+  return 1;
+}
+
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  return cuttlefish::GuestDiagnosticsReceiverMain(argc, argv);
+}
@@ -15,36 +15,34 @@
  */
 
 #include <stdio.h>
-#include <fstream>
+#include <optional>
 #include <string>
+#include <thread>
 
 #include <android-base/logging.h>
 #include <android-base/strings.h>
 #include <gflags/gflags.h>
 
-#include "common/libs/fs/shared_fd.h"
-#include "common/libs/fs/shared_select.h"
 #include "common/libs/utils/files.h"
+#include "host/commands/host_bugreport/parallel_zip_writer.h"
 #include "host/libs/config/cuttlefish_config.h"
-#include "ziparchive/zip_writer.h"
 
 DEFINE_string(output, "host_bugreport.zip", "Where to write the output");
+DEFINE_int32(log_tail_mb, 256,
+             "Only save the last this many MiB of each log, 0 for whole logs");
+DEFINE_int32(compression_threads, 0,
+             "Threads compressing the output, 0 for one per CPU");
 
 namespace cuttlefish {
 namespace {
 
-void SaveFile(ZipWriter& writer, const std::string& zip_path,
-              const std::string& file_path) {
-  writer.StartEntry(zip_path, ZipWriter::kCompress | ZipWriter::kAlign32);
-  std::fstream file(file_path, std::fstream::in | std::fstream::binary);
-  do {
-    char data[1024 * 10];
-    file.read(data, sizeof(data));
-    writer.WriteBytes(data, file.gcount());
-  } while (file);
-  writer.FinishEntry();
-  if (file.bad()) {
-    LOG(ERROR) << "Error in logging " << file_path << " to " << zip_path;
+void SaveFile(ParallelZipWriter& writer, const std::string& zip_path,
+              const std::string& file_path,
+              std::optional<std::size_t> tail_size = std::nullopt) {
+  auto result = writer.AddFile(zip_path, file_path, tail_size);
+  if (!result.ok()) {
+    LOG(ERROR) << "Error in logging " << file_path << " to " << zip_path
+               << ": " << result.error();
   }
 }
 
@@ -55,9 +53,16 @@ int CvdHostBugreportMain(int argc, char** argv) {
   auto config = CuttlefishConfig::Get();
   CHECK(config) << "Unable to find the config";
 
-  auto out_path = FLAGS_output.c_str();
-  std::unique_ptr<FILE, decltype(&fclose)> out(fopen(out_path, "wb"), &fclose);
-  ZipWriter writer(out.get());
+  auto threads = FLAGS_compression_threads > 0
+                     ? FLAGS_compression_threads
+                     : std::thread::hardware_concurrency();
+  auto writer_result = ParallelZipWriter::Create(FLAGS_output, threads);
+  CHECK(writer_result.ok()) << writer_result.error();
+  auto& writer = **writer_result;
+  std::optional<std::size_t> log_tail;
+  if (FLAGS_log_tail_mb > 0) {
+    log_tail = static_cast<std::size_t>(FLAGS_log_tail_mb) << 20;
+  }
 
   auto save = [&writer, config](const std::string& path) {
     SaveFile(writer, "cuttlefish_assembly/" + path, config->AssemblyPath(path));
@@ -66,17 +71,19 @@ int CvdHostBugreportMain(int argc, char** argv) {
   save("cuttlefish_config.json");
 
   for (const auto& instance : config->Instances()) {
-    auto save = [&writer, instance](const std::string& path) {
+    auto save = [&writer, instance](const std::string& path,
+                                    std::optional<std::size_t> tail_size =
+                                        std::nullopt) {
       const auto& zip_name = instance.instance_name() + "/" + path;
       const auto& file_name = instance.PerInstancePath(path.c_str());
-      SaveFile(writer, zip_name, file_name);
+      SaveFile(writer, zip_name, file_name, tail_size);
     };
     save("cuttlefish_config.json");
     save("disk_config.txt");
-    save("kernel.log");
-    save("launcher.log");
-    save("logcat");
-    save("metrics.log");
+    save("kernel.log", log_tail);
+    save("launcher.log", log_tail);
+    save("logcat", log_tail);
+    save("metrics.log", log_tail);
     auto tombstones = DirectoryContents(instance.PerInstancePath("tombstones"));
     for (const auto& tombstone : tombstones) {
       if (tombstone == "." || tombstone == "..") {
@@ -93,7 +100,8 @@ int CvdHostBugreportMain(int argc, char** argv) {
     }
   }
 
-  writer.Finish();
+  auto finished = writer.Finish();
+  CHECK(finished.ok()) << finished.error();
 
   LOG(INFO) << "Saved to \"" << FLAGS_output << "\"";
 
@@ -0,0 +1,319 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/host_bugreport/parallel_zip_writer.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <deque>
+#include <future>
+#include <string_view>
+
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr std::size_t kChunkSize = 4 << 20;
+// The most deflate can refer back to
+constexpr std::size_t kDictionarySize = 32 << 10;
+
+constexpr uint16_t kMethodStored = 0;
+constexpr uint16_t kMethodDeflated = 8;
+constexpr uint16_t kVersionNeeded = 20;
+// Unix, version 2.0
+constexpr uint16_t kVersionMadeBy = (3 << 8) | 20;
+constexpr uint16_t kFlagUtf8 = 1 << 11;
+constexpr uint32_t kLocalHeaderSignature = 0x04034b50;
+constexpr uint32_t kCentralHeaderSignature = 0x02014b50;
+constexpr uint32_t kEndOfCentralDirectorySignature = 0x06054b50;
+// Where the crc and sizes are in a local header
+constexpr long kLocalHeaderCrcOffset = 14;
+
+struct Chunk {
+  std::string data;
+  // The end of the previous chunk
+  std::string dictionary;
+  bool last;
+  bool store;
+};
+
+struct CompressedChunk {
+  std::string data;
+  uint32_t crc;
+  std::size_t size;
+};
+
+void PutU16(std::string& out, uint16_t value) {
+  out.push_back(value & 0xff);
+  out.push_back(value >> 8);
+}
+
+void PutU32(std::string& out, uint32_t value) {
+  PutU16(out, value & 0xffff);
+  PutU16(out, value >> 16);
+}
+
+bool IsCompressedFormat(const std::string& path) {
+  static const std::vector<std::string> extensions = {
+      ".apk", ".br",  ".bz2",  ".gz",  ".jpeg", ".jpg", ".lz4", ".mp4",
+      ".png", ".tgz", ".webm", ".xz",  ".zip",  ".zst",
+  };
+  for (const auto& extension : extensions) {
+    if (android::base::EndsWith(path, extension)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Result<CompressedChunk> CompressChunk(Chunk chunk) {
+  CompressedChunk compressed = {
+      .crc = static_cast<uint32_t>(
+          crc32(0, reinterpret_cast<const Bytef*>(chunk.data.data()),
+                chunk.data.size())),
+      .size = chunk.data.size(),
+  };
+  if (chunk.store) {
+    compressed.data = std::move(chunk.data);
+    return compressed;
+  }
+
+  z_stream stream = {};
+  // Negative window bits for raw deflate, zip has its own framing
+  CF_EXPECT(deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+                         8, Z_DEFAULT_STRATEGY) == Z_OK,
+            "deflateInit2 failed");
+  if (!chunk.dictionary.empty()) {
+    deflateSetDictionary(
+        &stream, reinterpret_cast<const Bytef*>(chunk.dictionary.data()),
+        chunk.dictionary.size());
+  }
+  // Room for the sync flush marker too
+  compressed.data.resize(deflateBound(&stream, chunk.data.size()) + 16);
+  stream.next_in = reinterpret_cast<Bytef*>(chunk.data.data());
+  stream.avail_in = chunk.data.size();
+  stream.next_out = reinterpret_cast<Bytef*>(compressed.data.data());
+  stream.avail_out = compressed.data.size();
+  // A sync flush ends on a byte boundary without marking the last block, so
+  // the next chunk's blocks can follow directly
+  auto status = deflate(&stream, chunk.last ? Z_FINISH : Z_SYNC_FLUSH);
+  compressed.data.resize(stream.total_out);
+  deflateEnd(&stream);
+  CF_EXPECT(status == (chunk.last ? Z_STREAM_END : Z_OK),
+            "deflate failed: " << status);
+  return compressed;
+}
+
+void DosTime(time_t time, uint16_t* dos_time, uint16_t* dos_date) {
+  struct tm tm;
+  localtime_r(&time, &tm);
+  // The format starts in 1980
+  if (tm.tm_year < 80) {
+    *dos_time = 0;
+    *dos_date = (1 << 5) | 1;
+    return;
+  }
+  *dos_time = (tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2);
+  *dos_date = ((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday;
+}
+
+}  // namespace
+
+Result<std::unique_ptr<ParallelZipWriter>> ParallelZipWriter::Create(
+    const std::string& path, unsigned int threads) {
+  auto out = fopen(path.c_str(), "wb");
+  CF_EXPECT(out != nullptr,
+            "Failed to open \"" << path << "\": " << strerror(errno));
+  return std::unique_ptr<ParallelZipWriter>(
+      new ParallelZipWriter(out, std::max(threads, 1u)));
+}
+
+ParallelZipWriter::ParallelZipWriter(FILE* out, unsigned int threads)
+    : out_(out), threads_(threads) {}
+
+ParallelZipWriter::~ParallelZipWriter() { fclose(out_); }
+
+Result<void> ParallelZipWriter::Write(const void* data, std::size_t size) {
+  CF_EXPECT(fwrite(data, 1, size, out_) == size,
+            "Failed to write the zip file: " << strerror(errno));
+  offset_ += size;
+  return {};
+}
+
+Result<void> ParallelZipWriter::WriteLocalHeader(const Entry& entry) {
+  std::string header;
+  PutU32(header, kLocalHeaderSignature);
+  PutU16(header, kVersionNeeded);
+  PutU16(header, kFlagUtf8);
+  PutU16(header, entry.method);
+  PutU16(header, entry.dos_time);
+  PutU16(header, entry.dos_date);
+  PutU32(header, entry.crc);
+  PutU32(header, entry.compressed_size);
+  PutU32(header, entry.size);
+  PutU16(header, entry.name.size());
+  PutU16(header, 0);
+  header += entry.name;
+  CF_EXPECT(Write(header.data(), header.size()));
+  return {};
+}
+
+Result<void> ParallelZipWriter::AddFile(const std::string& zip_path,
+                                        const std::string& file_path,
+                                        std::optional<std::size_t> tail_size) {
+  auto fd = SharedFD::Open(file_path, O_RDONLY);
+  CF_EXPECT(fd->IsOpen(),
+            "Failed to open \"" << file_path << "\": " << fd->StrError());
+  struct stat st;
+  CF_EXPECT(stat(file_path.c_str(), &st) == 0,
+            "Failed to stat \"" << file_path << "\": " << strerror(errno));
+
+  // Only what was there when it started, logs may keep growing
+  std::size_t remaining = st.st_size;
+  if (tail_size && remaining > *tail_size) {
+    LOG(INFO) << "Only saving the last " << *tail_size << " bytes of \""
+              << file_path << "\"";
+    CF_EXPECT(fd->LSeek(remaining - *tail_size, SEEK_SET) >= 0,
+              "Failed to seek \"" << file_path << "\": " << fd->StrError());
+    remaining = *tail_size;
+  }
+
+  CF_EXPECT(offset_ <= UINT32_MAX, "The zip file is over 4GiB");
+  bool store = IsCompressedFormat(file_path);
+  Entry entry = {
+      .name = zip_path,
+      .method = store ? kMethodStored : kMethodDeflated,
+      .crc = 0,
+      .compressed_size = 0,
+      .size = 0,
+      .offset = static_cast<uint32_t>(offset_),
+  };
+  DosTime(st.st_mtime, &entry.dos_time, &entry.dos_date);
+  // Rewritten with the crc and sizes at the end
+  CF_EXPECT(WriteLocalHeader(entry));
+
+  uint64_t compressed_size = 0;
+  uint64_t size = 0;
+  std::deque<std::future<Result<CompressedChunk>>> in_flight;
+  auto write_oldest = [this, &in_flight, &entry, &compressed_size,
+                       &size]() -> Result<void> {
+    auto future = std::move(in_flight.front());
+    in_flight.pop_front();
+    auto compressed = CF_EXPECT(future.get());
+    CF_EXPECT(Write(compressed.data.data(), compressed.data.size()));
+    entry.crc = crc32_combine(entry.crc, compressed.crc, compressed.size);
+    compressed_size += compressed.data.size();
+    size += compressed.size;
+    return {};
+  };
+
+  std::string previous;
+  bool last = false;
+  while (!last) {
+    Chunk chunk;
+    chunk.data.resize(std::min(remaining, kChunkSize));
+    CF_EXPECT(ReadExact(fd, &chunk.data) == (ssize_t)chunk.data.size(),
+              "Failed to read \"" << file_path << "\": " << fd->StrError());
+    remaining -= chunk.data.size();
+    last = remaining == 0;
+    chunk.last = last;
+    chunk.store = store;
+    if (!store && !previous.empty()) {
+      auto dictionary_size = std::min(previous.size(), kDictionarySize);
+      chunk.dictionary = previous.substr(previous.size() - dictionary_size);
+    }
+    if (!store && !last) {
+      previous = chunk.data;
+    }
+    in_flight.push_back(
+        std::async(std::launch::async, CompressChunk, std::move(chunk)));
+    // Bounds the memory used by large files
+    if (in_flight.size() >= threads_) {
+      CF_EXPECT(write_oldest());
+    }
+  }
+  while (!in_flight.empty()) {
+    CF_EXPECT(write_oldest());
+  }
+
+  CF_EXPECT(compressed_size <= UINT32_MAX && size <= UINT32_MAX,
+            "\"" << file_path << "\" is too large for a zip without zip64");
+  entry.compressed_size = compressed_size;
+  entry.size = size;
+  std::string sizes;
+  PutU32(sizes, entry.crc);
+  PutU32(sizes, entry.compressed_size);
+  PutU32(sizes, entry.size);
+  CF_EXPECT(fseeko(out_, entry.offset + kLocalHeaderCrcOffset, SEEK_SET) == 0,
+            "Failed to seek the zip file: " << strerror(errno));
+  CF_EXPECT(fwrite(sizes.data(), 1, sizes.size(), out_) == sizes.size(),
+            "Failed to write the zip file: " << strerror(errno));
+  CF_EXPECT(fseeko(out_, offset_, SEEK_SET) == 0,
+            "Failed to seek the zip file: " << strerror(errno));
+  entries_.push_back(std::move(entry));
+  return {};
+}
+
+Result<void> ParallelZipWriter::Finish() {
+  CF_EXPECT(offset_ <= UINT32_MAX, "The zip file is over 4GiB");
+  CF_EXPECT(entries_.size() <= UINT16_MAX, "Too many zip entries");
+  auto directory_offset = offset_;
+  std::string directory;
+  for (const auto& entry : entries_) {
+    PutU32(directory, kCentralHeaderSignature);
+    PutU16(directory, kVersionMadeBy);
+    PutU16(directory, kVersionNeeded);
+    PutU16(directory, kFlagUtf8);
+    PutU16(directory, entry.method);
+    PutU16(directory, entry.dos_time);
+    PutU16(directory, entry.dos_date);
+    PutU32(directory, entry.crc);
+    PutU32(directory, entry.compressed_size);
+    PutU32(directory, entry.size);
+    PutU16(directory, entry.name.size());
+    PutU16(directory, 0);  // Extra field
+    PutU16(directory, 0);  // Comment
+    PutU16(directory, 0);  // Disk
+    PutU16(directory, 0);  // Internal attributes
+    PutU32(directory, (S_IFREG | 0644) << 16);
+    PutU32(directory, entry.offset);
+    directory += entry.name;
+  }
+  auto directory_size = directory.size();
+  PutU32(directory, kEndOfCentralDirectorySignature);
+  PutU16(directory, 0);  // Disk
+  PutU16(directory, 0);  // Disk with the central directory
+  PutU16(directory, entries_.size());
+  PutU16(directory, entries_.size());
+  PutU32(directory, directory_size);
+  PutU32(directory, directory_offset);
+  PutU16(directory, 0);  // Comment
+  CF_EXPECT(Write(directory.data(), directory.size()));
+  CF_EXPECT(fflush(out_) == 0,
+            "Failed to write the zip file: " << strerror(errno));
+  return {};
+}
+
+}  // namespace cuttlefish
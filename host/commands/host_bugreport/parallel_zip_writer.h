@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+// Writes a zip archive, compressing each entry as independent chunks on
+// several threads and stitching the deflate streams together, in the way
+// pigz does. Each chunk is primed with the end of the previous one so the
+// compression ratio stays close to a single stream's.
+//
+// Doesn't write zip64 records, so archives are limited to 4GiB.
+class ParallelZipWriter {
+ public:
+  static Result<std::unique_ptr<ParallelZipWriter>> Create(
+      const std::string& path, unsigned int threads);
+  ~ParallelZipWriter();
+
+  // Only the last tail_size bytes are added if the file is larger. Files in
+  // compressed formats are stored rather than compressed again.
+  Result<void> AddFile(const std::string& zip_path,
+                       const std::string& file_path,
+                       std::optional<std::size_t> tail_size = std::nullopt);
+  // Writes the central directory
+  Result<void> Finish();
+
+ private:
+  struct Entry {
+    std::string name;
+    uint16_t method;
+    uint16_t dos_time;
+    uint16_t dos_date;
+    uint32_t crc;
+    uint32_t compressed_size;
+    uint32_t size;
+    uint32_t offset;
+  };
+
+  ParallelZipWriter(FILE* out, unsigned int threads);
+
+  Result<void> Write(const void* data, std::size_t size);
+  Result<void> WriteLocalHeader(const Entry& entry);
+
+  FILE* out_;
+  unsigned int threads_;
+  uint64_t offset_ = 0;
+  std::vector<Entry> entries_;
+};
+
+}  // namespace cuttlefish
@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+#include <gflags/gflags.h>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+#include "host/libs/config/cuttlefish_config.h"
+#include "host/libs/input_recording/input_recording.h"
+
+DEFINE_string(recording, "", "Input recording to replay, as produced by "
+                             "launch_cvd --record_input");
+DEFINE_double(speed, 1.0, "How fast to replay the input, 2 is twice as fast.");
+DEFINE_string(instance_nums, "",
+              "Comma separated instance numbers to replay the input on at the "
+              "same time. Defaults to the current instance.");
+DEFINE_bool(sync_frames, true,
+            "Hold input recorded after a display frame until the device has "
+            "committed as many frames since the replay started.");
+DEFINE_int32(frame_sync_timeout_ms, 1000,
+             "How long to wait for a frame before sending the input that "
+             "followed it anyway. Devices don't commit frames when nothing "
+             "changes on the screen.");
+
+namespace cuttlefish {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+Result<std::vector<InputRecord>> LoadRecording(const std::string& path) {
+  auto fd = SharedFD::Open(path, O_RDONLY);
+  CF_EXPECT(fd->IsOpen(), "Failed to open \"" << path << "\": "
+                                              << fd->StrError());
+  std::vector<InputRecord> records;
+  for (;;) {
+    auto record = CF_EXPECT(ReadInputRecord(fd));
+    if (!record) {
+      break;
+    }
+    records.emplace_back(std::move(*record));
+  }
+  // Anything before the first input is just the device booting
+  auto first_input =
+      std::find_if(records.begin(), records.end(), [](const auto& record) {
+        return record.label != kFrameCommitLabel;
+      });
+  CF_EXPECT(first_input != records.end(), "No input in \"" << path << "\"");
+  records.erase(records.begin(), first_input);
+  auto offset = records.front().timestamp;
+  for (auto& record : records) {
+    record.timestamp -= offset;
+  }
+  return records;
+}
+
+// Replays the input on one device, counting the frames it reports back.
+class InstanceReplayer {
+ public:
+  InstanceReplayer(SharedFD connection) : connection_(connection) {
+    reader_ = std::thread([this]() { ReadFrameCommits(); });
+  }
+  ~InstanceReplayer() {
+    connection_->Shutdown(SHUT_RDWR);
+    reader_.join();
+  }
+
+  Result<void> Replay(const std::vector<InputRecord>& records);
+
+ private:
+  void ReadFrameCommits();
+  // Waits for count frames to be committed after the first input was sent
+  bool WaitForFrames(uint64_t count, Clock::duration timeout);
+
+  SharedFD connection_;
+  std::mutex mutex_;
+  std::condition_variable frames_cv_;
+  uint64_t frames_ = 0;
+  uint64_t first_input_frames_ = 0;
+  bool closed_ = false;
+  std::thread reader_;
+};
+
+Result<void> InstanceReplayer::Replay(const std::vector<InputRecord>& records) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    first_input_frames_ = frames_;
+  }
+  auto start = Clock::now();
+  uint64_t recorded_frames = 0;
+  for (const auto& record : records) {
+    auto target = start + std::chrono::duration_cast<Clock::duration>(
+                              std::chrono::duration<double, std::micro>(
+                                  record.timestamp.count()) /
+                              FLAGS_speed);
+    if (record.label == kFrameCommitLabel) {
+      if (!FLAGS_sync_frames) {
+        continue;
+      }
+      ++recorded_frames;
+      if (!WaitForFrames(recorded_frames, std::chrono::milliseconds(
+                                              FLAGS_frame_sync_timeout_ms))) {
+        LOG(WARNING) << "Frame " << recorded_frames
+                     << " wasn't committed in time";
+      }
+      // Keep the input that followed the frame as far from it as it was
+      auto now = Clock::now();
+      if (now > target) {
+        start += now - target;
+      }
+      continue;
+    }
+    std::this_thread::sleep_until(target);
+    CF_EXPECT(WriteInputRecord(connection_, record));
+  }
+  return {};
+}
+
+void InstanceReplayer::ReadFrameCommits() {
+  for (;;) {
+    auto record = ReadInputRecord(connection_);
+    if (!record.ok() || !*record) {
+      break;
+    }
+    if ((*record)->label == kFrameCommitLabel) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      ++frames_;
+      frames_cv_.notify_all();
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  closed_ = true;
+  frames_cv_.notify_all();
+}
+
+bool InstanceReplayer::WaitForFrames(uint64_t count, Clock::duration timeout) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return frames_cv_.wait_for(lock, timeout, [this, count]() {
+    return closed_ || frames_ - first_input_frames_ >= count;
+  });
+}
+
+Result<std::vector<int>> InstanceNums() {
+  if (FLAGS_instance_nums.empty()) {
+    return std::vector<int>{GetInstance()};
+  }
+  std::vector<int> instance_nums;
+  for (const auto& num_str : android::base::Split(FLAGS_instance_nums, ",")) {
+    int num;
+    CF_EXPECT(android::base::ParseInt(num_str, &num),
+              "Invalid instance number: " << num_str);
+    instance_nums.push_back(num);
+  }
+  return instance_nums;
+}
+
+Result<void> InputReplayMain(int argc, char** argv) {
+  ::android::base::InitLogging(argv, android::base::StderrLogger);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  CF_EXPECT(!FLAGS_recording.empty(), "--recording is required");
+  CF_EXPECT(FLAGS_speed > 0, "--speed must be positive");
+
+  auto config = CuttlefishConfig::Get();
+  CF_EXPECT(config != nullptr, "Unable to load the config");
+  auto records = CF_EXPECT(LoadRecording(FLAGS_recording));
+
+  std::vector<std::unique_ptr<InstanceReplayer>> replayers;
+  for (int num : CF_EXPECT(InstanceNums())) {
+    auto path = config->ForInstance(num).input_replay_socket_path();
+    auto connection = SharedFD::SocketLocalClient(path, false, SOCK_STREAM);
+    CF_EXPECT(connection->IsOpen(), "Failed to connect to \""
+                                        << path
+                                        << "\": " << connection->StrError());
+    replayers.emplace_back(std::make_unique<InstanceReplayer>(connection));
+  }
+
+  // All instances start at the same time so that they can be compared
+  std::vector<std::thread> threads;
+  std::vector<Result<void>> results(replayers.size());
+  for (size_t i = 0; i < replayers.size(); i++) {
+    threads.emplace_back([&replayers, &records, &results, i]() {
+      results[i] = replayers[i]->Replay(records);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (auto& result : results) {
+    CF_EXPECT(std::move(result));
+  }
+  return {};
+}
+
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  auto result = cuttlefish::InputReplayMain(argc, argv);
+  if (!result.ok()) {
+    LOG(ERROR) << result.error();
+    return 1;
+  }
+  return 0;
+}
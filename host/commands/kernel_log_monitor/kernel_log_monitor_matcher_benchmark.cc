@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares looking for each kernel log pattern with std::string::find against
+// the multi-pattern automaton. Replays the log named by
+// KERNEL_LOG_BENCHMARK_INPUT, e.g. a kernel.log captured with printk debug
+// output enabled, or a synthetic verbose log otherwise.
+
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "host/commands/kernel_log_monitor/kernel_log_server.h"
+#include "host/commands/kernel_log_monitor/multi_pattern_matcher.h"
+
+namespace monitor {
+namespace {
+
+std::vector<std::string> SyntheticLog() {
+  std::vector<std::string> lines;
+  for (int i = 0; i < 10000; i++) {
+    lines.push_back("[  " + std::to_string(i / 100) + "." +
+                    std::to_string(100000 + i) +
+                    "] virtio_blk virtio2: dynamic debug: queue 0 request "
+                    "completed sector " + std::to_string(i * 8));
+  }
+  lines.push_back("[    0.000000] Linux version 5.15.41-android14");
+  lines.push_back("[   12.345678] init: starting service 'adbd'...");
+  lines.push_back("[   20.000000] VIRTUAL_DEVICE_BOOT_COMPLETED");
+  return lines;
+}
+
+const std::vector<std::string>& ReplayedLog() {
+  static const auto* lines = []() {
+    auto lines = new std::vector<std::string>();
+    const char* path = getenv("KERNEL_LOG_BENCHMARK_INPUT");
+    if (path) {
+      std::ifstream log(path);
+      std::string line;
+      while (std::getline(log, line)) {
+        lines->push_back(line);
+      }
+    }
+    if (lines->empty()) {
+      *lines = SyntheticLog();
+    }
+    return lines;
+  }();
+  return *lines;
+}
+
+void SetBytesProcessed(benchmark::State& state,
+                       const std::vector<std::string>& lines) {
+  std::size_t bytes = 0;
+  for (const auto& line : lines) {
+    bytes += line.size() + 1;
+  }
+  state.SetBytesProcessed(state.iterations() * bytes);
+}
+
+void BM_FindEachPattern(benchmark::State& state) {
+  const auto& lines = ReplayedLog();
+  auto patterns = KernelLogPatterns();
+  for (auto _ : state) {
+    for (const auto& line : lines) {
+      for (auto pattern : patterns) {
+        benchmark::DoNotOptimize(line.find(pattern));
+      }
+    }
+  }
+  SetBytesProcessed(state, lines);
+}
+BENCHMARK(BM_FindEachPattern);
+
+void BM_MultiPatternMatcher(benchmark::State& state) {
+  const auto& lines = ReplayedLog();
+  MultiPatternMatcher matcher(KernelLogPatterns());
+  std::vector<std::size_t> positions;
+  for (auto _ : state) {
+    for (const auto& line : lines) {
+      matcher.FirstMatches(line, &positions);
+      benchmark::DoNotOptimize(positions.data());
+    }
+  }
+  SetBytesProcessed(state, lines);
+}
+BENCHMARK(BM_MultiPatternMatcher);
+
+}  // namespace
+}  // namespace monitor
+
+BENCHMARK_MAIN();
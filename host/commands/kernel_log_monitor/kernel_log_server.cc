@@ -17,13 +17,14 @@
 #include "host/commands/kernel_log_monitor/kernel_log_server.h"
 
 #include <string>
+#include <string_view>
 #include <tuple>
 #include <utility>
 
 #include <android-base/logging.h>
 #include <android-base/strings.h>
 #include <netinet/in.h>
-#include "common/libs/fs/shared_select.h"
+#include "common/libs/fs/reactor.h"
 #include "host/libs/config/cuttlefish_config.h"
 
 namespace {
@@ -67,6 +68,9 @@ constexpr struct {
      monitor::Event::DisplayPowerModeChanged, kKeyValuePair},
 };
 
+constexpr std::size_t kNumInformationalPatterns =
+    sizeof(kInformationalPatterns) / sizeof(kInformationalPatterns[0]);
+
 void ProcessSubscriptions(
     Json::Value message,
     std::vector<monitor::EventCallback>* subscribers) {
@@ -90,21 +94,36 @@ void ProcessSubscriptions(
 }  // namespace
 
 namespace monitor {
-KernelLogServer::KernelLogServer(cuttlefish::SharedFD pipe_fd,
-                                 const std::string& log_name,
-                                 bool deprecated_boot_completed)
-    : pipe_fd_(pipe_fd),
-      log_fd_(cuttlefish::SharedFD::Open(log_name.c_str(), O_CREAT | O_RDWR | O_APPEND, 0666)),
-      deprecated_boot_completed_(deprecated_boot_completed) {}
 
-void KernelLogServer::BeforeSelect(cuttlefish::SharedFDSet* fd_read) const {
-  fd_read->Set(pipe_fd_);
+std::vector<std::string_view> KernelLogPatterns() {
+  std::vector<std::string_view> patterns;
+  for (const auto& pattern : kInformationalPatterns) {
+    patterns.push_back(pattern.match);
+  }
+  for (const auto& stage : kStageTable) {
+    patterns.push_back(stage.stage);
+  }
+  return patterns;
 }
 
-void KernelLogServer::AfterSelect(const cuttlefish::SharedFDSet& fd_read) {
-  if (fd_read.IsSet(pipe_fd_)) {
-    HandleIncomingMessage();
-  }
+KernelLogServer::KernelLogServer(
+    cuttlefish::SharedFD pipe_fd, const std::string& log_name,
+    bool deprecated_boot_completed,
+    std::optional<cuttlefish::LogStoreWriter> log_store)
+    : pipe_fd_(pipe_fd),
+      log_fd_(cuttlefish::SharedFD::Open(log_name.c_str(), O_CREAT | O_RDWR | O_APPEND, 0666)),
+      matcher_(KernelLogPatterns()),
+      deprecated_boot_completed_(deprecated_boot_completed),
+      log_store_(std::move(log_store)) {}
+
+cuttlefish::Result<void> KernelLogServer::Start(cuttlefish::Reactor& reactor) {
+  reactor_ = &reactor;
+  return reactor.Add(pipe_fd_, EPOLLIN, [this, &reactor](uint32_t events) {
+    if (!HandleIncomingMessage() && (events & EPOLLHUP)) {
+      // The VMM is gone, stop polling a pipe that will never have data again
+      reactor.Remove(pipe_fd_);
+    }
+  });
 }
 
 void KernelLogServer::SubscribeToEvents(monitor::EventCallback callback) {
@@ -112,7 +131,8 @@ void KernelLogServer::SubscribeToEvents(monitor::EventCallback callback) {
 }
 
 bool KernelLogServer::HandleIncomingMessage() {
-  const size_t buf_len = 256;
+  // Verbose kernels log a lot, fewer larger reads keep the overhead down
+  const size_t buf_len = 4096;
   char buf[buf_len];
   ssize_t ret = pipe_fd_->Read(buf, buf_len);
   if (ret < 0) {
@@ -127,63 +147,97 @@ bool KernelLogServer::HandleIncomingMessage() {
   }
 
   // Detect VIRTUAL_DEVICE_BOOT_*
-  for (ssize_t i=0; i<ret; i++) {
-    if ('\n' == buf[i]) {
-      for (auto& [match, prefix] : kInformationalPatterns) {
-        auto pos = line_.find(match);
-        if (std::string::npos != pos) {
-          LOG(INFO) << prefix << line_.substr(pos + match.size());
+  std::string_view data(buf, ret);
+  auto now = cuttlefish::LogStoreNow();
+  for (auto newline = data.find('\n'); newline != std::string_view::npos;
+       newline = data.find('\n')) {
+    line_.append(data.substr(0, newline));
+    HandleLine(line_);
+    if (log_store_) {
+      // The console doesn't carry the printk levels
+      log_store_->Append(now, android::base::INFO, "", line_);
+    }
+    line_.clear();
+    data.remove_prefix(newline + 1);
+  }
+  line_.append(data);
+  if (log_store_) {
+    FlushStore();
+  }
+
+  return true;
+}
+
+void KernelLogServer::FlushStore() {
+  auto result = log_store_->MaybeFlush();
+  if (!result.ok()) {
+    LOG(ERROR) << "Could not write the log store: " << result.error();
+  }
+  auto timeout = log_store_->TimeUntilFlush();
+  if (!timeout || store_flush_scheduled_) {
+    return;
+  }
+  store_flush_scheduled_ = true;
+  reactor_->RunAfter(*timeout, [this]() {
+    store_flush_scheduled_ = false;
+    FlushStore();
+  });
+}
+
+void KernelLogServer::HandleLine(const std::string& line) {
+  matcher_.FirstMatches(line, &positions_);
+  for (std::size_t i = 0; i < kNumInformationalPatterns; i++) {
+    auto pos = positions_[i];
+    if (std::string::npos != pos) {
+      const auto& [match, prefix] = kInformationalPatterns[i];
+      LOG(INFO) << prefix << line.substr(pos + match.size());
+    }
+  }
+  std::size_t index = kNumInformationalPatterns;
+  for (const auto& [stage, event, format] : kStageTable) {
+    auto pos = positions_[index++];
+    if (std::string::npos == pos) {
+      continue;
+    }
+    // Log the stage
+    LOG(INFO) << stage;
+
+    Json::Value message;
+    message["event"] = event;
+    Json::Value metadata;
+
+    if (format == kKeyValuePair) {
+      // Expect space-separated key=value pairs in the log message.
+      const auto& fields =
+          android::base::Split(line.substr(pos + stage.size()), " ");
+      for (std::string field : fields) {
+        field = android::base::Trim(field);
+        if (field.empty()) {
+          // Expected; android::base::Split() always returns at least
+          // one (possibly empty) string.
+          LOG(DEBUG) << "Empty field for line: " << line;
+          continue;
         }
-      }
-      for (const auto& [stage, event, format] : kStageTable) {
-        auto pos = line_.find(stage);
-        if (std::string::npos != pos) {
-          // Log the stage
-          LOG(INFO) << stage;
-
-          Json::Value message;
-          message["event"] = event;
-          Json::Value metadata;
-
-          if (format == kKeyValuePair) {
-            // Expect space-separated key=value pairs in the log message.
-            const auto& fields =
-                android::base::Split(line_.substr(pos + stage.size()), " ");
-            for (std::string field : fields) {
-              field = android::base::Trim(field);
-              if (field.empty()) {
-                // Expected; android::base::Split() always returns at least
-                // one (possibly empty) string.
-                LOG(DEBUG) << "Empty field for line: " << line_;
-                continue;
-              }
-              const auto& keyvalue = android::base::Split(field, "=");
-              if (keyvalue.size() != 2) {
-                LOG(WARNING) << "Field is not in key=value format: " << field;
-                continue;
-              }
-              metadata[keyvalue[0]] = keyvalue[1];
-            }
-          }
-          message["metadata"] = metadata;
-          ProcessSubscriptions(message, &subscribers_);
-
-          //TODO(b/69417553) Remove this when our clients have transitioned to the
-          // new boot completed
-          if (deprecated_boot_completed_) {
-            // Write to host kernel log
-            FILE* log = popen("/usr/bin/sudo /usr/bin/tee /dev/kmsg", "w");
-            fprintf(log, "%s\n", std::string(stage).c_str());
-            fclose(log);
-          }
+        const auto& keyvalue = android::base::Split(field, "=");
+        if (keyvalue.size() != 2) {
+          LOG(WARNING) << "Field is not in key=value format: " << field;
+          continue;
         }
+        metadata[keyvalue[0]] = keyvalue[1];
       }
-      line_.clear();
     }
-    line_.append(1, buf[i]);
+    message["metadata"] = metadata;
+    ProcessSubscriptions(message, &subscribers_);
+
+    //TODO(b/69417553) Remove this when our clients have transitioned to the
+    // new boot completed
+    if (deprecated_boot_completed_) {
+      // Write to host kernel log
+      FILE* log = popen("/usr/bin/sudo /usr/bin/tee /dev/kmsg", "w");
+      fprintf(log, "%s\n", std::string(stage).c_str());
+      fclose(log);
+    }
   }
-
-  return true;
 }
 
 }  // namespace monitor
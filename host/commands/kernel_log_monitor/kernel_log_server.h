@@ -18,13 +18,18 @@
 #include <stdint.h>
 
 #include <functional>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <json/json.h>
 
+#include "common/libs/fs/reactor.h"
 #include "common/libs/fs/shared_fd.h"
-#include "common/libs/fs/shared_select.h"
+#include "common/libs/utils/result.h"
+#include "host/commands/kernel_log_monitor/multi_pattern_matcher.h"
+#include "host/libs/log_store/log_store.h"
 
 namespace monitor {
 
@@ -51,23 +56,23 @@ enum class SubscriptionAction {
 
 using EventCallback = std::function<SubscriptionAction(Json::Value)>;
 
+// Every substring KernelLogServer looks for in a line, the informational
+// patterns followed by the stages.
+std::vector<std::string_view> KernelLogPatterns();
+
 // KernelLogServer manages an incoming kernel log connection from the VMM.
 // Only accept one connection.
 class KernelLogServer {
  public:
   KernelLogServer(cuttlefish::SharedFD pipe_fd,
                   const std::string& log_name,
-                  bool deprecated_boot_completed);
+                  bool deprecated_boot_completed,
+                  std::optional<cuttlefish::LogStoreWriter> log_store);
 
   ~KernelLogServer() = default;
 
-  // BeforeSelect is Called right before Select() to populate interesting
-  // SharedFDs.
-  void BeforeSelect(cuttlefish::SharedFDSet* fd_read) const;
-
-  // AfterSelect is Called right after Select() to detect and respond to changes
-  // on affected SharedFDs.
-  void AfterSelect(const cuttlefish::SharedFDSet& fd_read);
+  // Watches the kernel log pipe from `reactor`.
+  cuttlefish::Result<void> Start(cuttlefish::Reactor& reactor);
 
   void SubscribeToEvents(EventCallback callback);
 
@@ -75,11 +80,22 @@ class KernelLogServer {
   // Respond to message from remote client.
   // Returns false, if client disconnected.
   bool HandleIncomingMessage();
+  // Detects the informational patterns and stages in a complete line.
+  void HandleLine(const std::string& line);
+  // Writes the store's chunk if it's due, and makes sure the loop comes back
+  // for it if the console goes quiet before it is.
+  void FlushStore();
 
   cuttlefish::SharedFD pipe_fd_;
   cuttlefish::SharedFD log_fd_;
   std::string line_;
+  MultiPatternMatcher matcher_;
+  // Reused across lines to avoid an allocation per line
+  std::vector<std::size_t> positions_;
   bool deprecated_boot_completed_;
+  std::optional<cuttlefish::LogStoreWriter> log_store_;
+  cuttlefish::Reactor* reactor_ = nullptr;
+  bool store_flush_scheduled_ = false;
   std::vector<EventCallback> subscribers_;
 
   KernelLogServer(const KernelLogServer&) = delete;
@@ -17,6 +17,7 @@
 #include <signal.h>
 #include <unistd.h>
 
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -26,7 +27,7 @@
 #include <json/json.h>
 
 #include <common/libs/fs/shared_fd.h>
-#include <common/libs/fs/shared_select.h>
+#include <common/libs/fs/reactor.h>
 #include <host/libs/config/cuttlefish_config.h>
 #include <host/libs/config/logging.h>
 #include "host/commands/kernel_log_monitor/kernel_log_server.h"
@@ -94,39 +95,58 @@ int main(int argc, char** argv) {
     return 2;
   }
 
+  std::optional<cuttlefish::LogStoreWriter> log_store;
+  if (config->structured_logs()) {
+    auto writer =
+        cuttlefish::LogStoreWriter::Create(instance.log_store_dir(), "kernel");
+    if (writer.ok()) {
+      log_store = std::move(*writer);
+    } else {
+      // Don't return here, we still need to write the logs to a file
+      LOG(ERROR) << "Failed to open the log store: " << writer.error();
+    }
+  }
+
   monitor::KernelLogServer klog{pipe, instance.PerInstanceLogPath("kernel.log"),
-                                config->deprecated_boot_completed()};
+                                config->deprecated_boot_completed(),
+                                std::move(log_store)};
 
+  std::vector<cuttlefish::SharedFD> open_subscriber_fds;
   for (auto subscriber_fd: subscriber_fds) {
     if (subscriber_fd->IsOpen()) {
-      klog.SubscribeToEvents([subscriber_fd](Json::Value message) {
-        if (!monitor::WriteEvent(subscriber_fd, message)) {
-          if (subscriber_fd->GetErrno() != EPIPE) {
-            LOG(ERROR) << "Error while writing to pipe: "
-                       << subscriber_fd->StrError();
-          }
-          subscriber_fd->Close();
-          return monitor::SubscriptionAction::CancelSubscription;
-        }
-        return monitor::SubscriptionAction::ContinueSubscription;
-      });
+      open_subscriber_fds.push_back(subscriber_fd);
     } else {
       LOG(ERROR) << "Subscriber fd isn't valid: " << subscriber_fd->StrError();
       // Don't return here, we still need to write the logs to a file
     }
   }
-
-  for (;;) {
-    cuttlefish::SharedFDSet fd_read;
-    fd_read.Zero();
-
-    klog.BeforeSelect(&fd_read);
-
-    int ret = cuttlefish::Select(&fd_read, nullptr, nullptr, nullptr);
-    if (ret <= 0) continue;
-
-    klog.AfterSelect(fd_read);
+  if (!open_subscriber_fds.empty()) {
+    // Every subscriber gets the same bytes, so the event is serialized once
+    klog.SubscribeToEvents([fds = std::move(open_subscriber_fds)](
+                               Json::Value message) mutable {
+      auto serialized = monitor::SerializeEvent(message);
+      for (auto it = fds.begin(); it != fds.end();) {
+        if (monitor::WriteSerializedEvent(*it, serialized)) {
+          ++it;
+          continue;
+        }
+        if ((*it)->GetErrno() != EPIPE) {
+          LOG(ERROR) << "Error while writing to pipe: " << (*it)->StrError();
+        }
+        (*it)->Close();
+        it = fds.erase(it);
+      }
+      return fds.empty() ? monitor::SubscriptionAction::CancelSubscription
+                         : monitor::SubscriptionAction::ContinueSubscription;
+    });
   }
 
+  auto reactor = cuttlefish::Reactor::Create();
+  CHECK(reactor.ok()) << "Failed to create the event loop: " << reactor.error();
+  auto started = klog.Start(**reactor);
+  CHECK(started.ok()) << "Failed to watch the kernel log: " << started.error();
+  auto ran = (*reactor)->Run();
+  CHECK(ran.ok()) << "Kernel log event loop failed: " << ran.error();
+
   return 0;
 }
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/kernel_log_monitor/multi_pattern_matcher.h"
+
+#include <queue>
+
+namespace monitor {
+
+MultiPatternMatcher::MultiPatternMatcher(
+    const std::vector<std::string_view>& patterns)
+    : num_patterns_(patterns.size()) {
+  classes_.fill(0);
+  num_classes_ = 1;
+  for (auto pattern : patterns) {
+    for (unsigned char c : pattern) {
+      if (classes_[c] == 0) {
+        classes_[c] = num_classes_++;
+      }
+    }
+  }
+
+  // Trie of the patterns, 0 is both the root and "no transition" since no
+  // edge leads back to the root
+  transitions_.assign(num_classes_, 0);
+  outputs_.emplace_back();
+  for (std::size_t i = 0; i < patterns.size(); i++) {
+    if (patterns[i].empty()) {
+      continue;
+    }
+    std::uint32_t state = 0;
+    for (unsigned char c : patterns[i]) {
+      auto edge = state * num_classes_ + classes_[c];
+      if (transitions_[edge] == 0) {
+        transitions_[edge] = outputs_.size();
+        transitions_.resize(transitions_.size() + num_classes_, 0);
+        outputs_.emplace_back();
+      }
+      state = transitions_[edge];
+    }
+    outputs_[state].push_back(Output{i, patterns[i].size()});
+  }
+
+  // Fill in the missing transitions breadth first, so the failure state of
+  // every state is complete by the time it is needed
+  std::vector<std::uint32_t> failure(outputs_.size(), 0);
+  std::queue<std::uint32_t> pending;
+  for (std::size_t c = 0; c < num_classes_; c++) {
+    if (transitions_[c] != 0) {
+      pending.push(transitions_[c]);
+    }
+  }
+  while (!pending.empty()) {
+    auto state = pending.front();
+    pending.pop();
+    auto fallback = failure[state];
+    for (std::size_t c = 0; c < num_classes_; c++) {
+      auto& next = transitions_[state * num_classes_ + c];
+      auto fallback_next = transitions_[fallback * num_classes_ + c];
+      if (next == 0) {
+        next = fallback_next;
+        continue;
+      }
+      failure[next] = fallback_next;
+      const auto& inherited = outputs_[fallback_next];
+      outputs_[next].insert(outputs_[next].end(), inherited.begin(),
+                            inherited.end());
+      pending.push(next);
+    }
+  }
+}
+
+void MultiPatternMatcher::FirstMatches(
+    std::string_view text, std::vector<std::size_t>* positions) const {
+  positions->assign(num_patterns_, std::string_view::npos);
+  std::uint32_t state = 0;
+  for (std::size_t i = 0; i < text.size(); i++) {
+    auto c = static_cast<unsigned char>(text[i]);
+    state = transitions_[state * num_classes_ + classes_[c]];
+    for (const auto& output : outputs_[state]) {
+      auto& position = (*positions)[output.pattern];
+      if (position == std::string_view::npos) {
+        position = i + 1 - output.length;
+      }
+    }
+  }
+}
+
+}  // namespace monitor
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace monitor {
+
+// Aho-Corasick automaton finding any number of substrings in one pass over
+// the text, so the cost per line doesn't grow with the number of patterns.
+class MultiPatternMatcher {
+ public:
+  // The matcher keeps no references to the patterns. Empty patterns never
+  // match.
+  explicit MultiPatternMatcher(const std::vector<std::string_view>& patterns);
+
+  // Sets (*positions)[i] to the offset of the first occurrence of patterns[i]
+  // in text, or std::string_view::npos when it doesn't occur.
+  void FirstMatches(std::string_view text,
+                    std::vector<std::size_t>* positions) const;
+
+ private:
+  struct Output {
+    std::size_t pattern;
+    std::size_t length;
+  };
+
+  // Bytes that appear in no pattern share class 0, which keeps the
+  // transition table small
+  std::array<std::uint16_t, 256> classes_;
+  std::size_t num_classes_;
+  std::size_t num_patterns_;
+  // Complete DFA, transitions_[state * num_classes_ + class]
+  std::vector<std::uint32_t> transitions_;
+  // Patterns ending at each state, including through failure links
+  std::vector<std::vector<Output>> outputs_;
+};
+
+}  // namespace monitor
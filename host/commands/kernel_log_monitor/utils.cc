@@ -53,20 +53,55 @@ std::optional<ReadEventResult> ReadEvent(cuttlefish::SharedFD fd) {
 }
 
 bool WriteEvent(cuttlefish::SharedFD fd, const Json::Value& event_message) {
+  if (!WriteSerializedEvent(fd, SerializeEvent(event_message))) {
+    LOG(ERROR) << "Failed to write event: " << fd->StrError();
+    return false;
+  }
+  return true;
+}
+
+std::string SerializeEvent(const Json::Value& event_message) {
   Json::StreamWriterBuilder factory;
   std::string message_string = Json::writeString(factory, event_message);
   size_t length = message_string.length();
-  ssize_t retval = cuttlefish::WriteAllBinary(fd, &length);
-  if (retval <= 0) {
-    LOG(ERROR) << "Failed to write event buffer size: " << fd->StrError();
-    return false;
-  }
-  retval = cuttlefish::WriteAll(fd, message_string);
-  if (retval <= 0) {
-    LOG(ERROR) << "Failed to write event buffer: " << fd->StrError();
-    return false;
+  std::string serialized(reinterpret_cast<const char*>(&length),
+                         sizeof(length));
+  serialized += message_string;
+  return serialized;
+}
+
+bool WriteSerializedEvent(cuttlefish::SharedFD fd,
+                          const std::string& serialized_event) {
+  return cuttlefish::WriteAll(fd, serialized_event) ==
+         static_cast<ssize_t>(serialized_event.size());
+}
+
+std::string EventName(Event event) {
+  switch (event) {
+    case Event::BootStarted:
+      return "BootStarted";
+    case Event::BootCompleted:
+      return "BootCompleted";
+    case Event::BootFailed:
+      return "BootFailed";
+    case Event::WifiNetworkConnected:
+      return "WifiNetworkConnected";
+    case Event::MobileNetworkConnected:
+      return "MobileNetworkConnected";
+    case Event::AdbdStarted:
+      return "AdbdStarted";
+    case Event::ScreenChanged:
+      return "ScreenChanged";
+    case Event::EthernetNetworkConnected:
+      return "EthernetNetworkConnected";
+    case Event::KernelLoaded:
+      return "KernelLoaded";
+    case Event::BootloaderLoaded:
+      return "BootloaderLoaded";
+    case Event::DisplayPowerModeChanged:
+      return "DisplayPowerModeChanged";
   }
-  return true;
+  return "Event" + std::to_string(event);
 }
 
 }  // namespace monitor
@@ -17,6 +17,7 @@
 
 #include <json/json.h>
 #include <optional>
+#include <string>
 
 #include "common/libs/fs/shared_fd.h"
 #include "host/commands/kernel_log_monitor/kernel_log_server.h"
@@ -34,4 +35,15 @@ std::optional<ReadEventResult> ReadEvent(cuttlefish::SharedFD fd);
 // Writes a kernel log event to the fd, in a format expected by ReadEvent.
 bool WriteEvent(cuttlefish::SharedFD fd, const Json::Value& event_message);
 
+// The bytes WriteEvent writes for an event, to send the same event to many
+// fds with WriteSerializedEvent.
+std::string SerializeEvent(const Json::Value& event_message);
+// Writes an event from SerializeEvent with a single write, which is atomic
+// for pipes as long as the event is under PIPE_BUF bytes.
+bool WriteSerializedEvent(cuttlefish::SharedFD fd,
+                          const std::string& serialized_event);
+
+// Human readable name of a kernel log event, e.g. "BootCompleted".
+std::string EventName(Event event);
+
 }  // namespace monitor
@@ -0,0 +1,108 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "host/commands/log_tee/binary_log.h"
+
+#include <fcntl.h>
+
+#include <cstring>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+
+BinaryLogWriter::BinaryLogWriter(SharedFD fd) : fd_(fd) {}
+
+Result<BinaryLogWriter> BinaryLogWriter::Create(
+    const std::string& path, const std::vector<std::string>& sources) {
+  auto fd = SharedFD::Open(path, O_CREAT | O_WRONLY | O_APPEND, 0644);
+  CF_EXPECT(fd->IsOpen(),
+            "Could not open \"" << path << "\": " << fd->StrError());
+  BinaryLogWriter writer(fd);
+  // Appending to an existing log starts a new section with its own sources
+  writer.batch_.AddOwned(std::string(kBinaryLogMagic, sizeof(kBinaryLogMagic)));
+  for (const auto& source : sources) {
+    BinaryLogRecordHeader header = {};
+    header.length = source.size();
+    header.type = BinaryLogRecordType::kSource;
+    writer.batch_.AddOwned(std::string((char*)&header, sizeof(header)));
+    writer.batch_.AddOwned(source);
+  }
+  CF_EXPECT(writer.Flush());
+  return writer;
+}
+
+void BinaryLogWriter::Add(std::uint16_t source,
+                          android::base::LogSeverity severity,
+                          std::uint64_t timestamp_ns,
+                          std::string_view message) {
+  BinaryLogRecordHeader header;
+  header.length = message.size();
+  header.type = BinaryLogRecordType::kMessage;
+  header.severity = severity;
+  header.source = source;
+  header.timestamp_ns = timestamp_ns;
+  batch_.AddOwned(std::string((char*)&header, sizeof(header)));
+  batch_.Add(message);
+}
+
+Result<void> BinaryLogWriter::Flush() {
+  CF_EXPECT(batch_.Flush(fd_));
+  return {};
+}
+
+Result<void> ReadBinaryLog(
+    const std::string& path,
+    const std::function<void(const BinaryLogMessage&)>& callback) {
+  CF_EXPECT(FileExists(path), "\"" << path << "\" does not exist");
+  auto contents = ReadFile(path);
+  std::string_view data = contents;
+  std::vector<std::string> sources;
+  while (!data.empty()) {
+    if (data.size() >= sizeof(kBinaryLogMagic) &&
+        memcmp(data.data(), kBinaryLogMagic, sizeof(kBinaryLogMagic)) == 0) {
+      sources.clear();
+      data.remove_prefix(sizeof(kBinaryLogMagic));
+      continue;
+    }
+    BinaryLogRecordHeader header;
+    CF_EXPECT(data.size() >= sizeof(header), "Truncated record header");
+    memcpy(&header, data.data(), sizeof(header));
+    data.remove_prefix(sizeof(header));
+    CF_EXPECT(data.size() >= header.length, "Truncated record");
+    auto payload = data.substr(0, header.length);
+    data.remove_prefix(header.length);
+    if (header.type == BinaryLogRecordType::kSource) {
+      sources.emplace_back(payload);
+      continue;
+    }
+    CF_EXPECT(header.type == BinaryLogRecordType::kMessage,
+              "Unknown record type " << (int)header.type);
+    CF_EXPECT(header.source < sources.size(),
+              "Unknown source " << header.source);
+    BinaryLogMessage message;
+    message.source = sources[header.source];
+    message.severity =
+        static_cast<android::base::LogSeverity>(header.severity);
+    message.timestamp_ns = header.timestamp_ns;
+    message.message = payload;
+    callback(message);
+  }
+  return {};
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,80 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <android-base/logging.h>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+#include "host/commands/log_tee/log_format.h"
+
+namespace cuttlefish {
+
+// A compact log of several processes. After the magic every record is a
+// header followed by `length` bytes: the source's name for source records,
+// one line without the newline for message records.
+constexpr char kBinaryLogMagic[8] = "CFBLOG1";
+
+enum class BinaryLogRecordType : std::uint8_t {
+  kSource = 0,
+  kMessage = 1,
+};
+
+struct BinaryLogRecordHeader {
+  std::uint32_t length;
+  BinaryLogRecordType type;
+  std::uint8_t severity;
+  std::uint16_t source;
+  std::uint64_t timestamp_ns;  // Since the epoch
+};
+static_assert(sizeof(BinaryLogRecordHeader) == 16);
+
+class BinaryLogWriter {
+ public:
+  static Result<BinaryLogWriter> Create(
+      const std::string& path, const std::vector<std::string>& sources);
+
+  // Only keeps a view of the message, it must stay valid until Flush
+  void Add(std::uint16_t source, android::base::LogSeverity severity,
+           std::uint64_t timestamp_ns, std::string_view message);
+  Result<void> Flush();
+
+ private:
+  BinaryLogWriter(SharedFD fd);
+
+  SharedFD fd_;
+  IovecBatch batch_;
+};
+
+struct BinaryLogMessage {
+  std::string_view source;
+  android::base::LogSeverity severity;
+  std::uint64_t timestamp_ns;
+  std::string_view message;
+};
+
+// Calls the callback for each message in the log, in order
+Result<void> ReadBinaryLog(
+    const std::string& path,
+    const std::function<void(const BinaryLogMessage&)>& callback);
+
+}  // namespace cuttlefish
@@ -0,0 +1,235 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "host/commands/log_tee/log_aggregator.h"
+
+#include <ctype.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <map>
+
+#include "common/libs/fs/epoll.h"
+
+namespace cuttlefish {
+namespace {
+
+// Longer lines are split
+constexpr std::size_t kBufferSize = 1 << 16;
+constexpr std::size_t kNumSeverities = android::base::FATAL + 1;
+
+std::string StripColorCodes(std::string_view line) {
+  std::string stripped;
+  bool in_color_code = false;
+  for (char c : line) {
+    if (c == '\033') {
+      in_color_code = true;
+    }
+    if (!in_color_code) {
+      stripped += c;
+    }
+    if (c == 'm') {
+      in_color_code = false;
+    }
+  }
+  return stripped;
+}
+
+}  // namespace
+
+LogAggregator::LogAggregator(std::vector<LogSource> sources,
+                             std::vector<LogDestination> text_destinations,
+                             std::optional<BinaryLogWriter> binary_log,
+                             std::optional<LogStoreWriter> log_store)
+    : text_destinations_(std::move(text_destinations)),
+      text_batches_(text_destinations_.size()),
+      binary_log_(std::move(binary_log)),
+      log_store_(std::move(log_store)),
+      prefixes_(sources.size() * kNumSeverities) {
+  for (auto& source : sources) {
+    auto& state = sources_.emplace_back();
+    state.source = std::move(source);
+    state.buffer.reset(new char[kBufferSize]);
+  }
+  for (auto& destination : text_destinations_) {
+    strip_colors_.push_back(!destination.fd->IsATTY());
+  }
+}
+
+Result<void> LogAggregator::Run() {
+  auto epoll = CF_EXPECT(Epoll::Create());
+  std::map<SharedFD, std::uint16_t> indices;
+  for (std::size_t i = 0; i < sources_.size(); i++) {
+    CF_EXPECT(epoll.Add(sources_[i].source.fd, EPOLLIN));
+    indices[sources_[i].source.fd] = i;
+  }
+  auto open = sources_.size();
+  while (open > 0) {
+    // Wakes up in time for the store to write the lines received before the
+    // sources went quiet, the Flush() below does it.
+    int timeout_ms = -1;
+    if (log_store_) {
+      auto timeout = log_store_->TimeUntilFlush();
+      timeout_ms = timeout ? timeout->count() : -1;
+    }
+    auto event = CF_EXPECT(epoll.Wait(timeout_ms));
+    RefreshTime();
+    // Collect the output of every source that is ready before writing
+    while (event) {
+      auto index = indices[event->fd];
+      if (sources_[index].read_this_batch) {
+        // The batches still point into its buffer
+        Flush();
+      }
+      if (!ReadSource(index)) {
+        CF_EXPECT(epoll.Delete(event->fd));
+        open--;
+      }
+      event = CF_EXPECT(epoll.Wait(0));
+    }
+    Flush();
+  }
+  return {};
+}
+
+bool LogAggregator::ReadSource(std::uint16_t index) {
+  auto& state = sources_[index];
+  state.read_this_batch = true;
+  auto read = state.source.fd->Read(state.buffer.get() + state.filled,
+                                    kBufferSize - state.filled);
+  if (read <= 0) {
+    if (read < 0) {
+      LOG(DEBUG) << "Failed to read from process " << state.source.name << ": "
+                 << state.source.fd->StrError();
+    }
+    if (state.filled > state.consumed) {
+      AddLine(index, std::string_view(state.buffer.get() + state.consumed,
+                                      state.filled - state.consumed));
+      state.consumed = state.filled;
+    }
+    LOG(DEBUG) << "Finished reading from process " << state.source.name;
+    return false;
+  }
+  state.filled += read;
+  std::string_view data(state.buffer.get() + state.consumed,
+                        state.filled - state.consumed);
+  for (auto newline = data.find('\n'); newline != std::string_view::npos;
+       newline = data.find('\n')) {
+    AddLine(index, data.substr(0, newline));
+    data.remove_prefix(newline + 1);
+    state.consumed += newline + 1;
+  }
+  if (state.filled == kBufferSize && state.consumed == 0) {
+    AddLine(index, data);
+    state.consumed = state.filled;
+  }
+  return true;
+}
+
+void LogAggregator::AddLine(std::uint16_t index, std::string_view line) {
+  while (!line.empty() && isspace(line.back())) {
+    line.remove_suffix(1);
+  }
+  if (line.empty()) {
+    return;
+  }
+  auto severity = GuessLineSeverity(line);
+  if (binary_log_) {
+    binary_log_->Add(index, severity, now_ns_, line);
+  }
+  if (log_store_) {
+    const auto& name = sources_[index].source.name;
+    if (line.find('\033') != std::string_view::npos) {
+      log_store_->Append(now_ns_, severity, name, StripColorCodes(line));
+    } else {
+      log_store_->Append(now_ns_, severity, name, line);
+    }
+  }
+  for (std::size_t i = 0; i < text_destinations_.size(); i++) {
+    if (severity < text_destinations_[i].severity) {
+      continue;
+    }
+    auto& batch = text_batches_[i];
+    batch.Add(Prefix(index, severity));
+    if (strip_colors_[i] && line.find('\033') != std::string_view::npos) {
+      batch.AddOwned(StripColorCodes(line));
+    } else {
+      batch.Add(line);
+    }
+    batch.Add("\n");
+  }
+}
+
+const std::string& LogAggregator::Prefix(std::uint16_t index,
+                                         android::base::LogSeverity severity) {
+  auto& prefix = prefixes_[index * kNumSeverities + severity];
+  if (prefix.empty()) {
+    prefix = FormatLogPrefix(sources_[index].source.name, severity, now_tm_,
+                             getpid());
+  }
+  return prefix;
+}
+
+void LogAggregator::RefreshTime() {
+  auto now = std::chrono::system_clock::now();
+  now_ns_ = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                now.time_since_epoch())
+                .count();
+  auto seconds = std::chrono::system_clock::to_time_t(now);
+  if (seconds != now_) {
+    now_ = seconds;
+    localtime_r(&now_, &now_tm_);
+    // Only called between batches, nothing points into the old prefixes
+    for (auto& prefix : prefixes_) {
+      prefix.clear();
+    }
+  }
+}
+
+void LogAggregator::Flush() {
+  // Keep going on errors, one of the other destinations may still work
+  for (std::size_t i = 0; i < text_destinations_.size(); i++) {
+    auto result = text_batches_[i].Flush(text_destinations_[i].fd);
+    if (!result.ok()) {
+      LOG(DEBUG) << "Could not write logs: " << result.error();
+    }
+  }
+  if (binary_log_) {
+    auto result = binary_log_->Flush();
+    if (!result.ok()) {
+      LOG(DEBUG) << "Could not write the binary log: " << result.error();
+    }
+  }
+  if (log_store_) {
+    auto result = log_store_->MaybeFlush();
+    if (!result.ok()) {
+      LOG(DEBUG) << "Could not write the log store: " << result.error();
+    }
+  }
+  for (auto& state : sources_) {
+    if (!state.read_this_batch) {
+      continue;
+    }
+    memmove(state.buffer.get(), state.buffer.get() + state.consumed,
+            state.filled - state.consumed);
+    state.filled -= state.consumed;
+    state.consumed = 0;
+    state.read_this_batch = false;
+  }
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,91 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <time.h>
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <android-base/logging.h>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+#include "host/commands/log_tee/binary_log.h"
+#include "host/commands/log_tee/log_format.h"
+#include "host/libs/log_store/log_store.h"
+
+namespace cuttlefish {
+
+struct LogSource {
+  std::string name;
+  SharedFD fd;
+};
+
+struct LogDestination {
+  SharedFD fd;
+  android::base::LogSeverity severity;
+};
+
+// Reads the output of many processes in one process. Each wakeup reads every
+// ready source once and writes all the complete lines with one writev per
+// destination, pointing into the read buffers rather than copying the lines.
+class LogAggregator {
+ public:
+  LogAggregator(std::vector<LogSource> sources,
+                std::vector<LogDestination> text_destinations,
+                std::optional<BinaryLogWriter> binary_log,
+                std::optional<LogStoreWriter> log_store);
+
+  // Returns once every source is closed
+  Result<void> Run();
+
+ private:
+  struct SourceState {
+    LogSource source;
+    std::unique_ptr<char[]> buffer;
+    std::size_t filled = 0;
+    // Bytes before this were handed to the batches as complete lines
+    std::size_t consumed = 0;
+    bool read_this_batch = false;
+  };
+
+  // Returns false when the source is closed
+  bool ReadSource(std::uint16_t index);
+  void AddLine(std::uint16_t index, std::string_view line);
+  const std::string& Prefix(std::uint16_t index,
+                            android::base::LogSeverity severity);
+  void RefreshTime();
+  void Flush();
+
+  std::vector<SourceState> sources_;
+  std::vector<LogDestination> text_destinations_;
+  std::vector<bool> strip_colors_;
+  std::vector<IovecBatch> text_batches_;
+  std::optional<BinaryLogWriter> binary_log_;
+  std::optional<LogStoreWriter> log_store_;
+  // Line prefixes by source and severity, valid for the current second
+  std::vector<std::string> prefixes_;
+  time_t now_ = 0;
+  struct tm now_tm_ = {};
+  std::uint64_t now_ns_ = 0;
+};
+
+}  // namespace cuttlefish
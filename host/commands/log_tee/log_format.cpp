@@ -0,0 +1,89 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "host/commands/log_tee/log_format.h"
+
+#include <limits.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <android-base/stringprintf.h>
+#include <android-base/strings.h>
+
+namespace cuttlefish {
+
+void IovecBatch::Add(std::string_view view) {
+  if (!view.empty()) {
+    iovecs_.push_back(iovec{const_cast<char*>(view.data()), view.size()});
+  }
+}
+
+void IovecBatch::AddOwned(std::string owned) {
+  // Deque elements never move, so the views into them stay valid
+  Add(owned_.emplace_back(std::move(owned)));
+}
+
+Result<void> IovecBatch::Flush(SharedFD fd) {
+  std::size_t next = 0;
+  while (next < iovecs_.size()) {
+    auto count = std::min<std::size_t>(iovecs_.size() - next, IOV_MAX);
+    auto written = fd->Writev(&iovecs_[next], count);
+    CF_EXPECT(written >= 0, "writev failed: " << fd->StrError());
+    // Skip what was written, a short write can end inside an iovec
+    std::size_t remaining = written;
+    while (next < iovecs_.size() && remaining >= iovecs_[next].iov_len) {
+      remaining -= iovecs_[next++].iov_len;
+    }
+    if (remaining > 0) {
+      iovecs_[next].iov_base = (char*)iovecs_[next].iov_base + remaining;
+      iovecs_[next].iov_len -= remaining;
+    }
+  }
+  iovecs_.clear();
+  owned_.clear();
+  return {};
+}
+
+android::base::LogSeverity GuessLineSeverity(std::string_view line) {
+  auto start = line.find_first_not_of(" \t");
+  if (start == std::string_view::npos) {
+    return android::base::DEBUG;
+  }
+  line.remove_prefix(start);
+  if (android::base::StartsWith(line, "[ERROR")) {
+    return android::base::ERROR;
+  } else if (android::base::StartsWith(line, "[WARNING")) {
+    return android::base::WARNING;
+  } else if (android::base::StartsWith(line, "[VERBOSE")) {
+    return android::base::VERBOSE;
+  }
+  // Including "[INFO", which is too chatty for the launcher's INFO
+  return android::base::DEBUG;
+}
+
+std::string FormatLogPrefix(std::string_view tag,
+                            android::base::LogSeverity severity,
+                            const struct tm& time, int pid) {
+  char timestamp[32];
+  strftime(timestamp, sizeof(timestamp), "%m-%d %H:%M:%S", &time);
+  static const char log_characters[] = "VDIWEFF";
+  return android::base::StringPrintf("%.*s %c %s %5d %5d ", (int)tag.size(),
+                                     tag.data(), log_characters[severity],
+                                     timestamp, pid, pid);
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,58 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <android-base/logging.h>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+// Gathers pieces of output and writes them with as few writev calls as
+// possible. Views must stay valid until Flush.
+class IovecBatch {
+ public:
+  void Add(std::string_view view);
+  // Keeps the string alive until Flush
+  void AddOwned(std::string owned);
+  bool Empty() const { return iovecs_.empty(); }
+  Result<void> Flush(SharedFD fd);
+
+ private:
+  std::deque<std::string> owned_;
+  std::vector<iovec> iovecs_;
+};
+
+// Maps the prefix crosvm and other rust processes put on their log lines to a
+// severity, DEBUG when there is none.
+android::base::LogSeverity GuessLineSeverity(std::string_view line);
+
+// The same per-line header android::base logging writes to the log files
+std::string FormatLogPrefix(std::string_view tag,
+                            android::base::LogSeverity severity,
+                            const struct tm& time, int pid);
+
+}  // namespace cuttlefish
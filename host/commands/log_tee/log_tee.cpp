@@ -13,73 +13,152 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android-base/strings.h>
 #include <gflags/gflags.h>
 
 #include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
 #include "common/libs/utils/tee_logging.h"
+#include "host/commands/log_tee/binary_log.h"
+#include "host/commands/log_tee/log_aggregator.h"
+#include "host/commands/log_tee/log_format.h"
 #include "host/libs/config/cuttlefish_config.h"
+#include "host/libs/log_store/log_store.h"
 
 DEFINE_string(process_name, "", "The process to credit log messages to");
 DEFINE_int32(log_fd_in, -1, "The file descriptor to read logs from.");
+DEFINE_string(log_fds_in, "",
+              "Comma separated <process name>:<file descriptor> pairs to read "
+              "logs from, in addition to --log_fd_in");
+DEFINE_string(binary_log, "",
+              "Write the compact binary format to this file instead of "
+              "writing text to the launcher log");
+DEFINE_string(print_binary_log, "",
+              "Print a binary log written with --binary_log as text and exit");
+
+namespace cuttlefish {
+namespace {
+
+Result<SharedFD> AdoptFd(int fd) {
+  auto shared = SharedFD::Dup(fd);
+  CF_EXPECT(shared->IsOpen(),
+            "Failed to dup fd " << fd << ": " << shared->StrError());
+  close(fd);
+  return shared;
+}
 
-int main(int argc, char** argv) {
-  ::android::base::InitLogging(argv, android::base::StderrLogger);
-  google::ParseCommandLineFlags(&argc, &argv, /* remove_flags */ true);
+Result<std::vector<LogSource>> ParseSources() {
+  std::vector<LogSource> sources;
+  if (FLAGS_log_fd_in >= 0) {
+    sources.push_back(
+        LogSource{FLAGS_process_name, CF_EXPECT(AdoptFd(FLAGS_log_fd_in))});
+  }
+  for (const auto& pair : android::base::Split(FLAGS_log_fds_in, ",")) {
+    if (pair.empty()) {
+      continue;
+    }
+    auto separator = pair.rfind(':');
+    CF_EXPECT(separator != std::string::npos,
+              "Expected <name>:<fd>, got \"" << pair << "\"");
+    int fd = -1;
+    CF_EXPECT(android::base::ParseInt(pair.substr(separator + 1), &fd, 0),
+              "Bad file descriptor in \"" << pair << "\"");
+    sources.push_back(
+        LogSource{pair.substr(0, separator), CF_EXPECT(AdoptFd(fd))});
+  }
+  CF_EXPECT(!sources.empty(), "-log_fd_in or -log_fds_in is required");
+  return sources;
+}
 
-  CHECK(FLAGS_log_fd_in >= 0) << "-log_fd_in is required";
+Result<void> PrintBinaryLog(const std::string& path) {
+  auto pid = getpid();
+  auto print = [pid](const BinaryLogMessage& message) {
+    time_t seconds = message.timestamp_ns / 1000000000;
+    struct tm time;
+    localtime_r(&seconds, &time);
+    std::cout << FormatLogPrefix(message.source, message.severity, time, pid)
+              << message.message << "\n";
+  };
+  CF_EXPECT(ReadBinaryLog(path, print));
+  return {};
+}
 
-  auto config = cuttlefish::CuttlefishConfig::Get();
+Result<void> LogTeeMain(int argc, char** argv) {
+  ::android::base::InitLogging(argv, android::base::StderrLogger);
+  google::ParseCommandLineFlags(&argc, &argv, /* remove_flags */ true);
 
-  CHECK(config) << "Could not open cuttlefish config";
+  if (!FLAGS_print_binary_log.empty()) {
+    CF_EXPECT(PrintBinaryLog(FLAGS_print_binary_log));
+    return {};
+  }
 
+  auto config = CF_EXPECT(CuttlefishConfig::Get(),
+                          "Could not open cuttlefish config");
   auto instance = config->ForDefaultInstance();
 
   if (config->run_as_daemon()) {
-    android::base::SetLogger(
-        cuttlefish::LogToFiles({instance.launcher_log_path()}));
+    android::base::SetLogger(LogToFiles({instance.launcher_log_path()}));
   } else {
     android::base::SetLogger(
-        cuttlefish::LogToStderrAndFiles({instance.launcher_log_path()}));
+        LogToStderrAndFiles({instance.launcher_log_path()}));
   }
 
-  auto log_fd = cuttlefish::SharedFD::Dup(FLAGS_log_fd_in);
-  CHECK(log_fd->IsOpen()) << "Failed to dup log_fd_in: " <<  log_fd->StrError();
-  close(FLAGS_log_fd_in);
-
-  if (FLAGS_process_name.size() > 0) {
-    android::base::SetDefaultTag(FLAGS_process_name);
+  auto sources = CF_EXPECT(ParseSources());
+  if (sources.size() == 1 && !sources[0].name.empty()) {
+    android::base::SetDefaultTag(sources[0].name);
   }
 
-  char buf[1 << 16];
-  ssize_t chars_read = 0;
-
-  LOG(DEBUG) << "Starting to read from process " << FLAGS_process_name;
-
-  while ((chars_read = log_fd->Read(buf, sizeof(buf))) > 0) {
-    auto trimmed = android::base::Trim(std::string(buf, chars_read));
-    // Newlines inside `trimmed` are handled by the android logging code.
-    // These checks attempt to determine the log severity coming from crosvm.
-    // There is no guarantee of success all the time since log line boundaries
-    // could be out sync with the reads, but that's ok.
-    if (android::base::StartsWith(trimmed, "[INFO")) {
-      LOG(DEBUG) << trimmed;
-    } else if (android::base::StartsWith(trimmed, "[ERROR")) {
-      LOG(ERROR) << trimmed;
-    } else if (android::base::StartsWith(trimmed, "[WARNING")) {
-      LOG(WARNING) << trimmed;
-    } else if (android::base::StartsWith(trimmed, "[VERBOSE")) {
-      LOG(VERBOSE) << trimmed;
-    } else {
-      LOG(DEBUG) << trimmed;
+  std::vector<LogDestination> text_destinations;
+  std::optional<BinaryLogWriter> binary_log;
+  if (FLAGS_binary_log.empty()) {
+    auto log_path = instance.launcher_log_path();
+    auto log_file = SharedFD::Open(log_path, O_CREAT | O_WRONLY | O_APPEND,
+                                   S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    CF_EXPECT(log_file->IsOpen(), "Failed to open \"" << log_path
+                                      << "\": " << log_file->StrError());
+    text_destinations.push_back(LogDestination{log_file, LogFileSeverity()});
+  } else {
+    std::vector<std::string> names;
+    for (const auto& source : sources) {
+      names.push_back(source.name);
     }
+    binary_log = CF_EXPECT(BinaryLogWriter::Create(FLAGS_binary_log, names));
+  }
+  std::optional<LogStoreWriter> log_store;
+  if (config->structured_logs()) {
+    log_store =
+        CF_EXPECT(LogStoreWriter::Create(instance.log_store_dir(), "launcher"));
+  }
+  if (!config->run_as_daemon()) {
+    text_destinations.push_back(
+        LogDestination{SharedFD::Dup(/* stderr */ 2), ConsoleSeverity()});
   }
 
-  if (chars_read < 0) {
-    LOG(DEBUG) << "Failed to read from process " << FLAGS_process_name << ": "
-               << log_fd->StrError();
+  for (const auto& source : sources) {
+    LOG(DEBUG) << "Starting to read from process " << source.name;
   }
+  LogAggregator aggregator(std::move(sources), std::move(text_destinations),
+                           std::move(binary_log), std::move(log_store));
+  CF_EXPECT(aggregator.Run());
+  return {};
+}
 
-  LOG(DEBUG) << "Finished reading from process " << FLAGS_process_name;
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  auto result = cuttlefish::LogTeeMain(argc, argv);
+  CHECK(result.ok()) << result.error();
+  return 0;
 }
@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+
+#include "common/libs/utils/flag_parser.h"
+#include "common/libs/utils/result.h"
+#include "host/libs/config/cuttlefish_config.h"
+#include "host/libs/log_store/log_store.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr char kSeverityLetters[] = "VDIWEF";
+
+struct MatchedLine {
+  uint64_t timestamp_ns;
+  std::size_t stream;
+  uint8_t severity;
+  std::string tag;
+  std::string line;
+};
+
+// Accepts "<n>s", "<n>m", "<n>h" and "<n>d" ago, "@<seconds since the epoch>"
+// and local "YYYY-MM-DD HH:MM:SS".
+Result<uint64_t> ParseTime(const std::string& value) {
+  constexpr uint64_t kNsPerSecond = 1000000000;
+  if (value.empty()) {
+    return CF_ERR("Empty time");
+  }
+  if (value[0] == '@') {
+    uint64_t seconds = 0;
+    CF_EXPECT(android::base::ParseUint(value.substr(1), &seconds),
+              "Bad time \"" << value << "\"");
+    return seconds * kNsPerSecond;
+  }
+  uint64_t multiplier = 0;
+  switch (value.back()) {
+    case 's':
+      multiplier = 1;
+      break;
+    case 'm':
+      multiplier = 60;
+      break;
+    case 'h':
+      multiplier = 60 * 60;
+      break;
+    case 'd':
+      multiplier = 24 * 60 * 60;
+      break;
+  }
+  uint64_t amount = 0;
+  if (multiplier != 0 &&
+      android::base::ParseUint(value.substr(0, value.size() - 1), &amount)) {
+    return LogStoreNow() - amount * multiplier * kNsPerSecond;
+  }
+  struct tm time = {};
+  auto end = strptime(value.c_str(), "%Y-%m-%d %H:%M:%S", &time);
+  CF_EXPECT(end != nullptr && *end == '\0', "Bad time \"" << value << "\"");
+  time.tm_isdst = -1;
+  auto seconds = mktime(&time);
+  CF_EXPECT(seconds >= 0, "Bad time \"" << value << "\"");
+  return static_cast<uint64_t>(seconds) * kNsPerSecond;
+}
+
+Result<uint8_t> ParseSeverity(const std::string& value) {
+  auto upper = value;
+  std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+  const std::vector<std::string> names = {"VERBOSE", "DEBUG", "INFO",
+                                          "WARNING", "ERROR", "FATAL"};
+  for (std::size_t i = 0; i < names.size(); i++) {
+    if (upper == names[i] || upper == std::string(1, kSeverityLetters[i])) {
+      return i;
+    }
+  }
+  return CF_ERR("Unknown severity \"" << value << "\"");
+}
+
+std::string FormatTime(uint64_t timestamp_ns) {
+  time_t seconds = timestamp_ns / 1000000000;
+  struct tm time;
+  localtime_r(&seconds, &time);
+  std::stringstream formatted;
+  formatted << std::put_time(&time, "%Y-%m-%d %H:%M:%S") << "."
+            << std::setfill('0') << std::setw(3)
+            << (timestamp_ns / 1000000) % 1000;
+  return formatted.str();
+}
+
+Result<void> CvdLogsMain(int argc, char** argv) {
+  ::android::base::InitLogging(argv, android::base::StderrLogger);
+
+  std::vector<Flag> flags;
+  std::string instance_name;
+  flags.emplace_back(GflagsCompatFlag("instance_name", instance_name)
+                         .Help("Name of the instance to read the logs of. If "
+                               "not provided, DefaultInstance is used."));
+  std::string since;
+  flags.emplace_back(
+      GflagsCompatFlag("since", since)
+          .Help("Only lines at or after this time: \"YYYY-MM-DD HH:MM:SS\", "
+                "\"@<seconds since the epoch>\" or a duration ago like "
+                "\"10m\"."));
+  std::string until;
+  flags.emplace_back(GflagsCompatFlag("until", until)
+                         .Help("Only lines at or before this time, in the "
+                               "formats of --since."));
+  std::string grep;
+  flags.emplace_back(GflagsCompatFlag("grep", grep).Help(
+      "Only lines matching this regular expression."));
+  std::string severity = "VERBOSE";
+  flags.emplace_back(GflagsCompatFlag("severity", severity)
+                         .Help("Only lines of at least this severity."));
+  std::string streams_flag;
+  flags.emplace_back(
+      GflagsCompatFlag("streams", streams_flag)
+          .Help("Comma separated streams to read, e.g. launcher,kernel,logcat. "
+                "All of them if not provided."));
+  flags.emplace_back(HelpFlag(
+      flags,
+      "Query the logs kept by a device started with --structured_logs. Lines "
+      "still buffered by a running device may be missing."));
+  flags.emplace_back(UnexpectedArgumentGuard());
+
+  auto args = ArgsToVec(argc - 1, argv + 1);
+  CF_EXPECT(ParseFlags(flags, args), "Could not process command line flags.");
+
+  LogStoreQuery query;
+  if (!since.empty()) {
+    query.since_ns = CF_EXPECT(ParseTime(since));
+  }
+  if (!until.empty()) {
+    query.until_ns = CF_EXPECT(ParseTime(until));
+  }
+  query.min_severity = CF_EXPECT(ParseSeverity(severity));
+
+  auto config = CF_EXPECT(CuttlefishConfig::Get(), "Failed to obtain config");
+  auto instance = instance_name.empty()
+                      ? config->ForDefaultInstance()
+                      : config->ForInstanceName(instance_name);
+  auto directory = instance.log_store_dir();
+  auto streams = streams_flag.empty()
+                     ? LogStoreStreams(directory)
+                     : android::base::Split(streams_flag, ",");
+  CF_EXPECT(!streams.empty(), "No logs in \"" << directory
+                                  << "\", was the device started with "
+                                  << "--structured_logs?");
+
+  // Plain strings are much faster to look for than regular expressions
+  bool literal = grep.find_first_of("\\^$.|?*+()[]{}") == std::string::npos;
+  std::regex pattern;
+  if (!literal) {
+    pattern = std::regex(grep, std::regex::extended | std::regex::nosubs);
+  }
+
+  std::vector<MatchedLine> matched;
+  for (std::size_t i = 0; i < streams.size(); i++) {
+    auto collect = [&matched, &grep, &pattern, literal,
+                    i](const LogStoreRecord& record) {
+      if (literal ? record.line.find(grep) == std::string_view::npos
+                  : !std::regex_search(record.line.begin(), record.line.end(),
+                                       pattern)) {
+        return;
+      }
+      matched.push_back(MatchedLine{
+          .timestamp_ns = record.timestamp_ns,
+          .stream = i,
+          .severity = record.severity,
+          .tag = std::string(record.tag),
+          .line = std::string(record.line),
+      });
+    };
+    CF_EXPECT(QueryLogStore(directory, streams[i], query, collect));
+  }
+  auto earlier = [](const MatchedLine& a, const MatchedLine& b) {
+    return a.timestamp_ns < b.timestamp_ns;
+  };
+  std::stable_sort(matched.begin(), matched.end(), earlier);
+
+  for (const auto& line : matched) {
+    std::cout << FormatTime(line.timestamp_ns) << " " << streams[line.stream]
+              << " " << kSeverityLetters[std::min<uint8_t>(line.severity, 5)]
+              << " ";
+    if (!line.tag.empty()) {
+      std::cout << line.tag << ": ";
+    }
+    std::cout << line.line << "\n";
+  }
+  return {};
+}
+
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  auto result = cuttlefish::CvdLogsMain(argc, argv);
+  if (!result.ok()) {
+    LOG(ERROR) << result.error();
+    return 1;
+  }
+  return 0;
+}
@@ -13,6 +13,12 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include <android-base/strings.h>
 #include <gflags/gflags.h>
 #include <android-base/logging.h>
@@ -20,6 +26,10 @@
 #include "common/libs/utils/tee_logging.h"
 #include "host/commands/metrics/metrics_defs.h"
 #include "host/libs/config/cuttlefish_config.h"
+#include "host/libs/msg_queue/shm_msg_queue.h"
+
+DEFINE_int32(metrics_batch_interval_ms, 1000,
+             "How long events accumulate in the queue between batches");
 
 using cuttlefish::MetricsExitCodes;
 
@@ -48,9 +58,32 @@ int main(int argc, char** argv) {
     return cuttlefish::MetricsExitCodes::kInvalidHostConfiguration;
   }
 
+  auto queue = cuttlefish::ShmMessageQueue::Create(
+      instance.PerInstanceInternalPath(cuttlefish::kMetricsQueueName),
+      cuttlefish::kMetricsQueueCapacity);
+  if (!queue) {
+    LOG(ERROR) << "Could not create the metrics queue";
+    return cuttlefish::MetricsExitCodes::kMetricsError;
+  }
+
+  // Producers never wait on this process, so events are taken in batches
+  // rather than woken up for one by one.
+  std::vector<std::string> batch;
+  std::uint64_t dropped = 0;
   while (true) {
-    // do nothing
-    sleep(std::numeric_limits<unsigned int>::max());
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(FLAGS_metrics_batch_interval_ms));
+    batch.clear();
+    while (queue->ReceiveBatch(batch, 1024) > 0) {
+    }
+    if (!batch.empty()) {
+      LOG(VERBOSE) << "Received " << batch.size() << " metrics events";
+    }
+    if (queue->Dropped() != dropped) {
+      LOG(WARNING) << "The metrics queue was full, "
+                   << queue->Dropped() - dropped << " events were dropped";
+      dropped = queue->Dropped();
+    }
   }
   return cuttlefish::MetricsExitCodes::kMetricsError;
 }
@@ -15,8 +15,15 @@
  */
 #pragma once
 
+#include <cstddef>
+
 namespace cuttlefish {
 
+// Launcher tools send serialized metrics events through a ShmMessageQueue
+// at this per instance internal path, which the metrics process drains.
+constexpr char kMetricsQueueName[] = "metrics_queue";
+constexpr std::size_t kMetricsQueueCapacity = 1 << 20;
+
 enum MetricsExitCodes : int {
   kSuccess=0,
   kMetricsError=1,
@@ -19,8 +19,12 @@
 #include <android-base/logging.h>
 #include <android-base/strings.h>
 
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
 #include <algorithm>
 
+#include "common/libs/fs/shared_buf.h"
 #include "host/commands/modem_simulator/modem_simulator.h"
 
 namespace cuttlefish {
@@ -36,135 +40,206 @@ bool Client::operator==(const Client& other) const {
   return client_fd == other.client_fd;
 }
 
-void Client::SendCommandResponse(std::string response) const {
+static bool AppendResponse(std::string& data, const std::string& response) {
   if (response.empty()) {
     LOG(DEBUG) << "Invalid response, ignore!";
-    return;
+    return false;
   }
-
+  LOG(DEBUG) << " AT< " << response;
+  data += response;
   if (response.back() != '\r') {
-    response += '\r';
+    data += '\r';
   }
-  LOG(DEBUG) << " AT< " << response;
+  return true;
+}
 
-  std::lock_guard<std::mutex> autolock(const_cast<Client*>(this)->write_mutex);
-  client_fd->Write(response.data(), response.size());
+void Client::SendCommandResponse(std::string response) const {
+  std::string data;
+  if (AppendResponse(data, response)) {
+    Send(data);
+  }
 }
 
 void Client::SendCommandResponse(
     const std::vector<std::string>& responses) const {
+  std::string data;
   for (auto& response : responses) {
-    SendCommandResponse(response);
+    AppendResponse(data, response);
+  }
+  if (!data.empty()) {
+    Send(data);
+  }
+}
+
+void Client::Send(const std::string& data) const {
+  std::lock_guard<std::mutex> autolock(const_cast<Client*>(this)->write_mutex);
+  if (WriteAll(client_fd, data) != static_cast<ssize_t>(data.size())) {
+    LOG(DEBUG) << "Error writing to client fd: " << client_fd->StrError();
   }
 }
 
 ChannelMonitor::ChannelMonitor(ModemSimulator* modem,
                                cuttlefish::SharedFD server)
     : modem_(modem), server_(server) {
-  if (!cuttlefish::SharedFD::Pipe(&read_pipe_, &write_pipe_)) {
-    LOG(ERROR) << "Unable to create pipe, ignore";
+  if (!server_->IsOpen()) {
+    return;
+  }
+  auto epoll = Epoll::Create();
+  if (!epoll.ok()) {
+    LOG(ERROR) << "Unable to create epoll: " << epoll.error();
+    return;
+  }
+  epoll_ = std::move(*epoll);
+  wakeup_ = cuttlefish::SharedFD::Event(0, EFD_NONBLOCK);
+  if (!wakeup_->IsOpen()) {
+    LOG(ERROR) << "Unable to create eventfd, ignore: " << wakeup_->StrError();
+  } else if (auto res = epoll_.Add(wakeup_, EPOLLIN); !res.ok()) {
+    LOG(ERROR) << "Unable to watch eventfd, ignore: " << res.error();
+  }
+  if (auto res = epoll_.Add(server_, EPOLLIN); !res.ok()) {
+    LOG(ERROR) << "Unable to watch server socket: " << res.error();
+    return;
   }
 
-  if (server_->IsOpen())
-    monitor_thread_ = std::thread([this]() { MonitorLoop(); });
+  monitor_thread_ = std::thread([this]() { MonitorLoop(); });
 }
 
 void ChannelMonitor::SetRemoteClient(cuttlefish::SharedFD client, bool is_accepted) {
   auto remote_client = std::make_unique<Client>(client, Client::REMOTE);
-
-  if (is_accepted) {
-    // There may be new data from remote client before select.
-    remote_client->first_read_command_ = true;
-    ReadCommand(*remote_client);
-  }
-
-  if (remote_client->client_fd->IsOpen()) {
-    remote_client->first_read_command_ = false;
+  // Added to the list before being watched, so the first event always finds
+  // it. Data that came before is reported as soon as it's watched.
+  {
+    std::lock_guard<std::mutex> autolock(clients_mutex_);
     remote_clients_.push_back(std::move(remote_client));
-    LOG(DEBUG) << "added one remote client";
   }
-
-  // Trigger monitor loop
-  if (write_pipe_->IsOpen()) {
-    write_pipe_->Write("OK", sizeof("OK"));
-  } else {
-    LOG(ERROR) << "Pipe created fail, can't trigger monitor loop";
+  if (auto res = epoll_.Add(client, EPOLLIN | EPOLLET); !res.ok()) {
+    LOG(ERROR) << "Unable to watch remote client: " << res.error();
+    return;
   }
+  LOG(DEBUG) << "added one remote client, accepted: " << is_accepted;
 }
 
 void ChannelMonitor::AcceptIncomingConnection() {
   auto client_fd  = cuttlefish::SharedFD::Accept(*server_);
   if (!client_fd->IsOpen()) {
     LOG(ERROR) << "Error accepting connection on socket: " << client_fd->StrError();
-  } else {
-    auto client = std::make_unique<Client>(client_fd);
-    LOG(DEBUG) << "added one RIL client";
-    clients_.push_back(std::move(client));
-    if (clients_.size() == 1) {
-      // The first connected client default to be the unsolicited commands channel
-      modem_->OnFirstClientConnected();
-    }
+    return;
+  }
+  bool is_first_client;
+  {
+    std::lock_guard<std::mutex> autolock(clients_mutex_);
+    clients_.push_back(std::make_unique<Client>(client_fd));
+    is_first_client = clients_.size() == 1;
+  }
+  if (auto res = epoll_.Add(client_fd, EPOLLIN | EPOLLET); !res.ok()) {
+    LOG(ERROR) << "Unable to watch RIL client: " << res.error();
+  }
+  LOG(DEBUG) << "added one RIL client";
+  if (is_first_client) {
+    // The first connected client default to be the unsolicited commands channel
+    modem_->OnFirstClientConnected();
   }
 }
 
-void ChannelMonitor::ReadCommand(Client& client) {
-  std::vector<char> buffer(kMaxCommandLength);
-  auto bytes_read = client.client_fd->Read(buffer.data(), buffer.size());
-  if (bytes_read <= 0) {
-    if (errno == EAGAIN && client.type == Client::REMOTE &&
-        client.first_read_command_) {
-      LOG(ERROR) << "After read 'REM' from remote client, and before select "
-          "no new data come.";
-      return;
-    }
-    LOG(DEBUG) << "Error reading from client fd: "
-               << client.client_fd->StrError();
-    client.client_fd->Close();  // Ignore errors here
-    // Erase client from the vector clients
-    auto& clients = client.type == Client::REMOTE ? remote_clients_ : clients_;
-    auto iter = std::find_if(
-        clients.begin(), clients.end(),
-        [&](std::unique_ptr<Client>& other) { return *other == client; });
-    if (iter != clients.end()) {
-      clients.erase(iter);
+Client* ChannelMonitor::FindClient(const cuttlefish::SharedFD& fd) {
+  std::lock_guard<std::mutex> autolock(clients_mutex_);
+  for (auto clients : {&clients_, &remote_clients_}) {
+    for (auto& client : *clients) {
+      if (client->client_fd == fd) {
+        return client.get();
+      }
     }
-    return;
   }
+  return nullptr;
+}
 
-  std::string& incomplete_command = client.incomplete_command;
-
-  // Add the incomplete command from the last read
-  auto commands = std::string{incomplete_command.data()};
-  commands.append(buffer.data());
+void ChannelMonitor::RemoveClient(Client& client) {
+  // Deleted while the descriptor is still open, since epoll needs it
+  if (auto res = epoll_.Delete(client.client_fd); !res.ok()) {
+    LOG(ERROR) << "Unable to stop watching client: " << res.error();
+  }
+  client.client_fd->Close();  // Ignore errors here
+  std::lock_guard<std::mutex> autolock(clients_mutex_);
+  auto& clients = client.type == Client::REMOTE ? remote_clients_ : clients_;
+  auto iter = std::find_if(
+      clients.begin(), clients.end(),
+      [&](std::unique_ptr<Client>& other) { return other.get() == &client; });
+  if (iter != clients.end()) {
+    clients.erase(iter);
+  }
+}
 
-  incomplete_command.clear();
+void ChannelMonitor::RemoveInvalidClients() {
+  std::vector<Client*> invalid_clients;
+  {
+    std::lock_guard<std::mutex> autolock(clients_mutex_);
+    for (auto clients : {&clients_, &remote_clients_}) {
+      for (auto& client : *clients) {
+        if (!client->is_valid) {
+          invalid_clients.push_back(client.get());
+        }
+      }
+    }
+  }
+  for (auto client : invalid_clients) {
+    LOG(DEBUG) << "removed 1 client";
+    RemoveClient(*client);
+  }
+}
 
-  // Replacing '\n' with '\r'
-  commands = android::base::StringReplace(commands, "\n", "\r", true);
+bool ChannelMonitor::ReadCommand(Client& client) {
+  // Clients are watched edge triggered, so read until there's nothing left.
+  // The reads don't block, but the writes from the services still do.
+  char buffer[kMaxCommandLength];
+  while (true) {
+    auto bytes_read =
+        client.client_fd->Recv(buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (bytes_read < 0 && (client.client_fd->GetErrno() == EAGAIN ||
+                           client.client_fd->GetErrno() == EWOULDBLOCK)) {
+      return true;
+    } else if (bytes_read <= 0) {
+      LOG(DEBUG) << "Error reading from client fd: "
+                 << client.client_fd->StrError();
+      return false;
+    }
+    client.incomplete_command.append(buffer, bytes_read);
+    DispatchCommands(client);
+    if (!client.is_valid) {
+      return false;
+    }
+  }
+}
 
-  // Split into commands and dispatch
-  size_t pos = 0, r_pos = 0;  // '\r' or '\n'
-  while (r_pos != std::string::npos) {
+void ChannelMonitor::DispatchCommands(Client& client) {
+  auto& commands = client.incomplete_command;
+  // Split into commands and dispatch, '\r' and '\n' both end a command
+  size_t pos = 0;
+  while (pos < commands.size()) {
+    size_t end;
     if (modem_->IsWaitingSmsPdu()) {
-      r_pos = commands.find('\032', pos);  // In sms, find ctrl-z
+      end = commands.find('\032', pos);  // In sms, find ctrl-z
     } else {
-      r_pos = commands.find('\r', pos);
+      end = commands.find_first_of("\r\n", pos);
     }
-    if (r_pos != std::string::npos) {
-      auto command = commands.substr(pos, r_pos - pos);
-      if (command.size() > 0) {  // "\r\r" ?
-        LOG(DEBUG) << "AT> " << command;
-        modem_->DispatchCommand(client, command);
-      }
-      pos = r_pos + 1;  // Skip '\r'
-    } else if (pos < commands.length()) {  // Incomplete command
-      incomplete_command = commands.substr(pos);
-      LOG(DEBUG) << "incomplete command: " << incomplete_command;
+    if (end == std::string::npos) {
+      break;
+    }
+    if (end > pos) {  // "\r\r" ?
+      auto command = commands.substr(pos, end - pos);
+      std::replace(command.begin(), command.end(), '\n', '\r');
+      LOG(DEBUG) << "AT> " << command;
+      modem_->DispatchCommand(client, command);
     }
+    pos = end + 1;  // Skip '\r'
+  }
+  commands.erase(0, pos);
+  if (!commands.empty()) {
+    LOG(DEBUG) << "incomplete command: " << commands;
   }
 }
 
 void ChannelMonitor::SendUnsolicitedCommand(std::string& response) {
+  std::lock_guard<std::mutex> autolock(clients_mutex_);
   // The first accepted client default to be unsolicited command channel?
   auto iter = clients_.begin();
   if (iter != clients_.end()) {
@@ -174,7 +249,19 @@ void ChannelMonitor::SendUnsolicitedCommand(std::string& response) {
   }
 }
 
+void ChannelMonitor::SendUnsolicitedCommand(
+    const std::vector<std::string>& responses) {
+  std::lock_guard<std::mutex> autolock(clients_mutex_);
+  auto iter = clients_.begin();
+  if (iter != clients_.end()) {
+    iter->get()->SendCommandResponse(responses);
+  } else {
+    LOG(DEBUG) << "No client connected yet.";
+  }
+}
+
 void ChannelMonitor::SendRemoteCommand(cuttlefish::SharedFD client, std::string& response) {
+  std::lock_guard<std::mutex> autolock(clients_mutex_);
   auto iter = remote_clients_.begin();
   for (; iter != remote_clients_.end(); ++iter) {
     if (iter->get()->client_fd == client) {
@@ -186,29 +273,32 @@ void ChannelMonitor::SendRemoteCommand(cuttlefish::SharedFD client, std::string&
 }
 
 void ChannelMonitor::CloseRemoteConnection(cuttlefish::SharedFD client) {
+  std::lock_guard<std::mutex> autolock(clients_mutex_);
   auto iter = remote_clients_.begin();
   for (; iter != remote_clients_.end(); ++iter) {
     if (iter->get()->client_fd == client) {
-      iter->get()->client_fd->Close();
+      // The monitor loop closes it once it's no longer watched
+      iter->get()->client_fd->Shutdown(SHUT_RDWR);
       iter->get()->is_valid = false;
-
-      // Trigger monitor loop
-      if (write_pipe_->IsOpen()) {
-        write_pipe_->Write("OK", sizeof("OK"));
-        LOG(DEBUG) << "asking to remove clients";
-      } else {
-        LOG(ERROR) << "Pipe created fail, can't trigger monitor loop";
-      }
+      LOG(DEBUG) << "asking to remove clients";
+      WakeUpMonitorLoop();
       return;
     }
   }
   LOG(DEBUG) << "Remote client has been erased.";
 }
 
-ChannelMonitor::~ChannelMonitor() {
-  if (write_pipe_->IsOpen()) {
-    write_pipe_->Write("KO", sizeof("KO"));
+void ChannelMonitor::WakeUpMonitorLoop() {
+  if (wakeup_->IsOpen()) {
+    wakeup_->EventfdWrite(1);
+  } else {
+    LOG(ERROR) << "Eventfd created fail, can't trigger monitor loop";
   }
+}
+
+ChannelMonitor::~ChannelMonitor() {
+  exiting_ = true;
+  WakeUpMonitorLoop();
 
   if (monitor_thread_.joinable()) {
     LOG(DEBUG) << "waiting for monitor thread to join";
@@ -216,62 +306,31 @@ ChannelMonitor::~ChannelMonitor() {
   }
 }
 
-static void removeInvalidClients(std::vector<std::unique_ptr<Client>>& clients) {
-  auto iter = clients.begin();
-  for (; iter != clients.end();) {
-    if (iter->get()->is_valid) {
-      ++iter;
-    } else {
-      LOG(DEBUG) << "removed 1 client";
-      iter = clients.erase(iter);
-    }
-  }
-}
-
 void ChannelMonitor::MonitorLoop() {
   do {
-    cuttlefish::SharedFDSet read_set;
-    read_set.Set(server_);
-    read_set.Set(read_pipe_);
-    for (auto& client: clients_) {
-      if (client->is_valid) read_set.Set(client->client_fd);
-    }
-    for (auto& client: remote_clients_) {
-      if (client->is_valid) read_set.Set(client->client_fd);
-    }
-    int num_fds = cuttlefish::Select(&read_set, nullptr, nullptr, nullptr);
-    if (num_fds < 0) {
-      LOG(ERROR) << "Select call returned error : " << strerror(errno);
+    auto event = epoll_.Wait();
+    if (!event.ok()) {
+      LOG(ERROR) << "Epoll wait returned error : " << event.error();
       // std::exit(kSelectError);
       break;
-    } else if (num_fds > 0) {
-      if (read_set.IsSet(server_)) {
-        AcceptIncomingConnection();
-      }
-      if (read_set.IsSet(read_pipe_)) {
-        std::string buf(2, ' ');
-        read_pipe_->Read(buf.data(), buf.size());  // Empty pipe
-        if (buf == std::string("KO")) {
-          LOG(DEBUG) << "requested to exit now";
-          break;
-        }
-        // clean the lists
-        removeInvalidClients(clients_);
-        removeInvalidClients(remote_clients_);
+    } else if (!*event) {
+      continue;
+    }
+    auto& fd = (*event)->fd;
+    if (fd == server_) {
+      AcceptIncomingConnection();
+    } else if (fd == wakeup_) {
+      eventfd_t value;
+      wakeup_->EventfdRead(&value);
+      if (exiting_) {
+        LOG(DEBUG) << "requested to exit now";
+        break;
       }
-      for (auto& client : clients_) {
-        if (read_set.IsSet(client->client_fd)) {
-          ReadCommand(*client);
-        }
+      RemoveInvalidClients();
+    } else if (auto client = FindClient(fd); client) {
+      if (!ReadCommand(*client)) {
+        RemoveClient(*client);
       }
-      for (auto& client : remote_clients_) {
-        if (read_set.IsSet(client->client_fd)) {
-          ReadCommand(*client);
-        }
-      }
-    } else {
-      // Ignore errors here
-      LOG(ERROR) << "Select call returned error : " << strerror(errno);
     }
   } while (true);
 }
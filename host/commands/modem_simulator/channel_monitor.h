@@ -15,11 +15,13 @@
 
 #pragma once
 
+#include <atomic>
 #include <mutex>
 #include <thread>
 #include <vector>
 
-#include "common/libs/fs/shared_select.h"
+#include "common/libs/fs/epoll.h"
+#include "common/libs/fs/shared_fd.h"
 
 namespace cuttlefish {
 
@@ -43,9 +45,9 @@ class Client {
 
   ClientType type = RIL;
   cuttlefish::SharedFD client_fd;
+  // Bytes received after the last complete command
   std::string incomplete_command;
   std::mutex write_mutex;
-  bool first_read_command_;  // Only used when ClientType::REMOTE
   bool is_valid = true;
 
   Client() = default;
@@ -60,7 +62,11 @@ class Client {
   bool operator==(const Client& other) const;
 
   void SendCommandResponse(std::string response) const;
+  // Sends all the responses with a single write
   void SendCommandResponse(const std::vector<std::string>& responses) const;
+
+ private:
+  void Send(const std::string& data) const;
 };
 
 class ChannelMonitor {
@@ -77,19 +83,34 @@ class ChannelMonitor {
 
   // For modem services to send unsolicited commands
   void SendUnsolicitedCommand(std::string& response);
+  // Sends the unsolicited commands back to back with a single write
+  void SendUnsolicitedCommand(const std::vector<std::string>& responses);
 
  private:
   ModemSimulator* modem_;
   std::thread monitor_thread_;
   cuttlefish::SharedFD server_;
-  cuttlefish::SharedFD read_pipe_;
-  cuttlefish::SharedFD write_pipe_;
+  // Wakes up the monitor loop to remove invalid clients or to exit
+  cuttlefish::SharedFD wakeup_;
+  std::atomic<bool> exiting_ = false;
+  Epoll epoll_;
+  /**
+   * Guards the client lists, which the services change and send to from
+   * their own threads. It's never held while dispatching a command. Clients
+   * are only erased from the monitor thread, so it can use them unlocked.
+   */
+  std::mutex clients_mutex_;
   std::vector<std::unique_ptr<Client>> clients_;
   std::vector<std::unique_ptr<Client>> remote_clients_;
 
   void AcceptIncomingConnection();
-  void OnClientSocketClosed(int sock);
-  void ReadCommand(Client& client);
+  Client* FindClient(const cuttlefish::SharedFD& fd);
+  void RemoveClient(Client& client);
+  void RemoveInvalidClients();
+  // Returns false once the client disconnected
+  bool ReadCommand(Client& client);
+  void DispatchCommands(Client& client);
+  void WakeUpMonitorLoop();
 
   void MonitorLoop();
 };
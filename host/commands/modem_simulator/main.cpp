@@ -13,16 +13,20 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <android-base/parseint.h>
 #include <android-base/strings.h>
 #include <gflags/gflags.h>
 #include <signal.h>
 #include <unistd.h>
 
+#include <chrono>
 #include <limits>
+#include <map>
 
 #include "common/libs/device_config/device_config.h"
 #include "common/libs/fs/shared_buf.h"
 #include "common/libs/fs/shared_fd.h"
+#include "common/libs/fs/reactor.h"
 #include "common/libs/utils/tee_logging.h"
 #include "host/commands/modem_simulator/modem_simulator.h"
 #include "host/libs/config/cuttlefish_config.h"
@@ -32,6 +36,10 @@
 // there should be at least 1 valid fd
 DEFINE_string(server_fds, "", "A comma separated list of file descriptors");
 DEFINE_int32(sim_type, 1, "Sim type: 1 for normal, 2 for CtsCarrierApiTestCases");
+DEFINE_string(unsolicited_windows, "+CSQ=1000,+CREG=200,+CGREG=200",
+              "A comma separated list of indication=milliseconds. State "
+              "indications of each type are sent at most once per window, and "
+              "only when they change.");
 
 std::vector<cuttlefish::SharedFD> ServerFdsFromCmdline() {
   // Validate the parameter
@@ -55,6 +63,25 @@ std::vector<cuttlefish::SharedFD> ServerFdsFromCmdline() {
   return shared_fds;
 }
 
+std::map<std::string, std::chrono::milliseconds> UnsolicitedWindowsFromCmdline() {
+  std::map<std::string, std::chrono::milliseconds> windows;
+  for (const auto& entry :
+       android::base::Split(FLAGS_unsolicited_windows, ",")) {
+    if (entry.empty()) {
+      continue;
+    }
+    auto parts = android::base::Split(entry, "=");
+    int window_ms = 0;
+    if (parts.size() != 2 || parts[0].empty() ||
+        !android::base::ParseInt(parts[1], &window_ms, 0)) {
+      LOG(ERROR) << "Invalid unsolicited indication window: " << entry;
+      std::exit(1);
+    }
+    windows[parts[0]] = std::chrono::milliseconds(window_ms);
+  }
+  return windows;
+}
+
 int main(int argc, char** argv) {
   ::android::base::InitLogging(argv, android::base::StderrLogger);
   google::ParseCommandLineFlags(&argc, &argv, false);
@@ -88,8 +115,7 @@ int main(int argc, char** argv) {
     LOG(ERROR) << "Failed to set SIGPIPE to be ignored: " << strerror(errno);
   }
 
-  auto nvram_config = cuttlefish::NvramConfig::Get();
-  auto nvram_config_file = nvram_config->ConfigFileLocation();
+  auto unsolicited_windows = UnsolicitedWindowsFromCmdline();
 
   // Start channel monitor, wait for RIL to connect
   int32_t modem_id = 0;
@@ -104,6 +130,7 @@ int main(int argc, char** argv) {
         std::make_unique<cuttlefish::ChannelMonitor>(modem_simulator.get(), fd);
 
     modem_simulator->Initialize(std::move(channel_monitor));
+    modem_simulator->SetUnsolicitedWindows(unsolicited_windows);
 
     modem_simulators.push_back(modem_simulator);
 
@@ -124,40 +151,39 @@ int main(int argc, char** argv) {
     std::exit(cuttlefish::kServerError);
   }
 
-  // Server loop
-  while (true) {
-    cuttlefish::SharedFDSet read_set;
-    read_set.Set(monitor_socket);
-    int num_fds = cuttlefish::Select(&read_set, nullptr, nullptr, nullptr);
-    if (num_fds <= 0) {  // Ignore select error
-      LOG(ERROR) << "Select call returned error : " << strerror(errno);
-    } else if (read_set.IsSet(monitor_socket)) {
-      auto conn = cuttlefish::SharedFD::Accept(*monitor_socket);
-      std::string buf(4, ' ');
-      auto read = cuttlefish::ReadExact(conn, &buf);
-      if (read <= 0) {
-        conn->Close();
-        LOG(WARNING) << "Detected close from the other side";
-        continue;
+  auto reactor = cuttlefish::Reactor::Create();
+  CHECK(reactor.ok()) << "Failed to create the event loop: " << reactor.error();
+  auto added = (*reactor)->Add(monitor_socket, EPOLLIN, [&](uint32_t) {
+    auto conn = cuttlefish::SharedFD::Accept(*monitor_socket);
+    std::string buf(4, ' ');
+    auto read = cuttlefish::ReadExact(conn, &buf);
+    if (read <= 0) {
+      conn->Close();
+      LOG(WARNING) << "Detected close from the other side";
+      return;
+    }
+    if (buf == "STOP") {  // Exit request from parent process
+      LOG(INFO) << "Exit request from parent process";
+      cuttlefish::NvramConfig::Flush();
+      for (auto modem : modem_simulators) {
+        modem->SaveModemState();
       }
-      if (buf == "STOP") {  // Exit request from parent process
-        LOG(INFO) << "Exit request from parent process";
-        nvram_config->SaveToFile(nvram_config_file);
-        for (auto modem : modem_simulators) {
-          modem->SaveModemState();
-        }
-        cuttlefish::WriteAll(conn, "OK"); // Ignore the return value. Exit anyway.
-        std::exit(cuttlefish::kSuccess);
-      } else if (buf.compare(0, 3, "REM") == 0) {  // REMO for modem id 0 ...
-        // Remote request from other cuttlefish instance
-        int id = std::stoi(buf.substr(3, 1));
-        if (id >= modem_simulators.size()) {
-          LOG(ERROR) << "Not supported modem simulator count: " << id;
-        } else {
-          modem_simulators[id]->SetRemoteClient(conn, true);
-        }
+      cuttlefish::WriteAll(conn, "OK"); // Ignore the return value. Exit anyway.
+      std::exit(cuttlefish::kSuccess);
+    } else if (buf.compare(0, 3, "REM") == 0) {  // REMO for modem id 0 ...
+      // Remote request from other cuttlefish instance
+      int id = std::stoi(buf.substr(3, 1));
+      if (id >= modem_simulators.size()) {
+        LOG(ERROR) << "Not supported modem simulator count: " << id;
+      } else {
+        modem_simulators[id]->SetRemoteClient(conn, true);
       }
     }
-  }
+  });
+  CHECK(added.ok()) << "Failed to watch the monitor socket: " << added.error();
+
+  // Server loop
+  auto ran = (*reactor)->Run();
+  CHECK(ran.ok()) << "Modem simulator event loop failed: " << ran.error();
   // Until kill or exit
 }
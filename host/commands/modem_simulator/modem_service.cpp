@@ -17,6 +17,7 @@
 
 #include <android-base/logging.h>
 
+#include <algorithm>
 #include <cstring>
 
 #include "host/commands/modem_simulator/device_config.h"
@@ -58,14 +59,15 @@ CommandHandler::CommandHandler(const std::string& command, p_func handler)
       match_mode(PARTIAL_MATCH),
       p_command_handler(handler) {}
 
-int CommandHandler::Compare(const std::string& command) const {
-  int result = -1;
+int CommandHandler::Compare(std::string_view command) const {
+  if (command.size() < 2) {
+    return -1;
+  }
+  command.remove_prefix(2);  // skip "AT"
   if (match_mode == PARTIAL_MATCH) {
-    result = command.compare(2, command_prefix.size(), command_prefix);  // skip "AT"
-  } else {
-    result = command.compare(2, command.size(), command_prefix);
+    return command.substr(0, command_prefix.size()).compare(command_prefix);
   }
-  return result;
+  return command.compare(command_prefix);
 }
 
 void CommandHandler::HandleCommand(const Client& client,
@@ -79,6 +81,45 @@ void CommandHandler::HandleCommand(const Client& client,
   }
 }
 
+void CommandTable::Add(const CommandHandler& handler) {
+  // The handler's prefix outlives the table, so its key can be a view of it
+  std::string_view key = handler.prefix();
+  key = key.substr(0, kMaxKeySize);
+  if (std::find(key_sizes_.begin(), key_sizes_.end(), key.size()) ==
+      key_sizes_.end()) {
+    key_sizes_.push_back(key.size());
+  }
+  buckets_[key].push_back(Entry{size_++, &handler});
+}
+
+const CommandHandler* CommandTable::Find(std::string_view command) const {
+  if (command.size() < 2) {
+    return nullptr;
+  }
+  auto name = command.substr(2);  // skip "AT"
+  const Entry* best = nullptr;
+  for (auto key_size : key_sizes_) {
+    if (name.size() < key_size) {
+      continue;
+    }
+    auto bucket = buckets_.find(name.substr(0, key_size));
+    if (bucket == buckets_.end()) {
+      continue;
+    }
+    // Buckets are in order, only their first match can win
+    for (auto& entry : bucket->second) {
+      if (best && best->order < entry.order) {
+        break;
+      }
+      if (entry.handler->Compare(command) == 0) {
+        best = &entry;
+        break;
+      }
+    }
+  }
+  return best ? best->handler : nullptr;
+}
+
 ModemService::ModemService(int32_t service_id,
                            std::vector<CommandHandler> command_handlers,
                            ChannelMonitor* channel_monitor,
@@ -86,7 +127,10 @@ ModemService::ModemService(int32_t service_id,
     : service_id_(service_id),
       command_handlers_(command_handlers),
       thread_looper_(thread_looper),
-      channel_monitor_(channel_monitor) {}
+      channel_monitor_(channel_monitor),
+      unsolicited_coalescer_(thread_looper, [this](const std::string& command) {
+        SendUnsolicitedCommand(command);
+      }) {}
 
 bool ModemService::HandleModemCommand(const Client& client,
                                       std::string command) {
@@ -112,6 +156,26 @@ void ModemService::SendUnsolicitedCommand(std::string unsol_command) {
   }
 }
 
+void ModemService::SendUnsolicitedCommand(
+    const std::vector<std::string>& unsol_commands) {
+  if (channel_monitor_) {
+    channel_monitor_->SendUnsolicitedCommand(unsol_commands);
+  }
+}
+
+void ModemService::SendStateIndication(const std::string& unsol_command) {
+  unsolicited_coalescer_.Send(unsol_command);
+}
+
+void ModemService::SetUnsolicitedWindow(const std::string& type,
+                                        std::chrono::milliseconds window) {
+  unsolicited_coalescer_.SetWindow(type, window);
+}
+
+void ModemService::ResetUnsolicitedState() {
+  unsolicited_coalescer_.Reset();
+}
+
 cuttlefish::SharedFD ModemService::ConnectToRemoteCvd(std::string port) {
   std::string remote_sock_name = "modem_simulator" + port;
   auto remote_sock = cuttlefish::SharedFD::SocketLocalClient(
@@ -16,13 +16,18 @@
 #pragma once
 
 
+#include <chrono>
 #include <functional>
 #include <map>
 #include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include "host/commands/modem_simulator/channel_monitor.h"
 #include "host/commands/modem_simulator/command_parser.h"
 #include "host/commands/modem_simulator/thread_looper.h"
+#include "host/commands/modem_simulator/unsolicited_coalescer.h"
 
 namespace cuttlefish {
 
@@ -47,9 +52,11 @@ class CommandHandler {
 
   ~CommandHandler() = default;
 
-  int Compare(const std::string& command) const;
+  int Compare(std::string_view command) const;
   void HandleCommand(const Client& client, std::string& command) const;
 
+  const std::string& prefix() const { return command_prefix; }
+
  private:
   enum MatchMode {FULL_MATCH = 0, PARTIAL_MATCH = 1};
 
@@ -60,6 +67,33 @@ class CommandHandler {
   std::optional<p_func> p_command_handler;
 };
 
+/**
+ * Finds the handler of an AT command without comparing it against every
+ * registered prefix. The handlers are bucketed by the first characters of
+ * their prefixes, the lookups don't allocate.
+ *
+ * Handlers must be added in order of precedence, when several match a
+ * command the first one added wins, like with a linear search.
+ */
+class CommandTable {
+ public:
+  void Add(const CommandHandler& handler);
+  const CommandHandler* Find(std::string_view command) const;
+
+ private:
+  static constexpr size_t kMaxKeySize = 4;
+
+  struct Entry {
+    size_t order;
+    const CommandHandler* handler;
+  };
+
+  // The distinct key sizes in use, shorter keys belong to shorter prefixes
+  std::vector<size_t> key_sizes_;
+  std::unordered_map<std::string_view, std::vector<Entry>> buckets_;
+  size_t size_ = 0;
+};
+
 class ModemService {
  public:
 
@@ -70,6 +104,15 @@ class ModemService {
 
   bool HandleModemCommand(const Client& client, std::string command);
 
+  const std::vector<CommandHandler>& command_handlers() const {
+    return command_handlers_;
+  }
+
+  void SetUnsolicitedWindow(const std::string& type,
+                            std::chrono::milliseconds window);
+  // The RIL reconnected and has to be told every state again
+  void ResetUnsolicitedState();
+
   static const std::string kCmeErrorOperationNotAllowed;
   static const std::string kCmeErrorOperationNotSupported;
   static const std::string kCmeErrorSimNotInserted;
@@ -99,6 +142,9 @@ class ModemService {
                ChannelMonitor* channel_monitor, ThreadLooper* thread_looper);
   void HandleCommandDefaultSupported(const Client& client);
   void SendUnsolicitedCommand(std::string unsol_command);
+  void SendUnsolicitedCommand(const std::vector<std::string>& unsol_commands);
+  // For indications reporting a state, see UnsolicitedCoalescer
+  void SendStateIndication(const std::string& unsol_command);
 
   cuttlefish::SharedFD ConnectToRemoteCvd(std::string port);
   void SendCommandToRemote(cuttlefish::SharedFD remote_client,
@@ -110,6 +156,7 @@ class ModemService {
   const std::vector<CommandHandler> command_handlers_;
   ThreadLooper* thread_looper_;
   ChannelMonitor* channel_monitor_;
+  UnsolicitedCoalescer unsolicited_coalescer_;
 };
 
 }  // namespace cuttlefish
@@ -92,6 +92,13 @@ void ModemSimulator::RegisterModemService() {
   modem_services_[kSupService] = std::move(supservice);
   modem_services_[kStkService] = std::move(stkservice);
   modem_services_[kMiscService] = std::move(miscservice);
+
+  // Same precedence as asking the services in turn
+  for (auto& service : modem_services_) {
+    for (auto& handler : service.second->command_handlers()) {
+      command_table_.Add(handler);
+    }
+  }
 }
 
 void ModemSimulator::DispatchCommand(const Client& client, std::string& command) {
@@ -105,21 +112,20 @@ void ModemSimulator::DispatchCommand(const Client& client, std::string& command)
     }
   }
 
-  bool success = false;
-  for (auto& service : modem_services_) {
-    success = service.second->HandleModemCommand(client, command);
-    if (success) {
-      break;
-    }
-  }
-
-  if (!success && client.type != Client::REMOTE) {
+  auto handler = command_table_.Find(command);
+  if (handler) {
+    handler->HandleCommand(client, command);
+  } else if (client.type != Client::REMOTE) {
     LOG(DEBUG) << "Not supported AT command: " << command;
     client.SendCommandResponse(ModemService::kCmeErrorOperationNotSupported);
   }
 }
 
 void ModemSimulator::OnFirstClientConnected() {
+  for (auto& [type, service] : modem_services_) {
+    service->ResetUnsolicitedState();
+  }
+
   if (misc_service_) {
     misc_service_->TimeUpdate();
   }
@@ -130,6 +136,15 @@ void ModemSimulator::OnFirstClientConnected() {
   }
 }
 
+void ModemSimulator::SetUnsolicitedWindows(
+    const std::map<std::string, std::chrono::milliseconds>& windows) {
+  for (auto& [service_type, service] : modem_services_) {
+    for (const auto& [type, window] : windows) {
+      service->SetUnsolicitedWindow(type, window);
+    }
+  }
+}
+
 void ModemSimulator::SaveModemState() {
   if (sim_service_) {
     sim_service_->SavePinStateToIccProfile();
@@ -47,6 +47,9 @@ class ModemSimulator {
   }
 
   void SetTimeZone(std::string timezone);
+  // Rate limits of the state indications, by type
+  void SetUnsolicitedWindows(
+      const std::map<std::string, std::chrono::milliseconds>& windows);
 
  private:
   int32_t modem_id_;
@@ -59,6 +62,7 @@ class ModemSimulator {
   NetworkService* network_service_{nullptr};
 
   std::map<ModemServiceType, std::unique_ptr<ModemService>> modem_services_;
+  CommandTable command_table_;
 
   static void LoadNvramConfig();
 
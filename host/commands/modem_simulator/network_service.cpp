@@ -1072,7 +1072,7 @@ void NetworkService::OnVoiceRegisterStateChanged() {
     default :
       return;
   }
-  SendUnsolicitedCommand(ss.str());
+  SendStateIndication(ss.str());
 }
 
 void NetworkService::OnDataRegisterStateChanged() {
@@ -1110,7 +1110,7 @@ void NetworkService::OnDataRegisterStateChanged() {
     default:
       return;
   }
-  SendUnsolicitedCommand(ss.str());
+  SendStateIndication(ss.str());
 }
 
 int NetworkService::GetValueInRange(const std::pair<int, int>& range,
@@ -1247,7 +1247,7 @@ void NetworkService::HandleReceiveRemoteSignal(const Client& client,
 }
 
 void NetworkService::OnSignalStrengthChanged() {
-  SendUnsolicitedCommand(BuildCSQCommandResponse(GetCurrentSignalStrength()));
+  SendStateIndication(BuildCSQCommandResponse(GetCurrentSignalStrength()));
 }
 
 NetworkService::RegistrationState NetworkService::GetVoiceRegistrationState() const {
@@ -18,9 +18,15 @@
 #include <android-base/logging.h>
 #include <json/json.h>
 
+#include <stdio.h>
+
+#include <chrono>
+#include <condition_variable>
 #include <fstream>
 #include <mutex>
+#include <optional>
 #include <sstream>
+#include <thread>
 
 #include "common/libs/utils/files.h"
 #include "host/commands/modem_simulator/device_config.h"
@@ -41,6 +47,112 @@ const int   kDefaultModemTechnoloy        = 0x10;  // LTE
 const int   kDefaultPreferredNetworkMode  = 0x13;  // LTE | WCDMA | GSM
 const bool  kDefaultEmergencyMode         = false;
 
+// How long changes wait before being written, so a burst of them (e.g.
+// toggling the radio power repeatedly) is written once
+constexpr auto kWriteBehindDelay = std::chrono::milliseconds(500);
+
+/**
+ * Writes the config file from a background thread, so the AT command that
+ * changed a value doesn't wait for the disk.
+ *
+ * The file is replaced atomically by renaming a complete temporary file over
+ * it, so a crash leaves either the previous or the new values, never a
+ * truncated file.
+ */
+class NvramConfig::WriteBehind {
+ public:
+  WriteBehind(std::string path)
+      : path_(std::move(path)), thread_([this]() { Run(); }) {}
+
+  // Writes what's still pending before returning
+  ~WriteBehind() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+  }
+
+  void Schedule(std::string contents) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_ = std::move(contents);
+    generation_++;
+    cv_.notify_one();
+  }
+
+  void Flush(const std::string& contents) {
+    uint64_t generation;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_.reset();
+      generation = ++generation_;
+    }
+    Write(contents, generation);
+  }
+
+ private:
+  void Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_ || pending_) {
+      if (!pending_) {
+        cv_.wait(lock);
+        continue;
+      }
+      if (!stopping_) {
+        cv_.wait_for(lock, kWriteBehindDelay, [this]() { return stopping_; });
+      }
+      if (!pending_) {  // Flushed meanwhile
+        continue;
+      }
+      auto contents = std::move(*pending_);
+      pending_.reset();
+      auto generation = generation_;
+      lock.unlock();
+      Write(contents, generation);
+      lock.lock();
+    }
+  }
+
+  // Older contents are dropped if newer ones were written first
+  void Write(const std::string& contents, uint64_t generation) {
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    if (generation <= written_generation_) {
+      return;
+    }
+    auto tmp_path = path_ + ".tmp";
+    {
+      std::ofstream ofs =
+          modem::DeviceConfig::open_ofstream_crossplat(tmp_path.c_str());
+      if (!ofs.is_open()) {
+        LOG(ERROR) << "Unable to write to file " << tmp_path;
+        return;
+      }
+      ofs << contents;
+      ofs.close();
+      if (ofs.fail()) {
+        LOG(ERROR) << "Failed to write " << tmp_path;
+        return;
+      }
+    }
+    if (rename(tmp_path.c_str(), path_.c_str()) != 0) {
+      LOG(ERROR) << "Unable to replace " << path_ << ": " << strerror(errno);
+      return;
+    }
+    written_generation_ = generation;
+  }
+
+  std::string path_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::optional<std::string> pending_;
+  uint64_t generation_ = 0;
+  bool stopping_ = false;
+  std::mutex write_mutex_;
+  uint64_t written_generation_ = 0;
+  std::thread thread_;
+};
+
 /**
  * Creates the (initially empty) config object and populates it with values from
  * the config file "modem_nvram.json" located in the cuttlefish instance path,
@@ -83,14 +195,19 @@ void NvramConfig::InitNvramConfigService(size_t num_instances, int sim_type) {
 
 void NvramConfig::SaveToFile() {
   auto nvram_config = Get();
-  auto nvram_config_file = nvram_config->ConfigFileLocation();
-  nvram_config->SaveToFile(nvram_config_file);
+  nvram_config->write_behind_->Schedule(nvram_config->Serialize());
+}
+
+void NvramConfig::Flush() {
+  auto nvram_config = Get();
+  nvram_config->write_behind_->Flush(nvram_config->Serialize());
 }
 
 NvramConfig::NvramConfig(size_t num_instances, int sim_type)
     : total_instances_(num_instances),
       sim_type_(sim_type),
-      dictionary_(new Json::Value()) {}
+      dictionary_(new Json::Value()),
+      write_behind_(new WriteBehind(ConfigFileLocation())) {}
 // Can't use '= default' on the header because the compiler complains of
 // Json::Value being an incomplete type
 NvramConfig::~NvramConfig() = default;
@@ -125,6 +242,12 @@ bool NvramConfig::LoadFromFile(const char* file) {
   return true;
 }
 
+std::string NvramConfig::Serialize() const {
+  std::stringstream ss;
+  ss << *dictionary_;
+  return ss.str();
+}
+
 bool NvramConfig::SaveToFile(const std::string& file) const {
   std::ofstream ofs = modem::DeviceConfig::open_ofstream_crossplat(file.c_str());
   if (!ofs.is_open()) {
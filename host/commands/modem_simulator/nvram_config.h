@@ -17,6 +17,10 @@
 
 #include <json/json.h>
 
+#include <memory>
+#include <string>
+#include <vector>
+
 namespace cuttlefish {
 
 // Holds the configuration of modem simulator.
@@ -25,7 +29,11 @@ class NvramConfig {
  public:
   static void InitNvramConfigService(size_t num_instances, int sim_type);
   static const NvramConfig* Get();
+  // Schedules a save of the current values. Changes made in quick succession
+  // are coalesced and written from a background thread.
   static void SaveToFile();
+  // Saves the current values before returning, e.g. before exiting
+  static void Flush();
 
   NvramConfig(size_t num_instances, int sim_type);
   NvramConfig(NvramConfig&&);
@@ -77,10 +85,15 @@ class NvramConfig {
   };
 
  private:
+  class WriteBehind;
+
   static std::unique_ptr<NvramConfig> s_nvram_config;
   size_t total_instances_;
   int sim_type_;
   std::unique_ptr<Json::Value> dictionary_;
+  std::unique_ptr<WriteBehind> write_behind_;
+
+  std::string Serialize() const;
 
   bool LoadFromFile(const char* file);
   static NvramConfig* BuildConfigImpl(size_t num_instances, int sim_type);
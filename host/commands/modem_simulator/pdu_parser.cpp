@@ -19,6 +19,7 @@
 #include <chrono>
 #include <ctime>
 #include <iomanip>
+#include <mutex>
 #include <sstream>
 #include <string>
 #include <thread>
@@ -275,8 +276,19 @@ std::string PDUParser::BCDToString(std::string& data) {
 }
 
 std::string PDUParser::GetCurrentTimeStamp() {
-  std::string time_stamp;
+  // The time stamp only has second resolution, so it is computed once per
+  // second instead of for every PDU.
+  static std::mutex cache_mutex;
+  static std::time_t cached_time = -1;
+  static std::string cached_time_stamp;
+
   auto now = std::time(0);
+  std::lock_guard<std::mutex> autolock(cache_mutex);
+  if (now == cached_time) {
+    return cached_time_stamp;
+  }
+
+  std::string time_stamp;
 
   auto local_time = *std::localtime(&now);
   auto gm_time = *std::gmtime(&now);
@@ -294,6 +306,8 @@ std::string PDUParser::GetCurrentTimeStamp() {
   time_stamp += IntToHexString(local_time.tm_sec);
   time_stamp += IntToHexStringTimeZoneDiff(tzdiff);
 
+  cached_time = now;
+  cached_time_stamp = time_stamp;
   return time_stamp;
 }
 
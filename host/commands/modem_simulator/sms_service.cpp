@@ -381,8 +381,8 @@ void SmsService::HandleReceiveRemoteSMS(const Client& /*client*/, std::string& c
   }
   pdu = sms_pdu.CreatePDU();
   if (pdu != "") {
-    SendUnsolicitedCommand("+CMT: 0");
-    SendUnsolicitedCommand(pdu);
+    // Keeps the indication and its PDU together when SMS arrive in bursts
+    SendUnsolicitedCommand(std::vector<std::string>{"+CMT: 0", pdu});
   }
 }
 }  // namespace cuttlefish
@@ -17,11 +17,163 @@
 
 #include <android-base/logging.h>
 
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+
 namespace cuttlefish {
 
+// Enough to keep a callback that blocks from stalling the other modems
+static constexpr size_t kMaxPoolThreads = 4;
+
+/**
+ * The threads shared by all the loopers of the process. Each looper has at
+ * most one entry here: in the timers while its next event isn't due, in the
+ * ready queue once it is, or none while it's idle or running. That keeps the
+ * events of a looper serialized without a thread per looper.
+ */
+class LooperPool {
+ public:
+  static LooperPool& Get() {
+    // Never destroyed, the threads may outlive the static destructors
+    static auto pool = new LooperPool();
+    return *pool;
+  }
+
+  // Starts a thread for every looper until the pool reaches its size
+  void Register() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    loopers_++;
+    if (threads_ < std::min(loopers_, kMaxPoolThreads)) {
+      threads_++;
+      std::thread([this]() { Run(); }).detach();
+    }
+  }
+
+  // Called after the events of a looper change
+  void Wake(ThreadLooper* looper) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (looper->removed_) {
+      return;
+    }
+    switch (looper->pool_state_) {
+      case ThreadLooper::PoolState::kRunning:
+        // Rescheduled when the callbacks return
+      case ThreadLooper::PoolState::kReady:
+        return;
+      case ThreadLooper::PoolState::kWaiting:
+        EraseTimer(looper);
+        [[fallthrough]];
+      case ThreadLooper::PoolState::kIdle:
+        Schedule(looper, looper->NextEventTime());
+    }
+  }
+
+  // Returns once no callback of the looper is running
+  void Remove(ThreadLooper* looper) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    CHECK(looper->running_thread_ != std::this_thread::get_id())
+        << "Destructor called from looper thread";
+    looper->removed_ = true;
+    switch (looper->pool_state_) {
+      case ThreadLooper::PoolState::kWaiting:
+        EraseTimer(looper);
+        break;
+      case ThreadLooper::PoolState::kReady:
+        ready_.erase(std::find(ready_.begin(), ready_.end(), looper));
+        break;
+      case ThreadLooper::PoolState::kRunning:
+        done_cond_.wait(lock, [looper]() {
+          return looper->pool_state_ != ThreadLooper::PoolState::kRunning;
+        });
+        break;
+      case ThreadLooper::PoolState::kIdle:
+        break;
+    }
+    looper->pool_state_ = ThreadLooper::PoolState::kIdle;
+    loopers_--;
+  }
+
+ private:
+  LooperPool() = default;
+
+  void Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      auto now = std::chrono::steady_clock::now();
+      while (!timers_.empty() && timers_.begin()->first <= now) {
+        auto looper = timers_.begin()->second;
+        timers_.erase(timers_.begin());
+        looper->pool_state_ = ThreadLooper::PoolState::kReady;
+        ready_.push_back(looper);
+      }
+      if (ready_.empty()) {
+        if (timers_.empty()) {
+          cond_.wait(lock);
+        } else {
+          cond_.wait_until(lock, timers_.begin()->first);
+        }
+        continue;
+      }
+      auto looper = ready_.front();
+      ready_.pop_front();
+      looper->pool_state_ = ThreadLooper::PoolState::kRunning;
+      looper->running_thread_ = std::this_thread::get_id();
+      lock.unlock();
+      looper->RunDueEvents();
+      lock.lock();
+      looper->running_thread_ = {};
+      // Events posted while running are included, Wake() ignored them
+      if (looper->removed_) {
+        looper->pool_state_ = ThreadLooper::PoolState::kIdle;
+      } else {
+        Schedule(looper, looper->NextEventTime());
+      }
+      done_cond_.notify_all();
+    }
+  }
+
+  void Schedule(ThreadLooper* looper,
+                std::optional<std::chrono::steady_clock::time_point> when) {
+    if (!when) {
+      looper->pool_state_ = ThreadLooper::PoolState::kIdle;
+    } else if (*when <= std::chrono::steady_clock::now()) {
+      looper->pool_state_ = ThreadLooper::PoolState::kReady;
+      ready_.push_back(looper);
+      cond_.notify_one();
+    } else {
+      looper->pool_state_ = ThreadLooper::PoolState::kWaiting;
+      looper->wakeup_time_ = *when;
+      auto iter = timers_.emplace(*when, looper);
+      if (iter == timers_.begin()) {
+        // The waiting threads sleep until the previous earliest timer
+        cond_.notify_one();
+      }
+    }
+  }
+
+  void EraseTimer(ThreadLooper* looper) {
+    auto range = timers_.equal_range(looper->wakeup_time_);
+    for (auto iter = range.first; iter != range.second; ++iter) {
+      if (iter->second == looper) {
+        timers_.erase(iter);
+        return;
+      }
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::condition_variable done_cond_;
+  std::deque<ThreadLooper*> ready_;
+  std::multimap<std::chrono::steady_clock::time_point, ThreadLooper*> timers_;
+  size_t loopers_ = 0;
+  size_t threads_ = 0;
+};
+
 ThreadLooper::ThreadLooper()
   :   stopped_(false), next_serial_(1) {
-  looper_thread_ = std::thread([this]() { ThreadLoop(); });
+  LooperPool::Get().Register();
 }
 
 ThreadLooper::~ThreadLooper() { Stop(); }
@@ -53,56 +205,56 @@ ThreadLooper::Serial ThreadLooper::Post(
 }
 
 bool ThreadLooper::CancelSerial(Serial serial) {
-  std::lock_guard<std::mutex> autolock(lock_);
-
   bool found = false;
-  for (auto iter = queue_.begin(); iter != queue_.end(); ++iter) {
-    if (iter->serial == serial) {
-      queue_.erase(iter);
-      cond_.notify_all();
-
-      found = true;
-      break;
+  {
+    std::lock_guard<std::mutex> autolock(lock_);
+    for (auto iter = queue_.begin(); iter != queue_.end(); ++iter) {
+      if (iter->serial == serial) {
+        queue_.erase(iter);
+        found = true;
+        break;
+      }
     }
   }
+  if (found) {
+    LooperPool::Get().Wake(this);
+  }
 
   return found;
 }
 
 void ThreadLooper::Insert(const Event &event) {
-  std::lock_guard<std::mutex> autolock(lock_);
+  {
+    std::lock_guard<std::mutex> autolock(lock_);
 
-  auto iter = queue_.begin();
-  while (iter != queue_.end() && *iter <= event) {
-    ++iter;
+    auto iter = queue_.begin();
+    while (iter != queue_.end() && *iter <= event) {
+      ++iter;
+    }
+
+    queue_.insert(iter, event);
   }
+  // Not holding lock_, the pool locks it after its own lock
+  LooperPool::Get().Wake(this);
+}
 
-  queue_.insert(iter, event);
-  cond_.notify_all();
+std::optional<std::chrono::steady_clock::time_point>
+ThreadLooper::NextEventTime() {
+  std::lock_guard<std::mutex> autolock(lock_);
+  if (stopped_ || queue_.empty()) {
+    return {};
+  }
+  return queue_.front().when;
 }
 
-void ThreadLooper::ThreadLoop() {
+void ThreadLooper::RunDueEvents() {
   for(;;) {
     Callback cb;
     {
-      std::unique_lock<std::mutex> lock(lock_);
-
-      if (stopped_) {
-        break;
-      }
-
-      if (queue_.empty()) {
-        cond_.wait(lock);
-        continue;
-      }
-
-      auto time_to_wait = queue_.front().when - std::chrono::steady_clock::now();
-      if (time_to_wait.count() > 0) {
-        // wait with timeout
-        auto durationMs =
-            std::chrono::duration_cast<std::chrono::milliseconds>(time_to_wait);
-        cond_.wait_for(lock, durationMs);
-        continue;
+      std::lock_guard<std::mutex> autolock(lock_);
+      if (stopped_ || queue_.empty() ||
+          queue_.front().when > std::chrono::steady_clock::now()) {
+        return;
       }
       cb = queue_.front().cb; // callback at front of queue
       queue_.pop_front();
@@ -112,19 +264,14 @@ void ThreadLooper::ThreadLoop() {
 }
 
 void ThreadLooper::Stop() {
-  if (stopped_) {
-    return;
-  }
-  CHECK(looper_thread_.get_id() != std::this_thread::get_id())
-      << "Destructor called from looper thread";
   {
     std::lock_guard<std::mutex> autolock(lock_);
+    if (stopped_) {
+      return;
+    }
     stopped_ = true;
   }
-  cond_.notify_all();
-  if (looper_thread_.joinable()) {
-    looper_thread_.join();
-  }
+  LooperPool::Get().Remove(this);
 }
 
 }  // namespace cuttlefish
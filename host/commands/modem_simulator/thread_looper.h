@@ -17,10 +17,10 @@
 
 #include <atomic>
 #include <chrono>
-#include <condition_variable>
 #include <deque>
 #include <functional>
 #include <mutex>
+#include <optional>
 #include <thread>
 
 namespace cuttlefish {
@@ -48,6 +48,11 @@ std::function<void()> makeSafeCallback(
                              [f, params...](T *me) { (me->*f)(params...); });
 }
 
+/**
+ * Runs callbacks in order of their due time, one at a time. The loopers of
+ * all the modems share a small pool of threads, a looper without due events
+ * doesn't occupy any of them.
+ */
 class ThreadLooper {
  public:
   ThreadLooper();
@@ -68,6 +73,8 @@ class ThreadLooper {
   bool CancelSerial(Serial serial);
 
  private:
+  friend class LooperPool;
+
   struct Event {
       std::chrono::steady_clock::time_point when;
       Callback cb;
@@ -77,14 +84,20 @@ class ThreadLooper {
   };
 
   bool stopped_;
-  std::thread looper_thread_;
 
   std::mutex lock_;
-  std::condition_variable cond_;
   std::deque<Event> queue_;
   std::atomic<Serial> next_serial_;
 
-  void ThreadLoop();
+  // Scheduling state on the pool, guarded by the pool's lock
+  enum class PoolState { kIdle, kWaiting, kReady, kRunning };
+  PoolState pool_state_ = PoolState::kIdle;
+  bool removed_ = false;
+  std::chrono::steady_clock::time_point wakeup_time_;
+  std::thread::id running_thread_;
+
+  void RunDueEvents();
+  std::optional<std::chrono::steady_clock::time_point> NextEventTime();
 
   void Insert(const Event &event);
 };
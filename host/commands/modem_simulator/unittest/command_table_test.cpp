@@ -0,0 +1,75 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/commands/modem_simulator/modem_service.h"
+
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+namespace {
+
+void FullMatch(const Client&) {}
+void PartialMatch(const Client&, std::string&) {}
+
+}  // namespace
+
+class CommandTableTest : public ::testing::Test {
+ protected:
+  CommandTableTest()
+      : handlers_({
+            CommandHandler("+COPS?", FullMatch),
+            CommandHandler("+COPS=?", FullMatch),
+            CommandHandler("+COPS=", PartialMatch),
+            CommandHandler("+CSQ", FullMatch),
+            CommandHandler("D*99***1#", FullMatch),
+            CommandHandler("D", PartialMatch),
+            CommandHandler("+CMGS", PartialMatch),
+            CommandHandler("+CMGS=1", PartialMatch),
+        }) {
+    for (auto& handler : handlers_) {
+      table_.Add(handler);
+    }
+  }
+
+  // The handler the services would pick by comparing every prefix in turn
+  const CommandHandler* LinearFind(const std::string& command) {
+    for (auto& handler : handlers_) {
+      if (handler.Compare(command) == 0) {
+        return &handler;
+      }
+    }
+    return nullptr;
+  }
+
+  std::vector<CommandHandler> handlers_;
+  CommandTable table_;
+};
+
+TEST_F(CommandTableTest, MatchesLinearSearch) {
+  for (std::string command :
+       {"AT+COPS?", "AT+COPS=?", "AT+COPS=0", "AT+COPS", "AT+CSQ", "AT+CSQ=1",
+        "ATD*99***1#", "ATD12345;", "ATD", "AT+CMGS=12", "AT+CMGS=1",
+        "AT+CREG?", "AT", "A", ""}) {
+    ASSERT_EQ(LinearFind(command), table_.Find(command)) << command;
+  }
+}
+
+TEST_F(CommandTableTest, FirstHandlerWins) {
+  ASSERT_EQ(&handlers_[6], table_.Find("AT+CMGS=1"));
+  ASSERT_EQ(&handlers_[4], table_.Find("ATD*99***1#"));
+  ASSERT_EQ(&handlers_[5], table_.Find("ATD*99***2#"));
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,93 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/commands/modem_simulator/unsolicited_coalescer.h"
+
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+
+class UnsolicitedCoalescerTest : public ::testing::Test {
+ protected:
+  UnsolicitedCoalescerTest()
+      : coalescer_(&looper_, [this](const std::string& indication) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          sent_.push_back(indication);
+        }) {}
+
+  ~UnsolicitedCoalescerTest() override { looper_.Stop(); }
+
+  std::vector<std::string> Sent() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return sent_;
+  }
+
+  ThreadLooper looper_;
+  std::mutex mutex_;
+  std::vector<std::string> sent_;
+  UnsolicitedCoalescer coalescer_;
+};
+
+TEST_F(UnsolicitedCoalescerTest, TypeOf) {
+  ASSERT_EQ("+CSQ", UnsolicitedCoalescer::TypeOf("+CSQ: 1,2,3"));
+  ASSERT_EQ("+CGREG", UnsolicitedCoalescer::TypeOf("+CGREG: 1\r+CEREG: 1"));
+  ASSERT_EQ("RING", UnsolicitedCoalescer::TypeOf("RING"));
+}
+
+TEST_F(UnsolicitedCoalescerTest, DropsUnchangedValues) {
+  coalescer_.Send("+CREG: 1");
+  coalescer_.Send("+CREG: 1");
+  coalescer_.Send("+CSQ: 5");
+  coalescer_.Send("+CREG: 2");
+  coalescer_.Send("+CSQ: 5");
+  ASSERT_EQ(Sent(), (std::vector<std::string>{"+CREG: 1", "+CSQ: 5",
+                                              "+CREG: 2"}));
+}
+
+TEST_F(UnsolicitedCoalescerTest, ResetResendsValues) {
+  coalescer_.Send("+CREG: 1");
+  coalescer_.Reset();
+  coalescer_.Send("+CREG: 1");
+  ASSERT_EQ(Sent(), (std::vector<std::string>{"+CREG: 1", "+CREG: 1"}));
+}
+
+TEST_F(UnsolicitedCoalescerTest, SendsLastValueOfWindow) {
+  coalescer_.SetWindow("+CSQ", std::chrono::milliseconds(50));
+  coalescer_.Send("+CSQ: 1");
+  coalescer_.Send("+CSQ: 2");
+  coalescer_.Send("+CSQ: 3");
+  // Other types aren't held back
+  coalescer_.Send("+CREG: 1");
+  ASSERT_EQ(Sent(), (std::vector<std::string>{"+CSQ: 1", "+CREG: 1"}));
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  ASSERT_EQ(Sent(),
+            (std::vector<std::string>{"+CSQ: 1", "+CREG: 1", "+CSQ: 3"}));
+}
+
+TEST_F(UnsolicitedCoalescerTest, DropsChangeUndoneWithinWindow) {
+  coalescer_.SetWindow("+CSQ", std::chrono::milliseconds(50));
+  coalescer_.Send("+CSQ: 1");
+  coalescer_.Send("+CSQ: 2");
+  coalescer_.Send("+CSQ: 1");
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  ASSERT_EQ(Sent(), (std::vector<std::string>{"+CSQ: 1"}));
+}
+
+}  // namespace cuttlefish
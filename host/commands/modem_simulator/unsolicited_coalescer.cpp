@@ -0,0 +1,90 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/commands/modem_simulator/unsolicited_coalescer.h"
+
+namespace cuttlefish {
+
+UnsolicitedCoalescer::UnsolicitedCoalescer(ThreadLooper* thread_looper,
+                                           Sender sender)
+    : thread_looper_(thread_looper), sender_(std::move(sender)) {}
+
+void UnsolicitedCoalescer::SetWindow(const std::string& type,
+                                     std::chrono::milliseconds window) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  types_[type].window = window;
+}
+
+void UnsolicitedCoalescer::Send(const std::string& indication) {
+  auto type = TypeOf(indication);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& state = types_[type];
+    if (state.pending) {
+      // A flush is already scheduled
+      state.pending = indication;
+      return;
+    }
+    if (state.sent == indication) {
+      return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    auto due = state.sent_time + state.window;
+    if (state.sent && now < due) {
+      state.pending = indication;
+      thread_looper_->Post(
+          makeSafeCallback(this, &UnsolicitedCoalescer::Flush, type),
+          due - now);
+      return;
+    }
+    state.sent = indication;
+    state.sent_time = now;
+  }
+  // Not under the lock, the sender takes the channel's lock
+  sender_(indication);
+}
+
+void UnsolicitedCoalescer::Flush(const std::string& type) {
+  std::string indication;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& state = types_[type];
+    if (!state.pending) {
+      return;
+    }
+    indication = std::move(*state.pending);
+    state.pending.reset();
+    // Changed back to what was last sent within the window
+    if (state.sent == indication) {
+      return;
+    }
+    state.sent = indication;
+    state.sent_time = std::chrono::steady_clock::now();
+  }
+  sender_(indication);
+}
+
+void UnsolicitedCoalescer::Reset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& [type, state] : types_) {
+    state.sent.reset();
+  }
+}
+
+std::string UnsolicitedCoalescer::TypeOf(const std::string& indication) {
+  return indication.substr(0, indication.find(':'));
+}
+
+}  // namespace cuttlefish
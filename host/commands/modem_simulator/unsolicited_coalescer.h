@@ -0,0 +1,72 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+
+#include "host/commands/modem_simulator/thread_looper.h"
+
+namespace cuttlefish {
+
+/**
+ * Sends unsolicited indications that report a state, like signal strength or
+ * registration, rather than an event. An indication is dropped if the RIL
+ * already has the same value, and each type is sent at most once per window:
+ * changes within the window replace each other and only the last one is sent
+ * when it ends. Every indication wakes up rild and the telephony stack in the
+ * guest.
+ *
+ * The type is the part of the indication before the colon, e.g. "+CSQ".
+ */
+class UnsolicitedCoalescer {
+ public:
+  using Sender = std::function<void(const std::string&)>;
+
+  UnsolicitedCoalescer(ThreadLooper* thread_looper, Sender sender);
+
+  UnsolicitedCoalescer(const UnsolicitedCoalescer&) = delete;
+  UnsolicitedCoalescer& operator=(const UnsolicitedCoalescer&) = delete;
+
+  // Types without a window only have unchanged values dropped
+  void SetWindow(const std::string& type, std::chrono::milliseconds window);
+  void Send(const std::string& indication);
+  // For a RIL that doesn't know any value yet, pending ones are still sent
+  void Reset();
+
+  static std::string TypeOf(const std::string& indication);
+
+ private:
+  struct TypeState {
+    std::chrono::milliseconds window{0};
+    std::optional<std::string> sent;
+    std::chrono::steady_clock::time_point sent_time;
+    std::optional<std::string> pending;
+  };
+
+  void Flush(const std::string& type);
+
+  ThreadLooper* thread_looper_;
+  Sender sender_;
+  std::mutex mutex_;
+  std::map<std::string, TypeState> types_;
+};
+
+}  // namespace cuttlefish
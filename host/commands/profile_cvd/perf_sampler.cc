@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/profile_cvd/perf_sampler.h"
+
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+// Per thread, a power of two. At 100Hz and with deep stacks a thread fills
+// about 60KiB a second.
+constexpr std::size_t kRingPages = 32;
+// How often the rings are read and /proc is checked for new threads
+constexpr auto kDrainInterval = std::chrono::milliseconds(50);
+
+class ThreadSampler {
+ public:
+  // Null if the thread exited in the meantime
+  static Result<std::unique_ptr<ThreadSampler>> Create(pid_t tid,
+                                                       perf_event_attr attr) {
+    int fd = syscall(__NR_perf_event_open, &attr, tid, -1 /* cpu */,
+                     -1 /* group_fd */, PERF_FLAG_FD_CLOEXEC);
+    if (fd < 0 && errno == ESRCH) {
+      return std::unique_ptr<ThreadSampler>();
+    }
+    CF_EXPECT(fd >= 0,
+              "perf_event_open failed for thread "
+                  << tid << ": " << strerror(errno)
+                  << (errno == EACCES || errno == EPERM
+                          ? ". Profiling other processes needs "
+                            "/proc/sys/kernel/perf_event_paranoid at 2 or "
+                            "lower."
+                          : ""));
+    const std::size_t page_size = sysconf(_SC_PAGESIZE);
+    const std::size_t size = (1 + kRingPages) * page_size;
+    void* ring = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+      int error = errno;
+      close(fd);
+      return CF_ERR("Failed to map the perf ring of thread "
+                    << tid << ": " << strerror(error));
+    }
+    return std::unique_ptr<ThreadSampler>(
+        new ThreadSampler(fd, ring, size, page_size));
+  }
+
+  ~ThreadSampler() {
+    munmap(ring_, size_);
+    close(fd_);
+  }
+
+  // Reads the records the kernel wrote since the last call
+  void Drain(StackSamples& samples) {
+    auto meta = static_cast<perf_event_mmap_page*>(ring_);
+    const std::uint64_t head =
+        __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+    std::uint64_t tail = meta->data_tail;
+    std::vector<std::uint8_t> record;
+    while (head - tail >= sizeof(perf_event_header)) {
+      perf_event_header header;
+      Copy(tail, &header, sizeof(header));
+      if (header.size < sizeof(header) || head - tail < header.size) {
+        break;
+      }
+      record.resize(header.size);
+      Copy(tail, record.data(), record.size());
+      if (header.type == PERF_RECORD_SAMPLE) {
+        ParseSample(record, samples);
+      } else if (header.type == PERF_RECORD_LOST &&
+                 record.size() >= sizeof(header) + 2 * sizeof(std::uint64_t)) {
+        // Followed by the event id and the number of lost records
+        std::uint64_t lost;
+        std::memcpy(&lost,
+                    record.data() + sizeof(header) + sizeof(std::uint64_t),
+                    sizeof(lost));
+        samples.lost += lost;
+      }
+      tail += header.size;
+    }
+    __atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+  }
+
+ private:
+  ThreadSampler(int fd, void* ring, std::size_t size, std::size_t page_size)
+      : fd_(fd), ring_(ring), size_(size), page_size_(page_size) {}
+
+  // Copies out of the data area, which records may wrap around
+  void Copy(std::uint64_t position, void* dst, std::size_t len) const {
+    const auto data = static_cast<const std::uint8_t*>(ring_) + page_size_;
+    const std::size_t data_size = size_ - page_size_;
+    const std::size_t offset = position % data_size;
+    const std::size_t first = std::min(len, data_size - offset);
+    std::memcpy(dst, data + offset, first);
+    std::memcpy(static_cast<std::uint8_t*>(dst) + first, data, len - first);
+  }
+
+  // With PERF_SAMPLE_TID | PERF_SAMPLE_CALLCHAIN the record is the header,
+  // the pid and tid and the callchain.
+  static void ParseSample(const std::vector<std::uint8_t>& record,
+                          StackSamples& samples) {
+    std::size_t offset = sizeof(perf_event_header) + 2 * sizeof(std::uint32_t);
+    std::uint64_t count = 0;
+    if (record.size() < offset + sizeof(count)) {
+      return;
+    }
+    std::memcpy(&count, record.data() + offset, sizeof(count));
+    offset += sizeof(count);
+    if ((record.size() - offset) / sizeof(std::uint64_t) < count) {
+      return;
+    }
+    std::vector<std::uint64_t> stack;
+    for (std::uint64_t i = 0; i < count; i++) {
+      std::uint64_t ip;
+      std::memcpy(&ip, record.data() + offset + i * sizeof(ip), sizeof(ip));
+      // Markers of where the kernel and user parts of the chain start
+      if (ip < PERF_CONTEXT_MAX) {
+        stack.push_back(ip);
+      }
+    }
+    if (!stack.empty()) {
+      samples.stacks[stack]++;
+    }
+  }
+
+  const int fd_;
+  void* const ring_;
+  const std::size_t size_;
+  const std::size_t page_size_;
+};
+
+perf_event_attr EventAttr(SampledEvent event, std::uint64_t period) {
+  perf_event_attr attr = {};
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_SOFTWARE;
+  attr.config = event == SampledEvent::kTaskClock ? PERF_COUNT_SW_TASK_CLOCK
+                                                  : PERF_COUNT_SW_PAGE_FAULTS;
+  attr.sample_period = period;
+  attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_CALLCHAIN;
+  // Only what the process itself does, which is also all that's allowed at
+  // perf_event_paranoid 2.
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.exclude_callchain_kernel = 1;
+  return attr;
+}
+
+std::vector<pid_t> Threads(pid_t pid) {
+  std::vector<pid_t> threads;
+  for (const auto& entry :
+       DirectoryContents("/proc/" + std::to_string(pid) + "/task")) {
+    pid_t tid;
+    if (android::base::ParseInt(entry, &tid)) {
+      threads.push_back(tid);
+    }
+  }
+  return threads;
+}
+
+}  // namespace
+
+Result<StackSamples> SampleStacks(pid_t pid, SampledEvent event,
+                                  std::uint64_t period,
+                                  std::chrono::milliseconds duration) {
+  CF_EXPECT(period > 0, "The sampling period can't be 0");
+  const auto attr = EventAttr(event, period);
+  std::map<pid_t, std::unique_ptr<ThreadSampler>> samplers;
+  StackSamples samples;
+  const auto end = std::chrono::steady_clock::now() + duration;
+  for (bool first = true;; first = false) {
+    // Threads started while sampling are picked up late, which only matters
+    // for short lived ones.
+    auto threads = Threads(pid);
+    if (first) {
+      CF_EXPECT(!threads.empty(), "Process " << pid << " is not running");
+    }
+    for (auto tid : threads) {
+      if (samplers.count(tid)) {
+        continue;
+      }
+      auto sampler = CF_EXPECT(ThreadSampler::Create(tid, attr));
+      if (sampler) {
+        samplers.emplace(tid, std::move(sampler));
+      }
+    }
+    for (auto& [tid, sampler] : samplers) {
+      sampler->Drain(samples);
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (now >= end) {
+      break;
+    }
+    std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(
+        kDrainInterval, end - now));
+  }
+  samples.threads = samplers.size();
+  if (samples.lost > 0) {
+    LOG(WARNING) << samples.lost << " samples were lost, consider a longer "
+                 << "sampling period";
+  }
+  return samples;
+}
+
+}  // namespace cuttlefish
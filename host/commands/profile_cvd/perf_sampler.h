@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+enum class SampledEvent {
+  // Time spent running on a CPU
+  kTaskClock,
+  // Pages becoming resident, i.e. memory touched for the first time
+  kPageFaults,
+};
+
+struct StackSamples {
+  // User space stacks, leaf first, and how many times each was sampled
+  std::map<std::vector<std::uint64_t>, std::uint64_t> stacks;
+  // Samples the kernel dropped because they weren't read in time
+  std::uint64_t lost = 0;
+  // Threads that were sampled, including the ones that exited
+  std::size_t threads = 0;
+};
+
+// Samples the user space stacks of every thread of `pid` for `duration`
+// with perf events. The kernel walks the stacks through their frame pointers,
+// so code built without them shows truncated stacks.
+//
+// `period` is in nanoseconds of CPU time for kTaskClock and in page faults
+// for kPageFaults.
+Result<StackSamples> SampleStacks(pid_t pid, SampledEvent event,
+                                  std::uint64_t period,
+                                  std::chrono::milliseconds duration);
+
+}  // namespace cuttlefish
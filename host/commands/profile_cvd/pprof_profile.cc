@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/profile_cvd/pprof_profile.h"
+
+#include <zlib.h>
+
+#include <sstream>
+#include <unordered_map>
+
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+// Field numbers of profile.proto
+enum ProfileField {
+  kProfileSampleType = 1,
+  kProfileSample = 2,
+  kProfileMapping = 3,
+  kProfileLocation = 4,
+  kProfileStringTable = 6,
+  kProfileTimeNanos = 9,
+  kProfileDurationNanos = 10,
+  kProfilePeriodType = 11,
+  kProfilePeriod = 12,
+  kProfileComment = 13,
+};
+enum ValueTypeField { kValueTypeType = 1, kValueTypeUnit = 2 };
+enum SampleField { kSampleLocationId = 1, kSampleValue = 2 };
+enum MappingField {
+  kMappingId = 1,
+  kMappingMemoryStart = 2,
+  kMappingMemoryLimit = 3,
+  kMappingFileOffset = 4,
+  kMappingFilename = 5,
+};
+enum LocationField {
+  kLocationId = 1,
+  kLocationMappingId = 2,
+  kLocationAddress = 3,
+};
+
+enum WireType { kVarint = 0, kLengthDelimited = 2 };
+
+// Just enough of the protobuf wire format for profile.proto
+class ProtoWriter {
+ public:
+  void UInt64(int field, std::uint64_t value) {
+    Tag(field, kVarint);
+    Varint(value);
+  }
+  void Int64(int field, std::int64_t value) {
+    UInt64(field, static_cast<std::uint64_t>(value));
+  }
+  void Bytes(int field, const std::string& value) {
+    Tag(field, kLengthDelimited);
+    Varint(value.size());
+    out_ += value;
+  }
+  void Message(int field, const ProtoWriter& message) {
+    Bytes(field, message.out_);
+  }
+  template <typename T>
+  void Packed(int field, const std::vector<T>& values) {
+    ProtoWriter packed;
+    for (auto value : values) {
+      packed.Varint(static_cast<std::uint64_t>(value));
+    }
+    Message(field, packed);
+  }
+
+  const std::string& str() const { return out_; }
+
+ private:
+  void Tag(int field, WireType type) {
+    Varint((static_cast<std::uint64_t>(field) << 3) | type);
+  }
+  void Varint(std::uint64_t value) {
+    do {
+      std::uint8_t byte = value & 0x7f;
+      value >>= 7;
+      out_ += static_cast<char>(value ? byte | 0x80 : byte);
+    } while (value);
+  }
+
+  std::string out_;
+};
+
+class StringTable {
+ public:
+  StringTable() { Index(""); }  // Index 0 is always the empty string
+
+  std::int64_t Index(const std::string& str) {
+    auto [it, inserted] = indices_.emplace(str, strings_.size());
+    if (inserted) {
+      strings_.push_back(str);
+    }
+    return it->second;
+  }
+
+  void WriteTo(ProtoWriter& profile) const {
+    for (const auto& str : strings_) {
+      profile.Bytes(kProfileStringTable, str);
+    }
+  }
+
+ private:
+  std::unordered_map<std::string, std::int64_t> indices_;
+  std::vector<std::string> strings_;
+};
+
+ProtoWriter ValueTypeMessage(const PprofProfile::ValueType& value_type,
+                             StringTable& strings) {
+  ProtoWriter message;
+  message.Int64(kValueTypeType, strings.Index(value_type.first));
+  message.Int64(kValueTypeUnit, strings.Index(value_type.second));
+  return message;
+}
+
+}  // namespace
+
+Result<std::vector<ProfileMapping>> ReadExecutableMappings(pid_t pid) {
+  auto path = "/proc/" + std::to_string(pid) + "/maps";
+  auto maps = ReadFile(path);
+  CF_EXPECT(!maps.empty(), "Failed to read \"" << path << "\"");
+  std::vector<ProfileMapping> mappings;
+  std::istringstream lines(maps);
+  for (std::string line; std::getline(lines, line);) {
+    // start-limit perms offset dev inode [path]
+    std::istringstream fields(line);
+    std::string range, perms, dev, inode, file;
+    std::uint64_t offset = 0;
+    fields >> range >> perms >> std::hex >> offset >> dev >> inode;
+    std::getline(fields >> std::ws, file);
+    auto dash = range.find('-');
+    if (perms.size() < 3 || perms[2] != 'x' || dash == std::string::npos) {
+      continue;
+    }
+    mappings.push_back(ProfileMapping{
+        .start = std::stoull(range.substr(0, dash), nullptr, 16),
+        .limit = std::stoull(range.substr(dash + 1), nullptr, 16),
+        .file_offset = offset,
+        .path = file,
+    });
+  }
+  return mappings;
+}
+
+PprofProfile::PprofProfile(std::vector<ValueType> sample_types,
+                           ValueType period_type, std::int64_t period)
+    : sample_types_(std::move(sample_types)),
+      period_type_(std::move(period_type)),
+      period_(period) {}
+
+void PprofProfile::SetMappings(std::vector<ProfileMapping> mappings) {
+  mappings_ = std::move(mappings);
+}
+
+void PprofProfile::AddSample(const std::vector<std::uint64_t>& stack,
+                             const std::vector<std::int64_t>& values) {
+  auto& merged = samples_[stack];
+  merged.resize(sample_types_.size());
+  for (std::size_t i = 0; i < merged.size() && i < values.size(); i++) {
+    merged[i] += values[i];
+  }
+}
+
+void PprofProfile::SetTime(std::chrono::system_clock::time_point start,
+                           std::chrono::nanoseconds duration) {
+  start_ = start;
+  duration_ = duration;
+}
+
+void PprofProfile::AddComment(const std::string& comment) {
+  comments_.push_back(comment);
+}
+
+std::string PprofProfile::Serialize() const {
+  ProtoWriter profile;
+  StringTable strings;
+  for (const auto& sample_type : sample_types_) {
+    profile.Message(kProfileSampleType, ValueTypeMessage(sample_type, strings));
+  }
+
+  // Ids start at 1, 0 means none
+  auto mapping_id = [this](std::uint64_t address) -> std::uint64_t {
+    for (std::size_t i = 0; i < mappings_.size(); i++) {
+      if (address >= mappings_[i].start && address < mappings_[i].limit) {
+        return i + 1;
+      }
+    }
+    return 0;
+  };
+  std::map<std::uint64_t, std::uint64_t> location_ids;
+  for (const auto& [stack, values] : samples_) {
+    std::vector<std::uint64_t> locations;
+    for (std::size_t i = 0; i < stack.size(); i++) {
+      // Return addresses point after the call, which may already be the next
+      // line or function.
+      auto address = i == 0 ? stack[i] : stack[i] - 1;
+      auto [it, inserted] =
+          location_ids.emplace(address, location_ids.size() + 1);
+      if (inserted) {
+        ProtoWriter location;
+        location.UInt64(kLocationId, it->second);
+        location.UInt64(kLocationMappingId, mapping_id(address));
+        location.UInt64(kLocationAddress, address);
+        profile.Message(kProfileLocation, location);
+      }
+      locations.push_back(it->second);
+    }
+    ProtoWriter sample;
+    sample.Packed(kSampleLocationId, locations);
+    sample.Packed(kSampleValue, values);
+    profile.Message(kProfileSample, sample);
+  }
+
+  for (std::size_t i = 0; i < mappings_.size(); i++) {
+    ProtoWriter mapping;
+    mapping.UInt64(kMappingId, i + 1);
+    mapping.UInt64(kMappingMemoryStart, mappings_[i].start);
+    mapping.UInt64(kMappingMemoryLimit, mappings_[i].limit);
+    mapping.UInt64(kMappingFileOffset, mappings_[i].file_offset);
+    mapping.Int64(kMappingFilename, strings.Index(mappings_[i].path));
+    profile.Message(kProfileMapping, mapping);
+  }
+
+  profile.Int64(kProfileTimeNanos,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    start_.time_since_epoch())
+                    .count());
+  profile.Int64(kProfileDurationNanos, duration_.count());
+  profile.Message(kProfilePeriodType, ValueTypeMessage(period_type_, strings));
+  profile.Int64(kProfilePeriod, period_);
+  for (const auto& comment : comments_) {
+    profile.Int64(kProfileComment, strings.Index(comment));
+  }
+  // Last, once every string has been added
+  strings.WriteTo(profile);
+  return profile.str();
+}
+
+Result<void> PprofProfile::WriteGzipped(const std::string& path) const {
+  auto serialized = Serialize();
+  gzFile file = gzopen(path.c_str(), "wb");
+  CF_EXPECT(file != nullptr, "Failed to open \"" << path << "\"");
+  auto written = gzwrite(file, serialized.data(), serialized.size());
+  auto closed = gzclose(file);
+  CF_EXPECT(written == static_cast<int>(serialized.size()) && closed == Z_OK,
+            "Failed to write \"" << path << "\"");
+  return {};
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+// An executable mapping of the profiled process, from /proc/<pid>/maps
+struct ProfileMapping {
+  std::uint64_t start;
+  std::uint64_t limit;
+  std::uint64_t file_offset;
+  std::string path;
+};
+
+Result<std::vector<ProfileMapping>> ReadExecutableMappings(pid_t pid);
+
+// Builds a profile in the format pprof reads, see
+// https://github.com/google/pprof/blob/main/proto/profile.proto
+//
+// Only addresses and mappings are recorded, pprof symbolizes them with the
+// binaries found at the mapping paths.
+class PprofProfile {
+ public:
+  // A sample type or the period type, e.g. {"cpu", "nanoseconds"}
+  using ValueType = std::pair<std::string, std::string>;
+
+  PprofProfile(std::vector<ValueType> sample_types, ValueType period_type,
+               std::int64_t period);
+
+  void SetMappings(std::vector<ProfileMapping> mappings);
+  // A stack of addresses, leaf first and return addresses after it, with one
+  // value per sample type. Identical stacks are merged.
+  void AddSample(const std::vector<std::uint64_t>& stack,
+                 const std::vector<std::int64_t>& values);
+  void SetTime(std::chrono::system_clock::time_point start,
+               std::chrono::nanoseconds duration);
+  void AddComment(const std::string& comment);
+
+  // The encoded profile.proto message
+  std::string Serialize() const;
+  // Writes the message gzipped, as pprof writes its own profiles.
+  Result<void> WriteGzipped(const std::string& path) const;
+
+ private:
+  std::vector<ValueType> sample_types_;
+  ValueType period_type_;
+  std::int64_t period_;
+  std::vector<ProfileMapping> mappings_;
+  std::map<std::vector<std::uint64_t>, std::vector<std::int64_t>> samples_;
+  std::chrono::system_clock::time_point start_;
+  std::chrono::nanoseconds duration_{0};
+  std::vector<std::string> comments_;
+};
+
+}  // namespace cuttlefish
@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <time.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+#include <gflags/gflags.h>
+#include <json/json.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/environment.h"
+#include "common/libs/utils/files.h"
+#include "common/libs/utils/result.h"
+#include "host/commands/profile_cvd/perf_sampler.h"
+#include "host/commands/profile_cvd/pprof_profile.h"
+#include "host/commands/run_cvd/runner_defs.h"
+#include "host/libs/config/cuttlefish_config.h"
+
+DEFINE_int32(instance_num, cuttlefish::GetInstance(),
+             "Which instance the process belongs to");
+DEFINE_string(process, "",
+              "Name of the process to profile as listed by cvd status, e.g. "
+              "webRTC, secure_env or crosvm. Case insensitive.");
+DEFINE_string(type, "cpu",
+              "cpu to sample where the process spends its CPU time, heap to "
+              "sample where its resident memory grows");
+DEFINE_string(duration, "30s",
+              "How long to profile for, with an ms, s or m suffix");
+DEFINE_int32(frequency, 99,
+             "CPU profiles: samples per second of CPU time of each thread");
+DEFINE_int32(fault_period, 1,
+             "Heap profiles: record one in this many page faults");
+DEFINE_string(output, "",
+              "Where to write the profile. Defaults to a file in the "
+              "instance's profiles directory.");
+
+namespace cuttlefish {
+namespace {
+
+constexpr char kUsage[] =
+    "Captures a profile of one of the host processes of a running device, in "
+    "the gzipped protobuf format pprof reads, and prints its path.\n"
+    "\n"
+    "usage: cvd profile --process=webRTC [--instance_num=N] [--type=cpu|heap] "
+    "[--duration=30s]\n"
+    "\n"
+    "The process is found through the launcher, so a restarted process is "
+    "profiled under its new pid. Stacks are sampled with perf events and "
+    "walked through frame pointers by the kernel, which needs "
+    "/proc/sys/kernel/perf_event_paranoid at 2 or lower. Heap profiles sample "
+    "page faults: they show the code touching memory for the first time, "
+    "rather than every allocation.\n"
+    "\n"
+    "View the profile with: pprof -http=: <path>";
+
+Result<std::chrono::milliseconds> ParseDuration(const std::string& str) {
+  std::string number = str;
+  std::int64_t scale_ms = 1000;
+  if (android::base::EndsWith(str, "ms")) {
+    number = str.substr(0, str.size() - 2);
+    scale_ms = 1;
+  } else if (android::base::EndsWith(str, "s")) {
+    number = str.substr(0, str.size() - 1);
+  } else if (android::base::EndsWith(str, "m")) {
+    number = str.substr(0, str.size() - 1);
+    scale_ms = 60 * 1000;
+  }
+  std::int64_t value;
+  CF_EXPECT(android::base::ParseInt(number, &value, std::int64_t{1}),
+            "Invalid duration: \"" << str << "\"");
+  return std::chrono::milliseconds(value * scale_ms);
+}
+
+Result<Json::Value> QueryProcessStatus(
+    const CuttlefishConfig::InstanceSpecific& instance) {
+  auto path = instance.launcher_monitor_socket_path();
+  auto monitor = SharedFD::SocketLocalClient(path, false, SOCK_STREAM);
+  CF_EXPECT(monitor->IsOpen(), "Unable to connect to the launcher monitor at \""
+                                   << path << "\": " << monitor->StrError());
+  auto action = LauncherAction::kProcessStatus;
+  CF_EXPECT(WriteAllBinary(monitor, &action) == sizeof(action),
+            monitor->StrError());
+  LauncherResponse response;
+  CF_EXPECT(ReadExactBinary(monitor, &response) == sizeof(response),
+            monitor->StrError());
+  CF_EXPECT(response == LauncherResponse::kSuccess,
+            "The launcher failed to report its processes");
+  std::uint32_t size = 0;
+  CF_EXPECT(ReadExactBinary(monitor, &size) == sizeof(size),
+            monitor->StrError());
+  std::string status(size, '\0');
+  CF_EXPECT(ReadExact(monitor, &status) == static_cast<ssize_t>(size),
+            monitor->StrError());
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  Json::Value processes;
+  std::string errors;
+  CF_EXPECT(reader->parse(status.data(), status.data() + status.size(),
+                          &processes, &errors),
+            "Could not parse the process status: " << errors);
+  CF_EXPECT(processes.isArray(), "The process status is not a list");
+  return processes;
+}
+
+Result<pid_t> FindProcess(const CuttlefishConfig::InstanceSpecific& instance,
+                          const std::string& name) {
+  auto processes = CF_EXPECT(QueryProcessStatus(instance));
+  std::vector<std::string> names;
+  for (const auto& process : processes) {
+    names.push_back(process["name"].asString());
+    if (!android::base::EqualsIgnoreCase(names.back(), name)) {
+      continue;
+    }
+    auto pid = process["pid"].asInt();
+    CF_EXPECT(pid > 0, "\"" << names.back() << "\" is waiting to restart");
+    return pid;
+  }
+  return CF_ERR("No process named \""
+                << name << "\" in instance " << instance.instance_name()
+                << ", the instance runs: "
+                << android::base::Join(names, ", "));
+}
+
+std::string DefaultOutputPath(
+    const CuttlefishConfig::InstanceSpecific& instance) {
+  auto now = std::chrono::system_clock::to_time_t(
+      std::chrono::system_clock::now());
+  struct tm local;
+  char timestamp[32] = "";
+  if (localtime_r(&now, &local)) {
+    strftime(timestamp, sizeof(timestamp), "%Y%m%d-%H%M%S", &local);
+  }
+  return instance.PerInstancePath("profiles") + "/" + FLAGS_process + "-" +
+         FLAGS_type + "-" + timestamp + ".pb.gz";
+}
+
+Result<void> ProfileCvdMain(int argc, char** argv) {
+  ::android::base::InitLogging(argv, android::base::StderrLogger);
+  google::SetUsageMessage(kUsage);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  CF_EXPECT(!FLAGS_process.empty(), "--process is required");
+  CF_EXPECT(FLAGS_type == "cpu" || FLAGS_type == "heap",
+            "--type must be cpu or heap, not \"" << FLAGS_type << "\"");
+  auto duration = CF_EXPECT(ParseDuration(FLAGS_duration));
+
+  auto config = CuttlefishConfig::Get();
+  CF_EXPECT(config != nullptr, "Unable to load the config");
+  auto instance = config->ForInstance(FLAGS_instance_num);
+  auto pid = CF_EXPECT(FindProcess(instance, FLAGS_process));
+
+  const bool cpu = FLAGS_type == "cpu";
+  std::uint64_t period;
+  if (cpu) {
+    CF_EXPECT(FLAGS_frequency > 0 && FLAGS_frequency <= 10000,
+              "--frequency must be between 1 and 10000");
+    period = 1000000000 / FLAGS_frequency;
+  } else {
+    CF_EXPECT(FLAGS_fault_period > 0, "--fault_period must be positive");
+    period = FLAGS_fault_period;
+  }
+  LOG(INFO) << "Profiling " << FLAGS_process << " (pid " << pid << ") for "
+            << duration.count() << "ms";
+  const auto start = std::chrono::system_clock::now();
+  auto samples = CF_EXPECT(SampleStacks(
+      pid, cpu ? SampledEvent::kTaskClock : SampledEvent::kPageFaults, period,
+      duration));
+
+  const std::int64_t page_size = sysconf(_SC_PAGESIZE);
+  PprofProfile profile =
+      cpu ? PprofProfile({{"samples", "count"}, {"cpu", "nanoseconds"}},
+                         {"cpu", "nanoseconds"}, period)
+          : PprofProfile({{"page_faults", "count"}, {"resident", "bytes"}},
+                         {"page_faults", "count"}, period);
+  for (const auto& [stack, count] : samples.stacks) {
+    const std::int64_t events = count * period;
+    profile.AddSample(stack, {static_cast<std::int64_t>(count),
+                              cpu ? events : events * page_size});
+  }
+  // Read last to include the libraries loaded while sampling
+  profile.SetMappings(CF_EXPECT(ReadExecutableMappings(pid)));
+  profile.SetTime(start, duration);
+  profile.AddComment("process: " + FLAGS_process);
+  profile.AddComment("instance: " + instance.instance_name());
+  profile.AddComment("threads: " + std::to_string(samples.threads));
+  profile.AddComment("lost samples: " + std::to_string(samples.lost));
+
+  auto output = FLAGS_output.empty() ? DefaultOutputPath(instance)
+                                     : FLAGS_output;
+  CF_EXPECT(EnsureDirectoryExists(cpp_dirname(output)));
+  CF_EXPECT(profile.WriteGzipped(output));
+  LOG(INFO) << samples.stacks.size() << " distinct stacks from "
+            << samples.threads << " threads";
+  std::cout << output << std::endl;
+  return {};
+}
+
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  auto result = cuttlefish::ProfileCvdMain(argc, argv);
+  if (!result.ok()) {
+    LOG(ERROR) << result.error();
+    return 1;
+  }
+  return 0;
+}
@@ -19,6 +19,8 @@
 #include <poll.h>
 
 #include <memory>
+#include <optional>
+#include <set>
 #include <thread>
 
 #include <android-base/logging.h>
@@ -29,7 +31,9 @@
 #include "host/commands/kernel_log_monitor/kernel_log_server.h"
 #include "host/commands/kernel_log_monitor/utils.h"
 #include "host/commands/run_cvd/runner_defs.h"
+#include "host/libs/config/boot_timeline.h"
 #include "host/libs/config/feature.h"
+#include "host/libs/vm_manager/gem5_manager.h"
 
 DEFINE_int32(reboot_notification_fd, -1,
              "A file descriptor to notify when boot completes.");
@@ -153,9 +157,11 @@ class ProcessLeader : public SetupFeature {
 // launcher process
 class CvdBootStateMachine : public SetupFeature {
  public:
-  INJECT(CvdBootStateMachine(ProcessLeader& process_leader,
+  INJECT(CvdBootStateMachine(const CuttlefishConfig& config,
+                             ProcessLeader& process_leader,
                              KernelLogPipeProvider& kernel_log_pipe_provider))
-      : process_leader_(process_leader),
+      : config_(config),
+        process_leader_(process_leader),
         kernel_log_pipe_provider_(kernel_log_pipe_provider),
         state_(kBootStarted) {}
 
@@ -199,12 +205,47 @@ class CvdBootStateMachine : public SetupFeature {
       LOG(ERROR) << "Could not get boot events pipe";
       return false;
     }
-    boot_event_handler_ = std::thread(
-        [this, boot_events_pipe]() { ThreadLoop(boot_events_pipe); });
+    auto timeline =
+        BootTimeline::Open(config_.ForDefaultInstance().boot_timeline_path());
+    if (timeline.ok()) {
+      timeline_ = *timeline;
+    } else {
+      LOG(WARNING) << "Not recording boot events:\n" << timeline.error();
+    }
+    boot_event_handler_ = std::thread([this, boot_events_pipe]() {
+      ThreadLoop(boot_events_pipe);
+      ReportTimeline();
+    });
     return true;
   }
 
+  void ReportTimeline() {
+    if (!BootCompleted() && !BootFailed()) {
+      return;  // Interrupted
+    }
+    auto path = config_.ForDefaultInstance().boot_timeline_path();
+    auto summary = SummarizeBootTimeline(path);
+    if (summary.ok()) {
+      LOG(INFO) << "Boot timeline: " << *summary;
+      LOG(INFO) << "Chrome trace of the boot: " << path;
+    } else {
+      LOG(WARNING) << "Could not summarize the boot timeline:\n"
+                   << summary.error();
+    }
+  }
+
   void ThreadLoop(SharedFD boot_events_pipe) {
+    if (!config_.snapshot_path().empty() ||
+        vm_manager::Gem5Manager::RestoresCheckpoint(config_)) {
+      // A guest resumed from a snapshot is past boot and won't report it
+      LOG(INFO) << "Virtual device resumed from a snapshot";
+      if (timeline_) {
+        timeline_->AddInstant("boot", "ResumedFromSnapshot");
+      }
+      state_ |= kGuestBootCompleted;
+      MaybeWriteNotification();
+      return;
+    }
     while (true) {
       std::vector<PollSharedFd> poll_shared_fd = {
           {
@@ -249,10 +290,23 @@ class CvdBootStateMachine : public SetupFeature {
       state_ |= kGuestBootFailed;
       return MaybeWriteNotification();
     }
+    // Only the first of repeated events, like ScreenChanged, marks a phase
+    if (timeline_ && seen_events_.insert(read_result->event).second) {
+      timeline_->AddInstant("boot", monitor::EventName(read_result->event));
+    }
 
     if (read_result->event == monitor::Event::BootCompleted) {
       LOG(INFO) << "Virtual device booted successfully";
       state_ |= kGuestBootCompleted;
+      if (config_.vm_manager() == vm_manager::Gem5Manager::name() &&
+          !config_.gem5_checkpoint_dir().empty()) {
+        // Later launches of the same images restore it instead of booting
+        auto checkpoint = vm_manager::Gem5Manager::RequestCheckpoint(config_);
+        if (!checkpoint.ok()) {
+          LOG(WARNING) << "Could not request a gem5 checkpoint:\n"
+                       << checkpoint.error();
+        }
+      }
     } else if (read_result->event == monitor::Event::BootFailed) {
       LOG(ERROR) << "Virtual device failed to boot";
       state_ |= kGuestBootFailed;
@@ -285,10 +339,13 @@ class CvdBootStateMachine : public SetupFeature {
     return BootCompleted() || (state_ & kGuestBootFailed);
   }
 
+  const CuttlefishConfig& config_;
   ProcessLeader& process_leader_;
   KernelLogPipeProvider& kernel_log_pipe_provider_;
 
   std::thread boot_event_handler_;
+  std::optional<BootTimeline> timeline_;
+  std::set<monitor::Event> seen_events_;
   SharedFD fg_launcher_pipe_;
   SharedFD reboot_notification_;
   SharedFD interrupt_fd_;
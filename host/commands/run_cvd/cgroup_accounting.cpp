@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/run_cvd/cgroup_accounting.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr char kCgroupMount[] = "/sys/fs/cgroup";
+// Holds run_cvd itself and the process monitor, as a cgroup with children
+// can't hold processes once controllers are enabled for the children.
+constexpr char kLauncherGroup[] = "run_cvd";
+
+// The cgroup v2 path of this process, relative to the mount
+Result<std::string> OwnCgroup() {
+  for (const auto& line :
+       android::base::Split(ReadFile("/proc/self/cgroup"), "\n")) {
+    if (android::base::StartsWith(line, "0::")) {
+      return line.substr(3);
+    }
+  }
+  return CF_ERR("Not in a cgroup v2 hierarchy");
+}
+
+Result<void> MakeCgroup(const std::string& path) {
+  CF_EXPECT(mkdir(path.c_str(), 0755) == 0 || errno == EEXIST,
+            "Could not create the cgroup " << path << ": " << strerror(errno));
+  return {};
+}
+
+Result<void> WriteCgroupFile(const std::string& path,
+                             const std::string& value) {
+  auto fd = SharedFD::Open(path, O_WRONLY);
+  CF_EXPECT(fd->IsOpen(), "Could not open " << path << ": " << fd->StrError());
+  CF_EXPECT(WriteAll(fd, value) == (ssize_t)value.size(),
+            "Could not write \"" << value << "\" to " << path << ": "
+                                 << fd->StrError());
+  return {};
+}
+
+// Best effort, fails while `cgroup` holds processes or for controllers that
+// its parent didn't enable.
+void EnableControllers(const std::string& cgroup) {
+  auto available = android::base::Split(
+      android::base::Trim(ReadFile(cgroup + "/cgroup.controllers")), " ");
+  for (const auto& controller : {"cpu", "io", "memory"}) {
+    if (std::find(available.begin(), available.end(), controller) ==
+        available.end()) {
+      continue;
+    }
+    auto enabled = WriteCgroupFile(cgroup + "/cgroup.subtree_control",
+                                   std::string("+") + controller);
+    if (!enabled.ok()) {
+      LOG(DEBUG) << "Not accounting for " << controller << ":\n"
+                 << enabled.error();
+    }
+  }
+}
+
+// The value of `key` in a flat keyed file like cpu.stat, or in a line of a
+// nested keyed file like io.stat
+std::optional<std::int64_t> KeyedValue(const std::string& line,
+                                       const std::string& key) {
+  for (const auto& field : android::base::Split(line, " \n")) {
+    std::int64_t value = 0;
+    if (android::base::StartsWith(field, key + "=") &&
+        android::base::ParseInt(field.substr(key.size() + 1), &value)) {
+      return value;
+    }
+  }
+  return {};
+}
+
+std::optional<std::int64_t> ReadInt(const std::string& path) {
+  std::int64_t value = 0;
+  if (!android::base::ParseInt(android::base::Trim(ReadFile(path)), &value)) {
+    return {};
+  }
+  return value;
+}
+
+// The names of the child groups of `cgroup`
+std::vector<std::string> ChildCgroups(const std::string& cgroup) {
+  std::vector<std::string> children;
+  for (const auto& child : DirectoryContents(cgroup)) {
+    if (child != "." && child != ".." &&
+        DirectoryExists(cgroup + "/" + child, /* follow_symlinks */ false)) {
+      children.push_back(child);
+    }
+  }
+  return children;
+}
+
+CgroupUsage ReadCgroupUsage(const std::string& path, const std::string& name) {
+  CgroupUsage usage;
+  usage.group = name;
+  for (const auto& line :
+       android::base::Split(ReadFile(path + "/cpu.stat"), "\n")) {
+    std::int64_t usec = 0;
+    if (android::base::StartsWith(line, "usage_usec ") &&
+        android::base::ParseInt(line.substr(11), &usec)) {
+      usage.cpu_time = std::chrono::microseconds(usec);
+    }
+  }
+  usage.memory_bytes = ReadInt(path + "/memory.current");
+  if (FileExists(path + "/io.stat")) {
+    usage.io_read_bytes = 0;
+    usage.io_write_bytes = 0;
+    // One line per device, e.g. "8:0 rbytes=4096 wbytes=0 rios=1 ..."
+    for (const auto& line :
+         android::base::Split(ReadFile(path + "/io.stat"), "\n")) {
+      *usage.io_read_bytes += KeyedValue(line, "rbytes").value_or(0);
+      *usage.io_write_bytes += KeyedValue(line, "wbytes").value_or(0);
+    }
+  }
+  return usage;
+}
+
+}  // namespace
+
+CgroupAccounting::CgroupAccounting(std::string root, Settings settings)
+    : root_(std::move(root)), settings_(std::move(settings)) {}
+
+Result<CgroupAccounting> CgroupAccounting::Create(
+    const std::string& instance_name, Settings settings) {
+  CF_EXPECT(FileExists(std::string(kCgroupMount) + "/cgroup.controllers"),
+            "cgroup v2 is not mounted at " << kCgroupMount);
+  auto own = kCgroupMount + CF_EXPECT(OwnCgroup());
+  auto name = "cuttlefish-" + instance_name;
+  // A restarted run_cvd is already in place
+  std::string root = own + "/" + name;
+  if (android::base::EndsWith(own, "/" + name + "/" + kLauncherGroup)) {
+    root = cpp_dirname(own);
+  }
+  CF_EXPECT(MakeCgroup(root));
+
+  CgroupAccounting accounting(root, std::move(settings));
+  auto launcher = CF_EXPECT(accounting.GroupProcs(kLauncherGroup));
+  CF_EXPECT(WriteAll(launcher, "0") == 1,
+            "Could not move run_cvd to its cgroup: " << launcher->StrError());
+
+  EnableControllers(cpp_dirname(root));
+  EnableControllers(root);
+  return accounting;
+}
+
+Result<SharedFD> CgroupAccounting::GroupProcs(const std::string& group) const {
+  auto path = root_ + "/" + group;
+  CF_EXPECT(MakeCgroup(path));
+  if (auto it = settings_.find(group); it != settings_.end()) {
+    // Fails for controllers that couldn't be enabled, the process still runs
+    for (const auto& [file, value] : it->second) {
+      auto written = WriteCgroupFile(path + "/" + file, value);
+      if (!written.ok()) {
+        LOG(WARNING) << "Could not configure the cgroup of " << group << ":\n"
+                     << written.error();
+      }
+    }
+  }
+  auto procs = SharedFD::Open(path + "/cgroup.procs", O_WRONLY | O_CLOEXEC);
+  CF_EXPECT(procs->IsOpen(),
+            "Could not open " << path << "/cgroup.procs: "
+                              << procs->StrError());
+  return procs;
+}
+
+Result<std::vector<CgroupUsage>> CgroupAccounting::Usage() const {
+  CF_EXPECT(DirectoryExists(root_), root_ << " went away");
+  std::vector<CgroupUsage> usage;
+  for (const auto& group : ChildCgroups(root_)) {
+    usage.push_back(ReadCgroupUsage(root_ + "/" + group, group));
+  }
+  return usage;
+}
+
+Result<void> CgroupAccounting::Remove() {
+  // Only empty cgroups can be removed, so run_cvd goes back to the cgroup it
+  // started in. That fails if it was alone there and the controllers got
+  // enabled for the children, whoever manages that cgroup then cleans up.
+  CF_EXPECT(WriteCgroupFile(cpp_dirname(root_) + "/cgroup.procs", "0"),
+            "Could not move run_cvd out of " << root_);
+  for (const auto& group : ChildCgroups(root_)) {
+    auto path = root_ + "/" + group;
+    CF_EXPECT(rmdir(path.c_str()) == 0,
+              "Could not remove the cgroup " << path << ": "
+                                             << strerror(errno));
+  }
+  CF_EXPECT(rmdir(root_.c_str()) == 0,
+            "Could not remove the cgroup " << root_ << ": " << strerror(errno));
+  return {};
+}
+
+std::vector<NetworkUsage> ReadNetworkUsage(
+    const std::vector<std::string>& interfaces) {
+  std::vector<NetworkUsage> usage;
+  for (const auto& interface : interfaces) {
+    auto statistics = "/sys/class/net/" + interface + "/statistics";
+    auto receive = ReadInt(statistics + "/rx_bytes");
+    auto transmit = ReadInt(statistics + "/tx_bytes");
+    if (receive && transmit) {
+      usage.push_back(NetworkUsage{
+          .interface = interface,
+          .receive_bytes = *receive,
+          .transmit_bytes = *transmit,
+      });
+    }
+  }
+  return usage;
+}
+
+std::string PrometheusText(const std::string& instance_name,
+                           const std::vector<CgroupUsage>& cgroups,
+                           const std::vector<NetworkUsage>& network) {
+  std::stringstream text;
+  text << std::fixed << std::setprecision(6);
+  auto metric = [&text](const std::string& name, const std::string& type,
+                        const std::string& help) {
+    text << "# HELP " << name << " " << help << "\n";
+    text << "# TYPE " << name << " " << type << "\n";
+  };
+  auto labels = [&instance_name](const std::string& key,
+                                 const std::string& value) {
+    return "{instance=\"" + instance_name + "\"," + key + "=\"" + value +
+           "\"}";
+  };
+
+  metric("cuttlefish_cpu_seconds_total", "counter",
+         "CPU time used by the host processes of a group.");
+  for (const auto& cgroup : cgroups) {
+    text << "cuttlefish_cpu_seconds_total" << labels("group", cgroup.group)
+         << " " << cgroup.cpu_time.count() / 1e6 << "\n";
+  }
+  metric("cuttlefish_memory_bytes", "gauge",
+         "Memory charged to the host processes of a group.");
+  for (const auto& cgroup : cgroups) {
+    if (cgroup.memory_bytes) {
+      text << "cuttlefish_memory_bytes" << labels("group", cgroup.group)
+           << " " << *cgroup.memory_bytes << "\n";
+    }
+  }
+  metric("cuttlefish_io_read_bytes_total", "counter",
+         "Bytes read from block devices by the host processes of a group.");
+  for (const auto& cgroup : cgroups) {
+    if (cgroup.io_read_bytes) {
+      text << "cuttlefish_io_read_bytes_total" << labels("group", cgroup.group)
+           << " " << *cgroup.io_read_bytes << "\n";
+    }
+  }
+  metric("cuttlefish_io_write_bytes_total", "counter",
+         "Bytes written to block devices by the host processes of a group.");
+  for (const auto& cgroup : cgroups) {
+    if (cgroup.io_write_bytes) {
+      text << "cuttlefish_io_write_bytes_total" << labels("group", cgroup.group)
+           << " " << *cgroup.io_write_bytes << "\n";
+    }
+  }
+  metric("cuttlefish_network_receive_bytes_total", "counter",
+         "Bytes received by the host from the guest on an interface.");
+  for (const auto& interface : network) {
+    text << "cuttlefish_network_receive_bytes_total"
+         << labels("interface", interface.interface) << " "
+         << interface.receive_bytes << "\n";
+  }
+  metric("cuttlefish_network_transmit_bytes_total", "counter",
+         "Bytes sent by the host to the guest on an interface.");
+  for (const auto& interface : network) {
+    text << "cuttlefish_network_transmit_bytes_total"
+         << labels("interface", interface.interface) << " "
+         << interface.transmit_bytes << "\n";
+  }
+  return text.str();
+}
+
+}  // namespace cuttlefish
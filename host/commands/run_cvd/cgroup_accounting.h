@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+// Resources used by the processes of one cgroup. The memory and I/O figures
+// are only known when those controllers are enabled for the instance.
+struct CgroupUsage {
+  std::string group;
+  std::chrono::microseconds cpu_time{0};
+  std::optional<std::int64_t> memory_bytes;
+  std::optional<std::int64_t> io_read_bytes;
+  std::optional<std::int64_t> io_write_bytes;
+};
+
+struct NetworkUsage {
+  std::string interface;
+  std::int64_t receive_bytes = 0;
+  std::int64_t transmit_bytes = 0;
+};
+
+// A cgroup v2 hierarchy for the host processes of one instance, with one
+// child group per process name, e.g.
+//   <cgroup of run_cvd>/cuttlefish-cvd-1/{run_cvd,crosvm,webRTC,...}
+class CgroupAccounting {
+ public:
+  using Settings = std::map<std::string, std::map<std::string, std::string>>;
+
+  // Creates the hierarchy and moves run_cvd into it. Fails unless cgroup v2
+  // is mounted and the cgroup of run_cvd is delegated to the user. `settings`
+  // are the files to write in each group, like cpu.weight, by group name.
+  static Result<CgroupAccounting> Create(const std::string& instance_name,
+                                         Settings settings);
+
+  // The cgroup.procs file of the group for processes called `group`, which
+  // is created and configured if needed.
+  Result<SharedFD> GroupProcs(const std::string& group) const;
+  Result<std::vector<CgroupUsage>> Usage() const;
+  // Moves run_cvd back to the cgroup it started in and removes the hierarchy,
+  // once none of the other processes are left.
+  Result<void> Remove();
+
+ private:
+  CgroupAccounting(std::string root, Settings settings);
+
+  std::string root_;
+  Settings settings_;
+};
+
+// Traffic of the given network interfaces, skipping those that don't exist.
+std::vector<NetworkUsage> ReadNetworkUsage(
+    const std::vector<std::string>& interfaces);
+
+// The usage in the Prometheus text exposition format, for the textfile
+// collector of the node exporter.
+std::string PrometheusText(const std::string& instance_name,
+                           const std::vector<CgroupUsage>& cgroups,
+                           const std::vector<NetworkUsage>& network);
+
+}  // namespace cuttlefish
@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/run_cvd/displays.h"
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <sstream>
+#include <string>
+
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/files.h"
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+namespace {
+
+// Scanouts of a virtio-gpu device
+constexpr std::uint32_t kMaxDisplays = 16;
+
+Json::Value DisplayToJson(std::uint32_t display_number,
+                          const CuttlefishConfig::DisplayConfig& display) {
+  Json::Value ret;
+  ret["display"] = display_number;
+  ret["width"] = display.width;
+  ret["height"] = display.height;
+  ret["dpi"] = display.dpi;
+  ret["refresh_rate_hz"] = display.refresh_rate_hz;
+  return ret;
+}
+
+}  // namespace
+
+RuntimeDisplays::RuntimeDisplays(
+    const CuttlefishConfig& config,
+    const CuttlefishConfig::InstanceSpecific& instance,
+    vm_manager::VmManager& vm_manager)
+    : config_(config), instance_(instance), vm_manager_(vm_manager) {
+  auto display_configs = config_.display_configs();
+  for (std::uint32_t i = 0; i < display_configs.size(); i++) {
+    displays_[i] = display_configs[i];
+  }
+}
+
+Result<Json::Value> RuntimeDisplays::Handle(const Json::Value& request) {
+  CF_EXPECT(request.isObject() && request["action"].isString(),
+            "Display requests need an action");
+  auto action = request["action"].asString();
+  if (action == "add") {
+    // New displays look like the first one unless told otherwise
+    CuttlefishConfig::DisplayConfig defaults{.width = 0,
+                                             .height = 0,
+                                             .dpi = 320,
+                                             .refresh_rate_hz = 60};
+    if (!displays_.empty()) {
+      defaults = displays_.begin()->second;
+    }
+    CF_EXPECT(Add(CF_EXPECT(ParseDisplayConfig(request, defaults))));
+  } else if (action == "remove" || action == "resize") {
+    CF_EXPECT(request["display"].isUInt(), "Missing the display number");
+    auto display_number = request["display"].asUInt();
+    auto it = displays_.find(display_number);
+    CF_EXPECT(it != displays_.end(), "No display " << display_number);
+    if (action == "remove") {
+      CF_EXPECT(displays_.size() > 1, "The last display can't be removed");
+      CF_EXPECT(Remove(display_number));
+    } else {
+      // Displays can't change their mode in place, the display is replaced.
+      // It keeps its number, the lowest free one once it's removed, unless a
+      // display with a lower number was removed before.
+      auto original = it->second;
+      auto display = CF_EXPECT(ParseDisplayConfig(request, original));
+      CF_EXPECT(Remove(display_number));
+      auto count = displays_.size();
+      auto added_result = Add(display);
+      if (!added_result.ok()) {
+        // The display is put back as it was unless the VM has the new one
+        if (displays_.size() == count) {
+          auto restored = Add(original);
+          if (!restored.ok()) {
+            LOG(ERROR) << "Could not restore display " << display_number
+                       << ": " << restored.error();
+          }
+        }
+        return CF_ERR("Could not resize display "
+                      << display_number << ": " << added_result.error());
+      }
+      auto added = *added_result;
+      if (added != display_number) {
+        LOG(WARNING) << "Display " << display_number << " is now display "
+                     << added;
+      }
+    }
+  } else {
+    CF_EXPECT(action == "list", "Unknown display action \"" << action << "\"");
+  }
+  Json::Value ret(Json::arrayValue);
+  for (const auto& [display_number, display] : displays_) {
+    ret.append(DisplayToJson(display_number, display));
+  }
+  return ret;
+}
+
+Result<CuttlefishConfig::DisplayConfig> RuntimeDisplays::ParseDisplayConfig(
+    const Json::Value& request,
+    const CuttlefishConfig::DisplayConfig& defaults) const {
+  auto display = defaults;
+  for (auto [name, field] : {std::make_pair("width", &display.width),
+                             std::make_pair("height", &display.height),
+                             std::make_pair("dpi", &display.dpi),
+                             std::make_pair("refresh_rate_hz",
+                                            &display.refresh_rate_hz)}) {
+    if (request.isMember(name)) {
+      CF_EXPECT(request[name].isInt() && request[name].asInt() > 0,
+                "Invalid " << name << ": " << request[name]);
+      *field = request[name].asInt();
+    }
+  }
+  CF_EXPECT(display.width > 0 && display.height > 0,
+            "The display needs a width and a height");
+  return display;
+}
+
+Result<std::uint32_t> RuntimeDisplays::Add(
+    const CuttlefishConfig::DisplayConfig& display) {
+  // The VM gives the new display the lowest free number as well
+  std::uint32_t display_number = 0;
+  while (displays_.count(display_number)) {
+    display_number++;
+  }
+  CF_EXPECT(display_number < kMaxDisplays,
+            "There are " << kMaxDisplays << " displays already");
+  CF_EXPECT(vm_manager_.AddDisplay(config_, display));
+  displays_[display_number] = display;
+  LOG(INFO) << "Added display " << display_number << ": " << display.width
+            << "x" << display.height;
+  std::stringstream message;
+  message << "add " << display_number << " " << display.width << " "
+          << display.height << " " << display.dpi << " "
+          << display.refresh_rate_hz;
+  CF_EXPECT(NotifyStreamer(message.str()));
+  return display_number;
+}
+
+Result<void> RuntimeDisplays::Remove(std::uint32_t display_number) {
+  CF_EXPECT(vm_manager_.RemoveDisplay(config_, display_number));
+  displays_.erase(display_number);
+  LOG(INFO) << "Removed display " << display_number;
+  CF_EXPECT(NotifyStreamer("remove " + std::to_string(display_number)));
+  return {};
+}
+
+Result<void> RuntimeDisplays::NotifyStreamer(const std::string& message) const {
+  auto path = instance_.display_control_socket_path();
+  if (!FileExists(path)) {
+    // No streamer runs
+    return {};
+  }
+  auto streamer = SharedFD::SocketLocalClient(path, false, SOCK_STREAM);
+  CF_EXPECT(streamer->IsOpen(), "Could not connect to the streamer at \""
+                                    << path << "\": " << streamer->StrError());
+  struct timeval timeout = {.tv_sec = 10, .tv_usec = 0};
+  CF_EXPECT(streamer->SetSockOpt(SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                                 sizeof(timeout)) == 0,
+            streamer->StrError());
+  auto line = message + "\n";
+  CF_EXPECT(WriteAll(streamer, line) == (ssize_t)line.size(),
+            "Could not write to the streamer: " << streamer->StrError());
+  std::string reply;
+  char c;
+  while (streamer->Read(&c, 1) == 1 && c != '\n') {
+    reply.push_back(c);
+  }
+  CF_EXPECT(reply == "OK", "The streamer could not \""
+                               << message << "\": "
+                               << (reply.empty() ? streamer->StrError()
+                                                 : reply));
+  return {};
+}
+
+}  // namespace cuttlefish
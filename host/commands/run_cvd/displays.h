@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstdint>
+#include <map>
+
+#include <json/json.h>
+
+#include "common/libs/utils/result.h"
+#include "host/libs/config/cuttlefish_config.h"
+#include "host/libs/vm_manager/vm_manager.h"
+
+namespace cuttlefish {
+
+// The displays of the running guest, which may be added, removed and resized
+// without restarting it. Every change is made to the VM first and then to the
+// streamer, when one runs, so clients see the new displays right away.
+class RuntimeDisplays {
+ public:
+  RuntimeDisplays(const CuttlefishConfig& config,
+                  const CuttlefishConfig::InstanceSpecific& instance,
+                  vm_manager::VmManager& vm_manager);
+
+  // Handles one of
+  //
+  //   {"action": "add", "width": W, "height": H, "dpi": D,
+  //    "refresh_rate_hz": R}
+  //   {"action": "remove", "display": N}
+  //   {"action": "resize", "display": N, "width": W, "height": H, "dpi": D,
+  //    "refresh_rate_hz": R}
+  //   {"action": "list"}
+  //
+  // where dpi and refresh_rate_hz are optional, and returns the displays
+  // afterwards as a list of {"display", "width", "height", "dpi",
+  // "refresh_rate_hz"} objects.
+  Result<Json::Value> Handle(const Json::Value& request);
+
+ private:
+  Result<CuttlefishConfig::DisplayConfig> ParseDisplayConfig(
+      const Json::Value& request,
+      const CuttlefishConfig::DisplayConfig& defaults) const;
+  Result<std::uint32_t> Add(const CuttlefishConfig::DisplayConfig& display);
+  Result<void> Remove(std::uint32_t display_number);
+  Result<void> NotifyStreamer(const std::string& message) const;
+
+  const CuttlefishConfig& config_;
+  const CuttlefishConfig::InstanceSpecific& instance_;
+  vm_manager::VmManager& vm_manager_;
+  std::map<std::uint32_t, CuttlefishConfig::DisplayConfig> displays_;
+};
+
+}  // namespace cuttlefish
@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/run_cvd/displays.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+namespace {
+
+using DisplayConfig = CuttlefishConfig::DisplayConfig;
+
+// Keeps its displays the way the VM numbers them, the lowest free number
+class FakeVmManager : public vm_manager::VmManager {
+ public:
+  bool IsSupported() override { return true; }
+  std::vector<std::string> ConfigureGraphics(
+      const CuttlefishConfig&) override {
+    return {};
+  }
+  std::string ConfigureBootDevices(int) override { return ""; }
+  std::vector<Command> StartCommands(const CuttlefishConfig&,
+                                     LogTeeCreator&) override {
+    return {};
+  }
+
+  Result<void> AddDisplay(const CuttlefishConfig&,
+                          const DisplayConfig& display) override {
+    if (fail_adds > 0) {
+      fail_adds--;
+      return CF_ERR("Failing as told");
+    }
+    std::uint32_t display_number = 0;
+    while (display_number < displays.size() &&
+           displays[display_number].width != 0) {
+      display_number++;
+    }
+    if (display_number == displays.size()) {
+      displays.emplace_back();
+    }
+    displays[display_number] = display;
+    return {};
+  }
+  Result<void> RemoveDisplay(const CuttlefishConfig&,
+                             std::uint32_t display_number) override {
+    CF_EXPECT(display_number < displays.size() &&
+              displays[display_number].width != 0);
+    displays[display_number].width = 0;
+    return {};
+  }
+
+  // Removed displays have a width of 0
+  std::vector<DisplayConfig> displays;
+  int fail_adds = 0;
+};
+
+class RuntimeDisplaysTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    // No streamer runs in the empty root directory
+    config_.set_root_dir(dir_.path);
+    std::vector<DisplayConfig> displays = {
+        {.width = 720, .height = 1280, .dpi = 320, .refresh_rate_hz = 60}};
+    config_.set_display_configs(displays);
+    vm_manager_.displays = displays;
+  }
+
+  Json::Value Request(const std::string& action) {
+    Json::Value request;
+    request["action"] = action;
+    return request;
+  }
+
+  TemporaryDir dir_;
+  CuttlefishConfig config_;
+  FakeVmManager vm_manager_;
+};
+
+TEST_F(RuntimeDisplaysTest, ListsTheConfiguredDisplays) {
+  const CuttlefishConfig& config = config_;
+  auto instance = config.ForInstance(1);
+  RuntimeDisplays displays(config, instance, vm_manager_);
+
+  auto list = displays.Handle(Request("list"));
+  ASSERT_TRUE(list.ok()) << list.error();
+  ASSERT_EQ(list->size(), 1u);
+  EXPECT_EQ((*list)[0]["display"].asUInt(), 0u);
+  EXPECT_EQ((*list)[0]["width"].asInt(), 720);
+  EXPECT_EQ((*list)[0]["height"].asInt(), 1280);
+}
+
+TEST_F(RuntimeDisplaysTest, AddsDisplaysLikeTheFirstOne) {
+  const CuttlefishConfig& config = config_;
+  auto instance = config.ForInstance(1);
+  RuntimeDisplays displays(config, instance, vm_manager_);
+
+  auto request = Request("add");
+  request["width"] = 1080;
+  auto list = displays.Handle(request);
+  ASSERT_TRUE(list.ok()) << list.error();
+  ASSERT_EQ(list->size(), 2u);
+  EXPECT_EQ((*list)[1]["display"].asUInt(), 1u);
+  EXPECT_EQ((*list)[1]["width"].asInt(), 1080);
+  EXPECT_EQ((*list)[1]["height"].asInt(), 1280);
+  EXPECT_EQ((*list)[1]["dpi"].asInt(), 320);
+  ASSERT_EQ(vm_manager_.displays.size(), 2u);
+  EXPECT_EQ(vm_manager_.displays[1].width, 1080);
+}
+
+TEST_F(RuntimeDisplaysTest, RefusesToRemoveTheLastDisplay) {
+  const CuttlefishConfig& config = config_;
+  auto instance = config.ForInstance(1);
+  RuntimeDisplays displays(config, instance, vm_manager_);
+
+  auto request = Request("remove");
+  request["display"] = 0;
+  EXPECT_FALSE(displays.Handle(request).ok());
+  EXPECT_EQ(vm_manager_.displays[0].width, 720);
+
+  auto add = Request("add");
+  ASSERT_TRUE(displays.Handle(add).ok());
+  auto list = displays.Handle(request);
+  ASSERT_TRUE(list.ok()) << list.error();
+  ASSERT_EQ(list->size(), 1u);
+  EXPECT_EQ((*list)[0]["display"].asUInt(), 1u);
+  EXPECT_EQ(vm_manager_.displays[0].width, 0);
+}
+
+TEST_F(RuntimeDisplaysTest, ResizesInPlace) {
+  const CuttlefishConfig& config = config_;
+  auto instance = config.ForInstance(1);
+  RuntimeDisplays displays(config, instance, vm_manager_);
+
+  auto request = Request("resize");
+  request["display"] = 0;
+  request["width"] = 1080;
+  request["height"] = 1920;
+  auto list = displays.Handle(request);
+  ASSERT_TRUE(list.ok()) << list.error();
+  ASSERT_EQ(list->size(), 1u);
+  EXPECT_EQ((*list)[0]["display"].asUInt(), 0u);
+  EXPECT_EQ((*list)[0]["width"].asInt(), 1080);
+  EXPECT_EQ((*list)[0]["height"].asInt(), 1920);
+  EXPECT_EQ(vm_manager_.displays[0].width, 1080);
+}
+
+TEST_F(RuntimeDisplaysTest, RestoresTheDisplayWhenResizingFails) {
+  const CuttlefishConfig& config = config_;
+  auto instance = config.ForInstance(1);
+  RuntimeDisplays displays(config, instance, vm_manager_);
+
+  auto request = Request("resize");
+  request["display"] = 0;
+  request["width"] = 1080;
+  vm_manager_.fail_adds = 1;
+  EXPECT_FALSE(displays.Handle(request).ok());
+
+  auto list = displays.Handle(Request("list"));
+  ASSERT_TRUE(list.ok()) << list.error();
+  ASSERT_EQ(list->size(), 1u);
+  EXPECT_EQ((*list)[0]["display"].asUInt(), 0u);
+  EXPECT_EQ((*list)[0]["width"].asInt(), 720);
+  EXPECT_EQ(vm_manager_.displays[0].width, 720);
+}
+
+TEST_F(RuntimeDisplaysTest, RefusesInvalidRequests) {
+  const CuttlefishConfig& config = config_;
+  auto instance = config.ForInstance(1);
+  RuntimeDisplays displays(config, instance, vm_manager_);
+
+  EXPECT_FALSE(displays.Handle(Json::Value()).ok());
+  EXPECT_FALSE(displays.Handle(Request("rotate")).ok());
+  auto remove = Request("remove");
+  remove["display"] = 3;
+  EXPECT_FALSE(displays.Handle(remove).ok());
+  auto add = Request("add");
+  add["width"] = -1;
+  EXPECT_FALSE(displays.Handle(add).ok());
+  ASSERT_EQ(vm_manager_.displays.size(), 1u);
+}
+
+}  // namespace
+}  // namespace cuttlefish
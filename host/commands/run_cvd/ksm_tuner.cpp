@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/run_cvd/ksm_tuner.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/environment.h"
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr char kKsmDir[] = "/sys/kernel/mm/ksm";
+
+Result<void> WriteKsmFile(const std::string& name, int value) {
+  auto path = std::string(kKsmDir) + "/" + name;
+  auto fd = SharedFD::Open(path, O_WRONLY);
+  CF_EXPECT(fd->IsOpen(), "Could not open " << path << ": " << fd->StrError());
+  auto text = std::to_string(value);
+  CF_EXPECT(WriteAll(fd, text) == (ssize_t)text.size(),
+            "Could not write " << text << " to " << path << ": "
+                               << fd->StrError());
+  return {};
+}
+
+// Booting instances, removing the records of run_cvd processes that died
+// without clearing them.
+int CountBooting(const std::string& booting_dir) {
+  int booting = 0;
+  for (const auto& name : DirectoryContents(booting_dir)) {
+    pid_t pid = 0;
+    if (!android::base::ParseInt(name, &pid)) {
+      continue;  // ".", ".." and the lock
+    }
+    if (kill(pid, 0) == 0 || errno == EPERM) {
+      booting++;
+    } else {
+      RemoveFile(booting_dir + "/" + name);
+    }
+  }
+  return booting;
+}
+
+}  // namespace
+
+KsmTuner::KsmTuner(int boot_pages_to_scan, int steady_pages_to_scan)
+    : boot_pages_to_scan_(boot_pages_to_scan),
+      steady_pages_to_scan_(steady_pages_to_scan),
+      booting_dir_(StringFromEnv("TMPDIR", "/tmp") + "/cuttlefish_ksm") {}
+
+Result<void> KsmTuner::Booting() { return CF_EXPECT(Update(true)); }
+
+Result<void> KsmTuner::Booted() { return CF_EXPECT(Update(false)); }
+
+Result<void> KsmTuner::Update(bool booting) {
+  CF_EXPECT(mkdir(booting_dir_.c_str(), 0755) == 0 || errno == EEXIST,
+            "Could not create " << booting_dir_ << ": " << strerror(errno));
+  // Serializes counting and writing the settings with the other instances
+  auto lock_path = booting_dir_ + "/lock";
+  auto lock = SharedFD::Open(lock_path, O_CREAT | O_RDWR, 0644);
+  CF_EXPECT(lock->IsOpen(),
+            "Could not open " << lock_path << ": " << lock->StrError());
+  CF_EXPECT(lock->Flock(LOCK_EX) == 0,
+            "Could not lock " << lock_path << ": " << lock->StrError());
+
+  auto record = booting_dir_ + "/" + std::to_string(getpid());
+  if (booting) {
+    auto created = SharedFD::Creat(record, 0644);
+    CF_EXPECT(created->IsOpen(),
+              "Could not create " << record << ": " << created->StrError());
+  } else if (FileExists(record)) {
+    CF_EXPECT(RemoveFile(record), "Could not remove " << record);
+  }
+
+  auto pages = CountBooting(booting_dir_) > 0 ? boot_pages_to_scan_
+                                               : steady_pages_to_scan_;
+  CF_EXPECT(WriteKsmFile("pages_to_scan", pages));
+  if (booting) {
+    // 1 runs KSM, 0 stops it and 2 unmerges everything, which is left alone
+    std::int32_t run = 0;
+    if (android::base::ParseInt(
+            android::base::Trim(ReadFile(std::string(kKsmDir) + "/run")),
+            &run) &&
+        run == 0) {
+      CF_EXPECT(WriteKsmFile("run", 1));
+    }
+  }
+  return {};
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+// Adjusts how fast the host's KSM scans for identical pages, which is host
+// wide state shared by every instance with guest memory merging. Booting
+// guests fill their memory with pages worth merging, so KSM scans fast while
+// any of them boots and slowly once all of them booted, to save CPU time.
+//
+// Each booting instance is recorded by a file in a directory shared by the
+// run_cvd processes of the host, and records of processes that went away are
+// ignored. Writing to /sys/kernel/mm/ksm usually needs root, without it the
+// current settings are kept.
+class KsmTuner {
+ public:
+  KsmTuner(int boot_pages_to_scan, int steady_pages_to_scan);
+
+  // The guest of this run_cvd started booting, or rebooting.
+  Result<void> Booting();
+  // The guest booted, failed to boot or stopped.
+  Result<void> Booted();
+
+ private:
+  Result<void> Update(bool booting);
+
+  int boot_pages_to_scan_;
+  int steady_pages_to_scan_;
+  std::string booting_dir_;
+};
+
+}  // namespace cuttlefish
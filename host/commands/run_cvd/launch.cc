@@ -17,6 +17,10 @@
 
 #include <android-base/logging.h>
 
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <thread>
 #include <unordered_set>
 #include <utility>
 #include <vector>
@@ -32,6 +36,7 @@
 #include "host/libs/config/cuttlefish_config.h"
 #include "host/libs/config/inject.h"
 #include "host/libs/config/known_paths.h"
+#include "host/libs/config/log_tee_creator.h"
 #include "host/libs/vm_manager/crosvm_builder.h"
 #include "host/libs/vm_manager/crosvm_manager.h"
 #include "host/libs/vm_manager/vm_manager.h"
@@ -49,6 +54,18 @@ std::vector<T> single_element_emplace(T&& element) {
   return vec;
 }
 
+// Polls `ready` until it returns true or `timeout` runs out.
+Result<void> WaitFor(const std::function<bool()>& ready,
+                     std::chrono::seconds timeout) {
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  while (!ready()) {
+    CF_EXPECT(std::chrono::steady_clock::now() < deadline,
+              "Timed out after " << timeout.count() << " seconds");
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return {};
+}
+
 }  // namespace
 
 class KernelLogMonitor : public CommandSource,
@@ -111,7 +128,7 @@ class KernelLogMonitor : public CommandSource,
               "Unable to open \"" << log_name << "\": " << fifo_->StrError());
 
     // TODO(schuffelen): Find a way to calculate this dynamically.
-    int number_of_event_pipes = 4;
+    int number_of_event_pipes = 5;
     if (number_of_event_pipes > 0) {
       for (unsigned int i = 0; i < number_of_event_pipes; ++i) {
         SharedFD event_pipe_write_end, event_pipe_read_end;
@@ -130,32 +147,6 @@ class KernelLogMonitor : public CommandSource,
   std::vector<SharedFD> event_pipe_read_ends_;
 };
 
-class LogTeeCreator {
- public:
-  INJECT(LogTeeCreator(const CuttlefishConfig::InstanceSpecific& instance))
-      : instance_(instance) {}
-
-  Command CreateLogTee(Command& cmd, const std::string& process_name) {
-    auto name_with_ext = process_name + "_logs.fifo";
-    auto logs_path = instance_.PerInstanceInternalPath(name_with_ext.c_str());
-    auto logs = SharedFD::Fifo(logs_path, 0666);
-    if (!logs->IsOpen()) {
-      LOG(FATAL) << "Failed to create fifo for " << process_name
-                 << " output: " << logs->StrError();
-    }
-
-    cmd.RedirectStdIO(Subprocess::StdIOChannel::kStdOut, logs);
-    cmd.RedirectStdIO(Subprocess::StdIOChannel::kStdErr, logs);
-
-    return Command(HostBinaryPath("log_tee"))
-        .AddParameter("--process_name=", process_name)
-        .AddParameter("--log_fd_in=", logs);
-  }
-
- private:
-  const CuttlefishConfig::InstanceSpecific& instance_;
-};
-
 class RootCanal : public CommandSource {
  public:
   INJECT(RootCanal(const CuttlefishConfig& config,
@@ -183,10 +174,8 @@ class RootCanal : public CommandSource {
     command.AddParameter("--default_commands_file=",
                          config_.rootcanal_default_commands_file());
 
-    std::vector<Command> commands;
-    commands.emplace_back(log_tee_.CreateLogTee(command, "rootcanal"));
-    commands.emplace_back(std::move(command));
-    return commands;
+    log_tee_.CreateLogTee(command, "rootcanal");
+    return single_element_emplace(std::move(command));
   }
 
   // SetupFeature
@@ -195,6 +184,16 @@ class RootCanal : public CommandSource {
     return config_.enable_host_bluetooth() && instance_.start_rootcanal();
   }
 
+  Result<void> WaitUntilReady() override {
+    // The test port takes connections without affecting the controller
+    auto port = config_.rootcanal_test_port();
+    auto listening = [port]() {
+      return SharedFD::SocketLocalClient(port, SOCK_STREAM)->IsOpen();
+    };
+    CF_EXPECT(WaitFor(listening, std::chrono::seconds(30)));
+    return {};
+  }
+
  private:
   std::unordered_set<SetupFeature*> Dependencies() const override { return {}; }
   bool Setup() override { return true; }
@@ -204,46 +203,6 @@ class RootCanal : public CommandSource {
   LogTeeCreator& log_tee_;
 };
 
-class LogcatReceiver : public CommandSource, public DiagnosticInformation {
- public:
-  INJECT(LogcatReceiver(const CuttlefishConfig::InstanceSpecific& instance))
-      : instance_(instance) {}
-  // DiagnosticInformation
-  std::vector<std::string> Diagnostics() const override {
-    return {"Logcat output: " + instance_.logcat_path()};
-  }
-
-  // CommandSource
-  std::vector<Command> Commands() override {
-    return single_element_emplace(
-        Command(LogcatReceiverBinary()).AddParameter("-log_pipe_fd=", pipe_));
-  }
-
-  // SetupFeature
-  std::string Name() const override { return "LogcatReceiver"; }
-  bool Enabled() const override { return true; }
-
- private:
-  std::unordered_set<SetupFeature*> Dependencies() const override { return {}; }
-  Result<void> ResultSetup() {
-    auto log_name = instance_.logcat_pipe_name();
-    CF_EXPECT(mkfifo(log_name.c_str(), 0600) == 0,
-              "Unable to create named pipe at " << log_name << ": "
-                                                << strerror(errno));
-    // Open the pipe here (from the launcher) to ensure the pipe is not deleted
-    // due to the usage counters in the kernel reaching zero. If this is not
-    // done and the logcat_receiver crashes for some reason the VMM may get
-    // SIGPIPE.
-    pipe_ = SharedFD::Open(log_name.c_str(), O_RDWR);
-    CF_EXPECT(pipe_->IsOpen(),
-              "Can't open \"" << log_name << "\": " << pipe_->StrError());
-    return {};
-  }
-
-  const CuttlefishConfig::InstanceSpecific& instance_;
-  SharedFD pipe_;
-};
-
 class ConfigServer : public CommandSource {
  public:
   INJECT(ConfigServer(const CuttlefishConfig::InstanceSpecific& instance))
@@ -275,26 +234,49 @@ class ConfigServer : public CommandSource {
   SharedFD socket_;
 };
 
-class TombstoneReceiver : public CommandSource {
+// Receives logcat and tombstones from the guest in a single process.
+class GuestDiagnosticsReceiver : public CommandSource,
+                                 public DiagnosticInformation {
  public:
-  INJECT(TombstoneReceiver(const CuttlefishConfig::InstanceSpecific& instance))
-      : instance_(instance) {}
+  INJECT(GuestDiagnosticsReceiver(
+      const CuttlefishConfig& config,
+      const CuttlefishConfig::InstanceSpecific& instance))
+      : config_(config), instance_(instance) {}
+  // DiagnosticInformation
+  std::vector<std::string> Diagnostics() const override {
+    return {"Logcat output: " + instance_.logcat_path()};
+  }
 
   // CommandSource
   std::vector<Command> Commands() override {
-    return single_element_emplace(
-        Command(TombstoneReceiverBinary())
-            .AddParameter("-server_fd=", socket_)
-            .AddParameter("-tombstone_dir=", tombstone_dir_));
+    Command command(GuestDiagnosticsReceiverBinary());
+    command.AddParameter("-log_pipe_fd=", pipe_);
+    command.AddParameter("-server_fd=", socket_);
+    command.AddParameter("-tombstone_dir=", tombstone_dir_);
+    if (config_.compress_tombstones()) {
+      command.AddParameter("-compress_tombstones");
+    }
+    return single_element_emplace(std::move(command));
   }
 
   // SetupFeature
-  std::string Name() const override { return "TombstoneReceiver"; }
+  std::string Name() const override { return "GuestDiagnosticsReceiver"; }
   bool Enabled() const override { return true; }
 
  private:
   std::unordered_set<SetupFeature*> Dependencies() const override { return {}; }
   Result<void> ResultSetup() override {
+    auto log_name = instance_.logcat_pipe_name();
+    CF_EXPECT(mkfifo(log_name.c_str(), 0600) == 0,
+              "Unable to create named pipe at " << log_name << ": "
+                                                << strerror(errno));
+    // Open the pipe here (from the launcher) to ensure the pipe is not deleted
+    // due to the usage counters in the kernel reaching zero. If this is not
+    // done and the receiver crashes for some reason the VMM may get SIGPIPE.
+    pipe_ = SharedFD::Open(log_name.c_str(), O_RDWR);
+    CF_EXPECT(pipe_->IsOpen(),
+              "Can't open \"" << log_name << "\": " << pipe_->StrError());
+
     tombstone_dir_ = instance_.PerInstancePath("tombstones");
     if (!DirectoryExists(tombstone_dir_)) {
       LOG(DEBUG) << "Setting up " << tombstone_dir_;
@@ -311,7 +293,9 @@ class TombstoneReceiver : public CommandSource {
     return {};
   }
 
+  const CuttlefishConfig& config_;
   const CuttlefishConfig::InstanceSpecific& instance_;
+  SharedFD pipe_;
   SharedFD socket_;
   std::string tombstone_dir_;
 };
@@ -404,8 +388,9 @@ class GnssGrpcProxyServer : public CommandSource {
 class BluetoothConnector : public CommandSource {
  public:
   INJECT(BluetoothConnector(const CuttlefishConfig& config,
-                            const CuttlefishConfig::InstanceSpecific& instance))
-      : config_(config), instance_(instance) {}
+                            const CuttlefishConfig::InstanceSpecific& instance,
+                            RootCanal& root_canal))
+      : config_(config), instance_(instance), root_canal_(root_canal) {}
 
   // CommandSource
   std::vector<Command> Commands() override {
@@ -422,6 +407,10 @@ class BluetoothConnector : public CommandSource {
   std::string Name() const override { return "BluetoothConnector"; }
   bool Enabled() const override { return config_.enable_host_bluetooth(); }
 
+  std::unordered_set<CommandSource*> StartDependencies() const override {
+    return {&root_canal_};
+  }
+
  private:
   std::unordered_set<SetupFeature*> Dependencies() const override { return {}; }
   Result<void> ResultSetup() {
@@ -443,6 +432,7 @@ class BluetoothConnector : public CommandSource {
  private:
   const CuttlefishConfig& config_;
   const CuttlefishConfig::InstanceSpecific& instance_;
+  RootCanal& root_canal_;
   std::vector<SharedFD> fifos_;
 };
 
@@ -641,10 +631,8 @@ class WmediumdServer : public CommandSource {
     cmd.AddParameter("-a", config_.wmediumd_api_server_socket());
     cmd.AddParameter("-c", config_path_);
 
-    std::vector<Command> commands;
-    commands.emplace_back(log_tee_.CreateLogTee(cmd, "wmediumd"));
-    commands.emplace_back(std::move(cmd));
-    return commands;
+    log_tee_.CreateLogTee(cmd, "wmediumd");
+    return single_element_emplace(std::move(cmd));
   }
 
   // SetupFeature
@@ -657,6 +645,14 @@ class WmediumdServer : public CommandSource {
 #endif
   }
 
+  Result<void> WaitUntilReady() override {
+    // The VMs connect to the vhost-user socket wmediumd creates
+    auto socket = config_.vhost_user_mac80211_hwsim();
+    auto created = [&socket]() { return FileExists(socket); };
+    CF_EXPECT(WaitFor(created, std::chrono::seconds(30)));
+    return {};
+  }
+
  private:
   std::unordered_set<SetupFeature*> Dependencies() const override { return {}; }
   Result<void> ResultSetup() override {
@@ -685,34 +681,125 @@ class WmediumdServer : public CommandSource {
   std::string config_path_;
 };
 
+// Device backends the crosvm VM process connects to when it starts
+class VhostUserBackends : public CommandSource {
+ public:
+  INJECT(VhostUserBackends(const CuttlefishConfig& config,
+                           LogTeeCreator& log_tee))
+      : config_(config), log_tee_(log_tee) {}
+
+  // CommandSource
+  std::vector<Command> Commands() override {
+    return vm_manager::CrosvmManager::VhostUserCommands(config_, log_tee_);
+  }
+
+  // SetupFeature
+  std::string Name() const override { return "VhostUserBackends"; }
+  bool Enabled() const override {
+    return config_.vm_manager() == vm_manager::CrosvmManager::name() &&
+           (config_.vhost_user_block() || config_.vhost_user_gpu());
+  }
+
+  Result<void> WaitUntilReady() override {
+    auto sockets = vm_manager::CrosvmManager::VhostUserSockets(config_);
+    auto created = [&sockets]() {
+      return std::all_of(sockets.begin(), sockets.end(),
+                         [](const auto& socket) { return FileExists(socket); });
+    };
+    CF_EXPECT(WaitFor(created, std::chrono::seconds(30)));
+    return {};
+  }
+
+ private:
+  std::unordered_set<SetupFeature*> Dependencies() const override { return {}; }
+  Result<void> ResultSetup() override {
+    // Left behind by a previous run, they would look ready right away
+    for (const auto& socket :
+         vm_manager::CrosvmManager::VhostUserSockets(config_)) {
+      CF_EXPECT(!FileExists(socket) || RemoveFile(socket),
+                "Could not remove " << socket);
+    }
+    return {};
+  }
+
+  const CuttlefishConfig& config_;
+  LogTeeCreator& log_tee_;
+};
+
 class VmmCommands : public CommandSource {
  public:
-  INJECT(VmmCommands(const CuttlefishConfig& config, VmManager& vmm))
-      : config_(config), vmm_(vmm) {}
+  INJECT(VmmCommands(const CuttlefishConfig& config, VmManager& vmm,
+                     LogTeeCreator& log_tee, WmediumdServer& wmediumd,
+                     VhostUserBackends& vhost_user_backends))
+      : config_(config),
+        vmm_(vmm),
+        log_tee_(log_tee),
+        wmediumd_(wmediumd),
+        vhost_user_backends_(vhost_user_backends) {}
 
   // CommandSource
   std::vector<Command> Commands() override {
-    return vmm_.StartCommands(config_);
+    return vmm_.StartCommands(config_, log_tee_);
   }
 
   // SetupFeature
   std::string Name() const override { return "VirtualMachineManager"; }
   bool Enabled() const override { return true; }
 
+  std::unordered_set<CommandSource*> StartDependencies() const override {
+    return {&wmediumd_, &vhost_user_backends_};
+  }
+
  private:
   std::unordered_set<SetupFeature*> Dependencies() const override { return {}; }
   bool Setup() override { return true; }
 
   const CuttlefishConfig& config_;
   VmManager& vmm_;
+  LogTeeCreator& log_tee_;
+  WmediumdServer& wmediumd_;
+  VhostUserBackends& vhost_user_backends_;
+};
+
+class BalloonController : public CommandSource {
+ public:
+  INJECT(BalloonController(const CuttlefishConfig& config,
+                           VmmCommands& vmm_commands))
+      : config_(config), vmm_commands_(vmm_commands) {}
+
+  // CommandSource
+  std::vector<Command> Commands() override {
+    return single_element_emplace(Command(BalloonControllerBinary()));
+  }
+
+  // SetupFeature
+  std::string Name() const override { return "BalloonController"; }
+  bool Enabled() const override {
+    return config_.enable_memory_balloon() &&
+           config_.vm_manager() == vm_manager::CrosvmManager::name();
+  }
+
+  std::unordered_set<CommandSource*> StartDependencies() const override {
+    return {&vmm_commands_};
+  }
+
+ private:
+  std::unordered_set<SetupFeature*> Dependencies() const override { return {}; }
+  bool Setup() override { return true; }
+
+  const CuttlefishConfig& config_;
+  VmmCommands& vmm_commands_;
 };
 
 class OpenWrt : public CommandSource {
  public:
   INJECT(OpenWrt(const CuttlefishConfig& config,
                  const CuttlefishConfig::InstanceSpecific& instance,
-                 LogTeeCreator& log_tee))
-      : config_(config), instance_(instance), log_tee_(log_tee) {}
+                 LogTeeCreator& log_tee, WmediumdServer& wmediumd))
+      : config_(config),
+        instance_(instance),
+        log_tee_(log_tee),
+        wmediumd_(wmediumd) {}
 
   // CommandSource
   std::vector<Command> Commands() override {
@@ -764,10 +851,8 @@ class OpenWrt : public CommandSource {
 
     ap_cmd.Cmd().AddParameter(config_.ap_kernel_image());
 
-    std::vector<Command> commands;
-    commands.emplace_back(log_tee_.CreateLogTee(ap_cmd.Cmd(), "openwrt"));
-    commands.emplace_back(std::move(ap_cmd.Cmd()));
-    return commands;
+    log_tee_.CreateLogTee(ap_cmd.Cmd(), "openwrt");
+    return single_element_emplace(std::move(ap_cmd.Cmd()));
   }
 
   // SetupFeature
@@ -781,6 +866,10 @@ class OpenWrt : public CommandSource {
 #endif
   }
 
+  std::unordered_set<CommandSource*> StartDependencies() const override {
+    return {&wmediumd_};
+  }
+
  private:
   std::unordered_set<SetupFeature*> Dependencies() const override { return {}; }
   bool Setup() override { return true; }
@@ -788,6 +877,7 @@ class OpenWrt : public CommandSource {
   const CuttlefishConfig& config_;
   const CuttlefishConfig::InstanceSpecific& instance_;
   LogTeeCreator& log_tee_;
+  WmediumdServer& wmediumd_;
 };
 
 using PublicDeps = fruit::Required<const CuttlefishConfig, VmManager,
@@ -801,17 +891,18 @@ fruit::Component<PublicDeps, KernelLogPipeProvider> launchComponent() {
       Multi::Bases<CommandSource, DiagnosticInformation, SetupFeature>;
   return fruit::createComponent()
       .bind<KernelLogPipeProvider, KernelLogMonitor>()
+      .install(Bases::Impls<BalloonController>)
       .install(Bases::Impls<BluetoothConnector>)
       .install(Bases::Impls<ConfigServer>)
       .install(Bases::Impls<ConsoleForwarder>)
       .install(Bases::Impls<GnssGrpcProxyServer>)
+      .install(Bases::Impls<GuestDiagnosticsReceiver>)
       .install(Bases::Impls<KernelLogMonitor>)
-      .install(Bases::Impls<LogcatReceiver>)
       .install(Bases::Impls<MetricsService>)
       .install(Bases::Impls<RootCanal>)
       .install(Bases::Impls<SecureEnvironment>)
-      .install(Bases::Impls<TombstoneReceiver>)
       .install(Bases::Impls<VehicleHalServer>)
+      .install(Bases::Impls<VhostUserBackends>)
       .install(Bases::Impls<VmmCommands>)
       .install(Bases::Impls<WmediumdServer>)
       .install(Bases::Impls<OpenWrt>);
@@ -105,6 +105,10 @@ class StreamerSockets : public virtual SetupFeature {
     if (config_.enable_audio()) {
       cmd.AddParameter("--audio_server_fd=", audio_server_);
     }
+    if (config_.enable_screenshot_socket()) {
+      cmd.AddParameter("--screenshot_server_fd=", screenshot_server_);
+    }
+    cmd.AddParameter("--display_control_server_fd=", display_control_server_);
   }
 
   // SetupFeature
@@ -143,6 +147,15 @@ class StreamerSockets : public virtual SetupFeature {
           SharedFD::SocketLocalServer(path, false, SOCK_SEQPACKET, 0666);
       CF_EXPECT(audio_server_->IsOpen(), audio_server_->StrError());
     }
+    if (config_.enable_screenshot_socket()) {
+      screenshot_server_ = SharedFD::SocketLocalServer(
+          instance_.screenshot_socket_path(), false, SOCK_STREAM, 0666);
+      CF_EXPECT(screenshot_server_->IsOpen(), screenshot_server_->StrError());
+    }
+    display_control_server_ = SharedFD::SocketLocalServer(
+        instance_.display_control_socket_path(), false, SOCK_STREAM, 0600);
+    CF_EXPECT(display_control_server_->IsOpen(),
+              display_control_server_->StrError());
     return {};
   }
 
@@ -152,6 +165,8 @@ class StreamerSockets : public virtual SetupFeature {
   SharedFD keyboard_server_;
   SharedFD frames_server_;
   SharedFD audio_server_;
+  SharedFD screenshot_server_;
+  SharedFD display_control_server_;
 };
 
 class WebRtcServer : public virtual CommandSource,
@@ -22,6 +22,7 @@
 
 #include <fstream>
 #include <memory>
+#include <optional>
 #include <string>
 #include <utility>
 #include <vector>
@@ -34,17 +35,23 @@
 #include "common/libs/utils/subprocess.h"
 #include "common/libs/utils/tee_logging.h"
 #include "host/commands/run_cvd/boot_state_machine.h"
+#include "host/commands/run_cvd/cgroup_accounting.h"
 #include "host/commands/run_cvd/launch.h"
 #include "host/commands/run_cvd/process_monitor.h"
 #include "host/commands/run_cvd/reporting.h"
 #include "host/commands/run_cvd/runner_defs.h"
 #include "host/commands/run_cvd/server_loop.h"
+#include "host/commands/run_cvd/snapshot.h"
+#include "host/commands/run_cvd/status_reporter.h"
 #include "host/commands/run_cvd/validate.h"
 #include "host/libs/config/adb/adb.h"
 #include "host/libs/config/config_flag.h"
 #include "host/libs/config/config_fragment.h"
 #include "host/libs/config/custom_actions.h"
 #include "host/libs/config/cuttlefish_config.h"
+#include "host/libs/config/log_tee_creator.h"
+#include "host/libs/vm_manager/cpu_placement.h"
+#include "host/libs/vm_manager/crosvm_manager.h"
 #include "host/libs/vm_manager/vm_manager.h"
 
 namespace cuttlefish {
@@ -100,7 +107,7 @@ class CuttlefishEnvironment : public SetupFeature,
   const CuttlefishConfig::InstanceSpecific& instance_;
 };
 
-fruit::Component<ServerLoop> runCvdComponent(
+fruit::Component<ServerLoop, LogTeeCreator> runCvdComponent(
     const CuttlefishConfig* config,
     const CuttlefishConfig::InstanceSpecific* instance) {
   return fruit::createComponent()
@@ -118,6 +125,8 @@ fruit::Component<ServerLoop> runCvdComponent(
       .install(launchModemComponent)
       .install(launchStreamerComponent)
       .install(serverLoopComponent)
+      .install(snapshotRestoreComponent)
+      .install(statusReporterComponent)
       .install(validationComponent)
       .install(vm_manager::VmManagerComponent);
 }
@@ -194,7 +203,25 @@ Result<void> RunCvdMain(int argc, char** argv) {
   ConfigureLogs(*config, instance);
   CF_EXPECT(ChdirIntoRuntimeDir(instance));
 
-  fruit::Injector<ServerLoop> injector(runCvdComponent, config, &instance);
+  // Before any threads start, so the host processes and the VMM inherit it
+  if (instance.numa_node() >= 0) {
+    CF_EXPECT(vm_manager::BindToNumaNode(instance.numa_node()));
+  }
+
+  std::optional<CgroupAccounting> cgroups;
+  if (config->resource_accounting()) {
+    auto accounting = CgroupAccounting::Create(
+        instance.instance_name(), config->host_process_cgroups());
+    if (accounting.ok()) {
+      cgroups = std::move(*accounting);
+    } else {
+      LOG(WARNING) << "Not accounting for host process resources:\n"
+                   << accounting.error();
+    }
+  }
+
+  fruit::Injector<ServerLoop, LogTeeCreator> injector(runCvdComponent, config,
+                                                      &instance);
 
   for (auto& fragment : injector.getMultibindings<ConfigFragment>()) {
     CF_EXPECT(config->LoadFragment(*fragment));
@@ -209,14 +236,33 @@ Result<void> RunCvdMain(int argc, char** argv) {
 
   // Monitor and restart host processes supporting the CVD
   ProcessMonitor::Properties process_monitor_properties;
+  // A restarted VMM would resume the snapshot again, with memory that no
+  // longer matches the disks
   process_monitor_properties.RestartSubprocesses(
-      config->restart_subprocesses());
+      config->restart_subprocesses() && config->snapshot_path().empty());
+
+  process_monitor_properties.BootTimelinePath(instance.boot_timeline_path());
+  process_monitor_properties.LaunchedProcessesPath(
+      instance.launched_processes_path());
+  if (cgroups) {
+    process_monitor_properties.Cgroups(std::move(*cgroups));
+  }
+  if (config->guest_memory_merge() &&
+      config->vm_manager() == vm_manager::CrosvmManager::name()) {
+    // crosvm has no option for it, qemu advises its memory itself
+    process_monitor_properties.MergeableMemory(
+        {cpp_basename(config->crosvm_binary())});
+  }
 
   for (auto& command_source : injector.getMultibindings<CommandSource>()) {
     if (command_source->Enabled()) {
-      process_monitor_properties.AddCommands(command_source->Commands());
+      process_monitor_properties.AddCommandSource(*command_source);
     }
   }
+  // After every source created its log fifos. Plain commands start before the
+  // sources, so nothing blocks on a full fifo.
+  process_monitor_properties.AddCommand(
+      injector.get<LogTeeCreator&>().AggregatorCommand());
 
   ProcessMonitor process_monitor(std::move(process_monitor_properties));
 
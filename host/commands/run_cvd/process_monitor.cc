@@ -17,8 +17,11 @@
 #include "host/commands/run_cvd/process_monitor.h"
 
 #include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
 #include <assert.h>
 #include <errno.h>
@@ -26,20 +29,41 @@
 #include <stdio.h>
 
 #include <algorithm>
-#include <future>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <optional>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+#include <json/json.h>
 
 #include "common/libs/fs/shared_buf.h"
 #include "common/libs/fs/shared_select.h"
+#include "common/libs/utils/files.h"
+#include "host/libs/config/boot_timeline.h"
+#include "host/libs/config/launched_processes.h"
 
 namespace cuttlefish {
 
 struct ParentToChildMessage {
-  bool stop;
+  bool stop = false;
+  // Answered with a std::uint32_t length and the ProcessStatus json
+  bool status = false;
 };
 
+// Bounds of the delay before restarting a process that keeps exiting
+constexpr auto kMinRestartDelay = std::chrono::milliseconds(100);
+constexpr auto kMaxRestartDelay = std::chrono::seconds(30);
+// Running this long resets the restart delay
+constexpr auto kStableRunTime = std::chrono::seconds(60);
+// Orphaned descendants don't have a pidfd, this is how late they get reaped
+constexpr int kReapIntervalMs = 5000;
+
 ProcessMonitor::Properties& ProcessMonitor::Properties::RestartSubprocesses(
     bool r) & {
   restart_subprocesses_ = r;
@@ -66,10 +90,75 @@ ProcessMonitor::Properties ProcessMonitor::Properties::AddCommand(
   return std::move(*this);
 }
 
+ProcessMonitor::Properties& ProcessMonitor::Properties::AddCommandSource(
+    CommandSource& source) & {
+  for (auto& cmd : source.Commands()) {
+    AddCommand(std::move(cmd));
+    entries_.back().source = &source;
+  }
+  sources_.push_back(&source);
+  return *this;
+}
+
+ProcessMonitor::Properties ProcessMonitor::Properties::AddCommandSource(
+    CommandSource& source) && {
+  AddCommandSource(source);
+  return std::move(*this);
+}
+
+ProcessMonitor::Properties& ProcessMonitor::Properties::BootTimelinePath(
+    std::string path) & {
+  boot_timeline_path_ = std::move(path);
+  return *this;
+}
+
+ProcessMonitor::Properties ProcessMonitor::Properties::BootTimelinePath(
+    std::string path) && {
+  boot_timeline_path_ = std::move(path);
+  return std::move(*this);
+}
+
+ProcessMonitor::Properties&
+ProcessMonitor::Properties::LaunchedProcessesPath(std::string path) & {
+  launched_processes_path_ = std::move(path);
+  return *this;
+}
+
+ProcessMonitor::Properties
+ProcessMonitor::Properties::LaunchedProcessesPath(std::string path) && {
+  launched_processes_path_ = std::move(path);
+  return std::move(*this);
+}
+
+ProcessMonitor::Properties& ProcessMonitor::Properties::Cgroups(
+    CgroupAccounting cgroups) & {
+  cgroups_ = std::move(cgroups);
+  return *this;
+}
+
+ProcessMonitor::Properties ProcessMonitor::Properties::Cgroups(
+    CgroupAccounting cgroups) && {
+  cgroups_ = std::move(cgroups);
+  return std::move(*this);
+}
+
+ProcessMonitor::Properties& ProcessMonitor::Properties::MergeableMemory(
+    std::set<std::string> executables) & {
+  mergeable_executables_ = std::move(executables);
+  return *this;
+}
+
+ProcessMonitor::Properties ProcessMonitor::Properties::MergeableMemory(
+    std::set<std::string> executables) && {
+  mergeable_executables_ = std::move(executables);
+  return std::move(*this);
+}
+
 ProcessMonitor::ProcessMonitor(ProcessMonitor::Properties&& properties)
     : properties_(std::move(properties)), monitor_(-1) {}
 
 Result<void> ProcessMonitor::StopMonitoredProcesses() {
+  std::lock_guard lock(monitor_socket_mutex_);
   CF_EXPECT(monitor_ != -1, "The monitor process has already exited.");
   CF_EXPECT(monitor_socket_->IsOpen(), "The monitor socket is already closed");
   ParentToChildMessage message;
@@ -91,12 +180,46 @@ Result<void> ProcessMonitor::StopMonitoredProcesses() {
   return {};
 }
 
+Result<std::string> ProcessMonitor::ProcessStatus() {
+  std::lock_guard lock(monitor_socket_mutex_);
+  CF_EXPECT(monitor_ != -1, "The monitor process has already exited.");
+  CF_EXPECT(monitor_socket_->IsOpen(), "The monitor socket is already closed");
+  ParentToChildMessage message;
+  message.status = true;
+  CF_EXPECT(WriteAllBinary(monitor_socket_, &message) == sizeof(message),
+            "Failed to communicate with monitor socket: "
+                << monitor_socket_->StrError());
+  std::uint32_t size = 0;
+  CF_EXPECT(ReadExactBinary(monitor_socket_, &size) == sizeof(size),
+            "Failed to read the status size: " << monitor_socket_->StrError());
+  std::string status(size, '\0');
+  CF_EXPECT(ReadExact(monitor_socket_, &status) == (ssize_t)size,
+            "Failed to read the status: " << monitor_socket_->StrError());
+  return status;
+}
+
+Result<std::vector<CgroupUsage>> ProcessMonitor::CgroupStatus() const {
+  CF_EXPECT(properties_.cgroups_.has_value(),
+            "The commands don't run in cgroups");
+  return CF_EXPECT(properties_.cgroups_->Usage());
+}
+
+Result<void> ProcessMonitor::RemoveCgroups() {
+  std::lock_guard lock(monitor_socket_mutex_);
+  CF_EXPECT(monitor_ == -1, "The monitored processes are still running");
+  if (properties_.cgroups_) {
+    CF_EXPECT(properties_.cgroups_->Remove());
+  }
+  return {};
+}
+
 Result<void> ProcessMonitor::StartAndMonitorProcesses() {
   CF_EXPECT(monitor_ == -1, "The monitor process was already started");
   CF_EXPECT(!monitor_socket_->IsOpen(), "Monitor socket was already opened");
 
   SharedFD client_pipe, host_pipe;
-  CF_EXPECT(SharedFD::Pipe(&client_pipe, &host_pipe),
+  CF_EXPECT(SharedFD::SocketPair(AF_UNIX, SOCK_STREAM, 0, &client_pipe,
+                                 &host_pipe),
             "Could not create the monitor socket.");
   monitor_ = fork();
   if (monitor_ == 0) {
@@ -143,72 +266,422 @@ static void LogSubprocessExit(const std::string& name, const siginfo_t& infop) {
   }
 }
 
-Result<void> ProcessMonitor::MonitorRoutine() {
-  // Make this process a subreaper to reliably catch subprocess exits.
-  // See https://man7.org/linux/man-pages/man2/prctl.2.html
-  prctl(PR_SET_CHILD_SUBREAPER, 1);
-  prctl(PR_SET_PDEATHSIG, SIGHUP); // Die when parent dies
+namespace {
 
-  LOG(DEBUG) << "Starting monitoring subprocesses";
-  for (auto& monitored : properties_.entries_) {
-    LOG(INFO) << monitored.cmd->GetShortName();
-    auto options = SubprocessOptions().InGroup(true);
-    monitored.proc.reset(new Subprocess(monitored.cmd->Start(options)));
-    CF_EXPECT(monitored.proc->Started(), "Failed to start process");
-  }
-
-  bool running = true;
-  auto policy = std::launch::async;
-  auto parent_comms = std::async(policy, [&running, this]() -> Result<void> {
-    LOG(DEBUG) << "Waiting for a `stop` message from the parent.";
-    while (running) {
-      ParentToChildMessage message;
-      CF_EXPECT(ReadExactBinary(monitor_socket_, &message) == sizeof(message),
-                "Could not read message from parent.");
-      if (message.stop) {
-        running = false;
-        // Wake up the wait() loop by giving it an exited child process
-        if (fork() == 0) {
-          std::exit(0);
-        }
+struct StartTiming {
+  std::string name;
+  BootTimeline::Clock::time_point started;
+  BootTimeline::Clock::time_point ready;
+};
+
+std::int64_t Millis(BootTimeline::Clock::duration duration) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(duration)
+      .count();
+}
+
+Result<void> StartEntry(MonitorEntry& entry) {
+  LOG(INFO) << entry.cmd->GetShortName();
+  auto options = SubprocessOptions()
+                     .InGroup(true)
+                     .Cgroup(entry.cgroup_procs)
+                     .MergeableMemory(entry.mergeable_memory);
+  entry.proc.reset(new Subprocess(entry.cmd->Start(options)));
+  CF_EXPECT(entry.proc->Started(), "Failed to start process");
+  entry.started = std::chrono::steady_clock::now();
+  entry.pidfd = SharedFD::PidFdOpen(entry.proc->pid());
+  CF_EXPECT(entry.pidfd->IsOpen(),
+            "pidfd_open failed: " << entry.pidfd->StrError());
+  return {};
+}
+
+std::chrono::microseconds ToMicros(const struct timeval& time) {
+  return std::chrono::seconds(time.tv_sec) +
+         std::chrono::microseconds(time.tv_usec);
+}
+
+struct ProcessUsage {
+  std::chrono::microseconds cpu_time{0};
+  std::int64_t rss_kb = 0;
+  // Resident pages that KSM merged with identical ones
+  std::int64_t ksm_merging_kb = 0;
+};
+
+// CPU time and memory of a running process, from /proc
+ProcessUsage ProcUsage(pid_t pid) {
+  auto proc = "/proc/" + std::to_string(pid);
+  std::chrono::microseconds cpu_time{0};
+  // The process name comes first and may contain spaces
+  auto stat = ReadFile(proc + "/stat");
+  auto name_end = stat.rfind(')');
+  if (name_end != std::string::npos) {
+    auto fields = android::base::Split(stat.substr(name_end + 2), " ");
+    // utime and stime, the 14th and 15th fields of the whole line
+    std::int64_t utime = 0, stime = 0;
+    if (fields.size() > 12 && android::base::ParseInt(fields[11], &utime) &&
+        android::base::ParseInt(fields[12], &stime)) {
+      auto ticks = sysconf(_SC_CLK_TCK);
+      cpu_time = std::chrono::microseconds((utime + stime) * 1000000 / ticks);
+    }
+  }
+  std::int64_t rss_kb = 0;
+  auto statm = android::base::Split(ReadFile(proc + "/statm"), " ");
+  std::int64_t rss_pages = 0;
+  if (statm.size() > 1 && android::base::ParseInt(statm[1], &rss_pages)) {
+    rss_kb = rss_pages * (sysconf(_SC_PAGESIZE) / 1024);
+  }
+  std::int64_t merging_pages = 0;
+  // Missing before Linux 6.1
+  if (!android::base::ParseInt(
+          android::base::Trim(ReadFile(proc + "/ksm_merging_pages")),
+          &merging_pages)) {
+    merging_pages = 0;
+  }
+  return {
+      .cpu_time = cpu_time,
+      .rss_kb = rss_kb,
+      .ksm_merging_kb = merging_pages * (sysconf(_SC_PAGESIZE) / 1024),
+  };
+}
+
+}  // namespace
+
+// Starts each source once the sources it depends on are ready. Only forking is
+// serialized, waiting for readiness happens in parallel.
+Result<void> ProcessMonitor::StartSubprocesses() {
+  auto& entries = properties_.entries_;
+  const auto& sources = properties_.sources_;
+  auto begin = BootTimeline::Clock::now();
+
+  for (auto& entry : entries) {
+    entry.mergeable_memory = properties_.mergeable_executables_.count(
+                                 cpp_basename(entry.cmd->GetShortName())) > 0;
+  }
+
+  if (properties_.cgroups_) {
+    for (auto& entry : entries) {
+      // GetShortName() is the path of the executable
+      auto name = cpp_basename(entry.cmd->GetShortName());
+      auto procs = properties_.cgroups_->GroupProcs(name);
+      if (procs.ok()) {
+        entry.cgroup_procs = *procs;
+      } else {
+        LOG(WARNING) << "Not accounting for " << name << ":\n"
+                     << procs.error();
       }
     }
+  }
+
+  for (auto& entry : entries) {
+    if (entry.source == nullptr) {
+      CF_EXPECT(StartEntry(entry));
+    }
+  }
+
+  std::unordered_set<CommandSource*> registered(sources.begin(), sources.end());
+  std::unordered_map<CommandSource*, std::size_t> pending;
+  std::unordered_map<CommandSource*, std::vector<CommandSource*>> dependents;
+  for (const auto& source : sources) {
+    pending[source] = 0;
+    for (const auto& dependency : source->StartDependencies()) {
+      if (registered.count(dependency) > 0) {
+        pending[source]++;
+        dependents[dependency].push_back(source);
+      }
+    }
+  }
+  // Check for cycles before starting anything
+  auto unvisited = pending;
+  std::deque<CommandSource*> visitable;
+  for (const auto& [source, count] : unvisited) {
+    if (count == 0) {
+      visitable.push_back(source);
+    }
+  }
+  std::size_t visited = 0;
+  for (; !visitable.empty(); visitable.pop_front(), visited++) {
+    for (const auto& dependent : dependents[visitable.front()]) {
+      if (--unvisited[dependent] == 0) {
+        visitable.push_back(dependent);
+      }
+    }
+  }
+  CF_EXPECT(visited == sources.size(), "Cycle in the start dependencies");
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::optional<Result<void>> failure;
+  std::vector<StartTiming> timeline;
+
+  auto start_source = [&](CommandSource* source) -> Result<void> {
+    std::unique_lock lock(mutex);
+    changed.wait(lock, [&]() { return pending[source] == 0 || failure; });
+    if (failure) {
+      return {};
+    }
+    auto started = BootTimeline::Clock::now();
+    for (auto& entry : entries) {
+      if (entry.source == source) {
+        CF_EXPECT(StartEntry(entry), "Could not start " << source->Name());
+      }
+    }
+    lock.unlock();
+
+    CF_EXPECT(source->WaitUntilReady(), source->Name() << " didn't get ready");
+    auto ready = BootTimeline::Clock::now();
+
+    lock.lock();
+    timeline.emplace_back(StartTiming{source->Name(), started, ready});
+    for (const auto& dependent : dependents[source]) {
+      pending[dependent]--;
+    }
+    changed.notify_all();
     return {};
-  });
+  };
 
-  auto& monitored = properties_.entries_;
+  std::vector<std::thread> threads;
+  for (const auto& source : sources) {
+    threads.emplace_back([&, source]() {
+      auto result = start_source(source);
+      if (!result.ok()) {
+        std::lock_guard lock(mutex);
+        if (!failure) {
+          failure = std::move(result);
+        }
+        changed.notify_all();
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  if (failure) {
+    CF_EXPECT(std::move(*failure));
+  }
 
-  LOG(DEBUG) << "Monitoring subprocesses";
-  while(running) {
+  std::sort(timeline.begin(), timeline.end(),
+            [](const auto& a, const auto& b) { return a.started < b.started; });
+  for (const auto& timing : timeline) {
+    LOG(DEBUG) << timing.name << " started after "
+               << Millis(timing.started - begin) << " ms, ready after "
+               << Millis(timing.ready - begin) << " ms";
+  }
+  if (!properties_.boot_timeline_path_.empty()) {
+    auto boot_timeline = BootTimeline::Open(properties_.boot_timeline_path_);
+    if (boot_timeline.ok()) {
+      for (const auto& timing : timeline) {
+        boot_timeline->AddSpan("launch", timing.name, timing.started,
+                               timing.ready);
+      }
+    } else {
+      LOG(WARNING) << "Could not open the boot timeline:\n"
+                   << boot_timeline.error();
+    }
+  }
+  return {};
+}
+
+// Reaps every exited child, including orphaned descendants
+Result<void> ProcessMonitor::ReapSubprocesses(Epoll& epoll) {
+  auto& monitored = properties_.entries_;
+  while (true) {
     int wstatus;
-    pid_t pid = wait(&wstatus);
-    int error_num = errno;
-    CF_EXPECT(pid != -1, "Wait failed: " << strerror(error_num));
+    struct rusage usage;
+    pid_t pid = wait4(-1, &wstatus, WNOHANG, &usage);
+    if (pid == 0 || (pid == -1 && errno == ECHILD)) {
+      return {};
+    }
+    CF_EXPECT(pid != -1, "Wait failed: " << strerror(errno));
     if (!WIFSIGNALED(wstatus) && !WIFEXITED(wstatus)) {
-      LOG(DEBUG) << "Unexpected status from wait: " << wstatus
-                  << " for pid " << pid;
+      LOG(DEBUG) << "Unexpected status from wait: " << wstatus << " for pid "
+                 << pid;
       continue;
     }
-    if (!running) { // Avoid extra restarts near the end
-      break;
-    }
-    auto matches = [pid](const auto& it) { return it.proc->pid() == pid; };
+    auto matches = [pid](const auto& it) {
+      return it.proc && it.proc->pid() == pid;
+    };
     auto it = std::find_if(monitored.begin(), monitored.end(), matches);
     if (it == monitored.end()) {
       LogSubprocessExit("(unknown)", pid, wstatus);
+      continue;
+    }
+    LogSubprocessExit(it->cmd->GetShortName(), pid, wstatus);
+    CF_EXPECT(epoll.Delete(it->pidfd));
+    if (!properties_.restart_subprocesses_) {
+      monitored.erase(it);
+      continue;
+    }
+    it->cpu_time += ToMicros(usage.ru_utime) + ToMicros(usage.ru_stime);
+    it->proc.reset();
+    it->pidfd = SharedFD();
+    auto now = std::chrono::steady_clock::now();
+    if (now - it->started >= kStableRunTime) {
+      it->quick_exits = 0;
+    }
+    auto delay = std::min<std::chrono::steady_clock::duration>(
+        kMinRestartDelay * (1 << std::min(it->quick_exits, 16)),
+        kMaxRestartDelay);
+    it->quick_exits++;
+    it->restart_at = now + delay;
+    LOG(INFO) << "Restarting " << it->cmd->GetShortName() << " in "
+              << Millis(delay) << " ms";
+  }
+}
+
+Result<void> ProcessMonitor::RestartDueSubprocesses(Epoll& epoll) {
+  auto now = std::chrono::steady_clock::now();
+  bool restarted = false;
+  for (auto& entry : properties_.entries_) {
+    if (!entry.restart_at || *entry.restart_at > now) {
+      continue;
+    }
+    entry.restart_at.reset();
+    entry.restarts++;
+    auto started = StartEntry(entry);
+    if (!started.ok()) {
+      LOG(ERROR) << "Failed to restart " << entry.cmd->GetShortName() << ":\n"
+                 << started.error();
+      if (entry.proc && entry.proc->Started()) {
+        // It would keep running unmonitored, and be started a second time
+        entry.proc->Stop();
+        siginfo_t infop;
+        entry.proc->Wait(&infop, WEXITED);
+      }
+      entry.proc.reset();
+      entry.pidfd = SharedFD();
+      entry.restart_at = now + kMaxRestartDelay;
+      continue;
+    }
+    restarted = true;
+    CF_EXPECT(epoll.Add(entry.pidfd, EPOLLIN));
+  }
+  if (restarted) {
+    RecordLaunchedProcesses();
+  }
+  return {};
+}
+
+// Runs in the monitor process, the parent is run_cvd
+void ProcessMonitor::RecordLaunchedProcesses() {
+  if (properties_.launched_processes_path_.empty()) {
+    return;
+  }
+  std::vector<LaunchedProcess> processes;
+  for (pid_t pid : {getppid(), getpid()}) {
+    processes.push_back(LaunchedProcess{
+        .name = pid == getpid() ? "process_monitor" : "run_cvd",
+        .pid = pid,
+        .start_time = ProcessStartTime(pid).value_or(0),
+    });
+  }
+  for (const auto& entry : properties_.entries_) {
+    if (!entry.proc || !entry.proc->Started()) {
+      continue;
+    }
+    auto start_time = ProcessStartTime(entry.proc->pid());
+    if (!start_time) {
+      continue;  // Already exited
+    }
+    processes.push_back(LaunchedProcess{
+        .name = cpp_basename(entry.cmd->GetShortName()),
+        .pid = entry.proc->pid(),
+        .start_time = *start_time,
+        // Started with SubprocessOptions::InGroup
+        .group_leader = true,
+    });
+  }
+  auto written =
+      WriteLaunchedProcesses(properties_.launched_processes_path_, processes);
+  if (!written.ok()) {
+    LOG(WARNING) << "Could not record the launched processes:\n"
+                 << written.error();
+  }
+}
+
+int ProcessMonitor::NextTimeoutMs() const {
+  auto timeout = std::chrono::milliseconds(kReapIntervalMs);
+  auto now = std::chrono::steady_clock::now();
+  for (const auto& entry : properties_.entries_) {
+    if (entry.restart_at) {
+      auto until = std::chrono::duration_cast<std::chrono::milliseconds>(
+          *entry.restart_at - now);
+      timeout = std::max(std::chrono::milliseconds(0), std::min(timeout, until));
+    }
+  }
+  return timeout.count();
+}
+
+Result<void> ProcessMonitor::SendProcessStatus() {
+  Json::Value processes(Json::arrayValue);
+  for (const auto& entry : properties_.entries_) {
+    Json::Value process;
+    process["name"] = entry.cmd->GetShortName();
+    process["restarts"] = entry.restarts;
+    auto cpu_time = entry.cpu_time;
+    if (entry.proc) {
+      auto usage = ProcUsage(entry.proc->pid());
+      cpu_time += usage.cpu_time;
+      process["pid"] = entry.proc->pid();
+      process["rss_kb"] = Json::Int64(usage.rss_kb);
+      process["ksm_merging_kb"] = Json::Int64(usage.ksm_merging_kb);
     } else {
-      LogSubprocessExit(it->cmd->GetShortName(), it->proc->pid(), wstatus);
-      if (properties_.restart_subprocesses_) {
-        auto options = SubprocessOptions().InGroup(true);
-        it->proc.reset(new Subprocess(it->cmd->Start(options)));
-      } else {
-        properties_.entries_.erase(it);
+      process["pid"] = -1;  // Waiting to restart
+    }
+    process["cpu_time_ms"] = Json::Int64(cpu_time.count() / 1000);
+    processes.append(process);
+  }
+  Json::StreamWriterBuilder factory;
+  auto status = Json::writeString(factory, processes);
+  std::uint32_t size = status.size();
+  CF_EXPECT(WriteAllBinary(monitor_socket_, &size) == sizeof(size),
+            monitor_socket_->StrError());
+  CF_EXPECT(WriteAll(monitor_socket_, status) == (ssize_t)status.size(),
+            monitor_socket_->StrError());
+  return {};
+}
+
+Result<void> ProcessMonitor::MonitorRoutine() {
+  // Make this process a subreaper to reliably catch subprocess exits.
+  // See https://man7.org/linux/man-pages/man2/prctl.2.html
+  prctl(PR_SET_CHILD_SUBREAPER, 1);
+  prctl(PR_SET_PDEATHSIG, SIGHUP); // Die when parent dies
+
+  LOG(DEBUG) << "Starting monitoring subprocesses";
+  auto started = StartSubprocesses();
+  // Also when only some started, so that stop_cvd can clean them up
+  RecordLaunchedProcesses();
+  CF_EXPECT(std::move(started));
+
+  // Everything happens on this thread, woken up by the parent, an exited
+  // child or a due restart
+  auto epoll = CF_EXPECT(Epoll::Create());
+  CF_EXPECT(epoll.Add(monitor_socket_, EPOLLIN));
+  auto& monitored = properties_.entries_;
+  for (const auto& entry : monitored) {
+    CF_EXPECT(epoll.Add(entry.pidfd, EPOLLIN));
+  }
+
+  LOG(DEBUG) << "Monitoring subprocesses";
+  while (true) {
+    auto event = CF_EXPECT(epoll.Wait(NextTimeoutMs()));
+    CF_EXPECT(ReapSubprocesses(epoll));
+    if (event && event->fd == monitor_socket_) {
+      ParentToChildMessage message;
+      CF_EXPECT(ReadExactBinary(monitor_socket_, &message) == sizeof(message),
+                "Could not read message from parent.");
+      if (message.stop) {
+        break;  // Before restarting anything near the end
+      }
+      if (message.status) {
+        CF_EXPECT(SendProcessStatus());
       }
     }
+    CF_EXPECT(RestartDueSubprocesses(epoll));
   }
 
-  CF_EXPECT(parent_comms.get());  // Should have exited if `running` is false
   auto stop = [](const auto& it) {
+    if (!it.proc) {
+      return true;  // Was waiting to restart
+    }
     auto stop_result = it.proc->Stop();
     if (stop_result == StopperResult::kStopFailure) {
       LOG(WARNING) << "Error in stopping \"" << it.cmd->GetShortName() << "\"";
@@ -225,8 +698,7 @@ Result<void> ProcessMonitor::MonitorRoutine() {
     }
     return true;
   };
-  // Processes were started in the order they appear in the vector, stop them in
-  // reverse order for symmetry.
+  // Stop processes in the reverse of the order they were added in.
   size_t stopped = std::count_if(monitored.rbegin(), monitored.rend(), stop);
   LOG(DEBUG) << "Done monitoring subprocesses";
   CF_EXPECT(stopped == monitored.size(), "Didn't stop all subprocesses");
@@ -15,19 +15,44 @@
  */
 #pragma once
 
+#include <chrono>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <set>
+#include <string>
 #include <thread>
 #include <vector>
 
+#include "common/libs/fs/epoll.h"
+#include "common/libs/fs/shared_fd.h"
+
 #include "common/libs/utils/result.h"
 #include "common/libs/utils/subprocess.h"
+#include "host/commands/run_cvd/cgroup_accounting.h"
+#include "host/libs/config/command_source.h"
 
 namespace cuttlefish {
 
 struct MonitorEntry {
   std::unique_ptr<Command> cmd;
   std::unique_ptr<Subprocess> proc;
+  // Null for commands added without a source
+  CommandSource* source = nullptr;
+  // Readable once `proc` exits
+  SharedFD pidfd;
+  // cgroup.procs of the cgroup the command runs in, if accounting is enabled
+  SharedFD cgroup_procs;
+  // Whether KSM may merge the anonymous memory of the command
+  bool mergeable_memory = false;
+  std::chrono::steady_clock::time_point started;
+  // Set while waiting to restart a process that exited
+  std::optional<std::chrono::steady_clock::time_point> restart_at;
+  int restarts = 0;
+  // Exits without running long enough in between, drive the restart backoff
+  int quick_exits = 0;
+  // Of the exited runs of the command
+  std::chrono::microseconds cpu_time{0};
 };
 
 // Keeps track of launched subprocesses, restarts them if they unexpectedly exit
@@ -41,6 +66,26 @@ class ProcessMonitor {
     Properties& AddCommand(Command) &;
     Properties AddCommand(Command) &&;
 
+    // Starts the commands of `source` after its StartDependencies are ready.
+    Properties& AddCommandSource(CommandSource&) &;
+    Properties AddCommandSource(CommandSource&) &&;
+
+    // Adds when each source started and became ready to the boot timeline.
+    Properties& BootTimelinePath(std::string) &;
+    Properties BootTimelinePath(std::string) &&;
+
+    // Keeps a record of the running processes at `path` for stop_cvd.
+    Properties& LaunchedProcessesPath(std::string path) &;
+    Properties LaunchedProcessesPath(std::string path) &&;
+
+    // Runs each command in the cgroup named after it.
+    Properties& Cgroups(CgroupAccounting) &;
+    Properties Cgroups(CgroupAccounting) &&;
+
+    // Offers the memory of the given executables, by file name, to KSM.
+    Properties& MergeableMemory(std::set<std::string> executables) &;
+    Properties MergeableMemory(std::set<std::string> executables) &&;
+
     template <typename T>
     Properties& AddCommands(T commands) & {
       for (auto& command : commands) {
@@ -60,6 +105,11 @@ class ProcessMonitor {
    private:
     bool restart_subprocesses_;
     std::vector<MonitorEntry> entries_;
+    std::vector<CommandSource*> sources_;
+    std::string boot_timeline_path_;
+    std::optional<CgroupAccounting> cgroups_;
+    std::set<std::string> mergeable_executables_;
+    std::string launched_processes_path_;
 
     friend class ProcessMonitor;
   };
@@ -69,12 +119,29 @@ class ProcessMonitor {
   Result<void> StartAndMonitorProcesses();
   // Stops all monitored subprocesses.
   Result<void> StopMonitoredProcesses();
+  // Json list of the monitored subprocesses, with their CPU time, resident
+  // memory, memory merged by KSM and restart count. Safe to call from any thread.
+  Result<std::string> ProcessStatus();
+  // Resources used by each cgroup, when the commands run in cgroups. Safe to
+  // call from any thread.
+  Result<std::vector<CgroupUsage>> CgroupStatus() const;
+  // Removes the cgroups of the instance, if the commands ran in cgroups. Only
+  // after they were stopped and when run_cvd is about to exit.
+  Result<void> RemoveCgroups();
 
  private:
+  Result<void> StartSubprocesses();
   Result<void> MonitorRoutine();
+  Result<void> ReapSubprocesses(Epoll& epoll);
+  Result<void> RestartDueSubprocesses(Epoll& epoll);
+  void RecordLaunchedProcesses();
+  int NextTimeoutMs() const;
+  Result<void> SendProcessStatus();
 
   Properties properties_;
   pid_t monitor_;
+  // Serializes the request/response exchanges on monitor_socket_
+  std::mutex monitor_socket_mutex_;
   SharedFD monitor_socket_;
 };
 
@@ -51,8 +51,16 @@ enum RunnerExitCodes : int {
 enum class LauncherAction : char {
   kPowerwash = 'P',
   kRestart = 'R',
+  // Followed by a std::uint32_t length and the path of the snapshot directory
+  kSnapshot = 'N',
   kStatus = 'I',
+  // Answered with a std::uint32_t length and a json list of the subprocesses
+  kProcessStatus = 'M',
   kStop = 'X',
+  // Followed by a std::uint32_t length and a json request for the displays,
+  // answered with a std::uint32_t length and a json list of the displays.
+  // See RuntimeDisplays.
+  kDisplays = 'D',
 };
 
 // Responses from the launcher server
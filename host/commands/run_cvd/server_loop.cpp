@@ -16,47 +16,49 @@
 
 #include "host/commands/run_cvd/server_loop.h"
 
+#include <fcntl.h>
 #include <fruit/fruit.h>
 #include <gflags/gflags.h>
 #include <unistd.h>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
+
+#include <json/json.h>
 
 #include "common/libs/fs/shared_buf.h"
 #include "common/libs/utils/files.h"
 #include "common/libs/utils/subprocess.h"
+#include "host/commands/run_cvd/displays.h"
 #include "host/commands/run_cvd/runner_defs.h"
+#include "host/commands/run_cvd/snapshot.h"
+#include "host/commands/run_cvd/status_reporter.h"
 #include "host/libs/config/cuttlefish_config.h"
 #include "host/libs/config/data_image.h"
 #include "host/libs/config/feature.h"
+#include "host/libs/image_aggregator/image_aggregator.h"
+#include "host/libs/vm_manager/vm_manager.h"
 
 namespace cuttlefish {
 
 namespace {
 
-bool CreateQcowOverlay(const std::string& crosvm_path,
-                       const std::string& backing_file,
-                       const std::string& output_overlay_path) {
-  Command crosvm_qcow2_cmd(crosvm_path);
-  crosvm_qcow2_cmd.AddParameter("create_qcow2");
-  crosvm_qcow2_cmd.AddParameter("--backing_file=", backing_file);
-  crosvm_qcow2_cmd.AddParameter(output_overlay_path);
-  int success = crosvm_qcow2_cmd.Start().Wait();
-  if (success != 0) {
-    LOG(ERROR) << "Unable to run crosvm create_qcow2. Exited with status "
-               << success;
-    return false;
-  }
-  return true;
-}
-
 class ServerLoopImpl : public ServerLoop, public SetupFeature {
  public:
   INJECT(ServerLoopImpl(const CuttlefishConfig& config,
-                        const CuttlefishConfig::InstanceSpecific& instance))
-      : config_(config), instance_(instance) {}
+                        const CuttlefishConfig::InstanceSpecific& instance,
+                        vm_manager::VmManager& vm_manager,
+                        StatusReporter& status_reporter))
+      : config_(config),
+        instance_(instance),
+        vm_manager_(vm_manager),
+        status_reporter_(status_reporter),
+        displays_(config, instance, vm_manager) {}
 
   // ServerLoop
   void Run(ProcessMonitor& process_monitor) override {
+    status_reporter_.Start(process_monitor);
     while (true) {
       // TODO: use select to handle simultaneous connections.
       auto client = SharedFD::Accept(*server_);
@@ -66,6 +68,13 @@ class ServerLoopImpl : public ServerLoop, public SetupFeature {
           case LauncherAction::kStop: {
             auto stop = process_monitor.StopMonitoredProcesses();
             if (stop.ok()) {
+              status_reporter_.Stopped();
+              // Restarts reuse them, so only when run_cvd is done
+              auto removed = process_monitor.RemoveCgroups();
+              if (!removed.ok()) {
+                LOG(WARNING) << "Failed to remove the cgroups:\n"
+                             << removed.error();
+              }
               auto response = LauncherResponse::kSuccess;
               client->Write(&response, sizeof(response));
               std::exit(0);
@@ -82,6 +91,84 @@ class ServerLoopImpl : public ServerLoop, public SetupFeature {
             client->Write(&response, sizeof(response));
             break;
           }
+          case LauncherAction::kProcessStatus: {
+            auto status = process_monitor.ProcessStatus();
+            if (!status.ok()) {
+              LOG(ERROR) << "Failed to get the process status:\n"
+                         << status.error();
+              auto response = LauncherResponse::kError;
+              client->Write(&response, sizeof(response));
+              break;
+            }
+            auto response = LauncherResponse::kSuccess;
+            client->Write(&response, sizeof(response));
+            std::uint32_t size = status->size();
+            WriteAllBinary(client, &size);
+            WriteAll(client, *status);
+            break;
+          }
+          case LauncherAction::kSnapshot: {
+            // The action is followed by the length and the path of the
+            // snapshot directory
+            std::uint32_t path_size = 0;
+            std::string path;
+            if (ReadExactBinary(client, &path_size) == sizeof(path_size)) {
+              path.resize(path_size);
+            }
+            if (path.empty() ||
+                ReadExact(client, &path) != (ssize_t)path.size()) {
+              LOG(ERROR) << "Failed to read the snapshot path";
+              auto response = LauncherResponse::kError;
+              client->Write(&response, sizeof(response));
+              break;
+            }
+            auto snapshot = TakeSnapshot(config_, instance_, vm_manager_, path);
+            if (!snapshot.ok()) {
+              LOG(ERROR) << "Failed to take a snapshot:\n" << snapshot.error();
+            }
+            auto response = snapshot.ok() ? LauncherResponse::kSuccess
+                                          : LauncherResponse::kError;
+            client->Write(&response, sizeof(response));
+            break;
+          }
+          case LauncherAction::kDisplays: {
+            std::uint32_t request_size = 0;
+            std::string request_str;
+            if (ReadExactBinary(client, &request_size) ==
+                sizeof(request_size)) {
+              request_str.resize(request_size);
+            }
+            Json::CharReaderBuilder builder;
+            std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+            Json::Value request;
+            if (request_str.empty() ||
+                ReadExact(client, &request_str) !=
+                    (ssize_t)request_str.size() ||
+                !reader->parse(request_str.data(),
+                               request_str.data() + request_str.size(),
+                               &request, nullptr)) {
+              LOG(ERROR) << "Failed to read the display request";
+              auto response = LauncherResponse::kError;
+              client->Write(&response, sizeof(response));
+              break;
+            }
+            auto displays = displays_.Handle(request);
+            if (!displays.ok()) {
+              LOG(ERROR) << "Failed to change the displays:\n"
+                         << displays.error();
+              auto response = LauncherResponse::kError;
+              client->Write(&response, sizeof(response));
+              break;
+            }
+            auto response = LauncherResponse::kSuccess;
+            client->Write(&response, sizeof(response));
+            Json::StreamWriterBuilder factory;
+            auto displays_str = Json::writeString(factory, *displays);
+            std::uint32_t size = displays_str.size();
+            WriteAllBinary(client, &size);
+            WriteAll(client, displays_str);
+            break;
+          }
           case LauncherAction::kPowerwash: {
             LOG(INFO) << "Received a Powerwash request from the monitor socket";
             auto stop = process_monitor.StopMonitoredProcesses();
@@ -177,12 +264,93 @@ class ServerLoopImpl : public ServerLoop, public SetupFeature {
     }
   }
 
+  // Files recreated by a powerwash. Pristine copies are kept after the first
+  // one so later powerwashes only need to swap them in.
+  std::vector<std::string> PowerwashedFiles() {
+    std::vector<std::string> files = {
+        instance_.access_kregistry_path(),
+        instance_.hwcomposer_pmem_path(),
+        instance_.pstore_path(),
+        instance_.sdcard_path(),
+        instance_.PerInstancePath("overlay.img"),
+    };
+    if (instance_.start_ap()) {
+      files.emplace_back(instance_.PerInstancePath("ap_overlay.img"));
+    }
+    return files;
+  }
+
+  std::string PowerwashTemplate(const std::string& file) {
+    return instance_.PerInstanceInternalPath("powerwash") + "/" +
+           cpp_basename(file);
+  }
+
+  // The overlays point into the os composite disk, so templates made before
+  // it was last rebuilt are stale.
+  bool PowerwashTemplatesValid() {
+    auto stamp = PowerwashTemplate("stamp");
+    if (!FileExists(stamp) ||
+        FileModificationTime(stamp) <
+            FileModificationTime(config_.os_composite_disk_path())) {
+      return false;
+    }
+    for (const auto& file : PowerwashedFiles()) {
+      if (!FileExists(PowerwashTemplate(file))) {
+        return false;
+      }
+    }
+    // The sdcard keeps whatever size it was assembled with
+    auto sdcard_path = instance_.sdcard_path();
+    return FileSize(PowerwashTemplate(sdcard_path)) == FileSize(sdcard_path);
+  }
+
+  bool SwapInPowerwashTemplates() {
+    for (const auto& file : PowerwashedFiles()) {
+      // Copy next to the destination first so the swap itself is a rename
+      auto staging = file + ".powerwash";
+      if (!CopyImageFile(PowerwashTemplate(file), staging) ||
+          !RenameFile(staging, file)) {
+        LOG(ERROR) << "Failed to restore \"" << file << "\" from template";
+        unlink(staging.c_str());
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void SavePowerwashTemplates() {
+    auto directory = instance_.PerInstanceInternalPath("powerwash");
+    auto stamp = PowerwashTemplate("stamp");
+    unlink(stamp.c_str());
+    auto ensure = EnsureDirectoryExists(directory);
+    if (!ensure.ok()) {
+      LOG(WARNING) << "Not keeping powerwash templates: " << ensure.error();
+      return;
+    }
+    for (const auto& file : PowerwashedFiles()) {
+      if (!CopyImageFile(file, PowerwashTemplate(file))) {
+        LOG(WARNING) << "Not keeping powerwash templates, failed to copy \""
+                     << file << "\"";
+        return;
+      }
+    }
+    // Written last, marks the set as complete
+    SharedFD::Open(stamp, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  }
+
   bool PowerwashFiles() {
     DeleteFifos();
 
     // TODO(schuffelen): Clean up duplication with assemble_cvd
     unlink(instance_.PerInstancePath("NVChip").c_str());
 
+    if (PowerwashTemplatesValid()) {
+      if (SwapInPowerwashTemplates()) {
+        return true;
+      }
+      LOG(WARNING) << "Falling back to recreating the powerwashed files";
+    }
+
     auto kregistry_path = instance_.access_kregistry_path();
     unlink(kregistry_path.c_str());
     CreateBlankImage(kregistry_path, 2 /* mb */, "none");
@@ -206,15 +374,16 @@ class ServerLoopImpl : public ServerLoop, public SetupFeature {
     if (instance_.start_ap()) {
       overlay_files.emplace_back("ap_overlay.img");
     }
-    for (auto overlay_file : {"overlay.img", "ap_overlay.img"}) {
-      auto overlay_path = instance_.PerInstancePath(overlay_file);
+    for (const auto& overlay_file : overlay_files) {
+      auto overlay_path = instance_.PerInstancePath(overlay_file.c_str());
       unlink(overlay_path.c_str());
-      if (!CreateQcowOverlay(config_.crosvm_binary(),
-                             config_.os_composite_disk_path(), overlay_path)) {
+      if (!CreateQcowOverlay(config_.os_composite_disk_path(),
+                             overlay_path)) {
         LOG(ERROR) << "CreateQcowOverlay failed";
         return false;
       }
     }
+    SavePowerwashTemplates();
     return true;
   }
 
@@ -243,6 +412,9 @@ class ServerLoopImpl : public ServerLoop, public SetupFeature {
 
   const CuttlefishConfig& config_;
   const CuttlefishConfig::InstanceSpecific& instance_;
+  vm_manager::VmManager& vm_manager_;
+  StatusReporter& status_reporter_;
+  RuntimeDisplays displays_;
   SharedFD server_;
 };
 
@@ -251,7 +423,8 @@ class ServerLoopImpl : public ServerLoop, public SetupFeature {
 ServerLoop::~ServerLoop() = default;
 
 fruit::Component<fruit::Required<const CuttlefishConfig,
-                                 const CuttlefishConfig::InstanceSpecific>,
+                                 const CuttlefishConfig::InstanceSpecific,
+                                 vm_manager::VmManager, StatusReporter>,
                  ServerLoop>
 serverLoopComponent() {
   return fruit::createComponent()
@@ -20,7 +20,9 @@
 
 #include "common/libs/fs/shared_fd.h"
 #include "host/commands/run_cvd/process_monitor.h"
+#include "host/commands/run_cvd/status_reporter.h"
 #include "host/libs/config/cuttlefish_config.h"
+#include "host/libs/vm_manager/vm_manager.h"
 
 namespace cuttlefish {
 
@@ -31,7 +33,8 @@ class ServerLoop {
 };
 
 fruit::Component<fruit::Required<const CuttlefishConfig,
-                                 const CuttlefishConfig::InstanceSpecific>,
+                                 const CuttlefishConfig::InstanceSpecific,
+                                 vm_manager::VmManager, StatusReporter>,
                  ServerLoop>
 serverLoopComponent();
 }
@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/run_cvd/snapshot.h"
+
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+#include <fruit/fruit.h>
+#include <json/json.h>
+
+#include "common/libs/utils/files.h"
+#include "common/libs/utils/result.h"
+#include "host/libs/config/cuttlefish_config.h"
+#include "host/libs/config/data_image.h"
+#include "host/libs/config/feature.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr char kSnapshotConfig[] = "cuttlefish_config.json";
+
+// Files, relative to the instance directory, that the guest or the host
+// processes serving it write while the device runs. Everything else in the
+// instance is recreated identically by assemble_cvd.
+std::vector<std::string> StateFiles(
+    const CuttlefishConfig::InstanceSpecific& instance) {
+  std::vector<std::string> files = {
+      // Guest disks
+      "overlay.img",
+      "ap_overlay.img",
+      "sdcard.img",
+      "uboot_env.img",
+      "vbmeta.img",
+      "internal/factory_reset_protected.img",
+      // Shared memory files
+      "access-kregistry",
+      "hwcomposer-pmem",
+      "pstore",
+      // secure_env
+      "NVChip",
+      "gatekeeper_secure",
+      "gatekeeper_insecure",
+      // modem_simulator
+      "modem_nvram.json",
+  };
+  for (const auto& file : DirectoryContents(instance.instance_dir())) {
+    if (android::base::StartsWith(file, "iccprofile_for_sim")) {
+      files.emplace_back(file);
+    }
+  }
+  return files;
+}
+
+Result<void> CopyStateFiles(const CuttlefishConfig::InstanceSpecific& instance,
+                            const std::string& from, const std::string& to) {
+  for (const auto& file : StateFiles(instance)) {
+    auto source = from + "/" + file;
+    if (!FileExists(source)) {
+      continue;
+    }
+    CF_EXPECT(CopyImageFile(source, to + "/" + file),
+              "Could not copy \"" << source << "\" to \"" << to << "\"");
+  }
+  return {};
+}
+
+Result<void> SaveSuspended(const CuttlefishConfig& config,
+                           const CuttlefishConfig::InstanceSpecific& instance,
+                           vm_manager::VmManager& vm_manager,
+                           const std::string& directory) {
+  CF_EXPECT(CopyStateFiles(instance, instance.instance_dir(), directory));
+  CF_EXPECT(vm_manager.Snapshot(config, directory));
+  return {};
+}
+
+// Restores the files of the snapshot over the ones of the freshly assembled
+// instance, before the host processes and the VMM start.
+class SnapshotRestore : public SetupFeature {
+ public:
+  INJECT(SnapshotRestore(const CuttlefishConfig& config,
+                         const CuttlefishConfig::InstanceSpecific& instance))
+      : config_(config), instance_(instance) {}
+
+  // SetupFeature
+  std::string Name() const override { return "SnapshotRestore"; }
+  bool Enabled() const override { return !config_.snapshot_path().empty(); }
+
+ private:
+  std::unordered_set<SetupFeature*> Dependencies() const override { return {}; }
+  Result<void> ResultSetup() override {
+    auto directory = config_.snapshot_path();
+    auto config_path = directory + "/" + kSnapshotConfig;
+    std::ifstream config_stream(config_path);
+    CF_EXPECT(config_stream.is_open(),
+              "\"" << directory << "\" is not a snapshot");
+    Json::CharReaderBuilder builder;
+    Json::Value snapshot;
+    std::string errors;
+    CF_EXPECT(Json::parseFromStream(builder, config_stream, &snapshot, &errors),
+              "Could not parse \"" << config_path << "\": " << errors);
+    // The VMM refuses mismatched guests, fail early with a clear message
+    // instead of a cryptic one from the VMM
+    CF_EXPECT(snapshot["instances"].isMember(instance_.id()),
+              "The snapshot is of a different instance than " << instance_.id());
+    CF_EXPECT(snapshot["vm_manager"].asString() == config_.vm_manager(),
+              "The snapshot was taken with a different VM manager");
+    CF_EXPECT(snapshot["cpus"].asInt() == config_.cpus() &&
+                  snapshot["memory_mb"].asInt() == config_.memory_mb(),
+              "The snapshot has a different cpu count or memory size");
+
+    CF_EXPECT(CopyStateFiles(instance_, directory, instance_.instance_dir()));
+    LOG(INFO) << "Restoring the device from \"" << directory << "\"";
+    return {};
+  }
+
+  const CuttlefishConfig& config_;
+  const CuttlefishConfig::InstanceSpecific& instance_;
+};
+
+}  // namespace
+
+Result<void> TakeSnapshot(const CuttlefishConfig& config,
+                          const CuttlefishConfig::InstanceSpecific& instance,
+                          vm_manager::VmManager& vm_manager,
+                          const std::string& directory) {
+  CF_EXPECT(EnsureDirectoryExists(directory + "/internal"));
+  auto config_path = config.AssemblyPath(kSnapshotConfig);
+  CF_EXPECT(CopyImageFile(config_path, directory + "/" + kSnapshotConfig),
+            "Could not copy \"" << config_path << "\"");
+
+  CF_EXPECT(vm_manager.Suspend(config));
+  // Resume even if saving failed, so the device keeps running
+  auto saved = SaveSuspended(config, instance, vm_manager, directory);
+  auto resumed = vm_manager.Resume(config);
+  CF_EXPECT(std::move(saved));
+  CF_EXPECT(std::move(resumed));
+  LOG(INFO) << "Saved a snapshot of the device to \"" << directory << "\"";
+  return {};
+}
+
+fruit::Component<fruit::Required<const CuttlefishConfig,
+                                 const CuttlefishConfig::InstanceSpecific>>
+snapshotRestoreComponent() {
+  return fruit::createComponent()
+      .addMultibinding<SetupFeature, SnapshotRestore>();
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,382 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/run_cvd/status_reporter.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <fruit/fruit.h>
+#include <json/json.h>
+
+#include "cvd_server.pb.h"
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/files.h"
+#include "common/libs/utils/result.h"
+#include "common/libs/utils/unix_sockets.h"
+#include "host/commands/cvd/server_constants.h"
+#include "host/commands/run_cvd/cgroup_accounting.h"
+#include "host/commands/run_cvd/ksm_tuner.h"
+#include "host/commands/kernel_log_monitor/kernel_log_server.h"
+#include "host/commands/kernel_log_monitor/utils.h"
+#include "host/libs/config/feature.h"
+#include "host/libs/vm_manager/gem5_manager.h"
+
+namespace cuttlefish {
+namespace {
+
+// How often the liveness and resource usage of the processes is refreshed.
+// Boot events are reported as soon as they happen.
+constexpr auto kReportInterval = std::chrono::seconds(5);
+// Resource usage in the Prometheus text format, in the instance directory
+constexpr char kMetricsFile[] = "resource_usage.prom";
+
+Result<std::vector<cvd::ProcessStatus>> ParseProcessStatus(
+    const std::string& serialized) {
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  Json::Value json;
+  std::string errors;
+  CF_EXPECT(reader->parse(serialized.data(),
+                          serialized.data() + serialized.size(), &json,
+                          &errors),
+            "Failed to parse the process status: " << errors);
+  CF_EXPECT(json.isArray(), "The process status is not a list");
+  std::vector<cvd::ProcessStatus> processes;
+  for (const auto& process_json : json) {
+    cvd::ProcessStatus process;
+    process.set_name(process_json["name"].asString());
+    process.set_pid(process_json["pid"].asInt());
+    process.set_restarts(process_json["restarts"].asInt());
+    process.set_rss_kb(process_json["rss_kb"].asInt64());
+    process.set_ksm_merging_kb(process_json["ksm_merging_kb"].asInt64());
+    process.set_cpu_time_ms(process_json["cpu_time_ms"].asInt64());
+    processes.push_back(std::move(process));
+  }
+  return processes;
+}
+
+class StatusReporterImpl : public StatusReporter, public SetupFeature {
+ public:
+  INJECT(StatusReporterImpl(const CuttlefishConfig& config,
+                            const CuttlefishConfig::InstanceSpecific& instance,
+                            KernelLogPipeProvider& kernel_log_pipe_provider))
+      : config_(config),
+        instance_(instance),
+        kernel_log_pipe_provider_(kernel_log_pipe_provider) {}
+
+  ~StatusReporterImpl() { StopThread(); }
+
+  // StatusReporter
+  void Start(ProcessMonitor& process_monitor) override {
+    process_monitor_ = &process_monitor;
+    reporter_ = std::thread([this]() { ReportLoop(); });
+  }
+
+  void Stopped() override {
+    StopThread();
+    status_.set_state(cvd::InstanceStatus::STATE_STOPPED);
+    status_.clear_processes();
+    status_.clear_cgroups();
+    status_.clear_network();
+    TuneKsm(/* booting */ false);
+    // Stale metrics would look like an idle instance
+    RemoveFile(instance_.PerInstancePath(kMetricsFile));
+    Report();
+  }
+
+  // SetupFeature
+  std::string Name() const override { return "StatusReporter"; }
+  bool Enabled() const override { return true; }
+
+ private:
+  std::unordered_set<SetupFeature*> Dependencies() const override {
+    return {static_cast<SetupFeature*>(&kernel_log_pipe_provider_)};
+  }
+
+  Result<void> ResultSetup() override {
+    kernel_log_pipe_ = kernel_log_pipe_provider_.KernelLogPipe();
+    CF_EXPECT(kernel_log_pipe_->IsOpen(), "Could not get a kernel log pipe");
+    interrupt_fd_ = SharedFD::Event();
+    CF_EXPECT(interrupt_fd_->IsOpen(),
+              "Failed to open eventfd: " << interrupt_fd_->StrError());
+    // The cvd server expects stdio file descriptors with every request.
+    dev_null_ = SharedFD::Open("/dev/null", O_RDWR);
+    CF_EXPECT(dev_null_->IsOpen(),
+              "Failed to open /dev/null: " << dev_null_->StrError());
+    const bool resumed = !config_.snapshot_path().empty() ||
+                         vm_manager::Gem5Manager::RestoresCheckpoint(config_);
+    if (config_.guest_memory_merge()) {
+      ksm_tuner_.emplace(config_.ksm_boot_pages_to_scan(),
+                         config_.ksm_steady_pages_to_scan());
+      if (!resumed) {
+        TuneKsm(/* booting */ true);
+      }
+    }
+
+    status_.set_assembly_dir(config_.assembly_dir());
+    status_.set_instance_name(instance_.instance_name());
+    status_.set_instance_dir(instance_.instance_dir());
+    status_.set_run_cvd_pid(getpid());
+    if (!resumed) {
+      status_.set_state(cvd::InstanceStatus::STATE_BOOTING);
+    } else {
+      // A guest resumed from a snapshot is past boot and won't report it
+      status_.set_state(cvd::InstanceStatus::STATE_RUNNING);
+      status_.set_boot_phase("ResumedFromSnapshot");
+    }
+    return {};
+  }
+
+  void StopThread() {
+    if (!reporter_.joinable()) {
+      return;
+    }
+    CHECK(interrupt_fd_->EventfdWrite(1) >= 0);
+    reporter_.join();
+  }
+
+  void ReportLoop() {
+    auto next_report = std::chrono::steady_clock::now();
+    while (true) {
+      auto now = std::chrono::steady_clock::now();
+      if (now >= next_report) {
+        Report();
+        next_report = now + kReportInterval;
+      }
+      auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+          next_report - now);
+
+      std::vector<PollSharedFd> poll_fds = {{
+          .fd = interrupt_fd_,
+          .events = POLLIN,
+      }};
+      if (kernel_log_pipe_->IsOpen()) {
+        poll_fds.push_back({
+            .fd = kernel_log_pipe_,
+            .events = POLLIN,
+        });
+      }
+      int result = SharedFD::Poll(poll_fds, timeout.count());
+      if (result < 0) {
+        PLOG(ERROR) << "Failed to poll, no longer reporting the status";
+        return;
+      }
+      if (poll_fds[0].revents & POLLIN) {
+        return;
+      }
+      if (poll_fds.size() < 2 || poll_fds[1].revents == 0) {
+        continue;
+      }
+      auto event = monitor::ReadEvent(kernel_log_pipe_);
+      if (!event) {
+        // kernel_log_monitor went away, keep reporting the processes
+        kernel_log_pipe_ = SharedFD();
+        continue;
+      }
+      OnBootEvent(event->event);
+      Report();
+    }
+  }
+
+  void OnBootEvent(monitor::Event event) {
+    status_.set_boot_phase(monitor::EventName(event));
+    if (event == monitor::Event::BootStarted) {
+      // Also seen when the guest reboots
+      status_.set_state(cvd::InstanceStatus::STATE_BOOTING);
+      TuneKsm(/* booting */ true);
+    } else if (event == monitor::Event::BootCompleted) {
+      status_.set_state(cvd::InstanceStatus::STATE_RUNNING);
+      TuneKsm(/* booting */ false);
+    } else if (event == monitor::Event::BootFailed) {
+      status_.set_state(cvd::InstanceStatus::STATE_BOOT_FAILED);
+      TuneKsm(/* booting */ false);
+    }
+  }
+
+  void TuneKsm(bool booting) {
+    if (!ksm_tuner_) {
+      return;
+    }
+    auto updated = booting ? ksm_tuner_->Booting() : ksm_tuner_->Booted();
+    if (!updated.ok()) {
+      // Usually not running as root, KSM keeps scanning as configured
+      LOG(DEBUG) << "Not tuning KSM:\n" << updated.error();
+    }
+  }
+
+  void Report() {
+    if (process_monitor_ &&
+        status_.state() != cvd::InstanceStatus::STATE_STOPPED) {
+      auto processes = CollectProcesses();
+      if (processes.ok()) {
+        status_.clear_processes();
+        for (auto& process : *processes) {
+          *status_.add_processes() = std::move(process);
+        }
+      } else {
+        LOG(DEBUG) << "Not reporting the processes:\n" << processes.error();
+      }
+      ReportResourceUsage();
+    }
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    status_.set_update_time_ms(
+        std::chrono::duration_cast<std::chrono::milliseconds>(now).count());
+
+    auto sent = SendStatus();
+    if (!sent.ok()) {
+      // Most likely there is no cvd server, try again on the next report
+      LOG(DEBUG) << "Failed to report the instance status:\n" << sent.error();
+      server_.reset();
+    }
+  }
+
+  void ReportResourceUsage() {
+    auto cgroups = process_monitor_->CgroupStatus();
+    if (!cgroups.ok()) {
+      return;  // Not running in cgroups, logged when starting
+    }
+    auto network = ReadNetworkUsage({
+        instance_.mobile_tap_name(),
+        instance_.wifi_tap_name(),
+        instance_.ethernet_tap_name(),
+    });
+
+    status_.clear_cgroups();
+    for (const auto& cgroup : *cgroups) {
+      auto& usage = *status_.add_cgroups();
+      usage.set_group(cgroup.group);
+      usage.set_cpu_time_ms(
+          std::chrono::duration_cast<std::chrono::milliseconds>(
+              cgroup.cpu_time)
+              .count());
+      usage.set_memory_bytes(cgroup.memory_bytes.value_or(-1));
+      usage.set_io_read_bytes(cgroup.io_read_bytes.value_or(-1));
+      usage.set_io_write_bytes(cgroup.io_write_bytes.value_or(-1));
+    }
+    status_.clear_network();
+    for (const auto& interface : network) {
+      auto& usage = *status_.add_network();
+      usage.set_interface(interface.interface);
+      usage.set_receive_bytes(interface.receive_bytes);
+      usage.set_transmit_bytes(interface.transmit_bytes);
+    }
+
+    auto written = WriteMetrics(
+        PrometheusText(instance_.instance_name(), *cgroups, network));
+    if (!written.ok()) {
+      LOG(DEBUG) << "Failed to write the metrics:\n" << written.error();
+    }
+  }
+
+  // Replaced atomically, so the node exporter never reads a partial file
+  Result<void> WriteMetrics(const std::string& metrics) {
+    auto path = instance_.PerInstancePath(kMetricsFile);
+    auto temp_path = path + ".tmp";
+    auto file = SharedFD::Creat(temp_path, 0644);
+    CF_EXPECT(file->IsOpen(),
+              "Could not create " << temp_path << ": " << file->StrError());
+    CF_EXPECT(WriteAll(file, metrics) == (ssize_t)metrics.size(),
+              "Could not write " << temp_path << ": " << file->StrError());
+    file->Close();
+    CF_EXPECT(RenameFile(temp_path, path),
+              "Could not rename " << temp_path << " to " << path);
+    return {};
+  }
+
+  Result<std::vector<cvd::ProcessStatus>> CollectProcesses() {
+    auto process_status = CF_EXPECT(process_monitor_->ProcessStatus());
+    return CF_EXPECT(ParseProcessStatus(process_status));
+  }
+
+  Result<void> SendStatus() {
+    if (!server_) {
+      auto connection = SharedFD::SocketLocalClient(
+          cvd::kServerSocketPath, /*is_abstract=*/true, SOCK_SEQPACKET);
+      CF_EXPECT(connection->IsOpen(),
+                "Failed to connect to the cvd server: "
+                    << connection->StrError());
+      server_ = UnixMessageSocket(connection);
+    }
+
+    cvd::Request request;
+    *request.mutable_instance_status_update()->mutable_status() = status_;
+    std::string serialized;
+    CF_EXPECT(request.SerializeToString(&serialized),
+              "Unable to serialize request proto.");
+    UnixSocketMessage message;
+    message.data = std::vector<char>(serialized.begin(), serialized.end());
+    std::vector<SharedFD> stdio = {dev_null_, dev_null_, dev_null_};
+    message.control.emplace_back(
+        CF_EXPECT(ControlMessage::FromFileDescriptors(stdio)));
+    CF_EXPECT(server_->WriteMessage(message));
+
+    auto read_result = CF_EXPECT(server_->ReadMessage());
+    CF_EXPECT(!read_result.data.empty(), "The cvd server hung up");
+    cvd::Response response;
+    CF_EXPECT(response.ParseFromArray(read_result.data.data(),
+                                      read_result.data.size()),
+              "Unable to parse serialized response proto.");
+    CF_EXPECT(response.status().code() == cvd::Status::OK,
+              "The cvd server rejected the status: "
+                  << response.status().message());
+    return {};
+  }
+
+  const CuttlefishConfig& config_;
+  const CuttlefishConfig::InstanceSpecific& instance_;
+  KernelLogPipeProvider& kernel_log_pipe_provider_;
+  ProcessMonitor* process_monitor_ = nullptr;
+
+  SharedFD kernel_log_pipe_;
+  SharedFD interrupt_fd_;
+  SharedFD dev_null_;
+  // With guest memory merging
+  std::optional<KsmTuner> ksm_tuner_;
+  // Only touched by reporter_ while it runs
+  cvd::InstanceStatus status_;
+  std::optional<UnixMessageSocket> server_;
+  std::thread reporter_;
+};
+
+}  // namespace
+
+StatusReporter::~StatusReporter() = default;
+
+fruit::Component<fruit::Required<const CuttlefishConfig,
+                                 const CuttlefishConfig::InstanceSpecific,
+                                 KernelLogPipeProvider>,
+                 StatusReporter>
+statusReporterComponent() {
+  return fruit::createComponent()
+      .bind<StatusReporter, StatusReporterImpl>()
+      .addMultibinding<SetupFeature, StatusReporterImpl>();
+}
+
+}  // namespace cuttlefish
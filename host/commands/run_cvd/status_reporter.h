@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <fruit/fruit.h>
+
+#include "host/commands/run_cvd/process_monitor.h"
+#include "host/libs/config/cuttlefish_config.h"
+#include "host/libs/config/kernel_log_pipe_provider.h"
+
+namespace cuttlefish {
+
+// Pushes the state of the instance to the cvd server, which caches it so that
+// `cvd fleet --cached` and status queries don't have to contact every
+// instance. Nothing is reported while no cvd server is running. With guest
+// memory merging, boot events also drive the host's KSM scan rate.
+class StatusReporter {
+ public:
+  virtual ~StatusReporter();
+  // Starts reporting boot events as they happen, and the liveness and
+  // resource usage of the monitored processes periodically. The usage of
+  // their cgroups is also written to resource_usage.prom in the instance
+  // directory, for the textfile collector of the Prometheus node exporter.
+  virtual void Start(ProcessMonitor& process_monitor) = 0;
+  // Reports the instance as stopped and stops reporting.
+  virtual void Stopped() = 0;
+};
+
+fruit::Component<fruit::Required<const CuttlefishConfig,
+                                 const CuttlefishConfig::InstanceSpecific,
+                                 KernelLogPipeProvider>,
+                 StatusReporter>
+statusReporterComponent();
+
+}  // namespace cuttlefish
@@ -27,7 +27,9 @@
 namespace cuttlefish {
 namespace {
 
+using vm_manager::ValidateDiskOptions;
 using vm_manager::ValidateHostConfiguration;
+using vm_manager::ValidateHugepages;
 
 class ValidateTapDevices : public SetupFeature {
  public:
@@ -56,7 +58,10 @@ class ValidateTapDevices : public SetupFeature {
 
 class ValidateHostConfigurationFeature : public SetupFeature {
  public:
-  INJECT(ValidateHostConfigurationFeature()) {}
+  INJECT(ValidateHostConfigurationFeature(
+      const CuttlefishConfig& config,
+      const CuttlefishConfig::InstanceSpecific& instance))
+      : config_(config), instance_(instance) {}
 
   bool Enabled() const override {
 #ifndef __ANDROID__
@@ -72,7 +77,14 @@ class ValidateHostConfigurationFeature : public SetupFeature {
   bool Setup() override {
     // Check host configuration
     std::vector<std::string> config_commands;
-    if (!ValidateHostConfiguration(&config_commands)) {
+    auto valid = ValidateHostConfiguration(&config_commands);
+    valid &= ValidateHugepages(config_.guest_hugepages(), config_.memory_mb(),
+                               &config_commands);
+    valid &= ValidateDiskOptions(config_.disk_io_backend(),
+                                 config_.disk_direct_io(),
+                                 instance_.virtual_disk_paths(),
+                                 &config_commands);
+    if (!valid) {
       LOG(ERROR) << "Validation of user configuration failed";
       std::cout << "Execute the following to correctly configure:" << std::endl;
       for (auto& command : config_commands) {
@@ -84,11 +96,15 @@ class ValidateHostConfigurationFeature : public SetupFeature {
     }
     return true;
   }
+
+  const CuttlefishConfig& config_;
+  const CuttlefishConfig::InstanceSpecific& instance_;
 };
 
 }  // namespace
 
-fruit::Component<fruit::Required<const CuttlefishConfig::InstanceSpecific>>
+fruit::Component<fruit::Required<const CuttlefishConfig,
+                                 const CuttlefishConfig::InstanceSpecific>>
 validationComponent() {
   return fruit::createComponent()
       .addMultibinding<SetupFeature, ValidateHostConfigurationFeature>()
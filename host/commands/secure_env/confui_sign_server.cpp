@@ -15,6 +15,8 @@
 
 #include "confui_sign_server.h"
 
+#include <thread>
+
 #include <android-base/logging.h>
 
 #include "host/commands/secure_env/primary_key_builder.h"
@@ -42,49 +44,69 @@ ConfUiSignServer::ConfUiSignServer(TpmResourceManager& tpm_resource_manager,
       LOG(ERROR) << "Confirmation UI host signing client socket is broken.";
       continue;
     }
-    ConfUiSignSender sign_sender(accepted_socket_fd);
+    // Clients keep their connection for every prompt they sign, and one
+    // client waiting on its next prompt mustn't hold up the others. The TPM
+    // itself is still used by one request at a time.
+    std::thread([this, accepted_socket_fd]() {
+      ServeConnection(accepted_socket_fd);
+    }).detach();
+  }
+}
 
+void ConfUiSignServer::ServeConnection(SharedFD client_fd) {
+  ConfUiSignSender sign_sender(client_fd);
+  while (true) {
     // receive request
     auto request_opt = sign_sender.Receive();
     if (!request_opt) {
-      std::string error_category = (sign_sender.IsIoError() ? "IO" : "Logic");
-      LOG(ERROR) << "ReceiveRequest failed with " << error_category << " error";
-      continue;
+      // Clients closing their connection is how it usually ends
+      if (!sign_sender.IsIoError()) {
+        LOG(ERROR) << "ReceiveRequest failed with Logic error";
+      }
+      return;
     }
     auto request = request_opt.value();
 
-    // get signing key
-    auto signing_key_builder = PrimaryKeyBuilder();
-    signing_key_builder.SigningKey();
-    signing_key_builder.UniqueData("confirmation_token");
-    auto signing_key = signing_key_builder.CreateKey(tpm_resource_manager_);
-    if (!signing_key) {
-      LOG(ERROR) << "Could not generate signing key";
-      sign_sender.Send(confui::SignMessageError::kUnknownError, {});
-      continue;
-    }
-
-    // hmac
-    auto hmac = TpmHmac(tpm_resource_manager_, signing_key->get(),
-                        TpmAuth(ESYS_TR_PASSWORD), request.payload_.data(),
-                        request.payload_.size());
-    if (!hmac) {
-      LOG(ERROR) << "Could not calculate confirmation token hmac";
-      sign_sender.Send(confui::SignMessageError::kUnknownError, {});
-      continue;
-    }
-    if (hmac->size == 0) {
-      LOG(ERROR) << "hmac was too short";
+    auto hmac_buffer = SignRequest(request.payload_);
+    if (!hmac_buffer) {
       sign_sender.Send(confui::SignMessageError::kUnknownError, {});
-      continue;
+      // The client drops the connection after an error
+      return;
     }
-
     // send hmac
-    std::vector<std::uint8_t> hmac_buffer(hmac->buffer,
-                                          hmac->buffer + hmac->size);
-    if (!sign_sender.Send(confui::SignMessageError::kOk, hmac_buffer)) {
+    if (!sign_sender.Send(confui::SignMessageError::kOk, *hmac_buffer)) {
       LOG(ERROR) << "Sending signature failed likely due to I/O error";
+      return;
     }
   }
 }
+
+std::optional<std::vector<std::uint8_t>> ConfUiSignServer::SignRequest(
+    const std::vector<std::uint8_t>& payload) {
+  // get signing key
+  auto signing_key_builder = PrimaryKeyBuilder();
+  signing_key_builder.SigningKey();
+  signing_key_builder.UniqueData("confirmation_token");
+  auto lock = tpm_resource_manager_.Lock();
+  auto signing_key = signing_key_builder.CreateKey(tpm_resource_manager_);
+  if (!signing_key) {
+    LOG(ERROR) << "Could not generate signing key";
+    return std::nullopt;
+  }
+
+  // hmac
+  auto hmac = TpmHmac(tpm_resource_manager_, signing_key->get(),
+                      TpmAuth(ESYS_TR_PASSWORD), payload.data(),
+                      payload.size());
+  lock.unlock();
+  if (!hmac) {
+    LOG(ERROR) << "Could not calculate confirmation token hmac";
+    return std::nullopt;
+  }
+  if (hmac->size == 0) {
+    LOG(ERROR) << "hmac was too short";
+    return std::nullopt;
+  }
+  return std::vector<std::uint8_t>(hmac->buffer, hmac->buffer + hmac->size);
+}
 }  // namespace cuttlefish
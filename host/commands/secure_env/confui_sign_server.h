@@ -15,7 +15,10 @@
 
 #pragma once
 
+#include <cstdint>
+#include <optional>
 #include <string>
+#include <vector>
 
 #include "common/libs/fs/shared_fd.h"
 #include "common/libs/security/confui_sign.h"
@@ -29,6 +32,11 @@ class ConfUiSignServer {
   [[noreturn]] void MainLoop();
 
  private:
+  // Answers the requests of a client until it disconnects.
+  void ServeConnection(SharedFD client_fd);
+  std::optional<std::vector<std::uint8_t>> SignRequest(
+      const std::vector<std::uint8_t>& payload);
+
   TpmResourceManager& tpm_resource_manager_;
   std::string server_socket_path_;
   SharedFD server_fd_;
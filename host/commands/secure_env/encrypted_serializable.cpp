@@ -15,8 +15,10 @@
 
 #include "encrypted_serializable.h"
 
+#include <algorithm>
+#include <atomic>
 #include <vector>
-//
+
 #include <android-base/logging.h>
 
 #include "host/commands/secure_env/tpm_auth.h"
@@ -162,22 +164,47 @@ static uint32_t RoundUpToBlockSize(uint32_t num) {
   return num % BLOCK_SIZE == 0 ? num : num + (BLOCK_SIZE - (num % BLOCK_SIZE));
 }
 
-size_t EncryptedSerializable::SerializedSize() const {
+/*
+ * The size of the public and private parts of the keys made by CreateKey.
+ * They only depend on the key templates, so a key is created to measure them
+ * once instead of for every blob.
+ */
+static size_t SerializedKeySize(
+    TpmResourceManager& resource_manager,
+    const std::function<TpmObjectSlot(TpmResourceManager&)>& parent_key_fn) {
+  static std::atomic<size_t> cached_size{0};
+  if (auto size = cached_size.load()) {
+    return size;
+  }
   TPM2B_PUBLIC key_public;
   TPM2B_PRIVATE key_private;
-  auto parent = parent_key_fn_(resource_manager_);
+  auto lock = resource_manager.Lock();
+  auto parent = parent_key_fn(resource_manager);
+  if (!parent) {
+    LOG(ERROR) << "Unable to load encryption parent key";
+    return 0;
+  }
   if (!CreateKey(
-      resource_manager_, parent->get(), &key_public, &key_private, nullptr)) {
+      resource_manager, parent->get(), &key_public, &key_private, nullptr)) {
     LOG(ERROR) << "Unable to create key";
     return 0;
   }
-  // Assumes all created keys will have the same size.
   SerializeTpmKeyPublic serialize_public(&key_public);
   SerializeTpmKeyPrivate serialize_private(&key_private);
+  size_t size =
+      serialize_public.SerializedSize() + serialize_private.SerializedSize();
+  cached_size = size;
+  return size;
+}
+
+size_t EncryptedSerializable::SerializedSize() const {
+  auto key_size = SerializedKeySize(resource_manager_, parent_key_fn_);
+  if (key_size == 0) {
+    return 0;
+  }
   auto encrypted_size = RoundUpToBlockSize(wrapped_.SerializedSize());
-  size_t size = serialize_public.SerializedSize();  // tpm key public part
-  size += serialize_private.SerializedSize();       // tpm key private part
-  size += sizeof(uint32_t);                         // block size
+  size_t size = key_size;           // tpm key public and private parts
+  size += sizeof(uint32_t);         // block size
   size += sizeof(uint32_t);         // initialization vector length
   size += sizeof(((TPM2B_IV*)nullptr)->buffer);  // initialization vector
   size += sizeof(uint32_t);         // wrapped size
@@ -189,6 +216,7 @@ uint8_t* EncryptedSerializable::Serialize(
     uint8_t* buf, const uint8_t* end) const {
   TPM2B_PUBLIC key_public;
   TPM2B_PRIVATE key_private;
+  auto lock = resource_manager_.Lock();
   auto parent = parent_key_fn_(resource_manager_);
   if (!parent) {
     LOG(ERROR) << "Unable to load encryption parent key";
@@ -203,7 +231,7 @@ uint8_t* EncryptedSerializable::Serialize(
 
   TPM2B_IV iv;
   iv.size = sizeof(iv.buffer);
-  auto rc = TpmRandomSource(resource_manager_.Esys())
+  auto rc = TpmRandomSource(resource_manager_)
                 .GenerateRandom(iv.buffer, sizeof(iv.buffer));
   if (rc != KM_ERROR_OK) {
     LOG(ERROR) << "Failed to get random data";
@@ -212,21 +240,6 @@ uint8_t* EncryptedSerializable::Serialize(
 
   auto wrapped_size = wrapped_.SerializedSize();
   auto encrypted_size = RoundUpToBlockSize(wrapped_size);
-  std::vector<uint8_t> unencrypted(encrypted_size + 1, 0);
-  auto unencrypted_buf = unencrypted.data();
-  auto unencrypted_buf_end = unencrypted_buf + unencrypted.size();
-  auto next_buf = wrapped_.Serialize(unencrypted_buf, unencrypted_buf_end);
-  if (next_buf - unencrypted_buf != wrapped_size) {
-    LOG(ERROR) << "Size mismatch on wrapped data";
-    return buf;
-  }
-  std::vector<uint8_t> encrypted(encrypted_size, 0);
-  if (!TpmEncrypt(  //
-          resource_manager_.Esys(), key_slot->get(), TpmAuth(ESYS_TR_PASSWORD),
-          iv, unencrypted.data(), encrypted.data(), encrypted_size)) {
-    LOG(ERROR) << "Encryption failed";
-    return buf;
-  }
   SerializeTpmKeyPublic serialize_public(&key_public);
   SerializeTpmKeyPrivate serialize_private(&key_private);
 
@@ -236,12 +249,32 @@ uint8_t* EncryptedSerializable::Serialize(
   buf = keymaster::append_uint32_to_buf(buf, end, iv.size);
   buf = keymaster::append_to_buf(buf, end, iv.buffer, iv.size);
   buf = keymaster::append_uint32_to_buf(buf, end, wrapped_size);
-  buf = keymaster::append_to_buf(buf, end, encrypted.data(), encrypted_size);
-  return buf;
+  if (end - buf < encrypted_size) {
+    LOG(ERROR) << "No space left for the encrypted data";
+    return buf;
+  }
+  // The wrapped data is serialized where it goes and encrypted in place.
+  auto encrypted_end = buf + encrypted_size;
+  auto next_buf = wrapped_.Serialize(buf, encrypted_end);
+  if (next_buf - buf != wrapped_size) {
+    LOG(ERROR) << "Size mismatch on wrapped data";
+    std::fill(buf, encrypted_end, 0);
+    return buf;
+  }
+  std::fill(next_buf, encrypted_end, 0);
+  if (!TpmEncrypt(  //
+          resource_manager_.Esys(), key_slot->get(), TpmAuth(ESYS_TR_PASSWORD),
+          iv, buf, buf, encrypted_size)) {
+    LOG(ERROR) << "Encryption failed";
+    std::fill(buf, encrypted_end, 0);
+    return buf;
+  }
+  return encrypted_end;
 }
 
 bool EncryptedSerializable::Deserialize(
     const uint8_t** buf_ptr, const uint8_t* end) {
+  auto lock = resource_manager_.Lock();
   auto parent_key = parent_key_fn_(resource_manager_);
   if (!parent_key) {
     LOG(ERROR) << "Unable to load encryption parent key";
@@ -297,19 +330,19 @@ bool EncryptedSerializable::Deserialize(
     return false;
   }
   uint32_t encrypted_size = RoundUpToBlockSize(wrapped_size);
-  std::vector<uint8_t> encrypted_data(encrypted_size, 0);
-  if (!keymaster::copy_from_buf(
-      buf_ptr, end, encrypted_data.data(), encrypted_size)) {
+  if (end - *buf_ptr < encrypted_size) {
     LOG(ERROR) << "Failed to read encrypted data";
     return false;
   }
+  // Decrypted straight out of the input buffer
   std::vector<uint8_t> decrypted_data(encrypted_size, 0);
   if (!TpmDecrypt(  //
           resource_manager_.Esys(), key_slot->get(), TpmAuth(ESYS_TR_PASSWORD),
-          iv, encrypted_data.data(), decrypted_data.data(), encrypted_size)) {
+          iv, *buf_ptr, decrypted_data.data(), encrypted_size)) {
     LOG(ERROR) << "Failed to decrypt encrypted data";
     return false;
   }
+  *buf_ptr += encrypted_size;
   auto decrypted_buf = decrypted_data.data();
   auto decrypted_buf_end = decrypted_data.data() + wrapped_size;
   if (!wrapped_.Deserialize(
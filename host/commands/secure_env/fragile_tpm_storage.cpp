@@ -47,7 +47,7 @@ FragileTpmStorage::FragileTpmStorage(
 }
 
 TPM2_HANDLE FragileTpmStorage::GenerateRandomHandle() {
-  TpmRandomSource random_source{resource_manager_.Esys()};
+  TpmRandomSource random_source{resource_manager_};
   TPM2_HANDLE handle = 0;
   random_source.GenerateRandom(
       reinterpret_cast<uint8_t*>(&handle), sizeof(handle));
@@ -67,6 +67,7 @@ bool FragileTpmStorage::Allocate(const Json::Value& key, uint16_t size) {
     LOG(WARNING) << "Key " << key << " is already defined.";
     return false;
   }
+  auto lock = resource_manager_.Lock();
   TPM2_HANDLE handle;
   for (int i = 0; i < MAX_HANDLE_ATTEMPTS; i++) {
     handle = GenerateRandomHandle();
@@ -144,6 +145,7 @@ std::unique_ptr<TPM2B_MAX_NV_BUFFER> FragileTpmStorage::Read(
     LOG(WARNING) << "Could not read from " << key;
     return {};
   }
+  auto lock = resource_manager_.Lock();
   auto close_tr = [this](ESYS_TR* handle) {
     Esys_TR_Close(resource_manager_.Esys(), handle);
     delete handle;
@@ -207,6 +209,7 @@ bool FragileTpmStorage::Write(
     LOG(WARNING) << "Could not read from " << key;
     return false;
   }
+  auto lock = resource_manager_.Lock();
   ESYS_TR nv_handle;
   auto rc = Esys_TR_FromTPMPublic(
       /* esysContext */ resource_manager_.Esys(),
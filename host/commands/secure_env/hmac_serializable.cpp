@@ -43,24 +43,26 @@ size_t HmacSerializable::SerializedSize() const {
 uint8_t* HmacSerializable::Serialize(uint8_t* buf, const uint8_t* end) const {
   auto wrapped_size = wrapped_->SerializedSize();
   buf = keymaster::append_uint32_to_buf(buf, end, wrapped_size);
+  // Signed where it's serialized, in the output buffer
   auto signed_data = buf;
   buf = wrapped_->Serialize(buf, end);
   if (buf - signed_data != wrapped_size) {
     LOG(ERROR) << "Serialized wrapped data did not match expected size.";
     return buf;
   }
+  auto aad = SerializeAad();
+  if (!aad) {
+    return buf;
+  }
+  auto lock = resource_manager_.Lock();
   auto key = signing_key_fn_(resource_manager_);
   if (!key) {
     LOG(ERROR) << "Could not retrieve key";
     return buf;
   }
-  auto maced_data = AppendAad(signed_data, wrapped_size);
-  if (!maced_data) {
-    return buf;
-  }
   auto hmac_data =
       TpmHmac(resource_manager_, key->get(), TpmAuth(ESYS_TR_PASSWORD),
-              maced_data->data(), maced_data->size());
+              signed_data, wrapped_size, aad->data(), aad->size());
   if (!hmac_data) {
     LOG(ERROR) << "Failed to produce hmac";
     return buf;
@@ -74,22 +76,31 @@ uint8_t* HmacSerializable::Serialize(uint8_t* buf, const uint8_t* end) const {
       buf, end, hmac_data->buffer, digest_size_);
 }
 
+/* Reads a size and that much data, pointing into the buffer instead of
+ * copying it out. */
+static bool ReadSizedData(const uint8_t** buf_ptr, const uint8_t* end,
+                          const uint8_t** data, uint32_t* data_size) {
+  if (!keymaster::copy_uint32_from_buf(buf_ptr, end, data_size)) {
+    return false;
+  }
+  if (end - *buf_ptr < *data_size) {
+    return false;
+  }
+  *data = *buf_ptr;
+  *buf_ptr += *data_size;
+  return true;
+}
+
 bool HmacSerializable::Deserialize(const uint8_t** buf_ptr, const uint8_t* end) {
-  size_t signed_data_size;
-  keymaster::UniquePtr<uint8_t[]> signed_data;
-  bool success =
-      keymaster::copy_size_and_data_from_buf(
-          buf_ptr, end, &signed_data_size, &signed_data);
-  if (!success) {
+  const uint8_t* signed_data;
+  uint32_t signed_data_size;
+  if (!ReadSizedData(buf_ptr, end, &signed_data, &signed_data_size)) {
     LOG(ERROR) << "Failed to retrieve signed data";
     return false;
   }
-  size_t signature_size;
-  keymaster::UniquePtr<uint8_t[]> signature;
-  success =
-      keymaster::copy_size_and_data_from_buf(
-          buf_ptr, end, &signature_size, &signature);
-  if (!success) {
+  const uint8_t* signature;
+  uint32_t signature_size;
+  if (!ReadSizedData(buf_ptr, end, &signature, &signature_size)) {
     LOG(ERROR) << "Failed to retrieve signature";
     return false;
   }
@@ -97,18 +108,19 @@ bool HmacSerializable::Deserialize(const uint8_t** buf_ptr, const uint8_t* end)
     LOG(ERROR) << "Digest size did not match expected size.";
     return false;
   }
+  auto aad = SerializeAad();
+  if (!aad) {
+    return false;
+  }
+  auto lock = resource_manager_.Lock();
   auto key = signing_key_fn_(resource_manager_);
   if (!key) {
     LOG(ERROR) << "Could not retrieve key";
     return false;
   }
-  auto maced_data = AppendAad(signed_data.get(), signed_data_size);
-  if (!maced_data) {
-    return false;
-  }
   auto hmac_check =
       TpmHmac(resource_manager_, key->get(), TpmAuth(ESYS_TR_PASSWORD),
-              maced_data->data(), maced_data->size());
+              signed_data, signed_data_size, aad->data(), aad->size());
   if (!hmac_check) {
     LOG(ERROR) << "Unable to calculate signature check";
     return false;
@@ -118,27 +130,21 @@ bool HmacSerializable::Deserialize(const uint8_t** buf_ptr, const uint8_t* end)
                << ", TPM produced " << hmac_check->size;
     return false;
   }
-  if (memcmp(signature.get(), hmac_check->buffer, digest_size_) != 0) {
+  if (memcmp(signature, hmac_check->buffer, digest_size_) != 0) {
     LOG(ERROR) << "Signature check did not match original signature.";
     return false;
   }
   // Now that we've validated integrity on the data, do the inner deserialization
-  auto inner_buf = signed_data.get();
-  auto inner_buf_end = inner_buf + signed_data_size;
-  return wrapped_->Deserialize(
-      const_cast<const uint8_t**>(&inner_buf), inner_buf_end);
+  return wrapped_->Deserialize(&signed_data, signed_data + signed_data_size);
 }
 
-std::optional<std::vector<uint8_t>> HmacSerializable::AppendAad(
-    const uint8_t* sensitive, size_t sensitive_size) const {
+std::optional<std::vector<uint8_t>> HmacSerializable::SerializeAad() const {
   if (!aad_) {
-    return std::vector<uint8_t>(sensitive, sensitive + sensitive_size);
+    return std::vector<uint8_t>();
   }
-  std::vector<uint8_t> output(sensitive_size + aad_->SerializedSize());
-  std::copy(sensitive, sensitive + sensitive_size, output.begin());
-
+  std::vector<uint8_t> output(aad_->SerializedSize());
   const uint8_t* actual_output_end =
-      aad_->Serialize(&output[sensitive_size], output.data() + output.size());
+      aad_->Serialize(output.data(), output.data() + output.size());
   const ptrdiff_t actual_aad_size = actual_output_end - output.data();
   if (actual_aad_size != output.size()) {
     LOG(ERROR) << "Serialized aad did not match expected size. Expected: "
@@ -58,8 +58,9 @@ private:
   Serializable* wrapped_;
   const Serializable* aad_;
 
-  std::optional<std::vector<uint8_t>> AppendAad(const uint8_t* sensitive,
-                                                size_t sensitive_size) const;
+  // The aad is small, serializing it separately saves copying the wrapped
+  // data next to it.
+  std::optional<std::vector<uint8_t>> SerializeAad() const;
 };
 
 }  // namespace cuttlefish
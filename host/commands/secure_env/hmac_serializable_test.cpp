@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/secure_env/hmac_serializable.h"
+
+#include <gtest/gtest.h>
+#include <keymaster/authorization_set.h>
+#include <keymaster/serializable.h>
+#include <string.h>
+
+#include "host/commands/secure_env/encrypted_serializable.h"
+#include "host/commands/secure_env/primary_key_builder.h"
+#include "host/commands/secure_env/test_tpm.h"
+#include "host/commands/secure_env/tpm_resource_manager.h"
+
+namespace cuttlefish {
+
+class TpmHmacSerializable : public ::testing::Test {
+ protected:
+  TpmHmacSerializable() : resource_manager_(tpm_.Esys()) {}
+
+  // Signs and encrypts input_data_ together with `aad`
+  std::vector<uint8_t> Protect(const keymaster::Serializable* aad) {
+    keymaster::Buffer input(input_data_, sizeof(input_data_));
+    EncryptedSerializable encrypt_input(resource_manager_,
+                                        ParentKeyCreator("test"), input);
+    HmacSerializable sign_input(resource_manager_, SigningKeyCreator("test"),
+                                TPM2_SHA256_DIGEST_SIZE, &encrypt_input, aad);
+    std::vector<uint8_t> data(sign_input.SerializedSize());
+    auto end = sign_input.Serialize(data.data(), data.data() + data.size());
+    EXPECT_EQ(end, data.data() + data.size());
+    return data;
+  }
+
+  bool Unprotect(const std::vector<uint8_t>& data,
+                 const keymaster::Serializable* aad,
+                 keymaster::Buffer* output) {
+    EncryptedSerializable decrypt_output(resource_manager_,
+                                         ParentKeyCreator("test"), *output);
+    HmacSerializable check_output(resource_manager_, SigningKeyCreator("test"),
+                                  TPM2_SHA256_DIGEST_SIZE, &decrypt_output,
+                                  aad);
+    const uint8_t* data_ptr = data.data();
+    return check_output.Deserialize(&data_ptr, data.data() + data.size()) &&
+           data_ptr == data.data() + data.size();
+  }
+
+  TestTpm tpm_;
+  TpmResourceManager resource_manager_;
+  uint8_t input_data_[5] = {1, 2, 3, 4, 5};
+};
+
+TEST_F(TpmHmacSerializable, RoundTripWithAad) {
+  auto aad = keymaster::AuthorizationSetBuilder()
+                 .Authorization(keymaster::TAG_APPLICATION_ID, "app", 3)
+                 .build();
+  auto data = Protect(&aad);
+
+  keymaster::Buffer output(sizeof(input_data_));
+  ASSERT_TRUE(Unprotect(data, &aad, &output));
+  ASSERT_EQ(0, memcmp(input_data_, output.begin(), sizeof(input_data_)));
+}
+
+TEST_F(TpmHmacSerializable, RejectsDifferentAad) {
+  auto aad = keymaster::AuthorizationSetBuilder()
+                 .Authorization(keymaster::TAG_APPLICATION_ID, "app", 3)
+                 .build();
+  auto data = Protect(&aad);
+
+  auto other_aad = keymaster::AuthorizationSetBuilder()
+                       .Authorization(keymaster::TAG_APPLICATION_ID, "other", 5)
+                       .build();
+  keymaster::Buffer output(sizeof(input_data_));
+  ASSERT_FALSE(Unprotect(data, &other_aad, &output));
+  ASSERT_FALSE(Unprotect(data, nullptr, &output));
+}
+
+TEST_F(TpmHmacSerializable, RejectsTamperedData) {
+  auto data = Protect(nullptr);
+  data[data.size() / 2] ^= 1;
+
+  keymaster::Buffer output(sizeof(input_data_));
+  ASSERT_FALSE(Unprotect(data, nullptr, &output));
+}
+
+TEST_F(TpmHmacSerializable, RejectsTruncatedData) {
+  auto data = Protect(nullptr);
+  data.pop_back();
+
+  keymaster::Buffer output(sizeof(input_data_));
+  ASSERT_FALSE(Unprotect(data, nullptr, &output));
+}
+
+}  // namespace cuttlefish
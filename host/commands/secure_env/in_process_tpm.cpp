@@ -39,6 +39,8 @@ typedef int SOCKET;
 
 #include <mutex>
 
+#include "common/libs/utils/tracing.h"
+
 namespace cuttlefish {
 
 struct __attribute__((__packed__)) tpm_message_header {
@@ -80,6 +82,7 @@ class InProcessTpm::Impl {
       impl->command_queue_.pop_front();
     }
     auto header = reinterpret_cast<tpm_message_header*>(request.data());
+    CF_TRACE_DETAIL("tpm_command", TpmCommandName(be32toh(header->ordinal)));
     LOG(VERBOSE) << "Sending TPM command "
                 << TpmCommandName(be32toh(header->ordinal));
     _IN_BUFFER input = {
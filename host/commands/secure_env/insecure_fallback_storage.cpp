@@ -15,13 +15,21 @@
 
 #include "host/commands/secure_env/insecure_fallback_storage.h"
 
-#include <fstream>
+#include <fcntl.h>
+
+#include <cstring>
+#include <string_view>
 
 #include <android-base/logging.h>
+#include <keymaster/serializable.h>
 #include <tss2/tss2_rc.h>
 
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/utils/files.h"
+#include "host/commands/secure_env/encrypted_serializable.h"
+#include "host/commands/secure_env/hmac_serializable.h"
 #include "host/commands/secure_env/json_serializable.h"
-#include "host/commands/secure_env/tpm_random_source.h"
+#include "host/commands/secure_env/primary_key_builder.h"
 
 namespace cuttlefish {
 
@@ -29,121 +37,294 @@ static constexpr char kEntries[] = "entries";
 static constexpr char kKey[] = "key";
 static constexpr char kValue[] = "value";
 
-InsecureFallbackStorage::InsecureFallbackStorage(
-    TpmResourceManager& resource_manager, const std::string& index_file)
-    : resource_manager_(resource_manager), index_file_(index_file) {
-  index_ = ReadProtectedJsonFromFile(resource_manager_, index_file);
-  if (!index_.isMember(kEntries)
-      || index_[kEntries].type() != Json::arrayValue) {
-    if (index_.empty()) {
-      LOG(DEBUG) << "Initializing secure index file";
-    } else {
-      LOG(WARNING) << "Index file missing entries, likely corrupted.";
+static constexpr char kUniqueKey[] = "InsecureFallbackStorage";
+static constexpr std::string_view kLogMagic = "cf_gatekeeper_log_v1\n";
+// The log is fsynced after this many appended records, and on compaction.
+static constexpr size_t kRecordsPerSync = 8;
+// Stale records tolerated in the log beyond one per live entry.
+static constexpr size_t kCompactionSlack = 32;
+
+namespace {
+
+/* A single key/value entry, the payload of one protected log record. */
+class EntrySerializable : public keymaster::Serializable {
+public:
+  EntrySerializable(std::string& key, std::vector<uint8_t>& value)
+      : key_(key), value_(value) {}
+
+  size_t SerializedSize() const override {
+    return 2 * sizeof(uint32_t) + key_.size() + value_.size();
+  }
+
+  uint8_t* Serialize(uint8_t* buf, const uint8_t* end) const override {
+    buf = keymaster::append_size_and_data_to_buf(
+        buf, end, key_.data(), key_.size());
+    return keymaster::append_size_and_data_to_buf(
+        buf, end, value_.data(), value_.size());
+  }
+
+  bool Deserialize(const uint8_t** buf_ptr, const uint8_t* end) override {
+    size_t size = 0;
+    keymaster::UniquePtr<uint8_t[]> data;
+    if (!keymaster::copy_size_and_data_from_buf(buf_ptr, end, &size, &data)) {
+      return false;
     }
-    index_[kEntries] = Json::Value(Json::arrayValue);
-  } else {
-    LOG(DEBUG) << "Restoring index from file";
+    key_.assign(reinterpret_cast<const char*>(data.get()), size);
+    if (!keymaster::copy_size_and_data_from_buf(buf_ptr, end, &size, &data)) {
+      return false;
+    }
+    value_.assign(data.get(), data.get() + size);
+    return true;
   }
+private:
+  std::string& key_;
+  std::vector<uint8_t>& value_;
+};
+
+}  // namespace
+
+static std::string KeyString(const Json::Value& key) {
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "";
+  return Json::writeString(builder, key);
 }
 
-bool InsecureFallbackStorage::Allocate(const Json::Value& key, uint16_t size) {
-  if (HasKey(key)) {
-    LOG(WARNING) << "Key " << key << " is already defined.";
+/* Signs and encrypts an entry, framed with its size for the log. */
+static std::string ProtectRecord(
+    TpmResourceManager& resource_manager, std::string key,
+    std::vector<uint8_t> value) {
+  EntrySerializable entry(key, value);
+  EncryptedSerializable encryption(
+      resource_manager, ParentKeyCreator(kUniqueKey), entry);
+  HmacSerializable sign_check(resource_manager, SigningKeyCreator(kUniqueKey),
+                              TPM2_SHA256_DIGEST_SIZE, &encryption,
+                              /*aad=*/nullptr);
+  uint32_t size = sign_check.SerializedSize();
+  std::string record(sizeof(size) + size + 1, '\0');
+  std::memcpy(record.data(), &size, sizeof(size));
+  auto buf = reinterpret_cast<uint8_t*>(record.data()) + sizeof(size);
+  auto buf_end = buf + size + 1;
+  if (sign_check.Serialize(buf, buf_end) != buf_end - 1) {
+    LOG(ERROR) << "Serialized size did not match up with actual usage.";
+    return {};
+  }
+  record.pop_back();
+  return record;
+}
+
+/* Reads one framed record, advancing `data`. */
+static bool UnprotectRecord(
+    TpmResourceManager& resource_manager, std::string_view* data,
+    std::string* key, std::vector<uint8_t>* value) {
+  uint32_t size = 0;
+  if (data->size() < sizeof(size)) {
     return false;
   }
-  if (size > sizeof(((TPM2B_MAX_NV_BUFFER*)nullptr)->buffer)) {
-    LOG(ERROR) << "Size " << size << " was too large.";
+  std::memcpy(&size, data->data(), sizeof(size));
+  if (data->size() - sizeof(size) < size) {
     return false;
   }
-  Json::Value entry(Json::objectValue);
-  entry[kKey] = key;
-  Json::Value value(Json::arrayValue);
-  for (int i = 0; i < size; i++) {
-    value.append(0);
+  EntrySerializable entry(*key, *value);
+  EncryptedSerializable encryption(
+      resource_manager, ParentKeyCreator(kUniqueKey), entry);
+  HmacSerializable sign_check(resource_manager, SigningKeyCreator(kUniqueKey),
+                              TPM2_SHA256_DIGEST_SIZE, &encryption,
+                              /*aad=*/nullptr);
+  auto buf = reinterpret_cast<const uint8_t*>(data->data()) + sizeof(size);
+  auto buf_end = buf + size;
+  if (!sign_check.Deserialize(&buf, buf_end) || buf != buf_end) {
+    return false;
   }
-  entry[kValue] = value;
-  index_[kEntries].append(entry);
+  data->remove_prefix(sizeof(size) + size);
+  return true;
+}
 
-  if (!WriteProtectedJsonToFile(resource_manager_, index_file_, index_)) {
-    LOG(ERROR) << "Failed to save changes to " << index_file_;
-    return false;
+InsecureFallbackStorage::InsecureFallbackStorage(
+    TpmResourceManager& resource_manager, const std::string& index_file)
+    : resource_manager_(resource_manager), index_file_(index_file) {
+  auto contents = FileExists(index_file_) ? ReadFile(index_file_) : "";
+  bool up_to_date = false;
+  if (std::string_view(contents).substr(0, kLogMagic.size()) == kLogMagic) {
+    LOG(DEBUG) << "Restoring index from file";
+    up_to_date = LoadLog(contents);
+  } else if (!contents.empty()) {
+    LOG(DEBUG) << "Converting index file to the log format";
+    LoadLegacyIndex();
+  } else {
+    LOG(DEBUG) << "Initializing insecure index file";
+  }
+  if (up_to_date) {
+    log_ = SharedFD::Open(index_file_, O_WRONLY | O_APPEND);
+    if (!log_->IsOpen()) {
+      LOG(ERROR) << "Failed to open " << index_file_ << ": "
+                 << log_->StrError();
+    }
+  } else if (!Compact()) {
+    LOG(ERROR) << "Failed to write " << index_file_;
+  }
+}
+
+InsecureFallbackStorage::~InsecureFallbackStorage() {
+  if (unsynced_records_ > 0 && log_->IsOpen()) {
+    log_->Fsync();
+  }
+}
+
+bool InsecureFallbackStorage::LoadLog(const std::string& contents) {
+  std::string_view data(contents);
+  data.remove_prefix(kLogMagic.size());
+  while (!data.empty()) {
+    std::string key;
+    std::vector<uint8_t> value;
+    if (!UnprotectRecord(resource_manager_, &data, &key, &value)) {
+      LOG(WARNING) << "Index was corrupted after " << log_records_
+                   << " records, dropping the rest";
+      return false;
+    }
+    entries_[std::move(key)] = std::move(value);
+    log_records_++;
   }
   return true;
 }
 
-const Json::Value* InsecureFallbackStorage::GetEntry(
-    const Json::Value& key) const {
-  for (auto& entry : index_[kEntries]) {
-    if (!entry.isMember(kKey)) {
+bool InsecureFallbackStorage::LoadLegacyIndex() {
+  auto index = ReadProtectedJsonFromFile(resource_manager_, index_file_);
+  if (!index.isMember(kEntries) || index[kEntries].type() != Json::arrayValue) {
+    LOG(WARNING) << "Index file missing entries, likely corrupted.";
+    return false;
+  }
+  for (const auto& entry : index[kEntries]) {
+    if (!entry.isMember(kKey) || !entry.isMember(kValue)
+        || entry[kValue].type() != Json::arrayValue) {
       LOG(WARNING) << "Index was corrupted";
-      return nullptr;
+      return false;
     }
-    if (entry[kKey] != key) {
-      continue;
+    std::vector<uint8_t> value;
+    for (const auto& byte : entry[kValue]) {
+      value.push_back(byte.asUInt());
     }
-    if (!entry.isMember(kValue) || entry[kValue].type() != Json::arrayValue) {
-      LOG(WARNING) << "Index was corrupted";
-      return nullptr;
+    entries_[KeyString(entry[kKey])] = std::move(value);
+  }
+  return true;
+}
+
+bool InsecureFallbackStorage::AppendRecord(
+    const std::string& key, const std::vector<uint8_t>& value) {
+  if (log_records_ >= entries_.size() + kCompactionSlack) {
+    return Compact();
+  }
+  auto record = ProtectRecord(resource_manager_, key, value);
+  if (record.empty()) {
+    return false;
+  }
+  if (WriteAll(log_, record) != record.size()) {
+    LOG(ERROR) << "Failed to append to " << index_file_ << ": "
+               << log_->StrError();
+    return false;
+  }
+  log_records_++;
+  if (++unsynced_records_ >= kRecordsPerSync) {
+    if (log_->Fsync() != 0) {
+      LOG(WARNING) << "Failed to sync " << index_file_ << ": "
+                   << log_->StrError();
     }
-    return &entry;
+    unsynced_records_ = 0;
   }
-  return nullptr;
+  return true;
 }
 
-Json::Value* InsecureFallbackStorage::GetEntry(const Json::Value& key) {
-  return const_cast<Json::Value*>(
-      static_cast<const InsecureFallbackStorage&>(*this).GetEntry(key));
+bool InsecureFallbackStorage::Compact() {
+  std::string contents(kLogMagic);
+  for (const auto& [key, value] : entries_) {
+    auto record = ProtectRecord(resource_manager_, key, value);
+    if (record.empty()) {
+      return false;
+    }
+    contents += record;
+  }
+  auto temp_file = index_file_ + ".tmp";
+  auto temp = SharedFD::Open(temp_file, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (!temp->IsOpen()) {
+    LOG(ERROR) << "Failed to open " << temp_file << ": " << temp->StrError();
+    return false;
+  }
+  if (WriteAll(temp, contents) != contents.size() || temp->Fsync() != 0) {
+    LOG(ERROR) << "Failed to write " << temp_file << ": " << temp->StrError();
+    return false;
+  }
+  temp->Close();
+  if (!RenameFile(temp_file, index_file_)) {
+    LOG(ERROR) << "Failed to rename " << temp_file << " to " << index_file_;
+    return false;
+  }
+  log_ = SharedFD::Open(index_file_, O_WRONLY | O_APPEND);
+  if (!log_->IsOpen()) {
+    LOG(ERROR) << "Failed to open " << index_file_ << ": " << log_->StrError();
+    return false;
+  }
+  log_records_ = entries_.size();
+  unsynced_records_ = 0;
+  return true;
+}
+
+bool InsecureFallbackStorage::Allocate(const Json::Value& key, uint16_t size) {
+  if (HasKey(key)) {
+    LOG(WARNING) << "Key " << key << " is already defined.";
+    return false;
+  }
+  if (size > sizeof(((TPM2B_MAX_NV_BUFFER*)nullptr)->buffer)) {
+    LOG(ERROR) << "Size " << size << " was too large.";
+    return false;
+  }
+  auto key_string = KeyString(key);
+  auto& value = entries_[key_string];
+  value.assign(size, 0);
+
+  if (!AppendRecord(key_string, value)) {
+    LOG(ERROR) << "Failed to save changes to " << index_file_;
+    return false;
+  }
+  return true;
 }
 
 bool InsecureFallbackStorage::HasKey(const Json::Value& key) const {
-  return static_cast<bool>(GetEntry(key));
+  return entries_.count(KeyString(key)) > 0;
 }
 
 std::unique_ptr<TPM2B_MAX_NV_BUFFER> InsecureFallbackStorage::Read(
     const Json::Value& key) const {
-  auto entry = GetEntry(key);
-  if (!entry) {
+  auto entry = entries_.find(KeyString(key));
+  if (entry == entries_.end()) {
     LOG(WARNING) << "Could not read from " << key;
     return {};
   }
-  const auto& value = (*entry)[kValue];
-  if (value.type() != Json::arrayValue) {
-    LOG(WARNING) << "Index was corrupted";
-    return {};
-  }
+  const auto& value = entry->second;
   auto ret = std::make_unique<TPM2B_MAX_NV_BUFFER>();
   if (value.size() > sizeof(ret->buffer)) {
     LOG(ERROR) << "Index was corrupted: size of data was too large";
     return {};
   }
   ret->size = value.size();
-  for (unsigned int i = 0; i < value.size(); i++) {
-    ret->buffer[i] = value[i].asUInt();
-  }
+  std::memcpy(ret->buffer, value.data(), value.size());
   return ret;
 }
 
 bool InsecureFallbackStorage::Write(
     const Json::Value& key, const TPM2B_MAX_NV_BUFFER& data) {
-  auto entry = GetEntry(key);
-  if (!entry) {
+  auto key_string = KeyString(key);
+  auto entry = entries_.find(key_string);
+  if (entry == entries_.end()) {
     LOG(WARNING) << "Could not read from " << key;
     return false;
   }
-  auto& value = (*entry)[kValue];
-  if (value.type() != Json::arrayValue) {
-    LOG(WARNING) << "Index was corrupted";
-    return false;
-  }
+  auto& value = entry->second;
   if (data.size != value.size()) {
     LOG(ERROR) << "Size of data given was incorrect";
     return false;
-  };
-  for (unsigned int i = 0; i < value.size(); i++) {
-    value[i] = data.buffer[i];
   }
+  value.assign(data.buffer, data.buffer + data.size);
 
-  if (!WriteProtectedJsonToFile(resource_manager_, index_file_, index_)) {
+  if (!AppendRecord(key_string, value)) {
     LOG(ERROR) << "Failed to save changes to " << index_file_;
     return false;
   }
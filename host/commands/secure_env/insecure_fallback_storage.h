@@ -15,24 +15,33 @@
 
 #pragma once
 
+#include <cstdint>
+#include <map>
 #include <string>
+#include <vector>
 
 #include <json/json.h>
 #include <tss2/tss2_tpm2_types.h>
 
+#include "common/libs/fs/shared_fd.h"
 #include "host/commands/secure_env/gatekeeper_storage.h"
 #include "host/commands/secure_env/tpm_resource_manager.h"
 
 namespace cuttlefish {
 
 /**
- * A GatekeeperStorage fallback implementation that is less secure. It uses an
- * index file that is signed and encrypted by the TPM and the sensitive data
- * is contained inside the index file. This file can be deleted or corrupted
- * to lose access to the data inside, and is also susceptible to replay attacks.
- * If the index file is replaced with an older version and the secure
- * environment is restarted, it will still accept the old file with the old
- * data.
+ * A GatekeeperStorage fallback implementation that is less secure. Entries are
+ * kept in a log file of records that are each signed and encrypted by the TPM.
+ * This file can be deleted or corrupted to lose access to the data inside, and
+ * is also susceptible to replay attacks. If the log file is replaced with an
+ * older version, or records are dropped from its end, and the secure
+ * environment is restarted, it will still accept the old data.
+ *
+ * Every Write appends a single record instead of rewriting the whole file. The
+ * log is compacted into one record per entry once it accumulates enough stale
+ * records. Compaction writes a new file and renames it over the old one, so a
+ * crash leaves either version intact. Index files in the older JSON format are
+ * converted on load.
  *
  * This class is not thread-safe, and should be synchronized externally if it
  * is going to be used from multiple threads.
@@ -40,7 +49,7 @@ namespace cuttlefish {
 class InsecureFallbackStorage : public GatekeeperStorage {
 public:
   InsecureFallbackStorage(TpmResourceManager&, const std::string& index_file);
-  ~InsecureFallbackStorage() = default;
+  ~InsecureFallbackStorage();
 
   bool Allocate(const Json::Value& key, uint16_t size) override;
   bool HasKey(const Json::Value& key) const override;
@@ -49,12 +58,17 @@ public:
       override;
   bool Write(const Json::Value& key, const TPM2B_MAX_NV_BUFFER& data) override;
 private:
-  Json::Value* GetEntry(const Json::Value& key);
-  const Json::Value* GetEntry(const Json::Value& key) const;
+  bool LoadLog(const std::string& contents);
+  bool LoadLegacyIndex();
+  bool AppendRecord(const std::string& key, const std::vector<uint8_t>& value);
+  bool Compact();
 
   TpmResourceManager& resource_manager_;
   std::string index_file_;
-  Json::Value index_;
+  std::map<std::string, std::vector<uint8_t>> entries_;
+  SharedFD log_;
+  size_t log_records_ = 0;
+  size_t unsynced_records_ = 0;
 };
 
 }  // namespace cuttlefish
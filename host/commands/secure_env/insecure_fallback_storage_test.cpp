@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/commands/secure_env/insecure_fallback_storage.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <json/json.h>
+
+#include "common/libs/utils/files.h"
+#include "host/commands/secure_env/json_serializable.h"
+#include "host/commands/secure_env/test_tpm.h"
+#include "host/commands/secure_env/tpm_resource_manager.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr char kLogMagic[] = "cf_gatekeeper_log_v1\n";
+
+TPM2B_MAX_NV_BUFFER Buffer(const std::vector<uint8_t>& bytes) {
+  TPM2B_MAX_NV_BUFFER buffer = {};
+  buffer.size = bytes.size();
+  memcpy(buffer.buffer, bytes.data(), bytes.size());
+  return buffer;
+}
+
+std::vector<uint8_t> Bytes(const std::unique_ptr<TPM2B_MAX_NV_BUFFER>& read) {
+  if (!read) {
+    return {};
+  }
+  return std::vector<uint8_t>(read->buffer, read->buffer + read->size);
+}
+
+// The number of size framed records in the log at `path`, -1 if it isn't a
+// log or ends in the middle of a record.
+int CountRecords(const std::string& path) {
+  std::string contents;
+  if (!android::base::ReadFileToString(path, &contents) ||
+      contents.compare(0, strlen(kLogMagic), kLogMagic) != 0) {
+    return -1;
+  }
+  size_t offset = strlen(kLogMagic);
+  int records = 0;
+  while (offset < contents.size()) {
+    uint32_t size = 0;
+    if (contents.size() - offset < sizeof(size)) {
+      return -1;
+    }
+    memcpy(&size, contents.data() + offset, sizeof(size));
+    offset += sizeof(size);
+    if (contents.size() - offset < size) {
+      return -1;
+    }
+    offset += size;
+    records++;
+  }
+  return records;
+}
+
+class InsecureFallbackStorageTest : public ::testing::Test {
+ protected:
+  InsecureFallbackStorageTest() : resource_manager_(tpm_.Esys()) {
+    failure_key_["uid"] = 10;
+    failure_key_["type"] = "failures";
+  }
+
+  std::string Path() const { return std::string(dir_.path) + "/index"; }
+
+  void Truncate(off_t size) { ASSERT_EQ(truncate(Path().c_str(), size), 0); }
+
+  TemporaryDir dir_;
+  TestTpm tpm_;
+  TpmResourceManager resource_manager_;
+  Json::Value password_key_ = "password";
+  Json::Value failure_key_;
+};
+
+TEST_F(InsecureFallbackStorageTest, KeepsEntriesAcrossReopening) {
+  {
+    InsecureFallbackStorage storage(resource_manager_, Path());
+    EXPECT_EQ(CountRecords(Path()), 0);
+    EXPECT_FALSE(storage.HasKey(password_key_));
+    ASSERT_TRUE(storage.Allocate(password_key_, 4));
+    EXPECT_FALSE(storage.Allocate(password_key_, 4));
+    EXPECT_EQ(Bytes(storage.Read(password_key_)),
+              (std::vector<uint8_t>{0, 0, 0, 0}));
+    ASSERT_TRUE(storage.Write(password_key_, Buffer({1, 2, 3, 4})));
+    // Only values of the allocated size
+    EXPECT_FALSE(storage.Write(password_key_, Buffer({1, 2, 3})));
+    EXPECT_FALSE(storage.Write(failure_key_, Buffer({1})));
+    ASSERT_TRUE(storage.Allocate(failure_key_, 1));
+    ASSERT_TRUE(storage.Write(failure_key_, Buffer({7})));
+  }
+  // One record per change
+  EXPECT_EQ(CountRecords(Path()), 4);
+
+  InsecureFallbackStorage storage(resource_manager_, Path());
+  ASSERT_TRUE(storage.HasKey(password_key_));
+  EXPECT_EQ(Bytes(storage.Read(password_key_)),
+            (std::vector<uint8_t>{1, 2, 3, 4}));
+  ASSERT_TRUE(storage.HasKey(failure_key_));
+  EXPECT_EQ(Bytes(storage.Read(failure_key_)), std::vector<uint8_t>{7});
+}
+
+TEST_F(InsecureFallbackStorageTest, KeepsTheRecordsBeforeATruncatedOne) {
+  {
+    InsecureFallbackStorage storage(resource_manager_, Path());
+    ASSERT_TRUE(storage.Allocate(password_key_, 2));
+    ASSERT_TRUE(storage.Write(password_key_, Buffer({1, 2})));
+    ASSERT_TRUE(storage.Allocate(failure_key_, 1));
+  }
+  ASSERT_EQ(CountRecords(Path()), 3);
+  std::string contents;
+  ASSERT_TRUE(android::base::ReadFileToString(Path(), &contents));
+  Truncate(contents.size() - 5);
+
+  {
+    InsecureFallbackStorage storage(resource_manager_, Path());
+    EXPECT_EQ(Bytes(storage.Read(password_key_)),
+              (std::vector<uint8_t>{1, 2}));
+    EXPECT_FALSE(storage.HasKey(failure_key_));
+    // Rewritten without the partial record, one record per entry
+    EXPECT_EQ(CountRecords(Path()), 1);
+    EXPECT_FALSE(FileExists(Path() + ".tmp"));
+    // Appends go after the valid records
+    ASSERT_TRUE(storage.Allocate(failure_key_, 1));
+  }
+  InsecureFallbackStorage storage(resource_manager_, Path());
+  EXPECT_TRUE(storage.HasKey(password_key_));
+  EXPECT_TRUE(storage.HasKey(failure_key_));
+}
+
+TEST_F(InsecureFallbackStorageTest, DropsRecordsThatFailTheSignatureCheck) {
+  {
+    InsecureFallbackStorage storage(resource_manager_, Path());
+    ASSERT_TRUE(storage.Allocate(password_key_, 2));
+    ASSERT_TRUE(storage.Allocate(failure_key_, 1));
+  }
+  std::string contents;
+  ASSERT_TRUE(android::base::ReadFileToString(Path(), &contents));
+  contents.back() ^= 0xff;
+  ASSERT_TRUE(android::base::WriteStringToFile(contents, Path()));
+
+  InsecureFallbackStorage storage(resource_manager_, Path());
+  EXPECT_TRUE(storage.HasKey(password_key_));
+  EXPECT_FALSE(storage.HasKey(failure_key_));
+  EXPECT_EQ(CountRecords(Path()), 1);
+}
+
+TEST_F(InsecureFallbackStorageTest, ConvertsTheLegacyJsonIndex) {
+  Json::Value entry;
+  entry["key"] = failure_key_;
+  entry["value"].append(5);
+  entry["value"].append(6);
+  Json::Value index;
+  index["entries"].append(entry);
+  ASSERT_TRUE(WriteProtectedJsonToFile(resource_manager_, Path(), index));
+
+  {
+    InsecureFallbackStorage storage(resource_manager_, Path());
+    ASSERT_TRUE(storage.HasKey(failure_key_));
+    EXPECT_EQ(Bytes(storage.Read(failure_key_)),
+              (std::vector<uint8_t>{5, 6}));
+    EXPECT_EQ(CountRecords(Path()), 1);
+    ASSERT_TRUE(storage.Write(failure_key_, Buffer({7, 8})));
+  }
+  InsecureFallbackStorage storage(resource_manager_, Path());
+  EXPECT_EQ(Bytes(storage.Read(failure_key_)), (std::vector<uint8_t>{7, 8}));
+}
+
+TEST_F(InsecureFallbackStorageTest, CompactsStaleRecords) {
+  constexpr int kWrites = 100;
+  {
+    InsecureFallbackStorage storage(resource_manager_, Path());
+    ASSERT_TRUE(storage.Allocate(password_key_, 1));
+    for (int i = 0; i < kWrites; i++) {
+      ASSERT_TRUE(storage.Write(password_key_, Buffer({uint8_t(i)})));
+    }
+  }
+  auto records = CountRecords(Path());
+  EXPECT_GT(records, 0);
+  EXPECT_LT(records, kWrites / 2);
+  EXPECT_FALSE(FileExists(Path() + ".tmp"));
+
+  InsecureFallbackStorage storage(resource_manager_, Path());
+  EXPECT_EQ(Bytes(storage.Read(password_key_)),
+            std::vector<uint8_t>{uint8_t(kWrites - 1)});
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares streaming UPDATE_OPERATION requests through KeymasterChannel with
+// the previous framing, which allocated a message per send and read each
+// header and payload with separate syscalls.
+
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+#include <keymaster/android_keymaster_messages.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/security/keymaster_channel.h"
+
+namespace cuttlefish {
+namespace {
+
+const keymaster::KmVersion kKmVersion = keymaster::KmVersion::KEYMINT_2;
+
+keymaster::UpdateOperationRequest MakeRequest(size_t input_size) {
+  keymaster::UpdateOperationRequest request(
+      keymaster::MessageVersion(kKmVersion, 0 /* km_date */));
+  std::vector<uint8_t> input(input_size, 0x5a);
+  request.op_handle = 1;
+  request.input.Reinitialize(input.data(), input.size());
+  return request;
+}
+
+bool UnbufferedSend(SharedFD output, const keymaster::Serializable& message) {
+  auto payload_size = message.SerializedSize();
+  auto to_send = CreateKeymasterMessage(keymaster::UPDATE_OPERATION, false,
+                                        payload_size);
+  message.Serialize(to_send->payload, to_send->payload + payload_size);
+  auto write_size = payload_size + sizeof(keymaster_message);
+  auto to_send_bytes = reinterpret_cast<const char*>(to_send.get());
+  return WriteAll(output, to_send_bytes, write_size) == write_size;
+}
+
+ManagedKeymasterMessage UnbufferedReceive(SharedFD input) {
+  keymaster_message header;
+  if (ReadExactBinary(input, &header) != sizeof(header)) {
+    return {};
+  }
+  auto message =
+      CreateKeymasterMessage(header.cmd, header.is_response, header.payload_size);
+  auto message_bytes = reinterpret_cast<char*>(message->payload);
+  if (ReadExact(input, message_bytes, message->payload_size) !=
+      message->payload_size) {
+    return {};
+  }
+  return message;
+}
+
+void BM_UnbufferedUpdateStream(benchmark::State& state) {
+  SharedFD read_fd;
+  SharedFD write_fd;
+  CHECK(SharedFD::Pipe(&read_fd, &write_fd)) << "Failed to create pipe";
+  auto request = MakeRequest(state.range(0));
+  std::thread writer([write_fd, &request, count = state.max_iterations]() {
+    for (benchmark::IterationCount i = 0; i < count; i++) {
+      CHECK(UnbufferedSend(write_fd, request)) << write_fd->StrError();
+    }
+  });
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(UnbufferedReceive(read_fd));
+  }
+  writer.join();
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_UnbufferedUpdateStream)->Range(64, 256 * 1024)->UseRealTime();
+
+void BM_ChannelUpdateStream(benchmark::State& state) {
+  SharedFD read_fd;
+  SharedFD write_fd;
+  CHECK(SharedFD::Pipe(&read_fd, &write_fd)) << "Failed to create pipe";
+  KeymasterChannel sender(SharedFD(), write_fd);
+  KeymasterChannel receiver(read_fd, SharedFD());
+  auto request = MakeRequest(state.range(0));
+  std::thread writer([&sender, &request, count = state.max_iterations]() {
+    for (benchmark::IterationCount i = 0; i < count; i++) {
+      CHECK(sender.SendRequest(keymaster::UPDATE_OPERATION, request));
+    }
+  });
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(receiver.ReceiveMessage());
+  }
+  writer.join();
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ChannelUpdateStream)->Range(64, 256 * 1024)->UseRealTime();
+
+}  // namespace
+}  // namespace cuttlefish
+
+BENCHMARK_MAIN();
@@ -25,7 +25,9 @@ KeymasterResponder::KeymasterResponder(cuttlefish::KeymasterChannel& channel,
     : channel_(channel), keymaster_(keymaster) {}
 
 bool KeymasterResponder::ProcessMessage() {
-  auto request = channel_.ReceiveMessage();
+  // Echoed back so the guest can match responses to pipelined requests
+  uint32_t request_id = 0;
+  auto request = channel_.ReceiveMessage(&request_id);
   if (!request) {
     LOG(ERROR) << "Could not receive message";
     return false;
@@ -43,7 +45,7 @@ bool KeymasterResponder::ProcessMessage() {
     }                                                                \
     METHOD_NAME##Response response(keymaster_.message_version());    \
     keymaster_.METHOD_NAME(request, &response);                      \
-    return channel_.SendResponse(ENUM_NAME, response);               \
+    return channel_.SendResponse(ENUM_NAME, response, request_id);   \
   }
     HANDLE_MESSAGE(GENERATE_KEY, GenerateKey)
     HANDLE_MESSAGE(BEGIN_OPERATION, BeginOperation)
@@ -78,7 +80,7 @@ bool KeymasterResponder::ProcessMessage() {
       return false;                                                  \
     }                                                                \
     auto response = keymaster_.METHOD_NAME(request);                 \
-    return channel_.SendResponse(ENUM_NAME, response);               \
+    return channel_.SendResponse(ENUM_NAME, response, request_id);   \
   }
     HANDLE_MESSAGE_W_RETURN(COMPUTE_SHARED_HMAC, ComputeSharedHmac)
     HANDLE_MESSAGE_W_RETURN(VERIFY_AUTHORIZATION, VerifyAuthorization)
@@ -91,10 +93,10 @@ bool KeymasterResponder::ProcessMessage() {
                             ConfigureVerifiedBootInfo)
     HANDLE_MESSAGE_W_RETURN(GET_ROOT_OF_TRUST, GetRootOfTrust)
 #undef HANDLE_MESSAGE_W_RETURN
-#define HANDLE_MESSAGE_W_RETURN_NO_ARG(ENUM_NAME, METHOD_NAME) \
-  case ENUM_NAME: {                                            \
-    auto response = keymaster_.METHOD_NAME();                  \
-    return channel_.SendResponse(ENUM_NAME, response);         \
+#define HANDLE_MESSAGE_W_RETURN_NO_ARG(ENUM_NAME, METHOD_NAME)       \
+  case ENUM_NAME: {                                                  \
+    auto response = keymaster_.METHOD_NAME();                        \
+    return channel_.SendResponse(ENUM_NAME, response, request_id);   \
   }
     HANDLE_MESSAGE_W_RETURN_NO_ARG(GET_HMAC_SHARING_PARAMETERS,
                                    GetHmacSharingParameters)
@@ -109,7 +111,7 @@ bool KeymasterResponder::ProcessMessage() {
       AddEntropyResponse response(keymaster_.message_version());
       ;
       keymaster_.AddRngEntropy(request, &response);
-      return channel_.SendResponse(ADD_RNG_ENTROPY, response);
+      return channel_.SendResponse(ADD_RNG_ENTROPY, response, request_id);
     }
     case DESTROY_ATTESTATION_IDS:
       // Cuttlefish doesn't support ID attestation.
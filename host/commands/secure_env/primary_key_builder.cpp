@@ -65,6 +65,7 @@ void PrimaryKeyBuilder::UniqueData(const std::string& data) {
 
 TpmObjectSlot PrimaryKeyBuilder::CreateKey(
     TpmResourceManager& resource_manager) {
+  auto lock = resource_manager.Lock();
   TPM2B_AUTH authValue = {};
   auto rc =
       Esys_TR_SetAuth(resource_manager.Esys(), ESYS_TR_RH_OWNER, &authValue);
@@ -85,14 +86,29 @@ TpmObjectSlot PrimaryKeyBuilder::CreateKey(
   }
   public_template.size = offset;
 
-  TPM2B_SENSITIVE_CREATE in_sensitive = {};
-
   auto key_slot = resource_manager.ReserveSlot();
   if (!key_slot) {
     LOG(ERROR) << "No slots available";
     return {};
   }
   ESYS_TR raw_handle;
+
+  // The key only depends on the template, so a saved context of a previous
+  // instance can be loaded instead of generating it again.
+  std::string cache_key(reinterpret_cast<const char*>(public_template.buffer),
+                        public_template.size);
+  if (auto context = resource_manager.CachedContext(cache_key)) {
+    rc = Esys_ContextLoad(resource_manager.Esys(), &*context, &raw_handle);
+    if (rc == TSS2_RC_SUCCESS) {
+      key_slot->set(raw_handle);
+      return key_slot;
+    }
+    LOG(DEBUG) << "Esys_ContextLoad failed with return code " << rc << " ("
+               << Tss2_RC_Decode(rc) << "), recreating the primary key";
+    resource_manager.DropCachedContext(cache_key);
+  }
+
+  TPM2B_SENSITIVE_CREATE in_sensitive = {};
   // TODO(b/154956668): Define better ACLs on these keys.
   // Since this is a primary key, it's generated deterministically. It would
   // also be possible to generate this once and hold it in storage.
@@ -113,6 +129,16 @@ TpmObjectSlot PrimaryKeyBuilder::CreateKey(
     return {};
   }
   key_slot->set(raw_handle);
+
+  TPMS_CONTEXT* context = nullptr;
+  rc = Esys_ContextSave(resource_manager.Esys(), raw_handle, &context);
+  if (rc == TSS2_RC_SUCCESS) {
+    resource_manager.CacheContext(cache_key, *context);
+    Esys_Free(context);
+  } else {
+    LOG(WARNING) << "Esys_ContextSave failed with return code " << rc << " ("
+                 << Tss2_RC_Decode(rc) << ")";
+  }
   return key_slot;
 }
 
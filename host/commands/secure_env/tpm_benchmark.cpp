@@ -0,0 +1,490 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures the TPM backed operations of secure_env against the in-process TPM
+// simulator. Besides the rate reported by the library, every benchmark reports
+// per-operation latency percentiles so regressions in the TPM simulator or in
+// the keymaster libraries show up in the tail as well as in the average.
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+#include <keymaster/android_keymaster.h>
+#include <keymaster/authorization_set.h>
+#include <keymaster/serializable.h>
+#include <tss2/tss2_esys.h>
+#include <tss2/tss2_rc.h>
+
+#include "host/commands/secure_env/encrypted_serializable.h"
+#include "host/commands/secure_env/fragile_tpm_storage.h"
+#include "host/commands/secure_env/hmac_serializable.h"
+#include "host/commands/secure_env/insecure_fallback_storage.h"
+#include "host/commands/secure_env/primary_key_builder.h"
+#include "host/commands/secure_env/proxy_keymaster_context.h"
+#include "host/commands/secure_env/test_tpm.h"
+#include "host/commands/secure_env/tpm_auth.h"
+#include "host/commands/secure_env/tpm_encrypt_decrypt.h"
+#include "host/commands/secure_env/tpm_gatekeeper.h"
+#include "host/commands/secure_env/tpm_hmac.h"
+#include "host/commands/secure_env/tpm_key_blob_maker.h"
+#include "host/commands/secure_env/tpm_keymaster_context.h"
+#include "host/commands/secure_env/tpm_keymaster_enforcement.h"
+#include "host/commands/secure_env/tpm_resource_manager.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr size_t kOperationTableSize = 16;
+
+// InProcessTpm uses global state, so all the benchmarks share one instance.
+TpmResourceManager& ResourceManager() {
+  static auto tpm = new TestTpm();
+  static auto resource_manager = new TpmResourceManager(tpm->Esys());
+  return *resource_manager;
+}
+
+// The gatekeeper storage is file backed, keep it out of the working directory.
+const std::string& StorageDir() {
+  static const std::string dir = []() {
+    char templ[] = "/tmp/secure_env_benchmark.XXXXXX";
+    CHECK(mkdtemp(templ) != nullptr) << "mkdtemp failed: " << strerror(errno);
+    return std::string(templ);
+  }();
+  return dir;
+}
+
+class Environment {
+ public:
+  Environment()
+      : secure_storage_(ResourceManager(), StorageDir() + "/secure"),
+        insecure_storage_(ResourceManager(), StorageDir() + "/insecure"),
+        gatekeeper_(ResourceManager(), secure_storage_, insecure_storage_),
+        enforcement_(ResourceManager(), gatekeeper_),
+        keymaster_context_(ResourceManager(), enforcement_),
+        keymaster_(new ProxyKeymasterContext(keymaster_context_),
+                   kOperationTableSize,
+                   keymaster::MessageVersion(keymaster::KmVersion::KEYMINT_2,
+                                             0 /* km_date */)) {
+    keymaster::ConfigureRequest request(keymaster_.message_version());
+    keymaster::ConfigureResponse response(keymaster_.message_version());
+    keymaster_.Configure(request, &response);
+    CHECK(response.error == KM_ERROR_OK)
+        << "Failed to configure keymaster: " << response.error;
+  }
+
+  TpmGatekeeper& gatekeeper() { return gatekeeper_; }
+  keymaster::AndroidKeymaster& keymaster() { return keymaster_; }
+
+ private:
+  FragileTpmStorage secure_storage_;
+  InsecureFallbackStorage insecure_storage_;
+  TpmGatekeeper gatekeeper_;
+  TpmKeymasterEnforcement enforcement_;
+  TpmKeymasterContext keymaster_context_;
+  keymaster::AndroidKeymaster keymaster_;
+};
+
+Environment& SharedEnvironment() {
+  static auto environment = new Environment();
+  return *environment;
+}
+
+// Times individual iterations to report latency percentiles and the rate.
+class LatencyRecorder {
+ public:
+  LatencyRecorder(benchmark::State& state) : state_(state) {
+    latencies_.reserve(state.max_iterations);
+  }
+  ~LatencyRecorder() {
+    state_.counters["ops_per_second"] = benchmark::Counter(
+        state_.iterations(), benchmark::Counter::kIsRate);
+    if (latencies_.empty()) {
+      return;
+    }
+    std::sort(latencies_.begin(), latencies_.end());
+    state_.counters["p50_us"] = Percentile(0.50);
+    state_.counters["p90_us"] = Percentile(0.90);
+    state_.counters["p99_us"] = Percentile(0.99);
+    state_.counters["max_us"] = Percentile(1.0);
+  }
+
+  void Start() { start_ = std::chrono::steady_clock::now(); }
+  void Stop() {
+    latencies_.push_back(std::chrono::steady_clock::now() - start_);
+  }
+
+ private:
+  double Percentile(double fraction) const {
+    auto index = static_cast<size_t>(fraction * (latencies_.size() - 1));
+    return std::chrono::duration<double, std::micro>(latencies_[index]).count();
+  }
+
+  benchmark::State& state_;
+  std::chrono::steady_clock::time_point start_;
+  std::vector<std::chrono::steady_clock::duration> latencies_;
+};
+
+// An unrestricted AES key, PrimaryKeyBuilder only makes restricted parents.
+TpmObjectSlot CreateEncryptionKey(TpmResourceManager& resource_manager) {
+  TPM2B_SENSITIVE_CREATE in_sensitive = {};
+  TPM2B_PUBLIC in_public = {};
+  in_public.publicArea.type = TPM2_ALG_SYMCIPHER;
+  in_public.publicArea.nameAlg = TPM2_ALG_SHA256;
+  in_public.publicArea.objectAttributes =
+      TPMA_OBJECT_USERWITHAUTH | TPMA_OBJECT_DECRYPT |
+      TPMA_OBJECT_SIGN_ENCRYPT | TPMA_OBJECT_FIXEDTPM |
+      TPMA_OBJECT_FIXEDPARENT | TPMA_OBJECT_SENSITIVEDATAORIGIN;
+  in_public.publicArea.parameters.symDetail.sym.algorithm = TPM2_ALG_AES;
+  in_public.publicArea.parameters.symDetail.sym.keyBits.aes = 128;
+  in_public.publicArea.parameters.symDetail.sym.mode.aes = TPM2_ALG_CFB;
+  TPM2B_DATA outside_info = {};
+  TPML_PCR_SELECTION creation_pcr = {};
+
+  auto key_slot = resource_manager.ReserveSlot();
+  CHECK(key_slot) << "No slots available";
+  ESYS_TR raw_handle;
+  auto rc = Esys_CreatePrimary(
+      resource_manager.Esys(), ESYS_TR_RH_OWNER, ESYS_TR_PASSWORD,
+      ESYS_TR_NONE, ESYS_TR_NONE, &in_sensitive, &in_public, &outside_info,
+      &creation_pcr, &raw_handle, nullptr, nullptr, nullptr, nullptr);
+  CHECK(rc == TPM2_RC_SUCCESS)
+      << "Esys_CreatePrimary failed: " << Tss2_RC_Decode(rc) << " (" << rc
+      << ")";
+  key_slot->set(raw_handle);
+  return key_slot;
+}
+
+gatekeeper::SizedBuffer MakeSizedBuffer(const std::string& data) {
+  auto buffer = new uint8_t[data.size()];
+  std::copy(data.begin(), data.end(), buffer);
+  return gatekeeper::SizedBuffer(buffer, data.size());
+}
+
+void BM_TpmEncrypt(benchmark::State& state) {
+  auto& resource_manager = ResourceManager();
+  auto lock = resource_manager.Lock();
+  auto key = CreateEncryptionKey(resource_manager);
+  TPM2B_IV iv = {};
+  iv.size = sizeof(iv.buffer);
+  std::vector<uint8_t> input(state.range(0), 0x5a);
+  std::vector<uint8_t> output(input.size());
+  {
+    LatencyRecorder recorder(state);
+    for (auto _ : state) {
+      recorder.Start();
+      CHECK(TpmEncrypt(resource_manager.Esys(), key->get(),
+                       TpmAuth(ESYS_TR_PASSWORD), iv, input.data(),
+                       output.data(), input.size()));
+      recorder.Stop();
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_TpmEncrypt)->Range(16, 16 * 1024)->UseRealTime();
+
+void BM_TpmDecrypt(benchmark::State& state) {
+  auto& resource_manager = ResourceManager();
+  auto lock = resource_manager.Lock();
+  auto key = CreateEncryptionKey(resource_manager);
+  TPM2B_IV iv = {};
+  iv.size = sizeof(iv.buffer);
+  std::vector<uint8_t> input(state.range(0), 0x5a);
+  std::vector<uint8_t> output(input.size());
+  {
+    LatencyRecorder recorder(state);
+    for (auto _ : state) {
+      recorder.Start();
+      CHECK(TpmDecrypt(resource_manager.Esys(), key->get(),
+                       TpmAuth(ESYS_TR_PASSWORD), iv, input.data(),
+                       output.data(), input.size()));
+      recorder.Stop();
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_TpmDecrypt)->Range(16, 16 * 1024)->UseRealTime();
+
+void BM_TpmHmac(benchmark::State& state) {
+  auto& resource_manager = ResourceManager();
+  auto key = SigningKeyCreator("benchmark")(resource_manager);
+  CHECK(key) << "Could not create the signing key";
+  std::vector<uint8_t> data(state.range(0), 0x5a);
+  {
+    LatencyRecorder recorder(state);
+    for (auto _ : state) {
+      recorder.Start();
+      auto hmac = TpmHmac(resource_manager, key->get(),
+                          TpmAuth(ESYS_TR_PASSWORD), data.data(), data.size());
+      recorder.Stop();
+      CHECK(hmac) << "TpmHmac failed";
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_TpmHmac)->Range(16, 16 * 1024)->UseRealTime();
+
+// Includes deriving the signing key, like every HMAC done by secure_env.
+void BM_TpmHmacWithKeyDerivation(benchmark::State& state) {
+  auto& resource_manager = ResourceManager();
+  uint8_t data[64] = {};
+  LatencyRecorder recorder(state);
+  for (auto _ : state) {
+    recorder.Start();
+    auto lock = resource_manager.Lock();
+    auto key = SigningKeyCreator("benchmark")(resource_manager);
+    auto hmac = TpmHmac(resource_manager, key->get(),
+                        TpmAuth(ESYS_TR_PASSWORD), data, sizeof(data));
+    recorder.Stop();
+    CHECK(hmac) << "TpmHmac failed";
+  }
+}
+BENCHMARK(BM_TpmHmacWithKeyDerivation)->UseRealTime();
+
+void BM_EncryptedSerializableRoundTrip(benchmark::State& state) {
+  auto& resource_manager = ResourceManager();
+  std::vector<uint8_t> input_data(state.range(0), 0x5a);
+  keymaster::Buffer input(input_data.data(), input_data.size());
+  EncryptedSerializable encrypt_input(resource_manager,
+                                      ParentKeyCreator("benchmark"), input);
+  std::vector<uint8_t> encrypted(encrypt_input.SerializedSize());
+  {
+    LatencyRecorder recorder(state);
+    for (auto _ : state) {
+      recorder.Start();
+      auto encrypt_end =
+          encrypt_input.Serialize(encrypted.data(),
+                                  encrypted.data() + encrypted.size());
+      keymaster::Buffer output(input_data.size());
+      EncryptedSerializable decrypt_output(
+          resource_manager, ParentKeyCreator("benchmark"), output);
+      const uint8_t* encrypted_ptr = encrypted.data();
+      auto decrypted = decrypt_output.Deserialize(
+          &encrypted_ptr, encrypted.data() + encrypted.size());
+      recorder.Stop();
+      CHECK(encrypt_end == encrypted.data() + encrypted.size());
+      CHECK(decrypted) << "Failed to decrypt";
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_EncryptedSerializableRoundTrip)
+    ->Range(16, 16 * 1024)
+    ->UseRealTime();
+
+// The layering of key blobs: the encrypted data signed together with aad.
+void BM_HmacSerializableRoundTrip(benchmark::State& state) {
+  auto& resource_manager = ResourceManager();
+  std::vector<uint8_t> input_data(state.range(0), 0x5a);
+  keymaster::Buffer input(input_data.data(), input_data.size());
+  auto aad = keymaster::AuthorizationSetBuilder()
+                 .Authorization(keymaster::TAG_APPLICATION_ID, "benchmark", 9)
+                 .build();
+  EncryptedSerializable encrypt_input(resource_manager,
+                                      ParentKeyCreator("benchmark"), input);
+  HmacSerializable sign_input(resource_manager, SigningKeyCreator("benchmark"),
+                              TPM2_SHA256_DIGEST_SIZE, &encrypt_input, &aad);
+  std::vector<uint8_t> signed_data(sign_input.SerializedSize());
+  {
+    LatencyRecorder recorder(state);
+    for (auto _ : state) {
+      recorder.Start();
+      auto sign_end = sign_input.Serialize(
+          signed_data.data(), signed_data.data() + signed_data.size());
+      keymaster::Buffer output(input_data.size());
+      EncryptedSerializable decrypt_output(
+          resource_manager, ParentKeyCreator("benchmark"), output);
+      HmacSerializable check_output(
+          resource_manager, SigningKeyCreator("benchmark"),
+          TPM2_SHA256_DIGEST_SIZE, &decrypt_output, &aad);
+      const uint8_t* signed_ptr = signed_data.data();
+      auto checked = check_output.Deserialize(
+          &signed_ptr, signed_data.data() + signed_data.size());
+      recorder.Stop();
+      CHECK(sign_end == signed_data.data() + signed_data.size());
+      CHECK(checked) << "Failed to check and decrypt";
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_HmacSerializableRoundTrip)
+    ->Range(16, 16 * 1024)
+    ->UseRealTime();
+
+// What every keymaster operation on a key blob pays, without the keymaster
+// message handling around it.
+void BM_KeyBlobCreate(benchmark::State& state) {
+  TpmKeyBlobMaker blob_maker(ResourceManager());
+  std::vector<uint8_t> key_data(state.range(0), 0x5a);
+  keymaster::KeymasterKeyBlob key_material(key_data.data(), key_data.size());
+  auto hw_enforced = keymaster::AuthorizationSetBuilder()
+                         .AesEncryptionKey(128)
+                         .EcbMode()
+                         .Authorization(keymaster::TAG_NO_AUTH_REQUIRED)
+                         .build();
+  keymaster::AuthorizationSet sw_enforced;
+  keymaster::AuthorizationSet hidden;
+  {
+    LatencyRecorder recorder(state);
+    for (auto _ : state) {
+      keymaster::KeymasterKeyBlob blob;
+      recorder.Start();
+      auto rc = blob_maker.UnvalidatedCreateKeyBlob(
+          key_material, hw_enforced, sw_enforced, hidden, &blob);
+      recorder.Stop();
+      CHECK(rc == KM_ERROR_OK) << "Failed to create the key blob: " << rc;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_KeyBlobCreate)->Range(16, 4 * 1024)->UseRealTime();
+
+void BM_KeyBlobUnwrap(benchmark::State& state) {
+  TpmKeyBlobMaker blob_maker(ResourceManager());
+  std::vector<uint8_t> key_data(state.range(0), 0x5a);
+  keymaster::KeymasterKeyBlob key_material(key_data.data(), key_data.size());
+  auto hw_enforced = keymaster::AuthorizationSetBuilder()
+                         .AesEncryptionKey(128)
+                         .EcbMode()
+                         .Authorization(keymaster::TAG_NO_AUTH_REQUIRED)
+                         .build();
+  keymaster::AuthorizationSet sw_enforced;
+  keymaster::AuthorizationSet hidden;
+  keymaster::KeymasterKeyBlob blob;
+  auto rc = blob_maker.UnvalidatedCreateKeyBlob(key_material, hw_enforced,
+                                                sw_enforced, hidden, &blob);
+  CHECK(rc == KM_ERROR_OK) << "Failed to create the key blob: " << rc;
+  {
+    LatencyRecorder recorder(state);
+    for (auto _ : state) {
+      keymaster::AuthorizationSet unwrapped_hw_enforced;
+      keymaster::AuthorizationSet unwrapped_sw_enforced;
+      keymaster::KeymasterKeyBlob unwrapped;
+      recorder.Start();
+      rc = blob_maker.UnwrapKeyBlob(blob, &unwrapped_hw_enforced,
+                                    &unwrapped_sw_enforced, hidden, &unwrapped);
+      recorder.Stop();
+      CHECK(rc == KM_ERROR_OK) << "Failed to unwrap the key blob: " << rc;
+      CHECK(unwrapped.key_material_size == key_data.size());
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_KeyBlobUnwrap)->Range(16, 4 * 1024)->UseRealTime();
+
+void BM_GatekeeperEnroll(benchmark::State& state) {
+  auto& gatekeeper = SharedEnvironment().gatekeeper();
+  LatencyRecorder recorder(state);
+  for (auto _ : state) {
+    gatekeeper::EnrollRequest request(0 /* uid */, {},
+                                      MakeSizedBuffer("password"), {});
+    gatekeeper::EnrollResponse response;
+    recorder.Start();
+    gatekeeper.Enroll(request, &response);
+    recorder.Stop();
+    CHECK(response.error == gatekeeper::ERROR_NONE)
+        << "Enroll failed: " << response.error;
+  }
+}
+BENCHMARK(BM_GatekeeperEnroll)->UseRealTime();
+
+void BM_GatekeeperVerify(benchmark::State& state) {
+  auto& gatekeeper = SharedEnvironment().gatekeeper();
+  gatekeeper::EnrollRequest enroll_request(1 /* uid */, {},
+                                           MakeSizedBuffer("password"), {});
+  gatekeeper::EnrollResponse enroll_response;
+  gatekeeper.Enroll(enroll_request, &enroll_response);
+  CHECK(enroll_response.error == gatekeeper::ERROR_NONE)
+      << "Enroll failed: " << enroll_response.error;
+  auto& handle = enroll_response.enrolled_password_handle;
+  std::string handle_data(handle.Data<char>(), handle.size());
+
+  LatencyRecorder recorder(state);
+  for (auto _ : state) {
+    gatekeeper::VerifyRequest request(1 /* uid */, 0 /* challenge */,
+                                      MakeSizedBuffer(handle_data),
+                                      MakeSizedBuffer("password"));
+    gatekeeper::VerifyResponse response;
+    recorder.Start();
+    gatekeeper.Verify(request, &response);
+    recorder.Stop();
+    CHECK(response.error == gatekeeper::ERROR_NONE)
+        << "Verify failed: " << response.error;
+  }
+}
+BENCHMARK(BM_GatekeeperVerify)->UseRealTime();
+
+void GenerateKeyBenchmark(benchmark::State& state,
+                          const keymaster::AuthorizationSet& description) {
+  auto& keymaster = SharedEnvironment().keymaster();
+  LatencyRecorder recorder(state);
+  for (auto _ : state) {
+    keymaster::GenerateKeyRequest request(keymaster.message_version());
+    request.key_description.Reinitialize(description);
+    keymaster::GenerateKeyResponse response(keymaster.message_version());
+    recorder.Start();
+    keymaster.GenerateKey(request, &response);
+    recorder.Stop();
+    if (response.error != KM_ERROR_OK) {
+      state.SkipWithError("GenerateKey failed");
+      break;
+    }
+  }
+}
+
+void BM_KeymasterGenerateAesKey(benchmark::State& state) {
+  auto description = keymaster::AuthorizationSetBuilder()
+                         .AesEncryptionKey(128)
+                         .EcbMode()
+                         .Padding(KM_PAD_NONE)
+                         .Authorization(keymaster::TAG_NO_AUTH_REQUIRED)
+                         .build();
+  GenerateKeyBenchmark(state, description);
+}
+BENCHMARK(BM_KeymasterGenerateAesKey)->UseRealTime();
+
+void BM_KeymasterGenerateEcKey(benchmark::State& state) {
+  auto description = keymaster::AuthorizationSetBuilder()
+                         .EcdsaSigningKey(256)
+                         .Digest(KM_DIGEST_SHA_2_256)
+                         .Authorization(keymaster::TAG_NO_AUTH_REQUIRED)
+                         .build();
+  GenerateKeyBenchmark(state, description);
+}
+BENCHMARK(BM_KeymasterGenerateEcKey)->UseRealTime();
+
+void BM_KeymasterGenerateRsaKey(benchmark::State& state) {
+  auto description = keymaster::AuthorizationSetBuilder()
+                         .RsaSigningKey(2048, 65537)
+                         .Digest(KM_DIGEST_SHA_2_256)
+                         .Padding(KM_PAD_RSA_PKCS1_1_5_SIGN)
+                         .Authorization(keymaster::TAG_NO_AUTH_REQUIRED)
+                         .build();
+  GenerateKeyBenchmark(state, description);
+}
+BENCHMARK(BM_KeymasterGenerateRsaKey)->UseRealTime();
+
+}  // namespace
+}  // namespace cuttlefish
+
+BENCHMARK_MAIN();
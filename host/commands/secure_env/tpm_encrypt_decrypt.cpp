@@ -17,7 +17,6 @@
 
 #include <algorithm>
 #include <cstring>
-#include <vector>
 
 #include <android-base/logging.h>
 #include <tss2/tss2_rc.h>
@@ -28,14 +27,14 @@ using keymaster::KeymasterBlob;
 
 static bool TpmEncryptDecrypt(  //
     ESYS_CONTEXT* esys, ESYS_TR key_handle, TpmAuth auth, const TPM2B_IV& iv,
-    uint8_t* data_in, uint8_t* data_out, size_t data_size, bool decrypt) {
+    const uint8_t* data_in, uint8_t* data_out, size_t data_size,
+    bool decrypt) {
   if (iv.size != sizeof(iv.buffer)) {
     LOG(ERROR) << "Input IV had wrong size: " << iv.size;
     return false;
   }
   // TODO(schuffelen): Pipeline this for performance. Will require reevaluating
   // the initialization vector logic.
-  std::vector<unsigned char> converted(data_size);
   // malloc for parity with Esys_EncryptDecrypt2
   TPM2B_IV* init_vector_in = (TPM2B_IV*) malloc(sizeof(TPM2B_IV));
   *init_vector_in = iv;
@@ -78,14 +77,14 @@ static bool TpmEncryptDecrypt(  //
 }
 
 bool TpmEncrypt(ESYS_CONTEXT* esys, ESYS_TR key_handle, TpmAuth auth,
-                const TPM2B_IV& iv, uint8_t* data_in, uint8_t* data_out,
+                const TPM2B_IV& iv, const uint8_t* data_in, uint8_t* data_out,
                 size_t data_size) {
   return TpmEncryptDecrypt(  //
       esys, key_handle, auth, iv, data_in, data_out, data_size, false);
 }
 
 bool TpmDecrypt(ESYS_CONTEXT* esys, ESYS_TR key_handle, TpmAuth auth,
-                const TPM2B_IV& iv, uint8_t* data_in, uint8_t* data_out,
+                const TPM2B_IV& iv, const uint8_t* data_in, uint8_t* data_out,
                 size_t data_size) {
   return TpmEncryptDecrypt(  //
       esys, key_handle, auth, iv, data_in, data_out, data_size, true);
@@ -24,6 +24,7 @@ namespace cuttlefish {
 
 /**
  * Encrypt `data_in` to `data_out`, which are both buffers of size `data_size`.
+ * They may be the same buffer to encrypt in place.
  *
  * There are no integrity guarantees on this data: if the encrypted data is
  * corrupted, decrypting it could either fail or produce corrupted output.
@@ -32,17 +33,18 @@ namespace cuttlefish {
  * the plaintext.
  */
 bool TpmEncrypt(ESYS_CONTEXT* esys, ESYS_TR key_handle, TpmAuth auth,
-                const TPM2B_IV& iv, uint8_t* data_in, uint8_t* data_out,
+                const TPM2B_IV& iv, const uint8_t* data_in, uint8_t* data_out,
                 size_t data_size);
 
 /**
  * Decrypt `data_in` to `data_out`, which are both buffers of size `data_size`.
+ * They may be the same buffer to decrypt in place.
  *
  * There are no integrity guarantees on this data: if the encrypted data is
  * corrupted, decrypting it could either fail or produce corrupted output.
  */
 bool TpmDecrypt(ESYS_CONTEXT* esys, ESYS_TR key_handle, TpmAuth auth,
-                const TPM2B_IV& iv, uint8_t* data_in, uint8_t* data_out,
+                const TPM2B_IV& iv, const uint8_t* data_in, uint8_t* data_out,
                 size_t data_size);
 
 }  // namespace cuttlefish
@@ -82,7 +82,7 @@ void TpmGatekeeper::ComputePasswordSignature(
 
 void TpmGatekeeper::GetRandom(void* random, uint32_t requested_size) const {
   auto random_uint8 = reinterpret_cast<uint8_t*>(random);
-  TpmRandomSource(resource_manager_.Esys())
+  TpmRandomSource(resource_manager_)
       .GenerateRandom(random_uint8, requested_size);
 }
 
@@ -98,6 +98,7 @@ void TpmGatekeeper::ComputeSignature(
   PrimaryKeyBuilder key_builder;
   key_builder.UniqueData(key_unique);
   key_builder.SigningKey();
+  auto lock = resource_manager_.Lock();
   auto key_slot = key_builder.CreateKey(resource_manager_);
   if (!key_slot) {
     LOG(ERROR) << "Unable to load signing key into TPM memory";
@@ -15,6 +15,9 @@
 
 #include "tpm_hmac.h"
 
+#include <algorithm>
+#include <cstring>
+
 #include <android-base/logging.h>
 #include <tss2/tss2_rc.h>
 
@@ -22,22 +25,44 @@
 
 namespace cuttlefish {
 
+/* Data followed by a suffix, read as one buffer without joining them. */
+struct HmacInput {
+  const uint8_t* data;
+  size_t data_size;
+  const uint8_t* suffix;
+  size_t suffix_size;
+
+  size_t size() const { return data_size + suffix_size; }
+
+  void CopyTo(size_t offset, size_t len, uint8_t* out) const {
+    if (offset < data_size) {
+      auto from_data = std::min(len, data_size - offset);
+      memcpy(out, &data[offset], from_data);
+      out += from_data;
+      offset += from_data;
+      len -= from_data;
+    }
+    if (len > 0) {
+      memcpy(out, &suffix[offset - data_size], len);
+    }
+  }
+};
+
 /* For data large enough to fit in a single TPM2_HMAC call. */
 static UniqueEsysPtr<TPM2B_DIGEST> OneshotHmac(
     TpmResourceManager& resource_manager,
     ESYS_TR key_handle,
     TpmAuth auth,
-    const uint8_t* data,
-    size_t data_size) {
-  if (data_size  > TPM2_MAX_DIGEST_BUFFER) {
+    const HmacInput& input) {
+  if (input.size() > TPM2_MAX_DIGEST_BUFFER) {
     LOG(ERROR) << "Logic error: OneshotSign called with data_size "
-               << data_size << " (> " << TPM2_MAX_DIGEST_BUFFER << ")";
+               << input.size() << " (> " << TPM2_MAX_DIGEST_BUFFER << ")";
     return {};
   }
   TPM2B_MAX_BUFFER buffer;
   static_assert(sizeof(buffer.buffer) >= TPM2_MAX_DIGEST_BUFFER);
-  buffer.size = data_size;
-  memcpy(buffer.buffer, data, data_size);
+  buffer.size = input.size();
+  input.CopyTo(0, buffer.size, buffer.buffer);
   TPM2B_DIGEST* out_hmac = nullptr;
   auto rc = Esys_HMAC(
       resource_manager.Esys(),
@@ -64,8 +89,7 @@ static UniqueEsysPtr<TPM2B_DIGEST> SegmentedHmac(
     TpmResourceManager& resource_manager,
     ESYS_TR key_handle,
     TpmAuth key_auth,
-    const uint8_t* data,
-    size_t data_size) {
+    const HmacInput& input) {
   // TODO(schuffelen): Pipeline commands where possible.
   TPM2B_AUTH sequence_auth;
   sequence_auth.size = sizeof(rand());
@@ -98,11 +122,11 @@ static UniqueEsysPtr<TPM2B_DIGEST> SegmentedHmac(
                << "(" << rc << ")";
     return {};
   }
-  auto hashed = 0;
+  size_t hashed = 0;
   TPM2B_MAX_BUFFER buffer;
-  while (data_size - hashed > TPM2_MAX_DIGEST_BUFFER) {
+  while (input.size() - hashed > TPM2_MAX_DIGEST_BUFFER) {
     buffer.size = TPM2_MAX_DIGEST_BUFFER;
-    memcpy(buffer.buffer, &data[hashed], TPM2_MAX_DIGEST_BUFFER);
+    input.CopyTo(hashed, TPM2_MAX_DIGEST_BUFFER, buffer.buffer);
     hashed += TPM2_MAX_DIGEST_BUFFER;
     rc = Esys_SequenceUpdate(
         resource_manager.Esys(),
@@ -117,8 +141,8 @@ static UniqueEsysPtr<TPM2B_DIGEST> SegmentedHmac(
       return {};
     }
   }
-  buffer.size = data_size - hashed;
-  memcpy(buffer.buffer, &data[hashed], buffer.size);
+  buffer.size = input.size() - hashed;
+  input.CopyTo(hashed, buffer.size, buffer.buffer);
   TPM2B_DIGEST* out_hmac = nullptr;
   TPMT_TK_HASHCHECK* validation = nullptr;
   rc = Esys_SequenceComplete(
@@ -152,8 +176,22 @@ UniqueEsysPtr<TPM2B_DIGEST> TpmHmac(
     TpmAuth auth,
     const uint8_t* data,
     size_t data_size) {
-  auto fn = data_size > TPM2_MAX_DIGEST_BUFFER ? SegmentedHmac : OneshotHmac;
-  return fn(resource_manager, key_handle, auth, data, data_size);
+  return TpmHmac(resource_manager, key_handle, auth, data, data_size, nullptr,
+                 0);
+}
+
+UniqueEsysPtr<TPM2B_DIGEST> TpmHmac(
+    TpmResourceManager& resource_manager,
+    ESYS_TR key_handle,
+    TpmAuth auth,
+    const uint8_t* data,
+    size_t data_size,
+    const uint8_t* suffix,
+    size_t suffix_size) {
+  HmacInput input = {data, data_size, suffix, suffix_size};
+  auto lock = resource_manager.Lock();
+  auto fn = input.size() > TPM2_MAX_DIGEST_BUFFER ? SegmentedHmac : OneshotHmac;
+  return fn(resource_manager, key_handle, auth, input);
 }
 
 }  // namespace cuttlefish
@@ -52,4 +52,17 @@ UniqueEsysPtr<TPM2B_DIGEST> TpmHmac(
     const uint8_t* data,
     size_t data_size);
 
+/**
+ * Like the above, over `data` followed by `suffix`. Saves callers appending
+ * associated data from copying both into one buffer first.
+ */
+UniqueEsysPtr<TPM2B_DIGEST> TpmHmac(
+    TpmResourceManager& resource_manager,
+    ESYS_TR key_handle,
+    TpmAuth auth,
+    const uint8_t* data,
+    size_t data_size,
+    const uint8_t* suffix,
+    size_t suffix_size);
+
 }  // namespace cuttlefish
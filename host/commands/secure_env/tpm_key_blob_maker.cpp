@@ -161,17 +161,22 @@ static keymaster_error_t SplitEnforcedProperties(
   return KM_ERROR_OK;
 }
 
+/* Serializes straight into the blob, every layer writes into the one buffer. */
 static KeymasterKeyBlob SerializableToKeyBlob(
     const Serializable& serializable) {
-  std::vector<uint8_t> data(serializable.SerializedSize() + 1);
-  uint8_t* buf = data.data();
-  uint8_t* buf_end = buf + data.size();
+  KeymasterKeyBlob blob(serializable.SerializedSize());
+  if (blob.key_material == nullptr) {
+    LOG(ERROR) << "Failed to allocate the key blob.";
+    return {};
+  }
+  uint8_t* buf = blob.writable_data();
+  uint8_t* buf_end = buf + blob.key_material_size;
   buf = serializable.Serialize(buf, buf_end);
-  if (buf != (buf_end - 1)) {
+  if (buf != buf_end) {
     LOG(ERROR) << "Serialized size did not match up with actual usage.";
     return {};
   }
-  return KeymasterKeyBlob(data.data(), buf - data.data());
+  return blob;
 }
 
 
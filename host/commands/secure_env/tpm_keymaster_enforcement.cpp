@@ -159,7 +159,7 @@ keymaster_error_t TpmKeymasterEnforcement::GetHmacSharingParameters(
     HmacSharingParameters* params) {
   if (!have_saved_params_) {
     saved_params_.seed = {};
-    TpmRandomSource random_source{resource_manager_.Esys()};
+    TpmRandomSource random_source{resource_manager_};
     auto rc = random_source.GenerateRandom(saved_params_.nonce,
                                            sizeof(saved_params_.nonce));
     if (rc != KM_ERROR_OK) {
@@ -207,6 +207,7 @@ keymaster_error_t TpmKeymasterEnforcement::ComputeSharedHmac(
   auto signing_key_builder = PrimaryKeyBuilder();
   signing_key_builder.SigningKey();
   signing_key_builder.UniqueData(std::string(unique_data, sizeof(unique_data)));
+  auto lock = resource_manager_.Lock();
   auto signing_key = signing_key_builder.CreateKey(resource_manager_);
   if (!signing_key) {
     LOG(ERROR) << "Could not make signing key for key id";
@@ -251,6 +252,7 @@ VerifyAuthorizationResponse TpmKeymasterEnforcement::VerifyAuthorization(
   auto signing_key_builder = PrimaryKeyBuilder();
   signing_key_builder.SigningKey();
   signing_key_builder.UniqueData("verify_authorization");
+  auto lock = resource_manager_.Lock();
   auto signing_key = signing_key_builder.CreateKey(resource_manager_);
   if (!signing_key) {
     LOG(ERROR) << "Could not make signing key for verifying authorization";
@@ -282,6 +284,7 @@ keymaster_error_t TpmKeymasterEnforcement::GenerateTimestampToken(
   auto signing_key_builder = PrimaryKeyBuilder();
   signing_key_builder.SigningKey();
   signing_key_builder.UniqueData("timestamp_token");
+  auto lock = resource_manager_.Lock();
   auto signing_key = signing_key_builder.CreateKey(resource_manager_);
   if (!signing_key) {
     LOG(ERROR) << "Could not make signing key for verifying authorization";
@@ -326,6 +329,7 @@ bool TpmKeymasterEnforcement::CreateKeyId(const keymaster_key_blob_t& key_blob,
   auto signing_key_builder = PrimaryKeyBuilder();
   signing_key_builder.SigningKey();
   signing_key_builder.UniqueData("key_id");
+  auto lock = resource_manager_.Lock();
   auto signing_key = signing_key_builder.CreateKey(resource_manager_);
   if (!signing_key) {
     LOG(ERROR) << "Could not make signing key for key id";
@@ -21,7 +21,8 @@
 
 namespace cuttlefish {
 
-TpmRandomSource::TpmRandomSource(ESYS_CONTEXT* esys) : esys_(esys) {
+TpmRandomSource::TpmRandomSource(TpmResourceManager& resource_manager)
+    : resource_manager_(resource_manager) {
 }
 
 keymaster_error_t TpmRandomSource::GenerateRandom(
@@ -30,11 +31,12 @@ keymaster_error_t TpmRandomSource::GenerateRandom(
     return KM_ERROR_OK;
   }
   // TODO(b/158790549): Pipeline these calls.
+  auto lock = resource_manager_.Lock();
   TPM2B_DIGEST* generated = nullptr;
   while (requested_length > sizeof(generated->buffer)) {
-    auto rc = Esys_GetRandom(esys_, ESYS_TR_NONE, ESYS_TR_NONE,
-                             ESYS_TR_NONE, sizeof(generated->buffer),
-                             &generated);
+    auto rc = Esys_GetRandom(resource_manager_.Esys(), ESYS_TR_NONE,
+                             ESYS_TR_NONE, ESYS_TR_NONE,
+                             sizeof(generated->buffer), &generated);
     if (rc != TSS2_RC_SUCCESS) {
       LOG(ERROR) << "Esys_GetRandom failed with " << rc << " ("
                  << Tss2_RC_Decode(rc) << ")";
@@ -46,8 +48,9 @@ keymaster_error_t TpmRandomSource::GenerateRandom(
     requested_length -= sizeof(generated->buffer);
     Esys_Free(generated);
   }
-  auto rc = Esys_GetRandom(esys_, ESYS_TR_NONE, ESYS_TR_NONE,
-                           ESYS_TR_NONE, requested_length, &generated);
+  auto rc = Esys_GetRandom(resource_manager_.Esys(), ESYS_TR_NONE,
+                           ESYS_TR_NONE, ESYS_TR_NONE, requested_length,
+                           &generated);
   if (rc != TSS2_RC_SUCCESS) {
     LOG(ERROR) << "Esys_GetRandom failed with " << rc << " ("
                 << Tss2_RC_Decode(rc) << ")";
@@ -69,6 +72,7 @@ keymaster_error_t TpmRandomSource::AddRngEntropy(
     return KM_ERROR_INVALID_INPUT_LENGTH;
   }
 
+  auto lock = resource_manager_.Lock();
   TPM2B_SENSITIVE_DATA in_data;
   while (size > MAX_STIR_RANDOM_BUFFER_SIZE) {
     memcpy(in_data.buffer, buffer, MAX_STIR_RANDOM_BUFFER_SIZE);
@@ -76,7 +80,7 @@ keymaster_error_t TpmRandomSource::AddRngEntropy(
     buffer += MAX_STIR_RANDOM_BUFFER_SIZE;
     size -= MAX_STIR_RANDOM_BUFFER_SIZE;
     auto rc = Esys_StirRandom(
-        esys_,
+        resource_manager_.Esys(),
         ESYS_TR_NONE,
         ESYS_TR_NONE,
         ESYS_TR_NONE,
@@ -92,7 +96,7 @@ keymaster_error_t TpmRandomSource::AddRngEntropy(
   }
   memcpy(in_data.buffer, buffer, size);
   auto rc = Esys_StirRandom(
-      esys_,
+      resource_manager_.Esys(),
       ESYS_TR_NONE,
       ESYS_TR_NONE,
       ESYS_TR_NONE,
@@ -46,6 +46,7 @@ std::vector<uint8_t> TpmRemoteProvisioningContext::DeriveBytesFromHbk(
   PrimaryKeyBuilder key_builder;
   key_builder.SigningKey();
   key_builder.UniqueData("HardwareBoundKey");
+  auto lock = resource_manager_.Lock();
   TpmObjectSlot key = key_builder.CreateKey(resource_manager_);
 
   auto hbk =
@@ -202,6 +203,7 @@ TpmRemoteProvisioningContext::GenerateHmacSha256(
   auto signing_key_builder = PrimaryKeyBuilder();
   signing_key_builder.SigningKey();
   signing_key_builder.UniqueData("Public Key Authentication Key");
+  auto lock = resource_manager_.Lock();
   auto signing_key = signing_key_builder.CreateKey(resource_manager_);
   if (!signing_key) {
     LOG(ERROR) << "Could not make MAC key for authenticating the pubkey";
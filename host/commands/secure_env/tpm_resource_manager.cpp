@@ -20,6 +20,8 @@
 
 namespace cuttlefish {
 
+static constexpr size_t kMaxCachedContexts = 32;
+
 TpmResourceManager::ObjectSlot::ObjectSlot(TpmResourceManager* resource_manager)
     : ObjectSlot(resource_manager, ESYS_TR_NONE) {
 }
@@ -33,6 +35,7 @@ TpmResourceManager::ObjectSlot::ObjectSlot(TpmResourceManager* resource_manager,
 TpmResourceManager::ObjectSlot::~ObjectSlot() {
   if (resource_ != ESYS_TR_NONE) {
     LOG(VERBOSE) << "Freeing resource";
+    auto lock = resource_manager_->Lock();
     auto rc = Esys_FlushContext(resource_manager_->esys_, resource_);
     if (rc != TPM2_RC_SUCCESS) {
       LOG(ERROR) << "Esys_FlushContext failed: " << Tss2_RC_Decode(rc)
@@ -69,6 +72,39 @@ ESYS_CONTEXT* TpmResourceManager::Esys() {
   return esys_;
 }
 
+std::unique_lock<std::recursive_mutex> TpmResourceManager::Lock() {
+  return std::unique_lock<std::recursive_mutex>(esys_mutex_);
+}
+
+std::optional<TPMS_CONTEXT> TpmResourceManager::CachedContext(
+    const std::string& key) {
+  auto it = context_cache_index_.find(key);
+  if (it == context_cache_index_.end()) {
+    return {};
+  }
+  context_cache_.splice(context_cache_.begin(), context_cache_, it->second);
+  return it->second->second;
+}
+
+void TpmResourceManager::CacheContext(const std::string& key,
+                                      const TPMS_CONTEXT& context) {
+  DropCachedContext(key);
+  if (context_cache_.size() >= kMaxCachedContexts) {
+    context_cache_index_.erase(context_cache_.back().first);
+    context_cache_.pop_back();
+  }
+  context_cache_.emplace_front(key, context);
+  context_cache_index_[key] = context_cache_.begin();
+}
+
+void TpmResourceManager::DropCachedContext(const std::string& key) {
+  auto it = context_cache_index_.find(key);
+  if (it != context_cache_index_.end()) {
+    context_cache_.erase(it->second);
+    context_cache_index_.erase(it);
+  }
+}
+
 TpmObjectSlot TpmResourceManager::ReserveSlot() {
   auto slot_num = used_slots_.fetch_add(1);
   if (slot_num >= maximum_object_slots_) {
@@ -15,9 +15,15 @@
 
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <set>
+#include <string>
+#include <unordered_map>
 
 #include <tss2/tss2_esys.h>
 
@@ -55,8 +61,36 @@ public:
 
   ESYS_CONTEXT* Esys();
   std::shared_ptr<ObjectSlot> ReserveSlot();
+
+  /**
+   * The ESYS context is not thread safe and is shared by the keymaster,
+   * gatekeeper and confirmation UI threads. Every TPM command has to be
+   * issued while holding this lock. Sequences of commands that reserve object
+   * slots should hold it from before the first slot is reserved until the
+   * last one is released, so that concurrent sequences can't exhaust the
+   * slots. Work that doesn't use the TPM should happen outside of it, so the
+   * threads only serialize on the TPM itself. This lock is recursive, nested
+   * sequences can take it again.
+   */
+  std::unique_lock<std::recursive_mutex> Lock();
+
+  /**
+   * Bounded LRU cache of saved object contexts, used to reload often-used
+   * deterministic objects such as primary keys without regenerating them.
+   * Saved contexts don't survive a TPM reset, so callers should drop entries
+   * that fail to load. Callers must hold the lock.
+   */
+  std::optional<TPMS_CONTEXT> CachedContext(const std::string& key);
+  void CacheContext(const std::string& key, const TPMS_CONTEXT& context);
+  void DropCachedContext(const std::string& key);
 private:
+  using ContextCacheEntry = std::pair<std::string, TPMS_CONTEXT>;
+
   ESYS_CONTEXT* esys_;
+  std::recursive_mutex esys_mutex_;
+  std::list<ContextCacheEntry> context_cache_;  // Most recently used first
+  std::unordered_map<std::string, std::list<ContextCacheEntry>::iterator>
+      context_cache_index_;
   const std::uint32_t maximum_object_slots_;
   std::atomic<std::uint32_t> used_slots_;
 };
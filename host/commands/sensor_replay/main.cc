@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+#include <gflags/gflags.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+#include "common/libs/utils/subprocess.h"
+#include "host/libs/config/cuttlefish_config.h"
+
+DEFINE_int32(instance_num, cuttlefish::GetInstance(),
+             "Which instance to replay the trace on");
+DEFINE_string(trace, "-",
+              "CSV trace to replay, one `timestamp_ns,sensor,value...` sample "
+              "per line. \"-\" reads the trace from stdin");
+
+namespace cuttlefish {
+namespace {
+
+// Usage examples:
+//   * cvd_replay_sensors --trace=walking.csv
+//   * record_motion | cvd_replay_sensors --instance_num=2
+//
+// A trace line holds a timestamp in nanoseconds, a sensor and its values, in
+// the order of the ISensors event payload, e.g.
+//   120000000,accelerometer,0.1,9.7,0.4
+//   125000000,game_rotation_vector,0.0,0.0,0.7071,0.7071
+// The sensor is either one of the names below or a numeric SensorType. The
+// guest replays the samples with the spacing given by their timestamps.
+
+// android.hardware.sensors SensorType values
+const std::map<std::string, int> kSensorTypes = {
+    {"accelerometer", 1},
+    {"magnetic_field", 2},
+    {"orientation", 3},
+    {"gyroscope", 4},
+    {"light", 5},
+    {"pressure", 6},
+    {"proximity", 8},
+    {"gravity", 9},
+    {"linear_acceleration", 10},
+    {"rotation_vector", 11},
+    {"relative_humidity", 12},
+    {"ambient_temperature", 13},
+    {"game_rotation_vector", 15},
+    {"geomagnetic_rotation_vector", 20},
+    {"hinge_angle", 36},
+};
+
+// Flush to the guest once this much is buffered, or sooner when streaming
+// from stdin and no more input is pending.
+constexpr size_t kBatchSize = 16 * 1024;
+
+// Converts a trace line to the "<timestamp_ns> <type> <value>..." lines read
+// by `cuttlefish_sensor_injection stream`.
+Result<std::string> ConvertSample(const std::string& line) {
+  auto fields = android::base::Split(line, ",");
+  CF_EXPECT(fields.size() >= 3, "Expected timestamp, sensor and values");
+  std::string converted = android::base::Trim(fields[0]);
+  char* end = nullptr;
+  strtoll(converted.c_str(), &end, 10);
+  CF_EXPECT(!converted.empty() && *end == '\0',
+            "Bad timestamp \"" << fields[0] << "\"");
+
+  auto sensor = android::base::Trim(fields[1]);
+  int type = strtol(sensor.c_str(), &end, 10);
+  if (sensor.empty() || *end != '\0') {
+    std::transform(sensor.begin(), sensor.end(), sensor.begin(), ::tolower);
+    auto it = kSensorTypes.find(sensor);
+    CF_EXPECT(it != kSensorTypes.end(), "Unknown sensor \"" << sensor << "\"");
+    type = it->second;
+  }
+  converted += " " + std::to_string(type);
+  for (size_t i = 2; i < fields.size(); i++) {
+    auto value = android::base::Trim(fields[i]);
+    strtof(value.c_str(), &end);
+    CF_EXPECT(!value.empty() && *end == '\0',
+              "Bad value \"" << fields[i] << "\"");
+    converted += " " + value;
+  }
+  converted += "\n";
+  return converted;
+}
+
+int ReplaySensorsMain(int argc, char** argv) {
+  ::android::base::InitLogging(argv, android::base::StderrLogger);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  auto config = CuttlefishConfig::Get();
+  if (!config) {
+    LOG(ERROR) << "Failed to obtain config object";
+    return 1;
+  }
+  auto instance = config->ForInstance(FLAGS_instance_num);
+
+  std::ifstream trace_file;
+  bool from_stdin = FLAGS_trace == "-";
+  if (!from_stdin) {
+    trace_file.open(FLAGS_trace);
+    if (!trace_file) {
+      LOG(ERROR) << "Failed to open \"" << FLAGS_trace << "\"";
+      return 1;
+    }
+  }
+  std::istream& trace = from_stdin ? std::cin : trace_file;
+
+  SharedFD guest_stdin_read, guest_stdin_write;
+  if (!SharedFD::Pipe(&guest_stdin_read, &guest_stdin_write)) {
+    LOG(ERROR) << "Failed to create pipe: " << guest_stdin_read->StrError();
+    return 1;
+  }
+  auto adb = Command(HostBinaryPath("adb"))
+                 .AddParameter("-s")
+                 .AddParameter(instance.adb_device_name())
+                 .AddParameter("shell")
+                 .AddParameter("-T")
+                 .AddParameter("/vendor/bin/cuttlefish_sensor_injection")
+                 .AddParameter("stream")
+                 .RedirectStdIO(Subprocess::StdIOChannel::kStdIn,
+                                guest_stdin_read)
+                 .Start();
+  guest_stdin_read->Close();
+
+  std::string batch;
+  batch.reserve(kBatchSize);
+  auto flush = [&batch, &guest_stdin_write]() {
+    auto written = WriteAll(guest_stdin_write, batch);
+    bool success = written == static_cast<ssize_t>(batch.size());
+    if (!success) {
+      LOG(ERROR) << "Failed to send samples to the guest: "
+                 << guest_stdin_write->StrError();
+    }
+    batch.clear();
+    return success;
+  };
+  std::string line;
+  size_t line_number = 0;
+  size_t samples = 0;
+  bool success = true;
+  while (success && std::getline(trace, line)) {
+    line_number++;
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    auto converted = ConvertSample(line);
+    if (!converted.ok()) {
+      // Recorded traces usually start with a column header
+      if (samples > 0 || line_number > 1) {
+        LOG(WARNING) << "Skipping line " << line_number << ": "
+                     << converted.error();
+      }
+      continue;
+    }
+    batch += *converted;
+    samples++;
+    if (batch.size() >= kBatchSize ||
+        (from_stdin && std::cin.rdbuf()->in_avail() <= 0)) {
+      success = flush();
+    }
+  }
+  if (success && !batch.empty()) {
+    success = flush();
+  }
+  // Lets the guest finish playback of what it already received.
+  guest_stdin_write->Close();
+
+  if (adb.Wait() != 0) {
+    LOG(ERROR) << "Sensor playback in the guest failed";
+    return 1;
+  }
+  LOG(INFO) << "Replayed " << samples << " samples";
+  return success ? 0 : 1;
+}
+
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  return cuttlefish::ReplaySensorsMain(argc, argv);
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+#include <string>
+
+#include <android-base/logging.h>
+#include <gflags/gflags.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/fs/shared_select.h"
+#include "common/libs/utils/environment.h"
+#include "common/libs/utils/files.h"
+#include "host/commands/run_cvd/runner_defs.h"
+#include "host/libs/config/cuttlefish_config.h"
+
+DEFINE_int32(instance_num, cuttlefish::GetInstance(),
+             "Which instance to snapshot");
+
+DEFINE_int32(wait_for_launcher, 30,
+             "How many seconds to wait for the launcher to respond to the "
+             "snapshot command. A value of zero means wait indefinetly");
+
+DEFINE_string(snapshot_path, "",
+              "Directory to save the snapshot to. Start the device from it "
+              "with `cvd restore --snapshot_path=<directory>`.");
+
+namespace cuttlefish {
+namespace {
+
+int SnapshotCvdMain(int argc, char** argv) {
+  ::android::base::InitLogging(argv, android::base::StderrLogger);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (FLAGS_snapshot_path.empty()) {
+    LOG(ERROR) << "--snapshot_path is required";
+    return 1;
+  }
+  auto config = CuttlefishConfig::Get();
+  if (!config) {
+    LOG(ERROR) << "Failed to obtain config object";
+    return 1;
+  }
+
+  auto instance = config->ForInstance(FLAGS_instance_num);
+  auto monitor_path = instance.launcher_monitor_socket_path();
+  if (monitor_path.empty()) {
+    LOG(ERROR) << "No path to launcher monitor found";
+    return 2;
+  }
+  // This may hang if the server never picks up the connection.
+  auto monitor_socket = SharedFD::SocketLocalClient(
+      monitor_path.c_str(), false, SOCK_STREAM, FLAGS_wait_for_launcher);
+  if (!monitor_socket->IsOpen()) {
+    LOG(ERROR) << "Unable to connect to launcher monitor at " << monitor_path
+               << ": " << monitor_socket->StrError();
+    return 3;
+  }
+  // The launcher runs in the instance directory, send it an absolute path
+  auto path = AbsolutePath(FLAGS_snapshot_path);
+  std::uint32_t path_size = path.size();
+  auto request = LauncherAction::kSnapshot;
+  if (WriteAllBinary(monitor_socket, &request) != sizeof(request) ||
+      WriteAllBinary(monitor_socket, &path_size) != sizeof(path_size) ||
+      WriteAll(monitor_socket, path) != (ssize_t)path.size()) {
+    LOG(ERROR) << "Error sending launcher monitor the snapshot command: "
+               << monitor_socket->StrError();
+    return 4;
+  }
+  // Perform a select with a timeout to guard against launcher hanging
+  SharedFDSet read_set;
+  read_set.Set(monitor_socket);
+  struct timeval timeout = {FLAGS_wait_for_launcher, 0};
+  int selected = Select(&read_set, nullptr, nullptr,
+                        FLAGS_wait_for_launcher <= 0 ? nullptr : &timeout);
+  if (selected < 0) {
+    LOG(ERROR) << "Failed communication with the launcher monitor: "
+               << strerror(errno);
+    return 5;
+  }
+  if (selected == 0) {
+    LOG(ERROR) << "Timeout expired waiting for launcher monitor to respond";
+    return 6;
+  }
+  LauncherResponse response;
+  auto bytes_recv = monitor_socket->Recv(&response, sizeof(response), 0);
+  if (bytes_recv < 0) {
+    LOG(ERROR) << "Error receiving response from launcher monitor: "
+               << monitor_socket->StrError();
+    return 7;
+  }
+  if (response != LauncherResponse::kSuccess) {
+    LOG(ERROR) << "Received '" << static_cast<char>(response)
+               << "' response from launcher monitor for snapshot request";
+    return 8;
+  }
+  LOG(INFO) << "Saved a snapshot of the device to " << path;
+  return 0;
+}
+
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  return cuttlefish::SnapshotCvdMain(argc, argv);
+}
@@ -38,6 +38,7 @@
 
 #include <android-base/logging.h>
 
+#include "common/libs/fs/shared_buf.h"
 #include "common/libs/fs/shared_fd.h"
 #include "common/libs/fs/shared_select.h"
 #include "common/libs/utils/environment.h"
@@ -57,6 +58,56 @@
     CHECK(condition) << message
 
 namespace cuttlefish {
+namespace {
+
+// Null when the launcher can't tell, e.g. because it predates the action
+Json::Value ProcessStatus(SharedFD monitor_socket) {
+  auto request = LauncherAction::kProcessStatus;
+  if (monitor_socket->Send(&request, sizeof(request), 0) <= 0) {
+    return {};
+  }
+  LauncherResponse response;
+  if (monitor_socket->Recv(&response, sizeof(response), 0) <= 0 ||
+      response != LauncherResponse::kSuccess) {
+    return {};
+  }
+  std::uint32_t size = 0;
+  if (ReadExactBinary(monitor_socket, &size) != sizeof(size)) {
+    return {};
+  }
+  std::string status(size, '\0');
+  if (ReadExact(monitor_socket, &status) != (ssize_t)size) {
+    return {};
+  }
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  Json::Value processes;
+  std::string errors;
+  if (!reader->parse(status.data(), status.data() + status.size(), &processes,
+                     &errors)) {
+    LOG(WARNING) << "Could not parse the process status: " << errors;
+    return {};
+  }
+  return processes;
+}
+
+// Null unless the balloon controller has written a status
+Json::Value BalloonStatus(const std::string& path) {
+  std::ifstream status_file(path);
+  if (!status_file.is_open()) {
+    return {};
+  }
+  Json::CharReaderBuilder builder;
+  Json::Value status;
+  std::string errors;
+  if (!Json::parseFromStream(builder, status_file, &status, &errors)) {
+    LOG(WARNING) << "Could not parse \"" << path << "\": " << errors;
+    return {};
+  }
+  return status;
+}
+
+}  // namespace
 
 int CvdStatusMain(int argc, char** argv) {
   ::android::base::InitLogging(argv, android::base::StderrLogger);
@@ -158,6 +209,14 @@ int CvdStatusMain(int argc, char** argv) {
             std::to_string(config->display_configs()[i].dpi) + " )";
       }
       devices_info[index]["status"] = "Running";
+      auto processes = ProcessStatus(monitor_socket);
+      if (!processes.isNull()) {
+        devices_info[index]["processes"] = processes;
+      }
+      auto balloon = BalloonStatus(instance.balloon_status_path());
+      if (!balloon.isNull()) {
+        devices_info[index]["balloon"] = balloon;
+      }
       if (index == (instance_names.size() - 1)) {
         std::cout << devices_info.toStyledString() << std::endl;
       }
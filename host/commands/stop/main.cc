@@ -26,14 +26,17 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <signal.h>
+#include <poll.h>
 
 #include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <fstream>
 #include <iomanip>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <android-base/strings.h>
@@ -49,6 +52,7 @@
 #include "host/libs/allocd/request.h"
 #include "host/libs/allocd/utils.h"
 #include "host/libs/config/cuttlefish_config.h"
+#include "host/libs/config/launched_processes.h"
 #include "host/libs/vm_manager/vm_manager.h"
 
 namespace cuttlefish {
@@ -164,15 +168,96 @@ Result<void> CleanStopInstance(
   return {};
 }
 
+int Signal(const LaunchedProcess& process, int signal) {
+  return process.group_leader ? killpg(process.pid, signal)
+                              : kill(process.pid, signal);
+}
+
+// Waits until the processes exit or the deadline passes, and drops the ones
+// that exited from the lists.
+void WaitForExit(std::vector<LaunchedProcess>& processes,
+                 std::vector<SharedFD>& pidfds,
+                 std::chrono::steady_clock::time_point deadline) {
+  while (!processes.empty()) {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    if (remaining.count() <= 0) {
+      return;
+    }
+    std::vector<PollSharedFd> poll_fds;
+    for (const auto& pidfd : pidfds) {
+      poll_fds.push_back({.fd = pidfd, .events = POLLIN});
+    }
+    if (SharedFD::Poll(poll_fds, remaining.count()) < 0) {
+      PLOG(ERROR) << "Failed to wait for the processes to exit";
+      return;
+    }
+    for (std::size_t i = poll_fds.size(); i-- > 0;) {
+      if (poll_fds[i].revents & POLLIN) {
+        processes.erase(processes.begin() + i);
+        pidfds.erase(pidfds.begin() + i);
+      }
+    }
+  }
+}
+
+// Stops the host processes recorded by run_cvd, without the lsof scan of the
+// instance directories. Processes still running `timeout` after SIGTERM get
+// a SIGKILL.
+Result<void> StopLaunchedProcesses(
+    const CuttlefishConfig::InstanceSpecific& instance,
+    std::chrono::seconds timeout) {
+  auto recorded = CF_EXPECT(
+      ReadLaunchedProcesses(instance.launched_processes_path()));
+  std::vector<LaunchedProcess> processes;
+  std::vector<SharedFD> pidfds;
+  for (const auto& process : recorded) {
+    if (process.group_leader && process.pid == getpgrp()) {
+      continue;  // Don't stop stop_cvd
+    }
+    auto pidfd = SharedFD::PidFdOpen(process.pid);
+    // Checked after opening the pidfd, which pins the pid
+    if (pidfd->IsOpen() && IsRunning(process)) {
+      processes.push_back(process);
+      pidfds.push_back(pidfd);
+    }
+  }
+
+  for (const auto& process : processes) {
+    Signal(process, SIGTERM);
+  }
+  WaitForExit(processes, pidfds, std::chrono::steady_clock::now() + timeout);
+  for (const auto& process : processes) {
+    LOG(WARNING) << process.name << " (" << process.pid
+                 << ") didn't exit, sending SIGKILL";
+    Signal(process, SIGKILL);
+  }
+  WaitForExit(processes, pidfds,
+              std::chrono::steady_clock::now() + std::chrono::seconds(1));
+  CF_EXPECT(processes.empty(),
+            processes.size() << " processes survived SIGKILL");
+  LOG(INFO) << "Stopped the processes of " << instance.instance_name();
+  return {};
+}
+
 int StopInstance(const CuttlefishConfig& config,
                  const CuttlefishConfig::InstanceSpecific& instance,
-                 std::int32_t wait_for_launcher) {
+                 std::int32_t wait_for_launcher, std::int32_t kill_timeout) {
   auto res = CleanStopInstance(instance, wait_for_launcher);
-  if (!res.ok()) {
-    LOG(ERROR) << "Clean stop failed: " << res.error();
-    return FallBackStop(DirsForInstance(config, instance));
+  if (res.ok()) {
+    RemoveFile(instance.launched_processes_path());
+    return 0;
+  }
+  LOG(ERROR) << "Clean stop failed: " << res.error();
+  auto stopped =
+      StopLaunchedProcesses(instance, std::chrono::seconds(kill_timeout));
+  if (stopped.ok()) {
+    RemoveFile(instance.launched_processes_path());
+    return 1;  // Having to fallback is an error
   }
-  return 0;
+  LOG(ERROR) << "Stopping the recorded processes failed: " << stopped.error();
+  // Last resort, slow with large instance directories
+  return FallBackStop(DirsForInstance(config, instance));
 }
 
 /// Send a StopSession request to allocd
@@ -198,6 +283,37 @@ void ReleaseAllocdResources(SharedFD allocd_sock, uint32_t session_id) {
   LOG(INFO) << "Stop Session operation: " << resp["config_status"];
 }
 
+int StopAndCleanUpInstance(const CuttlefishConfig& config,
+                           const CuttlefishConfig::InstanceSpecific& instance,
+                           std::int32_t wait_for_launcher,
+                           std::int32_t kill_timeout,
+                           bool clear_instance_dirs) {
+  auto session_id = instance.session_id();
+  int exit_status =
+      StopInstance(config, instance, wait_for_launcher, kill_timeout);
+  if (exit_status == 0 && instance.use_allocd()) {
+    // only release session resources if the instance was stopped
+    SharedFD allocd_sock =
+        SharedFD::SocketLocalClient(kDefaultLocation, false, SOCK_STREAM);
+    if (!allocd_sock->IsOpen()) {
+      LOG(ERROR) << "Unable to connect to allocd on "
+                 << kDefaultLocation << ": "
+                 << allocd_sock->StrError();
+    }
+
+    ReleaseAllocdResources(allocd_sock, session_id);
+  }
+  if (clear_instance_dirs) {
+    if (DirectoryExists(instance.instance_dir())) {
+      LOG(INFO) << "Deleting instance dir " << instance.instance_dir();
+      if (!RecursivelyRemoveDirectory(instance.instance_dir())) {
+        LOG(ERROR) << "Unable to rmdir " << instance.instance_dir();
+      }
+    }
+  }
+  return exit_status;
+}
+
 int StopCvdMain(int argc, char** argv) {
   ::android::base::InitLogging(argv, android::base::StderrLogger);
 
@@ -208,6 +324,12 @@ int StopCvdMain(int argc, char** argv) {
       GflagsCompatFlag("wait_for_launcher", wait_for_launcher)
           .Help("How many seconds to wait for the launcher to respond to the "
                 "status command. A value of zero means wait indefinitely"));
+  std::int32_t kill_timeout = 5;
+  flags.emplace_back(
+      GflagsCompatFlag("kill_timeout", kill_timeout)
+          .Help("When the launcher doesn't respond, how many seconds to wait "
+                "for the host processes to exit after SIGTERM before sending "
+                "SIGKILL."));
   bool clear_instance_dirs;
   flags.emplace_back(
       GflagsCompatFlag("clear_instance_dirs", clear_instance_dirs)
@@ -225,31 +347,22 @@ int StopCvdMain(int argc, char** argv) {
     return FallBackStop(FallbackDirs());
   }
 
+  // Instances are independent, stopping them concurrently bounds the time
+  // to drain a host by the slowest instance.
+  auto instances = config->Instances();
+  std::vector<int> exit_statuses(instances.size(), 0);
+  std::vector<std::thread> threads;
+  for (std::size_t i = 0; i < instances.size(); i++) {
+    threads.emplace_back([&, i]() {
+      exit_statuses[i] = StopAndCleanUpInstance(
+          *config, instances[i], wait_for_launcher, kill_timeout,
+          clear_instance_dirs);
+    });
+  }
   int ret = 0;
-  for (const auto& instance : config->Instances()) {
-    auto session_id = instance.session_id();
-    int exit_status = StopInstance(*config, instance, wait_for_launcher);
-    if (exit_status == 0 && instance.use_allocd()) {
-      // only release session resources if the instance was stopped
-      SharedFD allocd_sock =
-          SharedFD::SocketLocalClient(kDefaultLocation, false, SOCK_STREAM);
-      if (!allocd_sock->IsOpen()) {
-        LOG(ERROR) << "Unable to connect to allocd on "
-                   << kDefaultLocation << ": "
-                   << allocd_sock->StrError();
-      }
-
-      ReleaseAllocdResources(allocd_sock, session_id);
-    }
-    if (clear_instance_dirs) {
-      if (DirectoryExists(instance.instance_dir())) {
-        LOG(INFO) << "Deleting instance dir " << instance.instance_dir();
-        if (!RecursivelyRemoveDirectory(instance.instance_dir())) {
-          LOG(ERROR) << "Unable to rmdir " << instance.instance_dir();
-        }
-      }
-    }
-    ret |= exit_status;
+  for (std::size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+    ret |= exit_statuses[i];
   }
 
   return ret;
@@ -19,12 +19,16 @@
 
 #include <fstream>
 #include <functional>
+#include <future>
 #include <iomanip>
 #include <iostream>
 #include <iterator>
 #include <optional>
+#include <set>
+#include <sstream>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include <android-base/logging.h>
 #include <android-base/result.h>
@@ -79,6 +83,17 @@ class ReadEvalPrintLoop {
         out_(out_fd),
         internal_addresses_(internal_addresses) {}
 
+  ~ReadEvalPrintLoop() {
+    // Each instance waits for its deletion to complete, the futures wait for
+    // all of them in parallel.
+    std::vector<std::future<void>> deletions;
+    for (auto& [name, instance] : instances_) {
+      deletions.push_back(std::async(
+          std::launch::async,
+          [instance = std::move(instance)]() mutable { instance.reset(); }));
+    }
+  }
+
   Result<void> Process() {
     while (true) {
       test_gce_driver::TestMessage msg;
@@ -104,8 +119,16 @@ class ReadEvalPrintLoop {
         case test_gce_driver::TestMessage::ContentsCase::kStreamEnd:
           continue;
         case test_gce_driver::TestMessage::ContentsCase::kCreateInstance:
-          handler_result = NewInstance(msg.create_instance());
+          handler_result = NewInstances({&msg.create_instance()});
           break;
+        case test_gce_driver::TestMessage::ContentsCase::kCreateInstances: {
+          std::vector<const test_gce_driver::CreateInstance*> requests;
+          for (const auto& request : msg.create_instances().instances()) {
+            requests.push_back(&request);
+          }
+          handler_result = NewInstances(requests);
+          break;
+        }
         case test_gce_driver::TestMessage::ContentsCase::kSshCommand:
           handler_result = SshCommand(msg.ssh_command());
           break;
@@ -140,12 +163,50 @@ class ReadEvalPrintLoop {
   }
 
  private:
-  Result<void> NewInstance(const test_gce_driver::CreateInstance& request) {
-    CF_EXPECT(request.id().name() != "", "Instance name must be specified");
-    CF_EXPECT(request.id().zone() != "", "Instance zone must be specified");
-    auto instance = CF_EXPECT(ScopedGceInstance::CreateDefault(
-        gce_, request.id().zone(), request.id().name(), internal_addresses_));
-    instances_.emplace(request.id().name(), std::move(instance));
+  // Most of the time goes to waiting for GCE and for the instances to boot,
+  // so they are all started at once. Instances created by earlier requests are
+  // reset rather than created again.
+  Result<void> NewInstances(
+      const std::vector<const test_gce_driver::CreateInstance*>& requests) {
+    std::set<std::string> names;
+    for (const auto request : requests) {
+      CF_EXPECT(request->id().name() != "", "Instance name must be specified");
+      CF_EXPECT(request->id().zone() != "", "Instance zone must be specified");
+      CF_EXPECT(names.insert(request->id().name()).second,
+                "Instance \"" << request->id().name() << "\" requested twice");
+    }
+    // Null for the reused instances
+    std::vector<std::future<Result<std::unique_ptr<ScopedGceInstance>>>>
+        starts;
+    for (const auto request : requests) {
+      auto existing = instances_.find(request->id().name());
+      if (existing != instances_.end()) {
+        auto task = [instance = existing->second.get()]()
+            -> Result<std::unique_ptr<ScopedGceInstance>> {
+          CF_EXPECT(instance->Reset());
+          return std::unique_ptr<ScopedGceInstance>();
+        };
+        starts.push_back(std::async(std::launch::async, task));
+      } else {
+        auto task = [this, id = request->id()]() {
+          return ScopedGceInstance::CreateDefault(gce_, id.zone(), id.name(),
+                                                  internal_addresses_);
+        };
+        starts.push_back(std::async(std::launch::async, task));
+      }
+    }
+    std::stringstream errors;
+    for (std::size_t i = 0; i < requests.size(); i++) {
+      const auto& name = requests[i]->id().name();
+      auto instance = starts[i].get();
+      if (!instance.ok()) {
+        errors << "\"" << name << "\": " << instance.error() << "\n";
+      } else if (*instance) {
+        instances_.emplace(name, std::move(*instance));
+      }
+    }
+    CF_EXPECT(errors.str().empty(),
+              "Failed to start instances:\n" << errors.str());
     return {};
   }
   Result<void> SshCommand(const test_gce_driver::SshCommand& request) {
@@ -287,6 +287,7 @@ GceApi::GceApi(CurlWrapper& curl, CredentialSource& credentials,
     : curl_(curl), credentials_(credentials), project_(project) {}
 
 std::vector<std::string> GceApi::Headers() {
+  std::lock_guard<std::mutex> lock(credentials_mutex_);
   return {
       "Authorization:Bearer " + credentials_.Credential(),
       "Content-Type: application/json",
@@ -466,7 +467,7 @@ GceApi::Operation GceApi::Reset(const std::string& zone,
   auto task = [this, url = url.str()]() -> Result<Json::Value> {
     auto response = curl_.PostToJson(url, Json::Value(), Headers());
     if (!response.HttpSuccess()) {
-      return Error() << "Failed to create instance: " << response.data;
+      return Error() << "Failed to reset instance: " << response.data;
     }
     return response.data;
   };
@@ -16,6 +16,7 @@
 #pragma once
 
 #include <future>
+#include <mutex>
 #include <optional>
 #include <string>
 
@@ -140,6 +141,9 @@ class GceApi {
   std::vector<std::string> Headers();
 
   CurlWrapper& curl_;
+  // Operations on several instances run concurrently, refreshing the
+  // credential isn't thread safe.
+  std::mutex credentials_mutex_;
   CredentialSource& credentials_;
   std::string project_;
 };
@@ -17,9 +17,11 @@
 
 #include <netinet/ip.h>
 
+#include <chrono>
 #include <random>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include <android-base/file.h>
 #include <android-base/result.h>
@@ -85,6 +87,24 @@ SshCommand SshCommand::RemoteParameter(const std::string& param) && {
   return *this;
 }
 
+SshCommand& SshCommand::ControlPath(const std::string& path) & {
+  control_path_ = path;
+  return *this;
+}
+SshCommand SshCommand::ControlPath(const std::string& path) && {
+  control_path_ = path;
+  return *this;
+}
+
+SshCommand& SshCommand::ControlCommand(const std::string& command) & {
+  control_command_ = command;
+  return *this;
+}
+SshCommand SshCommand::ControlCommand(const std::string& command) && {
+  control_command_ = command;
+  return *this;
+}
+
 Command SshCommand::Build() const {
   Command remote_cmd{"/usr/bin/ssh"};
   if (privkey_path_) {
@@ -97,6 +117,20 @@ Command SshCommand::Build() const {
     remote_cmd.AddParameter("-o");
     remote_cmd.AddParameter("UserKnownHostsFile=/dev/null");
   }
+  if (control_path_) {
+    // Saves the TCP and key exchange round trips of every command after the
+    // first one.
+    remote_cmd.AddParameter("-o");
+    remote_cmd.AddParameter("ControlMaster=auto");
+    remote_cmd.AddParameter("-o");
+    remote_cmd.AddParameter("ControlPath=", *control_path_);
+    remote_cmd.AddParameter("-o");
+    remote_cmd.AddParameter("ControlPersist=10m");
+  }
+  if (control_command_) {
+    remote_cmd.AddParameter("-O");
+    remote_cmd.AddParameter(*control_command_);
+  }
   for (const auto& fwd : remote_port_forwards_) {
     remote_cmd.AddParameter("-R");
     remote_cmd.AddParameter(fwd.remote_port, ":127.0.0.1:", fwd.local_port);
@@ -187,6 +221,8 @@ Result<void> ScopedGceInstance::EnforceSshReady() {
     if (ret == 0) {
       return {};
     }
+    // Refused connections fail right away while sshd is starting
+    std::this_thread::sleep_for(std::chrono::seconds(1));
   }
 
   return Error() << "Failed to ssh to the instance. stdout=\"" << out
@@ -203,6 +239,7 @@ ScopedGceInstance::ScopedGceInstance(GceApi& gce,
       use_internal_address_(use_internal_address) {}
 
 ScopedGceInstance::~ScopedGceInstance() {
+  StopSshMaster();
   auto delete_ins = gce_.Delete(instance_).Future().get();
   if (!delete_ins.ok()) {
     LOG(ERROR) << "Failed to delete instance: " << delete_ins.error();
@@ -219,7 +256,30 @@ Result<SshCommand> ScopedGceInstance::Ssh() {
       .PrivKey(privkey_->path)
       .WithoutKnownHosts()
       .Username("vsoc-01")
-      .Host(*ip);
+      .Host(*ip)
+      .ControlPath(std::string(ssh_control_dir_.path) + "/%C");
+}
+
+void ScopedGceInstance::StopSshMaster() {
+  auto ssh = Ssh();
+  if (!ssh.ok()) {
+    return;
+  }
+  ssh->ControlCommand("exit");
+  std::string out;
+  std::string err;
+  // Fails if no connection is open, which is fine
+  RunWithManagedStdio(ssh->Build(), nullptr, &out, &err);
+}
+
+Result<void> ScopedGceInstance::Reset() {
+  // The connection doesn't survive the restart
+  StopSshMaster();
+  CF_EXPECT(gce_.Reset(instance_).Future().get(), "Failed to reset instance");
+  instance_ = CF_EXPECT(gce_.Get(instance_).get(),
+                        "Failed to get instance info");
+  CF_EXPECT(EnforceSshReady(), "Failed to access SSH on instance");
+  return {};
 }
 
 }  // namespace cuttlefish
@@ -52,6 +52,16 @@ class SshCommand {
   SshCommand& RemoteParameter(const std::string& param) &;
   SshCommand RemoteParameter(const std::string& param) &&;
 
+  // Shares one connection between the commands using the same control path,
+  // and keeps it open for a while after the last one.
+  SshCommand& ControlPath(const std::string& path) &;
+  SshCommand ControlPath(const std::string& path) &&;
+
+  // Sends a command like "exit" to the shared connection instead of running
+  // anything remotely.
+  SshCommand& ControlCommand(const std::string& command) &;
+  SshCommand ControlCommand(const std::string& command) &&;
+
   Command Build() const;
 
  private:
@@ -61,11 +71,13 @@ class SshCommand {
   };
 
   std::optional<std::string> privkey_path_;
-  bool without_known_hosts_;
+  bool without_known_hosts_ = false;
   std::optional<std::string> username_;
   std::optional<std::string> host_;
   std::vector<RemotePortForwardType> remote_port_forwards_;
   std::vector<std::string> parameters_;
+  std::optional<std::string> control_path_;
+  std::optional<std::string> control_command_;
 };
 
 class ScopedGceInstance {
@@ -76,6 +88,7 @@ class ScopedGceInstance {
   ~ScopedGceInstance();
 
   android::base::Result<SshCommand> Ssh();
+  // Restarts the instance for reuse, its disk is kept
   android::base::Result<void> Reset();
 
  private:
@@ -84,10 +97,14 @@ class ScopedGceInstance {
                     bool internal_addresses);
 
   android::base::Result<void> EnforceSshReady();
+  // Closes the connection the ssh commands share
+  void StopSshMaster();
 
   GceApi& gce_;
   GceInstanceInfo instance_;
   std::unique_ptr<TemporaryFile> privkey_;
+  // Holds the socket of the shared ssh connection
+  TemporaryDir ssh_control_dir_;
   bool use_internal_address_;
 };
 
@@ -19,9 +19,12 @@
 #include <gflags/gflags.h>
 
 #include <cstdlib>
+#include <fstream>
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#include <optional>
+#include <sstream>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -35,6 +38,12 @@ const std::string usageMessage =
     "  Commands:\n\n"
     "    set_snr mac1 mac2 snr\n"
     "      set SNR between two nodes. (0 <= snr <= 255)\n\n"
+    "    set_snr_matrix path\n"
+    "      set the SNR of every 'mac1 mac2 snr' line of the file at once.\n"
+    "      '-' reads the lines from standard input\n\n"
+    "    stream_snr\n"
+    "      read 'mac1 mac2 snr' lines from standard input, applying them\n"
+    "      together at each empty line, for periodic topology updates\n\n"
     "    reload_config [path]\n"
     "      force reload wmediumd configuration file\n\n"
     "      if path is not specified, reload current configuration file\n\n"
@@ -90,6 +99,62 @@ std::string MacToString(const char* macAddr) {
   return result.str();
 }
 
+std::optional<cuttlefish::WmediumdMessageSetSnr> ParseSnrUpdate(
+    const std::string& mac1, const std::string& mac2,
+    const std::string& snrStr) {
+  if (!ValidMacAddr(mac1)) {
+    LOG(ERROR) << "error: invalid mac address " << mac1;
+    return std::nullopt;
+  }
+
+  if (!ValidMacAddr(mac2)) {
+    LOG(ERROR) << "error: invalid mac address " << mac2;
+    return std::nullopt;
+  }
+
+  uint8_t snr = 0;
+
+  auto parseResult =
+      android::base::ParseUint<decltype(snr)>(snrStr.c_str(), &snr);
+
+  if (!parseResult) {
+    if (errno == EINVAL) {
+      LOG(ERROR) << "error: cannot parse snr: " << snrStr;
+    } else if (errno == ERANGE) {
+      LOG(ERROR) << "error: snr exceeded range: " << snrStr;
+    }
+
+    return std::nullopt;
+  }
+
+  return cuttlefish::WmediumdMessageSetSnr(mac1, mac2, snr);
+}
+
+// Parses a 'mac1 mac2 snr' line, empty lines are skipped.
+bool ParseSnrLine(const std::string& line,
+                  std::vector<cuttlefish::WmediumdMessageSetSnr>& updates) {
+  std::istringstream fields(line);
+  std::string mac1, mac2, snr, extra;
+
+  if (!(fields >> mac1)) {
+    return true;
+  }
+
+  if (!(fields >> mac2 >> snr) || (fields >> extra)) {
+    LOG(ERROR) << "error: expected 'mac1 mac2 snr', got: " << line;
+    return false;
+  }
+
+  auto update = ParseSnrUpdate(mac1, mac2, snr);
+
+  if (!update) {
+    return false;
+  }
+
+  updates.push_back(*update);
+  return true;
+}
+
 bool HandleSetSnrCommand(cuttlefish::WmediumdController& client,
                          const std::vector<std::string>& args) {
   if (args.size() != 4) {
@@ -97,36 +162,75 @@ bool HandleSetSnrCommand(cuttlefish::WmediumdController& client,
     return false;
   }
 
-  if (!ValidMacAddr(args[1])) {
-    LOG(ERROR) << "error: invalid mac address " << args[1];
+  auto update = ParseSnrUpdate(args[1], args[2], args[3]);
+
+  if (!update) {
     return false;
   }
 
-  if (!ValidMacAddr(args[2])) {
-    LOG(ERROR) << "error: invalid mac address " << args[2];
+  return client.SetSnrs({*update});
+}
+
+bool HandleSetSnrMatrixCommand(cuttlefish::WmediumdController& client,
+                               const std::vector<std::string>& args) {
+  if (args.size() != 2) {
+    LOG(ERROR) << "error: you must provide only 1 option(path)";
     return false;
   }
 
-  uint8_t snr = 0;
+  std::ifstream file;
+  if (args[1] != "-") {
+    file.open(args[1]);
 
-  auto parseResult =
-      android::base::ParseUint<decltype(snr)>(args[3].c_str(), &snr);
+    if (!file) {
+      LOG(ERROR) << "error: cannot open " << args[1];
+      return false;
+    }
+  }
+  std::istream& input = args[1] == "-" ? std::cin : file;
 
-  if (!parseResult) {
-    if (errno == EINVAL) {
-      LOG(ERROR) << "error: cannot parse snr: " << args[3];
-    } else if (errno == ERANGE) {
-      LOG(ERROR) << "error: snr exceeded range: " << args[3];
+  std::vector<cuttlefish::WmediumdMessageSetSnr> updates;
+  std::string line;
+
+  while (std::getline(input, line)) {
+    if (!ParseSnrLine(line, updates)) {
+      return false;
     }
+  }
+
+  return client.SetSnrs(updates);
+}
 
+bool HandleStreamSnrCommand(cuttlefish::WmediumdController& client,
+                            const std::vector<std::string>& args) {
+  if (args.size() != 1) {
+    LOG(ERROR) << "error: you must not provide option";
     return false;
   }
 
-  if (!client.SetSnr(args[1], args[2], snr)) {
-    return false;
+  std::vector<cuttlefish::WmediumdMessageSetSnr> updates;
+  std::string line;
+  bool success = true;
+
+  // a bad line or rejected update fails the command, but keeps the stream
+  // going so the remaining ticks still apply
+  while (std::getline(std::cin, line)) {
+    if (!line.empty()) {
+      success &= ParseSnrLine(line, updates);
+      continue;
+    }
+
+    if (!updates.empty()) {
+      success &= client.SetSnrs(updates);
+      updates.clear();
+    }
   }
 
-  return true;
+  if (!updates.empty()) {
+    success &= client.SetSnrs(updates);
+  }
+
+  return success;
 }
 
 bool HandleReloadConfigCommand(cuttlefish::WmediumdController& client,
@@ -242,6 +346,8 @@ int main(int argc, char** argv) {
                          std::function<bool(cuttlefish::WmediumdController&,
                                             const std::vector<std::string>&)>>{{
           {"set_snr", HandleSetSnrCommand},
+          {"set_snr_matrix", HandleSetSnrMatrixCommand},
+          {"stream_snr", HandleStreamSnrCommand},
           {"reload_config", HandleReloadConfigCommand},
           {"start_pcap", HandleStartPcapCommand},
           {"stop_pcap", HandleStopPcapCommand},
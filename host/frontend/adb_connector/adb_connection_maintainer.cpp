@@ -14,14 +14,21 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <iomanip>
+#include <mutex>
+#include <random>
 #include <sstream>
 #include <string>
 #include <memory>
 #include <vector>
 #include <android-base/logging.h>
 
+#include <poll.h>
 #include <unistd.h>
 
 #include "common/libs/fs/shared_fd.h"
@@ -36,8 +43,8 @@ std::string MakeMessage(const std::string& user_message) {
   return ss.str();
 }
 
-std::string MakeShellUptimeMessage() {
-  return MakeMessage("shell,raw:cut -d. -f1 /proc/uptime");
+std::string MakeTrackDevicesMessage() {
+  return MakeMessage("host:track-devices");
 }
 
 std::string MakeTransportMessage(const std::string& address) {
@@ -117,97 +124,153 @@ bool AdbDisconnect(const std::string& address) {
   return AdbSendMessage(MakeDisconnectMessage(address));
 }
 
-bool IsInteger(const std::string& str) {
+bool IsHexInteger(const std::string& str) {
   return !str.empty() && std::all_of(str.begin(), str.end(),
-                                     [](char c) { return std::isdigit(c); });
+                                     [](char c) { return std::isxdigit(c); });
 }
 
 // assumes the OKAY/FAIL status has already been read
 std::string RecvAdbResponse(cuttlefish::SharedFD sock) {
   auto length_as_hex_str = RecvAll(sock, kAdbMessageLengthLength);
-  if (!IsInteger(length_as_hex_str)) {
+  if (!IsHexInteger(length_as_hex_str)) {
     return {};
   }
   auto length = std::stoi(length_as_hex_str, nullptr, 16);
   return RecvAll(sock, length);
 }
 
-// Returns a negative value if uptime result couldn't be read for
-// any reason.
-int RecvUptimeResult(cuttlefish::SharedFD sock) {
-  std::vector<char> uptime_vec{};
-  std::vector<char> just_read(16);
-  do {
-    auto count = sock->Read(just_read.data(), just_read.size());
-    if (count < 0) {
-      LOG(WARNING) << "couldn't receive adb shell output";
-      return -1;
-    }
-    just_read.resize(count);
-    uptime_vec.insert(uptime_vec.end(), just_read.begin(), just_read.end());
-  } while (!just_read.empty());
+// Wakes up the connection maintainers early
+std::mutex adbd_started_mutex;
+std::condition_variable adbd_started_cv;
+std::uint64_t adbd_started_count = 0;
 
-  if (uptime_vec.empty()) {
-    LOG(WARNING) << "empty adb shell result";
-    return -1;
-  }
+std::uint64_t AdbdStartedCount() {
+  std::lock_guard lock(adbd_started_mutex);
+  return adbd_started_count;
+}
 
-  uptime_vec.pop_back();
+// Returns true if it was cut short because adbd started after `since`
+bool SleepUnlessAdbdStarts(std::chrono::milliseconds duration,
+                           std::uint64_t since) {
+  std::unique_lock lock(adbd_started_mutex);
+  return adbd_started_cv.wait_for(
+      lock, duration, [since]() { return adbd_started_count != since; });
+}
 
-  auto uptime_str = std::string{uptime_vec.data(), uptime_vec.size()};
-  if (!IsInteger(uptime_str)) {
-    LOG(WARNING) << "non-numeric: uptime result: " << uptime_str;
-    return -1;
-  }
+// With many instances on a host, their connectors shouldn't all hit the adb
+// daemon at the same time.
+std::chrono::milliseconds Jittered(std::chrono::milliseconds delay) {
+  thread_local std::mt19937 generator{std::random_device{}()};
+  std::uniform_real_distribution<double> factor(0.5, 1.5);
+  return std::chrono::milliseconds(
+      static_cast<std::int64_t>(delay.count() * factor(generator)));
+}
 
-  return std::stoi(uptime_str);
+// The state of the device with that serial in a track-devices update, empty if
+// it isn't there
+std::string DeviceState(const std::string& devices,
+                        const std::string& address) {
+  std::istringstream lines(devices);
+  std::string line;
+  while (std::getline(lines, line)) {
+    auto tab = line.find('\t');
+    if (tab != std::string::npos && line.substr(0, tab) == address) {
+      return line.substr(tab + 1);
+    }
+  }
+  return {};
 }
 
-// There needs to be a gap between the adb commands, the daemon isn't able to
-// handle the avalanche of requests we would be sending without a sleep. Five
-// seconds is much larger than seems necessary so we should be more than okay.
-static constexpr int kAdbCommandGapTime = 5;
+// The delays grow while the connection fails, soon after adbd started it
+// should be quick to succeed
+constexpr auto kMinRetryDelay = std::chrono::milliseconds(200);
+constexpr auto kMaxRetryDelay = std::chrono::milliseconds(5000);
+// How long a connected device may take to come online
+constexpr auto kDeviceOnlineTimeout = std::chrono::seconds(10);
+constexpr int kWatchIntervalMs = 500;
 
 void EstablishConnection(const std::string& address) {
   LOG(DEBUG) << "Attempting to connect to device with address " << address;
-  while (!AdbConnect(address)) {
-    sleep(kAdbCommandGapTime);
+  auto delay = kMinRetryDelay;
+  while (true) {
+    auto started = AdbdStartedCount();
+    if (AdbConnect(address)) {
+      break;
+    }
+    if (SleepUnlessAdbdStarts(Jittered(delay), started)) {
+      delay = kMinRetryDelay;
+    } else {
+      delay = std::min(delay * 2, kMaxRetryDelay);
+    }
   }
   LOG(DEBUG) << "adb connect message for " << address << " successfully sent";
-  sleep(kAdbCommandGapTime);
 }
 
+// The adb daemon sends the device list every time a device changes state, the
+// connection is re-established as soon as this one leaves the list or goes
+// offline.
 void WaitForAdbDisconnection(const std::string& address) {
-  // adb daemon doesn't seem to handle quick, successive messages well. The
-  // sleeps stabilize the communication.
   LOG(DEBUG) << "Watching for disconnect on " << address;
-  while (true) {
-    auto sock = cuttlefish::SharedFD::SocketLocalClient(kAdbDaemonPort, SOCK_STREAM);
-    if (!AdbSendMessage(sock, MakeTransportMessage(address))) {
-      LOG(WARNING) << "transport message failed, response body: "
-                   << RecvAdbResponse(sock);
-      break;
-    }
-    if (!AdbSendMessage(sock, MakeShellUptimeMessage())) {
-      LOG(WARNING) << "adb shell uptime message failed";
-      break;
+  auto sock =
+      cuttlefish::SharedFD::SocketLocalClient(kAdbDaemonPort, SOCK_STREAM);
+  if (!AdbSendMessage(sock, MakeTrackDevicesMessage())) {
+    LOG(WARNING) << "track-devices message failed, response body: "
+                 << RecvAdbResponse(sock);
+  } else {
+    bool online = false;
+    auto started = AdbdStartedCount();
+    auto deadline = std::chrono::steady_clock::now() + kDeviceOnlineTimeout;
+    while (true) {
+      cuttlefish::PollSharedFd poll_fd = {
+          .fd = sock, .events = POLLIN, .revents = 0};
+      auto ready = cuttlefish::SharedFD::Poll(&poll_fd, 1, kWatchIntervalMs);
+      if (ready < 0) {
+        LOG(WARNING) << "Failed to wait for the adb daemon: "
+                     << sock->StrError();
+        break;
+      }
+      if (ready > 0) {
+        auto length_as_hex_str = RecvAll(sock, kAdbMessageLengthLength);
+        if (!IsHexInteger(length_as_hex_str)) {
+          LOG(WARNING) << "adb daemon stopped sending device updates";
+          break;
+        }
+        auto devices =
+            RecvAll(sock, std::stoi(length_as_hex_str, nullptr, 16));
+        auto state = DeviceState(devices, address);
+        LOG(VERBOSE) << "device on " << address << " is \"" << state << "\"";
+        if (state == "device") {
+          online = true;
+        } else if (online) {
+          LOG(WARNING) << "device on " << address << " went "
+                       << (state.empty() ? "away" : state);
+          break;
+        }
+      }
+      if (!online && AdbdStartedCount() != started) {
+        LOG(DEBUG) << "adbd started again before " << address
+                   << " came online, reconnecting";
+        break;
+      }
+      if (!online && std::chrono::steady_clock::now() > deadline) {
+        LOG(WARNING) << "device on " << address
+                     << " didn't come online after connecting";
+        break;
+      }
     }
-
-    auto uptime = RecvUptimeResult(sock);
-    if (uptime < 0) {
-      LOG(WARNING) << "couldn't read uptime result";
-      break;
-    }
-    LOG(VERBOSE) << "device on " << address << " uptime " << uptime;
-    sleep(kAdbCommandGapTime);
   }
   LOG(DEBUG) << "Sending adb disconnect";
   AdbDisconnect(address);
-  sleep(kAdbCommandGapTime);
 }
 
 }  // namespace
 
+void cuttlefish::NotifyAdbdStarted() {
+  std::lock_guard lock(adbd_started_mutex);
+  adbd_started_count++;
+  adbd_started_cv.notify_all();
+}
+
 [[noreturn]] void cuttlefish::EstablishAndMaintainConnection(std::string address) {
   while (true) {
     EstablishConnection(address);
@@ -15,8 +15,13 @@
  */
 #pragma once
 
+#include <string>
+
 namespace cuttlefish {
 
+// Makes the connection maintainers retry right away
+void NotifyAdbdStarted();
+
 [[noreturn]] void EstablishAndMaintainConnection(std::string address);
 
 }  // namespace cuttlefish
@@ -35,6 +35,10 @@
 
 DEFINE_string(addresses, "", "Comma-separated list of addresses to "
                              "'adb connect' to");
+DEFINE_int32(adbd_events_fd, -1, "A file descriptor. If set, kernel log "
+                                 "monitor events are read from it and the "
+                                 "connection is retried as soon as adbd "
+                                 "starts in the guest.");
 
 namespace {
 void LaunchConnectionMaintainerThread(const std::string& address) {
@@ -48,6 +52,25 @@ std::vector<std::string> ParseAddressList(std::string ports) {
           std::istream_iterator<std::string>{}};
 }
 
+void WatchAdbdEvents(int events_fd) {
+  auto events = cuttlefish::SharedFD::Dup(events_fd);
+  close(events_fd);
+  std::thread([events]() {
+    while (events->IsOpen()) {
+      auto read_result = monitor::ReadEvent(events);
+      if (!read_result) {
+        LOG(ERROR) << "Failed to read a complete kernel log adb event.";
+        // The connectors keep retrying on their own
+        return;
+      }
+      if (read_result->event == monitor::Event::AdbdStarted) {
+        LOG(DEBUG) << "Adbd has started in the guest, connecting adb";
+        cuttlefish::NotifyAdbdStarted();
+      }
+    }
+  }).detach();
+}
+
 [[noreturn]] void SleepForever() {
   while (true) {
     sleep(std::numeric_limits<unsigned int>::max());
@@ -61,6 +84,10 @@ int main(int argc, char* argv[]) {
   gflags::ParseCommandLineFlags(&argc, &argv, true);
   CHECK(!FLAGS_addresses.empty()) << "Must specify --addresses flag";
 
+  if (FLAGS_adbd_events_fd >= 0) {
+    WatchAdbdEvents(FLAGS_adbd_events_fd);
+  }
+
   for (auto address : ParseAddressList(FLAGS_addresses)) {
     LaunchConnectionMaintainerThread(address);
   }
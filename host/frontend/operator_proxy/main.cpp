@@ -14,8 +14,12 @@
  * limitations under the License.
  */
 
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <signal.h>
 
+#include <tuple>
+
 #include <android-base/logging.h>
 #include <gflags/gflags.h>
 
@@ -26,12 +30,43 @@
 DEFINE_int32(server_port, 8443, "The port for the proxy server");
 DEFINE_int32(operator_port, 1443, "The port of the operator server to proxy");
 
+namespace {
+
+// Viewers that go away without closing their connection, after a network
+// change for example, would otherwise keep both sockets and the pipes between
+// them forever.
+constexpr int kKeepAliveIdleSeconds = 60;
+constexpr int kKeepAliveIntervalSeconds = 10;
+constexpr int kKeepAliveProbes = 3;
+
+// Signaling messages are small and latency sensitive, they shouldn't wait for
+// the acknowledgement of the previous segment on either hop. Accepted sockets
+// inherit these options from the server socket.
+void SetTcpOptions(cuttlefish::SharedFD fd) {
+  const int one = 1;
+  for (auto [level, option, value] :
+       {std::make_tuple(IPPROTO_TCP, TCP_NODELAY, one),
+        std::make_tuple(SOL_SOCKET, SO_KEEPALIVE, one),
+        std::make_tuple(IPPROTO_TCP, TCP_KEEPIDLE, kKeepAliveIdleSeconds),
+        std::make_tuple(IPPROTO_TCP, TCP_KEEPINTVL, kKeepAliveIntervalSeconds),
+        std::make_tuple(IPPROTO_TCP, TCP_KEEPCNT, kKeepAliveProbes)}) {
+    if (fd->SetSockOpt(level, option, &value, sizeof(value)) != 0) {
+      LOG(WARNING) << "Failed to set socket option " << option << ": "
+                   << fd->StrError();
+    }
+  }
+}
+
+}  // namespace
+
 cuttlefish::SharedFD OpenConnection() {
   auto conn =
       cuttlefish::SharedFD::SocketLocalClient(FLAGS_operator_port, SOCK_STREAM);
   if (!conn->IsOpen()) {
     LOG(ERROR) << "Failed to connect to operator: " << conn->StrError();
+    return conn;
   }
+  SetTcpOptions(conn);
   return conn;
 }
 
@@ -43,6 +78,7 @@ int main(int argc, char** argv) {
       cuttlefish::SharedFD::SocketLocalServer(FLAGS_server_port, SOCK_STREAM);
   CHECK(server->IsOpen()) << "Error Creating proxy server: "
                           << server->StrError();
+  SetTcpOptions(server);
 
   signal(SIGPIPE, SIG_IGN);
 
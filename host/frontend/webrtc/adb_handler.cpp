@@ -18,6 +18,8 @@
 
 #include <unistd.h>
 
+#include <utility>
+
 #include <android-base/logging.h>
 
 using namespace android;
@@ -27,6 +29,10 @@ namespace webrtc_streaming {
 
 namespace {
 
+// Large enough for adb push to move in few messages while staying below the
+// data channel message size browsers accept.
+constexpr size_t kReadBufferSize = 64 * 1024;
+
 SharedFD SetupAdbSocket(const std::string &adb_host_and_port) {
   auto colonPos = adb_host_and_port.find(':');
   if (colonPos == std::string::npos) {
@@ -55,51 +61,19 @@ SharedFD SetupAdbSocket(const std::string &adb_host_and_port) {
 }  // namespace
 
 AdbHandler::AdbHandler(
-    const std::string &adb_host_and_port,
-    std::function<void(const uint8_t *, size_t)> send_to_client)
-    : send_to_client_(send_to_client),
-      adb_socket_(SetupAdbSocket(adb_host_and_port)),
-      shutdown_(SharedFD::Event(0,0))
-{
-    std::thread loop([this]() { ReadLoop(); });
-    read_thread_.swap(loop);
-}
-
+    HandlerLoop &loop, const std::string &adb_host_and_port,
+    std::function<bool(const uint8_t *, size_t)> send_to_client)
+    : adb_socket_(SetupAdbSocket(adb_host_and_port)),
+      forwarder_(SocketForwarder::Start(loop, adb_socket_, kReadBufferSize,
+                                        std::move(send_to_client))) {}
 
 AdbHandler::~AdbHandler() {
-    // Send a message to the looper to shut down.
-    uint64_t v = 1;
-    shutdown_->Write(&v, sizeof(v));
-    // Shut down the socket as well.  Not srictly necessary.
-    adb_socket_->Shutdown(SHUT_RDWR);
-    read_thread_.join();
+  forwarder_->Stop();
+  // Shut down the socket as well.  Not srictly necessary.
+  adb_socket_->Shutdown(SHUT_RDWR);
 }
 
-void AdbHandler::ReadLoop() {
-  while (1) {
-    uint8_t buffer[4096];
-
-    read_set_.Set(shutdown_);
-    read_set_.Set(adb_socket_);
-    Select(&read_set_, nullptr, nullptr, nullptr);
-
-    if (read_set_.IsSet(adb_socket_)) {
-        auto read = adb_socket_->Read(buffer, sizeof(buffer));
-        if (read < 0) {
-            LOG(ERROR) << "Error on reading from ADB socket: " << strerror(adb_socket_->GetErrno());
-            break;
-        }
-        if (read) {
-            send_to_client_(buffer, read);
-        }
-    }
-
-    if (read_set_.IsSet(shutdown_)) {
-        LOG(INFO) << "AdbHandler is shutting down.";
-        break;
-    }
-  }
-}
+void AdbHandler::ResumeSending() { forwarder_->Resume(); }
 
 void AdbHandler::handleMessage(const uint8_t *msg, size_t len) {
   size_t sent = 0;
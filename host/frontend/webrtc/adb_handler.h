@@ -16,34 +16,30 @@
 
 #pragma once
 
+#include <functional>
 #include <memory>
-#include <thread>
+#include <string>
 
 #include "common/libs/fs/shared_fd.h"
-#include "common/libs/fs/shared_select.h"
+#include "host/frontend/webrtc/handler_loop.h"
 
 namespace cuttlefish {
 namespace webrtc_streaming {
 
 struct AdbHandler {
-  explicit AdbHandler(const std::string
-          &adb_host_and_port,
-      std::function<void(const uint8_t *, size_t)> send_to_client);
+  // send_to_client returns false when the client can't take more data for
+  // now, nothing is read from adb until ResumeSending is called.
+  AdbHandler(HandlerLoop &loop, const std::string &adb_host_and_port,
+             std::function<bool(const uint8_t *, size_t)> send_to_client);
 
   ~AdbHandler();
 
   void handleMessage(const uint8_t *msg, size_t len);
+  void ResumeSending();
 
  private:
-
-  std::function<void(const uint8_t *, size_t)> send_to_client_;
-
-  void ReadLoop();
-
   SharedFD adb_socket_;
-  SharedFD shutdown_;
-  SharedFDSet read_set_;
-  std::thread read_thread_;
+  std::shared_ptr<SocketForwarder> forwarder_;
 };
 
 }  // namespace webrtc_streaming
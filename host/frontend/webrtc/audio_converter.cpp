@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/audio_converter.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <android-base/logging.h>
+
+#include "host/libs/audio_connector/shm_layout.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr int kFractionBits = 32;
+constexpr uint64_t kFractionMask = (uint64_t{1} << kFractionBits) - 1;
+constexpr float kFractionScale = 1.0f / (uint64_t{1} << kFractionBits);
+
+size_t BytesPerSample(uint8_t virtio_format) {
+  switch (virtio_format) {
+    case (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S8:
+      return 1;
+    case (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S16:
+      return 2;
+    case (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S24:
+    case (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S32:
+    case (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_FLOAT:
+      return 4;
+    default:
+      return 0;
+  }
+}
+
+// These loops have no dependencies between iterations so that the compiler
+// vectorizes them. Samples are little endian, same as the host.
+template <typename T>
+void DecodeInt(const uint8_t* src, size_t count, float* dst) {
+  constexpr float kScale = 1.0f / (uint64_t{1} << (sizeof(T) * 8 - 1));
+  for (size_t i = 0; i < count; i++) {
+    T sample;
+    memcpy(&sample, src + i * sizeof(T), sizeof(T));
+    dst[i] = sample * kScale;
+  }
+}
+
+void DecodeS24(const uint8_t* src, size_t count, float* dst) {
+  constexpr float kScale = 1.0f / (1 << 23);
+  for (size_t i = 0; i < count; i++) {
+    uint32_t sample;
+    memcpy(&sample, src + i * sizeof(sample), sizeof(sample));
+    // The 24 valid bits are the least significant ones, sign extend them.
+    dst[i] = (static_cast<int32_t>(sample << 8) >> 8) * kScale;
+  }
+}
+
+void DecodeFloat(const uint8_t* src, size_t count, float* dst) {
+  memcpy(dst, src, count * sizeof(float));
+}
+
+int16_t ToS16(float sample) {
+  return static_cast<int16_t>(std::clamp(sample, -1.0f, 1.0f) * 32767.0f);
+}
+
+}  // namespace
+
+bool AudioConverter::SupportsFormat(uint8_t virtio_format) {
+  return BytesPerSample(virtio_format) > 0;
+}
+
+bool AudioConverter::IsNative(uint8_t virtio_format, int sample_rate) {
+  return virtio_format == (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S16 &&
+         sample_rate == kOutputSampleRate;
+}
+
+AudioConverter::AudioConverter(uint8_t virtio_format, int sample_rate,
+                               int channels)
+    : format_(virtio_format),
+      channels_(channels),
+      frame_size_(BytesPerSample(virtio_format) * channels),
+      step_((static_cast<uint64_t>(sample_rate) << kFractionBits) /
+            kOutputSampleRate) {
+  CHECK(SupportsFormat(virtio_format))
+      << "Unsupported audio format: " << (int)virtio_format;
+  output_.reserve(2 * kOutputFramesPerChunk * channels_);
+}
+
+size_t AudioConverter::Convert(const volatile uint8_t* data, size_t len) {
+  // Casting away the volatility is as safe here as it's when handing the
+  // buffer to WebRTC, it's only read before being released to the guest.
+  Decode(const_cast<const uint8_t*>(data), len / frame_size_);
+  Resample();
+  return output_.size() / (kOutputFramesPerChunk * channels_);
+}
+
+const int16_t* AudioConverter::chunk(size_t i) const {
+  return output_.data() + i * kOutputFramesPerChunk * channels_;
+}
+
+void AudioConverter::ConsumeChunks() {
+  const size_t chunk_samples = kOutputFramesPerChunk * channels_;
+  const size_t complete = (output_.size() / chunk_samples) * chunk_samples;
+  output_.erase(output_.begin(), output_.begin() + complete);
+}
+
+void AudioConverter::Reset() {
+  position_ = 0;
+  input_.clear();
+  output_.clear();
+}
+
+void AudioConverter::Decode(const uint8_t* data, size_t frames) {
+  const size_t count = frames * channels_;
+  const size_t offset = input_.size();
+  input_.resize(offset + count);
+  float* dst = input_.data() + offset;
+  switch (format_) {
+    case (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S8:
+      DecodeInt<int8_t>(data, count, dst);
+      break;
+    case (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S16:
+      DecodeInt<int16_t>(data, count, dst);
+      break;
+    case (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S24:
+      DecodeS24(data, count, dst);
+      break;
+    case (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S32:
+      DecodeInt<int32_t>(data, count, dst);
+      break;
+    case (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_FLOAT:
+      DecodeFloat(data, count, dst);
+      break;
+  }
+}
+
+void AudioConverter::Resample() {
+  // Linear interpolation between the two input frames around each output
+  // frame. The last input frame is kept until the next one arrives.
+  const size_t input_frames = input_.size() / channels_;
+  while ((position_ >> kFractionBits) + 1 < input_frames) {
+    const size_t index = position_ >> kFractionBits;
+    const float weight = (position_ & kFractionMask) * kFractionScale;
+    const float* before = input_.data() + index * channels_;
+    const float* after = before + channels_;
+    for (int c = 0; c < channels_; c++) {
+      output_.push_back(ToS16(before[c] + (after[c] - before[c]) * weight));
+    }
+    position_ += step_;
+  }
+  const size_t consumed =
+      std::min<size_t>(position_ >> kFractionBits, input_frames);
+  input_.erase(input_.begin(), input_.begin() + consumed * channels_);
+  position_ -= static_cast<uint64_t>(consumed) << kFractionBits;
+}
+
+}  // namespace cuttlefish
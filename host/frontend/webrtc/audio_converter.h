@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace cuttlefish {
+
+// Turns the guest's playback samples into what WebRTC consumes without any
+// further processing: 16 bit signed samples at 48kHz, in 10ms chunks. Any
+// other format or rate is otherwise resampled by WebRTC itself for each frame.
+class AudioConverter {
+ public:
+  static constexpr int kOutputSampleRate = 48000;
+  static constexpr int kOutputBitsPerSample = 16;
+  static constexpr int kOutputFramesPerChunk = kOutputSampleRate / 100;
+
+  // Whether samples in the given virtio-snd format can be converted.
+  static bool SupportsFormat(uint8_t virtio_format);
+  // Whether WebRTC takes streams with these parameters as they are.
+  static bool IsNative(uint8_t virtio_format, int sample_rate);
+
+  AudioConverter(uint8_t virtio_format, int sample_rate, int channels);
+
+  // Converts the given samples, which must be whole frames, and returns the
+  // number of complete chunks available. Frames that don't complete a chunk
+  // are kept for the next call.
+  size_t Convert(const volatile uint8_t* data, size_t len);
+  // The samples of the i-th complete chunk, valid until ConsumeChunks.
+  const int16_t* chunk(size_t i) const;
+  // Drops the complete chunks, presumably after sending them.
+  void ConsumeChunks();
+  // Drops all samples held, for when the stream stops.
+  void Reset();
+
+ private:
+  void Decode(const uint8_t* data, size_t frames);
+  void Resample();
+
+  const uint8_t format_;
+  const int channels_;
+  const size_t frame_size_;
+  // Input frames per output frame, in 32.32 fixed point.
+  const uint64_t step_;
+  // Position of the next output frame in input_, in 32.32 fixed point.
+  uint64_t position_ = 0;
+  // Input frames decoded into floats, interleaved, not yet resampled.
+  std::vector<float> input_;
+  // Output samples, interleaved, complete chunks first.
+  std::vector<int16_t> output_;
+};
+
+}  // namespace cuttlefish
@@ -18,10 +18,13 @@
 
 #include <algorithm>
 #include <chrono>
+#include <cstring>
 
 #include <android-base/logging.h>
 #include <rtc_base/time_utils.h>
 
+#include "common/libs/fs/epoll.h"
+
 namespace cuttlefish {
 namespace {
 
@@ -53,14 +56,14 @@ const virtio_snd_pcm_info STREAMS[] = {{
             .hda_fn_nid = Le32(0),
         },
     .features = Le32(0),
-    // webrtc's api is quite primitive and doesn't allow for many different
-    // formats: It only takes the bits_per_sample as a parameter and assumes
-    // the underlying format to be one of the following:
+    // Playback samples in these formats are converted before reaching webrtc,
+    // see AudioConverter.
     .formats = Le64(
         (((uint64_t)1) << (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S8) |
         (((uint64_t)1) << (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S16) |
         (((uint64_t)1) << (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S24) |
-        (((uint64_t)1) << (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S32)),
+        (((uint64_t)1) << (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_S32) |
+        (((uint64_t)1) << (uint8_t)AudioStreamFormat::VIRTIO_SND_PCM_FMT_FLOAT)),
     .rates = Le64(
         (((uint64_t)1) << (uint8_t)AudioStreamRate::VIRTIO_SND_PCM_RATE_5512) |
         (((uint64_t)1) << (uint8_t)AudioStreamRate::VIRTIO_SND_PCM_RATE_8000) |
@@ -126,6 +129,12 @@ bool IsCapture(uint32_t stream_id) {
          (uint8_t)AudioStreamDirection::VIRTIO_SND_D_INPUT;
 }
 
+// The capture audio is pulled from WebRTC in chunks of this duration
+constexpr std::chrono::milliseconds kCaptureChunk(10);
+// After falling behind by this much the capture loop skips the missed chunks
+// rather than pulling them in a burst.
+constexpr std::chrono::milliseconds kMaxCaptureLag(100);
+
 class CvdAudioFrameBuffer : public webrtc_streaming::AudioFrameBuffer {
  public:
   CvdAudioFrameBuffer(const uint8_t* buffer, int bits_per_sample,
@@ -284,32 +293,60 @@ AudioHandler::AudioHandler(
     : audio_sink_(audio_sink),
       audio_server_(std::move(audio_server)),
       stream_descs_(NUM_STREAMS),
-      audio_source_(audio_source) {}
+      audio_source_(audio_source),
+      mixer_(NUM_STREAMS, [this](const int16_t* samples, int64_t timestamp) {
+        auto audio_frame_buffer = std::make_shared<CvdAudioFrameBuffer>(
+            reinterpret_cast<const uint8_t*>(samples),
+            AudioConverter::kOutputBitsPerSample,
+            AudioConverter::kOutputSampleRate, AudioMixer::kChannels,
+            AudioConverter::kOutputFramesPerChunk);
+        audio_sink_->OnFrame(audio_frame_buffer, timestamp);
+      }) {}
 
 void AudioHandler::Start() {
   server_thread_ = std::thread([this]() { Loop(); });
+  capture_thread_ = std::thread([this]() { CaptureLoop(); });
 }
 
+void AudioHandler::SetActive(bool active) { active_ = active; }
+
 [[noreturn]] void AudioHandler::Loop() {
+  auto epoll = Epoll::Create();
+  CHECK(epoll.ok()) << "Failed to create epoll: " << epoll.error();
   for (;;) {
     auto audio_client = audio_server_->AcceptClient(
         NUM_STREAMS, NUM_JACKS, NUM_CHMAPS,
         262144 /* tx_shm_len */, 262144 /* rx_shm_len */);
     CHECK(audio_client) << "Failed to create audio client connection instance";
 
-    std::thread playback_thread([this, &audio_client]() {
-      while (audio_client->ReceivePlayback(*this)) {
+    // Commands, playback and capture buffers are all handled from this
+    // thread, the executor callbacks never block.
+    auto added = audio_client->AddToEpoll(*epoll);
+    CHECK(added.ok()) << "Failed to watch the audio client: " << added.error();
+    for (;;) {
+      auto event = epoll->Wait();
+      if (!event.ok()) {
+        LOG(ERROR) << "Failed to wait for audio messages: " << event.error();
+        break;
+      }
+      if (!*event) {
+        continue;
       }
-    });
-    std::thread capture_thread([this, &audio_client]() {
-      while (audio_client->ReceiveCapture(*this)) {
+      if (!audio_client->HandleEvent(**event, *this)) {
+        break;
       }
-    });
-    // Wait for the client to do something
-    while (audio_client->ReceiveCommands(*this)) {
     }
-    playback_thread.join();
-    capture_thread.join();
+    // The buffers live in the client's shared memory, which goes away with it
+    for (auto& stream_desc : stream_descs_) {
+      std::lock_guard<std::mutex> lock(stream_desc.mtx);
+      ReleasePendingBuffer(stream_desc);
+      ReleaseCaptureBuffers(stream_desc);
+    }
+    auto removed = audio_client->RemoveFromEpoll(*epoll);
+    if (!removed.ok()) {
+      LOG(ERROR) << "Failed to stop watching the audio client: "
+                 << removed.error();
+    }
   }
 }
 
@@ -334,6 +371,7 @@ void AudioHandler::SetStreamParameters(StreamSetParamsCommand& cmd) {
   auto sample_rate = SampleRate(cmd.rate());
   auto channels = cmd.channels();
   if (bits_per_sample < 0 || sample_rate < 0 ||
+      !AudioConverter::SupportsFormat(cmd.format()) ||
       channels < stream_info.channels_min ||
       channels > stream_info.channels_max) {
     cmd.Reply(AudioStatus::VIRTIO_SND_S_BAD_MSG);
@@ -345,7 +383,20 @@ void AudioHandler::SetStreamParameters(StreamSetParamsCommand& cmd) {
     stream_descs_[cmd.stream_id()].sample_rate = sample_rate;
     stream_descs_[cmd.stream_id()].channels = channels;
     auto len10ms = (channels * (sample_rate / 100) * bits_per_sample) / 8;
+    ReleasePendingBuffer(stream_descs_[cmd.stream_id()]);
     stream_descs_[cmd.stream_id()].buffer.Reset(len10ms);
+    if (IsCapture(cmd.stream_id())) {
+      ReleaseCaptureBuffers(stream_descs_[cmd.stream_id()]);
+      stream_descs_[cmd.stream_id()].capture_chunk.resize(len10ms);
+      stream_descs_[cmd.stream_id()].capture_ring.Reset(
+          2 * std::max<size_t>(cmd.period_bytes(), len10ms));
+    }
+    auto& converter = stream_descs_[cmd.stream_id()].converter;
+    converter.reset();
+    if (!IsCapture(cmd.stream_id()) &&
+        !AudioConverter::IsNative(cmd.format(), sample_rate)) {
+      converter.emplace(cmd.format(), sample_rate, channels);
+    }
   }
   cmd.Reply(AudioStatus::VIRTIO_SND_S_OK);
 }
@@ -371,7 +422,14 @@ void AudioHandler::StartStream(StreamControlCommand& cmd) {
     cmd.Reply(AudioStatus::VIRTIO_SND_S_BAD_MSG);
     return;
   }
-  stream_descs_[cmd.stream_id()].active = true;
+  {
+    std::lock_guard<std::mutex> lock(stream_descs_[cmd.stream_id()].mtx);
+    stream_descs_[cmd.stream_id()].active = true;
+    stream_descs_[cmd.stream_id()].stats.Restart();
+  }
+  if (!IsCapture(cmd.stream_id())) {
+    mixer_.SetStreamActive(cmd.stream_id(), true);
+  }
   cmd.Reply(AudioStatus::VIRTIO_SND_S_OK);
 }
 
@@ -380,7 +438,20 @@ void AudioHandler::StopStream(StreamControlCommand& cmd) {
     cmd.Reply(AudioStatus::VIRTIO_SND_S_BAD_MSG);
     return;
   }
-  stream_descs_[cmd.stream_id()].active = false;
+  {
+    std::lock_guard<std::mutex> lock(stream_descs_[cmd.stream_id()].mtx);
+    stream_descs_[cmd.stream_id()].active = false;
+    ReleasePendingBuffer(stream_descs_[cmd.stream_id()]);
+    ReleaseCaptureBuffers(stream_descs_[cmd.stream_id()]);
+    auto& capture_ring = stream_descs_[cmd.stream_id()].capture_ring;
+    capture_ring.Drop(capture_ring.count);
+    if (stream_descs_[cmd.stream_id()].converter) {
+      stream_descs_[cmd.stream_id()].converter->Reset();
+    }
+  }
+  if (!IsCapture(cmd.stream_id())) {
+    mixer_.SetStreamActive(cmd.stream_id(), false);
+  }
   cmd.Reply(AudioStatus::VIRTIO_SND_S_OK);
 }
 
@@ -421,135 +492,235 @@ void AudioHandler::OnPlaybackBuffer(TxBuffer buffer) {
     // process it and the other side stopped the stream. Quitely ignore it in
     // that case
     if (!stream_desc.active) {
+      ReleasePendingBuffer(stream_desc);
+      buffer.SendStatus(AudioStatus::VIRTIO_SND_S_OK, 0, buffer.len());
+      return;
+    }
+    // Nobody is listening
+    if (!active_) {
+      ReleasePendingBuffer(stream_desc);
+      holding_buffer.count = 0;
       buffer.SendStatus(AudioStatus::VIRTIO_SND_S_OK, 0, buffer.len());
       return;
     }
+    const int64_t frame_len =
+        stream_desc.channels * (stream_desc.bits_per_sample / 8);
+    if (frame_len > 0 && stream_desc.sample_rate > 0) {
+      stream_desc.stats.RecordPlaybackBuffer(
+          buffer.received_at(),
+          std::chrono::microseconds(1000000 * (buffer.len() / frame_len) /
+                                    stream_desc.sample_rate));
+    }
+    if (stream_desc.converter) {
+      // The converted chunks are copies, the buffer is no longer needed once
+      // they've been produced.
+      auto& converter = *stream_desc.converter;
+      auto chunks = converter.Convert(buffer.get(), buffer.len());
+      buffer.SendStatus(AudioStatus::VIRTIO_SND_S_OK, 0, buffer.len());
+      auto base_time =
+          rtc::TimeMillis() - (static_cast<int64_t>(chunks) - 1) * 10;
+      for (size_t i = 0; i < chunks; i++) {
+        mixer_.AddChunk(stream_id, converter.chunk(i), stream_desc.channels,
+                        base_time + i * 10);
+        stream_desc.stats.RecordDelivery(buffer.received_at());
+      }
+      converter.ConsumeChunks();
+      return;
+    }
     // Webrtc will silently ignore any buffer with a length different than 10ms,
-    // so we must split any buffer bigger than that and temporarily store any
-    // remaining frames that are less than that size.
+    // so we must split any buffer bigger than that and temporarily hold on to
+    // any remaining frames that are less than that size.
+    const size_t chunk_len = holding_buffer.buffer.size();
     auto current_time = rtc::TimeMillis();
     // The timestamp of the first 10ms chunk to be sent so that the last one
     // will have the current time
-    auto base_time =
-        current_time - ((buffer.len() - 1) / holding_buffer.buffer.size()) * 10;
-    // number of frames in a 10 ms buffer
-    const int frames = stream_desc.sample_rate / 100;
+    auto base_time = current_time - ((buffer.len() - 1) / chunk_len) * 10;
+    // This casts away volatility of the pointer, necessary because the webrtc
+    // api doesn't expect volatile memory. This should be safe though because
+    // the mixer and webrtc will use or copy the contents of the buffer before
+    // returning and only then we release it. Native streams are always S16.
+    auto send_chunk = [&](const volatile uint8_t* data, int64_t timestamp,
+                          AudioStreamStats::Clock::time_point received) {
+      mixer_.AddChunk(stream_id,
+                      reinterpret_cast<const int16_t*>(
+                          const_cast<const uint8_t*>(data)),
+                      stream_desc.channels, timestamp);
+      stream_desc.stats.RecordDelivery(received);
+    };
     size_t pos = 0;
+    if (stream_desc.pending_buffer) {
+      auto& pending = *stream_desc.pending_buffer;
+      const size_t pending_len = pending.len() - stream_desc.pending_offset;
+      const size_t missing_len = chunk_len - pending_len;
+      if (pending.get() + pending.len() == buffer.get() &&
+          buffer.len() >= missing_len) {
+        // The guest's buffers are usually consecutive in the shared memory,
+        // so the chunk spanning both is read in place.
+        send_chunk(pending.get() + stream_desc.pending_offset, base_time,
+                   pending.received_at());
+        base_time += 10;
+        pos = missing_len;
+      } else {
+        holding_buffer.Add(pending.get() + stream_desc.pending_offset,
+                           pending_len);
+        stream_desc.held_since = pending.received_at();
+      }
+      ReleasePendingBuffer(stream_desc);
+    }
     while (pos < buffer.len()) {
-      if (holding_buffer.empty() &&
-          buffer.len() - pos >= holding_buffer.buffer.size()) {
-        // Avoid the extra copy into holding buffer
-        // This casts away volatility of the pointer, necessary because the
-        // webrtc api doesn't expect volatile memory. This should be safe though
-        // because webrtc will use the contents of the buffer before returning
-        // and only then we release it.
-        auto audio_frame_buffer = std::make_shared<CvdAudioFrameBuffer>(
-            const_cast<const uint8_t*>(&buffer.get()[pos]),
-            stream_desc.bits_per_sample, stream_desc.sample_rate,
-            stream_desc.channels, frames);
-        audio_sink_->OnFrame(audio_frame_buffer, base_time);
-        pos += holding_buffer.buffer.size();
+      if (holding_buffer.empty() && buffer.len() - pos >= chunk_len) {
+        send_chunk(buffer.get() + pos, base_time, buffer.received_at());
+        pos += chunk_len;
+      } else if (holding_buffer.empty()) {
+        // Sent along with the start of the next buffer, which is when this
+        // one goes back to the guest.
+        stream_desc.pending_offset = pos;
+        stream_desc.pending_buffer.emplace(std::move(buffer));
+        RecordPlaybackFill(stream_desc);
+        return;
       } else {
         pos += holding_buffer.Add(buffer.get() + pos, buffer.len() - pos);
         if (holding_buffer.full()) {
-          auto buffer_ptr = const_cast<const uint8_t*>(holding_buffer.data());
-          auto audio_frame_buffer = std::make_shared<CvdAudioFrameBuffer>(
-              buffer_ptr, stream_desc.bits_per_sample,
-              stream_desc.sample_rate, stream_desc.channels, frames);
-          audio_sink_->OnFrame(audio_frame_buffer, base_time);
+          send_chunk(holding_buffer.data(), base_time,
+                     stream_desc.held_since);
           holding_buffer.count = 0;
         }
       }
       base_time += 10;
     }
+    RecordPlaybackFill(stream_desc);
   }
   buffer.SendStatus(AudioStatus::VIRTIO_SND_S_OK, 0, buffer.len());
 }
 
+void AudioHandler::ReleasePendingBuffer(StreamDesc& stream_desc) {
+  if (!stream_desc.pending_buffer) {
+    return;
+  }
+  auto& pending = *stream_desc.pending_buffer;
+  pending.SendStatus(AudioStatus::VIRTIO_SND_S_OK, 0, pending.len());
+  stream_desc.pending_buffer.reset();
+}
+
+void AudioHandler::RecordPlaybackFill(StreamDesc& stream_desc) {
+  size_t held = stream_desc.buffer.count;
+  if (stream_desc.pending_buffer) {
+    held += stream_desc.pending_buffer->len() - stream_desc.pending_offset;
+  }
+  stream_desc.stats.RecordHoldingFill(held, stream_desc.buffer.buffer.size());
+}
+
 void AudioHandler::OnCaptureBuffer(RxBuffer buffer) {
   auto stream_id = buffer.stream_id();
+  // Invalid or playback streams shouldn't send rx buffers
+  if (stream_id >= NUM_STREAMS || !IsCapture(stream_id)) {
+    LOG(ERROR) << "Received capture buffers on playback stream " << stream_id;
+    buffer.SendStatus(AudioStatus::VIRTIO_SND_S_BAD_MSG, 0, 0);
+    return;
+  }
   auto& stream_desc = stream_descs_[stream_id];
-  {
-    std::lock_guard<std::mutex> lock(stream_desc.mtx);
-    // Invalid or playback streams shouldn't send rx buffers
-    if (stream_id >= NUM_STREAMS || !IsCapture(stream_id)) {
-      LOG(ERROR) << "Received capture buffers on playback stream " << stream_id;
-      buffer.SendStatus(AudioStatus::VIRTIO_SND_S_BAD_MSG, 0, 0);
-      return;
-    }
-    // A buffer may be received for an inactive stream if we were slow to
-    // process it and the other side stopped the stream. Quitely ignore it in
-    // that case
-    if (!stream_desc.active) {
-      buffer.SendStatus(AudioStatus::VIRTIO_SND_S_OK, 0, buffer.len());
-      return;
-    }
-    const auto bytes_per_sample = stream_desc.bits_per_sample / 8;
-    const auto samples_per_channel = stream_desc.sample_rate / 100;
-    const auto bytes_per_request =
-        samples_per_channel * bytes_per_sample * stream_desc.channels;
-    bool muted = false;
-    size_t bytes_read = 0;
-    auto& holding_buffer = stream_descs_[stream_id].buffer;
-    auto rx_buffer = const_cast<uint8_t*>(buffer.get());
-    if (!holding_buffer.empty()) {
-      // Consume any bytes remaining from previous requests
-      bytes_read += holding_buffer.Take(rx_buffer + bytes_read,
-                                        buffer.len() - bytes_read);
-    }
-    while (buffer.len() - bytes_read >= bytes_per_request) {
-      // Skip the holding buffer in as many reads as possible to avoid the extra
-      // copies
-      auto write_pos = rx_buffer + bytes_read;
-      auto res = audio_source_->GetMoreAudioData(
-          write_pos, bytes_per_sample, samples_per_channel,
-          stream_desc.channels, stream_desc.sample_rate, muted);
-      if (res < 0) {
-        // This is likely a recoverable error, log the error but don't let the
-        // VMM know about it so that it doesn't crash.
-        LOG(ERROR) << "Failed to receive audio data from client";
-        break;
-      }
-      if (muted) {
-        // The source is muted, just fill the buffer with zeros and return
-        memset(rx_buffer + bytes_read, 0, buffer.len() - bytes_read);
-        bytes_read = buffer.len();
-        break;
-      }
-      auto bytes_received = res * bytes_per_sample * stream_desc.channels;
-      bytes_read += bytes_received;
+  std::lock_guard<std::mutex> lock(stream_desc.mtx);
+  // A buffer may be received for an inactive stream if we were slow to
+  // process it and the other side stopped the stream. Quitely ignore it in
+  // that case
+  if (!stream_desc.active) {
+    buffer.SendStatus(AudioStatus::VIRTIO_SND_S_OK, 0, buffer.len());
+    return;
+  }
+  stream_desc.stats.RecordCaptureBuffer(buffer.received_at());
+  auto& ring = stream_desc.capture_ring;
+  if (buffer.len() + stream_desc.capture_chunk.size() > ring.buffer.size()) {
+    // Larger than the period the guest announced
+    ring.Reset(buffer.len() + stream_desc.capture_chunk.size());
+  }
+  stream_desc.capture_buffers.push_back(std::move(buffer));
+  // The audio may already be there
+  DeliverCaptures(stream_desc);
+}
+
+[[noreturn]] void AudioHandler::CaptureLoop() {
+  auto next = AudioStreamStats::Clock::now();
+  for (;;) {
+    std::this_thread::sleep_until(next);
+    auto now = AudioStreamStats::Clock::now();
+    if (now - next > kMaxCaptureLag) {
+      next = now;
     }
-    if (bytes_read < buffer.len()) {
-      // There is some buffer left to fill, but it's less than 10ms, read into
-      // holding buffer to ensure the remainder is kept around for future reads
-      auto write_pos = holding_buffer.data();
-      // Holding buffer is the exact size we need to read into and is emptied
-      // before we try to read into it.
-      CHECK(holding_buffer.freeCapacity() >= bytes_per_request)
-          << "Buffer too small for receiving audio";
-      auto res = audio_source_->GetMoreAudioData(
-          write_pos, bytes_per_sample, samples_per_channel,
-          stream_desc.channels, stream_desc.sample_rate, muted);
-      if (res < 0) {
-        // This is likely a recoverable error, log the error but don't let the
-        // VMM know about it so that it doesn't crash.
-        LOG(ERROR) << "Failed to receive audio data from client";
-      } else if (muted) {
-        // The source is muted, just fill the buffer with zeros and return
-        memset(rx_buffer + bytes_read, 0, buffer.len() - bytes_read);
-        bytes_read = buffer.len();
-      } else {
-        auto bytes_received = res * bytes_per_sample * stream_desc.channels;
-        holding_buffer.count += bytes_received;
-        bytes_read += holding_buffer.Take(rx_buffer + bytes_read,
-                                          buffer.len() - bytes_read);
-        // If the entire buffer is not full by now there is a bug above
-        // somewhere
-        CHECK(bytes_read == buffer.len()) << "Failed to read entire buffer";
+    for (; next <= now; next += kCaptureChunk) {
+      for (uint32_t stream_id = 0; stream_id < NUM_STREAMS; stream_id++) {
+        if (!IsCapture(stream_id)) {
+          continue;
+        }
+        auto& stream_desc = stream_descs_[stream_id];
+        std::lock_guard<std::mutex> lock(stream_desc.mtx);
+        if (!stream_desc.active || stream_desc.capture_chunk.empty()) {
+          continue;
+        }
+        PullCapture(stream_desc);
+        DeliverCaptures(stream_desc);
       }
     }
   }
-  buffer.SendStatus(AudioStatus::VIRTIO_SND_S_OK, 0, buffer.len());
+}
+
+void AudioHandler::PullCapture(StreamDesc& stream_desc) {
+  auto& chunk = stream_desc.capture_chunk;
+  const auto bytes_per_frame =
+      stream_desc.channels * stream_desc.bits_per_sample / 8;
+  bool muted = false;
+  auto res = audio_source_->GetMoreAudioData(
+      chunk.data(), stream_desc.bits_per_sample / 8,
+      stream_desc.sample_rate / 100, stream_desc.channels,
+      stream_desc.sample_rate, muted);
+  size_t received = 0;
+  if (res < 0) {
+    // This is likely a recoverable error, log the error but don't let the
+    // VMM know about it so that it doesn't crash.
+    LOG(ERROR) << "Failed to receive audio data from client";
+    stream_desc.stats.RecordUnderrun();
+  } else if (!muted) {
+    received = std::min<size_t>(res * bytes_per_frame, chunk.size());
+  }
+  // Silence keeps the guest's timeline going
+  std::memset(chunk.data() + received, 0, chunk.size() - received);
+  if (stream_desc.capture_ring.Add(chunk.data(), chunk.size(),
+                                   AudioStreamStats::Clock::now())) {
+    stream_desc.stats.RecordOverrun();
+  }
+}
+
+void AudioHandler::DeliverCaptures(StreamDesc& stream_desc) {
+  auto& ring = stream_desc.capture_ring;
+  auto& buffers = stream_desc.capture_buffers;
+  while (!buffers.empty() && ring.count >= buffers.front().len()) {
+    auto& buffer = buffers.front();
+    stream_desc.stats.RecordCaptureDelivery(ring.OldestPulled());
+    stream_desc.stats.RecordHoldingFill(ring.count, ring.buffer.size());
+    ring.Take(buffer.get(), buffer.len());
+    // What's left in the ring is audio the guest will get late
+    buffer.SendStatus(AudioStatus::VIRTIO_SND_S_OK, ring.count, buffer.len());
+    buffers.pop_front();
+  }
+}
+
+void AudioHandler::ReleaseCaptureBuffers(StreamDesc& stream_desc) {
+  for (auto& buffer : stream_desc.capture_buffers) {
+    buffer.SendStatus(AudioStatus::VIRTIO_SND_S_OK, 0, buffer.len());
+  }
+  stream_desc.capture_buffers.clear();
+}
+
+Json::Value AudioHandler::GetStats() {
+  Json::Value streams(Json::arrayValue);
+  for (uint32_t stream_id = 0; stream_id < NUM_STREAMS; stream_id++) {
+    auto stream = stream_descs_[stream_id].stats.ToJson();
+    stream["stream_id"] = stream_id;
+    stream["direction"] = IsCapture(stream_id) ? "capture" : "playback";
+    streams.append(stream);
+  }
+  Json::Value stats(Json::objectValue);
+  stats["streams"] = streams;
+  return stats;
 }
 
 void AudioHandler::HoldingBuffer::Reset(size_t size) {
@@ -565,24 +736,64 @@ size_t AudioHandler::HoldingBuffer::Add(const volatile uint8_t* data,
   return added_len;
 }
 
-size_t AudioHandler::HoldingBuffer::Take(uint8_t* dst, size_t len) {
-  auto n = std::min(len, count);
-  std::copy(buffer.begin(), buffer.begin() + n, dst);
-  std::copy(buffer.begin() + n, buffer.begin() + count, buffer.begin());
-  count -= n;
-  return n;
-}
-
 bool AudioHandler::HoldingBuffer::empty() const { return count == 0; }
 
 bool AudioHandler::HoldingBuffer::full() const {
   return count == buffer.size();
 }
 
-size_t AudioHandler::HoldingBuffer::freeCapacity() const {
-  return buffer.size() - count;
+uint8_t* AudioHandler::HoldingBuffer::data() { return buffer.data(); }
+
+void AudioHandler::CaptureRing::Reset(size_t size) {
+  buffer.resize(size);
+  start = 0;
+  count = 0;
+  chunks.clear();
+}
+
+bool AudioHandler::CaptureRing::Add(const uint8_t* data, size_t len,
+                                    AudioStreamStats::Clock::time_point pulled) {
+  if (len > buffer.size()) {
+    return true;
+  }
+  bool overrun = count + len > buffer.size();
+  if (overrun) {
+    Drop(count + len - buffer.size());
+  }
+  auto end = (start + count) % buffer.size();
+  auto first = std::min(len, buffer.size() - end);
+  std::copy(data, data + first, buffer.begin() + end);
+  std::copy(data + first, data + len, buffer.begin());
+  count += len;
+  chunks.emplace_back(pulled, len);
+  return overrun;
 }
 
-uint8_t* AudioHandler::HoldingBuffer::data() { return buffer.data(); }
+AudioStreamStats::Clock::time_point AudioHandler::CaptureRing::OldestPulled()
+    const {
+  return chunks.front().first;
+}
+
+void AudioHandler::CaptureRing::Take(volatile uint8_t* dst, size_t len) {
+  auto first = std::min(len, buffer.size() - start);
+  std::copy(buffer.begin() + start, buffer.begin() + start + first, dst);
+  std::copy(buffer.begin(), buffer.begin() + (len - first), dst + first);
+  Drop(len);
+}
+
+void AudioHandler::CaptureRing::Drop(size_t len) {
+  len = std::min(len, count);
+  start = buffer.empty() ? 0 : (start + len) % buffer.size();
+  count -= len;
+  while (len > 0) {
+    auto& [pulled, left] = chunks.front();
+    auto n = std::min(len, left);
+    left -= n;
+    len -= n;
+    if (left == 0) {
+      chunks.pop_front();
+    }
+  }
+}
 
 }  // namespace cuttlefish
@@ -16,11 +16,19 @@
 
 #pragma once
 
+#include <atomic>
+#include <deque>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <thread>
 #include <vector>
 
+#include <json/json.h>
+
+#include "host/frontend/webrtc/audio_converter.h"
+#include "host/frontend/webrtc/audio_mixer.h"
+#include "host/frontend/webrtc/audio_stream_stats.h"
 #include "host/frontend/webrtc/lib/audio_sink.h"
 #include "host/frontend/webrtc/lib/audio_source.h"
 #include "host/libs/audio_connector/server.h"
@@ -35,13 +43,30 @@ class AudioHandler : public AudioServerExecutor {
 
     void Reset(size_t size);
     size_t Add(const volatile uint8_t* data, size_t max_len);
-    size_t Take(uint8_t* dst, size_t len);
     bool empty() const;
     bool full() const;
-    size_t freeCapacity() const;
     uint8_t* data();
     uint8_t* end();
   };
+  // Capture audio pulled from WebRTC, waiting for the guest's buffers.
+  struct CaptureRing {
+    std::vector<uint8_t> buffer;
+    size_t start = 0;
+    size_t count = 0;
+    // When each chunk in the ring was pulled and how many of its bytes are
+    // left, oldest first.
+    std::deque<std::pair<AudioStreamStats::Clock::time_point, size_t>> chunks;
+
+    void Reset(size_t size);
+    // Drops the oldest audio if there is no room for the new one, returns
+    // whether it had to.
+    bool Add(const uint8_t* data, size_t len,
+             AudioStreamStats::Clock::time_point pulled);
+    // When the oldest byte was pulled. Must not be empty.
+    AudioStreamStats::Clock::time_point OldestPulled() const;
+    void Take(volatile uint8_t* dst, size_t len);
+    void Drop(size_t len);
+  };
   struct StreamDesc {
     std::mutex mtx;
     int bits_per_sample = -1;
@@ -49,6 +74,21 @@ class AudioHandler : public AudioServerExecutor {
     int channels = -1;
     bool active = false;
     HoldingBuffer buffer;
+    // A playback buffer whose last bytes, from pending_offset on, didn't fill
+    // a whole 10ms chunk. It's held until the next buffer completes that
+    // chunk, in place if the two are adjacent in shared memory.
+    std::optional<TxBuffer> pending_buffer;
+    size_t pending_offset = 0;
+    // Set for playback streams WebRTC would otherwise need to convert.
+    std::optional<AudioConverter> converter;
+    // Capture streams only: the audio pulled every 10ms, room for two virtio-snd
+    // periods, and the guest's buffers waiting for it, oldest first.
+    CaptureRing capture_ring;
+    std::vector<uint8_t> capture_chunk;
+    std::deque<RxBuffer> capture_buffers;
+    // When the first bytes in the holding buffer were received.
+    AudioStreamStats::Clock::time_point held_since;
+    AudioStreamStats stats;
   };
 
  public:
@@ -59,6 +99,10 @@ class AudioHandler : public AudioServerExecutor {
 
   void Start();
 
+  // While inactive, playback buffers go back to the guest right away instead
+  // of being converted and mixed for the streamer. Active by default.
+  void SetActive(bool active);
+
   // AudioServerExecutor implementation
   void StreamsInfo(StreamInfoCommand& cmd) override;
   void SetStreamParameters(StreamSetParamsCommand& cmd) override;
@@ -72,13 +116,37 @@ class AudioHandler : public AudioServerExecutor {
   void OnPlaybackBuffer(TxBuffer buffer) override;
   void OnCaptureBuffer(RxBuffer buffer) override;
 
+  // Timing and buffering of each stream's audio.
+  Json::Value GetStats();
+
  private:
   [[noreturn]] void Loop();
+  // Returns the pending playback buffer to the guest, dropping its unsent
+  // bytes. Must be called with the stream's mutex held.
+  static void ReleasePendingBuffer(StreamDesc& stream_desc);
+  // Must be called with the stream's mutex held.
+  static void RecordPlaybackFill(StreamDesc& stream_desc);
+  // Pulls the capture audio at the pace it's played by WebRTC, so that the
+  // guest gets it as soon as a period is complete instead of whatever WebRTC
+  // had buffered whenever the guest asks for it.
+  [[noreturn]] void CaptureLoop();
+  // Must be called with the stream's mutex held.
+  void PullCapture(StreamDesc& stream_desc);
+  // Fills the waiting capture buffers the ring has enough audio for. Must be
+  // called with the stream's mutex held.
+  static void DeliverCaptures(StreamDesc& stream_desc);
+  // Returns the waiting capture buffers to the guest empty. Must be called
+  // with the stream's mutex held.
+  static void ReleaseCaptureBuffers(StreamDesc& stream_desc);
 
   std::shared_ptr<webrtc_streaming::AudioSink> audio_sink_;
   std::unique_ptr<AudioServer> audio_server_;
   std::thread server_thread_;
+  std::thread capture_thread_;
   std::vector<StreamDesc> stream_descs_ = {};
   std::shared_ptr<webrtc_streaming::AudioSource> audio_source_;
+  // All playback streams go through it before reaching audio_sink_.
+  AudioMixer mixer_;
+  std::atomic<bool> active_ = true;
 };
 }  // namespace cuttlefish
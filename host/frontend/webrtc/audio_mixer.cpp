@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/audio_mixer.h"
+
+#include <algorithm>
+
+#include <android-base/logging.h>
+
+#include "host/frontend/webrtc/audio_converter.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr size_t kChunkSamples =
+    AudioConverter::kOutputFramesPerChunk * AudioMixer::kChannels;
+
+}  // namespace
+
+AudioMixer::AudioMixer(size_t num_streams, OnMixedCb on_mixed)
+    : streams_(num_streams),
+      on_mixed_(std::move(on_mixed)),
+      sum_(kChunkSamples),
+      mixed_(kChunkSamples) {}
+
+void AudioMixer::SetStreamActive(uint32_t stream_id, bool active) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  CHECK(stream_id < streams_.size()) << "Invalid stream id: " << stream_id;
+  auto& stream = streams_[stream_id];
+  stream.active = active;
+  if (!active) {
+    stream.chunks.clear();
+    // The other streams no longer wait for this one.
+    MixReady();
+  }
+}
+
+void AudioMixer::AddChunk(uint32_t stream_id, const int16_t* samples,
+                          int channels, int64_t timestamp_ms) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  CHECK(stream_id < streams_.size()) << "Invalid stream id: " << stream_id;
+  auto& stream = streams_[stream_id];
+  if (!stream.active) {
+    return;
+  }
+  bool others_active = false;
+  for (const auto& other : streams_) {
+    others_active |= &other != &stream && other.active;
+  }
+  if (!others_active && stream.chunks.empty() && channels == kChannels) {
+    // Nothing to mix with, which is the common case.
+    on_mixed_(samples, timestamp_ms);
+    return;
+  }
+  stream.chunks.push_back(MakeChunk(samples, channels, timestamp_ms));
+  MixReady();
+}
+
+AudioMixer::Chunk AudioMixer::MakeChunk(const int16_t* samples, int channels,
+                                        int64_t timestamp_ms) {
+  Chunk chunk{std::vector<int16_t>(kChunkSamples), true, timestamp_ms};
+  const int frames = AudioConverter::kOutputFramesPerChunk;
+  int16_t any_sample = 0;
+  if (channels == kChannels) {
+    std::copy(samples, samples + kChunkSamples, chunk.samples.begin());
+    for (size_t i = 0; i < kChunkSamples; i++) {
+      any_sample |= samples[i];
+    }
+  } else {
+    for (int i = 0; i < frames; i++) {
+      chunk.samples[2 * i] = chunk.samples[2 * i + 1] = samples[i];
+      any_sample |= samples[i];
+    }
+  }
+  chunk.silent = any_sample == 0;
+  return chunk;
+}
+
+void AudioMixer::MixReady() {
+  for (;;) {
+    bool all_ready = true;
+    size_t max_queued = 0;
+    for (const auto& stream : streams_) {
+      if (stream.active) {
+        all_ready &= !stream.chunks.empty();
+        max_queued = std::max(max_queued, stream.chunks.size());
+      }
+    }
+    if (max_queued == 0 || (!all_ready && max_queued < kMaxQueuedChunks)) {
+      return;
+    }
+    // Silent chunks are skipped entirely. When a single stream has sound its
+    // chunk is delivered as is.
+    std::vector<const Chunk*> audible;
+    const Chunk* first = nullptr;
+    for (const auto& stream : streams_) {
+      if (stream.chunks.empty()) {
+        continue;
+      }
+      const auto& chunk = stream.chunks.front();
+      if (!first || chunk.timestamp_ms < first->timestamp_ms) {
+        first = &chunk;
+      }
+      if (!chunk.silent) {
+        audible.push_back(&chunk);
+      }
+    }
+    const int16_t* samples = first->samples.data();
+    if (audible.size() == 1) {
+      samples = audible[0]->samples.data();
+    } else if (audible.size() > 1) {
+      std::fill(sum_.begin(), sum_.end(), 0);
+      for (const auto* chunk : audible) {
+        for (size_t i = 0; i < kChunkSamples; i++) {
+          sum_[i] += chunk->samples[i];
+        }
+      }
+      for (size_t i = 0; i < kChunkSamples; i++) {
+        mixed_[i] = std::clamp<int32_t>(sum_[i], INT16_MIN, INT16_MAX);
+      }
+      samples = mixed_.data();
+    }
+    on_mixed_(samples, first->timestamp_ms);
+    for (auto& stream : streams_) {
+      if (!stream.chunks.empty()) {
+        stream.chunks.pop_front();
+      }
+    }
+  }
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace cuttlefish {
+
+// Combines the 10ms chunks of all active playback streams into a single
+// stereo stream, so that WebRTC gets only one source to process. Chunks must
+// be 16 bit samples at AudioConverter::kOutputSampleRate, with one or two
+// channels.
+class AudioMixer {
+ public:
+  static constexpr int kChannels = 2;
+  // Chunks queued for a stream before the others are considered late and
+  // mixed in as silence.
+  static constexpr size_t kMaxQueuedChunks = 3;
+
+  using OnMixedCb =
+      std::function<void(const int16_t* samples, int64_t timestamp_ms)>;
+
+  AudioMixer(size_t num_streams, OnMixedCb on_mixed);
+
+  // Inactive streams aren't waited for and their queued chunks are dropped.
+  void SetStreamActive(uint32_t stream_id, bool active);
+  void AddChunk(uint32_t stream_id, const int16_t* samples, int channels,
+                int64_t timestamp_ms);
+
+ private:
+  struct Chunk {
+    std::vector<int16_t> samples;
+    bool silent;
+    int64_t timestamp_ms;
+  };
+  struct Stream {
+    bool active = false;
+    std::deque<Chunk> chunks;
+  };
+
+  // Mixes and delivers as many chunks as are ready. Must be called with the
+  // mutex held.
+  void MixReady();
+  Chunk MakeChunk(const int16_t* samples, int channels, int64_t timestamp_ms);
+
+  std::mutex mtx_;
+  std::vector<Stream> streams_;
+  OnMixedCb on_mixed_;
+  std::vector<int32_t> sum_;
+  std::vector<int16_t> mixed_;
+};
+
+}  // namespace cuttlefish
@@ -0,0 +1,534 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Drives the audio path of the streamer the way the guests of a dense host do,
+// without any of them. Each emulated device gets its own AudioHandler, behind
+// the same AudioServer socket and shared memory crosvm talks to, and a
+// synthetic virtio-snd client that plays and captures 48kHz stereo audio one
+// period at a time.
+//
+// Each run reports, across all streams:
+//  - jitter_us: how far apart the host gave back consecutive buffers of a
+//    stream, compared to the period, as mean, p99 and max.
+//  - glitches: buffers given back more than half a period late.
+//  - stalls: periods the client couldn't queue because the host still held
+//    every buffer of the stream, where a guest would underrun.
+//  - underruns and overruns: as seen by the AudioHandlers.
+//  - host_cpu_pct and client_cpu_pct: CPU time spent on the host side, and by
+//    the synthetic clients, as a percentage of one core.
+
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+#include <benchmark/benchmark.h>
+#include <gflags/gflags.h>
+#include <json/json.h>
+
+#include "common/libs/fs/epoll.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+#include "host/frontend/webrtc/audio_handler.h"
+#include "host/frontend/webrtc/frame_latency_stats.h"
+#include "host/frontend/webrtc/lib/audio_sink.h"
+#include "host/frontend/webrtc/lib/audio_source.h"
+#include "host/libs/audio_connector/server.h"
+#include "host/libs/audio_connector/synthetic_client.h"
+
+DEFINE_string(devices, "1,8,32",
+              "Comma separated numbers of devices to emulate, each with a "
+              "playback and a capture stream");
+DEFINE_string(periods_ms, "10,20",
+              "Comma separated virtio-snd periods to drive the streams at, in "
+              "milliseconds");
+DEFINE_int32(periods_per_buffer, 4,
+             "How many periods each stream's buffer holds, which is how many "
+             "the client can have queued with the host at once");
+DEFINE_int32(seconds, 5, "How long to drive the streams for");
+DEFINE_bool(capture, true,
+            "Whether to drive the capture streams along with the playback "
+            "ones");
+
+namespace cuttlefish {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kSampleRate = 48000;
+constexpr int kChannels = 2;
+constexpr int kBytesPerFrame = kChannels * sizeof(int16_t);
+// How long the receiving thread waits for statuses before checking whether
+// the run is over
+constexpr int kReceiveTimeoutMs = 100;
+
+std::chrono::nanoseconds CpuTime(clockid_t clock) {
+  timespec ts;
+  if (clock_gettime(clock, &ts) != 0) {
+    return {};
+  }
+  return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+// Takes the mixed playback audio like the WebRTC audio track would.
+class CountingSink : public webrtc_streaming::AudioSink {
+ public:
+  void OnFrame(std::shared_ptr<webrtc_streaming::AudioFrameBuffer> frame,
+               int64_t) override {
+    frames_ += frame->frames();
+  }
+
+ private:
+  std::atomic<std::uint64_t> frames_ = 0;
+};
+
+// Produces a tone for the capture streams, like a client's microphone would.
+class ToneSource : public webrtc_streaming::AudioSource {
+ public:
+  int GetMoreAudioData(void* data, int bytes_per_sample,
+                       int samples_per_channel, int num_channels, int,
+                       bool& muted) override {
+    auto samples = static_cast<int16_t*>(data);
+    const int count = samples_per_channel * num_channels;
+    for (int i = 0; bytes_per_sample == 2 && i < count; i++) {
+      samples[i] = static_cast<int16_t>((phase_++ % 128) * 256);
+    }
+    muted = bytes_per_sample != 2;
+    return samples_per_channel;
+  }
+
+ private:
+  std::uint32_t phase_ = 0;
+};
+
+// Jitter, lateness and turnaround of all the streams of a run.
+struct LoadStats {
+  LatencyHistogram jitter;
+  LatencyHistogram playback_turnaround;
+  std::atomic<std::uint64_t> glitches = 0;
+  std::atomic<std::uint64_t> stalls = 0;
+  std::atomic<std::uint64_t> errors = 0;
+};
+
+// One stream of a synthetic client, with its buffer split in periods that
+// are queued with the host in turn.
+class StreamLoad {
+ public:
+  StreamLoad(SyntheticAudioClient& client, uint32_t stream_id, bool capture,
+             std::chrono::milliseconds period, LoadStats& stats)
+      : client_(client),
+        stream_id_(stream_id),
+        capture_(capture),
+        period_(period),
+        period_bytes_(kSampleRate * period.count() / 1000 * kBytesPerFrame),
+        in_flight_(FLAGS_periods_per_buffer),
+        stats_(stats) {}
+
+  bool capture() const { return capture_; }
+  uint32_t buffer_bytes() const { return period_bytes_ * in_flight_.size(); }
+
+  Result<void> Start() {
+    CF_EXPECT(client_.SetParams(stream_id_, buffer_bytes(), period_bytes_,
+                                kChannels,
+                                AudioStreamFormat::VIRTIO_SND_PCM_FMT_S16,
+                                AudioStreamRate::VIRTIO_SND_PCM_RATE_48000));
+    CF_EXPECT(client_.Prepare(stream_id_));
+    CF_EXPECT(client_.Start(stream_id_));
+    if (capture_) {
+      // The guest queues its whole buffer to be filled
+      for (std::size_t slot = 0; slot < in_flight_.size(); slot++) {
+        CF_EXPECT(Send(slot));
+      }
+    }
+    return {};
+  }
+
+  Result<void> Stop() {
+    CF_EXPECT(client_.Stop(stream_id_));
+    CF_EXPECT(client_.Release(stream_id_));
+    return {};
+  }
+
+  // Plays the n-th period, if the host gave its part of the buffer back.
+  Result<void> PlayPeriod(std::uint64_t n) {
+    const std::size_t slot = n % in_flight_.size();
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      if (in_flight_[slot]) {
+        stats_.stalls++;
+        return {};
+      }
+    }
+    auto shm = client_.tx_shm() + slot * period_bytes_;
+    for (uint32_t i = 0; i < period_bytes_; i++) {
+      shm[i] = static_cast<uint8_t>(n + i);
+    }
+    CF_EXPECT(Send(slot));
+    return {};
+  }
+
+  // The host gave a period back.
+  Result<void> OnStatus(const IoStatusMsg& status) {
+    const auto now = Clock::now();
+    if (status.status.status.as_uint32_t() !=
+        static_cast<uint32_t>(AudioStatus::VIRTIO_SND_S_OK)) {
+      stats_.errors++;
+    }
+    CF_EXPECT(status.buffer_offset % period_bytes_ == 0 &&
+                  status.buffer_offset / period_bytes_ < in_flight_.size(),
+              "Status for an unknown buffer: " << status.buffer_offset);
+    const std::size_t slot = status.buffer_offset / period_bytes_;
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      CF_EXPECT(in_flight_[slot].has_value(),
+                "Status for a buffer that wasn't sent: " << slot);
+      if (!capture_) {
+        stats_.playback_turnaround.Record(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                now - *in_flight_[slot]));
+      }
+      in_flight_[slot].reset();
+      if (last_status_) {
+        const auto interval = now - *last_status_;
+        stats_.jitter.Record(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                interval > period_ ? interval - period_ : period_ - interval));
+        if (interval > period_ * 3 / 2) {
+          stats_.glitches++;
+        }
+      }
+      last_status_ = now;
+    }
+    if (capture_) {
+      // The guest reads the audio and queues the period again
+      CF_EXPECT(Send(slot));
+    }
+    return {};
+  }
+
+ private:
+  Result<void> Send(std::size_t slot) {
+    {
+      std::lock_guard<std::mutex> lock(mtx_);
+      in_flight_[slot] = Clock::now();
+    }
+    const uint32_t offset = slot * period_bytes_;
+    if (capture_) {
+      CF_EXPECT(client_.SendCapture(stream_id_, offset, period_bytes_));
+    } else {
+      CF_EXPECT(client_.SendPlayback(stream_id_, offset, period_bytes_));
+    }
+    return {};
+  }
+
+  SyntheticAudioClient& client_;
+  const uint32_t stream_id_;
+  const bool capture_;
+  const std::chrono::milliseconds period_;
+  const uint32_t period_bytes_;
+  std::mutex mtx_;
+  // When each period of the buffer was queued, empty when the host gave it
+  // back.
+  std::vector<std::optional<Clock::time_point>> in_flight_;
+  std::optional<Clock::time_point> last_status_;
+  LoadStats& stats_;
+};
+
+// An AudioHandler, set up the way the streamer does it, with a synthetic
+// client connected through a socket in its own directory.
+struct Device {
+  AudioHandler* handler;
+  std::unique_ptr<SyntheticAudioClient> client;
+  std::vector<std::unique_ptr<StreamLoad>> streams;
+};
+
+class AudioLoad {
+ public:
+  static Result<std::unique_ptr<AudioLoad>> Create(
+      int devices, std::chrono::milliseconds period) {
+    std::unique_ptr<AudioLoad> load(new AudioLoad(period));
+    load->epoll_ = CF_EXPECT(Epoll::Create());
+    char dir_template[] = "/tmp/audio_pipeline_benchmark.XXXXXX";
+    CF_EXPECT(mkdtemp(dir_template) != nullptr,
+              "Failed to create a directory for the audio sockets");
+    load->socket_dir_ = dir_template;
+    for (int i = 0; i < devices; i++) {
+      load->devices_.emplace_back(CF_EXPECT(load->CreateDevice(i)));
+    }
+    return load;
+  }
+
+  ~AudioLoad() {
+    for (int i = 0; i < static_cast<int>(devices_.size()); i++) {
+      unlink(SocketPath(i).c_str());
+    }
+    rmdir(socket_dir_.c_str());
+  }
+
+  Result<void> Run(std::chrono::seconds duration) {
+    for (auto& device : devices_) {
+      for (auto& stream : device.streams) {
+        CF_EXPECT(stream->Start());
+      }
+    }
+    const auto process_cpu_start = CpuTime(CLOCK_PROCESS_CPUTIME_ID);
+    const auto start = Clock::now();
+    std::atomic<bool> done = false;
+    std::atomic<std::int64_t> receiver_cpu_ns = 0;
+    Result<void> received;
+    std::thread receiver([this, &done, &receiver_cpu_ns, &received]() {
+      received = Receive(done);
+      receiver_cpu_ns = CpuTime(CLOCK_THREAD_CPUTIME_ID).count();
+    });
+
+    // The guest produces one period of each playback stream per period
+    const auto sender_cpu_start = CpuTime(CLOCK_THREAD_CPUTIME_ID);
+    Result<void> sent;
+    for (std::uint64_t n = 0; sent.ok(); n++) {
+      const auto due = start + n * period_;
+      if (due >= start + duration) {
+        break;
+      }
+      std::this_thread::sleep_until(due);
+      for (auto& device : devices_) {
+        for (auto& stream : device.streams) {
+          if (!stream->capture() && sent.ok()) {
+            sent = stream->PlayPeriod(n);
+          }
+        }
+      }
+    }
+    const auto sender_cpu = CpuTime(CLOCK_THREAD_CPUTIME_ID) - sender_cpu_start;
+    std::this_thread::sleep_until(start + duration);
+    done = true;
+    receiver.join();
+    wall_time_ = Clock::now() - start;
+    const auto process_cpu =
+        CpuTime(CLOCK_PROCESS_CPUTIME_ID) - process_cpu_start;
+    client_cpu_ = sender_cpu + std::chrono::nanoseconds(receiver_cpu_ns);
+    host_cpu_ = process_cpu - client_cpu_;
+    CF_EXPECT(std::move(sent));
+    CF_EXPECT(std::move(received));
+
+    for (auto& device : devices_) {
+      for (auto& stream : device.streams) {
+        CF_EXPECT(stream->Stop());
+      }
+    }
+    return {};
+  }
+
+  void Report(benchmark::State& state) const {
+    const auto jitter = stats_.jitter.ToJson();
+    state.counters["jitter_us"] = jitter["mean_us"].asDouble();
+    state.counters["jitter_p99_us"] = jitter["p99_us"].asDouble();
+    state.counters["jitter_max_us"] = jitter["max_us"].asDouble();
+    state.counters["playback_turnaround_us"] =
+        stats_.playback_turnaround.ToJson()["mean_us"].asDouble();
+    state.counters["glitches"] = stats_.glitches.load();
+    state.counters["stalls"] = stats_.stalls.load();
+    state.counters["errors"] = stats_.errors.load();
+    std::uint64_t underruns = 0;
+    std::uint64_t overruns = 0;
+    for (const auto& device : devices_) {
+      for (const auto& stream : device.handler->GetStats()["streams"]) {
+        underruns += stream["underruns"].asUInt64();
+        overruns += stream["overruns"].asUInt64();
+      }
+    }
+    state.counters["underruns"] = underruns;
+    state.counters["overruns"] = overruns;
+    const double wall_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(wall_time_)
+            .count();
+    if (wall_ns > 0) {
+      state.counters["host_cpu_pct"] = 100.0 * host_cpu_.count() / wall_ns;
+      state.counters["client_cpu_pct"] = 100.0 * client_cpu_.count() / wall_ns;
+    }
+  }
+
+ private:
+  AudioLoad(std::chrono::milliseconds period) : period_(period) {}
+
+  std::string SocketPath(int index) const {
+    return socket_dir_ + "/audio_server_" + std::to_string(index) + ".sock";
+  }
+
+  Result<Device> CreateDevice(int index) {
+    auto server_socket =
+        SharedFD::SocketLocalServer(SocketPath(index), false, SOCK_SEQPACKET,
+                                    0666);
+    CF_EXPECT(server_socket->IsOpen(),
+              "Failed to create the audio server socket: "
+                  << server_socket->StrError());
+    // The handler's threads never exit, so it can't be destroyed
+    auto handler = new AudioHandler(std::make_unique<AudioServer>(server_socket),
+                                    sink_, source_);
+    handler->Start();
+
+    Device device{
+        .handler = handler,
+        .client = CF_EXPECT(SyntheticAudioClient::Connect(SocketPath(index))),
+        .streams = {},
+    };
+    auto& client = *device.client;
+    auto infos = CF_EXPECT(client.StreamsInfo(0, client.config().streams));
+    for (uint32_t stream_id = 0; stream_id < infos.size(); stream_id++) {
+      const bool capture =
+          infos[stream_id].direction ==
+          static_cast<uint8_t>(AudioStreamDirection::VIRTIO_SND_D_INPUT);
+      if (capture && !FLAGS_capture) {
+        continue;
+      }
+      auto stream = std::make_unique<StreamLoad>(client, stream_id, capture,
+                                                 period_, stats_);
+      const auto shm_len = capture ? client.rx_shm_len() : client.tx_shm_len();
+      // Every stream of a direction shares the buffer area, which is plenty
+      // for the one stream of each the AudioHandler has.
+      CF_EXPECT(stream->buffer_bytes() < shm_len,
+                "The stream's buffer doesn't fit in the shared memory");
+      auto socket = capture ? client.rx_socket() : client.tx_socket();
+      CF_EXPECT(epoll_.Add(socket, EPOLLIN));
+      receivers_[socket] = {&client, stream.get()};
+      device.streams.emplace_back(std::move(stream));
+    }
+    return device;
+  }
+
+  // Handles the buffers the host gives back, from its own thread like the
+  // VMM does.
+  Result<void> Receive(const std::atomic<bool>& done) {
+    while (!done) {
+      auto event = CF_EXPECT(epoll_.Wait(kReceiveTimeoutMs));
+      if (!event) {
+        continue;
+      }
+      auto it = receivers_.find(event->fd);
+      CF_EXPECT(it != receivers_.end(), "Event for an unknown socket");
+      auto& [client, stream] = it->second;
+      auto status = stream->capture()
+                        ? CF_EXPECT(client->ReceiveCaptureStatus())
+                        : CF_EXPECT(client->ReceivePlaybackStatus());
+      CF_EXPECT(stream->OnStatus(status));
+    }
+    return {};
+  }
+
+  const std::chrono::milliseconds period_;
+  std::string socket_dir_;
+  std::shared_ptr<CountingSink> sink_ = std::make_shared<CountingSink>();
+  std::shared_ptr<ToneSource> source_ = std::make_shared<ToneSource>();
+  Epoll epoll_;
+  std::map<SharedFD, std::pair<SyntheticAudioClient*, StreamLoad*>>
+      receivers_;
+  std::vector<Device> devices_;
+  LoadStats stats_;
+  Clock::duration wall_time_{};
+  std::chrono::nanoseconds host_cpu_{};
+  std::chrono::nanoseconds client_cpu_{};
+};
+
+void BM_AudioLoad(benchmark::State& state, int devices,
+                  std::chrono::milliseconds period) {
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto load = AudioLoad::Create(devices, period);
+    if (!load.ok()) {
+      LOG(ERROR) << load.error().message();
+      state.SkipWithError("Failed to create the audio load");
+      return;
+    }
+    state.ResumeTiming();
+    auto run = (*load)->Run(std::chrono::seconds(FLAGS_seconds));
+    if (!run.ok()) {
+      LOG(ERROR) << run.error().message();
+      state.SkipWithError("Failed to drive the audio streams");
+      return;
+    }
+    (*load)->Report(state);
+  }
+}
+
+bool ParseList(const std::string& list, std::vector<int>* values) {
+  for (const auto& item : android::base::Split(list, ",")) {
+    int value;
+    if (!android::base::ParseInt(item, &value, 1)) {
+      return false;
+    }
+    values->push_back(value);
+  }
+  return true;
+}
+
+int RegisterBenchmarks() {
+  std::vector<int> devices;
+  if (!ParseList(FLAGS_devices, &devices)) {
+    LOG(ERROR) << "Invalid --devices: " << FLAGS_devices;
+    return 1;
+  }
+  std::vector<int> periods;
+  if (!ParseList(FLAGS_periods_ms, &periods)) {
+    LOG(ERROR) << "Invalid --periods_ms: " << FLAGS_periods_ms;
+    return 1;
+  }
+  if (FLAGS_periods_per_buffer < 2) {
+    LOG(ERROR) << "The buffers need at least two periods";
+    return 1;
+  }
+  for (int count : devices) {
+    for (int period : periods) {
+      benchmark::RegisterBenchmark(
+          ("BM_AudioLoad/devices:" + std::to_string(count) +
+           "/period_ms:" + std::to_string(period))
+              .c_str(),
+          [count, period](benchmark::State& state) {
+            BM_AudioLoad(state, count, std::chrono::milliseconds(period));
+          })
+          ->Iterations(1)
+          ->UseRealTime()
+          ->Unit(benchmark::kMillisecond);
+    }
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  // Takes its flags out of argv first, which gflags would reject
+  benchmark::Initialize(&argc, argv);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  if (auto result = cuttlefish::RegisterBenchmarks(); result != 0) {
+    return result;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/audio_stream_stats.h"
+
+#include <algorithm>
+#include <string>
+
+namespace cuttlefish {
+namespace {
+
+std::chrono::microseconds Elapsed(AudioStreamStats::Clock::time_point from,
+                                  AudioStreamStats::Clock::time_point to) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(to - from);
+}
+
+}  // namespace
+
+void AudioStreamStats::RecordPlaybackBuffer(
+    Clock::time_point received, std::chrono::microseconds duration) {
+  RecordArrival(received);
+  if (!queued_until_ || *queued_until_ < received) {
+    if (queued_until_) {
+      underruns_.fetch_add(1, std::memory_order_relaxed);
+    }
+    queued_until_ = received;
+  }
+  *queued_until_ += duration;
+  if (*queued_until_ - received > kMaxQueuedAudio) {
+    overruns_.fetch_add(1, std::memory_order_relaxed);
+    // Whatever didn't fit is assumed to be dropped.
+    queued_until_ = received + kMaxQueuedAudio;
+  }
+}
+
+void AudioStreamStats::RecordCaptureBuffer(Clock::time_point received) {
+  RecordArrival(received);
+}
+
+void AudioStreamStats::RecordCaptureDelivery(Clock::time_point pulled) {
+  capture_latency_.Record(Elapsed(pulled, Clock::now()));
+}
+
+void AudioStreamStats::RecordOverrun() {
+  overruns_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AudioStreamStats::RecordDelivery(Clock::time_point received) {
+  buffer_to_sink_.Record(Elapsed(received, Clock::now()));
+}
+
+void AudioStreamStats::RecordHoldingFill(std::size_t held,
+                                         std::size_t capacity) {
+  if (capacity == 0) {
+    return;
+  }
+  const auto index = std::min<std::size_t>(held * 10 / capacity, 10);
+  holding_fill_[index].fetch_add(1, std::memory_order_relaxed);
+}
+
+void AudioStreamStats::RecordUnderrun() {
+  underruns_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AudioStreamStats::Restart() {
+  last_received_.reset();
+  queued_until_.reset();
+}
+
+void AudioStreamStats::RecordArrival(Clock::time_point received) {
+  if (last_received_) {
+    period_interval_.Record(Elapsed(*last_received_, received));
+  }
+  last_received_ = received;
+}
+
+Json::Value AudioStreamStats::ToJson() const {
+  Json::Value json(Json::objectValue);
+  json["period_interval"] = period_interval_.ToJson();
+  json["buffer_to_sink"] = buffer_to_sink_.ToJson();
+  json["capture_latency"] = capture_latency_.ToJson();
+  json["underruns"] = Json::UInt64(underruns_.load(std::memory_order_relaxed));
+  json["overruns"] = Json::UInt64(overruns_.load(std::memory_order_relaxed));
+  Json::Value fill(Json::objectValue);
+  for (std::size_t i = 0; i < holding_fill_.size(); i++) {
+    fill[std::to_string(i * 10) + "%"] =
+        Json::UInt64(holding_fill_[i].load(std::memory_order_relaxed));
+  }
+  json["holding_fill"] = fill;
+  return json;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+#include <json/json.h>
+
+#include "host/frontend/webrtc/frame_latency_stats.h"
+
+namespace cuttlefish {
+
+// How regularly the guest sends or requests the audio of a stream and how long
+// it takes to reach WebRTC. The Record* functions must be called from a single
+// thread at a time, ToJson can be called from any thread.
+class AudioStreamStats {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // The guest is considered ahead of real time, with WebRTC having to buffer
+  // or drop the audio, once it sent this much more than has been played.
+  static constexpr std::chrono::milliseconds kMaxQueuedAudio{200};
+
+  // A playback buffer holding the given duration of audio. It's an underrun
+  // when it arrives after the previous ones have been played out and an
+  // overrun when it takes the queued audio above kMaxQueuedAudio.
+  void RecordPlaybackBuffer(Clock::time_point received,
+                            std::chrono::microseconds duration);
+  void RecordCaptureBuffer(Clock::time_point received);
+  // Capture audio pulled from WebRTC at the given time reached the guest.
+  void RecordCaptureDelivery(Clock::time_point pulled);
+  // Capture audio was dropped because the guest didn't take it in time.
+  void RecordOverrun();
+  // A 10ms chunk whose first samples were received at the given time was
+  // handed to WebRTC.
+  void RecordDelivery(Clock::time_point received);
+  // Bytes waiting for enough others to complete a 10ms chunk.
+  void RecordHoldingFill(std::size_t held, std::size_t capacity);
+  // The audio couldn't be produced or consumed on time.
+  void RecordUnderrun();
+  // Starts a new timeline, so that the pause isn't reported as an underrun.
+  void Restart();
+
+  Json::Value ToJson() const;
+
+ private:
+  void RecordArrival(Clock::time_point received);
+
+  LatencyHistogram period_interval_;
+  LatencyHistogram buffer_to_sink_;
+  LatencyHistogram capture_latency_;
+  // In steps of 10% of the 10ms chunk.
+  std::array<std::atomic<std::uint64_t>, 11> holding_fill_{};
+  std::atomic<std::uint64_t> underruns_{0};
+  std::atomic<std::uint64_t> overruns_{0};
+  std::optional<Clock::time_point> last_received_;
+  std::optional<Clock::time_point> queued_until_;
+};
+
+}  // namespace cuttlefish
@@ -18,6 +18,8 @@
 
 #include <unistd.h>
 
+#include <utility>
+
 #include <android-base/logging.h>
 
 using namespace android;
@@ -25,51 +27,29 @@ using namespace android;
 namespace cuttlefish {
 namespace webrtc_streaming {
 
+namespace {
+
+// HCI packets are small, this is only to drain bursts in few reads.
+constexpr size_t kReadBufferSize = 16 * 1024;
+
+}  // namespace
+
 BluetoothHandler::BluetoothHandler(
-    const int rootCanalTestPort,
-    std::function<void(const uint8_t *, size_t)> send_to_client)
-    : send_to_client_(send_to_client),
-      rootcanal_socket_(
+    HandlerLoop &loop, const int rootCanalTestPort,
+    std::function<bool(const uint8_t *, size_t)> send_to_client)
+    : rootcanal_socket_(
           SharedFD::SocketLocalClient(rootCanalTestPort, SOCK_STREAM)),
-      shutdown_(SharedFD::Event(0, 0)) {
-  std::thread loop([this]() { ReadLoop(); });
-  read_thread_.swap(loop);
-}
+      forwarder_(SocketForwarder::Start(loop, rootcanal_socket_,
+                                        kReadBufferSize,
+                                        std::move(send_to_client))) {}
 
 BluetoothHandler::~BluetoothHandler() {
-  // Send a message to the looper to shut down.
-  uint64_t v = 1;
-  shutdown_->Write(&v, sizeof(v));
+  forwarder_->Stop();
   // Shut down the socket as well.  Not strictly necessary.
   rootcanal_socket_->Shutdown(SHUT_RDWR);
-  read_thread_.join();
 }
 
-void BluetoothHandler::ReadLoop() {
-  while (1) {
-    uint8_t buffer[4096];
-
-    read_set_.Set(shutdown_);
-    read_set_.Set(rootcanal_socket_);
-    Select(&read_set_, nullptr, nullptr, nullptr);
-
-    if (read_set_.IsSet(rootcanal_socket_)) {
-      auto read = rootcanal_socket_->Read(buffer, sizeof(buffer));
-      if (read < 0) {
-        PLOG(ERROR) << "Error on reading from RootCanal socket.";
-        break;
-      }
-      if (read) {
-        send_to_client_(buffer, read);
-      }
-    }
-
-    if (read_set_.IsSet(shutdown_)) {
-      LOG(INFO) << "BluetoothHandler is shutting down.";
-      break;
-    }
-  }
-}
+void BluetoothHandler::ResumeSending() { forwarder_->Resume(); }
 
 void BluetoothHandler::handleMessage(const uint8_t *msg, size_t len) {
   size_t sent = 0;
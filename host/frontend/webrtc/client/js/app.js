@@ -98,6 +98,8 @@ class DeviceControlApp {
   #deviceConnection = {};
   #currentRotation = 0;
   #displayDescriptions = [];
+  // Whether the first frame of any display arrived
+  #displaysLoaded = false;
   #buttons = {};
   #recording = {};
   #phys = {};
@@ -260,6 +262,14 @@ class DeviceControlApp {
     // Set up touch input
     this.#startMouseTracking();
 
+    // Displays may be added or removed while connected
+    this.#deviceConnection.onDeviceInfo(() => {
+      document.getElementById('device-displays').replaceChildren();
+      this.#createDeviceDisplays();
+      this.#startMouseTracking();
+      this.#resizeDeviceDisplays();
+    });
+
     this.#updateDeviceHardwareDetails(
         this.#deviceConnection.description.hardware);
 
@@ -576,6 +586,9 @@ class DeviceControlApp {
       deviceDisplay.classList.add('device-display');
       // Start the screen as hidden. Only show when data is ready.
       deviceDisplay.style.visibility = 'hidden';
+      // Displays created after the first one loaded only wait for their own
+      // data.
+      let showOnLoad = this.#displaysLoaded;
 
       let deviceDisplayInfo = document.createElement("div");
       deviceDisplayInfo.classList.add("device-display-info");
@@ -588,7 +601,10 @@ class DeviceControlApp {
       deviceDisplayVideo.id = deviceDisplayDescription.stream_id;
       deviceDisplayVideo.classList.add('device-display-video');
       deviceDisplayVideo.addEventListener('loadeddata', (evt) => {
-        if (!anyDisplayLoaded) {
+        if (showOnLoad) {
+          deviceDisplay.style.visibility = 'visible';
+          this.#resizeDeviceDisplays();
+        } else if (!anyDisplayLoaded) {
           anyDisplayLoaded = true;
           this.#onDeviceDisplayLoaded();
         }
@@ -642,6 +658,7 @@ class DeviceControlApp {
   }
 
   #onDeviceDisplayLoaded() {
+    this.#displaysLoaded = true;
     document.getElementById('status-message').textContent =
         'Awaiting bootup and adb connection. Please wait...';
     this.#resizeDeviceDisplays();
@@ -905,8 +922,15 @@ class DeviceControlApp {
 
     const display_label = deviceDisplay.id;
 
-    this.#deviceConnection.sendMultiTouch(
-        {idArr, xArr, yArr, down: ctx.down, slotArr, display_label});
+    this.#deviceConnection.sendMultiTouch({
+      idArr,
+      xArr,
+      yArr,
+      down: ctx.down,
+      slotArr,
+      display_label,
+      timestamp: e.timeStamp,
+    });
   }
 
   #updateDisplayVisibility(displayId, powerMode) {
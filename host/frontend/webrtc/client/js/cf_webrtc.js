@@ -14,9 +14,9 @@
  * limitations under the License.
  */
 
-function createDataChannel(pc, label, onMessage) {
+function createDataChannel(pc, label, onMessage, options) {
   console.debug('creating data channel: ' + label);
-  let dataChannel = pc.createDataChannel(label);
+  let dataChannel = pc.createDataChannel(label, options);
   // Return an object with a send function like that of the dataChannel, but
   // that only actually sends over the data channel once it has connected.
   return {
@@ -81,6 +81,12 @@ function awaitDataChannel(pc, label, onMessage) {
   };
 }
 
+// Browsers split larger messages less efficiently, or refuse them.
+const FILE_TRANSFER_CHUNK_SIZE = 64 * 1024;
+// How far ahead of the device's last acknowledgement the file may be sent,
+// must match FileTransferHandler::kWindow.
+const FILE_TRANSFER_WINDOW = 16 * 1024 * 1024;
+
 class DeviceConnection {
   #pc;
   #control;
@@ -92,6 +98,8 @@ class DeviceConnection {
   #inputChannel;
   #adbChannel;
   #bluetoothChannel;
+  #fileTransferChannel;
+  #onFileTransferMessage;
 
   #streams;
   #streamPromiseResolvers;
@@ -103,10 +111,17 @@ class DeviceConnection {
   #onAdbMessage;
   #onControlMessage;
   #onBluetoothMessage;
+  #onDeviceInfo;
 
   constructor(pc, control) {
     this.#pc = pc;
     this.#control = control;
+    control.onDeviceInfo(info => {
+      this.#description = info;
+      if (this.#onDeviceInfo) {
+        this.#onDeviceInfo(info);
+      }
+    });
     this.#cameraDataChannel = pc.createDataChannel('camera-data-channel');
     this.#cameraDataChannel.binaryType = 'arraybuffer';
     this.#cameraInputQueue = new Array();
@@ -116,7 +131,10 @@ class DeviceConnection {
         self.sendCameraData(self.#cameraInputQueue.shift());
       }
     };
-    this.#inputChannel = createDataChannel(pc, 'input-channel');
+    // Input must not wait behind bulk transfers like adb push on the same
+    // connection. Browsers that don't support priorities ignore it.
+    this.#inputChannel = createDataChannel(
+        pc, 'input-channel', undefined, {ordered: true, priority: 'high'});
     this.#adbChannel = createDataChannel(pc, 'adb-channel', (msg) => {
       if (this.#onAdbMessage) {
         this.#onAdbMessage(msg.data);
@@ -145,10 +163,19 @@ class DeviceConnection {
     pc.addEventListener('track', e => {
       console.debug('Got remote stream: ', e);
       for (const stream of e.streams) {
+        if (this.#streams[stream.id] !== stream) {
+          // Displays removed while connected take their streams with them
+          stream.addEventListener('removetrack', () => {
+            if (stream.getTracks().length == 0 &&
+                this.#streams[stream.id] === stream) {
+              delete this.#streams[stream.id];
+            }
+          });
+        }
         this.#streams[stream.id] = stream;
         if (this.#streamPromiseResolvers[stream.id]) {
           for (let resolver of this.#streamPromiseResolvers[stream.id]) {
-            resolver();
+            resolver(stream);
           }
           delete this.#streamPromiseResolvers[stream.id];
         }
@@ -201,19 +228,22 @@ class DeviceConnection {
     this.#inputChannel.send(JSON.stringify(evt));
   }
 
-  sendMousePosition({x, y, down, display_label}) {
+  // The timestamp is the time the event happened in milliseconds, as found in
+  // Event.timeStamp.
+  sendMousePosition({x, y, down, display_label, timestamp}) {
     this.#sendJsonInput({
       type: 'mouse',
       down: down ? 1 : 0,
       x,
       y,
       display_label,
+      timestamp: timestamp ?? performance.now(),
     });
   }
 
   // TODO (b/124121375): This should probably be an array of pointer events and
   // have different properties.
-  sendMultiTouch({idArr, xArr, yArr, down, slotArr, display_label}) {
+  sendMultiTouch({idArr, xArr, yArr, down, slotArr, display_label, timestamp}) {
     this.#sendJsonInput({
       type: 'multi-touch',
       id: idArr,
@@ -222,6 +252,7 @@ class DeviceConnection {
       down: down ? 1 : 0,
       slot: slotArr,
       display_label: display_label,
+      timestamp: timestamp ?? performance.now(),
     });
   }
 
@@ -292,10 +323,36 @@ class DeviceConnection {
   }
 
   async useCamera(in_use) {
-    return this.#useDevice(in_use, this.#micSenders, {audio: false, video: true});
+    return this.#useDevice(
+        in_use, this.#cameraSenders, {audio: false, video: true});
+  }
+
+  // Feeds the camera in use from another of the client's cameras, e.g.
+  // facingMode 'user' or 'environment'. The track is replaced in place so
+  // the connection isn't renegotiated and the device keeps its camera open.
+  async switchCamera(facingMode) {
+    if (this.#cameraSenders.length == 0) {
+      console.warn('No camera in use to switch');
+      return false;
+    }
+    const sender = this.#cameraSenders[0];
+    try {
+      const stream = await navigator.mediaDevices.getUserMedia(
+          {audio: false, video: {facingMode}});
+      const oldTrack = sender.track;
+      await sender.replaceTrack(stream.getVideoTracks()[0]);
+      oldTrack.stop();
+      this.sendCameraResolution(stream);
+      return true;
+    } catch (e) {
+      console.error('Failed to switch camera: ', e);
+      return false;
+    }
   }
 
-  sendCameraResolution(stream) {
+  // The device may have several cameras, fed by the client's video tracks in
+  // the order they were added.
+  sendCameraResolution(stream, cameraId = 0) {
     const cameraTracks = stream.getVideoTracks();
     if (cameraTracks.length > 0) {
       const settings = cameraTracks[0].getSettings();
@@ -303,6 +360,7 @@ class DeviceConnection {
       this.#camera_res_y = settings.height;
       this.sendControlMessage(JSON.stringify({
         command: 'camera_settings',
+        camera_id: cameraId,
         width: settings.width,
         height: settings.height,
         frame_rate: settings.frameRate,
@@ -343,6 +401,102 @@ class DeviceConnection {
     this.#onBluetoothMessage = cb;
   }
 
+  // Created on the first push, the data channels of the connection are already
+  // negotiated so no renegotiation is needed.
+  #getFileTransferChannel() {
+    if (!this.#fileTransferChannel) {
+      let channel = this.#pc.createDataChannel('file-transfer-channel');
+      channel.binaryType = 'arraybuffer';
+      channel.bufferedAmountLowThreshold = 16 * FILE_TRANSFER_CHUNK_SIZE;
+      channel.onmessage = (msg) => {
+        if (this.#onFileTransferMessage) {
+          this.#onFileTransferMessage(JSON.parse(msg.data));
+        } else {
+          console.error('Received unexpected file transfer message');
+        }
+      };
+      this.#fileTransferChannel = new Promise((resolve, reject) => {
+        channel.onopen = () => resolve(channel);
+        channel.onerror = err => reject(err);
+      });
+    }
+    return this.#fileTransferChannel;
+  }
+
+  // Pushes a File or Blob into the directory the host shares with the device,
+  // continuing where a previous push of the same name stopped. Only one push
+  // may be in progress at a time. onProgress, if given, is called with the
+  // bytes the device wrote so far and the total.
+  async pushFile(file, name, onProgress) {
+    const channel = await this.#getFileTransferChannel();
+    return new Promise((resolve, reject) => {
+      let sent = 0;
+      let acked = 0;
+      let sending = false;
+      const sendMore = async () => {
+        if (sending) {
+          return;
+        }
+        sending = true;
+        try {
+          while (sent < file.size && sent - acked < FILE_TRANSFER_WINDOW) {
+            if (channel.bufferedAmount > channel.bufferedAmountLowThreshold) {
+              await new Promise(
+                  r => channel.addEventListener(
+                      'bufferedamountlow', r, {once: true}));
+              continue;
+            }
+            const end = Math.min(
+                sent + FILE_TRANSFER_CHUNK_SIZE, file.size,
+                acked + FILE_TRANSFER_WINDOW);
+            channel.send(await file.slice(sent, end).arrayBuffer());
+            sent = end;
+          }
+        } catch (e) {
+          this.#onFileTransferMessage = undefined;
+          channel.send(JSON.stringify({type: 'cancel'}));
+          reject(e);
+        }
+        sending = false;
+      };
+      this.#onFileTransferMessage = (msg) => {
+        switch (msg.type) {
+          case 'ready':
+            sent = acked = msg.offset;
+            sendMore();
+            break;
+          case 'ack':
+            acked = msg.offset;
+            if (onProgress) {
+              onProgress(acked, file.size);
+            }
+            sendMore();
+            break;
+          case 'done':
+            this.#onFileTransferMessage = undefined;
+            if (onProgress) {
+              onProgress(file.size, file.size);
+            }
+            resolve();
+            break;
+          case 'error':
+            this.#onFileTransferMessage = undefined;
+            reject(new Error(msg.error));
+            break;
+          default:
+            console.error('Unrecognized file transfer message: ', msg.type);
+        }
+      };
+      channel.send(JSON.stringify({type: 'start', name, size: file.size}));
+    });
+  }
+
+  // Provide a callback to learn about changes in the device description, like
+  // displays added or removed, after the description was updated.
+  onDeviceInfo(cb) {
+    this.#onDeviceInfo = cb;
+  }
+
   // Provide a callback to receive connectionstatechange states.
   onConnectionStateChange(cb) {
     this.#pc.addEventListener(
@@ -353,6 +507,7 @@ class DeviceConnection {
 class Controller {
   #pc;
   #serverConnector;
+  #onDeviceInfo;
 
   constructor(serverConnector) {
     this.#serverConnector = serverConnector;
@@ -375,6 +530,11 @@ class Controller {
             candidate: message.candidate
           }));
         break;
+      case 'device-info':
+        if (this.#onDeviceInfo) {
+          this.#onDeviceInfo(message.device_info);
+        }
+        break;
       case 'error':
         console.error('Device responded with error message: ', message.error);
         break;
@@ -383,6 +543,10 @@ class Controller {
     }
   }
 
+  onDeviceInfo(cb) {
+    this.#onDeviceInfo = cb;
+  }
+
   async #sendClientDescription(desc) {
     console.debug('sendClientDescription');
     return this.#serverConnector.sendToDevice({type: 'answer', sdp: desc.sdp});
@@ -445,7 +609,8 @@ class Controller {
 }
 
 function createPeerConnection(infra_config) {
-  let pc_config = {iceServers: []};
+  // Start gathering candidates while the device prepares its offer
+  let pc_config = {iceServers: [], iceCandidatePoolSize: 1};
   for (const stun of infra_config.ice_servers) {
     pc_config.iceServers.push({urls: stun.urls});
   }
@@ -35,6 +35,8 @@
 #include "common/libs/fs/shared_buf.h"
 #include "host/frontend/webrtc/adb_handler.h"
 #include "host/frontend/webrtc/bluetooth_handler.h"
+#include "host/frontend/webrtc/file_transfer_handler.h"
+#include "host/frontend/webrtc/lib/batched_udp_socket.h"
 #include "host/frontend/webrtc/lib/camera_controller.h"
 #include "host/frontend/webrtc/lib/utils.h"
 #include "host/libs/config/cuttlefish_config.h"
@@ -91,6 +93,14 @@ std::unique_ptr<InputEventBuffer> GetEventBuffer() {
   }
 }
 
+// Lets the guest compute velocities from when the events happened on the
+// client instead of when they were delivered. MSC_TIMESTAMP is in microseconds
+// and wraps around at 32 bits, devices that don't support it drop the event.
+void AddTimestampEvent(InputEventBuffer &buffer, int64_t timestamp_us) {
+  buffer.AddEvent(EV_MSC, MSC_TIMESTAMP,
+                  static_cast<int32_t>(static_cast<uint32_t>(timestamp_us)));
+}
+
 /**
  * connection observer implementation for regular android mode.
  * i.e. when it is not in the confirmation UI mode (or TEE),
@@ -100,28 +110,48 @@ class ConnectionObserverImpl
     : public cuttlefish::webrtc_streaming::ConnectionObserver {
  public:
   ConnectionObserverImpl(
+      cuttlefish::webrtc_streaming::HandlerLoop &handler_loop,
       cuttlefish::InputSockets &input_sockets,
       cuttlefish::KernelLogEventsHandler *kernel_log_events_handler,
       std::map<std::string, cuttlefish::SharedFD>
           commands_to_custom_action_servers,
       std::weak_ptr<DisplayHandler> display_handler,
+      std::weak_ptr<AudioHandler> audio_handler,
       CameraController *camera_controller,
+      cuttlefish::InputRecorder *input_recorder,
+      std::shared_ptr<ViewerTracker> viewer_tracker,
       cuttlefish::confui::HostVirtualInput &confui_input)
-      : input_sockets_(input_sockets),
+      : handler_loop_(handler_loop),
+        input_sockets_(input_sockets),
         kernel_log_events_handler_(kernel_log_events_handler),
         commands_to_custom_action_servers_(commands_to_custom_action_servers),
         weak_display_handler_(display_handler),
+        weak_audio_handler_(audio_handler),
         camera_controller_(camera_controller),
+        input_recorder_(input_recorder),
+        viewer_tracker_(std::move(viewer_tracker)),
         confui_input_(confui_input) {}
   virtual ~ConnectionObserverImpl() {
     auto display_handler = weak_display_handler_.lock();
     if (kernel_log_subscription_id_ != -1) {
       kernel_log_events_handler_->Unsubscribe(kernel_log_subscription_id_);
     }
+    if (connected_ && viewer_tracker_) {
+      viewer_tracker_->Disconnected();
+    }
+    if (file_transfer_handler_) {
+      file_transfer_handler_->Stop();
+    }
   }
 
   void OnConnected(std::function<void(const uint8_t *, size_t, bool)>
                    /*ctrl_msg_sender*/) override {
+    if (!connected_ && viewer_tracker_) {
+      // Before sending the last frame, which is converted when this activates
+      // the display handler
+      viewer_tracker_->Connected();
+    }
+    connected_ = true;
     auto display_handler = weak_display_handler_.lock();
     if (display_handler) {
       std::thread th([this]() {
@@ -143,7 +173,7 @@ class ConnectionObserverImpl
   }
 
   void OnTouchEvent(const std::string &display_label, int x, int y,
-                    bool down) override {
+                    bool down, int64_t timestamp_us) override {
     if (confui_input_.IsConfUiActive()) {
       ConfUiLog(DEBUG) << "delivering a touch event in confirmation UI mode";
       confui_input_.TouchEvent(x, y, down);
@@ -157,15 +187,15 @@ class ConnectionObserverImpl
     buffer->AddEvent(EV_ABS, ABS_X, x);
     buffer->AddEvent(EV_ABS, ABS_Y, y);
     buffer->AddEvent(EV_KEY, BTN_TOUCH, down);
+    AddTimestampEvent(*buffer, timestamp_us);
     buffer->AddEvent(EV_SYN, SYN_REPORT, 0);
-    cuttlefish::WriteAll(input_sockets_.GetTouchClientByLabel(display_label),
-                         reinterpret_cast<const char *>(buffer->data()),
-                         buffer->size());
+    WriteInput(display_label,
+               input_sockets_.GetTouchClientByLabel(display_label), *buffer);
   }
 
   void OnMultiTouchEvent(const std::string &display_label, Json::Value id,
                          Json::Value slot, Json::Value x, Json::Value y,
-                         bool down, int size) {
+                         bool down, int size, int64_t timestamp_us) override {
     auto buffer = GetEventBuffer();
     if (!buffer) {
       LOG(ERROR) << "Failed to allocate event buffer";
@@ -211,10 +241,10 @@ class ConnectionObserverImpl
       }
     }
 
+    AddTimestampEvent(*buffer, timestamp_us);
     buffer->AddEvent(EV_SYN, SYN_REPORT, 0);
-    cuttlefish::WriteAll(input_sockets_.GetTouchClientByLabel(display_label),
-                         reinterpret_cast<const char *>(buffer->data()),
-                         buffer->size());
+    WriteInput(display_label,
+               input_sockets_.GetTouchClientByLabel(display_label), *buffer);
   }
 
   void OnKeyboardEvent(uint16_t code, bool down) override {
@@ -230,9 +260,8 @@ class ConnectionObserverImpl
     }
     buffer->AddEvent(EV_KEY, code, down);
     buffer->AddEvent(EV_SYN, SYN_REPORT, 0);
-    cuttlefish::WriteAll(input_sockets_.keyboard_client,
-                         reinterpret_cast<const char *>(buffer->data()),
-                         buffer->size());
+    WriteInput(cuttlefish::kKeyboardInputLabel, input_sockets_.keyboard_client,
+               *buffer);
   }
 
   void OnSwitchEvent(uint16_t code, bool state) override {
@@ -243,15 +272,15 @@ class ConnectionObserverImpl
     }
     buffer->AddEvent(EV_SW, code, state);
     buffer->AddEvent(EV_SYN, SYN_REPORT, 0);
-    cuttlefish::WriteAll(input_sockets_.switches_client,
-                         reinterpret_cast<const char *>(buffer->data()),
-                         buffer->size());
+    WriteInput(cuttlefish::kSwitchesInputLabel, input_sockets_.switches_client,
+               *buffer);
   }
 
   void OnAdbChannelOpen(std::function<bool(const uint8_t *, size_t)>
                             adb_message_sender) override {
     LOG(VERBOSE) << "Adb Channel open";
     adb_handler_.reset(new cuttlefish::webrtc_streaming::AdbHandler(
+        handler_loop_,
         cuttlefish::CuttlefishConfig::Get()
             ->ForDefaultInstance()
             .adb_ip_and_port(),
@@ -260,14 +289,24 @@ class ConnectionObserverImpl
   void OnAdbMessage(const uint8_t *msg, size_t size) override {
     adb_handler_->handleMessage(msg, size);
   }
-  void OnControlChannelOpen(std::function<bool(const Json::Value)>
-                            control_message_sender) override {
+  void OnAdbChannelWritable() override {
+    if (adb_handler_) {
+      adb_handler_->ResumeSending();
+    }
+  }
+  void OnControlChannelOpen(
+      std::function<bool(const Json::Value)> control_message_sender,
+      std::function<bool(const std::string &)> serialized_message_sender)
+      override {
     LOG(VERBOSE) << "Control Channel open";
+    control_message_sender_ = control_message_sender;
     if (camera_controller_) {
       camera_controller_->SetMessageSender(control_message_sender);
     }
-    kernel_log_subscription_id_ =
-        kernel_log_events_handler_->AddSubscriber(control_message_sender);
+    kernel_log_subscription_id_ = kernel_log_events_handler_->AddSubscriber(
+        [serialized_message_sender](const std::string &event) {
+          serialized_message_sender(event);
+        });
   }
   void OnControlMessage(const uint8_t* msg, size_t size) override {
     Json::Value evt;
@@ -310,6 +349,34 @@ class ConnectionObserverImpl
       // Handle commands starting with "camera_" by camera controller
       camera_controller_->HandleMessage(evt);
       return;
+    } else if (command == "get_display_stats") {
+      auto display_handler = weak_display_handler_.lock();
+      if (display_handler && control_message_sender_) {
+        Json::Value message;
+        message["event"] = "display_stats";
+        message["stats"] = display_handler->GetFrameStats();
+        // How well the RTP packets carrying the frames are batched
+        auto udp_stats = webrtc_streaming::GetUdpBatchingStats();
+        Json::Value udp(Json::objectValue);
+        udp["packets_sent"] = Json::UInt64(udp_stats.packets_sent);
+        udp["send_calls"] = Json::UInt64(udp_stats.send_calls);
+        udp["segmented_packets"] = Json::UInt64(udp_stats.segmented_packets);
+        udp["packets_dropped"] = Json::UInt64(udp_stats.packets_dropped);
+        udp["packets_received"] = Json::UInt64(udp_stats.packets_received);
+        udp["receive_calls"] = Json::UInt64(udp_stats.receive_calls);
+        message["stats"]["udp"] = udp;
+        control_message_sender_(message);
+      }
+      return;
+    } else if (command == "get_audio_stats") {
+      auto audio_handler = weak_audio_handler_.lock();
+      if (audio_handler && control_message_sender_) {
+        Json::Value message;
+        message["event"] = "audio_stats";
+        message["stats"] = audio_handler->GetStats();
+        control_message_sender_(message);
+      }
+      return;
     }
 
     auto button_state = evt["button_state"].asString();
@@ -346,48 +413,128 @@ class ConnectionObserverImpl
     auto config = cuttlefish::CuttlefishConfig::Get();
     CHECK(config) << "Failed to get config";
     bluetooth_handler_.reset(new cuttlefish::webrtc_streaming::BluetoothHandler(
-        config->rootcanal_test_port(), bluetooth_message_sender));
+        handler_loop_, config->rootcanal_test_port(),
+        bluetooth_message_sender));
   }
 
   void OnBluetoothMessage(const uint8_t *msg, size_t size) override {
     bluetooth_handler_->handleMessage(msg, size);
   }
 
+  void OnBluetoothChannelWritable() override {
+    if (bluetooth_handler_) {
+      bluetooth_handler_->ResumeSending();
+    }
+  }
+
   void OnCameraData(const std::vector<char> &data) override {
     if (camera_controller_) {
       camera_controller_->HandleMessage(data);
     }
   }
 
+  void OnFileTransferChannelOpen(std::function<bool(const std::string &)>
+                                     file_transfer_message_sender) override {
+    LOG(VERBOSE) << "File transfer channel open";
+    auto config = cuttlefish::CuttlefishConfig::Get();
+    CHECK(config) << "Failed to get config";
+    if (file_transfer_handler_) {
+      file_transfer_handler_->Stop();
+    }
+    file_transfer_handler_ =
+        cuttlefish::webrtc_streaming::FileTransferHandler::Create(
+            config->ForDefaultInstance().PerInstancePath(
+                cuttlefish::kSharedDirName),
+            file_transfer_message_sender);
+  }
+
+  void OnFileTransferMessage(const uint8_t *msg, size_t size,
+                             bool binary) override {
+    file_transfer_handler_->HandleMessage(msg, size, binary);
+  }
+
  private:
+  void WriteInput(const std::string &label, cuttlefish::SharedFD device,
+                  const InputEventBuffer &buffer) {
+    auto data = reinterpret_cast<const char *>(buffer.data());
+    if (input_recorder_) {
+      input_recorder_->RecordInput(label, data, buffer.size());
+    }
+    cuttlefish::WriteAll(device, data, buffer.size());
+  }
+
+  cuttlefish::webrtc_streaming::HandlerLoop& handler_loop_;
   cuttlefish::InputSockets& input_sockets_;
   cuttlefish::KernelLogEventsHandler* kernel_log_events_handler_;
   int kernel_log_subscription_id_ = -1;
+  std::function<bool(const Json::Value)> control_message_sender_;
   std::shared_ptr<cuttlefish::webrtc_streaming::AdbHandler> adb_handler_;
   std::shared_ptr<cuttlefish::webrtc_streaming::BluetoothHandler>
       bluetooth_handler_;
+  std::shared_ptr<cuttlefish::webrtc_streaming::FileTransferHandler>
+      file_transfer_handler_;
   std::map<std::string, cuttlefish::SharedFD> commands_to_custom_action_servers_;
   std::weak_ptr<DisplayHandler> weak_display_handler_;
+  std::weak_ptr<AudioHandler> weak_audio_handler_;
   std::set<int32_t> active_touch_slots_;
   cuttlefish::CameraController *camera_controller_;
+  cuttlefish::InputRecorder *input_recorder_;
+  std::shared_ptr<ViewerTracker> viewer_tracker_;
+  bool connected_ = false;
   cuttlefish::confui::HostVirtualInput &confui_input_;
 };
 
+ViewerTracker::ViewerTracker(std::weak_ptr<DisplayHandler> display_handler,
+                             std::weak_ptr<AudioHandler> audio_handler)
+    : weak_display_handler_(display_handler),
+      weak_audio_handler_(audio_handler) {
+  SetActive(false);
+}
+
+void ViewerTracker::Connected() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (viewers_++ == 0) {
+    LOG(DEBUG) << "First client connected, activating the streamer";
+    SetActive(true);
+  }
+}
+
+void ViewerTracker::Disconnected() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (--viewers_ == 0) {
+    LOG(DEBUG) << "Last client disconnected, deactivating the streamer";
+    SetActive(false);
+  }
+}
+
+void ViewerTracker::SetActive(bool active) {
+  if (auto display_handler = weak_display_handler_.lock()) {
+    display_handler->SetActive(active);
+  }
+  if (auto audio_handler = weak_audio_handler_.lock()) {
+    audio_handler->SetActive(active);
+  }
+}
+
 CfConnectionObserverFactory::CfConnectionObserverFactory(
+    webrtc_streaming::HandlerLoop &handler_loop,
     cuttlefish::InputSockets &input_sockets,
     cuttlefish::KernelLogEventsHandler* kernel_log_events_handler,
     cuttlefish::confui::HostVirtualInput &confui_input)
-    : input_sockets_(input_sockets),
+    : handler_loop_(handler_loop),
+      input_sockets_(input_sockets),
       kernel_log_events_handler_(kernel_log_events_handler),
       confui_input_{confui_input} {}
 
 std::shared_ptr<cuttlefish::webrtc_streaming::ConnectionObserver>
 CfConnectionObserverFactory::CreateObserver() {
   return std::shared_ptr<cuttlefish::webrtc_streaming::ConnectionObserver>(
-      new ConnectionObserverImpl(input_sockets_, kernel_log_events_handler_,
+      new ConnectionObserverImpl(handler_loop_, input_sockets_,
+                                 kernel_log_events_handler_,
                                  commands_to_custom_action_servers_,
-                                 weak_display_handler_, camera_controller_,
-                                 confui_input_));
+                                 weak_display_handler_, weak_audio_handler_,
+                                 camera_controller_, input_recorder_,
+                                 viewer_tracker_, confui_input_));
 }
 
 void CfConnectionObserverFactory::AddCustomActionServer(
@@ -404,8 +551,25 @@ void CfConnectionObserverFactory::SetDisplayHandler(
   weak_display_handler_ = display_handler;
 }
 
+void CfConnectionObserverFactory::SetAudioHandler(
+    std::weak_ptr<AudioHandler> audio_handler) {
+  weak_audio_handler_ = audio_handler;
+}
+
 void CfConnectionObserverFactory::SetCameraHandler(
     CameraController *controller) {
   camera_controller_ = controller;
 }
+
+void CfConnectionObserverFactory::SetInputRecorder(
+    InputRecorder *input_recorder) {
+  input_recorder_ = input_recorder;
+}
+
+void CfConnectionObserverFactory::SetLazyHandlers(
+    std::weak_ptr<DisplayHandler> display_handler,
+    std::weak_ptr<AudioHandler> audio_handler) {
+  viewer_tracker_ =
+      std::make_shared<ViewerTracker>(display_handler, audio_handler);
+}
 }  // namespace cuttlefish
@@ -18,13 +18,17 @@
 
 #include <map>
 #include <memory>
+#include <mutex>
 
 #include "common/libs/fs/shared_fd.h"
+#include "host/frontend/webrtc/audio_handler.h"
 #include "host/frontend/webrtc/display_handler.h"
+#include "host/frontend/webrtc/handler_loop.h"
 #include "host/frontend/webrtc/kernel_log_events_handler.h"
 #include "host/frontend/webrtc/lib/camera_controller.h"
 #include "host/frontend/webrtc/lib/connection_observer.h"
 #include "host/libs/confui/host_virtual_input.h"
+#include "host/libs/input_recording/input_recording.h"
 
 namespace cuttlefish {
 
@@ -43,10 +47,29 @@ struct InputSockets {
   SharedFD switches_client;
 };
 
+// Keeps handlers active only while at least one client is connected.
+class ViewerTracker {
+ public:
+  ViewerTracker(std::weak_ptr<DisplayHandler> display_handler,
+                std::weak_ptr<AudioHandler> audio_handler);
+
+  void Connected();
+  void Disconnected();
+
+ private:
+  void SetActive(bool active);
+
+  std::weak_ptr<DisplayHandler> weak_display_handler_;
+  std::weak_ptr<AudioHandler> weak_audio_handler_;
+  std::mutex mutex_;
+  int viewers_ = 0;
+};
+
 class CfConnectionObserverFactory
     : public webrtc_streaming::ConnectionObserverFactory {
  public:
   CfConnectionObserverFactory(
+      webrtc_streaming::HandlerLoop& handler_loop,
       cuttlefish::InputSockets& input_sockets,
       KernelLogEventsHandler* kernel_log_events_handler,
       cuttlefish::confui::HostVirtualInput& confui_input);
@@ -60,16 +83,30 @@ class CfConnectionObserverFactory
 
   void SetDisplayHandler(std::weak_ptr<DisplayHandler> display_handler);
 
+  void SetAudioHandler(std::weak_ptr<AudioHandler> audio_handler);
+
   void SetCameraHandler(CameraController* controller);
 
+  // Input sent from clients is recorded there as well
+  void SetInputRecorder(InputRecorder* input_recorder);
+
+  // The given handlers are left inactive until a client connects and after
+  // the last one disconnects. Either can be null.
+  void SetLazyHandlers(std::weak_ptr<DisplayHandler> display_handler,
+                       std::weak_ptr<AudioHandler> audio_handler);
+
  private:
+  webrtc_streaming::HandlerLoop& handler_loop_;
   InputSockets& input_sockets_;
   KernelLogEventsHandler* kernel_log_events_handler_;
   std::map<std::string, SharedFD>
       commands_to_custom_action_servers_;
   std::weak_ptr<DisplayHandler> weak_display_handler_;
+  std::weak_ptr<AudioHandler> weak_audio_handler_;
   cuttlefish::confui::HostVirtualInput& confui_input_;
   cuttlefish::CameraController* camera_controller_ = nullptr;
+  cuttlefish::InputRecorder* input_recorder_ = nullptr;
+  std::shared_ptr<ViewerTracker> viewer_tracker_;
 };
 
 }  // namespace cuttlefish
@@ -16,9 +16,10 @@
 
 #include "host/frontend/webrtc/cvd_video_frame_buffer.h"
 
-#include <map>
-#include <mutex>
-#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
 #include "common/libs/utils/size_utils.h"
 
 namespace cuttlefish {
@@ -31,24 +32,18 @@ inline int AlignStride(int width) {
   return AlignToPowerOf2(width, kLogAlignment);
 }
 
-std::multimap<int, std::vector<uint8_t>> pool;
-std::mutex pool_mutex;
-std::vector<uint8_t> FromPool(int size) {
-  {
-    std::lock_guard<std::mutex> lock(pool_mutex);
-    auto it = pool.find(size);
-    if (it != pool.end()) {
-      auto ret = std::move(it->second);
-      pool.erase(it);
-      return ret;
-    }
-  }
-  return std::vector<uint8_t>(size);
+inline std::size_t SizeY(int width, int height) {
+  return AlignStride(width) * height + kPlanePadding;
+}
+
+inline std::size_t SizeUV(int width, int height) {
+  return AlignStride((width + 1) / 2) * ((height + 1) / 2) + kPlanePadding;
 }
 
-void BackToPool(std::vector<uint8_t> item) {
-  std::lock_guard<std::mutex> lock(pool_mutex);
-  pool.insert({item.size(), std::move(item)});
+std::unique_ptr<std::uint8_t[]> AllocateSlab(std::size_t size) {
+  // Every byte of the planes is overwritten by the color conversion, so there
+  // is no need to pay for zero-initializing a fresh slab.
+  return std::unique_ptr<std::uint8_t[]>(new std::uint8_t[size]);
 }
 
 }  // namespace
@@ -56,18 +51,23 @@ void BackToPool(std::vector<uint8_t> item) {
 CvdVideoFrameBuffer::CvdVideoFrameBuffer(int width, int height)
     : width_(width),
       height_(height),
-      y_(FromPool(AlignStride(width) * height + kPlanePadding)),
-      u_(FromPool(AlignStride((width + 1) / 2) * ((height + 1) / 2) +
-                  kPlanePadding)),
-      v_(FromPool(AlignStride((width + 1) / 2) * ((height + 1) / 2) +
-                  kPlanePadding)) {}
-
-CvdVideoFrameBuffer::~CvdVideoFrameBuffer() {
-  BackToPool(std::move(y_));
-  BackToPool(std::move(u_));
-  BackToPool(std::move(v_));
+      u_offset_(SizeY(width, height)),
+      v_offset_(u_offset_ + SizeUV(width, height)),
+      slab_size_(v_offset_ + SizeUV(width, height)),
+      slab_(AllocateSlab(slab_size_)) {}
+
+CvdVideoFrameBuffer::CvdVideoFrameBuffer(const CvdVideoFrameBuffer& other)
+    : width_(other.width_),
+      height_(other.height_),
+      u_offset_(other.u_offset_),
+      v_offset_(other.v_offset_),
+      slab_size_(other.slab_size_),
+      slab_(AllocateSlab(slab_size_)) {
+  std::memcpy(slab_.get(), other.slab_.get(), slab_size_);
 }
 
+CvdVideoFrameBuffer::~CvdVideoFrameBuffer() = default;
+
 int CvdVideoFrameBuffer::width() const { return width_; }
 int CvdVideoFrameBuffer::height() const { return height_; }
 
@@ -79,8 +79,51 @@ int CvdVideoFrameBuffer::StrideV() const {
   return AlignStride((width_ + 1) / 2);
 }
 
-const uint8_t *CvdVideoFrameBuffer::DataY() const { return y_.data(); }
-const uint8_t *CvdVideoFrameBuffer::DataU() const { return u_.data(); }
-const uint8_t *CvdVideoFrameBuffer::DataV() const { return v_.data(); }
+const uint8_t *CvdVideoFrameBuffer::DataY() const { return slab_.get(); }
+const uint8_t *CvdVideoFrameBuffer::DataU() const {
+  return slab_.get() + u_offset_;
+}
+const uint8_t *CvdVideoFrameBuffer::DataV() const {
+  return slab_.get() + v_offset_;
+}
+
+CvdVideoFrameBufferPool::CvdVideoFrameBufferPool(std::size_t max_buffers)
+    : max_buffers_(max_buffers) {}
+
+std::shared_ptr<CvdVideoFrameBuffer> CvdVideoFrameBufferPool::Get(int width,
+                                                                  int height) {
+  std::lock_guard<std::mutex> lock(buffers_mutex_);
+  // Drop free buffers of a different resolution, those in use are released
+  // when their last user is done with them.
+  buffers_.erase(
+      std::remove_if(buffers_.begin(), buffers_.end(),
+                     [width, height](const auto& buffer) {
+                       return buffer.use_count() == 1 &&
+                              (buffer->width() != width ||
+                               buffer->height() != height);
+                     }),
+      buffers_.end());
+  for (const auto& buffer : buffers_) {
+    // Only the pool holds a reference to this buffer and no one else can get
+    // one without going through this locked section, so it can be reused.
+    if (buffer.use_count() == 1 && buffer->width() == width &&
+        buffer->height() == height) {
+      // Pairs with the release done by the last user when it dropped its
+      // reference, making its accesses to the planes visible before reuse.
+      std::atomic_thread_fence(std::memory_order_acquire);
+      return buffer;
+    }
+  }
+  auto buffer = std::make_shared<CvdVideoFrameBuffer>(width, height);
+  if (buffers_.size() < max_buffers_) {
+    buffers_.push_back(buffer);
+  }
+  return buffer;
+}
+
+std::size_t CvdVideoFrameBufferPool::Size() const {
+  std::lock_guard<std::mutex> lock(buffers_mutex_);
+  return buffers_.size();
+}
 
 }  // namespace cuttlefish
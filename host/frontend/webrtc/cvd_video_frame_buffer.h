@@ -16,19 +16,26 @@
 
 #pragma once
 
+#include <cstddef>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 #include "host/frontend/webrtc/lib/video_frame_buffer.h"
 
 namespace cuttlefish {
 
+// An I420 frame whose three planes live in a single slab of memory. Frames
+// should be obtained from a CvdVideoFrameBufferPool so that the color
+// conversion from the guest's SHM buffer writes straight into memory that was
+// already faulted in by a previous frame of the same size.
 class CvdVideoFrameBuffer : public webrtc_streaming::VideoFrameBuffer {
  public:
   CvdVideoFrameBuffer(int width, int height);
   CvdVideoFrameBuffer(CvdVideoFrameBuffer&& cvd_frame_buf) = default;
-  CvdVideoFrameBuffer(const CvdVideoFrameBuffer& cvd_frame_buf) = default;
-  CvdVideoFrameBuffer& operator=(CvdVideoFrameBuffer&& cvd_frame_buf) = default;
-  CvdVideoFrameBuffer& operator=(const CvdVideoFrameBuffer& cvd_frame_buf) = default;
+  CvdVideoFrameBuffer(const CvdVideoFrameBuffer& cvd_frame_buf);
+  CvdVideoFrameBuffer& operator=(CvdVideoFrameBuffer&& cvd_frame_buf) = delete;
+  CvdVideoFrameBuffer& operator=(const CvdVideoFrameBuffer& cvd_frame_buf) = delete;
   CvdVideoFrameBuffer() = delete;
 
   ~CvdVideoFrameBuffer() override;
@@ -44,16 +51,45 @@ class CvdVideoFrameBuffer : public webrtc_streaming::VideoFrameBuffer {
   const uint8_t *DataU() const override;
   const uint8_t *DataV() const override;
 
-  uint8_t *DataY() { return y_.data(); }
-  uint8_t *DataU() { return u_.data(); }
-  uint8_t *DataV() { return v_.data(); }
+  uint8_t *DataY() { return slab_.get(); }
+  uint8_t *DataU() { return slab_.get() + u_offset_; }
+  uint8_t *DataV() { return slab_.get() + v_offset_; }
+
+  // Identifies the display frame whose contents were last written into this
+  // buffer, 0 if none was. Lets producers that recycle buffers only convert
+  // the regions that changed since then.
+  std::uint64_t frame_sequence() const { return frame_sequence_; }
+  void set_frame_sequence(std::uint64_t sequence) { frame_sequence_ = sequence; }
 
  private:
   const int width_;
   const int height_;
-  std::vector<std::uint8_t> y_;
-  std::vector<std::uint8_t> u_;
-  std::vector<std::uint8_t> v_;
+  const std::size_t u_offset_;
+  const std::size_t v_offset_;
+  const std::size_t slab_size_;
+  std::unique_ptr<std::uint8_t[]> slab_;
+  std::uint64_t frame_sequence_ = 0;
+};
+
+// Hands out frame buffers of a single resolution and takes them back once the
+// last reference held outside of the pool is dropped, e.g. when the encoders
+// of every WebRTC connection are done with a frame. One pool is meant to be
+// used per display. When the requested resolution changes the buffers of the
+// previous resolution are released as soon as they become free.
+class CvdVideoFrameBufferPool {
+ public:
+  // Buffers requested while max_buffers are in flight are still handed out,
+  // but are not retained by the pool.
+  CvdVideoFrameBufferPool(std::size_t max_buffers = 4);
+
+  std::shared_ptr<CvdVideoFrameBuffer> Get(int width, int height);
+
+  std::size_t Size() const;
+
+ private:
+  const std::size_t max_buffers_;
+  mutable std::mutex buffers_mutex_;
+  std::vector<std::shared_ptr<CvdVideoFrameBuffer>> buffers_;
 };
 
 }
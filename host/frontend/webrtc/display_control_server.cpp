@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/display_control_server.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "host/libs/screen_connector/screen_connector_common.h"
+
+namespace cuttlefish {
+namespace {
+
+std::string DisplayLabel(std::uint32_t display_number) {
+  // Same as the displays present at launch
+  return "display_" + std::to_string(display_number);
+}
+
+}  // namespace
+
+DisplayControlServer::DisplayControlServer(
+    SharedFD server, webrtc_streaming::Streamer& streamer,
+    std::shared_ptr<DisplayHandler> display_handler,
+    DisplayHandler::ScreenConnector& screen_connector)
+    : server_(server),
+      streamer_(streamer),
+      display_handler_(std::move(display_handler)),
+      screen_connector_(screen_connector) {}
+
+void DisplayControlServer::Loop() {
+  for (;;) {
+    auto client = SharedFD::Accept(*server_);
+    if (!client->IsOpen()) {
+      LOG(ERROR) << "Failed to accept display control client: "
+                 << server_->StrError();
+      continue;
+    }
+    std::string request;
+    char c;
+    while (client->Read(&c, 1) == 1 && c != '\n') {
+      request.push_back(c);
+    }
+    auto result = Handle(request);
+    std::string reply = "OK\n";
+    if (!result.ok()) {
+      LOG(ERROR) << "Display control request \"" << request
+                 << "\" failed: " << result.error();
+      auto reason = result.error().message();
+      // The reply is a single line
+      std::replace(reason.begin(), reason.end(), '\n', ' ');
+      reply = "ERROR " + reason + "\n";
+    }
+    if (WriteAll(client, reply) != (ssize_t)reply.size()) {
+      LOG(ERROR) << "Failed to reply to display control client: "
+                 << client->StrError();
+    }
+  }
+}
+
+Result<void> DisplayControlServer::Handle(const std::string& request) {
+  auto args = android::base::Split(request, " ");
+  CF_EXPECT(args.size() >= 2, "Malformed request");
+  std::uint32_t display_number;
+  CF_EXPECT(android::base::ParseUint(args[1], &display_number,
+                                     ScreenConnectorInfo::MaxScreenCount() - 1),
+            "Invalid display number: " << args[1]);
+  if (args[0] == "add") {
+    CF_EXPECT(args.size() == 6, "Malformed add request");
+    std::vector<int> values(4);
+    for (size_t i = 0; i < values.size(); i++) {
+      CF_EXPECT(android::base::ParseInt(args[i + 2], &values[i], 1),
+                "Invalid value: " << args[i + 2]);
+    }
+    CF_EXPECT(Add(display_number, values[0], values[1], values[2], values[3]));
+  } else if (args[0] == "remove") {
+    CF_EXPECT(args.size() == 2, "Malformed remove request");
+    Remove(display_number);
+  } else {
+    return CF_ERR("Unknown request: " << args[0]);
+  }
+  return {};
+}
+
+Result<void> DisplayControlServer::Add(std::uint32_t display_number, int width,
+                                       int height, int dpi,
+                                       int refresh_rate_hz) {
+  screen_connector_.SetDisplayRefreshRate(display_number, refresh_rate_hz);
+  auto label = DisplayLabel(display_number);
+  // Added displays have no touch device in the guest
+  auto sink = streamer_.AddDisplay(label, width, height, dpi, false);
+  if (!sink) {
+    // Streamed already, with the previous size
+    Remove(display_number);
+    sink = streamer_.AddDisplay(label, width, height, dpi, false);
+  }
+  CF_EXPECT(sink != nullptr, "Could not stream display " << display_number);
+  display_handler_->AddDisplay(display_number, std::move(sink));
+  LOG(INFO) << "Streaming display " << display_number << ": " << width << "x"
+            << height;
+  return {};
+}
+
+void DisplayControlServer::Remove(std::uint32_t display_number) {
+  // Stop the frames before the track goes away
+  display_handler_->RemoveDisplay(display_number);
+  streamer_.RemoveDisplay(DisplayLabel(display_number));
+  LOG(INFO) << "Stopped streaming display " << display_number;
+}
+
+}  // namespace cuttlefish
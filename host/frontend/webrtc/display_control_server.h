@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+#include "host/frontend/webrtc/display_handler.h"
+#include "host/frontend/webrtc/lib/streamer.h"
+
+namespace cuttlefish {
+
+// Takes the displays the launcher added to or removed from the VM and starts or
+// stops streaming them. Requests are lines of the form "add N W H DPI HZ" or
+// "remove N", answered with "OK" or "ERROR <reason>".
+class DisplayControlServer {
+ public:
+  DisplayControlServer(SharedFD server, webrtc_streaming::Streamer& streamer,
+                       std::shared_ptr<DisplayHandler> display_handler,
+                       DisplayHandler::ScreenConnector& screen_connector);
+
+  // Serves one client at a time
+  [[noreturn]] void Loop();
+
+ private:
+  Result<void> Handle(const std::string& request);
+  Result<void> Add(std::uint32_t display_number, int width, int height, int dpi,
+                   int refresh_rate_hz);
+  void Remove(std::uint32_t display_number);
+
+  SharedFD server_;
+  webrtc_streaming::Streamer& streamer_;
+  std::shared_ptr<DisplayHandler> display_handler_;
+  DisplayHandler::ScreenConnector& screen_connector_;
+};
+
+}  // namespace cuttlefish
@@ -16,64 +16,369 @@
 
 #include "host/frontend/webrtc/display_handler.h"
 
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <functional>
 #include <memory>
+#include <thread>
+#include <vector>
 
-#include <libyuv.h>
+#include <android-base/logging.h>
+
+#include "common/libs/utils/tracing.h"
 
 namespace cuttlefish {
+namespace {
+
+// Enough to cover every buffer a CvdVideoFrameBufferPool keeps around.
+constexpr std::size_t kMaxDamageHistory = 8;
+
+ScreenConnectorFrameDamage Union(const ScreenConnectorFrameDamage& a,
+                                 const ScreenConnectorFrameDamage& b) {
+  if (a.w == 0 || a.h == 0) {
+    return b;
+  }
+  if (b.w == 0 || b.h == 0) {
+    return a;
+  }
+  const std::uint32_t x0 = std::min(a.x, b.x);
+  const std::uint32_t y0 = std::min(a.y, b.y);
+  const std::uint32_t x1 = std::max(a.x + a.w, b.x + b.w);
+  const std::uint32_t y1 = std::max(a.y + a.h, b.y + b.h);
+  return {.x = x0, .y = y0, .w = x1 - x0, .h = y1 - y0};
+}
+
+// Chroma planes are subsampled 2x2, so the rectangle is grown to even
+// coordinates in order to convert whole chroma samples.
+ScreenConnectorFrameDamage AlignToChroma(const ScreenConnectorFrameDamage& d,
+                                         std::uint32_t frame_width,
+                                         std::uint32_t frame_height) {
+  const std::uint32_t x0 = d.x & ~1u;
+  const std::uint32_t y0 = d.y & ~1u;
+  const std::uint32_t x1 = std::min((d.x + d.w + 1) & ~1u, frame_width);
+  const std::uint32_t y1 = std::min((d.y + d.h + 1) & ~1u, frame_height);
+  return {.x = x0, .y = y0, .w = x1 - x0, .h = y1 - y0};
+}
+
+}  // namespace
+
 DisplayHandler::DisplayHandler(
     std::vector<std::shared_ptr<webrtc_streaming::VideoSink>> display_sinks,
     ScreenConnector& screen_connector)
-    : display_sinks_(display_sinks), screen_connector_(screen_connector) {
+    : screen_connector_(screen_connector) {
+  for (std::uint32_t i = 0; i < ScreenConnectorInfo::MaxScreenCount(); i++) {
+    display_states_.emplace_back(std::make_unique<DisplayFrameState>());
+  }
+  for (std::size_t i = 0; i < display_sinks.size(); i++) {
+    display_states_[i]->sink = std::move(display_sinks[i]);
+  }
   screen_connector_.SetCallback(std::move(GetScreenConnectorCallback()));
 }
 
 DisplayHandler::GenerateProcessedFrameCallback DisplayHandler::GetScreenConnectorCallback() {
     // only to tell the producer how to create a ProcessedFrame to cache into the queue
     DisplayHandler::GenerateProcessedFrameCallback callback =
-        [](std::uint32_t display_number, std::uint32_t frame_width,
+        [this](std::uint32_t display_number, std::uint32_t frame_width,
            std::uint32_t frame_height, std::uint32_t frame_stride_bytes,
            std::uint8_t* frame_pixels,
+           const ScreenConnectorFrameDamage& frame_damage,
            WebRtcScProcessedFrame& processed_frame) {
-          processed_frame.display_number_ = display_number;
-          processed_frame.buf_ =
-              std::make_unique<CvdVideoFrameBuffer>(frame_width, frame_height);
-          libyuv::ABGRToI420(
-              frame_pixels, frame_stride_bytes, processed_frame.buf_->DataY(),
-              processed_frame.buf_->StrideY(), processed_frame.buf_->DataU(),
-              processed_frame.buf_->StrideU(), processed_frame.buf_->DataV(),
-              processed_frame.buf_->StrideV(), frame_width, frame_height);
-          processed_frame.is_success_ = true;
+          ProcessFrame(display_number, frame_width, frame_height,
+                       frame_stride_bytes, frame_pixels, frame_damage,
+                       processed_frame);
         };
     return callback;
 }
 
+void DisplayHandler::ProcessFrame(
+    std::uint32_t display_number, std::uint32_t frame_width,
+    std::uint32_t frame_height, std::uint32_t frame_stride_bytes,
+    std::uint8_t* frame_pixels, const ScreenConnectorFrameDamage& frame_damage,
+    WebRtcScProcessedFrame& processed_frame) {
+  CF_TRACE("process_frame");
+  CHECK(display_number < display_states_.size())
+      << "Frame received for unknown display " << display_number;
+  auto& display = *display_states_[display_number];
+  std::lock_guard<std::mutex> lock(display.mutex);
+
+  if (display.width != frame_width || display.height != frame_height) {
+    display.width = frame_width;
+    display.height = frame_height;
+    display.first_valid_sequence = display.sequence + 1;
+    display.damage_history.clear();
+    display.standby_stale = true;
+  }
+  display.sequence++;
+  display.damage_history.push_back(frame_damage);
+  if (display.damage_history.size() > kMaxDamageHistory) {
+    display.damage_history.pop_front();
+  }
+
+  processed_frame.display_number_ = display_number;
+  if (!active_ || !display.sink) {
+    // The pool's buffers fall behind on every frame that isn't converted
+    display.first_valid_sequence = display.sequence + 1;
+    const std::uint32_t bytes_per_pixel = ScreenConnectorInfo::BytesPerPixel();
+    const std::uint32_t row_bytes = frame_width * bytes_per_pixel;
+    auto to_copy = frame_damage;
+    if (display.standby_stale) {
+      display.standby_pixels.resize(row_bytes * frame_height);
+      display.standby_stale = false;
+      to_copy = ScreenConnectorFrameDamage::Full(frame_width, frame_height);
+    }
+    for (std::uint32_t row = to_copy.y; row < to_copy.y + to_copy.h; row++) {
+      std::memcpy(display.standby_pixels.data() + row * row_bytes +
+                      to_copy.x * bytes_per_pixel,
+                  frame_pixels + row * frame_stride_bytes +
+                      to_copy.x * bytes_per_pixel,
+                  to_copy.w * bytes_per_pixel);
+    }
+    display.standby_pending = true;
+    // Without a buffer, so it's not streamed
+    processed_frame.is_success_ = true;
+    return;
+  }
+
+  processed_frame.timestamps_.conversion_started =
+      ScreenConnectorFrameTimestamps::Clock::now();
+  auto buffer = display.pool.Get(frame_width, frame_height);
+
+  // A recycled buffer already holds an older frame of this display, so only
+  // what changed in the frames produced after that one needs converting.
+  auto to_convert = ScreenConnectorFrameDamage::Full(frame_width, frame_height);
+  const std::uint64_t buffer_sequence = buffer->frame_sequence();
+  if (buffer_sequence >= display.first_valid_sequence &&
+      display.sequence - buffer_sequence <= display.damage_history.size()) {
+    ScreenConnectorFrameDamage accumulated{};
+    auto frames_behind = display.sequence - buffer_sequence;
+    for (auto it = display.damage_history.rbegin(); frames_behind > 0;
+         ++it, --frames_behind) {
+      accumulated = Union(accumulated, *it);
+    }
+    to_convert = AlignToChroma(accumulated, frame_width, frame_height);
+  }
+
+  if (to_convert.w > 0 && to_convert.h > 0) {
+    WriteRect(frame_pixels, frame_stride_bytes, to_convert, *buffer);
+  }
+  buffer->set_frame_sequence(display.sequence);
+  processed_frame.timestamps_.conversion_finished =
+      ScreenConnectorFrameTimestamps::Clock::now();
+
+  processed_frame.buf_ = std::move(buffer);
+  processed_frame.is_success_ = true;
+}
+
+void DisplayHandler::WriteRect(const std::uint8_t* pixels,
+                               std::uint32_t stride_bytes,
+                               const ScreenConnectorFrameDamage& rect,
+                               CvdVideoFrameBuffer& buffer) {
+  const std::uint8_t* src = pixels + rect.y * stride_bytes +
+                            rect.x * ScreenConnectorInfo::BytesPerPixel();
+  const std::uint32_t chroma_x = rect.x / 2;
+  const std::uint32_t chroma_y = rect.y / 2;
+  converter_.Convert(
+      src, stride_bytes, buffer.DataY() + rect.y * buffer.StrideY() + rect.x,
+      buffer.StrideY(), buffer.DataU() + chroma_y * buffer.StrideU() + chroma_x,
+      buffer.StrideU(), buffer.DataV() + chroma_y * buffer.StrideV() + chroma_x,
+      buffer.StrideV(), rect.w, rect.h);
+}
+
 [[noreturn]] void DisplayHandler::Loop() {
+  std::unique_lock<std::mutex> lock(display_threads_mutex_);
+  looping_ = true;
+  for (std::uint32_t i = 0; i < display_states_.size(); i++) {
+    auto& display = *display_states_[i];
+    std::lock_guard<std::mutex> send_lock(display.send_mutex);
+    if (display.sink) {
+      StartDisplayThread(i);
+    }
+  }
+  // The display threads never return
+  display_threads_cv_.wait(lock, []() { return false; });
+  LOG(FATAL) << "Display threads exited";
+  abort();
+}
+
+void DisplayHandler::StartDisplayThread(std::uint32_t display_number) {
+  if (display_threads_.count(display_number)) {
+    return;
+  }
+  display_threads_.emplace(
+      display_number,
+      std::thread([this, display_number]() { DisplayLoop(display_number); }));
+}
+
+void DisplayHandler::AddDisplay(
+    std::uint32_t display_number,
+    std::shared_ptr<webrtc_streaming::VideoSink> sink) {
+  CHECK(display_number < display_states_.size())
+      << "Can't add display " << display_number;
+  auto& display = *display_states_[display_number];
+  std::shared_ptr<CvdVideoFrameBuffer> buffer;
+  {
+    std::lock_guard<std::mutex> lock(display.mutex);
+    std::lock_guard<std::mutex> send_lock(display.send_mutex);
+    display.sink = std::move(sink);
+    // Its frames were only copied since it was last streamed, if ever
+    display.first_valid_sequence = display.sequence + 1;
+    display.damage_history.clear();
+    if (active_) {
+      buffer = ConvertStandbyFrame(display);
+    }
+  }
+  if (buffer) {
+    std::lock_guard<std::mutex> lock(display.last_buffer_mutex);
+    display.last_buffer = std::move(buffer);
+  }
+  {
+    std::lock_guard<std::mutex> lock(display_threads_mutex_);
+    if (looping_) {
+      StartDisplayThread(display_number);
+    }
+  }
+  SendLastFrame(display_number);
+}
+
+void DisplayHandler::RemoveDisplay(std::uint32_t display_number) {
+  CHECK(display_number < display_states_.size())
+      << "Can't remove display " << display_number;
+  auto& display = *display_states_[display_number];
+  {
+    std::lock_guard<std::mutex> lock(display.mutex);
+    std::lock_guard<std::mutex> send_lock(display.send_mutex);
+    display.sink.reset();
+    // Only the frames received from now on are kept up to date
+    display.standby_stale = true;
+    display.standby_pending = false;
+  }
+  // If the display comes back it may well have another resolution
+  std::lock_guard<std::mutex> lock(display.last_buffer_mutex);
+  display.last_buffer.reset();
+}
+
+[[noreturn]] void DisplayHandler::DisplayLoop(std::uint32_t display_number) {
+  auto& display = *display_states_[display_number];
   for (;;) {
-    auto processed_frame = screen_connector_.OnNextFrame();
-    // processed_frame has display number from the guest
-    {
-      std::lock_guard<std::mutex> lock(last_buffer_mutex_);
-      std::shared_ptr<CvdVideoFrameBuffer> buffer = std::move(processed_frame.buf_);
-      last_buffer_display_ = processed_frame.display_number_;
-      last_buffer_ =
-          std::static_pointer_cast<webrtc_streaming::VideoFrameBuffer>(buffer);
+    auto processed_frame = screen_connector_.OnNextFrame(display_number);
+    const auto popped = ScreenConnectorFrameTimestamps::Clock::now();
+    // Frames received while inactive weren't converted
+    const bool converted = processed_frame.buf_ != nullptr;
+    if (converted || !processed_frame.is_success_) {
+      std::lock_guard<std::mutex> lock(display.last_buffer_mutex);
+      display.last_buffer = std::move(processed_frame.buf_);
     }
     if (processed_frame.is_success_) {
-      SendLastFrame();
+      if (converted) {
+        SendLastFrame(display_number);
+        latency_stats_.RecordFrame(processed_frame.timestamps_, popped,
+                                   ScreenConnectorFrameTimestamps::Clock::now());
+      }
+      std::lock_guard<std::mutex> lock(frame_listeners_mutex_);
+      for (const auto& listener : frame_listeners_) {
+        listener();
+      }
+    }
+  }
+}
+
+void DisplayHandler::AddFrameListener(std::function<void()> listener) {
+  std::lock_guard<std::mutex> lock(frame_listeners_mutex_);
+  frame_listeners_.push_back(std::move(listener));
+}
+
+void DisplayHandler::SetActive(bool active) {
+  if (active_.exchange(active) == active) {
+    return;
+  }
+  for (std::uint32_t i = 0; i < display_states_.size(); i++) {
+    auto& display = *display_states_[i];
+    std::shared_ptr<CvdVideoFrameBuffer> buffer;
+    {
+      std::lock_guard<std::mutex> lock(display.mutex);
+      if (!display.sink) {
+        // Its frames are copied either way
+        continue;
+      }
+      if (!active) {
+        display.standby_stale = true;
+        continue;
+      }
+      buffer = ConvertStandbyFrame(display);
+      if (!buffer) {
+        // The last converted frame is still the latest one
+        continue;
+      }
     }
+    std::lock_guard<std::mutex> lock(display.last_buffer_mutex);
+    display.last_buffer = std::move(buffer);
   }
 }
 
+std::shared_ptr<CvdVideoFrameBuffer> DisplayHandler::ConvertStandbyFrame(
+    DisplayFrameState& display) {
+  if (!display.standby_pending) {
+    return nullptr;
+  }
+  display.standby_pending = false;
+  auto buffer = display.pool.Get(display.width, display.height);
+  WriteRect(display.standby_pixels.data(),
+            display.width * ScreenConnectorInfo::BytesPerPixel(),
+            ScreenConnectorFrameDamage::Full(display.width, display.height),
+            *buffer);
+  // Later frames are converted on top of this one as usual
+  buffer->set_frame_sequence(display.sequence);
+  display.first_valid_sequence = display.sequence;
+  display.damage_history.clear();
+  return buffer;
+}
+
+Json::Value DisplayHandler::GetFrameStats() const {
+  Json::Value stats(Json::objectValue);
+  stats["latency"] = latency_stats_.ToJson();
+  stats["dropped_identical_frames"] =
+      Json::UInt64(screen_connector_.DroppedIdenticalFrames());
+  stats["dropped_stale_frames"] =
+      Json::UInt64(screen_connector_.DroppedStaleFrames());
+  return stats;
+}
+
 void DisplayHandler::SendLastFrame() {
+  for (std::uint32_t i = 0; i < display_states_.size(); i++) {
+    SendLastFrame(i);
+  }
+}
+
+std::shared_ptr<webrtc_streaming::VideoFrameBuffer> DisplayHandler::LastFrame(
+    std::uint32_t display_number) {
+  CHECK(display_number < display_states_.size())
+      << "Frame requested for unknown display " << display_number;
+  auto& display = *display_states_[display_number];
+  {
+    std::lock_guard<std::mutex> lock(display.mutex);
+    if (display.standby_pending) {
+      // Not converted yet, a conversion outside of the pool does
+      auto buffer =
+          std::make_shared<CvdVideoFrameBuffer>(display.width, display.height);
+      WriteRect(display.standby_pixels.data(),
+                display.width * ScreenConnectorInfo::BytesPerPixel(),
+                ScreenConnectorFrameDamage::Full(display.width, display.height),
+                *buffer);
+      return buffer;
+    }
+  }
+  std::lock_guard<std::mutex> lock(display.last_buffer_mutex);
+  return display.last_buffer;
+}
+
+void DisplayHandler::SendLastFrame(std::uint32_t display_number) {
+  auto& display = *display_states_[display_number];
   std::shared_ptr<webrtc_streaming::VideoFrameBuffer> buffer;
-  std::uint32_t buffer_display;
   {
-    std::lock_guard<std::mutex> lock(last_buffer_mutex_);
-    buffer = last_buffer_;
-    buffer_display = last_buffer_display_;
+    std::lock_guard<std::mutex> lock(display.last_buffer_mutex);
+    buffer = display.last_buffer;
   }
   if (!buffer) {
     // If a connection request arrives before the first frame is available don't
@@ -83,12 +388,15 @@ void DisplayHandler::SendLastFrame() {
   {
     // SendLastFrame can be called from multiple threads simultaneously, locking
     // here avoids injecting frames with the timestamps in the wrong order.
-    std::lock_guard<std::mutex> lock(next_frame_mutex_);
+    std::lock_guard<std::mutex> lock(display.send_mutex);
+    if (!display.sink) {
+      return;
+    }
     int64_t time_stamp =
         std::chrono::duration_cast<std::chrono::microseconds>(
             std::chrono::system_clock::now().time_since_epoch())
             .count();
-    display_sinks_[buffer_display]->OnFrame(buffer, time_stamp);
+    display.sink->OnFrame(buffer, time_stamp);
   }
 }
 }  // namespace cuttlefish
@@ -16,12 +16,22 @@
 
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <thread>
 #include <vector>
 
+#include <json/json.h>
+
 #include "host/frontend/webrtc/cvd_video_frame_buffer.h"
+#include "host/frontend/webrtc/frame_latency_stats.h"
 #include "host/frontend/webrtc/lib/video_sink.h"
+#include "host/frontend/webrtc/parallel_i420_converter.h"
 #include "host/libs/screen_connector/screen_connector.h"
 
 namespace cuttlefish {
@@ -36,14 +46,18 @@ namespace cuttlefish {
  */
 struct WebRtcScProcessedFrame : public ScreenConnectorFrameInfo {
   // must support move semantic
-  std::unique_ptr<CvdVideoFrameBuffer> buf_;
+  //
+  // The buffer is reference counted so that the same I420 memory the frame
+  // was converted into is handed to every sink without further copies.
+  std::shared_ptr<CvdVideoFrameBuffer> buf_;
   std::unique_ptr<WebRtcScProcessedFrame> Clone() {
     // copy internal buffer, not move
-    CvdVideoFrameBuffer* new_buffer = new CvdVideoFrameBuffer(*(buf_.get()));
     auto cloned_frame = std::make_unique<WebRtcScProcessedFrame>();
-    cloned_frame->buf_ =
-        std::move(std::unique_ptr<CvdVideoFrameBuffer>(new_buffer));
-    return std::move(cloned_frame);
+    cloned_frame->display_number_ = display_number_;
+    cloned_frame->is_success_ = is_success_;
+    cloned_frame->timestamps_ = timestamps_;
+    cloned_frame->buf_ = std::make_shared<CvdVideoFrameBuffer>(*buf_);
+    return cloned_frame;
   }
 };
 
@@ -57,16 +71,104 @@ class DisplayHandler {
       ScreenConnector& screen_connector);
   ~DisplayHandler() = default;
 
+  // Streams the frames of each display from a thread of its own, so a slow
+  // display or encoder doesn't delay the others.
   [[noreturn]] void Loop();
+  // Streams a display added while the device runs to the sink, starting with
+  // the latest frame the guest showed on it. The sink replaces any previous
+  // one of the display.
+  void AddDisplay(std::uint32_t display_number,
+                  std::shared_ptr<webrtc_streaming::VideoSink> sink);
+  // Stops streaming the display. Its frames are still kept, like while
+  // inactive, in case it's added again.
+  void RemoveDisplay(std::uint32_t display_number);
+  // Sends the latest frame of every display again.
   void SendLastFrame();
+  // The latest frame of the display, including those received while inactive,
+  // in any of the frame types. Null before the first frame.
+  std::shared_ptr<webrtc_streaming::VideoFrameBuffer> LastFrame(
+      std::uint32_t display_number);
+
+  // While inactive, guest frames are only copied as they come instead of being
+  // converted for the streamer, which is pointless with nobody watching. The
+  // latest frames are converted when it becomes active again. Active by
+  // default.
+  void SetActive(bool active);
+
+  // Called from the display thread every time a guest frame is streamed.
+  void AddFrameListener(std::function<void()> listener);
+
+  // Latency of the frames sent so far, per stage, and how many frames were
+  // dropped before reaching the streamer.
+  Json::Value GetFrameStats() const;
 
  private:
+  // Per display state used to produce frames from the guest's buffers.
+  struct DisplayFrameState {
+    std::mutex mutex;
+    CvdVideoFrameBufferPool pool;
+    // Sequence number of the latest frame produced for this display.
+    std::uint64_t sequence = 0;
+    // Buffers holding frames older than this must be fully converted again,
+    // e.g. because the resolution changed since.
+    std::uint64_t first_valid_sequence = 1;
+    std::uint32_t width = 0;
+    std::uint32_t height = 0;
+    // Damage of the latest frames, the newest one is at the back.
+    std::deque<ScreenConnectorFrameDamage> damage_history;
+    // The latest frame received while inactive, tightly packed.
+    std::vector<std::uint8_t> standby_pixels;
+    // Whether standby_pixels is newer than the last converted frame.
+    bool standby_pending = false;
+    // Whether standby_pixels must be copied whole from the next frame, as
+    // only the frames received while inactive are kept up to date.
+    bool standby_stale = true;
+
+    // The latest converted frame, separately locked so sending it again
+    // doesn't wait for a conversion.
+    std::mutex last_buffer_mutex;
+    std::shared_ptr<webrtc_streaming::VideoFrameBuffer> last_buffer;
+    // Keeps the frames handed to the sink in timestamp order
+    std::mutex send_mutex;
+    // Null while the display isn't streamed. Changed with both mutex and
+    // send_mutex held, so either of them is enough to use it.
+    std::shared_ptr<webrtc_streaming::VideoSink> sink;
+  };
+
   GenerateProcessedFrameCallback GetScreenConnectorCallback();
-  std::vector<std::shared_ptr<webrtc_streaming::VideoSink>> display_sinks_;
+  [[noreturn]] void DisplayLoop(std::uint32_t display_number);
+  // Must be called with display_threads_mutex_ held.
+  void StartDisplayThread(std::uint32_t display_number);
+  // Converts the latest frame received while inactive, if there is one
+  // newer than the last converted frame. Must be called with the display's
+  // mutex held.
+  std::shared_ptr<CvdVideoFrameBuffer> ConvertStandbyFrame(
+      DisplayFrameState& display);
+  void SendLastFrame(std::uint32_t display_number);
+  void ProcessFrame(std::uint32_t display_number, std::uint32_t frame_width,
+                    std::uint32_t frame_height,
+                    std::uint32_t frame_stride_bytes,
+                    std::uint8_t* frame_pixels,
+                    const ScreenConnectorFrameDamage& frame_damage,
+                    WebRtcScProcessedFrame& processed_frame);
+  // Converts a rectangle of the guest's pixels into the same rectangle of the
+  // buffer.
+  void WriteRect(const std::uint8_t* pixels, std::uint32_t stride_bytes,
+                 const ScreenConnectorFrameDamage& rect,
+                 CvdVideoFrameBuffer& buffer);
+  // One per display the guest may have, indexed by display number.
+  std::vector<std::unique_ptr<DisplayFrameState>> display_states_;
+  // The threads of displays streamed so far, which never exit. Displays added
+  // before Loop() runs get theirs from it.
+  std::mutex display_threads_mutex_;
+  std::condition_variable display_threads_cv_;
+  bool looping_ = false;
+  std::map<std::uint32_t, std::thread> display_threads_;
+  ParallelI420Converter converter_;
   ScreenConnector& screen_connector_;
-  std::shared_ptr<webrtc_streaming::VideoFrameBuffer> last_buffer_;
-  std::uint32_t last_buffer_display_ = 0;
-  std::mutex last_buffer_mutex_;
-  std::mutex next_frame_mutex_;
+  std::atomic<bool> active_ = true;
+  FrameLatencyStats latency_stats_;
+  std::mutex frame_listeners_mutex_;
+  std::vector<std::function<void()>> frame_listeners_;
 };
 }  // namespace cuttlefish
@@ -0,0 +1,520 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Plays frames into the display pipeline the way the guest's compositor does,
+// through the ScreenConnector, the DisplayHandler and its conversion, and the
+// video track the encoders take their frames from, without a device.
+//
+// The frames are either synthetic ones at the resolutions and rates given by
+// --resolutions and --fps, or a recording made with launch_cvd
+// --record_frames passed with --frame_recording.
+//
+// Besides the time to play the frames, each run reports the mean conversion
+// time, queue dwell, encode time and total latency in microseconds, and the
+// share of frames dropped before reaching the encoder.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+#include <api/video/video_frame.h>
+#include <api/video_codecs/builtin_video_encoder_factory.h>
+#include <api/video_codecs/video_encoder.h>
+#include <benchmark/benchmark.h>
+#include <gflags/gflags.h>
+#include <json/json.h>
+
+#include "host/frontend/webrtc/display_handler.h"
+#include "host/frontend/webrtc/frame_latency_stats.h"
+#include "host/frontend/webrtc/lib/encoder_factory.h"
+#include "host/frontend/webrtc/lib/video_track_source_impl.h"
+#include "host/libs/screen_connector/frame_recording.h"
+
+DEFINE_string(resolutions, "720x1280,1080x1920",
+              "Comma separated display sizes to play the synthetic frames at");
+DEFINE_string(fps, "30,60",
+              "Comma separated frame rates to play the frames at. With "
+              "--frame_recording, 0 plays them at the recorded pace");
+DEFINE_int32(seconds, 3, "How long to play the synthetic frames for");
+DEFINE_string(frame_recording, "",
+              "A recording made with launch_cvd --record_frames, played "
+              "instead of the synthetic frames");
+DEFINE_string(codec, "VP8", "The codec to encode the frames with");
+
+namespace cuttlefish {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using webrtc_streaming::VideoTrackSourceImpl;
+using webrtc_streaming::VideoTrackSourceImplSinkWrapper;
+
+constexpr std::uint32_t kBytesPerPixel = ScreenConnectorInfo::BytesPerPixel();
+// How long to wait for the pipeline to go through the frames played last
+constexpr auto kDrainTimeout = std::chrono::seconds(5);
+
+// Plays frames into the pipeline like the compositor does, keeping the whole
+// content of each display and calling the callback with what changed.
+class ReplaySource : public ScreenConnectorSource {
+ public:
+  void SetFrameCallback(
+      GenerateProcessedFrameCallbackImpl frame_callback) override {
+    callback_ = std::move(frame_callback);
+  }
+  void SetDisplayRefreshRate(std::uint32_t, std::uint32_t) override {}
+
+  void Play(const RecordedFrame& frame) {
+    auto& display = displays_[frame.display_number];
+    if (display.width != frame.width || display.height != frame.height) {
+      display.width = frame.width;
+      display.height = frame.height;
+      display.pixels.assign(
+          std::size_t{frame.width} * frame.height * kBytesPerPixel, 0);
+    }
+    const std::size_t stride = std::size_t{frame.width} * kBytesPerPixel;
+    const std::size_t row_bytes = std::size_t{frame.damage.w} * kBytesPerPixel;
+    for (std::uint32_t row = 0; row < frame.damage.h; row++) {
+      std::copy_n(frame.pixels.data() + row * row_bytes, row_bytes,
+                  display.pixels.data() + (frame.damage.y + row) * stride +
+                      frame.damage.x * kBytesPerPixel);
+    }
+    callback_(frame.display_number, frame.width, frame.height, stride,
+              display.pixels.data(), frame.damage);
+  }
+
+ private:
+  struct Display {
+    std::uint32_t width = 0;
+    std::uint32_t height = 0;
+    std::vector<std::uint8_t> pixels;
+  };
+  GenerateProcessedFrameCallbackImpl callback_;
+  Display displays_[ScreenConnectorInfo::MaxScreenCount()];
+};
+
+// Encodes the frames of a display's video track as they arrive, like the
+// encoder of a connected client does.
+class EncodingSink : public rtc::VideoSinkInterface<webrtc::VideoFrame>,
+                     public webrtc::EncodedImageCallback {
+ public:
+  bool Init(webrtc::VideoEncoderFactory& factory, int width, int height) {
+    encoder_ = factory.CreateVideoEncoder(webrtc::SdpVideoFormat(FLAGS_codec));
+    if (!encoder_) {
+      LOG(ERROR) << "Could not create a " << FLAGS_codec << " encoder";
+      return false;
+    }
+    encoder_->RegisterEncodeCompleteCallback(this);
+    webrtc::VideoCodec codec{};
+    codec.codecType = webrtc::PayloadStringToCodecType(FLAGS_codec);
+    codec.width = width;
+    codec.height = height;
+    codec.startBitrate = 1000;  // kilobits/sec
+    codec.maxBitrate = 2000;
+    codec.maxFramerate = 60;
+    codec.active = true;
+    codec.qpMax = 56;
+    codec.mode = webrtc::VideoCodecMode::kScreensharing;
+    if (codec.codecType == webrtc::kVideoCodecVP8) {
+      *codec.VP8() = webrtc::VideoEncoder::GetDefaultVp8Settings();
+    }
+    webrtc::VideoEncoder::Capabilities capabilities(false);
+    webrtc::VideoEncoder::Settings settings(capabilities, 1, 1 << 20);
+    if (encoder_->InitEncode(&codec, settings) != 0) {
+      LOG(ERROR) << "Failed to initialize the " << FLAGS_codec << " encoder";
+      return false;
+    }
+    return true;
+  }
+
+  // VideoSinkInterface
+  void OnFrame(const webrtc::VideoFrame& frame) override {
+    webrtc::VideoFrame to_encode = frame;
+    // 90kHz RTP ticks
+    to_encode.set_timestamp(frame.timestamp_us() * 9 / 100);
+    std::vector<webrtc::VideoFrameType> types{
+        frames_ == 0 ? webrtc::VideoFrameType::kVideoFrameKey
+                     : webrtc::VideoFrameType::kVideoFrameDelta};
+    const auto start = Clock::now();
+    if (encoder_->Encode(to_encode, &types) != 0) {
+      LOG(ERROR) << "Failed to encode frame";
+    }
+    encode_.Record(std::chrono::duration_cast<std::chrono::microseconds>(
+        Clock::now() - start));
+    frames_++;
+  }
+
+  // EncodedImageCallback
+  webrtc::EncodedImageCallback::Result OnEncodedImage(
+      const webrtc::EncodedImage& encoded_image,
+      const webrtc::CodecSpecificInfo*,
+      const webrtc::RTPFragmentationHeader*) override {
+    encoded_bytes_ += encoded_image.size();
+    return webrtc::EncodedImageCallback::Result(
+        webrtc::EncodedImageCallback::Result::Error::OK);
+  }
+
+  std::uint64_t Frames() const { return frames_; }
+  std::uint64_t EncodedBytes() const { return encoded_bytes_; }
+  Json::Value EncodeStats() const { return encode_.ToJson(); }
+
+ private:
+  std::unique_ptr<webrtc::VideoEncoder> encoder_;
+  std::atomic<std::uint64_t> frames_ = 0;
+  std::atomic<std::uint64_t> encoded_bytes_ = 0;
+  LatencyHistogram encode_;
+};
+
+// A ScreenConnector, DisplayHandler and encoder per display, set up the way
+// the streamer does it.
+class Pipeline {
+ public:
+  static std::unique_ptr<Pipeline> Create(
+      const std::vector<std::pair<std::uint32_t, std::uint32_t>>& displays) {
+    std::unique_ptr<Pipeline> pipeline(new Pipeline());
+    std::vector<std::unique_ptr<webrtc::VideoEncoderFactory>> factories;
+    factories.push_back(webrtc::CreateBuiltinVideoEncoderFactory());
+    pipeline->encoder_factory_ =
+        std::make_unique<webrtc_streaming::CompositeEncoderFactory>(
+            std::move(factories), std::vector<std::string>{FLAGS_codec},
+            /* screen_content */ true);
+
+    auto source = std::make_unique<ReplaySource>();
+    pipeline->source_ = source.get();
+    pipeline->screen_connector_ = DisplayHandler::ScreenConnector::ForSource(
+        std::move(source), HostModeCtrl::Get(),
+        /* frame_keepalive */ std::chrono::milliseconds(1000));
+
+    std::vector<std::shared_ptr<webrtc_streaming::VideoSink>> sinks;
+    for (const auto& [width, height] : displays) {
+      rtc::scoped_refptr<VideoTrackSourceImpl> track_source(
+          new rtc::RefCountedObject<VideoTrackSourceImpl>(
+              width, height, /* is_screencast */ true));
+      auto encoder = std::make_unique<EncodingSink>();
+      if (!encoder->Init(*pipeline->encoder_factory_, width, height)) {
+        return nullptr;
+      }
+      track_source->AddOrUpdateSink(encoder.get(), rtc::VideoSinkWants{});
+      pipeline->track_sources_.push_back(track_source);
+      pipeline->encoders_.push_back(std::move(encoder));
+      sinks.push_back(
+          std::make_shared<VideoTrackSourceImplSinkWrapper>(track_source));
+    }
+    pipeline->display_handler_ = std::make_shared<DisplayHandler>(
+        std::move(sinks), *pipeline->screen_connector_);
+    std::thread([display_handler = pipeline->display_handler_]() {
+      display_handler->Loop();
+    }).detach();
+    return pipeline;
+  }
+
+  void Play(const RecordedFrame& frame) {
+    source_->Play(frame);
+    played_++;
+  }
+
+  // Waits for every frame played to be encoded or dropped
+  void Drain() {
+    auto give_up = Clock::now() + kDrainTimeout;
+    while (Clock::now() < give_up && Handled() < played_) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  void Report(benchmark::State& state) const {
+    auto stats = display_handler_->GetFrameStats();
+    std::uint64_t encoded = 0;
+    std::uint64_t encoded_bytes = 0;
+    for (const auto& encoder : encoders_) {
+      encoded += encoder->Frames();
+      encoded_bytes += encoder->EncodedBytes();
+    }
+    const auto& latency = stats["latency"];
+    state.counters["conversion_us"] = latency["conversion"]["mean_us"].asDouble();
+    state.counters["queue_dwell_us"] =
+        latency["queue_dwell"]["mean_us"].asDouble();
+    state.counters["total_us"] = latency["total"]["mean_us"].asDouble();
+    if (!encoders_.empty()) {
+      state.counters["encode_us"] =
+          encoders_[0]->EncodeStats()["mean_us"].asDouble();
+    }
+    state.counters["drop_rate"] =
+        played_ ? 1.0 - static_cast<double>(encoded) / played_ : 0;
+    state.counters["frames"] = played_;
+    state.counters["bytes_per_frame"] =
+        encoded ? static_cast<double>(encoded_bytes) / encoded : 0;
+  }
+
+ private:
+  Pipeline() = default;
+
+  std::uint64_t Handled() const {
+    std::uint64_t handled = screen_connector_->DroppedIdenticalFrames() +
+                            screen_connector_->DroppedStaleFrames();
+    for (const auto& encoder : encoders_) {
+      handled += encoder->Frames();
+    }
+    return handled;
+  }
+
+  std::unique_ptr<webrtc::VideoEncoderFactory> encoder_factory_;
+  ReplaySource* source_ = nullptr;
+  std::unique_ptr<DisplayHandler::ScreenConnector> screen_connector_;
+  std::vector<rtc::scoped_refptr<VideoTrackSourceImpl>> track_sources_;
+  std::vector<std::unique_ptr<EncodingSink>> encoders_;
+  std::shared_ptr<DisplayHandler> display_handler_;
+  std::uint64_t played_ = 0;
+};
+
+// Cheap to generate content with some structure, so the encoders don't face
+// either a flat image or pure noise.
+void FillPattern(std::uint8_t* pixels, std::uint32_t width, std::uint32_t rows,
+                 std::uint32_t seed) {
+  for (std::uint32_t y = 0; y < rows; y++) {
+    for (std::uint32_t x = 0; x < width; x++) {
+      auto pixel = pixels + (std::size_t{y} * width + x) * kBytesPerPixel;
+      pixel[0] = static_cast<std::uint8_t>((x + seed) / 4);
+      pixel[1] = static_cast<std::uint8_t>((y + seed) / 8);
+      pixel[2] = static_cast<std::uint8_t>((x ^ (y + seed)) & 0xc0);
+      pixel[3] = 0xff;
+    }
+  }
+}
+
+RecordedFrame DamageFrame(std::uint32_t width, std::uint32_t height,
+                          ScreenConnectorFrameDamage damage,
+                          std::uint32_t seed) {
+  RecordedFrame frame{
+      .timestamp = {},
+      .display_number = 0,
+      .width = width,
+      .height = height,
+      .damage = damage,
+      .pixels = std::vector<std::uint8_t>(std::size_t{damage.w} * damage.h *
+                                          kBytesPerPixel),
+  };
+  FillPattern(frame.pixels.data(), damage.w, damage.h, seed);
+  return frame;
+}
+
+// The n-th frame of a synthetic scenario on a single display
+using Scenario = std::function<RecordedFrame(
+    std::uint32_t width, std::uint32_t height, std::uint32_t n)>;
+
+const std::vector<std::pair<std::string, Scenario>>& Scenarios() {
+  static const std::vector<std::pair<std::string, Scenario>> scenarios = {
+      // A blinking cursor or a small widget changing
+      {"small_damage",
+       [](std::uint32_t width, std::uint32_t height, std::uint32_t n) {
+         const std::uint32_t size = std::min({64u, width, height});
+         const std::uint32_t x = (n * 16) % (width - size + 1);
+         return DamageFrame(width, height,
+                            {.x = x, .y = height / 2, .w = size, .h = size}, n);
+       }},
+      // Scrolling a list: everything below the status bar changes
+      {"scroll",
+       [](std::uint32_t width, std::uint32_t height, std::uint32_t n) {
+         const std::uint32_t top = height / 20;
+         return DamageFrame(width, height,
+                            {.x = 0, .y = top, .w = width, .h = height - top},
+                            n * 8);
+       }},
+      // Every pixel changes, like a game or a video
+      {"full_frame",
+       [](std::uint32_t width, std::uint32_t height, std::uint32_t n) {
+         return DamageFrame(width, height,
+                            ScreenConnectorFrameDamage::Full(width, height),
+                            n * 31);
+       }},
+  };
+  return scenarios;
+}
+
+// Plays the frames at the given rate, or at their recorded pace with zero
+void PlayFrames(Pipeline& pipeline, int fps,
+                const std::function<const RecordedFrame*(std::uint32_t)>&
+                    next_frame) {
+  const auto start = Clock::now();
+  for (std::uint32_t n = 0;; n++) {
+    auto frame = next_frame(n);
+    if (!frame) {
+      break;
+    }
+    auto due = fps > 0 ? start + n * std::chrono::duration_cast<Clock::duration>(
+                                         std::chrono::seconds(1)) /
+                                     fps
+                       : start + frame->timestamp;
+    std::this_thread::sleep_until(due);
+    pipeline.Play(*frame);
+  }
+  pipeline.Drain();
+}
+
+void BM_Synthetic(benchmark::State& state, const Scenario& scenario,
+                  std::uint32_t width, std::uint32_t height, int fps) {
+  const std::uint32_t frame_count = FLAGS_seconds * fps;
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto pipeline = Pipeline::Create({{width, height}});
+    if (!pipeline) {
+      state.SkipWithError("Failed to create the pipeline");
+      return;
+    }
+    RecordedFrame frame;
+    state.ResumeTiming();
+    PlayFrames(*pipeline, fps,
+               [&](std::uint32_t n) -> const RecordedFrame* {
+                 if (n == frame_count) {
+                   return nullptr;
+                 }
+                 // The first frame shows the whole display
+                 frame = n == 0 ? DamageFrame(width, height,
+                                              ScreenConnectorFrameDamage::Full(
+                                                  width, height),
+                                              0)
+                                : scenario(width, height, n);
+                 return &frame;
+               });
+    pipeline->Report(state);
+    // The display threads of the DisplayHandler never exit, so the pipeline
+    // can't be destroyed
+    (void)pipeline.release();
+  }
+}
+
+void BM_Recording(benchmark::State& state,
+                  const std::vector<RecordedFrame>& frames, int fps) {
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> displays;
+  for (const auto& frame : frames) {
+    if (frame.display_number >= displays.size()) {
+      displays.resize(frame.display_number + 1);
+    }
+    if (displays[frame.display_number].first == 0) {
+      displays[frame.display_number] = {frame.width, frame.height};
+    }
+  }
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto pipeline = Pipeline::Create(displays);
+    if (!pipeline) {
+      state.SkipWithError("Failed to create the pipeline");
+      return;
+    }
+    state.ResumeTiming();
+    PlayFrames(*pipeline, fps, [&frames](std::uint32_t n) {
+      return n < frames.size() ? &frames[n] : nullptr;
+    });
+    pipeline->Report(state);
+    (void)pipeline.release();
+  }
+}
+
+bool ParseList(const std::string& list, std::vector<int>* values) {
+  for (const auto& item : android::base::Split(list, ",")) {
+    int value;
+    if (!android::base::ParseInt(item, &value, 0)) {
+      return false;
+    }
+    values->push_back(value);
+  }
+  return true;
+}
+
+int RegisterBenchmarks() {
+  std::vector<int> rates;
+  if (!ParseList(FLAGS_fps, &rates)) {
+    LOG(ERROR) << "Invalid --fps: " << FLAGS_fps;
+    return 1;
+  }
+  if (!FLAGS_frame_recording.empty()) {
+    auto frames = ReadFrameRecording(FLAGS_frame_recording);
+    if (!frames.ok()) {
+      LOG(ERROR) << frames.error();
+      return 1;
+    }
+    if (frames->empty()) {
+      LOG(ERROR) << "No frames in " << FLAGS_frame_recording;
+      return 1;
+    }
+    auto recording =
+        std::make_shared<std::vector<RecordedFrame>>(std::move(*frames));
+    auto offset = recording->front().timestamp;
+    for (auto& frame : *recording) {
+      frame.timestamp -= offset;
+    }
+    for (int fps : rates) {
+      benchmark::RegisterBenchmark(
+          ("BM_Recording/fps:" + std::to_string(fps)).c_str(),
+          [recording, fps](benchmark::State& state) {
+            BM_Recording(state, *recording, fps);
+          })
+          ->Iterations(1)
+          ->UseRealTime()
+          ->Unit(benchmark::kMillisecond);
+    }
+    return 0;
+  }
+  for (const auto& resolution : android::base::Split(FLAGS_resolutions, ",")) {
+    std::vector<int> size;
+    if (!ParseList(android::base::StringReplace(resolution, "x", ",", false),
+                   &size) ||
+        size.size() != 2 || size[0] <= 0 || size[1] <= 0) {
+      LOG(ERROR) << "Invalid resolution: " << resolution;
+      return 1;
+    }
+    for (int fps : rates) {
+      if (fps <= 0) {
+        LOG(ERROR) << "Synthetic frames need a positive --fps";
+        return 1;
+      }
+      for (const auto& [name, scenario] : Scenarios()) {
+        benchmark::RegisterBenchmark(
+            ("BM_Synthetic/" + name + "/" + resolution +
+             "/fps:" + std::to_string(fps))
+                .c_str(),
+            [&scenario = scenario, width = size[0], height = size[1],
+             fps](benchmark::State& state) {
+              BM_Synthetic(state, scenario, width, height, fps);
+            })
+            ->Iterations(1)
+            ->UseRealTime()
+            ->Unit(benchmark::kMillisecond);
+      }
+    }
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace cuttlefish
+
+int main(int argc, char** argv) {
+  // Takes its flags out of argv first, which gflags would reject
+  benchmark::Initialize(&argc, argv);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  if (auto result = cuttlefish::RegisterBenchmarks(); result != 0) {
+    return result;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
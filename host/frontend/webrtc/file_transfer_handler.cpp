@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/file_transfer_handler.h"
+
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <thread>
+
+#include <android-base/logging.h>
+
+#include "common/libs/fs/shared_buf.h"
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+namespace {
+
+constexpr auto kTypeField = "type";
+constexpr auto kNameField = "name";
+constexpr auto kSizeField = "size";
+constexpr auto kOffsetField = "offset";
+constexpr auto kErrorField = "error";
+constexpr auto kPartSuffix = ".part";
+
+// Only plain file names, the files must land in the shared directory.
+bool ValidName(const std::string& name) {
+  return !name.empty() && name[0] != '.' &&
+         name.find('/') == std::string::npos &&
+         name.find('\0') == std::string::npos;
+}
+
+// The guest may have created anything under the name of a partial file, like a
+// link to a host file or a FIFO. Only a regular file that is not linked from
+// elsewhere is appended to, otherwise a new one is created. Returns -1 and sets
+// errno on failure.
+int OpenPartFile(int dir_fd, const std::string& name) {
+  constexpr int kFlags = O_WRONLY | O_APPEND | O_NOFOLLOW | O_NONBLOCK |
+                         O_CLOEXEC;
+  int fd = TEMP_FAILURE_RETRY(openat(dir_fd, name.c_str(), kFlags));
+  if (fd < 0 && errno == ENOENT) {
+    fd = TEMP_FAILURE_RETRY(
+        openat(dir_fd, name.c_str(), kFlags | O_CREAT | O_EXCL, 0644));
+  }
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_nlink != 1) {
+    close(fd);
+    errno = EPERM;
+    return -1;
+  }
+  return fd;
+}
+
+}  // namespace
+
+std::shared_ptr<FileTransferHandler> FileTransferHandler::Create(
+    std::string directory,
+    std::function<bool(const std::string&)> send_to_client) {
+  std::shared_ptr<FileTransferHandler> handler(new FileTransferHandler(
+      std::move(directory), std::move(send_to_client)));
+  std::thread([handler]() { handler->Loop(); }).detach();
+  return handler;
+}
+
+FileTransferHandler::FileTransferHandler(
+    std::string directory,
+    std::function<bool(const std::string&)> send_to_client)
+    : directory_(std::move(directory)),
+      send_to_client_(std::move(send_to_client)) {}
+
+void FileTransferHandler::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    stopping_ = true;
+  }
+  queue_cv_.notify_one();
+}
+
+void FileTransferHandler::HandleMessage(const std::uint8_t* msg,
+                                        std::size_t size, bool binary) {
+  auto data = reinterpret_cast<const char*>(msg);
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    queue_.push_back(Message{std::vector<char>(data, data + size), binary});
+  }
+  queue_cv_.notify_one();
+}
+
+void FileTransferHandler::Loop() {
+  for (;;) {
+    Message message;
+    {
+      std::unique_lock<std::mutex> lock(queue_mutex_);
+      queue_cv_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+      if (stopping_) {
+        // The partial file is kept for the client to resume
+        return;
+      }
+      message = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    if (message.binary) {
+      HandleData(message.data);
+    } else {
+      HandleControl(std::string(message.data.begin(), message.data.end()));
+    }
+  }
+}
+
+void FileTransferHandler::HandleControl(const std::string& message) {
+  Json::Value json;
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  std::string errors;
+  if (!reader->parse(message.data(), message.data() + message.size(), &json,
+                     &errors) ||
+      !json.isObject() || !json[kTypeField].isString()) {
+    Fail("Invalid message: " + errors);
+    return;
+  }
+  auto type = json[kTypeField].asString();
+  if (type == "start") {
+    if (!json[kNameField].isString() || !json[kSizeField].isUInt64()) {
+      Fail("Missing file name or size");
+      return;
+    }
+    Start(json[kNameField].asString(), json[kSizeField].asUInt64());
+  } else if (type == "cancel") {
+    LOG(INFO) << "Transfer of " << name_ << " cancelled at " << offset_;
+    file_ = SharedFD();
+    name_.clear();
+  } else {
+    Fail("Unknown message type: " + type);
+  }
+}
+
+void FileTransferHandler::Start(const std::string& name, std::uint64_t size) {
+  file_ = SharedFD();
+  name_ = name;
+  if (!ValidName(name)) {
+    Fail("Invalid file name");
+    return;
+  }
+  auto part_path = directory_ + "/" + name + kPartSuffix;
+  directory_fd_.reset(TEMP_FAILURE_RETRY(
+      open(directory_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)));
+  if (directory_fd_.get() < 0) {
+    Fail("Failed to open " + directory_ + ": " + strerror(errno));
+    return;
+  }
+  // Appending makes resuming at the end of the partial file implicit
+  int part_fd = OpenPartFile(directory_fd_.get(), name + kPartSuffix);
+  if (part_fd < 0) {
+    Fail("Failed to open " + part_path + ": " + strerror(errno));
+    return;
+  }
+  file_ = SharedFD::Dup(part_fd);
+  close(part_fd);
+  if (!file_->IsOpen()) {
+    Fail("Failed to open " + part_path + ": " + file_->StrError());
+    return;
+  }
+  auto existing = file_->LSeek(0, SEEK_END);
+  if (existing < 0 || static_cast<std::uint64_t>(existing) > size) {
+    // Left by a transfer of a different file with the same name
+    if (file_->Truncate(0) < 0) {
+      Fail("Failed to truncate " + part_path + ": " + file_->StrError());
+      return;
+    }
+    existing = 0;
+  }
+  size_ = size;
+  offset_ = existing;
+  acked_ = offset_;
+  // Reserving the space upfront keeps the file contiguous and fails early
+  // when it doesn't fit. Not every file system supports it.
+  if (size_ > offset_) {
+    file_->Fallocate(FALLOC_FL_KEEP_SIZE, offset_, size_ - offset_);
+  }
+  LOG(INFO) << "Receiving " << name_ << " (" << size_ << " bytes) from "
+            << offset_;
+  Json::Value ready;
+  ready[kOffsetField] = Json::UInt64(offset_);
+  Send("ready", ready);
+  if (offset_ == size_) {
+    Finish();
+  }
+}
+
+void FileTransferHandler::HandleData(const std::vector<char>& data) {
+  if (!file_->IsOpen()) {
+    // The rest of a failed or cancelled transfer
+    return;
+  }
+  if (offset_ + data.size() > size_) {
+    Fail("Received more data than the size of the file");
+    return;
+  }
+  if (WriteAll(file_, data) != static_cast<ssize_t>(data.size())) {
+    Fail("Failed to write " + name_ + ": " + file_->StrError());
+    return;
+  }
+  offset_ += data.size();
+  if (offset_ == size_) {
+    Finish();
+  } else if (offset_ - acked_ >= kAckInterval) {
+    acked_ = offset_;
+    Json::Value ack;
+    ack[kOffsetField] = Json::UInt64(offset_);
+    Send("ack", ack);
+  }
+}
+
+void FileTransferHandler::Finish() {
+  file_ = SharedFD();
+  auto path = directory_ + "/" + name_;
+  // Only a previously received file is replaced, never something the guest
+  // put in its place.
+  struct stat st;
+  if (fstatat(directory_fd_.get(), name_.c_str(), &st, AT_SYMLINK_NOFOLLOW) ==
+          0 &&
+      !S_ISREG(st.st_mode)) {
+    Fail(path + " exists and is not a regular file");
+    return;
+  }
+  auto part_name = name_ + kPartSuffix;
+  if (renameat(directory_fd_.get(), part_name.c_str(), directory_fd_.get(),
+               name_.c_str()) != 0) {
+    Fail("Failed to rename the received file: " + std::string(strerror(errno)));
+    return;
+  }
+  LOG(INFO) << "Received " << path;
+  Json::Value done;
+  done[kSizeField] = Json::UInt64(size_);
+  Send("done", done);
+  name_.clear();
+}
+
+void FileTransferHandler::Fail(const std::string& error) {
+  LOG(ERROR) << "File transfer failed: " << error;
+  file_ = SharedFD();
+  Json::Value message;
+  message[kErrorField] = error;
+  Send("error", message);
+  name_.clear();
+}
+
+void FileTransferHandler::Send(const std::string& type, Json::Value message) {
+  message[kTypeField] = type;
+  message[kNameField] = name_;
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "";
+  send_to_client_(Json::writeString(builder, message));
+}
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <android-base/unique_fd.h>
+#include <json/json.h>
+
+#include "common/libs/fs/shared_fd.h"
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+
+// Writes the files pushed by a client on the file transfer channel into a
+// directory shared with the guest, one file at a time:
+//
+// client: {"type": "start", "name": <String>, "size": <Integer>}
+// device: {"type": "ready", "name": <String>, "offset": <Integer>}
+// client: the contents of the file from offset on, in binary messages
+// device: {"type": "ack", "name": <String>, "offset": <Integer>} every
+//         kAckInterval bytes written
+// device: {"type": "done", "name": <String>, "size": <Integer>}
+//
+// The client must not get more than kWindow bytes ahead of the last ack, which
+// bounds the memory used here while the disk is slower than the link.
+// Incomplete files are kept with a ".part" suffix and the offset in the ready
+// message tells where a transfer started again continues from. The client
+// may send {"type": "cancel"} to stop a transfer, the device replies to
+// anything going wrong with {"type": "error", "name": <String>,
+// "error": <String>} and drops the transfer.
+class FileTransferHandler
+    : public std::enable_shared_from_this<FileTransferHandler> {
+ public:
+  static constexpr std::uint64_t kAckInterval = 4 * 1024 * 1024;
+  static constexpr std::uint64_t kWindow = 16 * 1024 * 1024;
+
+  static std::shared_ptr<FileTransferHandler> Create(
+      std::string directory,
+      std::function<bool(const std::string&)> send_to_client);
+
+  // Only copies the message, it's handled on the writer thread.
+  void HandleMessage(const std::uint8_t* msg, std::size_t size, bool binary);
+  // Makes the writer thread exit without waiting for it, as it may be sending
+  // to the client through the thread calling this. The thread holds a
+  // reference to the handler until then.
+  void Stop();
+
+ private:
+  FileTransferHandler(std::string directory,
+                      std::function<bool(const std::string&)> send_to_client);
+
+  struct Message {
+    std::vector<char> data;
+    bool binary;
+  };
+
+  void Loop();
+  void HandleControl(const std::string& message);
+  void HandleData(const std::vector<char>& data);
+  void Start(const std::string& name, std::uint64_t size);
+  void Finish();
+  void Fail(const std::string& error);
+  void Send(const std::string& type, Json::Value message);
+
+  const std::string directory_;
+  std::function<bool(const std::string&)> send_to_client_;
+
+  std::mutex queue_mutex_;
+  std::condition_variable queue_cv_;
+  std::deque<Message> queue_;
+  bool stopping_ = false;
+
+  // Only used from the writer thread. The directory is shared with the guest,
+  // the files are opened and renamed relative to it without following links.
+  android::base::unique_fd directory_fd_;
+  SharedFD file_;
+  std::string name_;
+  std::uint64_t size_ = 0;
+  std::uint64_t offset_ = 0;
+  std::uint64_t acked_ = 0;
+};
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
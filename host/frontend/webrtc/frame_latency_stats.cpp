@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/frame_latency_stats.h"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+namespace cuttlefish {
+namespace {
+
+std::size_t BucketIndex(std::uint64_t latency_us) {
+  // Bucket i holds latencies in [2^(i-1), 2^i) microseconds.
+  const std::size_t index =
+      latency_us == 0 ? 0 : 64 - __builtin_clzll(latency_us);
+  return std::min(index, LatencyHistogram::kBucketCount - 1);
+}
+
+std::chrono::microseconds Elapsed(
+    ScreenConnectorFrameTimestamps::Clock::time_point from,
+    ScreenConnectorFrameTimestamps::Clock::time_point to) {
+  // Frames that skipped a stage, e.g. Confirmation UI ones, leave its
+  // timestamps unset.
+  if (from.time_since_epoch().count() == 0 || to < from) {
+    return std::chrono::microseconds::zero();
+  }
+  return std::chrono::duration_cast<std::chrono::microseconds>(to - from);
+}
+
+}  // namespace
+
+void LatencyHistogram::Record(std::chrono::microseconds latency) {
+  const std::uint64_t latency_us = std::max<std::int64_t>(latency.count(), 0);
+  buckets_[BucketIndex(latency_us)].fetch_add(1, std::memory_order_relaxed);
+  sum_us_.fetch_add(latency_us, std::memory_order_relaxed);
+  auto max_us = max_us_.load(std::memory_order_relaxed);
+  while (latency_us > max_us &&
+         !max_us_.compare_exchange_weak(max_us, latency_us,
+                                        std::memory_order_relaxed)) {
+  }
+}
+
+Json::Value LatencyHistogram::ToJson() const {
+  std::array<std::uint64_t, kBucketCount> buckets;
+  std::uint64_t count = 0;
+  for (std::size_t i = 0; i < kBucketCount; i++) {
+    buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+    count += buckets[i];
+  }
+
+  Json::Value json(Json::objectValue);
+  json["count"] = Json::UInt64(count);
+  json["mean_us"] =
+      count ? Json::UInt64(sum_us_.load(std::memory_order_relaxed) / count)
+            : Json::UInt64(0);
+  json["max_us"] = Json::UInt64(max_us_.load(std::memory_order_relaxed));
+
+  // Percentiles are reported as the upper bound of the bucket they fall in.
+  const std::pair<const char*, double> percentiles[] = {
+      {"p50_us", 0.5}, {"p90_us", 0.9}, {"p99_us", 0.99}};
+  for (const auto& [name, fraction] : percentiles) {
+    const std::uint64_t rank = count * fraction;
+    std::uint64_t seen = 0;
+    std::size_t i = 0;
+    for (; i < kBucketCount - 1; i++) {
+      seen += buckets[i];
+      if (seen > rank) {
+        break;
+      }
+    }
+    json[name] = count ? Json::UInt64(std::uint64_t{1} << i) : Json::UInt64(0);
+  }
+
+  Json::Value buckets_json(Json::objectValue);
+  for (std::size_t i = 0; i < kBucketCount; i++) {
+    if (buckets[i]) {
+      const std::string bound = i == kBucketCount - 1
+                                    ? "inf"
+                                    : std::to_string(std::uint64_t{1} << i);
+      buckets_json[bound] = Json::UInt64(buckets[i]);
+    }
+  }
+  json["buckets"] = buckets_json;
+  return json;
+}
+
+void FrameLatencyStats::RecordFrame(
+    const ScreenConnectorFrameTimestamps& timestamps,
+    ScreenConnectorFrameTimestamps::Clock::time_point popped,
+    ScreenConnectorFrameTimestamps::Clock::time_point delivered) {
+  wait_for_conversion_.Record(
+      Elapsed(timestamps.committed, timestamps.conversion_started));
+  conversion_.Record(
+      Elapsed(timestamps.conversion_started, timestamps.conversion_finished));
+  queue_dwell_.Record(Elapsed(timestamps.queued, popped));
+  handoff_.Record(Elapsed(popped, delivered));
+  total_.Record(Elapsed(timestamps.committed, delivered));
+}
+
+Json::Value FrameLatencyStats::ToJson() const {
+  Json::Value json(Json::objectValue);
+  json["wait_for_conversion"] = wait_for_conversion_.ToJson();
+  json["conversion"] = conversion_.ToJson();
+  json["queue_dwell"] = queue_dwell_.ToJson();
+  json["handoff"] = handoff_.ToJson();
+  json["total"] = total_.ToJson();
+  return json;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include <json/json.h>
+
+#include "host/libs/screen_connector/screen_connector_common.h"
+
+namespace cuttlefish {
+
+// Distribution of durations in power of two microsecond buckets. It can be
+// recorded into and read from different threads at the same time.
+class LatencyHistogram {
+ public:
+  // The last bucket collects everything longer than ~8 seconds.
+  static constexpr std::size_t kBucketCount = 24;
+
+  void Record(std::chrono::microseconds latency);
+
+  // Count, mean, max and approximate percentiles, all in microseconds, plus
+  // the bucket counts keyed by their exclusive upper bound.
+  Json::Value ToJson() const;
+
+ private:
+  std::array<std::atomic<std::uint64_t>, kBucketCount> buckets_{};
+  std::atomic<std::uint64_t> sum_us_{0};
+  std::atomic<std::uint64_t> max_us_{0};
+};
+
+// Where the time goes between the guest committing a frame and the streamer
+// handing it to WebRTC, where the encoder picks it up. What happens after
+// that is reported by the standard WebRTC stats on the client.
+class FrameLatencyStats {
+ public:
+  void RecordFrame(const ScreenConnectorFrameTimestamps& timestamps,
+                   ScreenConnectorFrameTimestamps::Clock::time_point popped,
+                   ScreenConnectorFrameTimestamps::Clock::time_point delivered);
+
+  Json::Value ToJson() const;
+
+ private:
+  // From the commit until the conversion to I420 starts
+  LatencyHistogram wait_for_conversion_;
+  LatencyHistogram conversion_;
+  // Time spent in the ScreenConnector queue until the streamer takes it
+  LatencyHistogram queue_dwell_;
+  // Delivery to the video track, its per viewer adaptation and the encoder
+  LatencyHistogram handoff_;
+  LatencyHistogram total_;
+};
+
+}  // namespace cuttlefish
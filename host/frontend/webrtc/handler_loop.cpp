@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/handler_loop.h"
+
+#include <future>
+#include <utility>
+
+#include <android-base/logging.h>
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+
+namespace {
+
+std::unique_ptr<Reactor> CreateReactor() {
+  auto reactor = Reactor::Create();
+  CHECK(reactor.ok()) << "Failed to create the event loop: "
+                      << reactor.error();
+  return std::move(*reactor);
+}
+
+}  // namespace
+
+HandlerLoop::HandlerLoop()
+    : reactor_(CreateReactor()), thread_([this]() {
+        auto ran = reactor_->Run();
+        // Nothing would forward the handlers' sockets anymore and callers of
+        // RunAndWait would never return, a silent stall is worse than a crash
+        CHECK(ran.ok()) << "Handler event loop failed: " << ran.error();
+      }) {}
+
+HandlerLoop::~HandlerLoop() {
+  reactor_->Stop();
+  thread_.join();
+}
+
+void HandlerLoop::Post(Reactor::Callback callback) {
+  reactor_->Defer(std::move(callback));
+}
+
+void HandlerLoop::RunAndWait(Reactor::Callback callback) {
+  if (std::this_thread::get_id() == thread_.get_id()) {
+    callback();
+    return;
+  }
+  std::promise<void> done;
+  reactor_->Defer([&callback, &done]() {
+    callback();
+    done.set_value();
+  });
+  done.get_future().wait();
+}
+
+std::shared_ptr<SocketForwarder> SocketForwarder::Start(
+    HandlerLoop& loop, SharedFD socket, size_t buffer_size,
+    std::function<bool(const uint8_t*, size_t)> send) {
+  std::shared_ptr<SocketForwarder> forwarder(
+      new SocketForwarder(loop, socket, buffer_size, std::move(send)));
+  loop.Post([forwarder]() { forwarder->StartWatching(); });
+  return forwarder;
+}
+
+SocketForwarder::SocketForwarder(
+    HandlerLoop& loop, SharedFD socket, size_t buffer_size,
+    std::function<bool(const uint8_t*, size_t)> send)
+    : loop_(loop),
+      socket_(socket),
+      send_(std::move(send)),
+      buffer_(buffer_size) {}
+
+void SocketForwarder::Resume() {
+  loop_.Post([self = shared_from_this()]() {
+    if (!self->paused_ || self->stopped_) {
+      return;
+    }
+    self->paused_ = false;
+    self->StartWatching();
+  });
+}
+
+void SocketForwarder::Stop() {
+  loop_.Post([self = shared_from_this()]() {
+    self->stopped_ = true;
+    self->StopWatching();
+  });
+}
+
+void SocketForwarder::OnReadable() {
+  auto read = socket_->Read(buffer_.data(), buffer_.size());
+  if (read < 0) {
+    LOG(ERROR) << "Error on reading from the socket: " << socket_->StrError();
+    StopWatching();
+    return;
+  }
+  if (read == 0) {
+    // Nothing more will come from the other side, wait for the shutdown
+    StopWatching();
+    return;
+  }
+  if (!send_(buffer_.data(), read)) {
+    // Leave the rest in the socket, the other side blocks once it's full
+    paused_ = true;
+    StopWatching();
+  }
+}
+
+void SocketForwarder::StartWatching() {
+  // The callback keeps this alive until it's removed
+  auto added = loop_.reactor().Add(
+      socket_, EPOLLIN,
+      [self = shared_from_this()](uint32_t) { self->OnReadable(); });
+  if (!added.ok()) {
+    LOG(ERROR) << "Failed to watch the socket: " << added.error();
+    return;
+  }
+  watching_ = true;
+}
+
+void SocketForwarder::StopWatching() {
+  if (!watching_) {
+    return;
+  }
+  auto removed = loop_.reactor().Remove(socket_);
+  if (!removed.ok()) {
+    LOG(ERROR) << "Failed to stop watching the socket: " << removed.error();
+  }
+  watching_ = false;
+}
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "common/libs/fs/reactor.h"
+#include "common/libs/fs/shared_fd.h"
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+
+// Runs a Reactor on a thread of its own, shared by the adb, bluetooth and
+// kernel log event handlers of every client instead of each of them running
+// its own thread.
+class HandlerLoop {
+ public:
+  HandlerLoop();
+  ~HandlerLoop();
+
+  // Only to be used from callbacks running on the loop.
+  Reactor& reactor() { return *reactor_; }
+
+  // Runs the callback on the loop without waiting for it.
+  void Post(Reactor::Callback callback);
+  // Runs the callback on the loop and waits for it to complete, runs it
+  // inline when called from the loop itself. Data channel sends block on the
+  // WebRTC signaling thread, so this must never be called from there.
+  void RunAndWait(Reactor::Callback callback);
+
+ private:
+  std::unique_ptr<Reactor> reactor_;
+  std::thread thread_;
+};
+
+// Forwards what is read from a socket to a client from the loop. None of its
+// methods wait for the loop, it stays alive until the loop is done with it.
+class SocketForwarder : public std::enable_shared_from_this<SocketForwarder> {
+ public:
+  // send returns false when the client can't take more data for now, nothing
+  // is read from the socket until Resume is called.
+  static std::shared_ptr<SocketForwarder> Start(
+      HandlerLoop& loop, SharedFD socket, size_t buffer_size,
+      std::function<bool(const uint8_t*, size_t)> send);
+
+  void Resume();
+  // No data is sent once the loop gets to this.
+  void Stop();
+
+ private:
+  SocketForwarder(HandlerLoop& loop, SharedFD socket, size_t buffer_size,
+                  std::function<bool(const uint8_t*, size_t)> send);
+
+  void OnReadable();
+  void StartWatching();
+  void StopWatching();
+
+  HandlerLoop& loop_;
+  SharedFD socket_;
+  std::function<bool(const uint8_t*, size_t)> send_;
+  // Only accessed from the loop
+  std::vector<uint8_t> buffer_;
+  bool watching_ = false;
+  bool paused_ = false;
+  bool stopped_ = false;
+};
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/input_replay_server.h"
+
+#include <android-base/logging.h>
+
+#include "common/libs/fs/shared_buf.h"
+
+namespace cuttlefish {
+
+InputReplayServer::InputReplayServer(SharedFD server,
+                                     InputSockets& input_sockets)
+    : server_(server), input_sockets_(input_sockets) {}
+
+void InputReplayServer::Loop() {
+  for (;;) {
+    auto client = SharedFD::Accept(*server_);
+    if (!client->IsOpen()) {
+      LOG(ERROR) << "Failed to accept input replay client: "
+                 << server_->StrError();
+      continue;
+    }
+    LOG(INFO) << "Replaying input";
+    {
+      std::lock_guard<std::mutex> lock(client_mutex_);
+      client_ = client;
+      client_start_ = std::chrono::steady_clock::now();
+    }
+    for (;;) {
+      auto record = ReadInputRecord(client);
+      if (!record.ok()) {
+        LOG(ERROR) << record.error();
+        break;
+      }
+      if (!*record) {
+        break;
+      }
+      Replay(**record);
+    }
+    {
+      std::lock_guard<std::mutex> lock(client_mutex_);
+      client_ = SharedFD();
+    }
+    LOG(INFO) << "Input replay client disconnected";
+  }
+}
+
+void InputReplayServer::OnFrameCommit() {
+  std::lock_guard<std::mutex> lock(client_mutex_);
+  if (!client_->IsOpen()) {
+    return;
+  }
+  InputRecord record{
+      .timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - client_start_),
+      .label = kFrameCommitLabel,
+  };
+  auto result = WriteInputRecord(client_, record);
+  if (!result.ok()) {
+    LOG(ERROR) << result.error();
+  }
+}
+
+void InputReplayServer::Replay(const InputRecord& record) {
+  SharedFD device;
+  if (record.label == kKeyboardInputLabel) {
+    device = input_sockets_.keyboard_client;
+  } else if (record.label == kSwitchesInputLabel) {
+    device = input_sockets_.switches_client;
+  } else if (input_sockets_.touch_clients.count(record.label)) {
+    device = input_sockets_.GetTouchClientByLabel(record.label);
+  } else {
+    LOG(WARNING) << "Ignoring input for unknown device: " << record.label;
+    return;
+  }
+  WriteAll(device, record.data);
+}
+
+}  // namespace cuttlefish
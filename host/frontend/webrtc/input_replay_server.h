@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <mutex>
+
+#include "common/libs/fs/shared_fd.h"
+#include "host/frontend/webrtc/connection_observer.h"
+#include "host/libs/input_recording/input_recording.h"
+
+namespace cuttlefish {
+
+// Takes input records from the input_replay tool and writes them to the
+// devices' input sockets as if they came from a client. Frame commits are sent
+// back to the tool so it can keep the input in sync with the displays.
+class InputReplayServer {
+ public:
+  InputReplayServer(SharedFD server, InputSockets& input_sockets);
+
+  // Serves one client at a time
+  [[noreturn]] void Loop();
+  void OnFrameCommit();
+
+ private:
+  void Replay(const InputRecord& record);
+
+  SharedFD server_;
+  InputSockets& input_sockets_;
+  std::mutex client_mutex_;
+  SharedFD client_;
+  std::chrono::steady_clock::time_point client_start_;
+};
+
+}  // namespace cuttlefish
@@ -16,9 +16,10 @@
 
 #include "host/frontend/webrtc/kernel_log_events_handler.h"
 
+#include <utility>
+
 #include <android-base/logging.h>
 
-#include <common/libs/fs/shared_select.h>
 #include <host/commands/kernel_log_monitor/kernel_log_server.h>
 #include <host/commands/kernel_log_monitor/utils.h>
 #include <host/libs/config/cuttlefish_config.h>
@@ -28,90 +29,97 @@ using namespace android;
 namespace cuttlefish {
 
 KernelLogEventsHandler::KernelLogEventsHandler(
-    SharedFD kernel_log_fd)
-    : kernel_log_fd_(kernel_log_fd),
-      eventfd_(SharedFD::Event()),
-      running_(true),
-      read_thread_([this]() { ReadLoop(); }) {}
+    webrtc_streaming::HandlerLoop& loop, SharedFD kernel_log_fd)
+    : loop_(loop), kernel_log_fd_(kernel_log_fd) {
+  loop_.RunAndWait([this]() {
+    auto added = loop_.reactor().Add(
+        kernel_log_fd_, EPOLLIN, [this](uint32_t) { HandleKernelLogEvent(); });
+    if (!added.ok()) {
+      LOG(ERROR) << "Failed to watch the kernel log: " << added.error();
+      return;
+    }
+    watching_ = true;
+  });
+}
 
 KernelLogEventsHandler::~KernelLogEventsHandler() {
-  running_ = false;
-  eventfd_->EventfdWrite(1);
-  read_thread_.join();
+  // There won't be anyone listening for kernel log events once this is
+  // destroyed, so pending ones are left unread.
+  loop_.RunAndWait([this]() { StopWatching(); });
 }
 
-void KernelLogEventsHandler::ReadLoop() {
-  CHECK(eventfd_->IsOpen()) << "Failed to create event fd: "
-                           << eventfd_->StrError();
-  while (running_) {
-    SharedFDSet read_set;
-    read_set.Set(eventfd_);
-    read_set.Set(kernel_log_fd_);
-    auto select_ret = Select(&read_set, nullptr, nullptr, nullptr);
-    if (select_ret < 0) {
-      LOG(ERROR) << "Error on select call";
-      break;
-    }
-    if (read_set.IsSet(eventfd_)) {
-      eventfd_t evt;
-      (void)eventfd_->EventfdRead(&evt);
-      if (!running_) {
-        // There won't be anyone listening for kernel log events if the thread
-        // was asked to stop, so break out of the loop without reading.
-        break;
-      }
-    }
-    if (read_set.IsSet(kernel_log_fd_)) {
-      std::optional<monitor::ReadEventResult> read_result =
-          monitor::ReadEvent(kernel_log_fd_);
-      if (!read_result) {
-        LOG(ERROR) << "Failed to read kernel log event: "
-                   << kernel_log_fd_->StrError();
-        break;
-      }
+void KernelLogEventsHandler::StopWatching() {
+  if (!watching_) {
+    return;
+  }
+  auto removed = loop_.reactor().Remove(kernel_log_fd_);
+  if (!removed.ok()) {
+    LOG(ERROR) << "Failed to stop watching the kernel log: " << removed.error();
+  }
+  watching_ = false;
+}
 
-      if (read_result->event == monitor::Event::BootStarted) {
-        Json::Value message;
-        message["event"] = kBootStartedMessage;
-        DeliverEvent(message);
-      }
-      if (read_result->event == monitor::Event::BootCompleted) {
-        Json::Value message;
-        message["event"] = kBootCompletedMessage;
-        DeliverEvent(message);
-      }
-      if (read_result->event == monitor::Event::ScreenChanged) {
-        Json::Value message;
-        message["event"] = kScreenChangedMessage;
-        message["metadata"] = read_result->metadata;
-        DeliverEvent(message);
-      }
-      if (read_result->event == monitor::Event::DisplayPowerModeChanged) {
-        Json::Value message;
-        message["event"] = kDisplayPowerModeChangedMessage;
-        message["metadata"] = read_result->metadata;
-        DeliverEvent(message);
-      }
-    }
+void KernelLogEventsHandler::HandleKernelLogEvent() {
+  std::optional<monitor::ReadEventResult> read_result =
+      monitor::ReadEvent(kernel_log_fd_);
+  if (!read_result) {
+    LOG(ERROR) << "Failed to read kernel log event: "
+               << kernel_log_fd_->StrError();
+    StopWatching();
+    return;
+  }
+
+  if (read_result->event == monitor::Event::BootStarted) {
+    Json::Value message;
+    message["event"] = kBootStartedMessage;
+    // Events from before a reboot are no use to new subscribers
+    boot_events_.clear();
+    DeliverEvent(message, /*boot_event=*/true);
+  }
+  if (read_result->event == monitor::Event::BootCompleted) {
+    Json::Value message;
+    message["event"] = kBootCompletedMessage;
+    DeliverEvent(message, /*boot_event=*/true);
+  }
+  if (read_result->event == monitor::Event::ScreenChanged) {
+    Json::Value message;
+    message["event"] = kScreenChangedMessage;
+    message["metadata"] = read_result->metadata;
+    DeliverEvent(message, /*boot_event=*/false);
+  }
+  if (read_result->event == monitor::Event::DisplayPowerModeChanged) {
+    Json::Value message;
+    message["event"] = kDisplayPowerModeChangedMessage;
+    message["metadata"] = read_result->metadata;
+    DeliverEvent(message, /*boot_event=*/false);
   }
 }
 
-int KernelLogEventsHandler::AddSubscriber(
-    std::function<void(const Json::Value&)> subscriber) {
-  std::lock_guard<std::mutex> lock(subscribers_mtx_);
-  subscribers_[++last_subscriber_id_] = subscriber;
-  return last_subscriber_id_;
+int KernelLogEventsHandler::AddSubscriber(Subscriber subscriber) {
+  int id = ++last_subscriber_id_;
+  loop_.Post([this, id, subscriber = std::move(subscriber)]() {
+    for (const auto& event : boot_events_) {
+      subscriber(event);
+    }
+    subscribers_[id] = subscriber;
+  });
+  return id;
 }
 
 void KernelLogEventsHandler::Unsubscribe(int subscriber_id) {
-  std::lock_guard<std::mutex> lock(subscribers_mtx_);
-  subscribers_.erase(subscriber_id);
+  loop_.Post([this, subscriber_id]() { subscribers_.erase(subscriber_id); });
 }
 
-void KernelLogEventsHandler::DeliverEvent(const Json::Value& event) {
-  std::lock_guard<std::mutex> lock(subscribers_mtx_);
-  for (const auto& entry : subscribers_) {
-    entry.second(event);
+void KernelLogEventsHandler::DeliverEvent(const Json::Value& event,
+                                          bool boot_event) {
+  Json::StreamWriterBuilder factory;
+  factory["indentation"] = "";
+  auto serialized = Json::writeString(factory, event);
+  if (boot_event) {
+    boot_events_.push_back(serialized);
+  }
+  for (const auto& [id, subscriber] : subscribers_) {
+    subscriber(serialized);
   }
 }
 
@@ -17,36 +17,45 @@
 #pragma once
 
 #include <atomic>
-#include <memory>
-#include <mutex>
-#include <thread>
+#include <functional>
 #include <map>
+#include <string>
+#include <vector>
 
 #include <json/json.h>
 
 #include "common/libs/fs/shared_fd.h"
+#include "host/frontend/webrtc/handler_loop.h"
 
 namespace cuttlefish {
 
-// Listen to kernel log events and report them to clients.
+// Listen to kernel log events and report them to clients. Each event is
+// serialized to JSON once and the same string is handed to every subscriber.
 struct KernelLogEventsHandler {
-  explicit KernelLogEventsHandler(SharedFD kernel_log_fd);
+  using Subscriber = std::function<void(const std::string& serialized_event)>;
+
+  KernelLogEventsHandler(webrtc_streaming::HandlerLoop& loop,
+                         SharedFD kernel_log_fd);
 
   ~KernelLogEventsHandler();
 
-  int AddSubscriber(std::function<void(const Json::Value&)> subscriber);
+  // New subscribers first get the events of the current boot. Neither
+  // function waits for the loop, subscribers may still be called shortly
+  // after Unsubscribe returns.
+  int AddSubscriber(Subscriber subscriber);
   void Unsubscribe(int subscriber_id);
  private:
-  void ReadLoop();
-  void DeliverEvent(const Json::Value& event);
+  void HandleKernelLogEvent();
+  void StopWatching();
+  void DeliverEvent(const Json::Value& event, bool boot_event);
 
+  webrtc_streaming::HandlerLoop& loop_;
   SharedFD kernel_log_fd_;
-  SharedFD eventfd_;
-  std::atomic<bool> running_;
-  std::thread read_thread_;
-  std::map<int, std::function<void(const Json::Value&)>> subscribers_;
-  int last_subscriber_id_ = 0;
-  std::mutex subscribers_mtx_;
+  std::atomic<int> last_subscriber_id_ = 0;
+  // Only accessed from the loop
+  bool watching_ = false;
+  std::map<int, Subscriber> subscribers_;
+  std::vector<std::string> boot_events_;
 };
 
 }  // namespace cuttlefish
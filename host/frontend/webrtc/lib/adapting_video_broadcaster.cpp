@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/lib/adapting_video_broadcaster.h"
+
+#include <map>
+#include <utility>
+
+#include <api/video/i420_buffer.h>
+#include <rtc_base/time_utils.h>
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+
+void AdaptingVideoBroadcaster::AddOrUpdateSink(
+    rtc::VideoSinkInterface<webrtc::VideoFrame>* sink,
+    const rtc::VideoSinkWants& wants) {
+  std::lock_guard<std::mutex> lock(sinks_mutex_);
+  for (auto& state : sinks_) {
+    if (state->sink == sink) {
+      state->adapter.OnSinkWants(wants);
+      return;
+    }
+  }
+  auto state = std::make_unique<SinkState>();
+  state->sink = sink;
+  state->adapter.OnSinkWants(wants);
+  sinks_.push_back(std::move(state));
+}
+
+void AdaptingVideoBroadcaster::RemoveSink(
+    rtc::VideoSinkInterface<webrtc::VideoFrame>* sink) {
+  std::lock_guard<std::mutex> lock(sinks_mutex_);
+  for (auto it = sinks_.begin(); it != sinks_.end(); ++it) {
+    if ((*it)->sink == sink) {
+      sinks_.erase(it);
+      return;
+    }
+  }
+}
+
+void AdaptingVideoBroadcaster::OnFrame(const webrtc::VideoFrame& frame) {
+  std::lock_guard<std::mutex> lock(sinks_mutex_);
+  // Viewers with the same constraints share the scaled frame.
+  std::map<std::pair<int, int>, rtc::scoped_refptr<webrtc::VideoFrameBuffer>>
+      scaled_buffers;
+  const int64_t timestamp_ns =
+      frame.timestamp_us() * rtc::kNumNanosecsPerMicrosec;
+  for (auto& state : sinks_) {
+    int cropped_width = 0;
+    int cropped_height = 0;
+    int out_width = 0;
+    int out_height = 0;
+    if (!state->adapter.AdaptFrameResolution(
+            frame.width(), frame.height(), timestamp_ns, &cropped_width,
+            &cropped_height, &out_width, &out_height)) {
+      // Above this sink's frame rate cap.
+      continue;
+    }
+    if (out_width == frame.width() && out_height == frame.height()) {
+      state->sink->OnFrame(frame);
+      continue;
+    }
+    auto& scaled = scaled_buffers[{out_width, out_height}];
+    if (!scaled) {
+      auto source = frame.video_frame_buffer()->ToI420();
+      auto buffer = webrtc::I420Buffer::Create(out_width, out_height);
+      buffer->CropAndScaleFrom(*source, (frame.width() - cropped_width) / 2,
+                               (frame.height() - cropped_height) / 2,
+                               cropped_width, cropped_height);
+      scaled = buffer;
+    }
+    auto adapted_frame = webrtc::VideoFrame::Builder()
+                             .set_video_frame_buffer(scaled)
+                             .set_timestamp_us(frame.timestamp_us())
+                             .set_rotation(frame.rotation())
+                             .set_id(frame.id())
+                             .build();
+    state->sink->OnFrame(adapted_frame);
+  }
+}
+
+int AdaptingVideoBroadcaster::SinkCount() const {
+  std::lock_guard<std::mutex> lock(sinks_mutex_);
+  return sinks_.size();
+}
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <api/video/video_frame.h>
+#include <api/video/video_sink_interface.h>
+#include <api/video/video_source_interface.h>
+#include <media/base/video_adapter.h>
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+
+// Distributes frames to several sinks, adapting them for each sink according
+// to its wants.
+//
+// Every peer connection's encoder registers a sink whose wants reflect its
+// bandwidth estimate and CPU usage. rtc::VideoBroadcaster would only report
+// the most restrictive wants of all sinks back to the source, making every
+// viewer pay for the slowest one while still leaving the adaptation to the
+// source. Here each sink gets its own frame rate cap and resolution, and
+// frames are scaled on the host before reaching the encoder, once per distinct
+// output resolution.
+class AdaptingVideoBroadcaster
+    : public rtc::VideoSourceInterface<webrtc::VideoFrame> {
+ public:
+  AdaptingVideoBroadcaster() = default;
+  ~AdaptingVideoBroadcaster() override = default;
+
+  void AddOrUpdateSink(rtc::VideoSinkInterface<webrtc::VideoFrame>* sink,
+                       const rtc::VideoSinkWants& wants) override;
+  void RemoveSink(rtc::VideoSinkInterface<webrtc::VideoFrame>* sink) override;
+
+  void OnFrame(const webrtc::VideoFrame& frame);
+
+  int SinkCount() const;
+
+ private:
+  struct SinkState {
+    rtc::VideoSinkInterface<webrtc::VideoFrame>* sink;
+    cricket::VideoAdapter adapter;
+  };
+
+  mutable std::mutex sinks_mutex_;
+  std::vector<std::unique_ptr<SinkState>> sinks_;
+};
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
@@ -0,0 +1,363 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/lib/batched_udp_socket.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include <android-base/logging.h>
+#include <rtc_base/time_utils.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+
+namespace {
+
+// Packets queued before a flush is forced, also the most messages sent at once
+constexpr std::size_t kMaxQueuedPackets = 64;
+// Limits of a segmented message, the kernel refuses more than 64 segments
+// and the whole message must fit in a UDP datagram.
+constexpr std::size_t kMaxSegments = 64;
+constexpr std::size_t kMaxSegmentedBytes = 60000;
+constexpr std::size_t kReceiveBatch = 16;
+// RTP packets are kept under the MTU, anything larger is dropped
+constexpr std::size_t kMaxDatagramSize = 2048;
+
+struct {
+  std::atomic<std::uint64_t> packets_sent;
+  std::atomic<std::uint64_t> send_calls;
+  std::atomic<std::uint64_t> segmented_packets;
+  std::atomic<std::uint64_t> packets_dropped;
+  std::atomic<std::uint64_t> packets_received;
+  std::atomic<std::uint64_t> receive_calls;
+} stats;
+
+}  // namespace
+
+UdpBatchingStats GetUdpBatchingStats() {
+  return {
+      .packets_sent = stats.packets_sent.load(std::memory_order_relaxed),
+      .send_calls = stats.send_calls.load(std::memory_order_relaxed),
+      .segmented_packets =
+          stats.segmented_packets.load(std::memory_order_relaxed),
+      .packets_dropped = stats.packets_dropped.load(std::memory_order_relaxed),
+      .packets_received =
+          stats.packets_received.load(std::memory_order_relaxed),
+      .receive_calls = stats.receive_calls.load(std::memory_order_relaxed),
+  };
+}
+
+BatchedUdpSocket::BatchedUdpSocket(rtc::Thread* thread,
+                                   rtc::AsyncSocket* socket, int fd)
+    : thread_(thread),
+      socket_(socket),
+      fd_(fd),
+      receive_buffer_((kReceiveBatch + 1) * kMaxDatagramSize) {
+  // Only probes for support, 0 leaves the messages unsegmented by default
+  int segment_size = 0;
+  segmentation_supported_ = setsockopt(fd_, SOL_UDP, UDP_SEGMENT,
+                                       &segment_size,
+                                       sizeof(segment_size)) == 0;
+  queue_.reserve(kMaxQueuedPackets);
+  socket_->SignalReadEvent.connect(this, &BatchedUdpSocket::OnReadEvent);
+  socket_->SignalWriteEvent.connect(this, &BatchedUdpSocket::OnWriteEvent);
+}
+
+BatchedUdpSocket::~BatchedUdpSocket() {
+  // Sends what it can without signaling anyone at this point
+  std::size_t sent = 0;
+  while (sent < queued_ && !write_blocked_) {
+    sent += SendBatch(sent);
+  }
+  stats.packets_dropped.fetch_add(queued_ - sent, std::memory_order_relaxed);
+}
+
+rtc::SocketAddress BatchedUdpSocket::GetLocalAddress() const {
+  return socket_->GetLocalAddress();
+}
+
+rtc::SocketAddress BatchedUdpSocket::GetRemoteAddress() const {
+  return socket_->GetRemoteAddress();
+}
+
+int BatchedUdpSocket::Send(const void*, size_t, const rtc::PacketOptions&) {
+  // libwebrtc only sends to explicit addresses on UDP sockets
+  SetError(ENOTCONN);
+  return -1;
+}
+
+int BatchedUdpSocket::SendTo(const void* pv, size_t cb,
+                             const rtc::SocketAddress& addr,
+                             const rtc::PacketOptions& options) {
+  if (write_blocked_) {
+    // Lets the pacer hold the packets back until OnWriteEvent()
+    SetError(EWOULDBLOCK);
+    return -1;
+  }
+  if (queued_ == queue_.size()) {
+    queue_.emplace_back();
+  }
+  auto& packet = queue_[queued_];
+  packet.address_length = addr.ToSockAddrStorage(&packet.address);
+  if (packet.address_length == 0) {
+    SetError(EINVAL);
+    return -1;
+  }
+  auto data = static_cast<const char*>(pv);
+  packet.data.assign(data, data + cb);
+  packet.sent_packet =
+      rtc::SentPacket(options.packet_id, -1, options.info_signaled_after_sent);
+  rtc::CopySocketInformationToPacketInfo(cb, *this, true,
+                                         &packet.sent_packet.info);
+  queued_++;
+
+  if (queued_ >= kMaxQueuedPackets) {
+    Flush();
+  } else if (!flush_posted_) {
+    // Runs once the network thread is done with the current burst
+    flush_posted_ = true;
+    thread_->PostTask(RTC_FROM_HERE,
+                      [this, alive = std::weak_ptr<bool>(alive_)]() {
+                        if (alive.lock()) {
+                          flush_posted_ = false;
+                          Flush();
+                        }
+                      });
+  }
+  return static_cast<int>(cb);
+}
+
+void BatchedUdpSocket::Flush() {
+  std::size_t sent = 0;
+  while (sent < queued_ && !write_blocked_) {
+    sent += SendBatch(sent);
+  }
+  // Copied out, the handlers may send more packets
+  std::vector<rtc::SentPacket> sent_packets;
+  sent_packets.reserve(sent);
+  const int64_t now = rtc::TimeMillis();
+  for (std::size_t i = 0; i < sent; i++) {
+    sent_packets.push_back(queue_[i].sent_packet);
+    sent_packets.back().send_time_ms = now;
+  }
+  // The packets left wait for the socket to be writable, in order
+  std::rotate(queue_.begin(), queue_.begin() + sent, queue_.begin() + queued_);
+  queued_ -= sent;
+  for (const auto& sent_packet : sent_packets) {
+    SignalSentPacket(this, sent_packet);
+  }
+}
+
+std::size_t BatchedUdpSocket::SendBatch(std::size_t first) {
+  mmsghdr messages[kMaxQueuedPackets] = {};
+  iovec iovs[kMaxQueuedPackets];
+  alignas(cmsghdr) char controls[kMaxQueuedPackets]
+                                [CMSG_SPACE(sizeof(std::uint16_t))] = {};
+  std::size_t message_packets[kMaxQueuedPackets];
+  std::size_t message_count = 0;
+
+  std::size_t packet = first;
+  while (packet < queued_ && message_count < kMaxQueuedPackets) {
+    const auto& head = queue_[packet];
+    const std::size_t segment_size = head.data.size();
+    std::size_t end = packet + 1;
+    std::size_t bytes = segment_size;
+    // Every segment but the last must be of the same size
+    while (segmentation_supported_ && end < queued_ &&
+           end - packet < kMaxSegments) {
+      const auto& next = queue_[end];
+      const std::size_t size = next.data.size();
+      if (size > segment_size || bytes + size > kMaxSegmentedBytes ||
+          next.address_length != head.address_length ||
+          std::memcmp(&next.address, &head.address, head.address_length)) {
+        break;
+      }
+      bytes += size;
+      end++;
+      if (size < segment_size) {
+        break;
+      }
+    }
+    for (std::size_t i = packet; i < end; i++) {
+      iovs[i - first].iov_base = queue_[i].data.data();
+      iovs[i - first].iov_len = queue_[i].data.size();
+    }
+    auto& header = messages[message_count].msg_hdr;
+    header.msg_name = const_cast<sockaddr_storage*>(&head.address);
+    header.msg_namelen = head.address_length;
+    header.msg_iov = &iovs[packet - first];
+    header.msg_iovlen = end - packet;
+    if (end - packet > 1) {
+      header.msg_control = controls[message_count];
+      header.msg_controllen = sizeof(controls[message_count]);
+      auto cmsg = CMSG_FIRSTHDR(&header);
+      cmsg->cmsg_level = SOL_UDP;
+      cmsg->cmsg_type = UDP_SEGMENT;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(std::uint16_t));
+      std::uint16_t size = segment_size;
+      std::memcpy(CMSG_DATA(cmsg), &size, sizeof(size));
+    }
+    message_packets[message_count++] = end - packet;
+    packet = end;
+  }
+
+  int sent;
+  do {
+    sent = sendmmsg(fd_, messages, message_count, 0);
+  } while (sent < 0 && errno == EINTR);
+  stats.send_calls.fetch_add(1, std::memory_order_relaxed);
+
+  if (sent <= 0) {
+    int error_num = sent < 0 ? errno : EAGAIN;
+    if (error_num == EAGAIN || error_num == EWOULDBLOCK) {
+      // sendmmsg bypasses the socket server, which only waits for the socket
+      // to be writable after one of its own sends would block.
+      if (SendThroughSocket(queue_[first]) >= 0) {
+        return 1;
+      }
+      error_num = GetError();
+      if (error_num == EAGAIN || error_num == EWOULDBLOCK) {
+        write_blocked_ = true;
+        return 0;
+      }
+    } else if (message_packets[0] > 1 &&
+               (error_num == EIO || error_num == EINVAL)) {
+      // The kernel or the route can't segment these, the packets are sent
+      // again one by one.
+      LOG(WARNING) << "UDP segmentation failed, disabling it: "
+                   << strerror(error_num);
+      segmentation_supported_ = false;
+      return 0;
+    }
+    SetError(error_num);
+    // Nothing can be done about the packets of the failed message, like with
+    // any lost UDP packet. The ones after it are attempted again.
+    std::size_t dropped = message_packets[0];
+    stats.packets_dropped.fetch_add(dropped, std::memory_order_relaxed);
+    return dropped;
+  }
+  std::size_t covered = 0;
+  for (int i = 0; i < sent; i++) {
+    covered += message_packets[i];
+    if (message_packets[i] > 1) {
+      stats.segmented_packets.fetch_add(message_packets[i],
+                                        std::memory_order_relaxed);
+    }
+  }
+  stats.packets_sent.fetch_add(covered, std::memory_order_relaxed);
+  return covered;
+}
+
+int BatchedUdpSocket::SendThroughSocket(const QueuedPacket& packet) {
+  rtc::SocketAddress address;
+  rtc::SocketAddressFromSockAddrStorage(packet.address, &address);
+  int sent = socket_->SendTo(packet.data.data(), packet.data.size(), address);
+  stats.send_calls.fetch_add(1, std::memory_order_relaxed);
+  if (sent >= 0) {
+    stats.packets_sent.fetch_add(1, std::memory_order_relaxed);
+  }
+  return sent;
+}
+
+int BatchedUdpSocket::Close() {
+  Flush();
+  // Whatever is still waiting for the socket to be writable is lost
+  stats.packets_dropped.fetch_add(queued_, std::memory_order_relaxed);
+  queued_ = 0;
+  return socket_->Close();
+}
+
+rtc::AsyncPacketSocket::State BatchedUdpSocket::GetState() const {
+  return STATE_BOUND;
+}
+
+int BatchedUdpSocket::GetOption(rtc::Socket::Option opt, int* value) {
+  return socket_->GetOption(opt, value);
+}
+
+int BatchedUdpSocket::SetOption(rtc::Socket::Option opt, int value) {
+  return socket_->SetOption(opt, value);
+}
+
+int BatchedUdpSocket::GetError() const { return socket_->GetError(); }
+
+void BatchedUdpSocket::SetError(int error) { socket_->SetError(error); }
+
+void BatchedUdpSocket::OnReadEvent(rtc::AsyncSocket*) {
+  mmsghdr messages[kReceiveBatch] = {};
+  iovec iovs[kReceiveBatch];
+  sockaddr_storage addresses[kReceiveBatch];
+  for (std::size_t i = 0; i < kReceiveBatch; i++) {
+    iovs[i].iov_base = receive_buffer_.data() + i * kMaxDatagramSize;
+    iovs[i].iov_len = kMaxDatagramSize;
+    messages[i].msg_hdr.msg_name = &addresses[i];
+    messages[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+    messages[i].msg_hdr.msg_iov = &iovs[i];
+    messages[i].msg_hdr.msg_iovlen = 1;
+  }
+  int received = recvmmsg(fd_, messages, kReceiveBatch, MSG_DONTWAIT, nullptr);
+  stats.receive_calls.fetch_add(1, std::memory_order_relaxed);
+  const int64_t now = rtc::TimeMicros();
+  for (int i = 0; i < received; i++) {
+    if (messages[i].msg_hdr.msg_flags & MSG_TRUNC) {
+      continue;
+    }
+    rtc::SocketAddress remote_address;
+    rtc::SocketAddressFromSockAddrStorage(addresses[i], &remote_address);
+    SignalReadPacket(this, static_cast<const char*>(iovs[i].iov_base),
+                     messages[i].msg_len, remote_address, now);
+  }
+  if (received > 0) {
+    stats.packets_received.fetch_add(received, std::memory_order_relaxed);
+  }
+
+  // The socket server only watches the socket again after it is read through
+  // it, which usually finds nothing left.
+  char* last = receive_buffer_.data() + kReceiveBatch * kMaxDatagramSize;
+  rtc::SocketAddress remote_address;
+  int64_t timestamp = -1;
+  int length =
+      socket_->RecvFrom(last, kMaxDatagramSize, &remote_address, &timestamp);
+  stats.receive_calls.fetch_add(1, std::memory_order_relaxed);
+  if (length >= 0) {
+    stats.packets_received.fetch_add(1, std::memory_order_relaxed);
+    SignalReadPacket(this, last, length, remote_address,
+                     timestamp > -1 ? timestamp : now);
+  }
+}
+
+void BatchedUdpSocket::OnWriteEvent(rtc::AsyncSocket*) {
+  write_blocked_ = false;
+  Flush();
+  if (!write_blocked_) {
+    SignalReadyToSend(this);
+  }
+}
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/socket.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <rtc_base/async_packet_socket.h>
+#include <rtc_base/async_socket.h>
+#include <rtc_base/thread.h>
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+
+// Packets and system calls of the batched UDP sockets, process wide.
+struct UdpBatchingStats {
+  std::uint64_t packets_sent;
+  std::uint64_t send_calls;
+  // Packets sent as segments of a larger message with UDP_SEGMENT
+  std::uint64_t segmented_packets;
+  // Packets that couldn't be sent because of errors other than a full socket
+  // buffer, or that were still queued when the socket was closed
+  std::uint64_t packets_dropped;
+  std::uint64_t packets_received;
+  std::uint64_t receive_calls;
+};
+
+UdpBatchingStats GetUdpBatchingStats();
+
+// A UDP socket for libwebrtc that sends and receives several packets per
+// system call. The pacer sends the packets of a frame in a burst, SendTo()
+// queues them and they are flushed with a single sendmmsg once the network
+// thread is done with the burst. Consecutive packets of the same size to the
+// same address, as those of a video frame mostly are, are sent as a single
+// message segmented by the kernel (UDP_SEGMENT) when it supports it.
+// When the socket buffer is full the packets left stay queued until the socket
+// is writable again, and SendTo() fails with EWOULDBLOCK meanwhile.
+// Packets are received with recvmmsg.
+//
+// Must be used from the thread of the socket server that created the socket,
+// like any other libwebrtc socket.
+class BatchedUdpSocket : public rtc::AsyncPacketSocket {
+ public:
+  // Takes a bound socket of the physical socket server along with its file
+  // descriptor.
+  BatchedUdpSocket(rtc::Thread* thread, rtc::AsyncSocket* socket, int fd);
+  ~BatchedUdpSocket() override;
+
+  rtc::SocketAddress GetLocalAddress() const override;
+  rtc::SocketAddress GetRemoteAddress() const override;
+  int Send(const void* pv, size_t cb,
+           const rtc::PacketOptions& options) override;
+  int SendTo(const void* pv, size_t cb, const rtc::SocketAddress& addr,
+             const rtc::PacketOptions& options) override;
+  int Close() override;
+  State GetState() const override;
+  int GetOption(rtc::Socket::Option opt, int* value) override;
+  int SetOption(rtc::Socket::Option opt, int value) override;
+  int GetError() const override;
+  void SetError(int error) override;
+
+ private:
+  struct QueuedPacket {
+    std::vector<char> data;
+    sockaddr_storage address;
+    socklen_t address_length;
+    rtc::SentPacket sent_packet;
+  };
+
+  void Flush();
+  // Sends a batch of messages made of the queued packets starting at `first`,
+  // returns how many packets were sent or dropped. Sets write_blocked_ when
+  // the socket buffer is full.
+  std::size_t SendBatch(std::size_t first);
+  // Sends a single packet through the socket server, which watches for the
+  // socket to be writable again if it can't be sent.
+  int SendThroughSocket(const QueuedPacket& packet);
+  void OnReadEvent(rtc::AsyncSocket* socket);
+  void OnWriteEvent(rtc::AsyncSocket* socket);
+
+  rtc::Thread* thread_;
+  std::unique_ptr<rtc::AsyncSocket> socket_;
+  int fd_;
+  bool segmentation_supported_;
+  // Only the first queued_ entries are in use, the rest keep their memory
+  std::vector<QueuedPacket> queue_;
+  std::size_t queued_ = 0;
+  bool flush_posted_ = false;
+  // Until the socket server signals the socket is writable again
+  bool write_blocked_ = false;
+  // Dropped when the socket goes away, cancelling posted flushes
+  std::shared_ptr<bool> alive_ = std::make_shared<bool>(true);
+  std::vector<char> receive_buffer_;
+};
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/lib/camera_group.h"
+
+#include <android-base/logging.h>
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+namespace {
+
+constexpr auto kCameraIdKey = "camera_id";
+constexpr auto kEventKey = "event";
+constexpr auto kMessageCapture = "VIRTUAL_DEVICE_CAPTURE_IMAGE";
+
+}  // namespace
+
+void CameraGroup::AddCamera(CameraController* camera) {
+  cameras_.push_back(camera);
+  if (message_sender_) {
+    SetMessageSender(message_sender_);
+  }
+}
+
+void CameraGroup::HandleMessage(const std::vector<char>& message) {
+  auto index = capturing_camera_.load();
+  if (index < cameras_.size()) {
+    cameras_[index]->HandleMessage(message);
+  }
+}
+
+void CameraGroup::HandleMessage(const Json::Value& message) {
+  auto index = message.get(kCameraIdKey, 0).asUInt();
+  if (index >= cameras_.size()) {
+    LOG(WARNING) << "Message for unknown camera " << index;
+    return;
+  }
+  cameras_[index]->HandleMessage(message);
+}
+
+void CameraGroup::SetMessageSender(
+    std::function<bool(const Json::Value& msg)> sender) {
+  message_sender_ = sender;
+  for (std::size_t index = 0; index < cameras_.size(); index++) {
+    cameras_[index]->SetMessageSender(
+        [this, index, sender](const Json::Value& msg) {
+          if (msg.get(kEventKey, "").asString() == kMessageCapture) {
+            capturing_camera_ = index;
+          }
+          if (!sender) {
+            return false;
+          }
+          Json::Value tagged = msg;
+          tagged[kCameraIdKey] = Json::UInt(index);
+          return sender(tagged);
+        });
+  }
+}
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
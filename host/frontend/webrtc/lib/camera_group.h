@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#include <json/json.h>
+
+#include "host/frontend/webrtc/lib/camera_controller.h"
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+
+// Multiplexes the camera control channel of a client among the cameras of the
+// device. Control messages carry the index of their camera in "camera_id",
+// zero when missing, and the messages from the cameras get it added. Binary
+// data, the pictures the client takes when asked to, goes to the camera that
+// asked last.
+class CameraGroup : public CameraController {
+ public:
+  // The cameras must outlive the group.
+  void AddCamera(CameraController* camera);
+
+  void HandleMessage(const std::vector<char>& message) override;
+  void HandleMessage(const Json::Value& message) override;
+  void SetMessageSender(
+      std::function<bool(const Json::Value& msg)> sender) override;
+
+ private:
+  std::vector<CameraController*> cameras_;
+  std::atomic<std::size_t> capturing_camera_ = 0;
+};
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
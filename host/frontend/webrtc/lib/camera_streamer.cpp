@@ -16,21 +16,59 @@
 #include "camera_streamer.h"
 
 #include <android-base/logging.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <algorithm>
 #include <chrono>
+#include <cstring>
 #include "common/libs/utils/vsock_connection.h"
+#include "host/frontend/webrtc/lib/jpeg_encoder.h"
 
 namespace cuttlefish {
 namespace webrtc_streaming {
+namespace {
 
-CameraStreamer::CameraStreamer(unsigned int port, unsigned int cid)
-    : cid_(cid), port_(port), camera_session_active_(false) {}
+constexpr auto kEventKey = "event";
+constexpr auto kMessageCapture = "VIRTUAL_DEVICE_CAPTURE_IMAGE";
+constexpr int kJpegQuality = 90;
+// How old the cached jpeg may get while captures are expected
+constexpr auto kJpegRefreshInterval = std::chrono::milliseconds(100);
+// How long after a capture more captures are expected
+constexpr auto kStillsActiveTimeout = std::chrono::seconds(5);
 
-CameraStreamer::~CameraStreamer() { Disconnect(); }
+}  // namespace
+
+CameraStreamer::CameraStreamer(unsigned int port, unsigned int cid,
+                               const std::string& frames_pmem_path)
+    : cid_(cid),
+      port_(port),
+      frames_pmem_path_(frames_pmem_path),
+      camera_session_active_(false),
+      guest_maps_frames_(false) {}
+
+CameraStreamer::~CameraStreamer() {
+  {
+    std::lock_guard<std::mutex> lock(pending_frame_mutex_);
+    stop_scaler_ = true;
+  }
+  pending_frame_cv_.notify_one();
+  if (scaler_thread_.joinable()) {
+    scaler_thread_.join();
+  }
+  Disconnect();
+}
 
 // We are getting frames from the client so try forwarding those to the CVD
 void CameraStreamer::OnFrame(const webrtc::VideoFrame& client_frame) {
   std::lock_guard<std::mutex> lock(onframe_mutex_);
   if (!cvd_connection_.IsConnected() && !pending_connection_.valid()) {
+    if (!scaler_thread_.joinable()) {
+      // Nothing is set up until a client actually sends camera frames
+      if (!frames_pmem_path_.empty() && !MapFrameRing(frames_pmem_path_)) {
+        LOG(WARNING) << "Camera frames will be sent over vsock";
+      }
+      scaler_thread_ = std::thread([this]() { ScaleAndSendLoop(); });
+    }
     // Start new connection
     pending_connection_ = cvd_connection_.ConnectAsync(port_, cid_);
     return;
@@ -43,6 +81,8 @@ void CameraStreamer::OnFrame(const webrtc::VideoFrame& client_frame) {
       LOG(ERROR) << "Failed writing camera settings:";
       return;
     }
+    // What the guest is told it gets for as long as it stays connected
+    resolution_ = settings_resolution_;
     StartReadLoop();
     LOG(INFO) << "Connected!";
   }
@@ -53,39 +93,126 @@ void CameraStreamer::OnFrame(const webrtc::VideoFrame& client_frame) {
     // necessary for potential frame scaling
     return;
   }
-  auto frame = client_frame.video_frame_buffer()->ToI420().get();
-  if (frame->width() != resolution.width ||
-      frame->height() != resolution.height) {
-    // incoming resolution does not match with the resolution we
-    // have communicated to the CVD - scaling required
-    if (!scaled_frame_ || resolution.width != scaled_frame_->width() ||
-        resolution.height != scaled_frame_->height()) {
-      scaled_frame_ =
-          webrtc::I420Buffer::Create(resolution.width, resolution.height);
+  {
+    std::lock_guard<std::mutex> lock(pending_frame_mutex_);
+    pending_frame_ = client_frame.video_frame_buffer();
+  }
+  pending_frame_cv_.notify_one();
+}
+
+void CameraStreamer::ScaleAndSendLoop() {
+  for (;;) {
+    rtc::scoped_refptr<webrtc::VideoFrameBuffer> client_frame;
+    bool capture_requested;
+    {
+      std::unique_lock<std::mutex> lock(pending_frame_mutex_);
+      pending_frame_cv_.wait(lock, [this]() {
+        return stop_scaler_ || pending_frame_ || capture_requested_;
+      });
+      if (stop_scaler_) {
+        return;
+      }
+      client_frame = std::move(pending_frame_);
+      pending_frame_ = nullptr;
+      capture_requested = capture_requested_;
+      capture_requested_ = false;
+    }
+    if (capture_requested) {
+      SendStillCapture();
+    }
+    auto resolution = resolution_.load();
+    if (!client_frame || resolution.height <= 0 || resolution.width <= 0 ||
+        !camera_session_active_.load()) {
+      continue;
+    }
+    auto i420_frame = client_frame->ToI420();
+    webrtc::I420BufferInterface* frame = i420_frame.get();
+    if (frame->width() != resolution.width ||
+        frame->height() != resolution.height) {
+      // incoming resolution does not match with the resolution we
+      // have communicated to the CVD - scaling required
+      auto scaled_frame = ScaledFrame(resolution.width, resolution.height);
+      scaled_frame->CropAndScaleFrom(*frame);
+      frame = scaled_frame;
+    }
+    if (guest_maps_frames_.load()) {
+      if (!SendSharedYUVFrame(frame)) {
+        LOG(ERROR) << "Sending shared frame descriptor over vsock failed";
+      }
+    } else if (!VsockSendYUVFrame(frame)) {
+      LOG(ERROR) << "Sending frame over vsock failed";
+    }
+    last_frame_ = frame;
+    last_frame_encoded_ = false;
+    auto now = std::chrono::steady_clock::now();
+    if (now < stills_active_until_ &&
+        now - cached_jpeg_time_ >= kJpegRefreshInterval) {
+      UpdateCachedJpeg();
     }
-    scaled_frame_->CropAndScaleFrom(*frame);
-    frame = scaled_frame_.get();
   }
-  if (!VsockSendYUVFrame(frame)) {
-    LOG(ERROR) << "Sending frame over vsock failed";
+}
+
+bool CameraStreamer::UpdateCachedJpeg() {
+  if (!last_frame_) {
+    return false;
   }
+  cached_jpeg_ = EncodeJpeg(*last_frame_, kJpegQuality);
+  cached_jpeg_time_ = std::chrono::steady_clock::now();
+  last_frame_encoded_ = true;
+  return !cached_jpeg_.empty();
+}
+
+void CameraStreamer::SendStillCapture() {
+  auto now = std::chrono::steady_clock::now();
+  stills_active_until_ = now + kStillsActiveTimeout;
+  auto resolution = resolution_.load();
+  bool cache_valid =
+      !cached_jpeg_.empty() && last_frame_ &&
+      last_frame_->width() == resolution.width &&
+      last_frame_->height() == resolution.height &&
+      (last_frame_encoded_ || now - cached_jpeg_time_ < kJpegRefreshInterval);
+  if (!cache_valid && !UpdateCachedJpeg()) {
+    // No frame to take the picture from yet, let the client take it.
+    Json::Value message;
+    message[kEventKey] = kMessageCapture;
+    SendMessage(message);
+    return;
+  }
+  std::lock_guard<std::mutex> lock(frame_mutex_);
+  if (!cvd_connection_.WriteMessage(cached_jpeg_)) {
+    LOG(ERROR) << "Sending jpeg over vsock failed";
+  }
+}
+
+webrtc::I420Buffer* CameraStreamer::ScaledFrame(int32_t width,
+                                                int32_t height) {
+  // The guest rarely switches between more than a couple of resolutions
+  static constexpr size_t kMaxCachedResolutions = 4;
+  auto& scaled_frame = scaled_frames_[{width, height}];
+  if (!scaled_frame) {
+    if (scaled_frames_.size() > kMaxCachedResolutions) {
+      scaled_frames_.clear();
+      return ScaledFrame(width, height);
+    }
+    scaled_frame = webrtc::I420Buffer::Create(width, height);
+  }
+  return scaled_frame.get();
 }
 
 // Handle message json coming from client
 void CameraStreamer::HandleMessage(const Json::Value& message) {
   auto command = message["command"].asString();
   if (command == "camera_settings") {
-    // save local copy of resolution that is required for frame scaling
-    resolution_ = GetResolutionFromSettings(message);
     Json::StreamWriterBuilder factory;
     std::string new_settings = Json::writeString(factory, message);
-    if (!settings_buffer_.empty() && new_settings != settings_buffer_) {
-      // Settings have changed - disconnect
-      // Next incoming frames will trigger re-connection
-      Disconnect();
-    }
+    // A connected guest keeps the settings it got, frames from the client's
+    // new camera are scaled to them. Reconnecting would remove the guest's
+    // camera device and make the apps using it open it again, which is what
+    // made switching between the client's cameras slow. New connections get
+    // the latest settings.
     std::lock_guard<std::mutex> lock(settings_mutex_);
     settings_buffer_ = new_settings;
+    settings_resolution_ = GetResolutionFromSettings(message);
     LOG(INFO) << "New camera settings received:" << new_settings;
   }
 }
@@ -112,14 +239,92 @@ bool CameraStreamer::VsockSendYUVFrame(
   const char* v = reinterpret_cast<const char*>(frame->DataV());
   auto chroma_width = frame->ChromaWidth();
   auto chroma_height = frame->ChromaHeight();
+  // The size and every row of the planes go out with a few writev calls
+  std::vector<struct iovec> buffers = {{&size, sizeof(size)}};
+  VsockConnection::AddStrides(buffers, y, frame->width(), frame->height(),
+                              frame->StrideY());
+  VsockConnection::AddStrides(buffers, u, chroma_width, chroma_height,
+                              frame->StrideU());
+  VsockConnection::AddStrides(buffers, v, chroma_width, chroma_height,
+                              frame->StrideV());
+  std::lock_guard<std::mutex> lock(frame_mutex_);
+  return cvd_connection_.Writev(buffers);
+}
+
+bool CameraStreamer::MapFrameRing(const std::string& frames_pmem_path) {
+  auto fd = SharedFD::Open(frames_pmem_path, O_RDWR);
+  if (!fd->IsOpen()) {
+    LOG(ERROR) << "Failed to open " << frames_pmem_path << ": "
+               << fd->StrError();
+    return false;
+  }
+  off_t size = fd->LSeek(0, SEEK_END);
+  if (size < (off_t)(kCameraFrameRingHeaderSize + kCameraFrameRingSlotSize)) {
+    LOG(ERROR) << frames_pmem_path << " is too small for a camera frame";
+    return false;
+  }
+  auto ring = fd->MMap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, 0);
+  if (!ring) {
+    LOG(ERROR) << "Failed to map " << frames_pmem_path << ": "
+               << fd->StrError();
+    return false;
+  }
+  auto header = static_cast<CameraFrameRingHeader*>(ring.get());
+  header->magic = kCameraFrameRingMagic;
+  header->version = kCameraFrameRingVersion;
+  header->slot_count = std::min<uint32_t>(
+      (size - kCameraFrameRingHeaderSize) / kCameraFrameRingSlotSize,
+      kCameraFrameRingMaxSlots);
+  header->slot_size = kCameraFrameRingSlotSize;
+  for (auto& slot : header->slots) {
+    slot.sequence.store(0);
+  }
+  frame_ring_ = std::move(ring);
+  return true;
+}
+
+bool CameraStreamer::SendSharedYUVFrame(
+    const webrtc::I420BufferInterface* frame) {
+  auto header = static_cast<CameraFrameRingHeader*>(frame_ring_.get());
+  const uint32_t chroma_width = frame->ChromaWidth();
+  const uint32_t chroma_height = frame->ChromaHeight();
+  const uint32_t y_size = frame->width() * frame->height();
+  const uint32_t size = y_size + 2 * chroma_width * chroma_height;
+  if (size > header->slot_size) {
+    return VsockSendYUVFrame(frame);
+  }
+  // The guest only reads the latest frame, so overwriting the others is fine.
+  const uint32_t slot_index = next_slot_++ % header->slot_count;
+  auto& slot = header->slots[slot_index];
+  const uint32_t sequence = slot.sequence.load(std::memory_order_relaxed) + 2;
+  slot.sequence.store(sequence - 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  auto copy_plane = [](uint8_t* dst, const uint8_t* src, int width,
+                       int height, int stride) {
+    for (int row = 0; row < height; row++) {
+      std::memcpy(dst + row * width, src + row * stride, width);
+    }
+  };
+  auto dst = CameraFrameRingSlotData(header, slot_index);
+  copy_plane(dst, frame->DataY(), frame->width(), frame->height(),
+             frame->StrideY());
+  copy_plane(dst + y_size, frame->DataU(), chroma_width, chroma_height,
+             frame->StrideU());
+  copy_plane(dst + y_size + chroma_width * chroma_height, frame->DataV(),
+             chroma_width, chroma_height, frame->StrideV());
+  slot.width = frame->width();
+  slot.height = frame->height();
+  slot.size = size;
+  slot.sequence.store(sequence, std::memory_order_release);
+
+  CameraFrameDescriptor descriptor{.magic = kCameraFrameDescriptorMagic,
+                                   .slot = slot_index,
+                                   .sequence = sequence};
+  auto data = reinterpret_cast<const char*>(&descriptor);
   std::lock_guard<std::mutex> lock(frame_mutex_);
-  return cvd_connection_.Write(size) &&
-         cvd_connection_.WriteStrides(y, frame->width(), frame->height(),
-                                      frame->StrideY()) &&
-         cvd_connection_.WriteStrides(u, chroma_width, chroma_height,
-                                      frame->StrideU()) &&
-         cvd_connection_.WriteStrides(v, chroma_width, chroma_height,
-                                      frame->StrideV());
+  return cvd_connection_.WriteMessage(
+      std::vector<char>(data, data + sizeof(descriptor)));
 }
 
 bool CameraStreamer::IsConnectionReady() {
@@ -143,15 +348,25 @@ void CameraStreamer::StartReadLoop() {
   }
   reader_thread_ = std::thread([this] {
     while (cvd_connection_.IsConnected()) {
-      static constexpr auto kEventKey = "event";
       static constexpr auto kMessageStart =
           "VIRTUAL_DEVICE_START_CAMERA_SESSION";
       static constexpr auto kMessageStop = "VIRTUAL_DEVICE_STOP_CAMERA_SESSION";
       auto json_value = cvd_connection_.ReadJsonMessage();
+      static constexpr auto kSharedFramesKey = "shared_frames";
       if (json_value[kEventKey] == kMessageStart) {
+        // Older guests don't send the key and only take frames over vsock.
+        guest_maps_frames_ =
+            frame_ring_ && json_value[kSharedFramesKey].asBool();
         camera_session_active_ = true;
       } else if (json_value[kEventKey] == kMessageStop) {
         camera_session_active_ = false;
+      } else if (json_value[kEventKey] == kMessageCapture) {
+        {
+          std::lock_guard<std::mutex> lock(pending_frame_mutex_);
+          capture_requested_ = true;
+        }
+        pending_frame_cv_.notify_one();
+        continue;
       }
       if (!json_value.empty()) {
         SendMessage(json_value);
@@ -162,6 +377,7 @@ void CameraStreamer::StartReadLoop() {
 }
 
 void CameraStreamer::Disconnect() {
+  guest_maps_frames_ = false;
   cvd_connection_.Disconnect();
   if (reader_thread_.joinable()) {
     reader_thread_.join();
@@ -20,11 +20,17 @@
 #include <api/video/video_sink_interface.h>
 #include <json/json.h>
 
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/camera_frame_ring.h"
 #include "common/libs/utils/vsock_connection.h"
 #include "host/frontend/webrtc/lib/camera_controller.h"
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <vector>
 
@@ -34,7 +40,10 @@ namespace webrtc_streaming {
 class CameraStreamer : public rtc::VideoSinkInterface<webrtc::VideoFrame>,
                        public CameraController {
  public:
-  CameraStreamer(unsigned int port, unsigned int cid);
+  // Frames are written into the memory shared with the guest at
+  // frames_pmem_path when the guest camera HAL can read them from there.
+  CameraStreamer(unsigned int port, unsigned int cid,
+                 const std::string& frames_pmem_path = "");
   ~CameraStreamer();
 
   CameraStreamer(const CameraStreamer& other) = delete;
@@ -53,21 +62,54 @@ class CameraStreamer : public rtc::VideoSinkInterface<webrtc::VideoFrame>,
   bool ForwardClientMessage(const Json::Value& message);
   Resolution GetResolutionFromSettings(const Json::Value& settings);
   bool VsockSendYUVFrame(const webrtc::I420BufferInterface* frame);
+  bool MapFrameRing(const std::string& frames_pmem_path);
+  bool SendSharedYUVFrame(const webrtc::I420BufferInterface* frame);
+  // Scales and sends the latest frame received, away from the WebRTC thread.
+  void ScaleAndSendLoop();
+  webrtc::I420Buffer* ScaledFrame(int32_t width, int32_t height);
+  // Stills are encoded on the host from the latest frame sent to the guest.
+  bool UpdateCachedJpeg();
+  void SendStillCapture();
   bool IsConnectionReady();
   void StartReadLoop();
   void Disconnect();
   std::future<bool> pending_connection_;
   VsockClientConnection cvd_connection_;
+  // The resolution of the frames sent to the guest, the one in the settings
+  // it got when connecting.
   std::atomic<Resolution> resolution_;
   std::mutex settings_mutex_;
   std::string settings_buffer_;
+  Resolution settings_resolution_ = {0, 0};
   std::mutex frame_mutex_;
   std::mutex onframe_mutex_;
-  rtc::scoped_refptr<webrtc::I420Buffer> scaled_frame_;
+  // Only the latest frame is kept, older ones are dropped if the scaler
+  // didn't get to them.
+  std::mutex pending_frame_mutex_;
+  std::condition_variable pending_frame_cv_;
+  rtc::scoped_refptr<webrtc::VideoFrameBuffer> pending_frame_;
+  bool stop_scaler_ = false;
+  bool capture_requested_ = false;
+  std::thread scaler_thread_;
+  // Reused for each resolution the guest asks for, only used by the scaler.
+  std::map<std::pair<int32_t, int32_t>, rtc::scoped_refptr<webrtc::I420Buffer>>
+      scaled_frames_;
+  // Only used by the scaler. The cached jpeg is kept fresh while the guest is
+  // taking pictures so back to back captures don't wait on the encoder.
+  rtc::scoped_refptr<webrtc::I420BufferInterface> last_frame_;
+  bool last_frame_encoded_ = false;
+  std::vector<char> cached_jpeg_;
+  std::chrono::steady_clock::time_point cached_jpeg_time_;
+  std::chrono::steady_clock::time_point stills_active_until_;
   unsigned int cid_;
   unsigned int port_;
+  std::string frames_pmem_path_;
   std::thread reader_thread_;
   std::atomic<bool> camera_session_active_;
+  ScopedMMap frame_ring_;
+  // Whether the guest reads frames from frame_ring_
+  std::atomic<bool> guest_maps_frames_;
+  uint32_t next_slot_ = 0;
 };
 
 }  // namespace webrtc_streaming
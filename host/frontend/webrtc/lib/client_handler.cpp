@@ -18,6 +18,8 @@
 
 #include "host/frontend/webrtc/lib/client_handler.h"
 
+#include <atomic>
+#include <chrono>
 #include <vector>
 
 #include <json/json.h>
@@ -41,6 +43,54 @@ static constexpr auto kAdbChannelLabel = "adb-channel";
 static constexpr auto kBluetoothChannelLabel = "bluetooth-channel";
 static constexpr auto kCameraDataChannelLabel = "camera-data-channel";
 static constexpr auto kCameraDataEof = "EOF";
+static constexpr auto kFileTransferChannelLabel = "file-transfer-channel";
+// Consecutive ICE restarts attempted before giving up on a connection
+static constexpr int kMaxIceRestarts = 3;
+// Data channels buffer up to 16MB while the SCTP transport is congested and
+// close abruptly when that fills up, senders are paused well before that.
+static constexpr uint64_t kDataChannelHighWatermark = 4 * 1024 * 1024;
+static constexpr uint64_t kDataChannelLowWatermark = 1024 * 1024;
+// A base layer at half the frame rate and one on top of it
+static constexpr int kScreenContentTemporalLayers = 2;
+
+// Tracks whether the sender of a data channel was asked to pause. Sent is
+// called from the sender's thread and Drained from the signaling thread.
+class DataChannelFlowControl {
+ public:
+  // Returns false if the sender should pause until Drained returns true.
+  bool Sent(const webrtc::DataChannelInterface &channel) {
+    if (channel.buffered_amount() < kDataChannelHighWatermark) {
+      return true;
+    }
+    congested_ = true;
+    // Drained may have been called between the check and setting the flag,
+    // only one of them may take it back.
+    return channel.buffered_amount() <= kDataChannelLowWatermark &&
+           congested_.exchange(false);
+  }
+
+  // Returns true if the paused sender can resume.
+  bool Drained(const webrtc::DataChannelInterface &channel) {
+    return channel.buffered_amount() <= kDataChannelLowWatermark &&
+           congested_.exchange(false);
+  }
+
+ private:
+  std::atomic<bool> congested_ = false;
+};
+
+// The sender is called from the handler loop and may outlive the channel
+// handler, so it holds its own references.
+std::function<bool(const uint8_t *, size_t)> FlowControlledSender(
+    rtc::scoped_refptr<webrtc::DataChannelInterface> channel,
+    std::shared_ptr<DataChannelFlowControl> flow_control) {
+  return [channel, flow_control](const uint8_t *msg, size_t size) {
+    webrtc::DataBuffer buffer(rtc::CopyOnWriteBuffer(msg, size),
+                              true /*binary*/);
+    channel->Send(buffer);
+    return flow_control->Sent(*channel);
+  };
+}
 
 class CvdCreateSessionDescriptionObserver
     : public webrtc::CreateSessionDescriptionObserver {
@@ -130,8 +180,10 @@ class ClientVideoTrackImpl : public ClientVideoTrackInterface {
     }
   }
 
+  bool HasVideoTrack() const { return video_track_ != nullptr; }
+
  private:
-  webrtc::VideoTrackInterface* video_track_;
+  webrtc::VideoTrackInterface* video_track_ = nullptr;
   rtc::VideoSinkInterface<webrtc::VideoFrame> *sink_ = nullptr;
   rtc::VideoSinkWants wants_ = {};
 };
@@ -160,11 +212,14 @@ class AdbChannelHandler : public webrtc::DataChannelObserver {
 
   void OnStateChange() override;
   void OnMessage(const webrtc::DataBuffer &msg) override;
+  void OnBufferedAmountChange(uint64_t sent_data_size) override;
 
  private:
   rtc::scoped_refptr<webrtc::DataChannelInterface> adb_channel_;
   std::shared_ptr<ConnectionObserver> observer_;
   bool channel_open_reported_ = false;
+  std::shared_ptr<DataChannelFlowControl> flow_control_ =
+      std::make_shared<DataChannelFlowControl>();
 };
 
 class ControlChannelHandler : public webrtc::DataChannelObserver {
@@ -177,12 +232,12 @@ class ControlChannelHandler : public webrtc::DataChannelObserver {
   void OnStateChange() override;
   void OnMessage(const webrtc::DataBuffer &msg) override;
 
-  void Send(const Json::Value &message);
   void Send(const uint8_t *msg, size_t size, bool binary);
 
  private:
   rtc::scoped_refptr<webrtc::DataChannelInterface> control_channel_;
   std::shared_ptr<ConnectionObserver> observer_;
+  bool channel_open_reported_ = false;
 };
 
 class BluetoothChannelHandler : public webrtc::DataChannelObserver {
@@ -194,11 +249,14 @@ class BluetoothChannelHandler : public webrtc::DataChannelObserver {
 
   void OnStateChange() override;
   void OnMessage(const webrtc::DataBuffer &msg) override;
+  void OnBufferedAmountChange(uint64_t sent_data_size) override;
 
  private:
   rtc::scoped_refptr<webrtc::DataChannelInterface> bluetooth_channel_;
   std::shared_ptr<ConnectionObserver> observer_;
   bool channel_open_reported_ = false;
+  std::shared_ptr<DataChannelFlowControl> flow_control_ =
+      std::make_shared<DataChannelFlowControl>();
 };
 
 class CameraChannelHandler : public webrtc::DataChannelObserver {
@@ -217,6 +275,22 @@ class CameraChannelHandler : public webrtc::DataChannelObserver {
   std::vector<char> receive_buffer_;
 };
 
+class FileTransferChannelHandler : public webrtc::DataChannelObserver {
+ public:
+  FileTransferChannelHandler(
+      rtc::scoped_refptr<webrtc::DataChannelInterface> file_transfer_channel,
+      std::shared_ptr<ConnectionObserver> observer);
+  ~FileTransferChannelHandler() override;
+
+  void OnStateChange() override;
+  void OnMessage(const webrtc::DataBuffer &msg) override;
+
+ private:
+  rtc::scoped_refptr<webrtc::DataChannelInterface> file_transfer_channel_;
+  std::shared_ptr<ConnectionObserver> observer_;
+  bool channel_open_reported_ = false;
+};
+
 InputChannelHandler::InputChannelHandler(
     rtc::scoped_refptr<webrtc::DataChannelInterface> input_channel,
     std::shared_ptr<ConnectionObserver> observer)
@@ -258,6 +332,16 @@ void InputChannelHandler::OnMessage(const webrtc::DataBuffer &msg) {
     return;
   }
   auto event_type = evt["type"].asString();
+  // Clients send the time the event happened in milliseconds so that the guest
+  // sees the original spacing between events rather than when they arrived.
+  int64_t timestamp_us;
+  if (evt.isMember("timestamp") && evt["timestamp"].isNumeric()) {
+    timestamp_us = static_cast<int64_t>(evt["timestamp"].asDouble() * 1000);
+  } else {
+    timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                       .count();
+  }
   if (event_type == "mouse") {
     auto result =
         ValidationResult::ValidateJsonObject(evt, "mouse",
@@ -274,7 +358,7 @@ void InputChannelHandler::OnMessage(const webrtc::DataBuffer &msg) {
     int32_t x = evt["x"].asInt();
     int32_t y = evt["y"].asInt();
 
-    observer_->OnTouchEvent(label, x, y, down);
+    observer_->OnTouchEvent(label, x, y, down, timestamp_us);
   } else if (event_type == "multi-touch") {
     auto result =
         ValidationResult::ValidateJsonObject(evt, "multi-touch",
@@ -297,7 +381,8 @@ void InputChannelHandler::OnMessage(const webrtc::DataBuffer &msg) {
     auto slotArr = evt["slot"];
     int size = evt["id"].size();
 
-    observer_->OnMultiTouchEvent(label, idArr, slotArr, xArr, yArr, down, size);
+    observer_->OnMultiTouchEvent(label, idArr, slotArr, xArr, yArr, down, size,
+                                 timestamp_us);
   } else if (event_type == "keyboard") {
     auto result =
         ValidationResult::ValidateJsonObject(evt, "keyboard",
@@ -336,30 +421,24 @@ void AdbChannelHandler::OnMessage(const webrtc::DataBuffer &msg) {
   // channel open, this avoids unnecessarily connecting to the adb daemon for
   // clients that don't use ADB.
   if (!channel_open_reported_) {
-    observer_->OnAdbChannelOpen([this](const uint8_t *msg, size_t size) {
-      webrtc::DataBuffer buffer(rtc::CopyOnWriteBuffer(msg, size),
-                                true /*binary*/);
-      // TODO (b/185832105): When the SCTP channel is congested data channel
-      // messages are buffered up to 16MB, when the buffer is full the channel
-      // is abruptly closed. Keep track of the buffered data to avoid losing the
-      // adb data channel.
-      adb_channel_->Send(buffer);
-      return true;
-    });
+    observer_->OnAdbChannelOpen(
+        FlowControlledSender(adb_channel_, flow_control_));
     channel_open_reported_ = true;
   }
   observer_->OnAdbMessage(msg.data.cdata(), msg.size());
 }
 
+void AdbChannelHandler::OnBufferedAmountChange(uint64_t /*sent_data_size*/) {
+  if (flow_control_->Drained(*adb_channel_)) {
+    observer_->OnAdbChannelWritable();
+  }
+}
+
 ControlChannelHandler::ControlChannelHandler(
     rtc::scoped_refptr<webrtc::DataChannelInterface> control_channel,
     std::shared_ptr<ConnectionObserver> observer)
     : control_channel_(control_channel), observer_(observer) {
   control_channel->RegisterObserver(this);
-  observer_->OnControlChannelOpen([this](const Json::Value& message) {
-    this->Send(message);
-    return true;
-  });
 }
 
 ControlChannelHandler::~ControlChannelHandler() {
@@ -370,19 +449,36 @@ void ControlChannelHandler::OnStateChange() {
   LOG(VERBOSE) << "Control channel state changed to "
                << webrtc::DataChannelInterface::DataStateString(
                       control_channel_->state());
+  // Messages sent before the channel is open are dropped, so it isn't
+  // reported until then.
+  if (control_channel_->state() != webrtc::DataChannelInterface::kOpen ||
+      channel_open_reported_) {
+    return;
+  }
+  channel_open_reported_ = true;
+  // The senders may be called from other threads after this handler is gone,
+  // so they hold their own reference to the channel.
+  auto channel = control_channel_;
+  observer_->OnControlChannelOpen(
+      [channel](const Json::Value &message) {
+        Json::StreamWriterBuilder factory;
+        auto message_string = Json::writeString(factory, message);
+        return channel->Send(
+            webrtc::DataBuffer(rtc::CopyOnWriteBuffer(message_string.c_str(),
+                                                      message_string.size()),
+                               /*binary=*/false));
+      },
+      [channel](const std::string &message) {
+        return channel->Send(webrtc::DataBuffer(
+            rtc::CopyOnWriteBuffer(message.c_str(), message.size()),
+            /*binary=*/false));
+      });
 }
 
 void ControlChannelHandler::OnMessage(const webrtc::DataBuffer &msg) {
   observer_->OnControlMessage(msg.data.cdata(), msg.size());
 }
 
-void ControlChannelHandler::Send(const Json::Value& message) {
-  Json::StreamWriterBuilder factory;
-  std::string message_string = Json::writeString(factory, message);
-  Send(reinterpret_cast<const uint8_t*>(message_string.c_str()),
-       message_string.size(), /*binary=*/false);
-}
-
 void ControlChannelHandler::Send(const uint8_t *msg, size_t size, bool binary) {
   webrtc::DataBuffer buffer(rtc::CopyOnWriteBuffer(msg, size), binary);
   control_channel_->Send(buffer);
@@ -411,21 +507,20 @@ void BluetoothChannelHandler::OnMessage(const webrtc::DataBuffer &msg) {
   // to avoid unnecessarily connection for Rootcanal.
   if (channel_open_reported_ == false) {
     channel_open_reported_ = true;
-    observer_->OnBluetoothChannelOpen([this](const uint8_t *msg, size_t size) {
-      webrtc::DataBuffer buffer(rtc::CopyOnWriteBuffer(msg, size),
-                                true /*binary*/);
-      // TODO (b/185832105): When the SCTP channel is congested data channel
-      // messages are buffered up to 16MB, when the buffer is full the channel
-      // is abruptly closed. Keep track of the buffered data to avoid losing the
-      // adb data channel.
-      bluetooth_channel_->Send(buffer);
-      return true;
-    });
+    observer_->OnBluetoothChannelOpen(
+        FlowControlledSender(bluetooth_channel_, flow_control_));
   }
 
   observer_->OnBluetoothMessage(msg.data.cdata(), msg.size());
 }
 
+void BluetoothChannelHandler::OnBufferedAmountChange(
+    uint64_t /*sent_data_size*/) {
+  if (flow_control_->Drained(*bluetooth_channel_)) {
+    observer_->OnBluetoothChannelWritable();
+  }
+}
+
 CameraChannelHandler::CameraChannelHandler(
     rtc::scoped_refptr<webrtc::DataChannelInterface> camera_channel,
     std::shared_ptr<ConnectionObserver> observer)
@@ -457,6 +552,37 @@ void CameraChannelHandler::OnMessage(const webrtc::DataBuffer &msg) {
                          msg_data + msg.size());
 }
 
+FileTransferChannelHandler::FileTransferChannelHandler(
+    rtc::scoped_refptr<webrtc::DataChannelInterface> file_transfer_channel,
+    std::shared_ptr<ConnectionObserver> observer)
+    : file_transfer_channel_(file_transfer_channel), observer_(observer) {
+  file_transfer_channel_->RegisterObserver(this);
+}
+
+FileTransferChannelHandler::~FileTransferChannelHandler() {
+  file_transfer_channel_->UnregisterObserver();
+}
+
+void FileTransferChannelHandler::OnStateChange() {
+  LOG(VERBOSE) << "File transfer channel state changed to "
+               << webrtc::DataChannelInterface::DataStateString(
+                      file_transfer_channel_->state());
+}
+
+void FileTransferChannelHandler::OnMessage(const webrtc::DataBuffer &msg) {
+  // Reported on the first message for the same reasons as the adb channel
+  if (!channel_open_reported_) {
+    channel_open_reported_ = true;
+    // Called from the writer thread, holds its own reference to the channel
+    auto channel = file_transfer_channel_;
+    observer_->OnFileTransferChannelOpen([channel](const std::string &msg) {
+      webrtc::DataBuffer buffer(msg);
+      return channel->Send(buffer);
+    });
+  }
+  observer_->OnFileTransferMessage(msg.data.cdata(), msg.size(), msg.binary);
+}
+
 std::shared_ptr<ClientHandler> ClientHandler::Create(
     int client_id, std::shared_ptr<ConnectionObserver> observer,
     std::function<void(const Json::Value &)> send_to_client_cb,
@@ -473,7 +599,7 @@ ClientHandler::ClientHandler(
       observer_(observer),
       send_to_client_(send_to_client_cb),
       on_connection_changed_cb_(on_connection_changed_cb),
-      camera_track_(new ClientVideoTrackImpl()) {}
+      ice_restarts_left_(kMaxIceRestarts) {}
 
 ClientHandler::~ClientHandler() {
   for (auto &data_channel : data_channels_) {
@@ -507,7 +633,7 @@ bool ClientHandler::SetPeerConnection(
 
 bool ClientHandler::AddDisplay(
     rtc::scoped_refptr<webrtc::VideoTrackInterface> video_track,
-    const std::string &label) {
+    const std::string &label, bool screen_content) {
   // Send each track as part of a different stream with the label as id
   auto err_or_sender =
       peer_connection_->AddTrack(video_track, {label} /* stream_id */);
@@ -515,8 +641,36 @@ bool ClientHandler::AddDisplay(
     LOG(ERROR) << "Failed to add video track to the peer connection";
     return false;
   }
-  // TODO (b/154138394): use the returned sender (err_or_sender.value()) to
-  // remove the display from the connection.
+  auto sender = err_or_sender.value();
+  if (screen_content) {
+    auto parameters = sender->GetParameters();
+    for (auto& encoding : parameters.encodings) {
+      encoding.num_temporal_layers = kScreenContentTemporalLayers;
+    }
+    auto error = sender->SetParameters(parameters);
+    if (!error.ok()) {
+      // Still streamed, just without the layers
+      LOG(WARNING) << "Failed to set temporal layers for display " << label
+                   << ": " << error.message();
+    }
+  }
+  display_senders_[label] = sender;
+  return true;
+}
+
+bool ClientHandler::RemoveDisplay(const std::string& label) {
+  auto it = display_senders_.find(label);
+  if (it == display_senders_.end()) {
+    LOG(ERROR) << "Client " << client_id_ << " has no display " << label;
+    return false;
+  }
+  auto error = peer_connection_->RemoveTrackNew(it->second);
+  display_senders_.erase(it);
+  if (!error.ok()) {
+    LOG(ERROR) << "Failed to remove display " << label
+               << " from the peer connection: " << error.message();
+    return false;
+  }
   return true;
 }
 
@@ -533,8 +687,15 @@ bool ClientHandler::AddAudio(
   return true;
 }
 
-ClientVideoTrackInterface* ClientHandler::GetCameraStream() {
-  return camera_track_.get();
+ClientVideoTrackInterface* ClientHandler::GetCameraStream(std::size_t index) {
+  return CameraTrack(index);
+}
+
+ClientVideoTrackImpl* ClientHandler::CameraTrack(std::size_t index) {
+  while (camera_tracks_.size() <= index) {
+    camera_tracks_.emplace_back(new ClientVideoTrackImpl());
+  }
+  return camera_tracks_[index].get();
 }
 
 void ClientHandler::LogAndReplyError(const std::string &error_msg) const {
@@ -558,6 +719,40 @@ void ClientHandler::AddPendingIceCandidates() {
   pending_ice_candidates_.clear();
 }
 
+void ClientHandler::CreateOffer(bool ice_restart) {
+  state_ = State::kCreatingOffer;
+  webrtc::PeerConnectionInterface::RTCOfferAnswerOptions options;
+  options.ice_restart = ice_restart;
+  peer_connection_->CreateOffer(
+      // No memory leak here because this is a ref counted objects and the
+      // peer connection immediately wraps it with a scoped_refptr
+      new rtc::RefCountedObject<CvdCreateSessionDescriptionObserver>(
+          weak_from_this()),
+      options);
+  // The created offer wil be sent to the client on
+  // OnSuccess(webrtc::SessionDescriptionInterface* desc)
+}
+
+bool ClientHandler::RestartIce() {
+  if (!connected_once_) {
+    // The client never got through, a new ICE session will not do better
+    return false;
+  }
+  if (state_ == State::kCreatingOffer || state_ == State::kAwaitingAnswer) {
+    // Already renegotiating, give it a chance to complete
+    return true;
+  }
+  if (ice_restarts_left_ == 0) {
+    return false;
+  }
+  ice_restarts_left_--;
+  LOG(INFO) << "Client " << client_id_ << ": Restarting ICE";
+  // The new offer carries fresh ICE credentials, the candidates of both sides
+  // are then trickled through the operator as they are gathered.
+  CreateOffer(true /* ice_restart */);
+  return true;
+}
+
 void ClientHandler::OnCreateSDPSuccess(
     webrtc::SessionDescriptionInterface *desc) {
   std::string offer_str;
@@ -614,15 +809,7 @@ void ClientHandler::HandleMessage(const Json::Value &message) {
       LogAndReplyError("Multiple requests for offer received from single client");
       return;
     }
-    state_ = State::kCreatingOffer;
-    peer_connection_->CreateOffer(
-        // No memory leak here because this is a ref counted objects and the
-        // peer connection immediately wraps it with a scoped_refptr
-        new rtc::RefCountedObject<CvdCreateSessionDescriptionObserver>(
-            weak_from_this()),
-        webrtc::PeerConnectionInterface::RTCOfferAnswerOptions());
-    // The created offer wil be sent to the client on
-    // OnSuccess(webrtc::SessionDescriptionInterface* desc)
+    CreateOffer(false /* ice_restart */);
   } else if (type == "offer") {
     auto result = ValidationResult::ValidateJsonObject(
         message, type, {{"sdp", Json::ValueType::stringValue}});
@@ -685,6 +872,11 @@ void ClientHandler::HandleMessage(const Json::Value &message) {
                 // The remote description was rejected, this client can't be
                 // trusted anymore.
                 Close();
+                return;
+              }
+              if (renegotiation_pending_) {
+                renegotiation_pending_ = false;
+                CreateOffer(false /* ice_restart */);
               }
             }));
     peer_connection_->SetRemoteDescription(std::move(remote_desc), observer);
@@ -768,6 +960,12 @@ void ClientHandler::OnConnectionChange(
     case webrtc::PeerConnectionInterface::PeerConnectionState::kConnected:
       LOG(VERBOSE) << "Client " << client_id_ << ": WebRTC connected";
       state_ = State::kConnected;
+      ice_restarts_left_ = kMaxIceRestarts;
+      if (connected_once_) {
+        // Recovered after an ICE restart, the client was set up already
+        break;
+      }
+      connected_once_ = true;
       observer_->OnConnected(
           [this](const uint8_t *msg, size_t size, bool binary) {
             control_handler_->Send(msg, size, binary);
@@ -777,11 +975,15 @@ void ClientHandler::OnConnectionChange(
       break;
     case webrtc::PeerConnectionInterface::PeerConnectionState::kDisconnected:
       LOG(VERBOSE) << "Client " << client_id_ << ": Connection disconnected";
-      Close();
+      if (!RestartIce()) {
+        Close();
+      }
       break;
     case webrtc::PeerConnectionInterface::PeerConnectionState::kFailed:
       LOG(ERROR) << "Client " << client_id_ << ": Connection failed";
-      Close();
+      if (!RestartIce()) {
+        Close();
+      }
       break;
     case webrtc::PeerConnectionInterface::PeerConnectionState::kClosed:
       LOG(VERBOSE) << "Client " << client_id_ << ": Connection closed";
@@ -819,6 +1021,9 @@ void ClientHandler::OnDataChannel(
   } else if (label == kCameraDataChannelLabel) {
     camera_data_handler_.reset(
         new CameraChannelHandler(data_channel, observer_));
+  } else if (label == kFileTransferChannelLabel) {
+    file_transfer_handler_.reset(
+        new FileTransferChannelHandler(data_channel, observer_));
   } else {
     LOG(VERBOSE) << "Data channel connected: " << label;
     data_channels_.push_back(data_channel);
@@ -826,8 +1031,19 @@ void ClientHandler::OnDataChannel(
 }
 
 void ClientHandler::OnRenegotiationNeeded() {
-  state_ = State::kNew;
   LOG(VERBOSE) << "Client " << client_id_ << " needs renegotiation";
+  if (state_ == State::kCreatingOffer || state_ == State::kAwaitingAnswer) {
+    // Offered again once the answer to the current offer is in
+    renegotiation_pending_ = true;
+    return;
+  }
+  if (!remote_description_added_) {
+    // The offer the client asks for will carry the current tracks
+    state_ = State::kNew;
+    return;
+  }
+  // Tracks were added or removed after the client connected
+  CreateOffer(false /* ice_restart */);
 }
 
 void ClientHandler::OnIceGatheringChange(
@@ -888,7 +1104,11 @@ void ClientHandler::OnStandardizedIceConnectionChange(
       LOG(DEBUG) << "ICE connection state: Completed";
       break;
     case webrtc::PeerConnectionInterface::kIceConnectionFailed:
-      state_ = State::kFailed;
+      // An ICE restart may be underway already, see OnConnectionChange
+      if (state_ != State::kCreatingOffer &&
+          state_ != State::kAwaitingAnswer) {
+        state_ = State::kFailed;
+      }
       LOG(DEBUG) << "ICE connection state: Failed";
       break;
     case webrtc::PeerConnectionInterface::kIceConnectionDisconnected:
@@ -911,8 +1131,13 @@ void ClientHandler::OnTrack(
   auto track = transceiver->receiver()->track();
   if (track && track->kind() == webrtc::MediaStreamTrackInterface::kVideoKind) {
     // It's ok to take the raw pointer here because we make sure to unset it
-    // when the track is removed
-    camera_track_->SetVideoTrack(
+    // when the track is removed. The track goes to the first camera without
+    // one, so a removed track's camera is fed by the next one added.
+    std::size_t index = 0;
+    while (CameraTrack(index)->HasVideoTrack()) {
+      index++;
+    }
+    CameraTrack(index)->SetVideoTrack(
         static_cast<webrtc::VideoTrackInterface *>(track.get()));
   }
 }
@@ -921,8 +1146,10 @@ void ClientHandler::OnRemoveTrack(
   auto track = receiver->track();
   if (track && track->kind() == webrtc::MediaStreamTrackInterface::kVideoKind) {
     // this only unsets if the track matches the one already in store
-    camera_track_->UnsetVideoTrack(
-        reinterpret_cast<webrtc::VideoTrackInterface *>(track.get()));
+    for (auto &camera_track : camera_tracks_) {
+      camera_track->UnsetVideoTrack(
+          reinterpret_cast<webrtc::VideoTrackInterface *>(track.get()));
+    }
   }
 }
 
@@ -17,6 +17,7 @@
 #pragma once
 
 #include <functional>
+#include <map>
 #include <memory>
 #include <optional>
 #include <sstream>
@@ -39,6 +40,7 @@ class AdbChannelHandler;
 class ControlChannelHandler;
 class BluetoothChannelHandler;
 class CameraChannelHandler;
+class FileTransferChannelHandler;
 
 class ClientVideoTrackInterface;
 class ClientVideoTrackImpl;
@@ -55,13 +57,25 @@ class ClientHandler : public webrtc::PeerConnectionObserver,
   bool SetPeerConnection(
       rtc::scoped_refptr<webrtc::PeerConnectionInterface> peer_connection);
 
+  // Handlers may be created ahead of time, before the client they will serve
+  // is known.
+  void SetClientId(int client_id) { client_id_ = client_id; }
+
+  // Screen content is sent with temporal layers, so frames of the upper layer
+  // can be dropped when bandwidth runs short without freezing the picture.
   bool AddDisplay(rtc::scoped_refptr<webrtc::VideoTrackInterface> track,
-                  const std::string& label);
+                  const std::string& label, bool screen_content);
+  // Displays may be added and removed after the client connected, the
+  // connection is then renegotiated with a new offer.
+  bool RemoveDisplay(const std::string& label);
 
   bool AddAudio(rtc::scoped_refptr<webrtc::AudioTrackInterface> track,
                   const std::string& label);
 
-  ClientVideoTrackInterface* GetCameraStream();
+  // The client's video tracks, in the order they were received, feed the
+  // cameras with the same index. A track taking the place of another one with
+  // replaceTrack() keeps feeding the same camera, without a renegotiation.
+  ClientVideoTrackInterface* GetCameraStream(std::size_t index = 0);
 
   void HandleMessage(const Json::Value& client_message);
 
@@ -121,6 +135,12 @@ class ClientHandler : public webrtc::PeerConnectionObserver,
 
   void LogAndReplyError(const std::string& error_msg) const;
   void AddPendingIceCandidates();
+  void CreateOffer(bool ice_restart);
+  // Renegotiates the ICE transport of an established connection that was
+  // interrupted, keeping the peer connection with its tracks, data channels
+  // and DTLS state. Returns false if the connection can't be recovered that
+  // way.
+  bool RestartIce();
 
   int client_id_;
   State state_ = State::kNew;
@@ -134,10 +154,18 @@ class ClientHandler : public webrtc::PeerConnectionObserver,
   std::unique_ptr<ControlChannelHandler> control_handler_;
   std::unique_ptr<BluetoothChannelHandler> bluetooth_handler_;
   std::unique_ptr<CameraChannelHandler> camera_data_handler_;
-  std::unique_ptr<ClientVideoTrackImpl> camera_track_;
+  std::unique_ptr<FileTransferChannelHandler> file_transfer_handler_;
+  ClientVideoTrackImpl* CameraTrack(std::size_t index);
+  std::vector<std::unique_ptr<ClientVideoTrackImpl>> camera_tracks_;
   bool remote_description_added_ = false;
+  bool connected_once_ = false;
+  int ice_restarts_left_;
   std::vector<std::unique_ptr<webrtc::IceCandidateInterface>>
       pending_ice_candidates_;
+  std::map<std::string, rtc::scoped_refptr<webrtc::RtpSenderInterface>>
+      display_senders_;
+  // The tracks changed while an offer was being negotiated
+  bool renegotiation_pending_ = false;
 };
 
 class ClientVideoTrackInterface {
@@ -17,6 +17,7 @@
 #pragma once
 
 #include <functional>
+#include <string>
 
 #include <json/json.h>
 
@@ -30,22 +31,38 @@ class ConnectionObserver {
 
   virtual void OnConnected(
       std::function<void(const uint8_t*, size_t, bool)> ctrl_msg_sender) = 0;
+  // Touch timestamps are in microseconds, they are only meaningful relative to
+  // each other.
   virtual void OnTouchEvent(const std::string& display_label, int x, int y,
-                            bool down) = 0;
+                            bool down, int64_t timestamp_us) = 0;
   virtual void OnMultiTouchEvent(const std::string& label, Json::Value id, Json::Value slot,
-                                 Json::Value x, Json::Value y, bool down, int size) = 0;
+                                 Json::Value x, Json::Value y, bool down, int size,
+                                 int64_t timestamp_us) = 0;
   virtual void OnKeyboardEvent(uint16_t keycode, bool down) = 0;
   virtual void OnSwitchEvent(uint16_t code, bool state) = 0;
+  // The senders return false when the channel has buffered too much data,
+  // the matching On*ChannelWritable is called once it has drained.
   virtual void OnAdbChannelOpen(
       std::function<bool(const uint8_t*, size_t)> adb_message_sender) = 0;
   virtual void OnAdbMessage(const uint8_t* msg, size_t size) = 0;
+  virtual void OnAdbChannelWritable() = 0;
+  // Called once the control channel is open. Both senders send on the control
+  // channel, the second one takes messages that are already serialized JSON.
   virtual void OnControlChannelOpen(
-      std::function<bool(const Json::Value)> control_message_sender) = 0;
+      std::function<bool(const Json::Value)> control_message_sender,
+      std::function<bool(const std::string&)> serialized_message_sender) = 0;
   virtual void OnControlMessage(const uint8_t* msg, size_t size) = 0;
   virtual void OnBluetoothChannelOpen(
       std::function<bool(const uint8_t*, size_t)> bluetooth_message_sender) = 0;
   virtual void OnBluetoothMessage(const uint8_t* msg, size_t size) = 0;
+  virtual void OnBluetoothChannelWritable() = 0;
   virtual void OnCameraData(const std::vector<char>& data) = 0;
+  // Files pushed by the client: control messages are JSON text and the
+  // contents of the file come in binary messages. The sender takes JSON text.
+  virtual void OnFileTransferChannelOpen(
+      std::function<bool(const std::string&)> file_transfer_message_sender) = 0;
+  virtual void OnFileTransferMessage(const uint8_t* msg, size_t size,
+                                     bool binary) = 0;
 };
 
 class ConnectionObserverFactory {
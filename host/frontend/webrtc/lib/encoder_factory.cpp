@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/lib/encoder_factory.h"
+
+#include <algorithm>
+#include <cctype>
+
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+
+namespace {
+
+constexpr auto kFallbackCodec = "VP8";
+
+bool IsFormatSupported(const webrtc::VideoEncoderFactory& factory,
+                       const webrtc::SdpVideoFormat& format) {
+  for (const auto& supported : factory.GetSupportedFormats()) {
+    if (supported.IsSameCodec(format)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Configures the wrapped encoder for screen content, the rest is passed
+// through.
+class ScreenContentEncoder : public webrtc::VideoEncoder {
+ public:
+  ScreenContentEncoder(std::unique_ptr<webrtc::VideoEncoder> encoder)
+      : encoder_(std::move(encoder)) {}
+
+  void SetFecControllerOverride(
+      webrtc::FecControllerOverride* fec_controller_override) override {
+    encoder_->SetFecControllerOverride(fec_controller_override);
+  }
+
+  int32_t InitEncode(const webrtc::VideoCodec* codec_settings,
+                     const webrtc::VideoEncoder::Settings& settings) override {
+    auto screen_settings = *codec_settings;
+    screen_settings.mode = webrtc::VideoCodecMode::kScreensharing;
+    // 0 disables the periodic key frames, leaving those the receivers request
+    switch (screen_settings.codecType) {
+      case webrtc::kVideoCodecVP8:
+        screen_settings.VP8()->keyFrameInterval = 0;
+        break;
+      case webrtc::kVideoCodecVP9:
+        screen_settings.VP9()->keyFrameInterval = 0;
+        break;
+      case webrtc::kVideoCodecH264:
+        screen_settings.H264()->keyFrameInterval = 0;
+        break;
+      default:
+        break;
+    }
+    return encoder_->InitEncode(&screen_settings, settings);
+  }
+
+  int32_t RegisterEncodeCompleteCallback(
+      webrtc::EncodedImageCallback* callback) override {
+    return encoder_->RegisterEncodeCompleteCallback(callback);
+  }
+
+  int32_t Release() override { return encoder_->Release(); }
+
+  int32_t Encode(
+      const webrtc::VideoFrame& frame,
+      const std::vector<webrtc::VideoFrameType>* frame_types) override {
+    return encoder_->Encode(frame, frame_types);
+  }
+
+  void SetRates(const RateControlParameters& parameters) override {
+    encoder_->SetRates(parameters);
+  }
+
+  void OnPacketLossRateUpdate(float packet_loss_rate) override {
+    encoder_->OnPacketLossRateUpdate(packet_loss_rate);
+  }
+
+  void OnRttUpdate(int64_t rtt_ms) override { encoder_->OnRttUpdate(rtt_ms); }
+
+  void OnLossNotification(const LossNotification& loss_notification) override {
+    encoder_->OnLossNotification(loss_notification);
+  }
+
+  EncoderInfo GetEncoderInfo() const override {
+    return encoder_->GetEncoderInfo();
+  }
+
+ private:
+  std::unique_ptr<webrtc::VideoEncoder> encoder_;
+};
+
+}  // namespace
+
+CompositeEncoderFactory::CompositeEncoderFactory(
+    std::vector<std::unique_ptr<webrtc::VideoEncoderFactory>> factories,
+    std::vector<std::string> codec_preference, bool screen_content)
+    : factories_(std::move(factories)), screen_content_(screen_content) {
+  for (const auto& codec : codec_preference) {
+    auto name = android::base::Trim(codec);
+    auto upper = name;
+    std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+    if (!upper.empty() && std::find(codec_preference_.begin(),
+                                    codec_preference_.end(),
+                                    upper) == codec_preference_.end()) {
+      codec_preference_.push_back(upper);
+    }
+  }
+  if (std::find(codec_preference_.begin(), codec_preference_.end(),
+                kFallbackCodec) == codec_preference_.end()) {
+    codec_preference_.push_back(kFallbackCodec);
+  }
+}
+
+std::vector<webrtc::SdpVideoFormat>
+CompositeEncoderFactory::GetSupportedFormats() const {
+  std::vector<webrtc::SdpVideoFormat> ret;
+  for (const auto& codec : codec_preference_) {
+    bool found = false;
+    for (const auto& factory : factories_) {
+      for (auto& format : factory->GetSupportedFormats()) {
+        if (!android::base::EqualsIgnoreCase(format.name, codec)) {
+          continue;
+        }
+        found = true;
+        // Different factories usually support the same formats.
+        if (std::find(ret.begin(), ret.end(), format) == ret.end()) {
+          ret.push_back(format);
+        }
+      }
+    }
+    if (!found) {
+      LOG(WARNING) << "No encoder available for the " << codec << " codec";
+    }
+  }
+  return ret;
+}
+
+webrtc::VideoEncoderFactory::CodecInfo
+CompositeEncoderFactory::QueryVideoEncoder(
+    const webrtc::SdpVideoFormat& format) const {
+  auto factory = FactoryFor(format);
+  if (!factory) {
+    return CodecInfo();
+  }
+  return factory->QueryVideoEncoder(format);
+}
+
+std::unique_ptr<webrtc::VideoEncoder>
+CompositeEncoderFactory::CreateVideoEncoder(
+    const webrtc::SdpVideoFormat& format) {
+  auto factory = FactoryFor(format);
+  if (!factory) {
+    LOG(ERROR) << "No encoder factory supports " << format.ToString();
+    return nullptr;
+  }
+  LOG(INFO) << "Creating "
+            << (factory->QueryVideoEncoder(format).is_hardware_accelerated
+                    ? "hardware"
+                    : "software")
+            << " encoder for " << format.ToString();
+  auto encoder = factory->CreateVideoEncoder(format);
+  if (encoder && screen_content_) {
+    return std::make_unique<ScreenContentEncoder>(std::move(encoder));
+  }
+  return encoder;
+}
+
+std::unique_ptr<webrtc::VideoEncoderFactory::EncoderSelectorInterface>
+CompositeEncoderFactory::GetEncoderSelector() const {
+  for (const auto& factory : factories_) {
+    auto selector = factory->GetEncoderSelector();
+    if (selector) {
+      return selector;
+    }
+  }
+  return nullptr;
+}
+
+webrtc::VideoEncoderFactory* CompositeEncoderFactory::FactoryFor(
+    const webrtc::SdpVideoFormat& format) const {
+  webrtc::VideoEncoderFactory* fallback = nullptr;
+  for (const auto& factory : factories_) {
+    if (!IsFormatSupported(*factory, format)) {
+      continue;
+    }
+    if (factory->QueryVideoEncoder(format).is_hardware_accelerated) {
+      return factory.get();
+    }
+    if (!fallback) {
+      fallback = factory.get();
+    }
+  }
+  return fallback;
+}
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
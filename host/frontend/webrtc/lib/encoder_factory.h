@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <api/video_codecs/video_encoder_factory.h>
+#include <api/video_codecs/video_encoder.h>
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+
+// Combines several encoder factories, e.g. hardware backed ones and libwebrtc's
+// builtin software encoders, and only advertises the allowed codecs.
+//
+// Codecs are offered in the given order of preference so the negotiation
+// picks the first one the client supports. VP8 is always allowed as a last
+// resort since every WebRTC client is required to support it. When several
+// factories can encode a format the first one reporting hardware acceleration
+// is used, falling back to the first one that supports it at all.
+//
+// With screen_content the encoders are put in their screen sharing mode and
+// only produce key frames when asked to, as a static screen needs no periodic
+// refresh and every key frame is costly.
+class CompositeEncoderFactory : public webrtc::VideoEncoderFactory {
+ public:
+  CompositeEncoderFactory(
+      std::vector<std::unique_ptr<webrtc::VideoEncoderFactory>> factories,
+      std::vector<std::string> codec_preference, bool screen_content = false);
+
+  std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
+
+  CodecInfo QueryVideoEncoder(
+      const webrtc::SdpVideoFormat& format) const override;
+
+  std::unique_ptr<webrtc::VideoEncoder> CreateVideoEncoder(
+      const webrtc::SdpVideoFormat& format) override;
+
+  // The first selector offered by the given factories, if any.
+  std::unique_ptr<EncoderSelectorInterface> GetEncoderSelector() const override;
+
+ private:
+  webrtc::VideoEncoderFactory* FactoryFor(
+      const webrtc::SdpVideoFormat& format) const;
+
+  std::vector<std::unique_ptr<webrtc::VideoEncoderFactory>> factories_;
+  std::vector<std::string> codec_preference_;
+  bool screen_content_;
+};
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "host/frontend/webrtc/lib/jpeg_encoder.h"
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include <android-base/logging.h>
+#include <api/video/i420_buffer.h>
+#include <jpeglib.h>
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+namespace {
+
+// 4:2:0 MCUs are 16x16 luma samples
+constexpr int kMcuSize = 2 * DCTSIZE;
+
+struct ErrorManager {
+  jpeg_error_mgr mgr;
+  jmp_buf jump_buffer;
+};
+
+// The default handler exits the process
+void OnJpegError(j_common_ptr cinfo) {
+  char message[JMSG_LENGTH_MAX];
+  (*cinfo->err->format_message)(cinfo, message);
+  LOG(ERROR) << "Failed to encode jpeg: " << message;
+  longjmp(reinterpret_cast<ErrorManager*>(cinfo->err)->jump_buffer, 1);
+}
+
+void CopyPlane(const uint8_t* src, int src_stride, uint8_t* dst,
+               int dst_stride, int width, int height) {
+  for (int row = 0; row < height; ++row) {
+    memcpy(dst + row * dst_stride, src + row * src_stride, width);
+  }
+}
+
+// Raw data input reads whole MCUs, so every row must be readable up to the
+// next multiple of the MCU width. That's only the case for the last rows of a
+// frame when its strides are wide enough already.
+rtc::scoped_refptr<const webrtc::I420BufferInterface> PaddedFrame(
+    const webrtc::I420BufferInterface& frame) {
+  int padded_width = (frame.width() + kMcuSize - 1) / kMcuSize * kMcuSize;
+  if (frame.StrideY() >= padded_width &&
+      frame.StrideU() >= padded_width / 2 &&
+      frame.StrideV() >= padded_width / 2) {
+    return rtc::scoped_refptr<const webrtc::I420BufferInterface>(&frame);
+  }
+  auto padded =
+      webrtc::I420Buffer::Create(frame.width(), frame.height(), padded_width,
+                                 padded_width / 2, padded_width / 2);
+  CopyPlane(frame.DataY(), frame.StrideY(), padded->MutableDataY(),
+            padded->StrideY(), frame.width(), frame.height());
+  CopyPlane(frame.DataU(), frame.StrideU(), padded->MutableDataU(),
+            padded->StrideU(), frame.ChromaWidth(), frame.ChromaHeight());
+  CopyPlane(frame.DataV(), frame.StrideV(), padded->MutableDataV(),
+            padded->StrideV(), frame.ChromaWidth(), frame.ChromaHeight());
+  return padded;
+}
+
+}  // namespace
+
+std::vector<char> EncodeJpeg(const webrtc::I420BufferInterface& input_frame,
+                             int quality) {
+  auto frame = PaddedFrame(input_frame);
+  jpeg_compress_struct cinfo;
+  ErrorManager error_manager;
+  unsigned char* out_buffer = nullptr;
+  unsigned long out_size = 0;
+  cinfo.err = jpeg_std_error(&error_manager.mgr);
+  error_manager.mgr.error_exit = OnJpegError;
+  if (setjmp(error_manager.jump_buffer)) {
+    jpeg_destroy_compress(&cinfo);
+    free(out_buffer);
+    return {};
+  }
+  jpeg_create_compress(&cinfo);
+  jpeg_mem_dest(&cinfo, &out_buffer, &out_size);
+
+  cinfo.image_width = frame->width();
+  cinfo.image_height = frame->height();
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_YCbCr;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, quality, TRUE);
+  cinfo.raw_data_in = TRUE;
+  cinfo.dct_method = JDCT_IFAST;
+  cinfo.comp_info[0].h_samp_factor = 2;
+  cinfo.comp_info[0].v_samp_factor = 2;
+  cinfo.comp_info[1].h_samp_factor = 1;
+  cinfo.comp_info[1].v_samp_factor = 1;
+  cinfo.comp_info[2].h_samp_factor = 1;
+  cinfo.comp_info[2].v_samp_factor = 1;
+  jpeg_start_compress(&cinfo, TRUE);
+
+  JSAMPROW y_rows[kMcuSize];
+  JSAMPROW u_rows[kMcuSize / 2];
+  JSAMPROW v_rows[kMcuSize / 2];
+  JSAMPARRAY planes[3] = {y_rows, u_rows, v_rows};
+  while (cinfo.next_scanline < cinfo.image_height) {
+    int row = cinfo.next_scanline;
+    // Rows past the bottom edge repeat the last one
+    for (int i = 0; i < kMcuSize; ++i) {
+      int y = std::min(row + i, frame->height() - 1);
+      y_rows[i] = const_cast<JSAMPROW>(frame->DataY() + y * frame->StrideY());
+    }
+    for (int i = 0; i < kMcuSize / 2; ++i) {
+      int y = std::min(row / 2 + i, frame->ChromaHeight() - 1);
+      u_rows[i] = const_cast<JSAMPROW>(frame->DataU() + y * frame->StrideU());
+      v_rows[i] = const_cast<JSAMPROW>(frame->DataV() + y * frame->StrideV());
+    }
+    jpeg_write_raw_data(&cinfo, planes, kMcuSize);
+  }
+  jpeg_finish_compress(&cinfo);
+  std::vector<char> jpeg(out_buffer, out_buffer + out_size);
+  jpeg_destroy_compress(&cinfo);
+  free(out_buffer);
+  return jpeg;
+}
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <api/video/video_frame_buffer.h>
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+
+// Encodes an I420 frame as a baseline JPEG, feeding the planes straight to
+// the compressor so no color conversion is done. Returns an empty vector on
+// failure.
+std::vector<char> EncodeJpeg(const webrtc::I420BufferInterface& frame,
+                             int quality);
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
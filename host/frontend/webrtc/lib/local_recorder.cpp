@@ -16,8 +16,10 @@
 
 #include "host/frontend/webrtc/lib/local_recorder.h"
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <deque>
 #include <list>
 #include <mutex>
 #include <thread>
@@ -64,7 +66,11 @@ public:
   LocalRecorder::Impl& impl_;
   std::shared_ptr<webrtc::VideoTrackSourceInterface> source_;
   std::unique_ptr<webrtc::VideoEncoder> video_encoder_;
-  uint64_t video_track_number_;
+  // Index in Impl::displays_ and Impl::tracks_
+  size_t index_;
+  // Set when a new file starts, which the display's frames can only enter
+  // with a key frame.
+  std::atomic_bool force_key_frame_ = false;
 
   // TODO(schuffelen): Use a WebRTC task queue?
   std::thread encoder_thread_;
@@ -76,31 +82,217 @@ public:
 
 class LocalRecorder::Impl {
 public:
-  mkvmuxer::MkvWriter file_writer_;
-  mkvmuxer::Segment segment_;
+  struct Track {
+    size_t width;
+    size_t height;
+    // Track number in the current segment, 0 if not added to it yet
+    uint64_t number = 0;
+    // Whether the track got its first key frame in the current segment
+    bool started = false;
+  };
+  struct EncodedFrame {
+    std::vector<uint8_t> data;
+    uint64_t timestamp_ns;
+    bool is_key;
+  };
+
+  // All of these must be called with mkv_mutex_ held.
+  bool AddTrack(size_t width, size_t height, size_t* index);
+  bool AddFrame(size_t track, const uint8_t* data, size_t size,
+                uint64_t timestamp_ns, bool is_key);
+  bool WriteFrame(size_t track, const uint8_t* data, size_t size,
+                  uint64_t timestamp_ns, bool is_key);
+  bool OpenSegment(uint64_t start_ns);
+  void CloseSegment();
+  void WriteRecentFrames();
+
+  std::string filename_;
+  Options options_;
+  std::unique_ptr<mkvmuxer::MkvWriter> file_writer_;
+  std::unique_ptr<mkvmuxer::Segment> segment_;
+  size_t segment_index_ = 0;
+  uint64_t segment_start_ns_ = 0;
+  std::vector<Track> tracks_;
+  // Recent frames of each track when keeping only the last ones. Each starts
+  // with a key frame.
+  std::vector<std::deque<EncodedFrame>> recent_frames_;
   std::unique_ptr<webrtc::VideoEncoderFactory> encoder_factory_;
   std::mutex mkv_mutex_;
   std::vector<std::unique_ptr<Display>> displays_;
 };
 
+bool LocalRecorder::Impl::OpenSegment(uint64_t start_ns) {
+  std::string filename = filename_;
+  if (options_.segment_duration.count() > 0) {
+    const std::string extension = ".webm";
+    if (filename.size() > extension.size() &&
+        filename.compare(filename.size() - extension.size(), extension.size(),
+                         extension) == 0) {
+      filename.resize(filename.size() - extension.size());
+    }
+    filename += "_" + std::to_string(segment_index_++) + extension;
+  }
+
+  auto file_writer = std::make_unique<mkvmuxer::MkvWriter>();
+  if (!file_writer->Open(filename.c_str())) {
+    LOG(ERROR) << "Failed to open \"" << filename << "\" to write a webm";
+    return false;
+  }
+  auto segment = std::make_unique<mkvmuxer::Segment>();
+  if (!segment->Init(file_writer.get())) {
+    LOG(ERROR) << "Failed to initialize the mkvkmuxer segment";
+    return false;
+  }
+  segment->AccurateClusterDuration(true);
+  segment->set_estimate_file_duration(true);
+
+  file_writer_ = std::move(file_writer);
+  segment_ = std::move(segment);
+  segment_start_ns_ = start_ns;
+  for (auto& track : tracks_) {
+    track.number = segment_->AddVideoTrack(track.width, track.height, 0);
+    track.started = false;
+    if (track.number == 0) {
+      LOG(ERROR) << "Failed to add video track to webm muxer";
+    }
+  }
+  return true;
+}
+
+void LocalRecorder::Impl::CloseSegment() {
+  if (segment_) {
+    segment_->Finalize();
+  }
+  segment_.reset();
+  file_writer_.reset();
+}
+
+bool LocalRecorder::Impl::AddTrack(size_t width, size_t height,
+                                   size_t* index) {
+  *index = tracks_.size();
+  tracks_.push_back(Track{.width = width, .height = height});
+  recent_frames_.emplace_back();
+  if (!segment_) {
+    return true;
+  }
+  auto& track = tracks_.back();
+  track.number = segment_->AddVideoTrack(width, height, 0);
+  return track.number != 0;
+}
+
+bool LocalRecorder::Impl::WriteFrame(size_t track_index, const uint8_t* data,
+                                     size_t size, uint64_t timestamp_ns,
+                                     bool is_key) {
+  const uint64_t segment_duration_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          options_.segment_duration)
+          .count();
+  const bool segment_full =
+      segment_ && segment_duration_ns > 0 &&
+      timestamp_ns - segment_start_ns_ >= segment_duration_ns;
+  if (!segment_ || (segment_full && is_key)) {
+    CloseSegment();
+    if (!OpenSegment(timestamp_ns)) {
+      return false;
+    }
+    for (auto& display : displays_) {
+      display->force_key_frame_ = true;
+    }
+  }
+
+  auto& track = tracks_[track_index];
+  if (!track.started) {
+    if (!is_key) {
+      // Undecodable without the previous frames, which went to another file.
+      return true;
+    }
+    track.started = true;
+  }
+  // Every file starts at time zero.
+  const uint64_t segment_timestamp_ns =
+      timestamp_ns >= segment_start_ns_ ? timestamp_ns - segment_start_ns_ : 0;
+  return segment_->AddFrame(data, size, track.number, segment_timestamp_ns,
+                            is_key);
+}
+
+bool LocalRecorder::Impl::AddFrame(size_t track_index, const uint8_t* data,
+                                   size_t size, uint64_t timestamp_ns,
+                                   bool is_key) {
+  if (options_.keep_last.count() == 0) {
+    return WriteFrame(track_index, data, size, timestamp_ns, is_key);
+  }
+
+  auto& frames = recent_frames_[track_index];
+  if (frames.empty() && !is_key) {
+    return true;
+  }
+  frames.push_back(EncodedFrame{
+      .data = std::vector<uint8_t>(data, data + size),
+      .timestamp_ns = timestamp_ns,
+      .is_key = is_key,
+  });
+  // Whole groups of frames are dropped so there's always a key frame to
+  // start decoding from, so up to one key frame interval more is kept.
+  const uint64_t keep_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(options_.keep_last)
+          .count();
+  for (;;) {
+    auto next_key = std::find_if(frames.begin() + 1, frames.end(),
+                                 [](const auto& f) { return f.is_key; });
+    if (next_key == frames.end() ||
+        timestamp_ns - next_key->timestamp_ns < keep_ns) {
+      break;
+    }
+    frames.erase(frames.begin(), next_key);
+  }
+  return true;
+}
+
+void LocalRecorder::Impl::WriteRecentFrames() {
+  // The tracks are interleaved in timestamp order, as the muxer expects.
+  std::vector<size_t> next(recent_frames_.size(), 0);
+  for (;;) {
+    size_t track = recent_frames_.size();
+    for (size_t i = 0; i < recent_frames_.size(); i++) {
+      if (next[i] < recent_frames_[i].size() &&
+          (track == recent_frames_.size() ||
+           recent_frames_[i][next[i]].timestamp_ns <
+               recent_frames_[track][next[track]].timestamp_ns)) {
+        track = i;
+      }
+    }
+    if (track == recent_frames_.size()) {
+      break;
+    }
+    const auto& frame = recent_frames_[track][next[track]++];
+    if (!WriteFrame(track, frame.data.data(), frame.data.size(),
+                    frame.timestamp_ns, frame.is_key)) {
+      LOG(ERROR) << "Failed to write recorded frame";
+    }
+  }
+  for (auto& frames : recent_frames_) {
+    frames.clear();
+  }
+}
+
 /* static */
 std::unique_ptr<LocalRecorder> LocalRecorder::Create(
     const std::string& filename) {
-  std::unique_ptr<Impl> impl(new Impl());
+  return Create(filename, Options{});
+}
 
-  if (!impl->file_writer_.Open(filename.c_str())) {
-    LOG(ERROR) << "Failed to open \"" << filename << "\" to write a webm";
-    return {};
-  }
+/* static */
+std::unique_ptr<LocalRecorder> LocalRecorder::Create(
+    const std::string& filename, const Options& options) {
+  std::unique_ptr<Impl> impl(new Impl());
+  impl->filename_ = filename;
+  impl->options_ = options;
 
-  if (!impl->segment_.Init(&impl->file_writer_)) {
-    LOG(ERROR) << "Failed to initialize the mkvkmuxer segment";
+  // Otherwise the file is only created for the first frames to write.
+  if (options.keep_last.count() == 0 && !impl->OpenSegment(0)) {
     return {};
   }
 
-  impl->segment_.AccurateClusterDuration(true);
-  impl->segment_.set_estimate_file_duration(true);
-
   impl->encoder_factory_ = webrtc::CreateBuiltinVideoEncoderFactory();
   if (!impl->encoder_factory_) {
     LOG(ERROR) << "Failed to create webRTC built-in video encoder factory";
@@ -167,11 +359,8 @@ void LocalRecorder::AddDisplay(
   }, display.get());
 
   std::lock_guard lock(impl_->mkv_mutex_);
-  display->video_track_number_ =
-      impl_->segment_.AddVideoTrack(width, height, 0);
-  if (display->video_track_number_ == 0) {
+  if (!impl_->AddTrack(width, height, &display->index_)) {
     LOG(ERROR) << "Failed to add video track to webm muxer";
-    return;
   }
 
   impl_->displays_.emplace_back(std::move(display));
@@ -184,7 +373,8 @@ void LocalRecorder::Stop() {
   impl_->displays_.clear();
 
   std::lock_guard lock(impl_->mkv_mutex_);
-  impl_->segment_.Finalize();
+  impl_->WriteRecentFrames();
+  impl_->CloseSegment();
 }
 
 LocalRecorder::Display::Display(LocalRecorder::Impl& impl) : impl_(impl) {
@@ -233,7 +423,8 @@ void LocalRecorder::Display::EncoderLoop() {
     std::vector<webrtc::VideoFrameType> types;
     auto time_since_keyframe = now - last_keyframe_time;
     const auto min_keyframe_time = std::chrono::seconds(10);
-    if (frames_since_keyframe > 60 || time_since_keyframe > min_keyframe_time) {
+    if (force_key_frame_.exchange(false) || frames_since_keyframe > 60 ||
+        time_since_keyframe > min_keyframe_time) {
       last_keyframe_time = now;
       frames_since_keyframe = 0;
       types.push_back(webrtc::VideoFrameType::kVideoFrameKey);
@@ -261,14 +452,14 @@ webrtc::EncodedImageCallback::Result LocalRecorder::Display::OnEncodedImage(
     const webrtc::RTPFragmentationHeader* fragmentation) {
   uint64_t timestamp = encoded_image.Timestamp() / kRtpTicksPerNs;
 
-  std::lock_guard(impl_.mkv_mutex_);
+  std::lock_guard lock(impl_.mkv_mutex_);
 
   bool is_key =
       encoded_image._frameType == webrtc::VideoFrameType::kVideoFrameKey;
-  bool success = impl_.segment_.AddFrame(
+  bool success = impl_.AddFrame(
+      index_,
       encoded_image.data(),
       encoded_image.size(),
-      video_track_number_,
       timestamp,
       is_key);
 
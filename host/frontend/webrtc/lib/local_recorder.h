@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <memory>
 #include <string>
 
@@ -30,9 +31,22 @@ class VideoTrackSourceImpl;
 
 class LocalRecorder {
 public:
+  struct Options {
+    // Starts a new file, named after the given one with an increasing suffix,
+    // once the current one holds this long of video. Zero records into a
+    // single file.
+    std::chrono::seconds segment_duration{0};
+    // Only keeps about this long of the most recent video, in memory, and
+    // writes it when the recording stops, e.g. to keep what led to a test
+    // failure. Zero writes everything as it's encoded.
+    std::chrono::seconds keep_last{0};
+  };
+
   ~LocalRecorder();
 
   static std::unique_ptr<LocalRecorder> Create(const std::string& filename);
+  static std::unique_ptr<LocalRecorder> Create(const std::string& filename,
+                                               const Options& options);
 
   void AddDisplay(
       size_t width,
@@ -17,6 +17,9 @@
 #include "host/frontend/webrtc/lib/port_range_socket_factory.h"
 
 #include <android-base/logging.h>
+#include <rtc_base/physical_socket_server.h>
+
+#include "host/frontend/webrtc/lib/batched_udp_socket.h"
 
 namespace cuttlefish {
 namespace webrtc_streaming {
@@ -46,12 +49,28 @@ std::pair<uint16_t, uint16_t> IntersectPortRanges(
   return {std::max(min_port, own_min_port), std::min(max_port, own_max_port)};
 }
 
+// Binds to the first free port of the range, like rtc::BasicPacketSocketFactory
+bool BindInRange(rtc::AsyncSocket& socket,
+                 const rtc::SocketAddress& local_address, uint16_t min_port,
+                 uint16_t max_port) {
+  if (min_port == 0 && max_port == 0) {
+    return socket.Bind(local_address) == 0;
+  }
+  for (uint32_t port = min_port; port <= max_port; port++) {
+    if (socket.Bind(rtc::SocketAddress(local_address.ipaddr(), port)) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
 }  // namespace
 
 PortRangeSocketFactory::PortRangeSocketFactory(
     rtc::Thread* thread, std::pair<uint16_t, uint16_t> udp_port_range,
     std::pair<uint16_t, uint16_t> tcp_port_range)
     : rtc::BasicPacketSocketFactory(thread),
+      thread_(thread),
       udp_port_range_(udp_port_range),
       tcp_port_range_(tcp_port_range) {}
 
@@ -63,8 +82,24 @@ rtc::AsyncPacketSocket* PortRangeSocketFactory::CreateUdpSocket(
     // Own range doesn't intersect with requested range
     return nullptr;
   }
-  return rtc::BasicPacketSocketFactory::CreateUdpSocket(
-      local_address, port_range.first, port_range.second);
+  std::unique_ptr<rtc::AsyncSocket> socket(
+      thread_->socketserver()->CreateAsyncSocket(local_address.family(),
+                                                 SOCK_DGRAM));
+  // The batched socket needs the file descriptor behind it
+  auto dispatcher = dynamic_cast<rtc::Dispatcher*>(socket.get());
+  if (!dispatcher) {
+    return rtc::BasicPacketSocketFactory::CreateUdpSocket(
+        local_address, port_range.first, port_range.second);
+  }
+  if (!BindInRange(*socket, local_address, port_range.first,
+                   port_range.second)) {
+    LOG(ERROR) << "Failed to bind a UDP socket to " << local_address.ToString()
+               << " in [" << port_range.first << "," << port_range.second
+               << "]";
+    return nullptr;
+  }
+  int fd = dispatcher->GetDescriptor();
+  return new BatchedUdpSocket(thread_, socket.release(), fd);
 }
 
 rtc::AsyncPacketSocket* PortRangeSocketFactory::CreateServerTcpSocket(
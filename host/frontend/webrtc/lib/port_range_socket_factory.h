@@ -27,6 +27,9 @@ namespace webrtc_streaming {
 
 // rtc::BasicPacketSocketFactory is not part of the webrtc api so only functions
 // from its upper class should be overridden here.
+//
+// UDP sockets are BatchedUdpSockets when the thread runs a physical socket
+// server, as it does outside of tests.
 class PortRangeSocketFactory : public rtc::BasicPacketSocketFactory {
  public:
   PortRangeSocketFactory(rtc::Thread* thread,
@@ -42,6 +45,7 @@ class PortRangeSocketFactory : public rtc::BasicPacketSocketFactory {
       uint16_t max_port, int opts) override;
 
  private:
+  rtc::Thread* thread_;
   std::pair<uint16_t, uint16_t> udp_port_range_;
   std::pair<uint16_t, uint16_t> tcp_port_range_;
 };
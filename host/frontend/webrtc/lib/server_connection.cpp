@@ -18,8 +18,8 @@
 #include <android-base/logging.h>
 #include <libwebsockets.h>
 
+#include "common/libs/fs/reactor.h"
 #include "common/libs/fs/shared_fd.h"
-#include "common/libs/fs/shared_select.h"
 #include "common/libs/utils/files.h"
 
 namespace cuttlefish {
@@ -38,15 +38,16 @@ class UnixServerConnection : public ServerConnection {
   void Connect() override;
   void StopThread();
   void ReadLoop();
+  void HandleServerMessage();
 
   const std::string addr_;
   SharedFD conn_;
   std::mutex write_mtx_;
   std::weak_ptr<ServerConnectionObserver> observer_;
-  // The event fd must be declared before the thread to ensure it's initialized
+  // The reactor must be declared before the thread to ensure it's initialized
   // before the thread starts and is safe to be accessed from it.
-  SharedFD thread_notifier_;
-  std::atomic_bool running_ = false;
+  std::unique_ptr<Reactor> reactor_;
+  std::vector<uint8_t> buffer_;
   std::thread thread_;
 };
 
@@ -74,7 +75,8 @@ class WsConnection : public std::enable_shared_from_this<WsConnection> {
   void ConnectInner();
 
   void OnError(const std::string& error);
-  void OnReceive(const uint8_t* data, size_t len, bool is_binary);
+  void OnReceive(const uint8_t* data, size_t len, bool is_binary,
+                 bool is_final);
   void OnOpen();
   void OnClose();
   void OnWriteable();
@@ -112,6 +114,8 @@ class WsConnection : public std::enable_shared_from_this<WsConnection> {
   // each element contains the data to be sent and whether it's binary or not
   std::deque<WsBuffer> write_queue_;
   std::mutex write_queue_mutex_;
+  // Fragments of the message being received, only used on the service thread
+  std::vector<uint8_t> receive_buffer_;
   // The connection object should not outlive the context object. This reference
   // guarantees it.
   std::shared_ptr<WsConnectionContext> context_;
@@ -211,89 +215,76 @@ void UnixServerConnection::Connect() {
     }
     return;
   }
-  thread_notifier_ = SharedFD::Event();
-  if (!thread_notifier_->IsOpen()) {
-    LOG(ERROR) << "Failed to create eventfd for background thread: "
-               << thread_notifier_->StrError();
+  auto reactor = Reactor::Create();
+  if (!reactor.ok()) {
+    LOG(ERROR) << "Failed to create event loop for background thread: "
+               << reactor.error();
     if (auto o = observer_.lock(); o) {
-      o->OnError("Failed to create eventfd for background thread");
+      o->OnError("Failed to create event loop for background thread");
     }
     return;
   }
+  reactor_ = std::move(*reactor);
   if (auto o = observer_.lock(); o) {
     o->OnOpen();
   }
   // Start the thread
-  running_ = true;
   thread_ = std::thread([this](){ReadLoop();});
 }
 
 void UnixServerConnection::StopThread() {
-  running_ = false;
-  if (!thread_notifier_->IsOpen()) {
-    // The thread won't be running if this isn't open
+  if (!reactor_) {
+    // The thread won't be running without an event loop
     return;
   }
-  if (thread_notifier_->EventfdWrite(1) < 0) {
-    LOG(ERROR) << "Failed to notify background thread, this thread may block";
-  }
+  reactor_->Stop();
   if (thread_.joinable()) {
     thread_.join();
   }
 }
 
 void UnixServerConnection::ReadLoop() {
-  if (!thread_notifier_->IsOpen()) {
-    LOG(ERROR) << "The UnixServerConnection's background thread is unable to "
-                  "receive notifications so it can't run";
+  buffer_.resize(4096);
+  auto added = reactor_->Add(conn_, EPOLLIN,
+                             [this](uint32_t) { HandleServerMessage(); });
+  if (!added.ok()) {
+    LOG(ERROR) << "Failed to watch the server connection: " << added.error();
     return;
   }
-  std::vector<uint8_t> buffer(4096, 0);
-  while (running_) {
-    SharedFDSet rset;
-    rset.Set(thread_notifier_);
-    rset.Set(conn_);
-    auto res = Select(&rset, nullptr, nullptr, nullptr);
-    if (res < 0) {
-      LOG(ERROR) << "Failed to select from background thread";
-      break;
-    }
-    if (rset.IsSet(thread_notifier_)) {
-      eventfd_t val;
-      auto res = thread_notifier_->EventfdRead(&val);
-      if (res < 0) {
-        LOG(ERROR) << "Error reading from event fd: "
-                   << thread_notifier_->StrError();
-        break;
-      }
+  auto ran = reactor_->Run();
+  if (!ran.ok()) {
+    LOG(ERROR) << "Failed to wait for messages from background thread: "
+               << ran.error();
+  }
+}
+
+void UnixServerConnection::HandleServerMessage() {
+  auto size = conn_->Recv(buffer_.data(), 0, MSG_TRUNC | MSG_PEEK);
+  if (size > buffer_.size()) {
+    // Enlarge enough to accommodate size bytes and be a multiple of 4096
+    auto new_size = (size + 4095) & ~4095;
+    buffer_.resize(new_size);
+  }
+  auto res = conn_->Recv(buffer_.data(), buffer_.size(), MSG_TRUNC);
+  if (res < 0) {
+    LOG(ERROR) << "Failed to read from server: " << conn_->StrError();
+    if (auto observer = observer_.lock(); observer) {
+      observer->OnError(conn_->StrError());
     }
-    if (rset.IsSet(conn_)) {
-      auto size = conn_->Recv(buffer.data(), 0, MSG_TRUNC | MSG_PEEK);
-      if (size > buffer.size()) {
-        // Enlarge enough to accommodate size bytes and be a multiple of 4096
-        auto new_size = (size + 4095) & ~4095;
-        buffer.resize(new_size);
-      }
-      auto res = conn_->Recv(buffer.data(), buffer.size(), MSG_TRUNC);
-      if (res < 0) {
-        LOG(ERROR) << "Failed to read from server: " << conn_->StrError();
-        if (auto observer = observer_.lock(); observer) {
-          observer->OnError(conn_->StrError());
-        }
-        return;
-      }
-      if (res == 0) {
-        auto observer = observer_.lock();
-        if (observer) {
-          observer->OnClose();
-        }
-        break;
-      }
-      auto observer = observer_.lock();
-      if (observer) {
-        observer->OnReceive(buffer.data(), res, false);
-      }
+    reactor_->Stop();
+    return;
+  }
+  if (res == 0) {
+    auto observer = observer_.lock();
+    if (observer) {
+      observer->OnClose();
     }
+    reactor_->Stop();
+    return;
+  }
+  auto observer = observer_.lock();
+  if (observer) {
+    observer->OnReceive(buffer_.data(), res, false);
   }
 }
 
@@ -325,6 +316,15 @@ const struct lws_protocols kProtocols[2] = {
     {kProtocolName, LwsCallback, 0, kBufferSize, 0, NULL, 0},
     {NULL, NULL, 0, 0, 0, NULL, 0}};
 
+#if !defined(LWS_WITHOUT_EXTENSIONS)
+// Signaling messages are JSON with large and repetitive SDPs, they compress
+// well. Only used if the operator accepts it.
+const struct lws_extension kExtensions[] = {
+    {"permessage-deflate", lws_extension_callback_pm_deflate,
+     "permessage-deflate; client_max_window_bits"},
+    {NULL, NULL, NULL}};
+#endif
+
 }  // namespace
 
 std::shared_ptr<WsConnectionContext> WsConnectionContext::Create() {
@@ -332,6 +332,9 @@ std::shared_ptr<WsConnectionContext> WsConnectionContext::Create() {
   context_info.port = CONTEXT_PORT_NO_LISTEN;
   context_info.options = LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT;
   context_info.protocols = kProtocols;
+#if !defined(LWS_WITHOUT_EXTENSIONS)
+  context_info.extensions = kExtensions;
+#endif
   struct lws_context* lws_ctx = lws_create_context(&context_info);
   if (!lws_ctx) {
     return nullptr;
@@ -465,11 +468,24 @@ void WsConnection::OnError(const std::string& error) {
     observer->OnError(error);
   }
 }
-void WsConnection::OnReceive(const uint8_t* data, size_t len, bool is_binary) {
+void WsConnection::OnReceive(const uint8_t* data, size_t len, bool is_binary,
+                             bool is_final) {
+  // Messages larger than the receive buffer, or inflated into several chunks,
+  // arrive in pieces.
+  if (!is_final) {
+    receive_buffer_.insert(receive_buffer_.end(), data, data + len);
+    return;
+  }
+  if (!receive_buffer_.empty()) {
+    receive_buffer_.insert(receive_buffer_.end(), data, data + len);
+    data = receive_buffer_.data();
+    len = receive_buffer_.size();
+  }
   auto observer = observer_.lock();
   if (observer) {
     observer->OnReceive(data, len, is_binary);
   }
+  receive_buffer_.clear();
 }
 void WsConnection::OnOpen() {
   auto observer = observer_.lock();
@@ -478,6 +494,7 @@ void WsConnection::OnOpen() {
   }
 }
 void WsConnection::OnClose() {
+  receive_buffer_.clear();
   auto observer = observer_.lock();
   if (observer) {
     observer->OnClose();
@@ -552,8 +569,10 @@ int LwsCallback(struct lws* wsi, enum lws_callback_reasons reason, void* user,
     case LWS_CALLBACK_CLIENT_RECEIVE:
       return with_connection(
           [in, len, wsi](std::shared_ptr<WsConnection> connection) {
+            bool is_final = lws_remaining_packet_payload(wsi) == 0 &&
+                            lws_is_final_fragment(wsi);
             connection->OnReceive((const uint8_t*)in, len,
-                                  lws_frame_is_binary(wsi));
+                                  lws_frame_is_binary(wsi), is_final);
           });
 
     case LWS_CALLBACK_CLIENT_ESTABLISHED:
@@ -0,0 +1,376 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/lib/shared_encoder_factory.h"
+
+#include <algorithm>
+#include <iterator>
+#include <optional>
+#include <sstream>
+
+#include <android-base/logging.h>
+#include <modules/include/module_common_types.h>
+#include <modules/video_coding/include/video_error_codes.h>
+
+#include "host/frontend/webrtc/lib/video_track_source_impl.h"
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+
+namespace {
+
+constexpr int kGroupOutOfSync = -1000;
+
+struct EncodedOutput {
+  webrtc::EncodedImage image;
+  std::optional<webrtc::CodecSpecificInfo> codec_specific_info;
+  std::unique_ptr<webrtc::RTPFragmentationHeader> fragmentation;
+};
+
+}  // namespace
+
+class SharedEncoderGroup : public webrtc::EncodedImageCallback {
+ public:
+  SharedEncoderGroup(std::unique_ptr<webrtc::VideoEncoder> encoder)
+      : encoder_(std::move(encoder)) {
+    encoder_->RegisterEncodeCompleteCallback(this);
+  }
+  ~SharedEncoderGroup() override { encoder_->Release(); }
+
+  int32_t Join(const void* member, const webrtc::VideoCodec* codec_settings,
+               const webrtc::VideoEncoder::Settings& settings) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    members_[member] = MemberState{};
+    if (initialized_) {
+      return WEBRTC_VIDEO_CODEC_OK;
+    }
+    auto rc = encoder_->InitEncode(codec_settings, settings);
+    initialized_ = rc == WEBRTC_VIDEO_CODEC_OK;
+    return rc;
+  }
+
+  void Leave(const void* member) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    members_.erase(member);
+    ApplyRatesLocked();
+  }
+
+  int32_t Encode(const void* member, const webrtc::VideoFrame& frame,
+                 const std::vector<webrtc::VideoFrameType>* frame_types,
+                 webrtc::EncodedImageCallback* callback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& state = members_[member];
+    const bool key_requested =
+        frame_types &&
+        std::find(frame_types->begin(), frame_types->end(),
+                  webrtc::VideoFrameType::kVideoFrameKey) != frame_types->end();
+    const int64_t timestamp = frame.timestamp_us();
+    const bool shared = members_.size() > 1;
+
+    if (timestamp == last_encoded_timestamp_) {
+      // Another member already encoded this frame.
+      const bool in_sync = state.last_delivered == previous_encoded_timestamp_ ||
+                           (state.needs_key_frame && last_output_is_key_);
+      if (shared && !in_sync) {
+        return kGroupOutOfSync;
+      }
+      if (key_requested && !last_output_is_key_) {
+        key_frame_pending_ = true;
+      }
+      Deliver(state, callback);
+      return WEBRTC_VIDEO_CODEC_OK;
+    }
+
+    const bool in_sync = state.last_delivered == last_encoded_timestamp_ ||
+                         state.needs_key_frame;
+    if (shared && (timestamp < last_encoded_timestamp_ || !in_sync)) {
+      return kGroupOutOfSync;
+    }
+
+    bool key_frame = key_requested || key_frame_pending_;
+    for (const auto& [unused, other] : members_) {
+      key_frame |= other.needs_key_frame;
+    }
+    std::vector<webrtc::VideoFrameType> types = {
+        key_frame ? webrtc::VideoFrameType::kVideoFrameKey
+                  : webrtc::VideoFrameType::kVideoFrameDelta};
+    outputs_.clear();
+    auto rc = encoder_->Encode(frame, &types);
+    if (rc != WEBRTC_VIDEO_CODEC_OK) {
+      return rc;
+    }
+    previous_encoded_timestamp_ = last_encoded_timestamp_;
+    last_encoded_timestamp_ = timestamp;
+    last_output_is_key_ =
+        std::any_of(outputs_.begin(), outputs_.end(), [](const auto& output) {
+          return output.image._frameType ==
+                 webrtc::VideoFrameType::kVideoFrameKey;
+        });
+    if (last_output_is_key_) {
+      key_frame_pending_ = false;
+    }
+    Deliver(state, callback);
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  void SetRates(const void* member,
+                const webrtc::VideoEncoder::RateControlParameters& parameters) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    members_[member].rates = parameters;
+    ApplyRatesLocked();
+  }
+
+  webrtc::VideoEncoder::EncoderInfo GetEncoderInfo() const {
+    return encoder_->GetEncoderInfo();
+  }
+
+  // EncodedImageCallback, called synchronously from encoder_->Encode()
+  webrtc::EncodedImageCallback::Result OnEncodedImage(
+      const webrtc::EncodedImage& encoded_image,
+      const webrtc::CodecSpecificInfo* codec_specific_info,
+      const webrtc::RTPFragmentationHeader* fragmentation) override {
+    EncodedOutput output;
+    output.image = encoded_image;
+    if (codec_specific_info) {
+      output.codec_specific_info = *codec_specific_info;
+    }
+    if (fragmentation) {
+      output.fragmentation = std::make_unique<webrtc::RTPFragmentationHeader>();
+      output.fragmentation->CopyFrom(*fragmentation);
+    }
+    outputs_.push_back(std::move(output));
+    return webrtc::EncodedImageCallback::Result(
+        webrtc::EncodedImageCallback::Result::OK);
+  }
+
+ private:
+  struct MemberState {
+    int64_t last_delivered = -1;
+    bool needs_key_frame = true;
+    std::optional<webrtc::VideoEncoder::RateControlParameters> rates;
+  };
+
+  void Deliver(MemberState& state, webrtc::EncodedImageCallback* callback) {
+    for (const auto& output : outputs_) {
+      callback->OnEncodedImage(
+          output.image,
+          output.codec_specific_info ? &*output.codec_specific_info : nullptr,
+          output.fragmentation.get());
+    }
+    state.last_delivered = last_encoded_timestamp_;
+    if (last_output_is_key_) {
+      state.needs_key_frame = false;
+    }
+  }
+
+  // The slowest member determines the bitrate of the whole group
+  void ApplyRatesLocked() {
+    const webrtc::VideoEncoder::RateControlParameters* slowest = nullptr;
+    for (const auto& [unused, member] : members_) {
+      if (member.rates &&
+          (!slowest || member.rates->bitrate.get_sum_bps() <
+                           slowest->bitrate.get_sum_bps())) {
+        slowest = &*member.rates;
+      }
+    }
+    if (slowest && initialized_) {
+      encoder_->SetRates(*slowest);
+    }
+  }
+
+  std::mutex mutex_;
+  std::unique_ptr<webrtc::VideoEncoder> encoder_;
+  bool initialized_ = false;
+  std::map<const void*, MemberState> members_;
+  std::vector<EncodedOutput> outputs_;
+  int64_t last_encoded_timestamp_ = -1;
+  int64_t previous_encoded_timestamp_ = -1;
+  bool last_output_is_key_ = false;
+  bool key_frame_pending_ = false;
+};
+
+namespace {
+
+// The encoder handed to each peer connection
+class SharedVideoEncoder : public webrtc::VideoEncoder {
+ public:
+  SharedVideoEncoder(SharedEncoderFactory& factory,
+                     const webrtc::SdpVideoFormat& format)
+      : factory_(factory), format_(format) {}
+  ~SharedVideoEncoder() override { Release(); }
+
+  int32_t InitEncode(const webrtc::VideoCodec* codec_settings,
+                     const webrtc::VideoEncoder::Settings& settings) override {
+    Release();
+    codec_settings_ = *codec_settings;
+    settings_.emplace(settings);
+    // The group depends on the source of the frames, known from the first one
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  int32_t RegisterEncodeCompleteCallback(
+      webrtc::EncodedImageCallback* callback) override {
+    callback_ = callback;
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  int32_t Release() override {
+    settings_.reset();
+    if (group_) {
+      group_->Leave(this);
+      group_.reset();
+    }
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  int32_t Encode(const webrtc::VideoFrame& frame,
+                 const std::vector<webrtc::VideoFrameType>* frame_types) override {
+    if (!settings_ || !callback_) {
+      return WEBRTC_VIDEO_CODEC_UNINITIALIZED;
+    }
+    if (!group_) {
+      group_ = factory_.JoinGroup(format_, FrameSourceNumber(frame),
+                                  codec_settings_, *settings_);
+      auto rc = JoinAndApplyRates();
+      if (rc != WEBRTC_VIDEO_CODEC_OK) {
+        return rc;
+      }
+    }
+    auto rc = group_->Encode(this, frame, frame_types, callback_);
+    if (rc != kGroupOutOfSync) {
+      return rc;
+    }
+    LOG(VERBOSE) << "Encoder fell out of sync with its group, using a private "
+                 << "encoder from now on";
+    group_->Leave(this);
+    group_ = factory_.CreatePrivateGroup(format_);
+    rc = JoinAndApplyRates();
+    if (rc != WEBRTC_VIDEO_CODEC_OK) {
+      return rc;
+    }
+    return group_->Encode(this, frame, frame_types, callback_);
+  }
+
+  void SetRates(const RateControlParameters& parameters) override {
+    rates_ = parameters;
+    if (group_) {
+      group_->SetRates(this, parameters);
+    }
+  }
+
+  EncoderInfo GetEncoderInfo() const override {
+    return group_ ? group_->GetEncoderInfo() : EncoderInfo();
+  }
+
+ private:
+  int32_t JoinAndApplyRates() {
+    if (!group_) {
+      return WEBRTC_VIDEO_CODEC_ERROR;
+    }
+    auto rc = group_->Join(this, &codec_settings_, *settings_);
+    if (rc != WEBRTC_VIDEO_CODEC_OK) {
+      group_->Leave(this);
+      group_.reset();
+      return rc;
+    }
+    if (rates_) {
+      group_->SetRates(this, *rates_);
+    }
+    return WEBRTC_VIDEO_CODEC_OK;
+  }
+
+  SharedEncoderFactory& factory_;
+  const webrtc::SdpVideoFormat format_;
+  webrtc::VideoCodec codec_settings_;
+  std::optional<webrtc::VideoEncoder::Settings> settings_;
+  std::optional<RateControlParameters> rates_;
+  webrtc::EncodedImageCallback* callback_ = nullptr;
+  std::shared_ptr<SharedEncoderGroup> group_;
+};
+
+}  // namespace
+
+SharedEncoderFactory::SharedEncoderFactory(
+    std::unique_ptr<webrtc::VideoEncoderFactory> inner)
+    : inner_(std::move(inner)) {}
+
+SharedEncoderFactory::~SharedEncoderFactory() = default;
+
+std::vector<webrtc::SdpVideoFormat> SharedEncoderFactory::GetSupportedFormats()
+    const {
+  return inner_->GetSupportedFormats();
+}
+
+webrtc::VideoEncoderFactory::CodecInfo SharedEncoderFactory::QueryVideoEncoder(
+    const webrtc::SdpVideoFormat& format) const {
+  return inner_->QueryVideoEncoder(format);
+}
+
+std::unique_ptr<webrtc::VideoEncoder> SharedEncoderFactory::CreateVideoEncoder(
+    const webrtc::SdpVideoFormat& format) {
+  // Hardware encoders may deliver their output asynchronously
+  if (inner_->QueryVideoEncoder(format).is_hardware_accelerated) {
+    return inner_->CreateVideoEncoder(format);
+  }
+  return std::make_unique<SharedVideoEncoder>(*this, format);
+}
+
+std::unique_ptr<webrtc::VideoEncoderFactory::EncoderSelectorInterface>
+SharedEncoderFactory::GetEncoderSelector() const {
+  return inner_->GetEncoderSelector();
+}
+
+std::shared_ptr<SharedEncoderGroup> SharedEncoderFactory::JoinGroup(
+    const webrtc::SdpVideoFormat& format, uint16_t source,
+    const webrtc::VideoCodec& codec,
+    const webrtc::VideoEncoder::Settings& settings) {
+  // Anything that changes the encoder's output must be the same for everyone
+  std::stringstream key;
+  key << format.ToString() << " source " << source << " " << codec.width << "x"
+      << codec.height << " mode " << static_cast<int>(codec.mode) << " fps "
+      << codec.maxFramerate << " qp " << codec.qpMax << " simulcast "
+      << static_cast<int>(codec.numberOfSimulcastStreams) << " cores "
+      << settings.number_of_cores << " payload " << settings.max_payload_size;
+  if (source == 0) {
+    // Frames of unknown origin could come from anywhere
+    return CreatePrivateGroup(format);
+  }
+  std::lock_guard<std::mutex> lock(groups_mutex_);
+  for (auto it = groups_.begin(); it != groups_.end();) {
+    it = it->second.expired() ? groups_.erase(it) : std::next(it);
+  }
+  if (auto it = groups_.find(key.str()); it != groups_.end()) {
+    return it->second.lock();
+  }
+  auto group = CreatePrivateGroup(format);
+  if (group) {
+    groups_[key.str()] = group;
+  }
+  return group;
+}
+
+std::shared_ptr<SharedEncoderGroup> SharedEncoderFactory::CreatePrivateGroup(
+    const webrtc::SdpVideoFormat& format) {
+  auto encoder = inner_->CreateVideoEncoder(format);
+  if (!encoder) {
+    LOG(ERROR) << "Failed to create encoder for " << format.ToString();
+    return nullptr;
+  }
+  return std::make_shared<SharedEncoderGroup>(std::move(encoder));
+}
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
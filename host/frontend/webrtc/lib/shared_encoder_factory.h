@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <api/video_codecs/video_encoder_factory.h>
+#include <api/video_codecs/video_encoder.h>
+
+namespace cuttlefish {
+namespace webrtc_streaming {
+
+class SharedEncoderGroup;
+
+// Lets the encoders of several peer connections streaming the same display
+// share a single real encoder.
+//
+// Encoders created by this factory join a group of encoders using the same
+// format and settings for frames from the same source, as told by
+// FrameSourceNumber, once they get their first frame. The first member to be
+// handed a frame encodes it, the others get the same encoded output instead of
+// encoding the frame again.
+// The group's bitrate is the lowest of its members', key frame requests from
+// any member apply to everyone, and a member that stops receiving the same
+// frames as the rest of its group, e.g. because it streams at a lower frame
+// rate, leaves it for an encoder of its own.
+//
+// Only encoders that produce their output synchronously from Encode(), like
+// libwebrtc's software encoders, can be shared; others are used as is.
+class SharedEncoderFactory : public webrtc::VideoEncoderFactory {
+ public:
+  SharedEncoderFactory(std::unique_ptr<webrtc::VideoEncoderFactory> inner);
+  ~SharedEncoderFactory() override;
+
+  std::vector<webrtc::SdpVideoFormat> GetSupportedFormats() const override;
+
+  CodecInfo QueryVideoEncoder(
+      const webrtc::SdpVideoFormat& format) const override;
+
+  std::unique_ptr<webrtc::VideoEncoder> CreateVideoEncoder(
+      const webrtc::SdpVideoFormat& format) override;
+
+  std::unique_ptr<EncoderSelectorInterface> GetEncoderSelector() const override;
+
+  // Returns the group for the given source and settings, creating it if needed
+  std::shared_ptr<SharedEncoderGroup> JoinGroup(
+      const webrtc::SdpVideoFormat& format, uint16_t source,
+      const webrtc::VideoCodec& codec,
+      const webrtc::VideoEncoder::Settings& settings);
+
+  // Creates a private group that no other member will join
+  std::shared_ptr<SharedEncoderGroup> CreatePrivateGroup(
+      const webrtc::SdpVideoFormat& format);
+
+ private:
+  std::shared_ptr<webrtc::VideoEncoderFactory> inner_;
+  std::mutex groups_mutex_;
+  std::map<std::string, std::weak_ptr<SharedEncoderGroup>> groups_;
+};
+
+}  // namespace webrtc_streaming
+}  // namespace cuttlefish
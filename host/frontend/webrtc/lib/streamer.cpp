@@ -16,6 +16,8 @@
 
 #include "host/frontend/webrtc/lib/streamer.h"
 
+#include <optional>
+
 #include <android-base/logging.h>
 #include <json/json.h>
 
@@ -32,13 +34,16 @@
 #include <media/base/video_broadcaster.h>
 #include <pc/video_track_source.h>
 
+#include "common/libs/utils/base64.h"
 #include "host/frontend/webrtc/lib/audio_device.h"
 #include "host/frontend/webrtc/lib/audio_track_source_impl.h"
+#include "host/frontend/webrtc/lib/camera_group.h"
 #include "host/frontend/webrtc/lib/camera_streamer.h"
 #include "host/frontend/webrtc/lib/client_handler.h"
+#include "host/frontend/webrtc/lib/encoder_factory.h"
 #include "host/frontend/webrtc/lib/port_range_socket_factory.h"
+#include "host/frontend/webrtc/lib/shared_encoder_factory.h"
 #include "host/frontend/webrtc/lib/video_track_source_impl.h"
-#include "host/frontend/webrtc/lib/vp8only_encoder_factory.h"
 #include "host/frontend/webrtc_operator/constants/signaling_constants.h"
 
 namespace cuttlefish {
@@ -66,6 +71,9 @@ constexpr int kRegistrationRetries = 3;
 constexpr int kRetryFirstIntervalMs = 1000;
 constexpr int kReconnectRetries = 100;
 constexpr int kReconnectIntervalMs = 1000;
+// All media is bundled over one transport, a single pooled ICE session covers
+// it.
+constexpr int kIceCandidatePoolSize = 1;
 
 bool ParseMessage(const uint8_t* data, size_t length, Json::Value* msg_out) {
   auto str = reinterpret_cast<const char*>(data);
@@ -140,8 +148,27 @@ class Streamer::Impl : public ServerConnectionObserver,
  public:
   std::shared_ptr<ClientHandler> CreateClientHandler(int client_id);
 
+  // A client handler built ahead of time, so that new clients find the peer
+  // connection with its tracks, DTLS certificate and ICE candidates ready.
+  // Its callbacks read the client id from the shared holder, which is assigned
+  // when a client claims it.
+  struct PreparedClientHandler {
+    std::shared_ptr<ClientHandler> handler;
+    std::shared_ptr<int> client_id;
+  };
+  PreparedClientHandler BuildClientHandler();
+  void PrepareSpareClientHandler();
+  rtc::scoped_refptr<webrtc::VideoTrackInterface> CreateDisplayTrack(
+      const std::string& label, const DisplayDescriptor& display);
+
+  Json::Value DeviceInfo() const;
+  // Tells the operator and the connected clients about changes in the device
+  // info, like displays added or removed.
+  void PublishDeviceInfo();
+
   void Register(std::weak_ptr<OperatorObserver> observer);
 
+  void PublishThumbnail(Json::Value thumbnail);
   void SendMessageToClient(int client_id, const Json::Value& msg);
   void DestroyClientHandler(int client_id);
   void SetupCameraForClient(int client_id);
@@ -152,8 +179,10 @@ class Streamer::Impl : public ServerConnectionObserver,
   void OnError(const std::string& error) override;
   void OnReceive(const uint8_t* msg, size_t length, bool is_binary) override;
 
+  void HandleServerMessage(const Json::Value& server_message);
   void HandleConfigMessage(const Json::Value& msg);
   void HandleClientMessage(const Json::Value& server_message);
+  void FlushClientMessages();
 
   // All accesses to these variables happen from the signal_thread, so there is
   // no need for extra synchronization mechanisms (mutex)
@@ -170,11 +199,23 @@ class Streamer::Impl : public ServerConnectionObserver,
   std::map<std::string, rtc::scoped_refptr<AudioTrackSourceImpl>>
       audio_sources_;
   std::map<int, std::shared_ptr<ClientHandler>> clients_;
+  // Built once the ICE servers are known, dropped when the tracks change
+  std::optional<PreparedClientHandler> spare_client_handler_;
   std::weak_ptr<OperatorObserver> operator_observer_;
+  // Whether the register message was sent on the current connection
+  bool registered_ = false;
+  // Null until a thumbnail is published
+  Json::Value last_thumbnail_;
+  // Whether the operator takes several messages in one frame
+  bool operator_accepts_batches_ = false;
+  // Messages for the clients produced while handling the current task, sent
+  // together once it's done. Candidates are produced in such bursts.
+  Json::Value pending_client_messages_ = Json::Value(Json::arrayValue);
   std::map<std::string, std::string> hardware_;
   std::vector<ControlPanelButtonDescriptor> custom_control_panel_buttons_;
   std::shared_ptr<AudioDeviceModuleWrapper> audio_device_module_;
-  std::unique_ptr<CameraStreamer> camera_streamer_;
+  std::vector<std::unique_ptr<CameraStreamer>> camera_streamers_;
+  CameraGroup camera_group_;
   int registration_retries_left_ = kRegistrationRetries;
   int retry_interval_ms_ = kRetryFirstIntervalMs;
 };
@@ -205,13 +246,23 @@ std::unique_ptr<Streamer> Streamer::Create(
       rtc::scoped_refptr<CfAudioDeviceModule>(
           new rtc::RefCountedObject<CfAudioDeviceModule>()));
 
+  std::vector<std::unique_ptr<webrtc::VideoEncoderFactory>> encoder_factories;
+  encoder_factories.push_back(webrtc::CreateBuiltinVideoEncoderFactory());
+  std::unique_ptr<webrtc::VideoEncoderFactory> video_encoder_factory =
+      std::make_unique<CompositeEncoderFactory>(std::move(encoder_factories),
+                                                cfg.video_codecs,
+                                                cfg.screen_content);
+  if (cfg.share_video_encoders) {
+    video_encoder_factory =
+        std::make_unique<SharedEncoderFactory>(std::move(video_encoder_factory));
+  }
+
   impl->peer_connection_factory_ = webrtc::CreatePeerConnectionFactory(
       impl->network_thread_.get(), impl->worker_thread_.get(),
       impl->signal_thread_.get(), impl->audio_device_module_->device_module(),
       webrtc::CreateBuiltinAudioEncoderFactory(),
       webrtc::CreateBuiltinAudioDecoderFactory(),
-      std::make_unique<VP8OnlyEncoderFactory>(
-          webrtc::CreateBuiltinVideoEncoderFactory()),
+      std::move(video_encoder_factory),
       webrtc::CreateBuiltinVideoDecoderFactory(), nullptr /* audio_mixer */,
       nullptr /* audio_processing */);
 
@@ -242,13 +293,39 @@ std::shared_ptr<VideoSink> Streamer::AddDisplay(const std::string& label,
           return nullptr;
         }
         rtc::scoped_refptr<VideoTrackSourceImpl> source(
-            new rtc::RefCountedObject<VideoTrackSourceImpl>(width, height));
-        impl_->displays_[label] = {width, height, dpi, touch_enabled, source};
+            new rtc::RefCountedObject<VideoTrackSourceImpl>(
+                width, height, impl_->config_.screen_content));
+        auto& display = impl_->displays_[label];
+        display = {width, height, dpi, touch_enabled, source};
+        // The spare handler lacks a track for this display
+        impl_->spare_client_handler_.reset();
+        // Displays added after the clients connected are negotiated again
+        for (auto& [client_id, client] : impl_->clients_) {
+          client->AddDisplay(impl_->CreateDisplayTrack(label, display), label,
+                             impl_->config_.screen_content);
+        }
+        impl_->PublishDeviceInfo();
         return std::shared_ptr<VideoSink>(
             new VideoTrackSourceImplSinkWrapper(source));
       });
 }
 
+void Streamer::RemoveDisplay(const std::string& label) {
+  // Usually called from an application thread
+  impl_->signal_thread_->Invoke<void>(RTC_FROM_HERE, [this, &label]() {
+    if (!impl_->displays_.erase(label)) {
+      LOG(ERROR) << "No display with label: " << label;
+      return;
+    }
+    // The spare handler has a track for this display
+    impl_->spare_client_handler_.reset();
+    for (auto& [client_id, client] : impl_->clients_) {
+      client->RemoveDisplay(label);
+    }
+    impl_->PublishDeviceInfo();
+  });
+}
+
 std::shared_ptr<AudioSink> Streamer::AddAudioStream(const std::string& label) {
   // Usually called from an application thread
   return impl_->signal_thread_->Invoke<std::shared_ptr<AudioSink>>(
@@ -261,6 +338,7 @@ std::shared_ptr<AudioSink> Streamer::AddAudioStream(const std::string& label) {
         rtc::scoped_refptr<AudioTrackSourceImpl> source(
             new rtc::RefCountedObject<AudioTrackSourceImpl>());
         impl_->audio_sources_[label] = source;
+        impl_->spare_client_handler_.reset();
         return std::shared_ptr<AudioSink>(
             new AudioTrackSourceImplSinkWrapper(source));
       });
@@ -270,9 +348,12 @@ std::shared_ptr<AudioSource> Streamer::GetAudioSource() {
   return impl_->audio_device_module_;
 }
 
-CameraController* Streamer::AddCamera(unsigned int port, unsigned int cid) {
-  impl_->camera_streamer_ = std::make_unique<CameraStreamer>(port, cid);
-  return impl_->camera_streamer_.get();
+CameraController* Streamer::AddCamera(unsigned int port, unsigned int cid,
+                                      const std::string& frames_pmem_path) {
+  impl_->camera_streamers_.push_back(
+      std::make_unique<CameraStreamer>(port, cid, frames_pmem_path));
+  impl_->camera_group_.AddCamera(impl_->camera_streamers_.back().get());
+  return &impl_->camera_group_;
 }
 
 void Streamer::SetHardwareSpec(std::string key, std::string value) {
@@ -317,8 +398,30 @@ void Streamer::Register(std::weak_ptr<OperatorObserver> observer) {
 
 void Streamer::Unregister() {
   // Usually called from an application thread.
+  impl_->signal_thread_->PostTask(RTC_FROM_HERE, [this]() {
+    impl_->server_connection_.reset();
+    impl_->registered_ = false;
+  });
+}
+
+void Streamer::PublishThumbnail(const std::string& content_type,
+                                std::vector<char> image) {
+  // Called from the thumbnail thread, encoded there to keep the signal thread
+  // free.
+  std::string encoded_image;
+  if (!EncodeBase64(image.data(), image.size(), &encoded_image)) {
+    LOG(ERROR) << "Failed to encode the thumbnail";
+    return;
+  }
+  Json::Value thumbnail;
+  thumbnail[cuttlefish::webrtc_signaling::kTypeField] =
+      cuttlefish::webrtc_signaling::kThumbnailType;
+  thumbnail[cuttlefish::webrtc_signaling::kContentTypeField] = content_type;
+  thumbnail[cuttlefish::webrtc_signaling::kImageField] = encoded_image;
   impl_->signal_thread_->PostTask(
-      RTC_FROM_HERE, [this]() { impl_->server_connection_.reset(); });
+      RTC_FROM_HERE, [this, thumbnail = std::move(thumbnail)]() {
+        impl_->PublishThumbnail(thumbnail);
+      });
 }
 
 void Streamer::RecordDisplays(LocalRecorder& recorder) {
@@ -349,6 +452,97 @@ void Streamer::Impl::Register(std::weak_ptr<OperatorObserver> observer) {
   }
 }
 
+Json::Value Streamer::Impl::DeviceInfo() const {
+  CHECK(signal_thread_->IsCurrent())
+      << __FUNCTION__ << " called from the wrong thread";
+  Json::Value device_info;
+  Json::Value displays(Json::ValueType::arrayValue);
+  for (auto& entry : displays_) {
+    Json::Value display;
+    display[kStreamIdField] = entry.first;
+    display[kXResField] = entry.second.width;
+    display[kYResField] = entry.second.height;
+    display[kDpiField] = entry.second.dpi;
+    display[kIsTouchField] = entry.second.touch_enabled;
+    displays.append(display);
+  }
+  device_info[kDisplaysField] = displays;
+  Json::Value audio_streams(Json::ValueType::arrayValue);
+  for (auto& entry : audio_sources_) {
+    Json::Value audio;
+    audio[kStreamIdField] = entry.first;
+    audio_streams.append(audio);
+  }
+  device_info[kAudioStreamsField] = audio_streams;
+  Json::Value hardware;
+  for (const auto& [k, v] : hardware_) {
+    hardware[k] = v;
+  }
+  device_info[kHardwareField] = hardware;
+  Json::Value custom_control_panel_buttons(Json::arrayValue);
+  for (const auto& button : custom_control_panel_buttons_) {
+    Json::Value button_entry;
+    button_entry[kControlPanelButtonCommand] = button.command;
+    button_entry[kControlPanelButtonTitle] = button.title;
+    button_entry[kControlPanelButtonIconName] = button.icon_name;
+    if (button.shell_command) {
+      button_entry[kControlPanelButtonShellCommand] = *(button.shell_command);
+    } else if (!button.device_states.empty()) {
+      Json::Value device_states(Json::arrayValue);
+      for (const DeviceState& device_state : button.device_states) {
+        Json::Value device_state_entry;
+        if (device_state.lid_switch_open) {
+          device_state_entry[kControlPanelButtonLidSwitchOpen] =
+              *device_state.lid_switch_open;
+        }
+        if (device_state.hinge_angle_value) {
+          device_state_entry[kControlPanelButtonHingeAngleValue] =
+              *device_state.hinge_angle_value;
+        }
+        device_states.append(device_state_entry);
+      }
+      button_entry[kControlPanelButtonDeviceStates] = device_states;
+    }
+    custom_control_panel_buttons.append(button_entry);
+  }
+  device_info[kCustomControlPanelButtonsField] = custom_control_panel_buttons;
+  return device_info;
+}
+
+void Streamer::Impl::PublishDeviceInfo() {
+  CHECK(signal_thread_->IsCurrent())
+      << __FUNCTION__ << " called from the wrong thread";
+  auto device_info = DeviceInfo();
+  if (server_connection_ && registered_) {
+    Json::Value msg;
+    msg[cuttlefish::webrtc_signaling::kTypeField] =
+        cuttlefish::webrtc_signaling::kDeviceInfoType;
+    msg[cuttlefish::webrtc_signaling::kDeviceInfoField] = device_info;
+    server_connection_->Send(msg);
+  }
+  // Connected clients learn about the change from the device, since the
+  // operator only gives them the info when they connect.
+  Json::Value msg;
+  msg["type"] = "device-info";
+  msg["device_info"] = device_info;
+  for (auto& [client_id, client] : clients_) {
+    SendMessageToClient(client_id, msg);
+  }
+}
+
+rtc::scoped_refptr<webrtc::VideoTrackInterface>
+Streamer::Impl::CreateDisplayTrack(const std::string& label,
+                                   const DisplayDescriptor& display) {
+  auto video_track =
+      peer_connection_factory_->CreateVideoTrack(label, display.source.get());
+  if (config_.screen_content) {
+    // Degrades the frame rate rather than the resolution under congestion
+    video_track->set_content_hint(
+        webrtc::VideoTrackInterface::ContentHint::kText);
+  }
+  return video_track;
+}
+
 void Streamer::Impl::OnOpen() {
   // Called from the websocket thread.
   // Connected to operator.
@@ -361,62 +555,15 @@ void Streamer::Impl::OnOpen() {
     CHECK(config_.client_files_port >= 0) << "Invalide device port provided";
     register_obj[cuttlefish::webrtc_signaling::kDevicePortField] =
         config_.client_files_port;
-
-    Json::Value device_info;
-    Json::Value displays(Json::ValueType::arrayValue);
-    // No need to synchronize with other accesses to display_ because all
-    // happens on signal_thread.
-    for (auto& entry : displays_) {
-      Json::Value display;
-      display[kStreamIdField] = entry.first;
-      display[kXResField] = entry.second.width;
-      display[kYResField] = entry.second.height;
-      display[kDpiField] = entry.second.dpi;
-      display[kIsTouchField] = true;
-      displays.append(display);
-    }
-    device_info[kDisplaysField] = displays;
-    Json::Value audio_streams(Json::ValueType::arrayValue);
-    for (auto& entry : audio_sources_) {
-      Json::Value audio;
-      audio[kStreamIdField] = entry.first;
-      audio_streams.append(audio);
-    }
-    device_info[kAudioStreamsField] = audio_streams;
-    Json::Value hardware;
-    for (const auto& [k, v] : hardware_) {
-      hardware[k] = v;
-    }
-    device_info[kHardwareField] = hardware;
-    Json::Value custom_control_panel_buttons(Json::arrayValue);
-    for (const auto& button : custom_control_panel_buttons_) {
-      Json::Value button_entry;
-      button_entry[kControlPanelButtonCommand] = button.command;
-      button_entry[kControlPanelButtonTitle] = button.title;
-      button_entry[kControlPanelButtonIconName] = button.icon_name;
-      if (button.shell_command) {
-        button_entry[kControlPanelButtonShellCommand] = *(button.shell_command);
-      } else if (!button.device_states.empty()) {
-        Json::Value device_states(Json::arrayValue);
-        for (const DeviceState& device_state : button.device_states) {
-          Json::Value device_state_entry;
-          if (device_state.lid_switch_open) {
-            device_state_entry[kControlPanelButtonLidSwitchOpen] =
-                *device_state.lid_switch_open;
-          }
-          if (device_state.hinge_angle_value) {
-            device_state_entry[kControlPanelButtonHingeAngleValue] =
-                *device_state.hinge_angle_value;
-          }
-          device_states.append(device_state_entry);
-        }
-        button_entry[kControlPanelButtonDeviceStates] = device_states;
-      }
-      custom_control_panel_buttons.append(button_entry);
-    }
-    device_info[kCustomControlPanelButtonsField] = custom_control_panel_buttons;
-    register_obj[cuttlefish::webrtc_signaling::kDeviceInfoField] = device_info;
+    register_obj[cuttlefish::webrtc_signaling::kDeviceInfoField] =
+        DeviceInfo();
+    register_obj[cuttlefish::webrtc_signaling::kAcceptsBatchesField] = true;
+    register_obj[cuttlefish::webrtc_signaling::kAcceptsBinaryField] = true;
     server_connection_->Send(register_obj);
+    registered_ = true;
+    if (!last_thumbnail_.isNull()) {
+      server_connection_->Send(last_thumbnail_);
+    }
     // Do this last as OnRegistered() is user code and may take some time to
     // complete (although it shouldn't...)
     auto observer = operator_observer_.lock();
@@ -432,6 +579,8 @@ void Streamer::Impl::OnClose() {
   // device to decide when to disconnect.
   LOG(WARNING) << "Connection with server closed unexpectedly";
   signal_thread_->PostTask(RTC_FROM_HERE, [this]() {
+    registered_ = false;
+    operator_accepts_batches_ = false;
     auto observer = operator_observer_.lock();
     if (observer) {
       observer->OnClose();
@@ -471,9 +620,19 @@ void Streamer::Impl::OnError(const std::string& error) {
   }
 }
 
+void Streamer::Impl::PublishThumbnail(Json::Value thumbnail) {
+  last_thumbnail_ = std::move(thumbnail);
+  if (server_connection_ && registered_) {
+    server_connection_->Send(last_thumbnail_);
+  }
+}
+
 void Streamer::Impl::HandleConfigMessage(const Json::Value& server_message) {
   CHECK(signal_thread_->IsCurrent())
       << __FUNCTION__ << " called from the wrong thread";
+  operator_accepts_batches_ =
+      server_message[cuttlefish::webrtc_signaling::kAcceptsBatchesField]
+          .asBool();
   if (server_message.isMember("ice_servers") &&
       server_message["ice_servers"].isArray()) {
     auto servers = server_message["ice_servers"];
@@ -507,6 +666,9 @@ void Streamer::Impl::HandleConfigMessage(const Json::Value& server_message) {
       }
     }
   }
+  // A spare handler built earlier uses outdated ICE servers
+  spare_client_handler_.reset();
+  PrepareSpareClientHandler();
 }
 
 void Streamer::Impl::HandleClientMessage(const Json::Value& server_message) {
@@ -544,7 +706,8 @@ void Streamer::Impl::OnReceive(const uint8_t* msg, size_t length,
   Json::Value server_message;
   // Once OnReceive returns the buffer can be destroyed/recycled at any time, so
   // parse the data into a JSON object while still on the websocket thread.
-  if (is_binary || !ParseMessage(msg, length, &server_message)) {
+  // Binary frames carry JSON too, the operator uses them for large messages.
+  if (!ParseMessage(msg, length, &server_message)) {
     LOG(ERROR) << "Received invalid JSON from server: '"
                << (is_binary ? std::string("(binary_data)")
                              : std::string(msg, msg + length))
@@ -553,60 +716,106 @@ void Streamer::Impl::OnReceive(const uint8_t* msg, size_t length,
   }
   // Transition to the signal thread before member variables are accessed.
   signal_thread_->PostTask(RTC_FROM_HERE, [this, server_message]() {
-    if (!server_message.isMember(cuttlefish::webrtc_signaling::kTypeField) ||
-        !server_message[cuttlefish::webrtc_signaling::kTypeField].isString()) {
-      LOG(ERROR) << "No message_type field from server";
-      // Notify the caller
-      OnError(
-          "Invalid message received from operator: no message type field "
-          "present");
+    if (!server_message.isArray()) {
+      HandleServerMessage(server_message);
       return;
     }
-    auto type =
-        server_message[cuttlefish::webrtc_signaling::kTypeField].asString();
-    if (type == cuttlefish::webrtc_signaling::kConfigType) {
-      HandleConfigMessage(server_message);
-    } else if (type == cuttlefish::webrtc_signaling::kClientDisconnectType) {
-      if (!server_message.isMember(
-              cuttlefish::webrtc_signaling::kClientIdField) ||
-          !server_message.isMember(
-              cuttlefish::webrtc_signaling::kClientIdField)) {
-        LOG(ERROR) << "Invalid disconnect message received from server";
-        // Notify the caller
-        OnError("Invalid disconnect message: client_id is required");
-        return;
-      }
-      auto client_id =
-          server_message[cuttlefish::webrtc_signaling::kClientIdField].asInt();
-      LOG(INFO) << "Client " << client_id << " has disconnected.";
-      DestroyClientHandler(client_id);
-    } else if (type == cuttlefish::webrtc_signaling::kClientMessageType) {
-      HandleClientMessage(server_message);
-    } else {
-      LOG(ERROR) << "Unknown message type: " << type;
+    // A batch of messages
+    for (const auto& message : server_message) {
+      HandleServerMessage(message);
+    }
+  });
+}
+
+void Streamer::Impl::HandleServerMessage(const Json::Value& server_message) {
+  CHECK(signal_thread_->IsCurrent())
+      << __FUNCTION__ << " called from the wrong thread";
+  if (!server_message.isObject() ||
+      !server_message.isMember(cuttlefish::webrtc_signaling::kTypeField) ||
+      !server_message[cuttlefish::webrtc_signaling::kTypeField].isString()) {
+    LOG(ERROR) << "No message_type field from server";
+    // Notify the caller
+    OnError(
+        "Invalid message received from operator: no message type field "
+        "present");
+    return;
+  }
+  auto type =
+      server_message[cuttlefish::webrtc_signaling::kTypeField].asString();
+  if (type == cuttlefish::webrtc_signaling::kConfigType) {
+    HandleConfigMessage(server_message);
+  } else if (type == cuttlefish::webrtc_signaling::kClientDisconnectType) {
+    if (!server_message.isMember(
+            cuttlefish::webrtc_signaling::kClientIdField) ||
+        !server_message.isMember(
+            cuttlefish::webrtc_signaling::kClientIdField)) {
+      LOG(ERROR) << "Invalid disconnect message received from server";
       // Notify the caller
-      OnError("Invalid message received from operator: unknown message type");
+      OnError("Invalid disconnect message: client_id is required");
       return;
     }
-  });
+    auto client_id =
+        server_message[cuttlefish::webrtc_signaling::kClientIdField].asInt();
+    LOG(INFO) << "Client " << client_id << " has disconnected.";
+    DestroyClientHandler(client_id);
+  } else if (type == cuttlefish::webrtc_signaling::kClientMessageType) {
+    HandleClientMessage(server_message);
+  } else {
+    LOG(ERROR) << "Unknown message type: " << type;
+    // Notify the caller
+    OnError("Invalid message received from operator: unknown message type");
+    return;
+  }
 }
 
 std::shared_ptr<ClientHandler> Streamer::Impl::CreateClientHandler(
     int client_id) {
   CHECK(signal_thread_->IsCurrent())
       << __FUNCTION__ << " called from the wrong thread";
+  PreparedClientHandler prepared;
+  if (spare_client_handler_) {
+    prepared = std::move(*spare_client_handler_);
+    spare_client_handler_.reset();
+  } else {
+    prepared = BuildClientHandler();
+  }
+  if (!prepared.handler) {
+    return nullptr;
+  }
+  *prepared.client_id = client_id;
+  prepared.handler->SetClientId(client_id);
+  // Replace the spare after the messages of this client have been handled
+  signal_thread_->PostTask(RTC_FROM_HERE,
+                           [this]() { PrepareSpareClientHandler(); });
+  return prepared.handler;
+}
+
+void Streamer::Impl::PrepareSpareClientHandler() {
+  CHECK(signal_thread_->IsCurrent())
+      << __FUNCTION__ << " called from the wrong thread";
+  if (spare_client_handler_ || !server_connection_) {
+    return;
+  }
+  auto prepared = BuildClientHandler();
+  if (prepared.handler) {
+    spare_client_handler_ = std::move(prepared);
+  }
+}
+
+Streamer::Impl::PreparedClientHandler Streamer::Impl::BuildClientHandler() {
   auto observer = connection_observer_factory_->CreateObserver();
 
+  auto client_id = std::make_shared<int>(0);
   auto client_handler = ClientHandler::Create(
-      client_id, observer,
+      0, observer,
       [this, client_id](const Json::Value& msg) {
-        SendMessageToClient(client_id, msg);
+        SendMessageToClient(*client_id, msg);
       },
       [this, client_id](bool isOpen) {
         if (isOpen) {
-          SetupCameraForClient(client_id);
+          SetupCameraForClient(*client_id);
         } else {
-          DestroyClientHandler(client_id);
+          DestroyClientHandler(*client_id);
         }
       });
 
@@ -615,6 +824,10 @@ std::shared_ptr<ClientHandler> Streamer::Impl::CreateClientHandler(
   config.enable_dtls_srtp = true;
   config.servers.insert(config.servers.end(), operator_config_.servers.begin(),
                         operator_config_.servers.end());
+  // Gather candidates (and allocate their ports) as soon as the peer
+  // connection is created instead of when the offer is, which for spare
+  // handlers happens before the client even shows up.
+  config.ice_candidate_pool_size = kIceCandidatePoolSize;
   webrtc::PeerConnectionDependencies dependencies(client_handler.get());
   // PortRangeSocketFactory's super class' constructor needs to be called on the
   // network thread or have it as a parameter
@@ -625,20 +838,16 @@ std::shared_ptr<ClientHandler> Streamer::Impl::CreateClientHandler(
 
   if (!peer_connection) {
     LOG(ERROR) << "Failed to create peer connection";
-    return nullptr;
+    return {};
   }
 
   if (!client_handler->SetPeerConnection(std::move(peer_connection))) {
-    return nullptr;
+    return {};
   }
 
-  for (auto& entry : displays_) {
-    auto& label = entry.first;
-    auto& video_source = entry.second.source;
-
-    auto video_track =
-        peer_connection_factory_->CreateVideoTrack(label, video_source.get());
-    client_handler->AddDisplay(video_track, label);
+  for (auto& [label, display] : displays_) {
+    client_handler->AddDisplay(CreateDisplayTrack(label, display), label,
+                               config_.screen_content);
   }
 
   for (auto& entry : audio_sources_) {
@@ -649,7 +858,7 @@ std::shared_ptr<ClientHandler> Streamer::Impl::CreateClientHandler(
     client_handler->AddAudio(audio_track, label);
   }
 
-  return client_handler;
+  return {client_handler, client_id};
 }
 
 void Streamer::Impl::SendMessageToClient(int client_id,
@@ -662,9 +871,31 @@ void Streamer::Impl::SendMessageToClient(int client_id,
   wrapper[cuttlefish::webrtc_signaling::kTypeField] =
       cuttlefish::webrtc_signaling::kForwardType;
   wrapper[cuttlefish::webrtc_signaling::kClientIdField] = client_id;
-  // This is safe to call from the webrtc threads because
-  // ServerConnection(s) are thread safe
-  server_connection_->Send(wrapper);
+  if (!operator_accepts_batches_) {
+    server_connection_->Send(wrapper);
+    return;
+  }
+  if (pending_client_messages_.empty()) {
+    // Runs after the tasks already queued, which may add to the batch
+    signal_thread_->PostTask(RTC_FROM_HERE,
+                             [this]() { FlushClientMessages(); });
+  }
+  pending_client_messages_.append(wrapper);
+}
+
+void Streamer::Impl::FlushClientMessages() {
+  CHECK(signal_thread_->IsCurrent())
+      << __FUNCTION__ << " called from the wrong thread";
+  Json::Value messages(Json::arrayValue);
+  std::swap(messages, pending_client_messages_);
+  if (messages.empty() || !server_connection_) {
+    return;
+  }
+  if (messages.size() == 1) {
+    server_connection_->Send(messages[0]);
+  } else {
+    server_connection_->Send(messages);
+  }
 }
 
 void Streamer::Impl::DestroyClientHandler(int client_id) {
@@ -684,14 +915,14 @@ void Streamer::Impl::DestroyClientHandler(int client_id) {
 }
 
 void Streamer::Impl::SetupCameraForClient(int client_id) {
-  if (!camera_streamer_) {
+  auto client_handler = clients_[client_id];
+  if (!client_handler) {
     return;
   }
-  auto client_handler = clients_[client_id];
-  if (client_handler) {
-    auto camera_track = client_handler->GetCameraStream();
+  for (std::size_t index = 0; index < camera_streamers_.size(); index++) {
+    auto camera_track = client_handler->GetCameraStream(index);
     if (camera_track) {
-      camera_track->AddOrUpdateSink(camera_streamer_.get(),
+      camera_track->AddOrUpdateSink(camera_streamers_[index].get(),
                                     rtc::VideoSinkWants());
     }
   }
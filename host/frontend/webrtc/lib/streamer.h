@@ -49,6 +49,16 @@ struct StreamerConfig {
   // [0,0] means all ports
   std::pair<uint16_t, uint16_t> udp_port_range = {15550, 15558};
   std::pair<uint16_t, uint16_t> tcp_port_range = {15550, 15558};
+  // The video codecs to offer to clients, most preferred first. VP8 is always
+  // offered, after all the others.
+  std::vector<std::string> video_codecs = {"VP8"};
+  // Whether clients watching the same display at the same resolution share
+  // the encoded stream instead of each getting an encoder of their own.
+  bool share_video_encoders = false;
+  // Whether the displays are streamed as screen content rather than camera
+  // footage: encoders favor text sharpness over frame rate, use temporal
+  // layers and don't send periodic key frames.
+  bool screen_content = false;
 };
 
 class OperatorObserver {
@@ -75,6 +85,9 @@ class Streamer {
   std::shared_ptr<VideoSink> AddDisplay(const std::string& label, int width,
                                         int height, int dpi,
                                         bool touch_enabled);
+  // Displays may be added and removed while clients are connected, they get
+  // the new tracks through a renegotiation.
+  void RemoveDisplay(const std::string& label);
 
   void SetHardwareSpec(std::string key, std::string value);
 
@@ -90,7 +103,11 @@ class Streamer {
   // stream here.
   std::shared_ptr<AudioSource> GetAudioSource();
 
-  CameraController* AddCamera(unsigned int port, unsigned int cid);
+  // May be called once per camera, the client's video tracks feed them in the
+  // order they were added. Returns the controller of all the cameras added so
+  // far.
+  CameraController* AddCamera(unsigned int port, unsigned int cid,
+                              const std::string& frames_pmem_path = "");
 
   // Add a custom button to the control panel.
   void AddCustomControlPanelButton(const std::string& command,
@@ -108,6 +125,12 @@ class Streamer {
   void Register(std::weak_ptr<OperatorObserver> operator_observer);
   void Unregister();
 
+  // Sends a small picture of the device's screen to the operator, which
+  // serves it to device lists. The latest one is sent again whenever the
+  // device registers.
+  void PublishThumbnail(const std::string& content_type,
+                        std::vector<char> image);
+
   void RecordDisplays(LocalRecorder& recorder);
  private:
   /*
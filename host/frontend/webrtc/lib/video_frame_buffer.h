@@ -21,6 +21,10 @@
 namespace cuttlefish {
 namespace webrtc_streaming {
 
+// The I420 planes of a frame to stream. Every encoder the streamer creates
+// is a software one that takes I420, so frames are converted to it once on
+// the display thread. NV12 or native layouts would only save a conversion
+// for encoders that consume them directly, and there are none yet.
 class VideoFrameBuffer {
  public:
   virtual ~VideoFrameBuffer() = default;
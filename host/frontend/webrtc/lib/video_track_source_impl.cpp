@@ -16,6 +16,8 @@
 
 #include "host/frontend/webrtc/lib/video_track_source_impl.h"
 
+#include <atomic>
+
 #include <api/video/video_frame_buffer.h>
 
 namespace cuttlefish {
@@ -23,6 +25,12 @@ namespace webrtc_streaming {
 
 namespace {
 
+constexpr int kFrameCountBits = 12;
+constexpr std::uint16_t kFrameCountMask = (1 << kFrameCountBits) - 1;
+constexpr std::uint16_t kMaxSourceNumber = 0xffff >> kFrameCountBits;
+
+std::atomic<std::uint16_t> sources_created{0};
+
 class VideoFrameWrapper : public webrtc::I420BufferInterface {
  public:
   VideoFrameWrapper(
@@ -51,20 +59,32 @@ class VideoFrameWrapper : public webrtc::I420BufferInterface {
 
 }  // namespace
 
-VideoTrackSourceImpl::VideoTrackSourceImpl(int width, int height)
-    : webrtc::VideoTrackSource(false), width_(width), height_(height) {}
+VideoTrackSourceImpl::VideoTrackSourceImpl(int width, int height,
+                                           bool is_screencast)
+    : webrtc::VideoTrackSource(false),
+      width_(width),
+      height_(height),
+      is_screencast_(is_screencast),
+      source_number_(sources_created++ % kMaxSourceNumber + 1) {}
 
 void VideoTrackSourceImpl::OnFrame(std::shared_ptr<VideoFrameBuffer> frame,
                                    int64_t timestamp_us) {
-  auto video_frame =
-      webrtc::VideoFrame::Builder()
-          .set_video_frame_buffer(
-              new rtc::RefCountedObject<VideoFrameWrapper>(frame))
-          .set_timestamp_us(timestamp_us)
-          .build();
+  std::uint16_t id = (source_number_ << kFrameCountBits) |
+                     (frame_count_++ & kFrameCountMask);
+  auto video_frame = webrtc::VideoFrame::Builder()
+                         .set_video_frame_buffer(
+                             new rtc::RefCountedObject<VideoFrameWrapper>(
+                                 std::move(frame)))
+                         .set_timestamp_us(timestamp_us)
+                         .set_id(id)
+                         .build();
   broadcaster_.OnFrame(video_frame);
 }
 
+std::uint16_t FrameSourceNumber(const webrtc::VideoFrame& frame) {
+  return frame.id() >> kFrameCountBits;
+}
+
 bool VideoTrackSourceImpl::GetStats(Stats *stats) {
   stats->input_height = height_;
   stats->input_width = width_;
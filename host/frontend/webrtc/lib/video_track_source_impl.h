@@ -16,9 +16,11 @@
 
 #pragma once
 
-#include <media/base/video_broadcaster.h>
+#include <cstdint>
+
 #include <pc/video_track_source.h>
 
+#include "host/frontend/webrtc/lib/adapting_video_broadcaster.h"
 #include "host/frontend/webrtc/lib/video_sink.h"
 
 namespace cuttlefish {
@@ -26,7 +28,9 @@ namespace webrtc_streaming {
 
 class VideoTrackSourceImpl : public webrtc::VideoTrackSource {
  public:
-  VideoTrackSourceImpl(int width, int height);
+  // Screencast sources get the encoders' screen content modes, which favor
+  // sharp text and flat colors.
+  VideoTrackSourceImpl(int width, int height, bool is_screencast = false);
 
   void OnFrame(std::shared_ptr<VideoFrameBuffer> frame, int64_t timestamp_us);
 
@@ -36,6 +40,7 @@ class VideoTrackSourceImpl : public webrtc::VideoTrackSource {
   // Implementation should avoid blocking.
   bool GetStats(Stats* stats) override;
 
+  bool is_screencast() const override { return is_screencast_; }
   bool SupportsEncodedOutput() const override;
   void GenerateKeyFrame() override {}
   void AddEncodedSink(
@@ -48,9 +53,19 @@ class VideoTrackSourceImpl : public webrtc::VideoTrackSource {
  private:
   int width_;
   int height_;
-  rtc::VideoBroadcaster broadcaster_;
+  bool is_screencast_;
+  const std::uint16_t source_number_;
+  std::uint16_t frame_count_ = 0;
+  AdaptingVideoBroadcaster broadcaster_;
 };
 
+// Frames produced by a VideoTrackSourceImpl carry a number identifying their
+// source in the upper bits of their id, the lower bits count frames so the ids
+// still change from frame to frame as webrtc expects. Sources are numbered from
+// 1 and the numbers are reused after 15 sources. Returns 0 for frames from
+// anywhere else.
+std::uint16_t FrameSourceNumber(const webrtc::VideoFrame& frame);
+
 // Wraps a VideoTrackSourceImpl as an implementation of the VideoSink interface.
 // This is needed as the VideoTrackSourceImpl is a reference counted object that
 // should only be referenced by rtc::scoped_refptr pointers, but the
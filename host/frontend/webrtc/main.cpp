@@ -16,6 +16,8 @@
 
 #include <linux/input.h>
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <string>
 #include <utility>
@@ -32,13 +34,18 @@
 #include "host/frontend/webrtc/audio_handler.h"
 #include "host/frontend/webrtc/client_server.h"
 #include "host/frontend/webrtc/connection_observer.h"
+#include "host/frontend/webrtc/display_control_server.h"
 #include "host/frontend/webrtc/display_handler.h"
+#include "host/frontend/webrtc/handler_loop.h"
+#include "host/frontend/webrtc/input_replay_server.h"
 #include "host/frontend/webrtc/kernel_log_events_handler.h"
+#include "host/frontend/webrtc/thumbnail_publisher.h"
 #include "host/frontend/webrtc/lib/camera_controller.h"
 #include "host/frontend/webrtc/lib/local_recorder.h"
 #include "host/frontend/webrtc/lib/streamer.h"
 #include "host/frontend/webrtc/lib/video_sink.h"
 #include "host/libs/audio_connector/server.h"
+#include "host/libs/config/boot_timeline.h"
 #include "host/libs/config/cuttlefish_config.h"
 #include "host/libs/config/logging.h"
 #include "host/libs/confui/host_mode_ctrl.h"
@@ -59,6 +66,10 @@ DEFINE_string(action_servers, "",
 DEFINE_bool(write_virtio_input, true,
             "Whether to send input events in virtio format.");
 DEFINE_int32(audio_server_fd, -1, "An fd to listen on for audio frames");
+DEFINE_int32(screenshot_server_fd, -1,
+             "An fd to listen on for screenshot requests");
+DEFINE_int32(display_control_server_fd, -1,
+             "An fd to listen on for displays added or removed at runtime");
 DEFINE_int32(camera_streamer_fd, -1, "An fd to send client camera frames");
 DEFINE_string(client_dir, "webrtc", "Location of the client files");
 
@@ -66,6 +77,7 @@ using cuttlefish::AudioHandler;
 using cuttlefish::CfConnectionObserverFactory;
 using cuttlefish::DisplayHandler;
 using cuttlefish::KernelLogEventsHandler;
+using cuttlefish::webrtc_streaming::HandlerLoop;
 using cuttlefish::webrtc_streaming::LocalRecorder;
 using cuttlefish::webrtc_streaming::Streamer;
 using cuttlefish::webrtc_streaming::StreamerConfig;
@@ -206,6 +218,25 @@ int main(int argc, char** argv) {
   auto screen_connector_ptr = cuttlefish::DisplayHandler::ScreenConnector::Get(
       FLAGS_frame_server_fd, host_mode_ctrl);
   auto& screen_connector = *(screen_connector_ptr.get());
+  if (FLAGS_screenshot_server_fd >= 0) {
+    screen_connector.StartScreenshotServer(
+        cuttlefish::SharedFD::Dup(FLAGS_screenshot_server_fd));
+    close(FLAGS_screenshot_server_fd);
+  }
+  if (cvd_config->record_frames()) {
+    int recording_num = 0;
+    std::string recording_path;
+    do {
+      recording_path = instance.PerInstancePath("recording/frames_");
+      recording_path += std::to_string(recording_num);
+      recording_path += ".rec";
+      recording_num++;
+    } while (cuttlefish::FileExists(recording_path));
+    auto recorder = cuttlefish::FrameRecorder::Create(recording_path);
+    CHECK(recorder.ok()) << "Could not create frame recorder: "
+                         << recorder.error();
+    screen_connector.StartFrameRecording(std::move(*recorder));
+  }
   auto client_server = cuttlefish::ClientFilesServer::New(FLAGS_client_dir);
   CHECK(client_server) << "Failed to initialize client files server";
 
@@ -221,6 +252,12 @@ int main(int argc, char** argv) {
   streamer_config.client_files_port = client_server->port();
   streamer_config.tcp_port_range = cvd_config->webrtc_tcp_port_range();
   streamer_config.udp_port_range = cvd_config->webrtc_udp_port_range();
+  auto video_codecs = cvd_config->webrtc_video_codecs();
+  if (!video_codecs.empty()) {
+    streamer_config.video_codecs = std::move(video_codecs);
+  }
+  streamer_config.share_video_encoders = cvd_config->webrtc_share_encoders();
+  streamer_config.screen_content = cvd_config->webrtc_screen_content();
   streamer_config.operator_server.addr = cvd_config->sig_server_address();
   streamer_config.operator_server.port = cvd_config->sig_server_port();
   streamer_config.operator_server.path = cvd_config->sig_server_path();
@@ -239,9 +276,13 @@ int main(int argc, char** argv) {
         ParseHttpHeaders(cvd_config->sig_server_headers_path());
   }
 
-  KernelLogEventsHandler kernel_logs_event_handler(kernel_log_events_client);
+  // Serves the kernel log events and every client's adb and bluetooth sockets
+  HandlerLoop handler_loop;
+  KernelLogEventsHandler kernel_logs_event_handler(handler_loop,
+                                                   kernel_log_events_client);
   auto observer_factory = std::make_shared<CfConnectionObserverFactory>(
-      input_sockets, &kernel_logs_event_handler, host_confui_server);
+      handler_loop, input_sockets, &kernel_logs_event_handler,
+      host_confui_server);
 
   auto streamer = Streamer::Create(streamer_config, observer_factory);
   CHECK(streamer) << "Could not create streamer";
@@ -263,8 +304,16 @@ int main(int argc, char** argv) {
       std::make_shared<DisplayHandler>(std::move(displays), screen_connector);
 
   if (instance.camera_server_port()) {
-    auto camera_controller = streamer->AddCamera(instance.camera_server_port(),
-                                                 instance.vsock_guest_cid());
+    cuttlefish::CameraController* camera_controller = nullptr;
+    // Only the first camera has the shared frame ring, the others send their
+    // frames over their vsock connection
+    for (int i = 0; i < std::max(instance.camera_count(), 1); i++) {
+      camera_controller = streamer->AddCamera(
+          instance.camera_server_port() + i, instance.vsock_guest_cid(),
+          i == 0 && cuttlefish::FileExists(instance.camera_frames_pmem_path())
+              ? instance.camera_frames_pmem_path()
+              : "");
+    }
     observer_factory->SetCameraHandler(camera_controller);
   }
 
@@ -278,7 +327,13 @@ int main(int argc, char** argv) {
       recording_path += ".webm";
       recording_num++;
     } while (cuttlefish::FileExists(recording_path));
-    local_recorder = LocalRecorder::Create(recording_path);
+    LocalRecorder::Options recorder_options{
+        .segment_duration = std::chrono::seconds(
+            cvd_config->record_screen_segment_seconds()),
+        .keep_last =
+            std::chrono::seconds(cvd_config->record_screen_last_seconds()),
+    };
+    local_recorder = LocalRecorder::Create(recording_path, recorder_options);
     CHECK(local_recorder) << "Could not create local recorder";
 
     streamer->RecordDisplays(*local_recorder);
@@ -286,6 +341,66 @@ int main(int argc, char** argv) {
 
   observer_factory->SetDisplayHandler(display_handler);
 
+  std::unique_ptr<cuttlefish::InputRecorder> input_recorder;
+  if (cvd_config->record_input()) {
+    int recording_num = 0;
+    std::string recording_path;
+    do {
+      recording_path = instance.PerInstancePath("recording/input_");
+      recording_path += std::to_string(recording_num);
+      recording_path += ".rec";
+      recording_num++;
+    } while (cuttlefish::FileExists(recording_path));
+    auto recorder = cuttlefish::InputRecorder::Create(recording_path);
+    CHECK(recorder.ok()) << "Could not create input recorder: "
+                         << recorder.error();
+    input_recorder = std::move(*recorder);
+    observer_factory->SetInputRecorder(input_recorder.get());
+    display_handler->AddFrameListener(
+        [&input_recorder]() { input_recorder->RecordFrameCommit(); });
+  }
+
+  // When the device first shows something, which is what users wait for
+  auto boot_timeline =
+      cuttlefish::BootTimeline::Open(instance.boot_timeline_path());
+  if (boot_timeline.ok()) {
+    auto first_frame_seen = std::make_shared<std::atomic_bool>(false);
+    display_handler->AddFrameListener(
+        [timeline = *boot_timeline, first_frame_seen]() mutable {
+          if (!first_frame_seen->exchange(true)) {
+            timeline.AddInstant("display", "FirstFrame");
+          }
+        });
+  } else {
+    LOG(WARNING) << "Not adding the first frame to the boot timeline: "
+                 << boot_timeline.error();
+  }
+
+  std::unique_ptr<cuttlefish::InputReplayServer> input_replay_server;
+  auto input_replay_socket = cuttlefish::SharedFD::SocketLocalServer(
+      instance.input_replay_socket_path(), false, SOCK_STREAM, 0600);
+  if (input_replay_socket->IsOpen()) {
+    input_replay_server = std::make_unique<cuttlefish::InputReplayServer>(
+        input_replay_socket, input_sockets);
+    display_handler->AddFrameListener(
+        [&input_replay_server]() { input_replay_server->OnFrameCommit(); });
+    std::thread([&input_replay_server]() { input_replay_server->Loop(); })
+        .detach();
+  } else {
+    LOG(ERROR) << "Failed to create input replay socket: "
+               << input_replay_socket->StrError();
+  }
+
+  std::unique_ptr<cuttlefish::DisplayControlServer> display_control_server;
+  if (FLAGS_display_control_server_fd >= 0) {
+    display_control_server = std::make_unique<cuttlefish::DisplayControlServer>(
+        cuttlefish::SharedFD::Dup(FLAGS_display_control_server_fd), *streamer,
+        display_handler, screen_connector);
+    close(FLAGS_display_control_server_fd);
+    std::thread([&display_control_server]() { display_control_server->Loop(); })
+        .detach();
+  }
+
   streamer->SetHardwareSpec("CPUs", cvd_config->cpus());
   streamer->SetHardwareSpec("RAM", std::to_string(cvd_config->memory_mb()) + " mb");
 
@@ -308,6 +423,24 @@ int main(int argc, char** argv) {
     auto audio_source = streamer->GetAudioSource();
     audio_handler = std::make_shared<AudioHandler>(std::move(audio_server),
                                                    audio_stream, audio_source);
+    observer_factory->SetAudioHandler(audio_handler);
+  }
+
+  if (cvd_config->webrtc_lazy_streaming()) {
+    // Screen recordings need the frames whether somebody is watching or not
+    std::weak_ptr<DisplayHandler> lazy_display_handler;
+    if (!cvd_config->record_screen()) {
+      lazy_display_handler = display_handler;
+    }
+    observer_factory->SetLazyHandlers(lazy_display_handler, audio_handler);
+  }
+
+  std::unique_ptr<cuttlefish::ThumbnailPublisher> thumbnail_publisher;
+  if (cvd_config->webrtc_thumbnail_interval_ms() > 0 &&
+      !cvd_config->display_configs().empty()) {
+    thumbnail_publisher = std::make_unique<cuttlefish::ThumbnailPublisher>(
+        display_handler, *streamer,
+        std::chrono::milliseconds(cvd_config->webrtc_thumbnail_interval_ms()));
   }
 
   // Parse the -action_servers flag, storing a map of action server name -> fd
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/parallel_i420_converter.h"
+
+#include <algorithm>
+
+#include <libyuv.h>
+
+#include "common/libs/utils/tracing.h"
+
+namespace cuttlefish {
+namespace {
+
+// Below this many pixels per band the cost of waking up the workers is not
+// worth it. A 1080p frame is split in about four bands.
+constexpr int kMinPixelsPerBand = 512 * 1024;
+
+std::size_t DefaultThreadCount() {
+  return std::clamp<std::size_t>(std::thread::hardware_concurrency() / 2, 1,
+                                 4);
+}
+
+}  // namespace
+
+ParallelI420Converter::ParallelI420Converter()
+    : ParallelI420Converter(DefaultThreadCount()) {}
+
+ParallelI420Converter::ParallelI420Converter(std::size_t thread_count) {
+  // The calling thread converts bands too.
+  for (std::size_t i = 1; i < thread_count; i++) {
+    workers_.emplace_back([this]() { WorkerLoop(); });
+  }
+}
+
+ParallelI420Converter::~ParallelI420Converter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+void ParallelI420Converter::Convert(
+    const std::uint8_t* src_abgr, int src_stride_abgr, std::uint8_t* dst_y,
+    int dst_stride_y, std::uint8_t* dst_u, int dst_stride_u,
+    std::uint8_t* dst_v, int dst_stride_v, int width, int height) {
+  CF_TRACE("convert_frame");
+  const int max_bands = static_cast<int>(workers_.size()) + 1;
+  const int band_count = std::clamp(
+      static_cast<int>(std::int64_t{width} * height / kMinPixelsPerBand), 1,
+      max_bands);
+  // Bands start on even rows for each of them to cover whole chroma rows.
+  const int rows_per_band = ((height + band_count - 1) / band_count + 1) & ~1;
+  Job job{
+      .src_abgr = src_abgr,
+      .src_stride_abgr = src_stride_abgr,
+      .dst_y = dst_y,
+      .dst_stride_y = dst_stride_y,
+      .dst_u = dst_u,
+      .dst_stride_u = dst_stride_u,
+      .dst_v = dst_v,
+      .dst_stride_v = dst_stride_v,
+      .width = width,
+      .height = height,
+      .band_count = band_count,
+      .rows_per_band = rows_per_band,
+  };
+  if (band_count == 1) {
+    ConvertBand(job, 0);
+    return;
+  }
+
+  std::lock_guard<std::mutex> convert_lock(convert_mutex_);
+  std::unique_lock<std::mutex> lock(mutex_);
+  job_ = job;
+  next_band_ = 0;
+  remaining_bands_ = band_count;
+  work_cv_.notify_all();
+  RunBands(lock);
+  done_cv_.wait(lock, [this]() { return remaining_bands_ == 0; });
+}
+
+void ParallelI420Converter::ConvertBand(const Job& job, int band) {
+  CF_TRACE("convert_band");
+  const int first_row = band * job.rows_per_band;
+  const int rows = std::min(job.rows_per_band, job.height - first_row);
+  if (rows <= 0) {
+    return;
+  }
+  const int first_chroma_row = first_row / 2;
+  libyuv::ABGRToI420(job.src_abgr + first_row * job.src_stride_abgr,
+                     job.src_stride_abgr,
+                     job.dst_y + first_row * job.dst_stride_y,
+                     job.dst_stride_y,
+                     job.dst_u + first_chroma_row * job.dst_stride_u,
+                     job.dst_stride_u,
+                     job.dst_v + first_chroma_row * job.dst_stride_v,
+                     job.dst_stride_v, job.width, rows);
+}
+
+void ParallelI420Converter::RunBands(std::unique_lock<std::mutex>& lock) {
+  while (next_band_ < job_.band_count && remaining_bands_ > 0) {
+    const int band = next_band_++;
+    const Job job = job_;
+    lock.unlock();
+    ConvertBand(job, band);
+    lock.lock();
+    if (--remaining_bands_ == 0) {
+      done_cv_.notify_all();
+    }
+  }
+}
+
+void ParallelI420Converter::WorkerLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    work_cv_.wait(lock, [this]() {
+      return stop_ || (remaining_bands_ > 0 && next_band_ < job_.band_count);
+    });
+    if (stop_) {
+      return;
+    }
+    RunBands(lock);
+  }
+}
+
+}  // namespace cuttlefish
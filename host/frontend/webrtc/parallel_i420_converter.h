@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cuttlefish {
+
+// Converts ABGR pixels to I420 splitting the frame into horizontal bands that
+// a few worker threads, and the calling thread, convert in parallel. Frames
+// too small to benefit are converted on the calling thread alone.
+//
+// libyuv picks the fastest implementation the CPU supports (AVX2, NEON...)
+// at runtime, so each band is converted with SIMD too.
+class ParallelI420Converter {
+ public:
+  // Defaults to half the cores, up to four.
+  ParallelI420Converter();
+  explicit ParallelI420Converter(std::size_t thread_count);
+  ~ParallelI420Converter();
+
+  ParallelI420Converter(const ParallelI420Converter&) = delete;
+  ParallelI420Converter& operator=(const ParallelI420Converter&) = delete;
+
+  // Same arguments as libyuv::ABGRToI420. Can be called from several threads
+  // at once, conversions then take turns on the worker threads.
+  void Convert(const std::uint8_t* src_abgr, int src_stride_abgr,
+               std::uint8_t* dst_y, int dst_stride_y, std::uint8_t* dst_u,
+               int dst_stride_u, std::uint8_t* dst_v, int dst_stride_v,
+               int width, int height);
+
+ private:
+  struct Job {
+    const std::uint8_t* src_abgr;
+    int src_stride_abgr;
+    std::uint8_t* dst_y;
+    int dst_stride_y;
+    std::uint8_t* dst_u;
+    int dst_stride_u;
+    std::uint8_t* dst_v;
+    int dst_stride_v;
+    int width;
+    int height;
+    int band_count;
+    int rows_per_band;
+  };
+
+  static void ConvertBand(const Job& job, int band);
+  void WorkerLoop();
+  // Converts bands of the current job until none is left. Must be called
+  // with mutex_ held through lock.
+  void RunBands(std::unique_lock<std::mutex>& lock);
+
+  std::vector<std::thread> workers_;
+  // Serializes Convert() calls
+  std::mutex convert_mutex_;
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  Job job_{};
+  int next_band_ = 0;
+  int remaining_bands_ = 0;
+  bool stop_ = false;
+};
+
+}  // namespace cuttlefish
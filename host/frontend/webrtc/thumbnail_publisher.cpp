@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc/thumbnail_publisher.h"
+
+#include <algorithm>
+
+#include <android-base/logging.h>
+#include <api/video/i420_buffer.h>
+#include <libyuv.h>
+
+#include "host/frontend/webrtc/lib/jpeg_encoder.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr int kThumbnailWidth = 320;
+// Small enough for a grid of them, text is unreadable at this size anyway
+constexpr int kJpegQuality = 70;
+
+using webrtc_streaming::VideoFrameBuffer;
+
+rtc::scoped_refptr<webrtc::I420Buffer> Downscale(
+    const VideoFrameBuffer& frame) {
+  // Even dimensions, as the chroma planes are subsampled
+  int width = std::min(frame.width(), kThumbnailWidth) & ~1;
+  int height = (frame.height() * width / frame.width()) & ~1;
+  if (width == 0 || height == 0) {
+    return nullptr;
+  }
+  auto thumbnail = webrtc::I420Buffer::Create(width, height);
+  libyuv::I420Scale(frame.DataY(), frame.StrideY(), frame.DataU(),
+                    frame.StrideU(), frame.DataV(), frame.StrideV(),
+                    frame.width(), frame.height(), thumbnail->MutableDataY(),
+                    thumbnail->StrideY(), thumbnail->MutableDataU(),
+                    thumbnail->StrideU(), thumbnail->MutableDataV(),
+                    thumbnail->StrideV(), width, height, libyuv::kFilterBox);
+  return thumbnail;
+}
+
+}  // namespace
+
+ThumbnailPublisher::ThumbnailPublisher(
+    std::shared_ptr<DisplayHandler> display_handler,
+    webrtc_streaming::Streamer& streamer, std::chrono::milliseconds interval)
+    : display_handler_(std::move(display_handler)),
+      streamer_(streamer),
+      interval_(interval),
+      dirty_(std::make_shared<std::atomic<bool>>(true)) {
+  // Listeners can't be removed, the flag outlives the publisher instead
+  display_handler_->AddFrameListener(
+      [dirty = dirty_]() { dirty->store(true, std::memory_order_relaxed); });
+  thread_ = std::thread([this]() { Loop(); });
+}
+
+ThumbnailPublisher::~ThumbnailPublisher() {
+  running_ = false;
+  thread_.join();
+}
+
+void ThumbnailPublisher::Loop() {
+  while (running_) {
+    std::this_thread::sleep_for(interval_);
+    if (dirty_->exchange(false, std::memory_order_relaxed)) {
+      Publish();
+    }
+  }
+}
+
+void ThumbnailPublisher::Publish() {
+  auto frame = display_handler_->LastFrame(0);
+  if (!frame) {
+    // Try again once the first frame arrives
+    dirty_->store(true, std::memory_order_relaxed);
+    return;
+  }
+  auto thumbnail = Downscale(*frame);
+  if (!thumbnail) {
+    return;
+  }
+  auto jpeg = webrtc_streaming::EncodeJpeg(*thumbnail, kJpegQuality);
+  if (jpeg.empty()) {
+    LOG(ERROR) << "Failed to encode the display thumbnail";
+    return;
+  }
+  streamer_.PublishThumbnail("image/jpeg", std::move(jpeg));
+}
+
+}  // namespace cuttlefish
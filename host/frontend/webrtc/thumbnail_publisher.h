@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#include "host/frontend/webrtc/display_handler.h"
+#include "host/frontend/webrtc/lib/streamer.h"
+
+namespace cuttlefish {
+
+// Publishes a small JPEG of the first display through the streamer at most
+// once per interval, and only when the display changed since the previous
+// one. Device lists show it without opening a WebRTC connection per device.
+class ThumbnailPublisher {
+ public:
+  ThumbnailPublisher(std::shared_ptr<DisplayHandler> display_handler,
+                     webrtc_streaming::Streamer& streamer,
+                     std::chrono::milliseconds interval);
+  ~ThumbnailPublisher();
+
+ private:
+  void Loop();
+  void Publish();
+
+  std::shared_ptr<DisplayHandler> display_handler_;
+  webrtc_streaming::Streamer& streamer_;
+  const std::chrono::milliseconds interval_;
+  // Set by the display thread on every frame
+  std::shared_ptr<std::atomic<bool>> dirty_;
+  std::atomic<bool> running_ = true;
+  std::thread thread_;
+};
+
+}  // namespace cuttlefish
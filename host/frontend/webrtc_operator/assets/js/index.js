@@ -18,10 +18,12 @@
 
 class DeviceListApp {
   #url;
+  #hostsUrl;
   #selectDeviceCb;
 
-  constructor({url, selectDeviceCb}) {
+  constructor({url, hostsUrl, selectDeviceCb}) {
     this.#url = url;
+    this.#hostsUrl = hostsUrl;
     this.#selectDeviceCb = selectDeviceCb;
   }
 
@@ -36,33 +38,59 @@ class DeviceListApp {
 
   async #UpdateDeviceList() {
     try {
-      const device_ids = await fetch(this.#url, {
-        method: 'GET',
-        cache: 'no-cache',
-        redirect: 'follow',
-      });
-      this.#ShowNewDeviceList(await device_ids.json());
+      this.#ShowNewDeviceList(await this.#FetchDevices());
     } catch (e) {
       console.error('Error getting list of device ids: ', e);
     }
   }
 
-  #ShowNewDeviceList(device_ids) {
+  // Returns a list of {devId, label, baseUrl} objects. An operator acting as a
+  // fleet directory lists the devices of every host, each one served by the
+  // operator at baseUrl. A plain operator only lists its own devices.
+  async #FetchDevices() {
+    const hosts_response = await fetch(this.#hostsUrl, {
+      method: 'GET',
+      cache: 'no-cache',
+      redirect: 'follow',
+    });
+    if (hosts_response.ok) {
+      let devices = [];
+      for (const host of (await hosts_response.json()).hosts) {
+        if (host.status != 'up') {
+          continue;
+        }
+        for (const devId of host.devices) {
+          devices.push(
+              {devId, label: `${host.host_id}/${devId}`, baseUrl: host.url});
+        }
+      }
+      return devices;
+    }
+    const device_ids = await fetch(this.#url, {
+      method: 'GET',
+      cache: 'no-cache',
+      redirect: 'follow',
+    });
+    return (await device_ids.json())
+        .map(devId => ({devId, label: devId, baseUrl: ''}));
+  }
+
+  #ShowNewDeviceList(devices) {
     let ul = document.getElementById('device-list');
     ul.innerHTML = '';
     let count = 1;
-    let device_to_button_map = {};
-    for (const devId of device_ids) {
+    let button_to_device_map = {};
+    for (const device of devices) {
       const buttonId = 'connect_' + count++;
-      let entry = this.#createDeviceEntry(devId, buttonId);
+      let entry = this.#createDeviceEntry(device.label, buttonId);
       ul.appendChild(entry);
-      device_to_button_map[devId] = buttonId;
+      button_to_device_map[buttonId] = device;
     }
 
-    for (const [devId, buttonId] of Object.entries(device_to_button_map)) {
+    for (const [buttonId, device] of Object.entries(button_to_device_map)) {
       let button = document.getElementById(buttonId);
       button.addEventListener('click', evt => {
-        this.#selectDeviceCb(devId);
+        this.#selectDeviceCb(device);
       });
     }
   }
@@ -86,15 +114,25 @@ class DeviceListApp {
 
 window.addEventListener('load', e => {
   let listDevicesUrl = '/devices';
-  let selectDeviceCb = deviceId => {
+  let listHostsUrl = '/hosts';
+  let selectDeviceCb = ({devId, label, baseUrl}) => {
     return new Promise((resolve, reject) => {
-      let client = window.open(`client.html?deviceId=${deviceId}`, deviceId);
+      // The client page signals through the operator that serves it, which
+      // for fleet directories is the operator of the device's host.
+      let client =
+          window.open(`${baseUrl}/client.html?deviceId=${devId}`, label);
+      if (baseUrl) {
+        // Events of pages from other origins can't be observed
+        resolve();
+        return;
+      }
       client.addEventListener('load', evt => {
         console.log('loaded');
         resolve();
       });
     });
   };
-  let deviceListApp = new DeviceListApp({url: listDevicesUrl, selectDeviceCb});
+  let deviceListApp = new DeviceListApp(
+      {url: listDevicesUrl, hostsUrl: listHostsUrl, selectDeviceCb});
   deviceListApp.start();
 });
@@ -141,9 +141,16 @@ class WebsocketConnector extends Connector {
 
   constructor(ws) {
     super();
+    // The server sends large messages in binary frames
+    ws.binaryType = 'arraybuffer';
+    const decoder = new TextDecoder();
     ws.onmessage = e => {
-      let data = JSON.parse(e.data);
-      this.#onWebsocketMessage(data);
+      let text = typeof e.data === 'string' ? e.data : decoder.decode(e.data);
+      let data = JSON.parse(text);
+      // Batches are arrays of messages
+      for (const message of Array.isArray(data) ? data : [data]) {
+        this.#onWebsocketMessage(message);
+      }
     };
     this.#websocket = ws;
   }
@@ -155,6 +162,8 @@ class WebsocketConnector extends Connector {
       this.#wsSendJson({
         message_type: 'connect',
         device_id: deviceId,
+        accepts_batches: true,
+        accepts_binary: true,
       });
     });
   }
@@ -60,6 +60,20 @@ void ClientWSHandler::SendDeviceMessage(const Json::Value& device_message) {
   Reply(message);
 }
 
+void ClientWSHandler::SendDeviceMessages(
+    const std::vector<Json::Value>& device_messages) {
+  std::vector<Json::Value> messages;
+  messages.reserve(device_messages.size());
+  for (const auto& device_message : device_messages) {
+    Json::Value message;
+    message[webrtc_signaling::kTypeField] =
+        webrtc_signaling::kDeviceMessageType;
+    message[webrtc_signaling::kPayloadField] = device_message;
+    messages.push_back(std::move(message));
+  }
+  ReplyBatch(messages);
+}
+
 void ClientWSHandler::handleMessage(const std::string& type,
                                   const Json::Value& message) {
   if (type == webrtc_signaling::kConnectType) {
@@ -85,6 +99,7 @@ void ClientWSHandler::handleConnectionRequest(const Json::Value& message) {
     return;
   }
   auto device_id = message[webrtc_signaling::kDeviceIdField].asString();
+  ReadPeerCapabilities(message);
   // Always send the server config back, even if the requested device is not
   // registered. Applications may put clients on hold until the device is ready
   // to connect.
@@ -130,6 +145,37 @@ void ClientWSHandler::handleForward(const Json::Value& message) {
                                     message[webrtc_signaling::kPayloadField]);
 }
 
+void ClientWSHandler::handleBatch(const Json::Value& messages) {
+  // Consecutive forwards, usually ICE candidates, reach the device together
+  std::vector<Json::Value> payloads;
+  for (const auto& message : messages) {
+    auto type = message[webrtc_signaling::kTypeField].asString();
+    if (type == webrtc_signaling::kForwardType && client_id_ > 0 &&
+        message.isMember(webrtc_signaling::kPayloadField)) {
+      payloads.push_back(message[webrtc_signaling::kPayloadField]);
+      continue;
+    }
+    forwardToDevice(payloads);
+    payloads.clear();
+    handleMessage(type, message);
+  }
+  forwardToDevice(payloads);
+}
+
+void ClientWSHandler::forwardToDevice(const std::vector<Json::Value>& payloads) {
+  if (payloads.empty()) {
+    return;
+  }
+  auto device_handler = device_handler_.lock();
+  if (!device_handler) {
+    LogAndReplyError("Forward failed: Device disconnected");
+    // Disconnect this client since the device is gone
+    Close();
+    return;
+  }
+  device_handler->SendClientMessages(client_id_, payloads);
+}
+
 ClientWSHandlerFactory::ClientWSHandlerFactory(DeviceRegistry* registry,
                                            const ServerConfig& server_config)
   : registry_(registry),
@@ -146,8 +192,10 @@ class PollConnectionHandler : public ClientHandler {
  public:
   PollConnectionHandler() = default;
 
+  // Called from the device's service thread
   void SendDeviceMessage(const Json::Value& message) override {
     constexpr size_t kMaxMessagesInQueue = 1000;
+    std::lock_guard<std::mutex> lock(messages_mutex_);
     if (messages_.size() > kMaxMessagesInQueue) {
       LOG(ERROR) << "Polling client " << client_id_ << " reached "
                  << kMaxMessagesInQueue
@@ -158,6 +206,7 @@ class PollConnectionHandler : public ClientHandler {
   }
 
   std::vector<Json::Value> PollMessages() {
+    std::lock_guard<std::mutex> lock(messages_mutex_);
     std::vector<Json::Value> ret;
     std::swap(ret, messages_);
     return ret;
@@ -177,11 +226,13 @@ class PollConnectionHandler : public ClientHandler {
  private:
   size_t client_id_ = 0;
   std::weak_ptr<DeviceHandler> device_handler_;
+  std::mutex messages_mutex_;
   std::vector<Json::Value> messages_;
 };
 
 std::shared_ptr<PollConnectionHandler> PollConnectionStore::Get(
     const std::string& conn_id) const {
+  std::lock_guard<std::mutex> lock(mutex_);
   if (!handlers_.count(conn_id)) {
     return nullptr;
   }
@@ -189,6 +240,7 @@ std::shared_ptr<PollConnectionHandler> PollConnectionStore::Get(
 }
 
 std::string PollConnectionStore::Add(std::shared_ptr<PollConnectionHandler> handler) {
+  std::lock_guard<std::mutex> lock(mutex_);
   std::string conn_id;
   do {
     conn_id = RandomClientSecret(64);
@@ -15,8 +15,11 @@
 
 #pragma once
 
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include <json/json.h>
 
@@ -32,6 +35,12 @@ class ClientHandler {
  public:
   virtual ~ClientHandler() = default;
   virtual void SendDeviceMessage(const Json::Value& message) = 0;
+  // Clients that accept batches get the messages in a single frame
+  virtual void SendDeviceMessages(const std::vector<Json::Value>& messages) {
+    for (const auto& message : messages) {
+      SendDeviceMessage(message);
+    }
+  }
 };
 
 class ClientWSHandler : public ClientHandler,
@@ -42,16 +51,19 @@ class ClientWSHandler : public ClientHandler,
                   const ServerConfig& server_config);
 
   void SendDeviceMessage(const Json::Value& message) override;
+  void SendDeviceMessages(const std::vector<Json::Value>& messages) override;
 
   void OnClosed() override;
 
  protected:
   void handleMessage(const std::string& type,
                      const Json::Value& message) override;
+  void handleBatch(const Json::Value& messages) override;
 
  private:
   void handleConnectionRequest(const Json::Value& message);
   void handleForward(const Json::Value& message);
+  void forwardToDevice(const std::vector<Json::Value>& payloads);
 
   std::weak_ptr<DeviceHandler> device_handler_;
   // The device handler assigns this to each client to be able to differentiate
@@ -79,6 +91,7 @@ class PollConnectionStore {
     std::shared_ptr<PollConnectionHandler> Get(const std::string& conn_id) const;
     std::string Add(std::shared_ptr<PollConnectionHandler> handler);
   private:
+   mutable std::mutex mutex_;
    std::map<std::string, std::shared_ptr<PollConnectionHandler>>
        handlers_;
 };
@@ -31,6 +31,21 @@ constexpr auto kUrlsField = "urls";
 constexpr auto kUsernameField = "username";
 constexpr auto kCredentialField = "credential";
 constexpr auto kCredentialTypeField = "credentialType";
+// These are used between host operators and the directory
+constexpr auto kHostIdField = "host_id";
+constexpr auto kHostUrlField = "url";
+constexpr auto kDevicesField = "devices";
+constexpr auto kHealthField = "health";
+constexpr auto kReportIntervalField = "report_interval_ms";
+// These are used in the thumbnails devices publish for device lists
+constexpr auto kContentTypeField = "content_type";
+constexpr auto kImageField = "image";
+// What a peer can receive, announced in its register or connect message, and
+// what the operator can receive, announced in its config message. A peer that
+// accepts batches may be sent a JSON array of messages in one frame, one that
+// accepts binary may be sent large messages in binary frames.
+constexpr auto kAcceptsBatchesField = "accepts_batches";
+constexpr auto kAcceptsBinaryField = "accepts_binary";
 
 constexpr auto kRegisterType = "register";
 constexpr auto kForwardType = "forward";
@@ -41,6 +56,7 @@ constexpr auto kClientMessageType = "client_msg";
 constexpr auto kClientDisconnectType = "client_disconnected";
 constexpr auto kDeviceMessageType = "device_msg";
 constexpr auto kPollType = "client_poll";
+constexpr auto kThumbnailType = "thumbnail";
 
 }  // namespace webrtc_signaling
 }  // namespace cuttlefish
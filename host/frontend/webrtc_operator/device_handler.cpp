@@ -15,12 +15,28 @@
 
 #include "host/frontend/webrtc_operator/device_handler.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <iterator>
+#include <map>
+
 #include <android-base/logging.h>
 
+#include "common/libs/utils/base64.h"
 #include "host/frontend/webrtc_operator/client_handler.h"
 #include "host/frontend/webrtc_operator/constants/signaling_constants.h"
 
 namespace cuttlefish {
+namespace {
+
+// Thumbnails are meant to be a few kilobytes
+constexpr std::size_t kMaxThumbnailSize = 256 * 1024;
+// Thumbnails are served from the operator's origin, so the device must not
+// choose a type the browser would run, like text/html
+constexpr const char* kThumbnailContentTypes[] = {"image/jpeg", "image/png"};
+
+}  // namespace
 
 DeviceHandler::DeviceHandler(struct lws* wsi, DeviceRegistry* registry,
                              const ServerConfig& server_config)
@@ -34,6 +50,7 @@ void DeviceHandler::OnClosed() {
 
 size_t DeviceHandler::RegisterClient(
     std::shared_ptr<ClientHandler> client_handler) {
+  std::lock_guard<std::mutex> lock(clients_mutex_);
   clients_.emplace_back(client_handler);
   return clients_.size();
 }
@@ -44,6 +61,10 @@ void DeviceHandler::handleMessage(const std::string& type,
     HandleRegistrationRequest(message);
   } else if (type == webrtc_signaling::kForwardType) {
     HandleForward(message);
+  } else if (type == webrtc_signaling::kThumbnailType) {
+    HandleThumbnail(message);
+  } else if (type == webrtc_signaling::kDeviceInfoType) {
+    HandleDeviceInfo(message);
   } else {
     LogAndReplyError("Unknown message type: " + type);
   }
@@ -66,6 +87,7 @@ void DeviceHandler::HandleRegistrationRequest(const Json::Value& message) {
   if (message.isMember(webrtc_signaling::kDeviceInfoField)) {
     device_info_ = message[webrtc_signaling::kDeviceInfoField];
   }
+  ReadPeerCapabilities(message);
   if (!registry_->RegisterDevice(device_id_, weak_from_this())) {
     LOG(ERROR) << "Device registration failed";
     Close();
@@ -75,32 +97,120 @@ void DeviceHandler::HandleRegistrationRequest(const Json::Value& message) {
   SendServerConfig();
 }
 
+void DeviceHandler::handleBatch(const Json::Value& messages) {
+  // Consecutive forwards, usually ICE candidates, reach each client together
+  std::vector<const Json::Value*> forwards;
+  for (const auto& message : messages) {
+    auto type = message[webrtc_signaling::kTypeField].asString();
+    if (type == webrtc_signaling::kForwardType) {
+      if (!ValidateForward(message)) {
+        return;
+      }
+      forwards.push_back(&message);
+      continue;
+    }
+    ForwardToClients(forwards);
+    forwards.clear();
+    handleMessage(type, message);
+  }
+  ForwardToClients(forwards);
+}
+
 void DeviceHandler::HandleForward(const Json::Value& message) {
+  if (ValidateForward(message)) {
+    ForwardToClients({&message});
+  }
+}
+
+bool DeviceHandler::ValidateForward(const Json::Value& message) {
   if (!message.isMember(webrtc_signaling::kClientIdField) ||
       !message[webrtc_signaling::kClientIdField].isInt()) {
     LogAndReplyError("Forward failed: Missing or invalid client id");
     Close();
-    return;
+    return false;
   }
-  size_t client_id = message[webrtc_signaling::kClientIdField].asInt();
   if (!message.isMember(webrtc_signaling::kPayloadField)) {
     LogAndReplyError("Forward failed: Missing payload");
     Close();
+    return false;
+  }
+  return true;
+}
+
+void DeviceHandler::ForwardToClients(
+    const std::vector<const Json::Value*>& messages) {
+  // Keeps the order of the messages to each client
+  std::map<size_t, std::vector<Json::Value>> payloads;
+  for (const auto message : messages) {
+    size_t client_id = (*message)[webrtc_signaling::kClientIdField].asInt();
+    payloads[client_id].push_back((*message)[webrtc_signaling::kPayloadField]);
+  }
+  for (const auto& [client_id, client_payloads] : payloads) {
+    std::shared_ptr<ClientHandler> client_handler;
+    {
+      std::lock_guard<std::mutex> lock(clients_mutex_);
+      if (client_id <= 0 || client_id > clients_.size()) {
+        LogAndReplyError("Forward failed: Unknown client " +
+                         std::to_string(client_id));
+        continue;
+      }
+      auto client_index = client_id - 1;
+      client_handler = clients_[client_index].lock();
+    }
+    if (!client_handler) {
+      SendClientDisconnectMessage(client_id);
+      continue;
+    }
+    client_handler->SendDeviceMessages(client_payloads);
+  }
+}
+
+void DeviceHandler::HandleDeviceInfo(const Json::Value& message) {
+  if (device_id_.empty()) {
+    LogAndReplyError("Device info received before registration");
+    return;
+  }
+  if (!message[webrtc_signaling::kDeviceInfoField].isObject()) {
+    LogAndReplyError("Device info message without device info");
+    return;
+  }
+  // Clients connecting from now on get the new info, connected ones get it
+  // from the device itself.
+  device_info_ = message[webrtc_signaling::kDeviceInfoField];
+}
+
+void DeviceHandler::HandleThumbnail(const Json::Value& message) {
+  if (device_id_.empty()) {
+    LogAndReplyError("Thumbnail received before registration");
+    return;
+  }
+  if (!message[webrtc_signaling::kContentTypeField].isString() ||
+      !message[webrtc_signaling::kImageField].isString()) {
+    LogAndReplyError("Thumbnail without content type or image");
     return;
   }
-  if (client_id <= 0 || client_id > clients_.size()) {
-    LogAndReplyError("Forward failed: Unknown client " +
-                     std::to_string(client_id));
+  auto content_type = message[webrtc_signaling::kContentTypeField].asString();
+  if (std::find(std::begin(kThumbnailContentTypes),
+                std::end(kThumbnailContentTypes),
+                content_type) == std::end(kThumbnailContentTypes)) {
+    LogAndReplyError("Unsupported thumbnail content type: " + content_type);
     return;
   }
-  auto client_index = client_id - 1;
-  auto client_handler = clients_[client_index].lock();
-  if (!client_handler) {
-    SendClientDisconnectMessage(client_id);
+  std::vector<std::uint8_t> image;
+  if (!DecodeBase64(message[webrtc_signaling::kImageField].asString(),
+                    &image) ||
+      image.size() > kMaxThumbnailSize) {
+    LogAndReplyError("Invalid thumbnail image");
     return;
   }
-  client_handler->SendDeviceMessage(message[webrtc_signaling::kPayloadField]);
-  return;
+  auto thumbnail = std::make_shared<Thumbnail>();
+  thumbnail->content_type = content_type;
+  thumbnail->data.assign(image.begin(), image.end());
+  char etag[32];
+  snprintf(etag, sizeof(etag), "\"%016zx\"",
+           std::hash<std::string>()(thumbnail->data));
+  thumbnail->etag = etag;
+  thumbnail_ = std::move(thumbnail);
 }
 
 void DeviceHandler::SendClientMessage(size_t client_id,
@@ -112,6 +222,20 @@ void DeviceHandler::SendClientMessage(size_t client_id,
   Reply(msg);
 }
 
+void DeviceHandler::SendClientMessages(
+    size_t client_id, const std::vector<Json::Value>& client_messages) {
+  std::vector<Json::Value> messages;
+  messages.reserve(client_messages.size());
+  for (const auto& client_message : client_messages) {
+    Json::Value msg;
+    msg[webrtc_signaling::kTypeField] = webrtc_signaling::kClientMessageType;
+    msg[webrtc_signaling::kClientIdField] = static_cast<Json::UInt>(client_id);
+    msg[webrtc_signaling::kPayloadField] = client_message;
+    messages.push_back(std::move(msg));
+  }
+  ReplyBatch(messages);
+}
+
 void DeviceHandler::SendClientDisconnectMessage(size_t client_id) {
   Json::Value msg;
   msg[webrtc_signaling::kTypeField] = webrtc_signaling::kClientDisconnectType;
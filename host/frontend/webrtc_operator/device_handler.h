@@ -16,6 +16,7 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -33,13 +34,25 @@ class ClientHandler;
 class DeviceHandler : public SignalHandler,
                       public std::enable_shared_from_this<DeviceHandler> {
  public:
+  struct Thumbnail {
+    std::string content_type;
+    std::string data;
+    // Changes with the contents, for HTTP caches
+    std::string etag;
+  };
+
   DeviceHandler(struct lws* wsi, DeviceRegistry* registry,
                 const ServerConfig& server_config);
 
   Json::Value device_info() const { return device_info_; }
+  // The latest thumbnail published by the device, null if it hasn't published
+  // any.
+  std::shared_ptr<const Thumbnail> thumbnail() const { return thumbnail_; }
 
   size_t RegisterClient(std::shared_ptr<ClientHandler> client_handler);
   void SendClientMessage(size_t client_id, const Json::Value& message);
+  void SendClientMessages(size_t client_id,
+                          const std::vector<Json::Value>& messages);
   void SendClientDisconnectMessage(size_t client_id);
 
   void OnClosed() override;
@@ -47,14 +60,25 @@ class DeviceHandler : public SignalHandler,
  protected:
   void handleMessage(const std::string& type,
                     const Json::Value& message) override;
+  void handleBatch(const Json::Value& messages) override;
 
  private:
   void HandleRegistrationRequest(const Json::Value& message);
   void HandleForward(const Json::Value& message);
+  // Replies with an error and closes the connection if the message is invalid
+  bool ValidateForward(const Json::Value& message);
+  // Forwards the payloads of validated forward messages, grouped by client
+  void ForwardToClients(const std::vector<const Json::Value*>& messages);
+  void HandleThumbnail(const Json::Value& message);
+  // The device's displays may change while it runs
+  void HandleDeviceInfo(const Json::Value& message);
 
   std::string device_id_;
   Json::Value device_info_;
+  // clients register from their own service threads
+  std::mutex clients_mutex_;
   std::vector<std::weak_ptr<ClientHandler>> clients_;
+  std::shared_ptr<const Thumbnail> thumbnail_;
 };
 
 class DeviceHandlerFactory : public WebSocketHandlerFactory {
@@ -22,14 +22,7 @@ DeviceListHandler::DeviceListHandler(struct lws* wsi,
     : DynHandler(wsi), registry_(registry) {}
 
 HttpStatusCode DeviceListHandler::DoGet() {
-  Json::Value reply(Json::ValueType::arrayValue);
-
-  for (const auto& id : registry_.ListDeviceIds()) {
-    reply.append(id);
-  }
-  Json::StreamWriterBuilder json_factory;
-  auto replyAsString = Json::writeString(json_factory, reply);
-  AppendDataOut(replyAsString);
+  AppendDataOut(*registry_.SerializedDeviceList());
   return HttpStatusCode::Ok;
 }
 HttpStatusCode DeviceListHandler::DoPost() {
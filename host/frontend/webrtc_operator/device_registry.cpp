@@ -15,57 +15,104 @@
 
 #include "host/frontend/webrtc_operator/device_registry.h"
 
+#include <functional>
+
 #include <android-base/logging.h>
 
 #include "host/frontend/webrtc_operator/device_handler.h"
 
 namespace cuttlefish {
 
+DeviceRegistry::Shard& DeviceRegistry::ShardFor(const std::string& device_id) {
+  return shards_[std::hash<std::string>{}(device_id) % kNumShards];
+}
+
 bool DeviceRegistry::RegisterDevice(
     const std::string& device_id,
     std::weak_ptr<DeviceHandler> device_handler) {
-  if (devices_.count(device_id) > 0) {
-    LOG(ERROR) << "Device '" << device_id << "' is already registered";
-    return false;
+  {
+    auto& shard = ShardFor(device_id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (!shard.devices.try_emplace(device_id, device_handler).second) {
+      LOG(ERROR) << "Device '" << device_id << "' is already registered";
+      return false;
+    }
+    AddToList(device_id);
   }
-
-  devices_.try_emplace(device_id, device_handler);
   LOG(INFO) << "Registered device: '" << device_id << "'";
   return true;
 }
 
 void DeviceRegistry::UnRegisterDevice(const std::string& device_id) {
-  auto record = devices_.find(device_id);
-  if (record == devices_.end()) {
-    LOG(WARNING) << "Requested to unregister an unkwnown device: '" << device_id
-                 << "'";
-    return;
+  {
+    auto& shard = ShardFor(device_id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto record = shard.devices.find(device_id);
+    if (record == shard.devices.end()) {
+      LOG(WARNING) << "Requested to unregister an unkwnown device: '"
+                   << device_id << "'";
+      return;
+    }
+    shard.devices.erase(record);
+    RemoveFromList(device_id);
   }
-  devices_.erase(record);
   LOG(INFO) << "Unregistered device: '" << device_id << "'";
 }
 
 std::shared_ptr<DeviceHandler> DeviceRegistry::GetDevice(
     const std::string& device_id) {
-  if (devices_.count(device_id) == 0) {
-    LOG(INFO) << "Requested device (" << device_id << ") is not registered";
-    return nullptr;
-  }
-  auto device_handler = devices_[device_id].lock();
-  if (!device_handler) {
-    LOG(WARNING) << "Destroyed device handler detected for device '"
-                 << device_id << "'";
-    UnRegisterDevice(device_id);
+  std::shared_ptr<DeviceHandler> device_handler;
+  {
+    auto& shard = ShardFor(device_id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto record = shard.devices.find(device_id);
+    if (record == shard.devices.end()) {
+      LOG(INFO) << "Requested device (" << device_id << ") is not registered";
+      return nullptr;
+    }
+    device_handler = record->second.lock();
+    if (device_handler) {
+      return device_handler;
+    }
+    shard.devices.erase(record);
+    RemoveFromList(device_id);
   }
-  return device_handler;
+  LOG(WARNING) << "Destroyed device handler detected for device '"
+               << device_id << "'";
+  LOG(INFO) << "Unregistered device: '" << device_id << "'";
+  return nullptr;
 }
 
 std::vector<std::string> DeviceRegistry::ListDeviceIds() const {
-  std::vector<std::string> ret;
-  for (const auto& entry: devices_) {
-    ret.push_back(entry.first);
+  std::lock_guard<std::mutex> lock(list_mutex_);
+  return std::vector<std::string>(device_ids_.begin(), device_ids_.end());
+}
+
+std::shared_ptr<const std::string> DeviceRegistry::SerializedDeviceList()
+    const {
+  std::lock_guard<std::mutex> lock(list_mutex_);
+  if (!serialized_list_) {
+    Json::Value list(Json::ValueType::arrayValue);
+    for (const auto& id : device_ids_) {
+      list.append(id);
+    }
+    Json::StreamWriterBuilder json_factory;
+    serialized_list_ = std::make_shared<const std::string>(
+        Json::writeString(json_factory, list));
   }
-  return ret;
+  return serialized_list_;
+}
+
+void DeviceRegistry::AddToList(const std::string& device_id) {
+  std::lock_guard<std::mutex> lock(list_mutex_);
+  device_ids_.insert(device_id);
+  serialized_list_.reset();
+}
+
+void DeviceRegistry::RemoveFromList(const std::string& device_id) {
+  std::lock_guard<std::mutex> lock(list_mutex_);
+  device_ids_.erase(device_id);
+  serialized_list_.reset();
 }
 
 }  // namespace cuttlefish
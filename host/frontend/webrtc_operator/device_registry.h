@@ -17,8 +17,11 @@
 
 #include <cinttypes>
 
+#include <array>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -28,6 +31,10 @@ namespace cuttlefish {
 
 class DeviceHandler;
 
+// Safe to use from several service threads. Devices are spread across
+// independently locked shards by the hash of their id, so lookups for
+// different devices rarely contend. The serialized device list is cached and
+// only rebuilt after the set of devices changed.
 class DeviceRegistry {
  public:
   bool RegisterDevice(const std::string& device_id,
@@ -38,8 +45,29 @@ class DeviceRegistry {
 
   std::vector<std::string> ListDeviceIds() const;
 
+  // The JSON array of the registered device ids.
+  std::shared_ptr<const std::string> SerializedDeviceList() const;
+
  private:
-  std::map<std::string, std::weak_ptr<DeviceHandler>> devices_;
+  static constexpr size_t kNumShards = 16;
+
+  struct Shard {
+    std::mutex mutex;
+    std::map<std::string, std::weak_ptr<DeviceHandler>> devices;
+  };
+
+  Shard& ShardFor(const std::string& device_id);
+
+  // Called with the device's shard locked, so the list stays in sync.
+  void AddToList(const std::string& device_id);
+  void RemoveFromList(const std::string& device_id);
+
+  std::array<Shard, kNumShards> shards_;
+
+  mutable std::mutex list_mutex_;
+  std::set<std::string> device_ids_;
+  // null when it needs to be rebuilt
+  mutable std::shared_ptr<const std::string> serialized_list_;
 };
 
 }  // namespace cuttlefish
@@ -0,0 +1,123 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/frontend/webrtc_operator/directory_reporter.h"
+
+#include <android-base/logging.h>
+
+#include "host/frontend/webrtc_operator/constants/signaling_constants.h"
+
+namespace cuttlefish {
+namespace {
+
+// How often the device list is checked for changes between reports
+constexpr auto kChangeCheckPeriod = std::chrono::seconds(1);
+
+}  // namespace
+
+DirectoryReporter::DirectoryReporter(const std::string& directory_url,
+                                     const std::string& host_id,
+                                     const std::string& public_url,
+                                     const DeviceRegistry& registry,
+                                     std::chrono::milliseconds report_interval)
+    : hosts_url_(directory_url + "/hosts"),
+      host_id_(host_id),
+      public_url_(public_url),
+      registry_(registry),
+      start_time_(std::chrono::steady_clock::now()),
+      curl_(CurlWrapper::Create()),
+      report_interval_(report_interval),
+      thread_([this]() { ReportLoop(); }) {}
+
+DirectoryReporter::~DirectoryReporter() {
+  {
+    std::lock_guard<std::mutex> lock(stop_mutex_);
+    stop_ = true;
+  }
+  stop_cv_.notify_all();
+  thread_.join();
+}
+
+void DirectoryReporter::ReportLoop() {
+  std::shared_ptr<const std::string> reported_list;
+  auto next_report = std::chrono::steady_clock::now();
+  std::unique_lock<std::mutex> lock(stop_mutex_);
+  while (!stop_) {
+    // The registry only builds a new list when the devices changed
+    auto device_list = registry_.SerializedDeviceList();
+    auto now = std::chrono::steady_clock::now();
+    if (device_list != reported_list || now >= next_report) {
+      lock.unlock();
+      // A failed report is retried at the next interval, not every time the
+      // list is checked.
+      Report(device_list);
+      lock.lock();
+      reported_list = device_list;
+      next_report = now + report_interval_;
+    }
+    stop_cv_.wait_until(lock,
+                        std::min(next_report, now + kChangeCheckPeriod),
+                        [this]() { return stop_; });
+  }
+}
+
+void DirectoryReporter::Report(
+    const std::shared_ptr<const std::string>& device_list) {
+  Json::Value devices;
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> json_reader(builder.newCharReader());
+  std::string error_message;
+  if (!json_reader->parse(device_list->data(),
+                          device_list->data() + device_list->size(), &devices,
+                          &error_message)) {
+    LOG(ERROR) << "Failed to parse own device list: " << error_message;
+    return;
+  }
+  Json::Value health;
+  health["devices"] = static_cast<Json::UInt>(devices.size());
+  health["uptime_s"] = static_cast<Json::UInt64>(
+      std::chrono::duration_cast<std::chrono::seconds>(
+          std::chrono::steady_clock::now() - start_time_)
+          .count());
+
+  Json::Value report;
+  report[webrtc_signaling::kHostIdField] = host_id_;
+  report[webrtc_signaling::kHostUrlField] = public_url_;
+  report[webrtc_signaling::kDevicesField] = devices;
+  report[webrtc_signaling::kHealthField] = health;
+
+  auto response = curl_->PostToJson(hosts_url_, report,
+                                    {"Content-Type: application/json"});
+  if (!response.HttpSuccess()) {
+    // Only log transitions, a directory that is down would flood the logs
+    if (reachable_) {
+      LOG(ERROR) << "Failed to report to directory at " << hosts_url_
+                 << ", code " << response.http_code << ": "
+                 << response.data.toStyledString();
+      reachable_ = false;
+    }
+    return;
+  }
+  if (!reachable_) {
+    LOG(INFO) << "Reporting to directory at " << hosts_url_ << " again";
+    reachable_ = true;
+  }
+  auto& interval = response.data[webrtc_signaling::kReportIntervalField];
+  if (interval.isUInt64() && interval.asUInt64() > 0) {
+    report_interval_ = std::chrono::milliseconds(interval.asUInt64());
+  }
+}
+
+}  // namespace cuttlefish
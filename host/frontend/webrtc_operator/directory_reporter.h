@@ -0,0 +1,63 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <json/json.h>
+
+#include "host/frontend/webrtc_operator/device_registry.h"
+#include "host/libs/web/curl_wrapper.h"
+
+namespace cuttlefish {
+
+// Keeps this operator registered with a fleet directory (see HostDirectory),
+// posting the device list and health of the host periodically and soon after
+// the device list changes. The directory may change the reporting interval in
+// its replies.
+class DirectoryReporter {
+ public:
+  DirectoryReporter(const std::string& directory_url,
+                    const std::string& host_id, const std::string& public_url,
+                    const DeviceRegistry& registry,
+                    std::chrono::milliseconds report_interval);
+  ~DirectoryReporter();
+
+ private:
+  void ReportLoop();
+  void Report(const std::shared_ptr<const std::string>& device_list);
+
+  const std::string hosts_url_;
+  const std::string host_id_;
+  const std::string public_url_;
+  const DeviceRegistry& registry_;
+  const std::chrono::steady_clock::time_point start_time_;
+  std::unique_ptr<CurlWrapper> curl_;
+  std::chrono::milliseconds report_interval_;
+  bool reachable_ = true;
+
+  std::mutex stop_mutex_;
+  std::condition_variable stop_cv_;
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+}  // namespace cuttlefish
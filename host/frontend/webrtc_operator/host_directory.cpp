@@ -0,0 +1,157 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/frontend/webrtc_operator/host_directory.h"
+
+#include <memory>
+
+#include <android-base/logging.h>
+
+#include "host/frontend/webrtc_operator/constants/signaling_constants.h"
+
+namespace cuttlefish {
+namespace {
+
+// A host that missed this many reports in a row is considered down
+constexpr int kMissedReportsUntilStale = 3;
+// and it's removed from the directory after missing this many.
+constexpr int kMissedReportsUntilForgotten = 60;
+
+}  // namespace
+
+HostDirectory::HostDirectory(std::chrono::milliseconds report_interval)
+    : report_interval_(report_interval) {}
+
+void HostDirectory::Report(const std::string& host_id, const std::string& url,
+                           const Json::Value& devices,
+                           const Json::Value& health) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& record = hosts_[host_id];
+  if (record.url.empty()) {
+    LOG(INFO) << "Host '" << host_id << "' joined the directory at " << url;
+  }
+  record.url = url;
+  record.devices = devices;
+  record.health = health;
+  record.last_report = std::chrono::steady_clock::now();
+}
+
+void HostDirectory::ForgetDeadHosts(
+    std::chrono::steady_clock::time_point now) const {
+  for (auto it = hosts_.begin(); it != hosts_.end();) {
+    if (now - it->second.last_report >
+        report_interval_ * kMissedReportsUntilForgotten) {
+      LOG(INFO) << "Host '" << it->first << "' stopped reporting, removed";
+      it = hosts_.erase(it);
+    } else {
+      it++;
+    }
+  }
+}
+
+Json::Value HostDirectory::ToJson() const {
+  auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(mutex_);
+  ForgetDeadHosts(now);
+  Json::Value hosts(Json::arrayValue);
+  Json::UInt hosts_up = 0;
+  Json::UInt devices_up = 0;
+  for (const auto& [host_id, record] : hosts_) {
+    auto age = std::chrono::duration_cast<std::chrono::milliseconds>(
+        now - record.last_report);
+    bool up = age <= report_interval_ * kMissedReportsUntilStale;
+    Json::Value host;
+    host[webrtc_signaling::kHostIdField] = host_id;
+    host[webrtc_signaling::kHostUrlField] = record.url;
+    host[webrtc_signaling::kDevicesField] = record.devices;
+    host[webrtc_signaling::kHealthField] = record.health;
+    host["status"] = up ? "up" : "stale";
+    host["last_report_age_ms"] = static_cast<Json::UInt64>(age.count());
+    hosts.append(host);
+    if (up) {
+      hosts_up++;
+      devices_up += record.devices.size();
+    }
+  }
+  Json::Value summary;
+  summary["hosts"] = static_cast<Json::UInt>(hosts_.size());
+  summary["hosts_up"] = hosts_up;
+  summary["devices_up"] = devices_up;
+
+  Json::Value ret;
+  ret["hosts"] = hosts;
+  ret["summary"] = summary;
+  return ret;
+}
+
+HostsHandler::HostsHandler(struct lws* wsi, HostDirectory& directory)
+    : DynHandler(wsi), directory_(directory) {}
+
+void HostsHandler::Reply(const Json::Value& json) {
+  Json::StreamWriterBuilder factory;
+  AppendDataOut(Json::writeString(factory, json));
+}
+
+void HostsHandler::ReplyError(const std::string& message) {
+  LOG(ERROR) << message;
+  Json::Value reply;
+  reply["error"] = message;
+  Reply(reply);
+}
+
+HttpStatusCode HostsHandler::DoGet() {
+  Reply(directory_.ToJson());
+  return HttpStatusCode::Ok;
+}
+
+HttpStatusCode HostsHandler::DoPost() {
+  auto& data = GetDataIn();
+  Json::Value report;
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> json_reader(builder.newCharReader());
+  std::string error_message;
+  if (!json_reader->parse(data.c_str(), data.c_str() + data.size(), &report,
+                          &error_message)) {
+    ReplyError("Error parsing host report: " + error_message);
+    return HttpStatusCode::BadRequest;
+  }
+  if (!report.isMember(webrtc_signaling::kHostIdField) ||
+      !report[webrtc_signaling::kHostIdField].isString() ||
+      report[webrtc_signaling::kHostIdField].asString().empty()) {
+    ReplyError("Host report without host id");
+    return HttpStatusCode::BadRequest;
+  }
+  if (!report.isMember(webrtc_signaling::kHostUrlField) ||
+      !report[webrtc_signaling::kHostUrlField].isString()) {
+    ReplyError("Host report without operator url");
+    return HttpStatusCode::BadRequest;
+  }
+  if (!report[webrtc_signaling::kDevicesField].isArray()) {
+    ReplyError("Host report without device list");
+    return HttpStatusCode::BadRequest;
+  }
+  directory_.Report(report[webrtc_signaling::kHostIdField].asString(),
+                    report[webrtc_signaling::kHostUrlField].asString(),
+                    report[webrtc_signaling::kDevicesField],
+                    report[webrtc_signaling::kHealthField]);
+  // Lets the directory pace the reports of the whole fleet
+  Json::Value reply;
+  reply[webrtc_signaling::kReportIntervalField] =
+      static_cast<Json::UInt64>(directory_.report_interval().count());
+  Reply(reply);
+  return HttpStatusCode::Ok;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,79 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <json/json.h>
+
+#include "host/libs/websocket/websocket_handler.h"
+
+namespace cuttlefish {
+
+// Central view of a fleet of operators, one per host. Each host operator
+// periodically reports its devices and health, which the directory serves in
+// a single list. The directory never relays signaling or media: clients look
+// up the operator of a device here and then connect to that operator directly.
+// Safe to use from several service threads.
+class HostDirectory {
+ public:
+  HostDirectory(std::chrono::milliseconds report_interval);
+
+  // Records the latest report from a host, replacing any previous one.
+  void Report(const std::string& host_id, const std::string& url,
+              const Json::Value& devices, const Json::Value& health);
+
+  // The hosts with their devices and health, plus a fleet wide summary.
+  Json::Value ToJson() const;
+
+  // How often hosts are asked to report
+  std::chrono::milliseconds report_interval() const { return report_interval_; }
+
+ private:
+  struct HostRecord {
+    std::string url;
+    Json::Value devices;
+    Json::Value health;
+    std::chrono::steady_clock::time_point last_report;
+  };
+
+  // Must be called with mutex_ held
+  void ForgetDeadHosts(std::chrono::steady_clock::time_point now) const;
+
+  const std::chrono::milliseconds report_interval_;
+  mutable std::mutex mutex_;
+  mutable std::map<std::string, HostRecord> hosts_;
+};
+
+// GET lists the hosts in the directory, POST is how hosts report to it.
+class HostsHandler : public DynHandler {
+ public:
+  HostsHandler(struct lws* wsi, HostDirectory& directory);
+
+  HttpStatusCode DoGet() override;
+  HttpStatusCode DoPost() override;
+
+ private:
+  void Reply(const Json::Value& json);
+  void ReplyError(const std::string& message);
+
+  HostDirectory& directory_;
+};
+
+}  // namespace cuttlefish
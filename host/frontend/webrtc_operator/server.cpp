@@ -13,7 +13,11 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <unistd.h>
+
+#include <chrono>
 #include <map>
+#include <memory>
 #include <string>
 
 #include <android-base/logging.h>
@@ -22,6 +26,9 @@
 #include "host/frontend/webrtc_operator/client_handler.h"
 #include "host/frontend/webrtc_operator/device_handler.h"
 #include "host/frontend/webrtc_operator/device_list_handler.h"
+#include "host/frontend/webrtc_operator/directory_reporter.h"
+#include "host/frontend/webrtc_operator/host_directory.h"
+#include "host/frontend/webrtc_operator/thumbnail_handler.h"
 #include "host/libs/websocket/websocket_handler.h"
 #include "host/libs/websocket/websocket_server.h"
 
@@ -36,16 +43,46 @@ DEFINE_string(certs_dir, "webrtc/certs",
               "server.key file and (optionally) a CA.crt file.");
 DEFINE_string(stun_server, "stun.l.google.com:19302",
               "host:port of STUN server to use for public address resolution");
+DEFINE_int32(service_threads, 1,
+             "Threads serving the connections, each device and client "
+             "connection sticks to one of them.");
+DEFINE_bool(directory_mode, false,
+            "Also act as the directory of a fleet of operators, listing the "
+            "hosts that report to it with their devices and health.");
+DEFINE_string(directory_url, "",
+              "Base url of a fleet directory (an operator running with "
+              "--directory_mode) to report this host's devices to.");
+DEFINE_string(host_id, "",
+              "Name of this host in the fleet directory. Defaults to the "
+              "hostname.");
+DEFINE_string(public_url, "",
+              "Base url clients should use to reach this operator, as "
+              "published in the fleet directory. Defaults to one built from "
+              "the hostname and --http_server_port.");
+DEFINE_int32(directory_report_interval_ms, 10000,
+             "How often hosts report to the fleet directory. In directory "
+             "mode, the interval requested from the reporting hosts.");
 
 namespace {
 
 constexpr auto kRegisterDeviceUriPath = "/register_device";
 constexpr auto kConnectClientUriPath = "/connect_client";
 constexpr auto kListDevicesUriPath = "/devices";
+constexpr auto kThumbnailUriPath = "/thumbnail";
 const constexpr auto kInfraConfigPath = "/infra_config";
 const constexpr auto kConnectPath = "/connect";
 const constexpr auto kForwardPath = "/forward";
 const constexpr auto kPollPath = "/poll_messages";
+const constexpr auto kHostsPath = "/hosts";
+
+std::string Hostname() {
+  char hostname[256] = {};
+  if (gethostname(hostname, sizeof(hostname) - 1) != 0) {
+    PLOG(ERROR) << "Failed to get the hostname";
+    return "localhost";
+  }
+  return hostname;
+}
 
 }  // namespace
 
@@ -65,6 +102,8 @@ int main(int argc, char** argv) {
           : cuttlefish::WebSocketServer("webrtc-operator", FLAGS_assets_dir,
                                         FLAGS_http_server_port);
 
+  wss.SetServiceThreads(FLAGS_service_threads);
+
   // Device list endpoint
   wss.RegisterDynHandlerFactory(
       kListDevicesUriPath, [&device_registry](struct lws* wsi) {
@@ -72,6 +111,13 @@ int main(int argc, char** argv) {
             new cuttlefish::DeviceListHandler(wsi, device_registry));
       });
 
+  // Device screen thumbnails, for device lists
+  wss.RegisterDynHandlerFactory(
+      kThumbnailUriPath, [&device_registry](struct lws* wsi) {
+        return std::unique_ptr<cuttlefish::DynHandler>(
+            new cuttlefish::ThumbnailHandler(wsi, device_registry));
+      });
+
   // Websocket signaling endpoints
   auto device_handler_factory_p =
       std::unique_ptr<cuttlefish::WebSocketHandlerFactory>(
@@ -108,6 +154,31 @@ int main(int argc, char** argv) {
             new cuttlefish::PollHandler(wsi, &poll_store));
       });
 
+  std::unique_ptr<cuttlefish::HostDirectory> host_directory;
+  if (FLAGS_directory_mode) {
+    host_directory = std::make_unique<cuttlefish::HostDirectory>(
+        std::chrono::milliseconds(FLAGS_directory_report_interval_ms));
+    wss.RegisterDynHandlerFactory(
+        kHostsPath, [&host_directory](struct lws* wsi) {
+          return std::unique_ptr<cuttlefish::DynHandler>(
+              new cuttlefish::HostsHandler(wsi, *host_directory));
+        });
+  }
+
+  std::unique_ptr<cuttlefish::DirectoryReporter> directory_reporter;
+  if (!FLAGS_directory_url.empty()) {
+    auto host_id = FLAGS_host_id.empty() ? Hostname() : FLAGS_host_id;
+    auto public_url = FLAGS_public_url;
+    if (public_url.empty()) {
+      public_url = std::string(FLAGS_use_secure_http ? "https" : "http") +
+                   "://" + Hostname() + ":" +
+                   std::to_string(FLAGS_http_server_port);
+    }
+    directory_reporter = std::make_unique<cuttlefish::DirectoryReporter>(
+        FLAGS_directory_url, host_id, public_url, device_registry,
+        std::chrono::milliseconds(FLAGS_directory_report_interval_ms));
+  }
+
   wss.Serve();
   return 0;
 }
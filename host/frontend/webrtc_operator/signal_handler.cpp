@@ -21,6 +21,20 @@
 #include "host/frontend/webrtc_operator/constants/signaling_constants.h"
 
 namespace cuttlefish {
+namespace {
+
+// Bounds the work a single frame can cause
+constexpr Json::ArrayIndex kMaxBatchSize = 256;
+// Smaller messages go out as text, the frame type makes no difference for
+// them.
+constexpr std::size_t kMinBinaryMessageSize = 4096;
+
+bool IsValidMessage(const Json::Value& message) {
+  return message.isObject() && message.isMember(webrtc_signaling::kTypeField) &&
+         message[webrtc_signaling::kTypeField].isString();
+}
+
+}  // namespace
 
 SignalHandler::SignalHandler(struct lws* wsi, DeviceRegistry* registry,
                              const ServerConfig& server_config)
@@ -30,12 +44,9 @@ SignalHandler::SignalHandler(struct lws* wsi, DeviceRegistry* registry,
 
 void SignalHandler::OnConnected() {}
 
-void SignalHandler::OnReceive(const uint8_t* msg, size_t len, bool binary) {
-  if (binary) {
-    LogAndReplyError("Received a binary message");
-    Close();
-    return;
-  }
+void SignalHandler::OnReceive(const uint8_t* msg, size_t len, bool) {
+  // Peers that accept binary frames may send them too, the content is the same
+  // JSON either way.
   Json::Value json_message;
   Json::CharReaderBuilder builder;
   std::unique_ptr<Json::CharReader> json_reader(builder.newCharReader());
@@ -47,8 +58,24 @@ void SignalHandler::OnReceive(const uint8_t* msg, size_t len, bool binary) {
     Close();
     return;
   }
-  if (!json_message.isMember(webrtc_signaling::kTypeField) ||
-      !json_message[webrtc_signaling::kTypeField].isString()) {
+  if (json_message.isArray()) {
+    if (json_message.empty() || json_message.size() > kMaxBatchSize) {
+      LogAndReplyError("Invalid batch size: " +
+                       std::to_string(json_message.size()));
+      Close();
+      return;
+    }
+    for (const auto& message : json_message) {
+      if (!IsValidMessage(message)) {
+        LogAndReplyError("Invalid message format in batch");
+        Close();
+        return;
+      }
+    }
+    handleBatch(json_message);
+    return;
+  }
+  if (!IsValidMessage(json_message)) {
     LogAndReplyError("Invalid message format: '" + std::string(msg, msg + len) +
                      "'");
     // Rate limiting would be a good idea here
@@ -78,13 +105,30 @@ void SignalHandler::OnReceive(const uint8_t* msg, size_t len, bool binary,
   }
 }
 
+void SignalHandler::handleBatch(const Json::Value& messages) {
+  for (const auto& message : messages) {
+    handleMessage(message[webrtc_signaling::kTypeField].asString(), message);
+  }
+}
+
 void SignalHandler::SendServerConfig() {
   // Call every time to allow config changes?
   auto reply = server_config_.ToJson();
   reply[webrtc_signaling::kTypeField] = webrtc_signaling::kConfigType;
+  reply[webrtc_signaling::kAcceptsBatchesField] = true;
+  reply[webrtc_signaling::kAcceptsBinaryField] = true;
   Reply(reply);
 }
 
+void SignalHandler::ReadPeerCapabilities(const Json::Value& message) {
+  // Absent in messages from older peers
+  auto flag = [&message](const char* field) {
+    return message[field].isBool() && message[field].asBool();
+  };
+  peer_accepts_batches_ = flag(webrtc_signaling::kAcceptsBatchesField);
+  peer_accepts_binary_ = flag(webrtc_signaling::kAcceptsBinaryField);
+}
+
 void SignalHandler::LogAndReplyError(const std::string& error_message) {
   LOG(ERROR) << error_message;
   auto reply_str = "{\"error\":\"" + error_message + "\"}";
@@ -93,8 +137,30 @@ void SignalHandler::LogAndReplyError(const std::string& error_message) {
 
 void SignalHandler::Reply(const Json::Value& json) {
   Json::StreamWriterBuilder factory;
+  // The default indents with tabs and newlines
+  factory["indentation"] = "";
   auto replyAsString = Json::writeString(factory, json);
-  EnqueueMessage(replyAsString.c_str(), replyAsString.size());
+  // Binary frames spare the receiver the UTF-8 validation of large payloads
+  // like SDP offers.
+  bool binary =
+      peer_accepts_binary_ && replyAsString.size() >= kMinBinaryMessageSize;
+  EnqueueMessage(replyAsString.c_str(), replyAsString.size(), binary);
+}
+
+void SignalHandler::ReplyBatch(const std::vector<Json::Value>& messages) {
+  if (!peer_accepts_batches_ || messages.size() == 1) {
+    for (const auto& message : messages) {
+      Reply(message);
+    }
+    return;
+  }
+  for (std::size_t i = 0; i < messages.size(); i += kMaxBatchSize) {
+    Json::Value batch(Json::arrayValue);
+    for (std::size_t j = i; j < messages.size() && j < i + kMaxBatchSize; j++) {
+      batch.append(messages[j]);
+    }
+    Reply(batch);
+  }
 }
 
 }  // namespace cuttlefish
@@ -15,8 +15,10 @@
 
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <json/json.h>
 
@@ -38,13 +40,24 @@ class SignalHandler : public WebSocketHandler {
 
   virtual void handleMessage(const std::string& message_type,
                              const Json::Value& message) = 0;
+  // Receives the messages of a batch, already validated. Handles them one by
+  // one unless overridden.
+  virtual void handleBatch(const Json::Value& messages);
   void SendServerConfig();
+  // Reads the capabilities the peer announced when registering or connecting
+  void ReadPeerCapabilities(const Json::Value& message);
 
   void LogAndReplyError(const std::string& message);
   void Reply(const Json::Value& json);
+  // Sends the messages in a single frame if the peer accepts batches, one by
+  // one otherwise.
+  void ReplyBatch(const std::vector<Json::Value>& messages);
 
   DeviceRegistry* registry_;
   const ServerConfig& server_config_;
   std::vector<uint8_t> receive_buffer_;
+  // Replies are sent from other handlers' threads too
+  std::atomic<bool> peer_accepts_batches_ = false;
+  std::atomic<bool> peer_accepts_binary_ = false;
 };
 }  // namespace cuttlefish
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/frontend/webrtc_operator/thumbnail_handler.h"
+
+#include "host/frontend/webrtc_operator/constants/signaling_constants.h"
+#include "host/frontend/webrtc_operator/device_handler.h"
+
+namespace cuttlefish {
+
+ThumbnailHandler::ThumbnailHandler(struct lws* wsi, DeviceRegistry& registry)
+    : DynHandler(wsi), registry_(registry) {}
+
+HttpStatusCode ThumbnailHandler::DoGet() {
+  auto device_id = GetUrlArg(webrtc_signaling::kDeviceIdField);
+  if (device_id.empty()) {
+    return HttpStatusCode::BadRequest;
+  }
+  auto device = registry_.GetDevice(device_id);
+  if (!device) {
+    return HttpStatusCode::NotFound;
+  }
+  auto thumbnail = device->thumbnail();
+  if (!thumbnail) {
+    return HttpStatusCode::NotFound;
+  }
+  AddResponseHeader("ETag:", thumbnail->etag);
+  AddResponseHeader("Cache-Control:", "no-cache");
+  if (GetIfNoneMatch() == thumbnail->etag) {
+    return HttpStatusCode::NotModified;
+  }
+  SetContentType(thumbnail->content_type);
+  AppendDataOut(thumbnail->data);
+  return HttpStatusCode::Ok;
+}
+
+HttpStatusCode ThumbnailHandler::DoPost() {
+  return HttpStatusCode::MethodNotAllowed;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "host/frontend/webrtc_operator/device_registry.h"
+#include "host/libs/websocket/websocket_handler.h"
+
+namespace cuttlefish {
+
+// Serves the latest thumbnail of the device given by the device_id query
+// argument. Browsers revalidate it on every request and get a 304 while the
+// device's screen doesn't change, so polling a grid of thumbnails is cheap.
+class ThumbnailHandler : public DynHandler {
+ public:
+  ThumbnailHandler(struct lws* wsi, DeviceRegistry& registry);
+
+  HttpStatusCode DoGet() override;
+  HttpStatusCode DoPost() override;
+
+ private:
+  DeviceRegistry& registry_;
+};
+
+}  // namespace cuttlefish
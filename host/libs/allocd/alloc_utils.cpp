@@ -1,22 +1,102 @@
 #include "host/libs/allocd/alloc_utils.h"
 
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <linux/if_link.h>
+#include <linux/if_tun.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+
 #include <cstdint>
+#include <cstring>
 #include <fstream>
+#include <mutex>
 
 #include "android-base/logging.h"
+#include "android-base/parseint.h"
+#include "common/libs/net/netlink_client.h"
+#include "common/libs/net/netlink_request.h"
 
 namespace cuttlefish {
+namespace {
+
+constexpr char kTapGroup[] = "cvdnetwork";
+
+// Interfaces, bridges and addresses are configured through rtnetlink sockets
+// kept open for the lifetime of allocd, rather than by running `ip`. Each
+// thread gets its own, so replies are never read by the wrong thread.
+bool SendRouteRequest(const NetlinkRequest& request) {
+  static thread_local auto client =
+      NetlinkClientFactory::Default()->New(NETLINK_ROUTE);
+  if (!client) {
+    LOG(ERROR) << "Unable to open an rtnetlink socket";
+    return false;
+  }
+  return client->Send(request);
+}
 
-int RunExternalCommand(const std::string& command) {
-  FILE* fp;
-  LOG(INFO) << "Running external command: " << command;
-  fp = popen(command.c_str(), "r");
+// ebtables-restore replaces whole tables, so concurrent updates from the
+// request and teardown threads could drop each other's rules.
+std::mutex firewall_mutex;
 
-  if (fp == nullptr) {
-    LOG(WARNING) << "Error running external command";
-    return -1;
+int32_t IfaceIndex(const std::string& name) {
+  int32_t index = if_nametoindex(name.c_str());
+  if (index == 0) {
+    LOG(WARNING) << "No such interface: " << name;
+  }
+  return index;
+}
+
+// Adds the ifinfomsg selecting an interface, without changing its flags.
+void AddIfIndex(NetlinkRequest& request, int32_t index) {
+  auto info = request.Reserve<ifinfomsg>();
+  info->ifi_family = AF_UNSPEC;
+  info->ifi_index = index;
+}
+
+bool SetIfaceUp(const std::string& name, bool up) {
+  auto index = IfaceIndex(name);
+  if (index == 0) {
+    return false;
   }
+  NetlinkRequest request(RTM_SETLINK, 0);
+  request.AddIfInfo(index, up);
+  return SendRouteRequest(request);
+}
 
+// Equivalent of `ip addr add|del <gateway><netmask> broadcast + dev <name>`
+bool GatewayRequest(const std::string& name, const std::string& gateway,
+                    const std::string& netmask, bool add) {
+  auto index = IfaceIndex(name);
+  if (index == 0) {
+    return false;
+  }
+  in_addr address;
+  if (inet_pton(AF_INET, gateway.c_str(), &address) != 1) {
+    LOG(ERROR) << "Invalid gateway address: " << gateway;
+    return false;
+  }
+  int prefix_len;
+  if (netmask.empty() || netmask[0] != '/' ||
+      !android::base::ParseInt(netmask.substr(1), &prefix_len, 0, 32)) {
+    LOG(ERROR) << "Invalid netmask: " << netmask;
+    return false;
+  }
+  const uint32_t host_bits =
+      prefix_len == 0 ? ~0u : (1u << (32 - prefix_len)) - 1;
+  const in_addr_t broadcast = address.s_addr | htonl(host_bits);
+
+  NetlinkRequest request(add ? RTM_NEWADDR : RTM_DELADDR,
+                         add ? NLM_F_CREATE | NLM_F_EXCL : 0);
+  request.AddAddrInfo(index, prefix_len);
+  request.AddInt(IFA_LOCAL, address.s_addr);
+  request.AddInt(IFA_ADDRESS, address.s_addr);
+  request.AddInt(IFA_BROADCAST, broadcast);
+  return SendRouteRequest(request);
+}
+
+int WaitExternalCommand(FILE* fp) {
   int status = pclose(fp);
   int ret = -1;
   if (status == -1) {
@@ -34,33 +114,91 @@ int RunExternalCommand(const std::string& command) {
   return ret;
 }
 
+}  // namespace
+
+int RunExternalCommand(const std::string& command) {
+  FILE* fp;
+  LOG(INFO) << "Running external command: " << command;
+  fp = popen(command.c_str(), "r");
+
+  if (fp == nullptr) {
+    LOG(WARNING) << "Error running external command";
+    return -1;
+  }
+
+  return WaitExternalCommand(fp);
+}
+
+int RunExternalCommand(const std::string& command, const std::string& input) {
+  FILE* fp;
+  LOG(INFO) << "Running external command: " << command;
+  fp = popen(command.c_str(), "w");
+
+  if (fp == nullptr) {
+    LOG(WARNING) << "Error running external command";
+    return -1;
+  }
+
+  if (fwrite(input.data(), 1, input.size(), fp) != input.size()) {
+    LOG(WARNING) << "Failed to write the input of the external command";
+  }
+  return WaitExternalCommand(fp);
+}
+
+// Equivalent of `ip tuntap add dev <name> mode tap group cvdnetwork vnet_hdr
+// multi_queue`. Multiqueue lets the VMM serve each virtio-net queue pair
+// through its own file descriptor, and vhost-net through its own thread.
 bool AddTapIface(const std::string& name) {
-  std::stringstream ss;
-  ss << "ip tuntap add dev " << name << " mode tap group cvdnetwork vnet_hdr";
-  auto add_command = ss.str();
-  LOG(INFO) << "Create tap interface: " << add_command;
-  int status = RunExternalCommand(add_command);
-  return status == 0;
+  LOG(INFO) << "Create tap interface: " << name;
+  auto group = getgrnam(kTapGroup);
+  if (group == nullptr) {
+    LOG(WARNING) << "Group " << kTapGroup << " does not exist";
+    return false;
+  }
+  auto tun = SharedFD::Open("/dev/net/tun", O_RDWR);
+  if (!tun->IsOpen()) {
+    LOG(WARNING) << "Unable to open tun device: " << tun->StrError();
+    return false;
+  }
+  struct ifreq ifr;
+  memset(&ifr, 0, sizeof(ifr));
+  ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_VNET_HDR | IFF_MULTI_QUEUE;
+  strncpy(ifr.ifr_name, name.c_str(), IFNAMSIZ - 1);
+  if (tun->Ioctl(TUNSETIFF, &ifr) < 0) {
+    LOG(WARNING) << "Unable to create tap interface " << name << ": "
+                 << tun->StrError();
+    return false;
+  }
+  auto gid = reinterpret_cast<void*>(static_cast<uintptr_t>(group->gr_gid));
+  if (tun->Ioctl(TUNSETGROUP, gid) < 0 ||
+      tun->Ioctl(TUNSETPERSIST, reinterpret_cast<void*>(1)) < 0) {
+    LOG(WARNING) << "Unable to configure tap interface " << name << ": "
+                 << tun->StrError();
+    return false;
+  }
+  return true;
 }
 
 bool ShutdownIface(const std::string& name) {
-  std::stringstream ss;
-  ss << "ip link set dev " << name << " down";
-  auto link_command = ss.str();
-  LOG(INFO) << "Shutdown tap interface: " << link_command;
-  int status = RunExternalCommand(link_command);
-
-  return status == 0;
+  LOG(INFO) << "Shutdown tap interface: " << name;
+  return SetIfaceUp(name, false);
 }
 
 bool BringUpIface(const std::string& name) {
-  std::stringstream ss;
-  ss << "ip link set dev " << name << " up";
-  auto link_command = ss.str();
-  LOG(INFO) << "Bring up tap interface: " << link_command;
-  int status = RunExternalCommand(link_command);
+  LOG(INFO) << "Bring up tap interface: " << name;
+  return SetIfaceUp(name, true);
+}
 
-  return status == 0;
+bool ResetTapIface(const std::string& name) {
+  // an up tap only has carrier while a process has it open
+  std::ifstream carrier("/sys/class/net/" + name + "/carrier");
+  int has_carrier = 0;
+  if (carrier >> has_carrier && has_carrier) {
+    LOG(WARNING) << "Tap interface still in use: " << name;
+    return false;
+  }
+  LOG(INFO) << "Reset tap interface: " << name;
+  return SetIfaceUp(name, false) && SetIfaceUp(name, true);
 }
 
 bool CreateEthernetIface(const std::string& name, const std::string& bridge_name,
@@ -81,20 +219,14 @@ bool CreateEthernetIface(const std::string& name, const std::string& bridge_name
     return false;
   }
 
-  if (!has_ipv4_bridge) {
-    if (!CreateEbtables(name, true, use_ebtables_legacy)) {
-      CleanupEthernetIface(name, config);
-      return false;
-    }
-    config.has_broute_ipv4 = true;
-  }
-
-  if (!has_ipv6_bridge) {
-    if (CreateEbtables(name, false, use_ebtables_legacy)) {
+  if (!has_ipv4_bridge || !has_ipv6_bridge) {
+    if (!ConfigureEbtables(name, !has_ipv4_bridge, !has_ipv6_bridge, true,
+                           use_ebtables_legacy)) {
       CleanupEthernetIface(name, config);
       return false;
     }
-    config.has_broute_ipv6 = true;
+    config.has_broute_ipv4 = !has_ipv4_bridge;
+    config.has_broute_ipv6 = !has_ipv6_bridge;
   }
 
   return true;
@@ -159,34 +291,21 @@ bool DestroyMobileIface(const std::string& name, uint16_t id,
 
 bool AddGateway(const std::string& name, const std::string& gateway,
                 const std::string& netmask) {
-  std::stringstream ss;
-  ss << "ip addr add " << gateway << netmask << " broadcast + dev " << name;
-  auto command = ss.str();
-  LOG(INFO) << "setup gateway: " << command;
-  int status = RunExternalCommand(command);
-
-  return status == 0;
+  LOG(INFO) << "setup gateway: " << gateway << netmask << " on " << name;
+  return GatewayRequest(name, gateway, netmask, true);
 }
 
 bool DestroyGateway(const std::string& name, const std::string& gateway,
                     const std::string& netmask) {
-  std::stringstream ss;
-  ss << "ip addr del " << gateway << netmask << " broadcast + dev " << name;
-  auto command = ss.str();
-  LOG(INFO) << "removing gateway: " << command;
-  int status = RunExternalCommand(command);
-
-  return status == 0;
+  LOG(INFO) << "removing gateway: " << gateway << netmask << " on " << name;
+  return GatewayRequest(name, gateway, netmask, false);
 }
 
 bool DestroyEthernetIface(const std::string& name, bool has_ipv4_bridge,
                           bool has_ipv6_bridge, bool use_ebtables_legacy) {
-  if (!has_ipv6_bridge) {
-    DestroyEbtables(name, false, use_ebtables_legacy);
-  }
-
-  if (!has_ipv4_bridge) {
-    DestroyEbtables(name, true, use_ebtables_legacy);
+  if (!has_ipv4_bridge || !has_ipv6_bridge) {
+    ConfigureEbtables(name, !has_ipv4_bridge, !has_ipv6_bridge, false,
+                      use_ebtables_legacy);
   }
 
   return DestroyIface(name);
@@ -194,12 +313,9 @@ bool DestroyEthernetIface(const std::string& name, bool has_ipv4_bridge,
 
 void CleanupEthernetIface(const std::string& name,
                           const EthernetNetworkConfig& config) {
-  if (config.has_broute_ipv6) {
-    DestroyEbtables(name, false, config.use_ebtables_legacy);
-  }
-
-  if (config.has_broute_ipv4) {
-    DestroyEbtables(name, true, config.use_ebtables_legacy);
+  if (config.has_broute_ipv4 || config.has_broute_ipv6) {
+    ConfigureEbtables(name, config.has_broute_ipv4, config.has_broute_ipv6,
+                      false, config.use_ebtables_legacy);
   }
 
   if (config.has_tap) {
@@ -209,14 +325,57 @@ void CleanupEthernetIface(const std::string& name,
 
 bool CreateEbtables(const std::string& name, bool use_ipv4,
                     bool use_ebtables_legacy) {
-  return EbtablesBroute(name, use_ipv4, true, use_ebtables_legacy) &&
-         EbtablesFilter(name, use_ipv4, true, use_ebtables_legacy);
+  return ConfigureEbtables(name, use_ipv4, !use_ipv4, true,
+                           use_ebtables_legacy);
 }
 
 bool DestroyEbtables(const std::string& name, bool use_ipv4,
                      bool use_ebtables_legacy) {
-  return EbtablesBroute(name, use_ipv4, false, use_ebtables_legacy) &&
-         EbtablesFilter(name, use_ipv4, false, use_ebtables_legacy);
+  return ConfigureEbtables(name, use_ipv4, !use_ipv4, false,
+                           use_ebtables_legacy);
+}
+
+bool ConfigureEbtables(const std::string& name, bool use_ipv4, bool use_ipv6,
+                       bool add, bool use_ebtables_legacy) {
+  std::lock_guard<std::mutex> lock(firewall_mutex);
+  std::vector<const char*> protocols;
+  if (use_ipv4) {
+    protocols.push_back("ipv4");
+  }
+  if (use_ipv6) {
+    protocols.push_back("ipv6");
+  }
+  // All the rules go through a single ebtables-restore, which replaces each
+  // table once instead of once per rule.
+  std::stringstream rules;
+  rules << "*broute\n";
+  for (const auto& protocol : protocols) {
+    rules << (add ? "-A" : "-D") << " BROUTING -p " << protocol << " --in-if "
+          << name << " -j DROP\n";
+  }
+  rules << "*filter\n";
+  for (const auto& protocol : protocols) {
+    rules << (add ? "-A" : "-D") << " FORWARD -p " << protocol << " --out-if "
+          << name << " -j DROP\n";
+  }
+  std::stringstream ss;
+  // same as in EbtablesBroute, the program can only be one of the two
+  ss << (use_ebtables_legacy ? kEbtablesLegacyName : kEbtablesName)
+     << "-restore --noflush";
+  if (RunExternalCommand(ss.str(), rules.str()) == 0) {
+    return true;
+  }
+
+  LOG(WARNING) << "Batched ebtables update failed, applying rules one by one";
+  bool success = true;
+  for (bool ipv4 : {true, false}) {
+    if (ipv4 ? !use_ipv4 : !use_ipv6) {
+      continue;
+    }
+    success &= EbtablesBroute(name, ipv4, add, use_ebtables_legacy);
+    success &= EbtablesFilter(name, ipv4, add, use_ebtables_legacy);
+  }
+  return success;
 }
 
 bool EbtablesBroute(const std::string& name, bool use_ipv4, bool add,
@@ -258,12 +417,15 @@ bool EbtablesFilter(const std::string& name, bool use_ipv4, bool add,
 
 bool LinkTapToBridge(const std::string& tap_name,
                      const std::string& bridge_name) {
-  std::stringstream ss;
-  ss << "ip link set dev " << tap_name << " master " << bridge_name;
-  auto command = ss.str();
-  int status = RunExternalCommand(command);
-
-  return status == 0;
+  auto tap_index = IfaceIndex(tap_name);
+  auto bridge_index = IfaceIndex(bridge_name);
+  if (tap_index == 0 || bridge_index == 0) {
+    return false;
+  }
+  NetlinkRequest request(RTM_SETLINK, 0);
+  AddIfIndex(request, tap_index);
+  request.AddInt(IFLA_MASTER, static_cast<uint32_t>(bridge_index));
+  return SendRouteRequest(request);
 }
 
 bool CreateTap(const std::string& name) {
@@ -283,13 +445,14 @@ bool CreateTap(const std::string& name) {
 }
 
 bool DeleteIface(const std::string& name) {
-  std::stringstream ss;
-  ss << "ip link delete " << name;
-  auto link_command = ss.str();
-  LOG(INFO) << "Delete tap interface: " << link_command;
-  int status = RunExternalCommand(link_command);
-
-  return status == 0;
+  LOG(INFO) << "Delete tap interface: " << name;
+  auto index = IfaceIndex(name);
+  if (index == 0) {
+    return false;
+  }
+  NetlinkRequest request(RTM_DELLINK, 0);
+  AddIfIndex(request, index);
+  return SendRouteRequest(request);
 }
 
 bool DestroyIface(const std::string& name) {
@@ -317,20 +480,21 @@ std::optional<std::string> GetUserName(uid_t uid) {
   return std::nullopt;
 }
 
+// Equivalent of `ip link add name <name> type bridge forward_delay 0
+// stp_state 0` followed by `ip link set dev <name> up`, in one request.
 bool CreateBridge(const std::string& name) {
-  std::stringstream ss;
-  ss << "ip link add name " << name
-     << " type bridge forward_delay 0 stp_state 0";
-
-  auto command = ss.str();
-  LOG(INFO) << "create bridge: " << command;
-  int status = RunExternalCommand(command);
-
-  if (status != 0) {
-    return false;
-  }
-
-  return BringUpIface(name);
+  LOG(INFO) << "create bridge: " << name;
+  NetlinkRequest request(RTM_NEWLINK, NLM_F_CREATE | NLM_F_EXCL);
+  request.AddIfInfo(0, true);
+  request.AddString(IFLA_IFNAME, name);
+  request.PushList(IFLA_LINKINFO);
+  request.AddString(IFLA_INFO_KIND, "bridge");
+  request.PushList(IFLA_INFO_DATA);
+  request.AddInt(IFLA_BR_FORWARD_DELAY, static_cast<uint32_t>(0));
+  request.AddInt(IFLA_BR_STP_STATE, static_cast<uint32_t>(0));
+  request.PopList();
+  request.PopList();
+  return SendRouteRequest(request);
 }
 
 bool DestroyBridge(const std::string& name) { return DeleteIface(name); }
@@ -449,6 +613,7 @@ bool IptableConfig(const std::string& network, bool add) {
 
   auto command = ss.str();
   LOG(INFO) << "iptable_config: " << command;
+  std::lock_guard<std::mutex> lock(firewall_mutex);
   int status = RunExternalCommand(command);
 
   return status == 0;
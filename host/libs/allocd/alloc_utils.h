@@ -23,6 +23,7 @@
 #include <atomic>
 #include <optional>
 #include <sstream>
+#include <vector>
 
 #include "common/libs/fs/shared_fd.h"
 #include "host/libs/allocd/request.h"
@@ -63,6 +64,8 @@ struct GatewayConfig {
 };
 
 int RunExternalCommand(const std::string& command);
+// Same as above, also writing input to the standard input of the command.
+int RunExternalCommand(const std::string& command, const std::string& input);
 std::optional<std::string> GetUserName(uid_t uid);
 
 bool AddTapIface(const std::string& name);
@@ -70,6 +73,9 @@ bool CreateTap(const std::string& name);
 
 bool BringUpIface(const std::string& name);
 bool ShutdownIface(const std::string& name);
+// Cycles the link of a tap no process is attached to anymore, which drops
+// its queued frames and neighbour entries while keeping its configuration.
+bool ResetTapIface(const std::string& name);
 
 bool DestroyIface(const std::string& name);
 bool DeleteIface(const std::string& name);
@@ -81,6 +87,10 @@ bool CreateEbtables(const std::string& name, bool use_ipv,
                     bool use_ebtables_legacy);
 bool DestroyEbtables(const std::string& name, bool use_ipv4,
                      bool use_ebtables_legacy);
+// Adds or removes the broute and filter rules of the interface for the chosen
+// protocols at once.
+bool ConfigureEbtables(const std::string& name, bool use_ipv4, bool use_ipv6,
+                       bool add, bool use_ebtables_legacy);
 bool EbtablesBroute(const std::string& name, bool use_ipv4, bool add,
                     bool use_ebtables_legacy);
 bool EbtablesFilter(const std::string& name, bool use_ipv4, bool add,
@@ -15,6 +15,7 @@
  */
 
 #include <android-base/logging.h>
+#include <android-base/strings.h>
 #include <asm-generic/socket.h>
 #include <gflags/gflags.h>
 #include <pwd.h>
@@ -41,6 +42,11 @@
 
 DEFINE_string(socket_path, cuttlefish::kDefaultLocation, "Socket path");
 DEFINE_bool(ebtables_legacy, false, "use ebtables-legacy instead of ebtables");
+DEFINE_uint32(warm_pool_size, 2,
+              "Number of taps of each type kept ready for each user, 0 "
+              "creates them on demand only");
+DEFINE_string(warm_pool_users, "",
+              "Comma separated users whose taps are created at startup");
 
 int main(int argc, char* argv[]) {
   ::android::base::InitLogging(argv, android::base::StderrLogger);
@@ -52,6 +58,21 @@ int main(int argc, char* argv[]) {
     cuttlefish::ResourceManager m;
     m.SetSocketLocation(FLAGS_socket_path);
     m.SetUseEbtablesLegacy(FLAGS_ebtables_legacy);
+    m.SetWarmPoolSize(FLAGS_warm_pool_size);
+    if (FLAGS_warm_pool_size > 0) {
+      auto users = android::base::Split(FLAGS_warm_pool_users, ",");
+      for (const auto& user : users) {
+        if (user.empty()) {
+          continue;
+        }
+        passwd* pw = getpwnam(user.c_str());
+        if (!pw) {
+          LOG(WARNING) << "Unknown user for the warm pool: " << user;
+          continue;
+        }
+        m.WarmUp(pw->pw_uid);
+      }
+    }
     m.JsonServer();
   }
 
@@ -38,6 +38,7 @@ enum class RequestType : uint16_t {
   DestroyInterface,  // Request to destroy a managed network interface
   StopSession,       // Request all resources within a session be released
   Shutdown,          // request allocd to shutdown and clean up all resources
+  CreateInstances,   // Request the interfaces of several instances at once
 };
 
 /// Defines interface types supported by allocd
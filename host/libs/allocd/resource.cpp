@@ -30,6 +30,8 @@ bool MobileIface::ReleaseResource() {
   return DestroyMobileIface(GetName(), iface_id_, ipaddr_);
 }
 
+bool MobileIface::ResetResource() { return ResetTapIface(GetName()); }
+
 bool EthernetIface::AcquireResource() {
   return CreateEthernetIface(GetName(), GetBridgeName(), has_ipv4_, has_ipv6_,
                              use_ebtables_legacy_);
@@ -40,4 +42,6 @@ bool EthernetIface::ReleaseResource() {
                               use_ebtables_legacy_);
 }
 
+bool EthernetIface::ResetResource() { return ResetTapIface(GetName()); }
+
 }  // namespace cuttlefish
@@ -39,6 +39,9 @@ class StaticResource {
   virtual ~StaticResource() = default;
   virtual bool ReleaseResource() = 0;
   virtual bool AcquireResource() = 0;
+  // Returns an acquired resource to a clean state for reuse, without
+  // releasing it. Fails for resources that can't be reused.
+  virtual bool ResetResource() { return false; }
 
   std::string GetName() { return name_; }
   uid_t GetUid() { return uid_; }
@@ -64,6 +67,7 @@ class MobileIface : public StaticResource {
 
   bool ReleaseResource() override;
   bool AcquireResource() override;
+  bool ResetResource() override;
 
   uint16_t GetIfaceId() { return iface_id_; }
   std::string GetIpAddr() { return ipaddr_; }
@@ -90,6 +94,7 @@ class EthernetIface : public StaticResource {
 
   bool ReleaseResource() override;
   bool AcquireResource() override;
+  bool ResetResource() override;
 
   uint16_t GetIfaceId() { return iface_id_; }
 
@@ -23,7 +23,9 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <cstdlib>
 #include <iomanip>
@@ -32,6 +34,7 @@
 #include <sstream>
 #include <string>
 
+#include "common/libs/fs/epoll.h"
 #include "common/libs/fs/shared_fd.h"
 #include "host/libs/allocd/alloc_utils.h"
 #include "host/libs/allocd/request.h"
@@ -44,11 +47,34 @@ namespace cuttlefish {
 
 uid_t GetUserIDFromSock(SharedFD client_socket);
 
+namespace {
+
+std::string InterfaceName(const std::string& user_name,
+                          const std::string& iface_ty_name, uint32_t id) {
+  std::stringstream ss;
+  ss << "cvd-" << iface_ty_name << "-" << user_name.substr(0, 4)
+     << std::setfill('0') << std::setw(2) << (id % kMaxIfaceNameId);
+  return ss.str();
+}
+
+}  // namespace
+
 ResourceManager::~ResourceManager() {
+  if (background_thread_.joinable()) {
+    // finish the pending teardowns first
+    background_tasks_.Push(std::function<void()>());
+    background_thread_.join();
+  }
+
   bool success = true;
   for (auto& res : managed_sessions_) {
     success &= res.second->ReleaseAllResources();
   }
+  for (auto& pool : warm_pool_) {
+    for (auto& res : pool.second) {
+      success &= res->ReleaseResource();
+    }
+  }
 
   Json::Value resp;
   resp["request_type"] = "shutdown";
@@ -67,6 +93,23 @@ void ResourceManager::SetUseEbtablesLegacy(bool use_legacy) {
   use_ebtables_legacy_ = use_legacy;
 }
 
+void ResourceManager::SetWarmPoolSize(std::size_t size) {
+  warm_pool_size_ = size;
+}
+
+void ResourceManager::WarmUp(uid_t uid) {
+  auto user_opt = GetUserName(uid);
+  if (!user_opt) {
+    LOG(WARNING) << "UserName could not be matched to UID: " << uid;
+    return;
+  }
+  for (auto ty : {IfaceType::mtap, IfaceType::wtap, IfaceType::etap}) {
+    background_tasks_.Push([this, user_name = user_opt.value(), uid, ty]() {
+      FillWarmPool(user_name, uid, ty);
+    });
+  }
+}
+
 uint32_t ResourceManager::AllocateResourceID() {
   return global_resource_id_.fetch_add(1, std::memory_order_relaxed);
 }
@@ -77,10 +120,55 @@ uint32_t ResourceManager::AllocateSessionID() {
 
 bool ResourceManager::AddInterface(const std::string& iface, IfaceType ty,
                                    uint32_t resource_id, uid_t uid) {
+  switch (ty) {
+    case IfaceType::mtap:
+    case IfaceType::wtap:
+    case IfaceType::etap: {
+      auto res = AcquireTap(iface, ty, resource_id, uid);
+      if (res) {
+        pending_add_.insert({resource_id, res});
+      }
+      LOG(INFO) << "Finish CreateInterface Request";
+      return res != nullptr;
+    }
+    default:
+      break;
+  }
+
+  bool allocatedIface = false;
+
+  bool didInsert = false;
+  {
+    std::lock_guard<std::mutex> lock(interfaces_mutex_);
+    didInsert = active_interfaces_.emplace(iface, ty).second;
+  }
+  if (didInsert) {
+    allocatedIface = CreateBridge(iface);
+  } else {
+    LOG(WARNING) << "Interface already in use: " << iface;
+  }
+
+  if (didInsert && !allocatedIface) {
+    LOG(WARNING) << "Failed to allocate interface: " << iface;
+    std::lock_guard<std::mutex> lock(interfaces_mutex_);
+    active_interfaces_.erase(iface);
+  }
+
+  LOG(INFO) << "Finish CreateInterface Request";
+
+  return allocatedIface;
+}
+
+std::shared_ptr<StaticResource> ResourceManager::AcquireTap(
+    const std::string& iface, IfaceType ty, uint32_t resource_id, uid_t uid) {
   bool allocatedIface = false;
   std::shared_ptr<StaticResource> res = nullptr;
 
-  bool didInsert = active_interfaces_.insert(iface).second;
+  bool didInsert = false;
+  {
+    std::lock_guard<std::mutex> lock(interfaces_mutex_);
+    didInsert = active_interfaces_.emplace(iface, ty).second;
+  }
   if (didInsert) {
     const char* idp = iface.c_str() + (iface.size() - 3);
     int small_id = atoi(idp);
@@ -89,7 +177,6 @@ bool ResourceManager::AddInterface(const std::string& iface, IfaceType ty,
         res = std::make_shared<MobileIface>(iface, uid, small_id, resource_id,
                                             kMobileIp);
         allocatedIface = res->AcquireResource();
-        pending_add_.insert({resource_id, res});
         break;
       case IfaceType::wtap: {
         // TODO (paulkirth): change this to cvd-wbr, to test w/ today's
@@ -104,7 +191,6 @@ bool ResourceManager::AddInterface(const std::string& iface, IfaceType ty,
         w->SetHasIpv6(use_ipv6_bridge_);
         res = w;
         allocatedIface = res->AcquireResource();
-        pending_add_.insert({resource_id, res});
         break;
       }
       case IfaceType::etap: {
@@ -116,14 +202,9 @@ bool ResourceManager::AddInterface(const std::string& iface, IfaceType ty,
         w->SetHasIpv6(use_ipv6_bridge_);
         res = w;
         allocatedIface = res->AcquireResource();
-        pending_add_.insert({resource_id, res});
         break;
       }
-      case IfaceType::wbr:
-      case IfaceType::ebr:
-        allocatedIface = CreateBridge(iface);
-        break;
-      case IfaceType::Invalid:
+      default:
         break;
     }
   } else {
@@ -132,19 +213,89 @@ bool ResourceManager::AddInterface(const std::string& iface, IfaceType ty,
 
   if (didInsert && !allocatedIface) {
     LOG(WARNING) << "Failed to allocate interface: " << iface;
+    if (res) {
+      res->ReleaseResource();
+    }
+    std::lock_guard<std::mutex> lock(interfaces_mutex_);
     active_interfaces_.erase(iface);
-    auto it = pending_add_.find(resource_id);
-    it->second->ReleaseResource();
-    pending_add_.erase(it);
   }
 
-  LOG(INFO) << "Finish CreateInterface Request";
+  return allocatedIface ? res : nullptr;
+}
 
-  return allocatedIface;
+std::shared_ptr<StaticResource> ResourceManager::ClaimWarmTap(uid_t uid,
+                                                              IfaceType ty) {
+  std::lock_guard<std::mutex> lock(warm_pool_mutex_);
+  auto it = warm_pool_.find({uid, ty});
+  if (it == warm_pool_.end() || it->second.empty()) {
+    return nullptr;
+  }
+  auto res = std::move(it->second.back());
+  it->second.pop_back();
+  return res;
+}
+
+bool ResourceManager::RecycleTap(const std::shared_ptr<StaticResource>& res) {
+  IfaceType ty = IfaceType::Invalid;
+  {
+    std::lock_guard<std::mutex> lock(interfaces_mutex_);
+    auto it = active_interfaces_.find(res->GetName());
+    if (it != active_interfaces_.end()) {
+      ty = it->second;
+    }
+  }
+  if (ty != IfaceType::mtap && ty != IfaceType::wtap &&
+      ty != IfaceType::etap) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(warm_pool_mutex_);
+    if (warm_pool_[{res->GetUid(), ty}].size() >= warm_pool_size_) {
+      return false;
+    }
+  }
+  // the pool is only filled from this thread, so it still has room
+  if (!res->ResetResource()) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(warm_pool_mutex_);
+  warm_pool_[{res->GetUid(), ty}].push_back(res);
+  LOG(INFO) << "Returned interface to the warm pool: " << res->GetName();
+  return true;
+}
+
+void ResourceManager::FillWarmPool(const std::string& user_name, uid_t uid,
+                                   IfaceType ty) {
+  auto iface_ty_name = IfaceTyToStr(ty);
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lock(warm_pool_mutex_);
+      if (warm_pool_[{uid, ty}].size() >= warm_pool_size_) {
+        return;
+      }
+    }
+    std::shared_ptr<StaticResource> res = nullptr;
+    for (auto attempts = kMaxIfaceNameId; !res && attempts > 0; --attempts) {
+      auto id = AllocateResourceID();
+      res = AcquireTap(InterfaceName(user_name, iface_ty_name, id), ty, id,
+                       uid);
+    }
+    if (!res) {
+      LOG(WARNING) << "Failed to fill the warm pool with " << iface_ty_name
+                   << " interfaces";
+      return;
+    }
+    std::lock_guard<std::mutex> lock(warm_pool_mutex_);
+    warm_pool_[{uid, ty}].push_back(res);
+  }
 }
 
 bool ResourceManager::RemoveInterface(const std::string& iface, IfaceType ty) {
-  bool isManagedIface = active_interfaces_.erase(iface) > 0;
+  bool isManagedIface = false;
+  {
+    std::lock_guard<std::mutex> lock(interfaces_mutex_);
+    isManagedIface = active_interfaces_.erase(iface) > 0;
+  }
   bool removedIface = false;
   if (isManagedIface) {
     switch (ty) {
@@ -225,140 +376,257 @@ bool ResourceManager::ValidateRequest(const Json::Value& request) {
   return true;
 }
 
-void ResourceManager::JsonServer() {
-  LOG(INFO) << "Starting server on " << kDefaultLocation;
-  auto server = SharedFD::SocketLocalServer(kDefaultLocation, false,
-                                            SOCK_STREAM, kSocketMode);
-  CHECK(server->IsOpen()) << "Could not start server at " << kDefaultLocation;
-  LOG(INFO) << "Accepting client connections";
-
-  while (true) {
-    auto client_socket = SharedFD::Accept(*server);
-    CHECK(client_socket->IsOpen()) << "Error creating client socket";
+Json::Value ResourceManager::HandleConfigRequest(SharedFD client_socket,
+                                                 const Json::Value& req) {
+  Json::Value req_list = req["config_request"]["request_list"];
+
+  Json::Value config_response;
+  Json::Value response_list;
+  Json::ArrayIndex req_list_size = req_list.size();
+
+  // sentinel value, so we can populate the list of responses correctly
+  // without trying to satisfy requests that will be aborted
+  bool transaction_failed = false;
+
+  for (Json::ArrayIndex i = 0; i < req_list_size; ++i) {
+    LOG(INFO) << "Processing Request: " << i;
+    auto req = req_list[i];
+    auto req_ty_str = req["request_type"].asString();
+    auto req_ty = StrToReqTy(req_ty_str);
+
+    Json::Value response;
+    if (transaction_failed) {
+      response["request_type"] = req_ty_str;
+      response["request_status"] = "pending";
+      response["error"] = "";
+      response_list.append(response);
+      continue;
+    }
 
-    struct timeval timeout;
-    timeout.tv_sec = 10;
-    timeout.tv_usec = 0;
+    switch (req_ty) {
+      case RequestType::ID: {
+        response = JsonHandleIdRequest();
+        break;
+      }
+      case RequestType::Shutdown: {
+        if (i != 0 || req_list_size != 1) {
+          response["request_type"] = req_ty_str;
+          response["request_status"] = "failed";
+          response["error"] =
+              "Shutdown requests cannot be processed with other "
+              "configuration requests";
+          response_list.append(response);
+          break;
+        } else {
+          // the response is sent once the resources are released
+          return JsonHandleShutdownRequest(client_socket);
+        }
+      }
+      case RequestType::CreateInterface: {
+        response = JsonHandleCreateInterfaceRequest(client_socket, req);
+        break;
+      }
+      case RequestType::DestroyInterface: {
+        response = JsonHandleDestroyInterfaceRequest(req);
+        break;
+      }
+      case RequestType::StopSession: {
+        response = JsonHandleStopSessionRequest(
+            req, GetUserIDFromSock(client_socket));
+        break;
+      }
+      case RequestType::CreateInstances: {
+        response = JsonHandleCreateInstancesRequest(client_socket, req);
+        break;
+      }
+      case RequestType::Invalid: {
+        LOG(WARNING) << "Invalid Request Type: " << req["request_type"];
+        break;
+      }
+    }
 
-    int err = client_socket->SetSockOpt(SOL_SOCKET, SO_RCVTIMEO, &timeout,
-                                        sizeof(timeout));
-    if (err < 0) {
-      LOG(WARNING) << "Could not set socket timeout";
+    response_list.append(response);
+    if (!(response["request_status"].asString() ==
+          StatusToStr(RequestStatus::Success))) {
+      LOG(INFO) << "Request failed:" << req;
+      transaction_failed = true;
       continue;
     }
+  }
 
-    auto req_opt = RecvJsonMsg(client_socket);
+  config_response["response_list"] = response_list;
 
-    if (!req_opt) {
-      LOG(WARNING) << "Invalid JSON Request, closing connection";
-      continue;
+  auto status =
+      transaction_failed ? RequestStatus::Failure : RequestStatus::Success;
+  config_response["config_status"] = StatusToStr(status);
+
+  if (!transaction_failed) {
+    auto session_id = AllocateSessionID();
+    config_response["session_id"] = session_id;
+    auto s = std::make_shared<Session>(session_id,
+                                       GetUserIDFromSock(client_socket));
+
+    // commit the resources
+    s->Insert(pending_add_);
+    managed_sessions_.insert({session_id, s});
+  } else {
+    // be sure to release anything we've acquired if the transaction failed
+    std::vector<std::shared_ptr<StaticResource>> dropped_resources;
+    for (auto& dropped_resource : pending_add_) {
+      dropped_resources.push_back(dropped_resource.second);
     }
+    ScheduleRelease(std::move(dropped_resources));
+  }
+  pending_add_.clear();
 
-    Json::Value req = req_opt.value();
+  return config_response;
+}
 
-    if (!ValidateConfigRequest(req)) {
-      continue;
+void ResourceManager::ScheduleRelease(
+    std::vector<std::shared_ptr<StaticResource>> resources) {
+  if (resources.empty()) {
+    return;
+  }
+  background_tasks_.Push([this, resources = std::move(resources)]() {
+    for (auto& res : resources) {
+      if (RecycleTap(res)) {
+        continue;
+      }
+      if (!res->ReleaseResource()) {
+        LOG(WARNING) << "Failed to release resource: " << res->GetName();
+      }
+      // release the name for reuse in future requests
+      std::lock_guard<std::mutex> lock(interfaces_mutex_);
+      active_interfaces_.erase(res->GetName());
+    }
+  });
+}
+
+void ResourceManager::BackgroundLoop() {
+  while (true) {
+    auto task = background_tasks_.Pop();
+    if (!task) {
+      return;
     }
+    task();
+  }
+}
+
+namespace {
 
-    Json::Value req_list = req["config_request"]["request_list"];
+// A client connection whose request hasn't been fully received yet.
+struct ClientConnection {
+  std::string buffer;
+  std::chrono::steady_clock::time_point deadline;
+};
 
-    Json::Value config_response;
-    Json::Value response_list;
-    Json::ArrayIndex req_list_size = req_list.size();
+constexpr auto kClientTimeout = std::chrono::seconds(10);
 
-    // sentinel value, so we can populate the list of responses correctly
-    // without trying to satisfy requests that will be aborted
-    bool transaction_failed = false;
+}  // namespace
+
+void ResourceManager::JsonServer() {
+  LOG(INFO) << "Starting server on " << kDefaultLocation;
+  auto server = SharedFD::SocketLocalServer(kDefaultLocation, false,
+                                            SOCK_STREAM, kSocketMode);
+  CHECK(server->IsOpen()) << "Could not start server at " << kDefaultLocation;
+  auto epoll = Epoll::Create();
+  CHECK(epoll.ok()) << "Failed to create epoll: " << epoll.error();
+  auto added = epoll->Add(server, EPOLLIN);
+  CHECK(added.ok()) << "Failed to watch the server socket: " << added.error();
+  background_thread_ = std::thread([this]() { BackgroundLoop(); });
+  LOG(INFO) << "Accepting client connections";
 
-    for (Json::ArrayIndex i = 0; i < req_list_size; ++i) {
-      LOG(INFO) << "Processing Request: " << i;
-      auto req = req_list[i];
-      auto req_ty_str = req["request_type"].asString();
-      auto req_ty = StrToReqTy(req_ty_str);
+  std::map<SharedFD, ClientConnection> clients;
+  auto close_client = [&epoll, &clients](SharedFD client_socket) {
+    auto removed = epoll->Delete(client_socket);
+    if (!removed.ok()) {
+      LOG(WARNING) << "Failed to stop watching client: " << removed.error();
+    }
+    clients.erase(client_socket);
+    client_socket->Close();
+  };
 
-      Json::Value response;
-      if (transaction_failed) {
-        response["request_type"] = req_ty_str;
-        response["request_status"] = "pending";
-        response["error"] = "";
-        response_list.append(response);
+  while (true) {
+    const auto now = std::chrono::steady_clock::now();
+    auto timeout = std::chrono::milliseconds(-1);
+    for (auto it = clients.begin(); it != clients.end();) {
+      auto& [client_socket, client] = *it++;
+      if (client.deadline <= now) {
+        LOG(WARNING) << "Timed out receiving a request, closing connection";
+        close_client(client_socket);
         continue;
       }
-
-      switch (req_ty) {
-        case RequestType::ID: {
-          response = JsonHandleIdRequest();
-          break;
-        }
-        case RequestType::Shutdown: {
-          if (i != 0 || req_list_size != 1) {
-            response["request_type"] = req_ty_str;
-            response["request_status"] = "failed";
-            response["error"] =
-                "Shutdown requests cannot be processed with other "
-                "configuration requests";
-            response_list.append(response);
-            break;
-          } else {
-            response = JsonHandleShutdownRequest(client_socket);
-            response_list.append(response);
-            return;
-          }
-        }
-        case RequestType::CreateInterface: {
-          response = JsonHandleCreateInterfaceRequest(client_socket, req);
-          break;
-        }
-        case RequestType::DestroyInterface: {
-          response = JsonHandleDestroyInterfaceRequest(req);
-          break;
-        }
-        case RequestType::StopSession: {
-          response = JsonHandleStopSessionRequest(
-              req, GetUserIDFromSock(client_socket));
-          break;
-        }
-        case RequestType::Invalid: {
-          LOG(WARNING) << "Invalid Request Type: " << req["request_type"];
-          break;
-        }
+      auto left = std::chrono::ceil<std::chrono::milliseconds>(
+          client.deadline - now);
+      if (timeout.count() < 0 || left < timeout) {
+        timeout = left;
       }
+    }
 
-      response_list.append(response);
-      if (!(response["request_status"].asString() ==
-            StatusToStr(RequestStatus::Success))) {
-        LOG(INFO) << "Request failed:" << req;
-        transaction_failed = true;
+    auto event = epoll->Wait(timeout.count());
+    CHECK(event.ok()) << "Failed to wait for clients: " << event.error();
+    if (!*event) {
+      continue;
+    }
+    auto socket = (*event)->fd;
+    if (socket == server) {
+      auto client_socket = SharedFD::Accept(*server);
+      CHECK(client_socket->IsOpen()) << "Error creating client socket";
+      auto watched = epoll->Add(client_socket, EPOLLIN);
+      if (!watched.ok()) {
+        LOG(WARNING) << "Failed to watch client: " << watched.error();
         continue;
       }
+      clients[client_socket].deadline =
+          std::chrono::steady_clock::now() + kClientTimeout;
+      continue;
     }
 
-    config_response["response_list"] = response_list;
+    auto it = clients.find(socket);
+    if (it == clients.end()) {
+      continue;
+    }
+    auto& client = it->second;
+    char buf[4096];
+    auto bytes_read = socket->Recv(buf, sizeof(buf), MSG_DONTWAIT);
+    if (bytes_read < 0 && (socket->GetErrno() == EAGAIN ||
+                           socket->GetErrno() == EWOULDBLOCK)) {
+      continue;
+    }
+    if (bytes_read <= 0) {
+      LOG(WARNING) << "Client closed the connection before sending a request";
+      close_client(socket);
+      continue;
+    }
+    client.buffer.append(buf, bytes_read);
+    auto msg_size = JsonMsgSize(client.buffer);
+    if (msg_size && (*msg_size == 0 || client.buffer.size() < *msg_size)) {
+      continue;
+    }
 
-    auto status =
-        transaction_failed ? RequestStatus::Failure : RequestStatus::Success;
-    config_response["config_status"] = StatusToStr(status);
+    auto req_opt = msg_size ? ParseJsonMsg(client.buffer) : std::nullopt;
+    if (!req_opt) {
+      LOG(WARNING) << "Invalid JSON Request, closing connection";
+      close_client(socket);
+      continue;
+    }
 
-    if (!transaction_failed) {
-      auto session_id = AllocateSessionID();
-      config_response["session_id"] = session_id;
-      auto s = std::make_shared<Session>(session_id,
-                                         GetUserIDFromSock(client_socket));
+    Json::Value req = req_opt.value();
 
-      // commit the resources
-      s->Insert(pending_add_);
-      pending_add_.clear();
-      managed_sessions_.insert({session_id, s});
-    } else {
-      // be sure to release anything we've acquired if the transaction failed
-      for (auto& droped_resource : pending_add_) {
-        droped_resource.second->ReleaseResource();
-      }
+    if (!ValidateConfigRequest(req)) {
+      close_client(socket);
+      continue;
+    }
+
+    auto config_response = HandleConfigRequest(socket, req);
+    if (shutdown_socket_->IsOpen()) {
+      // the destructor responds once everything was released
+      break;
     }
 
-    SendJsonMsg(client_socket, config_response);
+    SendJsonMsg(socket, config_response);
     LOG(INFO) << "Closing connection to client";
-    client_socket->Close();
+    close_client(socket);
   }
   server->Close();
 }
@@ -447,37 +715,156 @@ Json::Value ResourceManager::JsonHandleCreateInterfaceRequest(
 
   auto user_opt = GetUserName(uid);
 
-  bool addedIface = false;
-  std::stringstream ss;
   if (!user_opt) {
     auto err_msg = "UserName could not be matched to UID";
     LOG(WARNING) << err_msg;
     resp["error"] = err_msg;
     return resp;
-  } else {
-    auto iface_ty_name = request["iface_type"].asString();
-    resp["iface_type"] = iface_ty_name;
-    auto iface_type = StrToIfaceTy(iface_ty_name);
-    auto attempts = kMaxIfaceNameId;
-    do {
-      auto id = AllocateResourceID();
-      resp["resource_id"] = id;
-      ss << "cvd-" << iface_ty_name << "-" << user_opt.value().substr(0, 4)
-         << std::setfill('0') << std::setw(2) << (id % kMaxIfaceNameId);
-      addedIface = AddInterface(ss.str(), iface_type, id, uid);
-      --attempts;
-    } while (!addedIface && (attempts > 0));
   }
 
-  if (addedIface) {
+  auto iface_ty_name = request["iface_type"].asString();
+  resp["iface_type"] = iface_ty_name;
+  uint32_t resource_id = 0;
+  auto iface_name =
+      CreateInterface(user_opt.value(), iface_ty_name, uid, &resource_id);
+  resp["resource_id"] = resource_id;
+
+  if (iface_name) {
     resp["request_status"] = StatusToStr(RequestStatus::Success);
-    resp["iface_name"] = ss.str();
+    resp["iface_name"] = iface_name.value();
     resp["error"] = "";
   }
 
   return resp;
 }
 
+std::optional<std::string> ResourceManager::CreateInterface(
+    const std::string& user_name, const std::string& iface_ty_name, uid_t uid,
+    uint32_t* resource_id) {
+  auto iface_type = StrToIfaceTy(iface_ty_name);
+  if (warm_pool_size_ > 0 &&
+      (iface_type == IfaceType::mtap || iface_type == IfaceType::wtap ||
+       iface_type == IfaceType::etap)) {
+    // top the pool up for the next instance, whether it had a tap or not
+    background_tasks_.Push([this, user_name, uid, iface_type]() {
+      FillWarmPool(user_name, uid, iface_type);
+    });
+    auto res = ClaimWarmTap(uid, iface_type);
+    if (res) {
+      LOG(INFO) << "Claimed interface from the warm pool: " << res->GetName();
+      *resource_id = res->GetGlobalID();
+      pending_add_.insert({*resource_id, res});
+      return res->GetName();
+    }
+  }
+
+  auto attempts = kMaxIfaceNameId;
+  do {
+    auto id = AllocateResourceID();
+    *resource_id = id;
+    auto iface_name = InterfaceName(user_name, iface_ty_name, id);
+    if (AddInterface(iface_name, iface_type, id, uid)) {
+      return iface_name;
+    }
+    --attempts;
+  } while (attempts > 0);
+  return std::nullopt;
+}
+
+Json::Value ResourceManager::JsonHandleCreateInstancesRequest(
+    SharedFD client_socket, const Json::Value& request) {
+  LOG(INFO) << "Received CreateInstances Request";
+
+  Json::Value resp;
+  resp["request_type"] = ReqTyToStr(RequestType::CreateInstances);
+  resp["request_status"] = StatusToStr(RequestStatus::Failure);
+  resp["error"] = "unknown";
+
+  if (!request.isMember("uid") || !request["uid"].isUInt()) {
+    auto err_msg = "Input event doesn't have a valid 'uid' field";
+    LOG(WARNING) << err_msg;
+    resp["error"] = err_msg;
+    return resp;
+  }
+
+  if (!request.isMember("count") || !request["count"].isUInt() ||
+      request["count"].asUInt() == 0 ||
+      request["count"].asUInt() > kMaxIfaceNameId) {
+    auto err_msg = "Input event doesn't have a valid 'count' field";
+    LOG(WARNING) << err_msg;
+    resp["error"] = err_msg;
+    return resp;
+  }
+
+  // Bridges are shared between instances, only taps can be requested here.
+  auto is_tap = [](const Json::Value& type) {
+    if (!type.isString()) {
+      return false;
+    }
+    auto iface_type = StrToIfaceTy(type.asString());
+    return iface_type == IfaceType::mtap || iface_type == IfaceType::wtap ||
+           iface_type == IfaceType::etap;
+  };
+  const auto& iface_types = request["iface_types"];
+  if (!iface_types.isArray() ||
+      !std::all_of(iface_types.begin(), iface_types.end(), is_tap)) {
+    auto err_msg = "Input event doesn't have a valid 'iface_types' field";
+    LOG(WARNING) << err_msg;
+    resp["error"] = err_msg;
+    return resp;
+  }
+
+  auto uid = request["uid"].asUInt();
+
+  if (!CheckCredentials(client_socket, uid)) {
+    auto err_msg = "Credential check failed";
+    LOG(WARNING) << err_msg;
+    resp["error"] = err_msg;
+    return resp;
+  }
+
+  auto user_opt = GetUserName(uid);
+  if (!user_opt) {
+    auto err_msg = "UserName could not be matched to UID";
+    LOG(WARNING) << err_msg;
+    resp["error"] = err_msg;
+    return resp;
+  }
+
+  // The created interfaces are pending until the whole transaction succeeds,
+  // so a failure here releases all of them.
+  Json::Value instances(Json::arrayValue);
+  for (uint32_t i = 0; i < request["count"].asUInt(); i++) {
+    Json::Value instance;
+    instance["id"] = AllocateSessionID();
+    Json::Value interfaces(Json::arrayValue);
+    for (const auto& iface_type : iface_types) {
+      auto iface_ty_name = iface_type.asString();
+      uint32_t resource_id = 0;
+      auto iface_name =
+          CreateInterface(user_opt.value(), iface_ty_name, uid, &resource_id);
+      if (!iface_name) {
+        auto err_msg = "Failed to create a " + iface_ty_name + " interface";
+        LOG(WARNING) << err_msg;
+        resp["error"] = err_msg;
+        return resp;
+      }
+      Json::Value iface;
+      iface["iface_type"] = iface_ty_name;
+      iface["iface_name"] = iface_name.value();
+      iface["resource_id"] = resource_id;
+      interfaces.append(iface);
+    }
+    instance["interfaces"] = interfaces;
+    instances.append(instance);
+  }
+
+  resp["instances"] = instances;
+  resp["request_status"] = StatusToStr(RequestStatus::Success);
+  resp["error"] = "";
+  return resp;
+}
+
 Json::Value ResourceManager::JsonHandleDestroyInterfaceRequest(
     const Json::Value& request) {
   Json::Value resp;
@@ -492,7 +879,11 @@ Json::Value ResourceManager::JsonHandleDestroyInterfaceRequest(
 
   auto iface_name = request["iface_name"].asString();
 
-  bool isManagedIface = active_interfaces_.erase(iface_name) > 0;
+  bool isManagedIface = false;
+  {
+    std::lock_guard<std::mutex> lock(interfaces_mutex_);
+    isManagedIface = active_interfaces_.count(iface_name) > 0;
+  }
 
   if (!isManagedIface) {
     auto msg = "Interface not managed: " + iface_name;
@@ -535,9 +926,18 @@ Json::Value ResourceManager::JsonHandleDestroyInterfaceRequest(
   // resource and then can signal to the rest of the transaction the failure
   // state, which can then just stop the transaction, and revert any newly
   // acquired resources, but any successful drop requests will persist
-  auto did_drop_resource = s->ReleaseResource(resource_id);
+  //
+  // The interface is torn down after the response was sent, its name is only
+  // available again after that.
+  auto resource = s->TakeResource(resource_id);
+  auto did_drop_resource = resource && resource->GetName() == iface_name;
+  if (resource && !did_drop_resource) {
+    // wrong name, put it back
+    s->Insert({{resource_id, resource}});
+  }
 
   if (did_drop_resource) {
+    ScheduleRelease({resource});
     resp["request_status"] = StatusToStr(RequestStatus::Success);
   } else {
     auto msg = "Interface " + iface_name +
@@ -587,21 +987,12 @@ Json::Value ResourceManager::JsonHandleStopSessionRequest(
   // method for aborting the transaction. Instead, we try to release the
   // resource and then can signal to the rest of the transaction the failure
   // state
-  auto success = it->second->ReleaseAllResources();
-
-  // release the names from the global list for reuse in future requests
-  for (auto& iface : it->second->GetActiveInterfaces()) {
-    active_interfaces_.erase(iface);
-  }
-
-  if (success) {
-    managed_sessions_.erase(it);
-    resp["request_status"] = StatusToStr(RequestStatus::Success);
-  } else {
-    resp["error"] =
-        "unknown, allocd experienced an error ending the session id: " +
-        std::to_string(session_id);
-  }
+  //
+  // Releasing is done by the teardown thread, which also returns the names
+  // to the global list for reuse in future requests.
+  ScheduleRelease(it->second->TakeAllResources());
+  managed_sessions_.erase(it);
+  resp["request_status"] = StatusToStr(RequestStatus::Success);
 
   return resp;
 }
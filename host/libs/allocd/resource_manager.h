@@ -19,12 +19,20 @@
 #include <sys/types.h>
 
 #include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
+#include "common/libs/concurrency/thread_safe_queue.h"
 #include "common/libs/fs/shared_fd.h"
 #include "host/libs/allocd/alloc_utils.h"
 #include "host/libs/allocd/request.h"
@@ -75,6 +83,27 @@ class Session {
     return success;
   }
 
+  // Removes the resources from the session without releasing them, that is
+  // left to the caller.
+  std::vector<std::shared_ptr<StaticResource>> TakeAllResources() {
+    std::vector<std::shared_ptr<StaticResource>> resources;
+    for (auto& res : managed_resources_) {
+      resources.push_back(std::move(res.second));
+    }
+    managed_resources_.clear();
+    return resources;
+  }
+
+  std::shared_ptr<StaticResource> TakeResource(uint32_t resource_id) {
+    auto it = managed_resources_.find(resource_id);
+    if (it == managed_resources_.end()) {
+      return nullptr;
+    }
+    auto res = std::move(it->second);
+    managed_resources_.erase(it);
+    return res;
+  }
+
  private:
   uint32_t session_id_{};
   uid_t uid_{};
@@ -91,6 +120,15 @@ class Session {
  *
  * Clients can request new resources by connecting to a socket, and sending a
  * JSON request, detailing the type of resource required.
+ *
+ * Connections are multiplexed with epoll, so a slow client doesn't hold up
+ * the others while its request is being received. Released resources are torn
+ * down on a separate thread after the response was sent, their interface
+ * names only become available again once that's done.
+ *
+ * Released taps are kept in a warm pool per user and type instead, up to the
+ * pool size, so the next instance of the user claims them without creating
+ * anything. Claims refill the pool in the background.
  */
 struct ResourceManager {
  public:
@@ -102,6 +140,12 @@ struct ResourceManager {
 
   void SetUseEbtablesLegacy(bool use_legacy);
 
+  // Number of taps of each type kept ready for each user, 0 disables the pool
+  void SetWarmPoolSize(std::size_t size);
+
+  // Creates the pool of the user in the background
+  void WarmUp(uid_t uid);
+
   void JsonServer();
 
  private:
@@ -113,6 +157,34 @@ struct ResourceManager {
 
   bool RemoveInterface(const std::string& iface, IfaceType ty);
 
+  // Reserves the name and creates a tap, returns nullptr on failure.
+  std::shared_ptr<StaticResource> AcquireTap(const std::string& iface,
+                                             IfaceType ty, uint32_t id,
+                                             uid_t uid);
+
+  // Takes a tap of the type from the user's warm pool if there is one.
+  std::shared_ptr<StaticResource> ClaimWarmTap(uid_t uid, IfaceType ty);
+
+  // Keeps a released tap in the warm pool, false if it must be destroyed.
+  bool RecycleTap(const std::shared_ptr<StaticResource>& res);
+
+  // Creates taps until the user's pool for the type is full.
+  void FillWarmPool(const std::string& user_name, uid_t uid, IfaceType ty);
+
+  // Creates an interface of the given type with the first free name for the
+  // user, returning the name and setting resource_id.
+  std::optional<std::string> CreateInterface(const std::string& user_name,
+                                             const std::string& iface_ty_name,
+                                             uid_t uid, uint32_t* resource_id);
+
+  // Processes one client connection's request list as a transaction.
+  Json::Value HandleConfigRequest(SharedFD client_socket,
+                                  const Json::Value& req);
+
+  void ScheduleRelease(std::vector<std::shared_ptr<StaticResource>> resources);
+
+  void BackgroundLoop();
+
   bool ValidateRequest(const Json::Value& request);
 
   bool ValidateRequestList(const Json::Value& config);
@@ -128,6 +200,9 @@ struct ResourceManager {
 
   Json::Value JsonHandleDestroyInterfaceRequest(const Json::Value& request);
 
+  Json::Value JsonHandleCreateInstancesRequest(SharedFD client_socket,
+                                               const Json::Value& request);
+
   Json::Value JsonHandleStopSessionRequest(const Json::Value& request,
                                            uid_t uid);
 
@@ -142,7 +217,9 @@ struct ResourceManager {
  private:
   std::atomic_uint32_t global_resource_id_ = 0;
   std::atomic_uint32_t session_id_ = 0;
-  std::set<std::string> active_interfaces_;
+  // guards active_interfaces_, which the background thread also updates
+  std::mutex interfaces_mutex_;
+  std::map<std::string, IfaceType> active_interfaces_;
   std::map<uint32_t, std::shared_ptr<Session>> managed_sessions_;
   std::map<uint32_t, std::shared_ptr<StaticResource>> pending_add_;
   std::string location = kDefaultLocation;
@@ -150,6 +227,14 @@ struct ResourceManager {
   bool use_ipv6_bridge_ = true;
   bool use_ebtables_legacy_ = false;
   cuttlefish::SharedFD shutdown_socket_;
+  std::size_t warm_pool_size_ = 0;
+  std::mutex warm_pool_mutex_;
+  std::map<std::pair<uid_t, IfaceType>,
+           std::vector<std::shared_ptr<StaticResource>>>
+      warm_pool_;
+  // teardowns and pool refills, an empty task stops the background thread
+  ThreadSafeQueue<std::function<void()>> background_tasks_;
+  std::thread background_thread_;
 };
 
 }  // namespace cuttlefish
@@ -31,6 +31,8 @@ using namespace cuttlefish;
 DEFINE_string(socket_path, kDefaultLocation, "Socket path");
 DEFINE_bool(id, false, "Request new UUID");
 DEFINE_bool(ifcreate, false, "Request a new Interface");
+DEFINE_uint32(create_instances, 0,
+              "Request the mtap and wtap interfaces of this many instances");
 DEFINE_bool(shutdown, false, "Shutdown Resource Allocation Server");
 DEFINE_bool(stop_session, false, "Remove all resources from session");
 DEFINE_string(ifdestroy, "", "Request an interface be destroyed");
@@ -97,6 +99,32 @@ int main(int argc, char* argv[]) {
     std::cout << resp["iface_name"] << std::endl;
   }
 
+  if (FLAGS_create_instances > 0) {
+    Json::Value req;
+    req["request_type"] = "create_instances";
+    req["uid"] = geteuid();
+    req["count"] = FLAGS_create_instances;
+    req["iface_types"].append("mtap");
+    req["iface_types"].append("wtap");
+    request_list.append(req);
+    config["config_request"]["request_list"] = request_list;
+
+    std::cout << config << "\n";
+    SendJsonMsg(monitor_socket, config);
+
+    auto resp_opt = RecvJsonMsg(monitor_socket);
+    if (!resp_opt.has_value()) {
+      std::cout << "Bad Response from server\n";
+      return -1;
+    }
+
+    auto resp = resp_opt.value();
+
+    std::cout << resp << "\n";
+    std::cout << "Create Instances operation: " << resp["config_status"]
+              << std::endl;
+  }
+
   if (!FLAGS_ifdestroy.empty() && (FLAGS_ifid != -1) && (FLAGS_session != -1)) {
     Json::Value req;
     req["request_type"] = "destroy_interface";
@@ -17,6 +17,7 @@
 #include "host/libs/allocd/utils.h"
 
 #include <cstdint>
+#include <cstring>
 #include <optional>
 
 #include "common/libs/fs/shared_buf.h"
@@ -44,6 +45,7 @@ const std::map<RequestType, const char*> RequestTyToStrMap = {
     {RequestType::DestroyInterface, "destroy_interface"},
     {RequestType::StopSession, "stop_session"},
     {RequestType::Shutdown, "shutdown"},
+    {RequestType::CreateInstances, "create_instances"},
     {RequestType::Invalid, "invalid"}};
 
 const std::map<std::string, RequestType> StrToRequestTyMap = {
@@ -52,6 +54,7 @@ const std::map<std::string, RequestType> StrToRequestTyMap = {
     {"destroy_interface", RequestType::DestroyInterface},
     {"stop_session", RequestType::StopSession},
     {"shutdown", RequestType::Shutdown},
+    {"create_instances", RequestType::CreateInstances},
     {"invalid", RequestType::Invalid}};
 
 const std::map<std::string, IfaceType> StrToIfaceTyMap = {
@@ -115,6 +118,24 @@ std::optional<Json::Value> RecvJsonMsg(SharedFD client_socket) {
   return reader.parse(payload);
 }
 
+std::optional<std::size_t> JsonMsgSize(const std::string& buffer) {
+  if (buffer.size() < sizeof(RequestHeader)) {
+    return 0;
+  }
+  RequestHeader header;
+  memcpy(&header, buffer.data(), sizeof(header));
+  if (header.version < kMinHeaderVersion) {
+    LOG(WARNING) << "bad request header version: " << header.version;
+    return std::nullopt;
+  }
+  return sizeof(header) + header.len;
+}
+
+std::optional<Json::Value> ParseJsonMsg(const std::string& message) {
+  JsonRequestReader reader;
+  return reader.parse(message.substr(sizeof(RequestHeader)));
+}
+
 std::string ReqTyToStr(RequestType req_ty) {
   switch (req_ty) {
     case RequestType::Invalid:
@@ -129,6 +150,8 @@ std::string ReqTyToStr(RequestType req_ty) {
       return "create_interface";
     case RequestType::ID:
       return "id";
+    case RequestType::CreateInstances:
+      return "create_instances";
   }
 }
 
@@ -19,6 +19,7 @@
 #include <android-base/logging.h>
 #include <json/json.h>
 
+#include <cstddef>
 #include <optional>
 #include <string>
 
@@ -47,6 +48,16 @@ bool SendJsonMsg(cuttlefish::SharedFD client_socket, const Json::Value& resp);
 /// or an std::nullopt if an error is reported
 std::optional<Json::Value> RecvJsonMsg(cuttlefish::SharedFD client_socket);
 
+/// Incremental counterparts of RecvJsonMsg, for sockets read without blocking
+///
+/// JsonMsgSize returns the size of the message at the front of buffer,
+/// including its header, or 0 while the header itself is incomplete. It
+/// returns std::nullopt if the header is invalid.
+std::optional<std::size_t> JsonMsgSize(const std::string& buffer);
+
+/// Parses a complete message, as sized by JsonMsgSize
+std::optional<Json::Value> ParseJsonMsg(const std::string& message);
+
 // Helper functions mapping between Enum types and std::string
 
 RequestType StrToReqTy(const std::string& req);
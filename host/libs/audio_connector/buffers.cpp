@@ -23,6 +23,7 @@ ShmBuffer::ShmBuffer(ShmBuffer&& other)
     : header_(std::move(other.header_)),
       len_(std::move(other.len_)),
       on_consumed_(std::move(other.on_consumed_)),
+      received_at_(other.received_at_),
       status_sent_(other.status_sent_) {
   // It's now this buffer's responsibility to send the status.
   other.status_sent_ = true;
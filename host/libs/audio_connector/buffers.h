@@ -14,6 +14,7 @@
 // limitations under the License.
 #pragma once
 
+#include <chrono>
 #include <cinttypes>
 #include <functional>
 
@@ -39,7 +40,10 @@ class ShmBuffer {
  public:
   ShmBuffer(const virtio_snd_pcm_xfer& header, uint32_t len,
             OnConsumedCb on_consumed)
-      : header_(header), len_(len), on_consumed_(on_consumed) {}
+      : header_(header),
+        len_(len),
+        on_consumed_(on_consumed),
+        received_at_(std::chrono::steady_clock::now()) {}
   ShmBuffer(const ShmBuffer& other) = delete;
   ShmBuffer(ShmBuffer&& other);
   ShmBuffer& operator=(const ShmBuffer& other) = delete;
@@ -48,6 +52,10 @@ class ShmBuffer {
 
   uint32_t stream_id() const;
   uint32_t len() const { return len_; }
+  // When the client's message announcing the buffer was received.
+  std::chrono::steady_clock::time_point received_at() const {
+    return received_at_;
+  }
 
   void SendStatus(AudioStatus status, uint32_t latency_bytes,
                   uint32_t consumed_len);
@@ -56,6 +64,7 @@ class ShmBuffer {
   const virtio_snd_pcm_xfer header_;
   const uint32_t len_;
   OnConsumedCb on_consumed_;
+  const std::chrono::steady_clock::time_point received_at_;
   bool status_sent_ = false;
 };
 
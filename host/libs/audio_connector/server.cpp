@@ -328,6 +328,35 @@ bool AudioClientConnection::ReceiveCapture(AudioServerExecutor& executor) {
   return true;
 }
 
+Result<void> AudioClientConnection::AddToEpoll(Epoll& epoll) {
+  for (const auto& socket : {control_socket_, tx_socket_, rx_socket_}) {
+    CF_EXPECT(epoll.Add(socket, EPOLLIN));
+  }
+  return {};
+}
+
+Result<void> AudioClientConnection::RemoveFromEpoll(Epoll& epoll) {
+  for (const auto& socket : {control_socket_, tx_socket_, rx_socket_}) {
+    CF_EXPECT(epoll.Delete(socket));
+  }
+  return {};
+}
+
+bool AudioClientConnection::HandleEvent(const EpollEvent& event,
+                                        AudioServerExecutor& executor) {
+  // Messages are received one per readiness report, so the blocking sockets
+  // never actually block. Hang ups are seen as zero length messages.
+  if (event.fd == control_socket_) {
+    return ReceiveCommands(executor);
+  } else if (event.fd == tx_socket_) {
+    return ReceivePlayback(executor);
+  } else if (event.fd == rx_socket_) {
+    return ReceiveCapture(executor);
+  }
+  LOG(ERROR) << "Event for a socket not owned by the audio connection";
+  return false;
+}
+
 bool AudioClientConnection::CmdReply(AudioStatus status, const void* data,
                                      size_t size) {
   virtio_snd_hdr vio_status = {
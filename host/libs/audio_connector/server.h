@@ -19,7 +19,9 @@
 #include <functional>
 #include <memory>
 
+#include "common/libs/fs/epoll.h"
 #include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
 #include "host/libs/audio_connector/buffers.h"
 #include "host/libs/audio_connector/commands.h"
 #include "host/libs/audio_connector/shm_layout.h"
@@ -35,6 +37,8 @@ class AudioServerExecutor {
 
   // Implementations must ensure each command is replied to before returning
   // from these functions. Failure to do so causes the program to abort.
+  // When driven through HandleEvent all calls are made from the thread
+  // waiting on the epoll, so they must not block.
   virtual void StreamsInfo(StreamInfoCommand& cmd) = 0;
   virtual void SetStreamParameters(StreamSetParamsCommand& cmd) = 0;
   virtual void PrepareStream(StreamControlCommand& cmd) = 0;
@@ -68,6 +72,14 @@ class AudioClientConnection {
   bool ReceivePlayback(AudioServerExecutor& executor);
   bool ReceiveCapture(AudioServerExecutor& executor);
 
+  // Lets a single thread wait on the connection's sockets, possibly along
+  // with other fds, instead of blocking one thread on each of them.
+  Result<void> AddToEpoll(Epoll& epoll);
+  Result<void> RemoveFromEpoll(Epoll& epoll);
+  // Handles the message the event reported ready to be received. Returns
+  // false when the client is gone, or the event isn't for this connection.
+  bool HandleEvent(const EpollEvent& event, AudioServerExecutor& executor);
+
   bool SendEvent(/*TODO*/);
 
  private:
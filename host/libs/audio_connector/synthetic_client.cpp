@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/audio_connector/synthetic_client.h"
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <utility>
+
+#include "common/libs/utils/unix_sockets.h"
+
+namespace cuttlefish {
+namespace {
+
+// The order the server sends the file descriptors in with the welcome message
+enum WelcomeFd {
+  kEventSocket = 0,
+  kTxSocket,
+  kRxSocket,
+  kTxShm,
+  kRxShm,
+  kWelcomeFdCount,
+};
+
+Result<ScopedMMap> MapShm(SharedFD shm_fd, const char* name) {
+  auto len = shm_fd->LSeek(0, SEEK_END);
+  CF_EXPECT(len > 0, "Failed to get the size of the " << name << " memory: "
+                                                      << shm_fd->StrError());
+  auto shm = shm_fd->MMap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, 0);
+  CF_EXPECT(static_cast<bool>(shm), "Failed to map the "
+                                        << name
+                                        << " memory: " << shm_fd->StrError());
+  return shm;
+}
+
+}  // namespace
+
+Result<std::unique_ptr<SyntheticAudioClient>> SyntheticAudioClient::Connect(
+    const std::string& path) {
+  auto socket = SharedFD::SocketLocalClient(path, false, SOCK_SEQPACKET);
+  CF_EXPECT(socket->IsOpen(), "Failed to connect to the audio server at \""
+                                  << path << "\": " << socket->StrError());
+  return CF_EXPECT(FromSocket(socket));
+}
+
+Result<std::unique_ptr<SyntheticAudioClient>> SyntheticAudioClient::FromSocket(
+    SharedFD socket) {
+  auto welcome = CF_EXPECT(UnixMessageSocket(socket).ReadMessage(),
+                           "Failed to receive the audio server's welcome");
+  VioSConfig config;
+  CF_EXPECT(welcome.data.size() == sizeof(config),
+            "Unexpected welcome message size: " << welcome.data.size());
+  std::memcpy(&config, welcome.data.data(), sizeof(config));
+  CF_EXPECT(config.version == VIOS_VERSION,
+            "Unsupported protocol version: " << config.version);
+  auto fds = CF_EXPECT(welcome.FileDescriptors());
+  CF_EXPECT(fds.size() == kWelcomeFdCount,
+            "Expected " << kWelcomeFdCount << " file descriptors, received "
+                        << fds.size());
+  auto tx_shm = CF_EXPECT(MapShm(fds[kTxShm], "tx"));
+  auto rx_shm = CF_EXPECT(MapShm(fds[kRxShm], "rx"));
+  return std::unique_ptr<SyntheticAudioClient>(new SyntheticAudioClient(
+      config, socket, fds[kEventSocket], fds[kTxSocket], fds[kRxSocket],
+      std::move(tx_shm), std::move(rx_shm)));
+}
+
+SyntheticAudioClient::SyntheticAudioClient(VioSConfig config,
+                                           SharedFD control_socket,
+                                           SharedFD event_socket,
+                                           SharedFD tx_socket,
+                                           SharedFD rx_socket,
+                                           ScopedMMap tx_shm, ScopedMMap rx_shm)
+    : config_(config),
+      control_socket_(control_socket),
+      event_socket_(event_socket),
+      tx_socket_(tx_socket),
+      rx_socket_(rx_socket),
+      tx_shm_(std::move(tx_shm)),
+      rx_shm_(std::move(rx_shm)) {}
+
+Result<std::vector<uint8_t>> SyntheticAudioClient::Command(const void* cmd,
+                                                           size_t cmd_len,
+                                                           size_t reply_len) {
+  auto sent = control_socket_->Send(cmd, cmd_len, 0);
+  CF_EXPECT(sent == static_cast<ssize_t>(cmd_len),
+            "Failed to send audio command: " << control_socket_->StrError());
+  std::vector<uint8_t> reply(sizeof(virtio_snd_hdr) + reply_len);
+  auto received = control_socket_->Recv(reply.data(), reply.size(), MSG_TRUNC);
+  CF_EXPECT(received >= static_cast<ssize_t>(sizeof(virtio_snd_hdr)),
+            "Failed to receive audio command reply: "
+                << control_socket_->StrError());
+  auto status =
+      reinterpret_cast<const virtio_snd_hdr*>(reply.data())->code.as_uint32_t();
+  CF_EXPECT(status == static_cast<uint32_t>(AudioStatus::VIRTIO_SND_S_OK),
+            "Audio command failed with status " << status);
+  CF_EXPECT(received == static_cast<ssize_t>(reply.size()),
+            "Unexpected audio command reply size: " << received);
+  reply.erase(reply.begin(), reply.begin() + sizeof(virtio_snd_hdr));
+  return reply;
+}
+
+template <typename Info>
+Result<std::vector<Info>> SyntheticAudioClient::QueryInfo(
+    AudioCommandType type, uint32_t start_id, uint32_t count) {
+  virtio_snd_query_info query = {
+      .hdr = {.code = Le32(static_cast<uint32_t>(type))},
+      .start_id = Le32(start_id),
+      .count = Le32(count),
+      .size = Le32(sizeof(Info)),
+  };
+  auto reply = CF_EXPECT(Command(&query, sizeof(query), count * sizeof(Info)));
+  auto info = reinterpret_cast<const Info*>(reply.data());
+  return std::vector<Info>(info, info + count);
+}
+
+Result<std::vector<virtio_snd_pcm_info>> SyntheticAudioClient::StreamsInfo(
+    uint32_t start_id, uint32_t count) {
+  return CF_EXPECT(QueryInfo<virtio_snd_pcm_info>(
+      AudioCommandType::VIRTIO_SND_R_PCM_INFO, start_id, count));
+}
+
+Result<std::vector<virtio_snd_chmap_info>> SyntheticAudioClient::ChmapsInfo(
+    uint32_t start_id, uint32_t count) {
+  return CF_EXPECT(QueryInfo<virtio_snd_chmap_info>(
+      AudioCommandType::VIRTIO_SND_R_CHMAP_INFO, start_id, count));
+}
+
+Result<void> SyntheticAudioClient::SetParams(uint32_t stream_id,
+                                             uint32_t buffer_bytes,
+                                             uint32_t period_bytes,
+                                             uint8_t channels,
+                                             AudioStreamFormat format,
+                                             AudioStreamRate rate) {
+  virtio_snd_pcm_set_params params = {
+      .hdr =
+          {
+              .hdr = {.code = Le32(static_cast<uint32_t>(
+                          AudioCommandType::VIRTIO_SND_R_PCM_SET_PARAMS))},
+              .stream_id = Le32(stream_id),
+          },
+      .buffer_bytes = Le32(buffer_bytes),
+      .period_bytes = Le32(period_bytes),
+      .features = Le32(0),
+      .channels = channels,
+      .format = static_cast<uint8_t>(format),
+      .rate = static_cast<uint8_t>(rate),
+      .padding = 0,
+  };
+  CF_EXPECT(Command(&params, sizeof(params), 0),
+            "Failed to set the parameters of stream " << stream_id);
+  return {};
+}
+
+Result<void> SyntheticAudioClient::StreamControl(AudioCommandType type,
+                                                 uint32_t stream_id) {
+  virtio_snd_pcm_hdr cmd = {
+      .hdr = {.code = Le32(static_cast<uint32_t>(type))},
+      .stream_id = Le32(stream_id),
+  };
+  CF_EXPECT(Command(&cmd, sizeof(cmd), 0),
+            "Command " << static_cast<uint32_t>(type) << " failed on stream "
+                       << stream_id);
+  return {};
+}
+
+Result<void> SyntheticAudioClient::Prepare(uint32_t stream_id) {
+  return StreamControl(AudioCommandType::VIRTIO_SND_R_PCM_PREPARE, stream_id);
+}
+
+Result<void> SyntheticAudioClient::Start(uint32_t stream_id) {
+  return StreamControl(AudioCommandType::VIRTIO_SND_R_PCM_START, stream_id);
+}
+
+Result<void> SyntheticAudioClient::Stop(uint32_t stream_id) {
+  return StreamControl(AudioCommandType::VIRTIO_SND_R_PCM_STOP, stream_id);
+}
+
+Result<void> SyntheticAudioClient::Release(uint32_t stream_id) {
+  return StreamControl(AudioCommandType::VIRTIO_SND_R_PCM_RELEASE, stream_id);
+}
+
+Result<void> SyntheticAudioClient::SendBuffer(SharedFD socket, size_t shm_len,
+                                              uint32_t stream_id,
+                                              uint32_t offset, uint32_t len) {
+  // The server aborts on buffers reaching the very end of the shared memory
+  CF_EXPECT(offset < shm_len && shm_len - offset > len,
+            "Buffer outside of the shared memory: " << offset << " " << len);
+  IoTransferMsg msg = {
+      .io_xfer = {.stream_id = Le32(stream_id)},
+      .buffer_offset = offset,
+      .buffer_len = len,
+  };
+  auto sent = socket->Send(&msg, sizeof(msg), 0);
+  CF_EXPECT(sent == static_cast<ssize_t>(sizeof(msg)),
+            "Failed to send audio buffer: " << socket->StrError());
+  return {};
+}
+
+Result<void> SyntheticAudioClient::SendPlayback(uint32_t stream_id,
+                                                uint32_t offset,
+                                                uint32_t len) {
+  return SendBuffer(tx_socket_, tx_shm_.len(), stream_id, offset, len);
+}
+
+Result<void> SyntheticAudioClient::SendCapture(uint32_t stream_id,
+                                               uint32_t offset, uint32_t len) {
+  return SendBuffer(rx_socket_, rx_shm_.len(), stream_id, offset, len);
+}
+
+Result<IoStatusMsg> SyntheticAudioClient::ReceiveStatus(SharedFD socket) {
+  IoStatusMsg status;
+  auto received = socket->Recv(&status, sizeof(status), 0);
+  CF_EXPECT(received == static_cast<ssize_t>(sizeof(status)),
+            "Failed to receive audio buffer status: " << socket->StrError());
+  return status;
+}
+
+Result<IoStatusMsg> SyntheticAudioClient::ReceivePlaybackStatus() {
+  return ReceiveStatus(tx_socket_);
+}
+
+Result<IoStatusMsg> SyntheticAudioClient::ReceiveCaptureStatus() {
+  return ReceiveStatus(rx_socket_);
+}
+
+}  // namespace cuttlefish
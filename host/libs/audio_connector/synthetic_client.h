@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cinttypes>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+#include "host/libs/audio_connector/shm_layout.h"
+
+namespace cuttlefish {
+
+// The VMM's side of the audio connector protocol, as crosvm's virtio-snd
+// device speaks it on behalf of the guest driver. It allows exercising an
+// AudioServer and its executor without booting a guest.
+//
+// Commands are synchronous. IO buffers are announced with SendPlayback and
+// SendCapture and their status is read from the tx and rx sockets, which can
+// be waited on with an epoll to drive many clients from a single thread.
+class SyntheticAudioClient {
+ public:
+  // Connects to the server socket the streamer listens on, like crosvm does
+  // with the path given in --sound.
+  static Result<std::unique_ptr<SyntheticAudioClient>> Connect(
+      const std::string& path);
+  // Takes an already connected socket.
+  static Result<std::unique_ptr<SyntheticAudioClient>> FromSocket(
+      SharedFD socket);
+
+  SyntheticAudioClient(const SyntheticAudioClient&) = delete;
+  SyntheticAudioClient& operator=(const SyntheticAudioClient&) = delete;
+
+  // What the server announced when the connection was made.
+  const VioSConfig& config() const { return config_; }
+
+  Result<std::vector<virtio_snd_pcm_info>> StreamsInfo(uint32_t start_id,
+                                                       uint32_t count);
+  Result<std::vector<virtio_snd_chmap_info>> ChmapsInfo(uint32_t start_id,
+                                                        uint32_t count);
+  Result<void> SetParams(uint32_t stream_id, uint32_t buffer_bytes,
+                         uint32_t period_bytes, uint8_t channels,
+                         AudioStreamFormat format, AudioStreamRate rate);
+  Result<void> Prepare(uint32_t stream_id);
+  Result<void> Start(uint32_t stream_id);
+  Result<void> Stop(uint32_t stream_id);
+  Result<void> Release(uint32_t stream_id);
+
+  // The shared memory the IO buffers live in. The ranges given to
+  // SendPlayback and SendCapture are offsets into these.
+  volatile uint8_t* tx_shm() {
+    return static_cast<volatile uint8_t*>(tx_shm_.get());
+  }
+  size_t tx_shm_len() const { return tx_shm_.len(); }
+  const volatile uint8_t* rx_shm() const {
+    return static_cast<const volatile uint8_t*>(rx_shm_.get());
+  }
+  size_t rx_shm_len() const { return rx_shm_.len(); }
+
+  // Hands the server a buffer of audio to play, or to fill with captured
+  // audio. The range must not be reused until its status is received.
+  Result<void> SendPlayback(uint32_t stream_id, uint32_t offset, uint32_t len);
+  Result<void> SendCapture(uint32_t stream_id, uint32_t offset, uint32_t len);
+
+  // Readable when there is a buffer status to receive.
+  SharedFD tx_socket() const { return tx_socket_; }
+  SharedFD rx_socket() const { return rx_socket_; }
+  // Block until the server gives a buffer back.
+  Result<IoStatusMsg> ReceivePlaybackStatus();
+  Result<IoStatusMsg> ReceiveCaptureStatus();
+
+ private:
+  SyntheticAudioClient(VioSConfig config, SharedFD control_socket,
+                       SharedFD event_socket, SharedFD tx_socket,
+                       SharedFD rx_socket, ScopedMMap tx_shm,
+                       ScopedMMap rx_shm);
+
+  // Sends a command and receives its reply, with the status stripped and
+  // expected to be VIRTIO_SND_S_OK.
+  Result<std::vector<uint8_t>> Command(const void* cmd, size_t cmd_len,
+                                       size_t reply_len);
+  template <typename Info>
+  Result<std::vector<Info>> QueryInfo(AudioCommandType type, uint32_t start_id,
+                                      uint32_t count);
+  Result<void> StreamControl(AudioCommandType type, uint32_t stream_id);
+  static Result<void> SendBuffer(SharedFD socket, size_t shm_len,
+                                 uint32_t stream_id, uint32_t offset,
+                                 uint32_t len);
+  static Result<IoStatusMsg> ReceiveStatus(SharedFD socket);
+
+  const VioSConfig config_;
+  SharedFD control_socket_;
+  // Not used by the server yet, kept open so that it doesn't see a hang up.
+  SharedFD event_socket_;
+  SharedFD tx_socket_;
+  SharedFD rx_socket_;
+  ScopedMMap tx_shm_;
+  ScopedMMap rx_shm_;
+};
+
+}  // namespace cuttlefish
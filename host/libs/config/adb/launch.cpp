@@ -65,7 +65,9 @@ class AdbHelper {
 
 class AdbConnector : public CommandSource {
  public:
-  INJECT(AdbConnector(const AdbHelper& helper)) : helper_(helper) {}
+  INJECT(AdbConnector(const AdbHelper& helper,
+                      KernelLogPipeProvider& log_pipe_provider))
+      : helper_(helper), log_pipe_provider_(log_pipe_provider) {}
 
   // CommandSource
   std::vector<Command> Commands() override {
@@ -89,6 +91,7 @@ class AdbConnector : public CommandSource {
     }
     address_arg.pop_back();
     adb_connector.AddParameter(address_arg);
+    adb_connector.AddParameter("-adbd_events_fd=", kernel_log_pipe_);
     std::vector<Command> commands;
     commands.emplace_back(std::move(adb_connector));
     return std::move(commands);
@@ -101,10 +104,17 @@ class AdbConnector : public CommandSource {
   }
 
  private:
-  std::unordered_set<SetupFeature*> Dependencies() const override { return {}; }
-  bool Setup() override { return true; }
+  std::unordered_set<SetupFeature*> Dependencies() const override {
+    return {static_cast<SetupFeature*>(&log_pipe_provider_)};
+  }
+  bool Setup() override {
+    kernel_log_pipe_ = log_pipe_provider_.KernelLogPipe();
+    return true;
+  }
 
   const AdbHelper& helper_;
+  KernelLogPipeProvider& log_pipe_provider_;
+  SharedFD kernel_log_pipe_;
 };
 
 class SocketVsockProxy : public CommandSource {
@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/config/boot_timeline.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+#include <json/json.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+std::int64_t Micros(BootTimeline::Clock::time_point time) {
+  auto since_epoch = time.time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::microseconds>(since_epoch)
+      .count();
+}
+
+// Overlapping spans on one thread have to nest, which parallel steps don't
+int NextSpanThread() {
+  static std::atomic_int next = 1;
+  return next++;
+}
+
+void AppendEvent(SharedFD fd, Json::Value event) {
+  event["pid"] = getpid();
+  Json::StreamWriterBuilder factory;
+  factory["indentation"] = "";
+  // One write per event keeps the events of concurrent writers apart
+  auto line = Json::writeString(factory, event) + ",\n";
+  if (WriteAll(fd, line) != (ssize_t)line.size()) {
+    LOG(WARNING) << "Could not add \"" << event["name"].asString()
+                 << "\" to the boot timeline: " << fd->StrError();
+  }
+}
+
+}  // namespace
+
+BootTimeline::BootTimeline(SharedFD fd) : fd_(fd) {}
+
+Result<BootTimeline> BootTimeline::Create(const std::string& path) {
+  auto fd = SharedFD::Open(path, O_CREAT | O_WRONLY | O_TRUNC | O_APPEND, 0644);
+  CF_EXPECT(fd->IsOpen(), "Could not open \"" << path
+                                              << "\": " << fd->StrError());
+  CF_EXPECT(WriteAll(fd, "[\n") == 2, fd->StrError());
+  return BootTimeline(fd);
+}
+
+Result<BootTimeline> BootTimeline::Open(const std::string& path) {
+  auto fd = SharedFD::Open(path, O_CREAT | O_WRONLY | O_APPEND, 0644);
+  CF_EXPECT(fd->IsOpen(), "Could not open \"" << path
+                                              << "\": " << fd->StrError());
+  if (fd->LSeek(0, SEEK_END) == 0) {
+    CF_EXPECT(WriteAll(fd, "[\n") == 2, fd->StrError());
+  }
+  return BootTimeline(fd);
+}
+
+void BootTimeline::AddSpan(const std::string& category,
+                           const std::string& name, Clock::time_point start,
+                           Clock::time_point end) {
+  Json::Value event;
+  event["cat"] = category;
+  event["name"] = name;
+  event["ph"] = "X";
+  event["ts"] = Json::Int64(Micros(start));
+  event["dur"] = Json::Int64(Micros(end) - Micros(start));
+  event["tid"] = NextSpanThread();
+  AppendEvent(fd_, event);
+}
+
+void BootTimeline::AddInstant(const std::string& category,
+                              const std::string& name, Clock::time_point time) {
+  Json::Value event;
+  event["cat"] = category;
+  event["name"] = name;
+  event["ph"] = "i";
+  event["s"] = "g";
+  event["ts"] = Json::Int64(Micros(time));
+  event["tid"] = 0;
+  AppendEvent(fd_, event);
+}
+
+namespace {
+
+Result<Json::Value> ReadTimelineEvents(const std::string& path) {
+  auto contents = android::base::Trim(ReadFile(path));
+  CF_EXPECT(!contents.empty(), "Could not read \"" << path << "\"");
+  if (contents.back() == ',') {
+    contents.pop_back();
+  }
+  contents += "]";
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  Json::Value events;
+  std::string errors;
+  CF_EXPECT(reader->parse(contents.data(), contents.data() + contents.size(),
+                          &events, &errors),
+            "Could not parse \"" << path << "\": " << errors);
+  CF_EXPECT(events.isArray() && !events.empty(), "Empty boot timeline");
+  return events;
+}
+
+std::int64_t TimelineBegin(const Json::Value& events) {
+  std::int64_t begin = events[0]["ts"].asInt64();
+  for (const auto& event : events) {
+    begin = std::min(begin, event["ts"].asInt64());
+  }
+  return begin;
+}
+
+}  // namespace
+
+Result<BootTimelineMarks> ReadBootTimelineMarks(const std::string& path) {
+  auto events = CF_EXPECT(ReadTimelineEvents(path));
+  auto begin = TimelineBegin(events);
+  BootTimelineMarks marks;
+  for (const auto& event : events) {
+    auto ts = event["ts"].asInt64() - begin;
+    if (event["ph"].asString() != "X") {
+      // The first time counts for events repeated on a reboot
+      auto time = std::chrono::microseconds(ts);
+      auto [it, inserted] =
+          marks.instants.try_emplace(event["name"].asString(), time);
+      it->second = std::min(it->second, time);
+      continue;
+    }
+    auto end = std::chrono::microseconds(ts + event["dur"].asInt64());
+    auto& phase_end = marks.phase_ends[event["cat"].asString()];
+    phase_end = std::max(phase_end, end);
+  }
+  return marks;
+}
+
+Result<std::string> SummarizeBootTimeline(const std::string& path) {
+  auto events = CF_EXPECT(ReadTimelineEvents(path));
+  std::int64_t begin = TimelineBegin(events);
+  struct Phase {
+    std::int64_t first;
+    std::int64_t end = 0;
+    std::string slowest;
+    std::int64_t slowest_duration = -1;
+  };
+  // Phases in the order they first appear
+  std::vector<std::string> order;
+  std::map<std::string, Phase> phases;
+  std::vector<std::pair<std::int64_t, std::string>> instants;
+  for (const auto& event : events) {
+    auto ts = event["ts"].asInt64() - begin;
+    if (event["ph"].asString() != "X") {
+      instants.emplace_back(ts, event["name"].asString());
+      continue;
+    }
+    auto category = event["cat"].asString();
+    auto duration = event["dur"].asInt64();
+    auto [it, inserted] = phases.try_emplace(category, Phase{ts});
+    if (inserted) {
+      order.push_back(category);
+    }
+    auto& phase = it->second;
+    phase.first = std::min(phase.first, ts);
+    phase.end = std::max(phase.end, ts + duration);
+    if (duration > phase.slowest_duration) {
+      phase.slowest = event["name"].asString();
+      phase.slowest_duration = duration;
+    }
+  }
+  std::sort(order.begin(), order.end(), [&phases](auto& a, auto& b) {
+    return phases[a].first < phases[b].first;
+  });
+  std::sort(instants.begin(), instants.end());
+
+  std::vector<std::string> parts;
+  for (const auto& category : order) {
+    const auto& phase = phases[category];
+    std::stringstream part;
+    part << category << " done at +" << phase.end / 1000 << " ms (slowest: "
+         << phase.slowest << " " << phase.slowest_duration / 1000 << " ms)";
+    parts.emplace_back(part.str());
+  }
+  for (const auto& [ts, name] : instants) {
+    parts.emplace_back(name + " at +" + std::to_string(ts / 1000) + " ms");
+  }
+  return android::base::Join(parts, ", ");
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <string>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+// The boot of a device as a Chrome trace in the json array format. Every
+// process taking part in the boot appends to the same file. The format makes
+// the closing bracket optional, so the file is a valid trace at any time.
+class BootTimeline {
+ public:
+  using Clock = std::chrono::system_clock;
+
+  // Starts an empty timeline, replacing the one of an earlier boot
+  static Result<BootTimeline> Create(const std::string& path);
+  // Appends to the timeline at `path`, creating it if necessary
+  static Result<BootTimeline> Open(const std::string& path);
+
+  void AddSpan(const std::string& category, const std::string& name,
+               Clock::time_point start, Clock::time_point end);
+  void AddInstant(const std::string& category, const std::string& name,
+                  Clock::time_point time = Clock::now());
+
+ private:
+  BootTimeline(SharedFD fd);
+
+  SharedFD fd_;
+};
+
+// When each boot phase (the category of its spans) ended and when each
+// instant first happened, since the beginning of the timeline
+struct BootTimelineMarks {
+  std::map<std::string, std::chrono::microseconds> phase_ends;
+  std::map<std::string, std::chrono::microseconds> instants;
+};
+
+Result<BootTimelineMarks> ReadBootTimelineMarks(const std::string& path);
+
+// One line with when each boot phase ended, and the slowest step of the
+// phases made of several steps.
+Result<std::string> SummarizeBootTimeline(const std::string& path);
+
+}  // namespace cuttlefish
@@ -95,9 +95,14 @@ std::vector<std::string> BootconfigArgsFromConfig(
     bootconfig_args.push_back("androidboot.selinux=permissive");
   }
 
+  // secure_env answers tagged keymaster messages, see KeymasterChannel
+  bootconfig_args.push_back("androidboot.keymint_pipelined=1");
+
   if (instance.tombstone_receiver_port()) {
     bootconfig_args.push_back(concat("androidboot.vsock_tombstone_port=",
                                      instance.tombstone_receiver_port()));
+    // guest_diagnostics_receiver recognizes gzip compressed uploads
+    bootconfig_args.push_back("androidboot.vsock_tombstone_compression=1");
   }
 
   if (instance.confui_host_vsock_port()) {
@@ -146,6 +151,8 @@ std::vector<std::string> BootconfigArgsFromConfig(
                                      instance.camera_server_port()));
     bootconfig_args.push_back(
         concat("androidboot.vsock_camera_cid=", instance.vsock_guest_cid()));
+    bootconfig_args.push_back(
+        concat("androidboot.vsock_camera_count=", instance.camera_count()));
   }
 
   if (config.enable_modem_simulator() &&
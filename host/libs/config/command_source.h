@@ -16,8 +16,10 @@
 #pragma once
 
 #include <fruit/fruit.h>
+#include <unordered_set>
 #include <vector>
 
+#include "common/libs/utils/result.h"
 #include "common/libs/utils/subprocess.h"
 #include "host/libs/config/feature.h"
 
@@ -27,6 +29,15 @@ class CommandSource : public virtual SetupFeature {
  public:
   virtual ~CommandSource() = default;
   virtual std::vector<Command> Commands() = 0;
+
+  // Sources whose commands must be running and ready before these commands
+  // start. Disabled sources are skipped.
+  virtual std::unordered_set<CommandSource*> StartDependencies() const {
+    return {};
+  }
+  // Blocks until the started commands can serve the sources depending on them,
+  // e.g. until they listen on their sockets.
+  virtual Result<void> WaitUntilReady() { return {}; }
 };
 
 }  // namespace cuttlefish
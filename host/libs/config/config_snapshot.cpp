@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/config/config_snapshot.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+#include <json/json.h>
+
+namespace cuttlefish {
+namespace {
+
+constexpr char kMagic[8] = {'C', 'F', 'S', 'N', 'A', 'P', '0', '1'};
+constexpr char kSnapshotSuffix[] = ".snapshot";
+
+enum Tag : std::uint8_t {
+  kNull,
+  kInt,
+  kUInt,
+  kReal,
+  kString,
+  kBool,
+  kArray,
+  kObject,
+};
+
+// Which version of the json file a snapshot is for
+struct JsonIdentity {
+  std::uint64_t size;
+  std::int64_t mtime_sec;
+  std::int64_t mtime_nsec;
+  std::uint64_t inode;
+};
+
+bool GetJsonIdentity(const std::string& json_path, JsonIdentity* identity) {
+  struct stat st;
+  if (stat(json_path.c_str(), &st) != 0) {
+    return false;
+  }
+  *identity = {static_cast<std::uint64_t>(st.st_size), st.st_mtim.tv_sec,
+               st.st_mtim.tv_nsec, st.st_ino};
+  return true;
+}
+
+template <typename T>
+void Append(std::string* out, const T& value) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void AppendString(std::string* out, const char* data, std::uint32_t size) {
+  Append(out, size);
+  out->append(data, size);
+}
+
+void Encode(const Json::Value& value, std::string* out) {
+  switch (value.type()) {
+    case Json::nullValue:
+      Append(out, kNull);
+      break;
+    case Json::intValue:
+      Append(out, kInt);
+      Append(out, value.asInt64());
+      break;
+    case Json::uintValue:
+      Append(out, kUInt);
+      Append(out, value.asUInt64());
+      break;
+    case Json::realValue:
+      Append(out, kReal);
+      Append(out, value.asDouble());
+      break;
+    case Json::stringValue: {
+      Append(out, kString);
+      const char* begin;
+      const char* end;
+      value.getString(&begin, &end);
+      AppendString(out, begin, end - begin);
+      break;
+    }
+    case Json::booleanValue:
+      Append(out, kBool);
+      Append(out, static_cast<std::uint8_t>(value.asBool()));
+      break;
+    case Json::arrayValue:
+      Append(out, kArray);
+      Append(out, static_cast<std::uint32_t>(value.size()));
+      for (const auto& element : value) {
+        Encode(element, out);
+      }
+      break;
+    case Json::objectValue:
+      Append(out, kObject);
+      Append(out, static_cast<std::uint32_t>(value.size()));
+      for (auto it = value.begin(); it != value.end(); it++) {
+        const char* end;
+        const char* begin = it.memberName(&end);
+        AppendString(out, begin, end - begin);
+        Encode(*it, out);
+      }
+      break;
+  }
+}
+
+class Decoder {
+ public:
+  Decoder(const char* data, size_t size) : data_(data), end_(data + size) {}
+
+  bool Decode(Json::Value* value) {
+    std::uint8_t tag;
+    if (!Read(&tag)) {
+      return false;
+    }
+    switch (tag) {
+      case kNull:
+        *value = Json::Value();
+        return true;
+      case kInt:
+        return ReadAs<Json::Int64>(value);
+      case kUInt:
+        return ReadAs<Json::UInt64>(value);
+      case kReal:
+        return ReadAs<double>(value);
+      case kString: {
+        const char* begin;
+        std::uint32_t size;
+        if (!ReadString(&begin, &size)) {
+          return false;
+        }
+        *value = Json::Value(begin, begin + size);
+        return true;
+      }
+      case kBool: {
+        std::uint8_t flag;
+        if (!Read(&flag)) {
+          return false;
+        }
+        *value = flag != 0;
+        return true;
+      }
+      case kArray: {
+        std::uint32_t size;
+        if (!ReadCount(&size)) {
+          return false;
+        }
+        *value = Json::Value(Json::arrayValue);
+        value->resize(size);
+        for (Json::ArrayIndex i = 0; i < size; i++) {
+          if (!Decode(&(*value)[i])) {
+            return false;
+          }
+        }
+        return true;
+      }
+      case kObject: {
+        std::uint32_t size;
+        if (!ReadCount(&size)) {
+          return false;
+        }
+        *value = Json::Value(Json::objectValue);
+        for (std::uint32_t i = 0; i < size; i++) {
+          const char* key;
+          std::uint32_t key_size;
+          if (!ReadString(&key, &key_size) ||
+              !Decode(&(*value)[std::string(key, key_size)])) {
+            return false;
+          }
+        }
+        return true;
+      }
+      default:
+        return false;
+    }
+  }
+
+  bool AtEnd() const { return data_ == end_; }
+
+  template <typename T>
+  bool Read(T* out) {
+    if (end_ - data_ < static_cast<std::ptrdiff_t>(sizeof(T))) {
+      return false;
+    }
+    memcpy(out, data_, sizeof(T));
+    data_ += sizeof(T);
+    return true;
+  }
+
+ private:
+  template <typename T>
+  bool ReadAs(Json::Value* value) {
+    T number;
+    if (!Read(&number)) {
+      return false;
+    }
+    *value = number;
+    return true;
+  }
+
+  // Every element takes at least one byte, so a count larger than what is
+  // left is corrupt. Checked before anything is allocated for the elements.
+  bool ReadCount(std::uint32_t* count) {
+    return Read(count) && *count <= static_cast<std::size_t>(end_ - data_);
+  }
+
+  bool ReadString(const char** begin, std::uint32_t* size) {
+    if (!Read(size) || end_ - data_ < static_cast<std::ptrdiff_t>(*size)) {
+      return false;
+    }
+    *begin = data_;
+    data_ += *size;
+    return true;
+  }
+
+  const char* data_;
+  const char* end_;
+};
+
+}  // namespace
+
+bool WriteConfigSnapshot(const Json::Value& config,
+                         const std::string& json_path) {
+  JsonIdentity identity;
+  if (!GetJsonIdentity(json_path, &identity)) {
+    PLOG(ERROR) << "Could not stat " << json_path;
+    return false;
+  }
+  std::string snapshot(kMagic, sizeof(kMagic));
+  Append(&snapshot, identity);
+  Encode(config, &snapshot);
+  // Readers map the file, it's replaced rather than rewritten
+  auto snapshot_path = json_path + kSnapshotSuffix;
+  auto tmp_path = snapshot_path + "." + std::to_string(getpid()) + ".tmp";
+  if (!android::base::WriteStringToFile(snapshot, tmp_path)) {
+    PLOG(ERROR) << "Could not write " << tmp_path;
+    return false;
+  }
+  if (rename(tmp_path.c_str(), snapshot_path.c_str()) != 0) {
+    PLOG(ERROR) << "Could not move " << tmp_path << " to " << snapshot_path;
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool ReadConfigSnapshot(const std::string& json_path, Json::Value* config) {
+  JsonIdentity identity;
+  if (!GetJsonIdentity(json_path, &identity)) {
+    return false;
+  }
+  auto snapshot_path = json_path + kSnapshotSuffix;
+  android::base::unique_fd fd(
+      open(snapshot_path.c_str(), O_RDONLY | O_CLOEXEC));
+  struct stat st;
+  if (fd < 0 || fstat(fd.get(), &st) != 0 || st.st_size == 0) {
+    return false;
+  }
+  void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+  if (mapped == MAP_FAILED) {
+    return false;
+  }
+  Decoder decoder(static_cast<const char*>(mapped), st.st_size);
+  char magic[sizeof(kMagic)];
+  JsonIdentity snapshot_identity;
+  bool current = decoder.Read(&magic) &&
+                 memcmp(magic, kMagic, sizeof(kMagic)) == 0 &&
+                 decoder.Read(&snapshot_identity) &&
+                 memcmp(&snapshot_identity, &identity, sizeof(identity)) == 0;
+  Json::Value decoded;
+  bool decoded_ok = current && decoder.Decode(&decoded) && decoder.AtEnd();
+  munmap(mapped, st.st_size);
+  if (!decoded_ok) {
+    if (current) {
+      LOG(WARNING) << "Ignoring malformed " << snapshot_path;
+    }
+    return false;
+  }
+  *config = std::move(decoded);
+  return true;
+}
+
+}  // namespace cuttlefish
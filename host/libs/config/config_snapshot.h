@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+
+namespace Json {
+class Value;
+}
+
+namespace cuttlefish {
+
+// A binary copy of a config json file, decoded without parsing any text.
+// The snapshot records which version of the json file it was made from, and
+// is ignored once that file changes.
+bool WriteConfigSnapshot(const Json::Value& config,
+                         const std::string& json_path);
+bool ReadConfigSnapshot(const std::string& json_path, Json::Value* config);
+
+}  // namespace cuttlefish
@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/config/config_snapshot.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <limits>
+#include <string>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <json/json.h>
+
+namespace cuttlefish {
+namespace {
+
+// The magic and the identity of the json file
+constexpr std::size_t kHeaderSize = 8 + 32;
+
+Json::Value EveryType() {
+  Json::Value config;
+  config["null"] = Json::Value();
+  config["int"] = -42;
+  config["int64_min"] = std::numeric_limits<Json::Int64>::min();
+  config["int64_max"] = std::numeric_limits<Json::Int64>::max();
+  config["uint"] = 42u;
+  config["uint64_max"] = std::numeric_limits<Json::UInt64>::max();
+  config["real"] = 0.25;
+  config["empty_string"] = "";
+  config["string_with_nuls"] = Json::Value(std::string("a\0b\0", 4));
+  config["true"] = true;
+  config["false"] = false;
+  config["empty_array"] = Json::Value(Json::arrayValue);
+  config["empty_object"] = Json::Value(Json::objectValue);
+  config[std::string("key\0with nul", 12)] = "value";
+
+  Json::Value instance;
+  instance["name"] = "cvd-1";
+  instance["ports"].append(6520);
+  instance["ports"].append(Json::Value(Json::arrayValue));
+  instance["ports"][1].append("nested");
+  instance["ports"][1].append(Json::Value(Json::objectValue));
+  instance["ports"][1][1]["deep"] = Json::Value();
+  config["instances"]["1"] = instance;
+  return config;
+}
+
+class ConfigSnapshotTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    json_path_ = std::string(dir_.path) + "/config.json";
+    snapshot_path_ = json_path_ + ".snapshot";
+    ASSERT_TRUE(android::base::WriteStringToFile("{\"a\": 1}", json_path_));
+  }
+
+  std::string ReadSnapshotFile() {
+    std::string contents;
+    EXPECT_TRUE(android::base::ReadFileToString(snapshot_path_, &contents));
+    return contents;
+  }
+
+  TemporaryDir dir_;
+  std::string json_path_;
+  std::string snapshot_path_;
+};
+
+TEST_F(ConfigSnapshotTest, RoundTripsEveryType) {
+  auto config = EveryType();
+  ASSERT_TRUE(WriteConfigSnapshot(config, json_path_));
+
+  Json::Value read;
+  ASSERT_TRUE(ReadConfigSnapshot(json_path_, &read));
+  // Also compares the types, e.g. int and uint
+  EXPECT_EQ(read, config);
+  EXPECT_EQ(read["int64_min"].type(), Json::intValue);
+  EXPECT_EQ(read["uint64_max"].type(), Json::uintValue);
+  EXPECT_EQ(read["uint64_max"].asUInt64(),
+            std::numeric_limits<Json::UInt64>::max());
+  EXPECT_EQ(read["string_with_nuls"].asString(), std::string("a\0b\0", 4));
+  EXPECT_TRUE(read.isMember(std::string("key\0with nul", 12)));
+}
+
+TEST_F(ConfigSnapshotTest, RoundTripsScalarRoots) {
+  for (const auto& config :
+       {Json::Value(), Json::Value(7), Json::Value("text"),
+        Json::Value(Json::arrayValue)}) {
+    ASSERT_TRUE(WriteConfigSnapshot(config, json_path_));
+    Json::Value read = "unchanged";
+    ASSERT_TRUE(ReadConfigSnapshot(json_path_, &read));
+    EXPECT_EQ(read, config);
+  }
+}
+
+TEST_F(ConfigSnapshotTest, IgnoresMissingSnapshots) {
+  Json::Value read = "unchanged";
+  EXPECT_FALSE(ReadConfigSnapshot(json_path_, &read));
+  EXPECT_EQ(read, "unchanged");
+}
+
+TEST_F(ConfigSnapshotTest, IgnoresSnapshotsOfAnotherSize) {
+  ASSERT_TRUE(WriteConfigSnapshot(EveryType(), json_path_));
+  struct stat before;
+  ASSERT_EQ(stat(json_path_.c_str(), &before), 0);
+  ASSERT_TRUE(android::base::WriteStringToFile("{\"a\": 12}", json_path_));
+  // Only the size differs
+  timespec times[2] = {before.st_atim, before.st_mtim};
+  ASSERT_EQ(utimensat(AT_FDCWD, json_path_.c_str(), times, 0), 0);
+
+  Json::Value read;
+  EXPECT_FALSE(ReadConfigSnapshot(json_path_, &read));
+}
+
+TEST_F(ConfigSnapshotTest, IgnoresSnapshotsOfAnotherModificationTime) {
+  ASSERT_TRUE(WriteConfigSnapshot(EveryType(), json_path_));
+  struct stat before;
+  ASSERT_EQ(stat(json_path_.c_str(), &before), 0);
+  timespec times[2] = {before.st_atim, before.st_mtim};
+  times[1].tv_nsec = (times[1].tv_nsec + 1) % 1000000000;
+  ASSERT_EQ(utimensat(AT_FDCWD, json_path_.c_str(), times, 0), 0);
+
+  Json::Value read;
+  EXPECT_FALSE(ReadConfigSnapshot(json_path_, &read));
+}
+
+TEST_F(ConfigSnapshotTest, IgnoresSnapshotsOfAnotherFile) {
+  ASSERT_TRUE(WriteConfigSnapshot(EveryType(), json_path_));
+  struct stat before;
+  ASSERT_EQ(stat(json_path_.c_str(), &before), 0);
+  // Same size and modification time, but replaced
+  auto other_path = json_path_ + ".new";
+  ASSERT_TRUE(android::base::WriteStringToFile("{\"b\": 2}", other_path));
+  timespec times[2] = {before.st_atim, before.st_mtim};
+  ASSERT_EQ(utimensat(AT_FDCWD, other_path.c_str(), times, 0), 0);
+  ASSERT_EQ(rename(other_path.c_str(), json_path_.c_str()), 0);
+  struct stat after;
+  ASSERT_EQ(stat(json_path_.c_str(), &after), 0);
+  ASSERT_NE(after.st_ino, before.st_ino);
+
+  Json::Value read;
+  EXPECT_FALSE(ReadConfigSnapshot(json_path_, &read));
+}
+
+TEST_F(ConfigSnapshotTest, RejectsTruncatedSnapshots) {
+  ASSERT_TRUE(WriteConfigSnapshot(EveryType(), json_path_));
+  auto snapshot = ReadSnapshotFile();
+  for (std::size_t size : {std::size_t{4}, kHeaderSize, snapshot.size() / 2,
+                           snapshot.size() - 1}) {
+    ASSERT_TRUE(
+        android::base::WriteStringToFile(snapshot.substr(0, size),
+                                         snapshot_path_));
+    Json::Value read;
+    EXPECT_FALSE(ReadConfigSnapshot(json_path_, &read)) << size;
+  }
+  ASSERT_TRUE(
+      android::base::WriteStringToFile(snapshot + "x", snapshot_path_));
+  Json::Value read;
+  EXPECT_FALSE(ReadConfigSnapshot(json_path_, &read));
+}
+
+TEST_F(ConfigSnapshotTest, RejectsCountsLargerThanTheSnapshot) {
+  for (const auto& config :
+       {Json::Value(Json::arrayValue), Json::Value(Json::objectValue)}) {
+    ASSERT_TRUE(WriteConfigSnapshot(config, json_path_));
+    auto snapshot = ReadSnapshotFile();
+    // The count follows the tag of the root
+    ASSERT_EQ(snapshot.size(), kHeaderSize + 1 + sizeof(std::uint32_t));
+    snapshot.replace(kHeaderSize + 1, sizeof(std::uint32_t),
+                     "\xff\xff\xff\xff");
+    ASSERT_TRUE(android::base::WriteStringToFile(snapshot, snapshot_path_));
+
+    Json::Value read;
+    EXPECT_FALSE(ReadConfigSnapshot(json_path_, &read));
+  }
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -26,14 +26,17 @@
 #include <iterator>
 #include <sstream>
 #include <string>
+#include <utility>
 #include <time.h>
 
+#include <android-base/file.h>
 #include <android-base/strings.h>
 #include <android-base/logging.h>
 #include <json/json.h>
 
 #include "common/libs/utils/environment.h"
 #include "common/libs/utils/files.h"
+#include "host/libs/config/config_snapshot.h"
 #include "host/libs/vm_manager/crosvm_manager.h"
 #include "host/libs/vm_manager/gem5_manager.h"
 #include "host/libs/vm_manager/qemu_manager.h"
@@ -110,7 +113,7 @@ bool CuttlefishConfig::LoadFragment(ConfigFragment& fragment) const {
     LOG(ERROR) << "Fragments member was missing";
     return false;
   }
-  const Json::Value& json_fragments = (*dictionary_)[kFragments];
+  const Json::Value& json_fragments = std::as_const(*dictionary_)[kFragments];
   if (!json_fragments.isMember(fragment.Name())) {
     LOG(ERROR) << "Could not find a fragment called " << fragment.Name();
     return false;
@@ -129,7 +132,7 @@ bool CuttlefishConfig::SaveFragment(const ConfigFragment& fragment) {
 
 static constexpr char kRootDir[] = "root_dir";
 std::string CuttlefishConfig::root_dir() const {
-  return (*dictionary_)[kRootDir].asString();
+  return std::as_const(*dictionary_)[kRootDir].asString();
 }
 void CuttlefishConfig::set_root_dir(const std::string& root_dir) {
   (*dictionary_)[kRootDir] = root_dir;
@@ -137,7 +140,7 @@ void CuttlefishConfig::set_root_dir(const std::string& root_dir) {
 
 static constexpr char kVmManager[] = "vm_manager";
 std::string CuttlefishConfig::vm_manager() const {
-  return (*dictionary_)[kVmManager].asString();
+  return std::as_const(*dictionary_)[kVmManager].asString();
 }
 void CuttlefishConfig::set_vm_manager(const std::string& name) {
   (*dictionary_)[kVmManager] = name;
@@ -145,7 +148,7 @@ void CuttlefishConfig::set_vm_manager(const std::string& name) {
 
 static constexpr char kGpuMode[] = "gpu_mode";
 std::string CuttlefishConfig::gpu_mode() const {
-  return (*dictionary_)[kGpuMode].asString();
+  return std::as_const(*dictionary_)[kGpuMode].asString();
 }
 void CuttlefishConfig::set_gpu_mode(const std::string& name) {
   (*dictionary_)[kGpuMode] = name;
@@ -153,7 +156,7 @@ void CuttlefishConfig::set_gpu_mode(const std::string& name) {
 
 static constexpr char kGpuCaptureBinary[] = "gpu_capture_binary";
 std::string CuttlefishConfig::gpu_capture_binary() const {
-  return (*dictionary_)[kGpuCaptureBinary].asString();
+  return std::as_const(*dictionary_)[kGpuCaptureBinary].asString();
 }
 void CuttlefishConfig::set_gpu_capture_binary(const std::string& name) {
   (*dictionary_)[kGpuCaptureBinary] = name;
@@ -161,7 +164,7 @@ void CuttlefishConfig::set_gpu_capture_binary(const std::string& name) {
 
 static constexpr char kHWComposer[] = "hwcomposer";
 std::string CuttlefishConfig::hwcomposer() const {
-  return (*dictionary_)[kHWComposer].asString();
+  return std::as_const(*dictionary_)[kHWComposer].asString();
 }
 void CuttlefishConfig::set_hwcomposer(const std::string& name) {
   (*dictionary_)[kHWComposer] = name;
@@ -172,7 +175,7 @@ void CuttlefishConfig::set_enable_gpu_udmabuf(const bool enable_gpu_udmabuf) {
   (*dictionary_)[kEnableGpuUdmabuf] = enable_gpu_udmabuf;
 }
 bool CuttlefishConfig::enable_gpu_udmabuf() const {
-  return (*dictionary_)[kEnableGpuUdmabuf].asBool();
+  return std::as_const(*dictionary_)[kEnableGpuUdmabuf].asBool();
 }
 
 static constexpr char kEnableGpuAngle[] = "enable_gpu_angle";
@@ -180,16 +183,16 @@ void CuttlefishConfig::set_enable_gpu_angle(const bool enable_gpu_angle) {
   (*dictionary_)[kEnableGpuAngle] = enable_gpu_angle;
 }
 bool CuttlefishConfig::enable_gpu_angle() const {
-  return (*dictionary_)[kEnableGpuAngle].asBool();
+  return std::as_const(*dictionary_)[kEnableGpuAngle].asBool();
 }
 
 static constexpr char kCpus[] = "cpus";
-int CuttlefishConfig::cpus() const { return (*dictionary_)[kCpus].asInt(); }
+int CuttlefishConfig::cpus() const { return std::as_const(*dictionary_)[kCpus].asInt(); }
 void CuttlefishConfig::set_cpus(int cpus) { (*dictionary_)[kCpus] = cpus; }
 
 static constexpr char kMemoryMb[] = "memory_mb";
 int CuttlefishConfig::memory_mb() const {
-  return (*dictionary_)[kMemoryMb].asInt();
+  return std::as_const(*dictionary_)[kMemoryMb].asInt();
 }
 void CuttlefishConfig::set_memory_mb(int memory_mb) {
   (*dictionary_)[kMemoryMb] = memory_mb;
@@ -203,7 +206,7 @@ static constexpr char kRefreshRateHz[] = "refresh_rate_hz";
 std::vector<CuttlefishConfig::DisplayConfig>
 CuttlefishConfig::display_configs() const {
   std::vector<DisplayConfig> display_configs;
-  for (auto& display_config_json : (*dictionary_)[kDisplayConfigs]) {
+  for (auto& display_config_json : std::as_const(*dictionary_)[kDisplayConfigs]) {
     DisplayConfig display_config = {};
     display_config.width = display_config_json[kXRes].asInt();
     display_config.height = display_config_json[kYRes].asInt();
@@ -239,7 +242,7 @@ void CuttlefishConfig::SetPath(const std::string& key,
 
 static constexpr char kGdbPort[] = "gdb_port";
 int CuttlefishConfig::gdb_port() const {
-  return (*dictionary_)[kGdbPort].asInt();
+  return std::as_const(*dictionary_)[kGdbPort].asInt();
 }
 void CuttlefishConfig::set_gdb_port(int port) {
   (*dictionary_)[kGdbPort] = port;
@@ -247,7 +250,7 @@ void CuttlefishConfig::set_gdb_port(int port) {
 
 static constexpr char kDeprecatedBootCompleted[] = "deprecated_boot_completed";
 bool CuttlefishConfig::deprecated_boot_completed() const {
-  return (*dictionary_)[kDeprecatedBootCompleted].asBool();
+  return std::as_const(*dictionary_)[kDeprecatedBootCompleted].asBool();
 }
 void CuttlefishConfig::set_deprecated_boot_completed(
     bool deprecated_boot_completed) {
@@ -259,7 +262,7 @@ void CuttlefishConfig::set_cuttlefish_env_path(const std::string& path) {
   SetPath(kCuttlefishEnvPath, path);
 }
 std::string CuttlefishConfig::cuttlefish_env_path() const {
-  return (*dictionary_)[kCuttlefishEnvPath].asString();
+  return std::as_const(*dictionary_)[kCuttlefishEnvPath].asString();
 }
 
 static SecureHal StringToSecureHal(std::string mode) {
@@ -276,7 +279,7 @@ static SecureHal StringToSecureHal(std::string mode) {
 static constexpr char kSecureHals[] = "secure_hals";
 std::set<SecureHal> CuttlefishConfig::secure_hals() const {
   std::set<SecureHal> args_set;
-  for (auto& hal : (*dictionary_)[kSecureHals]) {
+  for (auto& hal : std::as_const(*dictionary_)[kSecureHals]) {
     args_set.insert(StringToSecureHal(hal.asString()));
   }
   return args_set;
@@ -291,7 +294,7 @@ void CuttlefishConfig::set_secure_hals(const std::set<std::string>& hals) {
 
 static constexpr char kSetupWizardMode[] = "setupwizard_mode";
 std::string CuttlefishConfig::setupwizard_mode() const {
-  return (*dictionary_)[kSetupWizardMode].asString();
+  return std::as_const(*dictionary_)[kSetupWizardMode].asString();
 }
 void CuttlefishConfig::set_setupwizard_mode(const std::string& mode) {
   (*dictionary_)[kSetupWizardMode] = mode;
@@ -299,7 +302,7 @@ void CuttlefishConfig::set_setupwizard_mode(const std::string& mode) {
 
 static constexpr char kQemuBinaryDir[] = "qemu_binary_dir";
 std::string CuttlefishConfig::qemu_binary_dir() const {
-  return (*dictionary_)[kQemuBinaryDir].asString();
+  return std::as_const(*dictionary_)[kQemuBinaryDir].asString();
 }
 void CuttlefishConfig::set_qemu_binary_dir(const std::string& qemu_binary_dir) {
   (*dictionary_)[kQemuBinaryDir] = qemu_binary_dir;
@@ -307,7 +310,7 @@ void CuttlefishConfig::set_qemu_binary_dir(const std::string& qemu_binary_dir) {
 
 static constexpr char kCrosvmBinary[] = "crosvm_binary";
 std::string CuttlefishConfig::crosvm_binary() const {
-  return (*dictionary_)[kCrosvmBinary].asString();
+  return std::as_const(*dictionary_)[kCrosvmBinary].asString();
 }
 void CuttlefishConfig::set_crosvm_binary(const std::string& crosvm_binary) {
   (*dictionary_)[kCrosvmBinary] = crosvm_binary;
@@ -315,18 +318,27 @@ void CuttlefishConfig::set_crosvm_binary(const std::string& crosvm_binary) {
 
 static constexpr char kGem5BinaryDir[] = "gem5_binary_dir";
 std::string CuttlefishConfig::gem5_binary_dir() const {
-  return (*dictionary_)[kGem5BinaryDir].asString();
+  return std::as_const(*dictionary_)[kGem5BinaryDir].asString();
 }
 void CuttlefishConfig::set_gem5_binary_dir(const std::string& gem5_binary_dir) {
   (*dictionary_)[kGem5BinaryDir] = gem5_binary_dir;
 }
 
+static constexpr char kGem5CheckpointDir[] = "gem5_checkpoint_dir";
+std::string CuttlefishConfig::gem5_checkpoint_dir() const {
+  return std::as_const(*dictionary_)[kGem5CheckpointDir].asString();
+}
+void CuttlefishConfig::set_gem5_checkpoint_dir(
+    const std::string& gem5_checkpoint_dir) {
+  (*dictionary_)[kGem5CheckpointDir] = gem5_checkpoint_dir;
+}
+
 static constexpr char kEnableGnssGrpcProxy[] = "enable_gnss_grpc_proxy";
 void CuttlefishConfig::set_enable_gnss_grpc_proxy(const bool enable_gnss_grpc_proxy) {
   (*dictionary_)[kEnableGnssGrpcProxy] = enable_gnss_grpc_proxy;
 }
 bool CuttlefishConfig::enable_gnss_grpc_proxy() const {
-  return (*dictionary_)[kEnableGnssGrpcProxy].asBool();
+  return std::as_const(*dictionary_)[kEnableGnssGrpcProxy].asBool();
 }
 
 static constexpr char kEnableSandbox[] = "enable_sandbox";
@@ -334,7 +346,7 @@ void CuttlefishConfig::set_enable_sandbox(const bool enable_sandbox) {
   (*dictionary_)[kEnableSandbox] = enable_sandbox;
 }
 bool CuttlefishConfig::enable_sandbox() const {
-  return (*dictionary_)[kEnableSandbox].asBool();
+  return std::as_const(*dictionary_)[kEnableSandbox].asBool();
 }
 
 static constexpr char kSeccompPolicyDir[] = "seccomp_policy_dir";
@@ -346,7 +358,7 @@ void CuttlefishConfig::set_seccomp_policy_dir(const std::string& seccomp_policy_
   SetPath(kSeccompPolicyDir, seccomp_policy_dir);
 }
 std::string CuttlefishConfig::seccomp_policy_dir() const {
-  return (*dictionary_)[kSeccompPolicyDir].asString();
+  return std::as_const(*dictionary_)[kSeccompPolicyDir].asString();
 }
 
 static constexpr char kEnableWebRTC[] = "enable_webrtc";
@@ -354,7 +366,7 @@ void CuttlefishConfig::set_enable_webrtc(bool enable_webrtc) {
   (*dictionary_)[kEnableWebRTC] = enable_webrtc;
 }
 bool CuttlefishConfig::enable_webrtc() const {
-  return (*dictionary_)[kEnableWebRTC].asBool();
+  return std::as_const(*dictionary_)[kEnableWebRTC].asBool();
 }
 
 static constexpr char kEnableVehicleHalServer[] = "enable_vehicle_hal_server";
@@ -362,7 +374,7 @@ void CuttlefishConfig::set_enable_vehicle_hal_grpc_server(bool enable_vehicle_ha
   (*dictionary_)[kEnableVehicleHalServer] = enable_vehicle_hal_grpc_server;
 }
 bool CuttlefishConfig::enable_vehicle_hal_grpc_server() const {
-  return (*dictionary_)[kEnableVehicleHalServer].asBool();
+  return std::as_const(*dictionary_)[kEnableVehicleHalServer].asBool();
 }
 
 static constexpr char kWebRTCAssetsDir[] = "webrtc_assets_dir";
@@ -370,7 +382,7 @@ void CuttlefishConfig::set_webrtc_assets_dir(const std::string& webrtc_assets_di
   (*dictionary_)[kWebRTCAssetsDir] = webrtc_assets_dir;
 }
 std::string CuttlefishConfig::webrtc_assets_dir() const {
-  return (*dictionary_)[kWebRTCAssetsDir].asString();
+  return std::as_const(*dictionary_)[kWebRTCAssetsDir].asString();
 }
 
 static constexpr char kWebRTCEnableADBWebSocket[] =
@@ -379,28 +391,116 @@ void CuttlefishConfig::set_webrtc_enable_adb_websocket(bool enable) {
     (*dictionary_)[kWebRTCEnableADBWebSocket] = enable;
 }
 bool CuttlefishConfig::webrtc_enable_adb_websocket() const {
-    return (*dictionary_)[kWebRTCEnableADBWebSocket].asBool();
+    return std::as_const(*dictionary_)[kWebRTCEnableADBWebSocket].asBool();
 }
 
 static constexpr char kRestartSubprocesses[] = "restart_subprocesses";
 bool CuttlefishConfig::restart_subprocesses() const {
-  return (*dictionary_)[kRestartSubprocesses].asBool();
+  return std::as_const(*dictionary_)[kRestartSubprocesses].asBool();
 }
 void CuttlefishConfig::set_restart_subprocesses(bool restart_subprocesses) {
   (*dictionary_)[kRestartSubprocesses] = restart_subprocesses;
 }
 
+static constexpr char kResourceAccounting[] = "resource_accounting";
+bool CuttlefishConfig::resource_accounting() const {
+  return std::as_const(*dictionary_)[kResourceAccounting].asBool();
+}
+void CuttlefishConfig::set_resource_accounting(bool resource_accounting) {
+  (*dictionary_)[kResourceAccounting] = resource_accounting;
+}
+
+static constexpr char kGuestMemoryMerge[] = "guest_memory_merge";
+bool CuttlefishConfig::guest_memory_merge() const {
+  return std::as_const(*dictionary_)[kGuestMemoryMerge].asBool();
+}
+void CuttlefishConfig::set_guest_memory_merge(bool guest_memory_merge) {
+  (*dictionary_)[kGuestMemoryMerge] = guest_memory_merge;
+}
+
+static constexpr char kKsmBootPagesToScan[] = "ksm_boot_pages_to_scan";
+int CuttlefishConfig::ksm_boot_pages_to_scan() const {
+  return std::as_const(*dictionary_)[kKsmBootPagesToScan].asInt();
+}
+void CuttlefishConfig::set_ksm_boot_pages_to_scan(int pages) {
+  (*dictionary_)[kKsmBootPagesToScan] = pages;
+}
+
+static constexpr char kKsmSteadyPagesToScan[] = "ksm_steady_pages_to_scan";
+int CuttlefishConfig::ksm_steady_pages_to_scan() const {
+  return std::as_const(*dictionary_)[kKsmSteadyPagesToScan].asInt();
+}
+void CuttlefishConfig::set_ksm_steady_pages_to_scan(int pages) {
+  (*dictionary_)[kKsmSteadyPagesToScan] = pages;
+}
+
+static constexpr char kHostProcessCgroups[] = "host_process_cgroups";
+void CuttlefishConfig::set_host_process_cgroups(
+    const std::map<std::string, std::map<std::string, std::string>>&
+        settings) {
+  Json::Value settings_json(Json::objectValue);
+  for (const auto& [process, files] : settings) {
+    for (const auto& [file, value] : files) {
+      settings_json[process][file] = value;
+    }
+  }
+  (*dictionary_)[kHostProcessCgroups] = settings_json;
+}
+std::map<std::string, std::map<std::string, std::string>>
+CuttlefishConfig::host_process_cgroups() const {
+  std::map<std::string, std::map<std::string, std::string>> settings;
+  const auto& settings_json = std::as_const(*dictionary_)[kHostProcessCgroups];
+  for (const auto& process : settings_json.getMemberNames()) {
+    for (const auto& file : settings_json[process].getMemberNames()) {
+      settings[process][file] = settings_json[process][file].asString();
+    }
+  }
+  return settings;
+}
+
+static constexpr char kSnapshotPath[] = "snapshot_path";
+std::string CuttlefishConfig::snapshot_path() const {
+  return std::as_const(*dictionary_)[kSnapshotPath].asString();
+}
+void CuttlefishConfig::set_snapshot_path(const std::string& snapshot_path) {
+  (*dictionary_)[kSnapshotPath] = snapshot_path;
+}
+
 static constexpr char kRunAsDaemon[] = "run_as_daemon";
 bool CuttlefishConfig::run_as_daemon() const {
-  return (*dictionary_)[kRunAsDaemon].asBool();
+  return std::as_const(*dictionary_)[kRunAsDaemon].asBool();
 }
 void CuttlefishConfig::set_run_as_daemon(bool run_as_daemon) {
   (*dictionary_)[kRunAsDaemon] = run_as_daemon;
 }
 
+static constexpr char kBinarySubprocessLogs[] = "binary_subprocess_logs";
+bool CuttlefishConfig::binary_subprocess_logs() const {
+  return std::as_const(*dictionary_)[kBinarySubprocessLogs].asBool();
+}
+void CuttlefishConfig::set_binary_subprocess_logs(bool binary_subprocess_logs) {
+  (*dictionary_)[kBinarySubprocessLogs] = binary_subprocess_logs;
+}
+
+static constexpr char kStructuredLogs[] = "structured_logs";
+bool CuttlefishConfig::structured_logs() const {
+  return std::as_const(*dictionary_)[kStructuredLogs].asBool();
+}
+void CuttlefishConfig::set_structured_logs(bool structured_logs) {
+  (*dictionary_)[kStructuredLogs] = structured_logs;
+}
+
+static constexpr char kCompressTombstones[] = "compress_tombstones";
+bool CuttlefishConfig::compress_tombstones() const {
+  return std::as_const(*dictionary_)[kCompressTombstones].asBool();
+}
+void CuttlefishConfig::set_compress_tombstones(bool compress_tombstones) {
+  (*dictionary_)[kCompressTombstones] = compress_tombstones;
+}
+
 static constexpr char kDataPolicy[] = "data_policy";
 std::string CuttlefishConfig::data_policy() const {
-  return (*dictionary_)[kDataPolicy].asString();
+  return std::as_const(*dictionary_)[kDataPolicy].asString();
 }
 void CuttlefishConfig::set_data_policy(const std::string& data_policy) {
   (*dictionary_)[kDataPolicy] = data_policy;
@@ -408,7 +508,7 @@ void CuttlefishConfig::set_data_policy(const std::string& data_policy) {
 
 static constexpr char kBlankDataImageMb[] = "blank_data_image_mb";
 int CuttlefishConfig::blank_data_image_mb() const {
-  return (*dictionary_)[kBlankDataImageMb].asInt();
+  return std::as_const(*dictionary_)[kBlankDataImageMb].asInt();
 }
 void CuttlefishConfig::set_blank_data_image_mb(int blank_data_image_mb) {
   (*dictionary_)[kBlankDataImageMb] = blank_data_image_mb;
@@ -416,7 +516,7 @@ void CuttlefishConfig::set_blank_data_image_mb(int blank_data_image_mb) {
 
 static constexpr char kBootloader[] = "bootloader";
 std::string CuttlefishConfig::bootloader() const {
-  return (*dictionary_)[kBootloader].asString();
+  return std::as_const(*dictionary_)[kBootloader].asString();
 }
 void CuttlefishConfig::set_bootloader(const std::string& bootloader) {
   SetPath(kBootloader, bootloader);
@@ -427,7 +527,7 @@ void CuttlefishConfig::set_boot_slot(const std::string& boot_slot) {
   (*dictionary_)[kBootSlot] = boot_slot;
 }
 std::string CuttlefishConfig::boot_slot() const {
-  return (*dictionary_)[kBootSlot].asString();
+  return std::as_const(*dictionary_)[kBootSlot].asString();
 }
 
 static constexpr char kWebRTCCertsDir[] = "webrtc_certs_dir";
@@ -435,7 +535,7 @@ void CuttlefishConfig::set_webrtc_certs_dir(const std::string& certs_dir) {
   (*dictionary_)[kWebRTCCertsDir] = certs_dir;
 }
 std::string CuttlefishConfig::webrtc_certs_dir() const {
-  return (*dictionary_)[kWebRTCCertsDir].asString();
+  return std::as_const(*dictionary_)[kWebRTCCertsDir].asString();
 }
 
 static constexpr char kSigServerPort[] = "webrtc_sig_server_port";
@@ -443,7 +543,7 @@ void CuttlefishConfig::set_sig_server_port(int port) {
   (*dictionary_)[kSigServerPort] = port;
 }
 int CuttlefishConfig::sig_server_port() const {
-  return (*dictionary_)[kSigServerPort].asInt();
+  return std::as_const(*dictionary_)[kSigServerPort].asInt();
 }
 
 static constexpr char kWebrtcUdpPortRange[] = "webrtc_udp_port_range";
@@ -456,8 +556,8 @@ void CuttlefishConfig::set_webrtc_udp_port_range(
 }
 std::pair<uint16_t, uint16_t> CuttlefishConfig::webrtc_udp_port_range() const {
   std::pair<uint16_t, uint16_t> ret;
-  ret.first = (*dictionary_)[kWebrtcUdpPortRange][0].asInt();
-  ret.second = (*dictionary_)[kWebrtcUdpPortRange][1].asInt();
+  ret.first = std::as_const(*dictionary_)[kWebrtcUdpPortRange][0].asInt();
+  ret.second = std::as_const(*dictionary_)[kWebrtcUdpPortRange][1].asInt();
   return ret;
 }
 
@@ -471,8 +571,8 @@ void CuttlefishConfig::set_webrtc_tcp_port_range(
 }
 std::pair<uint16_t, uint16_t> CuttlefishConfig::webrtc_tcp_port_range() const {
   std::pair<uint16_t, uint16_t> ret;
-  ret.first = (*dictionary_)[kWebrtcTcpPortRange][0].asInt();
-  ret.second = (*dictionary_)[kWebrtcTcpPortRange][1].asInt();
+  ret.first = std::as_const(*dictionary_)[kWebrtcTcpPortRange][0].asInt();
+  ret.second = std::as_const(*dictionary_)[kWebrtcTcpPortRange][1].asInt();
   return ret;
 }
 
@@ -481,7 +581,7 @@ void CuttlefishConfig::set_sig_server_address(const std::string& addr) {
   (*dictionary_)[kSigServerAddress] = addr;
 }
 std::string CuttlefishConfig::sig_server_address() const {
-  return (*dictionary_)[kSigServerAddress].asString();
+  return std::as_const(*dictionary_)[kSigServerAddress].asString();
 }
 
 static constexpr char kSigServerPath[] = "webrtc_sig_server_path";
@@ -490,7 +590,7 @@ void CuttlefishConfig::set_sig_server_path(const std::string& path) {
   (*dictionary_)[kSigServerPath] = path;
 }
 std::string CuttlefishConfig::sig_server_path() const {
-  return (*dictionary_)[kSigServerPath].asString();
+  return std::as_const(*dictionary_)[kSigServerPath].asString();
 }
 
 static constexpr char kSigServerSecure[] = "webrtc_sig_server_secure";
@@ -498,7 +598,7 @@ void CuttlefishConfig::set_sig_server_secure(bool secure) {
   (*dictionary_)[kSigServerSecure] = secure;
 }
 bool CuttlefishConfig::sig_server_secure() const {
-  return (*dictionary_)[kSigServerSecure].asBool();
+  return std::as_const(*dictionary_)[kSigServerSecure].asBool();
 }
 
 static constexpr char kSigServerStrict[] = "webrtc_sig_server_strict";
@@ -506,7 +606,7 @@ void CuttlefishConfig::set_sig_server_strict(bool strict) {
   (*dictionary_)[kSigServerStrict] = strict;
 }
 bool CuttlefishConfig::sig_server_strict() const {
-  return (*dictionary_)[kSigServerStrict].asBool();
+  return std::as_const(*dictionary_)[kSigServerStrict].asBool();
 }
 
 static constexpr char kSigServerHeadersPath[] =
@@ -515,12 +615,12 @@ void CuttlefishConfig::set_sig_server_headers_path(const std::string& path) {
   SetPath(kSigServerHeadersPath, path);
 }
 std::string CuttlefishConfig::sig_server_headers_path() const {
-  return (*dictionary_)[kSigServerHeadersPath].asString();
+  return std::as_const(*dictionary_)[kSigServerHeadersPath].asString();
 }
 
 static constexpr char kRunModemSimulator[] = "enable_modem_simulator";
 bool CuttlefishConfig::enable_modem_simulator() const {
-  return (*dictionary_)[kRunModemSimulator].asBool();
+  return std::as_const(*dictionary_)[kRunModemSimulator].asBool();
 }
 void CuttlefishConfig::set_enable_modem_simulator(bool enable_modem_simulator) {
   (*dictionary_)[kRunModemSimulator] = enable_modem_simulator;
@@ -533,7 +633,7 @@ void CuttlefishConfig::set_modem_simulator_instance_number(
   (*dictionary_)[kModemSimulatorInstanceNumber] = instance_number;
 }
 int CuttlefishConfig::modem_simulator_instance_number() const {
-  return (*dictionary_)[kModemSimulatorInstanceNumber].asInt();
+  return std::as_const(*dictionary_)[kModemSimulatorInstanceNumber].asInt();
 }
 
 static constexpr char kModemSimulatorSimType[] = "modem_simulator_sim_type";
@@ -541,7 +641,7 @@ void CuttlefishConfig::set_modem_simulator_sim_type(int sim_type) {
   (*dictionary_)[kModemSimulatorSimType] = sim_type;
 }
 int CuttlefishConfig::modem_simulator_sim_type() const {
-  return (*dictionary_)[kModemSimulatorSimType].asInt();
+  return std::as_const(*dictionary_)[kModemSimulatorSimType].asInt();
 }
 
 static constexpr char kHostToolsVersion[] = "host_tools_version";
@@ -558,7 +658,7 @@ std::map<std::string, uint32_t> CuttlefishConfig::host_tools_version() const {
     return {};
   }
   std::map<std::string, uint32_t> versions;
-  const auto& elem = (*dictionary_)[kHostToolsVersion];
+  const auto& elem = std::as_const(*dictionary_)[kHostToolsVersion];
   for (auto it = elem.begin(); it != elem.end(); it++) {
     versions[it.key().asString()] = it->asUInt();
   }
@@ -570,7 +670,7 @@ void CuttlefishConfig::set_guest_enforce_security(bool guest_enforce_security) {
   (*dictionary_)[kGuestEnforceSecurity] = guest_enforce_security;
 }
 bool CuttlefishConfig::guest_enforce_security() const {
-  return (*dictionary_)[kGuestEnforceSecurity].asBool();
+  return std::as_const(*dictionary_)[kGuestEnforceSecurity].asBool();
 }
 
 static constexpr char kenableHostBluetooth[] = "enable_host_bluetooth";
@@ -578,7 +678,7 @@ void CuttlefishConfig::set_enable_host_bluetooth(bool enable_host_bluetooth) {
   (*dictionary_)[kenableHostBluetooth] = enable_host_bluetooth;
 }
 bool CuttlefishConfig::enable_host_bluetooth() const {
-  return (*dictionary_)[kenableHostBluetooth].asBool();
+  return std::as_const(*dictionary_)[kenableHostBluetooth].asBool();
 }
 
 static constexpr char kEnableMetrics[] = "enable_metrics";
@@ -598,7 +698,7 @@ void CuttlefishConfig::set_enable_metrics(std::string enable_metrics) {
   }
 }
 CuttlefishConfig::Answer CuttlefishConfig::enable_metrics() const {
-  return (CuttlefishConfig::Answer)(*dictionary_)[kEnableMetrics].asInt();
+  return (CuttlefishConfig::Answer)std::as_const(*dictionary_)[kEnableMetrics].asInt();
 }
 
 static constexpr char kMetricsBinary[] = "metrics_binary";
@@ -606,7 +706,7 @@ void CuttlefishConfig::set_metrics_binary(const std::string& metrics_binary) {
   (*dictionary_)[kMetricsBinary] = metrics_binary;
 }
 std::string CuttlefishConfig::metrics_binary() const {
-  return (*dictionary_)[kMetricsBinary].asString();
+  return std::as_const(*dictionary_)[kMetricsBinary].asString();
 }
 
 static constexpr char kExtraKernelCmdline[] = "extra_kernel_cmdline";
@@ -620,7 +720,7 @@ void CuttlefishConfig::set_extra_kernel_cmdline(
 }
 std::vector<std::string> CuttlefishConfig::extra_kernel_cmdline() const {
   std::vector<std::string> cmdline;
-  for (const Json::Value& arg : (*dictionary_)[kExtraKernelCmdline]) {
+  for (const Json::Value& arg : std::as_const(*dictionary_)[kExtraKernelCmdline]) {
     cmdline.push_back(arg.asString());
   }
   return cmdline;
@@ -637,7 +737,7 @@ void CuttlefishConfig::set_extra_bootconfig_args(
 }
 std::vector<std::string> CuttlefishConfig::extra_bootconfig_args() const {
   std::vector<std::string> bootconfig;
-  for (const Json::Value& arg : (*dictionary_)[kExtraBootconfigArgs]) {
+  for (const Json::Value& arg : std::as_const(*dictionary_)[kExtraBootconfigArgs]) {
     bootconfig.push_back(arg.asString());
   }
   return bootconfig;
@@ -648,7 +748,7 @@ void CuttlefishConfig::set_ril_dns(const std::string& ril_dns) {
   (*dictionary_)[kRilDns] = ril_dns;
 }
 std::string CuttlefishConfig::ril_dns() const {
-  return (*dictionary_)[kRilDns].asString();
+  return std::as_const(*dictionary_)[kRilDns].asString();
 }
 
 static constexpr char kKgdb[] = "kgdb";
@@ -656,12 +756,12 @@ void CuttlefishConfig::set_kgdb(bool kgdb) {
   (*dictionary_)[kKgdb] = kgdb;
 }
 bool CuttlefishConfig::kgdb() const {
-  return (*dictionary_)[kKgdb].asBool();
+  return std::as_const(*dictionary_)[kKgdb].asBool();
 }
 
 static constexpr char kEnableMinimalMode[] = "enable_minimal_mode";
 bool CuttlefishConfig::enable_minimal_mode() const {
-  return (*dictionary_)[kEnableMinimalMode].asBool();
+  return std::as_const(*dictionary_)[kEnableMinimalMode].asBool();
 }
 void CuttlefishConfig::set_enable_minimal_mode(bool enable_minimal_mode) {
   (*dictionary_)[kEnableMinimalMode] = enable_minimal_mode;
@@ -672,7 +772,7 @@ void CuttlefishConfig::set_console(bool console) {
   (*dictionary_)[kConsole] = console;
 }
 bool CuttlefishConfig::console() const {
-  return (*dictionary_)[kConsole].asBool();
+  return std::as_const(*dictionary_)[kConsole].asBool();
 }
 std::string CuttlefishConfig::console_dev() const {
   auto can_use_virtio_console = !kgdb() && !use_bootloader();
@@ -701,7 +801,40 @@ void CuttlefishConfig::set_vhost_net(bool vhost_net) {
   (*dictionary_)[kVhostNet] = vhost_net;
 }
 bool CuttlefishConfig::vhost_net() const {
-  return (*dictionary_)[kVhostNet].asBool();
+  return std::as_const(*dictionary_)[kVhostNet].asBool();
+}
+
+static constexpr char kQemuPerformanceProfile[] = "qemu_performance_profile";
+void CuttlefishConfig::set_qemu_performance_profile(
+    bool qemu_performance_profile) {
+  (*dictionary_)[kQemuPerformanceProfile] = qemu_performance_profile;
+}
+bool CuttlefishConfig::qemu_performance_profile() const {
+  return std::as_const(*dictionary_)[kQemuPerformanceProfile].asBool();
+}
+
+static constexpr char kVhostUserBlock[] = "vhost_user_block";
+void CuttlefishConfig::set_vhost_user_block(bool vhost_user_block) {
+  (*dictionary_)[kVhostUserBlock] = vhost_user_block;
+}
+bool CuttlefishConfig::vhost_user_block() const {
+  return std::as_const(*dictionary_)[kVhostUserBlock].asBool();
+}
+
+static constexpr char kVhostUserGpu[] = "vhost_user_gpu";
+void CuttlefishConfig::set_vhost_user_gpu(bool vhost_user_gpu) {
+  (*dictionary_)[kVhostUserGpu] = vhost_user_gpu;
+}
+bool CuttlefishConfig::vhost_user_gpu() const {
+  return std::as_const(*dictionary_)[kVhostUserGpu].asBool();
+}
+
+static constexpr char kVhostUserCpus[] = "vhost_user_cpus";
+void CuttlefishConfig::set_vhost_user_cpus(const std::string& cpus) {
+  (*dictionary_)[kVhostUserCpus] = cpus;
+}
+std::string CuttlefishConfig::vhost_user_cpus() const {
+  return std::as_const(*dictionary_)[kVhostUserCpus].asString();
 }
 
 static constexpr char kVhostUserMac80211Hwsim[] = "vhost_user_mac80211_hwsim";
@@ -709,7 +842,7 @@ void CuttlefishConfig::set_vhost_user_mac80211_hwsim(const std::string& path) {
   (*dictionary_)[kVhostUserMac80211Hwsim] = path;
 }
 std::string CuttlefishConfig::vhost_user_mac80211_hwsim() const {
-  return (*dictionary_)[kVhostUserMac80211Hwsim].asString();
+  return std::as_const(*dictionary_)[kVhostUserMac80211Hwsim].asString();
 }
 
 static constexpr char kWmediumdApiServerSocket[] = "wmediumd_api_server_socket";
@@ -717,12 +850,12 @@ void CuttlefishConfig::set_wmediumd_api_server_socket(const std::string& path) {
   (*dictionary_)[kWmediumdApiServerSocket] = path;
 }
 std::string CuttlefishConfig::wmediumd_api_server_socket() const {
-  return (*dictionary_)[kWmediumdApiServerSocket].asString();
+  return std::as_const(*dictionary_)[kWmediumdApiServerSocket].asString();
 }
 
 static constexpr char kApRootfsImage[] = "ap_rootfs_image";
 std::string CuttlefishConfig::ap_rootfs_image() const {
-  return (*dictionary_)[kApRootfsImage].asString();
+  return std::as_const(*dictionary_)[kApRootfsImage].asString();
 }
 void CuttlefishConfig::set_ap_rootfs_image(const std::string& ap_rootfs_image) {
   (*dictionary_)[kApRootfsImage] = ap_rootfs_image;
@@ -730,7 +863,7 @@ void CuttlefishConfig::set_ap_rootfs_image(const std::string& ap_rootfs_image) {
 
 static constexpr char kApKernelImage[] = "ap_kernel_image";
 std::string CuttlefishConfig::ap_kernel_image() const {
-  return (*dictionary_)[kApKernelImage].asString();
+  return std::as_const(*dictionary_)[kApKernelImage].asString();
 }
 void CuttlefishConfig::set_ap_kernel_image(const std::string& ap_kernel_image) {
   (*dictionary_)[kApKernelImage] = ap_kernel_image;
@@ -741,12 +874,12 @@ void CuttlefishConfig::set_wmediumd_config(const std::string& config) {
   (*dictionary_)[kWmediumdConfig] = config;
 }
 std::string CuttlefishConfig::wmediumd_config() const {
-  return (*dictionary_)[kWmediumdConfig].asString();
+  return std::as_const(*dictionary_)[kWmediumdConfig].asString();
 }
 
 static constexpr char kRootcanalHciPort[] = "rootcanal_hci_port";
 int CuttlefishConfig::rootcanal_hci_port() const {
-  return (*dictionary_)[kRootcanalHciPort].asInt();
+  return std::as_const(*dictionary_)[kRootcanalHciPort].asInt();
 }
 void CuttlefishConfig::set_rootcanal_hci_port(int rootcanal_hci_port) {
   (*dictionary_)[kRootcanalHciPort] = rootcanal_hci_port;
@@ -754,7 +887,7 @@ void CuttlefishConfig::set_rootcanal_hci_port(int rootcanal_hci_port) {
 
 static constexpr char kRootcanalLinkPort[] = "rootcanal_link_port";
 int CuttlefishConfig::rootcanal_link_port() const {
-  return (*dictionary_)[kRootcanalLinkPort].asInt();
+  return std::as_const(*dictionary_)[kRootcanalLinkPort].asInt();
 }
 void CuttlefishConfig::set_rootcanal_link_port(int rootcanal_link_port) {
   (*dictionary_)[kRootcanalLinkPort] = rootcanal_link_port;
@@ -762,7 +895,7 @@ void CuttlefishConfig::set_rootcanal_link_port(int rootcanal_link_port) {
 
 static constexpr char kRootcanalTestPort[] = "rootcanal_test_port";
 int CuttlefishConfig::rootcanal_test_port() const {
-  return (*dictionary_)[kRootcanalTestPort].asInt();
+  return std::as_const(*dictionary_)[kRootcanalTestPort].asInt();
 }
 void CuttlefishConfig::set_rootcanal_test_port(int rootcanal_test_port) {
   (*dictionary_)[kRootcanalTestPort] = rootcanal_test_port;
@@ -770,7 +903,7 @@ void CuttlefishConfig::set_rootcanal_test_port(int rootcanal_test_port) {
 
 static constexpr char kRootcanalConfigFile[] = "rootcanal_config_file";
 std::string CuttlefishConfig::rootcanal_config_file() const {
-  return (*dictionary_)[kRootcanalConfigFile].asString();
+  return std::as_const(*dictionary_)[kRootcanalConfigFile].asString();
 }
 void CuttlefishConfig::set_rootcanal_config_file(
     const std::string& rootcanal_config_file) {
@@ -781,7 +914,7 @@ void CuttlefishConfig::set_rootcanal_config_file(
 static constexpr char kRootcanalDefaultCommandsFile[] =
     "rootcanal_default_commands_file";
 std::string CuttlefishConfig::rootcanal_default_commands_file() const {
-  return (*dictionary_)[kRootcanalDefaultCommandsFile].asString();
+  return std::as_const(*dictionary_)[kRootcanalDefaultCommandsFile].asString();
 }
 void CuttlefishConfig::set_rootcanal_default_commands_file(
     const std::string& rootcanal_default_commands_file) {
@@ -789,12 +922,106 @@ void CuttlefishConfig::set_rootcanal_default_commands_file(
       DefaultHostArtifactsPath(rootcanal_default_commands_file);
 }
 
+static constexpr char kWebrtcVideoCodecs[] = "webrtc_video_codecs";
+void CuttlefishConfig::set_webrtc_video_codecs(const std::string& codecs) {
+  Json::Value codecs_json_obj(Json::arrayValue);
+  for (const auto& codec : android::base::Split(codecs, ",")) {
+    if (!codec.empty()) {
+      codecs_json_obj.append(codec);
+    }
+  }
+  (*dictionary_)[kWebrtcVideoCodecs] = codecs_json_obj;
+}
+std::vector<std::string> CuttlefishConfig::webrtc_video_codecs() const {
+  std::vector<std::string> codecs;
+  for (const Json::Value& codec : std::as_const(*dictionary_)[kWebrtcVideoCodecs]) {
+    codecs.push_back(codec.asString());
+  }
+  return codecs;
+}
+
+static constexpr char kWebrtcShareEncoders[] = "webrtc_share_encoders";
+void CuttlefishConfig::set_webrtc_share_encoders(bool share) {
+  (*dictionary_)[kWebrtcShareEncoders] = share;
+}
+bool CuttlefishConfig::webrtc_share_encoders() const {
+  return std::as_const(*dictionary_)[kWebrtcShareEncoders].asBool();
+}
+
+static constexpr char kWebrtcScreenContent[] = "webrtc_screen_content";
+void CuttlefishConfig::set_webrtc_screen_content(bool screen_content) {
+  (*dictionary_)[kWebrtcScreenContent] = screen_content;
+}
+bool CuttlefishConfig::webrtc_screen_content() const {
+  return std::as_const(*dictionary_)[kWebrtcScreenContent].asBool();
+}
+
+static constexpr char kWebrtcThumbnailIntervalMs[] =
+    "webrtc_thumbnail_interval_ms";
+void CuttlefishConfig::set_webrtc_thumbnail_interval_ms(int interval_ms) {
+  (*dictionary_)[kWebrtcThumbnailIntervalMs] = interval_ms;
+}
+int CuttlefishConfig::webrtc_thumbnail_interval_ms() const {
+  return std::as_const(*dictionary_)[kWebrtcThumbnailIntervalMs].asInt();
+}
+
+static constexpr char kWebrtcLazyStreaming[] = "webrtc_lazy_streaming";
+void CuttlefishConfig::set_webrtc_lazy_streaming(bool lazy) {
+  (*dictionary_)[kWebrtcLazyStreaming] = lazy;
+}
+bool CuttlefishConfig::webrtc_lazy_streaming() const {
+  return std::as_const(*dictionary_)[kWebrtcLazyStreaming].asBool();
+}
+
 static constexpr char kRecordScreen[] = "record_screen";
 void CuttlefishConfig::set_record_screen(bool record_screen) {
   (*dictionary_)[kRecordScreen] = record_screen;
 }
 bool CuttlefishConfig::record_screen() const {
-  return (*dictionary_)[kRecordScreen].asBool();
+  return std::as_const(*dictionary_)[kRecordScreen].asBool();
+}
+
+static constexpr char kRecordScreenSegmentSeconds[] =
+    "record_screen_segment_seconds";
+void CuttlefishConfig::set_record_screen_segment_seconds(int seconds) {
+  (*dictionary_)[kRecordScreenSegmentSeconds] = seconds;
+}
+int CuttlefishConfig::record_screen_segment_seconds() const {
+  return std::as_const(*dictionary_)[kRecordScreenSegmentSeconds].asInt();
+}
+
+static constexpr char kRecordScreenLastSeconds[] =
+    "record_screen_last_seconds";
+void CuttlefishConfig::set_record_screen_last_seconds(int seconds) {
+  (*dictionary_)[kRecordScreenLastSeconds] = seconds;
+}
+int CuttlefishConfig::record_screen_last_seconds() const {
+  return std::as_const(*dictionary_)[kRecordScreenLastSeconds].asInt();
+}
+
+static constexpr char kRecordInput[] = "record_input";
+void CuttlefishConfig::set_record_input(bool record_input) {
+  (*dictionary_)[kRecordInput] = record_input;
+}
+bool CuttlefishConfig::record_input() const {
+  return std::as_const(*dictionary_)[kRecordInput].asBool();
+}
+
+static constexpr char kRecordFrames[] = "record_frames";
+void CuttlefishConfig::set_record_frames(bool record_frames) {
+  (*dictionary_)[kRecordFrames] = record_frames;
+}
+bool CuttlefishConfig::record_frames() const {
+  return std::as_const(*dictionary_)[kRecordFrames].asBool();
+}
+
+static constexpr char kDisplayFrameKeepaliveMs[] =
+    "display_frame_keepalive_ms";
+void CuttlefishConfig::set_display_frame_keepalive_ms(int keepalive_ms) {
+  (*dictionary_)[kDisplayFrameKeepaliveMs] = keepalive_ms;
+}
+int CuttlefishConfig::display_frame_keepalive_ms() const {
+  return std::as_const(*dictionary_)[kDisplayFrameKeepaliveMs].asInt();
 }
 
 static constexpr char kSmt[] = "smt";
@@ -802,7 +1029,71 @@ void CuttlefishConfig::set_smt(bool smt) {
   (*dictionary_)[kSmt] = smt;
 }
 bool CuttlefishConfig::smt() const {
-  return (*dictionary_)[kSmt].asBool();
+  return std::as_const(*dictionary_)[kSmt].asBool();
+}
+
+static constexpr char kEnableMemoryBalloon[] = "enable_memory_balloon";
+void CuttlefishConfig::set_enable_memory_balloon(bool enable) {
+  (*dictionary_)[kEnableMemoryBalloon] = enable;
+}
+bool CuttlefishConfig::enable_memory_balloon() const {
+  return std::as_const(*dictionary_)[kEnableMemoryBalloon].asBool();
+}
+
+static constexpr char kGuestHugepages[] = "guest_hugepages";
+void CuttlefishConfig::set_guest_hugepages(const std::string& guest_hugepages) {
+  (*dictionary_)[kGuestHugepages] = guest_hugepages;
+}
+std::string CuttlefishConfig::guest_hugepages() const {
+  return std::as_const(*dictionary_)[kGuestHugepages].asString();
+}
+
+static constexpr char kDiskNumQueues[] = "disk_num_queues";
+void CuttlefishConfig::set_disk_num_queues(int num_queues) {
+  (*dictionary_)[kDiskNumQueues] = num_queues;
+}
+int CuttlefishConfig::disk_num_queues() const {
+  return std::as_const(*dictionary_)[kDiskNumQueues].asInt();
+}
+
+static constexpr char kNetNumQueues[] = "net_num_queues";
+void CuttlefishConfig::set_net_num_queues(int num_queues) {
+  (*dictionary_)[kNetNumQueues] = num_queues;
+}
+int CuttlefishConfig::net_num_queues() const {
+  return std::as_const(*dictionary_)[kNetNumQueues].asInt();
+}
+
+static constexpr char kDiskIoBackend[] = "disk_io_backend";
+void CuttlefishConfig::set_disk_io_backend(const std::string& io_backend) {
+  (*dictionary_)[kDiskIoBackend] = io_backend;
+}
+std::string CuttlefishConfig::disk_io_backend() const {
+  return std::as_const(*dictionary_)[kDiskIoBackend].asString();
+}
+
+static constexpr char kDiskDirectIo[] = "disk_direct_io";
+void CuttlefishConfig::set_disk_direct_io(bool direct_io) {
+  (*dictionary_)[kDiskDirectIo] = direct_io;
+}
+bool CuttlefishConfig::disk_direct_io() const {
+  return std::as_const(*dictionary_)[kDiskDirectIo].asBool();
+}
+
+static constexpr char kPmemSuperImage[] = "pmem_super_image";
+void CuttlefishConfig::set_pmem_super_image(bool pmem_super_image) {
+  (*dictionary_)[kPmemSuperImage] = pmem_super_image;
+}
+bool CuttlefishConfig::pmem_super_image() const {
+  return std::as_const(*dictionary_)[kPmemSuperImage].asBool();
+}
+
+static constexpr char kEnableScreenshotSocket[] = "enable_screenshot_socket";
+void CuttlefishConfig::set_enable_screenshot_socket(bool enable) {
+  (*dictionary_)[kEnableScreenshotSocket] = enable;
+}
+bool CuttlefishConfig::enable_screenshot_socket() const {
+  return std::as_const(*dictionary_)[kEnableScreenshotSocket].asBool();
 }
 
 static constexpr char kEnableAudio[] = "enable_audio";
@@ -810,7 +1101,7 @@ void CuttlefishConfig::set_enable_audio(bool enable) {
   (*dictionary_)[kEnableAudio] = enable;
 }
 bool CuttlefishConfig::enable_audio() const {
-  return (*dictionary_)[kEnableAudio].asBool();
+  return std::as_const(*dictionary_)[kEnableAudio].asBool();
 }
 
 static constexpr char kProtectedVm[] = "protected_vm";
@@ -818,7 +1109,7 @@ void CuttlefishConfig::set_protected_vm(bool protected_vm) {
   (*dictionary_)[kProtectedVm] = protected_vm;
 }
 bool CuttlefishConfig::protected_vm() const {
-  return (*dictionary_)[kProtectedVm].asBool();
+  return std::as_const(*dictionary_)[kProtectedVm].asBool();
 }
 
 static constexpr char kTargetArch[] = "target_arch";
@@ -826,12 +1117,12 @@ void CuttlefishConfig::set_target_arch(Arch target_arch) {
   (*dictionary_)[kTargetArch] = static_cast<int>(target_arch);
 }
 Arch CuttlefishConfig::target_arch() const {
-  return static_cast<Arch>((*dictionary_)[kTargetArch].asInt());
+  return static_cast<Arch>(std::as_const(*dictionary_)[kTargetArch].asInt());
 }
 
 static constexpr char kBootconfigSupported[] = "bootconfig_supported";
 bool CuttlefishConfig::bootconfig_supported() const {
-  return (*dictionary_)[kBootconfigSupported].asBool();
+  return std::as_const(*dictionary_)[kBootconfigSupported].asBool();
 }
 void CuttlefishConfig::set_bootconfig_supported(bool bootconfig_supported) {
   (*dictionary_)[kBootconfigSupported] = bootconfig_supported;
@@ -839,7 +1130,7 @@ void CuttlefishConfig::set_bootconfig_supported(bool bootconfig_supported) {
 
 static constexpr char kUserdataFormat[] = "userdata_format";
 std::string CuttlefishConfig::userdata_format() const {
-  return (*dictionary_)[kUserdataFormat].asString();
+  return std::as_const(*dictionary_)[kUserdataFormat].asString();
 }
 void CuttlefishConfig::set_userdata_format(const std::string& userdata_format) {
   auto fmt = userdata_format;
@@ -849,7 +1140,7 @@ void CuttlefishConfig::set_userdata_format(const std::string& userdata_format) {
 
 static constexpr char kApImageDevPath[] = "ap_image_dev_path";
 std::string CuttlefishConfig::ap_image_dev_path() const {
-  return (*dictionary_)[kApImageDevPath].asString();
+  return std::as_const(*dictionary_)[kApImageDevPath].asString();
 }
 void CuttlefishConfig::set_ap_image_dev_path(const std::string& dev_path) {
   (*dictionary_)[kApImageDevPath] = dev_path;
@@ -905,6 +1196,12 @@ bool CuttlefishConfig::LoadFromFile(const char* file) {
     LOG(ERROR) << "Could not get real path for file " << file;
     return false;
   }
+  // The snapshot is next to the file, not next to the link to it
+  std::string resolved_path;
+  if (android::base::Realpath(real_file_path, &resolved_path) &&
+      ReadConfigSnapshot(resolved_path, dictionary_.get())) {
+    return true;
+  }
   Json::CharReaderBuilder builder;
   std::ifstream ifs(real_file_path);
   std::string errorMessage;
@@ -915,13 +1212,22 @@ bool CuttlefishConfig::LoadFromFile(const char* file) {
   return true;
 }
 bool CuttlefishConfig::SaveToFile(const std::string& file) const {
-  std::ofstream ofs(file);
-  if (!ofs.is_open()) {
-    LOG(ERROR) << "Unable to write to file " << file;
-    return false;
+  {
+    std::ofstream ofs(file);
+    if (!ofs.is_open()) {
+      LOG(ERROR) << "Unable to write to file " << file;
+      return false;
+    }
+    ofs << *dictionary_;
+    if (ofs.fail()) {
+      return false;
+    }
+  }
+  // Loading still works from the json alone, only slower
+  if (!WriteConfigSnapshot(*dictionary_, file)) {
+    LOG(WARNING) << "Could not write a snapshot of " << file;
   }
-  ofs << *dictionary_;
-  return !ofs.fail();
+  return true;
 }
 
 std::string CuttlefishConfig::instances_dir() const {
@@ -946,6 +1252,10 @@ std::string CuttlefishConfig::os_composite_disk_path() const {
   return AssemblyPath("os_composite.img");
 }
 
+std::string CuttlefishConfig::super_pmem_path() const {
+  return AssemblyPath("super_pmem.img");
+}
+
 CuttlefishConfig::MutableInstanceSpecific CuttlefishConfig::ForInstance(int num) {
   return MutableInstanceSpecific(this, std::to_string(num));
 }
@@ -964,7 +1274,7 @@ CuttlefishConfig::InstanceSpecific CuttlefishConfig::ForDefaultInstance() const
 }
 
 std::vector<CuttlefishConfig::InstanceSpecific> CuttlefishConfig::Instances() const {
-  const auto& json = (*dictionary_)[kInstances];
+  const auto& json = std::as_const(*dictionary_)[kInstances];
   std::vector<CuttlefishConfig::InstanceSpecific> instances;
   for (const auto& name : json.getMemberNames()) {
     instances.push_back(CuttlefishConfig::InstanceSpecific(this, name));
@@ -999,7 +1309,7 @@ std::vector<std::string> CuttlefishConfig::instance_names() const {
   // Any non-stable changes must be accompanied by an uprev to the
   // cvd_server major version.
   std::vector<std::string> names;
-  for (const Json::Value& name : (*dictionary_)[kInstanceNames]) {
+  for (const Json::Value& name : std::as_const(*dictionary_)[kInstanceNames]) {
     names.push_back(name.asString());
   }
   return names;
@@ -95,6 +95,8 @@ class CuttlefishConfig {
   std::string AssemblyPath(const std::string&) const;
 
   std::string os_composite_disk_path() const;
+  // The super partition on its own disk, for virtio-pmem
+  std::string super_pmem_path() const;
 
   std::string vm_manager() const;
   void set_vm_manager(const std::string& name);
@@ -154,6 +156,11 @@ class CuttlefishConfig {
   void set_gem5_binary_dir(const std::string& gem5_binary_dir);
   std::string gem5_binary_dir() const;
 
+  // Where gem5 checkpoints of booted guests are cached, empty to always boot
+  // from scratch.
+  void set_gem5_checkpoint_dir(const std::string& gem5_checkpoint_dir);
+  std::string gem5_checkpoint_dir() const;
+
   void set_enable_sandbox(const bool enable_sandbox);
   bool enable_sandbox() const;
 
@@ -169,18 +176,84 @@ class CuttlefishConfig {
   void set_webrtc_enable_adb_websocket(bool enable);
   bool webrtc_enable_adb_websocket() const;
 
+  // The video codecs offered by the streamer, most preferred first.
+  void set_webrtc_video_codecs(const std::string& codecs);
+  std::vector<std::string> webrtc_video_codecs() const;
+
+  // Whether viewers of the same display share one encoder.
+  void set_webrtc_share_encoders(bool share);
+  bool webrtc_share_encoders() const;
+
+  // Whether the video encoders are tuned for screen content.
+  void set_webrtc_screen_content(bool screen_content);
+  bool webrtc_screen_content() const;
+
+  // How often the streamer publishes a thumbnail of the first display to the
+  // operator, 0 if it doesn't.
+  void set_webrtc_thumbnail_interval_ms(int interval_ms);
+  int webrtc_thumbnail_interval_ms() const;
+
+  // Whether the streamer leaves frame conversion and audio idle until a
+  // client connects.
+  void set_webrtc_lazy_streaming(bool lazy);
+  bool webrtc_lazy_streaming() const;
+
   void set_enable_vehicle_hal_grpc_server(bool enable_vhal_server);
   bool enable_vehicle_hal_grpc_server() const;
 
   void set_restart_subprocesses(bool restart_subprocesses);
   bool restart_subprocesses() const;
 
+  // Whether run_cvd places the host processes in cgroups to account for the
+  // resources they use.
+  void set_resource_accounting(bool resource_accounting);
+  bool resource_accounting() const;
+
+  // Whether the memory of the VMM is offered to KSM, for merging with that of
+  // other guests booted from the same images.
+  void set_guest_memory_merge(bool guest_memory_merge);
+  bool guest_memory_merge() const;
+
+  // pages_to_scan of the host's KSM while any instance with guest memory
+  // merging boots, and once all of them booted.
+  void set_ksm_boot_pages_to_scan(int pages);
+  int ksm_boot_pages_to_scan() const;
+  void set_ksm_steady_pages_to_scan(int pages);
+  int ksm_steady_pages_to_scan() const;
+
+  // Files written to the cgroup of each host process when accounting for
+  // resources, by process name, e.g. {"crosvm": {"cpu.weight": "400"}}.
+  void set_host_process_cgroups(
+      const std::map<std::string, std::map<std::string, std::string>>&
+          settings);
+  std::map<std::string, std::map<std::string, std::string>>
+  host_process_cgroups() const;
+
+  // Directory of a snapshot taken with `cvd snapshot`. When set the device
+  // resumes from the snapshot instead of booting.
+  void set_snapshot_path(const std::string& snapshot_path);
+  std::string snapshot_path() const;
+
   void set_enable_gnss_grpc_proxy(const bool enable_gnss_grpc_proxy);
   bool enable_gnss_grpc_proxy() const;
 
   void set_run_as_daemon(bool run_as_daemon);
   bool run_as_daemon() const;
 
+  // Subprocess logs go to a compact binary file, read with
+  // log_tee --print_binary_log, instead of the launcher log
+  void set_binary_subprocess_logs(bool binary_subprocess_logs);
+  bool binary_subprocess_logs() const;
+
+  // The log writers also keep their logs in an indexed store, queried with
+  // `cvd logs`
+  void set_structured_logs(bool structured_logs);
+  bool structured_logs() const;
+
+  // Received tombstones are gzipped in the background
+  void set_compress_tombstones(bool compress_tombstones);
+  bool compress_tombstones() const;
+
   void set_data_policy(const std::string& data_policy);
   std::string data_policy() const;
 
@@ -296,6 +369,22 @@ class CuttlefishConfig {
   void set_vhost_net(bool vhost_net);
   bool vhost_net() const;
 
+  // Whether qemu is launched with the settings tuned for guest performance
+  // rather than for the default device model.
+  void set_qemu_performance_profile(bool qemu_performance_profile);
+  bool qemu_performance_profile() const;
+
+  // Whether crosvm serves the disks and the GPU from vhost-user backends in
+  // processes of their own rather than from the VM process.
+  void set_vhost_user_block(bool vhost_user_block);
+  bool vhost_user_block() const;
+  void set_vhost_user_gpu(bool vhost_user_gpu);
+  bool vhost_user_gpu() const;
+  // Host cpus for the vhost-user backends in kernel cpu list format, empty to
+  // run them wherever run_cvd runs.
+  void set_vhost_user_cpus(const std::string& cpus);
+  std::string vhost_user_cpus() const;
+
   void set_vhost_user_mac80211_hwsim(const std::string& path);
   std::string vhost_user_mac80211_hwsim() const;
 
@@ -330,12 +419,65 @@ class CuttlefishConfig {
   void set_record_screen(bool record_screen);
   bool record_screen() const;
 
+  // Length of each file of the screen recording, zero for a single file.
+  void set_record_screen_segment_seconds(int seconds);
+  int record_screen_segment_seconds() const;
+
+  // Length of the screen recording kept in memory until the device stops,
+  // zero to write all of it as it's recorded.
+  void set_record_screen_last_seconds(int seconds);
+  int record_screen_last_seconds() const;
+
+  // Whether the streamer records the input it sends to the device.
+  void set_record_input(bool record_input);
+  bool record_input() const;
+
+  // Whether the streamer records the frames of the displays, to replay them
+  // into the display pipeline benchmark.
+  void set_record_frames(bool record_frames);
+  bool record_frames() const;
+
+  // Frames identical to the previous one are only streamed once every this
+  // many milliseconds. Zero streams every frame the guest produces.
+  void set_display_frame_keepalive_ms(int keepalive_ms);
+  int display_frame_keepalive_ms() const;
+
   void set_smt(bool smt);
   bool smt() const;
 
+  // Whether a host-side controller reclaims idle guest memory
+  void set_enable_memory_balloon(bool enable);
+  bool enable_memory_balloon() const;
+
+  // "none", "thp" for transparent hugepages or "hugetlb" for reserved ones
+  void set_guest_hugepages(const std::string& guest_hugepages);
+  std::string guest_hugepages() const;
+
+  // Applies to every virtio-blk disk of the instances
+  void set_disk_num_queues(int num_queues);
+  int disk_num_queues() const;
+  // Queue pairs of each virtio-net interface of the instances
+  void set_net_num_queues(int num_queues);
+  int net_num_queues() const;
+
+  // "threads", "io_uring" or "native"
+  void set_disk_io_backend(const std::string& io_backend);
+  std::string disk_io_backend() const;
+  void set_disk_direct_io(bool direct_io);
+  bool disk_direct_io() const;
+  // Whether the super partition is exposed through read-only virtio-pmem
+  // instead of the OS disk.
+  void set_pmem_super_image(bool pmem_super_image);
+  bool pmem_super_image() const;
+
   void set_enable_audio(bool enable);
   bool enable_audio() const;
 
+  // Whether the streamer serves screenshots over a local socket, see
+  // InstanceSpecific::screenshot_socket_path().
+  void set_enable_screenshot_socket(bool enable);
+  bool enable_screenshot_socket() const;
+
   void set_protected_vm(bool protected_vm);
   bool protected_vm() const;
 
@@ -408,6 +550,12 @@ class CuttlefishConfig {
     std::string adb_ip_and_port() const;
     // Port number to connect to the camera hal on the guest
     int camera_server_port() const;
+    // Cameras on consecutive ports starting at camera_server_port()
+    int camera_count() const;
+    // The host cpu of each vCPU as "<vcpu>=<cpu>:...", empty when unpinned
+    std::string cpu_affinity() const;
+    // Host NUMA node for the instance's processes and memory, -1 for any
+    int numa_node() const;
 
     std::string adb_device_name() const;
     std::string gnss_file_path() const;
@@ -437,12 +585,23 @@ class CuttlefishConfig {
     std::string switches_socket_path() const;
     std::string frames_socket_path() const;
 
+    std::string screenshot_socket_path() const;
+
+    // Where the streamer learns about displays added or removed at runtime
+    std::string display_control_socket_path() const;
+
     int confui_host_vsock_port() const;
 
     std::string access_kregistry_path() const;
 
     std::string hwcomposer_pmem_path() const;
 
+    // Camera frames shared with the guest, see camera_frame_ring.h
+    std::string camera_frames_pmem_path() const;
+
+    // Replayed input is sent to the streamer through this socket
+    std::string input_replay_socket_path() const;
+
     std::string pstore_path() const;
 
     std::string console_path() const;
@@ -463,6 +622,20 @@ class CuttlefishConfig {
 
     std::string launcher_log_path() const;
 
+    // The directory of the structured log store
+    std::string log_store_dir() const;
+
+    std::string boot_timeline_path() const;
+
+    // Link to the cached gem5 checkpoint for the instance's images and
+    // configuration, which doesn't exist until the guest first booted.
+    std::string gem5_checkpoint_path() const;
+
+    // The host processes run_cvd started, see launched_processes.h
+    std::string launched_processes_path() const;
+
+    std::string balloon_status_path() const;
+
     std::string launcher_monitor_socket_path() const;
 
     std::string sdcard_path() const;
@@ -534,6 +707,9 @@ class CuttlefishConfig {
     void set_adb_ip_and_port(const std::string& ip_port);
     void set_confui_host_vsock_port(int confui_host_port);
     void set_camera_server_port(int camera_server_port);
+    void set_camera_count(int camera_count);
+    void set_cpu_affinity(const std::string& cpu_affinity);
+    void set_numa_node(int numa_node);
     void set_mobile_bridge_name(const std::string& mobile_bridge_name);
     void set_mobile_tap_name(const std::string& mobile_tap_name);
     void set_wifi_tap_name(const std::string& wifi_tap_name);
@@ -16,6 +16,8 @@
 
 #include "host/libs/config/cuttlefish_config.h"
 
+#include <utility>
+
 #include <android-base/logging.h>
 #include <json/json.h>
 
@@ -43,7 +45,7 @@ Json::Value* CuttlefishConfig::MutableInstanceSpecific::Dictionary() {
 }
 
 const Json::Value* CuttlefishConfig::InstanceSpecific::Dictionary() const {
-  return &(*config_->dictionary_)[kInstances][id_];
+  return &std::as_const(*config_->dictionary_)[kInstances][id_];
 }
 
 std::string CuttlefishConfig::InstanceSpecific::instance_dir() const {
@@ -140,6 +142,16 @@ std::string CuttlefishConfig::InstanceSpecific::hwcomposer_pmem_path() const {
   return AbsolutePath(PerInstancePath("hwcomposer-pmem"));
 }
 
+std::string CuttlefishConfig::InstanceSpecific::camera_frames_pmem_path()
+    const {
+  return AbsolutePath(PerInstancePath("camera-frames-pmem"));
+}
+
+std::string CuttlefishConfig::InstanceSpecific::input_replay_socket_path()
+    const {
+  return AbsolutePath(PerInstanceInternalPath("input_replay.sock"));
+}
+
 std::string CuttlefishConfig::InstanceSpecific::pstore_path() const {
   return AbsolutePath(PerInstancePath("pstore"));
 }
@@ -170,6 +182,27 @@ std::string CuttlefishConfig::InstanceSpecific::launcher_log_path() const {
   return AbsolutePath(PerInstanceLogPath("launcher.log"));
 }
 
+std::string CuttlefishConfig::InstanceSpecific::log_store_dir() const {
+  return AbsolutePath(PerInstanceLogPath("store"));
+}
+
+std::string CuttlefishConfig::InstanceSpecific::boot_timeline_path() const {
+  return AbsolutePath(PerInstancePath("boot_timeline.json"));
+}
+
+std::string CuttlefishConfig::InstanceSpecific::gem5_checkpoint_path() const {
+  return AbsolutePath(PerInstancePath("gem5_checkpoint"));
+}
+
+std::string CuttlefishConfig::InstanceSpecific::launched_processes_path()
+    const {
+  return AbsolutePath(PerInstanceInternalPath("launched_processes.json"));
+}
+
+std::string CuttlefishConfig::InstanceSpecific::balloon_status_path() const {
+  return AbsolutePath(PerInstanceInternalPath("balloon_status.json"));
+}
+
 std::string CuttlefishConfig::InstanceSpecific::sdcard_path() const {
   return AbsolutePath(PerInstancePath("sdcard.img"));
 }
@@ -374,6 +407,33 @@ void CuttlefishConfig::MutableInstanceSpecific::set_camera_server_port(
   (*Dictionary())[kCameraServerPort] = camera_server_port;
 }
 
+static constexpr char kCameraCount[] = "camera_count";
+int CuttlefishConfig::InstanceSpecific::camera_count() const {
+  return (*Dictionary())[kCameraCount].asInt();
+}
+void CuttlefishConfig::MutableInstanceSpecific::set_camera_count(
+    int camera_count) {
+  (*Dictionary())[kCameraCount] = camera_count;
+}
+
+static constexpr char kCpuAffinity[] = "cpu_affinity";
+std::string CuttlefishConfig::InstanceSpecific::cpu_affinity() const {
+  return (*Dictionary())[kCpuAffinity].asString();
+}
+void CuttlefishConfig::MutableInstanceSpecific::set_cpu_affinity(
+    const std::string& cpu_affinity) {
+  (*Dictionary())[kCpuAffinity] = cpu_affinity;
+}
+
+static constexpr char kNumaNode[] = "numa_node";
+int CuttlefishConfig::InstanceSpecific::numa_node() const {
+  auto& value = (*Dictionary())[kNumaNode];
+  return value.isInt() ? value.asInt() : -1;
+}
+void CuttlefishConfig::MutableInstanceSpecific::set_numa_node(int numa_node) {
+  (*Dictionary())[kNumaNode] = numa_node;
+}
+
 static constexpr char kWebrtcDeviceId[] = "webrtc_device_id";
 void CuttlefishConfig::MutableInstanceSpecific::set_webrtc_device_id(
     const std::string& id) {
@@ -443,6 +503,16 @@ std::string CuttlefishConfig::InstanceSpecific::frames_socket_path() const {
   return PerInstanceInternalPath("frames.sock");
 }
 
+std::string CuttlefishConfig::InstanceSpecific::screenshot_socket_path()
+    const {
+  return PerInstanceInternalPath("screenshot.sock");
+}
+
+std::string CuttlefishConfig::InstanceSpecific::display_control_socket_path()
+    const {
+  return PerInstanceInternalPath("display_control.sock");
+}
+
 static constexpr char kWifiMacPrefix[] = "wifi_mac_prefix";
 int CuttlefishConfig::InstanceSpecific::wifi_mac_prefix() const {
   return (*Dictionary())[kWifiMacPrefix].asInt();
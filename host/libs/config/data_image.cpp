@@ -1,11 +1,24 @@
 #include "host/libs/config/data_image.h"
 
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <mutex>
+#include <vector>
+
+#include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/result.h>
+#include <android-base/unique_fd.h>
 
 #include "blkid.h"
 
 #include "common/libs/fs/shared_buf.h"
+#include "common/libs/utils/environment.h"
 #include "common/libs/utils/files.h"
 #include "common/libs/utils/result.h"
 #include "common/libs/utils/subprocess.h"
@@ -133,12 +146,9 @@ bool ResizeImage(const CuttlefishConfig& config, const std::string& data_image,
   }
   return true;
 }
-} // namespace
-
-bool CreateBlankImage(
-    const std::string& image, int num_mb, const std::string& image_fmt) {
-  LOG(DEBUG) << "Creating " << image;
 
+bool FormatBlankImage(const std::string& image, int num_mb,
+                      const std::string& image_fmt) {
   off_t image_size_bytes = static_cast<off_t>(num_mb) << 20;
   // The newfs_msdos tool with the mandatory -C option will do the same
   // as below to zero the image file, so we don't need to do it here
@@ -192,6 +202,102 @@ bool CreateBlankImage(
   return true;
 }
 
+// Formatting gives the same result every time, so it's done once per host for
+// each format and size and the images are copied from these templates.
+Result<std::string> BlankImageTemplate(int num_mb,
+                                       const std::string& image_fmt) {
+  // Instances set up in parallel would otherwise all format the same template
+  static std::mutex mutex;
+  std::lock_guard lock(mutex);
+  auto cache_dir =
+      StringFromEnv("XDG_CACHE_HOME", StringFromEnv("HOME", ".") + "/.cache");
+  auto template_dir = cache_dir + "/cuttlefish/blank_images";
+  CF_EXPECT(EnsureDirectoryExists(template_dir));
+  auto template_path =
+      template_dir + "/" + image_fmt + "_" + std::to_string(num_mb) + "M.img";
+  if (FileExists(template_path)) {
+    return template_path;
+  }
+  // Concurrent launches may be creating the same template
+  auto tmp_path = template_path + "." + std::to_string(getpid()) + ".tmp";
+  if (!FormatBlankImage(tmp_path, num_mb, image_fmt)) {
+    RemoveFile(tmp_path);
+    return CF_ERR("Failed to format \"" << tmp_path << "\"");
+  }
+  CF_EXPECT(RenameFile(tmp_path, template_path),
+            "Failed to move \"" << tmp_path << "\" to \"" << template_path
+                                 << "\"");
+  return template_path;
+}
+
+} // namespace
+
+bool CopyImageFile(const std::string& from, const std::string& to) {
+  android::base::unique_fd in(open(from.c_str(), O_RDONLY | O_CLOEXEC));
+  android::base::unique_fd out(
+      open(to.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0666));
+  if (in < 0 || out < 0) {
+    PLOG(ERROR) << "Failed to open \"" << from << "\" or \"" << to << "\"";
+    return false;
+  }
+  if (ioctl(out.get(), FICLONE, in.get()) == 0) {
+    return true;
+  }
+  off_t size = FileSize(from);
+  if (ftruncate(out.get(), size) != 0) {
+    PLOG(ERROR) << "Failed to resize \"" << to << "\"";
+    return false;
+  }
+  std::vector<char> buffer(1 << 20);
+  off_t position = 0;
+  while (position < size) {
+    off_t data = lseek(in.get(), position, SEEK_DATA);
+    if (data < 0 && errno == ENXIO) {
+      // Only a hole left
+      break;
+    }
+    off_t hole = size;
+    if (data < 0) {
+      // No hole detection, copy the rest
+      data = position;
+    } else {
+      hole = lseek(in.get(), data, SEEK_HOLE);
+      hole = hole < 0 ? size : std::min(hole, size);
+    }
+    while (data < hole) {
+      auto read = pread(in.get(), buffer.data(),
+                        std::min<off_t>(buffer.size(), hole - data), data);
+      if (read <= 0 || !android::base::WriteFullyAtOffset(
+                           out.get(), buffer.data(), read, data)) {
+        PLOG(ERROR) << "Failed to copy \"" << from << "\" to \"" << to
+                    << "\"";
+        return false;
+      }
+      data += read;
+    }
+    position = hole;
+  }
+  return true;
+}
+
+bool CreateBlankImage(
+    const std::string& image, int num_mb, const std::string& image_fmt) {
+  LOG(DEBUG) << "Creating " << image;
+
+  if (image_fmt != "ext4" && image_fmt != "f2fs" && image_fmt != "sdcard") {
+    // Nothing to gain from a template
+    return FormatBlankImage(image, num_mb, image_fmt);
+  }
+  auto template_path = BlankImageTemplate(num_mb, image_fmt);
+  if (!template_path.ok()) {
+    LOG(WARNING) << "Formatting " << image << " directly, no template: "
+                 << template_path.error();
+    return FormatBlankImage(image, num_mb, image_fmt);
+  }
+  LOG(DEBUG) << "Copying " << *template_path << " to " << image;
+  return CopyImageFile(*template_path, image);
+}
+
 std::string GetFsType(const std::string& path) {
   std::string fs_type;
   blkid_cache cache;
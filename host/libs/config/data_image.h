@@ -34,6 +34,10 @@ fruit::Component<fruit::Required<const CuttlefishConfig>,
 bool CreateBlankImage(
     const std::string& image, int num_mb, const std::string& image_fmt);
 
+// Shares the blocks of `from` when the filesystem supports reflinks, otherwise
+// leaves its holes unwritten in `to`.
+bool CopyImageFile(const std::string& from, const std::string& to);
+
 class MiscImagePath {
  public:
   virtual ~MiscImagePath() = default;
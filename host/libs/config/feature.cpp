@@ -16,9 +16,19 @@
 
 #include "host/libs/config/feature.h"
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "common/libs/utils/result.h"
+#include "common/libs/utils/tracing.h"
 
 namespace cuttlefish {
 
@@ -54,11 +64,128 @@ bool SetupFeature::Setup() {
   // TODO(b/189153501): This can potentially be parallelized.
   for (auto& feature : ordered_features) {
     LOG(DEBUG) << "Running setup for " << feature->Name();
+    CF_TRACE_DETAIL("setup_feature", feature->Name());
     CF_EXPECT(feature->ResultSetup(), "Setup failed for " << feature->Name());
   }
   return {};
 }
 
+/* static */ Result<void> SetupFeature::RunSetupInParallel(
+    const std::vector<SetupFeature*>& features,
+    const std::unordered_map<SetupFeature*, std::vector<BootTimeline*>>&
+        timelines) {
+  std::unordered_set<SetupFeature*> enabled;
+  for (const auto& feature : features) {
+    CF_EXPECT(feature != nullptr, "Received null feature");
+    if (feature->Enabled()) {
+      enabled.insert(feature);
+    }
+  }
+  // Still visit in order first to report dependency issues before any setup.
+  std::unordered_map<SetupFeature*, std::size_t> pending_dependencies;
+  std::unordered_map<SetupFeature*, std::vector<SetupFeature*>> dependents;
+  std::deque<SetupFeature*> ready;
+  auto add_feature = [&](SetupFeature* feature) -> bool {
+    auto dependencies = feature->Dependencies();
+    pending_dependencies[feature] = dependencies.size();
+    for (const auto& dependency : dependencies) {
+      dependents[dependency].push_back(feature);
+    }
+    if (dependencies.empty()) {
+      ready.push_back(feature);
+    }
+    return true;
+  };
+  CF_EXPECT(Feature<SetupFeature>::TopologicalVisit(enabled, add_feature),
+            "Dependency issue detected, not performing any setup.");
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::size_t remaining = enabled.size();
+  SetupFeature* failed_feature = nullptr;
+  Result<void> failure;
+  struct Timing {
+    BootTimeline::Clock::time_point start;
+    BootTimeline::Clock::time_point end;
+    SetupFeature* feature;
+  };
+  std::vector<Timing> timings;
+
+  auto worker = [&]() {
+    std::unique_lock lock(mutex);
+    for (;;) {
+      changed.wait(lock, [&]() {
+        return !ready.empty() || remaining == 0 || failed_feature != nullptr;
+      });
+      if (remaining == 0 || failed_feature != nullptr) {
+        return;
+      }
+      auto feature = ready.front();
+      ready.pop_front();
+      lock.unlock();
+
+      LOG(DEBUG) << "Running setup for " << feature->Name();
+      auto start = BootTimeline::Clock::now();
+      Result<void> result;
+      {
+        CF_TRACE_DETAIL("setup_feature", feature->Name());
+        result = feature->ResultSetup();
+      }
+      auto end = BootTimeline::Clock::now();
+
+      lock.lock();
+      remaining--;
+      timings.emplace_back(Timing{start, end, feature});
+      if (!result.ok()) {
+        if (failed_feature == nullptr) {
+          failed_feature = feature;
+          failure = std::move(result);
+        }
+      } else {
+        for (const auto& dependent : dependents[feature]) {
+          if (--pending_dependencies[dependent] == 0) {
+            ready.push_back(dependent);
+          }
+        }
+      }
+      changed.notify_all();
+    }
+  };
+  std::size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+  num_threads = std::min(num_threads, std::max<std::size_t>(enabled.size(), 1));
+  std::vector<std::thread> threads;
+  for (std::size_t i = 0; i < num_threads; i++) {
+    threads.emplace_back(worker);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  std::sort(timings.begin(), timings.end(), [](const auto& a, const auto& b) {
+    return a.end - a.start > b.end - b.start;
+  });
+  for (const auto& timing : timings) {
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  timing.end - timing.start)
+                  .count();
+    LOG(DEBUG) << "Setup for " << timing.feature->Name() << " took " << ms
+               << " ms";
+    auto feature_timelines = timelines.find(timing.feature);
+    if (feature_timelines == timelines.end()) {
+      continue;
+    }
+    for (const auto& timeline : feature_timelines->second) {
+      timeline->AddSpan("assemble", timing.feature->Name(), timing.start,
+                        timing.end);
+    }
+  }
+
+  if (failed_feature != nullptr) {
+    CF_EXPECT(std::move(failure), "Setup failed for " << failed_feature->Name());
+  }
+  return {};
+}
+
 Result<void> FlagFeature::ProcessFlags(
     const std::vector<FlagFeature*>& features,
     std::vector<std::string>& flags) {
@@ -15,6 +15,7 @@
  */
 #pragma once
 
+#include <functional>
 #include <ostream>
 #include <string>
 #include <unordered_map>
@@ -24,6 +25,7 @@
 #include <android-base/logging.h>
 
 #include "common/libs/utils/result.h"
+#include "host/libs/config/boot_timeline.h"
 
 namespace cuttlefish {
 
@@ -38,7 +40,7 @@ class Feature {
       const std::unordered_set<Subclass*>& features,
       const std::function<bool(Subclass*)>& callback);
 
- private:
+ protected:
   virtual std::unordered_set<Subclass*> Dependencies() const = 0;
 };
 
@@ -47,6 +49,14 @@ class SetupFeature : public virtual Feature<SetupFeature> {
   virtual ~SetupFeature();
 
   static Result<void> RunSetup(const std::vector<SetupFeature*>& features);
+  // Runs each feature as soon as its dependencies are done, on as many threads
+  // as the host has cores. Only for features without unlisted dependencies on
+  // each other. Logs how long each feature took, and adds it to the
+  // `timelines` of the feature.
+  static Result<void> RunSetupInParallel(
+      const std::vector<SetupFeature*>& features,
+      const std::unordered_map<SetupFeature*, std::vector<BootTimeline*>>&
+          timelines = {});
 
   virtual bool Enabled() const = 0;
 
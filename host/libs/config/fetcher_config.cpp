@@ -37,6 +37,8 @@ const char* kCvdFiles = "cvd_files";
 const char* kCvdFileSource = "source";
 const char* kCvdFileBuildId = "build_id";
 const char* kCvdFileBuildTarget = "build_target";
+const char* kCvdFileDeferredArtifact = "deferred_artifact";
+const char* kFetcherBinary = "fetcher_binary";
 
 FileSource SourceStringToEnum(std::string source) {
   for (auto& c : source) {
@@ -88,7 +90,11 @@ std::ostream& operator<<(std::ostream& os, const CvdFile& cvd_file) {
   os << "source = " << SourceEnumToString(cvd_file.source) << ", ";
   os << "build_id = " << cvd_file.build_id << ", ";
   os << "build_target = " << cvd_file.build_target << ", ";
-  os << "file_path = " << cvd_file.file_path << ")";
+  os << "file_path = " << cvd_file.file_path;
+  if (!cvd_file.deferred_artifact.empty()) {
+    os << ", deferred_artifact = " << cvd_file.deferred_artifact;
+  }
+  os << ")";
   return os;
 }
 
@@ -145,6 +151,25 @@ void FetcherConfig::RecordFlags() {
   (*dictionary_)[kFlags] = flags_json;
 }
 
+std::string FetcherConfig::RecordedFlag(const std::string& name) const {
+  const Json::Value& dictionary = *dictionary_;
+  for (const auto& flag : dictionary[kFlags]) {
+    if (flag["name"].asString() == name) {
+      return flag["current_value"].asString();
+    }
+  }
+  return "";
+}
+
+void FetcherConfig::set_fetcher_binary(const std::string& path) {
+  (*dictionary_)[kFetcherBinary] = path;
+}
+
+std::string FetcherConfig::fetcher_binary() const {
+  const Json::Value& dictionary = *dictionary_;
+  return dictionary[kFetcherBinary].asString();
+}
+
 namespace {
 
 CvdFile JsonToCvdFile(const std::string& file_path, const Json::Value& json) {
@@ -161,6 +186,9 @@ CvdFile JsonToCvdFile(const std::string& file_path, const Json::Value& json) {
   if (json.isMember(kCvdFileBuildTarget)) {
     cvd_file.build_target = json[kCvdFileBuildTarget].asString();
   }
+  if (json.isMember(kCvdFileDeferredArtifact)) {
+    cvd_file.deferred_artifact = json[kCvdFileDeferredArtifact].asString();
+  }
   return cvd_file;
 }
 
@@ -169,6 +197,9 @@ Json::Value CvdFileToJson(const CvdFile& cvd_file) {
   json[kCvdFileSource] = SourceEnumToString(cvd_file.source);
   json[kCvdFileBuildId] = cvd_file.build_id;
   json[kCvdFileBuildTarget] = cvd_file.build_target;
+  if (!cvd_file.deferred_artifact.empty()) {
+    json[kCvdFileDeferredArtifact] = cvd_file.deferred_artifact;
+  }
   return json;
 }
 
@@ -45,6 +45,9 @@ struct CvdFile {
   std::string build_id;
   std::string build_target;
   std::string file_path;
+  // Build artifact to download the file from on first use, when fetch_cvd
+  // was asked to defer it. Kept once downloaded, builds don't change.
+  std::string deferred_artifact;
 
   CvdFile();
   CvdFile(const FileSource& source, const std::string& build_id,
@@ -76,6 +79,13 @@ public:
 
   // For debugging only, not intended for programmatic access.
   void RecordFlags();
+  // The exception, fetch_cvd downloads the deferred files with the
+  // credentials the first fetch had.
+  std::string RecordedFlag(const std::string& name) const;
+
+  // fetch_cvd binary to run with --fetch_deferred for the deferred files
+  void set_fetcher_binary(const std::string& path);
+  std::string fetcher_binary() const;
 
   bool add_cvd_file(const CvdFile& file, bool override_entry = false);
   std::map<std::string, CvdFile> get_cvd_files() const;
@@ -24,6 +24,10 @@ std::string AdbConnectorBinary() {
   return HostBinaryPath("adb_connector");
 }
 
+std::string BalloonControllerBinary() {
+  return HostBinaryPath("balloon_controller");
+}
+
 std::string ConfigServerBinary() {
   return HostBinaryPath("config_server");
 }
@@ -36,12 +40,12 @@ std::string GnssGrpcProxyBinary() {
   return HostBinaryPath("gnss_grpc_proxy");
 }
 
-std::string KernelLogMonitorBinary() {
-  return HostBinaryPath("kernel_log_monitor");
+std::string GuestDiagnosticsReceiverBinary() {
+  return HostBinaryPath("guest_diagnostics_receiver");
 }
 
-std::string LogcatReceiverBinary() {
-  return HostBinaryPath("logcat_receiver");
+std::string KernelLogMonitorBinary() {
+  return HostBinaryPath("kernel_log_monitor");
 }
 
 std::string MetricsBinary() {
@@ -60,10 +64,6 @@ std::string SocketVsockProxyBinary() {
   return HostBinaryPath("socket_vsock_proxy");
 }
 
-std::string TombstoneReceiverBinary() {
-  return HostBinaryPath("tombstone_receiver");
-}
-
 std::string VehicleHalGrpcServerBinary() {
   return HostBinaryPath(
       "android.hardware.automotive.vehicle@2.0-virtualization-grpc-server");
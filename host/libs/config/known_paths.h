@@ -20,16 +20,16 @@
 namespace cuttlefish {
 
 std::string AdbConnectorBinary();
+std::string BalloonControllerBinary();
 std::string ConfigServerBinary();
 std::string ConsoleForwarderBinary();
 std::string GnssGrpcProxyBinary();
+std::string GuestDiagnosticsReceiverBinary();
 std::string KernelLogMonitorBinary();
-std::string LogcatReceiverBinary();
 std::string MetricsBinary();
 std::string ModemSimulatorBinary();
 std::string RootCanalBinary();
 std::string SocketVsockProxyBinary();
-std::string TombstoneReceiverBinary();
 std::string VehicleHalGrpcServerBinary();
 std::string WebRtcBinary();
 std::string WebRtcSigServerBinary();
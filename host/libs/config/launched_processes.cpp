@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/config/launched_processes.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+#include <json/json.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+
+std::optional<std::uint64_t> ProcessStartTime(pid_t pid) {
+  auto stat = ReadFile("/proc/" + std::to_string(pid) + "/stat");
+  // The process name comes second and may contain spaces
+  auto name_end = stat.rfind(')');
+  if (name_end == std::string::npos || name_end + 2 > stat.size()) {
+    return {};
+  }
+  auto fields = android::base::Split(stat.substr(name_end + 2), " ");
+  // starttime, the 22nd field of the whole line
+  std::uint64_t start_time = 0;
+  if (fields.size() <= 19 ||
+      !android::base::ParseUint(fields[19], &start_time)) {
+    return {};
+  }
+  return start_time;
+}
+
+bool IsRunning(const LaunchedProcess& process) {
+  return process.pid > 0 && ProcessStartTime(process.pid) == process.start_time;
+}
+
+Result<void> WriteLaunchedProcesses(
+    const std::string& path, const std::vector<LaunchedProcess>& processes) {
+  Json::Value json(Json::arrayValue);
+  for (const auto& process : processes) {
+    Json::Value process_json;
+    process_json["name"] = process.name;
+    process_json["pid"] = process.pid;
+    process_json["start_time"] = Json::UInt64(process.start_time);
+    process_json["group_leader"] = process.group_leader;
+    json.append(process_json);
+  }
+  auto serialized = json.toStyledString();
+
+  auto temp_path = path + ".tmp";
+  auto file = SharedFD::Creat(temp_path, 0644);
+  CF_EXPECT(file->IsOpen(),
+            "Could not create " << temp_path << ": " << file->StrError());
+  CF_EXPECT(WriteAll(file, serialized) == (ssize_t)serialized.size(),
+            "Could not write " << temp_path << ": " << file->StrError());
+  file->Close();
+  CF_EXPECT(RenameFile(temp_path, path),
+            "Could not rename " << temp_path << " to " << path);
+  return {};
+}
+
+Result<std::vector<LaunchedProcess>> ReadLaunchedProcesses(
+    const std::string& path) {
+  CF_EXPECT(FileExists(path), path << " does not exist");
+  auto serialized = ReadFile(path);
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  Json::Value json;
+  std::string errors;
+  CF_EXPECT(reader->parse(serialized.data(),
+                          serialized.data() + serialized.size(), &json,
+                          &errors),
+            "Could not parse " << path << ": " << errors);
+  CF_EXPECT(json.isArray(), path << " does not hold a list");
+  std::vector<LaunchedProcess> processes;
+  for (const auto& process_json : json) {
+    processes.push_back(LaunchedProcess{
+        .name = process_json["name"].asString(),
+        .pid = process_json["pid"].asInt(),
+        .start_time = process_json["start_time"].asUInt64(),
+        .group_leader = process_json["group_leader"].asBool(),
+    });
+  }
+  return processes;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+// A host process of an instance, recorded by run_cvd so that stop_cvd can
+// stop the instance when the launcher doesn't respond.
+struct LaunchedProcess {
+  std::string name;
+  pid_t pid = -1;
+  // Tells the process apart from a later one that reuses its pid
+  std::uint64_t start_time = 0;
+  // The process leads a process group holding its descendants
+  bool group_leader = false;
+};
+
+// When the process started, in clock ticks since boot
+std::optional<std::uint64_t> ProcessStartTime(pid_t pid);
+
+// Whether `process` is still running, and is not a reused pid
+bool IsRunning(const LaunchedProcess& process);
+
+// Replaces the record atomically, so readers never see a partial one
+Result<void> WriteLaunchedProcesses(const std::string& path,
+                                    const std::vector<LaunchedProcess>&);
+Result<std::vector<LaunchedProcess>> ReadLaunchedProcesses(
+    const std::string& path);
+
+}  // namespace cuttlefish
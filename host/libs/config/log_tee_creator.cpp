@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/config/log_tee_creator.h"
+
+#include <android-base/logging.h>
+
+#include "host/libs/config/cuttlefish_config.h"
+
+namespace cuttlefish {
+
+LogTeeCreator::LogTeeCreator(const CuttlefishConfig& config,
+                             const CuttlefishConfig::InstanceSpecific& instance)
+    : config_(config), instance_(instance) {}
+
+void LogTeeCreator::CreateLogTee(Command& cmd,
+                                 const std::string& process_name) {
+  auto logs = LogFifo(process_name);
+  cmd.RedirectStdIO(Subprocess::StdIOChannel::kStdOut, logs);
+  cmd.RedirectStdIO(Subprocess::StdIOChannel::kStdErr, logs);
+}
+
+SharedFD LogTeeCreator::LogFifo(const std::string& process_name) {
+  auto logs = SharedFD::Fifo(LogFifoPath(process_name), 0666);
+  if (!logs->IsOpen()) {
+    LOG(FATAL) << "Failed to create fifo for " << process_name
+               << " output: " << logs->StrError();
+  }
+  fifos_.push_back(Fifo{process_name, logs});
+  return logs;
+}
+
+std::string LogTeeCreator::LogFifoPath(const std::string& process_name) const {
+  auto name_with_ext = process_name + "_logs.fifo";
+  return instance_.PerInstanceInternalPath(name_with_ext.c_str());
+}
+
+Command LogTeeCreator::AggregatorCommand() const {
+  // The command keeps its own references to the fifos, so the aggregator gets
+  // them back when it is restarted
+  Command log_tee(HostBinaryPath("log_tee"));
+  log_tee.AddParameter("--log_fds_in=");
+  for (std::size_t i = 0; i < fifos_.size(); i++) {
+    log_tee.AppendToLastParameter(i == 0 ? "" : ",", fifos_[i].process_name,
+                                  ":", fifos_[i].fd);
+  }
+  if (config_.binary_subprocess_logs()) {
+    log_tee.AddParameter("--binary_log=",
+                         instance_.PerInstanceLogPath("subprocess_logs.bin"));
+  }
+  return log_tee;
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <fruit/fruit.h>
+
+#include <string>
+#include <vector>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/subprocess.h"
+#include "host/libs/config/cuttlefish_config.h"
+
+namespace cuttlefish {
+
+// Routes the output of the instance's subprocesses through fifos into a single
+// log_tee process, instead of one log_tee per subprocess.
+class LogTeeCreator {
+ public:
+  INJECT(LogTeeCreator(const CuttlefishConfig& config,
+                       const CuttlefishConfig::InstanceSpecific& instance));
+
+  // Sends the command's stdout and stderr to the launcher log
+  void CreateLogTee(Command& cmd, const std::string& process_name);
+
+  // A fifo whose contents go to the launcher log, credited to process_name
+  SharedFD LogFifo(const std::string& process_name);
+  std::string LogFifoPath(const std::string& process_name) const;
+
+  // The log_tee reading every fifo created so far. Build it after all the
+  // other commands, it must start before them.
+  Command AggregatorCommand() const;
+
+ private:
+  struct Fifo {
+    std::string process_name;
+    SharedFD fd;
+  };
+
+  const CuttlefishConfig& config_;
+  const CuttlefishConfig::InstanceSpecific& instance_;
+  std::vector<Fifo> fifos_;
+};
+
+}  // namespace cuttlefish
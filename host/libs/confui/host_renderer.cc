@@ -16,21 +16,36 @@
 
 #include "host/libs/confui/host_renderer.h"
 
+#include <map>
+#include <mutex>
+
 #include "host/libs/config/cuttlefish_config.h"
 
 namespace cuttlefish {
 namespace confui {
-static teeui::Color alfaCombineChannel(std::uint32_t shift, double alfa,
-                                       teeui::Color a, teeui::Color b) {
-  a >>= shift;
-  a &= 0xff;
-  b >>= shift;
-  b &= 0xff;
-  double acc = alfa * a + (1 - alfa) * b;
-  if (acc <= 0) return 0;
-  std::uint32_t result = acc;
-  if (result > 255) return 255 << shift;
-  return result << shift;
+/**
+ * alpha-blends color over pixel, the alpha byte of the result being 0
+ *
+ * The red and blue channels are blended together in the two 16 bit lanes of
+ * one 32 bit integer, so this is 2 multiplications per channel pair with no
+ * floating point. (x + 1 + (x >> 8)) >> 8 is x / 255 for x <= 255 * 255.
+ */
+static teeui::Color AlfaCombine(teeui::Color color, teeui::Color pixel) {
+  const std::uint32_t alfa = color >> 24;
+  if (alfa == 0xff) {
+    return color & 0x00ffffff;
+  }
+  if (alfa == 0) {
+    return pixel & 0x00ffffff;
+  }
+  const std::uint32_t inv_alfa = 0xff - alfa;
+  std::uint32_t rb =
+      (color & 0x00ff00ff) * alfa + (pixel & 0x00ff00ff) * inv_alfa;
+  std::uint32_t g =
+      ((color >> 8) & 0xff) * alfa + ((pixel >> 8) & 0xff) * inv_alfa;
+  rb = ((rb + 0x00010001 + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+  g = (g + 1 + (g >> 8)) >> 8;
+  return rb | (g << 8);
 }
 
 std::unique_ptr<ConfUiRenderer> ConfUiRenderer::GenerateRenderer(
@@ -175,11 +190,8 @@ teeui::Error ConfUiRenderer::UpdatePixels(TeeUiFrameWrapper& raw_frame,
     ConfUiLog(ERROR) << "Rendering Out of Bound";
     return teeui::Error::OutOfBoundsDrawing;
   }
-  const double alfa = ((color & 0xff000000) >> 24) / 255.0;
   auto& pixel = *reinterpret_cast<teeui::Color*>(buffer + pos);
-  pixel = alfaCombineChannel(0, alfa, color, pixel) |
-          alfaCombineChannel(8, alfa, color, pixel) |
-          alfaCombineChannel(16, alfa, color, pixel);
+  pixel = AlfaCombine(color, pixel);
   return teeui::Error::OK;
 }
 
@@ -221,6 +233,52 @@ std::shared_ptr<TeeUiFrameWrapper> ConfUiRenderer::RenderRawFrame() {
 
 std::unique_ptr<TeeUiFrameWrapper> ConfUiRenderer::RepaintRawFrame(
     const int w, const int h) {
+  auto static_layer = GetStaticLayer(w, h);
+  if (!static_layer) {
+    return nullptr;
+  }
+  // only the confirmation message differs from the static layer
+  auto new_raw_frame = std::make_unique<TeeUiFrameWrapper>(*static_layer);
+  auto draw_pixel = teeui::makePixelDrawer(
+      [this, &new_raw_frame](std::uint32_t x, std::uint32_t y,
+                             teeui::Color color) -> teeui::Error {
+        return this->UpdatePixels(*new_raw_frame, x, y, color);
+      });
+  const auto error = std::get<LabelConfMsg>(layout_).draw(draw_pixel);
+  if (error) {
+    ConfUiLog(ERROR) << "Painting failed: " << error.code();
+    return nullptr;
+  }
+
+  return new_raw_frame;
+}
+
+std::shared_ptr<const TeeUiFrameWrapper> ConfUiRenderer::GetStaticLayer(
+    const int w, const int h) {
+  using Key = std::tuple<std::string, int, int, int, bool, bool>;
+  static constexpr std::size_t kMaxCachedLayers = 8;
+  static std::mutex cache_mutex;
+  static std::map<Key, std::shared_ptr<const TeeUiFrameWrapper>> cache;
+
+  Key key{lang_id_, GetDpi(), w, h, is_inverted_, is_magnified_};
+  std::lock_guard lock(cache_mutex);
+  if (auto itr = cache.find(key); itr != cache.end()) {
+    return itr->second;
+  }
+  std::shared_ptr<const TeeUiFrameWrapper> static_layer =
+      PaintStaticLayer(w, h);
+  if (!static_layer) {
+    return nullptr;
+  }
+  if (cache.size() >= kMaxCachedLayers) {
+    cache.clear();
+  }
+  cache.emplace(std::move(key), static_layer);
+  return static_layer;
+}
+
+std::unique_ptr<TeeUiFrameWrapper> ConfUiRenderer::PaintStaticLayer(
+    const int w, const int h) {
   std::get<teeui::LabelOK>(layout_).setTextColor(kColorEnabled);
   std::get<teeui::LabelCancel>(layout_).setTextColor(kColorEnabled);
 
@@ -238,8 +296,8 @@ std::unique_ptr<TeeUiFrameWrapper> ConfUiRenderer::RepaintRawFrame(
         return this->UpdatePixels(*new_raw_frame, x, y, color);
       });
 
-  // render all components
-  const auto error = drawElements(layout_, draw_pixel);
+  // render all components but the confirmation message
+  const auto error = drawElementsExcept<LabelConfMsg>(layout_, draw_pixel);
   if (error) {
     ConfUiLog(ERROR) << "Painting failed: " << error.code();
     return nullptr;
@@ -21,6 +21,7 @@
 #include <memory>
 #include <string>
 #include <tuple>
+#include <type_traits>
 #include <vector>
 
 #include <freetype/ftglyph.h>  // $(croot)/external/freetype
@@ -125,6 +126,17 @@ class ConfUiRenderer {
   // when successful. Or, nullopt
   std::unique_ptr<TeeUiFrameWrapper> RepaintRawFrame(const int w, const int h);
 
+  /**
+   * the frame with every element but the confirmation message painted
+   *
+   * It only depends on the locale, DPI, screen size and color scheme, so
+   * it is shared by all the renderers (sessions) with the same ones
+   */
+  std::shared_ptr<const TeeUiFrameWrapper> GetStaticLayer(const int w,
+                                                          const int h);
+  std::unique_ptr<TeeUiFrameWrapper> PaintStaticLayer(const int w,
+                                                      const int h);
+
   bool InitLayout(const std::string& lang_id);
   teeui::Error UpdateTranslations();
   teeui::Error UpdateLocale();
@@ -144,6 +156,22 @@ class ConfUiRenderer {
     // draw the remaining elements in the order they appear in the layout tuple.
     return (std::get<Elements>(layout).draw(drawPixel) || ...);
   }
+
+  // draws all the elements in the layout tuple but Skip
+  template <typename Skip, typename... Elements>
+  static teeui::Error drawElementsExcept(std::tuple<Elements...>& layout,
+                                         const teeui::PixelDrawer& drawPixel) {
+    return (drawUnless<Skip>(std::get<Elements>(layout), drawPixel) || ...);
+  }
+  template <typename Skip, typename Element>
+  static teeui::Error drawUnless(Element& element,
+                                 const teeui::PixelDrawer& drawPixel) {
+    if constexpr (std::is_same_v<Skip, Element>) {
+      return teeui::Error::OK;
+    } else {
+      return element.draw(drawPixel);
+    }
+  }
   void UpdateColorScheme(const bool is_inverted);
   template <typename Label>
   auto SetText(const std::string& text) {
@@ -139,6 +139,8 @@ void Session::CleanUp() {
   state_ = MainLoopState::kTerminated;
   // common action done when the state is back to init state
   host_mode_ctrl_.SetMode(HostModeCtrl::ModeType::kAndroidMode);
+  // don't leave the dialog on the screen until the guest commits a frame
+  screen_connector_.RestoreAndroidFrames();
 }
 
 void Session::ScheduleToTerminate() {
@@ -16,9 +16,12 @@
 
 #include "host/libs/confui/sign.h"
 
+#include <poll.h>
+
 #include <openssl/hmac.h>
 #include <openssl/sha.h>
 
+#include <mutex>
 #include <string>
 
 #include <android-base/logging.h>
@@ -50,6 +53,42 @@ SharedFD ConnectToSecureEnv() {
       SharedFD::SocketLocalClient(socket_path, false, SOCK_STREAM);
   return socket_to_secure_env;
 }
+
+// An idle connection has nothing to read, unless secure_env closed it. This
+// is checked first as writing to it would raise SIGPIPE.
+bool IsClosedByPeer(SharedFD connection) {
+  std::vector<PollSharedFd> poll_fds = {{
+      .fd = connection,
+      .events = POLLIN | POLLRDHUP,
+  }};
+  return SharedFD::Poll(poll_fds, 0) != 0;
+}
+
+// Kept across prompts so that each signature doesn't pay for a connection.
+std::mutex secure_env_mutex;
+SharedFD secure_env_connection;
+
+std::optional<std::vector<std::uint8_t>> SignOnConnection(
+    SharedFD connection, const std::vector<std::uint8_t>& message) {
+  ConfUiSignRequester sign_client(connection);
+  // request signature
+  if (!sign_client.Request(message)) {
+    ConfUiLog(ERROR) << "Failed to send the signing request";
+    return std::nullopt;
+  }
+  auto response_opt = sign_client.Receive();
+  if (!response_opt) {
+    ConfUiLog(ERROR) << "Received nullopt";
+    return std::nullopt;
+  }
+  // respond should be either error code or the signature
+  auto response = std::move(response_opt.value());
+  if (response.error_ != SignMessageError::kOk) {
+    ConfUiLog(ERROR) << "Response was received with non-OK error code";
+    return std::nullopt;
+  }
+  return {response.payload_};
+}
 }  // end of namespace
 
 class HMacImplementation {
@@ -105,26 +144,30 @@ std::optional<std::vector<std::uint8_t>> TestSign(
 
 std::optional<std::vector<std::uint8_t>> Sign(
     const std::vector<std::uint8_t>& message) {
-  SharedFD socket_to_secure_env = ConnectToSecureEnv();
-  if (!socket_to_secure_env->IsOpen()) {
-    ConfUiLog(ERROR) << "Failed to connect to secure_env signing server.";
-    return std::nullopt;
+  std::lock_guard<std::mutex> lock(secure_env_mutex);
+  if (secure_env_connection->IsOpen() &&
+      IsClosedByPeer(secure_env_connection)) {
+    secure_env_connection = SharedFD();
   }
-  ConfUiSignRequester sign_client(socket_to_secure_env);
-  // request signature
-  sign_client.Request(message);
-  auto response_opt = sign_client.Receive();
-  if (!response_opt) {
-    ConfUiLog(ERROR) << "Received nullopt";
-    return std::nullopt;
+  if (secure_env_connection->IsOpen()) {
+    auto signature = SignOnConnection(secure_env_connection, message);
+    if (signature) {
+      return signature;
+    }
+    // secure_env may have restarted since, and after an error the rest of
+    // the response is left unread, so it's retried on a new connection
+    secure_env_connection = SharedFD();
   }
-  // respond should be either error code or the signature
-  auto response = std::move(response_opt.value());
-  if (response.error_ != SignMessageError::kOk) {
-    ConfUiLog(ERROR) << "Response was received with non-OK error code";
+  secure_env_connection = ConnectToSecureEnv();
+  if (!secure_env_connection->IsOpen()) {
+    ConfUiLog(ERROR) << "Failed to connect to secure_env signing server.";
     return std::nullopt;
   }
-  return {response.payload_};
+  auto signature = SignOnConnection(secure_env_connection, message);
+  if (!signature) {
+    secure_env_connection = SharedFD();
+  }
+  return signature;
 }
 }  // namespace confui
 }  // end of namespace cuttlefish
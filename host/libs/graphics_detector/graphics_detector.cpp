@@ -16,18 +16,33 @@
 
 #include "host/libs/graphics_detector/graphics_detector.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <optional>
 #include <sstream>
 #include <vector>
 
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 #include <GLES2/gl2.h>
+#include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/strings.h>
+#include <android-base/unique_fd.h>
+#include <dirent.h>
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <json/json.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
 #include <sys/wait.h>
+#include <unistd.h>
 #include <vulkan/vulkan.h>
 
+#include "common/libs/utils/environment.h"
+#include "common/libs/utils/files.h"
+
 namespace cuttlefish {
 namespace {
 
@@ -569,6 +584,192 @@ GraphicsAvailability GetGraphicsAvailability() {
   return availability;
 }
 
+// Bumped when the probes, the fields or the fingerprint change so old results
+// are ignored
+constexpr int kCacheVersion = 2;
+
+Json::Value ToJson(const GraphicsAvailability& availability) {
+  Json::Value json;
+  json["has_gl"] = availability.has_gl;
+  json["has_gles1"] = availability.has_gles1;
+  json["has_gles2"] = availability.has_gles2;
+  json["has_egl"] = availability.has_egl;
+  json["has_vulkan"] = availability.has_vulkan;
+  json["egl_client_extensions"] = availability.egl_client_extensions;
+  json["egl_version"] = availability.egl_version;
+  json["egl_vendor"] = availability.egl_vendor;
+  json["egl_extensions"] = availability.egl_extensions;
+  json["can_init_gles2_on_egl_surfaceless"] =
+      availability.can_init_gles2_on_egl_surfaceless;
+  json["gles2_vendor"] = availability.gles2_vendor;
+  json["gles2_version"] = availability.gles2_version;
+  json["gles2_renderer"] = availability.gles2_renderer;
+  json["gles2_extensions"] = availability.gles2_extensions;
+  json["has_discrete_gpu"] = availability.has_discrete_gpu;
+  json["discrete_gpu_device_name"] = availability.discrete_gpu_device_name;
+  json["discrete_gpu_device_extensions"] =
+      availability.discrete_gpu_device_extensions;
+  return json;
+}
+
+GraphicsAvailability FromJson(const Json::Value& json) {
+  GraphicsAvailability availability;
+  availability.has_gl = json["has_gl"].asBool();
+  availability.has_gles1 = json["has_gles1"].asBool();
+  availability.has_gles2 = json["has_gles2"].asBool();
+  availability.has_egl = json["has_egl"].asBool();
+  availability.has_vulkan = json["has_vulkan"].asBool();
+  availability.egl_client_extensions =
+      json["egl_client_extensions"].asString();
+  availability.egl_version = json["egl_version"].asString();
+  availability.egl_vendor = json["egl_vendor"].asString();
+  availability.egl_extensions = json["egl_extensions"].asString();
+  availability.can_init_gles2_on_egl_surfaceless =
+      json["can_init_gles2_on_egl_surfaceless"].asBool();
+  availability.gles2_vendor = json["gles2_vendor"].asString();
+  availability.gles2_version = json["gles2_version"].asString();
+  availability.gles2_renderer = json["gles2_renderer"].asString();
+  availability.gles2_extensions = json["gles2_extensions"].asString();
+  availability.has_discrete_gpu = json["has_discrete_gpu"].asBool();
+  availability.discrete_gpu_device_name =
+      json["discrete_gpu_device_name"].asString();
+  availability.discrete_gpu_device_extensions =
+      json["discrete_gpu_device_extensions"].asString();
+  return availability;
+}
+
+bool ParseJson(const std::string& contents, Json::Value* json) {
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  std::string errors;
+  return reader->parse(contents.data(), contents.data() + contents.size(),
+                       json, &errors);
+}
+
+std::string ModificationTime(const std::string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return "missing";
+  }
+  return std::to_string(st.st_mtim.tv_sec) + "." +
+         std::to_string(st.st_mtim.tv_nsec);
+}
+
+// Describes what the probes depend on: the GPU device nodes and whether this
+// user may open them, the kernel drivers behind them, the user space drivers
+// that would be loaded and the display server they may connect to. A driver
+// update changes the module versions or, through the package manager, the
+// library cache and the ICD directories. Being added to the render or video
+// group only takes effect in a new session, which the group list reflects.
+std::string HostGraphicsFingerprint() {
+  std::stringstream fingerprint;
+  struct utsname uts;
+  if (uname(&uts) == 0) {
+    fingerprint << "kernel " << uts.release << "\n";
+  }
+  fingerprint << "uid " << getuid() << " gid " << getgid() << "\n";
+  std::vector<gid_t> groups(std::max(getgroups(0, nullptr), 0));
+  int group_count = getgroups(groups.size(), groups.data());
+  groups.resize(std::max(group_count, 0));
+  std::sort(groups.begin(), groups.end());
+  fingerprint << "groups";
+  for (auto group : groups) {
+    fingerprint << " " << group;
+  }
+  fingerprint << "\n";
+  for (const auto& dir : {"/dev", "/dev/dri"}) {
+    auto entries = DirectoryContents(dir);
+    std::sort(entries.begin(), entries.end());
+    for (const auto& entry : entries) {
+      if (std::string(dir) == "/dev" &&
+          !android::base::StartsWith(entry, "nvidia")) {
+        continue;
+      }
+      struct stat st;
+      auto path = std::string(dir) + "/" + entry;
+      if (stat(path.c_str(), &st) == 0 && S_ISCHR(st.st_mode)) {
+        bool accessible = access(path.c_str(), R_OK | W_OK) == 0;
+        fingerprint << "device " << path << " " << st.st_rdev << " "
+                    << (accessible ? "rw" : "denied") << "\n";
+      }
+    }
+  }
+  for (const auto& module :
+       {"amdgpu", "i915", "nouveau", "nvidia", "radeon", "virtio_gpu", "xe"}) {
+    for (const auto& attribute : {"version", "srcversion"}) {
+      std::string value;
+      auto path = std::string("/sys/module/") + module + "/" + attribute;
+      if (android::base::ReadFileToString(path, &value)) {
+        fingerprint << "module " << module << " " << attribute << " "
+                    << android::base::Trim(value) << "\n";
+      }
+    }
+  }
+  for (const auto& path :
+       {"/etc/ld.so.cache", "/etc/vulkan/icd.d", "/usr/share/vulkan/icd.d",
+        "/etc/glvnd/egl_vendor.d", "/usr/share/glvnd/egl_vendor.d"}) {
+    fingerprint << "mtime " << path << " " << ModificationTime(path) << "\n";
+  }
+  for (const auto& variable :
+       {"LD_LIBRARY_PATH", "VK_ICD_FILENAMES", "VK_DRIVER_FILES",
+        "__EGL_VENDOR_LIBRARY_FILENAMES", "__EGL_VENDOR_LIBRARY_DIRS",
+        "LIBGL_ALWAYS_SOFTWARE", "MESA_LOADER_DRIVER_OVERRIDE", "DISPLAY",
+        "WAYLAND_DISPLAY"}) {
+    fingerprint << "env " << variable << "=" << StringFromEnv(variable, "")
+                << "\n";
+  }
+  return fingerprint.str();
+}
+
+std::string GraphicsCacheDirectory() {
+  return StringFromEnv("XDG_CACHE_HOME",
+                       StringFromEnv("HOME", ".") + "/.cache") +
+         "/cuttlefish";
+}
+
+// Runs GetGraphicsAvailability() inside of a subprocess to ensure that a
+// crashing driver doesn't take assemble_cvd down with it. Configurations such
+// as GCE instances without a GPU but with GPU drivers for example have seen
+// crashes. The results are sent back through a pipe, so the drivers are never
+// loaded in this process. Nothing is returned if the subprocess failed.
+std::optional<GraphicsAvailability> ProbeGraphicsAvailability() {
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) != 0) {
+    PLOG(DEBUG) << "Failed to create the graphics check pipe";
+    return {};
+  }
+  android::base::unique_fd read_end(fds[0]);
+  android::base::unique_fd write_end(fds[1]);
+  pid_t pid = fork();
+  if (pid == 0) {
+    read_end.reset();
+    Json::StreamWriterBuilder factory;
+    auto results =
+        Json::writeString(factory, ToJson(GetGraphicsAvailability()));
+    bool written = android::base::WriteStringToFd(results, write_end.get());
+    std::_Exit(written ? 0 : 1);
+  }
+  write_end.reset();
+  if (pid < 0) {
+    PLOG(DEBUG) << "Failed to fork the graphics check subprocess";
+    return {};
+  }
+  std::string results;
+  android::base::ReadFdToString(read_end.get(), &results);
+  int status;
+  if (TEMP_FAILURE_RETRY(waitpid(pid, &status, 0)) != pid) {
+    PLOG(DEBUG) << "Failed to wait for graphics check subprocess";
+    return {};
+  }
+  Json::Value json;
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+      !ParseJson(results, &json)) {
+    LOG(DEBUG) << "Subprocess for detect_graphics failed with " << status;
+    return {};
+  }
+  return FromJson(json);
+}
+
 }  // namespace
 
 bool ShouldEnableAcceleratedRendering(
@@ -578,26 +779,54 @@ bool ShouldEnableAcceleratedRendering(
          availability.has_discrete_gpu;
 }
 
-// Runs GetGraphicsAvailability() inside of a subprocess first to ensure that
-// GetGraphicsAvailability() can complete successfully without crashing
-// assemble_cvd. Configurations such as GCE instances without a GPU but with GPU
-// drivers for example have seen crashes.
 GraphicsAvailability GetGraphicsAvailabilityWithSubprocessCheck() {
-  pid_t pid = fork();
-  if (pid == 0) {
-    GetGraphicsAvailability();
-    std::exit(0);
-  }
-  int status;
-  if (waitpid(pid, &status, 0) != pid) {
-    PLOG(DEBUG) << "Failed to wait for graphics check subprocess";
+  return ProbeGraphicsAvailability().value_or(GraphicsAvailability{});
+}
+
+// Results are kept under $XDG_CACHE_HOME/cuttlefish along with the host
+// fingerprint they were probed with. The lock serializes instances assembled
+// in parallel, so only the first of them probes.
+GraphicsAvailability GetCachedGraphicsAvailability() {
+  const auto dir = GraphicsCacheDirectory();
+  const auto cache_path = dir + "/graphics_availability.json";
+  const auto fingerprint = HostGraphicsFingerprint();
+  if (!EnsureDirectoryExists(dir).ok()) {
+    return GetGraphicsAvailabilityWithSubprocessCheck();
+  }
+  android::base::unique_fd lock(
+      open((cache_path + ".lock").c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0644));
+  if (lock < 0 || TEMP_FAILURE_RETRY(flock(lock.get(), LOCK_EX)) != 0) {
+    PLOG(DEBUG) << "Could not lock the graphics availability cache";
+    return GetGraphicsAvailabilityWithSubprocessCheck();
+  }
+
+  std::string contents;
+  Json::Value cached;
+  if (android::base::ReadFileToString(cache_path, &contents) &&
+      ParseJson(contents, &cached) &&
+      cached["version"].asInt() == kCacheVersion &&
+      cached["fingerprint"].asString() == fingerprint) {
+    LOG(DEBUG) << "Using cached graphics availability from " << cache_path;
+    return FromJson(cached["availability"]);
+  }
+
+  auto availability = ProbeGraphicsAvailability();
+  if (!availability) {
+    // Possibly a transient failure, the next instance probes again
     return GraphicsAvailability{};
   }
-  if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-    return GetGraphicsAvailability();
-  }
-  LOG(DEBUG) << "Subprocess for detect_graphics failed with " << status;
-  return GraphicsAvailability{};
+  Json::Value entry;
+  entry["version"] = kCacheVersion;
+  entry["fingerprint"] = fingerprint;
+  entry["availability"] = ToJson(*availability);
+  Json::StreamWriterBuilder factory;
+  const auto temp_path = cache_path + ".tmp";
+  if (!android::base::WriteStringToFile(Json::writeString(factory, entry),
+                                        temp_path) ||
+      rename(temp_path.c_str(), cache_path.c_str()) != 0) {
+    PLOG(DEBUG) << "Could not write the graphics availability cache";
+  }
+  return *availability;
 }
 
 std::ostream& operator<<(std::ostream& stream,
@@ -46,6 +46,8 @@ struct GraphicsAvailability {
 
 bool ShouldEnableAcceleratedRendering(const GraphicsAvailability& availability);
 GraphicsAvailability GetGraphicsAvailabilityWithSubprocessCheck();
+// Reuses earlier results until the host's GPU devices or drivers change.
+GraphicsAvailability GetCachedGraphicsAvailability();
 
 std::ostream& operator<<(std::ostream& out, const GraphicsAvailability& info);
 
@@ -21,29 +21,37 @@
 #include "host/libs/image_aggregator/image_aggregator.h"
 
 #include <sys/types.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <linux/fs.h>
 #include <stdio.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
+#include <optional>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 #include <cdisk_spec.pb.h>
 #include <google/protobuf/text_format.h>
 #include <sparse/sparse.h>
 #include <uuid.h>
 #include <zlib.h>
 
+#include "common/libs/fs/batch_io.h"
 #include "common/libs/fs/shared_buf.h"
 #include "common/libs/fs/shared_fd.h"
 #include "common/libs/utils/cf_endian.h"
 #include "common/libs/utils/files.h"
 #include "common/libs/utils/size_utils.h"
-#include "common/libs/utils/subprocess.h"
 #include "host/libs/config/mbr.h"
 
 namespace cuttlefish {
@@ -146,6 +154,30 @@ struct __attribute__((packed)) QCowHeader {
 
 static_assert(sizeof(QCowHeader) == 72);
 
+// Fields that follow QCowHeader in version 3 images.
+struct __attribute__((packed)) QCowV3Header {
+  QCowHeader base;
+  Be64 incompatible_features;
+  Be64 compatible_features;
+  Be64 autoclear_features;
+  Be32 refcount_order;
+  Be32 header_length;
+};
+
+static_assert(sizeof(QCowV3Header) == 104);
+
+// Matches what `crosvm create_qcow2` produces: 64 KiB clusters and 16 bit
+// refcounts.
+constexpr std::uint32_t QCOW_MAGIC = 0x514649fb;  // QCOW2_MAGIC
+constexpr std::uint32_t QCOW_CLUSTER_BITS = 16;
+constexpr std::uint32_t QCOW_REFCOUNT_ORDER = 4;
+// A zeroed header extension marks the end of the (empty) extension list
+constexpr std::uint64_t QCOW_EXTENSION_END_SIZE = 8;
+
+std::uint64_t DivideRoundUp(std::uint64_t value, std::uint64_t divisor) {
+  return (value + divisor - 1) / divisor;
+}
+
 /*
  * Returns the expanded file size of `file_path`. Note that the raw size of
  * files doesn't match how large they may appear inside a VM.
@@ -426,9 +458,9 @@ bool WriteEnd(SharedFD out, const GptEnd& end) {
   auto disk_size = (end.footer.current_lba + 1) * SECTOR_SIZE;
   auto footer_start = (end.footer.last_usable_lba + 1) * SECTOR_SIZE;
   auto padding = disk_size - footer_start - sizeof(GptEnd);
-  std::string padding_str(padding, '\0');
-  if (WriteAll(out, padding_str) != padding_str.size()) {
-    LOG(ERROR) << "Could not write GPT end padding: " << out->StrError();
+  // Skipping over the padding leaves a hole, which reads as zeroes
+  if (out->LSeek(padding, SEEK_CUR) < 0) {
+    LOG(ERROR) << "Could not skip GPT end padding: " << out->StrError();
     return false;
   }
   if (WriteAllBinary(out, &end) != sizeof(end)) {
@@ -438,8 +470,163 @@ bool WriteEnd(SharedFD out, const GptEnd& end) {
   return true;
 }
 
+struct DesparseOutput {
+  int fd;
+  unsigned int block_size;
+  std::optional<unsigned int> current_block;
+  off_t offset = 0;
+};
+
+bool IsZero(const void* data, size_t len) {
+  auto bytes = static_cast<const char*>(data);
+  return len == 0 || (bytes[0] == 0 && memcmp(bytes, bytes + 1, len - 1) == 0);
+}
+
+// Called by libsparse with pieces of each chunk with data, in order. Don't
+// care chunks are never passed, and zeroes aren't written either, so both
+// stay holes in the output.
+int WriteDesparsedChunk(void* priv, const void* data, size_t len,
+                        unsigned int block, unsigned int /* nr_blocks */) {
+  auto output = static_cast<DesparseOutput*>(priv);
+  if (block != output->current_block) {
+    output->current_block = block;
+    output->offset = static_cast<off_t>(block) * output->block_size;
+  }
+  if (data && !IsZero(data, len) &&
+      !android::base::WriteFullyAtOffset(output->fd, data, len,
+                                         output->offset)) {
+    return -1;
+  }
+  output->offset += len;
+  return 0;
+}
+
+void DeAndroidSparse(const ImagePartition& partition) {
+  android::base::unique_fd fd(
+      open(partition.image_file_path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd < 0) {
+    PLOG(FATAL) << "Could not open \"" << partition.image_file_path;
+  }
+  auto sparse = sparse_file_import(fd, /* verbose */ false, /* crc */ false);
+  if (!sparse) {
+    return;
+  }
+  LOG(INFO) << "Desparsing " << partition.image_file_path;
+  std::string out_file_name = partition.image_file_path + ".desparse";
+  android::base::unique_fd write_fd(
+      open(out_file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+           S_IRUSR | S_IWUSR | S_IRGRP));
+  if (write_fd < 0) {
+    PLOG(FATAL) << "Could not open " << out_file_name;
+  }
+  if (ftruncate(write_fd, sparse_file_len(sparse, /* sparse */ false,
+                                          /* crc */ false)) < 0) {
+    PLOG(FATAL) << "Could not resize " << out_file_name;
+  }
+  DesparseOutput output{
+      .fd = write_fd,
+      .block_size = sparse_file_block_size(sparse),
+  };
+  int write_status =
+      sparse_file_foreach_chunk(sparse, /* sparse */ false, /* crc */ false,
+                                WriteDesparsedChunk, &output);
+  if (write_status < 0) {
+    LOG(FATAL) << "Failed to desparse \"" << partition.image_file_path
+               << "\": " << write_status;
+  }
+  if (rename(out_file_name.c_str(), partition.image_file_path.c_str()) < 0) {
+    int error_num = errno;
+    LOG(FATAL) << "Could not move \"" << out_file_name << "\" to \""
+               << partition.image_file_path << "\": " << strerror(error_num);
+  }
+  sparse_file_destroy(sparse);
+}
+
+bool CopyRange(int in, off_t in_offset, int out, off_t out_offset,
+               std::uint64_t length) {
+  while (length > 0) {
+    auto copied =
+        copy_file_range(in, &in_offset, out, &out_offset, length, 0);
+    if (copied < 0 && (errno == EXDEV || errno == ENOSYS ||
+                       errno == EOPNOTSUPP || errno == EINVAL)) {
+      break;
+    }
+    if (copied <= 0) {
+      return false;
+    }
+    length -= copied;
+  }
+  if (length == 0) {
+    return true;
+  }
+  // Fall back to copying through memory, with several chunks in flight to
+  // keep the storage busy
+  auto io = BatchIo::Create();
+  if (!io.ok()) {
+    LOG(ERROR) << io.error();
+    return false;
+  }
+  auto copied = CopyRangeBatched(**io, SharedFD::Dup(in), in_offset,
+                                 SharedFD::Dup(out), out_offset, length);
+  if (!copied.ok()) {
+    LOG(ERROR) << copied.error();
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Copies the first `length` bytes of `in` to `out` at `out_offset`, which must
+ * already be large enough. The copy shares the data with `in` when the
+ * filesystem supports reflinks, otherwise holes in `in` stay holes in `out`.
+ */
+bool CopyIntoImage(int in, int out, off_t out_offset, std::uint64_t length) {
+  // Partitions are aligned to PARTITION_SIZE_SHIFT, which is a multiple of the
+  // block size of the filesystems supporting this. A zero length clones up to
+  // the end of `in`.
+  struct file_clone_range clone {
+    .src_fd = in, .src_offset = 0, .src_length = 0,
+    .dest_offset = static_cast<std::uint64_t>(out_offset),
+  };
+  if (ioctl(out, FICLONERANGE, &clone) == 0) {
+    return true;
+  }
+  off_t position = 0;
+  while (position < static_cast<off_t>(length)) {
+    auto data = lseek(in, position, SEEK_DATA);
+    if (data < 0 && errno == ENXIO) {
+      // Only a hole left
+      return true;
+    }
+    off_t hole;
+    if (data < 0) {
+      // No hole detection, copy it all
+      data = position;
+      hole = length;
+    } else {
+      hole = lseek(in, data, SEEK_HOLE);
+      if (hole < 0) {
+        return false;
+      }
+      hole = std::min<off_t>(hole, length);
+    }
+    if (!CopyRange(in, data, out, out_offset + data, hole - data)) {
+      return false;
+    }
+    position = hole;
+  }
+  return true;
+}
+
+} // namespace
+
+uint64_t AlignToPartitionSize(uint64_t size) {
+  return AlignToPowerOf2(size, PARTITION_SIZE_SHIFT);
+}
+
 /**
- * Converts any Android-Sparse image files in `partitions` to raw image files.
+ * Converts any Android-Sparse image files in `partitions` to raw image files,
+ * working on all of them at once.
  *
  * Android-Sparse is a file format invented by Android that optimizes for
  * chunks of zeroes or repeated data. The Android build system can produce
@@ -451,45 +638,13 @@ bool WriteEnd(SharedFD out, const GptEnd& end) {
  * support them.
  */
 void DeAndroidSparse(const std::vector<ImagePartition>& partitions) {
+  std::vector<std::thread> threads;
   for (const auto& partition : partitions) {
-    auto fd = open(partition.image_file_path.c_str(), O_RDONLY);
-    if (fd < 0) {
-      PLOG(FATAL) << "Could not open \"" << partition.image_file_path;
-      break;
-    }
-    auto sparse = sparse_file_import(fd, /* verbose */ false, /* crc */ false);
-    if (!sparse) {
-      close(fd);
-      continue;
-    }
-    LOG(INFO) << "Desparsing " << partition.image_file_path;
-    std::string out_file_name = partition.image_file_path + ".desparse";
-    auto write_fd = open(out_file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC,
-                         S_IRUSR | S_IWUSR | S_IRGRP);
-    if (write_fd < 0) {
-      PLOG(FATAL) << "Could not open " << out_file_name;
-    }
-    int write_status = sparse_file_write(sparse, write_fd, /* gz */ false,
-                                         /* sparse */ false, /* crc */ false);
-    if (write_status < 0) {
-      LOG(FATAL) << "Failed to desparse \"" << partition.image_file_path
-                 << "\": " << write_status;
-    }
-    close(write_fd);
-    if (rename(out_file_name.c_str(), partition.image_file_path.c_str()) < 0) {
-      int error_num = errno;
-      LOG(FATAL) << "Could not move \"" << out_file_name << "\" to \""
-                 << partition.image_file_path << "\": " << strerror(error_num);
-    }
-    sparse_file_destroy(sparse);
-    close(fd);
+    threads.emplace_back([&partition]() { DeAndroidSparse(partition); });
+  }
+  for (auto& thread : threads) {
+    thread.join();
   }
-}
-
-} // namespace
-
-uint64_t AlignToPartitionSize(uint64_t size) {
-  return AlignToPowerOf2(size, PARTITION_SIZE_SHIFT);
 }
 
 void AggregateImage(const std::vector<ImagePartition>& partitions,
@@ -501,27 +656,37 @@ void AggregateImage(const std::vector<ImagePartition>& partitions,
   }
   auto output = SharedFD::Creat(output_path, 0600);
   auto beginning = builder.Beginning();
+  // Sizing the disk first leaves holes for all the padding, and lets the
+  // partitions be copied to their offsets independently.
+  if (output->Truncate(builder.DiskSize()) < 0) {
+    LOG(FATAL) << "Could not resize \"" << output_path
+               << "\": " << output->StrError();
+  }
   if (!WriteBeginning(output, beginning)) {
     LOG(FATAL) << "Could not write GPT beginning to \"" << output_path
                << "\": " << output->StrError();
   }
+  std::vector<std::thread> copiers;
+  std::uint64_t offset = sizeof(GptBeginning);
   for (auto& disk : partitions) {
-    auto disk_fd = SharedFD::Open(disk.image_file_path, O_RDONLY);
     auto file_size = FileSize(disk.image_file_path);
-    if (!output->CopyFrom(*disk_fd, file_size)) {
-      LOG(FATAL) << "Could not copy from \"" << disk.image_file_path
-                 << "\" to \"" << output_path << "\": " << output->StrError();
-    }
-    // Handle disk images that are not aligned to PARTITION_SIZE_SHIFT
-    std::uint64_t padding = AlignToPartitionSize(file_size) - file_size;
-    std::string padding_str;
-    padding_str.resize(padding, '\0');
-    if (WriteAll(output, padding_str) != padding_str.size()) {
-      LOG(FATAL) << "Could not write partition padding to \"" << output_path
-                 << "\": " << output->StrError();
-    }
+    copiers.emplace_back([&disk, &output_path, offset, file_size]() {
+      android::base::unique_fd in(
+          open(disk.image_file_path.c_str(), O_RDONLY | O_CLOEXEC));
+      android::base::unique_fd out(
+          open(output_path.c_str(), O_WRONLY | O_CLOEXEC));
+      if (in < 0 || out < 0 || !CopyIntoImage(in, out, offset, file_size)) {
+        PLOG(FATAL) << "Could not copy from \"" << disk.image_file_path
+                    << "\" to \"" << output_path << "\"";
+      }
+    });
+    offset += AlignToPartitionSize(file_size);
+  }
+  for (auto& copier : copiers) {
+    copier.join();
   }
-  if (!WriteEnd(output, builder.End(beginning))) {
+  if (output->LSeek(offset, SEEK_SET) < 0 ||
+      !WriteEnd(output, builder.End(beginning))) {
     LOG(FATAL) << "Could not write GPT end to \"" << output_path
                << "\": " << output->StrError();
   }
@@ -566,27 +731,129 @@ void CreateCompositeDisk(std::vector<MultipleImagePartition> partitions,
   composite.flush();
 }
 
-void CreateQcowOverlay(const std::string& crosvm_path,
-                       const std::string& backing_file,
+bool CreateQcowOverlay(const std::string& backing_file,
                        const std::string& output_overlay_path) {
-  Command cmd(crosvm_path);
-  cmd.AddParameter("create_qcow2");
-  cmd.AddParameter("--backing_file=", backing_file);
-  cmd.AddParameter(output_overlay_path);
-
-  std::string stdout_str;
-  std::string stderr_str;
-  int success =
-      RunWithManagedStdio(std::move(cmd), nullptr, &stdout_str, &stderr_str);
-
-  if (success != 0) {
-    LOG(ERROR) << "Failed to run `" << crosvm_path
-               << " create_qcow2 --backing_file=" << backing_file << " "
-               << output_overlay_path << "`";
-    LOG(ERROR) << "stdout:\n###\n" << stdout_str << "\n###";
-    LOG(ERROR) << "stderr:\n###\n" << stderr_str << "\n###";
-    LOG(FATAL) << "Return code: \"" << success << "\"";
+  const std::uint64_t cluster_size = 1ULL << QCOW_CLUSTER_BITS;
+  const std::uint64_t entries_per_cluster = cluster_size / sizeof(Be64);
+  const std::uint64_t refcounts_per_cluster = cluster_size / sizeof(Be16);
+  const std::uint64_t backing_offset =
+      sizeof(QCowV3Header) + QCOW_EXTENSION_END_SIZE;
+  if (backing_file.size() > cluster_size - backing_offset) {
+    LOG(ERROR) << "Backing file path too long: " << backing_file;
+    return false;
+  }
+
+  std::uint64_t size = ExpandedStorageSize(backing_file);
+  std::uint64_t data_clusters = DivideRoundUp(size, cluster_size);
+  std::uint64_t l2_clusters = DivideRoundUp(data_clusters, entries_per_cluster);
+  std::uint64_t l1_clusters = DivideRoundUp(l2_clusters, entries_per_cluster);
+  // crosvm never grows the refcount table, so it is sized up front to cover
+  // a fully allocated image. crosvm also rejects tables much larger than
+  // what it would have allocated itself.
+  std::uint64_t all_clusters = 1 + l1_clusters + l2_clusters + data_clusters;
+  std::uint64_t refcount_data =
+      DivideRoundUp(all_clusters * sizeof(Be16), cluster_size);
+  std::uint64_t refcount_self =
+      DivideRoundUp(refcount_data * sizeof(Be16), cluster_size);
+  std::uint64_t refcount_table_clusters = DivideRoundUp(
+      (refcount_data + refcount_self) * sizeof(Be64), cluster_size);
+
+  // Layout: header, L1 table, refcount table, then the refcount blocks that
+  // cover the metadata itself. Data and L2 clusters are appended on write.
+  std::uint64_t l1_offset = cluster_size;
+  std::uint64_t refcount_table_offset = l1_offset + l1_clusters * cluster_size;
+  std::uint64_t fixed_clusters = 1 + l1_clusters + refcount_table_clusters;
+  std::uint64_t refcount_blocks = 0;
+  while ((fixed_clusters + refcount_blocks) >
+         refcount_blocks * refcounts_per_cluster) {
+    refcount_blocks++;
+  }
+  std::uint64_t metadata_clusters = fixed_clusters + refcount_blocks;
+  std::uint64_t refcount_blocks_offset =
+      refcount_table_offset + refcount_table_clusters * cluster_size;
+
+  QCowV3Header header = {
+      .base =
+          {
+              .magic = Be32(QCOW_MAGIC),
+              .version = Be32(3),
+              .backing_file_offset = Be64(backing_offset),
+              .backing_file_size = Be32(backing_file.size()),
+              .cluster_bits = Be32(QCOW_CLUSTER_BITS),
+              .size = Be64(size),
+              .crypt_method = Be32(0),
+              .l1_size = Be32(l2_clusters),
+              .l1_table_offset = Be64(l1_offset),
+              .refcount_table_offset = Be64(refcount_table_offset),
+              .refcount_table_clusters = Be32(refcount_table_clusters),
+              .nb_snapshots = Be32(0),
+              .snapshots_offset = Be64(0),
+          },
+      .incompatible_features = Be64(0),
+      .compatible_features = Be64(0),
+      .autoclear_features = Be64(0),
+      .refcount_order = Be32(QCOW_REFCOUNT_ORDER),
+      .header_length = Be32(sizeof(QCowV3Header)),
+  };
+
+  std::vector<Be64> refcount_table(refcount_blocks);
+  for (std::uint64_t i = 0; i < refcount_blocks; i++) {
+    refcount_table[i] = Be64(refcount_blocks_offset + i * cluster_size);
+  }
+  std::vector<Be16> refcounts(metadata_clusters, Be16(1));
+
+  android::base::unique_fd fd(
+      open(output_overlay_path.c_str(),
+           O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644));
+  if (fd < 0) {
+    PLOG(ERROR) << "Could not open \"" << output_overlay_path << "\"";
+    return false;
+  }
+  // Everything not written below (the L1 table, the extension end marker and
+  // unused refcounts) is zero.
+  using android::base::WriteFullyAtOffset;
+  if (ftruncate(fd.get(), metadata_clusters * cluster_size) != 0 ||
+      !WriteFullyAtOffset(fd, &header, sizeof(header), 0) ||
+      !WriteFullyAtOffset(fd, backing_file.data(), backing_file.size(),
+                          backing_offset) ||
+      !WriteFullyAtOffset(fd, refcount_table.data(),
+                          refcount_table.size() * sizeof(Be64),
+                          refcount_table_offset) ||
+      !WriteFullyAtOffset(fd, refcounts.data(),
+                          refcounts.size() * sizeof(Be16),
+                          refcount_blocks_offset)) {
+    PLOG(ERROR) << "Could not write \"" << output_overlay_path << "\"";
+    return false;
+  }
+  return true;
+}
+
+std::vector<std::string> WritableDiskFiles(const std::string& disk_path) {
+  android::base::unique_fd fd(open(disk_path.c_str(), O_RDONLY));
+  CHECK(fd.get() >= 0) << "Could not open \"" << disk_path << "\""
+                       << strerror(errno);
+  std::string magic(CDISK_MAGIC.size(), '\0');
+  if (!android::base::ReadFully(fd, magic.data(), magic.size()) ||
+      magic != CDISK_MAGIC) {
+    return {disk_path};
+  }
+  std::string message;
+  if (!android::base::ReadFdToString(fd, &message)) {
+    PLOG(FATAL) << "Fail to read(cdisk): " << disk_path;
+    return {};
+  }
+  CompositeDisk cdisk;
+  if (!cdisk.ParseFromString(message)) {
+    PLOG(FATAL) << "Fail to parse(cdisk): " << disk_path;
+    return {};
+  }
+  std::vector<std::string> files;
+  for (const auto& component : cdisk.component_disks()) {
+    if (component.read_write_capability() == ReadWriteCapability::READ_WRITE) {
+      files.push_back(component.file_path());
+    }
   }
+  return files;
 }
 
 } // namespace cuttlefish
@@ -45,6 +45,13 @@ struct MultipleImagePartition {
 
 uint64_t AlignToPartitionSize(uint64_t size);
 
+/**
+ * Converts any Android-Sparse image files in `partitions` to raw image files,
+ * in place. AggregateImage does this too, doing it first lets the caller look
+ * at the raw contents.
+ */
+void DeAndroidSparse(const std::vector<ImagePartition>& partitions);
+
 /**
  * Combine the files in `partition` into a single raw disk file and write it to
  * `output_path`. The raw disk file will have a GUID Partition Table and copy in
@@ -87,12 +94,18 @@ void CreateCompositeDisk(std::vector<MultipleImagePartition> partitions,
  * files can be swapped out and replaced without affecting the original. qcow
  * is supported by QEMU and crosvm.
  *
- * The crosvm binary at `crosvm_path` is used to generate an overlay file at
- * `output_overlay_path` that functions as an overlay on the file at
- * `backing_file`.
+ * Writes an empty qcow2 overlay at `output_overlay_path` that functions as an
+ * overlay on the file at `backing_file`. The image has the same layout as one
+ * from `crosvm create_qcow2`, without spawning crosvm.
  */
-void CreateQcowOverlay(const std::string& crosvm_path,
-                       const std::string& backing_file,
+bool CreateQcowOverlay(const std::string& backing_file,
                        const std::string& output_overlay_path);
 
+/**
+ * Returns the files that a VM can write through the disk at `disk_path`: the
+ * writable components of a composite disk, or the file itself for any other
+ * disk format. Used to find the files that grow as the guest writes.
+ */
+std::vector<std::string> WritableDiskFiles(const std::string& disk_path);
+
 }
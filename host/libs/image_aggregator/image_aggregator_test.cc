@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/image_aggregator/image_aggregator.h"
+
+#include <endian.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/unique_fd.h>
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+namespace {
+
+constexpr std::uint64_t kClusterSize = 1 << 16;
+constexpr std::uint64_t kL2Entries = kClusterSize / sizeof(std::uint64_t);
+constexpr std::uint64_t kRefcountsPerBlock =
+    kClusterSize / sizeof(std::uint16_t);
+
+std::uint16_t Be16At(const std::string& image, std::uint64_t offset) {
+  std::uint16_t value;
+  std::memcpy(&value, image.data() + offset, sizeof(value));
+  return be16toh(value);
+}
+
+std::uint32_t Be32At(const std::string& image, std::uint64_t offset) {
+  std::uint32_t value;
+  std::memcpy(&value, image.data() + offset, sizeof(value));
+  return be32toh(value);
+}
+
+std::uint64_t Be64At(const std::string& image, std::uint64_t offset) {
+  std::uint64_t value;
+  std::memcpy(&value, image.data() + offset, sizeof(value));
+  return be64toh(value);
+}
+
+std::uint64_t DivideRoundUp(std::uint64_t value, std::uint64_t divisor) {
+  return (value + divisor - 1) / divisor;
+}
+
+// Reads the overlay back the way qemu does and checks what `qemu-img check`
+// would: every cluster in the file is used by the header, the L1 table or
+// the refcounts, and has a refcount of exactly the number of its uses.
+void CheckEmptyOverlay(const std::string& path, const std::string& backing,
+                       std::uint64_t size) {
+  std::string image;
+  ASSERT_TRUE(android::base::ReadFileToString(path, &image));
+  ASSERT_GE(image.size(), kClusterSize);
+  ASSERT_EQ(image.size() % kClusterSize, 0u);
+
+  EXPECT_EQ(image.substr(0, 4), "QFI\xfb");
+  EXPECT_EQ(Be32At(image, 4), 3u);  // version
+  EXPECT_EQ(Be32At(image, 20), 16u);  // cluster_bits
+  EXPECT_EQ(Be64At(image, 24), size);
+  EXPECT_EQ(Be32At(image, 32), 0u);  // crypt_method
+  EXPECT_EQ(Be32At(image, 60), 0u);  // nb_snapshots
+  EXPECT_EQ(Be64At(image, 72), 0u);  // incompatible_features
+  EXPECT_EQ(Be32At(image, 96), 4u);  // refcount_order
+  EXPECT_EQ(Be32At(image, 100), 104u);  // header_length
+  // The header extensions end right away
+  EXPECT_EQ(Be64At(image, 104), 0u);
+
+  auto backing_offset = Be64At(image, 8);
+  auto backing_size = Be32At(image, 16);
+  ASSERT_LE(backing_offset + backing_size, kClusterSize);
+  EXPECT_GE(backing_offset, 112u);
+  EXPECT_EQ(image.substr(backing_offset, backing_size), backing);
+
+  std::uint64_t clusters = image.size() / kClusterSize;
+  std::vector<int> uses(clusters, 0);
+  uses[0]++;
+
+  auto l1_size = Be32At(image, 36);
+  auto l1_offset = Be64At(image, 40);
+  EXPECT_EQ(l1_size, DivideRoundUp(DivideRoundUp(size, kClusterSize),
+                                   kL2Entries));
+  ASSERT_EQ(l1_offset % kClusterSize, 0u);
+  ASSERT_LE(l1_offset + l1_size * sizeof(std::uint64_t), image.size());
+  for (std::uint64_t i = 0; i < l1_size; i++) {
+    EXPECT_EQ(Be64At(image, l1_offset + i * sizeof(std::uint64_t)), 0u)
+        << "L1 entry " << i << " of an empty overlay";
+  }
+  for (std::uint64_t i = 0;
+       i < DivideRoundUp(l1_size * sizeof(std::uint64_t), kClusterSize); i++) {
+    uses[l1_offset / kClusterSize + i]++;
+  }
+
+  auto refcount_table_offset = Be64At(image, 48);
+  auto refcount_table_clusters = Be32At(image, 56);
+  ASSERT_EQ(refcount_table_offset % kClusterSize, 0u);
+  ASSERT_LE(refcount_table_offset + refcount_table_clusters * kClusterSize,
+            image.size());
+  for (std::uint64_t i = 0; i < refcount_table_clusters; i++) {
+    uses[refcount_table_offset / kClusterSize + i]++;
+  }
+  // Growing the table isn't needed to allocate every cluster of the disk
+  std::uint64_t data_clusters = DivideRoundUp(size, kClusterSize);
+  std::uint64_t full_image_clusters =
+      clusters + DivideRoundUp(data_clusters, kL2Entries) + data_clusters;
+  EXPECT_GE(refcount_table_clusters * kL2Entries * kRefcountsPerBlock,
+            full_image_clusters);
+
+  std::vector<std::uint64_t> refcount_blocks;
+  for (std::uint64_t i = 0; i < refcount_table_clusters * kL2Entries; i++) {
+    auto block = Be64At(image, refcount_table_offset + i * 8);
+    if (block == 0) {
+      continue;
+    }
+    ASSERT_EQ(block % kClusterSize, 0u);
+    ASSERT_LT(block, image.size());
+    uses[block / kClusterSize]++;
+    refcount_blocks.resize(i + 1);
+    refcount_blocks[i] = block;
+  }
+  for (std::uint64_t cluster = 0; cluster < clusters; cluster++) {
+    auto block = cluster / kRefcountsPerBlock;
+    ASSERT_LT(block, refcount_blocks.size())
+        << "No refcount block for cluster " << cluster;
+    ASSERT_NE(refcount_blocks[block], 0u)
+        << "No refcount block for cluster " << cluster;
+    auto refcount = Be16At(image, refcount_blocks[block] +
+                                      cluster % kRefcountsPerBlock * 2);
+    EXPECT_EQ(uses[cluster], 1) << "Cluster " << cluster;
+    EXPECT_EQ(refcount, uses[cluster]) << "Cluster " << cluster;
+  }
+  // Clusters past the end of the file are free
+  for (std::uint64_t block = 0; block < refcount_blocks.size(); block++) {
+    for (std::uint64_t i = 0; i < kRefcountsPerBlock; i++) {
+      if (refcount_blocks[block] != 0 &&
+          block * kRefcountsPerBlock + i >= clusters) {
+        ASSERT_EQ(Be16At(image, refcount_blocks[block] + i * 2), 0)
+            << "Cluster " << block * kRefcountsPerBlock + i;
+      }
+    }
+  }
+}
+
+class QcowOverlayTest : public ::testing::Test {
+ protected:
+  std::string Path(const std::string& name) const {
+    return std::string(dir_.path) + "/" + name;
+  }
+
+  // A sparse raw image of `size` bytes
+  std::string RawImage(const std::string& name, std::uint64_t size) {
+    auto path = Path(name);
+    android::base::unique_fd fd(
+        open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644));
+    EXPECT_GE(fd.get(), 0);
+    EXPECT_EQ(ftruncate(fd.get(), size), 0);
+    return path;
+  }
+
+  TemporaryDir dir_;
+};
+
+TEST_F(QcowOverlayTest, WritesAnEmptyOverlay) {
+  // Not a whole number of clusters
+  constexpr std::uint64_t kSize = 3 * 1024 * 1024 + 512;
+  auto backing = RawImage("backing.img", kSize);
+  auto overlay = Path("overlay.qcow2");
+  ASSERT_TRUE(CreateQcowOverlay(backing, overlay));
+  CheckEmptyOverlay(overlay, backing, kSize);
+}
+
+TEST_F(QcowOverlayTest, WritesOverlaysOfLargeDisks) {
+  // Takes several L1 clusters
+  constexpr std::uint64_t kSize = 8ULL << 40;
+  auto backing = RawImage("backing.img", kSize);
+  auto overlay = Path("overlay.qcow2");
+  ASSERT_TRUE(CreateQcowOverlay(backing, overlay));
+  CheckEmptyOverlay(overlay, backing, kSize);
+}
+
+TEST_F(QcowOverlayTest, TakesTheVirtualSizeOfQcowBackingFiles) {
+  constexpr std::uint64_t kSize = 64 * 1024 * 1024;
+  auto backing = RawImage("backing.img", kSize);
+  auto overlay = Path("overlay.qcow2");
+  ASSERT_TRUE(CreateQcowOverlay(backing, overlay));
+  auto second = Path("second.qcow2");
+  ASSERT_TRUE(CreateQcowOverlay(overlay, second));
+  CheckEmptyOverlay(second, overlay, kSize);
+}
+
+TEST_F(QcowOverlayTest, RefusesBackingPathsThatDontFitInTheHeader) {
+  std::string backing = "/" + std::string(kClusterSize, 'a');
+  EXPECT_FALSE(CreateQcowOverlay(backing, Path("overlay.qcow2")));
+}
+
+TEST_F(QcowOverlayTest, PassesQemuImgCheck) {
+  if (system("qemu-img --version >/dev/null 2>&1") != 0) {
+    GTEST_SKIP() << "qemu-img is not available";
+  }
+  auto backing = RawImage("backing.img", 1024 * 1024 * 1024);
+  auto overlay = Path("overlay.qcow2");
+  ASSERT_TRUE(CreateQcowOverlay(backing, overlay));
+  auto check = "qemu-img check -f qcow2 '" + overlay + "' >/dev/null 2>&1";
+  EXPECT_EQ(system(check.c_str()), 0);
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/input_recording/input_recording.h"
+
+#include <fcntl.h>
+
+#include <cstring>
+
+#include <android-base/logging.h>
+
+#include "common/libs/fs/shared_buf.h"
+
+namespace cuttlefish {
+namespace {
+
+// Nothing legitimate comes close, protects from reading garbage
+constexpr uint32_t kMaxLabelSize = 256;
+constexpr uint32_t kMaxDataSize = 1 << 20;
+
+}  // namespace
+
+Result<void> WriteInputRecord(SharedFD fd, const InputRecord& record) {
+  InputRecordHeader header{
+      .timestamp_us = static_cast<uint64_t>(record.timestamp.count()),
+      .label_size = static_cast<uint32_t>(record.label.size()),
+      .data_size = static_cast<uint32_t>(record.data.size()),
+  };
+  std::vector<char> buffer(sizeof(header) + header.label_size +
+                           header.data_size);
+  memcpy(buffer.data(), &header, sizeof(header));
+  memcpy(buffer.data() + sizeof(header), record.label.data(),
+         header.label_size);
+  memcpy(buffer.data() + sizeof(header) + header.label_size,
+         record.data.data(), header.data_size);
+  // A single write keeps records whole when the fd is shared between threads
+  CF_EXPECT(WriteAll(fd, buffer) == static_cast<ssize_t>(buffer.size()),
+            "Failed to write input record: " << fd->StrError());
+  return {};
+}
+
+Result<std::optional<InputRecord>> ReadInputRecord(SharedFD fd) {
+  InputRecordHeader header;
+  auto read = ReadExactBinary(fd, &header);
+  if (read == 0) {
+    return std::nullopt;
+  }
+  CF_EXPECT(read == static_cast<ssize_t>(sizeof(header)),
+            "Failed to read input record header: " << fd->StrError());
+  CF_EXPECT(header.label_size <= kMaxLabelSize,
+            "Input record label too long: " << header.label_size);
+  CF_EXPECT(header.data_size <= kMaxDataSize,
+            "Input record too large: " << header.data_size);
+  InputRecord record{
+      .timestamp = std::chrono::microseconds(header.timestamp_us),
+      .label = std::string(header.label_size, '\0'),
+      .data = std::vector<char>(header.data_size),
+  };
+  if (header.label_size > 0) {
+    CF_EXPECT(ReadExact(fd, &record.label) ==
+                  static_cast<ssize_t>(header.label_size),
+              "Failed to read input record label: " << fd->StrError());
+  }
+  if (header.data_size > 0) {
+    CF_EXPECT(ReadExact(fd, &record.data) ==
+                  static_cast<ssize_t>(header.data_size),
+              "Failed to read input record data: " << fd->StrError());
+  }
+  return std::optional<InputRecord>(std::move(record));
+}
+
+Result<std::unique_ptr<InputRecorder>> InputRecorder::Create(
+    const std::string& path) {
+  auto fd = SharedFD::Open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  CF_EXPECT(fd->IsOpen(),
+            "Failed to open \"" << path << "\": " << fd->StrError());
+  return std::unique_ptr<InputRecorder>(new InputRecorder(fd));
+}
+
+InputRecorder::InputRecorder(SharedFD fd)
+    : fd_(fd), start_(std::chrono::steady_clock::now()) {}
+
+void InputRecorder::RecordInput(const std::string& label, const char* data,
+                                size_t size) {
+  Record(label, data, size);
+}
+
+void InputRecorder::RecordFrameCommit() {
+  Record(kFrameCommitLabel, nullptr, 0);
+}
+
+void InputRecorder::Record(const std::string& label, const char* data,
+                           size_t size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Timestamps are taken with the lock held to keep them in file order
+  InputRecord record{
+      .timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start_),
+      .label = label,
+      .data = std::vector<char>(data, data + size),
+  };
+  auto result = WriteInputRecord(fd_, record);
+  if (!result.ok()) {
+    LOG(ERROR) << result.error();
+  }
+}
+
+}  // namespace cuttlefish
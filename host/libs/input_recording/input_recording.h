@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+// Input recordings and the input replay socket use the same format: a sequence
+// of records, each made of an InputRecordHeader followed by the label of the
+// device and the bytes written to that device's input socket, which are
+// whole input reports in the format the VMM consumes.
+struct InputRecordHeader {
+  // Since the beginning of the recording
+  uint64_t timestamp_us;
+  uint32_t label_size;
+  uint32_t data_size;
+};
+
+// Device labels other than the displays' ("display_0", ...)
+inline constexpr char kKeyboardInputLabel[] = "keyboard";
+inline constexpr char kSwitchesInputLabel[] = "switches";
+// Records with this label carry no data, they mark a frame being committed by
+// one of the displays.
+inline constexpr char kFrameCommitLabel[] = "frame";
+
+struct InputRecord {
+  std::chrono::microseconds timestamp;
+  std::string label;
+  std::vector<char> data;
+};
+
+Result<void> WriteInputRecord(SharedFD fd, const InputRecord& record);
+// Returns an empty optional at the end of the stream.
+Result<std::optional<InputRecord>> ReadInputRecord(SharedFD fd);
+
+// Writes the input sent to a device along with when it was sent. Safe to use
+// from multiple threads.
+class InputRecorder {
+ public:
+  static Result<std::unique_ptr<InputRecorder>> Create(const std::string& path);
+
+  void RecordInput(const std::string& label, const char* data, size_t size);
+  void RecordFrameCommit();
+
+ private:
+  InputRecorder(SharedFD fd);
+
+  void Record(const std::string& label, const char* data, size_t size);
+
+  SharedFD fd_;
+  std::chrono::steady_clock::time_point start_;
+  std::mutex mutex_;
+};
+
+}  // namespace cuttlefish
@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/log_store/log_store.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+
+#include "common/libs/fs/shared_buf.h"
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr char kChunksExtension[] = ".chunks";
+constexpr char kIndexExtension[] = ".index";
+
+// Big enough to compress well, small enough that a narrow query decompresses
+// little it doesn't need
+constexpr std::size_t kMaxChunkSize = 1 << 16;
+constexpr auto kMaxChunkAge = std::chrono::seconds(10);
+
+// Each record is this header followed by the tag and the line
+struct RecordHeader {
+  uint64_t timestamp_ns;
+  uint32_t line_size;
+  uint16_t tag_size;
+  uint8_t severity;
+  uint8_t reserved;
+} __attribute__((packed));
+
+std::string ChunksPath(const std::string& directory,
+                       const std::string& stream) {
+  return directory + "/" + stream + kChunksExtension;
+}
+
+std::string IndexPath(const std::string& directory,
+                      const std::string& stream) {
+  return directory + "/" + stream + kIndexExtension;
+}
+
+Result<SharedFD> OpenForAppend(const std::string& path) {
+  auto fd = SharedFD::Open(path, O_CREAT | O_WRONLY | O_APPEND, 0664);
+  CF_EXPECT(fd->IsOpen(),
+            "Failed to open \"" << path << "\": " << fd->StrError());
+  return fd;
+}
+
+LogStoreIndexEntry EmptyEntry() {
+  LogStoreIndexEntry entry;
+  memset(&entry, 0, sizeof(entry));
+  return entry;
+}
+
+bool Matches(const LogStoreIndexEntry& entry, const LogStoreQuery& query) {
+  if (query.since_ns && entry.last_timestamp_ns < *query.since_ns) {
+    return false;
+  }
+  if (query.until_ns && entry.first_timestamp_ns > *query.until_ns) {
+    return false;
+  }
+  return (entry.severity_mask >> query.min_severity) != 0;
+}
+
+bool Matches(const LogStoreRecord& record, const LogStoreQuery& query) {
+  if (query.since_ns && record.timestamp_ns < *query.since_ns) {
+    return false;
+  }
+  if (query.until_ns && record.timestamp_ns > *query.until_ns) {
+    return false;
+  }
+  return record.severity >= query.min_severity;
+}
+
+}  // namespace
+
+uint64_t LogStoreNow() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+Result<LogStoreWriter> LogStoreWriter::Create(const std::string& directory,
+                                              const std::string& stream) {
+  CF_EXPECT(EnsureDirectoryExists(directory));
+  auto chunks = CF_EXPECT(OpenForAppend(ChunksPath(directory, stream)));
+  auto index = CF_EXPECT(OpenForAppend(IndexPath(directory, stream)));
+  // Continue the files of a previous run of the same instance
+  auto offset = chunks->LSeek(0, SEEK_END);
+  CF_EXPECT(offset >= 0, "Failed to seek \"" << ChunksPath(directory, stream)
+                                             << "\": " << chunks->StrError());
+  return LogStoreWriter(chunks, index, offset);
+}
+
+LogStoreWriter::LogStoreWriter(SharedFD chunks, SharedFD index,
+                               uint64_t offset)
+    : chunks_(chunks),
+      index_(index),
+      offset_(offset),
+      entry_(EmptyEntry()) {}
+
+LogStoreWriter::~LogStoreWriter() {
+  // Also true when moved from
+  if (raw_.empty()) {
+    return;
+  }
+  auto result = Flush();
+  if (!result.ok()) {
+    LOG(ERROR) << "Lost the last log lines: " << result.error();
+  }
+}
+
+void LogStoreWriter::Append(uint64_t timestamp_ns, uint8_t severity,
+                            std::string_view tag, std::string_view line) {
+  if (entry_.record_count == 0) {
+    entry_.first_timestamp_ns = timestamp_ns;
+    chunk_start_ = std::chrono::steady_clock::now();
+  }
+  // Only goes back if the wall clock does
+  entry_.first_timestamp_ns = std::min(entry_.first_timestamp_ns, timestamp_ns);
+  entry_.last_timestamp_ns = std::max(entry_.last_timestamp_ns, timestamp_ns);
+  entry_.record_count++;
+  entry_.severity_mask |= 1 << severity;
+
+  tag = tag.substr(0, UINT16_MAX);
+  RecordHeader header = {
+      .timestamp_ns = timestamp_ns,
+      .line_size = static_cast<uint32_t>(line.size()),
+      .tag_size = static_cast<uint16_t>(tag.size()),
+      .severity = severity,
+      .reserved = 0,
+  };
+  raw_.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  raw_.append(tag);
+  raw_.append(line);
+}
+
+Result<void> LogStoreWriter::MaybeFlush() {
+  if (raw_.empty()) {
+    return {};
+  }
+  if (raw_.size() >= kMaxChunkSize ||
+      std::chrono::steady_clock::now() - chunk_start_ > kMaxChunkAge) {
+    CF_EXPECT(Flush());
+  }
+  return {};
+}
+
+std::optional<std::chrono::milliseconds> LogStoreWriter::TimeUntilFlush()
+    const {
+  if (raw_.empty()) {
+    return {};
+  }
+  auto age = std::chrono::steady_clock::now() - chunk_start_;
+  if (age > kMaxChunkAge) {
+    return std::chrono::milliseconds(0);
+  }
+  // Rounded up, waking up just before the deadline would find nothing to do
+  return std::chrono::ceil<std::chrono::milliseconds>(kMaxChunkAge - age) +
+         std::chrono::milliseconds(1);
+}
+
+Result<void> LogStoreWriter::Flush() {
+  if (raw_.empty()) {
+    return {};
+  }
+  // Not kept for another attempt, the writer would otherwise grow without
+  // bounds while the disk is full.
+  auto raw = std::move(raw_);
+  raw_.clear();
+  auto entry = entry_;
+  entry_ = EmptyEntry();
+
+  std::string compressed(compressBound(raw.size()), '\0');
+  uLongf compressed_size = compressed.size();
+  auto status = compress2(reinterpret_cast<Bytef*>(compressed.data()),
+                          &compressed_size,
+                          reinterpret_cast<const Bytef*>(raw.data()),
+                          raw.size(), Z_BEST_SPEED);
+  CF_EXPECT(status == Z_OK, "Failed to compress log chunk: " << status);
+  compressed.resize(compressed_size);
+
+  auto written = WriteAll(chunks_, compressed);
+  if (written != (ssize_t)compressed.size()) {
+    // Part of the chunk may have made it, the next one starts after it
+    auto end = chunks_->LSeek(0, SEEK_END);
+    if (end >= 0) {
+      offset_ = end;
+    }
+    return CF_ERR("Failed to write log chunk: " << chunks_->StrError());
+  }
+  entry.offset = offset_;
+  entry.compressed_size = compressed.size();
+  entry.raw_size = raw.size();
+  // The chunk is in the file whether or not its index entry is written
+  offset_ += compressed.size();
+
+  auto index_written = WriteAllBinary(index_, &entry);
+  if (index_written != sizeof(entry)) {
+    // A partial entry would shift every later one, readers stop at it
+    auto index_end = index_->LSeek(0, SEEK_END);
+    if (index_end >= 0) {
+      index_->Truncate(index_end - index_end % sizeof(entry));
+    }
+    return CF_ERR("Failed to write log index: " << index_->StrError());
+  }
+  return {};
+}
+
+std::vector<std::string> LogStoreStreams(const std::string& directory) {
+  std::vector<std::string> streams;
+  std::unique_ptr<DIR, int (*)(DIR*)> dir(opendir(directory.c_str()),
+                                          closedir);
+  if (!dir) {
+    return streams;
+  }
+  while (auto entry = readdir(dir.get())) {
+    std::string name = entry->d_name;
+    if (android::base::EndsWith(name, kIndexExtension)) {
+      streams.push_back(name.substr(0, name.size() - strlen(kIndexExtension)));
+    }
+  }
+  std::sort(streams.begin(), streams.end());
+  return streams;
+}
+
+Result<void> QueryLogStore(
+    const std::string& directory, const std::string& stream,
+    const LogStoreQuery& query,
+    const std::function<void(const LogStoreRecord&)>& callback) {
+  auto index_path = IndexPath(directory, stream);
+  auto chunks_path = ChunksPath(directory, stream);
+  auto index = SharedFD::Open(index_path, O_RDONLY);
+  CF_EXPECT(index->IsOpen(),
+            "Failed to open \"" << index_path << "\": " << index->StrError());
+  auto chunks = SharedFD::Open(chunks_path, O_RDONLY);
+  CF_EXPECT(chunks->IsOpen(),
+            "Failed to open \"" << chunks_path << "\": " << chunks->StrError());
+
+  std::string compressed;
+  std::string raw;
+  LogStoreIndexEntry entry;
+  // A partially written entry at the end is ignored
+  while (ReadExactBinary(index, &entry) == sizeof(entry)) {
+    if (!Matches(entry, query)) {
+      continue;
+    }
+    CF_EXPECT(chunks->LSeek(entry.offset, SEEK_SET) >= 0,
+              "Failed to seek \"" << chunks_path << "\": "
+                                  << chunks->StrError());
+    compressed.resize(entry.compressed_size);
+    CF_EXPECT(ReadExact(chunks, &compressed) == (ssize_t)compressed.size(),
+              "Truncated chunk in \"" << chunks_path << "\"");
+    raw.resize(entry.raw_size);
+    uLongf raw_size = raw.size();
+    auto status = uncompress(reinterpret_cast<Bytef*>(raw.data()), &raw_size,
+                             reinterpret_cast<const Bytef*>(compressed.data()),
+                             compressed.size());
+    CF_EXPECT(status == Z_OK && raw_size == raw.size(),
+              "Corrupted chunk at offset " << entry.offset << " of \""
+                                           << chunks_path << "\"");
+
+    std::string_view data(raw);
+    while (data.size() >= sizeof(RecordHeader)) {
+      RecordHeader header;
+      memcpy(&header, data.data(), sizeof(header));
+      data.remove_prefix(sizeof(header));
+      CF_EXPECT(data.size() >= header.tag_size + header.line_size,
+                "Corrupted record in \"" << chunks_path << "\"");
+      LogStoreRecord record = {
+          .timestamp_ns = header.timestamp_ns,
+          .severity = header.severity,
+          .tag = data.substr(0, header.tag_size),
+          .line = data.substr(header.tag_size, header.line_size),
+      };
+      data.remove_prefix(header.tag_size + header.line_size);
+      if (Matches(record, query)) {
+        callback(record);
+      }
+    }
+  }
+  return {};
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+
+// A log store keeps every stream (launcher, kernel, logcat, ...) of an
+// instance in two files in the store directory:
+//   <stream>.chunks: zlib compressed chunks of records, one after the other.
+//   <stream>.index: one LogStoreIndexEntry per chunk.
+// Queries read the small index first and only decompress the chunks that
+// overlap the requested time range and contain the requested severities.
+//
+// Chunks are appended before their index entry, so a reader never sees an
+// entry for a chunk that isn't there yet. Lines still in a writer's current
+// chunk are not visible to readers.
+struct LogStoreIndexEntry {
+  uint64_t offset;
+  uint32_t compressed_size;
+  uint32_t raw_size;
+  // Nanoseconds since the epoch
+  uint64_t first_timestamp_ns;
+  uint64_t last_timestamp_ns;
+  uint32_t record_count;
+  // Bit n is set if the chunk has a record of severity n
+  uint16_t severity_mask;
+  uint16_t reserved;
+};
+
+// The views point into the decompressed chunk, only valid during the
+// callback.
+struct LogStoreRecord {
+  uint64_t timestamp_ns;
+  // An android::base::LogSeverity
+  uint8_t severity;
+  // The process that wrote the line, empty if the stream has only one
+  std::string_view tag;
+  std::string_view line;
+};
+
+uint64_t LogStoreNow();
+
+class LogStoreWriter {
+ public:
+  static Result<LogStoreWriter> Create(const std::string& directory,
+                                       const std::string& stream);
+
+  LogStoreWriter(LogStoreWriter&&) = default;
+  LogStoreWriter& operator=(LogStoreWriter&&) = default;
+  // Writes the current chunk
+  ~LogStoreWriter();
+
+  void Append(uint64_t timestamp_ns, uint8_t severity, std::string_view tag,
+              std::string_view line);
+  // Writes the current chunk if it's full or has been open for a while. Cheap
+  // enough to call after every batch of appends.
+  Result<void> MaybeFlush();
+  // The lines of a chunk that fails to be written are dropped.
+  Result<void> Flush();
+  // How long until MaybeFlush() writes the current chunk because of its age,
+  // or nothing if there is no chunk. Writers whose streams go quiet must wake
+  // up by then for the last lines to become visible.
+  std::optional<std::chrono::milliseconds> TimeUntilFlush() const;
+
+ private:
+  LogStoreWriter(SharedFD chunks, SharedFD index, uint64_t offset);
+
+  SharedFD chunks_;
+  SharedFD index_;
+  uint64_t offset_;
+  std::string raw_;
+  LogStoreIndexEntry entry_;
+  std::chrono::steady_clock::time_point chunk_start_;
+};
+
+struct LogStoreQuery {
+  std::optional<uint64_t> since_ns;
+  std::optional<uint64_t> until_ns;
+  uint8_t min_severity = 0;
+};
+
+// The names of the streams in a store directory
+std::vector<std::string> LogStoreStreams(const std::string& directory);
+
+// Calls the callback for the records of the stream that match the query, in
+// the order they were written.
+Result<void> QueryLogStore(
+    const std::string& directory, const std::string& stream,
+    const LogStoreQuery& query,
+    const std::function<void(const LogStoreRecord&)>& callback);
+
+}  // namespace cuttlefish
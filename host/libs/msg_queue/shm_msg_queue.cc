@@ -0,0 +1,218 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/libs/msg_queue/shm_msg_queue.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstring>
+#include <memory>
+
+#include <android-base/logging.h>
+
+namespace cuttlefish {
+namespace {
+
+constexpr std::uint32_t kMagic = 0x51534643;  // "CFSQ"
+// Set in the length of the records filling the space left at the end of the
+// ring when a message doesn't fit there.
+constexpr std::uint32_t kPadding = 1u << 31;
+
+// Every record starts with these, 8 byte aligned. `length` is written last,
+// it is 0 until the record is published and covers the whole record.
+struct RecordHeader {
+  std::atomic<std::uint32_t> length;
+  std::uint32_t message_size;
+};
+static_assert(sizeof(RecordHeader) == 8);
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free);
+
+std::size_t RecordLength(std::size_t message_size) {
+  return (sizeof(RecordHeader) + message_size + 7) & ~std::size_t{7};
+}
+
+}  // namespace
+
+// Lives at the start of the shared file, followed by the records.
+struct ShmMessageQueue::Header {
+  std::uint32_t magic;
+  std::uint32_t capacity;
+  // Bytes ever claimed by producers and released by the consumer, the
+  // difference is the part of the ring in use.
+  std::atomic<std::uint64_t> reserved;
+  std::atomic<std::uint64_t> consumed;
+  std::atomic<std::uint64_t> dropped;
+};
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+
+ShmMessageQueue::ShmMessageQueue(void* mapping, std::size_t mapping_size)
+    : mapping_(mapping), mapping_size_(mapping_size) {}
+
+ShmMessageQueue::~ShmMessageQueue() { munmap(mapping_, mapping_size_); }
+
+std::unique_ptr<ShmMessageQueue> ShmMessageQueue::Create(
+    const std::string& path, std::size_t capacity) {
+  capacity = (capacity + 7) & ~std::size_t{7};
+  if (capacity == 0 || capacity >= kPadding) {
+    LOG(ERROR) << "Invalid message queue capacity " << capacity;
+    return nullptr;
+  }
+  // only the owning user has access
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    int error_num = errno;
+    LOG(ERROR) << "Could not open " << path << ": " << strerror(error_num);
+    return nullptr;
+  }
+  // Whoever gets here first initializes the queue
+  if (flock(fd, LOCK_EX) < 0) {
+    int error_num = errno;
+    LOG(ERROR) << "Could not lock " << path << ": " << strerror(error_num);
+    close(fd);
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    int error_num = errno;
+    LOG(ERROR) << "Could not stat " << path << ": " << strerror(error_num);
+    close(fd);
+    return nullptr;
+  }
+  bool created = st.st_size == 0;
+  std::size_t mapping_size =
+      created ? sizeof(Header) + capacity : static_cast<std::size_t>(st.st_size);
+  // Zero filled, which marks every record as unpublished
+  if (created && ftruncate(fd, mapping_size) < 0) {
+    int error_num = errno;
+    LOG(ERROR) << "Could not size " << path << ": " << strerror(error_num);
+    close(fd);
+    return nullptr;
+  }
+  void* mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED) {
+    int error_num = errno;
+    LOG(ERROR) << "Could not map " << path << ": " << strerror(error_num);
+    close(fd);
+    return nullptr;
+  }
+  std::unique_ptr<ShmMessageQueue> queue(
+      new ShmMessageQueue(mapping, mapping_size));
+  auto& header = queue->header();
+  if (created) {
+    header.capacity = capacity;
+    header.magic = kMagic;
+  } else if (mapping_size < sizeof(Header) || header.magic != kMagic ||
+             header.capacity != mapping_size - sizeof(Header)) {
+    LOG(ERROR) << path << " is not a message queue";
+    close(fd);
+    return nullptr;
+  }
+  // The mapping keeps the file open, so the lock must be released by hand
+  flock(fd, LOCK_UN);
+  close(fd);
+  return queue;
+}
+
+ShmMessageQueue::Header& ShmMessageQueue::header() const {
+  return *static_cast<Header*>(mapping_);
+}
+
+std::uint8_t* ShmMessageQueue::records() const {
+  return static_cast<std::uint8_t*>(mapping_) + sizeof(Header);
+}
+
+int ShmMessageQueue::Send(const void* data, std::size_t size) {
+  auto& header = this->header();
+  const std::uint64_t capacity = header.capacity;
+  const std::uint64_t length = RecordLength(size);
+  // Leaves room for the padding before it wherever it lands
+  if (length > capacity / 2) {
+    return EMSGSIZE;
+  }
+  std::uint64_t start = header.reserved.load(std::memory_order_relaxed);
+  std::uint64_t position;
+  std::uint64_t padding;
+  do {
+    position = start % capacity;
+    padding = position + length > capacity ? capacity - position : 0;
+    auto in_use = start - header.consumed.load(std::memory_order_acquire);
+    if (in_use + padding + length > capacity) {
+      header.dropped.fetch_add(1, std::memory_order_relaxed);
+      return EAGAIN;
+    }
+  } while (!header.reserved.compare_exchange_weak(
+      start, start + padding + length, std::memory_order_acq_rel,
+      std::memory_order_relaxed));
+
+  if (padding > 0) {
+    auto record = reinterpret_cast<RecordHeader*>(records() + position);
+    record->length.store(padding | kPadding, std::memory_order_release);
+    position = 0;
+  }
+  auto record = reinterpret_cast<RecordHeader*>(records() + position);
+  record->message_size = size;
+  std::memcpy(records() + position + sizeof(RecordHeader), data, size);
+  record->length.store(length, std::memory_order_release);
+  return 0;
+}
+
+std::size_t ShmMessageQueue::ReceiveBatch(std::vector<std::string>& messages,
+                                          std::size_t max_messages) {
+  auto& header = this->header();
+  const std::uint64_t capacity = header.capacity;
+  // Only written by this process
+  std::uint64_t consumed = header.consumed.load(std::memory_order_relaxed);
+  std::size_t received = 0;
+  while (received < max_messages) {
+    auto position = consumed % capacity;
+    auto record = reinterpret_cast<RecordHeader*>(records() + position);
+    std::uint32_t length = record->length.load(std::memory_order_acquire);
+    if (length == 0) {
+      break;  // Not published yet
+    }
+    bool is_padding = length & kPadding;
+    length &= ~kPadding;
+    if (length < sizeof(RecordHeader) || length > capacity - position ||
+        (!is_padding && RecordLength(record->message_size) != length)) {
+      LOG(ERROR) << "Corrupted message queue record at " << position;
+      break;
+    }
+    if (!is_padding) {
+      messages.emplace_back(
+          reinterpret_cast<const char*>(record) + sizeof(RecordHeader),
+          record->message_size);
+      received++;
+    }
+    // Later records may start anywhere in here, unpublished
+    std::memset(records() + position, 0, length);
+    consumed += length;
+  }
+  header.consumed.store(consumed, std::memory_order_release);
+  return received;
+}
+
+std::uint64_t ShmMessageQueue::Dropped() const {
+  return header().dropped.load(std::memory_order_relaxed);
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cuttlefish {
+
+// A message queue in a ring buffer of a file shared by mapping it, for many
+// producers and a single consumer. Unlike SysVMessageQueue, sending takes no
+// system call and never blocks, and its size isn't bound by the kernel's
+// message queue limits.
+//
+// Producers claim space with a compare and swap and publish the message when
+// they are done writing it, the consumer takes the published messages in
+// order. A producer dying between both steps stalls the queue, so producers
+// shouldn't be killed while sending.
+class ShmMessageQueue {
+ public:
+  // Maps the queue at `path`, creating it with room for `capacity` bytes of
+  // messages if it doesn't exist. Returns null on failure.
+  static std::unique_ptr<ShmMessageQueue> Create(const std::string& path,
+                                                 std::size_t capacity);
+  ~ShmMessageQueue();
+
+  // Returns 0 once the message is queued, EAGAIN if the queue is full, or
+  // EMSGSIZE if it's too large to ever fit.
+  int Send(const void* data, std::size_t size);
+  // Moves up to `max_messages` of the queued messages to `messages`, without
+  // waiting for more. Only one process may receive from a queue.
+  std::size_t ReceiveBatch(std::vector<std::string>& messages,
+                           std::size_t max_messages);
+  // Messages refused because the queue was full, since it was created.
+  std::uint64_t Dropped() const;
+
+ private:
+  struct Header;
+
+  ShmMessageQueue(void* mapping, std::size_t mapping_size);
+
+  Header& header() const;
+  std::uint8_t* records() const;
+
+  void* mapping_;
+  std::size_t mapping_size_;
+};
+
+}  // namespace cuttlefish
@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/msg_queue/shm_msg_queue.h"
+
+#include <errno.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+namespace cuttlefish {
+namespace {
+
+// Records take 8 bytes of header and are 8 byte aligned, so messages of
+// kMessageSize take kRecordSize bytes of the queue.
+constexpr std::size_t kCapacity = 256;
+constexpr std::size_t kMessageSize = 48;
+constexpr std::size_t kRecordSize = 56;
+
+std::string Message(char fill, std::size_t size = kMessageSize) {
+  return std::string(size, fill);
+}
+
+int Send(ShmMessageQueue& queue, const std::string& message) {
+  return queue.Send(message.data(), message.size());
+}
+
+std::vector<std::string> ReceiveAll(ShmMessageQueue& queue) {
+  std::vector<std::string> messages;
+  queue.ReceiveBatch(messages, SIZE_MAX);
+  return messages;
+}
+
+class ShmMessageQueueTest : public ::testing::Test {
+ protected:
+  std::string Path() const { return std::string(dir_.path) + "/queue"; }
+
+  TemporaryDir dir_;
+};
+
+TEST_F(ShmMessageQueueTest, ReceivesInOrder) {
+  auto queue = ShmMessageQueue::Create(Path(), kCapacity);
+  ASSERT_NE(queue, nullptr);
+
+  ASSERT_EQ(Send(*queue, "first"), 0);
+  ASSERT_EQ(Send(*queue, ""), 0);
+  ASSERT_EQ(Send(*queue, "third"), 0);
+
+  std::vector<std::string> messages;
+  EXPECT_EQ(queue->ReceiveBatch(messages, 2), 2);
+  EXPECT_EQ(queue->ReceiveBatch(messages, 2), 1);
+  EXPECT_EQ(queue->ReceiveBatch(messages, 2), 0);
+  EXPECT_EQ(messages, (std::vector<std::string>{"first", "", "third"}));
+}
+
+TEST_F(ShmMessageQueueTest, RefusesMessagesThatCanNeverFit) {
+  auto queue = ShmMessageQueue::Create(Path(), kCapacity);
+  ASSERT_NE(queue, nullptr);
+
+  // Up to half of the queue, including the record header
+  EXPECT_EQ(Send(*queue, Message('a', kCapacity / 2 - 8 + 1)), EMSGSIZE);
+  EXPECT_EQ(Send(*queue, Message('a', kCapacity / 2 - 8)), 0);
+  EXPECT_EQ(queue->Dropped(), 0);
+}
+
+TEST_F(ShmMessageQueueTest, RefusesMessagesWhenFull) {
+  auto queue = ShmMessageQueue::Create(Path(), kCapacity);
+  ASSERT_NE(queue, nullptr);
+
+  std::size_t sent = 0;
+  for (; (sent + 1) * kRecordSize <= kCapacity; sent++) {
+    ASSERT_EQ(Send(*queue, Message('a' + sent)), 0);
+  }
+  EXPECT_EQ(Send(*queue, Message('x')), EAGAIN);
+  EXPECT_EQ(Send(*queue, Message('x')), EAGAIN);
+  EXPECT_EQ(queue->Dropped(), 2);
+
+  std::vector<std::string> messages;
+  ASSERT_EQ(queue->ReceiveBatch(messages, 1), 1);
+  EXPECT_EQ(messages[0], Message('a'));
+  // The space of the received message is free again
+  EXPECT_EQ(Send(*queue, Message('y')), 0);
+
+  messages = ReceiveAll(*queue);
+  ASSERT_EQ(messages.size(), sent);
+  EXPECT_EQ(messages.back(), Message('y'));
+}
+
+TEST_F(ShmMessageQueueTest, PadsMessagesThatDontFitAtTheEnd) {
+  auto queue = ShmMessageQueue::Create(Path(), kCapacity);
+  ASSERT_NE(queue, nullptr);
+
+  // Moves the start of the free space to kCapacity - 88
+  for (char c : {'a', 'b', 'c'}) {
+    ASSERT_EQ(Send(*queue, Message(c)), 0);
+  }
+  ASSERT_EQ(ReceiveAll(*queue).size(), 3);
+
+  // 112 bytes don't fit in the 88 left before the end, they go to the start
+  auto wrapped = Message('w', 104);
+  ASSERT_EQ(Send(*queue, wrapped), 0);
+  // The padding is in use until the consumer skips it
+  ASSERT_EQ(Send(*queue, Message('z', 120)), EAGAIN);
+  ASSERT_EQ(Send(*queue, Message('d')), 0);
+
+  auto messages = ReceiveAll(*queue);
+  EXPECT_EQ(messages, (std::vector<std::string>{wrapped, Message('d')}));
+
+  // Still usable after wrapping around again
+  for (int round = 0; round < 10; round++) {
+    ASSERT_EQ(Send(*queue, Message('e', 40 + round)), 0);
+    ASSERT_EQ(Send(*queue, Message('f', 100)), 0);
+    messages = ReceiveAll(*queue);
+    EXPECT_EQ(messages, (std::vector<std::string>{Message('e', 40 + round),
+                                                  Message('f', 100)}));
+  }
+  EXPECT_EQ(queue->Dropped(), 1);
+}
+
+TEST_F(ShmMessageQueueTest, ConcurrentProducers) {
+  constexpr int kProducers = 4;
+  constexpr int kMessagesPerProducer = 2000;
+  auto queue = ShmMessageQueue::Create(Path(), 4096);
+  ASSERT_NE(queue, nullptr);
+
+  std::vector<std::thread> producers;
+  for (int producer = 0; producer < kProducers; producer++) {
+    producers.emplace_back([&queue, producer]() {
+      for (int i = 0; i < kMessagesPerProducer; i++) {
+        // Varying sizes make the producers wrap at different places
+        auto message = std::to_string(producer) + " " + std::to_string(i) +
+                       " " + std::string(i % 97, 'p');
+        while (Send(*queue, message) == EAGAIN) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  std::vector<int> next(kProducers, 0);
+  int received = 0;
+  while (received < kProducers * kMessagesPerProducer) {
+    std::vector<std::string> messages;
+    queue->ReceiveBatch(messages, 64);
+    for (const auto& message : messages) {
+      int producer = 0;
+      int i = 0;
+      ASSERT_EQ(sscanf(message.c_str(), "%d %d", &producer, &i), 2)
+          << message;
+      ASSERT_GE(producer, 0);
+      ASSERT_LT(producer, kProducers);
+      // Each producer's messages arrive in the order they were sent
+      ASSERT_EQ(i, next[producer]) << "from producer " << producer;
+      ASSERT_EQ(message.size(), std::to_string(producer).size() +
+                                    std::to_string(i).size() + 2 + i % 97);
+      next[producer]++;
+      received++;
+    }
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  EXPECT_EQ(ReceiveAll(*queue).size(), 0);
+}
+
+TEST_F(ShmMessageQueueTest, ReopensAnExistingQueue) {
+  {
+    auto queue = ShmMessageQueue::Create(Path(), kCapacity);
+    ASSERT_NE(queue, nullptr);
+    ASSERT_EQ(Send(*queue, "kept"), 0);
+  }
+  // The capacity of the existing queue wins
+  auto queue = ShmMessageQueue::Create(Path(), 2 * kCapacity);
+  ASSERT_NE(queue, nullptr);
+  EXPECT_EQ(ReceiveAll(*queue), std::vector<std::string>{"kept"});
+  EXPECT_EQ(Send(*queue, Message('a', kCapacity / 2)), EMSGSIZE);
+
+  auto producer = ShmMessageQueue::Create(Path(), kCapacity);
+  ASSERT_NE(producer, nullptr);
+  ASSERT_EQ(Send(*producer, "shared"), 0);
+  EXPECT_EQ(ReceiveAll(*queue), std::vector<std::string>{"shared"});
+}
+
+TEST_F(ShmMessageQueueTest, RefusesOtherFiles) {
+  ASSERT_TRUE(android::base::WriteStringToFile("not a queue", Path()));
+  EXPECT_EQ(ShmMessageQueue::Create(Path(), kCapacity), nullptr);
+}
+
+}  // namespace
+}  // namespace cuttlefish
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/screen_connector/frame_deduplicator.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace cuttlefish {
+namespace {
+
+constexpr std::uint32_t kRowsPerBand = 16;
+
+// Independent accumulators let the compiler vectorize the inner loop.
+constexpr int kLanes = 4;
+constexpr std::uint64_t kMul1 = 0x9e3779b97f4a7c15ULL;
+constexpr std::uint64_t kMul2 = 0xc2b2ae3d27d4eb4fULL;
+
+inline std::uint64_t Mix(std::uint64_t hash, std::uint64_t word) {
+  hash ^= word * kMul1;
+  hash = (hash << 31) | (hash >> 33);
+  return hash * kMul2;
+}
+
+std::uint64_t BandChecksum(const std::uint8_t* band, std::uint32_t row_bytes,
+                           std::uint32_t stride_bytes, std::uint32_t rows) {
+  std::uint64_t lanes[kLanes] = {1, 2, 3, 4};
+  constexpr std::uint32_t kChunkBytes = kLanes * sizeof(std::uint64_t);
+  for (std::uint32_t row = 0; row < rows; row++) {
+    const std::uint8_t* pixels = band + row * stride_bytes;
+    std::uint32_t i = 0;
+    for (; i + kChunkBytes <= row_bytes; i += kChunkBytes) {
+      for (int lane = 0; lane < kLanes; lane++) {
+        std::uint64_t word;
+        std::memcpy(&word, pixels + i + lane * sizeof(word), sizeof(word));
+        lanes[lane] = Mix(lanes[lane], word);
+      }
+    }
+    for (; i < row_bytes; i++) {
+      lanes[0] = Mix(lanes[0], pixels[i]);
+    }
+  }
+  std::uint64_t checksum = 0;
+  for (int lane = 0; lane < kLanes; lane++) {
+    checksum = Mix(checksum, lanes[lane]);
+  }
+  return checksum;
+}
+
+}  // namespace
+
+FrameDeduplicator::FrameDeduplicator(
+    std::chrono::milliseconds keepalive_interval)
+    : keepalive_interval_(keepalive_interval) {}
+
+bool FrameDeduplicator::ShouldForward(std::uint32_t display_number,
+                                      std::uint32_t frame_width,
+                                      std::uint32_t frame_height,
+                                      std::uint32_t frame_stride_bytes,
+                                      const std::uint8_t* frame_bytes,
+                                      ScreenConnectorFrameDamage& frame_damage) {
+  if (keepalive_interval_.count() == 0) {
+    return true;
+  }
+  const auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& display = displays_[display_number];
+
+  const std::uint32_t band_count =
+      (frame_height + kRowsPerBand - 1) / kRowsPerBand;
+  const std::uint32_t row_bytes =
+      frame_width * ScreenConnectorInfo::BytesPerPixel();
+
+  if (display.width != frame_width || display.height != frame_height ||
+      display.band_checksums.size() != band_count) {
+    // Nothing to compare against, hash everything and forward the frame.
+    display.width = frame_width;
+    display.height = frame_height;
+    display.band_checksums.resize(band_count);
+    for (std::uint32_t band = 0; band < band_count; band++) {
+      const std::uint32_t first_row = band * kRowsPerBand;
+      display.band_checksums[band] = BandChecksum(
+          frame_bytes + first_row * frame_stride_bytes, row_bytes,
+          frame_stride_bytes,
+          std::min(kRowsPerBand, frame_height - first_row));
+    }
+    display.last_forwarded = now;
+    return true;
+  }
+
+  std::uint32_t first_changed_row = frame_height;
+  std::uint32_t last_changed_row = 0;
+  if (frame_damage.w > 0 && frame_damage.h > 0) {
+    const std::uint32_t first_band = frame_damage.y / kRowsPerBand;
+    const std::uint32_t end_band = std::min(
+        band_count,
+        (frame_damage.y + frame_damage.h + kRowsPerBand - 1) / kRowsPerBand);
+    for (std::uint32_t band = first_band; band < end_band; band++) {
+      const std::uint32_t first_row = band * kRowsPerBand;
+      const std::uint32_t rows =
+          std::min(kRowsPerBand, frame_height - first_row);
+      const auto checksum =
+          BandChecksum(frame_bytes + first_row * frame_stride_bytes, row_bytes,
+                       frame_stride_bytes, rows);
+      if (checksum != display.band_checksums[band]) {
+        display.band_checksums[band] = checksum;
+        first_changed_row = std::min(first_changed_row, first_row);
+        last_changed_row = std::max(last_changed_row, first_row + rows);
+      }
+    }
+  }
+
+  if (first_changed_row < last_changed_row) {
+    // Only the rows of the changed bands that were actually damaged.
+    const std::uint32_t y0 = std::max(frame_damage.y, first_changed_row);
+    const std::uint32_t y1 =
+        std::min(frame_damage.y + frame_damage.h, last_changed_row);
+    frame_damage.y = y0;
+    frame_damage.h = y1 - y0;
+    display.last_forwarded = now;
+    return true;
+  }
+
+  if (now - display.last_forwarded >= keepalive_interval_) {
+    frame_damage.w = 0;
+    frame_damage.h = 0;
+    display.last_forwarded = now;
+    return true;
+  }
+  dropped_frames_++;
+  return false;
+}
+
+void FrameDeduplicator::Reset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  displays_.clear();
+}
+
+std::uint64_t FrameDeduplicator::DroppedFrames() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return dropped_frames_;
+}
+
+}  // namespace cuttlefish
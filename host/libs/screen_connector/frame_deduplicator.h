@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "host/libs/screen_connector/screen_connector_common.h"
+
+namespace cuttlefish {
+
+// Detects guest frames whose contents are identical to the last frame that
+// was forwarded for the same display, so they can be dropped before being
+// converted and encoded.
+//
+// Frames are split in horizontal bands of rows and a checksum is kept for each
+// band. Only bands touched by the frame damage are hashed again, the rest are
+// known to be unchanged.
+class FrameDeduplicator {
+ public:
+  // An identical frame is still forwarded if no frame was forwarded for its
+  // display in the last keepalive_interval. A zero interval disables
+  // deduplication altogether.
+  FrameDeduplicator(std::chrono::milliseconds keepalive_interval);
+
+  // Returns whether the frame should be forwarded to the streamer. When it
+  // should, frame_damage is narrowed down to the bands that actually changed.
+  bool ShouldForward(std::uint32_t display_number, std::uint32_t frame_width,
+                     std::uint32_t frame_height,
+                     std::uint32_t frame_stride_bytes,
+                     const std::uint8_t* frame_bytes,
+                     ScreenConnectorFrameDamage& frame_damage);
+
+  // Forgets the contents of every display, e.g. because something else was
+  // shown on them in the meantime. The next frame of each display is always
+  // forwarded.
+  void Reset();
+
+  std::uint64_t DroppedFrames() const;
+
+ private:
+  struct DisplayState {
+    std::uint32_t width = 0;
+    std::uint32_t height = 0;
+    std::vector<std::uint64_t> band_checksums;
+    std::chrono::steady_clock::time_point last_forwarded;
+  };
+
+  const std::chrono::milliseconds keepalive_interval_;
+  mutable std::mutex mutex_;
+  std::unordered_map<std::uint32_t, DisplayState> displays_;
+  std::uint64_t dropped_frames_ = 0;
+};
+
+}  // namespace cuttlefish
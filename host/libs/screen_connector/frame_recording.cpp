@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/screen_connector/frame_recording.h"
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include <android-base/logging.h>
+
+#include "common/libs/fs/shared_buf.h"
+
+namespace cuttlefish {
+namespace {
+
+// Larger than any display the guest may have, protects from reading garbage
+constexpr std::uint32_t kMaxDimension = 1 << 14;
+
+}  // namespace
+
+Result<std::vector<RecordedFrame>> ReadFrameRecording(const std::string& path) {
+  auto fd = SharedFD::Open(path, O_RDONLY);
+  CF_EXPECT(fd->IsOpen(),
+            "Failed to open \"" << path << "\": " << fd->StrError());
+  std::vector<RecordedFrame> frames;
+  for (;;) {
+    FrameRecordHeader header;
+    auto read = ReadExactBinary(fd, &header);
+    if (read == 0) {
+      break;
+    }
+    CF_EXPECT(read == static_cast<ssize_t>(sizeof(header)),
+              "Failed to read frame record header: " << fd->StrError());
+    CF_EXPECT(header.display_number < ScreenConnectorInfo::MaxScreenCount(),
+              "Invalid display number: " << header.display_number);
+    CF_EXPECT(header.width <= kMaxDimension && header.height <= kMaxDimension,
+              "Frame too large: " << header.width << "x" << header.height);
+    CF_EXPECT(header.damage_x <= header.width &&
+                  header.damage_w <= header.width - header.damage_x &&
+                  header.damage_y <= header.height &&
+                  header.damage_h <= header.height - header.damage_y,
+              "Damage outside of the frame");
+    RecordedFrame frame{
+        .timestamp = std::chrono::microseconds(header.timestamp_us),
+        .display_number = header.display_number,
+        .width = header.width,
+        .height = header.height,
+        .damage =
+            {
+                .x = header.damage_x,
+                .y = header.damage_y,
+                .w = header.damage_w,
+                .h = header.damage_h,
+            },
+        .pixels = std::vector<std::uint8_t>(
+            std::size_t{header.damage_w} * header.damage_h *
+            ScreenConnectorInfo::BytesPerPixel()),
+    };
+    if (!frame.pixels.empty()) {
+      CF_EXPECT(ReadExact(fd, reinterpret_cast<char*>(frame.pixels.data()),
+                          frame.pixels.size()) ==
+                    static_cast<ssize_t>(frame.pixels.size()),
+                "Failed to read frame pixels: " << fd->StrError());
+    }
+    frames.emplace_back(std::move(frame));
+  }
+  return frames;
+}
+
+Result<std::unique_ptr<FrameRecorder>> FrameRecorder::Create(
+    const std::string& path) {
+  auto fd = SharedFD::Open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  CF_EXPECT(fd->IsOpen(),
+            "Failed to open \"" << path << "\": " << fd->StrError());
+  return std::unique_ptr<FrameRecorder>(new FrameRecorder(fd));
+}
+
+FrameRecorder::FrameRecorder(SharedFD fd)
+    : fd_(fd), start_(std::chrono::steady_clock::now()) {}
+
+void FrameRecorder::OnFrame(std::uint32_t display_number, std::uint32_t width,
+                            std::uint32_t height, std::uint32_t stride_bytes,
+                            const std::uint8_t* pixels,
+                            const ScreenConnectorFrameDamage& damage) {
+  const std::uint32_t x = std::min(damage.x, width);
+  const std::uint32_t y = std::min(damage.y, height);
+  FrameRecordHeader header{
+      .timestamp_us = 0,
+      .display_number = display_number,
+      .width = width,
+      .height = height,
+      .damage_x = x,
+      .damage_y = y,
+      .damage_w = std::min(damage.w, width - x),
+      .damage_h = std::min(damage.h, height - y),
+  };
+  const std::size_t row_bytes =
+      std::size_t{header.damage_w} * ScreenConnectorInfo::BytesPerPixel();
+  std::vector<char> record(sizeof(header) + row_bytes * header.damage_h);
+  for (std::uint32_t row = 0; row < header.damage_h; row++) {
+    std::memcpy(record.data() + sizeof(header) + row * row_bytes,
+                pixels + (y + row) * stride_bytes +
+                    x * ScreenConnectorInfo::BytesPerPixel(),
+                row_bytes);
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Timestamps are taken with the lock held to keep them in file order
+  header.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::steady_clock::now() - start_)
+                            .count();
+  std::memcpy(record.data(), &header, sizeof(header));
+  if (WriteAll(fd_, record) != static_cast<ssize_t>(record.size())) {
+    LOG(ERROR) << "Failed to write frame record: " << fd_->StrError();
+  }
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "common/libs/fs/shared_fd.h"
+#include "common/libs/utils/result.h"
+#include "host/libs/screen_connector/screen_connector_common.h"
+
+namespace cuttlefish {
+
+// A frame recording is a sequence of records, each made of a
+// FrameRecordHeader followed by the pixels of the frame's damaged area as
+// tightly packed RGBA rows. Replaying them in order into a buffer per display
+// reproduces what the guest showed.
+struct FrameRecordHeader {
+  // Since the beginning of the recording
+  std::uint64_t timestamp_us;
+  std::uint32_t display_number;
+  std::uint32_t width;
+  std::uint32_t height;
+  std::uint32_t damage_x;
+  std::uint32_t damage_y;
+  std::uint32_t damage_w;
+  std::uint32_t damage_h;
+};
+
+struct RecordedFrame {
+  std::chrono::microseconds timestamp;
+  std::uint32_t display_number;
+  std::uint32_t width;
+  std::uint32_t height;
+  ScreenConnectorFrameDamage damage;
+  std::vector<std::uint8_t> pixels;
+};
+
+Result<std::vector<RecordedFrame>> ReadFrameRecording(const std::string& path);
+
+// Writes the frames of the guest as they are committed. Safe to use from the
+// threads of different displays.
+class FrameRecorder {
+ public:
+  static Result<std::unique_ptr<FrameRecorder>> Create(const std::string& path);
+
+  void OnFrame(std::uint32_t display_number, std::uint32_t width,
+               std::uint32_t height, std::uint32_t stride_bytes,
+               const std::uint8_t* pixels,
+               const ScreenConnectorFrameDamage& damage);
+
+ private:
+  FrameRecorder(SharedFD fd);
+
+  SharedFD fd_;
+  std::chrono::steady_clock::time_point start_;
+  std::mutex mutex_;
+};
+
+}  // namespace cuttlefish
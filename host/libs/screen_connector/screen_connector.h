@@ -17,13 +17,19 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
 #include <functional>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <shared_mutex>
 #include <string>
 #include <thread>
 #include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <chrono>
 
 #include <android-base/logging.h>
 
@@ -33,9 +39,12 @@
 #include "host/libs/config/cuttlefish_config.h"
 #include "host/libs/confui/host_mode_ctrl.h"
 #include "host/libs/confui/host_utils.h"
+#include "host/libs/screen_connector/frame_deduplicator.h"
+#include "host/libs/screen_connector/frame_recording.h"
 #include "host/libs/screen_connector/screen_connector_common.h"
 #include "host/libs/screen_connector/screen_connector_multiplexer.h"
 #include "host/libs/screen_connector/screen_connector_queue.h"
+#include "host/libs/screen_connector/screenshot_server.h"
 #include "host/libs/screen_connector/wayland_screen_connector.h"
 
 namespace cuttlefish {
@@ -63,6 +72,7 @@ class ScreenConnector : public ScreenConnectorInfo,
       std::uint32_t /*display_number*/, std::uint32_t /*frame_width*/,
       std::uint32_t /*frame_height*/, std::uint32_t /*frame_stride_bytes*/,
       std::uint8_t* /*frame_bytes*/,
+      const ScreenConnectorFrameDamage& /*frame_damage*/,
       /* ScImpl enqueues this type into the Q */
       ProcessedFrameType& msg)>;
 
@@ -74,13 +84,24 @@ class ScreenConnector : public ScreenConnectorInfo,
         config->gpu_mode() == cuttlefish::kGpuModeGfxStream ||
         config->gpu_mode() == cuttlefish::kGpuModeGuestSwiftshader) {
       raw_ptr = new ScreenConnector<ProcessedFrameType>(
-          std::make_unique<WaylandScreenConnector>(frames_fd), host_mode_ctrl);
+          std::make_unique<WaylandScreenConnector>(frames_fd), host_mode_ctrl,
+          std::chrono::milliseconds(config->display_frame_keepalive_ms()));
     } else {
       LOG(FATAL) << "Invalid gpu mode: " << config->gpu_mode();
     }
     return std::unique_ptr<ScreenConnector<ProcessedFrameType>>(raw_ptr);
   }
 
+  // Takes the frames from the given source instead of the guest, so that the
+  // pipeline can be exercised without a device.
+  static std::unique_ptr<ScreenConnector<ProcessedFrameType>> ForSource(
+      std::unique_ptr<ScreenConnectorSource> source,
+      HostModeCtrl& host_mode_ctrl, std::chrono::milliseconds frame_keepalive) {
+    return std::unique_ptr<ScreenConnector<ProcessedFrameType>>(
+        new ScreenConnector<ProcessedFrameType>(
+            std::move(source), host_mode_ctrl, frame_keepalive));
+  }
+
   virtual ~ScreenConnector() = default;
 
   /**
@@ -89,28 +110,69 @@ class ScreenConnector : public ScreenConnectorInfo,
    *
    */
   void SetCallback(GenerateProcessedFrameCallback&& frame_callback) {
-    std::lock_guard<std::mutex> lock(streamer_callback_mutex_);
+    std::unique_lock<std::shared_mutex> lock(streamer_callback_mutex_);
     callback_from_streamer_ = std::move(frame_callback);
     streamer_callback_set_cv_.notify_all();
 
     sc_android_src_->SetFrameCallback(
         [this](std::uint32_t display_number, std::uint32_t frame_w,
                std::uint32_t frame_h, std::uint32_t frame_stride_bytes,
-               std::uint8_t* frame_bytes) {
+               std::uint8_t* frame_bytes,
+               const ScreenConnectorFrameDamage& frame_damage) {
+          // Wayland calls this from within the guest's surface commit.
+          const auto committed = ScreenConnectorFrameTimestamps::Clock::now();
           const bool is_confui_mode = host_mode_ctrl_.IsConfirmatioUiMode();
           if (is_confui_mode) {
+            frame_deduplicator_.Reset();
+            return;
+          }
+
+          if (screenshot_server_) {
+            screenshot_server_->OnFrame(display_number, frame_w, frame_h,
+                                        frame_stride_bytes, frame_bytes,
+                                        frame_damage);
+          }
+          if (frame_recorder_) {
+            frame_recorder_->OnFrame(display_number, frame_w, frame_h,
+                                     frame_stride_bytes, frame_bytes,
+                                     frame_damage);
+          }
+
+          auto damage = frame_damage;
+          {
+            // Whatever changed while Confirmation UI was shown never reached
+            // the streamer, so the first frame after it is converted fully.
+            std::lock_guard<std::mutex> lock(frame_cache_mutex_);
+            if (display_number < full_damage_pending_.size() &&
+                full_damage_pending_[display_number]) {
+              full_damage_pending_[display_number] = false;
+              damage = ScreenConnectorFrameDamage::Full(frame_w, frame_h);
+            }
+          }
+          if (!frame_deduplicator_.ShouldForward(display_number, frame_w,
+                                                 frame_h, frame_stride_bytes,
+                                                 frame_bytes, damage)) {
             return;
           }
 
           ProcessedFrameType processed_frame;
+          processed_frame.timestamps_.committed = committed;
 
           {
-            std::lock_guard<std::mutex> lock(streamer_callback_mutex_);
+            // Frames of different displays are processed at the same time
+            std::shared_lock<std::shared_mutex> lock(streamer_callback_mutex_);
             callback_from_streamer_(display_number, frame_w, frame_h,
-                                    frame_stride_bytes, frame_bytes,
+                                    frame_stride_bytes, frame_bytes, damage,
                                     processed_frame);
           }
 
+          if constexpr (kIsFrameCacheable) {
+            std::lock_guard<std::mutex> lock(frame_cache_mutex_);
+            last_android_frames_.insert_or_assign(display_number,
+                                                  processed_frame);
+          }
+          processed_frame.timestamps_.queued =
+              ScreenConnectorFrameTimestamps::Clock::now();
           sc_frame_multiplexer_.PushToAndroidQueue(std::move(processed_frame));
         });
   }
@@ -122,12 +184,44 @@ class ScreenConnector : public ScreenConnectorInfo,
     return false;
   }
 
-  /* returns the processed frame that also includes meta-info such as success/fail
-   * and display number from the guest
+  /* returns the next processed frame of the display, which also includes
+   * meta-info such as success/fail
    *
-   * NOTE THAT THIS IS THE ONLY CONSUMER OF THE TWO QUEUES
+   * NOTE THAT THIS IS THE ONLY CONSUMER OF THE TWO QUEUES OF THE DISPLAY, it
+   * must be called from a single thread per display
    */
-  ProcessedFrameType OnNextFrame() { return sc_frame_multiplexer_.Pop(); }
+  ProcessedFrameType OnNextFrame(std::uint32_t display_number) {
+    return sc_frame_multiplexer_.Pop(display_number);
+  }
+
+  // Android frames that never reached the streamer, either because they were
+  // identical to the previous one or because a newer frame replaced them.
+  std::uint64_t DroppedIdenticalFrames() const {
+    return frame_deduplicator_.DroppedFrames();
+  }
+  std::uint64_t DroppedStaleFrames() const {
+    return sc_frame_multiplexer_.DroppedAndroidFrames();
+  }
+
+  // Starts serving screenshots of the latest frames on the given listening
+  // socket. See ScreenshotServer for the protocol. Must be called before
+  // SetCallback(), frames start flowing from then on.
+  void StartScreenshotServer(SharedFD server) {
+    screenshot_server_ = std::make_unique<ScreenshotServer>(
+        std::move(server), ScreenConnectorInfo::MaxScreenCount());
+  }
+
+  // Writes every frame the guest commits, for replaying them without a
+  // device. Must be called before SetCallback().
+  void StartFrameRecording(std::unique_ptr<FrameRecorder> recorder) {
+    frame_recorder_ = std::move(recorder);
+  }
+
+  // Paces the guest's frames of a display added while the device runs
+  void SetDisplayRefreshRate(std::uint32_t display_number,
+                             std::uint32_t refresh_rate_hz) {
+    sc_android_src_->SetDisplayRefreshRate(display_number, refresh_rate_hz);
+  }
 
   /**
    * ConfUi calls this when it has frames to render
@@ -148,30 +242,104 @@ class ScreenConnector : public ScreenConnectorInfo,
       ConfUiLog(ERROR) << "callback function to process frames is not yet set";
       return false;
     }
+    // The next Android frame must be shown even if it didn't change.
+    frame_deduplicator_.Reset();
+    {
+      std::lock_guard<std::mutex> lock(frame_cache_mutex_);
+      full_damage_pending_.assign(ScreenConnectorInfo::MaxScreenCount(), true);
+    }
+    if (screenshot_server_) {
+      screenshot_server_->OnFrame(
+          display_number, frame_width, frame_height, frame_stride_bytes,
+          frame_bytes,
+          ScreenConnectorFrameDamage::Full(frame_width, frame_height));
+    }
     ProcessedFrameType processed_frame;
+    processed_frame.timestamps_.committed =
+        ScreenConnectorFrameTimestamps::Clock::now();
     auto this_thread_name = cuttlefish::confui::thread::GetName();
     ConfUiLog(DEBUG) << this_thread_name
                      << "is sending a #" + std::to_string(render_confui_cnt_)
                      << "Conf UI frame";
-    callback_from_streamer_(display_number, frame_width, frame_height,
-                            frame_stride_bytes, frame_bytes, processed_frame);
+    if constexpr (kIsFrameCacheable) {
+      // The dialog is static, so the same frame is usually sent again and
+      // again; the conversion it went through the first time is reused.
+      std::lock_guard<std::mutex> lock(frame_cache_mutex_);
+      auto& cached = confui_frames_[display_number];
+      const std::size_t frame_size = frame_height * frame_stride_bytes;
+      if (cached.width != frame_width || cached.height != frame_height ||
+          cached.stride_bytes != frame_stride_bytes ||
+          std::memcmp(cached.bytes.data(), frame_bytes, frame_size) != 0) {
+        // Confirmation UI frames are always rendered from scratch.
+        callback_from_streamer_(
+            display_number, frame_width, frame_height, frame_stride_bytes,
+            frame_bytes,
+            ScreenConnectorFrameDamage::Full(frame_width, frame_height),
+            processed_frame);
+        cached.width = frame_width;
+        cached.height = frame_height;
+        cached.stride_bytes = frame_stride_bytes;
+        cached.bytes.assign(frame_bytes, frame_bytes + frame_size);
+        cached.processed_frame = processed_frame;
+      } else {
+        const auto committed = processed_frame.timestamps_.committed;
+        processed_frame = cached.processed_frame;
+        processed_frame.timestamps_ = {};
+        processed_frame.timestamps_.committed = committed;
+      }
+    } else {
+      // Confirmation UI frames are always rendered from scratch.
+      callback_from_streamer_(
+          display_number, frame_width, frame_height, frame_stride_bytes,
+          frame_bytes,
+          ScreenConnectorFrameDamage::Full(frame_width, frame_height),
+          processed_frame);
+    }
     // now add processed_frame to the queue
+    processed_frame.timestamps_.queued =
+        ScreenConnectorFrameTimestamps::Clock::now();
     sc_frame_multiplexer_.PushToConfUiQueue(std::move(processed_frame));
     return true;
   }
 
+  /**
+   * Confirmation UI calls this right after it switched back to Android mode
+   *
+   * The Android frames that arrived in Confirmation UI mode were dropped, and
+   * the guest only sends another one when its screen changes, so the frame
+   * converted last is handed to the streamer again instead.
+   */
+  void RestoreAndroidFrames() override {
+    // The next new frame must be shown even if it didn't change.
+    frame_deduplicator_.Reset();
+    if constexpr (kIsFrameCacheable) {
+      std::lock_guard<std::mutex> lock(frame_cache_mutex_);
+      for (const auto& [display_number, last_frame] : last_android_frames_) {
+        ProcessedFrameType processed_frame = last_frame;
+        processed_frame.timestamps_ = {};
+        processed_frame.timestamps_.committed =
+            ScreenConnectorFrameTimestamps::Clock::now();
+        processed_frame.timestamps_.queued =
+            processed_frame.timestamps_.committed;
+        sc_frame_multiplexer_.PushToAndroidQueue(std::move(processed_frame));
+      }
+    }
+  }
+
  protected:
-  ScreenConnector(std::unique_ptr<WaylandScreenConnector>&& impl,
-                  HostModeCtrl& host_mode_ctrl)
+  ScreenConnector(std::unique_ptr<ScreenConnectorSource>&& impl,
+                  HostModeCtrl& host_mode_ctrl,
+                  std::chrono::milliseconds frame_keepalive)
       : sc_android_src_{std::move(impl)},
         host_mode_ctrl_{host_mode_ctrl},
         on_next_frame_cnt_{0},
         render_confui_cnt_{0},
-        sc_frame_multiplexer_{host_mode_ctrl_} {}
+        sc_frame_multiplexer_{host_mode_ctrl_},
+        frame_deduplicator_{frame_keepalive} {}
   ScreenConnector() = delete;
 
  private:
-  std::unique_ptr<WaylandScreenConnector> sc_android_src_;
+  std::unique_ptr<ScreenConnectorSource> sc_android_src_;
   HostModeCtrl& host_mode_ctrl_;
   unsigned long long int on_next_frame_cnt_;
   unsigned long long int render_confui_cnt_;
@@ -182,9 +350,34 @@ class ScreenConnector : public ScreenConnectorInfo,
    * at a time from the right queue
    */
   FrameMultiplexer sc_frame_multiplexer_;
+  // drops Android frames identical to the previous one of the same display
+  FrameDeduplicator frame_deduplicator_;
+  std::unique_ptr<ScreenshotServer> screenshot_server_;
+  std::unique_ptr<FrameRecorder> frame_recorder_;
   GenerateProcessedFrameCallback callback_from_streamer_;
-  std::mutex streamer_callback_mutex_; // mutex to set & read callback_from_streamer_
+  std::shared_mutex streamer_callback_mutex_; // mutex to set & read callback_from_streamer_
   std::condition_variable streamer_callback_set_cv_;
+
+  /*
+   * Processed frames are only kept to be sent again if they can be copied.
+   * The streamer's frames share their converted buffer when copied.
+   */
+  static constexpr bool kIsFrameCacheable =
+      std::is_copy_constructible_v<ProcessedFrameType> &&
+      std::is_copy_assignable_v<ProcessedFrameType>;
+  struct CachedConfUiFrame {
+    std::uint32_t width = 0;
+    std::uint32_t height = 0;
+    std::uint32_t stride_bytes = 0;
+    // the raw frame, to tell whether a new one is any different
+    std::vector<std::uint8_t> bytes;
+    ProcessedFrameType processed_frame;
+  };
+  std::mutex frame_cache_mutex_;  // guards the members below
+  std::unordered_map<std::uint32_t, CachedConfUiFrame> confui_frames_;
+  std::unordered_map<std::uint32_t, ProcessedFrameType> last_android_frames_;
+  // per display, whether its next Android frame must be converted fully
+  std::vector<bool> full_damage_pending_;
 };
 
 }  // namespace cuttlefish
@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <chrono>
 #include <cstdint>
 #include <functional>
 
@@ -33,17 +34,47 @@ struct is_movable {
       std::is_move_assignable<T>::value;
 };
 
+// The rectangle of a frame, in pixels, that may differ from the previous frame
+// of the same display. Everything outside of it is unchanged.
+struct ScreenConnectorFrameDamage {
+  std::uint32_t x;
+  std::uint32_t y;
+  std::uint32_t w;
+  std::uint32_t h;
+
+  static ScreenConnectorFrameDamage Full(std::uint32_t frame_width,
+                                         std::uint32_t frame_height) {
+    return {.x = 0, .y = 0, .w = frame_width, .h = frame_height};
+  }
+};
+
 // this callback type is going directly to socket-based or wayland ScreenConnector
 using GenerateProcessedFrameCallbackImpl =
     std::function<void(std::uint32_t /*display_number*/,      //
                        std::uint32_t /*frame_width*/,         //
                        std::uint32_t /*frame_height*/,        //
                        std::uint32_t /*frame_stride_bytes*/,  //
-                       std::uint8_t* /*frame_pixels*/)>;
+                       std::uint8_t* /*frame_pixels*/,        //
+                       const ScreenConnectorFrameDamage& /*frame_damage*/)>;
+
+// Where the frames of the displays come from: the guest's compositor, or a
+// replay of recorded frames when benchmarking the pipeline without a device.
+class ScreenConnectorSource {
+ public:
+  virtual ~ScreenConnectorSource() = default;
+  virtual void SetFrameCallback(
+      GenerateProcessedFrameCallbackImpl frame_callback) = 0;
+  virtual void SetDisplayRefreshRate(std::uint32_t display_number,
+                                     std::uint32_t refresh_rate_hz) = 0;
+};
 
 struct ScreenConnectorInfo {
   // functions are intended to be inlined
   static constexpr std::uint32_t BytesPerPixel() { return 4; }
+  // Displays may be added while the device runs, up to the number of
+  // scanouts of a virtio-gpu device. Per display state is sized for all of
+  // them.
+  static constexpr std::uint32_t MaxScreenCount() { return 16; }
   static std::uint32_t ScreenCount() {
     auto config = ChkAndGetConfig();
     auto display_configs = config->display_configs();
@@ -91,14 +122,31 @@ struct ScreenConnectorFrameRenderer {
                                     std::uint32_t frame_stride_bytes,
                                     std::uint8_t* frame_bytes) = 0;
   virtual bool IsCallbackSet() const = 0;
+  // Sends the latest Android frame of each display again, for when the
+  // displays are handed back to Android and the guest may not commit a new
+  // frame any time soon.
+  virtual void RestoreAndroidFrames() = 0;
   virtual ~ScreenConnectorFrameRenderer() = default;
 };
 
+// When a frame went through each stage on its way to the streamer, so that
+// latency can be attributed to them. Stages a frame skipped are left unset.
+struct ScreenConnectorFrameTimestamps {
+  using Clock = std::chrono::steady_clock;
+  // The guest committed the frame to the compositor
+  Clock::time_point committed;
+  Clock::time_point conversion_started;
+  Clock::time_point conversion_finished;
+  // The frame was handed to the queue the streamer pops from
+  Clock::time_point queued;
+};
+
 // this is inherited by the data type that represents the processed frame
 // being moved around.
 struct ScreenConnectorFrameInfo {
   std::uint32_t display_number_;
   bool is_success_;
+  ScreenConnectorFrameTimestamps timestamps_;
 };
 
 }  // namespace cuttlefish
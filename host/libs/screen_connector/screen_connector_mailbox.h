@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include <android-base/logging.h>
+
+#include "common/libs/concurrency/triple_buffer.h"
+#include "host/libs/screen_connector/screen_connector_common.h"
+
+namespace cuttlefish {
+
+// Drop-in replacement for ScreenConnectorQueue, as seen by the Multiplexer,
+// holding at most the latest frame of each display.
+//
+// Each display gets a lock-free TripleBuffer, so neither the producer, the
+// Wayland server thread, nor the consumer, the streamer, ever takes a lock or
+// waits on the other to hand over a frame. It must be used by a single
+// producer thread and a single consumer thread.
+template <typename T>
+class ScreenConnectorMailbox {
+ public:
+  static_assert(is_movable<T>::value,
+                "Items in ScreenConnectorMailbox should be std::mov-able");
+  static_assert(std::is_base_of<ScreenConnectorFrameInfo, T>::value,
+                "Items in ScreenConnectorMailbox should be frames");
+
+  ScreenConnectorMailbox(const std::uint32_t display_count) {
+    for (std::uint32_t i = 0; i < display_count; i++) {
+      displays_.emplace_back(std::make_unique<TripleBuffer<T>>());
+    }
+  }
+  ScreenConnectorMailbox(const ScreenConnectorMailbox&) = delete;
+  ScreenConnectorMailbox& operator=(const ScreenConnectorMailbox&) = delete;
+
+  bool IsEmpty() const {
+    for (const auto& display : displays_) {
+      if (display->HasValue()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // frames replaced by a newer one before the consumer popped them
+  std::uint64_t DroppedCount() const {
+    return dropped_count_.load(std::memory_order_relaxed);
+  }
+
+  // Returns whether the number of pending frames grew, which is false when
+  // the frame replaced a pending one of the same display.
+  bool Push(T&& item) {
+    const auto display_number = item.display_number_;
+    CHECK(display_number < displays_.size())
+        << "Frame received for unknown display " << display_number;
+    if (!displays_[display_number]->Write(std::move(item))) {
+      dropped_count_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    return true;
+  }
+  void Push(T& item) = delete;
+  void Push(const T& item) = delete;
+
+  // Must only be called when not IsEmpty(). Displays are visited round robin
+  // so a busy display can't starve the others.
+  T Pop() {
+    for (std::size_t i = 0; i < displays_.size(); i++) {
+      auto& display = displays_[next_display_];
+      next_display_ = (next_display_ + 1) % displays_.size();
+      if (auto item = display->Read(); item) {
+        return std::move(*item);
+      }
+    }
+    LOG(FATAL) << "Pop() called on an empty ScreenConnectorMailbox";
+    return T();
+  }
+
+ private:
+  std::vector<std::unique_ptr<TripleBuffer<T>>> displays_;
+  std::size_t next_display_ = 0;  // only used by the consumer
+  std::atomic<std::uint64_t> dropped_count_{0};
+};
+
+}  // namespace cuttlefish
@@ -17,53 +17,80 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
+#include <vector>
 
 #include "common/libs/concurrency/multiplexer.h"
 #include "common/libs/confui/confui.h"
 
 #include "host/libs/confui/host_mode_ctrl.h"
-#include "host/libs/screen_connector/screen_connector_queue.h"
+#include "host/libs/screen_connector/screen_connector_common.h"
+#include "host/libs/screen_connector/screen_connector_mailbox.h"
 
 namespace cuttlefish {
 template <typename ProcessedFrameType>
 class ScreenConnectorInputMultiplexer {
-  using Queue = ScreenConnectorQueue<ProcessedFrameType>;
+  using Queue = ScreenConnectorMailbox<ProcessedFrameType>;
   using Multiplexer = Multiplexer<ProcessedFrameType, Queue>;
 
  public:
   ScreenConnectorInputMultiplexer(HostModeCtrl& host_mode_ctrl)
       : host_mode_ctrl_(host_mode_ctrl) {
-    sc_android_queue_id_ =
-        multiplexer_.RegisterQueue(multiplexer_.CreateQueue(/* q size */ 2));
-    sc_confui_queue_id_ =
-        multiplexer_.RegisterQueue(multiplexer_.CreateQueue(/* q size */ 2));
+    // Each display has its own pair of queues, so a display whose consumer is
+    // slow doesn't hold back the frames of the others.
+    //
+    // Neither the Wayland server thread nor Confirmation UI must ever wait on
+    // the streamer, so a newer frame replaces the pending one of the same
+    // display instead.
+    const auto display_count = ScreenConnectorInfo::MaxScreenCount();
+    for (std::uint32_t i = 0; i < display_count; i++) {
+      auto& display = *displays_.emplace_back(std::make_unique<Display>());
+      auto android_queue = display.multiplexer.CreateQueue(display_count);
+      display.android_queue = android_queue.get();
+      display.android_queue_id =
+          display.multiplexer.RegisterQueue(std::move(android_queue));
+      display.confui_queue_id = display.multiplexer.RegisterQueue(
+          display.multiplexer.CreateQueue(display_count));
+    }
   }
 
   virtual ~ScreenConnectorInputMultiplexer() = default;
 
   void PushToAndroidQueue(ProcessedFrameType&& t) {
-    multiplexer_.Push(sc_android_queue_id_, std::move(t));
+    auto& display = GetDisplay(t.display_number_);
+    display.multiplexer.Push(display.android_queue_id, std::move(t));
   }
 
   void PushToConfUiQueue(ProcessedFrameType&& t) {
-    multiplexer_.Push(sc_confui_queue_id_, std::move(t));
+    auto& display = GetDisplay(t.display_number_);
+    display.multiplexer.Push(display.confui_queue_id, std::move(t));
+  }
+
+  // Android frames replaced by a newer one before the streamer got them
+  std::uint64_t DroppedAndroidFrames() const {
+    std::uint64_t dropped = 0;
+    for (const auto& display : displays_) {
+      dropped += display->android_queue->DroppedCount();
+    }
+    return dropped;
   }
 
-  // customize Pop()
-  ProcessedFrameType Pop() {
-    on_next_frame_cnt_++;
+  // customize Pop(), only one thread may pop the frames of a display
+  ProcessedFrameType Pop(std::uint32_t display_number) {
+    auto& display = GetDisplay(display_number);
+    display.pop_cnt++;
 
     // is_discard_frame is thread-specific
     bool is_discard_frame = false;
 
     // callback to select the queue index, and update is_discard_frame
-    auto selector = [this, &is_discard_frame]() -> int {
-      if (multiplexer_.IsEmpty(sc_android_queue_id_)) {
+    auto selector = [this, &display, &is_discard_frame]() -> int {
+      if (display.multiplexer.IsEmpty(display.android_queue_id)) {
         ConfUiLog(VERBOSE)
             << "Streamer gets Conf UI frame with host ctrl mode = "
             << static_cast<std::uint32_t>(host_mode_ctrl_.GetMode())
-            << " and cnd = #" << on_next_frame_cnt_;
-        return sc_confui_queue_id_;
+            << " and cnd = #" << display.pop_cnt;
+        return display.confui_queue_id;
       }
       auto mode = host_mode_ctrl_.GetMode();
       if (mode != HostModeCtrl::ModeType::kAndroidMode) {
@@ -72,21 +99,21 @@ class ScreenConnectorInputMultiplexer {
         ConfUiLog(VERBOSE)
             << "Streamer ignores Android frame with host ctrl mode ="
             << static_cast<std::uint32_t>(mode) << "and cnd = #"
-            << on_next_frame_cnt_;
+            << display.pop_cnt;
         is_discard_frame = true;
       }
       ConfUiLog(VERBOSE) << "Streamer gets Android frame with host ctrl mode ="
                          << static_cast<std::uint32_t>(mode) << "and cnd = #"
-                         << on_next_frame_cnt_;
-      return sc_android_queue_id_;
+                         << display.pop_cnt;
+      return display.android_queue_id;
     };
 
     while (true) {
       ConfUiLog(VERBOSE) << "Streamer waiting Semaphore with host ctrl mode ="
                          << static_cast<std::uint32_t>(
                                 host_mode_ctrl_.GetMode())
-                         << " and cnd = #" << on_next_frame_cnt_;
-      auto processed_frame = multiplexer_.Pop(selector);
+                         << " and cnd = #" << display.pop_cnt;
+      auto processed_frame = display.multiplexer.Pop(selector);
       if (!is_discard_frame) {
         return processed_frame;
       }
@@ -95,10 +122,21 @@ class ScreenConnectorInputMultiplexer {
   }
 
  private:
+  struct Display {
+    Multiplexer multiplexer;
+    Queue* android_queue;  // owned by multiplexer
+    int android_queue_id;
+    int confui_queue_id;
+    unsigned long long int pop_cnt = 0;
+  };
+
+  Display& GetDisplay(std::uint32_t display_number) {
+    CHECK(display_number < displays_.size())
+        << "Frame received for unknown display " << display_number;
+    return *displays_[display_number];
+  }
+
   HostModeCtrl& host_mode_ctrl_;
-  Multiplexer multiplexer_;
-  unsigned long long int on_next_frame_cnt_;
-  int sc_android_queue_id_;
-  int sc_confui_queue_id_;
+  std::vector<std::unique_ptr<Display>> displays_;
 };
 }  // end of namespace cuttlefish
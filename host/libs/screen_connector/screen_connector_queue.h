@@ -16,8 +16,11 @@
 
 #pragma once
 
+#include <algorithm>
 #include <condition_variable>
+#include <cstdint>
 #include <deque>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <thread>
@@ -33,8 +36,26 @@ class ScreenConnectorQueue {
   static_assert( is_movable<T>::value,
                  "Items in ScreenConnectorQueue should be std::mov-able");
 
-  ScreenConnectorQueue(const int q_max_size = 2)
-      : q_mutex_(std::make_unique<std::mutex>()), q_max_size_{q_max_size} {}
+  // What Push does when the queue already holds q_max_size items
+  enum class FullQueuePolicy {
+    // block the producer until the consumer drained the queue
+    kWaitEmpty,
+    // never block, the new item takes the place of an older one
+    kReplaceOldest,
+  };
+
+  // Tells whether the queued item is made obsolete by the incoming one, e.g.
+  // both are frames of the same display. Only used with kReplaceOldest.
+  using SupersedesFn = std::function<bool(const T& /*queued*/,
+                                          const T& /*incoming*/)>;
+
+  ScreenConnectorQueue(const int q_max_size = 2,
+                       const FullQueuePolicy policy = FullQueuePolicy::kWaitEmpty,
+                       SupersedesFn supersedes = nullptr)
+      : q_mutex_(std::make_unique<std::mutex>()),
+        q_max_size_{q_max_size},
+        policy_{policy},
+        supersedes_{std::move(supersedes)} {}
   ScreenConnectorQueue(ScreenConnectorQueue&& cq) = delete;
   ScreenConnectorQueue(const ScreenConnectorQueue& cq) = delete;
   ScreenConnectorQueue& operator=(const ScreenConnectorQueue& cq) = delete;
@@ -50,6 +71,12 @@ class ScreenConnectorQueue {
     return buffer_.size();
   }
 
+  // number of items replaced before the consumer popped them
+  std::uint64_t DroppedCount() const {
+    const std::lock_guard<std::mutex> lock(*q_mutex_);
+    return dropped_count_;
+  }
+
   void WaitEmpty() {
     auto is_empty = [this](void) { return buffer_.empty(); };
     std::unique_lock<std::mutex> lock(*q_mutex_);
@@ -68,19 +95,30 @@ class ScreenConnectorQueue {
    *
    * Thus, the producers of this queue must not produce frames
    * much faster than the consumer, WebRTC consumes.
-   * Therefore, when the small buffer is full -- which means
-   * WebRTC would not call OnNextFrame --, the producer
+   * Therefore, with kWaitEmpty, when the small buffer is full -- which
+   * means WebRTC would not call OnNextFrame --, the producer
    * should stop adding itmes to the queue.
    *
+   * With kReplaceOldest the producer never waits: the oldest queued item
+   * superseded by the new one is dropped or, when there is none and the
+   * queue is full, the oldest item overall. This bounds the latency to
+   * the most recent items at the cost of skipping stale ones.
+   *
+   * Returns whether the number of queued items grew, which is false when
+   * the new item replaced an older one.
    */
-  void Push(T&& item) {
+  bool Push(T&& item) {
     std::unique_lock<std::mutex> lock(*q_mutex_);
+    if (policy_ == FullQueuePolicy::kReplaceOldest) {
+      return PushReplacingOldest(std::move(item));
+    }
     if (Full()) {
       auto is_empty =
           [this](void){ return buffer_.empty(); };
       q_empty_.wait(lock, is_empty);
     }
     buffer_.push_back(std::move(item));
+    return true;
   }
   void Push(T& item) = delete;
   void Push(const T& item) = delete;
@@ -101,10 +139,34 @@ class ScreenConnectorQueue {
     // after acquiring q_mutex_
     return q_max_size_ == buffer_.size();
   }
+  bool PushReplacingOldest(T&& item) {
+    // call this in a critical section
+    // after acquiring q_mutex_
+    auto replaced = buffer_.end();
+    if (supersedes_) {
+      replaced = std::find_if(buffer_.begin(), buffer_.end(),
+                              [this, &item](const T& queued) {
+                                return supersedes_(queued, item);
+                              });
+    }
+    if (replaced == buffer_.end() && Full()) {
+      replaced = buffer_.begin();
+    }
+    const bool grew = replaced == buffer_.end();
+    if (!grew) {
+      buffer_.erase(replaced);
+      dropped_count_++;
+    }
+    buffer_.push_back(std::move(item));
+    return grew;
+  }
   std::deque<T> buffer_;
   std::unique_ptr<std::mutex> q_mutex_;
   std::condition_variable q_empty_;
   const int q_max_size_;
+  const FullQueuePolicy policy_;
+  SupersedesFn supersedes_;
+  std::uint64_t dropped_count_ = 0;
 };
 
 } // namespace cuttlefish
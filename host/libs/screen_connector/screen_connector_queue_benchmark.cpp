@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares handing frames from a producer to a consumer through the mutex
+// based ScreenConnectorQueue and the lock-free ScreenConnectorMailbox.
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include <benchmark/benchmark.h>
+
+#include "host/libs/screen_connector/screen_connector_mailbox.h"
+#include "host/libs/screen_connector/screen_connector_queue.h"
+
+namespace cuttlefish {
+namespace {
+
+struct BenchmarkFrame : public ScreenConnectorFrameInfo {
+  std::shared_ptr<int> buf_;
+};
+
+BenchmarkFrame MakeFrame(std::uint32_t display_number) {
+  BenchmarkFrame frame;
+  frame.display_number_ = display_number;
+  frame.is_success_ = true;
+  frame.buf_ = std::make_shared<int>(0);
+  return frame;
+}
+
+void BM_QueuePushPop(benchmark::State& state) {
+  ScreenConnectorQueue<BenchmarkFrame> queue(2);
+  auto frame = MakeFrame(0);
+  for (auto _ : state) {
+    queue.Push(std::move(frame));
+    frame = queue.Pop();
+  }
+}
+BENCHMARK(BM_QueuePushPop);
+
+void BM_MailboxPushPop(benchmark::State& state) {
+  ScreenConnectorMailbox<BenchmarkFrame> mailbox(1);
+  auto frame = MakeFrame(0);
+  for (auto _ : state) {
+    mailbox.Push(std::move(frame));
+    frame = mailbox.Pop();
+  }
+}
+BENCHMARK(BM_MailboxPushPop);
+
+// The producer pushes as fast as it can while the benchmark thread pops, which
+// measures how long the consumer takes to get a frame under contention.
+void BM_QueueCrossThread(benchmark::State& state) {
+  ScreenConnectorQueue<BenchmarkFrame> queue(
+      2, ScreenConnectorQueue<BenchmarkFrame>::FullQueuePolicy::kReplaceOldest);
+  std::atomic<bool> running = true;
+  std::thread producer([&queue, &running]() {
+    while (running) {
+      queue.Push(MakeFrame(0));
+    }
+  });
+  for (auto _ : state) {
+    while (queue.IsEmpty()) {
+    }
+    benchmark::DoNotOptimize(queue.Pop());
+  }
+  running = false;
+  producer.join();
+  state.counters["dropped"] = queue.DroppedCount();
+}
+BENCHMARK(BM_QueueCrossThread)->UseRealTime();
+
+void BM_MailboxCrossThread(benchmark::State& state) {
+  ScreenConnectorMailbox<BenchmarkFrame> mailbox(1);
+  std::atomic<bool> running = true;
+  std::thread producer([&mailbox, &running]() {
+    while (running) {
+      mailbox.Push(MakeFrame(0));
+    }
+  });
+  for (auto _ : state) {
+    while (mailbox.IsEmpty()) {
+    }
+    benchmark::DoNotOptimize(mailbox.Pop());
+  }
+  running = false;
+  producer.join();
+  state.counters["dropped"] = mailbox.DroppedCount();
+}
+BENCHMARK(BM_MailboxCrossThread)->UseRealTime();
+
+}  // namespace
+}  // namespace cuttlefish
+
+BENCHMARK_MAIN();
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/screen_connector/screenshot_server.h"
+
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <cstring>
+#include <sstream>
+
+#include <android-base/logging.h>
+#include <zlib.h>
+
+#include "common/libs/fs/shared_buf.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr std::size_t kMaxRequestSize = 64;
+
+void AppendBigEndian(std::string& out, std::uint32_t value) {
+  out.push_back(static_cast<char>(value >> 24));
+  out.push_back(static_cast<char>(value >> 16));
+  out.push_back(static_cast<char>(value >> 8));
+  out.push_back(static_cast<char>(value));
+}
+
+void AppendPngChunk(std::string& out, const char type[4],
+                    const std::string& data) {
+  AppendBigEndian(out, data.size());
+  const std::size_t type_start = out.size();
+  out.append(type, 4);
+  out.append(data);
+  const auto crc = crc32(
+      crc32(0, nullptr, 0),
+      reinterpret_cast<const Bytef*>(out.data() + type_start), 4 + data.size());
+  AppendBigEndian(out, crc);
+}
+
+// Encodes 8 bit RGBA pixels, rows of width * 4 bytes, as a PNG image.
+std::string EncodePng(std::uint32_t width, std::uint32_t height,
+                      const std::uint8_t* rgba) {
+  const std::size_t row_bytes = std::size_t{width} * 4;
+  // Every row is prefixed with its filter type, none.
+  std::string filtered;
+  filtered.reserve((row_bytes + 1) * height);
+  for (std::uint32_t y = 0; y < height; y++) {
+    filtered.push_back(0);
+    filtered.append(reinterpret_cast<const char*>(rgba + y * row_bytes),
+                    row_bytes);
+  }
+  uLongf compressed_size = compressBound(filtered.size());
+  std::string compressed(compressed_size, '\0');
+  // Screenshots are mostly flat colors, which the fastest level already
+  // compresses well.
+  if (compress2(reinterpret_cast<Bytef*>(compressed.data()), &compressed_size,
+                reinterpret_cast<const Bytef*>(filtered.data()),
+                filtered.size(), Z_BEST_SPEED) != Z_OK) {
+    return "";
+  }
+  compressed.resize(compressed_size);
+
+  std::string header;
+  AppendBigEndian(header, width);
+  AppendBigEndian(header, height);
+  header.push_back(8);  // bit depth
+  header.push_back(6);  // color type: RGBA
+  header.push_back(0);  // compression
+  header.push_back(0);  // filter
+  header.push_back(0);  // no interlacing
+
+  std::string png("\x89PNG\r\n\x1a\n", 8);
+  AppendPngChunk(png, "IHDR", header);
+  AppendPngChunk(png, "IDAT", compressed);
+  AppendPngChunk(png, "IEND", "");
+  return png;
+}
+
+}  // namespace
+
+ScreenshotServer::ScreenshotServer(SharedFD server,
+                                   std::uint32_t display_count)
+    : server_(server) {
+  auto reactor = Reactor::Create();
+  CHECK(reactor.ok()) << "Failed to create the event loop: "
+                      << reactor.error();
+  reactor_ = std::move(*reactor);
+  for (std::uint32_t i = 0; i < display_count; i++) {
+    displays_.emplace_back(std::make_unique<Display>());
+  }
+  server_thread_ = std::thread([this]() { ServerLoop(); });
+}
+
+ScreenshotServer::~ScreenshotServer() {
+  reactor_->Stop();
+  server_thread_.join();
+}
+
+void ScreenshotServer::OnFrame(std::uint32_t display_number,
+                               std::uint32_t width, std::uint32_t height,
+                               std::uint32_t stride_bytes,
+                               const std::uint8_t* pixels,
+                               const ScreenConnectorFrameDamage& damage) {
+  if (display_number >= displays_.size()) {
+    return;
+  }
+  auto& display = *displays_[display_number];
+  std::lock_guard<std::mutex> lock(display.mutex);
+  auto copy = damage;
+  if (display.width != width || display.height != height) {
+    display.width = width;
+    display.height = height;
+    display.pixels.resize(std::size_t{width} * height *
+                          ScreenConnectorInfo::BytesPerPixel());
+    copy = ScreenConnectorFrameDamage::Full(width, height);
+  }
+  const std::size_t row_bytes = std::size_t{width} *
+                                ScreenConnectorInfo::BytesPerPixel();
+  const std::size_t copy_bytes = std::size_t{copy.w} *
+                                 ScreenConnectorInfo::BytesPerPixel();
+  const std::size_t x_offset = std::size_t{copy.x} *
+                               ScreenConnectorInfo::BytesPerPixel();
+  for (std::uint32_t y = copy.y; y < copy.y + copy.h; y++) {
+    std::memcpy(display.pixels.data() + y * row_bytes + x_offset,
+                pixels + std::size_t{y} * stride_bytes + x_offset, copy_bytes);
+  }
+}
+
+std::string ScreenshotServer::Screenshot(std::uint32_t display_number,
+                                         const std::string& format,
+                                         std::string* header) {
+  if (display_number >= displays_.size()) {
+    *header = "ERROR unknown display\n";
+    return "";
+  }
+  if (format != "raw" && format != "png") {
+    *header = "ERROR unknown format\n";
+    return "";
+  }
+  auto& display = *displays_[display_number];
+  std::uint32_t width;
+  std::uint32_t height;
+  std::string image;
+  {
+    std::lock_guard<std::mutex> lock(display.mutex);
+    width = display.width;
+    height = display.height;
+    image.assign(display.pixels.begin(), display.pixels.end());
+  }
+  if (width == 0 || height == 0) {
+    *header = "ERROR no frame received yet\n";
+    return "";
+  }
+  // Compressing takes much longer than copying, so it works on the copy
+  // instead of delaying the guest's next frame while holding the lock.
+  if (format == "png") {
+    image = EncodePng(width, height,
+                      reinterpret_cast<const std::uint8_t*>(image.data()));
+  }
+  if (image.empty()) {
+    *header = "ERROR failed to encode\n";
+    return "";
+  }
+  std::stringstream out;
+  out << "OK " << width << " " << height << " " << format << " "
+      << image.size() << "\n";
+  *header = out.str();
+  return image;
+}
+
+void ScreenshotServer::HandleClient(SharedFD client) {
+  // Clients are served one at a time, so an idle one must not hold the
+  // others up for long.
+  struct timeval timeout = {.tv_sec = 5, .tv_usec = 0};
+  if (client->SetSockOpt(SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout))) {
+    LOG(WARNING) << "Could not set the screenshot client timeout: "
+                 << client->StrError();
+  }
+  std::string request;
+  char c;
+  while (client->Read(&c, 1) == 1) {
+    if (c != '\n') {
+      request.push_back(c);
+      if (request.size() > kMaxRequestSize) {
+        WriteAll(client, "ERROR request too long\n");
+        return;
+      }
+      continue;
+    }
+    std::istringstream in(request);
+    std::uint32_t display_number;
+    std::string format;
+    std::string header;
+    std::string image;
+    if (!(in >> display_number >> format)) {
+      header = "ERROR malformed request\n";
+    } else {
+      image = Screenshot(display_number, format, &header);
+    }
+    if (WriteAll(client, header) != static_cast<ssize_t>(header.size()) ||
+        WriteAll(client, image) != static_cast<ssize_t>(image.size())) {
+      LOG(ERROR) << "Failed to send screenshot: " << client->StrError();
+      return;
+    }
+    request.clear();
+  }
+}
+
+void ScreenshotServer::ServerLoop() {
+  auto added = reactor_->Add(server_, EPOLLIN, [this](uint32_t) {
+    auto client = SharedFD::Accept(*server_);
+    if (!client->IsOpen()) {
+      LOG(ERROR) << "Failed to accept screenshot client: "
+                 << client->StrError();
+      return;
+    }
+    HandleClient(client);
+  });
+  if (!added.ok()) {
+    LOG(ERROR) << "Failed to watch the screenshot socket: " << added.error();
+    return;
+  }
+  auto ran = reactor_->Run();
+  if (!ran.ok()) {
+    LOG(ERROR) << "Error on the screenshot server loop: " << ran.error();
+  }
+}
+
+}  // namespace cuttlefish
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/libs/fs/reactor.h"
+#include "common/libs/fs/shared_fd.h"
+#include "host/libs/screen_connector/screen_connector_common.h"
+
+namespace cuttlefish {
+
+// Serves the latest frame of each display over a local socket, for tools that
+// need screenshots but not a WebRTC session.
+//
+// Clients connect and send one request line per screenshot:
+//
+//   <display number> <raw|png>\n
+//
+// and get back a header line followed by the image:
+//
+//   OK <width> <height> <raw|png> <size in bytes>\n<image bytes>
+//
+// or "ERROR <reason>\n". Raw images are tightly packed RGBA pixels. PNG
+// compression happens when requested, on the server thread, so guest frames
+// only cost copying their damaged area.
+class ScreenshotServer {
+ public:
+  ScreenshotServer(SharedFD server, std::uint32_t display_count);
+  ~ScreenshotServer();
+
+  ScreenshotServer(const ScreenshotServer&) = delete;
+  ScreenshotServer& operator=(const ScreenshotServer&) = delete;
+
+  // Keeps a copy of the frame's damaged area, called for every frame shown.
+  void OnFrame(std::uint32_t display_number, std::uint32_t width,
+               std::uint32_t height, std::uint32_t stride_bytes,
+               const std::uint8_t* pixels,
+               const ScreenConnectorFrameDamage& damage);
+
+ private:
+  struct Display {
+    std::mutex mutex;
+    std::uint32_t width = 0;
+    std::uint32_t height = 0;
+    // Tightly packed, width * 4 bytes per row
+    std::vector<std::uint8_t> pixels;
+  };
+
+  void ServerLoop();
+  void HandleClient(SharedFD client);
+  std::string Screenshot(std::uint32_t display_number, const std::string& format,
+                         std::string* header);
+
+  SharedFD server_;
+  std::unique_ptr<Reactor> reactor_;
+  std::vector<std::unique_ptr<Display>> displays_;
+  std::thread server_thread_;
+};
+
+}  // namespace cuttlefish
@@ -21,6 +21,7 @@
 
 #include <android-base/logging.h>
 
+#include "host/libs/config/cuttlefish_config.h"
 #include "host/libs/wayland/wayland_server.h"
 
 namespace cuttlefish {
@@ -31,11 +32,37 @@ WaylandScreenConnector::WaylandScreenConnector(int frames_fd) {
   close(frames_fd);
 
   server_.reset(new wayland::WaylandServer(wayland_fd));
+
+  auto config = CuttlefishConfig::Get();
+  CHECK(config) << "Config is missing";
+  const auto display_configs = config->display_configs();
+  for (std::uint32_t i = 0; i < display_configs.size(); i++) {
+    server_->SetDisplayRefreshRate(i, display_configs[i].refresh_rate_hz);
+  }
 }
 
 void WaylandScreenConnector::SetFrameCallback(
     GenerateProcessedFrameCallbackImpl frame_callback) {
-  server_->SetFrameCallback(std::move(frame_callback));
+  server_->SetFrameCallback(
+      [frame_callback = std::move(frame_callback)](
+          std::uint32_t display_number, std::uint32_t frame_width,
+          std::uint32_t frame_height, std::uint32_t frame_stride_bytes,
+          std::uint8_t* frame_bytes,
+          const wayland::Surface::Region& frame_damage) {
+        const ScreenConnectorFrameDamage damage{
+            .x = static_cast<std::uint32_t>(frame_damage.x),
+            .y = static_cast<std::uint32_t>(frame_damage.y),
+            .w = static_cast<std::uint32_t>(frame_damage.w),
+            .h = static_cast<std::uint32_t>(frame_damage.h),
+        };
+        frame_callback(display_number, frame_width, frame_height,
+                       frame_stride_bytes, frame_bytes, damage);
+      });
+}
+
+void WaylandScreenConnector::SetDisplayRefreshRate(
+    std::uint32_t display_number, std::uint32_t refresh_rate_hz) {
+  server_->SetDisplayRefreshRate(display_number, refresh_rate_hz);
 }
 
 }  // namespace cuttlefish
@@ -23,10 +23,13 @@
 
 namespace cuttlefish {
 
-class WaylandScreenConnector {
+class WaylandScreenConnector : public ScreenConnectorSource {
  public:
   WaylandScreenConnector(int frames_fd);
-  void SetFrameCallback(GenerateProcessedFrameCallbackImpl frame_callback);
+  void SetFrameCallback(
+      GenerateProcessedFrameCallbackImpl frame_callback) override;
+  void SetDisplayRefreshRate(std::uint32_t display_number,
+                             std::uint32_t refresh_rate_hz) override;
 
  private:
   std::unique_ptr<wayland::WaylandServer> server_;
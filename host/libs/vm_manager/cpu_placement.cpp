@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "host/libs/vm_manager/cpu_placement.h"
+
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <set>
+#include <sstream>
+
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace vm_manager {
+namespace {
+
+constexpr char kNodeDir[] = "/sys/devices/system/node";
+constexpr char kCpuDir[] = "/sys/devices/system/cpu";
+
+Result<std::vector<int>> ReadCpuList(const std::string& path) {
+  CF_EXPECT(FileExists(path), "\"" << path << "\" does not exist");
+  return CF_EXPECT(ParseCpuList(android::base::Trim(ReadFile(path))),
+                   "Bad cpu list in \"" << path << "\"");
+}
+
+// Orders the cpus by physical core so that siblings end up next to each other
+std::vector<int> GroupSiblings(const std::vector<int>& cpus) {
+  std::vector<int> ordered;
+  std::set<int> seen;
+  for (int cpu : cpus) {
+    if (seen.count(cpu)) {
+      continue;
+    }
+    auto siblings_path = std::string(kCpuDir) + "/cpu" + std::to_string(cpu) +
+                         "/topology/thread_siblings_list";
+    auto siblings = ReadCpuList(siblings_path);
+    if (!siblings.ok()) {
+      siblings = std::vector<int>{cpu};
+    }
+    for (int sibling : *siblings) {
+      if (std::count(cpus.begin(), cpus.end(), sibling) &&
+          seen.insert(sibling).second) {
+        ordered.push_back(sibling);
+      }
+    }
+  }
+  return ordered;
+}
+
+}  // namespace
+
+Result<std::vector<int>> ParseCpuList(const std::string& cpu_list) {
+  std::vector<int> cpus;
+  for (const auto& range : android::base::Split(cpu_list, ",")) {
+    if (range.empty()) {
+      continue;
+    }
+    auto bounds = android::base::Split(range, "-");
+    CF_EXPECT(bounds.size() <= 2, "Bad cpu range \"" << range << "\"");
+    int first = 0;
+    CF_EXPECT(android::base::ParseInt(bounds[0], &first, 0),
+              "Bad cpu \"" << bounds[0] << "\"");
+    int last = first;
+    if (bounds.size() == 2) {
+      CF_EXPECT(android::base::ParseInt(bounds[1], &last, first),
+                "Bad cpu range \"" << range << "\"");
+    }
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+std::string FormatVcpuAffinity(const std::vector<int>& cpus) {
+  std::stringstream affinity;
+  for (std::size_t vcpu = 0; vcpu < cpus.size(); vcpu++) {
+    affinity << (vcpu == 0 ? "" : ":") << vcpu << "=" << cpus[vcpu];
+  }
+  return affinity.str();
+}
+
+Result<std::vector<NumaNode>> HostNumaTopology() {
+  std::vector<NumaNode> nodes;
+  auto online = ReadCpuList(std::string(kNodeDir) + "/online");
+  if (!online.ok()) {
+    auto cpus = CF_EXPECT(ReadCpuList(std::string(kCpuDir) + "/online"));
+    nodes.push_back(NumaNode{0, GroupSiblings(cpus)});
+    return nodes;
+  }
+  for (int id : *online) {
+    auto path = std::string(kNodeDir) + "/node" + std::to_string(id) +
+                "/cpulist";
+    auto cpus = CF_EXPECT(ReadCpuList(path));
+    // Memory only nodes have no cpus to run on
+    if (!cpus.empty()) {
+      nodes.push_back(NumaNode{id, GroupSiblings(cpus)});
+    }
+  }
+  CF_EXPECT(!nodes.empty(), "No NUMA node has cpus");
+  return nodes;
+}
+
+Result<CpuPlacement> PlaceInstance(const std::vector<NumaNode>& nodes,
+                                   int slot, int cpus_per_instance) {
+  CF_EXPECT(!nodes.empty(), "No NUMA nodes to place on");
+  CF_EXPECT(slot >= 0 && cpus_per_instance > 0);
+  const auto& node = nodes[slot % nodes.size()];
+  int position = slot / nodes.size();
+  CpuPlacement placement;
+  placement.numa_node = node.id;
+  for (int i = 0; i < cpus_per_instance; i++) {
+    auto index = (position * cpus_per_instance + i) % node.cpus.size();
+    placement.cpus.push_back(node.cpus[index]);
+  }
+  return placement;
+}
+
+bool PlacementFits(const std::vector<NumaNode>& nodes, int num_slots,
+                   int cpus_per_instance) {
+  int num_nodes = nodes.size();
+  for (int i = 0; i < num_nodes; i++) {
+    // Slots i, i + num_nodes, ... land on this node
+    int on_node = num_slots / num_nodes + (i < num_slots % num_nodes ? 1 : 0);
+    if (on_node * cpus_per_instance > (int)nodes[i].cpus.size()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Result<void> BindToNumaNode(int numa_node) {
+  auto nodes = CF_EXPECT(HostNumaTopology());
+  auto node = std::find_if(nodes.begin(), nodes.end(),
+                           [numa_node](auto& n) { return n.id == numa_node; });
+  CF_EXPECT(node != nodes.end(), "No NUMA node " << numa_node << " with cpus");
+
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (int cpu : node->cpus) {
+    CPU_SET(cpu, &cpu_set);
+  }
+  CF_EXPECT(sched_setaffinity(0, sizeof(cpu_set), &cpu_set) == 0,
+            "sched_setaffinity failed: " << strerror(errno));
+
+  // Not in the C library, and libnuma isn't available on the host
+  constexpr auto kBitsPerLong = sizeof(unsigned long) * CHAR_BIT;
+  std::vector<unsigned long> mask(numa_node / kBitsPerLong + 1, 0);
+  mask[numa_node / kBitsPerLong] |= 1UL << (numa_node % kBitsPerLong);
+  auto max_node = mask.size() * kBitsPerLong + 1;
+  CF_EXPECT(syscall(__NR_set_mempolicy, MPOL_PREFERRED, mask.data(),
+                    max_node) == 0,
+            "set_mempolicy failed: " << strerror(errno));
+  return {};
+}
+
+} // namespace vm_manager
+} // namespace cuttlefish
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2022 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "common/libs/utils/result.h"
+
+namespace cuttlefish {
+namespace vm_manager {
+
+struct NumaNode {
+  int id;
+  // Hyperthread siblings are next to each other
+  std::vector<int> cpus;
+};
+
+// Falls back to a single node with every online cpu on hosts without NUMA
+Result<std::vector<NumaNode>> HostNumaTopology();
+
+struct CpuPlacement {
+  int numa_node;
+  std::vector<int> cpus;
+};
+
+// Instances are spread over the nodes round robin, the slot is the zero based
+// instance number. Each instance gets its own set of cores on the node until
+// the node runs out, then cores are shared.
+Result<CpuPlacement> PlaceInstance(const std::vector<NumaNode>& nodes,
+                                   int slot, int cpus_per_instance);
+
+// Whether every instance up to num_slots gets cores of its own
+bool PlacementFits(const std::vector<NumaNode>& nodes, int num_slots,
+                   int cpus_per_instance);
+
+// Kernel cpu list format, e.g. "0-3,8,10-11"
+Result<std::vector<int>> ParseCpuList(const std::string& cpu_list);
+
+// The host cpu of each vCPU in order, e.g. "0=4:1=5:2=4", as crosvm's
+// --cpu-affinity takes it. Cpus shared by several vCPUs appear once for each.
+std::string FormatVcpuAffinity(const std::vector<int>& cpus);
+
+// Restricts the calling thread and everything it later starts to the node's
+// cpus and prefers the node's memory.
+Result<void> BindToNumaNode(int numa_node);
+
+} // namespace vm_manager
+} // namespace cuttlefish
@@ -23,7 +23,12 @@
 #include <sys/types.h>
 #include <vulkan/vulkan.h>
 
+#include <json/json.h>
+
+#include <algorithm>
 #include <cassert>
+#include <memory>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -33,6 +38,7 @@
 #include "common/libs/utils/subprocess.h"
 #include "host/libs/config/cuttlefish_config.h"
 #include "host/libs/config/known_paths.h"
+#include "host/libs/vm_manager/cpu_placement.h"
 #include "host/libs/vm_manager/crosvm_builder.h"
 #include "host/libs/vm_manager/qemu_manager.h"
 
@@ -47,6 +53,48 @@ std::string GetControlSocketPath(
   return instance.PerInstanceInternalPath(socket_name.c_str());
 }
 
+constexpr char kSnapshotState[] = "crosvm_state";
+
+std::string VhostUserBlockSocket(
+    const CuttlefishConfig::InstanceSpecific& instance, std::size_t disk) {
+  return instance.PerInstanceInternalPath(
+      ("vhost_user_block_" + std::to_string(disk) + ".sock").c_str());
+}
+
+std::string VhostUserGpuSocket(
+    const CuttlefishConfig::InstanceSpecific& instance) {
+  return instance.PerInstanceInternalPath("vhost_user_gpu.sock");
+}
+
+// The options of --gpu, in the form `crosvm device gpu` takes them
+std::string GpuParameters(const CuttlefishConfig& config) {
+  Json::Value params(Json::objectValue);
+  auto gpu_mode = config.gpu_mode();
+  if (gpu_mode == kGpuModeGuestSwiftshader) {
+    params["backend"] = "2d";
+  } else {
+    params["backend"] =
+        gpu_mode == kGpuModeGfxStream ? "gfxstream" : "virglrenderer";
+    params["egl"] = true;
+    params["surfaceless"] = true;
+    params["glx"] = false;
+    params["gles"] = true;
+    params["angle"] = config.enable_gpu_angle();
+  }
+  params["udmabuf"] = config.enable_gpu_udmabuf();
+  Json::Value displays(Json::arrayValue);
+  for (const auto& display_config : config.display_configs()) {
+    Json::Value display(Json::objectValue);
+    display["width"] = display_config.width;
+    display["height"] = display_config.height;
+    displays.append(display);
+  }
+  params["displays"] = displays;
+  Json::StreamWriterBuilder factory;
+  factory["indentation"] = "";
+  return Json::writeString(factory, params);
+}
+
 }  // namespace
 
 bool CrosvmManager::IsSupported() {
@@ -112,7 +160,7 @@ std::string CrosvmManager::ConfigureBootDevices(int num_disks) {
 constexpr auto crosvm_socket = "crosvm_control.sock";
 
 std::vector<Command> CrosvmManager::StartCommands(
-    const CuttlefishConfig& config) {
+    const CuttlefishConfig& config, LogTeeCreator& log_tee) {
   auto instance = config.ForDefaultInstance();
   CrosvmBuilder crosvm_cmd;
   crosvm_cmd.SetBinary(config.crosvm_binary());
@@ -146,7 +194,10 @@ std::vector<Command> CrosvmManager::StartCommands(
   auto gpu_mode = config.gpu_mode();
   auto udmabuf_string = config.enable_gpu_udmabuf() ? "true" : "false";
   auto angle_string = config.enable_gpu_angle() ? ",angle=true" : "";
-  if (gpu_mode == kGpuModeGuestSwiftshader) {
+  if (config.vhost_user_gpu()) {
+    crosvm_cmd.Cmd().AddParameter("--vhost-user-gpu=",
+                                  VhostUserGpuSocket(instance));
+  } else if (gpu_mode == kGpuModeGuestSwiftshader) {
     crosvm_cmd.Cmd().AddParameter("--gpu=2D,udmabuf=", udmabuf_string);
   } else if (gpu_mode == kGpuModeDrmVirgl || gpu_mode == kGpuModeGfxStream) {
     crosvm_cmd.Cmd().AddParameter(
@@ -155,10 +206,12 @@ std::vector<Command> CrosvmManager::StartCommands(
         angle_string);
   }
 
-  for (const auto& display_config : config.display_configs()) {
-    crosvm_cmd.Cmd().AddParameter(
-        "--gpu-display=", "width=", display_config.width, ",",
-        "height=", display_config.height);
+  if (!config.vhost_user_gpu()) {
+    for (const auto& display_config : config.display_configs()) {
+      crosvm_cmd.Cmd().AddParameter(
+          "--gpu-display=", "width=", display_config.width, ",",
+          "height=", display_config.height);
+    }
   }
 
   crosvm_cmd.Cmd().AddParameter("--wayland-sock=",
@@ -166,15 +219,45 @@ std::vector<Command> CrosvmManager::StartCommands(
 
   // crosvm_cmd.Cmd().AddParameter("--null-audio");
   crosvm_cmd.Cmd().AddParameter("--mem=", config.memory_mb());
+  if (config.enable_memory_balloon()) {
+    // Free guest pages go back to the host without inflating the balloon
+    crosvm_cmd.Cmd().AddParameter("--balloon-page-reporting");
+  }
+  if (config.guest_hugepages() == "thp") {
+    crosvm_cmd.Cmd().AddParameter("--hugepages");
+  }
   crosvm_cmd.Cmd().AddParameter("--cpus=", config.cpus());
+  if (!instance.cpu_affinity().empty()) {
+    crosvm_cmd.Cmd().AddParameter("--cpu-affinity=", instance.cpu_affinity());
+  }
 
   auto disk_num = instance.virtual_disk_paths().size();
   CHECK_GE(VmManager::kMaxDisks, disk_num)
       << "Provided too many disks (" << disk_num << "), maximum "
       << VmManager::kMaxDisks << "supported";
-  for (const auto& disk : instance.virtual_disk_paths()) {
+  // Let guest discards punch holes in the overlay so trimmed space is
+  // returned to the host
+  std::string disk_options = ",sparse=true";
+  if (config.disk_num_queues() > 1) {
+    // Crosvm exposes its queues to the guest and serves them from one worker
+    // unless told otherwise
+    disk_options += ",multiple-workers=true";
+  }
+  if (config.disk_io_backend() == "io_uring") {
+    disk_options += ",async_executor=uring";
+  }
+  if (config.disk_direct_io()) {
+    disk_options += ",o_direct=true";
+  }
+  for (std::size_t i = 0; i < disk_num; i++) {
+    if (config.vhost_user_block()) {
+      crosvm_cmd.Cmd().AddParameter("--vhost-user-blk=",
+                                    VhostUserBlockSocket(instance, i));
+      continue;
+    }
     crosvm_cmd.Cmd().AddParameter(
-        config.protected_vm() ? "--disk=" : "--rwdisk=", disk);
+        config.protected_vm() ? "--disk=" : "--rwdisk=",
+        instance.virtual_disk_paths()[i], disk_options);
   }
 
   if (config.enable_webrtc()) {
@@ -203,6 +286,22 @@ std::vector<Command> CrosvmManager::StartCommands(
   // GPU capture can only support named files and not file descriptors due to
   // having to pass arguments to crosvm via a wrapper script.
   if (!gpu_capture_enabled) {
+    std::vector<std::string> tap_names = {instance.mobile_tap_name(),
+                                          instance.ethernet_tap_name()};
+#ifndef ENFORCE_MAC80211_HWSIM
+    tap_names.push_back(instance.wifi_tap_name());
+#endif
+    // The queue pairs apply to every tap device, crosvm opens the extra queues
+    // from the tap's name. Offloads were already enabled on the tap itself.
+    if (config.net_num_queues() > 1) {
+      if (std::all_of(tap_names.begin(), tap_names.end(), IsMultiQueueTap)) {
+        crosvm_cmd.Cmd().AddParameter("--net-vq-pairs=",
+                                      config.net_num_queues());
+      } else {
+        LOG(WARNING) << "Single queue taps in use, ignoring --net_num_queues";
+      }
+    }
+
     crosvm_cmd.AddTap(instance.mobile_tap_name());
     crosvm_cmd.AddTap(instance.ethernet_tap_name());
 
@@ -223,6 +322,16 @@ std::vector<Command> CrosvmManager::StartCommands(
                                   instance.hwcomposer_pmem_path());
   }
 
+  if (FileExists(instance.camera_frames_pmem_path())) {
+    crosvm_cmd.Cmd().AddParameter("--rw-pmem-device=",
+                                  instance.camera_frames_pmem_path());
+  }
+
+  // After the other pmem devices, which the guest finds by their number
+  if (config.pmem_super_image()) {
+    crosvm_cmd.Cmd().AddParameter("--pmem-device=", config.super_pmem_path());
+  }
+
   if (FileExists(instance.pstore_path())) {
     crosvm_cmd.Cmd().AddParameter("--pstore=path=", instance.pstore_path(),
                                   ",size=", FileSize(instance.pstore_path()));
@@ -287,17 +396,8 @@ std::vector<Command> CrosvmManager::StartCommands(
     crosvm_cmd.AddHvcSink();
   }
 
-  auto crosvm_logs_path = instance.PerInstanceInternalPath("crosvm.fifo");
-  auto crosvm_logs = SharedFD::Fifo(crosvm_logs_path, 0666);
-  if (!crosvm_logs->IsOpen()) {
-    LOG(FATAL) << "Failed to create log fifo for crosvm's stdout/stderr: "
-               << crosvm_logs->StrError();
-    return {};
-  }
-
-  Command crosvm_log_tee_cmd(HostBinaryPath("log_tee"));
-  crosvm_log_tee_cmd.AddParameter("--process_name=crosvm");
-  crosvm_log_tee_cmd.AddParameter("--log_fd_in=", crosvm_logs);
+  auto crosvm_logs_path = log_tee.LogFifoPath("crosvm");
+  auto crosvm_logs = log_tee.LogFifo("crosvm");
 
   // Serial port for logcat, redirected to a pipe
   crosvm_cmd.AddHvcReadOnly(instance.logcat_pipe_name());
@@ -351,6 +451,11 @@ std::vector<Command> CrosvmManager::StartCommands(
         ":shared:type=fs");
   }
 
+  if (!config.snapshot_path().empty()) {
+    crosvm_cmd.Cmd().AddParameter(
+        "--restore=", config.snapshot_path() + "/" + kSnapshotState);
+  }
+
   // This needs to be the last parameter
   crosvm_cmd.Cmd().AddParameter("--bios=", config.bootloader());
 
@@ -380,21 +485,6 @@ std::vector<Command> CrosvmManager::StartCommands(
     const std::string gpu_capture_basename =
         cpp_basename(config.gpu_capture_binary());
 
-    auto gpu_capture_logs_path =
-        instance.PerInstanceInternalPath("gpu_capture.fifo");
-    auto gpu_capture_logs = SharedFD::Fifo(gpu_capture_logs_path, 0666);
-    if (!gpu_capture_logs->IsOpen()) {
-      LOG(FATAL)
-          << "Failed to create log fifo for gpu capture's stdout/stderr: "
-          << gpu_capture_logs->StrError();
-      return {};
-    }
-
-    Command gpu_capture_log_tee_cmd(HostBinaryPath("log_tee"));
-    gpu_capture_log_tee_cmd.AddParameter("--process_name=",
-                                         gpu_capture_basename);
-    gpu_capture_log_tee_cmd.AddParameter("--log_fd_in=", gpu_capture_logs);
-
     Command gpu_capture_command(config.gpu_capture_binary());
     if (gpu_capture_basename == "ngfx") {
       // Crosvm depends on command line arguments being passed as multiple
@@ -420,12 +510,8 @@ std::vector<Command> CrosvmManager::StartCommands(
                  << config.gpu_capture_binary();
     }
 
-    gpu_capture_command.RedirectStdIO(Subprocess::StdIOChannel::kStdOut,
-                                      gpu_capture_logs);
-    gpu_capture_command.RedirectStdIO(Subprocess::StdIOChannel::kStdErr,
-                                      gpu_capture_logs);
+    log_tee.CreateLogTee(gpu_capture_command, gpu_capture_basename);
 
-    ret.push_back(std::move(gpu_capture_log_tee_cmd));
     ret.push_back(std::move(gpu_capture_command));
   } else {
     crosvm_cmd.Cmd().RedirectStdIO(Subprocess::StdIOChannel::kStdOut,
@@ -436,10 +522,159 @@ std::vector<Command> CrosvmManager::StartCommands(
     ret.push_back(std::move(crosvm_cmd.Cmd()));
   }
 
-  ret.push_back(std::move(crosvm_log_tee_cmd));
   return ret;
 }
 
+std::vector<Command> CrosvmManager::VhostUserCommands(
+    const CuttlefishConfig& config, LogTeeCreator& log_tee) {
+  auto instance = config.ForDefaultInstance();
+  std::vector<int> cpus;
+  if (!config.vhost_user_cpus().empty()) {
+    auto parsed = ParseCpuList(config.vhost_user_cpus());
+    CHECK(parsed.ok()) << parsed.error();
+    cpus = std::move(*parsed);
+  }
+
+  // The device subcommands take their options as separate arguments
+  std::vector<Command> commands;
+  if (config.vhost_user_block()) {
+    auto disks = instance.virtual_disk_paths();
+    for (std::size_t i = 0; i < disks.size(); i++) {
+      // The backend serves the disk from an executor of its own
+      Command block(config.crosvm_binary());
+      block.AddParameter("device");
+      block.AddParameter("block");
+      block.AddParameter("--socket");
+      block.AddParameter(VhostUserBlockSocket(instance, i));
+      block.AddParameter("--file");
+      block.AddParameter(disks[i]);
+      block.SetCpuAffinity(cpus);
+      log_tee.CreateLogTee(block, "crosvm_block_" + std::to_string(i));
+      commands.push_back(std::move(block));
+    }
+  }
+  if (config.vhost_user_gpu()) {
+    Command gpu(config.crosvm_binary());
+    gpu.AddParameter("device");
+    gpu.AddParameter("gpu");
+    gpu.AddParameter("--socket");
+    gpu.AddParameter(VhostUserGpuSocket(instance));
+    gpu.AddParameter("--wayland-sock");
+    gpu.AddParameter(instance.frames_socket_path());
+    gpu.AddParameter("--params");
+    gpu.AddParameter(GpuParameters(config));
+    gpu.SetCpuAffinity(cpus);
+    log_tee.CreateLogTee(gpu, "crosvm_gpu");
+    commands.push_back(std::move(gpu));
+  }
+  return commands;
+}
+
+std::vector<std::string> CrosvmManager::VhostUserSockets(
+    const CuttlefishConfig& config) {
+  auto instance = config.ForDefaultInstance();
+  std::vector<std::string> sockets;
+  if (config.vhost_user_block()) {
+    for (std::size_t i = 0; i < instance.virtual_disk_paths().size(); i++) {
+      sockets.push_back(VhostUserBlockSocket(instance, i));
+    }
+  }
+  if (config.vhost_user_gpu()) {
+    sockets.push_back(VhostUserGpuSocket(instance));
+  }
+  return sockets;
+}
+
+namespace {
+
+// Runs a crosvm subcommand against the control socket of the running VM
+Result<void> RunControlCommand(const CuttlefishConfig& config,
+                               const std::vector<std::string>& arguments) {
+  Command command(config.crosvm_binary());
+  for (const auto& argument : arguments) {
+    command.AddParameter(argument);
+  }
+  command.AddParameter(
+      GetControlSocketPath(config.ForDefaultInstance(), crosvm_socket));
+  int exit_code = command.Start().Wait();
+  CF_EXPECT(exit_code == 0, "`crosvm " << android::base::Join(arguments, " ")
+                                       << "` exited with " << exit_code);
+  return {};
+}
+
+}  // namespace
+
+Result<BalloonStats> CrosvmManager::GetBalloonStats(
+    const CuttlefishConfig& config) {
+  Command command(config.crosvm_binary());
+  command.AddParameter("balloon_stats");
+  command.AddParameter(
+      GetControlSocketPath(config.ForDefaultInstance(), crosvm_socket));
+  std::string out, err;
+  int exit_code = RunWithManagedStdio(std::move(command), nullptr, &out, &err);
+  CF_EXPECT(exit_code == 0, "`crosvm balloon_stats` exited with "
+                                << exit_code << ": " << err);
+  // {"BalloonStats":{"stats":{...,"available_memory":N},"balloon_actual":N}}
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  Json::Value root;
+  std::string errors;
+  CF_EXPECT(reader->parse(out.data(), out.data() + out.size(), &root, &errors),
+            "Could not parse the balloon stats: " << errors);
+  const auto& stats = root["BalloonStats"];
+  CF_EXPECT(stats.isObject(), "Unexpected balloon stats: " << out);
+  BalloonStats ret;
+  ret.balloon_bytes = stats["balloon_actual"].asUInt64();
+  ret.available_bytes = stats["stats"]["available_memory"].asUInt64();
+  return ret;
+}
+
+Result<void> CrosvmManager::SetBalloonSize(const CuttlefishConfig& config,
+                                           std::uint64_t bytes) {
+  CF_EXPECT(RunControlCommand(config, {"balloon", std::to_string(bytes)}));
+  return {};
+}
+
+Result<void> CrosvmManager::Suspend(const CuttlefishConfig& config) {
+  CF_EXPECT(RunControlCommand(config, {"suspend"}));
+  return {};
+}
+
+Result<void> CrosvmManager::Resume(const CuttlefishConfig& config) {
+  CF_EXPECT(RunControlCommand(config, {"resume"}));
+  return {};
+}
+
+Result<void> CrosvmManager::Snapshot(const CuttlefishConfig& config,
+                                     const std::string& directory) {
+  auto state = directory + "/" + kSnapshotState;
+  CF_EXPECT(RunControlCommand(config, {"snapshot", "take", state}));
+  return {};
+}
+
+Result<void> CrosvmManager::AddDisplay(
+    const CuttlefishConfig& config,
+    const CuttlefishConfig::DisplayConfig& display_config) {
+  // The displays of a vhost-user gpu aren't known to the VM process
+  CF_EXPECT(!config.vhost_user_gpu(),
+            "Displays can't be added with a vhost-user gpu");
+  CF_EXPECT(RunControlCommand(
+      config, {"gpu", "add-displays",
+               "--gpu-display=width=" + std::to_string(display_config.width) +
+                   ",height=" + std::to_string(display_config.height)}));
+  return {};
+}
+
+Result<void> CrosvmManager::RemoveDisplay(const CuttlefishConfig& config,
+                                          std::uint32_t display_number) {
+  CF_EXPECT(!config.vhost_user_gpu(),
+            "Displays can't be removed with a vhost-user gpu");
+  CF_EXPECT(RunControlCommand(config,
+                              {"gpu", "remove-displays",
+                               "--display-id=" + std::to_string(display_number)}));
+  return {};
+}
+
 } // namespace vm_manager
 } // namespace cuttlefish
 
@@ -39,7 +39,30 @@ class CrosvmManager : public VmManager {
   std::string ConfigureBootDevices(int num_disks) override;
 
   std::vector<cuttlefish::Command> StartCommands(
-      const CuttlefishConfig& config) override;
+      const CuttlefishConfig& config, LogTeeCreator& log_tee) override;
+
+  Result<void> Suspend(const CuttlefishConfig& config) override;
+  Result<void> Resume(const CuttlefishConfig& config) override;
+  Result<void> Snapshot(const CuttlefishConfig& config,
+                        const std::string& directory) override;
+
+  Result<BalloonStats> GetBalloonStats(const CuttlefishConfig& config) override;
+  Result<void> SetBalloonSize(const CuttlefishConfig& config,
+                              std::uint64_t bytes) override;
+
+  Result<void> AddDisplay(
+      const CuttlefishConfig& config,
+      const CuttlefishConfig::DisplayConfig& display_config) override;
+  Result<void> RemoveDisplay(const CuttlefishConfig& config,
+                             std::uint32_t display_number) override;
+
+  // The vhost-user backends for the devices that run outside of the VM
+  // process, which must be listening on VhostUserSockets by the time the VM
+  // starts.
+  static std::vector<cuttlefish::Command> VhostUserCommands(
+      const CuttlefishConfig& config, LogTeeCreator& log_tee);
+  static std::vector<std::string> VhostUserSockets(
+      const CuttlefishConfig& config);
 };
 
 } // namespace vm_manager
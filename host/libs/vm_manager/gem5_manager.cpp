@@ -31,8 +31,9 @@
 #include <thread>
 #include <vector>
 
-#include <android-base/strings.h>
+#include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/strings.h>
 #include <vulkan/vulkan.h>
 
 #include "common/libs/fs/shared_select.h"
@@ -51,6 +52,12 @@ void LogAndSetEnv(const char* key, const std::string& value) {
   LOG(INFO) << key << "=" << value;
 }
 
+// Written by RequestCheckpoint, polled by the simulation
+std::string CheckpointRequestPath(
+    const CuttlefishConfig::InstanceSpecific& instance) {
+  return instance.PerInstanceInternalPath("gem5_checkpoint_request");
+}
+
 void GenerateGem5File(const CuttlefishConfig& config) {
   // Gem5 specific config, currently users have to change these config locally (without throug launch_cvd input flag) to meet their design
   // TODO: Add these config into launch_cvd input flag or parse from one json file
@@ -69,6 +76,7 @@ void GenerateGem5File(const CuttlefishConfig& config) {
   std::string fs_path = config.gem5_binary_dir() + "/configs/example/arm/starter_fs.py";
   std::ofstream starter_fs_ofstream(fs_path.c_str());
   starter_fs_ofstream << fs_header << "\n";
+  starter_fs_ofstream << fs_run << "\n";
 
   // global vars in python
   starter_fs_ofstream << "default_disk = 'linaro-minimal-aarch64.img'\n";
@@ -84,6 +92,8 @@ void GenerateGem5File(const CuttlefishConfig& config) {
   starter_fs_ofstream << "  parser.add_argument(\"--mem-channels\", type=int, default=" << mem_channels << ")\n";
   starter_fs_ofstream << "  parser.add_argument(\"--mem-ranks\", type=int, default=" << mem_ranks << ")\n";
   starter_fs_ofstream << "  parser.add_argument(\"--mem-size\", action=\"store\", type=str, default=\"" << config.memory_mb() << "MB\")\n";
+  starter_fs_ofstream << "  parser.add_argument(\"--restore\", type=str, default=None)\n";
+  starter_fs_ofstream << "  parser.add_argument(\"--checkpoint-request\", type=str, default=None)\n";
   starter_fs_ofstream << "  args = parser.parse_args()\n";
 
   // instantiate system
@@ -148,7 +158,7 @@ std::string Gem5Manager::ConfigureBootDevices(int /*num_disks*/) {
 }
 
 std::vector<Command> Gem5Manager::StartCommands(
-    const CuttlefishConfig& config) {
+    const CuttlefishConfig& config, LogTeeCreator&) {
   auto instance = config.ForDefaultInstance();
 
   auto stop = [](Subprocess* proc) {
@@ -176,6 +186,16 @@ std::vector<Command> Gem5Manager::StartCommands(
   for (const auto& disk : instance.virtual_disk_paths()) {
     gem5_cmd.AddParameter("--disk-image=", disk);
   }
+  if (RestoresCheckpoint(config)) {
+    LOG(INFO) << "Restoring the gem5 checkpoint at "
+              << instance.gem5_checkpoint_path();
+    gem5_cmd.AddParameter("--restore=", instance.gem5_checkpoint_path());
+  } else if (!config.gem5_checkpoint_dir().empty()) {
+    // Left behind by a run that stopped before checking it
+    RemoveFile(CheckpointRequestPath(instance));
+    gem5_cmd.AddParameter("--checkpoint-request=",
+                          CheckpointRequestPath(instance));
+  }
 
   LogAndSetEnv("M5_PATH", config.assembly_dir());
 
@@ -184,5 +204,23 @@ std::vector<Command> Gem5Manager::StartCommands(
   return ret;
 }
 
+bool Gem5Manager::RestoresCheckpoint(const CuttlefishConfig& config) {
+  // The link points into the cache whether or not the checkpoint exists
+  return config.vm_manager() == name() &&
+         !config.gem5_checkpoint_dir().empty() &&
+         DirectoryExists(config.ForDefaultInstance().gem5_checkpoint_path());
+}
+
+Result<void> Gem5Manager::RequestCheckpoint(const CuttlefishConfig& config) {
+  auto instance = config.ForDefaultInstance();
+  std::string target;
+  CF_EXPECT(android::base::Readlink(instance.gem5_checkpoint_path(), &target),
+            "Could not read the link " << instance.gem5_checkpoint_path());
+  CF_EXPECT(android::base::WriteStringToFile(target,
+                                             CheckpointRequestPath(instance)),
+            "Could not write " << CheckpointRequestPath(instance));
+  return {};
+}
+
 } // namespace vm_manager
 } // namespace cuttlefish
@@ -40,7 +40,14 @@ class Gem5Manager : public VmManager {
   std::string ConfigureBootDevices(int num_disks) override;
 
   std::vector<cuttlefish::Command> StartCommands(
-      const CuttlefishConfig& config) override;
+      const CuttlefishConfig& config, LogTeeCreator& log_tee) override;
+
+  // Whether the simulation starts from the cached checkpoint of a booted
+  // guest, in which case no boot events will be seen.
+  static bool RestoresCheckpoint(const CuttlefishConfig& config);
+  // Asks the running simulation to save the cached checkpoint, which it does
+  // the next time it checks. Only valid if it didn't restore one.
+  static Result<void> RequestCheckpoint(const CuttlefishConfig& config);
 
  private:
   Arch arch_;
@@ -49,6 +56,7 @@ class Gem5Manager : public VmManager {
 const std::string fs_header = R"CPP_STR_END(import argparse
 import devices
 import os
+import shutil
 import m5
 from m5.util import addToPath
 from m5.objects import *
@@ -60,6 +68,32 @@ from common.cores.arm import HPI
 m5.util.addToPath('../..')
 )CPP_STR_END";
 
+const std::string fs_run = R"CPP_STR_END(
+# Simulated time between checks for a checkpoint request, in ticks
+checkpoint_poll_ticks = 10000000000
+
+def run(args):
+  if not args.checkpoint_request:
+    return m5.simulate()
+  while True:
+    event = m5.simulate(checkpoint_poll_ticks)
+    if event.getCause() != "simulate() limit reached":
+      return event
+    if not os.path.exists(args.checkpoint_request):
+      continue
+    with open(args.checkpoint_request) as request:
+      target = request.read().strip()
+    os.remove(args.checkpoint_request)
+    # Other simulations may save the same checkpoint, the first one wins
+    building = "%s.%d.tmp" % (target, os.getpid())
+    m5.checkpoint(building)
+    try:
+      os.rename(building, target)
+      print("Saved checkpoint %s" % target)
+    except OSError:
+      shutil.rmtree(building)
+)CPP_STR_END";
+
 const std::string fs_mem_pci = R"CPP_STR_END(
   MemConfig.config_mem(args, root.system)
 
@@ -101,8 +135,8 @@ const std::string fs_kernel_cmd = R"CPP_STR_END(
     "androidboot.force_normal_boot=1",
   ]
   root.system.workload.command_line = " ".join(kernel_cmd)
-  m5.instantiate()
-  sys.exit(m5.simulate().getCode())
+  m5.instantiate(args.restore)
+  sys.exit(run(args).getCode())
 )CPP_STR_END";
 
 const std::string fs_exe_main = R"CPP_STR_END(
@@ -16,12 +16,17 @@
 
 #include "host/libs/vm_manager/host_configuration.h"
 
+#include <fstream>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include <android-base/logging.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
 #include <sys/utsname.h>
+#include <unistd.h>
 
 #include "common/libs/utils/users.h"
 
@@ -73,8 +78,80 @@ bool LinuxVersionAtLeast(std::vector<std::string>* config_commands,
   return false;
 }
 
+constexpr char kThpEnabled[] = "/sys/kernel/mm/transparent_hugepage/enabled";
+constexpr char kHugepages2M[] = "/sys/kernel/mm/hugepages/hugepages-2048kB";
+
+std::string ReadSysfs(const std::string& path) {
+  std::ifstream file(path);
+  std::string contents;
+  std::getline(file, contents);
+  return contents;
+}
+
 } // namespace
 
+bool ValidateHugepages(const std::string& mode, int memory_mb,
+                       std::vector<std::string>* config_commands) {
+  if (mode == "thp") {
+    // The selected mode is in brackets, e.g. "always [madvise] never"
+    auto enabled = ReadSysfs(kThpEnabled);
+    if (enabled.find("[never]") == std::string::npos && !enabled.empty()) {
+      return true;
+    }
+    LOG(ERROR) << "Transparent hugepages are disabled on the host";
+    config_commands->push_back("# Let processes ask for transparent hugepages:");
+    config_commands->push_back(std::string("echo madvise | sudo tee ") +
+                               kThpEnabled);
+    return false;
+  }
+  if (mode == "hugetlb") {
+    auto needed = memory_mb / 2;
+    auto free = atoi(ReadSysfs(std::string(kHugepages2M) + "/free_hugepages")
+                         .c_str());
+    if (free >= needed) {
+      return true;
+    }
+    auto total = atoi(ReadSysfs(std::string(kHugepages2M) + "/nr_hugepages")
+                          .c_str());
+    LOG(ERROR) << "The guest needs " << needed << " free 2M hugepages, the "
+               << "host has " << free;
+    config_commands->push_back("# Reserve more 2M hugepages:");
+    config_commands->push_back("echo " + std::to_string(total + needed - free) +
+                               " | sudo tee " + kHugepages2M +
+                               "/nr_hugepages");
+    return false;
+  }
+  return true;
+}
+
+bool ValidateDiskOptions(const std::string& io_backend, bool direct_io,
+                         const std::vector<std::string>& disk_paths,
+                         std::vector<std::string>* config_commands) {
+  bool valid = true;
+  if (io_backend == "io_uring") {
+    auto version = GetLinuxVersion();
+    valid &= version != invalid_linux_version &&
+             LinuxVersionAtLeast(config_commands, version, 5, 6);
+  }
+  if (direct_io) {
+    for (const auto& disk : disk_paths) {
+      // tmpfs and some overlay setups refuse O_DIRECT with EINVAL
+      int fd = open(disk.c_str(), O_RDONLY | O_DIRECT | O_CLOEXEC);
+      if (fd < 0) {
+        LOG(ERROR) << "Could not open \"" << disk << "\" with O_DIRECT: "
+                   << strerror(errno);
+        config_commands->push_back(
+            "# Keep the instance files on a filesystem with O_DIRECT, or "
+            "drop --disk_direct_io");
+        valid = false;
+        continue;
+      }
+      close(fd);
+    }
+  }
+  return valid;
+}
+
 bool ValidateHostConfiguration(std::vector<std::string>* config_commands) {
   // if we can't detect the kernel version, just fail
   auto version = GetLinuxVersion();
@@ -23,6 +23,17 @@ namespace vm_manager {
 
 bool ValidateHostConfiguration(std::vector<std::string>* config_commands);
 
+// Checks that the host can back memory_mb of guest memory with the given
+// --guest_hugepages mode
+bool ValidateHugepages(const std::string& mode, int memory_mb,
+                       std::vector<std::string>* config_commands);
+
+// Checks that the host kernel and the filesystems holding the disks support
+// the --disk_io_backend and --disk_direct_io settings
+bool ValidateDiskOptions(const std::string& io_backend, bool direct_io,
+                         const std::vector<std::string>& disk_paths,
+                         std::vector<std::string>* config_commands);
+
 } // namespace vm_manager
 } // namespace cuttlefish
 
@@ -24,7 +24,9 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <chrono>
 #include <cstdlib>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <thread>
@@ -32,10 +34,13 @@
 
 #include <android-base/strings.h>
 #include <android-base/logging.h>
+#include <json/json.h>
 #include <vulkan/vulkan.h>
 
+#include "common/libs/fs/shared_buf.h"
 #include "common/libs/fs/shared_select.h"
 #include "common/libs/utils/files.h"
+#include "common/libs/utils/network.h"
 #include "common/libs/utils/subprocess.h"
 #include "common/libs/utils/users.h"
 #include "host/libs/config/cuttlefish_config.h"
@@ -85,6 +90,77 @@ bool Stop() {
   return true;
 }
 
+// A connection to the QMP monitor of the running VM
+class QmpClient {
+ public:
+  static Result<QmpClient> Connect(const CuttlefishConfig& config) {
+    auto monitor_path = GetMonitorPath(config);
+    QmpClient client(
+        SharedFD::SocketLocalClient(monitor_path.c_str(), false, SOCK_STREAM));
+    CF_EXPECT(client.socket_->IsOpen(),
+              "Could not connect to the qemu monitor at \""
+                  << monitor_path << "\": " << client.socket_->StrError());
+    auto greeting = CF_EXPECT(client.ReadMessage());
+    CF_EXPECT(greeting.isMember("QMP"), "Unexpected qemu monitor greeting");
+    CF_EXPECT(client.Execute("qmp_capabilities"));
+    return client;
+  }
+
+  // Returns the "return" member of the reply
+  Result<Json::Value> Execute(
+      const std::string& command,
+      const Json::Value& arguments = Json::Value(Json::objectValue)) {
+    Json::Value request;
+    request["execute"] = command;
+    request["arguments"] = arguments;
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    auto message = Json::writeString(builder, request);
+    CF_EXPECT(WriteAll(socket_, message) == (ssize_t)message.size(),
+              "Error writing to the qemu monitor: " << socket_->StrError());
+    while (true) {
+      auto reply = CF_EXPECT(ReadMessage());
+      if (reply.isMember("event")) {
+        continue;
+      }
+      CF_EXPECT(!reply.isMember("error"),
+                "qemu monitor command \"" << command << "\" failed: "
+                                          << reply["error"]["desc"].asString());
+      return reply["return"];
+    }
+  }
+
+ private:
+  QmpClient(SharedFD socket) : socket_(std::move(socket)) {}
+
+  // Messages from the monitor end in a line break
+  Result<Json::Value> ReadMessage() {
+    auto end = buffer_.find('\n');
+    while (end == std::string::npos) {
+      char chunk[4096];
+      auto read = socket_->Read(chunk, sizeof(chunk));
+      CF_EXPECT(read > 0, "Error reading from the qemu monitor: "
+                              << socket_->StrError());
+      buffer_.append(chunk, read);
+      end = buffer_.find('\n');
+    }
+    Json::CharReaderBuilder builder;
+    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+    Json::Value message;
+    std::string errors;
+    CF_EXPECT(reader->parse(buffer_.data(), buffer_.data() + end, &message,
+                            &errors),
+              "Could not parse qemu monitor message: " << errors);
+    buffer_.erase(0, end + 1);
+    return message;
+  }
+
+  SharedFD socket_;
+  std::string buffer_;
+};
+
+constexpr char kSnapshotState[] = "qemu_state";
+
 std::pair<int,int> GetQemuVersion(const std::string& qemu_binary)
 {
   Command qemu_version_cmd(qemu_binary);
@@ -169,7 +245,7 @@ std::string QemuManager::ConfigureBootDevices(int num_disks) {
 }
 
 std::vector<Command> QemuManager::StartCommands(
-    const CuttlefishConfig& config) {
+    const CuttlefishConfig& config, LogTeeCreator&) {
   auto instance = config.ForDefaultInstance();
 
   auto stop = [](Subprocess* proc) {
@@ -268,6 +344,7 @@ std::vector<Command> QemuManager::StartCommands(
 
   bool is_arm = arch_ == Arch::Arm || arch_ == Arch::Arm64;
   bool is_arm64 = arch_ == Arch::Arm64;
+  bool tuned = config.qemu_performance_profile();
 
   auto access_kregistry_size_bytes = 0;
   if (FileExists(instance.access_kregistry_path())) {
@@ -285,6 +362,15 @@ std::vector<Command> QemuManager::StartCommands(
         << hwcomposer_pmem_size_bytes << ") not a multiple of 1MB";
   }
 
+  auto camera_frames_pmem_size_bytes = 0;
+  if (FileExists(instance.camera_frames_pmem_path())) {
+    camera_frames_pmem_size_bytes =
+        FileSize(instance.camera_frames_pmem_path());
+    CHECK((camera_frames_pmem_size_bytes & (1024 * 1024 - 1)) == 0)
+        << instance.camera_frames_pmem_path() << " file size ("
+        << camera_frames_pmem_size_bytes << ") not a multiple of 1MB";
+  }
+
   auto pstore_size_bytes = 0;
   if (FileExists(instance.pstore_path())) {
     pstore_size_bytes = FileSize(instance.pstore_path());
@@ -313,19 +399,46 @@ std::vector<Command> QemuManager::StartCommands(
     }
     CHECK(config.cpus() <= 8) << "CPUs must be no more than 8 with GICv2";
   }
+  // Qemu already advises transparent hugepages for anonymous guest memory
+  auto hugetlb = config.guest_hugepages() == "hugetlb";
+  if (hugetlb) {
+    machine += ",memory-backend=guest-ram";
+  }
+  if (config.guest_memory_merge()) {
+    // Qemu's default, but stated so that it survives changes to that
+    machine += ",mem-merge=on";
+  }
+  if (tuned && !is_arm) {
+    // The guest keeps time with kvm-clock and the local APIC timers. These
+    // ISA devices don't take PCI slots, so the boot devices don't move. The
+    // RTC stays, the pc machine can't do without it.
+    machine += ",pit=off,hpet=off,vmport=off";
+  }
   qemu_cmd.AddParameter(machine, ",usb=off,dump-guest-core=off");
 
   qemu_cmd.AddParameter("-m");
   auto maxmem = config.memory_mb() +
                 (access_kregistry_size_bytes / 1024 / 1024) +
                 (hwcomposer_pmem_size_bytes / 1024 / 1024) +
+                (camera_frames_pmem_size_bytes / 1024 / 1024) +
                 (is_arm ? 0 : pstore_size_bytes / 1024 / 1024);
-  auto slots = is_arm ? "" : ",slots=2";
+  auto slots = is_arm ? "" : ",slots=3";
   qemu_cmd.AddParameter("size=", config.memory_mb(), "M",
                         ",maxmem=", maxmem, "M", slots);
+  if (hugetlb) {
+    qemu_cmd.AddParameter("-object");
+    qemu_cmd.AddParameter("memory-backend-memfd,id=guest-ram,size=",
+                          config.memory_mb(), "M,hugetlb=on,hugetlbsize=2M");
+  }
 
   qemu_cmd.AddParameter("-overcommit");
-  qemu_cmd.AddParameter("mem-lock=off");
+  if (tuned && IsHostCompatible(arch_)) {
+    // Idle vCPUs halt in the guest instead of exiting to the host, which
+    // keeps their host CPUs busy but makes waking them up much cheaper
+    qemu_cmd.AddParameter("mem-lock=off,cpu-pm=on");
+  } else {
+    qemu_cmd.AddParameter("mem-lock=off");
+  }
 
   // Assume SMT is always 2 threads per core, which is how most hardware
   // today is configured, and the way crosvm does it
@@ -360,6 +473,14 @@ std::vector<Command> QemuManager::StartCommands(
   qemu_cmd.AddParameter("-mon");
   qemu_cmd.AddParameter("chardev=charmonitor,id=monitor,mode=control");
 
+  if (!config.snapshot_path().empty()) {
+    // qemu starts the guest by itself once the state is loaded
+    qemu_cmd.AddParameter("-incoming");
+    // A file URI takes the path as is, without a shell to quote it for
+    qemu_cmd.AddParameter("file:", config.snapshot_path(), "/",
+                          kSnapshotState);
+  }
+
   if (config.gpu_mode() == kGpuModeDrmVirgl) {
     qemu_cmd.AddParameter("-display");
     qemu_cmd.AddParameter("egl-headless");
@@ -458,16 +579,32 @@ std::vector<Command> QemuManager::StartCommands(
       << "Provided too many disks (" << disk_num << "), maximum "
       << VmManager::kMaxDisks << "supported";
   auto readonly = config.protected_vm() ? ",readonly" : "";
+  auto cache = config.disk_direct_io() ? ",cache.direct=on" : "";
+  // Pass guest discards down so trimmed space is returned to the host
+  auto discard = config.protected_vm() ? "" : ",discard=unmap";
+  std::string num_queues;
+  if (config.disk_num_queues() > 1) {
+    num_queues = ",num-queues=" + std::to_string(config.disk_num_queues());
+  }
   for (size_t i = 0; i < disk_num; i++) {
+    // Requests are served off the main loop, which the other devices share
+    std::string iothread;
+    if (tuned) {
+      qemu_cmd.AddParameter("-object");
+      qemu_cmd.AddParameter("iothread,id=iothread-disk", i);
+      iothread = ",iothread=iothread-disk" + std::to_string(i);
+    }
     auto bootindex = i == 0 ? ",bootindex=1" : "";
     auto format = i == 0 ? "" : ",format=raw";
     auto disk = instance.virtual_disk_paths()[i];
     qemu_cmd.AddParameter("-drive");
     qemu_cmd.AddParameter("file=", disk, ",if=none,id=drive-virtio-disk", i,
-                          ",aio=threads", format, readonly);
+                          ",aio=", config.disk_io_backend(), cache, discard,
+                          format, readonly);
     qemu_cmd.AddParameter("-device");
     qemu_cmd.AddParameter("virtio-blk-pci-non-transitional,scsi=off,drive=drive-virtio-disk", i,
-                          ",id=virtio-disk", i, bootindex);
+                          ",id=virtio-disk", i, num_queues, iothread,
+                          bootindex);
   }
 
   if (!is_arm && FileExists(instance.pstore_path())) {
@@ -507,6 +644,17 @@ std::vector<Command> QemuManager::StartCommands(
       qemu_cmd.AddParameter(
           "virtio-pmem-pci,disable-legacy=on,memdev=objpmem2,id=pmem1");
     }
+    if (camera_frames_pmem_size_bytes > 0) {
+      qemu_cmd.AddParameter("-object");
+      qemu_cmd.AddParameter(
+          "memory-backend-file,id=objpmem3,share=on,mem-path=",
+          instance.camera_frames_pmem_path(),
+          ",size=", camera_frames_pmem_size_bytes);
+
+      qemu_cmd.AddParameter("-device");
+      qemu_cmd.AddParameter(
+          "virtio-pmem-pci,disable-legacy=on,memdev=objpmem3,id=pmem2");
+    }
   }
 
   qemu_cmd.AddParameter("-object");
@@ -526,30 +674,40 @@ std::vector<Command> QemuManager::StartCommands(
   qemu_cmd.AddParameter("-device");
   qemu_cmd.AddParameter("virtio-keyboard-pci,disable-legacy=on");
 
-  auto vhost_net = config.vhost_net() ? ",vhost=on" : "";
+  auto vhost_net = config.vhost_net() || tuned ? ",vhost=on" : "";
 
   qemu_cmd.AddParameter("-device");
   qemu_cmd.AddParameter("virtio-balloon-pci-non-transitional,id=balloon0");
 
-  qemu_cmd.AddParameter("-netdev");
-  qemu_cmd.AddParameter("tap,id=hostnet0,ifname=", instance.mobile_tap_name(),
-                        ",script=no,downscript=no", vhost_net);
-
-  qemu_cmd.AddParameter("-device");
-  qemu_cmd.AddParameter("virtio-net-pci-non-transitional,netdev=hostnet0,id=net0");
-
-  qemu_cmd.AddParameter("-netdev");
-  qemu_cmd.AddParameter("tap,id=hostnet1,ifname=", instance.ethernet_tap_name(),
-                        ",script=no,downscript=no", vhost_net);
+  // Checksum and segmentation offloads are on by default in virtio-net-pci,
+  // the queue pairs need a multiqueue tap.
+  auto add_net_device = [&qemu_cmd, &config, vhost_net](
+                            int num, const std::string& tap_name) {
+    std::string netdev_queues;
+    std::string device_queues;
+    if (config.net_num_queues() > 1) {
+      if (IsMultiQueueTap(tap_name)) {
+        auto queues = config.net_num_queues();
+        netdev_queues = ",queues=" + std::to_string(queues);
+        // one vector per virtqueue, plus the config and control ones
+        device_queues = ",mq=on,vectors=" + std::to_string(2 * queues + 2);
+      } else {
+        LOG(WARNING) << tap_name << " is a single queue tap, ignoring "
+                     << "--net_num_queues for it";
+      }
+    }
+    qemu_cmd.AddParameter("-netdev");
+    qemu_cmd.AddParameter("tap,id=hostnet", num, ",ifname=", tap_name,
+                          ",script=no,downscript=no", vhost_net, netdev_queues);
+    qemu_cmd.AddParameter("-device");
+    qemu_cmd.AddParameter("virtio-net-pci-non-transitional,netdev=hostnet", num,
+                          ",id=net", num, device_queues);
+  };
 
-  qemu_cmd.AddParameter("-device");
-  qemu_cmd.AddParameter("virtio-net-pci-non-transitional,netdev=hostnet1,id=net1");
+  add_net_device(0, instance.mobile_tap_name());
+  add_net_device(1, instance.ethernet_tap_name());
 #ifndef ENFORCE_MAC80211_HWSIM
-  qemu_cmd.AddParameter("-netdev");
-  qemu_cmd.AddParameter("tap,id=hostnet2,ifname=", instance.wifi_tap_name(),
-                        ",script=no,downscript=no", vhost_net);
-  qemu_cmd.AddParameter("-device");
-  qemu_cmd.AddParameter("virtio-net-pci-non-transitional,netdev=hostnet2,id=net2");
+  add_net_device(2, instance.wifi_tap_name());
 #endif
 
   qemu_cmd.AddParameter("-cpu");
@@ -584,6 +742,38 @@ std::vector<Command> QemuManager::StartCommands(
   return ret;
 }
 
+Result<void> QemuManager::Suspend(const CuttlefishConfig& config) {
+  auto qmp = CF_EXPECT(QmpClient::Connect(config));
+  CF_EXPECT(qmp.Execute("stop"));
+  return {};
+}
+
+Result<void> QemuManager::Resume(const CuttlefishConfig& config) {
+  auto qmp = CF_EXPECT(QmpClient::Connect(config));
+  CF_EXPECT(qmp.Execute("cont"));
+  return {};
+}
+
+Result<void> QemuManager::Snapshot(const CuttlefishConfig& config,
+                                   const std::string& directory) {
+  auto qmp = CF_EXPECT(QmpClient::Connect(config));
+  Json::Value arguments;
+  arguments["uri"] = "file:" + directory + "/" + kSnapshotState;
+  CF_EXPECT(qmp.Execute("migrate", arguments));
+  // The migration runs in the background, the vcpus stay stopped after it
+  while (true) {
+    auto migration = CF_EXPECT(qmp.Execute("query-migrate"));
+    auto status = migration["status"].asString();
+    if (status == "completed") {
+      return {};
+    }
+    CF_EXPECT(status != "failed" && status != "cancelled",
+              "Saving the qemu state failed: "
+                  << migration["error-desc"].asString());
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+}
+
 } // namespace vm_manager
 } // namespace cuttlefish
 
@@ -40,7 +40,12 @@ class QemuManager : public VmManager {
   std::string ConfigureBootDevices(int num_disks) override;
 
   std::vector<cuttlefish::Command> StartCommands(
-      const CuttlefishConfig& config) override;
+      const CuttlefishConfig& config, LogTeeCreator& log_tee) override;
+
+  Result<void> Suspend(const CuttlefishConfig& config) override;
+  Result<void> Resume(const CuttlefishConfig& config) override;
+  Result<void> Snapshot(const CuttlefishConfig& config,
+                        const std::string& directory) override;
 
  private:
   Arch arch_;
@@ -50,6 +50,35 @@ std::unique_ptr<VmManager> GetVmManager(const std::string& name, Arch arch) {
   return vmm;
 }
 
+Result<void> VmManager::Suspend(const CuttlefishConfig&) {
+  return CF_ERR("Suspending is not supported by this VM manager");
+}
+
+Result<void> VmManager::Resume(const CuttlefishConfig&) {
+  return CF_ERR("Resuming is not supported by this VM manager");
+}
+
+Result<void> VmManager::Snapshot(const CuttlefishConfig&, const std::string&) {
+  return CF_ERR("Snapshots are not supported by this VM manager");
+}
+
+Result<BalloonStats> VmManager::GetBalloonStats(const CuttlefishConfig&) {
+  return CF_ERR("Memory balloons are not supported by this VM manager");
+}
+
+Result<void> VmManager::SetBalloonSize(const CuttlefishConfig&, std::uint64_t) {
+  return CF_ERR("Memory balloons are not supported by this VM manager");
+}
+
+Result<void> VmManager::AddDisplay(const CuttlefishConfig&,
+                                   const CuttlefishConfig::DisplayConfig&) {
+  return CF_ERR("Adding displays is not supported by this VM manager");
+}
+
+Result<void> VmManager::RemoveDisplay(const CuttlefishConfig&, std::uint32_t) {
+  return CF_ERR("Removing displays is not supported by this VM manager");
+}
+
 std::string ConfigureMultipleBootDevices(const std::string& pci_path,
                                          int pci_offset, int num_disks) {
   int num_boot_devices =
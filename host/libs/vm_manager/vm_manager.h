@@ -14,16 +14,26 @@
  * limitations under the License.
  */
 #pragma once
+#include <common/libs/utils/result.h>
 #include <common/libs/utils/subprocess.h>
 #include <fruit/fruit.h>
 #include <host/libs/config/cuttlefish_config.h>
+#include <host/libs/config/log_tee_creator.h>
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
 namespace cuttlefish {
 namespace vm_manager {
 
+struct BalloonStats {
+  // Memory the balloon currently takes from the guest
+  std::uint64_t balloon_bytes;
+  // Memory the guest could use without swapping, outside of the balloon
+  std::uint64_t available_bytes;
+};
+
 // Superclass of every guest VM manager.
 class VmManager {
  public:
@@ -66,8 +76,34 @@ class VmManager {
   // command_starter function, although it may start more than one. The
   // command_starter function allows to customize the way vmm commands are
   // started/tracked/etc.
+  // The output of the VMM's processes goes through log_tee.
   virtual std::vector<cuttlefish::Command> StartCommands(
-      const CuttlefishConfig& config) = 0;
+      const CuttlefishConfig& config, LogTeeCreator& log_tee) = 0;
+
+  // Stops and restarts the guest vcpus. The guest can't observe anything while
+  // suspended, so the host side of the device can be captured consistently.
+  virtual Result<void> Suspend(const CuttlefishConfig& config);
+  virtual Result<void> Resume(const CuttlefishConfig& config);
+
+  // Saves the state of a suspended guest to the `directory` of a snapshot.
+  // StartCommands resumes the guest from that state instead of booting it
+  // when the config has a snapshot_path.
+  virtual Result<void> Snapshot(const CuttlefishConfig& config,
+                                const std::string& directory);
+
+  // Memory balloon of the running guest. Inflating it returns guest memory
+  // to the host.
+  virtual Result<BalloonStats> GetBalloonStats(const CuttlefishConfig& config);
+  virtual Result<void> SetBalloonSize(const CuttlefishConfig& config,
+                                      std::uint64_t bytes);
+
+  // Displays of the running guest. Added displays take the lowest display
+  // number that is free, removing one frees its number.
+  virtual Result<void> AddDisplay(
+      const CuttlefishConfig& config,
+      const CuttlefishConfig::DisplayConfig& display_config);
+  virtual Result<void> RemoveDisplay(const CuttlefishConfig& config,
+                                     std::uint32_t display_number);
 };
 
 fruit::Component<fruit::Required<const CuttlefishConfig>, VmManager>
@@ -105,10 +105,25 @@ void surface_damage(wl_client*,
                << " y=" << y
                << " w=" << w
                << " h=" << h;
+
+  GetUserData<Surface>(surface_resource)
+      ->AddDamage(Surface::Region{.x = x, .y = y, .w = w, .h = h});
 }
 
-void surface_frame(wl_client*, wl_resource* surface, uint32_t) {
-  LOG(VERBOSE) << " surface=" << surface;
+void surface_frame(wl_client* client,
+                   wl_resource* surface_resource,
+                   uint32_t callback_id) {
+  LOG(VERBOSE) << __FUNCTION__
+               << " surface=" << surface_resource
+               << " callback=" << callback_id;
+
+  wl_resource* callback_resource =
+      wl_resource_create(client, &wl_callback_interface, 1, callback_id);
+  if (callback_resource == nullptr) {
+    wl_client_post_no_memory(client);
+    return;
+  }
+  GetUserData<Surface>(surface_resource)->AddFrameCallback(callback_resource);
 }
 
 void surface_set_opaque_region(wl_client*,
@@ -167,6 +182,9 @@ void surface_damage_buffer(wl_client*,
                << " y=" << y
                << " w=" << w
                << " h=" << h;
+
+  GetUserData<Surface>(surface_resource)
+      ->AddDamage(Surface::Region{.x = x, .y = y, .w = w, .h = h});
 }
 
 const struct wl_surface_interface surface_implementation = {
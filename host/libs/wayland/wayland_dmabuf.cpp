@@ -16,6 +16,14 @@
 
 #include "host/libs/wayland/wayland_dmabuf.h"
 
+#include <linux/dma-buf.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <iterator>
+#include <optional>
+
 #include <android-base/logging.h>
 
 #include <drm_fourcc.h>
@@ -27,6 +35,54 @@
 namespace wayland {
 namespace {
 
+// The formats offered to clients, read by copying their pixels as they are
+// like the matching wl_shm formats. The frames are then converted as libyuv
+// ABGR, which is R, G, B, A in memory, so only the DRM formats with that byte
+// order are offered. ARGB8888 and XRGB8888 would stream with red and blue
+// swapped.
+struct DmabufFormat {
+  uint32_t fourcc;
+  uint32_t bytes_per_pixel;
+  bool opaque;
+};
+constexpr DmabufFormat kFormats[] = {
+    {DRM_FORMAT_ABGR8888, 4, false},
+    {DRM_FORMAT_XBGR8888, 4, true},
+};
+
+const DmabufFormat* FindFormat(uint32_t fourcc) {
+  for (const auto& format : kFormats) {
+    if (format.fourcc == fourcc) {
+      return &format;
+    }
+  }
+  return nullptr;
+}
+
+// The planes received so far for a buffer that hasn't been created yet.
+struct BufferParams {
+  struct Plane {
+    int fd;
+    uint32_t offset;
+    uint32_t stride;
+    uint64_t modifier;
+  };
+  std::optional<Plane> planes[4];
+  bool used = false;
+
+  ~BufferParams() {
+    for (auto& plane : planes) {
+      if (plane) {
+        close(plane->fd);
+      }
+    }
+  }
+};
+
+BufferParams* GetBufferParams(wl_resource* params) {
+  return static_cast<BufferParams*>(wl_resource_get_user_data(params));
+}
+
 void buffer_destroy(wl_client*, wl_resource* buffer) {
   LOG(VERBOSE) << __FUNCTION__
                << " buffer=" << buffer;
@@ -38,6 +94,10 @@ const struct wl_buffer_interface buffer_implementation = {
     .destroy = buffer_destroy
 };
 
+void buffer_destroy_resource_callback(struct wl_resource* buffer) {
+  delete DmabufBuffer::FromResource(buffer);
+}
+
 void linux_buffer_params_destroy(wl_client*, wl_resource* params) {
   LOG(VERBOSE) << __FUNCTION__
                << " params=" << params;
@@ -45,7 +105,9 @@ void linux_buffer_params_destroy(wl_client*, wl_resource* params) {
   wl_resource_destroy(params);
 }
 
-void params_destroy_resource_callback(struct wl_resource*) {}
+void params_destroy_resource_callback(struct wl_resource* params) {
+  delete GetBufferParams(params);
+}
 
 void linux_buffer_params_add(wl_client*,
                              wl_resource* params,
@@ -63,6 +125,113 @@ void linux_buffer_params_add(wl_client*,
                << " stride=" << stride
                << " mod_hi=" << modifier_hi
                << " mod_lo=" << modifier_lo;
+
+  auto* buffer_params = GetBufferParams(params);
+  if (buffer_params->used) {
+    close(fd);
+    wl_resource_post_error(params, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED,
+                           "params were already used to create a buffer");
+    return;
+  }
+  if (plane >= std::size(buffer_params->planes)) {
+    close(fd);
+    wl_resource_post_error(params, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_PLANE_IDX,
+                           "plane index %u is out of bounds", plane);
+    return;
+  }
+  if (buffer_params->planes[plane]) {
+    close(fd);
+    wl_resource_post_error(params, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_PLANE_SET,
+                           "plane %u was already set", plane);
+    return;
+  }
+  buffer_params->planes[plane] = BufferParams::Plane{
+      .fd = fd,
+      .offset = offset,
+      .stride = stride,
+      .modifier = (static_cast<uint64_t>(modifier_hi) << 32) | modifier_lo,
+  };
+}
+
+// Takes the plane out of the params if they describe a buffer that can be
+// read directly, which is only the case for single plane, linear buffers in
+// one of kFormats. Invalid params get a protocol error posted on them, which
+// `posted_error` tells apart from params that are valid but unsupported.
+std::optional<BufferParams::Plane> TakeSinglePlane(wl_resource* params,
+                                                   int32_t w, int32_t h,
+                                                   const DmabufFormat* format,
+                                                   bool* posted_error) {
+  *posted_error = false;
+  auto* buffer_params = GetBufferParams(params);
+  if (buffer_params->used) {
+    *posted_error = true;
+    wl_resource_post_error(params, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED,
+                           "params were already used to create a buffer");
+    return std::nullopt;
+  }
+  buffer_params->used = true;
+  if (format == nullptr) {
+    *posted_error = true;
+    wl_resource_post_error(params,
+                           ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_FORMAT,
+                           "format was not advertised");
+    return std::nullopt;
+  }
+  auto& planes = buffer_params->planes;
+  if (!planes[0]) {
+    *posted_error = true;
+    wl_resource_post_error(params, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INCOMPLETE,
+                           "plane 0 is missing");
+    return std::nullopt;
+  }
+  if (planes[1] || planes[2] || planes[3]) {
+    LOG(ERROR) << "Only single plane dmabuf buffers are supported";
+    return std::nullopt;
+  }
+  if (planes[0]->modifier != DRM_FORMAT_MOD_LINEAR &&
+      planes[0]->modifier != DRM_FORMAT_MOD_INVALID) {
+    LOG(ERROR) << "Unsupported dmabuf modifier " << planes[0]->modifier;
+    return std::nullopt;
+  }
+  if (w <= 0 || h <= 0) {
+    *posted_error = true;
+    wl_resource_post_error(params,
+                           ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_DIMENSIONS,
+                           "invalid dimensions %dx%d", w, h);
+    return std::nullopt;
+  }
+  const uint64_t row_size = static_cast<uint64_t>(w) * format->bytes_per_pixel;
+  const uint64_t size = planes[0]->offset +
+                        static_cast<uint64_t>(planes[0]->stride) * (h - 1) +
+                        row_size;
+  // Not every exporter reports the size of its buffers
+  const off_t dmabuf_size = lseek(planes[0]->fd, 0, SEEK_END);
+  if (planes[0]->stride < row_size ||
+      (dmabuf_size >= 0 && size > static_cast<uint64_t>(dmabuf_size))) {
+    *posted_error = true;
+    wl_resource_post_error(params, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_OUT_OF_BOUNDS,
+                           "%dx%d buffer with stride %u at offset %u doesn't "
+                           "fit in the dmabuf",
+                           w, h, planes[0]->stride, planes[0]->offset);
+    return std::nullopt;
+  }
+  auto plane = planes[0];
+  planes[0].reset();
+  return plane;
+}
+
+wl_resource* CreateBufferResource(wl_client* client, uint32_t id,
+                                  const BufferParams::Plane& plane, int32_t w,
+                                  int32_t h, const DmabufFormat& format) {
+  wl_resource* buffer_resource =
+      wl_resource_create(client, &wl_buffer_interface, 1, id);
+
+  wl_resource_set_implementation(
+      buffer_resource, &buffer_implementation,
+      new DmabufBuffer(plane.fd, plane.offset, plane.stride, w, h,
+                       format.opaque),
+      buffer_destroy_resource_callback);
+  return buffer_resource;
 }
 
 void linux_buffer_params_create(wl_client* client,
@@ -78,11 +247,18 @@ void linux_buffer_params_create(wl_client* client,
                << " format=" << format
                << " flags=" << flags;
 
+  auto buffer_format = FindFormat(format);
+  bool posted_error;
+  auto plane = TakeSinglePlane(params, w, h, buffer_format, &posted_error);
+  if (!plane) {
+    if (!posted_error) {
+      zwp_linux_buffer_params_v1_send_failed(params);
+    }
+    return;
+  }
   wl_resource* buffer_resource =
-      wl_resource_create(client, &wl_buffer_interface, 1, 0);
-
-  wl_resource_set_implementation(buffer_resource, &buffer_implementation,
-                                 nullptr, params_destroy_resource_callback);
+      CreateBufferResource(client, 0, *plane, w, h, *buffer_format);
+  zwp_linux_buffer_params_v1_send_created(params, buffer_resource);
 }
 
 void linux_buffer_params_create_immed(wl_client* client,
@@ -100,11 +276,18 @@ void linux_buffer_params_create_immed(wl_client* client,
                << " format=" << format
                << " flags=" << flags;
 
-  wl_resource* buffer_resource =
-      wl_resource_create(client, &wl_buffer_interface, 1, id);
-
-  wl_resource_set_implementation(buffer_resource, &buffer_implementation,
-                                 nullptr, params_destroy_resource_callback);
+  auto buffer_format = FindFormat(format);
+  bool posted_error;
+  auto plane = TakeSinglePlane(params, w, h, buffer_format, &posted_error);
+  if (!plane) {
+    if (!posted_error) {
+      wl_resource_post_error(params,
+                             ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_WL_BUFFER,
+                             "unsupported dmabuf buffer");
+    }
+    return;
+  }
+  CreateBufferResource(client, id, *plane, w, h, *buffer_format);
 }
 
 const struct zwp_linux_buffer_params_v1_interface
@@ -133,7 +316,8 @@ void linux_dmabuf_create_params(wl_client* client,
 
   wl_resource_set_implementation(buffer_params_resource,
                                  &zwp_linux_buffer_params_implementation,
-                                 nullptr, params_destroy_resource_callback);
+                                 new BufferParams(),
+                                 params_destroy_resource_callback);
 }
 
 const struct zwp_linux_dmabuf_v1_interface
@@ -154,7 +338,9 @@ void bind_linux_dmabuf(wl_client* client,
   wl_resource_set_implementation(resource, &zwp_linux_dmabuf_v1_implementation,
                                  data, nullptr);
 
-  zwp_linux_dmabuf_v1_send_format(resource, DRM_FORMAT_ARGB8888);
+  for (const auto& format : kFormats) {
+    zwp_linux_dmabuf_v1_send_format(resource, format.fourcc);
+  }
 }
 
 }  // namespace
@@ -164,4 +350,51 @@ void BindDmabufInterface(wl_display* display) {
                    kLinuxDmabufVersion, nullptr, bind_linux_dmabuf);
 }
 
+DmabufBuffer::DmabufBuffer(int fd, uint32_t offset, uint32_t stride,
+                           int32_t width, int32_t height, bool opaque)
+    : fd_(fd), offset_(offset), stride_(stride), width_(width),
+      height_(height), opaque_(opaque) {}
+
+DmabufBuffer::~DmabufBuffer() {
+  if (mapping_ != nullptr) {
+    munmap(mapping_, mapping_size_);
+  }
+  close(fd_);
+}
+
+DmabufBuffer* DmabufBuffer::FromResource(struct wl_resource* buffer) {
+  if (!wl_resource_instance_of(buffer, &wl_buffer_interface,
+                               &buffer_implementation)) {
+    return nullptr;
+  }
+  return static_cast<DmabufBuffer*>(wl_resource_get_user_data(buffer));
+}
+
+const uint8_t* DmabufBuffer::BeginAccess() {
+  if (mapping_ == nullptr) {
+    const size_t size = static_cast<size_t>(offset_) +
+                        static_cast<size_t>(stride_) * height_;
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd_, 0);
+    if (mapping == MAP_FAILED) {
+      PLOG(ERROR) << "Failed to map dmabuf of " << size << " bytes";
+      return nullptr;
+    }
+    mapping_ = mapping;
+    mapping_size_ = size;
+  }
+  // Not every exporter supports syncing, e.g. memfd backed buffers don't
+  // need it, so failures are ignored.
+  struct dma_buf_sync sync = {.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ};
+  ioctl(fd_, DMA_BUF_IOCTL_SYNC, &sync);
+  return static_cast<const uint8_t*>(mapping_) + offset_;
+}
+
+void DmabufBuffer::EndAccess() {
+  if (mapping_ == nullptr) {
+    return;
+  }
+  struct dma_buf_sync sync = {.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ};
+  ioctl(fd_, DMA_BUF_IOCTL_SYNC, &sync);
+}
+
 }  // namespace wayland
\ No newline at end of file
@@ -14,7 +14,6 @@
  * limitations under the License.
  */
 
-
 #pragma once
 
 #include <stdint.h>
@@ -26,4 +25,44 @@ namespace wayland {
 // Binds the dmabuf interface to the given wayland server.
 void BindDmabufInterface(wl_display* display);
 
-}  // namespace wayland
\ No newline at end of file
+// A single plane, linear wl_buffer created through zwp_linux_dmabuf_v1.
+//
+// The dmabuf is mapped the first time its pixels are needed and stays mapped
+// until the client destroys the buffer, so clients cycling through a few
+// buffers don't pay for a new mapping on every commit.
+class DmabufBuffer {
+ public:
+  DmabufBuffer(int fd, uint32_t offset, uint32_t stride, int32_t width,
+               int32_t height, bool opaque);
+  ~DmabufBuffer();
+
+  DmabufBuffer(const DmabufBuffer&) = delete;
+  DmabufBuffer& operator=(const DmabufBuffer&) = delete;
+
+  // Returns the DmabufBuffer backing the wl_buffer, or nullptr if it's not a
+  // dmabuf buffer.
+  static DmabufBuffer* FromResource(struct wl_resource* buffer);
+
+  int32_t width() const { return width_; }
+  int32_t height() const { return height_; }
+  uint32_t stride() const { return stride_; }
+  // Whether the format has no alpha channel
+  bool opaque() const { return opaque_; }
+
+  // Returns the pixels, ready to be read until EndAccess(), or nullptr if the
+  // dmabuf can't be mapped.
+  const uint8_t* BeginAccess();
+  void EndAccess();
+
+ private:
+  int fd_;
+  uint32_t offset_;
+  uint32_t stride_;
+  int32_t width_;
+  int32_t height_;
+  bool opaque_;
+  void* mapping_ = nullptr;
+  size_t mapping_size_ = 0;
+};
+
+}  // namespace wayland
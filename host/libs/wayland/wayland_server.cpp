@@ -101,4 +101,10 @@ void WaylandServer::SetFrameCallback(Surfaces::FrameCallback callback) {
   server_state_->surfaces_.SetFrameCallback(std::move(callback));
 }
 
+void WaylandServer::SetDisplayRefreshRate(std::uint32_t display_number,
+                                          std::uint32_t refresh_rate_hz) {
+  server_state_->surfaces_.SetDisplayRefreshRate(display_number,
+                                                 refresh_rate_hz);
+}
+
 }  // namespace wayland
@@ -52,6 +52,11 @@ class WaylandServer {
     // available.
     void SetFrameCallback(Surfaces::FrameCallback callback);
 
+    // Limits how often clients showing on the display are told to draw a
+    // new frame.
+    void SetDisplayRefreshRate(std::uint32_t display_number,
+                               std::uint32_t refresh_rate_hz);
+
    private:
     void ServerLoop(int wayland_socket_fd);
 
@@ -21,9 +21,18 @@
 #include <wayland-server-core.h>
 #include <wayland-server-protocol.h>
 
+#include "host/libs/wayland/wayland_surface.h"
+#include "host/libs/wayland/wayland_utils.h"
+
 namespace wayland {
 namespace {
 
+// The surface a subsurface gives a role to, or nullptr once that surface was
+// destroyed, which leaves the subsurface inert.
+Surface* GetSubsurfaceSurface(wl_resource* subsurface) {
+  return static_cast<Surface*>(wl_resource_get_user_data(subsurface));
+}
+
 void subsurface_destroy(wl_client*, wl_resource* subsurface) {
   LOG(VERBOSE) << " subsurface=" << subsurface;
 
@@ -38,6 +47,10 @@ void subsurface_set_position(wl_client*,
                << " subsurface=" << subsurface
                << " x=" << x
                << " y=" << y;
+
+  if (Surface* surface = GetSubsurfaceSurface(subsurface); surface) {
+    surface->SetPosition(x, y);
+  }
 }
 
 void subsurface_place_above(wl_client*,
@@ -46,6 +59,11 @@ void subsurface_place_above(wl_client*,
   LOG(VERBOSE) << __FUNCTION__
                << " subsurface=" << subsurface
                << " surface=" << surface;
+
+  if (Surface* subsurface_surface = GetSubsurfaceSurface(subsurface);
+      subsurface_surface) {
+    subsurface_surface->PlaceAbove(GetUserData<Surface>(surface));
+  }
 }
 
 void subsurface_place_below(wl_client*,
@@ -54,6 +72,11 @@ void subsurface_place_below(wl_client*,
   LOG(VERBOSE) << __FUNCTION__
                << " subsurface=" << subsurface
                << " surface=" << surface;
+
+  if (Surface* subsurface_surface = GetSubsurfaceSurface(subsurface);
+      subsurface_surface) {
+    subsurface_surface->PlaceBelow(GetUserData<Surface>(surface));
+  }
 }
 
 void subsurface_set_sync(wl_client*, wl_resource* subsurface) {
@@ -66,7 +89,12 @@ void subsurface_set_desync(wl_client*, wl_resource* subsurface) {
                << " subsurface=" << subsurface;
 }
 
-void subsurface_destroy_resource_callback(struct wl_resource*) {}
+// Destroying the subsurface unmaps its surface.
+void subsurface_destroy_resource_callback(struct wl_resource* subsurface) {
+  if (Surface* surface = GetSubsurfaceSurface(subsurface); surface) {
+    surface->SetParent(nullptr, nullptr);
+  }
+}
 
 const struct wl_subsurface_interface subsurface_implementation = {
     .destroy = subsurface_destroy,
@@ -97,9 +125,13 @@ void subcompositor_get_subsurface(wl_client* client,
   wl_resource* subsurface_resource =
       wl_resource_create(client, &wl_subsurface_interface, 1, id);
 
+  Surface* subsurface_surface = GetUserData<Surface>(surface);
   wl_resource_set_implementation(subsurface_resource,
-                                 &subsurface_implementation, nullptr,
+                                 &subsurface_implementation,
+                                 subsurface_surface,
                                  subsurface_destroy_resource_callback);
+  subsurface_surface->SetParent(GetUserData<Surface>(parent_surface),
+                                subsurface_resource);
 }
 
 const struct wl_subcompositor_interface subcompositor_implementation = {
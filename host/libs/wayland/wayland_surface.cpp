@@ -16,62 +16,759 @@
 
 #include "host/libs/wayland/wayland_surface.h"
 
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <tuple>
+
 #include <android-base/logging.h>
+#include <libyuv.h>
 #include <wayland-server-protocol.h>
 
+#include "host/libs/wayland/wayland_dmabuf.h"
 #include "host/libs/wayland/wayland_surfaces.h"
 
 namespace wayland {
+namespace {
+
+constexpr int32_t kBytesPerPixel = 4;
+
+// Clients commonly damage (0, 0, INT32_MAX, INT32_MAX) to mean everything,
+// so the far edges are computed in 64 bits to avoid overflowing.
+Surface::Region Union(const Surface::Region& a, const Surface::Region& b) {
+  const int64_t x0 = std::min(a.x, b.x);
+  const int64_t y0 = std::min(a.y, b.y);
+  const int64_t x1 = std::max(int64_t{a.x} + a.w, int64_t{b.x} + b.w);
+  const int64_t y1 = std::max(int64_t{a.y} + a.h, int64_t{b.y} + b.h);
+  return Surface::Region{
+      .x = static_cast<int32_t>(x0),
+      .y = static_cast<int32_t>(y0),
+      .w = static_cast<int32_t>(std::min<int64_t>(x1 - x0, INT32_MAX)),
+      .h = static_cast<int32_t>(std::min<int64_t>(y1 - y0, INT32_MAX)),
+  };
+}
+
+// Grows into with the region, an empty into standing for nothing.
+void Accumulate(std::optional<Surface::Region>& into,
+                const std::optional<Surface::Region>& region) {
+  if (!region) {
+    return;
+  }
+  into = into ? Union(*into, *region) : *region;
+}
+
+std::optional<Surface::Region> Intersect(const Surface::Region& a,
+                                         const Surface::Region& b) {
+  const int64_t x0 = std::max(a.x, b.x);
+  const int64_t y0 = std::max(a.y, b.y);
+  const int64_t x1 = std::min(int64_t{a.x} + a.w, int64_t{b.x} + b.w);
+  const int64_t y1 = std::min(int64_t{a.y} + a.h, int64_t{b.y} + b.h);
+  if (x1 <= x0 || y1 <= y0) {
+    return std::nullopt;
+  }
+  return Surface::Region{
+      .x = static_cast<int32_t>(x0),
+      .y = static_cast<int32_t>(y0),
+      .w = static_cast<int32_t>(x1 - x0),
+      .h = static_cast<int32_t>(y1 - y0),
+  };
+}
+
+// Clients that attach a new buffer without reporting any damage are treated
+// as having changed the whole buffer.
+Surface::Region ClampToBuffer(const std::optional<Surface::Region>& damage,
+                              int32_t buffer_w, int32_t buffer_h) {
+  const Surface::Region buffer{.x = 0, .y = 0, .w = buffer_w, .h = buffer_h};
+  if (!damage) {
+    return buffer;
+  }
+  return Intersect(*damage, buffer).value_or(Surface::Region{});
+}
+
+}  // namespace
+
+Surface::Surface(Surfaces& surfaces) : surfaces_(surfaces), stack_{this} {}
 
-Surface::Surface(Surfaces& surfaces) : surfaces_(surfaces) {}
+Surface::~Surface() {
+  Surface* root = nullptr;
+  std::optional<Region> uncovered;
+  {
+    std::lock_guard<std::mutex> lock(surfaces_.composition_mutex_);
+    // Subsurfaces of a destroyed surface aren't shown anymore
+    for (Surface* subsurface : stack_) {
+      if (subsurface != this) {
+        subsurface->parent_ = nullptr;
+      }
+    }
+    stack_ = {this};
+    if (parent_ != nullptr) {
+      root = RootLocked();
+      uncovered = UnlinkLocked();
+    }
+    if (subsurface_resource_ != nullptr) {
+      wl_resource_set_user_data(subsurface_resource_, nullptr);
+    }
+  }
+  if (uncovered) {
+    root->QueueComposition(*uncovered);
+  }
+
+  if (worker_.joinable()) {
+    {
+      std::unique_lock<std::mutex> lock(state_mutex_);
+      state_.stop_worker = true;
+    }
+    frame_queued_cv_.notify_all();
+    worker_.join();
+  }
+  std::vector<struct wl_resource*> callbacks;
+  {
+    std::unique_lock<std::mutex> lock(state_mutex_);
+    if (state_.queued_frame) {
+      ReleaseFrame(*state_.queued_frame);
+      state_.queued_frame.reset();
+    }
+    for (auto& frame : state_.done_frames) {
+      ReleaseFrame(*frame);
+    }
+    state_.done_frames.clear();
+    if (frames_done_source_ != nullptr) {
+      wl_event_source_remove(frames_done_source_);
+      frames_done_source_ = nullptr;
+      close(frames_done_fd_);
+    }
+    callbacks = std::move(state_.pending_frame_callbacks);
+    callbacks.insert(callbacks.end(), state_.frame_callbacks.begin(),
+                     state_.frame_callbacks.end());
+    state_.frame_callbacks.clear();
+    if (state_.frame_timer != nullptr) {
+      wl_event_source_remove(state_.frame_timer);
+      state_.frame_timer = nullptr;
+    }
+  }
+  for (auto* callback : callbacks) {
+    wl_resource_set_user_data(callback, nullptr);
+    wl_resource_destroy(callback);
+  }
+}
 
 void Surface::SetRegion(const Region& region) {
   std::unique_lock<std::mutex> lock(state_mutex_);
   state_.region = region;
 }
 
+void Surface::AddDamage(const Region& damage) {
+  if (damage.w <= 0 || damage.h <= 0) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(state_mutex_);
+  if (!state_.pending_damage) {
+    state_.pending_damage = damage;
+    return;
+  }
+  state_.pending_damage = Union(*state_.pending_damage, damage);
+}
+
 void Surface::Attach(struct wl_resource* buffer) {
   std::unique_lock<std::mutex> lock(state_mutex_);
   state_.pending_buffer = buffer;
 }
 
+void Surface::AddFrameCallback(struct wl_resource* callback) {
+  wl_resource_set_implementation(callback, nullptr, this,
+                                 OnFrameCallbackDestroyed);
+  std::unique_lock<std::mutex> lock(state_mutex_);
+  state_.pending_frame_callbacks.push_back(callback);
+}
+
+void Surface::OnFrameCallbackDestroyed(struct wl_resource* callback) {
+  // Callbacks the surface sends or drops itself have no user data left.
+  Surface* surface = static_cast<Surface*>(wl_resource_get_user_data(callback));
+  if (surface == nullptr) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(surface->state_mutex_);
+  for (auto* callbacks : {&surface->state_.pending_frame_callbacks,
+                          &surface->state_.frame_callbacks}) {
+    callbacks->erase(std::remove(callbacks->begin(), callbacks->end(), callback),
+                     callbacks->end());
+  }
+}
+
 void Surface::Commit() {
+  ApplySubsurfacePositions();
+
   std::unique_lock<std::mutex> lock(state_mutex_);
   state_.current_buffer = state_.pending_buffer;
   state_.pending_buffer = nullptr;
 
+  std::optional<Region> damage = state_.pending_damage;
+  state_.pending_damage.reset();
+
+  state_.frame_callbacks.insert(state_.frame_callbacks.end(),
+                                state_.pending_frame_callbacks.begin(),
+                                state_.pending_frame_callbacks.end());
+  state_.pending_frame_callbacks.clear();
+
   if (state_.current_buffer == nullptr) {
+    ScheduleFrameCallbacks();
     return;
   }
 
+  struct wl_client* client = wl_resource_get_client(state_.current_buffer);
+  std::unique_ptr<Frame> frame;
   if (state_.virtio_gpu_metadata_.scanout_id.has_value()) {
-    const uint32_t display_number = *state_.virtio_gpu_metadata_.scanout_id;
+    frame = std::make_unique<Frame>();
+    frame->surface = this;
+    frame->buffer = state_.current_buffer;
+    frame->display_number = *state_.virtio_gpu_metadata_.scanout_id;
+    frame->region = state_.region;
+    frame->damage = damage;
+    if (struct wl_shm_buffer* shm_buffer =
+            wl_shm_buffer_get(state_.current_buffer);
+        shm_buffer != nullptr) {
+      frame->shm_buffer = shm_buffer;
+      frame->shm_pool = wl_shm_buffer_ref_pool(shm_buffer);
+    } else if (auto* dmabuf = DmabufBuffer::FromResource(state_.current_buffer);
+               dmabuf != nullptr) {
+      frame->dmabuf = dmabuf;
+    } else {
+      LOG(ERROR) << "Unsupported buffer type committed to display "
+                 << frame->display_number;
+      frame.reset();
+    }
+  }
 
-    struct wl_shm_buffer* shm_buffer = wl_shm_buffer_get(state_.current_buffer);
-    CHECK(shm_buffer != nullptr);
+  if (frame) {
+    frame->buffer_destroy_listener.listener.notify = OnBufferDestroyed;
+    frame->buffer_destroy_listener.frame = frame.get();
+    wl_resource_add_destroy_listener(frame->buffer,
+                                     &frame->buffer_destroy_listener.listener);
+    if (state_.queued_frame) {
+      // Replaced before the worker got to it. Without damage the whole
+      // buffer counts as changed, which the union must keep.
+      if (frame->damage && state_.queued_frame->damage) {
+        frame->damage = Union(*frame->damage, *state_.queued_frame->damage);
+      } else {
+        frame->damage.reset();
+      }
+      ReleaseFrame(*state_.queued_frame);
+    }
+    state_.queued_frame = std::move(frame);
+    if (!worker_.joinable()) {
+      StartFrameWorker(wl_client_get_display(client));
+    }
+    frame_queued_cv_.notify_one();
+    // The frame callbacks go out once the worker handled the frame
+  } else {
+    UpdateSubsurfaceContent(state_.current_buffer, damage);
+    // The pixels were consumed, if at all, so the buffer goes back to the
+    // client right away for it to recycle.
+    wl_buffer_send_release(state_.current_buffer);
+    ScheduleFrameCallbacks();
+  }
+  wl_client_flush(client);
 
-    wl_shm_buffer_begin_access(shm_buffer);
+  state_.current_buffer = nullptr;
+  state_.current_frame_number++;
+}
+
+void Surface::StartFrameWorker(struct wl_display* display) {
+  frames_done_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  PCHECK(frames_done_fd_ >= 0) << "Failed to create eventfd";
+  frames_done_source_ = wl_event_loop_add_fd(
+      wl_display_get_event_loop(display), frames_done_fd_, WL_EVENT_READABLE,
+      OnFramesDone, this);
+  CHECK(frames_done_source_ != nullptr) << "Failed to watch eventfd";
+  worker_ = std::thread([this]() { FrameWorkerLoop(); });
+}
+
+void Surface::FrameWorkerLoop() {
+  std::unique_lock<std::mutex> lock(state_mutex_);
+  for (;;) {
+    frame_queued_cv_.wait(lock, [this]() {
+      return state_.stop_worker || state_.queued_frame != nullptr;
+    });
+    if (state_.stop_worker) {
+      return;
+    }
+    state_.handled_frame = std::move(state_.queued_frame);
+    const Frame& frame = *state_.handled_frame;
+    // The buffer can't go away while it's the handled frame's
+    if (frame.buffer != nullptr || frame.recompose) {
+      lock.unlock();
+      HandleFrame(frame);
+      lock.lock();
+    }
+    state_.done_frames.push_back(std::move(state_.handled_frame));
+    frame_done_cv_.notify_all();
+    eventfd_write(frames_done_fd_, 1);
+  }
+}
 
-    const int32_t buffer_w = wl_shm_buffer_get_width(shm_buffer);
-    CHECK(buffer_w == state_.region.w);
-    const int32_t buffer_h = wl_shm_buffer_get_height(shm_buffer);
-    CHECK(buffer_h == state_.region.h);
-    const int32_t buffer_stride_bytes = wl_shm_buffer_get_stride(shm_buffer);
+void Surface::ReleaseFrame(Frame& frame) {
+  if (frame.shm_pool != nullptr) {
+    wl_shm_pool_unref(frame.shm_pool);
+    frame.shm_pool = nullptr;
+  }
+  if (frame.buffer != nullptr) {
+    wl_list_remove(&frame.buffer_destroy_listener.listener.link);
+    wl_buffer_send_release(frame.buffer);
+    frame.buffer = nullptr;
+  }
+}
 
-    uint8_t* buffer_pixels =
-        reinterpret_cast<uint8_t*>(wl_shm_buffer_get_data(shm_buffer));
+int Surface::OnFramesDone(int fd, uint32_t /*mask*/, void* data) {
+  Surface* surface = static_cast<Surface*>(data);
+  eventfd_t count;
+  eventfd_read(fd, &count);
+  std::unique_lock<std::mutex> lock(surface->state_mutex_);
+  struct wl_client* client = nullptr;
+  for (auto& frame : surface->state_.done_frames) {
+    if (frame->buffer != nullptr) {
+      client = wl_resource_get_client(frame->buffer);
+    }
+    surface->ReleaseFrame(*frame);
+  }
+  surface->state_.done_frames.clear();
+  if (client == nullptr && !surface->state_.frame_callbacks.empty()) {
+    client = wl_resource_get_client(surface->state_.frame_callbacks.front());
+  }
+  surface->ScheduleFrameCallbacks();
+  if (client != nullptr) {
+    wl_client_flush(client);
+  }
+  return 0;
+}
 
-    surfaces_.HandleSurfaceFrame(display_number, buffer_w, buffer_h,
-                                 buffer_stride_bytes, buffer_pixels);
+void Surface::OnBufferDestroyed(struct wl_listener* listener, void* /*data*/) {
+  BufferDestroyListener* destroy_listener =
+      wl_container_of(listener, destroy_listener, listener);
+  Frame* frame = destroy_listener->frame;
+  Surface* surface = frame->surface;
+  std::unique_lock<std::mutex> lock(surface->state_mutex_);
+  // Clients don't usually destroy buffers they haven't got back, but if they
+  // do the worker must be done reading it first.
+  surface->frame_done_cv_.wait(lock, [surface, frame]() {
+    return surface->state_.handled_frame.get() != frame;
+  });
+  wl_list_remove(&listener->link);
+  wl_list_init(&listener->link);
+  frame->buffer = nullptr;
+}
 
+void Surface::ScheduleFrameCallbacks() {
+  if (state_.frame_callbacks.empty()) {
+    return;
+  }
+  std::chrono::microseconds interval{0};
+  if (state_.virtio_gpu_metadata_.scanout_id) {
+    interval =
+        surfaces_.GetFrameInterval(*state_.virtio_gpu_metadata_.scanout_id);
+  }
+  const auto now = std::chrono::steady_clock::now();
+  const auto due = state_.last_frame_callbacks_time + interval;
+  if (now >= due) {
+    SendFrameCallbacks();
+    return;
+  }
+  if (state_.frame_timer == nullptr) {
+    struct wl_display* display = wl_client_get_display(
+        wl_resource_get_client(state_.frame_callbacks.front()));
+    state_.frame_timer = wl_event_loop_add_timer(
+        wl_display_get_event_loop(display), OnFrameTimer, this);
+  }
+  // Rounded up, firing early would only arm the timer again.
+  const auto delay_ms =
+      std::chrono::ceil<std::chrono::milliseconds>(due - now).count();
+  wl_event_source_timer_update(state_.frame_timer, static_cast<int>(delay_ms));
+}
+
+void Surface::SendFrameCallbacks() {
+  const auto now = std::chrono::steady_clock::now();
+  state_.last_frame_callbacks_time = now;
+  const uint32_t now_ms = static_cast<uint32_t>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          now.time_since_epoch())
+          .count());
+  for (auto* callback : state_.frame_callbacks) {
+    wl_callback_send_done(callback, now_ms);
+    wl_resource_set_user_data(callback, nullptr);
+    wl_resource_destroy(callback);
+  }
+  state_.frame_callbacks.clear();
+}
+
+int Surface::OnFrameTimer(void* data) {
+  Surface* surface = static_cast<Surface*>(data);
+  std::unique_lock<std::mutex> lock(surface->state_mutex_);
+  if (!surface->state_.frame_callbacks.empty()) {
+    auto* client =
+        wl_resource_get_client(surface->state_.frame_callbacks.front());
+    surface->SendFrameCallbacks();
+    wl_client_flush(client);
+  }
+  return 0;
+}
+
+void Surface::HandleFrame(const Frame& frame) {
+  if (frame.recompose) {
+    Region damage;
+    {
+      std::lock_guard<std::mutex> lock(surfaces_.composition_mutex_);
+      if (!base_valid_) {
+        return;  // Subsurfaces are shown from the next frame on
+      }
+      auto output_damage = Intersect(
+          *frame.damage, Region{.x = 0, .y = 0, .w = base_w_, .h = base_h_});
+      if (!output_damage) {
+        return;
+      }
+      damage = *output_damage;
+      ComposeLocked(damage);
+    }
+    surfaces_.HandleSurfaceFrame(frame.display_number, base_w_, base_h_,
+                                 base_w_ * kBytesPerPixel,
+                                 composed_pixels_.data(), damage);
+    return;
+  }
+  if (frame.shm_buffer != nullptr) {
+    wl_shm_buffer_begin_access(frame.shm_buffer);
+    HandleFramePixels(
+        frame, wl_shm_buffer_get_width(frame.shm_buffer),
+        wl_shm_buffer_get_height(frame.shm_buffer),
+        wl_shm_buffer_get_stride(frame.shm_buffer),
+        reinterpret_cast<uint8_t*>(wl_shm_buffer_get_data(frame.shm_buffer)));
+    wl_shm_buffer_end_access(frame.shm_buffer);
+  } else if (frame.dmabuf != nullptr) {
+    // GPU rendered frames are read straight out of the dmabuf, with the
+    // same byte order as the shared memory buffers.
+    if (const uint8_t* pixels = frame.dmabuf->BeginAccess();
+        pixels != nullptr) {
+      HandleFramePixels(frame, frame.dmabuf->width(), frame.dmabuf->height(),
+                        frame.dmabuf->stride(), const_cast<uint8_t*>(pixels));
+    }
+    frame.dmabuf->EndAccess();
+  }
+}
+
+void Surface::HandleFramePixels(const Frame& frame, int32_t buffer_w,
+                                int32_t buffer_h, int32_t buffer_stride_bytes,
+                                uint8_t* buffer_pixels) {
+  CHECK(buffer_w == frame.region.w);
+  CHECK(buffer_h == frame.region.h);
+
+  Region frame_damage = ClampToBuffer(frame.damage, buffer_w, buffer_h);
+  {
+    std::lock_guard<std::mutex> lock(surfaces_.composition_mutex_);
+    if (stack_.size() > 1) {
+      const size_t size = static_cast<size_t>(buffer_w) * buffer_h *
+                          kBytesPerPixel;
+      if (!base_valid_ || base_w_ != buffer_w || base_h_ != buffer_h) {
+        base_pixels_.resize(size);
+        composed_pixels_.resize(size);
+        base_w_ = buffer_w;
+        base_h_ = buffer_h;
+        base_valid_ = true;
+        frame_damage = Region{.x = 0, .y = 0, .w = buffer_w, .h = buffer_h};
+      }
+      libyuv::ARGBCopy(
+          buffer_pixels + frame_damage.y * buffer_stride_bytes +
+              frame_damage.x * kBytesPerPixel,
+          buffer_stride_bytes,
+          base_pixels_.data() +
+              (frame_damage.y * buffer_w + frame_damage.x) * kBytesPerPixel,
+          buffer_w * kBytesPerPixel, frame_damage.w, frame_damage.h);
+      ComposeLocked(frame_damage);
+      buffer_pixels = composed_pixels_.data();
+      buffer_stride_bytes = buffer_w * kBytesPerPixel;
+    } else if (base_valid_) {
+      // Buffers are handed through again, the copies would only go stale
+      base_valid_ = false;
+      std::vector<uint8_t>().swap(base_pixels_);
+      std::vector<uint8_t>().swap(composed_pixels_);
+    }
+  }
+
+  surfaces_.HandleSurfaceFrame(frame.display_number, buffer_w, buffer_h,
+                               buffer_stride_bytes, buffer_pixels,
+                               frame_damage);
+}
+
+void Surface::QueueComposition(const Region& damage) {
+  std::unique_lock<std::mutex> lock(state_mutex_);
+  // Without a worker no frame was shown yet, there's nothing to compose
+  if (!worker_.joinable() || !state_.virtio_gpu_metadata_.scanout_id) {
+    return;
+  }
+  if (state_.queued_frame) {
+    if (state_.queued_frame->damage) {
+      state_.queued_frame->damage =
+          Union(*state_.queued_frame->damage, damage);
+    }
+    return;
+  }
+  auto frame = std::make_unique<Frame>();
+  frame->surface = this;
+  frame->display_number = *state_.virtio_gpu_metadata_.scanout_id;
+  frame->region = state_.region;
+  frame->damage = damage;
+  frame->recompose = true;
+  state_.queued_frame = std::move(frame);
+  frame_queued_cv_.notify_one();
+}
+
+void Surface::UpdateSubsurfaceContent(struct wl_resource* buffer,
+                                      const std::optional<Region>& damage) {
+  {
+    std::lock_guard<std::mutex> lock(surfaces_.composition_mutex_);
+    if (parent_ == nullptr) {
+      return;
+    }
+  }
+  const uint8_t* pixels = nullptr;
+  int32_t buffer_w = 0;
+  int32_t buffer_h = 0;
+  int32_t buffer_stride_bytes = 0;
+  bool opaque = false;
+  struct wl_shm_buffer* shm_buffer = wl_shm_buffer_get(buffer);
+  DmabufBuffer* dmabuf = nullptr;
+  if (shm_buffer != nullptr) {
+    wl_shm_buffer_begin_access(shm_buffer);
+    pixels = static_cast<const uint8_t*>(wl_shm_buffer_get_data(shm_buffer));
+    buffer_w = wl_shm_buffer_get_width(shm_buffer);
+    buffer_h = wl_shm_buffer_get_height(shm_buffer);
+    buffer_stride_bytes = wl_shm_buffer_get_stride(shm_buffer);
+    const uint32_t format = wl_shm_buffer_get_format(shm_buffer);
+    opaque = format == WL_SHM_FORMAT_XRGB8888 ||
+             format == WL_SHM_FORMAT_XBGR8888;
+  } else if (dmabuf = DmabufBuffer::FromResource(buffer); dmabuf != nullptr) {
+    pixels = dmabuf->BeginAccess();
+    buffer_w = dmabuf->width();
+    buffer_h = dmabuf->height();
+    buffer_stride_bytes = dmabuf->stride();
+    opaque = dmabuf->opaque();
+  }
+
+  Surface* root = nullptr;
+  std::optional<Region> changed;
+  if (pixels != nullptr) {
+    std::lock_guard<std::mutex> lock(surfaces_.composition_mutex_);
+    if (parent_ != nullptr) {
+      root = RootLocked();
+      Region to_copy = ClampToBuffer(damage, buffer_w, buffer_h);
+      if (content_w_ != buffer_w || content_h_ != buffer_h) {
+        Accumulate(changed, RectInRootLocked(false));
+        content_.resize(static_cast<size_t>(buffer_w) * buffer_h *
+                        kBytesPerPixel);
+        content_w_ = buffer_w;
+        content_h_ = buffer_h;
+        to_copy = Region{.x = 0, .y = 0, .w = buffer_w, .h = buffer_h};
+      }
+      content_opaque_ = opaque;
+      libyuv::ARGBCopy(
+          pixels + to_copy.y * buffer_stride_bytes + to_copy.x * kBytesPerPixel,
+          buffer_stride_bytes,
+          content_.data() + (to_copy.y * buffer_w + to_copy.x) * kBytesPerPixel,
+          buffer_w * kBytesPerPixel, to_copy.w, to_copy.h);
+      if (auto rect = RectInRootLocked(false); rect && to_copy.w > 0) {
+        to_copy.x += rect->x;
+        to_copy.y += rect->y;
+        Accumulate(changed, to_copy);
+      }
+    }
+  }
+  if (shm_buffer != nullptr) {
     wl_shm_buffer_end_access(shm_buffer);
+  } else if (dmabuf != nullptr) {
+    dmabuf->EndAccess();
   }
+  if (changed) {
+    root->QueueComposition(*changed);
+  }
+}
 
-  wl_buffer_send_release(state_.current_buffer);
-  wl_client_flush(wl_resource_get_client(state_.current_buffer));
+void Surface::ApplySubsurfacePositions() {
+  Surface* root = nullptr;
+  std::optional<Region> changed;
+  {
+    std::lock_guard<std::mutex> lock(surfaces_.composition_mutex_);
+    for (Surface* subsurface : stack_) {
+      if (subsurface == this || !subsurface->pending_position_) {
+        continue;
+      }
+      Accumulate(changed, subsurface->RectInRootLocked(true));
+      std::tie(subsurface->x_, subsurface->y_) = *subsurface->pending_position_;
+      subsurface->pending_position_.reset();
+      Accumulate(changed, subsurface->RectInRootLocked(true));
+    }
+    root = RootLocked();
+  }
+  if (changed) {
+    root->QueueComposition(*changed);
+  }
+}
 
-  state_.current_buffer = nullptr;
-  state_.current_frame_number++;
+void Surface::SetParent(Surface* parent,
+                        struct wl_resource* subsurface_resource) {
+  Surface* root = nullptr;
+  std::optional<Region> uncovered;
+  {
+    std::lock_guard<std::mutex> lock(surfaces_.composition_mutex_);
+    for (Surface* ancestor = parent; ancestor != nullptr;
+         ancestor = ancestor->parent_) {
+      if (ancestor == this) {
+        LOG(ERROR) << "A surface can't be a subsurface of itself";
+        return;
+      }
+    }
+    if (parent_ != nullptr) {
+      root = RootLocked();
+      uncovered = UnlinkLocked();
+    }
+    subsurface_resource_ = subsurface_resource;
+    if (parent != nullptr) {
+      parent_ = parent;
+      parent->stack_.push_back(this);
+    }
+  }
+  if (uncovered) {
+    root->QueueComposition(*uncovered);
+  }
+}
+
+void Surface::SetPosition(int32_t x, int32_t y) {
+  std::lock_guard<std::mutex> lock(surfaces_.composition_mutex_);
+  pending_position_.emplace(x, y);
+}
+
+void Surface::PlaceAbove(Surface* sibling) { Restack(sibling, true); }
+
+void Surface::PlaceBelow(Surface* sibling) { Restack(sibling, false); }
+
+void Surface::Restack(Surface* sibling, bool above) {
+  Surface* root = nullptr;
+  std::optional<Region> changed;
+  {
+    std::lock_guard<std::mutex> lock(surfaces_.composition_mutex_);
+    if (parent_ == nullptr) {
+      return;
+    }
+    auto& stack = parent_->stack_;
+    if (sibling == this ||
+        std::find(stack.begin(), stack.end(), sibling) == stack.end()) {
+      LOG(ERROR) << "Subsurfaces can only be placed next to their siblings "
+                 << "or parent";
+      return;
+    }
+    stack.erase(std::find(stack.begin(), stack.end(), this));
+    auto it = std::find(stack.begin(), stack.end(), sibling);
+    stack.insert(above ? it + 1 : it, this);
+    root = RootLocked();
+    changed = RectInRootLocked(true);
+  }
+  if (changed) {
+    root->QueueComposition(*changed);
+  }
+}
+
+Surface* Surface::RootLocked() {
+  Surface* root = this;
+  while (root->parent_ != nullptr) {
+    root = root->parent_;
+  }
+  return root;
+}
+
+std::optional<Surface::Region> Surface::RectInRootLocked(bool subtree) {
+  std::optional<Region> rect;
+  if (!content_.empty()) {
+    int32_t x = 0;
+    int32_t y = 0;
+    for (Surface* s = this; s->parent_ != nullptr; s = s->parent_) {
+      x += s->x_;
+      y += s->y_;
+    }
+    rect = Region{.x = x, .y = y, .w = content_w_, .h = content_h_};
+  }
+  if (subtree) {
+    for (Surface* subsurface : stack_) {
+      if (subsurface != this) {
+        Accumulate(rect, subsurface->RectInRootLocked(true));
+      }
+    }
+  }
+  return rect;
+}
+
+std::optional<Surface::Region> Surface::UnlinkLocked() {
+  auto covered = RectInRootLocked(true);
+  auto& stack = parent_->stack_;
+  stack.erase(std::remove(stack.begin(), stack.end(), this), stack.end());
+  parent_ = nullptr;
+  x_ = 0;
+  y_ = 0;
+  pending_position_.reset();
+  std::vector<uint8_t>().swap(content_);
+  content_w_ = 0;
+  content_h_ = 0;
+  return covered;
+}
+
+void Surface::ComposeLocked(const Region& damage) {
+  const bool root_opaque = stack_.front() == this;
+  if (!root_opaque) {
+    // Subsurfaces below this one show through, they are all blended over
+    // transparent black.
+    for (int32_t row = damage.y; row < damage.y + damage.h; row++) {
+      std::memset(composed_pixels_.data() +
+                      (row * base_w_ + damage.x) * kBytesPerPixel,
+                  0, damage.w * kBytesPerPixel);
+    }
+  }
+  DrawStackLocked(this, 0, 0, damage, root_opaque);
+}
+
+void Surface::DrawStackLocked(Surface* surface, int32_t x, int32_t y,
+                              const Region& damage, bool root_opaque) {
+  for (Surface* member : surface->stack_) {
+    if (member != surface) {
+      DrawStackLocked(member, x + member->x_, y + member->y_, damage,
+                      root_opaque);
+    } else if (surface == this) {
+      DrawPixelsLocked(base_pixels_.data(), base_w_, base_h_, x, y,
+                       root_opaque, damage);
+    } else if (!surface->content_.empty()) {
+      DrawPixelsLocked(surface->content_.data(), surface->content_w_,
+                       surface->content_h_, x, y, surface->content_opaque_,
+                       damage);
+    }
+  }
+}
+
+void Surface::DrawPixelsLocked(const uint8_t* pixels, int32_t w, int32_t h,
+                               int32_t x, int32_t y, bool opaque,
+                               const Region& damage) {
+  auto area = Intersect(Region{.x = x, .y = y, .w = w, .h = h}, damage);
+  if (!area) {
+    return;
+  }
+  const uint8_t* src =
+      pixels + ((area->y - y) * w + (area->x - x)) * kBytesPerPixel;
+  uint8_t* dst =
+      composed_pixels_.data() + (area->y * base_w_ + area->x) * kBytesPerPixel;
+  const int src_stride = w * kBytesPerPixel;
+  const int dst_stride = base_w_ * kBytesPerPixel;
+  if (opaque) {
+    libyuv::ARGBCopy(src, src_stride, dst, dst_stride, area->w, area->h);
+  } else {
+    // Wayland's pixels have their alpha premultiplied, as libyuv expects.
+    // It picks a SIMD implementation for the CPU at runtime.
+    libyuv::ARGBBlend(src, src_stride, dst, dst_stride, dst, dst_stride,
+                      area->w, area->h);
+  }
 }
 
 void Surface::SetVirtioGpuScanoutId(uint32_t scanout_id) {
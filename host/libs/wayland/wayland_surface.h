@@ -18,20 +18,37 @@
 #pragma once
 
 #include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include <wayland-server-core.h>
 
 namespace wayland {
 
+class DmabufBuffer;
 class Surfaces;
 
 // Tracks the buffer associated with a Wayland surface.
+//
+// Committed frames are handed to the surfaces' frame callback by a worker
+// thread of the surface, so the server thread goes on answering the client
+// while the frame is processed. The buffer goes back to the client when the
+// worker is done with it.
+//
+// Subsurfaces keep a copy of their latest pixels, which the worker of the
+// surface shown on the display blends over its own frames. Only the damaged
+// part of the output is composed again, and surfaces without subsurfaces
+// hand their buffers through untouched.
 class Surface {
  public:
   Surface(Surfaces& surfaces);
-  virtual ~Surface() = default;
+  virtual ~Surface();
 
   Surface(const Surface& rhs) = delete;
   Surface& operator=(const Surface& rhs) = delete;
@@ -48,15 +65,115 @@ class Surface {
 
   void SetRegion(const Region& region);
 
+  // Marks part of the pending frame as changed. Both wl_surface.damage and
+  // wl_surface.damage_buffer end up here as buffer scale and transform are
+  // not supported, making surface and buffer coordinates the same.
+  void AddDamage(const Region& damage);
+
   // Sets the buffer of the pending frame.
   void Attach(struct wl_resource* buffer);
 
+  // Requests a wl_surface.frame notification for the pending frame. It's
+  // sent once the frame has been handled by the worker, but no sooner than
+  // the display's frame interval after the previous one, so the client
+  // doesn't render faster than the display is refreshed.
+  void AddFrameCallback(struct wl_resource* callback);
+
   // Commits the pending frame state.
   void Commit();
 
   void SetVirtioGpuScanoutId(uint32_t scanout);
 
+  // Makes this surface a subsurface of parent, on top of its siblings, or a
+  // standalone surface again when parent is null.
+  void SetParent(Surface* parent, struct wl_resource* subsurface_resource);
+
+  // Position of the subsurface relative to its parent, applied on the
+  // parent's next commit.
+  void SetPosition(int32_t x, int32_t y);
+
+  // Restacks the subsurface right above or below a sibling or its parent.
+  void PlaceAbove(Surface* sibling);
+  void PlaceBelow(Surface* sibling);
+
  private:
+  struct Frame;
+  struct BufferDestroyListener {
+    struct wl_listener listener;
+    Frame* frame;
+  };
+
+  // A committed buffer on its way to the frame callback.
+  struct Frame {
+    Surface* surface = nullptr;
+    // Null once the client destroyed it
+    struct wl_resource* buffer = nullptr;
+    // One of these backs the buffer
+    struct wl_shm_buffer* shm_buffer = nullptr;
+    DmabufBuffer* dmabuf = nullptr;
+    // Keeps the shm pool mapped, and not resized, while the worker reads it
+    struct wl_shm_pool* shm_pool = nullptr;
+    uint32_t display_number = 0;
+    Region region;
+    std::optional<Region> damage;
+    // Composes the last frame again, with updated subsurfaces, instead of
+    // reading a buffer.
+    bool recompose = false;
+    BufferDestroyListener buffer_destroy_listener;
+  };
+
+  // Runs on the worker thread.
+  void FrameWorkerLoop();
+  // Hands the pixels of the frame's buffer to the surfaces' frame callback.
+  void HandleFrame(const Frame& frame);
+  void HandleFramePixels(const Frame& frame, int32_t buffer_w,
+                         int32_t buffer_h, int32_t buffer_stride_bytes,
+                         uint8_t* buffer_pixels);
+
+  // Starts the worker and the event source telling the server thread about
+  // the frames it's done with. Must be called with state_mutex_ held.
+  void StartFrameWorker(struct wl_display* display);
+  // Gives the buffer back to the client. Must be called with state_mutex_
+  // held.
+  void ReleaseFrame(Frame& frame);
+  static int OnFramesDone(int fd, uint32_t mask, void* data);
+  static void OnBufferDestroyed(struct wl_listener* listener, void* data);
+
+  // Queues a composition of the given part of the last frame, unless a frame
+  // is queued already, which then gets the damage.
+  void QueueComposition(const Region& damage);
+  // Copies the pixels committed to a subsurface and composes the root again
+  // where they changed.
+  void UpdateSubsurfaceContent(struct wl_resource* buffer,
+                               const std::optional<Region>& damage);
+  // Applies the positions of the subsurfaces set since the last commit.
+  void ApplySubsurfacePositions();
+  void Restack(Surface* sibling, bool above);
+
+  // These must be called with the composition mutex held.
+  Surface* RootLocked();
+  // Where this subsurface's pixels, and with subtree those of its own
+  // subsurfaces too, are shown in the root's coordinates.
+  std::optional<Region> RectInRootLocked(bool subtree);
+  // Takes this subsurface out of its parent's stack, returning the part of
+  // the root it covered.
+  std::optional<Region> UnlinkLocked();
+  // Composes the damaged part of the output from the last frame of this
+  // surface and its subsurfaces.
+  void ComposeLocked(const Region& damage);
+  void DrawStackLocked(Surface* surface, int32_t x, int32_t y,
+                       const Region& damage, bool root_opaque);
+  void DrawPixelsLocked(const uint8_t* pixels, int32_t w, int32_t h,
+                        int32_t x, int32_t y, bool opaque,
+                        const Region& damage);
+
+  // Sends the committed frame callbacks now, or arms a timer to do it when
+  // the frame interval elapses. Must be called with state_mutex_ held.
+  void ScheduleFrameCallbacks();
+  void SendFrameCallbacks();
+  static int OnFrameTimer(void* data);
+  static void OnFrameCallbackDestroyed(struct wl_resource* callback);
+
   Surfaces& surfaces_;
 
   struct VirtioGpuMetadata {
@@ -75,11 +192,65 @@ class Surface {
     // The buffers expected dimensions.
     Region region;
 
+    // The bounding box of the damage accumulated for the next frame.
+    std::optional<Region> pending_damage;
+
     VirtioGpuMetadata virtio_gpu_metadata_;
+
+    // wl_surface.frame callbacks requested for the next frame.
+    std::vector<struct wl_resource*> pending_frame_callbacks;
+
+    // Callbacks of committed frames waiting for the frame interval.
+    std::vector<struct wl_resource*> frame_callbacks;
+
+    std::chrono::steady_clock::time_point last_frame_callbacks_time;
+
+    struct wl_event_source* frame_timer = nullptr;
+
+    // The latest committed frame the worker didn't take yet. A newer commit
+    // releases it right away, its damage carries over to the newer frame.
+    std::unique_ptr<Frame> queued_frame;
+
+    // The frame the worker is handling, its buffer is in use until then.
+    std::unique_ptr<Frame> handled_frame;
+
+    // Frames the worker is done with, to be released by the server thread.
+    std::vector<std::unique_ptr<Frame>> done_frames;
+
+    bool stop_worker = false;
   };
 
   std::mutex state_mutex_;
+  // Signaled when a frame is queued or the worker must stop
+  std::condition_variable frame_queued_cv_;
+  // Signaled when the worker is done with a frame
+  std::condition_variable frame_done_cv_;
   State state_;
+
+  std::thread worker_;
+  int frames_done_fd_ = -1;
+  struct wl_event_source* frames_done_source_ = nullptr;
+
+  // The subsurface tree, guarded by the surfaces' composition mutex.
+  Surface* parent_ = nullptr;
+  struct wl_resource* subsurface_resource_ = nullptr;
+  // This surface and its subsurfaces, bottom to top.
+  std::vector<Surface*> stack_;
+  int32_t x_ = 0;
+  int32_t y_ = 0;
+  std::optional<std::pair<int32_t, int32_t>> pending_position_;
+  // The pixels last committed to this subsurface, tightly packed.
+  std::vector<uint8_t> content_;
+  int32_t content_w_ = 0;
+  int32_t content_h_ = 0;
+  bool content_opaque_ = false;
+  // The last frame of this surface and the output composed over it, only
+  // kept while it has subsurfaces.
+  std::vector<uint8_t> base_pixels_;
+  std::vector<uint8_t> composed_pixels_;
+  int32_t base_w_ = 0;
+  int32_t base_h_ = 0;
+  bool base_valid_ = false;
 };
 
 }  // namespace wayland
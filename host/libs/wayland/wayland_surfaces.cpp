@@ -24,19 +24,39 @@
 namespace wayland {
 
 void Surfaces::SetFrameCallback(FrameCallback callback) {
-  std::unique_lock<std::mutex> lock(callback_mutex_);
+  std::unique_lock<std::shared_mutex> lock(callback_mutex_);
   callback_.emplace(std::move(callback));
 }
 
+void Surfaces::SetDisplayRefreshRate(std::uint32_t display_number,
+                                     std::uint32_t refresh_rate_hz) {
+  std::unique_lock<std::mutex> lock(frame_intervals_mutex_);
+  if (refresh_rate_hz == 0) {
+    frame_intervals_.erase(display_number);
+    return;
+  }
+  frame_intervals_[display_number] =
+      std::chrono::microseconds(1000000 / refresh_rate_hz);
+}
+
+std::chrono::microseconds Surfaces::GetFrameInterval(
+    std::uint32_t display_number) {
+  std::unique_lock<std::mutex> lock(frame_intervals_mutex_);
+  auto it = frame_intervals_.find(display_number);
+  return it == frame_intervals_.end() ? std::chrono::microseconds::zero()
+                                      : it->second;
+}
+
 void Surfaces::HandleSurfaceFrame(std::uint32_t display_number,
                                   std::uint32_t frame_width,
                                   std::uint32_t frame_height,
                                   std::uint32_t frame_stride_bytes,
-                                  std::uint8_t* frame_bytes) {
-  std::unique_lock<std::mutex> lock(callback_mutex_);
+                                  std::uint8_t* frame_bytes,
+                                  const Surface::Region& frame_damage) {
+  std::shared_lock<std::shared_mutex> lock(callback_mutex_);
   if (callback_) {
     (callback_.value())(display_number, frame_width, frame_height,
-                        frame_stride_bytes, frame_bytes);
+                        frame_stride_bytes, frame_bytes, frame_damage);
   }
 }
 
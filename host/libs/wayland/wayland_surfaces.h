@@ -17,16 +17,18 @@
 #pragma once
 
 #include <stdint.h>
+#include <chrono>
 #include <future>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <shared_mutex>
 #include <thread>
 #include <unordered_map>
 
-namespace wayland {
+#include "host/libs/wayland/wayland_surface.h"
 
-class Surface;
+namespace wayland {
 
 class Surfaces {
  public:
@@ -44,19 +46,36 @@ class Surfaces {
                          std::uint32_t /*frame_width*/,         //
                          std::uint32_t /*frame_height*/,        //
                          std::uint32_t /*frame_stride_bytes*/,  //
-                         std::uint8_t* /*frame_bytes*/)>;
+                         std::uint8_t* /*frame_bytes*/,         //
+                         const Surface::Region& /*frame_damage*/)>;
 
   void SetFrameCallback(FrameCallback callback);
 
+  // Paces the frame callbacks of the surfaces shown on the display. Displays
+  // without a refresh rate are not paced.
+  void SetDisplayRefreshRate(std::uint32_t display_number,
+                             std::uint32_t refresh_rate_hz);
+
  private:
   friend class Surface;
   void HandleSurfaceFrame(std::uint32_t display_number,      //
                           std::uint32_t frame_width,         //
                           std::uint32_t frame_height,        //
                           std::uint32_t frame_stride_bytes,  //
-                          std::uint8_t* frame_bytes);
+                          std::uint8_t* frame_bytes,         //
+                          const Surface::Region& frame_damage);
+
+  std::chrono::microseconds GetFrameInterval(std::uint32_t display_number);
+
+  std::mutex frame_intervals_mutex_;
+  std::unordered_map<std::uint32_t, std::chrono::microseconds>
+      frame_intervals_;
+
+  // Guards the subsurface trees and the pixels composed from them
+  std::mutex composition_mutex_;
 
-  std::mutex callback_mutex_;
+  // Shared by the workers of the surfaces calling back at the same time
+  std::shared_mutex callback_mutex_;
   std::optional<FrameCallback> callback_;
 };
 
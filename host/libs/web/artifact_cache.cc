@@ -0,0 +1,217 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/libs/web/artifact_cache.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <tuple>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+#include <android-base/unique_fd.h>
+
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+const std::string kLockSuffix = ".lock";
+// Left behind by interrupted downloads, resumed by the next fetcher.
+const std::vector<std::string> kDownloadSuffixes = {".partial.chunks",
+                                                     ".partial"};
+
+android::base::unique_fd LockFile(const std::string& path, int operation) {
+  android::base::unique_fd fd(
+      open(path.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0644));
+  if (fd < 0) {
+    PLOG(ERROR) << "Could not open \"" << path << "\"";
+    return {};
+  }
+  if (TEMP_FAILURE_RETRY(flock(fd.get(), operation)) != 0) {
+    if (errno != EWOULDBLOCK) {
+      PLOG(ERROR) << "Could not lock \"" << path << "\"";
+    }
+    return {};
+  }
+  return fd;
+}
+
+// A reflink gives the target its own copy on write blocks. Otherwise the
+// target is a hard link to the read-only entry, or a copy across filesystems.
+bool PlaceEntry(const std::string& entry, const std::string& path) {
+  unlink(path.c_str());
+  android::base::unique_fd in(open(entry.c_str(), O_RDONLY | O_CLOEXEC));
+  if (in < 0) {
+    PLOG(ERROR) << "Could not open \"" << entry << "\"";
+    return false;
+  }
+  {
+    android::base::unique_fd out(
+        open(path.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0644));
+    if (out >= 0 && ioctl(out.get(), FICLONE, in.get()) == 0) {
+      return true;
+    }
+  }
+  unlink(path.c_str());
+  if (link(entry.c_str(), path.c_str()) == 0) {
+    return true;
+  }
+  android::base::unique_fd out(
+      open(path.c_str(), O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0644));
+  if (out < 0) {
+    PLOG(ERROR) << "Could not open \"" << path << "\"";
+    return false;
+  }
+  std::vector<char> buffer(1 << 20);
+  ssize_t read;
+  while ((read = TEMP_FAILURE_RETRY(
+              ::read(in.get(), buffer.data(), buffer.size()))) > 0) {
+    if (!android::base::WriteFully(out.get(), buffer.data(), read)) {
+      PLOG(ERROR) << "Could not write \"" << path << "\"";
+      return false;
+    }
+  }
+  if (read < 0) {
+    PLOG(ERROR) << "Could not read \"" << entry << "\"";
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+ArtifactCache::ArtifactCache(std::string directory, std::uint64_t max_size)
+    : directory_(std::move(directory)), max_size_(max_size) {}
+
+bool ArtifactCache::Fetch(
+    const std::string& key, const std::string& path,
+    const std::function<bool(const std::string& entry)>& download) {
+  auto ensure_dir = EnsureDirectoryExists(directory_);
+  if (!ensure_dir.ok()) {
+    LOG(ERROR) << "Could not create \"" << directory_
+               << "\": " << ensure_dir.error();
+    return false;
+  }
+  auto entry = directory_ + "/" + key;
+  {
+    // Eviction takes the cache lock exclusively, so entries in use stay.
+    auto cache_lock = LockFile(directory_ + "/" + kLockSuffix, LOCK_SH);
+    auto entry_lock = LockFile(entry + kLockSuffix, LOCK_EX);
+    if (cache_lock < 0 || entry_lock < 0) {
+      return false;
+    }
+    if (FileExists(entry)) {
+      LOG(INFO) << "Using cached \"" << entry << "\"";
+      // Eviction goes by modification time
+      if (utimensat(AT_FDCWD, entry.c_str(), nullptr, 0) != 0) {
+        PLOG(WARNING) << "Could not touch \"" << entry << "\"";
+      }
+    } else {
+      if (!download(entry)) {
+        unlink(entry.c_str());
+        return false;
+      }
+      if (chmod(entry.c_str(), 0444) != 0) {
+        PLOG(ERROR) << "Could not chmod \"" << entry << "\"";
+        unlink(entry.c_str());
+        return false;
+      }
+    }
+    if (!PlaceEntry(entry, path)) {
+      return false;
+    }
+  }
+  Evict();
+  return true;
+}
+
+void ArtifactCache::Evict() {
+  // Another fetcher using the cache will evict after it's done.
+  auto cache_lock =
+      LockFile(directory_ + "/" + kLockSuffix, LOCK_EX | LOCK_NB);
+  if (cache_lock < 0) {
+    return;
+  }
+  struct Entry {
+    std::uint64_t size = 0;
+    struct timespec mtime = {};
+    std::vector<std::string> files;
+  };
+  std::map<std::string, Entry> entries;
+  std::uint64_t total_size = 0;
+  for (const auto& name : DirectoryContents(directory_)) {
+    auto path = directory_ + "/" + name;
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+      continue;
+    }
+    std::string_view key = name;
+    if (android::base::ConsumeSuffix(&key, kLockSuffix)) {
+      if (!key.empty()) {
+        entries[std::string(key)].files.push_back(path);
+      }
+      continue;
+    }
+    for (const auto& suffix : kDownloadSuffixes) {
+      if (android::base::ConsumeSuffix(&key, suffix)) {
+        break;
+      }
+    }
+    auto& entry = entries[std::string(key)];
+    std::uint64_t size = st.st_blocks * 512;
+    entry.size += size;
+    total_size += size;
+    if (st.st_mtim.tv_sec > entry.mtime.tv_sec ||
+        (st.st_mtim.tv_sec == entry.mtime.tv_sec &&
+         st.st_mtim.tv_nsec > entry.mtime.tv_nsec)) {
+      entry.mtime = st.st_mtim;
+    }
+    entry.files.push_back(path);
+  }
+  if (total_size <= max_size_) {
+    return;
+  }
+  std::vector<Entry*> by_age;
+  for (auto& [key, entry] : entries) {
+    by_age.push_back(&entry);
+  }
+  std::sort(by_age.begin(), by_age.end(), [](Entry* a, Entry* b) {
+    return std::tie(a->mtime.tv_sec, a->mtime.tv_nsec) <
+           std::tie(b->mtime.tv_sec, b->mtime.tv_nsec);
+  });
+  for (auto entry : by_age) {
+    if (total_size <= max_size_) {
+      break;
+    }
+    for (const auto& file : entry->files) {
+      LOG(DEBUG) << "Evicting \"" << file << "\" from the artifact cache";
+      unlink(file.c_str());
+    }
+    total_size -= entry->size;
+  }
+}
+
+} // namespace cuttlefish
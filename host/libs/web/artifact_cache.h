@@ -0,0 +1,43 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace cuttlefish {
+
+// Host wide cache of downloaded artifacts, shared by concurrent fetchers.
+// Entries are read-only and evicted least recently used first once the cache
+// outgrows its size.
+class ArtifactCache {
+ public:
+  ArtifactCache(std::string directory, std::uint64_t max_size);
+
+  // Places the entry for `key` at `path`, calling `download` to write the
+  // entry first on a miss. Fetchers of the same key wait for each other.
+  bool Fetch(const std::string& key, const std::string& path,
+             const std::function<bool(const std::string& entry)>& download);
+
+ private:
+  void Evict();
+
+  std::string directory_;
+  std::uint64_t max_size_;
+};
+
+} // namespace cuttlefish
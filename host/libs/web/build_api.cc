@@ -16,16 +16,22 @@
 #include "build_api.h"
 
 #include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include <chrono>
 #include <set>
 #include <string>
 #include <thread>
+#include <vector>
 
+#include <android-base/stringprintf.h>
 #include <android-base/strings.h>
 #include <android-base/logging.h>
+#include <android-base/unique_fd.h>
+#include <openssl/md5.h>
 
+#include "common/libs/utils/base64.h"
 #include "common/libs/utils/environment.h"
 #include "common/libs/utils/files.h"
 
@@ -47,6 +53,33 @@ bool StatusIsTerminal(const std::string& status) {
   return terminal_statuses.count(status) > 0;
 }
 
+std::string FileMd5(const std::string& path) {
+  android::base::unique_fd fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd < 0) {
+    PLOG(ERROR) << "Could not open \"" << path << "\"";
+    return "";
+  }
+  MD5_CTX md5;
+  MD5_Init(&md5);
+  std::vector<char> buffer(1 << 20);
+  ssize_t read;
+  while ((read = TEMP_FAILURE_RETRY(
+              ::read(fd.get(), buffer.data(), buffer.size()))) > 0) {
+    MD5_Update(&md5, buffer.data(), read);
+  }
+  if (read < 0) {
+    PLOG(ERROR) << "Could not read \"" << path << "\"";
+    return "";
+  }
+  uint8_t digest[MD5_DIGEST_LENGTH];
+  MD5_Final(digest, &md5);
+  std::string hex;
+  for (auto byte : digest) {
+    hex += android::base::StringPrintf("%02x", byte);
+  }
+  return hex;
+}
+
 } // namespace
 
 Artifact::Artifact(const Json::Value& json_artifact) {
@@ -85,13 +118,19 @@ BuildApi::BuildApi(CurlWrapper& curl, CredentialSource* credential_source)
 
 BuildApi::BuildApi(CurlWrapper& curl, CredentialSource* credential_source,
                    std::string api_key)
+    : BuildApi(curl, credential_source, std::move(api_key), nullptr) {}
+
+BuildApi::BuildApi(CurlWrapper& curl, CredentialSource* credential_source,
+                   std::string api_key, ArtifactCache* artifact_cache)
     : curl(curl),
       credential_source(credential_source),
-      api_key_(std::move(api_key)) {}
+      api_key_(std::move(api_key)),
+      artifact_cache_(artifact_cache) {}
 
 std::vector<std::string> BuildApi::Headers() {
   std::vector<std::string> headers;
   if (credential_source) {
+    std::lock_guard<std::mutex> lock(credential_mutex_);
     headers.push_back("Authorization: Bearer " +
                       credential_source->Credential());
   }
@@ -224,9 +263,8 @@ std::vector<Artifact> BuildApi::Artifacts(const DirectoryBuild& build) {
   return artifacts;
 }
 
-bool BuildApi::ArtifactToCallback(const DeviceBuild& build,
-                                  const std::string& artifact,
-                                  CurlWrapper::DataCallback callback) {
+std::string BuildApi::ArtifactUrl(const DeviceBuild& build,
+                                  const std::string& artifact) {
   std::string download_url_endpoint =
       BUILD_API + "/builds/" + curl.UrlEscape(build.id) + "/" +
       curl.UrlEscape(build.target) + "/attempts/latest/artifacts/" +
@@ -240,24 +278,47 @@ bool BuildApi::ArtifactToCallback(const DeviceBuild& build,
     LOG(ERROR) << "Error fetching the url of \"" << artifact << "\" for \""
                << build << "\". The server response was \"" << json
                << "\", and code was " << curl_response.http_code;
-    return false;
+    return "";
   }
   if (json.isMember("error")) {
     LOG(ERROR) << "Response had \"error\" but had http success status. "
                << "Received \"" << json << "\"";
-    return false;
+    return "";
   }
   if (!json.isMember("signedUrl")) {
     LOG(ERROR) << "URL endpoint did not have json path: " << json;
+    return "";
+  }
+  return json["signedUrl"].asString();
+}
+
+bool BuildApi::ArtifactToCallback(const DeviceBuild& build,
+                                  const std::string& artifact,
+                                  CurlWrapper::DataCallback callback) {
+  std::string url = ArtifactUrl(build, artifact);
+  if (url.empty()) {
     return false;
   }
-  std::string url = json["signedUrl"].asString();
   return curl.DownloadToCallback(callback, url).HttpSuccess();
 }
 
 bool BuildApi::ArtifactToFile(const DeviceBuild& build,
                               const std::string& artifact,
                               const std::string& path) {
+  if (!artifact_cache_) {
+    return DownloadArtifact(build, artifact, path);
+  }
+  // Escaping never produces '+', so keys can't collide.
+  auto key = curl.UrlEscape(build.id) + "+" + curl.UrlEscape(build.target) +
+             "+" + curl.UrlEscape(artifact);
+  return artifact_cache_->Fetch(key, path, [&](const std::string& entry) {
+    return DownloadArtifact(build, artifact, entry);
+  });
+}
+
+bool BuildApi::DownloadArtifact(const DeviceBuild& build,
+                                const std::string& artifact,
+                                const std::string& path) {
   std::string download_url_endpoint =
       BUILD_API + "/builds/" + curl.UrlEscape(build.id) + "/" +
       curl.UrlEscape(build.target) + "/attempts/latest/artifacts/" +
@@ -282,7 +343,50 @@ bool BuildApi::ArtifactToFile(const DeviceBuild& build,
     return false;
   }
   std::string url = json["signedUrl"].asString();
-  return curl.DownloadToFile(url, path).HttpSuccess();
+  if (!curl.DownloadToFile(url, path).HttpSuccess()) {
+    return false;
+  }
+  if (!MatchesArtifactChecksum(build, artifact, path)) {
+    unlink(path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool BuildApi::MatchesArtifactChecksum(const DeviceBuild& build,
+                                       const std::string& artifact,
+                                       const std::string& path) {
+  std::string url = BUILD_API + "/builds/" + curl.UrlEscape(build.id) + "/" +
+                    curl.UrlEscape(build.target) +
+                    "/attempts/latest/artifacts/" + curl.UrlEscape(artifact);
+  if (!api_key_.empty()) {
+    url += "?key=" + curl.UrlEscape(api_key_);
+  }
+  auto curl_response = curl.DownloadToJson(url, Headers());
+  const auto& json = curl_response.data;
+  if (!curl_response.HttpSuccess() || json.isMember("error") ||
+      !json.isMember("md5") || json["md5"].asString().empty()) {
+    LOG(WARNING) << "No checksum for \"" << artifact << "\" of " << build
+                 << ", not verifying it";
+    return true;
+  }
+  auto expected = android::base::Trim(json["md5"].asString());
+  // Either hex or base64 encoded
+  std::vector<uint8_t> decoded;
+  if (expected.size() != 2 * MD5_DIGEST_LENGTH &&
+      DecodeBase64(expected, &decoded)) {
+    expected = "";
+    for (auto byte : decoded) {
+      expected += android::base::StringPrintf("%02x", byte);
+    }
+  }
+  auto actual = FileMd5(path);
+  if (!android::base::EqualsIgnoreCase(expected, actual)) {
+    LOG(ERROR) << "\"" << path << "\" has md5 " << actual << ", expected "
+               << expected;
+    return false;
+  }
+  return true;
 }
 
 bool BuildApi::ArtifactToFile(const DirectoryBuild& build,
@@ -18,10 +18,12 @@
 #include <chrono>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <string>
 #include <variant>
 
+#include "artifact_cache.h"
 #include "credential_source.h"
 #include "curl_wrapper.h"
 
@@ -84,6 +86,9 @@ class BuildApi {
  public:
   BuildApi(CurlWrapper&, CredentialSource*);
   BuildApi(CurlWrapper&, CredentialSource*, std::string api_key);
+  // Device build artifacts go through `artifact_cache` when it's not null.
+  BuildApi(CurlWrapper&, CredentialSource*, std::string api_key,
+           ArtifactCache* artifact_cache);
   ~BuildApi() = default;
 
   std::string LatestBuildId(const std::string& branch,
@@ -95,9 +100,19 @@ class BuildApi {
 
   std::vector<Artifact> Artifacts(const DeviceBuild&);
 
+  // Whether ArtifactToFile keeps copies of what it downloads
+  bool CachesArtifacts() const { return artifact_cache_ != nullptr; }
+
   bool ArtifactToCallback(const DeviceBuild& build, const std::string& artifact,
                           CurlWrapper::DataCallback callback);
 
+  // A signed url of the artifact, which can be fetched without credentials
+  // and in ranges for a while. Empty on failure.
+  std::string ArtifactUrl(const DeviceBuild& build,
+                          const std::string& artifact);
+  // For requests to the urls handed out, like ranges of an artifact
+  CurlWrapper& Curl() { return curl; }
+
   bool ArtifactToFile(const DeviceBuild& build, const std::string& artifact,
                       const std::string& path);
 
@@ -119,10 +134,19 @@ class BuildApi {
 
  private:
   std::vector<std::string> Headers();
+  bool DownloadArtifact(const DeviceBuild& build, const std::string& artifact,
+                        const std::string& path);
+  // Whether the file matches the md5 the API has for the artifact, if any.
+  bool MatchesArtifactChecksum(const DeviceBuild& build,
+                               const std::string& artifact,
+                               const std::string& path);
 
   CurlWrapper& curl;
   CredentialSource* credential_source;
+  // Credential sources refresh lazily and are shared by concurrent downloads.
+  std::mutex credential_mutex_;
   std::string api_key_;
+  ArtifactCache* artifact_cache_;
 };
 
 Build ArgumentToBuild(BuildApi* api, const std::string& arg,
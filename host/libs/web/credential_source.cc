@@ -15,14 +15,26 @@
 
 #include "credential_source.h"
 
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 #include <json/json.h>
 #include <openssl/bio.h>
 #include <openssl/evp.h>
 #include <openssl/pem.h>
+#include <openssl/sha.h>
 
 #include "common/libs/utils/base64.h"
+#include "common/libs/utils/files.h"
 
 namespace cuttlefish {
 namespace {
@@ -47,6 +59,11 @@ std::string GceMetadataCredentialSource::Credential() {
   return latest_credential;
 }
 
+std::chrono::steady_clock::time_point
+GceMetadataCredentialSource::Expiration() {
+  return expiration;
+}
+
 void GceMetadataCredentialSource::RefreshCredential() {
   auto curl_response =
       curl.DownloadToJson(REFRESH_URL, {"Metadata-Flavor: Google"});
@@ -146,6 +163,10 @@ std::string RefreshCredentialSource::Credential() {
   return latest_credential_;
 }
 
+std::chrono::steady_clock::time_point RefreshCredentialSource::Expiration() {
+  return expiration_;
+}
+
 void RefreshCredentialSource::UpdateLatestCredential() {
   std::vector<std::string> headers = {
       "Content-Type: application/x-www-form-urlencoded"};
@@ -310,4 +331,106 @@ std::string ServiceAccountOauthCredentialSource::Credential() {
   return latest_credential_;
 }
 
+std::chrono::steady_clock::time_point
+ServiceAccountOauthCredentialSource::Expiration() {
+  return expiration_;
+}
+
+std::unique_ptr<CredentialSource> CachedCredentialSource::make(
+    std::unique_ptr<CredentialSource> source, const std::string& directory,
+    const std::string& identity) {
+  std::uint8_t digest[SHA256_DIGEST_LENGTH];
+  SHA256(reinterpret_cast<const std::uint8_t*>(identity.data()),
+         identity.size(), digest);
+  std::stringstream name;
+  name << std::hex << std::setfill('0');
+  for (auto byte : digest) {
+    name << std::setw(2) << static_cast<int>(byte);
+  }
+  return std::unique_ptr<CredentialSource>(new CachedCredentialSource(
+      std::move(source), directory + "/" + name.str()));
+}
+
+CachedCredentialSource::CachedCredentialSource(
+    std::unique_ptr<CredentialSource> source, std::string path)
+    : source_(std::move(source)), path_(std::move(path)) {}
+
+std::string CachedCredentialSource::Credential() {
+  if (expiration_ - std::chrono::steady_clock::now() < REFRESH_WINDOW) {
+    auto result = LoadOrRefresh();
+    if (!result.ok()) {
+      LOG(WARNING) << "Not sharing credentials through \"" << path_
+                   << "\": " << result.error();
+      latest_credential_ = source_->Credential();
+      expiration_ = source_->Expiration();
+    }
+  }
+  return latest_credential_;
+}
+
+std::chrono::steady_clock::time_point CachedCredentialSource::Expiration() {
+  return expiration_;
+}
+
+Result<void> CachedCredentialSource::LoadOrRefresh() {
+  using std::chrono::duration_cast;
+  using std::chrono::seconds;
+  using std::chrono::steady_clock;
+  using std::chrono::system_clock;
+
+  CF_EXPECT(EnsureDirectoryExists(cpp_dirname(path_)));
+  // Only the owner may read the tokens
+  android::base::unique_fd fd(
+      open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600));
+  CF_EXPECT(fd >= 0, "Could not open: " << strerror(errno));
+  // Processes needing a refresh wait for the first one to store its token
+  CF_EXPECT(flock(fd.get(), LOCK_EX) == 0,
+            "Could not lock: " << strerror(errno));
+
+  std::string content;
+  CF_EXPECT(android::base::ReadFdToString(fd.get(), &content),
+            "Could not read: " << strerror(errno));
+  Json::Value json;
+  std::string errors;
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  if (!content.empty() &&
+      reader->parse(content.data(), content.data() + content.size(), &json,
+                    &errors) &&
+      json.isMember("access_token") && json.isMember("expires_at")) {
+    // Stored in wall clock time, which other processes share
+    auto expires_at = system_clock::time_point(
+        seconds(json["expires_at"].asInt64()));
+    auto remaining = expires_at - system_clock::now();
+    if (remaining >= REFRESH_WINDOW) {
+      latest_credential_ = json["access_token"].asString();
+      expiration_ = steady_clock::now() +
+                    duration_cast<steady_clock::duration>(remaining);
+      return {};
+    }
+  }
+
+  latest_credential_ = source_->Credential();
+  expiration_ = source_->Expiration();
+  if (expiration_ == steady_clock::time_point::max()) {
+    // Credentials that don't expire aren't worth sharing
+    return {};
+  }
+  auto expires_at =
+      system_clock::now() + duration_cast<system_clock::duration>(
+                                expiration_ - steady_clock::now());
+  json = Json::Value();
+  json["access_token"] = latest_credential_;
+  json["expires_at"] = static_cast<Json::Int64>(
+      duration_cast<seconds>(expires_at.time_since_epoch()).count());
+  Json::StreamWriterBuilder factory;
+  auto serialized = Json::writeString(factory, json);
+  CF_EXPECT(ftruncate(fd.get(), 0) == 0,
+            "Could not truncate: " << strerror(errno));
+  CF_EXPECT(android::base::WriteFullyAtOffset(fd.get(), serialized.data(),
+                                              serialized.size(), 0),
+            "Could not write: " << strerror(errno));
+  return {};
+}
+
 } // namespace cuttlefish
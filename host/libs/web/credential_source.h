@@ -30,6 +30,10 @@ class CredentialSource {
 public:
   virtual ~CredentialSource() = default;
   virtual std::string Credential() = 0;
+  // When the last credential returned stops being valid
+  virtual std::chrono::steady_clock::time_point Expiration() {
+    return std::chrono::steady_clock::time_point::max();
+  }
 };
 
 class GceMetadataCredentialSource : public CredentialSource {
@@ -43,6 +47,7 @@ public:
  GceMetadataCredentialSource(GceMetadataCredentialSource&&) = default;
 
  virtual std::string Credential();
+ std::chrono::steady_clock::time_point Expiration() override;
 
  static std::unique_ptr<CredentialSource> make(CurlWrapper&);
 };
@@ -67,6 +72,7 @@ class RefreshCredentialSource : public CredentialSource {
                           const std::string& refresh_token);
 
   std::string Credential() override;
+  std::chrono::steady_clock::time_point Expiration() override;
 
  private:
   void UpdateLatestCredential();
@@ -89,6 +95,7 @@ class ServiceAccountOauthCredentialSource : public CredentialSource {
       default;
 
   std::string Credential() override;
+  std::chrono::steady_clock::time_point Expiration() override;
 
  private:
   ServiceAccountOauthCredentialSource(CurlWrapper& curl);
@@ -102,4 +109,31 @@ class ServiceAccountOauthCredentialSource : public CredentialSource {
   std::string latest_credential_;
   std::chrono::steady_clock::time_point expiration_;
 };
+
+// Shares the credentials of another source with other processes through a
+// file, so concurrent fetchers using the same account get a token from the
+// server once until it expires. The file is locked while a process reads or
+// refreshes it, and only its owner can read it.
+class CachedCredentialSource : public CredentialSource {
+ public:
+  // `identity` tells apart the accounts sharing the directory, e.g. the
+  // contents of their credentials file. Only its hash is stored.
+  static std::unique_ptr<CredentialSource> make(
+      std::unique_ptr<CredentialSource> source, const std::string& directory,
+      const std::string& identity);
+
+  std::string Credential() override;
+  std::chrono::steady_clock::time_point Expiration() override;
+
+ private:
+  CachedCredentialSource(std::unique_ptr<CredentialSource> source,
+                         std::string path);
+  Result<void> LoadOrRefresh();
+
+  std::unique_ptr<CredentialSource> source_;
+  std::string path_;
+
+  std::string latest_credential_;
+  std::chrono::steady_clock::time_point expiration_;
+};
 }
@@ -15,21 +15,40 @@
 
 #include "host/libs/web/curl_wrapper.h"
 
+#include <fcntl.h>
 #include <stdio.h>
+#include <unistd.h>
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <fstream>
 #include <mutex>
+#include <optional>
+#include <set>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <vector>
 
+#include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
+#include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 #include <curl/curl.h>
 #include <json/json.h>
 
+#include "common/libs/utils/files.h"
+#include "common/libs/utils/tracing.h"
+
 namespace cuttlefish {
 namespace {
 
+constexpr std::uint64_t kDownloadChunkSize = 64 << 20;
+constexpr std::size_t kDownloadConnections = 8;
+
 size_t curl_to_function_cb(char* ptr, size_t, size_t nmemb, void* userdata) {
   CurlWrapper::DataCallback* callback = (CurlWrapper::DataCallback*)userdata;
   if (!(*callback)(ptr, nmemb)) {
@@ -44,6 +63,110 @@ size_t file_write_callback(char *ptr, size_t, size_t nmemb, void *userdata) {
   return nmemb;
 }
 
+// What a ranged download needs to know about the resource
+struct RangeHeaders {
+  // From a "Content-Range: bytes <first>-<last>/<total>" header
+  std::optional<std::uint64_t> total_size;
+  std::string etag;
+  std::string last_modified;
+
+  // Changes whenever the resource does, empty if the server doesn't tell
+  std::string Version() const { return etag.empty() ? last_modified : etag; }
+};
+
+size_t range_headers_cb(char* buffer, size_t size, size_t nitems,
+                        void* userdata) {
+  auto range_headers = (RangeHeaders*)userdata;
+  std::string header(buffer, size * nitems);
+  auto value = [&header]() {
+    return android::base::Trim(header.substr(header.find(':') + 1));
+  };
+  if (android::base::StartsWithIgnoreCase(header, "content-range:")) {
+    auto total = android::base::Trim(header.substr(header.rfind('/') + 1));
+    std::uint64_t total_size;
+    if (android::base::ParseUint(total, &total_size)) {
+      range_headers->total_size = total_size;
+    }
+  } else if (android::base::StartsWithIgnoreCase(header, "etag:")) {
+    range_headers->etag = value();
+  } else if (android::base::StartsWithIgnoreCase(header, "last-modified:")) {
+    range_headers->last_modified = value();
+  }
+  return size * nitems;
+}
+
+// Lets the handles of one CurlWrapper reuse each other's DNS lookups and TLS
+// sessions, from any thread. Connections aren't shared, libcurl doesn't support
+// using a shared connection cache from several threads at once. Resuming the
+// TLS sessions keeps the new connections cheap.
+class CurlShare {
+ public:
+  CurlShare() : share_(curl_share_init()) {
+    if (!share_) {
+      LOG(ERROR) << "failed to initialize the curl share";
+      return;
+    }
+    curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, Lock);
+    curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, Unlock);
+    curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+    for (auto data : {CURL_LOCK_DATA_DNS, CURL_LOCK_DATA_SSL_SESSION}) {
+      curl_share_setopt(share_, CURLSHOPT_SHARE, data);
+    }
+  }
+  ~CurlShare() {
+    if (share_) {
+      curl_share_cleanup(share_);
+    }
+  }
+
+  CURLSH* get() { return share_; }
+
+  // Caps the combined rate of every download through the share, 0 for none
+  void SetMaxReceiveSpeed(std::uint64_t bytes_per_second) {
+    max_receive_speed_ = bytes_per_second;
+  }
+  // Blocks until `size` more bytes fit in the rate, which also keeps curl
+  // from reading more until then.
+  void Throttle(size_t size) {
+    if (max_receive_speed_ == 0) {
+      return;
+    }
+    using Clock = std::chrono::steady_clock;
+    auto duration = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(double(size) / max_receive_speed_));
+    Clock::time_point slot;
+    {
+      std::lock_guard lock(throttle_mutex_);
+      slot = std::max(Clock::now(), next_slot_);
+      next_slot_ = slot + duration;
+    }
+    std::this_thread::sleep_until(slot);
+  }
+
+ private:
+  static void Lock(CURL*, curl_lock_data data, curl_lock_access, void* self) {
+    static_cast<CurlShare*>(self)->mutexes_[data].lock();
+  }
+  static void Unlock(CURL*, curl_lock_data data, void* self) {
+    static_cast<CurlShare*>(self)->mutexes_[data].unlock();
+  }
+
+  CURLSH* share_;
+  std::mutex mutexes_[CURL_LOCK_DATA_LAST];
+  std::uint64_t max_receive_speed_ = 0;
+  std::mutex throttle_mutex_;
+  std::chrono::steady_clock::time_point next_slot_;
+};
+
+// Options every request sets after curl_easy_reset
+void SetCommonOptions(CURL* curl, CURLSH* share) {
+  curl_easy_setopt(curl, CURLOPT_CAINFO, "/etc/ssl/certs/ca-certificates.crt");
+  curl_easy_setopt(curl, CURLOPT_SHARE, share);
+  // Falls back to HTTP/1.1 when the server doesn't negotiate HTTP/2
+  curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+  curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+}
+
 curl_slist* build_slist(const std::vector<std::string>& strings) {
   curl_slist* curl_headers = nullptr;
   for (const auto& str : strings) {
@@ -60,9 +183,199 @@ curl_slist* build_slist(const std::vector<std::string>& strings) {
   return curl_headers;
 }
 
+// GET of `url` on `curl`, limited to `range` if it's not empty. The total size
+// and version of the resource are written to `range_headers` if not null.
+CurlResponse<bool> PerformDownload(
+    CURL* curl, CurlShare& share, const std::string& url,
+    const std::vector<std::string>& headers,
+    CurlWrapper::DataCallback& callback, const std::string& range,
+    RangeHeaders* range_headers) {
+  CF_TRACE_DETAIL("download", range.empty() ? url : url + " " + range);
+  if (!callback(nullptr, 0)) {  // Signal start of data
+    LOG(ERROR) << "Callback failure\n";
+    return {false, -1};
+  }
+  CurlWrapper::DataCallback throttled_callback = [&](char* data, size_t size) {
+    if (TracingEnabled()) {
+      static std::atomic<std::int64_t> downloaded_bytes = 0;
+      TraceCounter("downloaded_bytes", downloaded_bytes += size);
+    }
+    share.Throttle(size);
+    return callback(data, size);
+  };
+  curl_slist* curl_headers = build_slist(headers);
+  curl_easy_reset(curl);
+  SetCommonOptions(curl, share.get());
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, curl_headers);
+  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_to_function_cb);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &throttled_callback);
+  if (!range.empty()) {
+    curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+  }
+  if (range_headers) {
+    *range_headers = RangeHeaders();
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, range_headers_cb);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, range_headers);
+  }
+  char error_buf[CURL_ERROR_SIZE];
+  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, error_buf);
+  curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+  CURLcode res = curl_easy_perform(curl);
+  if (curl_headers) {
+    curl_slist_free_all(curl_headers);
+  }
+  if (res != CURLE_OK) {
+    LOG(ERROR) << "curl_easy_perform() failed. "
+               << "Code was \"" << res << "\". "
+               << "Strerror was \"" << curl_easy_strerror(res) << "\". "
+               << "Error buffer was \"" << error_buf << "\".";
+    return {false, -1};
+  }
+  long http_code = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+  return {true, http_code};
+}
+
+struct CurlCleanup {
+  void operator()(CURL* curl) { curl_easy_cleanup(curl); }
+};
+
+// The lines a chunked download's state file starts with. Its chunks are only
+// reused for the same version of the same resource. Query strings are left out
+// as they hold signatures that change from one request to the next.
+std::string DownloadIdentity(const std::string& url,
+                             const RangeHeaders& range_headers) {
+  return "url " + url.substr(0, url.find('?')) + "\nsize " +
+         std::to_string(*range_headers.total_size) + "\nversion " +
+         range_headers.Version() + "\n";
+}
+
+// Chunks written so far by an earlier download with the same identity, from a
+// state file of the identity lines followed by "chunk <index>" lines.
+std::set<std::uint64_t> CompletedChunks(const std::string& state_path,
+                                        const std::string& identity) {
+  std::string state;
+  if (!android::base::ReadFileToString(state_path, &state)) {
+    return {};
+  }
+  if (!android::base::StartsWith(state, identity)) {
+    LOG(INFO) << "Discarding a partial download of a different resource";
+    return {};
+  }
+  auto lines = android::base::Split(state.substr(identity.size()), "\n");
+  std::set<std::uint64_t> chunks;
+  for (const auto& line : lines) {
+    std::uint64_t chunk;
+    if (android::base::StartsWith(line, "chunk ") &&
+        android::base::ParseUint(line.substr(6), &chunk)) {
+      chunks.insert(chunk);
+    }
+  }
+  return chunks;
+}
+
+// Downloads every chunk after the first one over separate connections. Without
+// a version to check them against, chunks from earlier attempts aren't reused.
+bool DownloadRemainingChunks(CurlShare& share, const std::string& url,
+                             const std::vector<std::string>& headers, int fd,
+                             const RangeHeaders& first_headers,
+                             const std::string& state_path) {
+  auto total_size = *first_headers.total_size;
+  if (ftruncate(fd, total_size) != 0) {
+    PLOG(ERROR) << "Failed to resize the download to " << total_size;
+    return false;
+  }
+  auto identity = DownloadIdentity(url, first_headers);
+  std::set<std::uint64_t> completed;
+  if (!first_headers.Version().empty()) {
+    completed = CompletedChunks(state_path, identity);
+  }
+  if (completed.empty()) {
+    if (!android::base::WriteStringToFile(identity, state_path)) {
+      PLOG(ERROR) << "Failed to write \"" << state_path << "\"";
+      return false;
+    }
+  } else {
+    LOG(INFO) << "Resuming download with " << completed.size()
+              << " chunks already written";
+  }
+  std::vector<std::uint64_t> chunks;
+  auto num_chunks = (total_size + kDownloadChunkSize - 1) / kDownloadChunkSize;
+  for (std::uint64_t chunk = 1; chunk < num_chunks; chunk++) {
+    if (completed.count(chunk) == 0) {
+      chunks.push_back(chunk);
+    }
+  }
+
+  std::mutex state_mutex;
+  std::ofstream state(state_path, std::ios::app);
+  std::atomic<std::size_t> next = 0;
+  std::atomic<bool> success = true;
+  auto download_chunks = [&]() {
+    std::unique_ptr<CURL, CurlCleanup> curl(curl_easy_init());
+    if (!curl) {
+      LOG(ERROR) << "failed to initialize curl";
+      success = false;
+      return;
+    }
+    for (auto i = next++; i < chunks.size() && success; i = next++) {
+      std::uint64_t start = chunks[i] * kDownloadChunkSize;
+      std::uint64_t end = std::min(start + kDownloadChunkSize, total_size);
+      std::uint64_t offset = start;
+      CurlWrapper::DataCallback callback = [&](char* data, size_t size) {
+        if (data == nullptr) {
+          offset = start;
+          return true;
+        }
+        if (offset + size > end ||
+            !android::base::WriteFullyAtOffset(fd, data, size, offset)) {
+          return false;
+        }
+        offset += size;
+        return true;
+      };
+      auto range = std::to_string(start) + "-" + std::to_string(end - 1);
+      RangeHeaders chunk_headers;
+      auto response =
+          PerformDownload(curl.get(), share, url, headers, callback, range,
+                          &chunk_headers);
+      if (!response.data || response.http_code != 206 || offset != end) {
+        LOG(ERROR) << "Failed to download bytes " << range << ", code was "
+                   << response.http_code;
+        success = false;
+        return;
+      }
+      if (chunk_headers.Version() != first_headers.Version() ||
+          chunk_headers.total_size != first_headers.total_size) {
+        LOG(ERROR) << "\"" << url << "\" changed while downloading it";
+        // Nothing written so far can be trusted
+        unlink(state_path.c_str());
+        success = false;
+        return;
+      }
+      std::lock_guard lock(state_mutex);
+      state << "chunk " << chunks[i] << "\n" << std::flush;
+    }
+  };
+  std::vector<std::thread> threads;
+  for (std::size_t i = 0; i < std::min(kDownloadConnections, chunks.size());
+       i++) {
+    threads.emplace_back(download_chunks);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return success;
+}
+
+// Every request runs on its own handle, so requests from different threads
+// don't wait on each other. The handles share DNS lookups and TLS sessions
+// through share_.
 class CurlWrapperImpl : public CurlWrapper {
  public:
-  CurlWrapperImpl() {
+  CurlWrapperImpl(std::uint64_t max_receive_speed) {
+    share_.SetMaxReceiveSpeed(max_receive_speed);
     curl_ = curl_easy_init();
     if (!curl_) {
       LOG(ERROR) << "failed to initialize curl";
@@ -74,27 +387,25 @@ class CurlWrapperImpl : public CurlWrapper {
   CurlResponse<std::string> PostToString(
       const std::string& url, const std::string& data_to_write,
       const std::vector<std::string>& headers) override {
-    std::lock_guard<std::mutex> lock(mutex_);
     LOG(INFO) << "Attempting to download \"" << url << "\"";
-    if (!curl_) {
-      LOG(ERROR) << "curl was not initialized\n";
+    std::unique_ptr<CURL, CurlCleanup> curl(curl_easy_init());
+    if (!curl) {
+      LOG(ERROR) << "failed to initialize curl";
       return {"", -1};
     }
     curl_slist* curl_headers = build_slist(headers);
-    curl_easy_reset(curl_);
-    curl_easy_setopt(curl_, CURLOPT_CAINFO,
-                     "/etc/ssl/certs/ca-certificates.crt");
-    curl_easy_setopt(curl_, CURLOPT_HTTPHEADER, curl_headers);
-    curl_easy_setopt(curl_, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl_, CURLOPT_POSTFIELDSIZE, data_to_write.size());
-    curl_easy_setopt(curl_, CURLOPT_POSTFIELDS, data_to_write.c_str());
+    SetCommonOptions(curl.get(), share_.get());
+    curl_easy_setopt(curl.get(), CURLOPT_HTTPHEADER, curl_headers);
+    curl_easy_setopt(curl.get(), CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl.get(), CURLOPT_POSTFIELDSIZE, data_to_write.size());
+    curl_easy_setopt(curl.get(), CURLOPT_POSTFIELDS, data_to_write.c_str());
     std::stringstream data_to_read;
-    curl_easy_setopt(curl_, CURLOPT_WRITEFUNCTION, file_write_callback);
-    curl_easy_setopt(curl_, CURLOPT_WRITEDATA, &data_to_read);
+    curl_easy_setopt(curl.get(), CURLOPT_WRITEFUNCTION, file_write_callback);
+    curl_easy_setopt(curl.get(), CURLOPT_WRITEDATA, &data_to_read);
     char error_buf[CURL_ERROR_SIZE];
-    curl_easy_setopt(curl_, CURLOPT_ERRORBUFFER, error_buf);
-    curl_easy_setopt(curl_, CURLOPT_VERBOSE, 1L);
-    CURLcode res = curl_easy_perform(curl_);
+    curl_easy_setopt(curl.get(), CURLOPT_ERRORBUFFER, error_buf);
+    curl_easy_setopt(curl.get(), CURLOPT_VERBOSE, 1L);
+    CURLcode res = curl_easy_perform(curl.get());
     if (curl_headers) {
       curl_slist_free_all(curl_headers);
     }
@@ -106,7 +417,7 @@ class CurlWrapperImpl : public CurlWrapper {
       return {"", -1};
     }
     long http_code = 0;
-    curl_easy_getinfo(curl_, CURLINFO_RESPONSE_CODE, &http_code);
+    curl_easy_getinfo(curl.get(), CURLINFO_RESPONSE_CODE, &http_code);
     return {data_to_read.str(), http_code};
   }
 
@@ -140,66 +451,135 @@ class CurlWrapperImpl : public CurlWrapper {
   CurlResponse<bool> DownloadToCallback(
       DataCallback callback, const std::string& url,
       const std::vector<std::string>& headers) {
-    std::lock_guard<std::mutex> lock(mutex_);
     LOG(INFO) << "Attempting to download \"" << url << "\"";
-    if (!curl_) {
-      LOG(ERROR) << "curl was not initialized\n";
+    std::unique_ptr<CURL, CurlCleanup> curl(curl_easy_init());
+    if (!curl) {
+      LOG(ERROR) << "failed to initialize curl";
       return {false, -1};
     }
-    if (!callback(nullptr, 0)) {  // Signal start of data
-      LOG(ERROR) << "Callback failure\n";
+    return PerformDownload(curl.get(), share_, url, headers, callback,
+                           "", nullptr);
+  }
+
+  CurlResponse<bool> DownloadRangeToCallback(
+      DataCallback callback, const std::string& url, const std::string& range,
+      std::uint64_t* total_size, const std::vector<std::string>& headers) {
+    LOG(INFO) << "Attempting to download bytes " << range << " of \"" << url
+              << "\"";
+    std::unique_ptr<CURL, CurlCleanup> curl(curl_easy_init());
+    if (!curl) {
+      LOG(ERROR) << "failed to initialize curl";
       return {false, -1};
     }
-    curl_slist* curl_headers = build_slist(headers);
-    curl_easy_reset(curl_);
-    curl_easy_setopt(curl_, CURLOPT_CAINFO,
-                     "/etc/ssl/certs/ca-certificates.crt");
-    curl_easy_setopt(curl_, CURLOPT_HTTPHEADER, curl_headers);
-    curl_easy_setopt(curl_, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl_, CURLOPT_WRITEFUNCTION, curl_to_function_cb);
-    curl_easy_setopt(curl_, CURLOPT_WRITEDATA, &callback);
-    char error_buf[CURL_ERROR_SIZE];
-    curl_easy_setopt(curl_, CURLOPT_ERRORBUFFER, error_buf);
-    curl_easy_setopt(curl_, CURLOPT_VERBOSE, 1L);
-    CURLcode res = curl_easy_perform(curl_);
-    if (curl_headers) {
-      curl_slist_free_all(curl_headers);
+    // A server ignoring the range would send the whole resource
+    DataCallback range_callback = [&](char* data, size_t size) -> bool {
+      if (data != nullptr) {
+        long http_code = 0;
+        curl_easy_getinfo(curl.get(), CURLINFO_RESPONSE_CODE, &http_code);
+        if (http_code != 206) {  // Partial Content
+          return false;
+        }
+      }
+      return callback(data, size);
+    };
+    RangeHeaders range_headers;
+    auto response = PerformDownload(curl.get(), share_, url, headers,
+                                    range_callback, range, &range_headers);
+    auto& size = range_headers.total_size;
+    if (response.data && response.HttpSuccess() && response.http_code != 206) {
+      LOG(ERROR) << "\"" << url << "\" was not sent as a range";
+      return {false, -1};
     }
-    if (res != CURLE_OK) {
-      LOG(ERROR) << "curl_easy_perform() failed. "
-                 << "Code was \"" << res << "\". "
-                 << "Strerror was \"" << curl_easy_strerror(res) << "\". "
-                 << "Error buffer was \"" << error_buf << "\".";
+    if (response.data && !size) {
+      LOG(ERROR) << "Missing the total size in the response for \"" << url
+                 << "\"";
       return {false, -1};
     }
-    long http_code = 0;
-    curl_easy_getinfo(curl_, CURLINFO_RESPONSE_CODE, &http_code);
-    return {true, http_code};
+    if (response.data && total_size) {
+      *total_size = *size;
+    }
+    return response;
   }
 
   CurlResponse<std::string> DownloadToFile(
       const std::string& url, const std::string& path,
       const std::vector<std::string>& headers) {
     LOG(INFO) << "Attempting to save \"" << url << "\" to \"" << path << "\"";
-    std::fstream stream;
-    auto callback = [&stream, path](char* data, size_t size) -> bool {
+    std::unique_ptr<CURL, CurlCleanup> curl(curl_easy_init());
+    if (!curl) {
+      LOG(ERROR) << "failed to initialize curl";
+      return {"", -1};
+    }
+    auto partial_path = path + ".partial";
+    auto state_path = path + ".partial.chunks";
+    if (!FileExists(partial_path)) {
+      // The recorded chunks went with the data
+      unlink(state_path.c_str());
+    }
+    android::base::unique_fd fd(
+        open(partial_path.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC, 0644));
+    if (fd < 0) {
+      PLOG(ERROR) << "Could not open \"" << partial_path << "\"";
+      return {"", -1};
+    }
+    // The first chunk also tells whether the server accepts ranges. If it
+    // doesn't, the whole file is in this response.
+    RangeHeaders range_headers;
+    auto& total_size = range_headers.total_size;
+    std::uint64_t offset = 0;
+    bool whole_file = false;
+    DataCallback callback = [&](char* data, size_t size) -> bool {
       if (data == nullptr) {
-        stream.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
-        return !stream.fail();
+        offset = 0;
+        return true;
       }
-      stream.write(data, size);
-      return !stream.fail();
+      if (!total_size && !whole_file) {
+        whole_file = true;
+        if (ftruncate(fd.get(), 0) != 0) {
+          return false;
+        }
+      }
+      if (!android::base::WriteFullyAtOffset(fd.get(), data, size, offset)) {
+        return false;
+      }
+      offset += size;
+      return true;
     };
-    auto callback_res = DownloadToCallback(callback, url, headers);
-    if (!callback_res.data) {
-      return {"", callback_res.http_code};
+    auto range = "0-" + std::to_string(kDownloadChunkSize - 1);
+    auto response = PerformDownload(curl.get(), share_, url, headers,
+                                    callback, range, &range_headers);
+    if (response.data && response.http_code == 416) {
+      // Range Not Satisfiable: an empty file has no first byte to ask for
+      if (ftruncate(fd.get(), 0) != 0) {
+        PLOG(ERROR) << "Failed to truncate \"" << partial_path << "\"";
+        return {"", -1};
+      }
+      whole_file = true;
+      response = PerformDownload(curl.get(), share_, url, headers, callback,
+                                 "", nullptr);
     }
-    return {path, callback_res.http_code};
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (!curl_) {
-      LOG(ERROR) << "curl was not initialized\n";
+    if (!response.data || !response.HttpSuccess()) {
+      return {"", response.http_code};
+    }
+    if (response.http_code == 206) {  // Partial Content
+      if (!total_size) {
+        LOG(ERROR) << "Missing the total size in the response for \"" << url
+                   << "\"";
+        return {"", -1};
+      }
+      if (!DownloadRemainingChunks(share_, url, headers, fd.get(),
+                                   range_headers, state_path)) {
+        // The chunks already written are kept to resume from
+        return {"", -1};
+      }
+    }
+    unlink(state_path.c_str());
+    if (rename(partial_path.c_str(), path.c_str()) != 0) {
+      PLOG(ERROR) << "Could not move \"" << partial_path << "\" to \""
+                  << path << "\"";
       return {"", -1};
     }
+    return {path, response.http_code};
   }
 
   CurlResponse<std::string> DownloadToString(
@@ -240,26 +620,24 @@ class CurlWrapperImpl : public CurlWrapper {
   CurlResponse<Json::Value> DeleteToJson(
       const std::string& url,
       const std::vector<std::string>& headers) override {
-    std::lock_guard<std::mutex> lock(mutex_);
     LOG(INFO) << "Attempting to download \"" << url << "\"";
-    if (!curl_) {
-      LOG(ERROR) << "curl was not initialized\n";
+    std::unique_ptr<CURL, CurlCleanup> curl(curl_easy_init());
+    if (!curl) {
+      LOG(ERROR) << "failed to initialize curl";
       return {"", -1};
     }
     curl_slist* curl_headers = build_slist(headers);
-    curl_easy_reset(curl_);
-    curl_easy_setopt(curl_, CURLOPT_CUSTOMREQUEST, "DELETE");
-    curl_easy_setopt(curl_, CURLOPT_CAINFO,
-                     "/etc/ssl/certs/ca-certificates.crt");
-    curl_easy_setopt(curl_, CURLOPT_HTTPHEADER, curl_headers);
-    curl_easy_setopt(curl_, CURLOPT_URL, url.c_str());
+    SetCommonOptions(curl.get(), share_.get());
+    curl_easy_setopt(curl.get(), CURLOPT_CUSTOMREQUEST, "DELETE");
+    curl_easy_setopt(curl.get(), CURLOPT_HTTPHEADER, curl_headers);
+    curl_easy_setopt(curl.get(), CURLOPT_URL, url.c_str());
     std::stringstream data_to_read;
-    curl_easy_setopt(curl_, CURLOPT_WRITEFUNCTION, file_write_callback);
-    curl_easy_setopt(curl_, CURLOPT_WRITEDATA, &data_to_read);
+    curl_easy_setopt(curl.get(), CURLOPT_WRITEFUNCTION, file_write_callback);
+    curl_easy_setopt(curl.get(), CURLOPT_WRITEDATA, &data_to_read);
     char error_buf[CURL_ERROR_SIZE];
-    curl_easy_setopt(curl_, CURLOPT_ERRORBUFFER, error_buf);
-    curl_easy_setopt(curl_, CURLOPT_VERBOSE, 1L);
-    CURLcode res = curl_easy_perform(curl_);
+    curl_easy_setopt(curl.get(), CURLOPT_ERRORBUFFER, error_buf);
+    curl_easy_setopt(curl.get(), CURLOPT_VERBOSE, 1L);
+    CURLcode res = curl_easy_perform(curl.get());
     if (curl_headers) {
       curl_slist_free_all(curl_headers);
     }
@@ -271,7 +649,7 @@ class CurlWrapperImpl : public CurlWrapper {
       return {"", -1};
     }
     long http_code = 0;
-    curl_easy_getinfo(curl_, CURLINFO_RESPONSE_CODE, &http_code);
+    curl_easy_getinfo(curl.get(), CURLINFO_RESPONSE_CODE, &http_code);
 
     auto contents = data_to_read.str();
     Json::CharReaderBuilder builder;
@@ -288,6 +666,7 @@ class CurlWrapperImpl : public CurlWrapper {
   }
 
   std::string UrlEscape(const std::string& text) override {
+    // Escaping only reads the handle, which no request uses
     char* escaped_str = curl_easy_escape(curl_, text.c_str(), text.size());
     std::string ret{escaped_str};
     curl_free(escaped_str);
@@ -296,7 +675,7 @@ class CurlWrapperImpl : public CurlWrapper {
 
  private:
   CURL* curl_;
-  std::mutex mutex_;
+  CurlShare share_;
 };
 
 class CurlServerErrorRetryingWrapper : public CurlWrapper {
@@ -353,6 +732,15 @@ class CurlServerErrorRetryingWrapper : public CurlWrapper {
     return RetryImpl<bool>(
         [&, this]() { return inner_curl_.DownloadToCallback(cb, url, hdrs); });
   }
+  CurlResponse<bool> DownloadRangeToCallback(
+      DataCallback cb, const std::string& url, const std::string& range,
+      std::uint64_t* total_size,
+      const std::vector<std::string>& hdrs) override {
+    return RetryImpl<bool>([&, this]() {
+      return inner_curl_.DownloadRangeToCallback(cb, url, range, total_size,
+                                                 hdrs);
+    });
+  }
   CurlResponse<Json::Value> DeleteToJson(
       const std::string& url,
       const std::vector<std::string>& headers) override {
@@ -388,8 +776,9 @@ class CurlServerErrorRetryingWrapper : public CurlWrapper {
 
 }  // namespace
 
-/* static */ std::unique_ptr<CurlWrapper> CurlWrapper::Create() {
-  return std::unique_ptr<CurlWrapper>(new CurlWrapperImpl());
+/* static */ std::unique_ptr<CurlWrapper> CurlWrapper::Create(
+    std::uint64_t max_receive_speed) {
+  return std::unique_ptr<CurlWrapper>(new CurlWrapperImpl(max_receive_speed));
 }
 
 /* static */ std::unique_ptr<CurlWrapper> CurlWrapper::WithServerErrorRetry(
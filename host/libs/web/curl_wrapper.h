@@ -16,6 +16,7 @@
 #pragma once
 
 #include <chrono>
+#include <cstdint>
 #include <mutex>
 #include <string>
 
@@ -39,7 +40,11 @@ class CurlWrapper {
  public:
   typedef std::function<bool(char*, size_t)> DataCallback;
 
-  static std::unique_ptr<CurlWrapper> Create();
+  // Requests can be made from several threads at once. They reuse each
+  // other's connections, DNS lookups and TLS sessions. Downloads share
+  // `max_receive_speed` bytes per second between them, when it's not 0.
+  static std::unique_ptr<CurlWrapper> Create(
+      std::uint64_t max_receive_speed = 0);
   static std::unique_ptr<CurlWrapper> WithServerErrorRetry(
       CurlWrapper&, int retry_attempts, std::chrono::milliseconds retry_delay);
   virtual ~CurlWrapper();
@@ -54,6 +59,9 @@ class CurlWrapper {
       const std::string& url, const Json::Value& data,
       const std::vector<std::string>& headers = {}) = 0;
 
+  // Large files are downloaded in chunks over several connections when the
+  // server accepts ranges. The chunks written by an interrupted call for the
+  // same path are kept and not downloaded again.
   virtual CurlResponse<std::string> DownloadToFile(
       const std::string& url, const std::string& path,
       const std::vector<std::string>& headers = {}) = 0;
@@ -64,6 +72,14 @@ class CurlWrapper {
   virtual CurlResponse<bool> DownloadToCallback(
       DataCallback callback, const std::string& url,
       const std::vector<std::string>& headers = {}) = 0;
+  // Downloads the bytes in `range`, written as in a Range header without the
+  // unit: "0-99", or "-100" for the last 100 bytes. Fails without reading the
+  // body when the server doesn't answer with just that range. The size of the
+  // whole resource is written to `total_size` if it's not null.
+  virtual CurlResponse<bool> DownloadRangeToCallback(
+      DataCallback callback, const std::string& url, const std::string& range,
+      std::uint64_t* total_size,
+      const std::vector<std::string>& headers = {}) = 0;
 
   virtual CurlResponse<Json::Value> DeleteToJson(
       const std::string& url, const std::vector<std::string>& headers = {}) = 0;
@@ -0,0 +1,615 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/libs/web/tar_stream.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr size_t kBlockSize = 512;
+// Inflated data is handed to the writer in chunks this size
+constexpr size_t kChunkSize = 1 << 20;
+// Bounds the memory used when the disk is slower than the download
+constexpr size_t kMaxQueuedChunks = 16;
+// Long names and pax headers are small, anything larger is corrupted
+constexpr std::uint64_t kMaxMetadataSize = 1 << 20;
+
+constexpr char kRegularFile = '0';
+constexpr char kOldRegularFile = '\0';
+constexpr char kHardLink = '1';
+constexpr char kSymlink = '2';
+constexpr char kDirectory = '5';
+constexpr char kContiguousFile = '7';
+constexpr char kGnuLongName = 'L';
+constexpr char kGnuLongLink = 'K';
+constexpr char kPaxHeader = 'x';
+
+// Numeric fields are octal, or big endian binary when their high bit is set
+std::uint64_t ParseNumber(const char* field, size_t size) {
+  std::uint64_t value = 0;
+  if (static_cast<unsigned char>(field[0]) & 0x80) {
+    value = static_cast<unsigned char>(field[0]) & 0x7f;
+    for (size_t i = 1; i < size; i++) {
+      value = (value << 8) | static_cast<unsigned char>(field[i]);
+    }
+    return value;
+  }
+  for (size_t i = 0; i < size; i++) {
+    if (field[i] >= '0' && field[i] <= '7') {
+      value = (value << 3) | (field[i] - '0');
+    } else if (field[i] != ' ' || value != 0) {
+      break;
+    }
+  }
+  return value;
+}
+
+// Up to the first NUL, the fields fill their whole size otherwise
+std::string ParseString(const char* field, size_t size) {
+  return std::string(field, strnlen(field, size));
+}
+
+bool ValidChecksum(const char* header) {
+  constexpr size_t kChecksumOffset = 148;
+  constexpr size_t kChecksumSize = 8;
+  std::uint64_t sum = 0;
+  for (size_t i = 0; i < kBlockSize; i++) {
+    bool in_checksum =
+        i >= kChecksumOffset && i < kChecksumOffset + kChecksumSize;
+    sum += in_checksum ? ' ' : static_cast<unsigned char>(header[i]);
+  }
+  return sum == ParseNumber(header + kChecksumOffset, kChecksumSize);
+}
+
+// Paths come from the archive, they must stay in the target directory
+bool SafeName(const std::string& name) {
+  if (name.empty() || name[0] == '/') {
+    return false;
+  }
+  for (const auto& component : android::base::Split(name, "/")) {
+    if (component == "..") {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+TarStreamExtractor::TarStreamExtractor(std::string directory)
+    : directory_(std::move(directory)) {}
+
+TarStreamExtractor::~TarStreamExtractor() {
+  StopWriter();
+  if (inflating_) {
+    inflateEnd(&inflate_);
+  }
+}
+
+void TarStreamExtractor::StartWriter() {
+  input_done_ = false;
+  writer_failed_ = false;
+  queue_.clear();
+  writer_ = std::thread([this]() { WriterLoop(); });
+}
+
+void TarStreamExtractor::StopWriter() {
+  if (!writer_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    input_done_ = true;
+  }
+  queue_cv_.notify_all();
+  writer_.join();
+  // Left over from an interrupted entry
+  existing_.reset();
+  if (out_ >= 0) {
+    out_.reset();
+    unlink(temp_path_.c_str());
+  }
+}
+
+void TarStreamExtractor::WriterLoop() {
+  for (;;) {
+    std::vector<char> chunk;
+    {
+      std::unique_lock<std::mutex> lock(queue_mutex_);
+      queue_cv_.wait(lock, [this]() { return !queue_.empty() || input_done_; });
+      if (queue_.empty()) {
+        return;
+      }
+      chunk = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    queue_cv_.notify_all();
+    if (!Untar(chunk.data(), chunk.size())) {
+      std::lock_guard<std::mutex> lock(queue_mutex_);
+      writer_failed_ = true;
+      queue_.clear();
+      queue_cv_.notify_all();
+      return;
+    }
+  }
+}
+
+bool TarStreamExtractor::StartInflating() {
+  inflate_ = {};
+  // Gzip framing, which zlib checks
+  if (inflateInit2(&inflate_, 16 + MAX_WBITS) != Z_OK) {
+    LOG(ERROR) << "Could not start inflating the archive";
+    return false;
+  }
+  inflating_ = true;
+  inflate_done_ = false;
+  return true;
+}
+
+bool TarStreamExtractor::Consume(char* data, size_t size) {
+  if (data == nullptr) {
+    StopWriter();
+    if (inflating_) {
+      inflateEnd(&inflate_);
+      inflating_ = false;
+    }
+    state_ = State::kHeader;
+    header_.clear();
+    metadata_.clear();
+    long_name_.clear();
+    long_link_.clear();
+    has_pax_size_ = false;
+    extracted_.clear();
+    real_directories_.clear();
+    unchanged_ = 0;
+    return true;
+  }
+  if (!writer_.joinable()) {
+    StartWriter();
+  }
+  if (!inflating_ && !StartInflating()) {
+    return false;
+  }
+  inflate_.next_in = reinterpret_cast<Bytef*>(data);
+  inflate_.avail_in = size;
+  while (inflate_.avail_in > 0) {
+    if (inflate_done_) {
+      // Another gzip member follows, as in concatenated archives
+      inflateReset(&inflate_);
+      inflate_done_ = false;
+    }
+    std::vector<char> chunk(kChunkSize);
+    inflate_.next_out = reinterpret_cast<Bytef*>(chunk.data());
+    inflate_.avail_out = chunk.size();
+    int result = inflate(&inflate_, Z_NO_FLUSH);
+    if (result != Z_OK && result != Z_STREAM_END) {
+      LOG(ERROR) << "Could not inflate the archive: " << result;
+      return false;
+    }
+    inflate_done_ = result == Z_STREAM_END;
+    chunk.resize(chunk.size() - inflate_.avail_out);
+    if (chunk.empty()) {
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(queue_mutex_);
+    queue_cv_.wait(lock, [this]() {
+      return queue_.size() < kMaxQueuedChunks || writer_failed_;
+    });
+    if (writer_failed_) {
+      return false;
+    }
+    queue_.push_back(std::move(chunk));
+    lock.unlock();
+    queue_cv_.notify_all();
+  }
+  std::lock_guard<std::mutex> lock(queue_mutex_);
+  return !writer_failed_;
+}
+
+bool TarStreamExtractor::Finish() {
+  bool inflated = inflating_ && inflate_done_;
+  StopWriter();
+  if (!inflated) {
+    LOG(ERROR) << "The compressed archive ended early";
+    return false;
+  }
+  if (writer_failed_) {
+    return false;
+  }
+  if (state_ != State::kDone) {
+    LOG(ERROR) << "The tar archive ended early";
+    return false;
+  }
+  return true;
+}
+
+bool TarStreamExtractor::Untar(const char* data, size_t size) {
+  while (size > 0) {
+    if (state_ == State::kFailed) {
+      return false;
+    } else if (state_ == State::kDone) {
+      // Only the end of archive blocks and their padding are left
+      return true;
+    } else if (state_ == State::kHeader) {
+      size_t take = std::min(size, kBlockSize - header_.size());
+      header_.append(data, take);
+      data += take;
+      size -= take;
+      if (header_.size() < kBlockSize) {
+        continue;
+      }
+      bool parsed = ParseHeader();
+      header_.clear();
+      if (!parsed) {
+        state_ = State::kFailed;
+        return false;
+      }
+    } else if (entry_remaining_ > 0) {
+      size_t take = std::min<std::uint64_t>(size, entry_remaining_);
+      if (entry_type_ == EntryType::kFile && !FileData(data, take)) {
+        state_ = State::kFailed;
+        return false;
+      } else if (entry_type_ == EntryType::kMetadata) {
+        metadata_.append(data, take);
+      }
+      entry_remaining_ -= take;
+      data += take;
+      size -= take;
+    } else {
+      size_t take = std::min<std::uint64_t>(size, padding_remaining_);
+      padding_remaining_ -= take;
+      data += take;
+      size -= take;
+    }
+    if (state_ == State::kEntryData && entry_remaining_ == 0 &&
+        padding_remaining_ == 0 && !FinishEntry()) {
+      state_ = State::kFailed;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TarStreamExtractor::ParseHeader() {
+  const char* header = header_.data();
+  if (std::all_of(header, header + kBlockSize,
+                  [](char byte) { return byte == 0; })) {
+    state_ = State::kDone;
+    return true;
+  }
+  if (!ValidChecksum(header)) {
+    LOG(ERROR) << "Corrupted tar header";
+    return false;
+  }
+  char type = header[156];
+  std::uint64_t size = ParseNumber(header + 124, 12);
+  if (has_pax_size_) {
+    size = pax_size_;
+    has_pax_size_ = false;
+  }
+  entry_remaining_ = size;
+  padding_remaining_ = (kBlockSize - size % kBlockSize) % kBlockSize;
+  state_ = State::kEntryData;
+  entry_type_ = EntryType::kSkipped;
+
+  if (type == kGnuLongName || type == kGnuLongLink || type == kPaxHeader) {
+    if (size > kMaxMetadataSize) {
+      LOG(ERROR) << "Tar metadata entry of " << size << " bytes";
+      return false;
+    }
+    entry_type_ = EntryType::kMetadata;
+    metadata_type_ = type;
+    metadata_.clear();
+    return true;
+  }
+
+  std::string name = std::move(long_name_);
+  std::string link = std::move(long_link_);
+  long_name_.clear();
+  long_link_.clear();
+  if (name.empty()) {
+    name = ParseString(header, 100);
+    // Only ustar archives have the prefix field
+    if (memcmp(header + 257, "ustar", 5) == 0 && header[345] != 0) {
+      name = ParseString(header + 345, 155) + "/" + name;
+    }
+  }
+  if (link.empty()) {
+    link = ParseString(header + 157, 100);
+  }
+  while (android::base::StartsWith(name, "./")) {
+    name = name.substr(2);
+  }
+  if (name.empty() || name == ".") {
+    return true;
+  }
+  if (!SafeName(name) || !NoSymlinkParents(name)) {
+    LOG(ERROR) << "Refusing to extract \"" << name << "\"";
+    return false;
+  }
+  auto path = directory_ + "/" + name;
+  switch (type) {
+    case kDirectory: {
+      auto dir = EnsureDirectoryExists(path);
+      if (!dir.ok()) {
+        LOG(ERROR) << dir.error();
+        return false;
+      }
+      extracted_.push_back(android::base::EndsWith(path, "/") ? path
+                                                              : path + "/");
+      return true;
+    }
+    case kSymlink:
+      return CreateSymlink(path, link);
+    case kHardLink:
+      while (android::base::StartsWith(link, "./")) {
+        link = link.substr(2);
+      }
+      if (!SafeName(link) || !NoSymlinkParents(link)) {
+        LOG(ERROR) << "Refusing to link to \"" << link << "\"";
+        return false;
+      }
+      return CreateHardLink(path, directory_ + "/" + link);
+    case kRegularFile:
+    case kOldRegularFile:
+    case kContiguousFile:
+      entry_type_ = EntryType::kFile;
+      return StartFile(path, size, ParseNumber(header + 100, 8) & 07777);
+    default:
+      LOG(WARNING) << "Skipping \"" << name << "\" of tar entry type "
+                   << type;
+      return true;
+  }
+}
+
+// A symlink on the way, e.g. one extracted earlier from the same archive,
+// would send the entry anywhere. Directories that don't exist yet are fine,
+// they are created as real ones.
+bool TarStreamExtractor::NoSymlinkParents(const std::string& name) {
+  auto components = android::base::Split(name, "/");
+  components.pop_back();
+  std::string relative;
+  for (const auto& component : components) {
+    if (component.empty() || component == ".") {
+      continue;
+    }
+    relative += (relative.empty() ? "" : "/") + component;
+    if (real_directories_.count(relative)) {
+      continue;
+    }
+    auto path = directory_ + "/" + relative;
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) {
+      if (errno == ENOENT) {
+        return true;
+      }
+      PLOG(ERROR) << "Could not check \"" << path << "\"";
+      return false;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+      LOG(ERROR) << "\"" << path << "\" is not a directory";
+      return false;
+    }
+    real_directories_.insert(relative);
+  }
+  return true;
+}
+
+// Created anew, a symlink already at the temporary path isn't followed
+bool TarStreamExtractor::OpenTempFile() {
+  if (unlink(temp_path_.c_str()) != 0 && errno != ENOENT) {
+    PLOG(ERROR) << "Could not remove \"" << temp_path_ << "\"";
+    return false;
+  }
+  out_.reset(open(temp_path_.c_str(),
+                  O_CREAT | O_EXCL | O_WRONLY | O_NOFOLLOW | O_CLOEXEC, 0644));
+  if (out_ < 0) {
+    PLOG(ERROR) << "Could not open \"" << temp_path_ << "\"";
+    return false;
+  }
+  return true;
+}
+
+bool TarStreamExtractor::StartFile(const std::string& path,
+                                   std::uint64_t size, mode_t mode) {
+  auto dir = EnsureDirectoryExists(cpp_dirname(path));
+  if (!dir.ok()) {
+    LOG(ERROR) << dir.error();
+    return false;
+  }
+  path_ = path;
+  temp_path_ = path + ".partial";
+  mode_ = mode;
+  offset_ = 0;
+  existing_.reset();
+  out_.reset();
+  // A file of the same size is compared as the data arrives instead
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) &&
+      static_cast<std::uint64_t>(st.st_size) == size) {
+    existing_.reset(open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC));
+  }
+  if (existing_ < 0 && !OpenTempFile()) {
+    return false;
+  }
+  extracted_.push_back(path);
+  return true;
+}
+
+bool TarStreamExtractor::FileData(const char* data, size_t size) {
+  if (existing_ >= 0) {
+    compare_buffer_.resize(size);
+    if (android::base::ReadFullyAtOffset(existing_.get(),
+                                         compare_buffer_.data(), size,
+                                         offset_) &&
+        memcmp(compare_buffer_.data(), data, size) == 0) {
+      offset_ += size;
+      return true;
+    }
+    // Keeps what matched so far and writes the rest
+    if (!OpenTempFile()) {
+      return false;
+    }
+    for (std::uint64_t copied = 0; copied < offset_;) {
+      size_t piece = std::min<std::uint64_t>(kChunkSize, offset_ - copied);
+      compare_buffer_.resize(piece);
+      if (!android::base::ReadFullyAtOffset(
+              existing_.get(), compare_buffer_.data(), piece, copied) ||
+          !android::base::WriteFully(out_.get(), compare_buffer_.data(),
+                                     piece)) {
+        PLOG(ERROR) << "Could not copy \"" << path_ << "\"";
+        return false;
+      }
+      copied += piece;
+    }
+    existing_.reset();
+  }
+  if (!android::base::WriteFully(out_.get(), data, size)) {
+    PLOG(ERROR) << "Could not write \"" << temp_path_ << "\"";
+    return false;
+  }
+  offset_ += size;
+  return true;
+}
+
+bool TarStreamExtractor::FinishFile() {
+  if (existing_ >= 0) {
+    struct stat st;
+    if (fstat(existing_.get(), &st) == 0 && (st.st_mode & 07777) != mode_ &&
+        fchmod(existing_.get(), mode_) != 0) {
+      PLOG(ERROR) << "Could not change the mode of \"" << path_ << "\"";
+      return false;
+    }
+    existing_.reset();
+    unchanged_++;
+    return true;
+  }
+  if (fchmod(out_.get(), mode_) != 0) {
+    PLOG(ERROR) << "Could not change the mode of \"" << temp_path_ << "\"";
+    return false;
+  }
+  out_.reset();
+  // Replacing rather than rewriting works for binaries that are running
+  if (rename(temp_path_.c_str(), path_.c_str()) != 0) {
+    PLOG(ERROR) << "Could not move \"" << temp_path_ << "\" to \"" << path_
+                << "\"";
+    return false;
+  }
+  return true;
+}
+
+bool TarStreamExtractor::FinishEntry() {
+  state_ = State::kHeader;
+  if (entry_type_ == EntryType::kFile) {
+    return FinishFile();
+  } else if (entry_type_ != EntryType::kMetadata) {
+    return true;
+  }
+  if (metadata_type_ == kGnuLongName) {
+    long_name_ = ParseString(metadata_.data(), metadata_.size());
+  } else if (metadata_type_ == kGnuLongLink) {
+    long_link_ = ParseString(metadata_.data(), metadata_.size());
+  } else {
+    // Records of "<length> <key>=<value>\n"
+    size_t position = 0;
+    while (position < metadata_.size()) {
+      auto space = metadata_.find(' ', position);
+      if (space == std::string::npos) {
+        break;
+      }
+      auto length = strtoull(metadata_.c_str() + position, nullptr, 10);
+      if (length <= space - position || position + length > metadata_.size()) {
+        LOG(ERROR) << "Corrupted pax header";
+        return false;
+      }
+      auto record = metadata_.substr(space + 1, position + length - space - 2);
+      auto equals = record.find('=');
+      if (equals != std::string::npos) {
+        auto key = record.substr(0, equals);
+        auto value = record.substr(equals + 1);
+        if (key == "path") {
+          long_name_ = value;
+        } else if (key == "linkpath") {
+          long_link_ = value;
+        } else if (key == "size") {
+          pax_size_ = strtoull(value.c_str(), nullptr, 10);
+          has_pax_size_ = true;
+        }
+      }
+      position += length;
+    }
+  }
+  metadata_.clear();
+  return true;
+}
+
+bool TarStreamExtractor::CreateSymlink(const std::string& path,
+                                       const std::string& target) {
+  auto dir = EnsureDirectoryExists(cpp_dirname(path));
+  if (!dir.ok()) {
+    LOG(ERROR) << dir.error();
+    return false;
+  }
+  extracted_.push_back(path);
+  char current[PATH_MAX];
+  auto length = readlink(path.c_str(), current, sizeof(current));
+  if (length >= 0 && target == std::string(current, length)) {
+    return true;
+  }
+  if (unlink(path.c_str()) != 0 && errno != ENOENT) {
+    PLOG(ERROR) << "Could not remove \"" << path << "\"";
+    return false;
+  }
+  if (symlink(target.c_str(), path.c_str()) != 0) {
+    PLOG(ERROR) << "Could not link \"" << path << "\" to \"" << target << "\"";
+    return false;
+  }
+  return true;
+}
+
+bool TarStreamExtractor::CreateHardLink(const std::string& path,
+                                        const std::string& target) {
+  auto dir = EnsureDirectoryExists(cpp_dirname(path));
+  if (!dir.ok()) {
+    LOG(ERROR) << dir.error();
+    return false;
+  }
+  extracted_.push_back(path);
+  if (unlink(path.c_str()) != 0 && errno != ENOENT) {
+    PLOG(ERROR) << "Could not remove \"" << path << "\"";
+    return false;
+  }
+  if (link(target.c_str(), path.c_str()) != 0) {
+    PLOG(ERROR) << "Could not link \"" << path << "\" to \"" << target << "\"";
+    return false;
+  }
+  return true;
+}
+
+} // namespace cuttlefish
@@ -0,0 +1,119 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <sys/types.h>
+#include <zlib.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <android-base/unique_fd.h>
+
+namespace cuttlefish {
+
+// Extracts a gzip compressed tar archive as its bytes arrive, without the
+// archive ever being on disk. The data is inflated on the thread delivering
+// it while another thread writes the files, so downloading, decompressing
+// and writing overlap.
+//
+// Files already in the directory are compared with the archive's as they
+// arrive and only replaced from the first difference on, so extracting over
+// a previous copy of the same archive doesn't write anything.
+class TarStreamExtractor {
+ public:
+  TarStreamExtractor(std::string directory);
+  ~TarStreamExtractor();
+
+  // Matches CurlWrapper::DataCallback, where null data restarts the archive.
+  bool Consume(char* data, size_t size);
+  // Whether the archive ended after its last entry
+  bool Finish();
+
+  // Paths of the extracted entries, directories end with '/'
+  const std::vector<std::string>& Extracted() const { return extracted_; }
+  // Files that were left alone because they already had the right contents
+  size_t Unchanged() const { return unchanged_; }
+
+ private:
+  enum class State { kHeader, kEntryData, kDone, kFailed };
+  enum class EntryType { kFile, kMetadata, kSkipped };
+
+  void StartWriter();
+  void StopWriter();
+  void WriterLoop();
+  bool StartInflating();
+
+  // Only called from the writer thread
+  bool Untar(const char* data, size_t size);
+  bool ParseHeader();
+  bool NoSymlinkParents(const std::string& name);
+  bool OpenTempFile();
+  bool StartFile(const std::string& path, std::uint64_t size, mode_t mode);
+  bool FileData(const char* data, size_t size);
+  bool FinishFile();
+  bool FinishEntry();
+  bool CreateSymlink(const std::string& path, const std::string& target);
+  bool CreateHardLink(const std::string& path, const std::string& target);
+
+  std::string directory_;
+  // Relative paths already checked to be directories rather than symlinks
+  std::set<std::string> real_directories_;
+  std::vector<std::string> extracted_;
+  size_t unchanged_ = 0;
+
+  // Inflated data on its way to the writer thread
+  std::mutex queue_mutex_;
+  std::condition_variable queue_cv_;
+  std::deque<std::vector<char>> queue_;
+  bool input_done_ = false;
+  bool writer_failed_ = false;
+  std::thread writer_;
+
+  z_stream inflate_ = {};
+  bool inflating_ = false;
+  bool inflate_done_ = false;
+
+  State state_ = State::kHeader;
+  std::string header_;
+  EntryType entry_type_ = EntryType::kSkipped;
+  std::uint64_t entry_remaining_ = 0;
+  std::uint64_t padding_remaining_ = 0;
+  // Long names and pax headers apply to the entry after them
+  char metadata_type_ = 0;
+  std::string metadata_;
+  std::string long_name_;
+  std::string long_link_;
+  bool has_pax_size_ = false;
+  std::uint64_t pax_size_ = 0;
+
+  // The regular file being written
+  std::string path_;
+  std::string temp_path_;
+  mode_t mode_ = 0;
+  std::uint64_t offset_ = 0;
+  android::base::unique_fd existing_;
+  android::base::unique_fd out_;
+  std::vector<char> compare_buffer_;
+};
+
+} // namespace cuttlefish
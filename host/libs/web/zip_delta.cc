@@ -0,0 +1,415 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/libs/web/zip_delta.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+#include <android-base/unique_fd.h>
+
+#include "common/libs/utils/files.h"
+#include "host/libs/web/zip_stream.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr std::uint32_t kCentralHeaderSignature = 0x02014b50;
+constexpr std::uint32_t kEndOfCentralDirSignature = 0x06054b50;
+constexpr std::uint32_t kZip64EndOfCentralDirSignature = 0x06064b50;
+constexpr std::uint32_t kZip64LocatorSignature = 0x07064b50;
+constexpr size_t kCentralHeaderSize = 46;
+constexpr size_t kEndOfCentralDirSize = 22;
+constexpr size_t kZip64EndOfCentralDirSize = 56;
+constexpr size_t kZip64LocatorSize = 20;
+constexpr std::uint16_t kZip64ExtraId = 0x0001;
+// Usually covers the central directory of an img zip, which has few entries
+constexpr std::uint64_t kTailSize = 128 << 10;
+// Entries to skip between two to download that are cheaper to download along
+// with them than to request separately
+constexpr std::uint64_t kMaxGap = 1 << 20;
+constexpr size_t kBufferSize = 1 << 20;
+// Zero blocks this size are left as holes in the copied files
+constexpr size_t kBlockSize = 4096;
+
+std::uint16_t Read16(const char* data) {
+  auto bytes = reinterpret_cast<const std::uint8_t*>(data);
+  return bytes[0] | (bytes[1] << 8);
+}
+
+std::uint32_t Read32(const char* data) {
+  return Read16(data) | (static_cast<std::uint32_t>(Read16(data + 2)) << 16);
+}
+
+std::uint64_t Read64(const char* data) {
+  return Read32(data) | (static_cast<std::uint64_t>(Read32(data + 4)) << 32);
+}
+
+bool IsZero(const char* data, size_t size) {
+  return size > 0 && data[0] == 0 && memcmp(data, data + 1, size - 1) == 0;
+}
+
+// Whether the file has the given size and CRC32
+bool HasContents(const std::string& path, std::uint64_t size,
+                 std::uint32_t crc) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) ||
+      static_cast<std::uint64_t>(st.st_size) != size) {
+    return false;
+  }
+  android::base::unique_fd fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd < 0) {
+    return false;
+  }
+  std::vector<char> buffer(kBufferSize);
+  std::uint32_t actual_crc = crc32(0, nullptr, 0);
+  std::uint64_t read_size = 0;
+  while (read_size < size) {
+    auto bytes = TEMP_FAILURE_RETRY(read(fd.get(), buffer.data(), buffer.size()));
+    if (bytes <= 0) {
+      return false;
+    }
+    actual_crc = crc32(actual_crc, reinterpret_cast<const Bytef*>(buffer.data()),
+                       bytes);
+    read_size += bytes;
+  }
+  return read_size == size && actual_crc == crc;
+}
+
+bool CopySparse(const std::string& from, const std::string& to) {
+  android::base::unique_fd in(open(from.c_str(), O_RDONLY | O_CLOEXEC));
+  if (in < 0) {
+    PLOG(ERROR) << "Could not open \"" << from << "\"";
+    return false;
+  }
+  android::base::unique_fd out(
+      open(to.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644));
+  if (out < 0) {
+    PLOG(ERROR) << "Could not open \"" << to << "\"";
+    return false;
+  }
+  std::vector<char> buffer(kBufferSize);
+  std::uint64_t offset = 0;
+  while (true) {
+    auto bytes = TEMP_FAILURE_RETRY(read(in.get(), buffer.data(), buffer.size()));
+    if (bytes < 0) {
+      PLOG(ERROR) << "Could not read \"" << from << "\"";
+      return false;
+    } else if (bytes == 0) {
+      break;
+    }
+    for (ssize_t i = 0; i < bytes; i += kBlockSize) {
+      size_t block = std::min<size_t>(kBlockSize, bytes - i);
+      if (!IsZero(buffer.data() + i, block) &&
+          !android::base::WriteFullyAtOffset(out.get(), buffer.data() + i,
+                                             block, offset + i)) {
+        PLOG(ERROR) << "Could not write \"" << to << "\"";
+        return false;
+      }
+    }
+    offset += bytes;
+  }
+  // Covers trailing holes
+  if (ftruncate(out.get(), offset) != 0) {
+    PLOG(ERROR) << "Could not resize \"" << to << "\"";
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+ZipDeltaFetcher::ZipDeltaFetcher(CurlWrapper& curl, std::string url)
+    : curl_(curl), url_(std::move(url)) {}
+
+bool ZipDeltaFetcher::FetchRange(std::uint64_t begin, std::uint64_t end,
+                                 std::string* data) {
+  data->clear();
+  auto callback = [this, data](char* bytes, size_t size) {
+    if (bytes == nullptr) {
+      data->clear();
+      return true;
+    }
+    data->append(bytes, size);
+    downloaded_bytes_ += size;
+    return true;
+  };
+  if (begin >= end) {
+    LOG(ERROR) << "Invalid archive range " << begin << "-" << end;
+    return false;
+  }
+  // `end` is exclusive, the range's last byte is not
+  auto range = std::to_string(begin) + "-" + std::to_string(end - 1);
+  if (!curl_.DownloadRangeToCallback(callback, url_, range, &archive_size_)
+           .HttpSuccess()) {
+    LOG(ERROR) << "Could not download bytes " << range << " of the archive";
+    return false;
+  }
+  if (data->size() != end - begin) {
+    LOG(ERROR) << "Got " << data->size() << " bytes instead of "
+               << end - begin;
+    return false;
+  }
+  return true;
+}
+
+bool ZipDeltaFetcher::ReadCentralDirectory() {
+  std::string tail;
+  auto callback = [this, &tail](char* bytes, size_t size) {
+    if (bytes == nullptr) {
+      tail.clear();
+      return true;
+    }
+    tail.append(bytes, size);
+    downloaded_bytes_ += size;
+    return true;
+  };
+  if (!curl_.DownloadRangeToCallback(callback, url_,
+                                     "-" + std::to_string(kTailSize),
+                                     &archive_size_)
+           .HttpSuccess()) {
+    LOG(ERROR) << "Could not download the end of the archive";
+    return false;
+  }
+  if (tail.size() < kEndOfCentralDirSize || tail.size() > archive_size_) {
+    LOG(ERROR) << "The archive is too small to be a zip";
+    return false;
+  }
+  const std::uint64_t tail_start = archive_size_ - tail.size();
+
+  // Followed by a comment of up to 64K
+  size_t eocd = tail.size() - kEndOfCentralDirSize;
+  while (Read32(tail.data() + eocd) != kEndOfCentralDirSignature ||
+         eocd + kEndOfCentralDirSize + Read16(tail.data() + eocd + 20) !=
+             tail.size()) {
+    if (eocd == 0) {
+      LOG(ERROR) << "Could not find the end of the zip central directory";
+      return false;
+    }
+    eocd--;
+  }
+  std::uint64_t entry_count = Read16(tail.data() + eocd + 10);
+  std::uint64_t directory_size = Read32(tail.data() + eocd + 12);
+  std::uint64_t directory_offset = Read32(tail.data() + eocd + 16);
+  if (entry_count == 0xFFFF || directory_size == 0xFFFFFFFF ||
+      directory_offset == 0xFFFFFFFF) {
+    if (eocd < kZip64LocatorSize ||
+        Read32(tail.data() + eocd - kZip64LocatorSize) !=
+            kZip64LocatorSignature) {
+      LOG(ERROR) << "Missing the zip64 end of central directory locator";
+      return false;
+    }
+    auto zip64_offset = Read64(tail.data() + eocd - kZip64LocatorSize + 8);
+    std::string zip64_eocd;
+    if (zip64_offset >= tail_start &&
+        zip64_offset - tail_start + kZip64EndOfCentralDirSize <= tail.size()) {
+      zip64_eocd = tail.substr(zip64_offset - tail_start,
+                               kZip64EndOfCentralDirSize);
+    } else if (!FetchRange(zip64_offset,
+                           zip64_offset + kZip64EndOfCentralDirSize,
+                           &zip64_eocd)) {
+      return false;
+    }
+    if (Read32(zip64_eocd.data()) != kZip64EndOfCentralDirSignature) {
+      LOG(ERROR) << "Invalid zip64 end of central directory";
+      return false;
+    }
+    entry_count = Read64(zip64_eocd.data() + 32);
+    directory_size = Read64(zip64_eocd.data() + 40);
+    directory_offset = Read64(zip64_eocd.data() + 48);
+  }
+  if (directory_offset > archive_size_ ||
+      directory_size > archive_size_ - directory_offset) {
+    LOG(ERROR) << "The zip central directory is out of the archive";
+    return false;
+  }
+  std::string directory;
+  if (directory_offset >= tail_start) {
+    directory = tail.substr(directory_offset - tail_start, directory_size);
+  } else if (!FetchRange(directory_offset, directory_offset + directory_size,
+                         &directory)) {
+    return false;
+  }
+
+  entries_.clear();
+  size_t position = 0;
+  for (std::uint64_t i = 0; i < entry_count; i++) {
+    const char* header = directory.data() + position;
+    if (position + kCentralHeaderSize > directory.size() ||
+        Read32(header) != kCentralHeaderSignature) {
+      LOG(ERROR) << "Invalid zip central directory entry " << i;
+      return false;
+    }
+    auto name_size = Read16(header + 28);
+    auto extra_size = Read16(header + 30);
+    auto comment_size = Read16(header + 32);
+    if (position + kCentralHeaderSize + name_size + extra_size +
+            comment_size > directory.size()) {
+      LOG(ERROR) << "Truncated zip central directory entry " << i;
+      return false;
+    }
+    Entry entry;
+    entry.name = directory.substr(position + kCentralHeaderSize, name_size);
+    entry.crc = Read32(header + 16);
+    std::uint64_t compressed_size = Read32(header + 20);
+    entry.uncompressed_size = Read32(header + 24);
+    entry.offset = Read32(header + 42);
+    // Only has the fields that didn't fit, in this order
+    const char* extra = header + kCentralHeaderSize + name_size;
+    for (size_t j = 0; j + 4 <= extra_size;) {
+      auto id = Read16(extra + j);
+      auto size = Read16(extra + j + 2);
+      if (id == kZip64ExtraId && j + 4 + size <= extra_size) {
+        const char* field = extra + j + 4;
+        const char* fields_end = field + size;
+        for (auto value : {&entry.uncompressed_size, &compressed_size,
+                           &entry.offset}) {
+          if (*value == 0xFFFFFFFF && field + 8 <= fields_end) {
+            *value = Read64(field);
+            field += 8;
+          }
+        }
+      }
+      j += 4 + size;
+    }
+    if (entry.offset >= directory_offset) {
+      LOG(ERROR) << "\"" << entry.name << "\" is out of the archive";
+      return false;
+    }
+    entries_.push_back(entry);
+    position += kCentralHeaderSize + name_size + extra_size + comment_size;
+  }
+  std::sort(entries_.begin(), entries_.end(),
+            [](const Entry& a, const Entry& b) { return a.offset < b.offset; });
+  for (size_t i = 0; i < entries_.size(); i++) {
+    entries_[i].end =
+        i + 1 < entries_.size() ? entries_[i + 1].offset : directory_offset;
+  }
+  return true;
+}
+
+bool ZipDeltaFetcher::FetchEntries(const std::string& directory,
+                                   const std::vector<Entry>& entries) {
+  // In archive order, runs of entries close to each other share a request
+  size_t first = 0;
+  while (first < entries.size()) {
+    size_t last = first;
+    while (last + 1 < entries.size() &&
+           entries[last + 1].offset - entries[last].end <= kMaxGap) {
+      last++;
+    }
+    std::vector<std::string> names;
+    for (size_t i = first; i <= last; i++) {
+      names.push_back(entries[i].name);
+    }
+    ZipStreamExtractor extractor(directory, names);
+    auto callback = [this, &extractor](char* data, size_t size) {
+      if (data != nullptr) {
+        downloaded_bytes_ += size;
+      }
+      return extractor.Consume(data, size);
+    };
+    auto begin = entries[first].offset;
+    auto end = entries[last].end;
+    auto range = std::to_string(begin) + "-" + std::to_string(end - 1);
+    if (!curl_.DownloadRangeToCallback(callback, url_, range, nullptr)
+             .HttpSuccess() ||
+        !extractor.AtEntryBoundary()) {
+      LOG(ERROR) << "Could not extract bytes " << range << " of the archive";
+      return false;
+    }
+    if (extractor.Extracted().size() != names.size()) {
+      LOG(ERROR) << "Bytes " << range << " of the archive were missing "
+                 << "some of its entries";
+      return false;
+    }
+    for (const auto& path : extractor.Extracted()) {
+      extracted_.push_back(path);
+    }
+    first = last + 1;
+  }
+  return true;
+}
+
+bool ZipDeltaFetcher::Fetch(const std::string& directory,
+                            const std::string& base_directory,
+                            const std::vector<std::string>& files) {
+  extracted_.clear();
+  reused_bytes_ = 0;
+  downloaded_bytes_ = 0;
+  if (!ReadCentralDirectory()) {
+    return false;
+  }
+  for (const auto& file : files) {
+    auto has_name = [&file](const Entry& e) { return e.name == file; };
+    if (std::find_if(entries_.begin(), entries_.end(), has_name) ==
+        entries_.end()) {
+      LOG(ERROR) << "Could not find " << file << " in the archive";
+      return false;
+    }
+  }
+  std::vector<Entry> to_fetch;
+  for (const auto& entry : entries_) {
+    if (!files.empty() &&
+        std::find(files.begin(), files.end(), entry.name) == files.end()) {
+      continue;
+    }
+    if (entry.name.find("..") != std::string::npos || entry.name.empty() ||
+        entry.name[0] == '/') {
+      LOG(ERROR) << "Refusing to extract \"" << entry.name << "\"";
+      return false;
+    }
+    if (android::base::EndsWith(entry.name, "/")) {
+      auto dir = EnsureDirectoryExists(directory + "/" + entry.name);
+      if (!dir.ok()) {
+        LOG(ERROR) << dir.error();
+        return false;
+      }
+      continue;
+    }
+    auto path = directory + "/" + entry.name;
+    if (HasContents(path, entry.uncompressed_size, entry.crc)) {
+      extracted_.push_back(path);
+      reused_bytes_ += entry.uncompressed_size;
+      continue;
+    }
+    auto base_path = base_directory + "/" + entry.name;
+    if (!base_directory.empty() && base_directory != directory &&
+        HasContents(base_path, entry.uncompressed_size, entry.crc)) {
+      auto dir = EnsureDirectoryExists(path.substr(0, path.rfind('/')));
+      if (!dir.ok()) {
+        LOG(ERROR) << dir.error();
+        return false;
+      }
+      if (CopySparse(base_path, path)) {
+        extracted_.push_back(path);
+        reused_bytes_ += entry.uncompressed_size;
+        continue;
+      }
+    }
+    to_fetch.push_back(entry);
+  }
+  return FetchEntries(directory, to_fetch);
+}
+
+} // namespace cuttlefish
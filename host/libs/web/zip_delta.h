@@ -0,0 +1,72 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "host/libs/web/curl_wrapper.h"
+
+namespace cuttlefish {
+
+// Extracts a zip archive from a server that accepts range requests, only
+// downloading the entries that aren't on disk already. The central directory
+// at the end of the archive gives the size and CRC32 of every entry, and a
+// file with both, at the entry's path in the target directory or in a base
+// directory holding a previous extraction, is used instead of downloading
+// the entry. Consecutive entries to download are fetched in one request.
+class ZipDeltaFetcher {
+ public:
+  ZipDeltaFetcher(CurlWrapper& curl, std::string url);
+
+  // Extracts only `files` when it's not empty. The base directory may be
+  // empty or the target directory itself.
+  bool Fetch(const std::string& directory, const std::string& base_directory,
+             const std::vector<std::string>& files);
+
+  // Paths of the extracted files, including those that were reused
+  const std::vector<std::string>& Extracted() const { return extracted_; }
+  // Uncompressed bytes of the entries that didn't need downloading
+  std::uint64_t ReusedBytes() const { return reused_bytes_; }
+  // Bytes of the archive that were downloaded
+  std::uint64_t DownloadedBytes() const { return downloaded_bytes_; }
+
+ private:
+  struct Entry {
+    std::string name;
+    std::uint32_t crc;
+    std::uint64_t uncompressed_size;
+    std::uint64_t offset;
+    // Where the next entry or the central directory starts
+    std::uint64_t end;
+  };
+
+  bool FetchRange(std::uint64_t begin, std::uint64_t end, std::string* data);
+  bool ReadCentralDirectory();
+  bool FetchEntries(const std::string& directory,
+                    const std::vector<Entry>& entries);
+
+  CurlWrapper& curl_;
+  std::string url_;
+  std::uint64_t archive_size_ = 0;
+  std::vector<Entry> entries_;
+  std::vector<std::string> extracted_;
+  std::uint64_t reused_bytes_ = 0;
+  std::uint64_t downloaded_bytes_ = 0;
+};
+
+} // namespace cuttlefish
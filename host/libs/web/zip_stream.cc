@@ -0,0 +1,372 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "host/libs/web/zip_stream.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+
+#include "common/libs/utils/files.h"
+
+namespace cuttlefish {
+namespace {
+
+constexpr std::uint32_t kLocalHeaderSignature = 0x04034b50;
+constexpr std::uint32_t kCentralHeaderSignature = 0x02014b50;
+constexpr std::uint32_t kEndOfCentralDirSignature = 0x06054b50;
+constexpr std::uint32_t kDescriptorSignature = 0x08074b50;
+constexpr size_t kLocalHeaderSize = 30;
+constexpr std::uint16_t kDescriptorFlag = 1 << 3;
+constexpr std::uint16_t kZip64ExtraId = 0x0001;
+constexpr std::uint16_t kStored = 0;
+constexpr std::uint16_t kDeflated = 8;
+// Zero blocks this size are left as holes in the extracted files
+constexpr size_t kBlockSize = 4096;
+
+std::uint16_t Read16(const char* data) {
+  auto bytes = reinterpret_cast<const std::uint8_t*>(data);
+  return bytes[0] | (bytes[1] << 8);
+}
+
+std::uint32_t Read32(const char* data) {
+  return Read16(data) | (static_cast<std::uint32_t>(Read16(data + 2)) << 16);
+}
+
+std::uint64_t Read64(const char* data) {
+  return Read32(data) | (static_cast<std::uint64_t>(Read32(data + 4)) << 32);
+}
+
+bool IsZero(const char* data, size_t size) {
+  return size > 0 && data[0] == 0 && memcmp(data, data + 1, size - 1) == 0;
+}
+
+} // namespace
+
+ZipStreamExtractor::ZipStreamExtractor(std::string directory,
+                                       std::vector<std::string> files)
+    : directory_(std::move(directory)), files_(std::move(files)),
+      inflated_(1 << 20) {}
+
+ZipStreamExtractor::~ZipStreamExtractor() {
+  if (inflating_) {
+    inflateEnd(&inflate_);
+  }
+}
+
+void ZipStreamExtractor::Reset() {
+  if (inflating_) {
+    inflateEnd(&inflate_);
+    inflating_ = false;
+  }
+  out_.reset();
+  state_ = State::kHeader;
+  buffer_.clear();
+  block_.clear();
+  extracted_.clear();
+}
+
+size_t ZipStreamExtractor::BytesNeeded() const {
+  if (state_ == State::kHeader) {
+    if (buffer_.size() < 4) {
+      // The signature tells whether the entries are over
+      return 4;
+    } else if (buffer_.size() < kLocalHeaderSize) {
+      return kLocalHeaderSize;
+    }
+    return kLocalHeaderSize + Read16(buffer_.data() + 26) +
+           Read16(buffer_.data() + 28);
+  }
+  // The descriptor's signature is optional
+  size_t sizes = zip64_ ? 16 : 8;
+  if (buffer_.size() < 4) {
+    return 4;
+  }
+  return (Read32(buffer_.data()) == kDescriptorSignature ? 8 : 4) + sizes;
+}
+
+bool ZipStreamExtractor::Consume(char* data, size_t size) {
+  if (data == nullptr) {
+    Reset();
+    return true;
+  }
+  while (size > 0) {
+    if (state_ == State::kFailed) {
+      return false;
+    } else if (state_ == State::kDone) {
+      // The central directory repeats what the local headers had
+      return true;
+    } else if (state_ == State::kEntryData) {
+      size_t used = 0;
+      if (!EntryData(data, size, &used)) {
+        state_ = State::kFailed;
+        return false;
+      }
+      data += used;
+      size -= used;
+      continue;
+    }
+    if (state_ == State::kHeader && buffer_.size() >= 4 &&
+        Read32(buffer_.data()) != kLocalHeaderSignature) {
+      auto signature = Read32(buffer_.data());
+      if (signature != kCentralHeaderSignature &&
+          signature != kEndOfCentralDirSignature) {
+        LOG(ERROR) << "Unexpected zip record " << std::hex << signature;
+        state_ = State::kFailed;
+        return false;
+      }
+      state_ = State::kDone;
+      continue;
+    }
+    size_t need = BytesNeeded();
+    size_t take = std::min(size, need - buffer_.size());
+    buffer_.append(data, take);
+    data += take;
+    size -= take;
+    if (buffer_.size() < 4 || BytesNeeded() > buffer_.size()) {
+      // Still short, or now knows it needs more
+      continue;
+    }
+    bool parsed =
+        state_ == State::kHeader ? ParseHeader() : ParseDescriptor();
+    buffer_.clear();
+    if (!parsed) {
+      state_ = State::kFailed;
+      return false;
+    }
+  }
+  return state_ != State::kFailed;
+}
+
+bool ZipStreamExtractor::ParseHeader() {
+  const char* header = buffer_.data();
+  flags_ = Read16(header + 6);
+  method_ = Read16(header + 8);
+  crc_ = Read32(header + 14);
+  compressed_size_ = Read32(header + 18);
+  uncompressed_size_ = Read32(header + 22);
+  auto name_size = Read16(header + 26);
+  auto extra_size = Read16(header + 28);
+  name_ = buffer_.substr(kLocalHeaderSize, name_size);
+  zip64_ = false;
+  const char* extra = header + kLocalHeaderSize + name_size;
+  for (size_t i = 0; i + 4 <= extra_size;) {
+    auto id = Read16(extra + i);
+    auto size = Read16(extra + i + 2);
+    if (id == kZip64ExtraId && size >= 16 && i + 4 + size <= extra_size) {
+      zip64_ = true;
+      uncompressed_size_ = Read64(extra + i + 4);
+      compressed_size_ = Read64(extra + i + 12);
+    }
+    i += 4 + size;
+  }
+  if (method_ != kStored && method_ != kDeflated) {
+    LOG(ERROR) << "\"" << name_ << "\" has unsupported compression " << method_;
+    return false;
+  }
+  if (method_ == kStored && (flags_ & kDescriptorFlag)) {
+    // Nothing marks where the data ends
+    LOG(ERROR) << "\"" << name_ << "\" is stored without its size";
+    return false;
+  }
+  if (name_.find("..") != std::string::npos || name_.empty() ||
+      name_[0] == '/') {
+    LOG(ERROR) << "Refusing to extract \"" << name_ << "\"";
+    return false;
+  }
+  compressed_read_ = 0;
+  written_ = 0;
+  block_.clear();
+  actual_crc_ = crc32(0, nullptr, 0);
+  bool wanted = files_.empty() ||
+                std::find(files_.begin(), files_.end(), name_) != files_.end();
+  if (wanted && android::base::EndsWith(name_, "/")) {
+    auto dir = EnsureDirectoryExists(directory_ + "/" + name_);
+    if (!dir.ok()) {
+      LOG(ERROR) << dir.error();
+      return false;
+    }
+  } else if (wanted) {
+    auto path = directory_ + "/" + name_;
+    auto slash = path.rfind('/');
+    auto dir = EnsureDirectoryExists(path.substr(0, slash));
+    if (!dir.ok()) {
+      LOG(ERROR) << dir.error();
+      return false;
+    }
+    out_.reset(open(path.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC,
+                    0644));
+    if (out_ < 0) {
+      PLOG(ERROR) << "Could not open \"" << path << "\"";
+      return false;
+    }
+    extracted_.push_back(path);
+  }
+  if (method_ == kDeflated) {
+    inflate_ = {};
+    // Raw deflate data, zip has its own framing
+    if (inflateInit2(&inflate_, -MAX_WBITS) != Z_OK) {
+      LOG(ERROR) << "Could not start inflating \"" << name_ << "\"";
+      return false;
+    }
+    inflating_ = true;
+  }
+  state_ = State::kEntryData;
+  if (method_ == kStored && compressed_size_ == 0) {
+    return FinishEntry();
+  }
+  return true;
+}
+
+bool ZipStreamExtractor::EntryData(const char* data, size_t size,
+                                   size_t* used) {
+  if (method_ == kStored) {
+    *used = std::min<std::uint64_t>(size, compressed_size_ - compressed_read_);
+    compressed_read_ += *used;
+    if (!Output(data, *used)) {
+      return false;
+    }
+    return compressed_read_ < compressed_size_ || FinishEntry();
+  }
+  inflate_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+  inflate_.avail_in = size;
+  int result = Z_OK;
+  while (inflate_.avail_in > 0 && result != Z_STREAM_END) {
+    inflate_.next_out = reinterpret_cast<Bytef*>(inflated_.data());
+    inflate_.avail_out = inflated_.size();
+    result = inflate(&inflate_, Z_NO_FLUSH);
+    if (result != Z_OK && result != Z_STREAM_END) {
+      LOG(ERROR) << "Could not inflate \"" << name_ << "\": " << result;
+      return false;
+    }
+    if (!Output(inflated_.data(), inflated_.size() - inflate_.avail_out)) {
+      return false;
+    }
+  }
+  *used = size - inflate_.avail_in;
+  compressed_read_ += *used;
+  if (result != Z_STREAM_END) {
+    return true;
+  }
+  inflateEnd(&inflate_);
+  inflating_ = false;
+  return FinishEntry();
+}
+
+bool ZipStreamExtractor::Output(const char* data, size_t size) {
+  actual_crc_ = crc32(actual_crc_, reinterpret_cast<const Bytef*>(data), size);
+  if (out_ < 0) {
+    written_ += size;
+    return true;
+  }
+  while (size > 0) {
+    // Whole zero blocks are skipped, partial ones wait for the rest of their
+    // bytes.
+    size_t piece = std::min(size, kBlockSize - block_.size());
+    if (piece == kBlockSize) {
+      written_ += piece;
+      if (!IsZero(data, piece) && !WriteBlock(data, piece)) {
+        return false;
+      }
+    } else {
+      block_.append(data, piece);
+      written_ += piece;
+      if (block_.size() == kBlockSize) {
+        if (!IsZero(block_.data(), kBlockSize) &&
+            !WriteBlock(block_.data(), kBlockSize)) {
+          return false;
+        }
+        block_.clear();
+      }
+    }
+    data += piece;
+    size -= piece;
+  }
+  return true;
+}
+
+bool ZipStreamExtractor::WriteBlock(const char* data, size_t size) {
+  // Blocks are written once all of their bytes are counted
+  if (!android::base::WriteFullyAtOffset(out_.get(), data, size,
+                                         written_ - size)) {
+    PLOG(ERROR) << "Could not write \"" << name_ << "\"";
+    return false;
+  }
+  return true;
+}
+
+bool ZipStreamExtractor::FinishEntry() {
+  if (out_ >= 0) {
+    if (!block_.empty() && !WriteBlock(block_.data(), block_.size())) {
+      return false;
+    }
+    block_.clear();
+    // Covers trailing holes
+    if (ftruncate(out_.get(), written_) != 0) {
+      PLOG(ERROR) << "Could not resize \"" << name_ << "\"";
+      return false;
+    }
+    out_.reset();
+  }
+  if (flags_ & kDescriptorFlag) {
+    state_ = State::kDescriptor;
+    return true;
+  }
+  state_ = State::kHeader;
+  if (compressed_read_ != compressed_size_ || written_ != uncompressed_size_ ||
+      actual_crc_ != crc_) {
+    LOG(ERROR) << "\"" << name_ << "\" doesn't match its zip header";
+    return false;
+  }
+  return true;
+}
+
+bool ZipStreamExtractor::ParseDescriptor() {
+  const char* descriptor = buffer_.data();
+  if (Read32(descriptor) == kDescriptorSignature) {
+    descriptor += 4;
+  }
+  crc_ = Read32(descriptor);
+  compressed_size_ = zip64_ ? Read64(descriptor + 4) : Read32(descriptor + 4);
+  uncompressed_size_ =
+      zip64_ ? Read64(descriptor + 12) : Read32(descriptor + 8);
+  state_ = State::kHeader;
+  if (compressed_read_ != compressed_size_ || written_ != uncompressed_size_ ||
+      actual_crc_ != crc_) {
+    LOG(ERROR) << "\"" << name_ << "\" doesn't match its data descriptor";
+    return false;
+  }
+  return true;
+}
+
+bool ZipStreamExtractor::AtEntryBoundary() const {
+  return state_ == State::kHeader && buffer_.empty();
+}
+
+bool ZipStreamExtractor::Finish() {
+  if (state_ != State::kDone) {
+    LOG(ERROR) << "The zip archive ended early";
+    return false;
+  }
+  return true;
+}
+
+} // namespace cuttlefish
@@ -0,0 +1,85 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <zlib.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <android-base/unique_fd.h>
+
+namespace cuttlefish {
+
+// Extracts a zip archive as its bytes arrive, without the whole archive ever
+// being on disk. Entries are read from their local headers, the central
+// directory at the end is not needed.
+class ZipStreamExtractor {
+ public:
+  // Extracts only `files` when it's not empty.
+  ZipStreamExtractor(std::string directory, std::vector<std::string> files);
+  ~ZipStreamExtractor();
+
+  // Matches CurlWrapper::DataCallback, where null data restarts the archive.
+  bool Consume(char* data, size_t size);
+  // Whether the archive ended after its last entry
+  bool Finish();
+  // Whether the data so far ends right after an entry, for when only a range
+  // of the archive's entries is consumed.
+  bool AtEntryBoundary() const;
+
+  // Paths of the extracted files
+  const std::vector<std::string>& Extracted() const { return extracted_; }
+
+ private:
+  enum class State { kHeader, kEntryData, kDescriptor, kDone, kFailed };
+
+  void Reset();
+  size_t BytesNeeded() const;
+  bool ParseHeader();
+  bool ParseDescriptor();
+  bool EntryData(const char* data, size_t size, size_t* used);
+  bool Output(const char* data, size_t size);
+  bool WriteBlock(const char* data, size_t size);
+  bool FinishEntry();
+
+  std::string directory_;
+  std::vector<std::string> files_;
+  std::vector<std::string> extracted_;
+
+  State state_ = State::kHeader;
+  std::string buffer_;
+
+  // The entry being read
+  std::string name_;
+  std::uint16_t flags_ = 0;
+  std::uint16_t method_ = 0;
+  std::uint32_t crc_ = 0;
+  std::uint64_t compressed_size_ = 0;
+  std::uint64_t uncompressed_size_ = 0;
+  bool zip64_ = false;
+  std::uint64_t compressed_read_ = 0;
+  std::uint64_t written_ = 0;
+  std::uint32_t actual_crc_ = 0;
+  android::base::unique_fd out_;
+  std::string block_;
+  z_stream inflate_ = {};
+  bool inflating_ = false;
+  std::vector<char> inflated_;
+};
+
+} // namespace cuttlefish
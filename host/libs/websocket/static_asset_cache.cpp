@@ -0,0 +1,218 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "host/libs/websocket/static_asset_cache.h"
+
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+#include <android-base/file.h>
+#include <android-base/logging.h>
+#include <android-base/strings.h>
+
+namespace cuttlefish {
+namespace {
+
+// Smaller files don't gain enough to pay for the extra header and CPU
+constexpr size_t kMinCompressSize = 1024;
+
+const std::unordered_map<std::string, std::string> kMimeTypes = {
+    {".html", "text/html"},
+    {".css", "text/css"},
+    {".js", "application/javascript"},
+    {".json", "application/json"},
+    {".txt", "text/plain"},
+    {".svg", "image/svg+xml"},
+    {".png", "image/png"},
+    {".jpg", "image/jpeg"},
+    {".ico", "image/x-icon"},
+    {".woff2", "font/woff2"},
+    {".crt", "application/x-x509-ca-cert"},
+    {".pem", "application/x-pem-file"},
+};
+
+std::string MimeType(const std::string& path) {
+  auto dot = path.rfind('.');
+  if (dot != std::string::npos) {
+    auto it = kMimeTypes.find(path.substr(dot));
+    if (it != kMimeTypes.end()) {
+      return it->second;
+    }
+  }
+  return "application/octet-stream";
+}
+
+bool IsCompressible(const std::string& mime_type) {
+  return android::base::StartsWith(mime_type, "text/") ||
+         mime_type == "application/javascript" ||
+         mime_type == "application/json" || mime_type == "image/svg+xml";
+}
+
+// Strong validator derived from the content, so it remains stable across
+// restarts and hosts serving the same files.
+std::string ETag(const std::string& content) {
+  // FNV-1a
+  uint64_t hash = 14695981039346656037ull;
+  for (unsigned char c : content) {
+    hash = (hash ^ c) * 1099511628211ull;
+  }
+  std::stringstream ss;
+  ss << '"' << std::hex << std::setfill('0') << std::setw(16) << hash << '"';
+  return ss.str();
+}
+
+// Returns an empty string on failure
+std::string GzipCompress(const std::string& data) {
+  z_stream stream = {};
+  // 16 + MAX_WBITS selects the gzip wrapper instead of the zlib one
+  if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    LOG(ERROR) << "Failed to initialize gzip stream";
+    return "";
+  }
+  std::string compressed(deflateBound(&stream, data.size()), '\0');
+  stream.next_in =
+      reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = data.size();
+  stream.next_out = reinterpret_cast<Bytef*>(compressed.data());
+  stream.avail_out = compressed.size();
+  auto res = deflate(&stream, Z_FINISH);
+  deflateEnd(&stream);
+  if (res != Z_STREAM_END) {
+    LOG(ERROR) << "Failed to gzip compress asset: " << res;
+    return "";
+  }
+  compressed.resize(stream.total_out);
+  return compressed;
+}
+
+// Whether an Accept-Encoding header value allows the given coding. Codings
+// explicitly refused with q=0 are not allowed.
+bool AcceptsEncoding(const std::string& accept_encoding,
+                     const std::string& encoding) {
+  for (const auto& entry : android::base::Split(accept_encoding, ",")) {
+    auto params = android::base::Split(entry, ";");
+    if (android::base::Trim(params[0]) != encoding) {
+      continue;
+    }
+    for (size_t i = 1; i < params.size(); i++) {
+      auto param = android::base::Trim(params[i]);
+      if (android::base::StartsWith(param, "q=") &&
+          std::strtod(param.c_str() + 2, nullptr) == 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+const StaticAssetCache::Variant& StaticAssetCache::Asset::SelectVariant(
+    const std::string& accept_encoding) const {
+  const Variant* best = &identity;
+  for (const Variant* variant : {&brotli, &gzip}) {
+    if (!variant->content.empty() &&
+        variant->content.size() < best->content.size() &&
+        AcceptsEncoding(accept_encoding, variant->encoding)) {
+      best = variant;
+    }
+  }
+  return *best;
+}
+
+StaticAssetCache::StaticAssetCache(const std::string& root_dir)
+    : root_dir_(root_dir) {}
+
+std::shared_ptr<const StaticAssetCache::Asset> StaticAssetCache::Get(
+    const std::string& uri_path) {
+  std::string path = uri_path;
+  if (path.empty() || path.back() == '/') {
+    path += "index.html";
+  }
+  if (path[0] != '/') {
+    path = "/" + path;
+  }
+  // Don't serve anything outside the assets directory
+  for (const auto& component : android::base::Split(path, "/")) {
+    if (component == "..") {
+      LOG(WARNING) << "Refusing to serve asset outside of root: " << uri_path;
+      return nullptr;
+    }
+  }
+  auto file_path = root_dir_ + path;
+  struct stat st;
+  if (stat(file_path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+    return nullptr;
+  }
+  {
+    std::lock_guard<std::mutex> lock(assets_mutex_);
+    auto it = assets_.find(path);
+    if (it != assets_.end() && it->second->size == st.st_size &&
+        it->second->mtime == st.st_mtime) {
+      return it->second;
+    }
+  }
+  // Load outside the lock so that other assets can still be served, at worst
+  // two threads load the same file and the last one wins.
+  auto asset = Load(file_path, st);
+  if (!asset) {
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> lock(assets_mutex_);
+  assets_[path] = asset;
+  return asset;
+}
+
+std::shared_ptr<const StaticAssetCache::Asset> StaticAssetCache::Load(
+    const std::string& file_path, const struct stat& st) const {
+  auto asset = std::make_shared<Asset>();
+  if (!android::base::ReadFileToString(file_path, &asset->identity.content)) {
+    LOG(ERROR) << "Failed to read asset: " << file_path;
+    return nullptr;
+  }
+  asset->mime_type = MimeType(file_path);
+  asset->identity.etag = ETag(asset->identity.content);
+  asset->size = st.st_size;
+  asset->mtime = st.st_mtime;
+
+  // Precompressed files shipped next to the asset take precedence, brotli can
+  // only be served this way.
+  asset->brotli.encoding = "br";
+  android::base::ReadFileToString(file_path + ".br", &asset->brotli.content);
+  asset->gzip.encoding = "gzip";
+  android::base::ReadFileToString(file_path + ".gz", &asset->gzip.content);
+  if (asset->gzip.content.empty() && IsCompressible(asset->mime_type) &&
+      asset->identity.content.size() >= kMinCompressSize) {
+    asset->gzip.content = GzipCompress(asset->identity.content);
+  }
+  // The variant validators derive from the identity content, so they change
+  // whenever the asset does.
+  auto identity_hash = asset->identity.etag.substr(
+      0, asset->identity.etag.size() - 1);
+  asset->brotli.etag = identity_hash + "-br\"";
+  asset->gzip.etag = identity_hash + "-gzip\"";
+  return asset;
+}
+
+}  // namespace cuttlefish
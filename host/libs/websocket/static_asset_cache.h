@@ -0,0 +1,72 @@
+//
+// Copyright (C) 2022 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#pragma once
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace cuttlefish {
+
+// Keeps the static web assets in memory together with their compressed
+// variants, so that serving them again doesn't touch the disk or compress
+// anything. Files are revalidated against their size and modification time on
+// every lookup, so assets replaced on disk are picked up without a restart.
+class StaticAssetCache {
+ public:
+  struct Variant {
+    std::string content;
+    // Empty for the identity encoding
+    std::string encoding;
+    // Quoted, as sent in the ETag header. Different for every encoding.
+    std::string etag;
+  };
+
+  struct Asset {
+    std::string mime_type;
+    Variant identity;
+    // Only valid when their content isn't empty
+    Variant gzip;
+    Variant brotli;
+
+    // Picks the smallest variant allowed by an Accept-Encoding header value.
+    const Variant& SelectVariant(const std::string& accept_encoding) const;
+
+    off_t size;
+    time_t mtime;
+  };
+
+  StaticAssetCache(const std::string& root_dir);
+
+  // Returns the asset for an URI path, or nullptr if there is no such file
+  // under the root directory. Thread safe.
+  std::shared_ptr<const Asset> Get(const std::string& uri_path);
+
+ private:
+  std::shared_ptr<const Asset> Load(const std::string& file_path,
+                                    const struct stat& st) const;
+
+  std::string root_dir_;
+  std::mutex assets_mutex_;
+  std::unordered_map<std::string, std::shared_ptr<const Asset>> assets_;
+};
+
+}  // namespace cuttlefish
@@ -15,6 +15,8 @@
 
 #include "host/libs/websocket/websocket_handler.h"
 
+#include <utility>
+
 #include <android-base/logging.h>
 #include <libwebsockets.h>
 
@@ -36,8 +38,49 @@ void WebSocketHandler::EnqueueMessage(const uint8_t* data, size_t len,
                                       bool binary) {
   std::vector<uint8_t> buffer(LWS_PRE + len, 0);
   std::copy(data, data + len, buffer.begin() + LWS_PRE);
-  buffer_queue_.emplace_front(std::move(buffer), binary);
-  lws_callback_on_writable(wsi_);
+  std::lock_guard<std::mutex> lock(queue_mutex_);
+  if (disconnected_) {
+    return;
+  }
+  if (queued_bytes_ + len > kMaxQueuedBytes) {
+    if (!close_) {
+      LOG(ERROR) << "Websocket peer is not reading its messages, closing the "
+                 << "connection with " << buffer_queue_.size() << " queued";
+      close_ = true;
+      RequestWritable();
+    }
+    return;
+  }
+  queued_bytes_ += len;
+  buffer_queue_.emplace_back(std::move(buffer), binary);
+  RequestWritable();
+}
+
+void WebSocketHandler::RequestWritable() {
+  if (disconnected_) {
+    return;
+  }
+  if (std::this_thread::get_id() == service_thread_) {
+    lws_callback_on_writable(wsi_);
+  } else if (!wakeup_pending_.exchange(true)) {
+    // lws_callback_on_writable is only safe on the service thread, wake it up
+    // so it can call it
+    lws_cancel_service_pt(wsi_);
+  }
+}
+
+void WebSocketHandler::OnWakeup() {
+  if (wakeup_pending_.exchange(false)) {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    RequestWritable();
+  }
+}
+
+void WebSocketHandler::OnDisconnected() {
+  std::lock_guard<std::mutex> lock(queue_mutex_);
+  disconnected_ = true;
+  buffer_queue_.clear();
+  queued_bytes_ = 0;
 }
 
 // Attempts to write what's left on a websocket buffer to the websocket,
@@ -61,22 +104,36 @@ void WebSocketHandler::WriteWsBuffer(WebSocketHandler::WsBuffer& ws_buffer) {
 }
 
 bool WebSocketHandler::OnWritable() {
-  if (buffer_queue_.empty()) {
-    return close_;
+  // Bursts of messages are written in the same callback while the socket
+  // accepts them, up to a limit to be fair to the other connections.
+  constexpr int kMaxWritesPerCallback = 32;
+  for (int i = 0; i < kMaxWritesPerCallback; i++) {
+    std::unique_lock<std::mutex> lock(queue_mutex_);
+    if (buffer_queue_.empty()) {
+      // Only close if there are no more queued writes
+      return close_;
+    }
+    if (i > 0 && lws_send_pipe_choked(wsi_)) {
+      break;
+    }
+    auto ws_buffer = std::move(buffer_queue_.front());
+    buffer_queue_.pop_front();
+    queued_bytes_ -= ws_buffer.data.size() - LWS_PRE;
+    lock.unlock();
+    WriteWsBuffer(ws_buffer);
   }
-  WriteWsBuffer(buffer_queue_.back());
-  buffer_queue_.pop_back();
 
-  if (!buffer_queue_.empty()) {
+  std::lock_guard<std::mutex> lock(queue_mutex_);
+  if (!buffer_queue_.empty() || close_) {
     lws_callback_on_writable(wsi_);
   }
-  // Only close if there are no more queued writes
-  return buffer_queue_.empty() && close_;
+  return false;
 }
 
 void WebSocketHandler::Close() {
+  std::lock_guard<std::mutex> lock(queue_mutex_);
   close_ = true;
-  lws_callback_on_writable(wsi_);
+  RequestWritable();
 }
 
 DynHandler::DynHandler(struct lws* wsi) : wsi_(wsi), out_buffer_(LWS_PRE, 0) {}
@@ -103,4 +160,27 @@ int DynHandler::OnWritable() {
   return lws_http_transaction_completed(wsi_);
 }
 size_t DynHandler::content_len() const { return out_buffer_.size() - LWS_PRE; }
+
+std::string DynHandler::GetUrlArg(const std::string& name) const {
+  char buffer[256] = {};
+  auto arg = name + "=";
+  // Points past the name in the buffer
+  const char* value =
+      lws_get_urlarg_by_name(wsi_, arg.c_str(), buffer, sizeof(buffer));
+  return value ? value : "";
+}
+
+std::string DynHandler::GetIfNoneMatch() const {
+  auto len = lws_hdr_total_length(wsi_, WSI_TOKEN_HTTP_IF_NONE_MATCH);
+  if (len <= 0) {
+    return "";
+  }
+  std::string value(len + 1, '\0');
+  if (lws_hdr_copy(wsi_, value.data(), value.size(),
+                   WSI_TOKEN_HTTP_IF_NONE_MATCH) < 0) {
+    return "";
+  }
+  value.resize(len);
+  return value;
+}
 }  // namespace cuttlefish
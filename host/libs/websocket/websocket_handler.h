@@ -15,14 +15,22 @@
 
 #pragma once
 
+#include <atomic>
 #include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
 struct lws;
 
 namespace cuttlefish {
 
+class WebSocketServer;
+
 class WebSocketHandler {
  public:
   WebSocketHandler(struct lws* wsi);
@@ -36,6 +44,9 @@ class WebSocketHandler {
   virtual void OnConnected() = 0;
   virtual void OnClosed() = 0;
 
+  // Messages can be enqueued and the connection closed from any thread, the
+  // writes always happen on the connection's service thread. A connection
+  // that doesn't keep up with its queue is closed.
   void EnqueueMessage(const uint8_t* data, size_t len, bool binary = false);
   void EnqueueMessage(const char* data, size_t len, bool binary = false) {
     EnqueueMessage(reinterpret_cast<const uint8_t*>(data), len, binary);
@@ -43,7 +54,16 @@ class WebSocketHandler {
   void Close();
   bool OnWritable();
 
+  static constexpr size_t kMaxQueuedBytes = 8 * 1024 * 1024;
+
  private:
+  friend WebSocketServer;
+  // Called by the server on the service thread.
+  void OnWakeup();
+  void OnDisconnected();
+  // Must be called with queue_mutex_ held.
+  void RequestWritable();
+
   struct WsBuffer {
     WsBuffer(std::vector<uint8_t> data, bool binary)
         : data(std::move(data)), binary(binary) {}
@@ -54,8 +74,15 @@ class WebSocketHandler {
   void WriteWsBuffer(WsBuffer& ws_buffer);
 
   struct lws* wsi_;
+  // The thread servicing the connection, which creates its handler
+  const std::thread::id service_thread_ = std::this_thread::get_id();
+  std::mutex queue_mutex_;
   bool close_ = false;
+  bool disconnected_ = false;
+  size_t queued_bytes_ = 0;
   std::deque<WsBuffer> buffer_queue_;
+  // Write requests from other threads are coalesced into a single wakeup
+  std::atomic<bool> wakeup_pending_ = false;
 };
 
 class WebSocketHandlerFactory {
@@ -64,12 +91,11 @@ class WebSocketHandlerFactory {
   virtual std::shared_ptr<WebSocketHandler> Build(struct lws* wsi) = 0;
 };
 
-class WebSocketServer;
-
 enum class HttpStatusCode : int {
   // From https://developer.mozilla.org/en-US/docs/Web/HTTP/Status
   Ok = 200,
   NoContent = 204,
+  NotModified = 304,
   BadRequest = 400,
   Unauthorized = 401,
   NotFound = 404,
@@ -82,8 +108,6 @@ class DynHandler {
   DynHandler(struct lws* wsi);
 
   virtual ~DynHandler() = default;
-  // TODO (jemoreira): Allow more than just JSON replies
-  // TODO (jemoreira): Receive request parameters
   // Handle a GET request.
   virtual HttpStatusCode DoGet() = 0;
   // Handle a POST request.
@@ -92,6 +116,18 @@ class DynHandler {
  protected:
   void AppendDataOut(const std::string& data);
   const std::string& GetDataIn() const { return in_buffer_; }
+  // The value of a query string argument, empty if it's missing.
+  std::string GetUrlArg(const std::string& name) const;
+  // The If-None-Match header of the request, empty if it's missing.
+  std::string GetIfNoneMatch() const;
+  // Replies are JSON unless told otherwise.
+  void SetContentType(const std::string& content_type) {
+    content_type_ = content_type;
+  }
+  // The name includes the colon, e.g. "ETag:".
+  void AddResponseHeader(const std::string& name, const std::string& value) {
+    response_headers_.emplace_back(name, value);
+  }
 
  private:
   friend WebSocketServer;
@@ -102,6 +138,8 @@ class DynHandler {
   struct lws* wsi_;
   std::string in_buffer_ = {};
   std::string out_buffer_ = {};
+  std::string content_type_ = "application/json";
+  std::vector<std::pair<std::string, std::string>> response_headers_;
 };
 
 using DynHandlerFactory =
@@ -17,7 +17,9 @@
 #include <host/libs/websocket/websocket_server.h>
 
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include <android-base/logging.h>
 #include <libwebsockets.h>
@@ -52,9 +54,40 @@ const std::vector<std::pair<std::string, std::string>> kCORSHeaders = {
      "Content-Type, Access-Control-Allow-Headers, Authorization, "
      "X-Requested-With, Accept"}};
 
-bool AddCORSHeaders(struct lws* wsi, unsigned char** buffer_ptr,
-                    unsigned char* buffer_end) {
-  for (const auto& header : kCORSHeaders) {
+// HTML pages are revalidated on every load, the scripts and styles they
+// reference may be reused for a few minutes without asking.
+constexpr char kHtmlCacheControl[] = "no-cache";
+constexpr char kAssetCacheControl[] = "max-age=300";
+
+std::string GetHeader(struct lws* wsi, enum lws_token_indexes token) {
+  auto len = lws_hdr_total_length(wsi, token);
+  if (len <= 0) {
+    return "";
+  }
+  std::string value(len + 1, '\0');
+  if (lws_hdr_copy(wsi, value.data(), value.size(), token) < 0) {
+    return "";
+  }
+  value.resize(len);
+  return value;
+}
+
+// Holds the body of a static asset response until the connection is writable
+class StaticAssetHandler : public DynHandler {
+ public:
+  StaticAssetHandler(struct lws* wsi, const std::string& body)
+      : DynHandler(wsi) {
+    AppendDataOut(body);
+  }
+
+  HttpStatusCode DoGet() override { return HttpStatusCode::Ok; }
+  HttpStatusCode DoPost() override { return HttpStatusCode::MethodNotAllowed; }
+};
+
+bool AddHeaders(struct lws* wsi,
+                const std::vector<std::pair<std::string, std::string>>& headers,
+                unsigned char** buffer_ptr, unsigned char* buffer_end) {
+  for (const auto& header : headers) {
     const auto& name = header.first;
     const auto& value = header.second;
     if (lws_add_http_header_by_name(
@@ -67,8 +100,10 @@ bool AddCORSHeaders(struct lws* wsi, unsigned char** buffer_ptr,
   return true;
 }
 
-bool WriteCommonHttpHeaders(int status, const char* mime_type,
-                            size_t content_len, struct lws* wsi) {
+bool WriteCommonHttpHeaders(
+    int status, const char* mime_type, size_t content_len, struct lws* wsi,
+    const std::vector<std::pair<std::string, std::string>>& extra_headers =
+        {}) {
   constexpr size_t BUFF_SIZE = 2048;
   uint8_t header_buffer[LWS_PRE + BUFF_SIZE];
   const auto start = &header_buffer[LWS_PRE];
@@ -79,10 +114,14 @@ bool WriteCommonHttpHeaders(int status, const char* mime_type,
     LOG(ERROR) << "Failed to write headers for response";
     return false;
   }
-  if (!AddCORSHeaders(wsi, &p, end)) {
+  if (!AddHeaders(wsi, kCORSHeaders, &p, end)) {
     LOG(ERROR) << "Failed to write CORS headers for response";
     return false;
   }
+  if (!AddHeaders(wsi, extra_headers, &p, end)) {
+    LOG(ERROR) << "Failed to write extra headers for response";
+    return false;
+  }
   if (lws_finalize_write_http_header(wsi, start, &p, end)) {
     LOG(ERROR) << "Failed to finalize headers for response";
     return false;
@@ -90,6 +129,24 @@ bool WriteCommonHttpHeaders(int status, const char* mime_type,
   return true;
 }
 
+#if !defined(LWS_WITHOUT_EXTENSIONS)
+// Negotiated with the clients that offer it, which browsers do. Signaling
+// messages are repetitive JSON and compress several times over.
+const struct lws_extension kExtensions[] = {
+    {
+        .name = "permessage-deflate",
+        .callback = lws_extension_callback_pm_deflate,
+        .client_offer = "permessage-deflate; client_no_context_takeover; "
+                        "client_max_window_bits",
+    },
+    {
+        .name = nullptr,
+        .callback = nullptr,
+        .client_offer = nullptr,
+    },
+};
+#endif
+
 }  // namespace
 WebSocketServer::WebSocketServer(const char* protocol_name,
                                  const std::string& assets_dir, int server_port)
@@ -100,6 +157,7 @@ WebSocketServer::WebSocketServer(const char* protocol_name,
                                  const std::string& assets_dir, int server_port)
     : protocol_name_(protocol_name),
       assets_dir_(assets_dir),
+      asset_cache_(assets_dir),
       certs_dir_(certs_dir),
       server_port_(server_port) {}
 
@@ -173,12 +231,14 @@ void WebSocketServer::InitializeLwsObjects() {
     next_mount = &mount;
   }
 
+  // Static assets are served from memory by the dynamic handler protocol too,
+  // see ServeStaticAsset.
   static_mount_ = {
       .mount_next = next_mount,
       .mountpoint = "/",
       .mountpoint_len = 1,
-      .origin = assets_dir_.c_str(),
-      .def = "index.html",
+      .origin = "__http_polling__",
+      .def = nullptr,
       .protocol = nullptr,
       .cgienv = nullptr,
       .extra_mimetypes = nullptr,
@@ -189,7 +249,7 @@ void WebSocketServer::InitializeLwsObjects() {
       .cache_reusable = 0,
       .cache_revalidate = 0,
       .cache_intermediaries = 0,
-      .origin_protocol = LWSMPRO_FILE,  // files in a dir
+      .origin_protocol = LWSMPRO_CALLBACK,
       .basic_auth_login_file = nullptr,
   };
 
@@ -203,9 +263,13 @@ void WebSocketServer::InitializeLwsObjects() {
   info.port = server_port_;
   info.mounts = &static_mount_;
   info.protocols = protocols;
+#if !defined(LWS_WITHOUT_EXTENSIONS)
+  info.extensions = kExtensions;
+#endif
   info.vhost_name = "localhost";
   info.headers = &headers_;
   info.retry_and_idle_policy = &retry_;
+  info.count_threads = service_threads_;
 
   if (!certs_dir_.empty()) {
     info.options |= LWS_SERVER_OPTION_DO_SSL_GLOBAL_INIT;
@@ -220,6 +284,14 @@ void WebSocketServer::InitializeLwsObjects() {
   if (!context_) {
     LOG(FATAL) << "Failed to create websocket context";
   }
+  // libwebsockets caps the number of threads to what it was built for
+  auto count_threads = lws_get_count_threads(context_);
+  if (count_threads < service_threads_) {
+    LOG(WARNING) << "Using " << count_threads << " service threads instead of "
+                 << service_threads_;
+  }
+  handlers_.resize(count_threads);
+  dyn_handlers_.resize(count_threads);
 }
 
 void WebSocketServer::RegisterHandlerFactory(
@@ -234,11 +306,26 @@ void WebSocketServer::RegisterDynHandlerFactory(
   dyn_handler_factories_[path] = std::move(handler_factory);
 }
 
+void WebSocketServer::SetServiceThreads(int count) {
+  CHECK(count > 0) << "At least one service thread is needed";
+  service_threads_ = count;
+}
+
 void WebSocketServer::Serve() {
   InitializeLwsObjects();
-  int n = 0;
-  while (n >= 0) {
-    n = lws_service(context_, 0);
+  auto service_loop = [this](int tsi) {
+    int n = 0;
+    while (n >= 0) {
+      n = lws_service_tsi(context_, 0, tsi);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int tsi = 1; tsi < static_cast<int>(handlers_.size()); tsi++) {
+    threads.emplace_back(service_loop, tsi);
+  }
+  service_loop(0);
+  for (auto& thread : threads) {
+    thread.join();
   }
   lws_context_destroy(context_);
 }
@@ -271,6 +358,7 @@ int WebSocketServer::DynHttpCallback(struct lws* wsi,
 int WebSocketServer::DynServerCallback(struct lws* wsi,
                                        enum lws_callback_reasons reason,
                                        void* user, void* in, size_t len) {
+  auto& dyn_handlers = dyn_handlers_[lws_get_tsi(wsi)];
   switch (reason) {
     case LWS_CALLBACK_HTTP: {
       char* path_raw;
@@ -280,6 +368,10 @@ int WebSocketServer::DynServerCallback(struct lws* wsi,
         return 1;
       }
       std::string path(path_raw, path_len);
+      if (method == LWSHUMETH_GET &&
+          dyn_handler_factories_.count(path) == 0) {
+        return ServeStaticAsset(path, wsi);
+      }
       auto handler = InstantiateDynHandler(path, wsi);
       if (!handler) {
         if (!WriteCommonHttpHeaders(static_cast<int>(HttpStatusCode::NotFound),
@@ -288,13 +380,15 @@ int WebSocketServer::DynServerCallback(struct lws* wsi,
         }
         return lws_http_transaction_completed(wsi);
       }
-      dyn_handlers_[wsi] = std::move(handler);
+      dyn_handlers[wsi] = std::move(handler);
       switch (method) {
         case LWSHUMETH_GET: {
-          auto status = dyn_handlers_[wsi]->DoGet();
+          auto dyn_handler = dyn_handlers[wsi].get();
+          auto status = dyn_handler->DoGet();
           if (!WriteCommonHttpHeaders(static_cast<int>(status),
-                                      "application/json",
-                                      dyn_handlers_[wsi]->content_len(), wsi)) {
+                                      dyn_handler->content_type_.c_str(),
+                                      dyn_handler->content_len(), wsi,
+                                      dyn_handler->response_headers_)) {
             return 1;
           }
           // Write the response later, when the server is ready
@@ -320,7 +414,7 @@ int WebSocketServer::DynServerCallback(struct lws* wsi,
       break;
     }
     case LWS_CALLBACK_HTTP_BODY: {
-      auto handler = dyn_handlers_[wsi].get();
+      auto handler = dyn_handlers[wsi].get();
       if (!handler) {
         LOG(WARNING) << "Received body for unknown wsi";
         return 1;
@@ -329,27 +423,29 @@ int WebSocketServer::DynServerCallback(struct lws* wsi,
       break;
     }
     case LWS_CALLBACK_HTTP_BODY_COMPLETION: {
-      auto handler = dyn_handlers_[wsi].get();
+      auto handler = dyn_handlers[wsi].get();
       if (!handler) {
         LOG(WARNING) << "Unexpected body completion event from unknown wsi";
         return 1;
       }
       auto status = handler->DoPost();
-      if (!WriteCommonHttpHeaders(static_cast<int>(status), "application/json",
-                                  dyn_handlers_[wsi]->content_len(), wsi)) {
+      if (!WriteCommonHttpHeaders(static_cast<int>(status),
+                                  handler->content_type_.c_str(),
+                                  handler->content_len(), wsi,
+                                  handler->response_headers_)) {
         return 1;
       }
       lws_callback_on_writable(wsi);
       break;
     }
     case LWS_CALLBACK_HTTP_WRITEABLE: {
-      auto handler = dyn_handlers_[wsi].get();
+      auto handler = dyn_handlers[wsi].get();
       if (!handler) {
         LOG(WARNING) << "Unknown wsi became writable";
         return 1;
       }
       auto ret = handler->OnWritable();
-      dyn_handlers_.erase(wsi);
+      dyn_handlers.erase(wsi);
       // Make sure the connection (in HTTP 1) or stream (in HTTP 2) is closed
       // after the response is written
       return ret;
@@ -365,7 +461,15 @@ int WebSocketServer::DynServerCallback(struct lws* wsi,
 int WebSocketServer::ServerCallback(struct lws* wsi,
                                     enum lws_callback_reasons reason,
                                     void* user, void* in, size_t len) {
+  auto& handlers = handlers_[lws_get_tsi(wsi)];
   switch (reason) {
+    case LWS_CALLBACK_EVENT_WAIT_CANCELLED: {
+      // Other threads enqueued messages for connections of this thread
+      for (auto& [_, handler] : handlers) {
+        handler->OnWakeup();
+      }
+      break;
+    }
     case LWS_CALLBACK_ESTABLISHED: {
       auto path = GetPath(wsi);
       auto handler = InstantiateHandler(path, wsi);
@@ -374,20 +478,21 @@ int WebSocketServer::ServerCallback(struct lws* wsi,
         lws_close_reason(wsi, LWS_CLOSE_STATUS_NOSTATUS, (uint8_t*)"404", 3);
         return -1;
       }
-      handlers_[wsi] = handler;
+      handlers[wsi] = handler;
       handler->OnConnected();
       break;
     }
     case LWS_CALLBACK_CLOSED: {
-      auto handler = handlers_[wsi];
+      auto handler = handlers[wsi];
       if (handler) {
+        handler->OnDisconnected();
         handler->OnClosed();
-        handlers_.erase(wsi);
+        handlers.erase(wsi);
       }
       break;
     }
     case LWS_CALLBACK_SERVER_WRITEABLE: {
-      auto handler = handlers_[wsi];
+      auto handler = handlers[wsi];
       if (handler) {
         auto should_close = handler->OnWritable();
         if (should_close) {
@@ -401,7 +506,7 @@ int WebSocketServer::ServerCallback(struct lws* wsi,
       break;
     }
     case LWS_CALLBACK_RECEIVE: {
-      auto handler = handlers_[wsi];
+      auto handler = handlers[wsi];
       if (handler) {
         bool is_final = (lws_remaining_packet_payload(wsi) == 0) &&
                         lws_is_final_fragment(wsi);
@@ -442,4 +547,47 @@ std::unique_ptr<DynHandler> WebSocketServer::InstantiateDynHandler(
   }
 }
 
+int WebSocketServer::ServeStaticAsset(const std::string& uri_path,
+                                      struct lws* wsi) {
+  auto asset = asset_cache_.Get(uri_path);
+  if (!asset) {
+    if (!WriteCommonHttpHeaders(static_cast<int>(HttpStatusCode::NotFound),
+                                "text/plain", 0, wsi)) {
+      return 1;
+    }
+    return lws_http_transaction_completed(wsi);
+  }
+  const auto& variant = asset->SelectVariant(
+      GetHeader(wsi, WSI_TOKEN_HTTP_ACCEPT_ENCODING));
+  std::vector<std::pair<std::string, std::string>> headers = {
+      {"ETag:", variant.etag},
+      {"Cache-Control:", asset->mime_type == "text/html" ? kHtmlCacheControl
+                                                         : kAssetCacheControl},
+      {"Vary:", "Accept-Encoding"},
+  };
+  if (!variant.encoding.empty()) {
+    headers.emplace_back("Content-Encoding:", variant.encoding);
+  }
+  auto if_none_match = GetHeader(wsi, WSI_TOKEN_HTTP_IF_NONE_MATCH);
+  if (!if_none_match.empty() &&
+      (if_none_match == "*" ||
+       if_none_match.find(variant.etag) != std::string::npos)) {
+    if (!WriteCommonHttpHeaders(static_cast<int>(HttpStatusCode::NotModified),
+                                asset->mime_type.c_str(), 0, wsi, headers)) {
+      return 1;
+    }
+    return lws_http_transaction_completed(wsi);
+  }
+  if (!WriteCommonHttpHeaders(static_cast<int>(HttpStatusCode::Ok),
+                              asset->mime_type.c_str(),
+                              variant.content.size(), wsi, headers)) {
+    return 1;
+  }
+  dyn_handlers_[lws_get_tsi(wsi)][wsi] =
+      std::make_unique<StaticAssetHandler>(wsi, variant.content);
+  // Write the response later, when the server is ready
+  lws_callback_on_writable(wsi);
+  return 0;
+}
+
 }  // namespace cuttlefish
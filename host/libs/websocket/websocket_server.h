@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -23,6 +24,7 @@
 #include <android-base/logging.h>
 #include <libwebsockets.h>
 
+#include <host/libs/websocket/static_asset_cache.h>
 #include <host/libs/websocket/websocket_handler.h>
 
 namespace cuttlefish {
@@ -47,6 +49,12 @@ class WebSocketServer {
   void RegisterDynHandlerFactory(const std::string& path,
                                  DynHandlerFactory handler_factory);
 
+  // Connections are spread over this many service threads, each one always
+  // handled by the same thread. Handlers may then run concurrently, so they
+  // must synchronize any state they share. Only effective when libwebsockets
+  // was built with LWS_MAX_SMP > 1.
+  void SetServiceThreads(int count);
+
   void Serve();
 
  private:
@@ -66,21 +74,28 @@ class WebSocketServer {
       const std::string& uri_path, struct lws* wsi);
   std::unique_ptr<DynHandler> InstantiateDynHandler(
       const std::string& uri_path, struct lws* wsi);
+  // Answers a GET request from the asset cache, with a 304 response when the
+  // client already has the current version.
+  int ServeStaticAsset(const std::string& uri_path, struct lws* wsi);
 
   void InitializeLwsObjects();
 
-  std::unordered_map<struct lws*, std::shared_ptr<WebSocketHandler>> handlers_ =
-      {};
+  // Indexed by service thread, which only touches its own connections
+  std::vector<
+      std::unordered_map<struct lws*, std::shared_ptr<WebSocketHandler>>>
+      handlers_ = {};
   std::unordered_map<std::string, std::unique_ptr<WebSocketHandlerFactory>>
       handler_factories_ = {};
-  std::unordered_map<struct lws*, std::unique_ptr<DynHandler>> dyn_handlers_ =
-      {};
+  std::vector<std::unordered_map<struct lws*, std::unique_ptr<DynHandler>>>
+      dyn_handlers_ = {};
   std::unordered_map<std::string, DynHandlerFactory> dyn_handler_factories_ =
       {};
   std::string protocol_name_;
   std::string assets_dir_;
+  StaticAssetCache asset_cache_;
   std::string certs_dir_;
   int server_port_;
+  int service_threads_ = 1;
   struct lws_context* context_;
   struct lws_http_mount static_mount_;
   std::vector<struct lws_http_mount> dyn_mounts_ = {};
@@ -38,16 +38,24 @@ namespace cuttlefish {
 std::string WmediumdMessage::Serialize(void) const {
   std::string result;
 
-  AppendBinaryRepresentation(result, this->Type());
+  SerializeTo(result);
 
-  std::string body;
-  this->SerializeBody(body);
+  return result;
+}
 
-  AppendBinaryRepresentation(result, static_cast<uint32_t>(body.size()));
+void WmediumdMessage::SerializeTo(std::string& out) const {
+  AppendBinaryRepresentation(out, this->Type());
 
-  std::copy(std::begin(body), std::end(body), std::back_inserter(result));
+  auto size_pos = out.size();
+  AppendBinaryRepresentation(out, static_cast<uint32_t>(0));
 
-  return result;
+  auto body_pos = out.size();
+  this->SerializeBody(out);
+
+  auto body_size = static_cast<uint32_t>(out.size() - body_pos);
+  std::copy(reinterpret_cast<const char*>(&body_size),
+            reinterpret_cast<const char*>(&body_size) + sizeof(body_size),
+            out.begin() + size_pos);
 }
 
 void WmediumdMessageSetControl::SerializeBody(std::string& buf) const {
@@ -49,6 +49,9 @@ class WmediumdMessage {
   virtual ~WmediumdMessage() {}
 
   std::string Serialize(void) const;
+  // Appends the serialized message, so pipelined requests can be written to
+  // the socket at once without intermediate copies.
+  void SerializeTo(std::string& out) const;
 
   virtual WmediumdMessageType Type() const = 0;
 
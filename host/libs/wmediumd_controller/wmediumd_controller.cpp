@@ -18,16 +18,26 @@
 #include <android-base/logging.h>
 #include <sys/socket.h>
 
+#include <algorithm>
 #include <cstdint>
 #include <memory>
 #include <optional>
 #include <string>
+#include <vector>
 
 #include "common/libs/fs/shared_buf.h"
 
 #include "host/libs/wmediumd_controller/wmediumd_api_protocol.h"
 
 namespace cuttlefish {
+namespace {
+
+// Requests written before reading their replies. wmediumd answers in order,
+// the limit keeps its replies from filling the socket buffer while it is
+// still being written to.
+constexpr size_t kMaxPipelinedMessages = 256;
+
+}  // namespace
 
 std::unique_ptr<WmediumdController> WmediumdController::New(
     const std::string& serverSocketPath) {
@@ -58,6 +68,11 @@ bool WmediumdController::SetSnr(const std::string& node1,
   return SendMessage(WmediumdMessageSetSnr(node1, node2, snr));
 }
 
+bool WmediumdController::SetSnrs(
+    const std::vector<WmediumdMessageSetSnr>& updates) {
+  return SendMessages(updates);
+}
+
 bool WmediumdController::SetControl(const uint32_t flags) {
   return SendMessage(WmediumdMessageSetControl(flags));
 }
@@ -103,6 +118,41 @@ bool WmediumdController::SendMessage(const WmediumdMessage& message) {
   return true;
 }
 
+template <typename T>
+bool WmediumdController::SendMessages(const std::vector<T>& messages) {
+  bool success = true;
+
+  for (size_t begin = 0; begin < messages.size();
+       begin += kMaxPipelinedMessages) {
+    auto end = std::min(messages.size(), begin + kMaxPipelinedMessages);
+
+    std::string requests;
+    for (auto i = begin; i < end; ++i) {
+      messages[i].SerializeTo(requests);
+    }
+
+    if (!SendAll(wmediumd_socket_, requests)) {
+      LOG(ERROR) << "sendmessage failed: " << wmediumd_socket_->StrError();
+      return false;
+    }
+
+    // every reply has to be read to keep the stream in sync
+    for (auto i = begin; i < end; ++i) {
+      auto reply = RecvReply();
+
+      if (!reply) {
+        return false;
+      }
+
+      if (reply->Type() != WmediumdMessageType::kAck) {
+        success = false;
+      }
+    }
+  }
+
+  return success;
+}
+
 std::optional<WmediumdMessageReply> WmediumdController::SendMessageWithReply(
     const WmediumdMessage& message) {
   auto sendResult = SendAll(wmediumd_socket_, message.Serialize());
@@ -112,6 +162,10 @@ std::optional<WmediumdMessageReply> WmediumdController::SendMessageWithReply(
     return std::nullopt;
   }
 
+  return RecvReply();
+}
+
+std::optional<WmediumdMessageReply> WmediumdController::RecvReply() {
   std::string recvHeader = RecvAll(wmediumd_socket_, sizeof(uint32_t) * 2);
 
   if (recvHeader.size() != sizeof(uint32_t) * 2) {
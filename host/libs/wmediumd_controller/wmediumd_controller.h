@@ -18,6 +18,7 @@
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "common/libs/fs/shared_fd.h"
 #include "host/libs/wmediumd_controller/wmediumd_api_protocol.h"
@@ -39,6 +40,10 @@ class WmediumdController {
 
   bool SetControl(const uint32_t flags);
   bool SetSnr(const std::string& node1, const std::string& node2, uint8_t snr);
+  // Applies all the updates, pipelining the requests so the whole matrix
+  // costs a few round trips rather than one per pair. Returns false if any
+  // update was rejected, the others are still applied.
+  bool SetSnrs(const std::vector<WmediumdMessageSetSnr>& updates);
   bool ReloadCurrentConfig(void);
   bool ReloadConfig(const std::string& configPath);
   bool StartPcap(const std::string& pcapPath);
@@ -50,8 +55,11 @@ class WmediumdController {
 
   bool Connect(const std::string& serverSocketPath);
   bool SendMessage(const WmediumdMessage& message);
+  template <typename T>
+  bool SendMessages(const std::vector<T>& messages);
   std::optional<WmediumdMessageReply> SendMessageWithReply(
       const WmediumdMessage& message);
+  std::optional<WmediumdMessageReply> RecvReply();
 
   SharedFD wmediumd_socket_;
 };
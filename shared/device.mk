@@ -122,6 +122,7 @@ PRODUCT_VENDOR_PROPERTIES += \
     ro.hardware.keystore_desede=true \
     ro.rebootescrow.device=/dev/block/pmem0 \
     ro.vendor.hwcomposer.pmem=/dev/block/pmem1 \
+    ro.vendor.camera.pmem=/dev/block/pmem2 \
     ro.incremental.enable=1 \
     debug.c2.use_dmabufheaps=1 \
     ro.camerax.extensions.enabled=true \